@@ -170,6 +170,30 @@ public class Collectd
   native public static int registerWrite (String name,
       CollectdWriteInterface object);
 
+  /**
+   * Java representation of collectd/src/plugin.h:plugin_register_write_batch
+   *
+   * @param batchSize The largest number of value lists passed at once.
+   * @param batchTimeout The longest time, in milliseconds, a value list waits
+   *   for the batch to fill up, the global interval if zero.
+   * @return Zero when successful, non-zero otherwise.
+   * @see CollectdWriteBatchInterface
+   */
+  native public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object, int batchSize, long batchTimeout);
+
+  /**
+   * Registers a batch write callback receiving up to 100 value lists at once.
+   *
+   * @return Zero when successful, non-zero otherwise.
+   * @see #registerWriteBatch(String, CollectdWriteBatchInterface, int, long)
+   */
+  public static int registerWriteBatch (String name,
+      CollectdWriteBatchInterface object)
+  {
+    return (registerWriteBatch (name, object, 100, 0));
+  } /* int registerWriteBatch */
+
   /**
    * Java representation of collectd/src/plugin.h:plugin_register_flush
    *
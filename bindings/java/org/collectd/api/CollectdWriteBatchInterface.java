@@ -0,0 +1,33 @@
+/*
+ * collectd/java - org/collectd/api/CollectdWriteBatchInterface.java
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ */
+
+package org.collectd.api;
+
+/**
+ * Interface for objects implementing a write method which receives several
+ * value lists at once.
+ *
+ * The value lists of one type share their {@link DataSet} object, which must
+ * not be modified.
+ *
+ * @see Collectd#registerWriteBatch
+ */
+public interface CollectdWriteBatchInterface
+{
+	public int write (ValueList[] vl);
+}
@@ -25,6 +25,9 @@ import java.util.List;
 import java.util.ArrayList;
 import java.util.Map;
 import java.util.TreeMap;
+import java.util.concurrent.Callable;
+import java.util.concurrent.ExecutorService;
+import java.util.concurrent.Executors;
 
 import org.collectd.api.Collectd;
 import org.collectd.api.CollectdConfigInterface;
@@ -41,7 +44,11 @@ public class GenericJMX implements CollectdConfigInterface,
   static private Map<String,GenericJMXConfMBean> _mbeans
     = new TreeMap<String,GenericJMXConfMBean> ();
 
+  /* At most this many connections are polled in parallel. */
+  static private final int MAX_THREADS = 16;
+
   private List<GenericJMXConfConnection> _connections = null;
+  private ExecutorService _executor = null;
 
   public GenericJMX ()
   {
@@ -102,19 +109,59 @@ public class GenericJMX implements CollectdConfigInterface,
     return (0);
   } /* }}} int config */
 
-  public int read () /* {{{ */
+  static private class QueryTask implements Callable<Object> /* {{{ */
   {
-    for (int i = 0; i < this._connections.size (); i++)
+    private GenericJMXConfConnection _conn;
+
+    public QueryTask (GenericJMXConfConnection conn)
+    {
+      this._conn = conn;
+    }
+
+    public Object call ()
     {
       try
       {
-        this._connections.get (i).query ();
+        this._conn.query ();
       }
       catch (Exception e)
       {
         Collectd.logError ("GenericJMX: Caught unexpected exception: " + e);
         e.printStackTrace ();
       }
+      return (null);
+    }
+  } /* }}} class QueryTask */
+
+  public int read () /* {{{ */
+  {
+    List<QueryTask> tasks;
+
+    /* With a single connection, there's nothing to parallelize. */
+    if (this._connections.size () < 2)
+    {
+      for (int i = 0; i < this._connections.size (); i++)
+        new QueryTask (this._connections.get (i)).call ();
+      return (0);
+    }
+
+    if (this._executor == null)
+      this._executor = Executors.newFixedThreadPool (
+          Math.min (this._connections.size (), MAX_THREADS));
+
+    tasks = new ArrayList<QueryTask> ();
+    for (int i = 0; i < this._connections.size (); i++)
+      tasks.add (new QueryTask (this._connections.get (i)));
+
+    /* Waits until all connections have been read. */
+    try
+    {
+      this._executor.invokeAll (tasks);
+    }
+    catch (InterruptedException e)
+    {
+      Collectd.logError ("GenericJMX: Interrupted while waiting for the "
+          + "connections to be read.");
     }
 
     return (0);
@@ -123,6 +170,11 @@ public class GenericJMX implements CollectdConfigInterface,
   public int shutdown () /* {{{ */
   {
     System.out.print ("org.collectd.java.GenericJMX.Shutdown ();\n");
+    if (this._executor != null)
+    {
+      this._executor.shutdownNow ();
+      this._executor = null;
+    }
     this._connections = null;
     return (0);
   } /* }}} int shutdown */
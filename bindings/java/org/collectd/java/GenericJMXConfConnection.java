@@ -23,6 +23,7 @@ package org.collectd.java;
 
 import java.util.List;
 import java.util.Map;
+import java.util.Set;
 import java.util.Iterator;
 import java.util.ArrayList;
 import java.util.HashMap;
@@ -49,6 +50,11 @@ class GenericJMXConfConnection
   private String _service_url = null;
   private MBeanServerConnection _jmx_connection = null;
   private List<GenericJMXConfMBean> _mbeans = null;
+  /* Names returned by `queryNames', by MBean block. Refreshed every
+   * `_refresh_interval' milliseconds. */
+  private Map<String,Set<ObjectName>> _names = null;
+  private long _names_time = 0;
+  private long _refresh_interval = 300000;
 
   /*
    * private methods
@@ -77,6 +83,30 @@ class GenericJMXConfConnection
     return (v.getString ());
   } /* }}} String getConfigString */
 
+  private Number getConfigNumber (OConfigItem ci) /* {{{ */
+  {
+    List<OConfigValue> values;
+    OConfigValue v;
+
+    values = ci.getValues ();
+    if (values.size () != 1)
+    {
+      Collectd.logError ("GenericJMXConfConnection: The " + ci.getKey ()
+          + " configuration option needs exactly one numeric argument.");
+      return (null);
+    }
+
+    v = values.get (0);
+    if (v.getType () != OConfigValue.OCONFIG_TYPE_NUMBER)
+    {
+      Collectd.logError ("GenericJMXConfConnection: The " + ci.getKey ()
+          + " configuration option needs exactly one numeric argument.");
+      return (null);
+    }
+
+    return (v.getNumber ());
+  } /* }}} Number getConfigNumber */
+
 private void connect () /* {{{ */
 {
   JMXServiceURL service_url;
@@ -120,6 +150,7 @@ private void connect () /* {{{ */
  * <Connection>
  *   Host "tomcat0.mycompany"
  *   ServiceURL "service:jmx:rmi:///jndi/rmi://localhost:17264/jmxrmi"
+ *   MBeanRefreshInterval 300
  *   Collect "java.lang:type=GarbageCollector,name=Copy"
  *   Collect "java.lang:type=Memory"
  * </Connection>
@@ -169,6 +200,12 @@ private void connect () /* {{{ */
         if (tmp != null)
           this._instance_prefix = tmp;
       }
+      else if (child.getKey ().equalsIgnoreCase ("MBeanRefreshInterval"))
+      {
+        Number tmp = getConfigNumber (child);
+        if ((tmp != null) && (tmp.doubleValue () >= 0.0))
+          this._refresh_interval = (long) (tmp.doubleValue () * 1000.0);
+      }
       else if (child.getKey ().equalsIgnoreCase ("Collect"))
       {
         String tmp = getConfigString (child);
@@ -200,6 +237,7 @@ private void connect () /* {{{ */
   public void query () /* {{{ */
   {
     PluginData pd;
+    long now;
 
     connect ();
 
@@ -214,17 +252,48 @@ private void connect () /* {{{ */
     pd.setHost ((this._host != null) ? this._host : "localhost");
     pd.setPlugin ("GenericJMX");
 
+    /* The names of the MBeans are looked up again once the refresh interval
+     * has passed, so that MBeans registered later on are picked up. */
+    now = System.currentTimeMillis ();
+    if ((this._names == null)
+        || ((now - this._names_time) >= this._refresh_interval))
+    {
+      this._names = new HashMap<String,Set<ObjectName>> ();
+      this._names_time = now;
+    }
+
     for (int i = 0; i < this._mbeans.size (); i++)
     {
+      GenericJMXConfMBean mbean = this._mbeans.get (i);
+      Set<ObjectName> names;
       int status;
 
-      status = this._mbeans.get (i).query (this._jmx_connection, pd,
-          this._instance_prefix);
-      if (status != 0)
+      names = this._names.get (mbean.getName ());
+      if (names == null)
+      {
+        names = mbean.queryNames (this._jmx_connection);
+        if (names == null)
+        {
+          this._jmx_connection = null;
+          this._names = null;
+          return;
+        }
+        this._names.put (mbean.getName (), names);
+      }
+
+      status = mbean.query (this._jmx_connection, pd,
+          this._instance_prefix, names);
+      if (status < 0)
       {
         this._jmx_connection = null;
+        this._names = null;
         return;
       }
+      else if (status > 0)
+      {
+        /* An MBean has been unregistered. */
+        this._names.remove (mbean.getName ());
+      }
     } /* for */
   } /* }}} void query */
 
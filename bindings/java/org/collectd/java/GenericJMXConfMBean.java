@@ -23,9 +23,17 @@ package org.collectd.java;
 
 import java.util.Iterator;
 import java.util.List;
+import java.util.Map;
 import java.util.Set;
 import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.TreeSet;
 
+import java.io.IOException;
+
+import javax.management.Attribute;
+import javax.management.AttributeList;
+import javax.management.InstanceNotFoundException;
 import javax.management.MBeanServerConnection;
 import javax.management.ObjectName;
 import javax.management.MalformedObjectNameException;
@@ -42,6 +50,8 @@ class GenericJMXConfMBean
   private String _instance_prefix;
   private List<String> _instance_from;
   private List<GenericJMXConfValue> _values;
+  /* The MBean attributes read by all values, fetched with one call. */
+  private String[] _attribute_keys;
 
   private String getConfigString (OConfigItem ci) /* {{{ */
   {
@@ -147,6 +157,11 @@ class GenericJMXConfMBean
     if (this._values.size () == 0)
       throw (new IllegalArgumentException ("No value block was defined."));
 
+    Set<String> keys = new TreeSet<String> ();
+    for (int i = 0; i < this._values.size (); i++)
+      this._values.get (i).addAttributeKeys (keys);
+    this._attribute_keys = keys.toArray (new String[keys.size ()]);
+
   } /* }}} GenericJMXConfMBean (OConfigItem ci) */
 
   public String getName () /* {{{ */
@@ -154,11 +169,13 @@ class GenericJMXConfMBean
     return (this._name);
   } /* }}} */
 
-  public int query (MBeanServerConnection conn, PluginData pd, /* {{{ */
-      String instance_prefix)
+  /**
+   * Returns the names of the MBeans matching the configured ObjectName, or
+   * null if the query failed.
+   */
+  public Set<ObjectName> queryNames (MBeanServerConnection conn) /* {{{ */
   {
     Set<ObjectName> names;
-    Iterator<ObjectName> iter;
 
     try
     {
@@ -167,7 +184,7 @@ class GenericJMXConfMBean
     catch (Exception e)
     {
       Collectd.logError ("GenericJMXConfMBean: queryNames failed: " + e);
-      return (-1);
+      return (null);
     }
 
     if (names.size () == 0)
@@ -176,6 +193,66 @@ class GenericJMXConfMBean
           + "the ObjectName " + this._obj_name);
     }
 
+    return (names);
+  } /* }}} Set<ObjectName> queryNames */
+
+  /**
+   * Fetches all attributes the values need from one MBean with a single
+   * call. Attributes which could not be read are missing from the returned
+   * map; the values then query them one at a time.
+   *
+   * @throws InstanceNotFoundException if the MBean has been unregistered.
+   * @throws IOException if the connection failed.
+   */
+  private Map<String,Object> getAttributes (MBeanServerConnection conn, /* {{{ */
+      ObjectName objName)
+    throws InstanceNotFoundException, IOException
+  {
+    AttributeList attrList;
+    Map<String,Object> attrs;
+
+    try
+    {
+      attrList = conn.getAttributes (objName, this._attribute_keys);
+    }
+    catch (InstanceNotFoundException e)
+    {
+      throw (e);
+    }
+    catch (IOException e)
+    {
+      throw (e);
+    }
+    catch (Exception e)
+    {
+      Collectd.logDebug ("GenericJMXConfMBean: getAttributes failed: " + e);
+      return (null);
+    }
+
+    attrs = new HashMap<String,Object> ();
+    for (int i = 0; i < attrList.size (); i++)
+    {
+      Attribute attr = (Attribute) attrList.get (i);
+      attrs.put (attr.getName (), attr.getValue ());
+    }
+
+    return (attrs);
+  } /* }}} Map<String,Object> getAttributes */
+
+  /**
+   * Reads the MBeans in <em>names</em>, as returned by {@link #queryNames},
+   * and dispatches their values.
+   *
+   * @return Zero upon success, less than zero if the connection failed and
+   *         greater than zero if one of the MBeans doesn't exist anymore, so
+   *         the names need to be queried again.
+   */
+  public int query (MBeanServerConnection conn, PluginData pd, /* {{{ */
+      String instance_prefix, Set<ObjectName> names)
+  {
+    Iterator<ObjectName> iter;
+    int status = 0;
+
     iter = names.iterator ();
     while (iter.hasNext ())
     {
@@ -183,6 +260,7 @@ class GenericJMXConfMBean
       PluginData   pd_tmp;
       List<String> instanceList;
       StringBuffer instance;
+      Map<String,Object> attrs;
 
       objName      = iter.next ();
       pd_tmp       = new PluginData (pd);
@@ -227,12 +305,29 @@ class GenericJMXConfMBean
 
       Collectd.logDebug ("GenericJMXConfMBean: instance = " + instance.toString ());
 
+      try
+      {
+        attrs = getAttributes (conn, objName);
+      }
+      catch (InstanceNotFoundException e)
+      {
+        Collectd.logDebug ("GenericJMXConfMBean: " + objName
+            + " has been unregistered.");
+        status = 1;
+        continue;
+      }
+      catch (IOException e)
+      {
+        Collectd.logError ("GenericJMXConfMBean: getAttributes failed: " + e);
+        return (-1);
+      }
+
       for (int i = 0; i < this._values.size (); i++)
-        this._values.get (i).query (conn, objName, pd_tmp);
+        this._values.get (i).query (conn, objName, pd_tmp, attrs);
     }
 
-    return (0);
-  } /* }}} void query */
+    return (status);
+  } /* }}} int query */
 }
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
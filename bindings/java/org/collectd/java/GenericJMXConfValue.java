@@ -23,6 +23,7 @@ package org.collectd.java;
 
 import java.util.Arrays;
 import java.util.List;
+import java.util.Map;
 import java.util.Set;
 import java.util.Iterator;
 import java.util.ArrayList;
@@ -295,8 +296,21 @@ class GenericJMXConfValue
     }
   } /* }}} queryAttributeRecursive */
 
+  /**
+   * Returns the name of the MBean attribute an attribute path refers to, i.e.
+   * the part before the first dot.
+   */
+  private static String getAttributeKey (String attrName) /* {{{ */
+  {
+    int pos = attrName.indexOf ('.');
+
+    if (pos < 0)
+      return (attrName);
+    return (attrName.substring (0, pos));
+  } /* }}} String getAttributeKey */
+
   private Object queryAttribute (MBeanServerConnection conn, /* {{{ */
-      ObjectName objName, String attrName)
+      ObjectName objName, String attrName, Map<String,Object> attrCache)
   {
     List<String> attrNameList;
     String key;
@@ -310,23 +324,30 @@ class GenericJMXConfValue
     for (int i = 1; i < attrNameArray.length; i++)
       attrNameList.add (attrNameArray[i]);
 
-    try
+    if ((attrCache != null) && attrCache.containsKey (key))
+    {
+      value = attrCache.get (key);
+    }
+    else
     {
       try
       {
-        value = conn.getAttribute (objName, key);
+        try
+        {
+          value = conn.getAttribute (objName, key);
+        }
+        catch (javax.management.AttributeNotFoundException e)
+        {
+          value = conn.invoke (objName, key, /* args = */ null, /* types = */ null);
+        }
       }
-      catch (javax.management.AttributeNotFoundException e)
+      catch (Exception e)
       {
-        value = conn.invoke (objName, key, /* args = */ null, /* types = */ null);
+        Collectd.logError ("GenericJMXConfValue.query: getAttribute failed: "
+            + e);
+        return (null);
       }
     }
-    catch (Exception e)
-    {
-      Collectd.logError ("GenericJMXConfValue.query: getAttribute failed: "
-          + e);
-      return (null);
-    }
 
     if (attrNameList.size () == 0)
     {
@@ -491,6 +512,16 @@ class GenericJMXConfValue
       throw (new IllegalArgumentException ("No attribute was defined."));
   } /* }}} GenericJMXConfValue (OConfigItem ci) */
 
+  /**
+   * Adds the names of the MBean attributes this value reads to
+   * <em>keys</em>, so that they can be fetched with a single call.
+   */
+  public void addAttributeKeys (Set<String> keys) /* {{{ */
+  {
+    for (int i = 0; i < this._attributes.size (); i++)
+      keys.add (getAttributeKey (this._attributes.get (i)));
+  } /* }}} void addAttributeKeys */
+
   /**
    * Query values via JMX according to the object's configuration and dispatch
    * them to collectd.
@@ -502,6 +533,18 @@ class GenericJMXConfValue
    */
   public void query (MBeanServerConnection conn, ObjectName objName, /* {{{ */
       PluginData pd)
+  {
+    query (conn, objName, pd, /* attrCache = */ null);
+  } /* }}} void query */
+
+  /**
+   * Like {@link #query(MBeanServerConnection,ObjectName,PluginData)}, but
+   * takes the attributes from <em>attrCache</em>, which maps attribute names
+   * to their values. Attributes missing from the map are queried from the
+   * MBeanServer one at a time.
+   */
+  public void query (MBeanServerConnection conn, ObjectName objName, /* {{{ */
+      PluginData pd, Map<String,Object> attrCache)
   {
     ValueList vl;
     List<DataSource> dsrc;
@@ -573,7 +616,7 @@ class GenericJMXConfValue
     {
       Object v;
 
-      v = queryAttribute (conn, objName, this._attributes.get (i));
+      v = queryAttribute (conn, objName, this._attributes.get (i), attrCache);
       if (v == null)
       {
         Collectd.logError ("GenericJMXConfValue.query: "
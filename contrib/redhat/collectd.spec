@@ -148,6 +148,7 @@ exit 0
 %attr(0755,root,root) %{_sbindir}/collectd
 %attr(0755,root,root) %{_bindir}/collectd-nagios
 %attr(0755,root,root) %{_bindir}/collectdctl
+%attr(0755,root,root) %{_bindir}/collectd-replay
 %attr(0755,root,root) %{_sbindir}/collectdmon
 %attr(0644,root,root) %{_mandir}/man1/*
 %attr(0644,root,root) %{_mandir}/man5/*
@@ -0,0 +1,910 @@
+/**
+ * collectd - src/aggregation.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Aggregation plugin
+ *
+ * Combines the values of many value lists, for example of all CPUs or all
+ * interfaces of a host, into a few aggregated value lists. Each <Aggregation>
+ * block selects value lists by their identifier and groups them by some of
+ * its fields. The values of each group are added up, as they arrive, in an
+ * instance kept in a hash table keyed by the group. Once per interval the
+ * sum, average, minimum and maximum of each group are dispatched with the
+ * plugin name "aggregation".
+ *
+ * Value lists of types with COUNTER, DERIVE or ABSOLUTE data sources are
+ * aggregated as rates, which are taken from the cache. The aggregates are
+ * turned back into values of the original type, so that they can be stored
+ * like any other value list.
+ *
+ * The plugin sees value lists either as a write plugin or, if it is used in
+ * a chain, as the target "aggregation". Only the target can keep the value
+ * lists it aggregated from being written.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "filter_chain.h"
+#include "utils_arena.h"
+#include "utils_cache.h"
+#include "utils_hashtable.h"
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <regex.h>
+
+/* Fields a value list can be grouped by, as bits of `group_by'. */
+#define AGG_GROUP_HOST            0x01
+#define AGG_GROUP_PLUGIN          0x02
+#define AGG_GROUP_PLUGIN_INSTANCE 0x04
+#define AGG_GROUP_TYPE_INSTANCE   0x08
+
+#define AGG_CALC_SUM     0
+#define AGG_CALC_AVERAGE 1
+#define AGG_CALC_MIN     2
+#define AGG_CALC_MAX     3
+#define AGG_CALC_NUM     4
+
+static const char *agg_calc_names[AGG_CALC_NUM] =
+{
+	"sum", "average", "min", "max"
+};
+
+/* Groups which received no values for this many of their intervals are
+ * removed. */
+#define AGG_IDLE_INTERVALS 3
+
+/* Rates of up to this many data sources are looked up without allocating
+ * memory. */
+#define AGG_RATES_BUFFER 16
+
+/* Selects the values of one field of the identifier. If both members are
+ * NULL, all values are selected. */
+struct agg_match_s
+{
+	char *string;
+	regex_t *regex;
+};
+typedef struct agg_match_s agg_match_t;
+
+/* The state of one data source of a group. */
+struct agg_ds_s
+{
+	/* Aggregates of the rates received since the last read. */
+	size_t num;
+	gauge_t sum;
+	gauge_t min;
+	gauge_t max;
+
+	/* Values dispatched for types other than GAUGE: the rates are added up
+	 * like the daemon would, keeping the fraction for the next read. */
+	derive_t total[AGG_CALC_NUM];
+	gauge_t residual[AGG_CALC_NUM];
+};
+typedef struct agg_ds_s agg_ds_t;
+
+/* One group of an aggregation. The fields it isn't grouped by are empty. */
+struct agg_instance_s
+{
+	char key[5 * DATA_MAX_NAME_LEN];
+
+	char host[DATA_MAX_NAME_LEN];
+	char plugin[DATA_MAX_NAME_LEN];
+	char plugin_instance[DATA_MAX_NAME_LEN];
+	char type_instance[DATA_MAX_NAME_LEN];
+
+	cdtime_t interval;
+	cdtime_t last_update;
+	cdtime_t last_dispatch;
+
+	size_t num;
+	agg_ds_t *ds;
+};
+typedef struct agg_instance_s agg_instance_t;
+
+struct aggregation_s;
+typedef struct aggregation_s aggregation_t;
+struct aggregation_s
+{
+	agg_match_t host;
+	agg_match_t plugin;
+	agg_match_t plugin_instance;
+	char type[DATA_MAX_NAME_LEN];
+	agg_match_t type_instance;
+
+	int group_by;
+	_Bool calc[AGG_CALC_NUM];
+	_Bool suppress;
+
+	/* Protects `ds' and `instances'. */
+	pthread_mutex_t lock;
+	const data_set_t *ds;
+	c_hashtable_t *instances;
+
+	aggregation_t *next;
+};
+
+static aggregation_t *agg_list = NULL;
+
+/* Set if the target is used in a chain: the value lists are then aggregated
+ * by the target rather than by the write callback. */
+static _Bool agg_target_used = 0;
+
+/*
+ * Configuration
+ */
+static int agg_config_match (const oconfig_item_t *ci, /* {{{ */
+		agg_match_t *m)
+{
+	char *value = NULL;
+	size_t len;
+	int status;
+
+	status = cf_util_get_string (ci, &value);
+	if (status != 0)
+		return (status);
+
+	sfree (m->string);
+	if (m->regex != NULL)
+	{
+		regfree (m->regex);
+		sfree (m->regex);
+	}
+
+	/* Regular expressions are enclosed in slashes, like in ignorelists. */
+	len = strlen (value);
+	if ((len < 3) || (value[0] != '/') || (value[len - 1] != '/'))
+	{
+		m->string = value;
+		return (0);
+	}
+
+	value[len - 1] = 0;
+
+	m->regex = malloc (sizeof (*m->regex));
+	if (m->regex == NULL)
+	{
+		ERROR ("aggregation plugin: malloc failed.");
+		sfree (value);
+		return (-1);
+	}
+
+	status = regcomp (m->regex, value + 1, REG_EXTENDED | REG_NOSUB);
+	if (status != 0)
+	{
+		char errbuf[1024];
+
+		regerror (status, m->regex, errbuf, sizeof (errbuf));
+		ERROR ("aggregation plugin: Compiling the regular expression "
+				"\"%s\" failed: %s", value + 1, errbuf);
+		sfree (m->regex);
+		sfree (value);
+		return (-1);
+	}
+
+	sfree (value);
+	return (0);
+} /* }}} int agg_config_match */
+
+static void agg_match_free (agg_match_t *m) /* {{{ */
+{
+	sfree (m->string);
+	if (m->regex != NULL)
+	{
+		regfree (m->regex);
+		sfree (m->regex);
+	}
+} /* }}} void agg_match_free */
+
+static int agg_config_group_by (const oconfig_item_t *ci, /* {{{ */
+		int *group_by)
+{
+	int i;
+
+	for (i = 0; i < ci->values_num; i++)
+	{
+		const char *field;
+
+		if (ci->values[i].type != OCONFIG_TYPE_STRING)
+		{
+			ERROR ("aggregation plugin: The `GroupBy' option requires "
+					"string arguments.");
+			return (-1);
+		}
+		field = ci->values[i].value.string;
+
+		if (strcasecmp ("Host", field) == 0)
+			*group_by |= AGG_GROUP_HOST;
+		else if (strcasecmp ("Plugin", field) == 0)
+			*group_by |= AGG_GROUP_PLUGIN;
+		else if (strcasecmp ("PluginInstance", field) == 0)
+			*group_by |= AGG_GROUP_PLUGIN_INSTANCE;
+		else if (strcasecmp ("TypeInstance", field) == 0)
+			*group_by |= AGG_GROUP_TYPE_INSTANCE;
+		else
+		{
+			ERROR ("aggregation plugin: Cannot group by \"%s\". Valid "
+					"fields are \"Host\", \"Plugin\", \"PluginInstance\" "
+					"and \"TypeInstance\".", field);
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* }}} int agg_config_group_by */
+
+static void agg_free_instances (c_hashtable_t *instances) /* {{{ */
+{
+	agg_instance_t *inst;
+	char *key;
+
+	if (instances == NULL)
+		return;
+
+	while (c_hashtable_pick (instances, (void *) &key, (void *) &inst) == 0)
+	{
+		sfree (inst->ds);
+		sfree (inst);
+	}
+
+	c_hashtable_destroy (instances);
+} /* }}} void agg_free_instances */
+
+static void agg_free (aggregation_t *agg) /* {{{ */
+{
+	if (agg == NULL)
+		return;
+
+	agg_match_free (&agg->host);
+	agg_match_free (&agg->plugin);
+	agg_match_free (&agg->plugin_instance);
+	agg_match_free (&agg->type_instance);
+
+	agg_free_instances (agg->instances);
+	pthread_mutex_destroy (&agg->lock);
+
+	sfree (agg);
+} /* }}} void agg_free */
+
+static int agg_config_aggregation (const oconfig_item_t *ci) /* {{{ */
+{
+	aggregation_t *agg;
+	int status = 0;
+	int i;
+
+	agg = calloc (1, sizeof (*agg));
+	if (agg == NULL)
+	{
+		ERROR ("aggregation plugin: calloc failed.");
+		return (-1);
+	}
+	pthread_mutex_init (&agg->lock, /* attr = */ NULL);
+	agg->calc[AGG_CALC_SUM] = 1;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Host", child->key) == 0)
+			status = agg_config_match (child, &agg->host);
+		else if (strcasecmp ("Plugin", child->key) == 0)
+			status = agg_config_match (child, &agg->plugin);
+		else if (strcasecmp ("PluginInstance", child->key) == 0)
+			status = agg_config_match (child, &agg->plugin_instance);
+		else if (strcasecmp ("Type", child->key) == 0)
+			status = cf_util_get_string_buffer (child, agg->type,
+					sizeof (agg->type));
+		else if (strcasecmp ("TypeInstance", child->key) == 0)
+			status = agg_config_match (child, &agg->type_instance);
+		else if (strcasecmp ("GroupBy", child->key) == 0)
+			status = agg_config_group_by (child, &agg->group_by);
+		else if (strcasecmp ("CalculateSum", child->key) == 0)
+			status = cf_util_get_boolean (child, &agg->calc[AGG_CALC_SUM]);
+		else if (strcasecmp ("CalculateAverage", child->key) == 0)
+			status = cf_util_get_boolean (child,
+					&agg->calc[AGG_CALC_AVERAGE]);
+		else if (strcasecmp ("CalculateMinimum", child->key) == 0)
+			status = cf_util_get_boolean (child, &agg->calc[AGG_CALC_MIN]);
+		else if (strcasecmp ("CalculateMaximum", child->key) == 0)
+			status = cf_util_get_boolean (child, &agg->calc[AGG_CALC_MAX]);
+		else if (strcasecmp ("SuppressOriginals", child->key) == 0)
+			status = cf_util_get_boolean (child, &agg->suppress);
+		else
+		{
+			WARNING ("aggregation plugin: Unknown config option: %s",
+					child->key);
+			status = -1;
+		}
+
+		if (status != 0)
+			break;
+	}
+
+	/* All value lists of an aggregation must have the same data sources. */
+	if ((status == 0) && (agg->type[0] == 0))
+	{
+		ERROR ("aggregation plugin: Each <Aggregation> block requires the "
+				"`Type' option.");
+		status = -1;
+	}
+
+	if ((status == 0) && !agg->calc[AGG_CALC_SUM]
+			&& !agg->calc[AGG_CALC_AVERAGE] && !agg->calc[AGG_CALC_MIN]
+			&& !agg->calc[AGG_CALC_MAX])
+	{
+		ERROR ("aggregation plugin: An <Aggregation> block of type "
+				"\"%s\" doesn't calculate anything.", agg->type);
+		status = -1;
+	}
+
+	if (status == 0)
+	{
+		agg->instances = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (agg->instances == NULL)
+		{
+			ERROR ("aggregation plugin: c_hashtable_create failed.");
+			status = -1;
+		}
+	}
+
+	if (status != 0)
+	{
+		agg_free (agg);
+		return (status);
+	}
+
+	agg->next = agg_list;
+	agg_list = agg;
+
+	return (0);
+} /* }}} int agg_config_aggregation */
+
+static int agg_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Aggregation", child->key) == 0)
+			agg_config_aggregation (child);
+		else
+			WARNING ("aggregation plugin: Unknown config option: %s",
+					child->key);
+	}
+
+	return (0);
+} /* }}} int agg_config */
+
+/*
+ * Aggregating
+ */
+static _Bool agg_match (const agg_match_t *m, const char *value) /* {{{ */
+{
+	if (m->string != NULL)
+		return (strcmp (m->string, value) == 0);
+	if (m->regex != NULL)
+		return (regexec (m->regex, value, 0, NULL, 0) == 0);
+	return (1);
+} /* }}} _Bool agg_match */
+
+static _Bool agg_selects (const aggregation_t *agg, /* {{{ */
+		const value_list_t *vl)
+{
+	return ((strcmp (agg->type, vl->type) == 0)
+			&& agg_match (&agg->plugin, vl->plugin)
+			&& agg_match (&agg->type_instance, vl->type_instance)
+			&& agg_match (&agg->plugin_instance, vl->plugin_instance)
+			&& agg_match (&agg->host, vl->host));
+} /* }}} _Bool agg_selects */
+
+/* Appends `value' followed by a byte which doesn't occur in identifiers. */
+static void agg_key_append (char *key, size_t key_size, /* {{{ */
+		size_t *fill, const char *value)
+{
+	size_t len = strlen (value);
+
+	if ((*fill + len + 2) > key_size)
+		len = key_size - *fill - 2;
+
+	memcpy (key + *fill, value, len);
+	*fill += len;
+	key[*fill] = '\001';
+	(*fill)++;
+	key[*fill] = 0;
+} /* }}} void agg_key_append */
+
+static agg_instance_t *agg_instance_get (aggregation_t *agg, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	agg_instance_t *inst;
+	char key[sizeof (inst->key)];
+	size_t fill = 0;
+	int i;
+
+	key[0] = 0;
+	if (agg->group_by & AGG_GROUP_HOST)
+		agg_key_append (key, sizeof (key), &fill, vl->host);
+	if (agg->group_by & AGG_GROUP_PLUGIN)
+		agg_key_append (key, sizeof (key), &fill, vl->plugin);
+	if (agg->group_by & AGG_GROUP_PLUGIN_INSTANCE)
+		agg_key_append (key, sizeof (key), &fill, vl->plugin_instance);
+	if (agg->group_by & AGG_GROUP_TYPE_INSTANCE)
+		agg_key_append (key, sizeof (key), &fill, vl->type_instance);
+
+	if (c_hashtable_get (agg->instances, key, (void *) &inst) == 0)
+		return (inst);
+
+	inst = calloc (1, sizeof (*inst));
+	if (inst == NULL)
+	{
+		ERROR ("aggregation plugin: calloc failed.");
+		return (NULL);
+	}
+
+	inst->ds = calloc (ds->ds_num, sizeof (*inst->ds));
+	if (inst->ds == NULL)
+	{
+		ERROR ("aggregation plugin: calloc failed.");
+		sfree (inst);
+		return (NULL);
+	}
+	for (i = 0; i < ds->ds_num; i++)
+	{
+		inst->ds[i].min = NAN;
+		inst->ds[i].max = NAN;
+	}
+
+	sstrncpy (inst->key, key, sizeof (inst->key));
+	if (agg->group_by & AGG_GROUP_HOST)
+		sstrncpy (inst->host, vl->host, sizeof (inst->host));
+	if (agg->group_by & AGG_GROUP_PLUGIN)
+		sstrncpy (inst->plugin, vl->plugin, sizeof (inst->plugin));
+	if (agg->group_by & AGG_GROUP_PLUGIN_INSTANCE)
+		sstrncpy (inst->plugin_instance, vl->plugin_instance,
+				sizeof (inst->plugin_instance));
+	if (agg->group_by & AGG_GROUP_TYPE_INSTANCE)
+		sstrncpy (inst->type_instance, vl->type_instance,
+				sizeof (inst->type_instance));
+
+	if (c_hashtable_insert (agg->instances, inst->key, inst) != 0)
+	{
+		ERROR ("aggregation plugin: c_hashtable_insert failed.");
+		sfree (inst->ds);
+		sfree (inst);
+		return (NULL);
+	}
+
+	return (inst);
+} /* }}} agg_instance_t *agg_instance_get */
+
+static void agg_instance_add (aggregation_t *agg, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl, const gauge_t *rates)
+{
+	agg_instance_t *inst;
+	int i;
+
+	pthread_mutex_lock (&agg->lock);
+
+	/* The data set of a type doesn't change, but make sure the instances
+	 * are never updated with more data sources than they have. */
+	if (agg->ds == NULL)
+		agg->ds = ds;
+	if (agg->ds->ds_num != ds->ds_num)
+	{
+		pthread_mutex_unlock (&agg->lock);
+		return;
+	}
+
+	inst = agg_instance_get (agg, ds, vl);
+	if (inst == NULL)
+	{
+		pthread_mutex_unlock (&agg->lock);
+		return;
+	}
+
+	for (i = 0; i < ds->ds_num; i++)
+	{
+		agg_ds_t *d = inst->ds + i;
+
+		if (isnan (rates[i]))
+			continue;
+
+		d->num++;
+		d->sum += rates[i];
+		if (isnan (d->min) || (d->min > rates[i]))
+			d->min = rates[i];
+		if (isnan (d->max) || (d->max < rates[i]))
+			d->max = rates[i];
+	}
+
+	inst->num++;
+	if (inst->interval < vl->interval)
+		inst->interval = vl->interval;
+	inst->last_update = cdtime ();
+
+	pthread_mutex_unlock (&agg->lock);
+} /* }}} void agg_instance_add */
+
+/* Adds the value list to all aggregations selecting it. Returns true if one
+ * of them suppresses the value lists it aggregates. */
+static _Bool agg_process (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl)
+{
+	gauge_t rates_buffer[AGG_RATES_BUFFER];
+	gauge_t *rates = NULL;
+	_Bool suppress = 0;
+	aggregation_t *agg;
+	arena_mark_t mark;
+
+	/* Don't aggregate the aggregates. */
+	if (strcmp ("aggregation", vl->plugin) == 0)
+		return (0);
+
+	/* Write callbacks may run in a thread of their own, which doesn't
+	 * release the arena in between value lists. */
+	mark = arena_mark ();
+
+	for (agg = agg_list; agg != NULL; agg = agg->next)
+	{
+		if (!agg_selects (agg, vl))
+			continue;
+
+		if (rates == NULL)
+		{
+			_Bool gauges_only = 1;
+			int i;
+
+			for (i = 0; i < ds->ds_num; i++)
+				if (ds->ds[i].type != DS_TYPE_GAUGE)
+					gauges_only = 0;
+
+			if (ds->ds_num > AGG_RATES_BUFFER)
+				rates = uc_get_rate_arena (ds, vl);
+			else if (gauges_only
+					|| (uc_get_rate_buffer (ds, vl, rates_buffer) == 0))
+				rates = rates_buffer;
+
+			if (rates == NULL)
+			{
+				arena_release (mark);
+				return (0);
+			}
+
+			/* Gauges don't need the cache, which doesn't have the
+			 * values yet when the target is in the pre-cache chain. */
+			if (gauges_only)
+				for (i = 0; i < ds->ds_num; i++)
+					rates[i] = vl->values[i].gauge;
+		}
+
+		agg_instance_add (agg, ds, vl, rates);
+		if (agg->suppress)
+			suppress = 1;
+	}
+
+	arena_release (mark);
+
+	return (suppress);
+} /* }}} _Bool agg_process */
+
+static int agg_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+		user_data_t __attribute__((unused)) *user_data)
+{
+	if (agg_target_used)
+		return (0);
+
+	agg_process (ds, vl);
+	return (0);
+} /* }}} int agg_write */
+
+/*
+ * Dispatching
+ */
+static void agg_instance_name (const aggregation_t *agg, /* {{{ */
+		const agg_instance_t *inst, int calc, value_list_t *vl)
+{
+	const char *plugin = inst->plugin;
+	const char *type_instance = inst->type_instance;
+
+	/* Fields matched by a plain string have the same value in all value
+	 * lists, so they are kept even if they're not grouped by. */
+	if ((plugin[0] == 0) && (agg->plugin.string != NULL))
+		plugin = agg->plugin.string;
+	if ((type_instance[0] == 0) && (agg->type_instance.string != NULL))
+		type_instance = agg->type_instance.string;
+
+	if (inst->host[0] != 0)
+		sstrncpy (vl->host, inst->host, sizeof (vl->host));
+	else if (agg->host.string != NULL)
+		sstrncpy (vl->host, agg->host.string, sizeof (vl->host));
+	else
+		sstrncpy (vl->host, "global", sizeof (vl->host));
+
+	sstrncpy (vl->plugin, "aggregation", sizeof (vl->plugin));
+
+	if ((plugin[0] != 0) && (inst->plugin_instance[0] != 0))
+		ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+				"%s-%s-%s", plugin, inst->plugin_instance,
+				agg_calc_names[calc]);
+	else if ((plugin[0] != 0) || (inst->plugin_instance[0] != 0))
+		ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+				"%s-%s", (plugin[0] != 0) ? plugin : inst->plugin_instance,
+				agg_calc_names[calc]);
+	else
+		sstrncpy (vl->plugin_instance, agg_calc_names[calc],
+				sizeof (vl->plugin_instance));
+
+	sstrncpy (vl->type, agg->type, sizeof (vl->type));
+	sstrncpy (vl->type_instance, type_instance, sizeof (vl->type_instance));
+} /* }}} void agg_instance_name */
+
+/* Turns an aggregated rate into a value of the data source's type. */
+static value_t agg_rate_to_value (agg_ds_t *d, int calc, int ds_type, /* {{{ */
+		gauge_t rate, gauge_t elapsed)
+{
+	value_t value;
+
+	if (ds_type == DS_TYPE_GAUGE)
+	{
+		value.gauge = rate;
+		return (value);
+	}
+
+	if (ds_type == DS_TYPE_ABSOLUTE)
+	{
+		value.absolute = (!isnan (rate) && (rate > 0.0))
+			? (absolute_t) (rate * elapsed + .5) : 0;
+		return (value);
+	}
+
+	/* COUNTER and DERIVE: integrate the rate. */
+	if (!isnan (rate))
+	{
+		derive_t whole;
+
+		d->residual[calc] += rate * elapsed;
+		whole = (derive_t) d->residual[calc];
+		d->total[calc] += whole;
+		d->residual[calc] -= (gauge_t) whole;
+	}
+
+	if (ds_type == DS_TYPE_COUNTER)
+		value.counter = (counter_t) d->total[calc];
+	else
+		value.derive = d->total[calc];
+
+	return (value);
+} /* }}} value_t agg_rate_to_value */
+
+/* Appends the value lists of all groups which received values to `*vl_list'
+ * and removes groups which didn't for a while. Returns the new number of
+ * value lists. */
+static size_t agg_read_aggregation (aggregation_t *agg, cdtime_t now, /* {{{ */
+		value_list_t **vl_list, size_t *vl_size, size_t vl_num)
+{
+	c_hashtable_iterator_t *iter;
+	agg_instance_t *inst;
+	char *key;
+	char **expired = NULL;
+	size_t expired_num = 0;
+	size_t i;
+
+	pthread_mutex_lock (&agg->lock);
+
+	if (agg->ds == NULL)
+	{
+		pthread_mutex_unlock (&agg->lock);
+		return (vl_num);
+	}
+
+	iter = c_hashtable_get_iterator (agg->instances);
+	while ((iter != NULL) && (c_hashtable_iterator_next (iter,
+					(void *) &key, (void *) &inst) == 0))
+	{
+		gauge_t elapsed;
+		int calc;
+		int j;
+
+		if (inst->num == 0)
+		{
+			if ((now - inst->last_update)
+					> (AGG_IDLE_INTERVALS * inst->interval))
+			{
+				char **tmp = realloc (expired,
+						(expired_num + 1) * sizeof (*expired));
+				if (tmp != NULL)
+				{
+					expired = tmp;
+					expired[expired_num] = key;
+					expired_num++;
+				}
+			}
+			continue;
+		}
+
+		if (inst->last_dispatch == 0)
+			elapsed = CDTIME_T_TO_DOUBLE (inst->interval);
+		else
+			elapsed = CDTIME_T_TO_DOUBLE (now - inst->last_dispatch);
+		inst->last_dispatch = now;
+
+		for (calc = 0; calc < AGG_CALC_NUM; calc++)
+		{
+			value_list_t *vl;
+
+			if (!agg->calc[calc])
+				continue;
+
+			if (vl_num >= *vl_size)
+			{
+				size_t new_size = (*vl_size == 0) ? 16 : 2 * (*vl_size);
+				value_list_t *tmp;
+
+				tmp = realloc (*vl_list, new_size * sizeof (*tmp));
+				if (tmp == NULL)
+				{
+					ERROR ("aggregation plugin: realloc failed.");
+					break;
+				}
+				*vl_list = tmp;
+				*vl_size = new_size;
+			}
+
+			vl = (*vl_list) + vl_num;
+			memset (vl, 0, sizeof (*vl));
+			vl->values = calloc (agg->ds->ds_num, sizeof (*vl->values));
+			if (vl->values == NULL)
+			{
+				ERROR ("aggregation plugin: calloc failed.");
+				break;
+			}
+			vl->values_len = agg->ds->ds_num;
+			vl->time = now;
+			vl->interval = inst->interval;
+			agg_instance_name (agg, inst, calc, vl);
+
+			for (j = 0; j < agg->ds->ds_num; j++)
+			{
+				agg_ds_t *d = inst->ds + j;
+				gauge_t rate = NAN;
+
+				if (d->num > 0)
+				{
+					if (calc == AGG_CALC_SUM)
+						rate = d->sum;
+					else if (calc == AGG_CALC_AVERAGE)
+						rate = d->sum / ((gauge_t) d->num);
+					else if (calc == AGG_CALC_MIN)
+						rate = d->min;
+					else
+						rate = d->max;
+				}
+
+				vl->values[j] = agg_rate_to_value (d, calc,
+						agg->ds->ds[j].type, rate, elapsed);
+			}
+
+			vl_num++;
+		}
+
+		/* Start the next interval. */
+		inst->num = 0;
+		for (j = 0; j < agg->ds->ds_num; j++)
+		{
+			inst->ds[j].num = 0;
+			inst->ds[j].sum = 0.0;
+			inst->ds[j].min = NAN;
+			inst->ds[j].max = NAN;
+		}
+	}
+	c_hashtable_iterator_destroy (iter);
+
+	/* The table must not be modified while iterating over it. */
+	for (i = 0; i < expired_num; i++)
+	{
+		if (c_hashtable_remove (agg->instances, expired[i],
+					/* key = */ NULL, (void *) &inst) != 0)
+			continue;
+
+		sfree (inst->ds);
+		sfree (inst);
+	}
+	sfree (expired);
+
+	pthread_mutex_unlock (&agg->lock);
+	return (vl_num);
+} /* }}} size_t agg_read_aggregation */
+
+static int agg_read (void) /* {{{ */
+{
+	value_list_t *vl_list = NULL;
+	size_t vl_size = 0;
+	size_t vl_num = 0;
+	aggregation_t *agg;
+	cdtime_t now;
+	size_t i;
+
+	now = cdtime ();
+
+	for (agg = agg_list; agg != NULL; agg = agg->next)
+		vl_num = agg_read_aggregation (agg, now, &vl_list, &vl_size, vl_num);
+
+	/* The aggregates are dispatched without holding any lock, because they
+	 * pass through the chains and the write callbacks again. */
+	if (vl_num > 0)
+		plugin_dispatch_values_batch (vl_list, vl_num);
+
+	for (i = 0; i < vl_num; i++)
+		sfree (vl_list[i].values);
+	sfree (vl_list);
+
+	return (0);
+} /* }}} int agg_read */
+
+/*
+ * The "aggregation" target
+ */
+static int agg_target_create (const oconfig_item_t *ci, /* {{{ */
+		void **user_data)
+{
+	if (ci->children_num > 0)
+		WARNING ("aggregation plugin: The `aggregation' target doesn't have "
+				"any options. They are set in the <Plugin aggregation> block.");
+
+	agg_target_used = 1;
+	*user_data = NULL;
+	return (0);
+} /* }}} int agg_target_create */
+
+static int agg_target_destroy (void **user_data) /* {{{ */
+{
+	return (0);
+} /* }}} int agg_target_destroy */
+
+static int agg_target_invoke (const data_set_t *ds, /* {{{ */
+		value_list_t *vl,
+		notification_meta_t __attribute__((unused)) **meta,
+		void __attribute__((unused)) **user_data)
+{
+	if (agg_process (ds, vl))
+		return (FC_TARGET_STOP);
+
+	return (FC_TARGET_CONTINUE);
+} /* }}} int agg_target_invoke */
+
+void module_register (void)
+{
+	target_proc_t tproc;
+
+	plugin_register_complex_config ("aggregation", agg_config);
+	plugin_register_read ("aggregation", agg_read);
+	plugin_register_write ("aggregation", agg_write, /* user_data = */ NULL);
+
+	memset (&tproc, 0, sizeof (tproc));
+	tproc.create  = agg_target_create;
+	tproc.destroy = agg_target_destroy;
+	tproc.invoke  = agg_target_invoke;
+	fc_register_target ("aggregation", tproc);
+} /* void module_register */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -47,6 +47,11 @@
 
 #define CAMQP_CHANNEL 1
 
+/* Batched messages must be able to hold at least one value list. */
+#define CAMQP_MIN_MESSAGE_SIZE 4096
+#define CAMQP_BATCH_ROUTING_KEY "collectd"
+#define CAMQP_BATCH_MESSAGE_SIZE 65536
+
 /*
  * Data types
  */
@@ -69,6 +74,20 @@ struct camqp_config_s
     _Bool   store_rates;
     int     format;
 
+    /* Batching, publish only: Value lists are collected in `send_buffer' and
+     * published as one message. `send_buffer' is NULL if batching is
+     * disabled. */
+    size_t  max_message_size;
+    cdtime_t max_delay;
+    char   *send_buffer;
+    size_t  send_buffer_fill;
+    size_t  send_buffer_free;
+    cdtime_t send_buffer_init_time;
+
+    /* Batches collected by the daemon, see plugin_register_write_batch(). */
+    int     batch_size;
+    cdtime_t batch_timeout;
+
     /* subscribe only */
     char   *exchange_type;
     char   *queue;
@@ -96,6 +115,8 @@ static _Bool      subscriber_threads_running = 1;
 /*
  * Functions
  */
+static int camqp_flush_locked (camqp_config_t *conf, cdtime_t timeout);
+
 static void camqp_close_connection (camqp_config_t *conf) /* {{{ */
 {
     int sockfd;
@@ -118,6 +139,13 @@ static void camqp_config_free (void *ptr) /* {{{ */
     if (conf == NULL)
         return;
 
+    if (conf->send_buffer != NULL)
+    {
+        pthread_mutex_lock (&conf->lock);
+        camqp_flush_locked (conf, /* timeout = */ 0);
+        pthread_mutex_unlock (&conf->lock);
+    }
+
     camqp_close_connection (conf);
 
     sfree (conf->name);
@@ -129,6 +157,7 @@ static void camqp_config_free (void *ptr) /* {{{ */
     sfree (conf->exchange_type);
     sfree (conf->queue);
     sfree (conf->routing_key);
+    sfree (conf->send_buffer);
 
     sfree (conf);
 } /* }}} void camqp_config_free */
@@ -427,17 +456,64 @@ static int camqp_shutdown (void) /* {{{ */
 /*
  * Subscribing code
  */
+/* Handles one PUTVAL command per line. Batched messages contain many of
+ * them. */
+static int camqp_read_putval (char *body) /* {{{ */
+{
+    char *line;
+    char *next;
+    int ret = 0;
+    int status;
+
+    for (line = body; line != NULL; line = next)
+    {
+        size_t len;
+
+        next = strchr (line, '\n');
+        if (next != NULL)
+        {
+            *next = 0;
+            next++;
+        }
+
+        len = strlen (line);
+        while ((len > 0) && (line[len - 1] == '\r'))
+        {
+            len--;
+            line[len] = 0;
+        }
+        if (len == 0)
+            continue;
+
+        status = handle_putval (stderr, line);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: handle_putval failed with status %i.",
+                    status);
+            ret = status;
+        }
+    }
+
+    return (ret);
+} /* }}} int camqp_read_putval */
+
 static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         size_t body_size, const char *content_type)
 {
-    char body[body_size + 1];
+    char *body;
     char *body_ptr;
     size_t received;
     amqp_frame_t frame;
     int status;
 
-    memset (body, 0, sizeof (body));
-    body_ptr = &body[0];
+    /* Batched messages may be large, so don't put them on the stack. */
+    body = calloc (1, body_size + 1);
+    if (body == NULL)
+    {
+        ERROR ("amqp plugin: calloc failed.");
+        return (ENOMEM);
+    }
+    body_ptr = body;
     received = 0;
 
     while (received < body_size)
@@ -450,6 +526,7 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
             ERROR ("amqp plugin: amqp_simple_wait_frame failed: %s",
                     sstrerror (status, errbuf, sizeof (errbuf)));
             camqp_close_connection (conf);
+            sfree (body);
             return (status);
         }
 
@@ -457,12 +534,14 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
         {
             NOTICE ("amqp plugin: Unexpected frame type: %#"PRIx8,
                     frame.frame_type);
+            sfree (body);
             return (-1);
         }
 
         if ((body_size - received) < frame.payload.body_fragment.len)
         {
             WARNING ("amqp plugin: Body is larger than indicated by header.");
+            sfree (body);
             return (-1);
         }
 
@@ -473,28 +552,23 @@ static int camqp_read_body (camqp_config_t *conf, /* {{{ */
     } /* while (received < body_size) */
 
     if (strcasecmp ("text/collectd", content_type) == 0)
+        status = camqp_read_putval (body);
+    else if (strcasecmp ("application/json", content_type) == 0)
     {
-        status = handle_putval (stderr, body);
+        status = format_json_parse (body);
         if (status != 0)
-            ERROR ("amqp plugin: handle_putval failed with status %i.",
+            ERROR ("amqp plugin: format_json_parse failed with status %i.",
                     status);
-        return (status);
-    }
-    else if (strcasecmp ("application/json", content_type) == 0)
-    {
-        ERROR ("amqp plugin: camqp_read_body: Parsing JSON data has not "
-                "been implemented yet. FIXME!");
-        return (0);
     }
     else
     {
         ERROR ("amqp plugin: camqp_read_body: Unknown content type \"%s\".",
                 content_type);
-        return (EINVAL);
+        status = EINVAL;
     }
 
-    /* not reached */
-    return (0);
+    sfree (body);
+    return (status);
 } /* }}} int camqp_read_body */
 
 static int camqp_read_header (camqp_config_t *conf) /* {{{ */
@@ -669,6 +743,166 @@ static int camqp_write_locked (camqp_config_t *conf, /* {{{ */
     return (status);
 } /* }}} int camqp_write_locked */
 
+/* XXX: You must hold "conf->lock" when calling this function! */
+static void camqp_reset_buffer (camqp_config_t *conf) /* {{{ */
+{
+    memset (conf->send_buffer, 0, conf->max_message_size);
+    conf->send_buffer_free = conf->max_message_size;
+    conf->send_buffer_fill = 0;
+    conf->send_buffer_init_time = 0;
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+        format_json_initialize (conf->send_buffer,
+                &conf->send_buffer_fill, &conf->send_buffer_free);
+} /* }}} void camqp_reset_buffer */
+
+/* Publishes the batch if it's older than "timeout". A timeout of zero
+ * publishes unconditionally. XXX: You must hold "conf->lock" when calling this
+ * function! */
+static int camqp_flush_locked (camqp_config_t *conf, /* {{{ */
+        cdtime_t timeout)
+{
+    int status;
+
+    if (conf->send_buffer_fill == 0)
+        return (0);
+
+    if ((timeout > 0)
+            && ((conf->send_buffer_init_time + timeout) > cdtime ()))
+        return (0);
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        status = format_json_finalize (conf->send_buffer,
+                &conf->send_buffer_fill, &conf->send_buffer_free);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_json_finalize failed.");
+            camqp_reset_buffer (conf);
+            return (status);
+        }
+    }
+
+    status = camqp_write_locked (conf, conf->send_buffer,
+            (conf->routing_key != NULL)
+            ? conf->routing_key : CAMQP_BATCH_ROUTING_KEY);
+    camqp_reset_buffer (conf);
+
+    return (status);
+} /* }}} int camqp_flush_locked */
+
+static int camqp_flush (cdtime_t timeout, /* {{{ */
+        const char __attribute__((unused)) *identifier,
+        user_data_t *user_data)
+{
+    camqp_config_t *conf = user_data->data;
+    int status;
+
+    pthread_mutex_lock (&conf->lock);
+    status = camqp_flush_locked (conf, timeout);
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_flush */
+
+/* Adds the value list to the batch: JSON messages hold an array of value
+ * lists, "Command" messages one PUTVAL command per line. XXX: You must hold
+ * "conf->lock" when calling this function! */
+static int camqp_batch_add_locked (const data_set_t *ds, /* {{{ */
+        const value_list_t *vl, camqp_config_t *conf)
+{
+    char command[4096];
+    size_t command_len = 0;
+    int status;
+
+    if (conf->format == CAMQP_FORMAT_JSON)
+    {
+        status = format_json_value_list (conf->send_buffer,
+                &conf->send_buffer_fill, &conf->send_buffer_free,
+                ds, vl, conf->store_rates);
+        if (status == (-ENOMEM))
+        {
+            camqp_flush_locked (conf, /* timeout = */ 0);
+            status = format_json_value_list (conf->send_buffer,
+                    &conf->send_buffer_fill, &conf->send_buffer_free,
+                    ds, vl, conf->store_rates);
+        }
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: format_json_value_list failed with "
+                    "status %i.", status);
+            return (status);
+        }
+    }
+    else
+    {
+        status = create_putval (command, sizeof (command) - 1, ds, vl);
+        if (status != 0)
+        {
+            ERROR ("amqp plugin: create_putval failed with status %i.",
+                    status);
+            return (status);
+        }
+        command_len = strlen (command);
+        command[command_len] = '\n';
+        command_len++;
+        command[command_len] = 0;
+
+        if (command_len >= conf->send_buffer_free)
+            camqp_flush_locked (conf, /* timeout = */ 0);
+        assert (command_len < conf->send_buffer_free);
+
+        memcpy (conf->send_buffer + conf->send_buffer_fill,
+                command, command_len + 1);
+        conf->send_buffer_fill += command_len;
+        conf->send_buffer_free -= command_len;
+    }
+
+    if (conf->send_buffer_init_time == 0)
+        conf->send_buffer_init_time = cdtime ();
+
+    return (0);
+} /* }}} int camqp_batch_add_locked */
+
+static int camqp_batch_add (const data_set_t *ds, /* {{{ */
+        const value_list_t *vl, camqp_config_t *conf)
+{
+    int status;
+
+    pthread_mutex_lock (&conf->lock);
+
+    status = camqp_batch_add_locked (ds, vl, conf);
+    if ((status == 0) && (conf->max_delay > 0))
+        status = camqp_flush_locked (conf, conf->max_delay);
+
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_batch_add */
+
+/* Batch write callback: publishes all value lists handed in by the daemon as
+ * one message, unless that exceeds "MaxMessageSize". */
+static int camqp_write_values (const data_set_t **ds, /* {{{ */
+        const value_list_t **vl, size_t num, user_data_t *user_data)
+{
+    camqp_config_t *conf = user_data->data;
+    size_t i;
+    int status = 0;
+
+    pthread_mutex_lock (&conf->lock);
+    for (i = 0; i < num; i++)
+    {
+        int tmp = camqp_batch_add_locked (ds[i], vl[i], conf);
+        if (tmp != 0)
+            status = tmp;
+    }
+    if (camqp_flush_locked (conf, /* timeout = */ 0) != 0)
+        status = -1;
+    pthread_mutex_unlock (&conf->lock);
+
+    return (status);
+} /* }}} int camqp_write_values */
+
 static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         user_data_t *user_data)
 {
@@ -680,6 +914,9 @@ static int camqp_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     if ((ds == NULL) || (vl == NULL) || (conf == NULL))
         return (EINVAL);
 
+    if (conf->send_buffer != NULL)
+        return (camqp_batch_add (ds, vl, conf));
+
     memset (buffer, 0, sizeof (buffer));
 
     if (conf->routing_key != NULL)
@@ -796,6 +1033,11 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
     /* publish only */
     conf->delivery_mode = CAMQP_DM_VOLATILE;
     conf->store_rates = 0;
+    conf->max_message_size = 0;
+    conf->max_delay = 0;
+    conf->batch_size = 0;
+    conf->batch_timeout = 0;
+    conf->send_buffer = NULL;
     /* subscribe only */
     conf->exchange_type = NULL;
     conf->queue = NULL;
@@ -853,6 +1095,21 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
             status = cf_util_get_boolean (child, &conf->store_rates);
         else if ((strcasecmp ("Format", child->key) == 0) && publish)
             status = camqp_config_set_format (child, conf);
+        else if ((strcasecmp ("MaxMessageSize", child->key) == 0) && publish)
+        {
+            int tmp = 0;
+            status = cf_util_get_int (child, &tmp);
+            if ((status == 0) && (tmp > 0))
+                conf->max_message_size = (size_t) tmp;
+            else
+                conf->max_message_size = 0;
+        }
+        else if ((strcasecmp ("MaxDelay", child->key) == 0) && publish)
+            status = cf_util_get_cdtime (child, &conf->max_delay);
+        else if ((strcasecmp ("BatchSize", child->key) == 0) && publish)
+            status = cf_util_get_int (child, &conf->batch_size);
+        else if ((strcasecmp ("BatchTimeout", child->key) == 0) && publish)
+            status = cf_util_get_cdtime (child, &conf->batch_timeout);
         else
             WARNING ("amqp plugin: Ignoring unknown "
                     "configuration option \"%s\".", child->key);
@@ -873,6 +1130,31 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
     }
 
+    /* Batches from the daemon are assembled in the send buffer, too. */
+    if ((status == 0) && (conf->batch_size > 0)
+            && (conf->max_message_size == 0))
+        conf->max_message_size = CAMQP_BATCH_MESSAGE_SIZE;
+
+    if ((status == 0) && (conf->max_message_size > 0))
+    {
+        if (conf->max_message_size < CAMQP_MIN_MESSAGE_SIZE)
+        {
+            WARNING ("amqp plugin: MaxMessageSize %zu is too small. "
+                    "Using %i instead.", conf->max_message_size,
+                    CAMQP_MIN_MESSAGE_SIZE);
+            conf->max_message_size = CAMQP_MIN_MESSAGE_SIZE;
+        }
+
+        conf->send_buffer = malloc (conf->max_message_size);
+        if (conf->send_buffer == NULL)
+        {
+            ERROR ("amqp plugin: malloc failed.");
+            status = ENOMEM;
+        }
+        else
+            camqp_reset_buffer (conf);
+    }
+
     if (status != 0)
     {
         camqp_config_free (conf);
@@ -892,12 +1174,23 @@ static int camqp_config_connection (oconfig_item_t *ci, /* {{{ */
 
         ssnprintf (cbname, sizeof (cbname), "amqp/%s", conf->name);
 
-        status = plugin_register_write (cbname, camqp_write, &ud);
+        if (conf->batch_size > 0)
+            status = plugin_register_write_batch (cbname, camqp_write_values,
+                    (size_t) conf->batch_size, conf->batch_timeout, &ud);
+        else
+            status = plugin_register_write (cbname, camqp_write, &ud);
         if (status != 0)
         {
             camqp_config_free (conf);
             return (status);
         }
+
+        /* The write callback owns "conf". */
+        if (conf->send_buffer != NULL)
+        {
+            ud.free_func = NULL;
+            plugin_register_flush (cbname, camqp_flush, &ud);
+        }
     }
     else
     {
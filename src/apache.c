@@ -28,6 +28,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 
@@ -37,6 +38,27 @@ enum server_enum
 	LIGHTTPD
 };
 
+/* The response is parsed while it is received, so it is never stored. The
+ * key of each line, up to the colon, and its value are collected in small
+ * buffers; the characters of the `Scoreboard' line are counted right away. */
+enum apache_parse_e
+{
+	PARSE_KEY = 0,
+	PARSE_VALUE,
+	PARSE_SCOREBOARD,
+	PARSE_SKIP
+};
+
+#define APACHE_KEY_SIZE   32
+#define APACHE_VALUE_SIZE 64
+
+/* Bits of `apache_s.have'. */
+#define HAVE_REQUESTS   0x01
+#define HAVE_BYTES      0x02
+#define HAVE_BUSY       0x04
+#define HAVE_IDLE       0x08
+#define HAVE_SCOREBOARD 0x10
+
 struct apache_s
 {
 	int server_type;
@@ -49,17 +71,33 @@ struct apache_s
 	int   verify_host;
 	char *cacert;
 	char *server; /* user specific server type */
-	char *apache_buffer;
 	char apache_curl_error[CURL_ERROR_SIZE];
-	size_t apache_buffer_size;
-	size_t apache_buffer_fill;
 	CURL *curl;
+
+	/* State of the response being received. */
+	int parse_state;
+	char key[APACHE_KEY_SIZE];
+	size_t key_len;
+	char value[APACHE_VALUE_SIZE];
+	size_t value_len;
+
+	/* What has been parsed so far. `scoreboard' counts each character of
+	 * the `Scoreboard' line. */
+	int have;
+	derive_t requests;
+	derive_t bytes;
+	gauge_t busy;
+	gauge_t idle;
+	uint32_t scoreboard[256];
+
+	struct apache_s *next;
 }; /* apache_s */
 
 typedef struct apache_s apache_t;
 
-/* TODO: Remove this prototype */
-static int apache_read_host (user_data_t *user_data);
+/* All instances are fetched at the same time with one multi handle. */
+static apache_t *apache_list = NULL;
+static ucm_t *apache_multi = NULL;
 
 static void apache_free (apache_t *st)
 {
@@ -73,18 +111,65 @@ static void apache_free (apache_t *st)
 	sfree (st->pass);
 	sfree (st->cacert);
 	sfree (st->server);
-	sfree (st->apache_buffer);
 	if (st->curl) {
 		curl_easy_cleanup(st->curl);
 		st->curl = NULL;
 	}
+	sfree (st);
 } /* apache_free */
 
+/* Handles the line whose key and value have been collected. */
+static void apache_parse_line (apache_t *st) /* {{{ */
+{
+	const char *key = st->key;
+	const char *value = st->value;
+
+	if (st->parse_state != PARSE_VALUE)
+		return;
+
+	st->key[st->key_len] = 0;
+	st->value[st->value_len] = 0;
+
+	if (strcmp (key, "Total Accesses") == 0)
+	{
+		st->requests = (derive_t) strtoll (value, NULL, 10);
+		st->have |= HAVE_REQUESTS;
+	}
+	else if (strcmp (key, "Total kBytes") == 0)
+	{
+		st->bytes = 1024LL * (derive_t) strtoll (value, NULL, 10);
+		st->have |= HAVE_BYTES;
+	}
+	else if ((strcmp (key, "BusyServers") == 0) /* Apache 1.* */
+			|| (strcmp (key, "BusyWorkers") == 0) /* Apache 2.* */)
+	{
+		st->busy = (gauge_t) atol (value);
+		st->have |= HAVE_BUSY;
+	}
+	else if ((strcmp (key, "IdleServers") == 0) /* Apache 1.x */
+			|| (strcmp (key, "IdleWorkers") == 0) /* Apache 2.x */)
+	{
+		st->idle = (gauge_t) atol (value);
+		st->have |= HAVE_IDLE;
+	}
+} /* }}} void apache_parse_line */
+
+static void apache_parse_reset (apache_t *st) /* {{{ */
+{
+	st->parse_state = PARSE_KEY;
+	st->key_len = 0;
+	st->value_len = 0;
+	st->have = 0;
+	memset (st->scoreboard, 0, sizeof (st->scoreboard));
+} /* }}} void apache_parse_reset */
+
 static size_t apache_curl_callback (void *buf, size_t size, size_t nmemb,
 		void *user_data)
 {
 	size_t len = size * nmemb;
+	const unsigned char *ptr = buf;
 	apache_t *st;
+	size_t i;
 
 	st = user_data;
 	if (st == NULL)
@@ -94,27 +179,58 @@ static size_t apache_curl_callback (void *buf, size_t size, size_t nmemb,
 		return (0);
 	}
 
-	if (len <= 0)
-		return (len);
-
-	if ((st->apache_buffer_fill + len) >= st->apache_buffer_size)
+	for (i = 0; i < len; i++)
 	{
-		char *temp;
+		unsigned char c = ptr[i];
 
-		temp = (char *) realloc (st->apache_buffer,
-				st->apache_buffer_fill + len + 1);
-		if (temp == NULL)
+		if ((c == '\n') || (c == '\r'))
 		{
-			ERROR ("apache plugin: realloc failed.");
-			return (0);
+			apache_parse_line (st);
+			st->parse_state = PARSE_KEY;
+			st->key_len = 0;
+			st->value_len = 0;
+			continue;
 		}
-		st->apache_buffer = temp;
-		st->apache_buffer_size = st->apache_buffer_fill + len + 1;
-	}
 
-	memcpy (st->apache_buffer + st->apache_buffer_fill, (char *) buf, len);
-	st->apache_buffer_fill += len;
-	st->apache_buffer[st->apache_buffer_fill] = 0;
+		switch (st->parse_state)
+		{
+			case PARSE_KEY:
+				if (c != ':')
+				{
+					if (st->key_len >= (sizeof (st->key) - 1))
+						st->parse_state = PARSE_SKIP;
+					else
+						st->key[st->key_len++] = (char) c;
+					break;
+				}
+
+				st->key[st->key_len] = 0;
+				if (strcmp (st->key, "Scoreboard") == 0)
+				{
+					st->parse_state = PARSE_SCOREBOARD;
+					st->have |= HAVE_SCOREBOARD;
+				}
+				else
+					st->parse_state = PARSE_VALUE;
+				break;
+
+			case PARSE_VALUE:
+				if ((st->value_len == 0) && ((c == ' ') || (c == '\t')))
+					break;
+				if (st->value_len >= (sizeof (st->value) - 1))
+					st->parse_state = PARSE_SKIP;
+				else
+					st->value[st->value_len++] = (char) c;
+				break;
+
+			case PARSE_SCOREBOARD:
+				st->scoreboard[c]++;
+				break;
+
+			default: /* PARSE_SKIP */
+				break;
+		}
+	}
 
 	return (len);
 } /* int apache_curl_callback */
@@ -300,34 +416,25 @@ static int config_add (oconfig_item_t *ci)
 		status = -1;
 	}
 
-	if (status == 0)
-	{
-		user_data_t ud;
-		char callback_name[3*DATA_MAX_NAME_LEN];
-
-		memset (&ud, 0, sizeof (ud));
-		ud.data = st;
-		ud.free_func = (void *) apache_free;
-
-		memset (callback_name, 0, sizeof (callback_name));
-		ssnprintf (callback_name, sizeof (callback_name),
-				"apache/%s/%s",
-				(st->host != NULL) ? st->host : hostname_g,
-				(st->name != NULL) ? st->name : "default"),
-
-		status = plugin_register_complex_read (/* group = */ NULL,
-				/* name      = */ callback_name,
-				/* callback  = */ apache_read_host,
-				/* interval  = */ NULL,
-				/* user_data = */ &ud);
-	}
-
 	if (status != 0)
 	{
 		apache_free(st);
 		return (-1);
 	}
 
+	/* Keep the configured order. */
+	if (apache_list == NULL)
+	{
+		apache_list = st;
+	}
+	else
+	{
+		apache_t *last = apache_list;
+		while (last->next != NULL)
+			last = last->next;
+		last->next = st;
+	}
+
 	return (0);
 } /* int config_add */
 
@@ -453,170 +560,180 @@ static int init_host (apache_t *st) /* {{{ */
 	return (0);
 } /* }}} int init_host */
 
-static void submit_value (const char *type, const char *type_instance,
-		value_t value, apache_t *st)
+static int apache_init (void) /* {{{ */
 {
-	value_list_t vl = VALUE_LIST_INIT;
+	if (apache_list == NULL)
+	{
+		INFO ("apache plugin: No instances have been configured.");
+		return (-1);
+	}
 
-	vl.values = &value;
-	vl.values_len = 1;
+	apache_multi = ucm_create ();
+	if (apache_multi == NULL)
+		return (-1);
 
-	sstrncpy (vl.host, (st->host != NULL) ? st->host : hostname_g,
-			sizeof (vl.host));
+	return (0);
+} /* }}} int apache_init */
 
-	sstrncpy (vl.plugin, "apache", sizeof (vl.plugin));
-	if (st->name != NULL)
-		sstrncpy (vl.plugin_instance, st->name,
-				sizeof (vl.plugin_instance));
+struct apache_state_s
+{
+	unsigned char c;
+	const char *type_instance;
+};
+typedef struct apache_state_s apache_state_t;
+
+/*
+ * Scoreboard Key:
+ * "_" Waiting for Connection, "S" Starting up,
+ * "R" Reading Request for apache and read-POST for lighttpd,
+ * "W" Sending Reply, "K" Keepalive (read), "D" DNS Lookup,
+ * "C" Closing connection, "L" Logging, "G" Gracefully finishing,
+ * "I" Idle cleanup of worker, "." Open slot with no current process
+ * Lighttpd specific legends -
+ * "E" hard error, "." connect, "h" handle-request,
+ * "q" request-start, "Q" request-end, "s" response-start
+ * "S" response-end, "r" read
+ */
+static const apache_state_t apache_states[] =
+{
+	{ '.', "open"         },
+	{ '_', "waiting"      },
+	{ 'S', "starting"     },
+	{ 'R', "reading"      },
+	{ 'W', "sending"      },
+	{ 'K', "keepalive"    },
+	{ 'D', "dnslookup"    },
+	{ 'C', "closing"      },
+	{ 'L', "logging"      },
+	{ 'G', "finishing"    },
+	{ 'I', "idle_cleanup" }
+};
 
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (type_instance != NULL)
-		sstrncpy (vl.type_instance, type_instance,
-				sizeof (vl.type_instance));
+static const apache_state_t lighttpd_states[] =
+{
+	{ '.', "connect"        },
+	{ 'C', "close"          },
+	{ 'E', "hard_error"     },
+	{ 'r', "read"           },
+	{ 'R', "read_post"      },
+	{ 'W', "write"          },
+	{ 'h', "handle_request" },
+	{ 'q', "request_start"  },
+	{ 'Q', "request_end"    },
+	{ 's', "response_start" },
+	{ 'S', "response_end"   }
+};
 
-	plugin_dispatch_values (&vl);
-} /* void submit_value */
+#define APACHE_VALUES_MAX (4 + STATIC_ARRAY_SIZE (apache_states))
 
-static void submit_derive (const char *type, const char *type_instance,
-		derive_t c, apache_t *st)
+static void apache_add_value (value_list_t *vl, value_t *values, /* {{{ */
+		size_t *num, const value_list_t *template,
+		const char *type, const char *type_instance, value_t value)
 {
-	value_t v;
-	v.derive = c;
-	submit_value (type, type_instance, v, st);
-} /* void submit_derive */
+	value_list_t *v = vl + *num;
 
-static void submit_gauge (const char *type, const char *type_instance,
-		gauge_t g, apache_t *st)
+	*v = *template;
+	values[*num] = value;
+	v->values = values + *num;
+	v->values_len = 1;
+
+	sstrncpy (v->type, type, sizeof (v->type));
+	if (type_instance != NULL)
+		sstrncpy (v->type_instance, type_instance,
+				sizeof (v->type_instance));
+	else
+		v->type_instance[0] = 0;
+
+	(*num)++;
+} /* }}} void apache_add_value */
+
+/* Dispatches everything found in one response with a single call. */
+static void apache_submit (apache_t *st) /* {{{ */
 {
+	value_list_t template = VALUE_LIST_INIT;
+	value_list_t vl[APACHE_VALUES_MAX];
+	value_t values[APACHE_VALUES_MAX];
+	size_t num = 0;
 	value_t v;
-	v.gauge = g;
-	submit_value (type, type_instance, v, st);
-} /* void submit_gauge */
 
-static void submit_scoreboard (char *buf, apache_t *st)
-{
-	/*
-	 * Scoreboard Key:
-	 * "_" Waiting for Connection, "S" Starting up,
-	 * "R" Reading Request for apache and read-POST for lighttpd,
-	 * "W" Sending Reply, "K" Keepalive (read), "D" DNS Lookup,
-	 * "C" Closing connection, "L" Logging, "G" Gracefully finishing,
-	 * "I" Idle cleanup of worker, "." Open slot with no current process
-	 * Lighttpd specific legends -
-	 * "E" hard error, "." connect, "h" handle-request,
-	 * "q" request-start, "Q" request-end, "s" response-start
-	 * "S" response-end, "r" read
-	 */
-	long long open      = 0LL;
-	long long waiting   = 0LL;
-	long long starting  = 0LL;
-	long long reading   = 0LL;
-	long long sending   = 0LL;
-	long long keepalive = 0LL;
-	long long dnslookup = 0LL;
-	long long closing   = 0LL;
-	long long logging   = 0LL;
-	long long finishing = 0LL;
-	long long idle_cleanup = 0LL;
-
-	/* lighttpd specific */
-	long long hard_error     = 0LL;
-	long long lighttpd_read  = 0LL;
-	long long handle_request = 0LL;
-	long long request_start  = 0LL;
-	long long request_end    = 0LL;
-	long long response_start = 0LL;
-	long long response_end   = 0LL;
+	sstrncpy (template.host, (st->host != NULL) ? st->host : hostname_g,
+			sizeof (template.host));
+	sstrncpy (template.plugin, "apache", sizeof (template.plugin));
+	if (st->name != NULL)
+		sstrncpy (template.plugin_instance, st->name,
+				sizeof (template.plugin_instance));
 
-	int i;
-	for (i = 0; buf[i] != '\0'; i++)
-	{
-		if (buf[i] == '.') open++;
-		else if (buf[i] == '_') waiting++;
-		else if (buf[i] == 'S') starting++;
-		else if (buf[i] == 'R') reading++;
-		else if (buf[i] == 'W') sending++;
-		else if (buf[i] == 'K') keepalive++;
-		else if (buf[i] == 'D') dnslookup++;
-		else if (buf[i] == 'C') closing++;
-		else if (buf[i] == 'L') logging++;
-		else if (buf[i] == 'G') finishing++;
-		else if (buf[i] == 'I') idle_cleanup++;
-		else if (buf[i] == 'r') lighttpd_read++;
-		else if (buf[i] == 'h') handle_request++;
-		else if (buf[i] == 'E') hard_error++;
-		else if (buf[i] == 'q') request_start++;
-		else if (buf[i] == 'Q') request_end++;
-		else if (buf[i] == 's') response_start++;
-		else if (buf[i] == 'S') response_end++;
-	}
-
-	if (st->server_type == APACHE)
-	{
-		submit_gauge ("apache_scoreboard", "open"     , open, st);
-		submit_gauge ("apache_scoreboard", "waiting"  , waiting, st);
-		submit_gauge ("apache_scoreboard", "starting" , starting, st);
-		submit_gauge ("apache_scoreboard", "reading"  , reading, st);
-		submit_gauge ("apache_scoreboard", "sending"  , sending, st);
-		submit_gauge ("apache_scoreboard", "keepalive", keepalive, st);
-		submit_gauge ("apache_scoreboard", "dnslookup", dnslookup, st);
-		submit_gauge ("apache_scoreboard", "closing"  , closing, st);
-		submit_gauge ("apache_scoreboard", "logging"  , logging, st);
-		submit_gauge ("apache_scoreboard", "finishing", finishing, st);
-		submit_gauge ("apache_scoreboard", "idle_cleanup", idle_cleanup, st);
+	if (st->have & HAVE_REQUESTS)
+	{
+		v.derive = st->requests;
+		apache_add_value (vl, values, &num, &template,
+				"apache_requests", "", v);
 	}
-	else
+	if (st->have & HAVE_BYTES)
 	{
-		submit_gauge ("apache_scoreboard", "connect"       , open, st);
-		submit_gauge ("apache_scoreboard", "close"         , closing, st);
-		submit_gauge ("apache_scoreboard", "hard_error"    , hard_error, st);
-		submit_gauge ("apache_scoreboard", "read"          , lighttpd_read, st);
-		submit_gauge ("apache_scoreboard", "read_post"     , reading, st);
-		submit_gauge ("apache_scoreboard", "write"         , sending, st);
-		submit_gauge ("apache_scoreboard", "handle_request", handle_request, st);
-		submit_gauge ("apache_scoreboard", "request_start" , request_start, st);
-		submit_gauge ("apache_scoreboard", "request_end"   , request_end, st);
-		submit_gauge ("apache_scoreboard", "response_start", response_start, st);
-		submit_gauge ("apache_scoreboard", "response_end"  , response_end, st);
-	}
-}
-
-static int apache_read_host (user_data_t *user_data) /* {{{ */
-{
-	int i;
+		v.derive = st->bytes;
+		apache_add_value (vl, values, &num, &template,
+				"apache_bytes", "", v);
+	}
+	if (st->have & HAVE_BUSY)
+	{
+		v.gauge = st->busy;
+		apache_add_value (vl, values, &num, &template,
+				"apache_connections", NULL, v);
+	}
+	if (st->have & HAVE_IDLE)
+	{
+		v.gauge = st->idle;
+		apache_add_value (vl, values, &num, &template,
+				"apache_idle_workers", NULL, v);
+	}
 
-	char *ptr;
-	char *saveptr;
-	char *lines[16];
-	int   lines_num = 0;
+	if (st->have & HAVE_SCOREBOARD)
+	{
+		const apache_state_t *states;
+		size_t states_num;
+		size_t i;
 
-	char *fields[4];
-	int   fields_num;
+		if (st->server_type == APACHE)
+		{
+			states = apache_states;
+			states_num = STATIC_ARRAY_SIZE (apache_states);
+		}
+		else
+		{
+			states = lighttpd_states;
+			states_num = STATIC_ARRAY_SIZE (lighttpd_states);
+		}
 
-	apache_t *st;
+		for (i = 0; i < states_num; i++)
+		{
+			v.gauge = (gauge_t) st->scoreboard[states[i].c];
+			apache_add_value (vl, values, &num, &template,
+					"apache_scoreboard",
+					states[i].type_instance, v);
+		}
+	}
 
-	st = user_data->data;
+	if (num > 0)
+		plugin_dispatch_values_batch (vl, num);
+} /* }}} void apache_submit */
 
-	assert (st->url != NULL);
-	/* (Assured by `config_add') */
+static void apache_done (CURL *curl, CURLcode result, /* {{{ */
+		void *user_data)
+{
+	apache_t *st = user_data;
 
-	if (st->curl == NULL)
+	if (result != CURLE_OK)
 	{
-		int status;
-
-		status = init_host (st);
-		if (status != 0)
-			return (-1);
+		ERROR ("apache plugin: Fetching %s failed: %s", st->url,
+				(st->apache_curl_error[0] != 0)
+				? st->apache_curl_error
+				: curl_easy_strerror (result));
+		return;
 	}
-	assert (st->curl != NULL);
 
-	st->apache_buffer_fill = 0;
-	if (curl_easy_perform (st->curl) != 0)
-	{
-		ERROR ("apache: curl_easy_perform failed: %s",
-				st->apache_curl_error);
-		return (-1);
-	}
+	/* The last line may not end in a newline. */
+	apache_parse_line (st);
 
 	/* fallback - server_type to apache if not set at this time */
 	if (st->server_type == -1)
@@ -626,53 +743,60 @@ static int apache_read_host (user_data_t *user_data) /* {{{ */
 		st->server_type = APACHE;
 	}
 
-	ptr = st->apache_buffer;
-	saveptr = NULL;
-	while ((lines[lines_num] = strtok_r (ptr, "\n\r", &saveptr)) != NULL)
-	{
-		ptr = NULL;
-		lines_num++;
+	apache_submit (st);
+} /* }}} void apache_done */
 
-		if (lines_num >= 16)
-			break;
-	}
+static int apache_read (void) /* {{{ */
+{
+	apache_t *st;
 
-	for (i = 0; i < lines_num; i++)
+	for (st = apache_list; st != NULL; st = st->next)
 	{
-		fields_num = strsplit (lines[i], fields, 4);
+		assert (st->url != NULL);
+		/* (Assured by `config_add') */
 
-		if (fields_num == 3)
-		{
-			if ((strcmp (fields[0], "Total") == 0)
-					&& (strcmp (fields[1], "Accesses:") == 0))
-				submit_derive ("apache_requests", "",
-						atoll (fields[2]), st);
-			else if ((strcmp (fields[0], "Total") == 0)
-					&& (strcmp (fields[1], "kBytes:") == 0))
-				submit_derive ("apache_bytes", "",
-						1024LL * atoll (fields[2]), st);
-		}
-		else if (fields_num == 2)
+		if (st->curl == NULL)
 		{
-			if (strcmp (fields[0], "Scoreboard:") == 0)
-				submit_scoreboard (fields[1], st);
-			else if ((strcmp (fields[0], "BusyServers:") == 0) /* Apache 1.* */
-					|| (strcmp (fields[0], "BusyWorkers:") == 0) /* Apache 2.* */)
-				submit_gauge ("apache_connections", NULL, atol (fields[1]), st);
-			else if ((strcmp (fields[0], "IdleServers:") == 0) /* Apache 1.x */
-					|| (strcmp (fields[0], "IdleWorkers:") == 0) /* Apache 2.x */)
-				submit_gauge ("apache_idle_workers", NULL, atol (fields[1]), st);
+			if (init_host (st) != 0)
+				continue;
 		}
+		assert (st->curl != NULL);
+
+		apache_parse_reset (st);
+		st->apache_curl_error[0] = 0;
+
+		if (ucm_add (apache_multi, st->curl, apache_done, st) != 0)
+			ERROR ("apache plugin: Unable to fetch %s.", st->url);
 	}
 
-	st->apache_buffer_fill = 0;
+	/* All instances are polled at the same time. Whatever has not arrived
+	 * within one interval is given up on, so the next read starts on time. */
+	ucm_perform (apache_multi, interval_g);
+
+	return (0);
+} /* }}} int apache_read */
+
+static int apache_shutdown (void) /* {{{ */
+{
+	ucm_destroy (apache_multi);
+	apache_multi = NULL;
+
+	while (apache_list != NULL)
+	{
+		apache_t *next = apache_list->next;
+		apache_free (apache_list);
+		apache_list = next;
+	}
 
 	return (0);
-} /* }}} int apache_read_host */
+} /* }}} int apache_shutdown */
 
 void module_register (void)
 {
 	plugin_register_complex_config ("apache", config);
+	plugin_register_init ("apache", apache_init);
+	plugin_register_read ("apache", apache_read);
+	plugin_register_shutdown ("apache", apache_shutdown);
 } /* void module_register */
 
 /* vim: set sw=8 noet fdm=marker : */
@@ -0,0 +1,298 @@
+/**
+ * collectd - src/bench.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_hashtable.h"
+
+#include "bench.h"
+
+#include <stdarg.h>
+
+uint64_t bench_iterations = 0;
+uint64_t bench_dispatched = 0;
+
+/*
+ * Globals of the daemon
+ */
+char     hostname_g[DATA_MAX_NAME_LEN] = "localhost";
+cdtime_t interval_g = 0;
+int      timeout_g = 2;
+
+static data_source_t bench_ds_gauge[] = {
+	{ "value", DS_TYPE_GAUGE, NAN, NAN }
+};
+static data_source_t bench_ds_derive[] = {
+	{ "value", DS_TYPE_DERIVE, 0.0, NAN }
+};
+static data_source_t bench_ds_counter[] = {
+	{ "value", DS_TYPE_COUNTER, NAN, NAN }
+};
+static data_source_t bench_ds_if_octets[] = {
+	{ "rx", DS_TYPE_DERIVE, 0.0, NAN },
+	{ "tx", DS_TYPE_DERIVE, 0.0, NAN }
+};
+static data_source_t bench_ds_load[] = {
+	{ "shortterm", DS_TYPE_GAUGE, 0.0, 100.0 },
+	{ "midterm",   DS_TYPE_GAUGE, 0.0, 100.0 },
+	{ "longterm",  DS_TYPE_GAUGE, 0.0, 100.0 }
+};
+
+static data_set_t bench_data_sets[] = {
+	{ "gauge",     STATIC_ARRAY_SIZE (bench_ds_gauge),     bench_ds_gauge },
+	{ "derive",    STATIC_ARRAY_SIZE (bench_ds_derive),    bench_ds_derive },
+	{ "counter",   STATIC_ARRAY_SIZE (bench_ds_counter),   bench_ds_counter },
+	{ "if_octets", STATIC_ARRAY_SIZE (bench_ds_if_octets), bench_ds_if_octets },
+	{ "load",      STATIC_ARRAY_SIZE (bench_ds_load),      bench_ds_load }
+};
+
+void bench_init (int argc, char **argv, uint64_t default_iterations) /* {{{ */
+{
+	interval_g = TIME_T_TO_CDTIME_T (10);
+
+	bench_iterations = default_iterations;
+	if (argc > 1)
+	{
+		char *endptr = NULL;
+		unsigned long long tmp;
+
+		tmp = strtoull (argv[1], &endptr, 0);
+		if ((endptr == argv[1]) || (*endptr != 0) || (tmp == 0))
+		{
+			fprintf (stderr, "Usage: %s [<iterations>]\n", argv[0]);
+			exit (EXIT_FAILURE);
+		}
+		bench_iterations = (uint64_t) tmp;
+	}
+} /* }}} void bench_init */
+
+void bench_report (const char *name, uint64_t ops, /* {{{ */
+		cdtime_t elapsed)
+{
+	double seconds = CDTIME_T_TO_DOUBLE (elapsed);
+
+	if ((ops == 0) || (seconds <= 0.0))
+	{
+		printf ("  %-44s (too fast to measure)\n", name);
+		return;
+	}
+
+	printf ("  %-44s %14.0f ops/s %10.1f ns/op\n", name,
+			((double) ops) / seconds,
+			(seconds * 1000000000.0) / ((double) ops));
+	fflush (stdout);
+} /* }}} void bench_report */
+
+const data_set_t *bench_get_ds (const char *name) /* {{{ */
+{
+	const data_set_t *ds = plugin_get_ds (name);
+
+	if (ds == NULL)
+	{
+		fprintf (stderr, "bench: Unknown type: %s\n", name);
+		exit (EXIT_FAILURE);
+	}
+
+	return (ds);
+} /* }}} const data_set_t *bench_get_ds */
+
+/*
+ * Functions of the daemon used by the utilities
+ */
+void plugin_log (int level, const char *format, ...) /* {{{ */
+{
+	char msg[1024];
+	va_list ap;
+
+	/* Rejected values are expected in some of the benchmarks. */
+	if (level > LOG_WARNING)
+		return;
+
+	va_start (ap, format);
+	vsnprintf (msg, sizeof (msg), format, ap);
+	msg[sizeof (msg) - 1] = 0;
+	va_end (ap);
+
+	fprintf (stderr, "%s\n", msg);
+} /* }}} void plugin_log */
+
+const data_set_t *plugin_get_ds (const char *name) /* {{{ */
+{
+	size_t i;
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (bench_data_sets); i++)
+		if (strcmp (bench_data_sets[i].type, name) == 0)
+			return (bench_data_sets + i);
+
+	return (NULL);
+} /* }}} const data_set_t *plugin_get_ds */
+
+const vl_identifier_t *plugin_value_list_identifier ( /* {{{ */
+		const value_list_t *vl, vl_identifier_t *buffer)
+{
+	vl_identifier_t *ident;
+
+	if (vl == NULL)
+		return (NULL);
+
+	if (vl->identifier != NULL)
+	{
+		ident = vl->identifier;
+		if (ident->valid)
+			return (ident);
+	}
+	else if (buffer != NULL)
+		ident = buffer;
+	else
+		return (NULL);
+
+	if (FORMAT_VL (ident->name, sizeof (ident->name), vl) != 0)
+	{
+		ident->valid = 0;
+		return (NULL);
+	}
+	ident->hash = c_hashtable_hash_string (ident->name);
+	ident->valid = 1;
+
+	return (ident);
+} /* }}} const vl_identifier_t *plugin_value_list_identifier */
+
+int plugin_dispatch_values (value_list_t __attribute__((unused)) *vl)
+{
+	__sync_fetch_and_add (&bench_dispatched, 1);
+	return (0);
+}
+
+int plugin_dispatch_values_batch (value_list_t __attribute__((unused)) *vl,
+		size_t vl_num)
+{
+	__sync_fetch_and_add (&bench_dispatched, (uint64_t) vl_num);
+	return (0);
+}
+
+int plugin_dispatch_values_secure (const value_list_t __attribute__((unused)) *vl)
+{
+	__sync_fetch_and_add (&bench_dispatched, 1);
+	return (0);
+}
+
+int plugin_dispatch_notification (const notification_t __attribute__((unused)) *n)
+{
+	return (0);
+}
+
+int plugin_flush (const char __attribute__((unused)) *plugin,
+		cdtime_t __attribute__((unused)) timeout,
+		const char __attribute__((unused)) *identifier)
+{
+	return (0);
+}
+
+int plugin_dispatch_missing (const value_list_t __attribute__((unused)) *vl)
+{
+	return (0);
+}
+
+int plugin_phase_align (const char __attribute__((unused)) *name,
+		cdtime_t __attribute__((unused)) interval,
+		cdtime_t __attribute__((unused)) t,
+		cdtime_t __attribute__((unused)) *ret)
+{
+	return (-1);
+}
+
+const char *global_option_get (const char __attribute__((unused)) *option)
+{
+	return (NULL);
+}
+
+int global_option_set (const char __attribute__((unused)) *option,
+		const char __attribute__((unused)) *value)
+{
+	return (0);
+}
+
+/* Registering callbacks succeeds, but nothing is ever called. */
+int plugin_register_complex_config (const char __attribute__((unused)) *type,
+		int __attribute__((unused)) (*callback) (oconfig_item_t *))
+{
+	return (0);
+}
+
+int plugin_register_init (const char __attribute__((unused)) *name,
+		plugin_init_cb __attribute__((unused)) callback)
+{
+	return (0);
+}
+
+int plugin_register_read (const char __attribute__((unused)) *name,
+		int __attribute__((unused)) (*callback) (void))
+{
+	return (0);
+}
+
+int plugin_register_write (const char __attribute__((unused)) *name,
+		plugin_write_cb __attribute__((unused)) callback,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	return (0);
+}
+
+int plugin_register_flush (const char __attribute__((unused)) *name,
+		plugin_flush_cb __attribute__((unused)) callback,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	return (0);
+}
+
+int plugin_register_shutdown (const char __attribute__((unused)) *name,
+		plugin_shutdown_cb __attribute__((unused)) callback)
+{
+	return (0);
+}
+
+int plugin_register_notification (const char __attribute__((unused)) *name,
+		plugin_notification_cb __attribute__((unused)) callback,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	return (0);
+}
+
+int plugin_unregister_config (const char __attribute__((unused)) *name)
+{
+	return (0);
+}
+
+int plugin_unregister_init (const char __attribute__((unused)) *name)
+{
+	return (0);
+}
+
+int plugin_unregister_write (const char __attribute__((unused)) *name)
+{
+	return (0);
+}
+
+int plugin_unregister_shutdown (const char __attribute__((unused)) *name)
+{
+	return (0);
+}
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,49 @@
+/**
+ * collectd - src/bench.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef BENCH_H
+#define BENCH_H 1
+
+/*
+ * Helpers for the microbenchmarks built by `make bench'. The benchmarks link
+ * the utilities they measure directly; `bench.c' provides the parts of the
+ * daemon those utilities call, i.e. logging, the data sets of a few types and
+ * dispatch functions which only count the values.
+ */
+
+#include "collectd.h"
+#include "plugin.h"
+#include "utils_time.h"
+
+/* Number of iterations: the first command line argument, if given, or the
+ * default passed to `bench_init'. */
+extern uint64_t bench_iterations;
+
+/* Number of values passed to the `plugin_dispatch_*' functions. */
+extern uint64_t bench_dispatched;
+
+void bench_init (int argc, char **argv, uint64_t default_iterations);
+
+/* Prints the throughput of `ops' operations which took `elapsed'. */
+void bench_report (const char *name, uint64_t ops, cdtime_t elapsed);
+
+/* Returns the data set of `name', one of the types of `bench.c'. Exits if the
+ * type is unknown. */
+const data_set_t *bench_get_ds (const char *name);
+
+#endif /* BENCH_H */
@@ -0,0 +1,171 @@
+/**
+ * collectd - src/bench_avltree.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Inserts, looks up and iterates over identifier-like keys in the AVL tree,
+ * and does the same with the hash table for comparison. The argument is the
+ * number of keys.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_avltree.h"
+#include "utils_hashtable.h"
+
+#include "bench.h"
+
+/* Look-ups are repeated until about this many have been done. */
+#define BENCH_LOOKUPS 2000000
+
+static char **bench_keys_create (uint64_t num) /* {{{ */
+{
+	char **keys;
+	uint64_t seed = 42;
+	uint64_t i;
+
+	keys = calloc ((size_t) num, sizeof (*keys));
+	if (keys == NULL)
+		exit (EXIT_FAILURE);
+
+	for (i = 0; i < num; i++)
+	{
+		char buffer[6 * DATA_MAX_NAME_LEN];
+
+		ssnprintf (buffer, sizeof (buffer),
+				"host%"PRIu64"/plugin%"PRIu64"-%"PRIu64"/gauge-%"PRIu64,
+				i % 97, i % 13, i / 1261, i % 1261);
+		keys[i] = strdup (buffer);
+		if (keys[i] == NULL)
+			exit (EXIT_FAILURE);
+	}
+
+	/* Shuffle, so that the keys are not inserted in order. The generator
+	 * is seeded with a constant to make runs comparable. */
+	for (i = num - 1; i > 0; i--)
+	{
+		uint64_t j;
+		char *tmp;
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		j = (seed >> 33) % (i + 1);
+
+		tmp = keys[i];
+		keys[i] = keys[j];
+		keys[j] = tmp;
+	}
+
+	return (keys);
+} /* }}} char **bench_keys_create */
+
+static void bench_avltree (char **keys, uint64_t num) /* {{{ */
+{
+	c_avl_tree_t *tree;
+	c_avl_iterator_t *iter;
+	uint64_t rounds = (BENCH_LOOKUPS + num - 1) / num;
+	uint64_t found = 0;
+	uint64_t n;
+	uint64_t i;
+	cdtime_t start;
+	void *key;
+	void *value;
+
+	tree = c_avl_create ((void *) strcmp);
+	if (tree == NULL)
+		exit (EXIT_FAILURE);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		c_avl_insert (tree, keys[i], keys[i]);
+	bench_report ("c_avl_insert", num, cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (n = 0; n < rounds; n++)
+		for (i = 0; i < num; i++)
+			if (c_avl_get (tree, keys[i], &value) == 0)
+				found++;
+	bench_report ("c_avl_get", rounds * num, cdtime_monotonic () - start);
+	if (found != rounds * num)
+		fprintf (stderr, "bench_avltree: c_avl_get missed keys.\n");
+
+	start = cdtime_monotonic ();
+	for (n = 0; n < rounds; n++)
+	{
+		iter = c_avl_get_iterator (tree);
+		while (c_avl_iterator_next (iter, &key, &value) == 0)
+			/* do nothing */;
+		c_avl_iterator_destroy (iter);
+	}
+	bench_report ("c_avl_iterator_next", rounds * num,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	while (c_avl_pick (tree, &key, &value) == 0)
+		/* do nothing */;
+	bench_report ("c_avl_pick", num, cdtime_monotonic () - start);
+
+	c_avl_destroy (tree);
+} /* }}} void bench_avltree */
+
+static void bench_hashtable (char **keys, uint64_t num) /* {{{ */
+{
+	c_hashtable_t *h;
+	uint64_t rounds = (BENCH_LOOKUPS + num - 1) / num;
+	uint64_t n;
+	uint64_t i;
+	cdtime_t start;
+	void *value;
+
+	h = c_hashtable_create (c_hashtable_hash_string, (void *) strcmp);
+	if (h == NULL)
+		exit (EXIT_FAILURE);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		c_hashtable_insert (h, keys[i], keys[i]);
+	bench_report ("c_hashtable_insert", num, cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (n = 0; n < rounds; n++)
+		for (i = 0; i < num; i++)
+			c_hashtable_get (h, keys[i], &value);
+	bench_report ("c_hashtable_get", rounds * num,
+			cdtime_monotonic () - start);
+
+	c_hashtable_destroy (h);
+} /* }}} void bench_hashtable */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	char **keys;
+	uint64_t i;
+
+	bench_init (argc, argv, 100000);
+	keys = bench_keys_create (bench_iterations);
+
+	printf ("utils_avltree, %"PRIu64" keys:\n", bench_iterations);
+	bench_avltree (keys, bench_iterations);
+	bench_hashtable (keys, bench_iterations);
+
+	for (i = 0; i < bench_iterations; i++)
+		sfree (keys[i]);
+	sfree (keys);
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
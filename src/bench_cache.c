@@ -0,0 +1,183 @@
+/**
+ * collectd - src/bench_cache.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Updates the value cache from several threads at once: with identifiers of
+ * their own, as with several read threads, and with identifiers shared by
+ * all threads, as with several network dispatch threads receiving the same
+ * hosts. The argument is the number of updates per thread.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cache.h"
+
+#include "bench.h"
+
+#include <pthread.h>
+
+#define BENCH_IDENTIFIERS 10000
+#define BENCH_THREADS_MAX 8
+#define BENCH_BATCH_SIZE  64
+
+struct bench_thread_s
+{
+	pthread_t thread;
+	value_list_t *vl;
+	value_t *values;
+	size_t vl_num;
+	_Bool batch;
+};
+typedef struct bench_thread_s bench_thread_t;
+
+static const data_set_t *bench_ds;
+/* Time of the next update of shared identifiers. */
+static cdtime_t bench_time;
+
+static void bench_thread_init (bench_thread_t *t, int index, /* {{{ */
+		_Bool shared)
+{
+	size_t i;
+
+	memset (t, 0, sizeof (*t));
+	t->vl_num = BENCH_IDENTIFIERS;
+	t->vl = calloc (t->vl_num, sizeof (*t->vl));
+	t->values = calloc (t->vl_num, sizeof (*t->values));
+	if ((t->vl == NULL) || (t->values == NULL))
+		exit (EXIT_FAILURE);
+
+	for (i = 0; i < t->vl_num; i++)
+	{
+		value_list_t *vl = t->vl + i;
+
+		vl->values = t->values + i;
+		vl->values_len = 1;
+		vl->interval = interval_g;
+		ssnprintf (vl->host, sizeof (vl->host), "host%zu", i % 100);
+		sstrncpy (vl->plugin, "bench", sizeof (vl->plugin));
+		ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+				"%i", shared ? 0 : index);
+		sstrncpy (vl->type, "gauge", sizeof (vl->type));
+		ssnprintf (vl->type_instance, sizeof (vl->type_instance),
+				"%zu", i / 100);
+	}
+} /* }}} void bench_thread_init */
+
+static void bench_thread_destroy (bench_thread_t *t) /* {{{ */
+{
+	sfree (t->vl);
+	sfree (t->values);
+} /* }}} void bench_thread_destroy */
+
+static void *bench_thread (void *arg) /* {{{ */
+{
+	bench_thread_t *t = arg;
+	const data_set_t *ds_list[BENCH_BATCH_SIZE];
+	uint64_t n;
+	size_t i;
+
+	for (i = 0; i < BENCH_BATCH_SIZE; i++)
+		ds_list[i] = bench_ds;
+
+	for (n = 0; n < bench_iterations; n += t->batch ? BENCH_BATCH_SIZE : 1)
+	{
+		size_t pos = (size_t) (n % t->vl_num);
+		size_t num = 1;
+
+		if (t->batch)
+		{
+			num = BENCH_BATCH_SIZE;
+			if (pos + num > t->vl_num)
+				num = t->vl_num - pos;
+		}
+
+		for (i = pos; i < pos + num; i++)
+		{
+			/* Times must increase per identifier. With shared
+			 * identifiers some updates still arrive out of order
+			 * and are rejected, like in the daemon. */
+			t->vl[i].time = __sync_add_and_fetch (&bench_time,
+					MS_TO_CDTIME_T (1));
+			t->vl[i].values[0].gauge = (gauge_t) n;
+		}
+
+		if (t->batch)
+			uc_update_batch (ds_list, t->vl + pos, NULL, num);
+		else
+			uc_update (bench_ds, t->vl + pos);
+	}
+
+	return (NULL);
+} /* }}} void *bench_thread */
+
+static void bench_run (const char *name, int threads_num, /* {{{ */
+		_Bool shared, _Bool batch)
+{
+	bench_thread_t threads[BENCH_THREADS_MAX];
+	char title[128];
+	cdtime_t start;
+	int i;
+
+	for (i = 0; i < threads_num; i++)
+	{
+		bench_thread_init (threads + i, i, shared);
+		threads[i].batch = batch;
+	}
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < threads_num; i++)
+		pthread_create (&threads[i].thread, NULL, bench_thread, threads + i);
+	for (i = 0; i < threads_num; i++)
+		pthread_join (threads[i].thread, NULL);
+
+	ssnprintf (title, sizeof (title), "%s, %i thread%s", name,
+			threads_num, (threads_num == 1) ? "" : "s");
+	bench_report (title, bench_iterations * (uint64_t) threads_num,
+			cdtime_monotonic () - start);
+
+	for (i = 0; i < threads_num; i++)
+		bench_thread_destroy (threads + i);
+} /* }}} void bench_run */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	int threads_num;
+
+	bench_init (argc, argv, 500000);
+	bench_ds = bench_get_ds ("gauge");
+	bench_time = cdtime ();
+	uc_init ();
+
+	printf ("utils_cache, %d identifiers per set, %"PRIu64" updates per "
+			"thread:\n", BENCH_IDENTIFIERS, bench_iterations);
+
+	for (threads_num = 1; threads_num <= BENCH_THREADS_MAX; threads_num *= 2)
+		bench_run ("uc_update private", threads_num, /* shared = */ 0,
+				/* batch = */ 0);
+	for (threads_num = 2; threads_num <= BENCH_THREADS_MAX; threads_num *= 2)
+		bench_run ("uc_update shared", threads_num, /* shared = */ 1,
+				/* batch = */ 0);
+	for (threads_num = 1; threads_num <= BENCH_THREADS_MAX; threads_num *= 4)
+		bench_run ("uc_update_batch private", threads_num,
+				/* shared = */ 0, /* batch = */ 1);
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
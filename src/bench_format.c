@@ -0,0 +1,160 @@
+/**
+ * collectd - src/bench_format.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Formats and parses values the way the write plugins and the text protocol
+ * do: `format_json_value_list', `parse_values', `format_name' and
+ * `escape_slashes'. The argument is the number of calls of each function.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_cache.h"
+#include "utils_format_json.h"
+
+#include "bench.h"
+
+static void bench_json (value_list_t *vl, int store_rates) /* {{{ */
+{
+	const data_set_t *ds = bench_get_ds (vl->type);
+	char buffer[4096];
+	uint64_t formatted = 0;
+	uint64_t i;
+	cdtime_t start;
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+	{
+		size_t fill = 0;
+		size_t avail = sizeof (buffer);
+
+		format_json_initialize (buffer, &fill, &avail);
+		if (format_json_value_list (buffer, &fill, &avail, ds, vl,
+					store_rates) == 0)
+			formatted++;
+		format_json_finalize (buffer, &fill, &avail);
+	}
+	bench_report (store_rates
+			? "format_json_value_list (StoreRates)"
+			: "format_json_value_list",
+			bench_iterations, cdtime_monotonic () - start);
+
+	if (formatted != bench_iterations)
+		fprintf (stderr, "bench_format: format_json_value_list failed.\n");
+} /* }}} void bench_json */
+
+static void bench_parse_values (void) /* {{{ */
+{
+	const data_set_t *ds = bench_get_ds ("load");
+	value_t values[3];
+	value_list_t vl = VALUE_LIST_INIT;
+	uint64_t i;
+	cdtime_t start;
+
+	vl.values = values;
+	vl.values_len = STATIC_ARRAY_SIZE (values);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+	{
+		/* `parse_values' modifies the buffer. */
+		char buffer[] = "1311622041.123:0.25:0.5:1.125";
+
+		parse_values (buffer, &vl, ds);
+	}
+	bench_report ("parse_values (3 values)", bench_iterations,
+			cdtime_monotonic () - start);
+} /* }}} void bench_parse_values */
+
+static void bench_format_name (const value_list_t *vl) /* {{{ */
+{
+	char name[6 * DATA_MAX_NAME_LEN];
+	uint64_t i;
+	cdtime_t start;
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+		FORMAT_VL (name, sizeof (name), vl);
+	bench_report ("format_name", bench_iterations,
+			cdtime_monotonic () - start);
+} /* }}} void bench_format_name */
+
+static void bench_escape_slashes_one (const char *name, /* {{{ */
+		const char *path)
+{
+	char buffer[DATA_MAX_NAME_LEN];
+	uint64_t i;
+	cdtime_t start;
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+	{
+		sstrncpy (buffer, path, sizeof (buffer));
+		escape_slashes (buffer, sizeof (buffer));
+	}
+	bench_report (name, bench_iterations, cdtime_monotonic () - start);
+} /* }}} void bench_escape_slashes_one */
+
+static void bench_escape_slashes (void) /* {{{ */
+{
+	bench_escape_slashes_one ("escape_slashes path (incl. copy)",
+			"/var/lib/collectd/rrd/localhost/df-root");
+	/* What `plugin_dispatch_values' usually sees. */
+	bench_escape_slashes_one ("escape_slashes clean (incl. copy)",
+			"if_octets-eth0.example.org");
+} /* }}} void bench_escape_slashes */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	value_t values[2];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	bench_init (argc, argv, 1000000);
+	uc_init ();
+
+	vl.values = values;
+	vl.values_len = STATIC_ARRAY_SIZE (values);
+	vl.interval = interval_g;
+	sstrncpy (vl.host, "host.example.com", sizeof (vl.host));
+	sstrncpy (vl.plugin, "interface", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, "eth0", sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "if_octets", sizeof (vl.type));
+
+	/* Two updates, so that the cache has a rate for `StoreRates'. */
+	values[0].derive = 1000;
+	values[1].derive = 2000;
+	vl.time = cdtime () - interval_g;
+	uc_update (bench_get_ds (vl.type), &vl);
+	values[0].derive = 123456789;
+	values[1].derive = 987654321;
+	vl.time = cdtime ();
+	uc_update (bench_get_ds (vl.type), &vl);
+
+	printf ("formatting and parsing, %"PRIu64" calls each:\n",
+			bench_iterations);
+	bench_json (&vl, /* store_rates = */ 0);
+	bench_json (&vl, /* store_rates = */ 1);
+	bench_parse_values ();
+	bench_format_name (&vl);
+	bench_escape_slashes ();
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
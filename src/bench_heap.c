@@ -0,0 +1,176 @@
+/**
+ * collectd - src/bench_heap.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Fills the heap with timestamps and empties it again, the way the cache's
+ * expiry heaps are used, and mixes both operations at a constant size. The
+ * same is done in place with an indexed heap, along with removing elements
+ * from the middle. The argument is the number of elements.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "utils_heap.h"
+
+#include "bench.h"
+
+struct bench_elem_s
+{
+	cdtime_t time;
+	size_t position;
+};
+typedef struct bench_elem_s bench_elem_t;
+
+static int bench_compare (const void *a, const void *b) /* {{{ */
+{
+	const cdtime_t *t0 = a;
+	const cdtime_t *t1 = b;
+
+	if (*t0 < *t1)
+		return (-1);
+	else if (*t0 > *t1)
+		return (1);
+	return (0);
+} /* }}} int bench_compare */
+
+static int bench_elem_compare (const void *a, const void *b) /* {{{ */
+{
+	return (bench_compare (&((const bench_elem_t *) a)->time,
+				&((const bench_elem_t *) b)->time));
+} /* }}} int bench_elem_compare */
+
+static size_t *bench_elem_position (void *ptr) /* {{{ */
+{
+	return (&((bench_elem_t *) ptr)->position);
+} /* }}} size_t *bench_elem_position */
+
+static int bench_indexed (uint64_t num, uint64_t seed) /* {{{ */
+{
+	c_heap_t *h;
+	bench_elem_t *elems;
+	uint64_t i;
+	cdtime_t start;
+
+	elems = calloc ((size_t) num, sizeof (*elems));
+	h = c_heap_create_indexed (bench_elem_compare, bench_elem_position);
+	if ((elems == NULL) || (h == NULL))
+	{
+		sfree (elems);
+		c_heap_destroy (h);
+		return (-1);
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		elems[i].time = (cdtime_t) (seed >> 20);
+		c_heap_insert (h, elems + i);
+	}
+
+	/* Reschedule the earliest element in place, like the next read of a
+	 * function. */
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+	{
+		bench_elem_t *e = c_heap_peek_root (h);
+
+		e->time += (cdtime_t) (seed >> 40) + 1;
+		c_heap_update (h, e);
+	}
+	bench_report ("c_heap_peek_root + c_heap_update", num,
+			cdtime_monotonic () - start);
+
+	/* Remove the elements in the order they were inserted, i.e. mostly from
+	 * the middle of the heap. */
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		c_heap_remove (h, elems + i);
+	bench_report ("c_heap_remove", num, cdtime_monotonic () - start);
+
+	if (c_heap_size (h) != 0)
+	{
+		fprintf (stderr, "bench_heap: %i elements left after removing "
+				"all of them.\n", c_heap_size (h));
+		c_heap_destroy (h);
+		sfree (elems);
+		return (-1);
+	}
+
+	c_heap_destroy (h);
+	sfree (elems);
+	return (0);
+} /* }}} int bench_indexed */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	c_heap_t *h;
+	cdtime_t *times;
+	uint64_t seed = 42;
+	uint64_t num;
+	uint64_t i;
+	cdtime_t start;
+
+	bench_init (argc, argv, 1000000);
+	num = bench_iterations;
+
+	times = calloc ((size_t) num, sizeof (*times));
+	h = c_heap_create (bench_compare);
+	if ((times == NULL) || (h == NULL))
+		return (EXIT_FAILURE);
+
+	for (i = 0; i < num; i++)
+	{
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		times[i] = (cdtime_t) (seed >> 20);
+	}
+
+	printf ("utils_heap, %"PRIu64" elements:\n", num);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		c_heap_insert (h, times + i);
+	bench_report ("c_heap_insert", num, cdtime_monotonic () - start);
+
+	/* Replace the earliest element by a later one, like a cache entry
+	 * being updated. */
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+	{
+		cdtime_t *t = c_heap_get_root (h);
+
+		*t += (cdtime_t) (seed >> 40) + 1;
+		c_heap_insert (h, t);
+	}
+	bench_report ("c_heap_get_root + c_heap_insert", num,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		c_heap_get_root (h);
+	bench_report ("c_heap_get_root", num, cdtime_monotonic () - start);
+
+	c_heap_destroy (h);
+	sfree (times);
+
+	if (bench_indexed (num, seed) != 0)
+		return (EXIT_FAILURE);
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,138 @@
+/**
+ * collectd - src/bench_meta_data.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Creates meta data objects with a few entries of each type, as plugins and
+ * the network plugin do, reads the entries and clones the objects. The
+ * argument is the number of objects.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "meta_data.h"
+
+#include "bench.h"
+
+#define BENCH_ENTRIES 8
+
+static const char *bench_keys[BENCH_ENTRIES] = {
+	"network:received", "network:time_sent", "csv:file", "rate",
+	"plugin:first", "plugin:second", "plugin:third", "plugin:fourth"
+};
+
+static void bench_fill (meta_data_t *md, uint64_t n) /* {{{ */
+{
+	meta_data_add_boolean (md, bench_keys[0], 1);
+	meta_data_add_unsigned_int (md, bench_keys[1], n);
+	meta_data_add_string (md, bench_keys[2], "/var/lib/collectd/csv");
+	meta_data_add_double (md, bench_keys[3], (double) n / 3.0);
+	meta_data_add_signed_int (md, bench_keys[4], (int64_t) n);
+	meta_data_add_signed_int (md, bench_keys[5], -((int64_t) n));
+	meta_data_add_string (md, bench_keys[6], "value");
+	meta_data_add_unsigned_int (md, bench_keys[7], n * 2);
+} /* }}} void bench_fill */
+
+static uint64_t bench_read (meta_data_t *md) /* {{{ */
+{
+	_Bool b = 0;
+	uint64_t u = 0;
+	int64_t s = 0;
+	double d = 0.0;
+	char *str = NULL;
+
+	meta_data_get_boolean (md, bench_keys[0], &b);
+	meta_data_get_unsigned_int (md, bench_keys[1], &u);
+	meta_data_get_string (md, bench_keys[2], &str);
+	sfree (str);
+	meta_data_get_double (md, bench_keys[3], &d);
+	meta_data_get_signed_int (md, bench_keys[4], &s);
+	meta_data_get_signed_int (md, bench_keys[5], &s);
+	meta_data_get_string (md, bench_keys[6], &str);
+	sfree (str);
+	meta_data_get_unsigned_int (md, bench_keys[7], &u);
+
+	return (u + (uint64_t) b);
+} /* }}} uint64_t bench_read */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	meta_data_t **mds;
+	uint64_t num;
+	uint64_t sum = 0;
+	uint64_t i;
+	cdtime_t start;
+
+	bench_init (argc, argv, 200000);
+	num = bench_iterations;
+
+	mds = calloc ((size_t) num, sizeof (*mds));
+	if (mds == NULL)
+		return (EXIT_FAILURE);
+
+	printf ("meta_data, %"PRIu64" objects with %i entries:\n",
+			num, BENCH_ENTRIES);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		mds[i] = meta_data_create ();
+	bench_report ("meta_data_create", num, cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		bench_fill (mds[i], i);
+	bench_report ("meta_data_add_*", num * BENCH_ENTRIES,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		sum += bench_read (mds[i]);
+	bench_report ("meta_data_get_*", num * BENCH_ENTRIES,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		sum += (uint64_t) meta_data_exists (mds[i], "missing");
+	bench_report ("meta_data_exists (missing key)", num,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+	{
+		meta_data_t *copy = meta_data_clone (mds[i]);
+
+		meta_data_destroy (mds[i]);
+		mds[i] = copy;
+	}
+	bench_report ("meta_data_clone + meta_data_destroy", num,
+			cdtime_monotonic () - start);
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < num; i++)
+		meta_data_destroy (mds[i]);
+	bench_report ("meta_data_destroy", num, cdtime_monotonic () - start);
+
+	sfree (mds);
+
+	/* Keeps the compiler from dropping the reads. */
+	if (sum == 0)
+		fprintf (stderr, "bench_meta_data: No entries read.\n");
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
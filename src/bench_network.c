@@ -0,0 +1,280 @@
+/**
+ * collectd - src/bench_network.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Encodes value lists with `add_to_buffer' and parses the resulting packets
+ * with `parse_packet', plain and, if the network plugin is built with
+ * libgcrypt, signed and encrypted. The plugin is included, so that its
+ * static functions can be called without sockets. The argument is the number
+ * of value lists and packets.
+ */
+
+#include "network.c"
+
+#include "bench.h"
+
+#define BENCH_IDENTIFIERS 1000
+
+static value_list_t *bench_vl = NULL;
+static value_t      *bench_values = NULL;
+
+static void bench_vl_create (void) /* {{{ */
+{
+	cdtime_t now = cdtime ();
+	size_t i;
+
+	bench_vl = calloc (BENCH_IDENTIFIERS, sizeof (*bench_vl));
+	bench_values = calloc (2 * BENCH_IDENTIFIERS, sizeof (*bench_values));
+	if ((bench_vl == NULL) || (bench_values == NULL))
+		exit (EXIT_FAILURE);
+
+	/* Ten plugins of five hosts, as a client sending all its values in
+	 * one interval would. */
+	for (i = 0; i < BENCH_IDENTIFIERS; i++)
+	{
+		value_list_t *vl = bench_vl + i;
+		_Bool octets = ((i % 4) == 0);
+
+		vl->values = bench_values + 2 * i;
+		vl->values_len = octets ? 2 : 1;
+		vl->values[0].derive = (derive_t) (i * 1000);
+		vl->values[1].derive = (derive_t) (i * 2000);
+		vl->time = now;
+		vl->interval = interval_g;
+		ssnprintf (vl->host, sizeof (vl->host), "host%zu.example.com",
+				i / 200);
+		ssnprintf (vl->plugin, sizeof (vl->plugin), "plugin%zu",
+				(i / 20) % 10);
+		ssnprintf (vl->plugin_instance, sizeof (vl->plugin_instance),
+				"%zu", (i / 4) % 5);
+		sstrncpy (vl->type, octets ? "if_octets" : "derive",
+				sizeof (vl->type));
+		ssnprintf (vl->type_instance, sizeof (vl->type_instance),
+				"%zu", i % 4);
+	}
+} /* }}} void bench_vl_create */
+
+static void bench_add_to_buffer (void) /* {{{ */
+{
+	char buffer[1452];
+	value_list_t vl_def;
+	string_table_t st;
+	size_t fill = 0;
+	uint64_t packets = 1;
+	uint64_t i;
+	cdtime_t start;
+
+	memset (&vl_def, 0, sizeof (vl_def));
+	st.strings_num = 0;
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+	{
+		const value_list_t *vl = bench_vl + (i % BENCH_IDENTIFIERS);
+		const data_set_t *ds = bench_get_ds (vl->type);
+		int status;
+
+		status = add_to_buffer (buffer + fill, (int) (sizeof (buffer) - fill),
+				&vl_def, &st, ds, vl);
+		if (status < 0)
+		{
+			/* The packet is full: start the next one. */
+			memset (&vl_def, 0, sizeof (vl_def));
+			st.strings_num = 0;
+			fill = 0;
+			packets++;
+
+			status = add_to_buffer (buffer, (int) sizeof (buffer),
+					&vl_def, &st, ds, vl);
+			if (status < 0)
+			{
+				fprintf (stderr, "bench_network: add_to_buffer failed.\n");
+				exit (EXIT_FAILURE);
+			}
+		}
+		fill += (size_t) status;
+	}
+	bench_report ("add_to_buffer", bench_iterations,
+			cdtime_monotonic () - start);
+	printf ("  (%.1f value lists per %zu byte packet)\n",
+			((double) bench_iterations) / ((double) packets),
+			sizeof (buffer));
+} /* }}} void bench_add_to_buffer */
+
+/* Fills `buffer' with as many value lists as fit. Returns the size of the
+ * packet. */
+static size_t bench_packet_create (char *buffer, size_t buffer_size, /* {{{ */
+		size_t *ret_vl_num)
+{
+	value_list_t vl_def;
+	string_table_t st;
+	size_t fill = 0;
+	size_t i;
+
+	memset (&vl_def, 0, sizeof (vl_def));
+	st.strings_num = 0;
+
+	for (i = 0; i < BENCH_IDENTIFIERS; i++)
+	{
+		int status;
+
+		status = add_to_buffer (buffer + fill, (int) (buffer_size - fill),
+				&vl_def, &st, bench_get_ds (bench_vl[i].type),
+				bench_vl + i);
+		if (status < 0)
+			break;
+		fill += (size_t) status;
+	}
+
+	*ret_vl_num = i;
+	return (fill);
+} /* }}} size_t bench_packet_create */
+
+static void bench_parse (const char *name, sockent_t *se, /* {{{ */
+		const char *packet, size_t packet_size, size_t vl_num)
+{
+	char buffer[BUFF_SIG_SIZE + 1452];
+	char title[128];
+	uint64_t dispatched = bench_dispatched;
+	uint64_t i;
+	cdtime_t start;
+
+	start = cdtime_monotonic ();
+	for (i = 0; i < bench_iterations; i++)
+	{
+		/* Decryption works in place. */
+		memcpy (buffer, packet, packet_size);
+		parse_packet (se, buffer, packet_size, /* flags = */ 0,
+				/* username = */ NULL);
+	}
+	ssnprintf (title, sizeof (title), "parse_packet %s (%zu values)",
+			name, vl_num);
+	bench_report (title, bench_iterations, cdtime_monotonic () - start);
+
+	if (bench_dispatched - dispatched != bench_iterations * vl_num)
+		fprintf (stderr, "bench_network: parse_packet %s dispatched "
+				"%"PRIu64" instead of %"PRIu64" value lists.\n",
+				name, bench_dispatched - dispatched,
+				bench_iterations * vl_num);
+} /* }}} void bench_parse */
+
+#if HAVE_LIBGCRYPT
+static char bench_auth_file[] = "/tmp/bench_network.XXXXXX";
+
+static void bench_crypto_init (sockent_t *client, sockent_t *server) /* {{{ */
+{
+	const char *line = "bench: secret\n";
+	int fd;
+
+	gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+	gcry_control (GCRYCTL_INIT_SECMEM, 32768, 0);
+	gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+	client->data.client.security_level = SECURITY_LEVEL_SIGN;
+	client->data.client.username = strdup ("bench");
+	client->data.client.password = strdup ("secret");
+	if ((client->data.client.username == NULL)
+			|| (client->data.client.password == NULL))
+		exit (EXIT_FAILURE);
+	gcry_md_hash_buffer (GCRY_MD_SHA256, client->data.client.password_hash,
+			client->data.client.password,
+			strlen (client->data.client.password));
+
+	fd = mkstemp (bench_auth_file);
+	if ((fd < 0) || (write (fd, line, strlen (line)) != (ssize_t) strlen (line)))
+	{
+		fprintf (stderr, "bench_network: Writing %s failed.\n",
+				bench_auth_file);
+		exit (EXIT_FAILURE);
+	}
+	close (fd);
+
+	/* Set up like `sockent_open' does, without opening sockets. */
+	server->data.server.auth_file = strdup (bench_auth_file);
+	server->data.server.userdb = fbh_create (bench_auth_file);
+	server->data.server.keys = c_avl_create ((void *) strcmp);
+	if ((server->data.server.userdb == NULL)
+			|| (server->data.server.keys == NULL))
+		exit (EXIT_FAILURE);
+	server->data.server.keys_generation =
+		fbh_generation (server->data.server.userdb);
+	pthread_mutex_init (&server->data.server.keys_lock, /* attr = */ NULL);
+} /* }}} void bench_crypto_init */
+#endif /* HAVE_LIBGCRYPT */
+
+int main (int argc, char **argv) /* {{{ */
+{
+	sockent_t *client;
+	sockent_t *server;
+	char packet[1452];
+	size_t packet_size;
+	size_t vl_num;
+
+	bench_init (argc, argv, 1000000);
+	uc_init ();
+	bench_vl_create ();
+
+	client = malloc (sizeof (*client));
+	server = malloc (sizeof (*server));
+	if ((client == NULL) || (server == NULL))
+		return (EXIT_FAILURE);
+	sockent_init (client, SOCKENT_TYPE_CLIENT);
+	sockent_init (server, SOCKENT_TYPE_SERVER);
+
+	printf ("network, %"PRIu64" value lists and packets:\n",
+			bench_iterations);
+	bench_add_to_buffer ();
+
+	/* Parsing a packet takes much longer than adding a value list. */
+	bench_iterations = (bench_iterations + 9) / 10;
+
+	packet_size = bench_packet_create (packet, sizeof (packet), &vl_num);
+	bench_parse ("plain", server, packet, packet_size, vl_num);
+
+#if HAVE_LIBGCRYPT
+	{
+		char secure[BUFF_SIG_SIZE + sizeof (packet)];
+		size_t secure_size;
+
+		bench_crypto_init (client, server);
+
+		if (network_sign_buffer (client, packet, packet_size,
+					secure, &secure_size) != 0)
+			return (EXIT_FAILURE);
+		bench_parse ("signed", server, secure, secure_size, vl_num);
+
+		if (network_encrypt_buffer (client, packet, packet_size,
+					secure, &secure_size) != 0)
+			return (EXIT_FAILURE);
+		bench_parse ("encrypted", server, secure, secure_size, vl_num);
+
+		unlink (bench_auth_file);
+	}
+#else
+	printf ("  (signed and encrypted packets need libgcrypt)\n");
+#endif
+
+	sockent_destroy (client);
+	sockent_destroy (server);
+	sfree (bench_vl);
+	sfree (bench_values);
+
+	return (EXIT_SUCCESS);
+} /* }}} int main */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,577 @@
+/**
+ * collectd - src/benchmark.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Generates a reproducible load for measuring how many values per second the
+ * daemon sustains with a given configuration. Generator threads dispatch
+ * synthetic values at a fixed rate; the read callback reports the achieved
+ * rate and the time spent in `plugin_dispatch_values'.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "meta_data.h"
+#include "utils_time.h"
+
+#include <pthread.h>
+
+#define BENCH_DEFAULT_RATE 10000.0
+/* Generators which can't keep up don't try to catch up on more than one
+ * second worth of values; the rest is counted as missed. */
+#define BENCH_MAX_BACKLOG 1.0
+/* Longest sleep of a generator, so that shutdown isn't delayed. */
+#define BENCH_SLEEP_MAX_MS 10
+
+struct bench_thread_s
+{
+	pthread_t thread;
+	int index;
+	_Bool started;
+
+	/* Written by the generator, read by `bench_read'. */
+	uint64_t dispatched;
+	uint64_t missed;
+	uint64_t failed;
+	uint64_t latency_sum;
+	uint64_t latency_max;
+};
+typedef struct bench_thread_s bench_thread_t;
+
+static char    *bench_host_prefix = NULL;
+static char    *bench_plugin_prefix = NULL;
+static int      bench_hosts = 1;
+static int      bench_plugins = 1;
+static int      bench_values = 100;
+static char   **bench_types = NULL;
+static int     *bench_types_ds_type = NULL;
+static size_t   bench_types_num = 0;
+static double   bench_rate = BENCH_DEFAULT_RATE;
+static int      bench_meta_data = 0;
+static int      bench_threads_num = 1;
+
+static bench_thread_t *bench_threads = NULL;
+static volatile _Bool  bench_loop = 0;
+
+static uint64_t bench_identifiers_num = 0;
+static cdtime_t bench_start = 0;
+static uint64_t bench_last_dispatched = 0;
+static cdtime_t bench_last_time = 0;
+
+static void bench_update_max (uint64_t *max, uint64_t value) /* {{{ */
+{
+	uint64_t old = *max;
+
+	while (value > old)
+	{
+		uint64_t prev = __sync_val_compare_and_swap (max, old, value);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+} /* }}} void bench_update_max */
+
+/* Fills `vl' with the identifier number `id' and its value in round
+ * `round'. Counters and derives increase with every round, so that rates are
+ * calculated and nothing is rejected by the cache. */
+static void bench_fill (value_list_t *vl, uint64_t id, /* {{{ */
+		uint64_t round)
+{
+	uint64_t value_index = id % (uint64_t) bench_values;
+	uint64_t plugin_index = (id / (uint64_t) bench_values)
+		% (uint64_t) bench_plugins;
+	uint64_t host_index = id / ((uint64_t) bench_values
+			* (uint64_t) bench_plugins);
+	size_t type_index = (size_t) (value_index % bench_types_num);
+
+	ssnprintf (vl->host, sizeof (vl->host), "%s%"PRIu64,
+			bench_host_prefix, host_index);
+	ssnprintf (vl->plugin, sizeof (vl->plugin), "%s%"PRIu64,
+			bench_plugin_prefix, plugin_index);
+	sstrncpy (vl->type, bench_types[type_index], sizeof (vl->type));
+	ssnprintf (vl->type_instance, sizeof (vl->type_instance), "%"PRIu64,
+			value_index);
+
+	switch (bench_types_ds_type[type_index])
+	{
+		case DS_TYPE_COUNTER:
+			vl->values[0].counter = (counter_t) (round * (value_index + 1));
+			break;
+		case DS_TYPE_DERIVE:
+			vl->values[0].derive = (derive_t) (round * (value_index + 1));
+			break;
+		case DS_TYPE_ABSOLUTE:
+			vl->values[0].absolute = (absolute_t) (value_index + 1);
+			break;
+		default:
+			vl->values[0].gauge = (gauge_t) ((round + value_index) % 100);
+	}
+} /* }}} void bench_fill */
+
+static meta_data_t *bench_meta_data_create (uint64_t id) /* {{{ */
+{
+	meta_data_t *meta;
+	int i;
+
+	meta = meta_data_create ();
+	if (meta == NULL)
+		return (NULL);
+
+	for (i = 0; i < bench_meta_data; i++)
+	{
+		char key[32];
+
+		ssnprintf (key, sizeof (key), "benchmark:%i", i);
+		meta_data_add_signed_int (meta, key, (int64_t) id);
+	}
+
+	return (meta);
+} /* }}} meta_data_t *bench_meta_data_create */
+
+static void *bench_thread (void *arg) /* {{{ */
+{
+	bench_thread_t *t = arg;
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+	double rate = bench_rate / ((double) bench_threads_num);
+	double interval;
+	uint64_t id = (uint64_t) t->index;
+	uint64_t round = 1;
+	uint64_t sent = 0;
+	cdtime_t start;
+
+	vl.values = values;
+	vl.values_len = 1;
+
+	/* Each identifier is dispatched every `interval' seconds. */
+	if (rate > 0.0)
+		interval = ((double) bench_identifiers_num) / bench_rate;
+	else
+		interval = CDTIME_T_TO_DOUBLE (interval_g);
+	vl.interval = DOUBLE_TO_CDTIME_T (interval);
+	if (vl.interval == 0)
+		vl.interval = 1;
+
+	start = cdtime_monotonic ();
+	while (bench_loop)
+	{
+		uint64_t due;
+
+		if (rate > 0.0)
+		{
+			double elapsed = CDTIME_T_TO_DOUBLE (cdtime_monotonic () - start);
+			uint64_t backlog = (uint64_t) (rate * BENCH_MAX_BACKLOG);
+
+			due = (uint64_t) (rate * elapsed);
+			if (due > sent + backlog)
+			{
+				__sync_fetch_and_add (&t->missed, due - sent - backlog);
+				sent = due - backlog;
+			}
+
+			if (sent >= due)
+			{
+				struct timespec ts;
+				double wait_ms = 1000.0 / rate;
+
+				if (wait_ms > BENCH_SLEEP_MAX_MS)
+					wait_ms = BENCH_SLEEP_MAX_MS;
+				ts.tv_sec = 0;
+				ts.tv_nsec = (long) (wait_ms * 1000000.0);
+				nanosleep (&ts, NULL);
+				continue;
+			}
+		}
+		else
+		{
+			due = sent + 1;
+		}
+
+		while (bench_loop && (sent < due))
+		{
+			cdtime_t dispatch_start;
+			cdtime_t latency;
+			int status;
+
+			bench_fill (&vl, id, round);
+			vl.time = cdtime ();
+			vl.meta = NULL;
+			if (bench_meta_data > 0)
+				vl.meta = bench_meta_data_create (id);
+
+			dispatch_start = cdtime_monotonic ();
+			status = plugin_dispatch_values (&vl);
+			latency = cdtime_monotonic () - dispatch_start;
+
+			if (vl.meta != NULL)
+			{
+				meta_data_destroy (vl.meta);
+				vl.meta = NULL;
+			}
+
+			__sync_fetch_and_add (&t->dispatched, 1);
+			if (status != 0)
+				__sync_fetch_and_add (&t->failed, 1);
+			__sync_fetch_and_add (&t->latency_sum, (uint64_t) latency);
+			bench_update_max (&t->latency_max, (uint64_t) latency);
+
+			/* This thread takes every `bench_threads_num'th
+			 * identifier. */
+			id += (uint64_t) bench_threads_num;
+			if (id >= bench_identifiers_num)
+			{
+				id = (uint64_t) t->index;
+				round++;
+			}
+			sent++;
+		}
+	}
+
+	return ((void *) 0);
+} /* }}} void *bench_thread */
+
+static int bench_config_types (oconfig_item_t *ci) /* {{{ */
+{
+	char **tmp;
+	int i;
+
+	if (ci->values_num < 1)
+	{
+		WARNING ("benchmark plugin: The `Types' option needs at least "
+				"one argument.");
+		return (-1);
+	}
+
+	for (i = 0; i < ci->values_num; i++)
+	{
+		if (ci->values[i].type != OCONFIG_TYPE_STRING)
+		{
+			WARNING ("benchmark plugin: The arguments of the `Types' "
+					"option must be strings.");
+			return (-1);
+		}
+	}
+
+	tmp = realloc (bench_types,
+			(bench_types_num + ci->values_num) * sizeof (*bench_types));
+	if (tmp == NULL)
+	{
+		ERROR ("benchmark plugin: realloc failed.");
+		return (-1);
+	}
+	bench_types = tmp;
+
+	for (i = 0; i < ci->values_num; i++)
+	{
+		bench_types[bench_types_num] = strdup (ci->values[i].value.string);
+		if (bench_types[bench_types_num] == NULL)
+		{
+			ERROR ("benchmark plugin: strdup failed.");
+			return (-1);
+		}
+		bench_types_num++;
+	}
+
+	return (0);
+} /* }}} int bench_config_types */
+
+static int bench_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("HostPrefix", child->key) == 0)
+			cf_util_get_string (child, &bench_host_prefix);
+		else if (strcasecmp ("PluginPrefix", child->key) == 0)
+			cf_util_get_string (child, &bench_plugin_prefix);
+		else if (strcasecmp ("Hosts", child->key) == 0)
+			cf_util_get_int (child, &bench_hosts);
+		else if (strcasecmp ("Plugins", child->key) == 0)
+			cf_util_get_int (child, &bench_plugins);
+		else if (strcasecmp ("Values", child->key) == 0)
+			cf_util_get_int (child, &bench_values);
+		else if (strcasecmp ("Types", child->key) == 0)
+			bench_config_types (child);
+		else if (strcasecmp ("Rate", child->key) == 0)
+		{
+			if ((child->values_num != 1)
+					|| (child->values[0].type != OCONFIG_TYPE_NUMBER)
+					|| (child->values[0].value.number < 0.0))
+				WARNING ("benchmark plugin: The `Rate' option needs "
+						"one non-negative number.");
+			else
+				bench_rate = child->values[0].value.number;
+		}
+		else if (strcasecmp ("MetaData", child->key) == 0)
+			cf_util_get_int (child, &bench_meta_data);
+		else if (strcasecmp ("Threads", child->key) == 0)
+			cf_util_get_int (child, &bench_threads_num);
+		else
+			WARNING ("benchmark plugin: Ignoring unknown config option "
+					"`%s'.", child->key);
+	}
+
+	return (0);
+} /* }}} int bench_config */
+
+static int bench_read (void) /* {{{ */
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+	uint64_t dispatched = 0;
+	uint64_t missed = 0;
+	uint64_t failed = 0;
+	uint64_t latency_sum = 0;
+	uint64_t latency_max = 0;
+	cdtime_t now;
+	int i;
+
+	for (i = 0; i < bench_threads_num; i++)
+	{
+		bench_thread_t *t = bench_threads + i;
+		uint64_t max;
+
+		dispatched += __sync_fetch_and_add (&t->dispatched, 0);
+		missed += __sync_fetch_and_add (&t->missed, 0);
+		failed += __sync_fetch_and_add (&t->failed, 0);
+		latency_sum += __sync_fetch_and_add (&t->latency_sum, 0);
+		/* The maximum is reported per interval. */
+		max = __sync_lock_test_and_set (&t->latency_max, 0);
+		if (latency_max < max)
+			latency_max = max;
+	}
+	now = cdtime_monotonic ();
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "benchmark", sizeof (vl.plugin));
+
+	sstrncpy (vl.type, "total_values", sizeof (vl.type));
+	values[0].derive = (derive_t) dispatched;
+	sstrncpy (vl.type_instance, "dispatched", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	values[0].derive = (derive_t) missed;
+	sstrncpy (vl.type_instance, "missed", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	values[0].derive = (derive_t) failed;
+	sstrncpy (vl.type_instance, "failed", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	/* Computed here as well, so that the rate is available without
+	 * looking at two values of the counter. */
+	if ((bench_last_time != 0) && (now > bench_last_time))
+	{
+		sstrncpy (vl.type, "gauge", sizeof (vl.type));
+		values[0].gauge = ((gauge_t) (dispatched - bench_last_dispatched))
+			/ CDTIME_T_TO_DOUBLE (now - bench_last_time);
+		sstrncpy (vl.type_instance, "rate", sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+	bench_last_dispatched = dispatched;
+	bench_last_time = now;
+
+	sstrncpy (vl.type, "total_time_in_ns", sizeof (vl.type));
+	values[0].derive = (derive_t) CDTIME_T_TO_NS ((cdtime_t) latency_sum);
+	sstrncpy (vl.type_instance, "dispatch", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type, "response_time", sizeof (vl.type));
+	values[0].gauge = CDTIME_T_TO_DOUBLE ((cdtime_t) latency_max);
+	sstrncpy (vl.type_instance, "dispatch-max", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	return (0);
+} /* }}} int bench_read */
+
+static int bench_init (void) /* {{{ */
+{
+	char errbuf[1024];
+	size_t i;
+	int j;
+
+	if (bench_threads != NULL)
+		return (0);
+
+	if (bench_host_prefix == NULL)
+		bench_host_prefix = strdup ("bench");
+	if (bench_plugin_prefix == NULL)
+		bench_plugin_prefix = strdup ("bench");
+	if ((bench_host_prefix == NULL) || (bench_plugin_prefix == NULL))
+	{
+		ERROR ("benchmark plugin: strdup failed.");
+		return (-1);
+	}
+
+	if ((bench_hosts < 1) || (bench_plugins < 1) || (bench_values < 1))
+	{
+		ERROR ("benchmark plugin: Hosts, Plugins and Values must be "
+				"positive.");
+		return (-1);
+	}
+	bench_identifiers_num = ((uint64_t) bench_hosts)
+		* ((uint64_t) bench_plugins) * ((uint64_t) bench_values);
+
+	if (bench_types_num == 0)
+	{
+		bench_types = malloc (sizeof (*bench_types));
+		if (bench_types == NULL)
+		{
+			ERROR ("benchmark plugin: malloc failed.");
+			return (-1);
+		}
+		bench_types[0] = strdup ("gauge");
+		if (bench_types[0] == NULL)
+		{
+			ERROR ("benchmark plugin: strdup failed.");
+			return (-1);
+		}
+		bench_types_num = 1;
+	}
+
+	/* The types.db files have been read by now. */
+	bench_types_ds_type = calloc (bench_types_num,
+			sizeof (*bench_types_ds_type));
+	if (bench_types_ds_type == NULL)
+	{
+		ERROR ("benchmark plugin: calloc failed.");
+		return (-1);
+	}
+	for (i = 0; i < bench_types_num; i++)
+	{
+		const data_set_t *ds = plugin_get_ds (bench_types[i]);
+
+		if ((ds == NULL) || (ds->ds_num != 1))
+		{
+			ERROR ("benchmark plugin: The type `%s' is unknown or has "
+					"more than one data source.", bench_types[i]);
+			return (-1);
+		}
+		bench_types_ds_type[i] = ds->ds[0].type;
+	}
+
+	if (bench_meta_data < 0)
+		bench_meta_data = 0;
+	if (bench_threads_num < 1)
+		bench_threads_num = 1;
+	if (((uint64_t) bench_threads_num) > bench_identifiers_num)
+		bench_threads_num = (int) bench_identifiers_num;
+
+	bench_threads = calloc ((size_t) bench_threads_num,
+			sizeof (*bench_threads));
+	if (bench_threads == NULL)
+	{
+		ERROR ("benchmark plugin: calloc failed.");
+		return (-1);
+	}
+
+	bench_loop = 1;
+	for (j = 0; j < bench_threads_num; j++)
+	{
+		bench_thread_t *t = bench_threads + j;
+		int status;
+
+		t->index = j;
+		status = pthread_create (&t->thread, NULL, bench_thread, t);
+		if (status != 0)
+		{
+			ERROR ("benchmark plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			continue;
+		}
+		t->started = 1;
+	}
+	bench_start = cdtime_monotonic ();
+
+	if (bench_rate > 0.0)
+		INFO ("benchmark plugin: Dispatching %"PRIu64" identifiers at "
+				"%g values per second using %i thread%s.",
+				bench_identifiers_num, bench_rate,
+				bench_threads_num, (bench_threads_num == 1) ? "" : "s");
+	else
+		INFO ("benchmark plugin: Dispatching %"PRIu64" identifiers as "
+				"fast as possible using %i thread%s.",
+				bench_identifiers_num,
+				bench_threads_num, (bench_threads_num == 1) ? "" : "s");
+
+	plugin_register_read ("benchmark", bench_read);
+
+	return (0);
+} /* }}} int bench_init */
+
+static int bench_shutdown (void) /* {{{ */
+{
+	uint64_t dispatched = 0;
+	uint64_t missed = 0;
+	uint64_t latency_sum = 0;
+	size_t i;
+	int j;
+
+	if (bench_threads != NULL)
+	{
+		double elapsed;
+
+		bench_loop = 0;
+		for (j = 0; j < bench_threads_num; j++)
+		{
+			bench_thread_t *t = bench_threads + j;
+
+			if (t->started)
+				pthread_join (t->thread, NULL);
+			dispatched += t->dispatched;
+			missed += t->missed;
+			latency_sum += t->latency_sum;
+		}
+
+		elapsed = CDTIME_T_TO_DOUBLE (cdtime_monotonic () - bench_start);
+		if ((elapsed > 0.0) && (dispatched > 0))
+			INFO ("benchmark plugin: Dispatched %"PRIu64" values in "
+					"%.3f seconds (%.1f per second, %"PRIu64" missed), "
+					"average dispatch latency %.3f us.",
+					dispatched, elapsed, ((double) dispatched) / elapsed,
+					missed, CDTIME_T_TO_DOUBLE ((cdtime_t) latency_sum)
+					* 1000000.0 / ((double) dispatched));
+
+		sfree (bench_threads);
+	}
+
+	for (i = 0; i < bench_types_num; i++)
+		sfree (bench_types[i]);
+	sfree (bench_types);
+	sfree (bench_types_ds_type);
+	bench_types_num = 0;
+	sfree (bench_host_prefix);
+	sfree (bench_plugin_prefix);
+
+	return (0);
+} /* }}} int bench_shutdown */
+
+void module_register (void)
+{
+	plugin_register_complex_config ("benchmark", bench_config);
+	plugin_register_init ("benchmark", bench_init);
+	plugin_register_shutdown ("benchmark", bench_shutdown);
+} /* void module_register */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -111,9 +111,9 @@ static size_t     views_num = 0;
 
 static CURL *curl = NULL;
 
-static char  *bind_buffer = NULL;
-static size_t bind_buffer_size = 0;
-static size_t bind_buffer_fill = 0;
+/* The document is parsed while it is received, so that it is never held
+ * in memory as text in addition to the tree. */
+static xmlParserCtxtPtr bind_parser = NULL;
 static char   bind_curl_error[CURL_ERROR_SIZE];
 
 /* Translation table for the `nsstats' values. */
@@ -274,23 +274,26 @@ static size_t bind_curl_callback (void *buf, size_t size, /* {{{ */
   if (len <= 0)
     return (len);
 
-  if ((bind_buffer_fill + len) >= bind_buffer_size)
+  if (bind_parser == NULL)
   {
-    char *temp;
-
-    temp = realloc(bind_buffer, bind_buffer_fill + len + 1);
-    if (temp == NULL)
+    /* Blank text nodes are dropped and short texts are stored in the
+     * nodes, which makes the tree of the statistics much smaller. */
+    bind_parser = xmlCreatePushParserCtxt (/* sax = */ NULL,
+        /* user_data = */ NULL, /* chunk = */ NULL, 0, /* filename = */ NULL);
+    if (bind_parser == NULL)
     {
-      ERROR ("bind plugin: realloc failed.");
+      ERROR ("bind plugin: xmlCreatePushParserCtxt failed.");
       return (0);
     }
-    bind_buffer = temp;
-    bind_buffer_size = bind_buffer_fill + len + 1;
+    xmlCtxtUseOptions (bind_parser,
+        XML_PARSE_NOBLANKS | XML_PARSE_COMPACT | XML_PARSE_NONET);
   }
 
-  memcpy (bind_buffer + bind_buffer_fill, (char *) buf, len);
-  bind_buffer_fill += len;
-  bind_buffer[bind_buffer_fill] = 0;
+  if (xmlParseChunk (bind_parser, buf, (int) len, /* terminate = */ 0) != 0)
+  {
+    ERROR ("bind plugin: xmlParseChunk failed.");
+    return (0);
+  }
 
   return (len);
 } /* }}} size_t bind_curl_callback */
@@ -1134,21 +1137,14 @@ static int bind_xml_stats (int version, xmlDoc *doc, /* {{{ */
   return 0;
 } /* }}} int bind_xml_stats */
 
-static int bind_xml (const char *data) /* {{{ */
+/* Takes ownership of `doc'. */
+static int bind_xml (xmlDoc *doc) /* {{{ */
 {
-  xmlDoc *doc = NULL;
   xmlXPathContext *xpathCtx = NULL;
   xmlXPathObject *xpathObj = NULL;
   int ret = -1;
   int i;
 
-  doc = xmlParseMemory (data, strlen (data));
-  if (doc == NULL)
-  {
-    ERROR ("bind plugin: xmlParseMemory failed.");
-    return (-1);
-  }
-
   xpathCtx = xmlXPathNewContext (doc);
   if (xpathCtx == NULL)
   {
@@ -1397,6 +1393,7 @@ static int bind_init (void) /* {{{ */
 
 static int bind_read (void) /* {{{ */
 {
+  xmlDoc *doc = NULL;
   int status;
 
   if (curl == NULL)
@@ -1405,15 +1402,35 @@ static int bind_read (void) /* {{{ */
     return (-1);
   }
 
-  bind_buffer_fill = 0;
-  if (curl_easy_perform (curl) != 0)
+  status = curl_easy_perform (curl);
+  if (bind_parser != NULL)
+  {
+    if (status == 0)
+      xmlParseChunk (bind_parser, NULL, 0, /* terminate = */ 1);
+
+    if ((status == 0) && bind_parser->wellFormed)
+      doc = bind_parser->myDoc;
+    else if (bind_parser->myDoc != NULL)
+      xmlFreeDoc (bind_parser->myDoc);
+    bind_parser->myDoc = NULL;
+
+    xmlFreeParserCtxt (bind_parser);
+    bind_parser = NULL;
+  }
+
+  if (status != 0)
   {
     ERROR ("bind plugin: curl_easy_perform failed: %s",
         bind_curl_error);
     return (-1);
   }
+  else if (doc == NULL)
+  {
+    ERROR ("bind plugin: Parsing the statistics failed.");
+    return (-1);
+  }
 
-  status = bind_xml (bind_buffer);
+  status = bind_xml (doc);
   if (status != 0)
     return (-1);
   else
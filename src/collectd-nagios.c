@@ -33,6 +33,8 @@
 #include <errno.h>
 #include <string.h>
 #include <strings.h>
+#include <stdarg.h>
+#include <time.h>
 #include <assert.h>
 
 #if NAN_STATIC_DEFAULT
@@ -101,6 +103,33 @@ static _Bool nan_is_error_g = 0;
 static char **match_ds_g = NULL;
 static int    match_ds_num_g = 0;
 
+static char *service_g = NULL;
+static char *batch_file_g = NULL;
+
+/* In batch mode, one check is read per line and its options are applied on
+ * top of the ones given on the command line. */
+struct check_s
+{
+	char   *line;
+	char   *host;
+	char   *value_spec;
+	char   *service;
+	range_t range_critical;
+	range_t range_warning;
+	int     consolitation;
+	_Bool   nan_is_error;
+	char  **match_ds;
+	int     match_ds_num;
+	lcc_identifier_t ident;
+	int     ident_valid;
+};
+typedef struct check_s check_t;
+
+/* The status message of the current check. It's printed as is in the
+ * normal mode and as part of a passive check result in batch mode. */
+static char   output_g[4096];
+static size_t output_len_g = 0;
+
 /* `strdup' is an XSI extension. I don't want to pull in all of XSI just for
  * that, so here's an own implementation.. It's easy enough. The GCC attributes
  * are supposed to get good performance..  -octo */
@@ -117,6 +146,28 @@ static char *cn_strdup (const char *str) /* {{{ */
   return (ret);
 } /* }}} char *cn_strdup */
 
+__attribute__((format (printf, 1, 2)))
+static void cn_printf (const char *format, ...) /* {{{ */
+{
+	va_list ap;
+	int status;
+
+	if (output_len_g >= sizeof (output_g) - 1)
+		return;
+
+	va_start (ap, format);
+	status = vsnprintf (output_g + output_len_g,
+			sizeof (output_g) - output_len_g, format, ap);
+	va_end (ap);
+
+	if (status < 0)
+		return;
+
+	output_len_g += (size_t) status;
+	if (output_len_g >= sizeof (output_g))
+		output_len_g = sizeof (output_g) - 1;
+} /* }}} void cn_printf */
+
 static int filter_ds (size_t *values_num,
 		double **values, char ***values_names)
 {
@@ -165,7 +216,7 @@ static int filter_ds (size_t *values_num,
 
 		if (j == *values_num)
 		{
-			printf ("ERROR: DS `%s' is not available.\n", new_names[i]);
+			cn_printf ("ERROR: DS `%s' is not available.\n", new_names[i]);
 			free (new_values);
 			for (j = 0; j <= i; j++)
 				free (new_names[j]);
@@ -243,6 +294,7 @@ static int match_range (range_t *range, double value)
 static void usage (const char *name)
 {
 	fprintf (stderr, "Usage: %s <-s socket> <-n value_spec> <-H hostname> [options]\n"
+			"       %s <-s socket> <-b file> [options]\n"
 			"\n"
 			"Valid options are:\n"
 			"  -s <socket>    Path to collectd's UNIX-socket.\n"
@@ -256,6 +308,10 @@ static void usage (const char *name)
 			"  -c <range>     Critical range\n"
 			"  -w <range>     Warning range\n"
 			"  -m             Treat \"Not a Number\" (NaN) as critical (default: warning)\n"
+			"  -b <file>      Read one check per line from <file> (`-' for STDIN) and\n"
+			"                 print passive check results. The options given above\n"
+			"                 are used as the defaults of each check.\n"
+			"  -N <service>   Service name of a check in batch mode (default: v_spec).\n"
 			"\n"
 			"Consolidation functions:\n"
 			"  none:          Apply the warning- and critical-ranges to each data-source\n"
@@ -265,7 +321,7 @@ static void usage (const char *name)
 			"  sum:           Apply the ranges to the sum of all DSes.\n"
 			"  percentage:    Apply the ranges to the ratio (in percent) of the first value\n"
 			"                 and the sum of all values."
-			"\n", name);
+			"\n", name, name);
 	exit (1);
 } /* void usage */
 
@@ -359,7 +415,7 @@ static int do_check_con_none (size_t values_num,
 
 	if ((num_critical == 0) && (num_warning == 0) && (num_okay == 0))
 	{
-		printf ("WARNING: No defined values found\n");
+		cn_printf ("WARNING: No defined values found\n");
 		return (RET_WARNING);
 	}
 	else if ((num_critical == 0) && (num_warning == 0))
@@ -378,15 +434,15 @@ static int do_check_con_none (size_t values_num,
 		status_code = RET_CRITICAL;
 	}
 
-	printf ("%s: %i critical, %i warning, %i okay", status_str,
+	cn_printf ("%s: %i critical, %i warning, %i okay", status_str,
 			num_critical, num_warning, num_okay);
 	if (values_num > 0)
 	{
-		printf (" |");
+		cn_printf (" |");
 		for (i = 0; i < values_num; i++)
-			printf (" %s=%f;;;;", values_names[i], values[i]);
+			cn_printf (" %s=%f;;;;", values_names[i], values[i]);
 	}
-	printf ("\n");
+	cn_printf ("\n");
 
 	return (status_code);
 } /* int do_check_con_none */
@@ -410,7 +466,7 @@ static int do_check_con_average (size_t values_num,
 			if (!nan_is_error_g)
 				continue;
 
-			printf ("CRITICAL: Data source \"%s\" is NaN\n",
+			cn_printf ("CRITICAL: Data source \"%s\" is NaN\n",
 					values_names[i]);
 			return (RET_CRITICAL);
 		}
@@ -421,7 +477,7 @@ static int do_check_con_average (size_t values_num,
 
 	if (total_num == 0)
 	{
-		printf ("WARNING: No defined values found\n");
+		cn_printf ("WARNING: No defined values found\n");
 		return (RET_WARNING);
 	}
 
@@ -443,10 +499,10 @@ static int do_check_con_average (size_t values_num,
 		status_code = RET_OKAY;
 	}
 
-	printf ("%s: %g average |", status_str, average);
+	cn_printf ("%s: %g average |", status_str, average);
 	for (i = 0; i < values_num; i++)
-		printf (" %s=%f;;;;", values_names[i], values[i]);
-	printf ("\n");
+		cn_printf (" %s=%f;;;;", values_names[i], values[i]);
+	cn_printf ("\n");
 
 	return (status_code);
 } /* int do_check_con_average */
@@ -469,7 +525,7 @@ static int do_check_con_sum (size_t values_num,
 			if (!nan_is_error_g)
 				continue;
 
-			printf ("CRITICAL: Data source \"%s\" is NaN\n",
+			cn_printf ("CRITICAL: Data source \"%s\" is NaN\n",
 					values_names[i]);
 			return (RET_CRITICAL);
 		}
@@ -480,7 +536,7 @@ static int do_check_con_sum (size_t values_num,
 
 	if (total_num == 0)
 	{
-		printf ("WARNING: No defined values found\n");
+		cn_printf ("WARNING: No defined values found\n");
 		return (RET_WARNING);
 	}
 
@@ -500,10 +556,10 @@ static int do_check_con_sum (size_t values_num,
 		status_code = RET_OKAY;
 	}
 
-	printf ("%s: %g sum |", status_str, total);
+	cn_printf ("%s: %g sum |", status_str, total);
 	for (i = 0; i < values_num; i++)
-		printf (" %s=%f;;;;", values_names[i], values[i]);
-	printf ("\n");
+		cn_printf (" %s=%f;;;;", values_names[i], values[i]);
+	cn_printf ("\n");
 
 	return (status_code);
 } /* int do_check_con_sum */
@@ -520,7 +576,7 @@ static int do_check_con_percentage (size_t values_num,
 
 	if ((values_num < 1) || (isnan (values[0])))
 	{
-		printf ("WARNING: The first value is not defined\n");
+		cn_printf ("WARNING: The first value is not defined\n");
 		return (RET_WARNING);
 	}
 
@@ -531,7 +587,7 @@ static int do_check_con_percentage (size_t values_num,
 			if (!nan_is_error_g)
 				continue;
 
-			printf ("CRITICAL: Data source \"%s\" is NaN\n",
+			cn_printf ("CRITICAL: Data source \"%s\" is NaN\n",
 					values_names[i]);
 			return (RET_CRITICAL);
 		}
@@ -541,7 +597,7 @@ static int do_check_con_percentage (size_t values_num,
 
 	if (sum == 0.0)
 	{
-		printf ("WARNING: Values sum up to zero\n");
+		cn_printf ("WARNING: Values sum up to zero\n");
 		return (RET_WARNING);
 	}
 
@@ -563,12 +619,44 @@ static int do_check_con_percentage (size_t values_num,
 		status_code = RET_OKAY;
 	}
 
-	printf ("%s: %lf percent |", status_str, percentage);
+	cn_printf ("%s: %lf percent |", status_str, percentage);
 	for (i = 0; i < values_num; i++)
-		printf (" %s=%lf;;;;", values_names[i], values[i]);
+		cn_printf (" %s=%lf;;;;", values_names[i], values[i]);
 	return (status_code);
 } /* int do_check_con_percentage */
 
+
+/* Applies the ranges and the consolidation function to the values. The
+ * arrays are freed. */
+static int do_check_values (size_t values_num, /* {{{ */
+		gauge_t *values, char **values_names)
+{
+	size_t i;
+	int status;
+
+	status = filter_ds (&values_num, &values, &values_names);
+	if (status != RET_OKAY)
+		return (status);
+
+	status = RET_UNKNOWN;
+	if (consolitation_g == CON_NONE)
+		status =  do_check_con_none (values_num, values, values_names);
+	else if (consolitation_g == CON_AVERAGE)
+		status =  do_check_con_average (values_num, values, values_names);
+	else if (consolitation_g == CON_SUM)
+		status = do_check_con_sum (values_num, values, values_names);
+	else if (consolitation_g == CON_PERCENTAGE)
+		status = do_check_con_percentage (values_num, values, values_names);
+
+	free (values);
+	if (values_names != NULL)
+		for (i = 0; i < values_num; i++)
+			free (values_names[i]);
+	free (values_names);
+
+	return (status);
+} /* }}} int do_check_values */
+
 static int do_check (lcc_connection_t *connection)
 {
 	gauge_t *values;
@@ -576,7 +664,6 @@ static int do_check (lcc_connection_t *connection)
 	size_t   values_num;
 	char ident_str[1024];
 	lcc_identifier_t ident;
-	size_t i;
 	int status;
 
 	snprintf (ident_str, sizeof (ident_str), "%s/%s",
@@ -605,28 +692,475 @@ static int do_check (lcc_connection_t *connection)
 
 	LCC_DESTROY (connection);
 
-	status = filter_ds (&values_num, &values, &values_names);
-	if (status != RET_OKAY)
-		return (status);
+	status = do_check_values (values_num, values, values_names);
+	fputs (output_g, stdout);
 
-	status = RET_UNKNOWN;
-	if (consolitation_g == CON_NONE)
-		status =  do_check_con_none (values_num, values, values_names);
-	else if (consolitation_g == CON_AVERAGE)
-		status =  do_check_con_average (values_num, values, values_names);
-	else if (consolitation_g == CON_SUM)
-		status = do_check_con_sum (values_num, values, values_names);
-	else if (consolitation_g == CON_PERCENTAGE)
-		status = do_check_con_percentage (values_num, values, values_names);
+	return (status);
+} /* int do_check */
 
-	free (values);
-	if (values_names != NULL)
-		for (i = 0; i < values_num; i++)
-			free (values_names[i]);
-	free (values_names);
+/* Handles the options which describe a check. Returns EINVAL if the argument
+ * is invalid and ENOMEM if memory is exhausted. */
+static int parse_check_option (int c, char *arg) /* {{{ */
+{
+	switch (c)
+	{
+		case 'c':
+			parse_range (arg, &range_critical_g);
+			break;
+		case 'w':
+			parse_range (arg, &range_warning_g);
+			break;
+		case 'n':
+			value_string_g = arg;
+			break;
+		case 'H':
+			hostname_g = arg;
+			break;
+		case 'N':
+			service_g = arg;
+			break;
+		case 'g':
+			if (strcasecmp (arg, "none") == 0)
+				consolitation_g = CON_NONE;
+			else if (strcasecmp (arg, "average") == 0)
+				consolitation_g = CON_AVERAGE;
+			else if (strcasecmp (arg, "sum") == 0)
+				consolitation_g = CON_SUM;
+			else if (strcasecmp (arg, "percentage") == 0)
+				consolitation_g = CON_PERCENTAGE;
+			else
+			{
+				fprintf (stderr, "Unknown consolidation function `%s'.\n",
+						arg);
+				return (EINVAL);
+			}
+			break;
+		case 'd':
+		{
+			char **tmp;
+			tmp = (char **) realloc (match_ds_g,
+					(match_ds_num_g + 1)
+					* sizeof (char *));
+			if (tmp == NULL)
+			{
+				fprintf (stderr, "realloc failed: %s\n",
+						strerror (errno));
+				return (ENOMEM);
+			}
+			match_ds_g = tmp;
+			match_ds_g[match_ds_num_g] = cn_strdup (arg);
+			if (match_ds_g[match_ds_num_g] == NULL)
+			{
+				fprintf (stderr, "cn_strdup failed: %s\n",
+						strerror (errno));
+				return (ENOMEM);
+			}
+			match_ds_num_g++;
+			break;
+		}
+		case 'm':
+			nan_is_error_g = 1;
+			break;
+		default:
+			return (EINVAL);
+	} /* switch (c) */
+
+	return (0);
+} /* }}} int parse_check_option */
+
+/* Copies the check described by the global variables to `c' and back. */
+static void check_save (check_t *c) /* {{{ */
+{
+	c->host = hostname_g;
+	c->value_spec = value_string_g;
+	c->service = (service_g != NULL) ? service_g : value_string_g;
+	c->range_critical = range_critical_g;
+	c->range_warning = range_warning_g;
+	c->consolitation = consolitation_g;
+	c->nan_is_error = nan_is_error_g;
+	c->match_ds = match_ds_g;
+	c->match_ds_num = match_ds_num_g;
+} /* }}} void check_save */
+
+static void check_restore (const check_t *c) /* {{{ */
+{
+	hostname_g = c->host;
+	value_string_g = c->value_spec;
+	service_g = c->service;
+	range_critical_g = c->range_critical;
+	range_warning_g = c->range_warning;
+	consolitation_g = c->consolitation;
+	nan_is_error_g = c->nan_is_error;
+	match_ds_g = c->match_ds;
+	match_ds_num_g = c->match_ds_num;
+} /* }}} void check_restore */
+
+static void free_match_ds (char **match_ds, int match_ds_num) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < match_ds_num; i++)
+		free (match_ds[i]);
+	free (match_ds);
+} /* }}} void free_match_ds */
+
+/* Parses one line of the batch file into `ret'. The line must be
+ * heap-allocated and is owned by `ret' if zero is returned. Returns 1 for
+ * empty lines and comments. */
+static int parse_check_line (char *line, int lineno, /* {{{ */
+		const check_t *defaults, check_t *ret)
+{
+	char *saveptr = NULL;
+	char *token;
+	int status;
 
+	memset (ret, 0, sizeof (*ret));
+
+	check_restore (defaults);
+	service_g = NULL;
+	match_ds_g = NULL;
+	match_ds_num_g = 0;
+
+	token = strtok_r (line, " \t\r\n", &saveptr);
+	if ((token == NULL) || (token[0] == '#'))
+		return (1);
+
+	while (token != NULL)
+	{
+		char *arg = NULL;
+
+		if ((token[0] != '-') || (token[1] == 0) || (token[2] != 0)
+				|| (strchr ("cwnHNgdm", token[1]) == NULL))
+		{
+			fprintf (stderr, "Line %i: Invalid option `%s'.\n",
+					lineno, token);
+			status = EINVAL;
+			goto error;
+		}
+
+		if (token[1] != 'm')
+		{
+			arg = strtok_r (NULL, " \t\r\n", &saveptr);
+			if (arg == NULL)
+			{
+				fprintf (stderr, "Line %i: Option `%s' requires "
+						"an argument.\n", lineno, token);
+				status = EINVAL;
+				goto error;
+			}
+		}
+
+		status = parse_check_option (token[1], arg);
+		if (status != 0)
+			goto error;
+
+		token = strtok_r (NULL, " \t\r\n", &saveptr);
+	}
+
+	if ((hostname_g == NULL) || (value_string_g == NULL))
+	{
+		fprintf (stderr, "Line %i: The host and the value have to be "
+				"given.\n", lineno);
+		status = EINVAL;
+		goto error;
+	}
+
+	/* A `-d' in the line replaces the ones given on the command line. */
+	if (match_ds_g == NULL)
+	{
+		match_ds_g = defaults->match_ds;
+		match_ds_num_g = defaults->match_ds_num;
+	}
+
+	check_save (ret);
+	ret->line = line;
+	return (0);
+
+error:
+	free_match_ds (match_ds_g, match_ds_num_g);
+	match_ds_g = NULL;
+	match_ds_num_g = 0;
 	return (status);
-} /* int do_check */
+} /* }}} int parse_check_line */
+
+static void check_free (check_t *c, const check_t *defaults) /* {{{ */
+{
+	if (c->match_ds != defaults->match_ds)
+		free_match_ds (c->match_ds, c->match_ds_num);
+	free (c->line);
+} /* }}} void check_free */
+
+static int compare_identifiers (const lcc_identifier_t *a, /* {{{ */
+		const lcc_identifier_t *b)
+{
+	int status;
+
+	status = strcmp (a->host, b->host);
+	if (status == 0)
+		status = strcmp (a->plugin, b->plugin);
+	if (status == 0)
+		status = strcmp (a->plugin_instance, b->plugin_instance);
+	if (status == 0)
+		status = strcmp (a->type, b->type);
+	if (status == 0)
+		status = strcmp (a->type_instance, b->type_instance);
+	return (status);
+} /* }}} int compare_identifiers */
+
+static int compare_results (const void *a, const void *b) /* {{{ */
+{
+	return (compare_identifiers (&((const lcc_getval_result_t *) a)->identifier,
+				&((const lcc_getval_result_t *) b)->identifier));
+} /* }}} int compare_results */
+
+/* Evaluates one check of the batch. The result's values are copied, because
+ * several checks may refer to the same identifier. */
+static int do_batch_check (const lcc_getval_result_t *res) /* {{{ */
+{
+	gauge_t *values;
+	char   **values_names;
+	size_t   i;
+
+	values = (gauge_t *) calloc (res->values_num + 1, sizeof (*values));
+	values_names = (char **) calloc (res->values_num + 1,
+			sizeof (*values_names));
+	if ((values == NULL) || (values_names == NULL))
+	{
+		free (values);
+		free (values_names);
+		cn_printf ("UNKNOWN: malloc failed: %s\n", strerror (errno));
+		return (RET_UNKNOWN);
+	}
+
+	for (i = 0; i < res->values_num; i++)
+	{
+		values[i] = res->values[i];
+		values_names[i] = cn_strdup (res->values_names[i]);
+		if (values_names[i] == NULL)
+		{
+			size_t j;
+
+			for (j = 0; j < i; j++)
+				free (values_names[j]);
+			free (values);
+			free (values_names);
+			cn_printf ("UNKNOWN: cn_strdup failed: %s\n",
+					strerror (errno));
+			return (RET_UNKNOWN);
+		}
+	}
+
+	return (do_check_values (res->values_num, values, values_names));
+} /* }}} int do_batch_check */
+
+/* Prints the result of a check as an external command for Nagios, which may
+ * be written to its command file. */
+static void print_passive_result (const check_t *c, int code) /* {{{ */
+{
+	size_t i;
+
+	while ((output_len_g > 0)
+			&& ((output_g[output_len_g - 1] == '\n')
+				|| (output_g[output_len_g - 1] == ' ')))
+		output_len_g--;
+	output_g[output_len_g] = 0;
+
+	for (i = 0; i < output_len_g; i++)
+		if ((output_g[i] == '\n') || (output_g[i] == '\r'))
+			output_g[i] = ' ';
+
+	printf ("[%lu] PROCESS_SERVICE_CHECK_RESULT;%s;%s;%i;%s\n",
+			(unsigned long) time (NULL), c->host, c->service, code,
+			output_g);
+} /* }}} void print_passive_result */
+
+/* Reads the checks from `batch_file_g', fetches the values of all of them
+ * with one request and prints a passive check result for each. Returns the
+ * worst status of all checks. */
+static int do_batch (lcc_connection_t *connection) /* {{{ */
+{
+	check_t defaults;
+	check_t *checks = NULL;
+	size_t checks_num = 0;
+	size_t checks_size = 0;
+	char **idents = NULL;
+	size_t idents_num = 0;
+	lcc_getval_result_t *res = NULL;
+	size_t res_num = 0;
+	FILE *fh;
+	char buffer[4096];
+	int lineno = 0;
+	int ret = RET_OKAY;
+	int status;
+	size_t i;
+
+	check_save (&defaults);
+
+	if (strcmp ("-", batch_file_g) == 0)
+		fh = stdin;
+	else
+		fh = fopen (batch_file_g, "r");
+	if (fh == NULL)
+	{
+		fprintf (stderr, "Opening `%s' failed: %s\n",
+				batch_file_g, strerror (errno));
+		LCC_DESTROY (connection);
+		return (RET_UNKNOWN);
+	}
+
+	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	{
+		char *line;
+
+		lineno++;
+
+		if (checks_num >= checks_size)
+		{
+			check_t *tmp;
+			size_t size = (checks_size > 0) ? (2 * checks_size) : 64;
+
+			tmp = (check_t *) realloc (checks, size * sizeof (*checks));
+			if (tmp == NULL)
+			{
+				fprintf (stderr, "realloc failed: %s\n", strerror (errno));
+				ret = RET_UNKNOWN;
+				break;
+			}
+			checks = tmp;
+			checks_size = size;
+		}
+
+		line = cn_strdup (buffer);
+		if (line == NULL)
+		{
+			fprintf (stderr, "cn_strdup failed: %s\n", strerror (errno));
+			ret = RET_UNKNOWN;
+			break;
+		}
+
+		status = parse_check_line (line, lineno, &defaults,
+				checks + checks_num);
+		if (status != 0)
+		{
+			free (line);
+
+			if (status == ENOMEM)
+			{
+				ret = RET_UNKNOWN;
+				break;
+			}
+			if (status != 1)
+				ret = RET_UNKNOWN;
+			continue;
+		}
+		checks_num++;
+	}
+
+	if (ferror (fh))
+	{
+		fprintf (stderr, "Reading `%s' failed: %s\n",
+				batch_file_g, strerror (errno));
+		ret = RET_UNKNOWN;
+	}
+	if (fh != stdin)
+		fclose (fh);
+
+	if (checks_num > 0)
+		idents = (char **) calloc (checks_num, sizeof (*idents));
+	if ((checks_num > 0) && (idents == NULL))
+	{
+		fprintf (stderr, "calloc failed: %s\n", strerror (errno));
+		checks_num = 0;
+		ret = RET_UNKNOWN;
+	}
+
+	for (i = 0; i < checks_num; i++)
+	{
+		check_t *c = checks + i;
+		char ident_str[1024];
+
+		snprintf (ident_str, sizeof (ident_str), "%s/%s",
+				c->host, c->value_spec);
+		ident_str[sizeof (ident_str) - 1] = 0;
+
+		if ((lcc_string_to_identifier (connection, &c->ident, ident_str) != 0)
+				|| (lcc_identifier_to_string (connection, ident_str,
+						sizeof (ident_str), &c->ident) != 0))
+			continue;
+
+		idents[idents_num] = cn_strdup (ident_str);
+		if (idents[idents_num] == NULL)
+			continue;
+		idents_num++;
+		c->ident_valid = 1;
+	}
+
+	status = 0;
+	if (idents_num > 0)
+		status = lcc_getval_multi (connection,
+				(const char * const *) idents, idents_num,
+				&res, &res_num);
+	if (status == 0)
+		qsort (res, res_num, sizeof (*res), compare_results);
+
+	for (i = 0; i < checks_num; i++)
+	{
+		check_t *c = checks + i;
+		lcc_getval_result_t key;
+		lcc_getval_result_t *r = NULL;
+		int code;
+
+		output_len_g = 0;
+		output_g[0] = 0;
+
+		if (!c->ident_valid)
+		{
+			cn_printf ("ERROR: Creating an identifier failed.");
+			code = RET_CRITICAL;
+		}
+		else if (status != 0)
+		{
+			cn_printf ("ERROR: Retrieving values from the daemon failed: "
+					"%s.", lcc_strerror (connection));
+			code = RET_CRITICAL;
+		}
+		else
+		{
+			key.identifier = c->ident;
+			if (res_num > 0)
+				r = bsearch (&key, res, res_num, sizeof (*res),
+						compare_results);
+
+			if (r == NULL)
+			{
+				cn_printf ("ERROR: Retrieving values from the daemon "
+						"failed: No such value.");
+				code = RET_CRITICAL;
+			}
+			else
+			{
+				check_restore (c);
+				code = do_batch_check (r);
+			}
+		}
+
+		print_passive_result (c, code);
+		if (code > ret)
+			ret = code;
+	}
+
+	LCC_DESTROY (connection);
+
+	lcc_getval_result_free (res, res_num);
+	for (i = 0; i < idents_num; i++)
+		free (idents[i]);
+	free (idents);
+	for (i = 0; i < checks_num; i++)
+		check_free (checks + i, &defaults);
+	free (checks);
+
+	return (ret);
+} /* }}} int do_batch */
 
 int main (int argc, char **argv)
 {
@@ -647,76 +1181,31 @@ int main (int argc, char **argv)
 	{
 		int c;
 
-		c = getopt (argc, argv, "w:c:s:n:H:g:d:hm");
+		c = getopt (argc, argv, "w:c:s:n:H:N:g:d:b:hm");
 		if (c < 0)
 			break;
 
 		switch (c)
 		{
-			case 'c':
-				parse_range (optarg, &range_critical_g);
-				break;
-			case 'w':
-				parse_range (optarg, &range_warning_g);
-				break;
 			case 's':
 				socket_file_g = optarg;
 				break;
-			case 'n':
-				value_string_g = optarg;
-				break;
-			case 'H':
-				hostname_g = optarg;
-				break;
-			case 'g':
-				if (strcasecmp (optarg, "none") == 0)
-					consolitation_g = CON_NONE;
-				else if (strcasecmp (optarg, "average") == 0)
-					consolitation_g = CON_AVERAGE;
-				else if (strcasecmp (optarg, "sum") == 0)
-					consolitation_g = CON_SUM;
-				else if (strcasecmp (optarg, "percentage") == 0)
-					consolitation_g = CON_PERCENTAGE;
-				else
-				{
-					fprintf (stderr, "Unknown consolidation function `%s'.\n",
-							optarg);
-					usage (argv[0]);
-				}
-				break;
-			case 'd':
-			{
-				char **tmp;
-				tmp = (char **) realloc (match_ds_g,
-						(match_ds_num_g + 1)
-						* sizeof (char *));
-				if (tmp == NULL)
-				{
-					fprintf (stderr, "realloc failed: %s\n",
-							strerror (errno));
-					return (RET_UNKNOWN);
-				}
-				match_ds_g = tmp;
-				match_ds_g[match_ds_num_g] = cn_strdup (optarg);
-				if (match_ds_g[match_ds_num_g] == NULL)
-				{
-					fprintf (stderr, "cn_strdup failed: %s\n",
-							strerror (errno));
-					return (RET_UNKNOWN);
-				}
-				match_ds_num_g++;
-				break;
-			}
-			case 'm':
-				nan_is_error_g = 1;
+			case 'b':
+				batch_file_g = optarg;
 				break;
 			default:
-				usage (argv[0]);
+				status = parse_check_option (c, optarg);
+				if (status == ENOMEM)
+					return (RET_UNKNOWN);
+				else if (status != 0)
+					usage (argv[0]);
 		} /* switch (c) */
 	}
 
-	if ((socket_file_g == NULL) || (value_string_g == NULL)
-			|| ((hostname_g == NULL) && (strcasecmp (value_string_g, "LIST"))))
+	if ((socket_file_g == NULL)
+			|| ((batch_file_g == NULL) && ((value_string_g == NULL)
+					|| ((hostname_g == NULL)
+						&& (strcasecmp (value_string_g, "LIST"))))))
 	{
 		fprintf (stderr, "Missing required arguments.\n");
 		usage (argv[0]);
@@ -734,6 +1223,9 @@ int main (int argc, char **argv)
 		return (RET_CRITICAL);
 	}
 
+	if (batch_file_g != NULL)
+		return (do_batch (connection));
+
 	if (0 == strcasecmp (value_string_g, "LIST"))
 		return (do_listval (connection));
 
@@ -0,0 +1,690 @@
+/**
+ * collectd - src/collectd-replay.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Records the datagrams sent to a network plugin and replays them, possibly
+ * faster and on behalf of many hosts, to benchmark a receiving daemon.
+ */
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libcollectdclient/client.h"
+#include "network.h"
+
+#define DEFAULT_SOCK LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+
+/* The file starts with this magic string, followed by records of a 64 bit
+ * time in nanoseconds since the recording started, a 32 bit length and the
+ * datagram, all in network byte order. */
+#define REPLAY_MAGIC "collectd-replay1"
+#define REPLAY_MAGIC_LEN 16
+
+/* Large enough for any UDP datagram. */
+#define REPLAY_BUFFER_SIZE 65536
+
+extern char *optarg;
+extern int   optind;
+
+static volatile int loop = 1;
+
+static void exit_usage (const char *name, int status) {
+  fprintf ((status == 0) ? stdout : stderr,
+      "Usage: %s [options] record <file> [<address> [<port>]]\n"
+      "       %s [options] replay <file> <address> [<port>]\n\n"
+
+      "Available options:\n"
+      "  -r <rate>   Replay at <rate> times the recorded speed, or as fast as\n"
+      "              possible with \"max\". Default: 1\n"
+      "  -n <num>    Simulate <num> senders by appending \"-<n>\" to host names.\n"
+      "              Each datagram is sent once per sender. Default: 1\n"
+      "  -l <num>    Replay the file <num> times, 0 means forever. Default: 1\n"
+      "  -c <num>    Stop recording after <num> datagrams.\n"
+      "  -s <path>   Read the receiver's statistics from this UNIX socket\n"
+      "              every second while replaying.\n"
+      "  -H <host>   Host name the receiver reports its statistics as.\n"
+      "              Default: the local host name\n"
+
+      "\n  -h          Display this help and exit.\n"
+
+      "\nThe receiver needs the unixsock plugin and `ReportStats' enabled in\n"
+      "the network plugin for -s. The default port is "NET_DEFAULT_PORT".\n"
+
+      "\n"PACKAGE" "VERSION", http://collectd.org/\n"
+      "for contributions see `AUTHORS'\n"
+      , name, name);
+  exit (status);
+} /* exit_usage */
+
+static void sig_handler (int __attribute__((unused)) signal)
+{
+  loop = 0;
+} /* sig_handler */
+
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (((uint64_t) ts.tv_sec) * 1000000000ULL + (uint64_t) ts.tv_nsec);
+} /* now_ns */
+
+static void sleep_until (uint64_t when)
+{
+  uint64_t now = now_ns ();
+  struct timespec ts;
+
+  if (when <= now)
+    return;
+
+  ts.tv_sec = (time_t) ((when - now) / 1000000000ULL);
+  ts.tv_nsec = (long) ((when - now) % 1000000000ULL);
+  while ((nanosleep (&ts, &ts) != 0) && (errno == EINTR) && loop)
+    /* continue */;
+} /* sleep_until */
+
+static void write_u64 (unsigned char *buffer, uint64_t value)
+{
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    buffer[i] = (unsigned char) (value & 0xff);
+    value >>= 8;
+  }
+} /* write_u64 */
+
+static uint64_t read_u64 (const unsigned char *buffer)
+{
+  uint64_t value = 0;
+  int i;
+
+  for (i = 0; i < 8; i++)
+    value = (value << 8) | buffer[i];
+  return (value);
+} /* read_u64 */
+
+static int open_socket (const char *node, const char *service,
+    int do_bind)
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  int fd = -1;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+  ai_hints.ai_protocol = IPPROTO_UDP;
+  if (do_bind)
+    ai_hints.ai_flags = AI_PASSIVE;
+
+  status = getaddrinfo (node, service, &ai_hints, &ai_list);
+  if (status != 0) {
+    fprintf (stderr, "ERROR: Resolving %s:%s failed: %s\n",
+        (node != NULL) ? node : "*", service, gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) {
+    fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (fd < 0)
+      continue;
+
+    if (!do_bind) {
+      if (connect (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+        break;
+    }
+    else {
+      int yes = 1;
+
+      setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (yes));
+      if (bind (fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0) {
+        /* Join the group to record multicast traffic. */
+        if (ai_ptr->ai_family == AF_INET) {
+          struct sockaddr_in *addr = (struct sockaddr_in *) ai_ptr->ai_addr;
+
+          if (IN_MULTICAST (ntohl (addr->sin_addr.s_addr))) {
+            struct ip_mreq mreq;
+
+            memset (&mreq, 0, sizeof (mreq));
+            mreq.imr_multiaddr.s_addr = addr->sin_addr.s_addr;
+            mreq.imr_interface.s_addr = htonl (INADDR_ANY);
+            setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                &mreq, sizeof (mreq));
+          }
+        }
+        else if (ai_ptr->ai_family == AF_INET6) {
+          struct sockaddr_in6 *addr = (struct sockaddr_in6 *) ai_ptr->ai_addr;
+
+          if (IN6_IS_ADDR_MULTICAST (&addr->sin6_addr)) {
+            struct ipv6_mreq mreq;
+
+            memset (&mreq, 0, sizeof (mreq));
+            memcpy (&mreq.ipv6mr_multiaddr, &addr->sin6_addr,
+                sizeof (addr->sin6_addr));
+            mreq.ipv6mr_interface = 0;
+            setsockopt (fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+                &mreq, sizeof (mreq));
+          }
+        }
+        break;
+      }
+    }
+
+    close (fd);
+    fd = -1;
+  }
+
+  if (fd < 0)
+    fprintf (stderr, "ERROR: Cannot %s %s:%s: %s\n",
+        do_bind ? "bind to" : "connect to",
+        (node != NULL) ? node : "*", service, strerror (errno));
+
+  freeaddrinfo (ai_list);
+  return (fd);
+} /* open_socket */
+
+static int record (const char *file, const char *node, const char *service,
+    uint64_t max_count)
+{
+  char buffer[REPLAY_BUFFER_SIZE];
+  uint64_t count = 0;
+  uint64_t start = 0;
+  FILE *fh;
+  int fd;
+
+  fd = open_socket (node, service, /* bind = */ 1);
+  if (fd < 0)
+    return (-1);
+
+  fh = fopen (file, "w");
+  if (fh == NULL) {
+    fprintf (stderr, "ERROR: Cannot open %s: %s\n", file, strerror (errno));
+    close (fd);
+    return (-1);
+  }
+  fwrite (REPLAY_MAGIC, 1, REPLAY_MAGIC_LEN, fh);
+
+  fprintf (stderr, "Recording to %s, press Ctrl+C to stop.\n", file);
+
+  while (loop && ((max_count == 0) || (count < max_count))) {
+    unsigned char tmp64[8];
+    uint64_t time_ns;
+    uint32_t tmp32;
+    ssize_t len;
+
+    len = recv (fd, buffer, sizeof (buffer), /* flags = */ 0);
+    if (len < 0) {
+      if (errno == EINTR)
+        continue;
+      fprintf (stderr, "ERROR: recv failed: %s\n", strerror (errno));
+      break;
+    }
+
+    if (count == 0)
+      start = now_ns ();
+    time_ns = now_ns () - start;
+
+    write_u64 (tmp64, time_ns);
+    tmp32 = htonl ((uint32_t) len);
+    if ((fwrite (tmp64, sizeof (tmp64), 1, fh) != 1)
+        || (fwrite (&tmp32, sizeof (tmp32), 1, fh) != 1)
+        || (fwrite (buffer, 1, (size_t) len, fh) != (size_t) len)) {
+      fprintf (stderr, "ERROR: Writing to %s failed: %s\n",
+          file, strerror (errno));
+      break;
+    }
+    count++;
+  }
+
+  fclose (fh);
+  close (fd);
+
+  fprintf (stderr, "Recorded %"PRIu64" datagrams.\n", count);
+  return (0);
+} /* record */
+
+/* Reads the next record from `fh'. Returns 1 at the end of the file. */
+static int read_record (FILE *fh, uint64_t *ret_time, char *buffer,
+    size_t *ret_len)
+{
+  unsigned char tmp64[8];
+  uint32_t tmp32;
+
+  if (fread (tmp64, sizeof (tmp64), 1, fh) != 1)
+    return (1);
+  if (fread (&tmp32, sizeof (tmp32), 1, fh) != 1)
+    return (-1);
+
+  *ret_time = read_u64 (tmp64);
+  *ret_len = (size_t) ntohl (tmp32);
+  if (*ret_len > REPLAY_BUFFER_SIZE)
+    return (-1);
+
+  if (fread (buffer, 1, *ret_len, fh) != *ret_len)
+    return (-1);
+  return (0);
+} /* read_record */
+
+/* Copies the datagram `in' to `out', appending `suffix' to the host names.
+ * Signed or encrypted datagrams can't be changed and compressed parts are
+ * copied unchanged. References to earlier strings use the string's index,
+ * so they keep working. Returns the size of `out' or zero if the datagram
+ * can't be rewritten. */
+static size_t rewrite_hosts (const char *in, size_t in_len,
+    char *out, size_t out_size, const char *suffix)
+{
+  size_t suffix_len = strlen (suffix);
+  size_t in_pos = 0;
+  size_t out_pos = 0;
+
+  while (in_pos + 4 <= in_len) {
+    uint16_t type;
+    uint16_t length;
+
+    memcpy (&type, in + in_pos, sizeof (type));
+    memcpy (&length, in + in_pos + 2, sizeof (length));
+    type = ntohs (type);
+    length = ntohs (length);
+
+    if ((length < 4) || (in_pos + length > in_len))
+      break;
+
+    if ((type == TYPE_SIGN_SHA256) || (type == TYPE_ENCR_AES256))
+      return (0);
+
+    if ((type == TYPE_HOST) && (length > 4)
+        && (in[in_pos + length - 1] == 0)) {
+      size_t new_length = length + suffix_len;
+      uint16_t tmp16;
+
+      if ((new_length > 0xffff) || (out_pos + new_length > out_size))
+        return (0);
+
+      tmp16 = htons ((uint16_t) new_length);
+      memcpy (out + out_pos, in + in_pos, 2);
+      memcpy (out + out_pos + 2, &tmp16, sizeof (tmp16));
+      memcpy (out + out_pos + 4, in + in_pos + 4, length - 5);
+      memcpy (out + out_pos + length - 1, suffix, suffix_len);
+      out[out_pos + new_length - 1] = 0;
+      out_pos += new_length;
+    }
+    else {
+      if (out_pos + length > out_size)
+        return (0);
+      memcpy (out + out_pos, in + in_pos, length);
+      out_pos += length;
+    }
+
+    in_pos += length;
+  }
+
+  /* Trailing garbage is passed on, too. */
+  if (in_pos < in_len) {
+    if (out_pos + (in_len - in_pos) > out_size)
+      return (0);
+    memcpy (out + out_pos, in + in_pos, in_len - in_pos);
+    out_pos += in_len - in_pos;
+  }
+
+  return (out_pos);
+} /* rewrite_hosts */
+
+/* The receiver's statistics which are printed, see `network_stats_read'. */
+static const char *stats_names[] = {
+  "if_packets",
+  "total_values-dispatch-accepted",
+  "total_values-dispatch-ratelimited",
+  "if_rx_errors-buffers-exhausted",
+  "if_rx_errors-queue-full",
+  "if_rx_errors-memory-budget"
+};
+#define STATS_NUM (sizeof (stats_names) / sizeof (stats_names[0]))
+
+/* Prints the receiver's rates, as of its last read, to the current line. */
+static void print_receiver_stats (lcc_connection_t *c, const char *host)
+{
+  char pattern[1024];
+  const char *patterns[1];
+  lcc_getval_result_t *res = NULL;
+  size_t res_num = 0;
+  double rates[STATS_NUM];
+  size_t i;
+  size_t j;
+
+  snprintf (pattern, sizeof (pattern), "%s/network/*", host);
+  pattern[sizeof (pattern) - 1] = 0;
+  patterns[0] = pattern;
+
+  if (lcc_getval_multi (c, patterns, 1, &res, &res_num) != 0) {
+    printf ("  (%s)", lcc_strerror (c));
+    return;
+  }
+
+  for (i = 0; i < STATS_NUM; i++)
+    rates[i] = NAN;
+
+  for (i = 0; i < res_num; i++) {
+    char name[2 * LCC_NAME_LEN];
+
+    /* Skip the counters of pass-through sockets. */
+    if ((res[i].identifier.plugin_instance[0] != 0)
+        || (res[i].values_num < 1))
+      continue;
+
+    if (res[i].identifier.type_instance[0] != 0)
+      snprintf (name, sizeof (name), "%s-%s", res[i].identifier.type,
+          res[i].identifier.type_instance);
+    else
+      snprintf (name, sizeof (name), "%s", res[i].identifier.type);
+    name[sizeof (name) - 1] = 0;
+
+    for (j = 0; j < STATS_NUM; j++)
+      if (strcmp (name, stats_names[j]) == 0)
+        rates[j] = res[i].values[0];
+  }
+  lcc_getval_result_free (res, res_num);
+
+  printf (" %12.0f %12.0f %10.0f %10.0f %10.0f %10.0f",
+      rates[0], rates[1], rates[2], rates[3], rates[4], rates[5]);
+} /* print_receiver_stats */
+
+static void print_header (lcc_connection_t *c)
+{
+  printf ("%8s %12s %10s", "time", "sent/s", "Mbit/s");
+  if (c != NULL)
+    printf (" %12s %12s %10s %10s %10s %10s", "received/s", "values/s",
+        "limited/s", "no-buf/s", "q-full/s", "memory/s");
+  printf ("\n");
+} /* print_header */
+
+static int replay (const char *file, const char *node, const char *service,
+    double rate, int senders, uint64_t loops, lcc_connection_t *c,
+    const char *host)
+{
+  char buffer[REPLAY_BUFFER_SIZE];
+  char rewritten[REPLAY_BUFFER_SIZE];
+  char magic[REPLAY_MAGIC_LEN];
+  uint64_t start;
+  uint64_t loop_start;
+  uint64_t next_report;
+  uint64_t sent = 0;
+  uint64_t sent_bytes = 0;
+  uint64_t report_sent = 0;
+  uint64_t report_bytes = 0;
+  uint64_t loops_done = 0;
+  uint64_t last_time = 0;
+  FILE *fh;
+  int fd;
+
+  fh = fopen (file, "r");
+  if (fh == NULL) {
+    fprintf (stderr, "ERROR: Cannot open %s: %s\n", file, strerror (errno));
+    return (-1);
+  }
+
+  if ((fread (magic, 1, sizeof (magic), fh) != sizeof (magic))
+      || (memcmp (magic, REPLAY_MAGIC, REPLAY_MAGIC_LEN) != 0)) {
+    fprintf (stderr, "ERROR: %s is not a recording.\n", file);
+    fclose (fh);
+    return (-1);
+  }
+
+  fd = open_socket (node, service, /* bind = */ 0);
+  if (fd < 0) {
+    fclose (fh);
+    return (-1);
+  }
+
+  print_header (c);
+
+  start = now_ns ();
+  loop_start = start;
+  next_report = start + 1000000000ULL;
+
+  while (loop) {
+    uint64_t time_ns = 0;
+    uint64_t now;
+    size_t len = 0;
+    int status;
+    int i;
+
+    status = read_record (fh, &time_ns, buffer, &len);
+    if (status < 0) {
+      fprintf (stderr, "ERROR: %s is truncated.\n", file);
+      break;
+    }
+    else if (status > 0) {
+      loops_done++;
+      if ((loops != 0) && (loops_done >= loops))
+        break;
+
+      /* Start the next loop as if it had been recorded right after the
+       * last datagram. */
+      fseek (fh, REPLAY_MAGIC_LEN, SEEK_SET);
+      if (rate > 0.0)
+        loop_start += (uint64_t) (((double) last_time) / rate);
+      continue;
+    }
+    last_time = time_ns;
+
+    if (rate > 0.0)
+      sleep_until (loop_start + (uint64_t) (((double) time_ns) / rate));
+
+    for (i = 0; (i < senders) && loop; i++) {
+      const char *data = buffer;
+      size_t data_len = len;
+
+      if (senders > 1) {
+        char suffix[32];
+        size_t n;
+
+        snprintf (suffix, sizeof (suffix), "-%i", i);
+        n = rewrite_hosts (buffer, len, rewritten, sizeof (rewritten),
+            suffix);
+        if (n > 0) {
+          data = rewritten;
+          data_len = n;
+        }
+      }
+
+      /* The receiver may not be listening yet or drop datagrams, which
+       * is what this program is supposed to find out. */
+      if (send (fd, data, data_len, /* flags = */ 0) >= 0) {
+        sent++;
+        sent_bytes += data_len;
+      }
+      else if ((errno != ECONNREFUSED) && (errno != EINTR)
+          && (errno != ENOBUFS)) {
+        fprintf (stderr, "ERROR: send failed: %s\n", strerror (errno));
+        loop = 0;
+      }
+    }
+
+    now = now_ns ();
+    if (now >= next_report) {
+      double elapsed = ((double) (now - next_report + 1000000000ULL)) / 1e9;
+
+      printf ("%8.1f %12.0f %10.2f", ((double) (now - start)) / 1e9,
+          ((double) (sent - report_sent)) / elapsed,
+          ((double) (sent_bytes - report_bytes)) * 8.0 / elapsed / 1e6);
+      if (c != NULL)
+        print_receiver_stats (c, host);
+      printf ("\n");
+      fflush (stdout);
+
+      report_sent = sent;
+      report_bytes = sent_bytes;
+      next_report = now + 1000000000ULL;
+    }
+  }
+
+  fclose (fh);
+  close (fd);
+
+  {
+    double elapsed = ((double) (now_ns () - start)) / 1e9;
+
+    printf ("Sent %"PRIu64" datagrams (%"PRIu64" bytes) in %.1f seconds: "
+        "%.0f datagrams/s, %.2f Mbit/s.\n", sent, sent_bytes, elapsed,
+        (elapsed > 0.0) ? ((double) sent) / elapsed : 0.0,
+        (elapsed > 0.0) ? ((double) sent_bytes) * 8.0 / elapsed / 1e6 : 0.0);
+  }
+
+  return (0);
+} /* replay */
+
+int main (int argc, char **argv) {
+  char address[1024] = "";
+  char host[1024] = "";
+  double rate = 1.0;
+  int senders = 1;
+  uint64_t loops = 1;
+  uint64_t count = 0;
+  const char *service = NET_DEFAULT_PORT;
+  lcc_connection_t *c = NULL;
+  struct sigaction sa;
+  int status;
+
+  while (42) {
+    int opt;
+
+    opt = getopt (argc, argv, "r:n:l:c:s:H:h");
+
+    if (opt == -1)
+      break;
+
+    switch (opt) {
+      case 'r':
+        if (strcasecmp (optarg, "max") == 0)
+          rate = 0.0;
+        else {
+          rate = atof (optarg);
+          if (rate <= 0.0) {
+            fprintf (stderr, "ERROR: Invalid rate: %s\n", optarg);
+            exit_usage (argv[0], 1);
+          }
+        }
+        break;
+      case 'n':
+        senders = atoi (optarg);
+        if (senders < 1) {
+          fprintf (stderr, "ERROR: Invalid number of senders: %s\n", optarg);
+          exit_usage (argv[0], 1);
+        }
+        break;
+      case 'l':
+        loops = (uint64_t) strtoull (optarg, NULL, 10);
+        break;
+      case 'c':
+        count = (uint64_t) strtoull (optarg, NULL, 10);
+        break;
+      case 's':
+        snprintf (address, sizeof (address), "unix:%s", optarg);
+        address[sizeof (address) - 1] = '\0';
+        break;
+      case 'H':
+        snprintf (host, sizeof (host), "%s", optarg);
+        host[sizeof (host) - 1] = '\0';
+        break;
+      case 'h':
+        exit_usage (argv[0], 0);
+        break;
+      default:
+        exit_usage (argv[0], 1);
+    }
+  }
+
+  if ((argc - optind) < 2) {
+    fprintf (stderr, "%s: missing command or file\n", argv[0]);
+    exit_usage (argv[0], 1);
+  }
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = sig_handler;
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+
+  if ((argc - optind) >= 4)
+    service = argv[optind + 3];
+
+  if (strcasecmp (argv[optind], "record") == 0) {
+    status = record (argv[optind + 1],
+        ((argc - optind) >= 3) ? argv[optind + 2] : NULL, service, count);
+  }
+  else if (strcasecmp (argv[optind], "replay") == 0) {
+    if ((argc - optind) < 3) {
+      fprintf (stderr, "%s: missing address\n", argv[0]);
+      exit_usage (argv[0], 1);
+    }
+
+    if (address[0] != 0) {
+      if (lcc_connect (address, &c) != 0) {
+        fprintf (stderr, "ERROR: Failed to connect to daemon at %s: %s.\n",
+            address, strerror (errno));
+        return (1);
+      }
+
+      if ((host[0] == 0) && (gethostname (host, sizeof (host)) != 0)) {
+        fprintf (stderr, "ERROR: Failed to get local hostname: %s\n",
+            strerror (errno));
+        return (1);
+      }
+      host[sizeof (host) - 1] = '\0';
+    }
+
+    status = replay (argv[optind + 1], argv[optind + 2], service, rate,
+        senders, loops, c, host);
+
+    if (c != NULL)
+      LCC_DESTROY (c);
+  }
+  else {
+    fprintf (stderr, "%s: invalid command: %s\n", argv[0], argv[optind]);
+    return (1);
+  }
+
+  if (status != 0)
+    return (1);
+  return (0);
+} /* main */
+
+/* vim: set sw=2 ts=2 tw=78 expandtab : */
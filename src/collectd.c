@@ -31,6 +31,7 @@
 
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_handoff.h"
 
 #if HAVE_STATGRAB_H
 # include <statgrab.h>
@@ -468,6 +469,10 @@ int main (int argc, char **argv)
 	if (optind < argc)
 		exit_usage (1);
 
+	/* Before any file is opened, so the inherited sockets are where they
+	 * are expected. */
+	handoff_init ();
+
 	/*
 	 * Read options from the config file, the environment and the command
 	 * line (in that order, with later options overwriting previous ones in
@@ -602,6 +607,7 @@ int main (int argc, char **argv)
 	 * run the actual loops
 	 */
 	do_init ();
+	handoff_complete ();
 
 	if (test_readall)
 	{
@@ -86,7 +86,9 @@ static void exit_usage (const char *name, int status) {
 
       " * getval <identifier>\n"
       " * flush [timeout=<seconds>] [plugin=<name>] [identifier=<id>]\n"
-      " * listval\n"
+      "         [async=true]\n"
+      " * flush token=<token>\n"
+      " * listval [prefix=<identifier prefix>] [filter=<pattern>]\n"
       " * putval <identifier> [interval=<seconds>] <value-list(s)>\n"
 
       "\nIdentifiers:\n\n"
@@ -227,6 +229,9 @@ static int getval (lcc_connection_t *c, int argc, char **argv)
 static int flush (lcc_connection_t *c, int argc, char **argv)
 {
   int timeout = -1;
+  int async = 0;
+  int have_token = 0;
+  uint64_t token = 0;
 
   lcc_identifier_t *identifiers = NULL;
   int identifiers_num = 0;
@@ -279,6 +284,20 @@ static int flush (lcc_connection_t *c, int argc, char **argv)
             "%s.\n", endptr);
       }
     }
+    else if (strcasecmp (key, "async") == 0) {
+      async = (strcasecmp (value, "true") == 0);
+    }
+    else if (strcasecmp (key, "token") == 0) {
+      char *endptr = NULL;
+
+      token = (uint64_t) strtoull (value, &endptr, 10);
+      if ((endptr == value) || (*endptr != '\0')) {
+        fprintf (stderr, "ERROR: Failed to parse token as number: %s.\n",
+            value);
+        BAIL_OUT (-1);
+      }
+      have_token = 1;
+    }
     else if (strcasecmp (key, "plugin") == 0) {
       status = array_grow ((void *)&plugins, &plugins_num,
           sizeof (*plugins));
@@ -305,6 +324,19 @@ static int flush (lcc_connection_t *c, int argc, char **argv)
     }
   }
 
+  if (have_token) {
+    int done = 0;
+
+    status = lcc_flush_finished (c, token, &done);
+    if (status != 0) {
+      fprintf (stderr, "ERROR: Failed to query flush %"PRIu64": %s.\n",
+          token, lcc_strerror (c));
+      BAIL_OUT (-1);
+    }
+    printf ("%s\n", done ? "done" : "in progress");
+    BAIL_OUT (0);
+  }
+
   if (plugins_num == 0) {
     status = array_grow ((void *)&plugins, &plugins_num, sizeof (*plugins));
     if (status != 0)
@@ -314,6 +346,27 @@ static int flush (lcc_connection_t *c, int argc, char **argv)
     plugins[0] = NULL;
   }
 
+  /* Each plugin/identifier combination becomes a flush of its own; the
+   * tokens are printed one per line. */
+  if (async) {
+    for (i = 0; i < plugins_num; ++i) {
+      int j;
+
+      for (j = 0; j < ((identifiers_num > 0) ? identifiers_num : 1); ++j) {
+        status = lcc_flush_start (c, plugins[i],
+            (identifiers_num > 0) ? identifiers + j : NULL, timeout, &token);
+        if (status != 0) {
+          fprintf (stderr, "ERROR: Failed to start flushing plugin `%s': "
+              "%s.\n", (plugins[i] == NULL) ? "(all)" : plugins[i],
+              lcc_strerror (c));
+          continue;
+        }
+        printf ("%"PRIu64"\n", token);
+      }
+    }
+    BAIL_OUT (0);
+  }
+
   for (i = 0; i < plugins_num; ++i) {
     if (identifiers_num == 0) {
       status = lcc_flush (c, plugins[i], NULL, timeout);
@@ -343,19 +396,58 @@ static int flush (lcc_connection_t *c, int argc, char **argv)
 #undef BAIL_OUT
 } /* flush */
 
+static int listval_print (const lcc_identifier_t *ident,
+    double __attribute__((unused)) last_update, void *user_data)
+{
+  lcc_connection_t *c = user_data;
+  char id[1024];
+  int status;
+
+  status = lcc_identifier_to_string (c, id, sizeof (id), ident);
+  if (status != 0) {
+    fprintf (stderr, "ERROR: listval: Failed to convert returned "
+        "identifier to a string: %s\n", lcc_strerror (c));
+    return (0);
+  }
+
+  printf ("%s\n", id);
+  return (0);
+} /* listval_print */
+
 static int listval (lcc_connection_t *c, int argc, char **argv)
 {
   lcc_identifier_t *ret_ident     = NULL;
   size_t            ret_ident_num = 0;
+  const char       *prefix        = NULL;
+  const char       *filter        = NULL;
 
   int status;
   size_t i;
 
   assert (strcasecmp (argv[0], "listval") == 0);
 
-  if (argc != 1) {
-    fprintf (stderr, "ERROR: listval: Does not accept any arguments.\n");
-    return (-1);
+  for (i = 1; i < (size_t) argc; ++i) {
+    char *key, *value;
+
+    key   = argv[i];
+    value = strchr (argv[i], (int)'=');
+
+    if (! value) {
+      fprintf (stderr, "ERROR: listval: Invalid option ``%s''.\n", argv[i]);
+      return (-1);
+    }
+
+    *value = '\0';
+    ++value;
+
+    if (strcasecmp (key, "prefix") == 0)
+      prefix = value;
+    else if (strcasecmp (key, "filter") == 0)
+      filter = value;
+    else {
+      fprintf (stderr, "ERROR: listval: Unknown option `%s'.\n", key);
+      return (-1);
+    }
   }
 
 #define BAIL_OUT(s) \
@@ -366,7 +458,16 @@ static int listval (lcc_connection_t *c, int argc, char **argv)
     return (s); \
   } while (0)
 
-  status = lcc_listval (c, &ret_ident, &ret_ident_num);
+  /* The daemon does the matching and identifiers are printed as they
+   * arrive. */
+  if (filter != NULL) {
+    status = lcc_listval_stream (c, prefix, filter, listval_print, c);
+    if (status != 0)
+      fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
+    return (status);
+  }
+
+  status = lcc_listval_prefix (c, prefix, &ret_ident, &ret_ident_num);
   if (status != 0) {
     fprintf (stderr, "ERROR: %s\n", lcc_strerror (c));
     BAIL_OUT (status);
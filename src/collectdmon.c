@@ -31,6 +31,8 @@
 
 #include <fcntl.h>
 
+#include <poll.h>
+
 #include <signal.h>
 
 #include <stdio.h>
@@ -41,9 +43,11 @@
 #include <syslog.h>
 
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 
 #include <time.h>
@@ -64,6 +68,18 @@ static int restart = 0;
 static char  *pidfile      = NULL;
 static pid_t  collectd_pid = 0;
 
+/* The listening sockets of the last collectd which passed them on. They are
+ * kept open while collectd restarts, so no packets or connections are lost,
+ * and are passed to the next collectd, see utils_handoff.h. */
+#define HANDOFF_FDS_MAX 64
+static int    handoff_fds[HANDOFF_FDS_MAX];
+static int    handoff_fds_num = 0;
+/* Connected to the running collectd, which sends its sockets once it has
+ * been initialized. */
+static int    control_fd = -1;
+/* Passed to collectd as COLLECTD_CACHE_FILE. */
+static char  *cache_file = NULL;
+
 static void exit_usage (char *name)
 {
 	printf ("Usage: %s <options> [-- <collectd options>]\n"
@@ -72,6 +88,7 @@ static void exit_usage (char *name)
 			"  -h         Display this help and exit.\n"
 			"  -c <path>  Path to the collectd binary.\n"
 			"  -P <file>  PID-file.\n"
+			"  -S <file>  File to pass the value cache on in restarts.\n"
 
 			"\nFor <collectd options> see collectd.conf(5).\n"
 
@@ -170,19 +187,173 @@ static int daemonize (void)
 	return 0;
 } /* daemonize */
 
+static void set_cloexec (int fd)
+{
+	int flags = fcntl (fd, F_GETFD);
+
+	if (0 <= flags)
+		fcntl (fd, F_SETFD, flags | FD_CLOEXEC);
+	return;
+} /* set_cloexec */
+
+static void handoff_close (void)
+{
+	int i = 0;
+
+	for (i = 0; i < handoff_fds_num; ++i)
+		close (handoff_fds[i]);
+	handoff_fds_num = 0;
+	return;
+} /* handoff_close */
+
+/* Removes the files of the UNIX sockets which won't be passed on anymore. */
+static void handoff_unlink (void)
+{
+	int i = 0;
+
+	for (i = 0; i < handoff_fds_num; ++i) {
+		struct sockaddr_un sa;
+		socklen_t sa_len = sizeof (sa);
+
+		memset (&sa, 0, sizeof (sa));
+		if ((0 == getsockname (handoff_fds[i], (struct sockaddr *)&sa, &sa_len))
+				&& (AF_UNIX == sa.sun_family) && ('\0' != sa.sun_path[0]))
+			unlink (sa.sun_path);
+	}
+	return;
+} /* handoff_unlink */
+
+/* Reads the sockets collectd has sent, replacing the ones held so far. */
+static void handoff_receive (void)
+{
+	char   message[64];
+	char   control[CMSG_SPACE (HANDOFF_FDS_MAX * sizeof (int))];
+	struct iovec    iov;
+	struct msghdr   msg;
+	struct cmsghdr *cmsg = NULL;
+	ssize_t status = 0;
+	int     i = 0;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = message;
+	iov.iov_len  = sizeof (message);
+	msg.msg_iov        = &iov;
+	msg.msg_iovlen     = 1;
+	msg.msg_control    = control;
+	msg.msg_controllen = sizeof (control);
+
+	status = recvmsg (control_fd, &msg, 0);
+	if (0 >= status) {
+		/* collectd has closed its end */
+		close (control_fd);
+		control_fd = -1;
+		return;
+	}
+
+	handoff_close ();
+
+	for (cmsg = CMSG_FIRSTHDR (&msg); NULL != cmsg;
+			cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+		int num = 0;
+
+		if ((SOL_SOCKET != cmsg->cmsg_level) || (SCM_RIGHTS != cmsg->cmsg_type))
+			continue;
+
+		num = (int)((cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int));
+		for (i = 0; i < num; ++i) {
+			int fd = ((int *)CMSG_DATA (cmsg))[i];
+
+			if (HANDOFF_FDS_MAX <= handoff_fds_num) {
+				close (fd);
+				continue;
+			}
+			set_cloexec (fd);
+			handoff_fds[handoff_fds_num] = fd;
+			++handoff_fds_num;
+		}
+	}
+
+	if (0 != (msg.msg_flags & MSG_CTRUNC))
+		syslog (LOG_WARNING, "Warning: collectd passed more than %i sockets",
+				HANDOFF_FDS_MAX);
+
+	syslog (LOG_INFO, "Info: holding %i socket%s of collectd",
+			handoff_fds_num, (1 == handoff_fds_num) ? "" : "s");
+	return;
+} /* handoff_receive */
+
+/* In the child: moves the held sockets to the file descriptors 3, 4, ...,
+ * and the control socket behind them, and sets up the environment. */
+static int handoff_setup_child (int control)
+{
+	int  fds[HANDOFF_FDS_MAX + 1];
+	int  fds_num = handoff_fds_num + 1;
+	int  base    = 3 + fds_num;
+	char buffer[32];
+	int  i = 0;
+
+	/* Move them out of the way first, so they don't overwrite each other. */
+	for (i = 0; i < handoff_fds_num; ++i)
+		fds[i] = handoff_fds[i];
+	fds[handoff_fds_num] = control;
+
+	for (i = 0; i < fds_num; ++i) {
+		int tmp = fcntl (fds[i], F_DUPFD, base);
+
+		if (0 > tmp)
+			return -1;
+		set_cloexec (tmp);
+		fds[i] = tmp;
+	}
+
+	/* dup2() clears FD_CLOEXEC on the new descriptors */
+	for (i = 0; i < fds_num; ++i)
+		if (0 > dup2 (fds[i], 3 + i))
+			return -1;
+
+	snprintf (buffer, sizeof (buffer), "%i", handoff_fds_num);
+	setenv ("LISTEN_FDS", buffer, 1);
+	snprintf (buffer, sizeof (buffer), "%i", (int)getpid ());
+	setenv ("LISTEN_PID", buffer, 1);
+	snprintf (buffer, sizeof (buffer), "%i", 3 + handoff_fds_num);
+	setenv ("COLLECTDMON_FD", buffer, 1);
+
+	if (NULL != cache_file)
+		setenv ("COLLECTD_CACHE_FILE", cache_file, 1);
+	return 0;
+} /* handoff_setup_child */
+
 static int collectd_start (char **argv)
 {
 	pid_t pid = 0;
+	int   sv[2] = { -1, -1 };
+
+	if (0 != socketpair (AF_UNIX, SOCK_DGRAM, 0, sv)) {
+		syslog (LOG_ERR, "Error: socketpair() failed: %s", strerror (errno));
+		return -1;
+	}
+	set_cloexec (sv[0]);
+	set_cloexec (sv[1]);
 
 	if (0 > (pid = fork ())) {
 		syslog (LOG_ERR, "Error: fork() failed: %s", strerror (errno));
+		close (sv[0]);
+		close (sv[1]);
 		return -1;
 	}
 	else if (pid != 0) {
+		close (sv[1]);
+		if (0 <= control_fd)
+			close (control_fd);
+		control_fd   = sv[0];
 		collectd_pid = pid;
 		return 0;
 	}
 
+	if (0 != handoff_setup_child (sv[1]))
+		syslog (LOG_ERR, "Error: passing the sockets to collectd failed: %s",
+				strerror (errno));
+
 	execvp (argv[0], argv);
 	syslog (LOG_ERR, "Error: execvp(%s) failed: %s",
 			argv[0], strerror (errno));
@@ -268,7 +439,7 @@ int main (int argc, char **argv)
 
 	/* parse command line options */
 	while (42) {
-		int c = getopt (argc, argv, "hc:P:");
+		int c = getopt (argc, argv, "hc:P:S:");
 
 		if (-1 == c)
 			break;
@@ -280,6 +451,9 @@ int main (int argc, char **argv)
 			case 'P':
 				pidfile = optarg;
 				break;
+			case 'S':
+				cache_file = optarg;
+				break;
 			case 'h':
 			default:
 				exit_usage (argv[0]);
@@ -336,7 +510,8 @@ int main (int argc, char **argv)
 	}
 
 	while (0 == loop) {
-		int status = 0;
+		int status  = 0;
+		int stopped = 0;
 
 		if (0 != collectd_start (collectd_argv)) {
 			syslog (LOG_ERR, "Error: failed to start collectd.");
@@ -344,10 +519,26 @@ int main (int argc, char **argv)
 		}
 
 		assert (0 < collectd_pid);
-		while ((collectd_pid != waitpid (collectd_pid, &status, 0))
-				&& (EINTR == errno))
-			if ((0 != loop) || (0 != restart))
+		while (42) {
+			struct pollfd pfd;
+			pid_t pid = waitpid (collectd_pid, &status, WNOHANG);
+
+			if ((collectd_pid == pid) || ((0 > pid) && (EINTR != errno)))
+				break;
+
+			if ((0 == stopped) && ((0 != loop) || (0 != restart))) {
 				collectd_stop ();
+				stopped = 1;
+			}
+
+			/* Signals interrupt poll(), so they are handled right away. */
+			pfd.fd      = control_fd;
+			pfd.events  = POLLIN;
+			pfd.revents = 0;
+			if ((0 < poll (&pfd, (0 <= control_fd) ? 1 : 0, 1000))
+					&& (0 != pfd.revents))
+				handoff_receive ();
+		}
 
 		collectd_pid = 0;
 
@@ -364,6 +555,9 @@ int main (int argc, char **argv)
 
 	syslog (LOG_INFO, "Info: shutting down collectdmon");
 
+	handoff_unlink ();
+	handoff_close ();
+
 	pidfile_delete ();
 	closelog ();
 
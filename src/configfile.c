@@ -98,9 +98,35 @@ static cf_global_option_t cf_global_options[] =
 	{"FQDNLookup",  NULL, "true"},
 	{"Interval",    NULL, "10"},
 	{"ReadThreads", NULL, "5"},
+	{"SlowReadThreads", NULL, "2"},
+	{"ReadThreadsCPUs",     NULL, NULL},
+	{"SlowReadThreadsCPUs", NULL, NULL},
+	{"InitThreads", NULL, "5"},
+	{"PhaseSpreading", NULL, "false"},
+	{"CacheReadTime",  NULL, "false"},
 	{"Timeout",     NULL, "2"},
 	{"PreCacheChain",  NULL, "PreCache"},
-	{"PostCacheChain", NULL, "PostCache"}
+	{"PostCacheChain", NULL, "PostCache"},
+	{"CacheFile",       NULL, NULL},
+	{"CacheFileMaxAge", NULL, NULL},
+	{"CacheNewEntriesLimit",        NULL, NULL},
+	{"CacheNewEntriesPerHostLimit", NULL, NULL},
+	{"TypesDBCacheDir", NULL, NULL},
+	{"WriteQueueThreads",    NULL, "0"},
+	{"WriteQueueThreadsCPUs", NULL, NULL},
+	{"WriteQueueLimit",      NULL, "10000"},
+	{"WriteQueueDropPolicy", NULL, "DropOldest"},
+	{"LogQueueLimit",        NULL, "0"},
+	{"NotificationQueueLimit",   NULL, "0"},
+	{"NotificationQueueThreads", NULL, "1"},
+	{"NotificationCoalesceInterval", NULL, "0"},
+	{"FilterChainStatistics", NULL, "false"},
+	{"CallbackStatistics", NULL, "false"},
+	{"PipelineTracing",    NULL, "false"},
+	{"MemoryBudget",       NULL, NULL},
+	{"MemoryStatistics",   NULL, "false"},
+	{"DeferredLoading",    NULL, "false"},
+	{"ReportStartupTimes", NULL, "false"}
 };
 static int cf_global_options_num = STATIC_ARRAY_LEN (cf_global_options);
 
@@ -244,6 +270,15 @@ static int dispatch_loadplugin (const oconfig_item_t *ci)
 	int i;
 	const char *name;
 	unsigned int flags = 0;
+	cdtime_t read_timeout = 0;
+	_Bool slow_reads = 0;
+	_Bool have_read_options = 0;
+	cdtime_t write_interval = 0;
+	int consolidation = PLUGIN_CONSOLIDATE_AVERAGE;
+	char *spool_dir = NULL;
+	int spool_size = 256;
+	int spool_rate = 0;
+	_Bool deferred = IS_TRUE (global_option_get ("DeferredLoading"));
 	assert (strcasecmp (ci->key, "LoadPlugin") == 0);
 
 	if (ci->values_num != 1)
@@ -271,6 +306,43 @@ static int dispatch_loadplugin (const oconfig_item_t *ci)
 	for (i = 0; i < ci->children_num; ++i) {
 		if (strcasecmp("Globals", ci->children[i].key) == 0)
 			cf_util_get_flag (ci->children + i, &flags, PLUGIN_FLAGS_GLOBAL);
+		else if (strcasecmp ("ReadTimeout", ci->children[i].key) == 0) {
+			if (cf_util_get_cdtime (ci->children + i, &read_timeout) == 0)
+				have_read_options = 1;
+		}
+		else if (strcasecmp ("SlowReads", ci->children[i].key) == 0) {
+			if (cf_util_get_boolean (ci->children + i, &slow_reads) == 0)
+				have_read_options = 1;
+		}
+		else if (strcasecmp ("WriteInterval", ci->children[i].key) == 0)
+			cf_util_get_cdtime (ci->children + i, &write_interval);
+		else if (strcasecmp ("Consolidation", ci->children[i].key) == 0) {
+			char function[16];
+
+			if (cf_util_get_string_buffer (ci->children + i,
+						function, sizeof (function)) != 0)
+				continue;
+
+			if (strcasecmp ("Average", function) == 0)
+				consolidation = PLUGIN_CONSOLIDATE_AVERAGE;
+			else if ((strcasecmp ("Max", function) == 0)
+					|| (strcasecmp ("Maximum", function) == 0))
+				consolidation = PLUGIN_CONSOLIDATE_MAXIMUM;
+			else if (strcasecmp ("Last", function) == 0)
+				consolidation = PLUGIN_CONSOLIDATE_LAST;
+			else
+				WARNING ("Ignoring unknown consolidation function "
+						"\"%s\" for plugin \"%s\"",
+						function, name);
+		}
+		else if (strcasecmp ("SpoolDirectory", ci->children[i].key) == 0)
+			cf_util_get_string (ci->children + i, &spool_dir);
+		else if (strcasecmp ("SpoolSize", ci->children[i].key) == 0)
+			cf_util_get_int (ci->children + i, &spool_size);
+		else if (strcasecmp ("SpoolReplayRate", ci->children[i].key) == 0)
+			cf_util_get_int (ci->children + i, &spool_rate);
+		else if (strcasecmp ("Deferred", ci->children[i].key) == 0)
+			cf_util_get_boolean (ci->children + i, &deferred);
 		else {
 			WARNING("Ignoring unknown LoadPlugin option \"%s\" "
 					"for plugin \"%s\"",
@@ -278,43 +350,39 @@ static int dispatch_loadplugin (const oconfig_item_t *ci)
 		}
 	}
 
+	/* Read functions may be registered by `module_register', so the
+	 * options have to be known first. */
+	if (have_read_options)
+		plugin_set_read_options (name, read_timeout, slow_reads);
+	/* Likewise, write callbacks are usually registered by
+	 * `module_register'. */
+	if (write_interval > 0)
+		plugin_set_write_options (name, write_interval, consolidation);
+	if (spool_dir != NULL)
+	{
+		/* The size is given in megabytes. */
+		if (spool_size <= 0)
+			spool_size = 256;
+		plugin_set_spool_options (name, spool_dir,
+				((uint64_t) spool_size) * 1048576,
+				(spool_rate > 0) ? (double) spool_rate : 0.0);
+		sfree (spool_dir);
+	}
+
+	if (deferred)
+		return (plugin_load_deferred (name, (uint32_t) flags));
+
 	return (plugin_load (name, (uint32_t) flags));
 } /* int dispatch_value_loadplugin */
 
 static int dispatch_value_plugin (const char *plugin, oconfig_item_t *ci)
 {
-	char  buffer[4096];
-	char *buffer_ptr;
-	int   buffer_free;
-	int i;
+	char buffer[4096];
 
-	buffer_ptr = buffer;
-	buffer_free = sizeof (buffer);
-
-	for (i = 0; i < ci->values_num; i++)
-	{
-		int status = -1;
-
-		if (ci->values[i].type == OCONFIG_TYPE_STRING)
-			status = ssnprintf (buffer_ptr, buffer_free, " %s",
-					ci->values[i].value.string);
-		else if (ci->values[i].type == OCONFIG_TYPE_NUMBER)
-			status = ssnprintf (buffer_ptr, buffer_free, " %lf",
-					ci->values[i].value.number);
-		else if (ci->values[i].type == OCONFIG_TYPE_BOOLEAN)
-			status = ssnprintf (buffer_ptr, buffer_free, " %s",
-					ci->values[i].value.boolean
-					? "true" : "false");
-
-		if ((status < 0) || (status >= buffer_free))
-			return (-1);
-		buffer_free -= status;
-		buffer_ptr  += status;
-	}
-	/* skip the initial space */
-	buffer_ptr = buffer + 1;
+	if (cf_util_get_values_string (ci, buffer, sizeof (buffer)) != 0)
+		return (-1);
 
-	return (cf_dispatch (plugin, ci->key, buffer_ptr));
+	return (cf_dispatch (plugin, ci->key, buffer));
 } /* int dispatch_value_plugin */
 
 static int dispatch_value (const oconfig_item_t *ci)
@@ -355,6 +423,9 @@ static int dispatch_block_plugin (oconfig_item_t *ci)
 
 	name = ci->values[0].value.string;
 
+	/* A deferred plugin is loaded once its configuration is reached. */
+	plugin_load_pending (name);
+
 	/* Check for a complex callback first */
 	for (cb = complex_callback_head; cb != NULL; cb = cb->next)
 		if (strcasecmp (name, cb->type) == 0)
@@ -393,103 +464,61 @@ static int dispatch_block (oconfig_item_t *ci)
 	return (0);
 }
 
-static int cf_ci_replace_child (oconfig_item_t *dst, oconfig_item_t *src,
-		int offset)
+/* Appends `src_num' items to the children of `dst'. `dst_size' holds the
+ * number of children allocated and is doubled whenever it is exhausted, so
+ * assembling the children of many statements or files takes linear time. */
+static int cf_ci_append_items (oconfig_item_t *dst, int *dst_size,
+		const oconfig_item_t *src, int src_num)
 {
-	oconfig_item_t *temp;
-	int i;
-
-	assert (offset >= 0);
-	assert (dst->children_num > offset);
-
-	/* Free the memory used by the replaced child. Usually that's the
-	 * `Include "blah"' statement. */
-	temp = dst->children + offset;
-	for (i = 0; i < temp->values_num; i++)
-	{
-		if (temp->values[i].type == OCONFIG_TYPE_STRING)
-		{
-			sfree (temp->values[i].value.string);
-		}
-	}
-	sfree (temp->values);
-	temp = NULL;
-
-	/* If (src->children_num == 0) the array size is decreased. If offset
-	 * is _not_ the last element, (offset < (dst->children_num - 1)), then
-	 * we need to move the trailing elements before resizing the array. */
-	if ((src->children_num == 0) && (offset < (dst->children_num - 1)))
-	{
-		int nmemb = dst->children_num - (offset + 1);
-		memmove (dst->children + offset, dst->children + offset + 1,
-				sizeof (oconfig_item_t) * nmemb);
-	}
+	if (src_num <= 0)
+		return (0);
 
-	/* Resize the memory containing the children to be big enough to hold
-	 * all children. */
-	temp = (oconfig_item_t *) realloc (dst->children,
-			sizeof (oconfig_item_t)
-			* (dst->children_num + src->children_num - 1));
-	if (temp == NULL)
-	{
-		ERROR ("configfile: realloc failed.");
-		return (-1);
-	}
-	dst->children = temp;
-
-	/* If there are children behind the include statement, and they have
-	 * not yet been moved because (src->children_num == 0), then move them
-	 * to the end of the list, so that the new children have room before
-	 * them. */
-	if ((src->children_num > 0)
-			&& ((dst->children_num - (offset + 1)) > 0))
+	if ((dst->children_num + src_num) > *dst_size)
 	{
-		int nmemb = dst->children_num - (offset + 1);
-		int old_offset = offset + 1;
-		int new_offset = offset + src->children_num;
+		oconfig_item_t *temp;
+		int size = (*dst_size > 0) ? *dst_size : 16;
 
-		memmove (dst->children + new_offset,
-				dst->children + old_offset,
-				sizeof (oconfig_item_t) * nmemb);
-	}
+		while (size < (dst->children_num + src_num))
+			size *= 2;
 
-	/* Last but not least: If there are new children, copy them to the
-	 * memory reserved for them. */
-	if (src->children_num > 0)
-	{
-		memcpy (dst->children + offset,
-				src->children,
-				sizeof (oconfig_item_t) * src->children_num);
+		temp = (oconfig_item_t *) realloc (dst->children,
+				sizeof (oconfig_item_t) * size);
+		if (temp == NULL)
+		{
+			ERROR ("configfile: realloc failed.");
+			return (-1);
+		}
+		dst->children = temp;
+		*dst_size = size;
 	}
 
-	/* Update the number of children. */
-	dst->children_num += (src->children_num - 1);
+	memcpy (dst->children + dst->children_num, src,
+			sizeof (oconfig_item_t) * src_num);
+	dst->children_num += src_num;
 
 	return (0);
-} /* int cf_ci_replace_child */
+} /* int cf_ci_append_items */
 
-static int cf_ci_append_children (oconfig_item_t *dst, oconfig_item_t *src)
+/* Moves the children of `src' to the end of the children of `dst' and frees
+ * `src' itself. */
+static int cf_ci_append_children (oconfig_item_t *dst, int *dst_size,
+		oconfig_item_t *src)
 {
-	oconfig_item_t *temp;
-
-	if ((src == NULL) || (src->children_num == 0))
-		return (0);
+	int status;
 
-	temp = (oconfig_item_t *) realloc (dst->children,
-			sizeof (oconfig_item_t)
-			* (dst->children_num + src->children_num));
-	if (temp == NULL)
+	status = cf_ci_append_items (dst, dst_size,
+			src->children, src->children_num);
+	if (status != 0)
 	{
-		ERROR ("configfile: realloc failed.");
-		return (-1);
+		oconfig_free (src);
+		sfree (src);
+		return (status);
 	}
-	dst->children = temp;
 
-	memcpy (dst->children + dst->children_num,
-			src->children,
-			sizeof (oconfig_item_t)
-			* src->children_num);
-	dst->children_num += src->children_num;
+	sfree (src->children);
+	src->children_num = 0;
+	oconfig_free (src);
+	sfree (src);
 
 	return (0);
 } /* int cf_ci_append_children */
@@ -497,46 +526,71 @@ static int cf_ci_append_children (oconfig_item_t *dst, oconfig_item_t *src)
 #define CF_MAX_DEPTH 8
 static oconfig_item_t *cf_read_generic (const char *path, int depth);
 
+/* Replaces all `Include' statements in `root' with the statements read from
+ * the included files. The children are collected in a new array in one
+ * pass, rather than by moving the trailing statements for each include. */
 static int cf_include_all (oconfig_item_t *root, int depth)
 {
+	oconfig_item_t result;
+	int result_size = 0;
+	int status = 0;
 	int i;
 
+	memset (&result, 0, sizeof (result));
+
 	for (i = 0; i < root->children_num; i++)
 	{
 		oconfig_item_t *new;
-		oconfig_item_t *old;
+		oconfig_item_t *old = root->children + i;
 
 		/* Ignore all blocks, including `Include' blocks. */
-		if (root->children[i].children_num != 0)
-			continue;
-
-		if (strcasecmp (root->children[i].key, "Include") != 0)
+		if ((old->children_num != 0)
+				|| (strcasecmp (old->key, "Include") != 0))
+		{
+			status = cf_ci_append_items (&result, &result_size, old, 1);
+			if (status != 0)
+				break;
 			continue;
+		}
 
-		old = root->children + i;
-
+		new = NULL;
 		if ((old->values_num != 1)
 				|| (old->values[0].type != OCONFIG_TYPE_STRING))
-		{
 			ERROR ("configfile: `Include' needs exactly one string argument.");
-			continue;
-		}
+		else
+			/* Includes in the included files have been replaced by
+			 * `cf_read_file' already. */
+			new = cf_read_generic (old->values[0].value.string, depth + 1);
 
-		new = cf_read_generic (old->values[0].value.string, depth + 1);
 		if (new == NULL)
+		{
+			status = cf_ci_append_items (&result, &result_size, old, 1);
+			if (status != 0)
+				break;
 			continue;
+		}
 
-		/* Now replace the i'th child in `root' with `new'. */
-		cf_ci_replace_child (root, new, i);
-
-		/* ... and go back to the new i'th child. */
-		--i;
+		/* Free the memory used by the `Include "blah"' statement. */
+		oconfig_free (old);
 
-		sfree (new->values);
-		sfree (new);
+		status = cf_ci_append_children (&result, &result_size, new);
+		if (status != 0)
+		{
+			i++;
+			break;
+		}
 	} /* for (i = 0; i < root->children_num; i++) */
 
-	return (0);
+	/* If the array could not be grown, the statements not moved yet are
+	 * dropped. */
+	for (; i < root->children_num; i++)
+		oconfig_free (root->children + i);
+
+	sfree (root->children);
+	root->children = result.children;
+	root->children_num = result.children_num;
+
+	return (status);
 } /* int cf_include_all */
 
 static oconfig_item_t *cf_read_file (const char *file, int depth)
@@ -565,6 +619,7 @@ static int cf_compare_string (const void *p1, const void *p2)
 static oconfig_item_t *cf_read_dir (const char *dir, int depth)
 {
 	oconfig_item_t *root = NULL;
+	int root_size = 0;
 	DIR *dh;
 	struct dirent *de;
 	char **filenames = NULL;
@@ -645,9 +700,7 @@ static oconfig_item_t *cf_read_dir (const char *dir, int depth)
 			continue;
 		}
 
-		cf_ci_append_children (root, temp);
-		sfree (temp->children);
-		sfree (temp);
+		cf_ci_append_children (root, &root_size, temp);
 
 		free (name);
 	}
@@ -671,6 +724,7 @@ static oconfig_item_t *cf_read_dir (const char *dir, int depth)
 static oconfig_item_t *cf_read_generic (const char *path, int depth)
 {
 	oconfig_item_t *root = NULL;
+	int root_size = 0;
 	int status;
 	const char *path_ptr;
 	wordexp_t we;
@@ -736,9 +790,7 @@ static oconfig_item_t *cf_read_generic (const char *path, int depth)
 			return (NULL);
 		}
 
-		cf_ci_append_children (root, temp);
-		sfree (temp->children);
-		sfree (temp);
+		cf_ci_append_children (root, &root_size, temp);
 	}
 
 	wordfree (&we);
@@ -925,8 +977,11 @@ int cf_register_complex (const char *type, int (*callback) (oconfig_item_t *))
 int cf_read (char *filename)
 {
 	oconfig_item_t *conf;
+	cdtime_t start;
 	int i;
 
+	start = cdtime_monotonic ();
+
 	conf = cf_read_generic (filename, 0 /* depth */);
 	if (conf == NULL)
 	{
@@ -944,10 +999,14 @@ int cf_read (char *filename)
 
 	oconfig_free (conf);
 
+	plugin_load_pending_finish ();
+
 	/* Read the default types.db if no `TypesDB' option was given. */
 	if (cf_default_typesdb)
 		read_types_list (PKGDATADIR"/types.db");
 
+	plugin_set_config_duration (cdtime_monotonic () - start);
+
 	return (0);
 } /* int cf_read */
 
@@ -997,6 +1056,54 @@ int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer, /* {{{ */
 	return (0);
 } /* }}} int cf_util_get_string_buffer */
 
+/* Joins all arguments of the config option with spaces, formatting numbers and
+ * booleans like `dispatch_value_plugin' always did. */
+int cf_util_get_values_string (const oconfig_item_t *ci, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	char *buffer_ptr;
+	size_t buffer_free;
+	int i;
+
+	if ((ci == NULL) || (buffer == NULL) || (buffer_size < 1))
+		return (EINVAL);
+
+	buffer_ptr = buffer;
+	buffer_free = buffer_size;
+	buffer[0] = 0;
+
+	for (i = 0; i < ci->values_num; i++)
+	{
+		/* Separate the values by a single space. */
+		const char *sep = (i == 0) ? "" : " ";
+		int status = -1;
+
+		if (ci->values[i].type == OCONFIG_TYPE_STRING)
+			status = ssnprintf (buffer_ptr, buffer_free, "%s%s",
+					sep, ci->values[i].value.string);
+		else if (ci->values[i].type == OCONFIG_TYPE_NUMBER)
+			status = ssnprintf (buffer_ptr, buffer_free, "%s%lf",
+					sep, ci->values[i].value.number);
+		else if (ci->values[i].type == OCONFIG_TYPE_BOOLEAN)
+			status = ssnprintf (buffer_ptr, buffer_free, "%s%s",
+					sep, ci->values[i].value.boolean
+					? "true" : "false");
+
+		if (status < 0)
+			return (-1);
+		else if ((size_t) status >= buffer_free)
+		{
+			ERROR ("cf_util_get_values_string: The arguments of the "
+					"%s option are too long.", ci->key);
+			return (-1);
+		}
+		buffer_free -= (size_t) status;
+		buffer_ptr  += status;
+	}
+
+	return (0);
+} /* }}} int cf_util_get_values_string */
+
 /* Assures the config option is a number and returns it as an int. */
 int cf_util_get_int (const oconfig_item_t *ci, int *ret_value) /* {{{ */
 {
@@ -97,6 +97,11 @@ int cf_util_get_string (const oconfig_item_t *ci, char **ret_string);
 int cf_util_get_string_buffer (const oconfig_item_t *ci, char *buffer,
 		size_t buffer_size);
 
+/* Copies all arguments of the config option to the provided buffer, separated
+ * by spaces, the way they are passed to "simple" config callbacks. */
+int cf_util_get_values_string (const oconfig_item_t *ci, char *buffer,
+		size_t buffer_size);
+
 /* Assures the config option is a number and returns it as an int. */
 int cf_util_get_int (const oconfig_item_t *ci, int *ret_value);
 
@@ -29,8 +29,75 @@
 # error "No applicable input method."
 #endif
 
+#if HAVE_CTNETLINK_STATS
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <linux/netlink.h>
+# include <linux/netfilter/nfnetlink.h>
+# include <linux/netfilter/nfnetlink_conntrack.h>
+#endif
+
 #define CONNTRACK_FILE "/proc/sys/net/netfilter/nf_conntrack_count"
 
+static const char *config_keys[] =
+{
+	"CPUStatistics",
+	"AggregateCPUs"
+};
+static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+
+static _Bool collect_cpu_stats = 0;
+static _Bool aggregate_cpus = 1;
+
+#if HAVE_CTNETLINK_STATS
+/* The per-CPU counters reported by IPCTNL_MSG_CT_GET_STATS_CPU. The others
+ * are always zero on current kernels. */
+struct conntrack_stat_s
+{
+	int attr;
+	const char *type_instance;
+};
+typedef struct conntrack_stat_s conntrack_stat_t;
+
+static const conntrack_stat_t conntrack_stats[] =
+{
+	{ CTA_STATS_FOUND,          "found"          },
+	{ CTA_STATS_INVALID,        "invalid"        },
+	{ CTA_STATS_INSERT,         "insert"         },
+	{ CTA_STATS_INSERT_FAILED,  "insert_failed"  },
+	{ CTA_STATS_DROP,           "drop"           },
+	{ CTA_STATS_EARLY_DROP,     "early_drop"     },
+	{ CTA_STATS_ERROR,          "error"          },
+	{ CTA_STATS_SEARCH_RESTART, "search_restart" }
+};
+#define CONNTRACK_STATS_NUM STATIC_ARRAY_SIZE (conntrack_stats)
+
+/* The netlink socket is kept open across reads. */
+static int nl_sock = -1;
+static uint32_t nl_seq = 0;
+#endif /* HAVE_CTNETLINK_STATS */
+
+static int conntrack_config (const char *key, const char *value)
+{
+	if (strcasecmp (key, "CPUStatistics") == 0)
+	{
+#if HAVE_CTNETLINK_STATS
+		collect_cpu_stats = IS_TRUE (value) ? 1 : 0;
+#else
+		if (IS_TRUE (value))
+			WARNING ("conntrack plugin: The `CPUStatistics' option is not "
+					"supported, because the plugin was built without "
+					"ctnetlink support.");
+#endif
+	}
+	else if (strcasecmp (key, "AggregateCPUs") == 0)
+		aggregate_cpus = IS_TRUE (value) ? 1 : 0;
+	else
+		return (-1);
+
+	return (0);
+} /* int conntrack_config */
+
 static void conntrack_submit (double conntrack)
 {
 	value_t values[1];
@@ -47,6 +114,220 @@ static void conntrack_submit (double conntrack)
 	plugin_dispatch_values (&vl);
 } /* static void conntrack_submit */
 
+#if HAVE_CTNETLINK_STATS
+static void conntrack_submit_stats (int cpu, const derive_t *counters)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+	size_t i;
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "conntrack", sizeof (vl.plugin));
+	if (cpu >= 0)
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"%i", cpu);
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+
+	for (i = 0; i < CONNTRACK_STATS_NUM; i++)
+	{
+		values[0].derive = counters[i];
+		sstrncpy (vl.type_instance, conntrack_stats[i].type_instance,
+				sizeof (vl.type_instance));
+		plugin_dispatch_values (&vl);
+	}
+} /* void conntrack_submit_stats */
+
+static void conntrack_nl_close (void)
+{
+	if (nl_sock >= 0)
+	{
+		close (nl_sock);
+		nl_sock = -1;
+	}
+} /* void conntrack_nl_close */
+
+static int conntrack_nl_open (void)
+{
+	struct sockaddr_nl sa;
+	char errbuf[1024];
+
+	if (nl_sock >= 0)
+		return (0);
+
+	nl_sock = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_NETFILTER);
+	if (nl_sock < 0)
+	{
+		ERROR ("conntrack plugin: socket (NETLINK_NETFILTER) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (bind (nl_sock, (struct sockaddr *) &sa, sizeof (sa)) != 0)
+	{
+		ERROR ("conntrack plugin: bind (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		conntrack_nl_close ();
+		return (-1);
+	}
+
+	return (0);
+} /* int conntrack_nl_open */
+
+/* Parses the attributes of one CPU's statistics message into `counters'. */
+static void conntrack_parse_stats (const struct nlmsghdr *nlh,
+		derive_t *counters)
+{
+	const struct nlattr *nla;
+	size_t offset;
+
+	offset = NLMSG_LENGTH (sizeof (struct nfgenmsg));
+	offset = NLMSG_ALIGN (offset);
+	while (offset + sizeof (*nla) <= nlh->nlmsg_len)
+	{
+		uint32_t value;
+		int type;
+		size_t i;
+
+		nla = (const struct nlattr *) (((const char *) nlh) + offset);
+		if ((nla->nla_len < sizeof (*nla))
+				|| (offset + nla->nla_len > nlh->nlmsg_len))
+			break;
+
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (nla->nla_len >= NLA_HDRLEN + sizeof (value))
+		{
+			memcpy (&value, ((const char *) nla) + NLA_HDRLEN,
+					sizeof (value));
+			value = ntohl (value);
+
+			for (i = 0; i < CONNTRACK_STATS_NUM; i++)
+			{
+				if (conntrack_stats[i].attr == type)
+				{
+					counters[i] = (derive_t) value;
+					break;
+				}
+			}
+		}
+
+		offset += NLA_ALIGN (nla->nla_len);
+	}
+} /* void conntrack_parse_stats */
+
+/* Requests the statistics of all CPUs with a single netlink dump. The
+ * kernel answers with one message per CPU. */
+static int conntrack_read_stats (void)
+{
+	struct {
+		struct nlmsghdr nlh;
+		struct nfgenmsg nfg;
+	} req;
+	char buffer[16384];
+	derive_t total[CONNTRACK_STATS_NUM];
+	_Bool done = 0;
+	char errbuf[1024];
+
+	if (conntrack_nl_open () != 0)
+		return (-1);
+
+	memset (&req, 0, sizeof (req));
+	req.nlh.nlmsg_len = NLMSG_LENGTH (sizeof (req.nfg));
+	req.nlh.nlmsg_type = (NFNL_SUBSYS_CTNETLINK << 8)
+		| IPCTNL_MSG_CT_GET_STATS_CPU;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++nl_seq;
+	req.nfg.nfgen_family = AF_UNSPEC;
+	req.nfg.version = NFNETLINK_V0;
+	req.nfg.res_id = 0;
+
+	if (send (nl_sock, &req, req.nlh.nlmsg_len, /* flags = */ 0) < 0)
+	{
+		ERROR ("conntrack plugin: send (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		conntrack_nl_close ();
+		return (-1);
+	}
+
+	memset (total, 0, sizeof (total));
+	while (!done)
+	{
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv (nl_sock, buffer, sizeof (buffer), /* flags = */ 0);
+		if (len < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			ERROR ("conntrack plugin: recv (AF_NETLINK) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			conntrack_nl_close ();
+			return (-1);
+		}
+
+		for (nlh = (struct nlmsghdr *) buffer;
+				NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			derive_t counters[CONNTRACK_STATS_NUM];
+			const struct nfgenmsg *nfg;
+			size_t i;
+
+			/* Left over from a previous, failed dump. */
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+			{
+				done = 1;
+				break;
+			}
+			else if (nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				const struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+				ERROR ("conntrack plugin: Reading the statistics failed: %s",
+						sstrerror (-err->error, errbuf, sizeof (errbuf)));
+				return (-1);
+			}
+
+			if (nlh->nlmsg_len < NLMSG_LENGTH (sizeof (*nfg)))
+				continue;
+			nfg = NLMSG_DATA (nlh);
+
+			memset (counters, 0, sizeof (counters));
+			conntrack_parse_stats (nlh, counters);
+
+			if (aggregate_cpus)
+			{
+				for (i = 0; i < CONNTRACK_STATS_NUM; i++)
+					total[i] += counters[i];
+			}
+			else
+			{
+				conntrack_submit_stats ((int) ntohs (nfg->res_id), counters);
+			}
+
+			/* Without NLM_F_MULTI, the message is the only one. */
+			if ((nlh->nlmsg_flags & NLM_F_MULTI) == 0)
+			{
+				done = 1;
+				break;
+			}
+		}
+	}
+
+	if (aggregate_cpus)
+		conntrack_submit_stats (/* cpu = */ -1, total);
+
+	return (0);
+} /* int conntrack_read_stats */
+#endif /* HAVE_CTNETLINK_STATS */
+
 static int conntrack_read (void)
 {
 	double conntrack;
@@ -69,10 +350,28 @@ static int conntrack_read (void)
 	if (conntrack > 0.0)
 		conntrack_submit (conntrack);
 
+#if HAVE_CTNETLINK_STATS
+	if (collect_cpu_stats)
+		conntrack_read_stats ();
+#endif
+
 	return (0);
 } /* static int conntrack_read */
 
+#if HAVE_CTNETLINK_STATS
+static int conntrack_shutdown (void)
+{
+	conntrack_nl_close ();
+	return (0);
+} /* int conntrack_shutdown */
+#endif
+
 void module_register (void)
 {
+	plugin_register_config ("conntrack", conntrack_config,
+			config_keys, config_keys_num);
 	plugin_register_read ("conntrack", conntrack_read);
+#if HAVE_CTNETLINK_STATS
+	plugin_register_shutdown ("conntrack", conntrack_shutdown);
+#endif
 } /* void module_register */
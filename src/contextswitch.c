@@ -24,6 +24,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
@@ -34,14 +35,14 @@
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+static procfs_file_t *proc_stat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
 # error "No applicable input method."
 #endif
 
-static void cs_submit (derive_t context_switches)
+static void cs_submit (derive_t context_switches, cdtime_t t)
 {
 	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
@@ -53,6 +54,7 @@ static void cs_submit (derive_t context_switches)
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "contextswitch", sizeof (vl.plugin));
 	sstrncpy (vl.type, "contextswitch", sizeof (vl.type));
+	vl.time = t;
 
 	plugin_dispatch_values (&vl);
 }
@@ -74,29 +76,35 @@ static int cs_read (void)
 		return (-1);
 	}
 
-	cs_submit (value);
+	cs_submit (value, /* time = now */ 0);
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[64];
+	char *buffer;
+	char *line;
 	int numfields;
 	char *fields[3];
 	derive_t result = 0;
+	cdtime_t t;
 	int status = -2;
 
-	fh = fopen ("/proc/stat", "r");
-	if (fh == NULL) {
-		ERROR ("contextswitch plugin: unable to open /proc/stat: %s",
-				sstrerror (errno, buffer, sizeof (buffer)));
-		return (-1);
+	if (proc_stat == NULL)
+	{
+		/* Shared with the other readers of /proc/stat. */
+		proc_stat = procfs_open ("/proc/stat", interval_g / 10);
+		if (proc_stat == NULL)
+			return (-1);
 	}
 
-	while (fgets(buffer, sizeof(buffer), fh) != NULL)
+	buffer = procfs_read (proc_stat, &t);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
 	{
 		char *endptr;
 
-		numfields = strsplit(buffer, fields, STATIC_ARRAY_SIZE (fields));
+		numfields = strsplit(line, fields, STATIC_ARRAY_SIZE (fields));
 		if (numfields != 2)
 			continue;
 
@@ -113,11 +121,10 @@ static int cs_read (void)
 			break;
 		}
 
-		cs_submit(result);
+		cs_submit(result, t);
 		status = 0;
 		break;
 	}
-	fclose(fh);
 
 	if (status == -2)
 		ERROR ("contextswitch plugin: Unable to find context switch value.");
@@ -126,7 +133,22 @@ static int cs_read (void)
 	return status;
 }
 
+static int cs_shutdown (void)
+{
+#if HAVE_SYSCTLBYNAME
+	/* nothing to do */
+/* #endif HAVE_SYSCTLBYNAME */
+
+#elif KERNEL_LINUX
+	procfs_close (proc_stat);
+	proc_stat = NULL;
+#endif /* KERNEL_LINUX */
+
+	return (0);
+}
+
 void module_register (void)
 {
 	plugin_register_read ("contextswitch", cs_read);
+	plugin_register_shutdown ("contextswitch", cs_shutdown);
 } /* void module_register */
@@ -28,6 +28,9 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
+#include "utils_thread.h"
+#include "utils_sampler.h"
 
 #ifdef HAVE_MACH_KERN_RETURN_H
 # include <mach/kern_return.h>
@@ -113,7 +116,9 @@ static int cpu_temp_retry_max     = 1;
 /* #endif PROCESSOR_CPU_LOAD_INFO */
 
 #elif defined(KERNEL_LINUX)
-/* no variables needed */
+static procfs_file_t *proc_stat = NULL;
+/* Time of the shared copy of /proc/stat being submitted. */
+static cdtime_t proc_stat_time = 0;
 /* #endif KERNEL_LINUX */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -145,6 +150,221 @@ static int numcpu;
 static int pnumcpu;
 #endif /* HAVE_PERFSTAT */
 
+#define COLLECTD_CPU_STATE_USER 0
+#define COLLECTD_CPU_STATE_NICE 1
+#define COLLECTD_CPU_STATE_SYSTEM 2
+#define COLLECTD_CPU_STATE_IDLE 3
+#define COLLECTD_CPU_STATE_WAIT 4
+#define COLLECTD_CPU_STATE_INTERRUPT 5
+#define COLLECTD_CPU_STATE_SOFTIRQ 6
+#define COLLECTD_CPU_STATE_STEAL 7
+#define COLLECTD_CPU_STATE_SWAP 8
+#define COLLECTD_CPU_STATE_MAX 9
+
+static const char *cpu_state_names[COLLECTD_CPU_STATE_MAX] =
+{
+	"user",
+	"nice",
+	"system",
+	"idle",
+	"wait",
+	"interrupt",
+	"softirq",
+	"steal",
+	"swap"
+};
+
+/* The ticks of one state of one CPU, kept between reads to compute the
+ * percentages. */
+typedef struct cpu_state_s
+{
+	derive_t last_value;
+	derive_t delta;
+	/* Number of the read which set `last_value'. */
+	unsigned int last_read;
+	_Bool seen;
+	_Bool has_delta;
+} cpu_state_t;
+
+static const char *config_keys[] =
+{
+	"ReportByCpu",
+	"ValuesPercentage",
+	"ReportNumaNode",
+	"SampleInterval"
+};
+static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+
+static _Bool report_by_cpu = 1;
+static _Bool report_percent = 0;
+static _Bool report_numa = 0;
+static cdtime_t sample_interval = 0;
+
+/* COLLECTD_CPU_STATE_MAX states per CPU. Only used if values are
+ * aggregated or reported as percentages. */
+static cpu_state_t *cpu_states = NULL;
+static size_t cpu_states_num = 0;
+static unsigned int cpu_read_num = 0;
+
+/* The NUMA node of each CPU, or -1. */
+static int *cpu_node = NULL;
+static size_t cpu_node_num = 0;
+static int cpu_nodes_num = 0;
+
+#if KERNEL_LINUX
+/* The ticks of each CPU at the previous sample. Only used by the sampler's
+ * thread, which reads /proc/stat on its own. */
+typedef struct cpu_sample_s
+{
+	derive_t last[COLLECTD_CPU_STATE_MAX];
+	int last_num;
+} cpu_sample_t;
+
+static sampler_t *cpu_sampler = NULL;
+static procfs_file_t *sample_stat = NULL;
+static cpu_sample_t *cpu_samples = NULL;
+static size_t cpu_samples_num = 0;
+#endif
+
+static int cpu_config (const char *key, const char *value)
+{
+	if (strcasecmp (key, "ReportByCpu") == 0)
+		report_by_cpu = IS_TRUE (value) ? 1 : 0;
+	else if (strcasecmp (key, "ValuesPercentage") == 0)
+		report_percent = IS_TRUE (value) ? 1 : 0;
+	else if (strcasecmp (key, "ReportNumaNode") == 0)
+		report_numa = IS_TRUE (value) ? 1 : 0;
+	else if (strcasecmp (key, "SampleInterval") == 0)
+	{
+		double tmp = atof (value);
+		sample_interval = (tmp > 0.0) ? DOUBLE_TO_CDTIME_T (tmp) : 0;
+	}
+	else
+		return (-1);
+
+	return (0);
+} /* int cpu_config */
+
+#if KERNEL_LINUX
+static int cpu_numa_init (void)
+{
+	int status;
+
+	status = thread_cpu_nodes (&cpu_node, &cpu_node_num);
+	if (status < 0)
+	{
+		WARNING ("cpu plugin: Cannot determine the NUMA node of each "
+				"CPU. Not reporting NUMA nodes.");
+		return (-1);
+	}
+	cpu_nodes_num = status;
+
+	return (0);
+} /* int cpu_numa_init */
+
+/* Called by the sampler every `SampleInterval': adds the share of each state
+ * since the previous sample, per CPU or for all CPUs. */
+static int cpu_sample (sampler_t *s, cdtime_t __attribute__((unused)) now,
+		void __attribute__((unused)) *user_data)
+{
+	derive_t all[COLLECTD_CPU_STATE_MAX];
+	derive_t all_sum = 0;
+	int all_num = 0;
+	char instance[DATA_MAX_NAME_LEN];
+	char *buffer;
+	char *buf;
+	int state;
+
+	if (sample_stat == NULL)
+	{
+		/* Not shared, so the samples aren't older than they seem. */
+		sample_stat = procfs_open ("/proc/stat", /* max age = */ 0);
+		if (sample_stat == NULL)
+			return (-1);
+	}
+
+	buffer = procfs_read (sample_stat, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	memset (all, 0, sizeof (all));
+
+	while ((buf = procfs_next_line (&buffer)) != NULL)
+	{
+		char *fields[COLLECTD_CPU_STATE_MAX];
+		derive_t delta[COLLECTD_CPU_STATE_MAX];
+		derive_t sum = 0;
+		cpu_sample_t *cs;
+		_Bool valid;
+		int numfields;
+		int cpu;
+
+		if (strncmp (buf, "cpu", 3))
+			continue;
+		if ((buf[3] < '0') || (buf[3] > '9'))
+			continue;
+
+		/* The CPU and its ticks up to "steal", in the order of
+		 * `cpu_state_names'. */
+		numfields = strsplit (buf, fields, COLLECTD_CPU_STATE_MAX);
+		if (numfields < 5)
+			continue;
+
+		cpu = atoi (fields[0] + 3);
+		if ((size_t) cpu >= cpu_samples_num)
+		{
+			cpu_sample_t *tmp;
+
+			tmp = realloc (cpu_samples, (cpu + 1) * sizeof (*tmp));
+			if (tmp == NULL)
+				return (-1);
+			memset (tmp + cpu_samples_num, 0,
+					(cpu + 1 - cpu_samples_num) * sizeof (*tmp));
+			cpu_samples = tmp;
+			cpu_samples_num = (size_t) cpu + 1;
+		}
+		cs = cpu_samples + cpu;
+
+		valid = (cs->last_num == numfields - 1);
+		for (state = 0; state < numfields - 1; state++)
+		{
+			derive_t value = atoll (fields[state + 1]);
+
+			if (value < cs->last[state])
+				valid = 0;
+			delta[state] = value - cs->last[state];
+			sum += delta[state];
+			cs->last[state] = value;
+		}
+		cs->last_num = numfields - 1;
+
+		if (!valid || (sum <= 0))
+			continue;
+
+		ssnprintf (instance, sizeof (instance), "%i", cpu);
+		for (state = 0; state < numfields - 1; state++)
+		{
+			if (report_by_cpu)
+				sampler_add (s, instance, cpu_state_names[state],
+						100.0 * ((gauge_t) delta[state])
+						/ ((gauge_t) sum));
+			all[state] += delta[state];
+		}
+		all_sum += sum;
+		if (all_num < numfields - 1)
+			all_num = numfields - 1;
+	}
+
+	if (!report_by_cpu && (all_sum > 0))
+		for (state = 0; state < all_num; state++)
+			sampler_add (s, "", cpu_state_names[state],
+					100.0 * ((gauge_t) all[state])
+					/ ((gauge_t) all_sum));
+
+	return (0);
+} /* int cpu_sample */
+#endif /* KERNEL_LINUX */
+
 static int init (void)
 {
 #if PROCESSOR_CPU_LOAD_INFO || PROCESSOR_TEMPERATURE
@@ -238,10 +458,36 @@ static int init (void)
 	/* nothing to initialize */
 #endif /* HAVE_PERFSTAT */
 
+	if (report_numa)
+	{
+#if KERNEL_LINUX
+		if (cpu_numa_init () != 0)
+			report_numa = 0;
+#else
+		WARNING ("cpu plugin: The `ReportNumaNode' option is only "
+				"supported on Linux.");
+		report_numa = 0;
+#endif
+	}
+
+	if ((sample_interval > 0) && (cpu_sampler == NULL))
+	{
+#if KERNEL_LINUX
+		cpu_sampler = sampler_create ("cpu/sample", sample_interval,
+				cpu_sample, /* user data = */ NULL);
+		if (cpu_sampler == NULL)
+			ERROR ("cpu plugin: Starting the sampler failed.");
+#else
+		WARNING ("cpu plugin: The `SampleInterval' option is only "
+				"supported on Linux.");
+#endif
+	}
+
 	return (0);
 } /* int init */
 
-static void submit (int cpu_num, const char *type_instance, derive_t value)
+static void submit_derive (int cpu_num, const char *type_instance,
+		derive_t value)
 {
 	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
@@ -256,9 +502,204 @@ static void submit (int cpu_num, const char *type_instance, derive_t value)
 			"%i", cpu_num);
 	sstrncpy (vl.type, "cpu", sizeof (vl.type));
 	sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+#if KERNEL_LINUX
+	vl.time = proc_stat_time;
+#endif
 
 	plugin_dispatch_values (&vl);
-}
+} /* void submit_derive */
+
+static void submit_percent (const char *plugin_instance,
+		const char *type_instance, gauge_t value, cdtime_t t)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	values[0].gauge = value;
+
+	vl.values = values;
+	vl.values_len = 1;
+	vl.time = t;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "cpu", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, plugin_instance,
+			sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "percent", sizeof (vl.type));
+	sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* void submit_percent */
+
+/* Remembers the ticks of a state, so that `cpu_commit' can compute the
+ * share of each state since the last read. */
+static void cpu_stage (int cpu_num, const char *type_instance, derive_t value)
+{
+	cpu_state_t *s;
+	int state;
+
+	if (cpu_num < 0)
+		return;
+
+	for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+		if (strcmp (type_instance, cpu_state_names[state]) == 0)
+			break;
+	if (state >= COLLECTD_CPU_STATE_MAX)
+		return;
+
+	if ((size_t) cpu_num >= cpu_states_num)
+	{
+		cpu_state_t *tmp;
+		size_t new_num = (size_t) cpu_num + 1;
+
+		tmp = realloc (cpu_states, new_num * COLLECTD_CPU_STATE_MAX
+				* sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ERROR ("cpu plugin: realloc failed.");
+			return;
+		}
+		memset (tmp + cpu_states_num * COLLECTD_CPU_STATE_MAX, 0,
+				(new_num - cpu_states_num) * COLLECTD_CPU_STATE_MAX
+				* sizeof (*tmp));
+		cpu_states = tmp;
+		cpu_states_num = new_num;
+	}
+
+	s = cpu_states + (size_t) cpu_num * COLLECTD_CPU_STATE_MAX + state;
+
+	/* CPUs taken offline and counters going backwards have no share in
+	 * this read. */
+	s->has_delta = s->seen && (s->last_read + 1 == cpu_read_num)
+		&& (value >= s->last_value);
+	s->delta = value - s->last_value;
+	s->last_value = value;
+	s->last_read = cpu_read_num;
+	s->seen = 1;
+} /* void cpu_stage */
+
+/* Dispatches the shares of the states staged by this read, per CPU, for all
+ * CPUs and per NUMA node, as configured. */
+static void cpu_commit (void)
+{
+	derive_t all[COLLECTD_CPU_STATE_MAX];
+	_Bool all_valid[COLLECTD_CPU_STATE_MAX];
+	derive_t *nodes = NULL;
+	_Bool *nodes_valid = NULL;
+	char instance[DATA_MAX_NAME_LEN];
+	cdtime_t t;
+	size_t cpu;
+	int state;
+	int node;
+
+#if KERNEL_LINUX
+	t = proc_stat_time;
+#else
+	t = cdtime ();
+#endif
+
+	memset (all, 0, sizeof (all));
+	memset (all_valid, 0, sizeof (all_valid));
+
+	if (report_numa && (cpu_nodes_num > 0))
+	{
+		nodes = calloc ((size_t) cpu_nodes_num * COLLECTD_CPU_STATE_MAX,
+				sizeof (*nodes));
+		nodes_valid = calloc ((size_t) cpu_nodes_num
+				* COLLECTD_CPU_STATE_MAX, sizeof (*nodes_valid));
+		if ((nodes == NULL) || (nodes_valid == NULL))
+		{
+			ERROR ("cpu plugin: calloc failed.");
+			sfree (nodes);
+			sfree (nodes_valid);
+		}
+	}
+
+	for (cpu = 0; cpu < cpu_states_num; cpu++)
+	{
+		cpu_state_t *s = cpu_states + cpu * COLLECTD_CPU_STATE_MAX;
+		derive_t sum = 0;
+
+		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+			if (s[state].has_delta && (s[state].last_read == cpu_read_num))
+				sum += s[state].delta;
+		if (sum <= 0)
+			continue;
+
+		node = ((nodes != NULL) && (cpu < cpu_node_num))
+			? cpu_node[cpu] : -1;
+
+		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+		{
+			if (!s[state].has_delta || (s[state].last_read != cpu_read_num))
+				continue;
+
+			if (report_by_cpu && report_percent)
+			{
+				ssnprintf (instance, sizeof (instance), "%zu", cpu);
+				submit_percent (instance, cpu_state_names[state],
+						100.0 * ((gauge_t) s[state].delta)
+						/ ((gauge_t) sum), t);
+			}
+
+			all[state] += s[state].delta;
+			all_valid[state] = 1;
+
+			if ((node >= 0) && (node < cpu_nodes_num))
+			{
+				nodes[node * COLLECTD_CPU_STATE_MAX + state]
+					+= s[state].delta;
+				nodes_valid[node * COLLECTD_CPU_STATE_MAX + state] = 1;
+			}
+		}
+	}
+
+	if (!report_by_cpu)
+	{
+		derive_t sum = 0;
+
+		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+			sum += all[state];
+
+		for (state = 0; (sum > 0) && (state < COLLECTD_CPU_STATE_MAX); state++)
+			if (all_valid[state])
+				submit_percent ("", cpu_state_names[state],
+						100.0 * ((gauge_t) all[state])
+						/ ((gauge_t) sum), t);
+	}
+
+	for (node = 0; (nodes != NULL) && (node < cpu_nodes_num); node++)
+	{
+		derive_t *n = nodes + node * COLLECTD_CPU_STATE_MAX;
+		_Bool *n_valid = nodes_valid + node * COLLECTD_CPU_STATE_MAX;
+		derive_t sum = 0;
+
+		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+			sum += n[state];
+		if (sum <= 0)
+			continue;
+
+		ssnprintf (instance, sizeof (instance), "node%i", node);
+		for (state = 0; state < COLLECTD_CPU_STATE_MAX; state++)
+			if (n_valid[state])
+				submit_percent (instance, cpu_state_names[state],
+						100.0 * ((gauge_t) n[state])
+						/ ((gauge_t) sum), t);
+	}
+
+	sfree (nodes);
+	sfree (nodes_valid);
+
+	cpu_read_num++;
+} /* void cpu_commit */
+
+static void submit (int cpu_num, const char *type_instance, derive_t value)
+{
+	if (report_by_cpu && !report_percent)
+		submit_derive (cpu_num, type_instance, value);
+
+	if (!report_by_cpu || report_percent || report_numa)
+		cpu_stage (cpu_num, type_instance, value);
+} /* void submit */
 
 static int cpu_read (void)
 {
@@ -354,21 +795,25 @@ static int cpu_read (void)
 	int cpu;
 	derive_t user, nice, syst, idle;
 	derive_t wait, intr, sitr; /* sitr == soft interrupt */
-	FILE *fh;
-	char buf[1024];
+	char *buffer;
+	char *buf;
 
 	char *fields[9];
 	int numfields;
 
-	if ((fh = fopen ("/proc/stat", "r")) == NULL)
+	if (proc_stat == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("cpu plugin: fopen (/proc/stat) failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		/* Shared with the other readers of /proc/stat. */
+		proc_stat = procfs_open ("/proc/stat", interval_g / 10);
+		if (proc_stat == NULL)
+			return (-1);
 	}
 
-	while (fgets (buf, 1024, fh) != NULL)
+	buffer = procfs_read (proc_stat, &proc_stat_time);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((buf = procfs_next_line (&buffer)) != NULL)
 	{
 		if (strncmp (buf, "cpu", 3))
 			continue;
@@ -404,8 +849,6 @@ static int cpu_read (void)
 				submit (cpu, "steal", atoll (fields[8]));
 		}
 	}
-
-	fclose (fh);
 /* #endif defined(KERNEL_LINUX) */
 
 #elif defined(HAVE_LIBKSTAT)
@@ -598,11 +1041,46 @@ static int cpu_read (void)
 	}
 #endif /* HAVE_PERFSTAT */
 
+	if (!report_by_cpu || report_percent || report_numa)
+		cpu_commit ();
+
+#if KERNEL_LINUX
+	if (cpu_sampler != NULL)
+		sampler_dispatch (cpu_sampler, "cpu", "sampled_percent");
+#endif
+
 	return (0);
 }
 
+static int cpu_shutdown (void)
+{
+#if KERNEL_LINUX
+	procfs_close (proc_stat);
+	proc_stat = NULL;
+
+	/* Stops the thread before its state is freed. */
+	sampler_destroy (cpu_sampler);
+	cpu_sampler = NULL;
+	procfs_close (sample_stat);
+	sample_stat = NULL;
+	sfree (cpu_samples);
+	cpu_samples_num = 0;
+#endif
+
+	sfree (cpu_states);
+	cpu_states_num = 0;
+	sfree (cpu_node);
+	cpu_node_num = 0;
+	cpu_nodes_num = 0;
+
+	return (0);
+} /* int cpu_shutdown */
+
 void module_register (void)
 {
+	plugin_register_config ("cpu", cpu_config,
+			config_keys, config_keys_num);
 	plugin_register_init ("cpu", init);
 	plugin_register_read ("cpu", cpu_read);
+	plugin_register_shutdown ("cpu", cpu_shutdown);
 } /* void module_register */
@@ -192,6 +192,11 @@ typedef struct {
 } Values;
 PyTypeObject ValuesType;
 #define Values_New() PyObject_CallFunctionObjArgs((PyObject *) &ValuesType, (void *) 0)
+/* Converts a Values object for dispatching. The values and meta data of `vl'
+ * have to be freed with cpy_value_list_free. Sets an exception and returns
+ * non-zero on failure. */
+int Values_to_value_list(PyObject *obj, value_list_t *vl);
+void cpy_value_list_free(value_list_t *vl);
 
 typedef struct {
 	PluginData data;
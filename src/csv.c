@@ -24,22 +24,59 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_cmd_putval.h"
+#include "utils_known_paths.h"
 #include "utils_parse_option.h"
 
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
+
+#if HAVE_LIBZ
+# include <zlib.h>
+#endif
+
 /*
- * Private variables
+ * Private types
  */
-static const char *config_keys[] =
+/* An open and locked file. Files are kept in `files_tree', keyed by the file
+ * name without the date, and in a list ordered by the time they were last
+ * written to. */
+struct csv_file_s;
+typedef struct csv_file_s csv_file_t;
+struct csv_file_s
 {
-	"DataDir",
-	"StoreRates"
+	char *key;
+	char *filename;
+	FILE *fh;
+#if HAVE_LIBZ
+	gzFile gz; /* used instead of `fh' if compression is enabled */
+#endif
+
+	csv_file_t *prev; /* used more recently */
+	csv_file_t *next; /* used less recently */
 };
-static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
+/*
+ * Private variables
+ */
 static char *datadir   = NULL;
 static int store_rates = 0;
 static int use_stdio   = 0;
+static _Bool compress_gzip = 0;
+static known_paths_t *known_paths = NULL;
+
+static int max_open_files = 0;
+static cdtime_t flush_interval = TIME_T_TO_CDTIME_T (10);
+static cdtime_t flush_last = 0;
+
+static c_avl_tree_t *files_tree = NULL;
+static csv_file_t *files_head = NULL;
+static csv_file_t *files_tail = NULL;
+static int files_num = 0;
+static pthread_mutex_t files_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int value_list_to_string (char *buffer, int buffer_len,
 		const data_set_t *ds, const value_list_t *vl)
@@ -47,7 +84,8 @@ static int value_list_to_string (char *buffer, int buffer_len,
 	int offset;
 	int status;
 	int i;
-	gauge_t *rates = NULL;
+	gauge_t rates[ds->ds_num];
+	_Bool have_rates = 0;
 
 	assert (0 == strcmp (ds->type, vl->type));
 
@@ -74,14 +112,14 @@ static int value_list_to_string (char *buffer, int buffer_len,
 		} 
 		else if (store_rates != 0)
 		{
-			if (rates == NULL)
-				rates = uc_get_rate (ds, vl);
-			if (rates == NULL)
+			if (!have_rates
+					&& (uc_get_rate_buffer (ds, vl, rates) != 0))
 			{
 				WARNING ("csv plugin: "
-						"uc_get_rate failed.");
+						"uc_get_rate_buffer failed.");
 				return (-1);
 			}
+			have_rates = 1;
 			status = ssnprintf (buffer + offset,
 					buffer_len - offset,
 					",%lf", rates[i]);
@@ -109,15 +147,11 @@ static int value_list_to_string (char *buffer, int buffer_len,
 		}
 
 		if ((status < 1) || (status >= (buffer_len - offset)))
-		{
-			sfree (rates);
 			return (-1);
-		}
 
 		offset += status;
 	} /* for ds->ds_num */
 
-	sfree (rates);
 	return (0);
 } /* int value_list_to_string */
 
@@ -162,28 +196,75 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 				"%s", vl->type);
 	if ((status < 1) || (status >= buffer_len - offset))
 		return (-1);
-	offset += status;
 
-	if (!use_stdio)
+	return (0);
+} /* int value_list_to_filename */
+
+/* Appends the current date to `name' and stores the result in `buffer'. */
+static int filename_add_date (char *buffer, int buffer_len,
+		const char *name)
+{
+	time_t now;
+	struct tm stm;
+	int offset;
+
+	sstrncpy (buffer, name, buffer_len);
+	offset = strlen (buffer);
+
+	/* TODO: Find a way to minimize the calls to `localtime_r',
+	 * since they are pretty expensive.. */
+	now = time (NULL);
+	if (localtime_r (&now, &stm) == NULL)
 	{
-		time_t now;
-		struct tm stm;
+		ERROR ("csv plugin: localtime_r failed");
+		return (1);
+	}
 
-		/* TODO: Find a way to minimize the calls to `localtime_r',
-		 * since they are pretty expensive.. */
-		now = time (NULL);
-		if (localtime_r (&now, &stm) == NULL)
-		{
-			ERROR ("csv plugin: localtime_r failed");
-			return (1);
-		}
+	if (strftime (buffer + offset, buffer_len - offset,
+				"-%Y-%m-%d", &stm) == 0)
+		return (-1);
+
+	if (compress_gzip
+			&& (strlen (buffer) + 3 < (size_t) buffer_len))
+		strcat (buffer, ".gz");
+	else if (compress_gzip)
+		return (-1);
+
+	return (0);
+} /* int filename_add_date */
+
+#if HAVE_LIBZ
+/* Writes the header as a gzip member of its own. The values are appended as
+ * further members, which gzip and zcat simply concatenate. */
+static int csv_create_file_gz (const char *filename, const data_set_t *ds)
+{
+	gzFile gz;
+	int i;
+
+	gz = gzopen (filename, "wb");
+	if (gz == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: gzopen (%s) failed: %s",
+				filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	gzputs (gz, "epoch");
+	for (i = 0; i < ds->ds_num; i++)
+		gzprintf (gz, ",%s", ds->ds[i].name);
+	gzputs (gz, "\n");
 
-		strftime (buffer + offset, buffer_len - offset,
-				"-%Y-%m-%d", &stm);
+	if (gzclose (gz) != Z_OK)
+	{
+		ERROR ("csv plugin: gzclose (%s) failed.", filename);
+		return (-1);
 	}
 
 	return (0);
-} /* int value_list_to_filename */
+} /* int csv_create_file_gz */
+#endif
 
 static int csv_create_file (const char *filename, const data_set_t *ds)
 {
@@ -193,6 +274,11 @@ static int csv_create_file (const char *filename, const data_set_t *ds)
 	if (check_create_dir (filename))
 		return (-1);
 
+#if HAVE_LIBZ
+	if (compress_gzip)
+		return (csv_create_file_gz (filename, ds));
+#endif
+
 	csv = fopen (filename, "w");
 	if (csv == NULL)
 	{
@@ -213,7 +299,309 @@ static int csv_create_file (const char *filename, const data_set_t *ds)
 	return 0;
 } /* int csv_create_file */
 
-static int csv_config (const char *key, const char *value)
+/* Opens `filename' for appending, creating it if necessary, and locks it.
+ * The lock is released when the file is closed. */
+static int csv_open_fd (const char *filename, const data_set_t *ds)
+{
+	int fd;
+	struct flock fl;
+	int status;
+
+	status = kp_check (known_paths, filename);
+	if (status == ENOENT)
+	{
+		if (csv_create_file (filename, ds))
+		{
+			kp_invalidate (known_paths, filename);
+			return (-1);
+		}
+		kp_set_exists (known_paths, filename);
+	}
+	else if (status != 0)
+	{
+		return (-1);
+	}
+
+	fd = open (filename, O_WRONLY | O_APPEND);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: open (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		kp_invalidate (known_paths, filename);
+		return (-1);
+	}
+
+	memset (&fl, '\0', sizeof (fl));
+	fl.l_start  = 0;
+	fl.l_len    = 0; /* till end of file */
+	fl.l_pid    = getpid ();
+	fl.l_type   = F_WRLCK;
+	fl.l_whence = SEEK_SET;
+
+	status = fcntl (fd, F_SETLK, &fl);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: flock (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
+
+	return (fd);
+} /* int csv_open_fd */
+
+static FILE *csv_open_file (const char *filename, const data_set_t *ds)
+{
+	FILE *csv;
+	int fd;
+
+	fd = csv_open_fd (filename, ds);
+	if (fd < 0)
+		return (NULL);
+
+	csv = fdopen (fd, "a");
+	if (csv == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: fdopen (%s) failed: %s", filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (NULL);
+	}
+
+	return (csv);
+} /* FILE *csv_open_file */
+
+#if HAVE_LIBZ
+/* Opens a compressed file. Each call starts a new gzip member, so it should
+ * be kept open for as long as possible. */
+static gzFile csv_open_file_gz (const char *filename, const data_set_t *ds)
+{
+	gzFile gz;
+	int fd;
+
+	fd = csv_open_fd (filename, ds);
+	if (fd < 0)
+		return (NULL);
+
+	gz = gzdopen (fd, "ab");
+	if (gz == NULL)
+	{
+		ERROR ("csv plugin: gzdopen (%s) failed.", filename);
+		close (fd);
+		return (NULL);
+	}
+
+	return (gz);
+} /* gzFile csv_open_file_gz */
+#endif
+
+/* Appends one line to the file, either compressed or not. */
+static int csv_file_puts (csv_file_t *f, const char *line) /* {{{ */
+{
+#if HAVE_LIBZ
+	if (f->gz != NULL)
+	{
+		if ((gzputs (f->gz, line) < 0) || (gzputc (f->gz, '\n') < 0))
+		{
+			int errnum = 0;
+			ERROR ("csv plugin: gzputs (%s) failed: %s", f->filename,
+					gzerror (f->gz, &errnum));
+			return (-1);
+		}
+		return (0);
+	}
+#endif
+
+	if (fprintf (f->fh, "%s\n", line) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: fprintf (%s) failed: %s", f->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int csv_file_puts */
+
+/* The following functions must be called with `files_lock' held. */
+static void csv_file_unlink (csv_file_t *f) /* {{{ */
+{
+	if (f->prev != NULL)
+		f->prev->next = f->next;
+	else
+		files_head = f->next;
+
+	if (f->next != NULL)
+		f->next->prev = f->prev;
+	else
+		files_tail = f->prev;
+
+	f->prev = NULL;
+	f->next = NULL;
+} /* }}} void csv_file_unlink */
+
+static void csv_file_push (csv_file_t *f) /* {{{ */
+{
+	f->prev = NULL;
+	f->next = files_head;
+	if (files_head != NULL)
+		files_head->prev = f;
+	files_head = f;
+	if (files_tail == NULL)
+		files_tail = f;
+} /* }}} void csv_file_push */
+
+static void csv_file_close (csv_file_t *f) /* {{{ */
+{
+	c_avl_remove (files_tree, f->key, NULL, NULL);
+	csv_file_unlink (f);
+	files_num--;
+
+	/* The lock is implicitely released. Closing a compressed file finishes
+	 * its gzip member. */
+#if HAVE_LIBZ
+	if (f->gz != NULL)
+	{
+		if (gzclose (f->gz) != Z_OK)
+		{
+			ERROR ("csv plugin: gzclose (%s) failed.", f->filename);
+			kp_invalidate (known_paths, f->filename);
+		}
+	}
+	else
+#endif
+	if (fclose (f->fh) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("csv plugin: fclose (%s) failed: %s", f->filename,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		kp_invalidate (known_paths, f->filename);
+	}
+
+	sfree (f->key);
+	sfree (f->filename);
+	sfree (f);
+} /* }}} void csv_file_close */
+
+static void csv_files_flush (void) /* {{{ */
+{
+	csv_file_t *f;
+
+	for (f = files_head; f != NULL; f = f->next)
+	{
+#if HAVE_LIBZ
+		/* A sync flush writes out all the data compressed so far and
+		 * aligns the stream, so it can be read up to this point. */
+		if (f->gz != NULL)
+		{
+			if (gzflush (f->gz, Z_SYNC_FLUSH) != Z_OK)
+			{
+				int errnum = 0;
+				ERROR ("csv plugin: gzflush (%s) failed: %s",
+						f->filename,
+						gzerror (f->gz, &errnum));
+			}
+			continue;
+		}
+#endif
+
+		if (fflush (f->fh) != 0)
+		{
+			char errbuf[1024];
+			ERROR ("csv plugin: fflush (%s) failed: %s", f->filename,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+
+	flush_last = cdtime ();
+} /* }}} void csv_files_flush */
+
+static csv_file_t *csv_file_get (const char *key, /* {{{ */
+		const char *filename, const data_set_t *ds)
+{
+	csv_file_t *f = NULL;
+
+	if (files_tree == NULL)
+	{
+		files_tree = c_avl_create ((int (*) (const void *,
+						const void *)) strcmp);
+		if (files_tree == NULL)
+		{
+			ERROR ("csv plugin: c_avl_create failed.");
+			return (NULL);
+		}
+	}
+
+	if (c_avl_get (files_tree, key, (void *) &f) == 0)
+	{
+		/* Still the same day? */
+		if (strcmp (f->filename, filename) == 0)
+		{
+			csv_file_unlink (f);
+			csv_file_push (f);
+			return (f);
+		}
+
+		csv_file_close (f);
+		f = NULL;
+	}
+
+	while ((files_num >= max_open_files) && (files_tail != NULL))
+		csv_file_close (files_tail);
+
+	f = malloc (sizeof (*f));
+	if (f == NULL)
+	{
+		ERROR ("csv plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (f, 0, sizeof (*f));
+
+	f->key = strdup (key);
+	f->filename = strdup (filename);
+	if ((f->key == NULL) || (f->filename == NULL))
+	{
+		ERROR ("csv plugin: strdup failed.");
+		sfree (f->key);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+
+#if HAVE_LIBZ
+	if (compress_gzip)
+	{
+		f->gz = csv_open_file_gz (filename, ds);
+		if (f->gz == NULL)
+		{
+			sfree (f->key);
+			sfree (f->filename);
+			sfree (f);
+			return (NULL);
+		}
+	}
+	else
+#endif
+	f->fh = csv_open_file (filename, ds);
+	if ((f->fh == NULL) && !compress_gzip)
+	{
+		sfree (f->key);
+		sfree (f->filename);
+		sfree (f);
+		return (NULL);
+	}
+
+	c_avl_insert (files_tree, f->key, f);
+	csv_file_push (f);
+	files_num++;
+
+	return (f);
+} /* }}} csv_file_t *csv_file_get */
+
+static int csv_config_value (const char *key, const char *value)
 {
 	if (strcasecmp ("DataDir", key) == 0)
 	{
@@ -252,109 +640,184 @@ static int csv_config (const char *key, const char *value)
 		else
 			store_rates = 0;
 	}
+	else if (strcasecmp ("MaxOpenFiles", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 0)
+		{
+			ERROR ("csv plugin: `MaxOpenFiles' must be greater "
+					"than or equal to zero.");
+			return (1);
+		}
+		max_open_files = tmp;
+	}
+	else if (strcasecmp ("FlushInterval", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp < 0.0)
+		{
+			ERROR ("csv plugin: `FlushInterval' must be greater "
+					"than or equal to zero.");
+			return (1);
+		}
+		flush_interval = DOUBLE_TO_CDTIME_T (tmp);
+	}
+	else if (strcasecmp ("Compression", key) == 0)
+	{
+		if ((strcasecmp ("none", value) == 0) || IS_FALSE (value))
+			compress_gzip = 0;
+		else if (strcasecmp ("gzip", value) == 0)
+		{
+#if HAVE_LIBZ
+			compress_gzip = 1;
+#else
+			ERROR ("csv plugin: `Compression gzip' is not supported, "
+					"because the plugin was built without zlib.");
+			return (1);
+#endif
+		}
+		else
+		{
+			ERROR ("csv plugin: Unknown compression `%s'. Supported "
+					"are \"gzip\" and \"none\".", value);
+			return (1);
+		}
+	}
 	else
 	{
 		return (-1);
 	}
 	return (0);
-} /* int csv_config */
+} /* int csv_config_value */
+
+static int csv_config_stat_cache_timeout (oconfig_item_t *ci) /* {{{ */
+{
+	cdtime_t timeout = 0;
+
+	if (cf_util_get_cdtime (ci, &timeout) != 0)
+		return (-1);
+
+	kp_destroy (known_paths);
+	known_paths = NULL;
+	if (timeout > 0)
+	{
+		known_paths = kp_create (timeout);
+		if (known_paths == NULL)
+		{
+			ERROR ("csv plugin: kp_create failed.");
+			return (-1);
+		}
+	}
+
+	return (0);
+} /* }}} int csv_config_stat_cache_timeout */
+
+static int csv_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+		char value[4096];
+
+		if (strcasecmp ("StatCacheTimeout", child->key) == 0)
+			csv_config_stat_cache_timeout (child);
+		else if (cf_util_get_values_string (child, value,
+					sizeof (value)) != 0)
+			continue;
+		else if (csv_config_value (child->key, value) < 0)
+			WARNING ("csv plugin: Unknown config option: %s",
+					child->key);
+	}
+
+	return (0);
+} /* }}} int csv_config */
 
 static int csv_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
+	char         key[512];
 	char         filename[512];
 	char         values[4096];
 	FILE        *csv;
-	int          csv_fd;
-	struct flock fl;
-	int          status;
 
 	if (0 != strcmp (ds->type, vl->type)) {
 		ERROR ("csv plugin: DS type does not match value list type");
 		return -1;
 	}
 
-	if (value_list_to_filename (filename, sizeof (filename), ds, vl) != 0)
-		return (-1);
+	if (use_stdio)
+	{
+		/* format_putval writes the whole command in one go, which is
+		 * much cheaper than formatting the CSV line and converting it. */
+		if (format_putval (values, sizeof (values), ds, vl,
+					store_rates != 0) < 0)
+			return (-1);
 
-	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
+		fprintf (use_stdio == 1 ? stdout : stderr, "%s\n", values);
+		return (0);
+	}
+
+	if (value_list_to_filename (key, sizeof (key), ds, vl) != 0)
+		return (-1);
 
 	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
 		return (-1);
 
-	if (use_stdio)
+	if (filename_add_date (filename, sizeof (filename), key) != 0)
+		return (-1);
+
+	DEBUG ("csv plugin: csv_write: filename = %s;", filename);
+
+	pthread_mutex_lock (&files_lock);
+	if (max_open_files > 0)
 	{
-		size_t i;
+		csv_file_t *f;
 
-		escape_string (filename, sizeof (filename));
+		f = csv_file_get (key, filename, ds);
+		if (f == NULL)
+		{
+			pthread_mutex_unlock (&files_lock);
+			return (-1);
+		}
 
-		/* Replace commas by colons for PUTVAL compatible output. */
-		for (i = 0; i < sizeof (values); i++)
+		if (csv_file_puts (f, values) != 0)
 		{
-			if (values[i] == 0)
-				break;
-			else if (values[i] == ',')
-				values[i] = ':';
+			kp_invalidate (known_paths, filename);
+			csv_file_close (f);
+			pthread_mutex_unlock (&files_lock);
+			return (-1);
 		}
 
-		fprintf (use_stdio == 1 ? stdout : stderr,
-			 "PUTVAL %s interval=%.3f %s\n",
-			 filename,
-			 CDTIME_T_TO_DOUBLE (vl->interval),
-			 values);
+		if ((cdtime () - flush_last) >= flush_interval)
+			csv_files_flush ();
+
+		pthread_mutex_unlock (&files_lock);
 		return (0);
 	}
+	pthread_mutex_unlock (&files_lock);
 
-	if (stat (filename, &statbuf) == -1)
+#if HAVE_LIBZ
+	if (compress_gzip)
 	{
-		if (errno == ENOENT)
-		{
-			if (csv_create_file (filename, ds))
-				return (-1);
-		}
-		else
-		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
+		gzFile gz;
+
+		gz = csv_open_file_gz (filename, ds);
+		if (gz == NULL)
 			return (-1);
-		}
-	}
-	else if (!S_ISREG (statbuf.st_mode))
-	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
-		return (-1);
-	}
 
-	csv = fopen (filename, "a");
-	if (csv == NULL)
-	{
-		char errbuf[1024];
-		ERROR ("csv plugin: fopen (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
-	}
-	csv_fd = fileno (csv);
+		gzputs (gz, values);
+		gzputc (gz, '\n');
+		gzclose (gz);
 
-	memset (&fl, '\0', sizeof (fl));
-	fl.l_start  = 0;
-	fl.l_len    = 0; /* till end of file */
-	fl.l_pid    = getpid ();
-	fl.l_type   = F_WRLCK;
-	fl.l_whence = SEEK_SET;
+		return (0);
+	}
+#endif
 
-	status = fcntl (csv_fd, F_SETLK, &fl);
-	if (status != 0)
-	{
-		char errbuf[1024];
-		ERROR ("csv plugin: flock (%s) failed: %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (csv);
+	csv = csv_open_file (filename, ds);
+	if (csv == NULL)
 		return (-1);
-	}
 
 	fprintf (csv, "%s\n", values);
 
@@ -365,9 +828,59 @@ static int csv_write (const data_set_t *ds, const value_list_t *vl,
 	return (0);
 } /* int csv_write */
 
+static int csv_flush (cdtime_t __attribute__((unused)) timeout,
+		const char __attribute__((unused)) *identifier,
+		user_data_t __attribute__((unused)) *user_data)
+{
+	/* Flushing all files is cheap, so don't bother looking up the one
+	 * `identifier' refers to. */
+	pthread_mutex_lock (&files_lock);
+	csv_files_flush ();
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* int csv_flush */
+
+static int csv_init (void)
+{
+	if (compress_gzip && (max_open_files == 0))
+		WARNING ("csv plugin: `Compression' is enabled, but `MaxOpenFiles' "
+				"is not. Each value will be written as a gzip member "
+				"of its own, which is larger than the uncompressed "
+				"text.");
+
+	return (0);
+} /* int csv_init */
+
+static int csv_shutdown (void)
+{
+	pthread_mutex_lock (&files_lock);
+
+	while (files_head != NULL)
+		csv_file_close (files_head);
+
+	if (files_tree != NULL)
+	{
+		c_avl_destroy (files_tree);
+		files_tree = NULL;
+	}
+
+	/* Values arriving after this are written the slow way, without
+	 * remembering which files exist. */
+	max_open_files = 0;
+	kp_destroy (known_paths);
+	known_paths = NULL;
+
+	pthread_mutex_unlock (&files_lock);
+
+	return (0);
+} /* int csv_shutdown */
+
 void module_register (void)
 {
-	plugin_register_config ("csv", csv_config,
-			config_keys, config_keys_num);
+	plugin_register_complex_config ("csv", csv_config);
+	plugin_register_init ("csv", csv_init);
 	plugin_register_write ("csv", csv_write, /* user_data = */ NULL);
+	plugin_register_flush ("csv", csv_flush, /* user_data = */ NULL);
+	plugin_register_shutdown ("csv", csv_shutdown);
 } /* void module_register */
@@ -26,6 +26,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_match.h"
+#include "utils_curl_multi.h"
 
 #include <curl/curl.h>
 
@@ -76,7 +77,7 @@ struct web_page_s /* {{{ */
 /*
  * Global variables;
  */
-/* static CURLM *curl = NULL; */
+static ucm_t *multi_g = NULL;
 static web_page_t *pages_g = NULL;
 
 /*
@@ -565,6 +566,11 @@ static int cc_init (void) /* {{{ */
     INFO ("curl plugin: No pages have been defined.");
     return (-1);
   }
+
+  multi_g = ucm_create ();
+  if (multi_g == NULL)
+    return (-1);
+
   return (0);
 } /* }}} int cc_init */
 
@@ -604,30 +610,28 @@ static void cc_submit_response_time (const web_page_t *wp, double seconds) /* {{
   plugin_dispatch_values (&vl);
 } /* }}} void cc_submit_response_time */
 
-static int cc_read_page (web_page_t *wp) /* {{{ */
+static void cc_page_done (CURL *curl, CURLcode result, /* {{{ */
+    void *user_data)
 {
+  web_page_t *wp = user_data;
   web_match_t *wm;
   int status;
-  struct timeval start, end;
-
-  if (wp->response_time)
-    gettimeofday (&start, NULL);
 
-  wp->buffer_fill = 0;
-  status = curl_easy_perform (wp->curl);
-  if (status != 0)
+  if (result != CURLE_OK)
   {
-    ERROR ("curl plugin: curl_easy_perform failed with staus %i: %s",
-        status, wp->curl_errbuf);
-    return (-1);
+    ERROR ("curl plugin: Fetching %s failed with status %i: %s",
+        wp->url, (int) result,
+        (wp->curl_errbuf[0] != 0)
+        ? wp->curl_errbuf : curl_easy_strerror (result));
+    return;
   }
 
   if (wp->response_time)
   {
+    /* The pages are fetched concurrently, so only libcurl knows how long
+     * this one took. */
     double secs = 0;
-    gettimeofday (&end, NULL);
-    secs += end.tv_sec - start.tv_sec;
-    secs += (end.tv_usec - start.tv_usec) / 1000000.0;
+    curl_easy_getinfo (curl, CURLINFO_TOTAL_TIME, &secs);
     cc_submit_response_time (wp, secs);
   }
 
@@ -651,22 +655,35 @@ static int cc_read_page (web_page_t *wp) /* {{{ */
 
     cc_submit (wp, wm, mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
-
-  return (0);
-} /* }}} int cc_read_page */
+} /* }}} void cc_page_done */
 
 static int cc_read (void) /* {{{ */
 {
   web_page_t *wp;
 
   for (wp = pages_g; wp != NULL; wp = wp->next)
-    cc_read_page (wp);
+  {
+    wp->buffer_fill = 0;
+    if (wp->buffer != NULL)
+      wp->buffer[0] = 0;
+    wp->curl_errbuf[0] = 0;
+
+    if (ucm_add (multi_g, wp->curl, cc_page_done, wp) != 0)
+      ERROR ("curl plugin: Unable to fetch %s.", wp->url);
+  }
+
+  /* All pages are fetched at the same time. Whatever has not arrived
+   * within one interval is given up on, so the next read starts on time. */
+  ucm_perform (multi_g, interval_g);
 
   return (0);
 } /* }}} int cc_read */
 
 static int cc_shutdown (void) /* {{{ */
 {
+  ucm_destroy (multi_g);
+  multi_g = NULL;
+
   cc_web_page_free (pages_g);
   pages_g = NULL;
 
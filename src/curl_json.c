@@ -25,7 +25,6 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
 #include "utils_complain.h"
 
 #include <curl/curl.h>
@@ -39,8 +38,6 @@
 #endif
 
 #define CJ_DEFAULT_HOST "localhost"
-#define CJ_KEY_MAGIC 0x43484b59UL /* CHKY */
-#define CJ_IS_KEY(key) ((key)->magic == CJ_KEY_MAGIC)
 #define CJ_ANY "*"
 #define COUCH_MIN(x,y) ((x) < (y) ? (x) : (y))
 
@@ -51,7 +48,31 @@ struct cj_key_s /* {{{ */
   char *path;
   char *type;
   char *instance;
-  unsigned long magic;
+};
+/* }}} */
+
+/* The configured keys, stored in a tree that matches the json map
+ * structure, example:
+ * "httpd/requests/count",
+ * "httpd/requests/current" ->
+ * { "httpd": { "requests": { "count": $key, "current": $key } } } */
+struct cj_tree_s;
+typedef struct cj_tree_s cj_tree_t;
+struct cj_tree_s /* {{{ */
+{
+  char *name;
+  /* The key configured for this path, if any. */
+  cj_key_t *key;
+
+  /* Sorted by name for the binary search in `cj_tree_child'. */
+  cj_tree_t **children;
+  size_t children_num;
+  /* The `*' child, which matches all names without another child. */
+  cj_tree_t *any;
+
+  /* The read during which the value of this node was last complete. Only
+   * used for the children of the root, see `StopAfterLastKey'. */
+  unsigned int generation;
 };
 /* }}} */
 
@@ -67,21 +88,25 @@ struct cj_s /* {{{ */
   _Bool verify_peer;
   _Bool verify_host;
   char *cacert;
+  _Bool stop_after_last_key;
 
   CURL *curl;
   char curl_errbuf[CURL_ERROR_SIZE];
 
   yajl_handle yajl;
-  c_avl_tree_t *tree;
-  cj_key_t *key;
+  cj_tree_t *tree;
   int depth;
   struct {
-    union {
-      c_avl_tree_t *tree;
-      cj_key_t *key;
-    };
+    cj_tree_t *node;
     char name[DATA_MAX_NAME_LEN];
   } state[YAJL_MAX_DEPTH];
+
+  /* Number of the current read and the number of children of the root
+   * whose value has been complete during it. */
+  unsigned int generation;
+  size_t done_num;
+  /* Set when the parser has been stopped after the last configured key. */
+  _Bool stopped;
 };
 typedef struct cj_s cj_t; /* }}} */
 
@@ -126,6 +151,9 @@ static size_t cj_curl_callback (void *buf, /* {{{ */
     return (len);
 #endif
 
+  if (db->stopped)
+    return (0); /* abort the transfer, the rest is not needed */
+
   if (status != yajl_status_ok)
   {
     unsigned char *msg =
@@ -176,6 +204,59 @@ static int cj_get_type (cj_key_t *key)
 #define CJ_CB_ABORT    0
 #define CJ_CB_CONTINUE 1
 
+/* Returns the child of `t' matching the (not null terminated) name or the
+ * `*' child if there is none. */
+static cj_tree_t *cj_tree_child (const cj_tree_t *t, /* {{{ */
+    const char *name, size_t name_len)
+{
+  size_t lo = 0;
+  size_t hi = t->children_num;
+
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    const char *child = t->children[mid]->name;
+    int cmp;
+
+    cmp = strncmp (child, name, name_len);
+    if ((cmp == 0) && (child[name_len] != 0))
+      cmp = 1;
+
+    if (cmp < 0)
+      lo = mid + 1;
+    else if (cmp > 0)
+      hi = mid;
+    else
+      return (t->children[mid]);
+  }
+
+  return (t->any);
+} /* }}} cj_tree_t *cj_tree_child */
+
+/* Called whenever a value has been parsed completely. If `StopAfterLastKey'
+ * is enabled and this completes the last configured child of the root, the
+ * remaining document is of no interest and parsing is aborted. */
+static int cj_value_done (cj_t *db) /* {{{ */
+{
+  cj_tree_t *node;
+
+  if (!db->stop_after_last_key || (db->depth != 1))
+    return (CJ_CB_CONTINUE);
+
+  node = db->state[db->depth].node;
+  if ((node == NULL) || (node == db->tree->any)
+      || (node->generation == db->generation))
+    return (CJ_CB_CONTINUE);
+
+  node->generation = db->generation;
+  db->done_num++;
+  if ((db->tree->any != NULL) || (db->done_num < db->tree->children_num))
+    return (CJ_CB_CONTINUE);
+
+  db->stopped = 1;
+  return (CJ_CB_ABORT);
+} /* }}} int cj_value_done */
+
 /* "number" may not be null terminated, so copy it into a buffer before
  * parsing. */
 static int cj_cb_number (void *ctx,
@@ -184,52 +265,50 @@ static int cj_cb_number (void *ctx,
   char buffer[number_len + 1];
 
   cj_t *db = (cj_t *)ctx;
-  cj_key_t *key = db->state[db->depth].key;
+  cj_tree_t *node = db->state[db->depth].node;
   value_t vt;
   int type;
   int status;
 
-  if ((key == NULL) || !CJ_IS_KEY (key))
-    return (CJ_CB_CONTINUE);
+  if ((node == NULL) || (node->key == NULL))
+    return (cj_value_done (db));
 
   memcpy (buffer, number, number_len);
   buffer[sizeof (buffer) - 1] = 0;
 
-  type = cj_get_type (key);
+  type = cj_get_type (node->key);
   status = parse_value (buffer, &vt, type);
   if (status != 0)
   {
     NOTICE ("curl_json plugin: Unable to parse number: \"%s\"", buffer);
-    return (CJ_CB_CONTINUE);
+    return (cj_value_done (db));
   }
 
-  cj_submit (db, key, &vt);
-  return (CJ_CB_CONTINUE);
+  cj_submit (db, node->key, &vt);
+  return (cj_value_done (db));
 } /* int cj_cb_number */
 
 static int cj_cb_map_key (void *ctx, const unsigned char *val,
     yajl_len_t len)
 {
   cj_t *db = (cj_t *)ctx;
-  c_avl_tree_t *tree;
+  cj_tree_t *parent;
+  cj_tree_t *node;
 
-  tree = db->state[db->depth-1].tree;
+  parent = db->state[db->depth-1].node;
 
-  if (tree != NULL)
-  {
-    cj_key_t *value;
-    char *name;
+  /* Nothing is configured below this map: skip the lookup. */
+  if (parent == NULL)
+    return (CJ_CB_CONTINUE);
 
-    name = db->state[db->depth].name;
-    len = COUCH_MIN(len, sizeof (db->state[db->depth].name)-1);
-    sstrncpy (name, (char *)val, len+1);
+  node = cj_tree_child (parent, (const char *) val, (size_t) len);
+  db->state[db->depth].node = node;
 
-    if (c_avl_get (tree, name, (void *) &value) == 0)
-      db->state[db->depth].key = value;
-    else if (c_avl_get (tree, CJ_ANY, (void *) &value) == 0)
-      db->state[db->depth].key = value;
-    else
-      db->state[db->depth].key = NULL;
+  /* The name is only needed for the type instance of matching keys. */
+  if (node != NULL)
+  {
+    len = COUCH_MIN(len, sizeof (db->state[db->depth].name)-1);
+    sstrncpy (db->state[db->depth].name, (char *)val, len+1);
   }
 
   return (CJ_CB_CONTINUE);
@@ -239,27 +318,39 @@ static int cj_cb_string (void *ctx, const unsigned char *val,
     yajl_len_t len)
 {
   cj_t *db = (cj_t *)ctx;
-  char str[len + 1];
-
-  /* Create a null-terminated version of the string. */
-  memcpy (str, val, len);
-  str[len] = 0;
+  cj_tree_t *node = db->state[db->depth].node;
 
   /* No configuration for this string -> simply return. */
-  if (db->state[db->depth].key == NULL)
-    return (CJ_CB_CONTINUE);
+  if (node == NULL)
+    return (cj_value_done (db));
 
-  if (!CJ_IS_KEY (db->state[db->depth].key))
+  if (node->key == NULL)
   {
+    char str[len + 1];
+
+    /* Create a null-terminated version of the string. */
+    memcpy (str, val, len);
+    str[len] = 0;
+
     NOTICE ("curl_json plugin: Found string \"%s\", but the configuration "
         "expects a map here.", str);
-    return (CJ_CB_CONTINUE);
+    return (cj_value_done (db));
   }
 
   /* Handle the string as if it was a number. */
   return (cj_cb_number (ctx, (const char *) val, len));
 } /* int cj_cb_string */
 
+static int cj_cb_null (void *ctx)
+{
+  return (cj_value_done ((cj_t *) ctx));
+}
+
+static int cj_cb_boolean (void *ctx, int boolean_value)
+{
+  return (cj_value_done ((cj_t *) ctx));
+}
+
 static int cj_cb_start (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
@@ -274,9 +365,9 @@ static int cj_cb_start (void *ctx)
 static int cj_cb_end (void *ctx)
 {
   cj_t *db = (cj_t *)ctx;
-  db->state[db->depth].tree = NULL;
+  db->state[db->depth].node = NULL;
   --db->depth;
-  return (CJ_CB_CONTINUE);
+  return (cj_value_done (db));
 }
 
 static int cj_cb_start_map (void *ctx)
@@ -300,8 +391,8 @@ static int cj_cb_end_array (void * ctx)
 }
 
 static yajl_callbacks ycallbacks = {
-  NULL, /* null */
-  NULL, /* boolean */
+  cj_cb_null,
+  cj_cb_boolean,
   NULL, /* integer */
   NULL, /* double */
   cj_cb_number,
@@ -327,24 +418,21 @@ static void cj_key_free (cj_key_t *key) /* {{{ */
   sfree (key);
 } /* }}} void cj_key_free */
 
-static void cj_tree_free (c_avl_tree_t *tree) /* {{{ */
+static void cj_tree_free (cj_tree_t *tree) /* {{{ */
 {
-  char *name;
-  void *value;
+  size_t i;
 
-  while (c_avl_pick (tree, (void *) &name, (void *) &value) == 0)
-  {
-    cj_key_t *key = (cj_key_t *)value;
+  if (tree == NULL)
+    return;
 
-    if (CJ_IS_KEY(key))
-      cj_key_free (key);
-    else
-      cj_tree_free ((c_avl_tree_t *)value);
+  for (i = 0; i < tree->children_num; i++)
+    cj_tree_free (tree->children[i]);
+  sfree (tree->children);
+  cj_tree_free (tree->any);
 
-    sfree (name);
-  }
-
-  c_avl_destroy (tree);
+  cj_key_free (tree->key);
+  sfree (tree->name);
+  sfree (tree);
 } /* }}} void cj_tree_free */
 
 static void cj_free (void *arg) /* {{{ */
@@ -362,8 +450,7 @@ static void cj_free (void *arg) /* {{{ */
     curl_easy_cleanup (db->curl);
   db->curl = NULL;
 
-  if (db->tree != NULL)
-    cj_tree_free (db->tree);
+  cj_tree_free (db->tree);
   db->tree = NULL;
 
   sfree (db->instance);
@@ -380,10 +467,69 @@ static void cj_free (void *arg) /* {{{ */
 
 /* Configuration handling functions {{{ */
 
-static c_avl_tree_t *cj_avl_create(void)
+/* Returns the child of `t' called `name', creating it if necessary. */
+static cj_tree_t *cj_tree_get_child (cj_tree_t *t, /* {{{ */
+    const char *name)
 {
-  return c_avl_create ((int (*) (const void *, const void *)) strcmp);
-}
+  cj_tree_t **tmp;
+  cj_tree_t *child;
+  size_t pos = 0;
+
+  if (strcmp (CJ_ANY, name) == 0)
+  {
+    if (t->any != NULL)
+      return (t->any);
+  }
+  else
+  {
+    /* Find the position of `name' in the sorted array. */
+    for (pos = 0; pos < t->children_num; pos++)
+    {
+      int cmp = strcmp (t->children[pos]->name, name);
+
+      if (cmp == 0)
+        return (t->children[pos]);
+      else if (cmp > 0)
+        break;
+    }
+  }
+
+  child = calloc (1, sizeof (*child));
+  if (child == NULL)
+  {
+    ERROR ("curl_json plugin: calloc failed.");
+    return (NULL);
+  }
+  child->name = strdup (name);
+  if (child->name == NULL)
+  {
+    ERROR ("curl_json plugin: strdup failed.");
+    sfree (child);
+    return (NULL);
+  }
+
+  if (strcmp (CJ_ANY, name) == 0)
+  {
+    t->any = child;
+    return (child);
+  }
+
+  tmp = realloc (t->children, (t->children_num + 1) * sizeof (*tmp));
+  if (tmp == NULL)
+  {
+    ERROR ("curl_json plugin: realloc failed.");
+    cj_tree_free (child);
+    return (NULL);
+  }
+  t->children = tmp;
+
+  memmove (t->children + pos + 1, t->children + pos,
+      (t->children_num - pos) * sizeof (*tmp));
+  t->children[pos] = child;
+  t->children_num++;
+
+  return (child);
+} /* }}} cj_tree_t *cj_tree_get_child */
 
 static int cj_config_add_key (cj_t *db, /* {{{ */
                                    oconfig_item_t *ci)
@@ -407,7 +553,6 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     return (-1);
   }
   memset (key, 0, sizeof (*key));
-  key->magic = CJ_KEY_MAGIC;
 
   if (strcasecmp ("Key", ci->key) == 0)
   {
@@ -455,33 +600,34 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
     break;
   } /* while (status == 0) */
 
-  /* store path in a tree that will match the json map structure, example:
-   * "httpd/requests/count",
-   * "httpd/requests/current" ->
-   * { "httpd": { "requests": { "count": $key, "current": $key } } }
-   */
   if (status == 0)
   {
     char *ptr;
     char *name;
     char ent[PATH_MAX];
-    c_avl_tree_t *tree;
+    cj_tree_t *tree;
 
     if (db->tree == NULL)
-      db->tree = cj_avl_create();
+    {
+      db->tree = calloc (1, sizeof (*db->tree));
+      if (db->tree == NULL)
+      {
+        ERROR ("curl_json plugin: calloc failed.");
+        cj_key_free (key);
+        return (-1);
+      }
+    }
 
     tree = db->tree;
-    name = key->path;
     ptr = key->path;
     if (*ptr == '/')
       ++ptr;
 
     name = ptr;
-    while (*ptr)
+    while (*ptr && (tree != NULL))
     {
       if (*ptr == '/')
       {
-        c_avl_tree_t *value;
         int len;
 
         len = ptr-name;
@@ -489,26 +635,36 @@ static int cj_config_add_key (cj_t *db, /* {{{ */
           break;
         sstrncpy (ent, name, len+1);
 
-        if (c_avl_get (tree, ent, (void *) &value) != 0)
-        {
-          value = cj_avl_create ();
-          c_avl_insert (tree, strdup (ent), value);
-        }
-
-        tree = value;
+        tree = cj_tree_get_child (tree, ent);
         name = ptr+1;
       }
       ++ptr;
     }
-    if (*name)
-      c_avl_insert (tree, strdup(name), key);
+
+    if ((tree != NULL) && (*name != 0))
+      tree = cj_tree_get_child (tree, name);
     else
     {
       ERROR ("curl_json plugin: invalid key: %s", key->path);
-      status = -1;
+      tree = NULL;
+    }
+
+    if ((tree != NULL) && (tree->key != NULL))
+    {
+      WARNING ("curl_json plugin: Key \"%s\" is configured more than once.",
+          key->path);
+      tree = NULL;
     }
+
+    if (tree == NULL)
+      status = -1;
+    else
+      tree->key = key;
   }
 
+  if (status != 0)
+    cj_key_free (key);
+
   return (status);
 } /* }}} int cj_config_add_key */
 
@@ -615,6 +771,8 @@ static int cj_config_add_url (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean (child, &db->verify_host);
     else if (strcasecmp ("CACert", child->key) == 0)
       status = cf_util_get_string (child, &db->cacert);
+    else if (strcasecmp ("StopAfterLastKey", child->key) == 0)
+      status = cf_util_get_boolean (child, &db->stop_after_last_key);
     else if (strcasecmp ("Key", child->key) == 0)
       status = cj_config_add_key (db, child);
     else
@@ -770,7 +928,7 @@ static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
   curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &url);
 
   status = curl_easy_perform (curl);
-  if (status != 0)
+  if ((status != 0) && !db->stopped)
   {
     ERROR ("curl_json plugin: curl_easy_perform failed with status %i: %s (%s)",
            status, db->curl_errbuf, (url != NULL) ? url : "<null>");
@@ -791,12 +949,21 @@ static int cj_curl_perform (cj_t *db, CURL *curl) /* {{{ */
     return (-1);
   }
 
+  /* The transfer was aborted after the last configured key. */
+  if (db->stopped)
+  {
+    yajl_free (db->yajl);
+    db->yajl = yprev;
+    return (0);
+  }
+
 #if HAVE_YAJL_V2
     status = yajl_complete_parse(db->yajl);
 #else
     status = yajl_parse_complete(db->yajl);
 #endif
-  if (status != yajl_status_ok)
+  /* Parsing may also be stopped while the last bytes are parsed. */
+  if ((status != yajl_status_ok) && !db->stopped)
   {
     unsigned char *errmsg;
 
@@ -829,8 +996,11 @@ static int cj_read (user_data_t *ud) /* {{{ */
 
   db->depth = 0;
   memset (&db->state, 0, sizeof(db->state));
-  db->state[db->depth].tree = db->tree;
-  db->key = NULL;
+  db->state[db->depth].node = db->tree;
+
+  db->generation++;
+  db->done_num = 0;
+  db->stopped = 0;
 
   return cj_curl_perform (db, db->curl);
 } /* }}} int cj_read */
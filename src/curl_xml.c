@@ -28,6 +28,7 @@
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
+#include <libxml/SAX2.h>
 
 #include <curl/curl.h>
 
@@ -44,6 +45,27 @@ struct cx_values_s /* {{{ */
 typedef struct cx_values_s cx_values_t;
 /* }}} */
 
+/* An XPath expression compiled for the streaming parser. */
+struct cx_stream_path_s /* {{{ */
+{
+  /* Element names, "*" matches any element. */
+  char **steps;
+  int steps_num;
+  /* The (base) path started with "//". */
+  _Bool any_depth;
+  /* The attribute selected instead of the text of the last step. */
+  char *attribute;
+
+  /* State while parsing one base node. */
+  int matches;
+  int capture_depth;
+  char *value;
+  size_t value_len;
+  size_t value_size;
+};
+typedef struct cx_stream_path_s cx_stream_path_t;
+/* }}} */
+
 struct cx_xpath_s /* {{{ */
 {
   char *path;
@@ -54,6 +76,15 @@ struct cx_xpath_s /* {{{ */
   char *instance;
   int is_table;
   unsigned long magic;
+
+  /* Only used by the streaming parser. */
+  cx_stream_path_t *stream_base;
+  /* The values followed by the instance. */
+  cx_stream_path_t *stream_targets;
+  const data_set_t *stream_ds;
+  /* The depth of the current base node, zero if none is open. */
+  int stream_depth;
+  int stream_records;
 };
 typedef struct cx_xpath_s cx_xpath_t;
 /* }}} */
@@ -78,9 +109,23 @@ struct cx_s /* {{{ */
   size_t buffer_fill;
 
   llist_t *list; /* list of xpath blocks */
+
+  _Bool streaming;
+  xmlParserCtxtPtr parser;
+  /* The names of the open elements. */
+  int depth;
+  char *names;
+  size_t names_size;
+  size_t names_fill;
+  size_t *names_offsets;
+  int names_offsets_size;
+  int stream_dispatched;
 };
 typedef struct cx_s cx_t; /* }}} */
 
+static size_t cx_stream_feed (cx_t *db, const char *buf, size_t len);
+static void cx_stream_xpath_free (cx_xpath_t *xpath);
+
 /*
  * Private functions
  */
@@ -101,6 +146,9 @@ static size_t cx_curl_callback (void *buf, /* {{{ */
    if (len <= 0)
     return (len);
 
+  if (db->streaming)
+    return (cx_stream_feed (db, buf, len));
+
   if ((db->buffer_fill + len) >= db->buffer_size)
   {
     char *temp;
@@ -133,6 +181,7 @@ static void cx_xpath_free (cx_xpath_t *xpath) /* {{{ */
   sfree (xpath->instance_prefix);
   sfree (xpath->instance);
   sfree (xpath->values);
+  cx_stream_xpath_free (xpath);
   sfree (xpath);
 } /* }}} void cx_xpath_free */
 
@@ -175,6 +224,11 @@ static void cx_free (void *arg) /* {{{ */
   if (db->list != NULL)
     cx_list_free (db->list);
 
+  if (db->parser != NULL)
+    xmlFreeParserCtxt (db->parser);
+  sfree (db->names);
+  sfree (db->names_offsets);
+
   sfree (db->buffer);
   sfree (db->instance);
   sfree (db->host);
@@ -206,6 +260,624 @@ static int cx_check_type (const data_set_t *ds, cx_xpath_t *xpath) /* {{{ */
   return (0);
 } /* }}} cx_check_type */
 
+/*
+ * Streaming evaluation
+ *
+ * With `Streaming' enabled the document is parsed by a SAX push parser while
+ * it is received, and never stored or built into a tree. This supports a
+ * subset of XPath which is evaluated in the same pass for all expressions:
+ * base paths are absolute paths of element names, which may start with
+ * "//" and use "*" as a step. Instance and value paths are relative paths of
+ * element names ending with "text()" or "@attribute".
+ */
+static int cx_stream_step_valid (const char *step) /* {{{ */
+{
+  const char *ptr;
+
+  if (strcmp ("*", step) == 0)
+    return (1);
+
+  if (!isalpha ((unsigned char) *step) && (*step != '_'))
+    return (0);
+
+  for (ptr = step; *ptr != 0; ptr++)
+    if (!isalnum ((unsigned char) *ptr) && (strchr ("_-.:", *ptr) == NULL))
+      return (0);
+
+  return (1);
+} /* }}} int cx_stream_step_valid */
+
+/* Parses `str' into `p'. Returns non-zero if it is not in the subset
+ * supported by the streaming parser. */
+static int cx_stream_path_parse (cx_stream_path_t *p, /* {{{ */
+    const char *str, _Bool absolute)
+{
+  char buffer[DATA_MAX_NAME_LEN];
+  char *fields[64];
+  int fields_num;
+  char *ptr;
+  int i;
+
+  memset (p, 0, sizeof (*p));
+  p->capture_depth = -1;
+
+  if (absolute)
+  {
+    if (strncmp ("//", str, 2) == 0)
+    {
+      p->any_depth = 1;
+      str += 2;
+    }
+    else if (*str == '/')
+      str++;
+    else
+      return (-1);
+  }
+  else if (strncmp ("./", str, 2) == 0)
+    str += 2;
+
+  sstrncpy (buffer, str, sizeof (buffer));
+  ptr = buffer;
+
+  /* Empty steps, as in "a//b", are not supported. */
+  fields_num = 0;
+  while (fields_num < STATIC_ARRAY_SIZE (fields))
+  {
+    fields[fields_num++] = ptr;
+    ptr = strchr (ptr, '/');
+    if (ptr == NULL)
+      break;
+    *ptr = 0;
+    ptr++;
+  }
+  if ((ptr != NULL) || (fields_num < 1))
+    return (-1);
+
+  if (!absolute)
+  {
+    char *last = fields[fields_num - 1];
+
+    if (strcmp ("text()", last) == 0)
+      fields_num--;
+    else if ((last[0] == '@') && cx_stream_step_valid (last + 1)
+        && (strcmp ("*", last + 1) != 0))
+    {
+      p->attribute = strdup (last + 1);
+      if (p->attribute == NULL)
+        return (-1);
+      fields_num--;
+    }
+    else
+      return (-1);
+  }
+
+  if (fields_num > 0)
+  {
+    p->steps = calloc (fields_num, sizeof (*p->steps));
+    if (p->steps == NULL)
+      return (-1);
+  }
+
+  for (i = 0; i < fields_num; i++)
+  {
+    if (!cx_stream_step_valid (fields[i]))
+      return (-1);
+
+    p->steps[i] = strdup (fields[i]);
+    if (p->steps[i] == NULL)
+      return (-1);
+    p->steps_num++;
+  }
+
+  if (absolute && (p->steps_num == 0))
+    return (-1);
+
+  return (0);
+} /* }}} int cx_stream_path_parse */
+
+static void cx_stream_path_free (cx_stream_path_t *p) /* {{{ */
+{
+  int i;
+
+  if (p == NULL)
+    return;
+
+  for (i = 0; i < p->steps_num; i++)
+    sfree (p->steps[i]);
+  sfree (p->steps);
+  sfree (p->attribute);
+  sfree (p->value);
+} /* }}} void cx_stream_path_free */
+
+static void cx_stream_xpath_free (cx_xpath_t *xpath) /* {{{ */
+{
+  int i;
+
+  if (xpath->stream_base != NULL)
+  {
+    cx_stream_path_free (xpath->stream_base);
+    sfree (xpath->stream_base);
+  }
+
+  if (xpath->stream_targets != NULL)
+  {
+    for (i = 0; i <= xpath->values_len; i++)
+      cx_stream_path_free (xpath->stream_targets + i);
+    sfree (xpath->stream_targets);
+  }
+} /* }}} void cx_stream_xpath_free */
+
+/* Compiles all expressions of `db' for the streaming parser. */
+static int cx_stream_compile (cx_t *db) /* {{{ */
+{
+  llentry_t *le;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    cx_xpath_t *xpath = le->value;
+    const char *failed = NULL;
+    int i;
+
+    xpath->stream_base = calloc (1, sizeof (*xpath->stream_base));
+    /* The values are followed by the instance. */
+    xpath->stream_targets = calloc (xpath->values_len + 1,
+        sizeof (*xpath->stream_targets));
+    if ((xpath->stream_base == NULL) || (xpath->stream_targets == NULL))
+    {
+      ERROR ("curl_xml plugin: calloc failed.");
+      cx_stream_xpath_free (xpath);
+      return (-1);
+    }
+
+    if (cx_stream_path_parse (xpath->stream_base, xpath->path,
+          /* absolute = */ 1) != 0)
+      failed = xpath->path;
+
+    for (i = 0; (i < xpath->values_len) && (failed == NULL); i++)
+      if (cx_stream_path_parse (xpath->stream_targets + i,
+            xpath->values[i].path, /* absolute = */ 0) != 0)
+        failed = xpath->values[i].path;
+
+    if ((failed == NULL) && (xpath->instance != NULL)
+        && (cx_stream_path_parse (xpath->stream_targets + xpath->values_len,
+            xpath->instance, /* absolute = */ 0) != 0))
+      failed = xpath->instance;
+
+    if (failed != NULL)
+    {
+      WARNING ("curl_xml plugin: The XPath expression \"%s\" is not "
+          "supported by the streaming parser. The documents of `%s' "
+          "will be parsed into a tree instead.", failed, db->url);
+      for (le = llist_head (db->list); le != NULL; le = le->next)
+        cx_stream_xpath_free (le->value);
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int cx_stream_compile */
+
+static const char *cx_stream_name (const cx_t *db, int index) /* {{{ */
+{
+  return (db->names + db->names_offsets[index]);
+} /* }}} const char *cx_stream_name */
+
+/* Checks the names of the open elements, starting at `first', against the
+ * steps of `p'. */
+static _Bool cx_stream_steps_match (const cx_t *db, /* {{{ */
+    const cx_stream_path_t *p, int first)
+{
+  int i;
+
+  for (i = 0; i < p->steps_num; i++)
+    if ((strcmp ("*", p->steps[i]) != 0)
+        && (strcmp (p->steps[i], cx_stream_name (db, first + i)) != 0))
+      return (0);
+
+  return (1);
+} /* }}} _Bool cx_stream_steps_match */
+
+static _Bool cx_stream_base_matches (const cx_t *db, /* {{{ */
+    const cx_stream_path_t *p)
+{
+  if (p->any_depth)
+  {
+    if (db->depth < p->steps_num)
+      return (0);
+    return (cx_stream_steps_match (db, p, db->depth - p->steps_num));
+  }
+
+  if (db->depth != p->steps_num)
+    return (0);
+  return (cx_stream_steps_match (db, p, 0));
+} /* }}} _Bool cx_stream_base_matches */
+
+static int cx_stream_append (cx_stream_path_t *p, /* {{{ */
+    const char *str, size_t len)
+{
+  if ((p->value_len + len) >= p->value_size)
+  {
+    char *tmp;
+
+    tmp = realloc (p->value, p->value_len + len + 1);
+    if (tmp == NULL)
+    {
+      ERROR ("curl_xml plugin: realloc failed.");
+      return (-1);
+    }
+    p->value = tmp;
+    p->value_size = p->value_len + len + 1;
+  }
+
+  memcpy (p->value + p->value_len, str, len);
+  p->value_len += len;
+  p->value[p->value_len] = 0;
+
+  return (0);
+} /* }}} int cx_stream_append */
+
+/* Handles an element, at the current depth, selected by `p'. */
+static void cx_stream_target_found (cx_stream_path_t *p, /* {{{ */
+    const xmlChar **atts, int depth)
+{
+  int i;
+
+  if (p->attribute == NULL)
+  {
+    /* Only the text of the first match is kept; more matches are an
+     * error anyway. */
+    if (p->matches++ == 0)
+      p->capture_depth = depth;
+    return;
+  }
+
+  for (i = 0; (atts != NULL) && (atts[i] != NULL); i += 2)
+  {
+    if (strcmp (p->attribute, (const char *) atts[i]) != 0)
+      continue;
+
+    if ((p->matches++ == 0) && (atts[i + 1] != NULL))
+      cx_stream_append (p, (const char *) atts[i + 1],
+          strlen ((const char *) atts[i + 1]));
+    break;
+  }
+} /* }}} void cx_stream_target_found */
+
+/* Returns the number of selected values and instances of `xpath'. */
+static int cx_stream_targets_num (const cx_xpath_t *xpath) /* {{{ */
+{
+  return (xpath->values_len + ((xpath->instance != NULL) ? 1 : 0));
+} /* }}} int cx_stream_targets_num */
+
+/* Returns the text of `p' without surrounding white space, or NULL and
+ * complains if `p' did not select exactly one node. */
+static char *cx_stream_target_value (cx_stream_path_t *p, /* {{{ */
+    const char *path)
+{
+  char *value;
+  size_t len;
+
+  if ((p->matches == 0) || (p->value == NULL))
+  {
+    WARNING ("curl_xml plugin: "
+        "relative xpath expression \"%s\" doesn't match any of the nodes. "
+        "Skipping...", path);
+    return (NULL);
+  }
+  else if (p->matches > 1)
+  {
+    WARNING ("curl_xml plugin: "
+        "relative xpath expression \"%s\" is expected to return "
+        "only one node. Skipping...", path);
+    return (NULL);
+  }
+
+  value = p->value;
+  while (isspace ((unsigned char) *value))
+    value++;
+  len = strlen (value);
+  while ((len > 0) && isspace ((unsigned char) value[len - 1]))
+    value[--len] = 0;
+
+  return (value);
+} /* }}} char *cx_stream_target_value */
+
+/* Dispatches the values of the base node which has just been closed. */
+static void cx_stream_dispatch (cx_t *db, cx_xpath_t *xpath) /* {{{ */
+{
+  value_t values[xpath->values_len];
+  value_list_t vl = VALUE_LIST_INIT;
+  int i;
+
+  /* If the base xpath returns multiple results, an instance is required.
+   * The first result has already been dispatched by then. */
+  if ((xpath->instance == NULL) && (xpath->stream_records > 1))
+  {
+    if (xpath->stream_records == 2)
+      ERROR ("curl_xml plugin: "
+          "InstanceFrom is must in xpath block since the base xpath "
+          "expression \"%s\" returned multiple results. Skipping the "
+          "additional results...", xpath->path);
+    return;
+  }
+
+  if (xpath->instance != NULL)
+  {
+    char *instance;
+
+    instance = cx_stream_target_value (xpath->stream_targets
+        + xpath->values_len, xpath->instance);
+    if (instance == NULL)
+      return;
+
+    ssnprintf (vl.type_instance, sizeof (vl.type_instance), "%s%s",
+        (xpath->instance_prefix != NULL) ? xpath->instance_prefix : "",
+        instance);
+  }
+  else if (xpath->instance_prefix != NULL)
+    sstrncpy (vl.type_instance, xpath->instance_prefix,
+        sizeof (vl.type_instance));
+
+  for (i = 0; i < xpath->values_len; i++)
+  {
+    char *value;
+
+    value = cx_stream_target_value (xpath->stream_targets + i,
+        xpath->values[i].path);
+    if (value == NULL)
+      return;
+
+    if (parse_value (value, values + i, xpath->stream_ds->ds[i].type) != 0)
+      return;
+  }
+
+  vl.values = values;
+  vl.values_len = xpath->values_len;
+  sstrncpy (vl.type, xpath->type, sizeof (vl.type));
+  sstrncpy (vl.plugin, "curl_xml", sizeof (vl.plugin));
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  if (db->instance != NULL)
+    sstrncpy (vl.plugin_instance, db->instance, sizeof (vl.plugin_instance));
+
+  plugin_dispatch_values (&vl);
+  db->stream_dispatched++;
+} /* }}} void cx_stream_dispatch */
+
+static void cx_stream_start_element (void *ctx, /* {{{ */
+    const xmlChar *name, const xmlChar **atts)
+{
+  cx_t *db = ctx;
+  size_t name_len = strlen ((const char *) name);
+  llentry_t *le;
+
+  if (db->depth >= db->names_offsets_size)
+  {
+    size_t *tmp;
+
+    tmp = realloc (db->names_offsets,
+        2 * (db->names_offsets_size + 8) * sizeof (*tmp));
+    if (tmp == NULL)
+    {
+      ERROR ("curl_xml plugin: realloc failed.");
+      xmlStopParser (db->parser);
+      return;
+    }
+    db->names_offsets = tmp;
+    db->names_offsets_size = 2 * (db->names_offsets_size + 8);
+  }
+
+  if ((db->names_fill + name_len + 1) > db->names_size)
+  {
+    char *tmp;
+
+    tmp = realloc (db->names, 2 * (db->names_fill + name_len + 1));
+    if (tmp == NULL)
+    {
+      ERROR ("curl_xml plugin: realloc failed.");
+      xmlStopParser (db->parser);
+      return;
+    }
+    db->names = tmp;
+    db->names_size = 2 * (db->names_fill + name_len + 1);
+  }
+
+  db->names_offsets[db->depth] = db->names_fill;
+  memcpy (db->names + db->names_fill, name, name_len + 1);
+  db->names_fill += name_len + 1;
+  db->depth++;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    cx_xpath_t *xpath = le->value;
+    int i;
+
+    if (xpath->stream_ds == NULL)
+      continue;
+
+    if (xpath->stream_depth == 0)
+    {
+      if (!cx_stream_base_matches (db, xpath->stream_base))
+        continue;
+
+      xpath->stream_depth = db->depth;
+      xpath->stream_records++;
+      for (i = 0; i < cx_stream_targets_num (xpath); i++)
+      {
+        cx_stream_path_t *p = xpath->stream_targets + i;
+
+        p->matches = 0;
+        p->capture_depth = -1;
+        p->value_len = 0;
+        if (p->value != NULL)
+          p->value[0] = 0;
+
+        if (p->steps_num == 0)
+          cx_stream_target_found (p, atts, db->depth);
+      }
+      continue;
+    }
+
+    for (i = 0; i < cx_stream_targets_num (xpath); i++)
+    {
+      cx_stream_path_t *p = xpath->stream_targets + i;
+
+      if ((p->steps_num == db->depth - xpath->stream_depth)
+          && cx_stream_steps_match (db, p, xpath->stream_depth))
+        cx_stream_target_found (p, atts, db->depth);
+    }
+  }
+} /* }}} void cx_stream_start_element */
+
+static void cx_stream_end_element (void *ctx, /* {{{ */
+    const xmlChar __attribute__((unused)) *name)
+{
+  cx_t *db = ctx;
+  llentry_t *le;
+
+  if (db->depth <= 0)
+    return;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    cx_xpath_t *xpath = le->value;
+    int i;
+
+    if (xpath->stream_depth == 0)
+      continue;
+
+    for (i = 0; i < cx_stream_targets_num (xpath); i++)
+      if (xpath->stream_targets[i].capture_depth == db->depth)
+        xpath->stream_targets[i].capture_depth = -1;
+
+    if (xpath->stream_depth == db->depth)
+    {
+      cx_stream_dispatch (db, xpath);
+      xpath->stream_depth = 0;
+    }
+  }
+
+  db->depth--;
+  db->names_fill = db->names_offsets[db->depth];
+} /* }}} void cx_stream_end_element */
+
+static void cx_stream_characters (void *ctx, /* {{{ */
+    const xmlChar *ch, int len)
+{
+  cx_t *db = ctx;
+  llentry_t *le;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    cx_xpath_t *xpath = le->value;
+    int i;
+
+    if (xpath->stream_depth == 0)
+      continue;
+
+    for (i = 0; i < cx_stream_targets_num (xpath); i++)
+      if (xpath->stream_targets[i].capture_depth == db->depth)
+        cx_stream_append (xpath->stream_targets + i,
+            (const char *) ch, (size_t) len);
+  }
+} /* }}} void cx_stream_characters */
+
+static int cx_stream_begin (cx_t *db) /* {{{ */
+{
+  xmlSAXHandler sax;
+  llentry_t *le;
+
+  memset (&sax, 0, sizeof (sax));
+  sax.startElement = cx_stream_start_element;
+  sax.endElement = cx_stream_end_element;
+  sax.characters = cx_stream_characters;
+  sax.cdataBlock = cx_stream_characters;
+
+  db->depth = 0;
+  db->names_fill = 0;
+  db->stream_dispatched = 0;
+
+  for (le = llist_head (db->list); le != NULL; le = le->next)
+  {
+    cx_xpath_t *xpath = le->value;
+    const data_set_t *ds = plugin_get_ds (xpath->type);
+
+    /* Types are checked once per document, not per node. */
+    xpath->stream_ds = (cx_check_type (ds, xpath) == 0) ? ds : NULL;
+    xpath->stream_depth = 0;
+    xpath->stream_records = 0;
+  }
+
+  db->parser = xmlCreatePushParserCtxt (&sax, db, /* chunk = */ NULL, 0,
+      db->url);
+  if (db->parser == NULL)
+  {
+    ERROR ("curl_xml plugin: xmlCreatePushParserCtxt failed.");
+    return (-1);
+  }
+  xmlCtxtUseOptions (db->parser, XML_PARSE_NONET);
+
+  return (0);
+} /* }}} int cx_stream_begin */
+
+/* Feeds data received by libcurl to the parser. */
+static size_t cx_stream_feed (cx_t *db, const char *buf, size_t len) /* {{{ */
+{
+  long rc = 0;
+
+  /* Error pages are not parsed; the status is reported by
+   * `cx_curl_perform'. */
+  curl_easy_getinfo (db->curl, CURLINFO_RESPONSE_CODE, &rc);
+  if ((rc != 0) && (rc != 200))
+    return (0);
+
+  if ((db->parser == NULL)
+      || (xmlParseChunk (db->parser, buf, (int) len,
+          /* terminate = */ 0) != 0))
+  {
+    ERROR ("curl_xml plugin: Failed to parse the xml document (%s).",
+        db->url);
+    return (0);
+  }
+
+  return (len);
+} /* }}} size_t cx_stream_feed */
+
+/* Finishes the document. Returns zero if anything has been dispatched. */
+static int cx_stream_end (cx_t *db, _Bool complete) /* {{{ */
+{
+  int status = -1;
+
+  if (db->parser == NULL)
+    return (-1);
+
+  if (complete)
+  {
+    llentry_t *le;
+
+    if ((xmlParseChunk (db->parser, NULL, 0, /* terminate = */ 1) != 0)
+        || !db->parser->wellFormed)
+      ERROR ("curl_xml plugin: Failed to parse the xml document (%s).",
+          db->url);
+    else if (db->stream_dispatched > 0)
+      status = 0;
+
+    for (le = llist_head (db->list); le != NULL; le = le->next)
+    {
+      cx_xpath_t *xpath = le->value;
+
+      if ((xpath->stream_ds != NULL) && (xpath->stream_records == 0))
+        ERROR ("curl_xml plugin: "
+            "xpath expression \"%s\" doesn't match any of the nodes. "
+            "Skipping the xpath block...", xpath->path);
+    }
+  }
+
+  xmlFreeParserCtxt (db->parser);
+  db->parser = NULL;
+
+  return (status);
+} /* }}} int cx_stream_end */
+
 static xmlXPathObjectPtr cx_evaluate_xpath (xmlXPathContextPtr xpath_ctx, /* {{{ */ 
            xmlChar *expr)
 {
@@ -549,6 +1221,9 @@ static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
   char *ptr;
   char *url;
 
+  if (db->streaming && (cx_stream_begin (db) != 0))
+    return (-1);
+
   db->buffer_fill = 0; 
   status = curl_easy_perform (curl);
 
@@ -560,6 +1235,8 @@ static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with response code %ld (%s)",
            rc, url);
+    if (db->streaming)
+      cx_stream_end (db, /* complete = */ 0);
     return (-1);
   }
 
@@ -567,9 +1244,15 @@ static int cx_curl_perform (cx_t *db, CURL *curl) /* {{{ */
   {
     ERROR ("curl_xml plugin: curl_easy_perform failed with status %i: %s (%s)",
            status, db->curl_errbuf, url);
+    if (db->streaming)
+      cx_stream_end (db, /* complete = */ 0);
     return (-1);
   }
 
+  /* The values have been dispatched while receiving the document. */
+  if (db->streaming)
+    return (cx_stream_end (db, /* complete = */ 1));
+
   ptr = db->buffer;
 
   status = cx_parse_stats_xml(BAD_CAST ptr, db);
@@ -829,6 +1512,8 @@ static int cx_config_add_url (oconfig_item_t *ci) /* {{{ */
       status = cf_util_get_boolean (child, &db->verify_host);
     else if (strcasecmp ("CACert", child->key) == 0)
       status = cf_util_get_string (child, &db->cacert);
+    else if (strcasecmp ("Streaming", child->key) == 0)
+      status = cf_util_get_boolean (child, &db->streaming);
     else if (strcasecmp ("xpath", child->key) == 0)
       status = cx_config_add_xpath (db, child);
     else
@@ -849,6 +1534,8 @@ static int cx_config_add_url (oconfig_item_t *ci) /* {{{ */
                "within `URL' block `%s'.", db->url);
       status = -1;
     }
+    if ((status == 0) && db->streaming && (cx_stream_compile (db) != 0))
+      db->streaming = 0;
     if (status == 0)
       status = cx_init_curl (db);
   }
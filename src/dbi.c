@@ -37,6 +37,22 @@ struct cdbi_driver_option_s /* {{{ */
 };
 typedef struct cdbi_driver_option_s cdbi_driver_option_t; /* }}} */
 
+struct cdbi_database_s;
+typedef struct cdbi_database_s cdbi_database_t;
+
+/* A database has one or more connections, each of which is read by its own
+ * read callback, so the queries of a database may run concurrently.
+ * Connection `index' runs the queries `index', `index + connections_num' and
+ * so on. */
+struct cdbi_connection_s /* {{{ */
+{
+  cdbi_database_t *db;
+  size_t index;
+
+  dbi_conn connection;
+};
+typedef struct cdbi_connection_s cdbi_connection_t; /* }}} */
+
 struct cdbi_database_s /* {{{ */
 {
   char *name;
@@ -50,9 +66,9 @@ struct cdbi_database_s /* {{{ */
   udb_query_t **queries;
   size_t        queries_num;
 
-  dbi_conn connection;
-};
-typedef struct cdbi_database_s cdbi_database_t; /* }}} */
+  int connections_num;
+  cdbi_connection_t *connections;
+}; /* }}} */
 
 /*
  * Global variables
@@ -168,6 +184,8 @@ static void cdbi_database_free (cdbi_database_t *db) /* {{{ */
       udb_query_delete_preparation_area (db->q_prep_areas[i]);
   free (db->q_prep_areas);
 
+  sfree (db->connections);
+
   sfree (db);
 } /* }}} void cdbi_database_free */
 
@@ -189,6 +207,7 @@ static void cdbi_database_free (cdbi_database_t *db) /* {{{ */
  *     DriverOption "hostname" "localhost"
  *     ...
  *     Query "plugin_instance0"
+ *     Connections 2
  *   </Database>
  * </Plugin>
  */
@@ -285,6 +304,7 @@ static int cdbi_config_add_database (oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
   memset (db, 0, sizeof (*db));
+  db->connections_num = 1;
 
   status = cdbi_config_set_string (&db->name, ci);
   if (status != 0)
@@ -307,6 +327,15 @@ static int cdbi_config_add_database (oconfig_item_t *ci) /* {{{ */
     else if (strcasecmp ("Query", child->key) == 0)
       status = udb_query_pick_from_list (child, queries, queries_num,
           &db->queries, &db->queries_num);
+    else if (strcasecmp ("Connections", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &db->connections_num);
+      if ((status == 0) && (db->connections_num < 1))
+      {
+        WARNING ("dbi plugin: `Connections' must be at least one.");
+        status = -1;
+      }
+    }
     else
     {
       WARNING ("dbi plugin: Option `%s' not allowed here.", child->key);
@@ -362,6 +391,29 @@ static int cdbi_config_add_database (oconfig_item_t *ci) /* {{{ */
     break;
   }
 
+  if (status == 0)
+  {
+    /* More connections than queries would be idle. */
+    if ((size_t) db->connections_num > db->queries_num)
+      db->connections_num = (db->queries_num > 0) ? (int) db->queries_num : 1;
+
+    db->connections = calloc ((size_t) db->connections_num,
+        sizeof (*db->connections));
+    if (db->connections == NULL)
+    {
+      ERROR ("dbi plugin: calloc failed");
+      status = -1;
+    }
+    else
+    {
+      for (i = 0; i < db->connections_num; i++)
+      {
+        db->connections[i].db = db;
+        db->connections[i].index = (size_t) i;
+      }
+    }
+  }
+
   /* If all went well, add this database to the global list of databases. */
   if (status == 0)
   {
@@ -414,9 +466,12 @@ static int cdbi_config (oconfig_item_t *ci) /* {{{ */
 
 /* }}} End of configuration handling functions */
 
+static int cdbi_read (user_data_t *ud);
+
 static int cdbi_init (void) /* {{{ */
 {
   static int did_init = 0;
+  size_t i;
   int status;
 
   if (did_init != 0)
@@ -452,10 +507,36 @@ static int cdbi_init (void) /* {{{ */
   DEBUG ("dbi plugin: cdbi_init: dbi_initialize reports %i driver%s.",
       status, (status == 1) ? "" : "s");
 
+  for (i = 0; i < databases_num; i++)
+  {
+    cdbi_database_t *db = databases[i];
+    int j;
+
+    for (j = 0; j < db->connections_num; j++)
+    {
+      char cb_name[DATA_MAX_NAME_LEN];
+      user_data_t ud;
+
+      if (db->connections_num == 1)
+        ssnprintf (cb_name, sizeof (cb_name), "dbi-%s", db->name);
+      else
+        ssnprintf (cb_name, sizeof (cb_name), "dbi-%s-%i", db->name, j);
+
+      memset (&ud, 0, sizeof (ud));
+      ud.data = db->connections + j;
+      ud.free_func = NULL;
+
+      plugin_register_complex_read ("dbi", cb_name, cdbi_read,
+          /* interval = */ NULL, &ud);
+    }
+  }
+
+  did_init = 1;
   return (0);
 } /* }}} int cdbi_init */
 
 static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
+    dbi_conn connection,
     udb_query_t *q, udb_query_preparation_area_t *prep_area)
 {
   const char *statement;
@@ -481,14 +562,14 @@ static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
   statement = udb_query_get_statement (q);
   assert (statement != NULL);
 
-  res = dbi_conn_query (db->connection, statement);
+  res = dbi_conn_query (connection, statement);
   if (res == NULL)
   {
     char errbuf[1024];
     ERROR ("dbi plugin: cdbi_read_database_query (%s, %s): "
         "dbi_conn_query failed: %s",
         db->name, udb_query_get_name (q),
-        cdbi_strerror (db->connection, errbuf, sizeof (errbuf)));
+        cdbi_strerror (connection, errbuf, sizeof (errbuf)));
     BAIL_OUT (-1);
   }
   else /* Get the number of columns */
@@ -502,7 +583,7 @@ static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
       ERROR ("dbi plugin: cdbi_read_database_query (%s, %s): "
           "dbi_result_get_numfields failed: %s",
           db->name, udb_query_get_name (q),
-          cdbi_strerror (db->connection, errbuf, sizeof (errbuf)));
+          cdbi_strerror (connection, errbuf, sizeof (errbuf)));
       BAIL_OUT (-1);
     }
 
@@ -577,7 +658,7 @@ static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
         "dbi_result_first_row failed: %s. Maybe the statement didn't "
         "return any rows?",
         db->name, udb_query_get_name (q),
-        cdbi_strerror (db->connection, errbuf, sizeof (errbuf)));
+        cdbi_strerror (connection, errbuf, sizeof (errbuf)));
     udb_query_finish_result (q, prep_area);
     BAIL_OUT (-1);
   } /* }}} */
@@ -620,13 +701,13 @@ static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
     status = dbi_result_next_row (res); /* {{{ */
     if (status != 1)
     {
-      if (dbi_conn_error (db->connection, NULL) != 0)
+      if (dbi_conn_error (connection, NULL) != 0)
       {
         char errbuf[1024];
         WARNING ("dbi plugin: cdbi_read_database_query (%s, %s): "
             "dbi_result_next_row failed: %s.",
             db->name, udb_query_get_name (q),
-            cdbi_strerror (db->connection, errbuf, sizeof (errbuf)));
+            cdbi_strerror (connection, errbuf, sizeof (errbuf)));
       }
       break;
     } /* }}} */
@@ -640,21 +721,22 @@ static int cdbi_read_database_query (cdbi_database_t *db, /* {{{ */
 #undef BAIL_OUT
 } /* }}} int cdbi_read_database_query */
 
-static int cdbi_connect_database (cdbi_database_t *db) /* {{{ */
+static int cdbi_connect_database (cdbi_database_t *db, /* {{{ */
+    dbi_conn *ret_connection)
 {
   dbi_driver driver;
   dbi_conn connection;
   size_t i;
   int status;
 
-  if (db->connection != NULL)
+  if (*ret_connection != NULL)
   {
-    status = dbi_conn_ping (db->connection);
+    status = dbi_conn_ping (*ret_connection);
     if (status != 0) /* connection is alive */
       return (0);
 
-    dbi_conn_close (db->connection);
-    db->connection = NULL;
+    dbi_conn_close (*ret_connection);
+    *ret_connection = NULL;
   }
 
   driver = dbi_driver_open (db->driver);
@@ -747,28 +829,29 @@ static int cdbi_connect_database (cdbi_database_t *db) /* {{{ */
     }
   }
 
-  db->connection = connection;
+  *ret_connection = connection;
   return (0);
 } /* }}} int cdbi_connect_database */
 
-static int cdbi_read_database (cdbi_database_t *db) /* {{{ */
+static int cdbi_read_database (cdbi_connection_t *c) /* {{{ */
 {
+  cdbi_database_t *db = c->db;
   size_t i;
   int success;
   int status;
 
   unsigned int db_version;
 
-  status = cdbi_connect_database (db);
+  status = cdbi_connect_database (db, &c->connection);
   if (status != 0)
     return (status);
-  assert (db->connection != NULL);
+  assert (c->connection != NULL);
 
-  db_version = dbi_conn_get_engine_version (db->connection);
+  db_version = dbi_conn_get_engine_version (c->connection);
   /* TODO: Complain if `db_version == 0' */
 
   success = 0;
-  for (i = 0; i < db->queries_num; i++)
+  for (i = c->index; i < db->queries_num; i += (size_t) db->connections_num)
   {
     /* Check if we know the database's version and if so, if this query applies
      * to that version. */
@@ -776,7 +859,7 @@ static int cdbi_read_database (cdbi_database_t *db) /* {{{ */
         && (udb_query_check_version (db->queries[i], db_version) == 0))
       continue;
 
-    status = cdbi_read_database_query (db,
+    status = cdbi_read_database_query (db, c->connection,
         db->queries[i], db->q_prep_areas[i]);
     if (status == 0)
       success++;
@@ -791,41 +874,37 @@ static int cdbi_read_database (cdbi_database_t *db) /* {{{ */
   return (0);
 } /* }}} int cdbi_read_database */
 
-static int cdbi_read (void) /* {{{ */
+static int cdbi_read (user_data_t *ud) /* {{{ */
 {
-  size_t i;
-  int success = 0;
-  int status;
-
-  for (i = 0; i < databases_num; i++)
-  {
-    status = cdbi_read_database (databases[i]);
-    if (status == 0)
-      success++;
-  }
-
-  if (success == 0)
+  if ((ud == NULL) || (ud->data == NULL))
   {
-    ERROR ("dbi plugin: No database could be read. Will return an error so "
-        "the plugin will be delayed.");
+    ERROR ("dbi plugin: cdbi_read: Invalid user data.");
     return (-1);
   }
 
-  return (0);
+  return (cdbi_read_database (ud->data));
 } /* }}} int cdbi_read */
 
 static int cdbi_shutdown (void) /* {{{ */
 {
   size_t i;
+  int j;
+
+  plugin_unregister_read_group ("dbi");
 
   for (i = 0; i < databases_num; i++)
   {
-    if (databases[i]->connection != NULL)
+    cdbi_database_t *db = databases[i];
+
+    for (j = 0; j < db->connections_num; j++)
     {
-      dbi_conn_close (databases[i]->connection);
-      databases[i]->connection = NULL;
+      if (db->connections[j].connection != NULL)
+      {
+        dbi_conn_close (db->connections[j].connection);
+        db->connections[j].connection = NULL;
+      }
     }
-    cdbi_database_free (databases[i]);
+    cdbi_database_free (db);
   }
   sfree (databases);
   databases_num = 0;
@@ -841,7 +920,6 @@ void module_register (void) /* {{{ */
 {
   plugin_register_complex_config ("dbi", cdbi_config);
   plugin_register_init ("dbi", cdbi_init);
-  plugin_register_read ("dbi", cdbi_read);
   plugin_register_shutdown ("dbi", cdbi_shutdown);
 } /* }}} void module_register */
 
@@ -28,6 +28,11 @@
 #include "utils_mount.h"
 #include "utils_ignorelist.h"
 
+#include <pthread.h>
+#if KERNEL_LINUX
+# include <poll.h>
+#endif
+
 #if HAVE_STATVFS
 # if HAVE_SYS_STATVFS_H
 #  include <sys/statvfs.h>
@@ -65,6 +70,62 @@ static ignorelist_t *il_fstype = NULL;
 static _Bool by_device = 0;
 static _Bool report_inodes = 0;
 
+#if HAVE_STATVFS
+typedef struct statvfs df_statbuf_t;
+#elif HAVE_STATFS
+typedef struct statfs df_statbuf_t;
+#endif
+
+/* One STATANYFS call, done by a worker thread. A job which doesn't finish in
+ * time is abandoned by the read callback and freed by its worker, if the
+ * call ever returns. */
+typedef struct df_job_s
+{
+	char *dir;
+	int status;
+	int error;
+	df_statbuf_t statbuf;
+
+	_Bool done;
+	_Bool abandoned;
+	struct df_job_s *next;
+} df_job_t;
+
+/* The mount list is kept between reads, together with what was decided
+ * about each file system. It's only read again when it has changed. */
+typedef struct df_mount_s
+{
+	cu_mount_t *mnt;
+	_Bool ignored;
+	char disk_name[256];
+	df_job_t *job;
+} df_mount_t;
+
+static cu_mount_t *df_mnt_list = NULL;
+static df_mount_t *df_mounts = NULL;
+static size_t df_mounts_num = 0;
+static _Bool df_mounts_valid = 0;
+#if KERNEL_LINUX
+/* Polling /proc/self/mountinfo reports changes of the mount table. */
+static int df_mountinfo_fd = -1;
+#endif
+
+/* The workers calling STATANYFS. A worker stuck on a hung file system, NFS
+ * for example, is replaced, so that the others are still read. */
+#define DF_THREADS 4
+#define DF_THREADS_MAX 64
+
+static pthread_mutex_t df_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t df_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t df_done_cond = PTHREAD_COND_INITIALIZER;
+static df_job_t *df_queue_head = NULL;
+static df_job_t *df_queue_tail = NULL;
+/* Abandoned jobs still running. Their file systems are skipped. */
+static df_job_t *df_hung = NULL;
+static int df_hung_num = 0;
+static int df_threads_num = 0;
+static _Bool df_shutdown_flag = 0;
+
 static int df_init (void)
 {
 	if (il_device == NULL)
@@ -161,31 +222,177 @@ static void df_submit_one (char *plugin_instance,
 	plugin_dispatch_values (&vl);
 } /* void df_submit_one */
 
-static int df_read (void)
+static void *df_worker (void __attribute__((unused)) *arg)
 {
-#if HAVE_STATVFS
-	struct statvfs statbuf;
-#elif HAVE_STATFS
-	struct statfs statbuf;
+	pthread_mutex_lock (&df_lock);
+	while (42)
+	{
+		df_job_t *job;
+
+		while ((df_queue_head == NULL) && !df_shutdown_flag)
+			pthread_cond_wait (&df_queue_cond, &df_lock);
+		if (df_shutdown_flag)
+			break;
+
+		job = df_queue_head;
+		df_queue_head = job->next;
+		if (df_queue_head == NULL)
+			df_queue_tail = NULL;
+		job->next = NULL;
+		pthread_mutex_unlock (&df_lock);
+
+		job->status = STATANYFS (job->dir, &job->statbuf);
+		job->error = (job->status != 0) ? errno : 0;
+
+		pthread_mutex_lock (&df_lock);
+		job->done = 1;
+		if (job->abandoned)
+		{
+			df_job_t *prev = NULL;
+			df_job_t *ptr;
+
+			for (ptr = df_hung; ptr != NULL; prev = ptr, ptr = ptr->next)
+				if (ptr == job)
+					break;
+			if (ptr != NULL)
+			{
+				if (prev == NULL)
+					df_hung = job->next;
+				else
+					prev->next = job->next;
+			}
+			df_hung_num--;
+
+			INFO ("df plugin: "STATANYFS_STR"(%s) returned after all.",
+					job->dir);
+			sfree (job->dir);
+			sfree (job);
+		}
+		else
+		{
+			pthread_cond_broadcast (&df_done_cond);
+		}
+
+		/* Workers replacing hung ones aren't needed anymore. */
+		if (df_threads_num > DF_THREADS + df_hung_num)
+			break;
+	}
+	df_threads_num--;
+	pthread_mutex_unlock (&df_lock);
+
+	return (NULL);
+} /* void *df_worker */
+
+/* Starts workers until there are DF_THREADS which aren't hung. Called with
+ * `df_lock' held. */
+static void df_workers_start (void)
+{
+	while ((df_threads_num < DF_THREADS + df_hung_num)
+			&& (df_threads_num < DF_THREADS_MAX))
+	{
+		pthread_t thread;
+		pthread_attr_t attr;
+		int status;
+
+		pthread_attr_init (&attr);
+		pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+		status = pthread_create (&thread, &attr, df_worker, NULL);
+		pthread_attr_destroy (&attr);
+		if (status != 0)
+		{
+			ERROR ("df plugin: pthread_create failed with status %i.",
+					status);
+			break;
+		}
+		df_threads_num++;
+	}
+} /* void df_workers_start */
+
+/* Returns true if the file system is being waited for since an earlier
+ * read. Called with `df_lock' held. */
+static _Bool df_is_hung (const char *dir)
+{
+	df_job_t *job;
+
+	for (job = df_hung; job != NULL; job = job->next)
+		if (strcmp (job->dir, dir) == 0)
+			return (1);
+
+	return (0);
+} /* _Bool df_is_hung */
+
+#if KERNEL_LINUX
+/* Returns true if the mount table may have changed since the last call. */
+static _Bool df_mounts_changed (void)
+{
+	struct pollfd pfd;
+
+	if (df_mountinfo_fd < 0)
+	{
+		df_mountinfo_fd = open ("/proc/self/mountinfo", O_RDONLY);
+		if (df_mountinfo_fd < 0)
+			return (1);
+		fcntl (df_mountinfo_fd, F_SETFD, FD_CLOEXEC);
+		return (1);
+	}
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = df_mountinfo_fd;
+	pfd.events = POLLPRI;
+
+	/* Reports POLLERR | POLLPRI once per change. */
+	if (poll (&pfd, 1, /* timeout = */ 0) != 0)
+		return (1);
+
+	return (0);
+} /* _Bool df_mounts_changed */
 #endif
-	/* struct STATANYFS statbuf; */
-	cu_mount_t *mnt_list;
+
+static void df_mounts_free (void)
+{
+	cu_mount_freelist (df_mnt_list);
+	df_mnt_list = NULL;
+	sfree (df_mounts);
+	df_mounts_num = 0;
+	df_mounts_valid = 0;
+} /* void df_mounts_free */
+
+/* Reads the mount list and decides which file systems are reported under
+ * which name. */
+static int df_mounts_refresh (void)
+{
 	cu_mount_t *mnt_ptr;
+	size_t num = 0;
+	size_t i;
 
-	mnt_list = NULL;
-	if (cu_mount_getlist (&mnt_list) == NULL)
+	df_mounts_free ();
+
+	if (cu_mount_getlist (&df_mnt_list) == NULL)
 	{
 		ERROR ("df plugin: cu_mount_getlist failed.");
 		return (-1);
 	}
 
-	for (mnt_ptr = mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+	for (mnt_ptr = df_mnt_list; mnt_ptr != NULL; mnt_ptr = mnt_ptr->next)
+		num++;
+
+	df_mounts = calloc (num, sizeof (*df_mounts));
+	if (df_mounts == NULL)
+	{
+		ERROR ("df plugin: calloc failed.");
+		df_mounts_free ();
+		return (-1);
+	}
+
+	for (i = 0, mnt_ptr = df_mnt_list; mnt_ptr != NULL;
+			i++, mnt_ptr = mnt_ptr->next)
 	{
-		unsigned long long blocksize;
-		char disk_name[256];
-		uint64_t blk_free;
-		uint64_t blk_reserved;
-		uint64_t blk_used;
+		df_mount_t *m = df_mounts + i;
+		char *disk_name = m->disk_name;
+		size_t disk_name_size = sizeof (m->disk_name);
+
+		m->mnt = mnt_ptr;
+		m->ignored = 1;
 
 		if (ignorelist_match (il_device,
 					(mnt_ptr->spec_device != NULL)
@@ -197,26 +404,13 @@ static int df_read (void)
 		if (ignorelist_match (il_fstype, mnt_ptr->type))
 			continue;
 
-		if (STATANYFS (mnt_ptr->dir, &statbuf) < 0)
-		{
-			char errbuf[1024];
-			ERROR (STATANYFS_STR"(%s) failed: %s",
-					mnt_ptr->dir,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			continue;
-		}
-
-		if (!statbuf.f_blocks)
-			continue;
-
 		if (by_device) 
 		{
 			/* eg, /dev/hda1  -- strip off the "/dev/" */
 			if (strncmp (mnt_ptr->spec_device, "/dev/", strlen ("/dev/")) == 0)
-				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), sizeof (disk_name));
+				sstrncpy (disk_name, mnt_ptr->spec_device + strlen ("/dev/"), disk_name_size);
 			else
-				sstrncpy (disk_name, mnt_ptr->spec_device, sizeof (disk_name));
+				sstrncpy (disk_name, mnt_ptr->spec_device, disk_name_size);
 
 			if (strlen(disk_name) < 1) 
 			{
@@ -228,90 +422,285 @@ static int df_read (void)
 		{
 			if (strcmp (mnt_ptr->dir, "/") == 0)
 			{
-				sstrncpy (disk_name, "root", sizeof (disk_name));
+				sstrncpy (disk_name, "root", disk_name_size);
 			}
 			else
 			{
-				int i, len;
+				int j, len;
 
-				sstrncpy (disk_name, mnt_ptr->dir + 1, sizeof (disk_name));
+				sstrncpy (disk_name, mnt_ptr->dir + 1, disk_name_size);
 				len = strlen (disk_name);
 
-				for (i = 0; i < len; i++)
-					if (disk_name[i] == '/')
-						disk_name[i] = '-';
+				for (j = 0; j < len; j++)
+					if (disk_name[j] == '/')
+						disk_name[j] = '-';
 			}
 		}
 
-		blocksize = BLOCKSIZE(statbuf);
+		m->ignored = 0;
+	}
+
+	df_mounts_num = num;
+	df_mounts_valid = 1;
+	return (0);
+} /* int df_mounts_refresh */
 
-		/*
-		 * Sanity-check for the values in the struct
-		 */
-		/* Check for negative "available" byes. For example UFS can
-		 * report negative free space for user. Notice. blk_reserved
-		 * will start to diminish after this. */
+static void df_submit_mount (const df_mount_t *m, df_statbuf_t *statbuf)
+{
+	char disk_name[256];
+	unsigned long long blocksize;
+	uint64_t blk_free;
+	uint64_t blk_reserved;
+	uint64_t blk_used;
+
+	if (!statbuf->f_blocks)
+		return;
+
+	sstrncpy (disk_name, m->disk_name, sizeof (disk_name));
+
+	blocksize = BLOCKSIZE(*statbuf);
+
+	/*
+	 * Sanity-check for the values in the struct
+	 */
+	/* Check for negative "available" byes. For example UFS can
+	 * report negative free space for user. Notice. blk_reserved
+	 * will start to diminish after this. */
 #if HAVE_STATVFS
-		/* Cast is needed to avoid compiler warnings.
-		 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
-		if (((int64_t) statbuf.f_bavail) < 0)
-			statbuf.f_bavail = 0;
+	/* Cast is needed to avoid compiler warnings.
+	 * ((struct statvfs).f_bavail is unsigned (POSIX)) */
+	if (((int64_t) statbuf->f_bavail) < 0)
+		statbuf->f_bavail = 0;
 #elif HAVE_STATFS
-		if (statbuf.f_bavail < 0)
-			statbuf.f_bavail = 0;
+	if (statbuf->f_bavail < 0)
+		statbuf->f_bavail = 0;
+#endif
+	/* Make sure that f_blocks >= f_bfree >= f_bavail */
+	if (statbuf->f_bfree < statbuf->f_bavail)
+		statbuf->f_bfree = statbuf->f_bavail;
+	if (statbuf->f_blocks < statbuf->f_bfree)
+		statbuf->f_blocks = statbuf->f_bfree;
+
+	blk_free     = (uint64_t) statbuf->f_bavail;
+	blk_reserved = (uint64_t) (statbuf->f_bfree - statbuf->f_bavail);
+	blk_used     = (uint64_t) (statbuf->f_blocks - statbuf->f_bfree);
+
+	df_submit_one (disk_name, "df_complex", "free",
+			(gauge_t) (blk_free * blocksize));
+	df_submit_one (disk_name, "df_complex", "reserved",
+			(gauge_t) (blk_reserved * blocksize));
+	df_submit_one (disk_name, "df_complex", "used",
+			(gauge_t) (blk_used * blocksize));
+
+	/* inode handling */
+	if (report_inodes)
+	{
+		uint64_t inode_free;
+		uint64_t inode_reserved;
+		uint64_t inode_used;
+
+		/* Sanity-check for the values in the struct */
+		if (statbuf->f_ffree < statbuf->f_favail)
+			statbuf->f_ffree = statbuf->f_favail;
+		if (statbuf->f_files < statbuf->f_ffree)
+			statbuf->f_files = statbuf->f_ffree;
+
+		inode_free = (uint64_t) statbuf->f_favail;
+		inode_reserved = (uint64_t) (statbuf->f_ffree - statbuf->f_favail);
+		inode_used = (uint64_t) (statbuf->f_files - statbuf->f_ffree);
+		
+		df_submit_one (disk_name, "df_inodes", "free",
+				(gauge_t) inode_free);
+		df_submit_one (disk_name, "df_inodes", "reserved",
+				(gauge_t) inode_reserved);
+		df_submit_one (disk_name, "df_inodes", "used",
+				(gauge_t) inode_used);
+	}
+} /* void df_submit_mount */
+
+static int df_read (void)
+{
+	struct timespec deadline;
+	size_t jobs_num = 0;
+	size_t jobs_done = 0;
+	size_t i;
+
+#if KERNEL_LINUX
+	if (df_mounts_changed ())
+		df_mounts_valid = 0;
+#else
+	df_mounts_valid = 0;
 #endif
-		/* Make sure that f_blocks >= f_bfree >= f_bavail */
-		if (statbuf.f_bfree < statbuf.f_bavail)
-			statbuf.f_bfree = statbuf.f_bavail;
-		if (statbuf.f_blocks < statbuf.f_bfree)
-			statbuf.f_blocks = statbuf.f_bfree;
-
-		blk_free     = (uint64_t) statbuf.f_bavail;
-		blk_reserved = (uint64_t) (statbuf.f_bfree - statbuf.f_bavail);
-		blk_used     = (uint64_t) (statbuf.f_blocks - statbuf.f_bfree);
-
-		df_submit_one (disk_name, "df_complex", "free",
-				(gauge_t) (blk_free * blocksize));
-		df_submit_one (disk_name, "df_complex", "reserved",
-				(gauge_t) (blk_reserved * blocksize));
-		df_submit_one (disk_name, "df_complex", "used",
-				(gauge_t) (blk_used * blocksize));
-
-		/* inode handling */
-		if (report_inodes)
+
+	if (!df_mounts_valid && (df_mounts_refresh () != 0))
+		return (-1);
+
+	pthread_mutex_lock (&df_lock);
+
+	df_workers_start ();
+
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts + i;
+		df_job_t *job;
+
+		m->job = NULL;
+		if (m->ignored)
+			continue;
+
+		if (df_is_hung (m->mnt->dir))
 		{
-			uint64_t inode_free;
-			uint64_t inode_reserved;
-			uint64_t inode_used;
-
-			/* Sanity-check for the values in the struct */
-			if (statbuf.f_ffree < statbuf.f_favail)
-				statbuf.f_ffree = statbuf.f_favail;
-			if (statbuf.f_files < statbuf.f_ffree)
-				statbuf.f_files = statbuf.f_ffree;
-
-			inode_free = (uint64_t) statbuf.f_favail;
-			inode_reserved = (uint64_t) (statbuf.f_ffree - statbuf.f_favail);
-			inode_used = (uint64_t) (statbuf.f_files - statbuf.f_ffree);
-			
-			df_submit_one (disk_name, "df_inodes", "free",
-					(gauge_t) inode_free);
-			df_submit_one (disk_name, "df_inodes", "reserved",
-					(gauge_t) inode_reserved);
-			df_submit_one (disk_name, "df_inodes", "used",
-					(gauge_t) inode_used);
+			DEBUG ("df plugin: Still waiting for "STATANYFS_STR"(%s).",
+					m->mnt->dir);
+			continue;
 		}
+
+		job = calloc (1, sizeof (*job));
+		if (job != NULL)
+			job->dir = strdup (m->mnt->dir);
+		if ((job == NULL) || (job->dir == NULL))
+		{
+			ERROR ("df plugin: calloc failed.");
+			sfree (job);
+			continue;
+		}
+
+		if (df_queue_tail == NULL)
+			df_queue_head = job;
+		else
+			df_queue_tail->next = job;
+		df_queue_tail = job;
+
+		m->job = job;
+		jobs_num++;
 	}
+	pthread_cond_broadcast (&df_queue_cond);
+
+	/* Give the file systems half an interval. */
+	CDTIME_T_TO_TIMESPEC (cdtime () + interval_g / 2, &deadline);
+	while (42)
+	{
+		jobs_done = 0;
+		for (i = 0; i < df_mounts_num; i++)
+			if ((df_mounts[i].job != NULL) && df_mounts[i].job->done)
+				jobs_done++;
 
-	cu_mount_freelist (mnt_list);
+		if ((jobs_done >= jobs_num) || (df_threads_num == 0))
+			break;
+
+		if (pthread_cond_timedwait (&df_done_cond, &df_lock,
+					&deadline) == ETIMEDOUT)
+			break;
+	}
+
+	/* Jobs which aren't done by now are left behind: still queued ones
+	 * are dropped, running ones are freed by their worker. */
+	for (i = 0; (jobs_done < jobs_num) && (i < df_mounts_num); i++)
+	{
+		df_mount_t *m = df_mounts + i;
+		df_job_t *prev = NULL;
+		df_job_t *ptr;
+
+		if ((m->job == NULL) || m->job->done)
+			continue;
+
+		for (ptr = df_queue_head; ptr != NULL; prev = ptr, ptr = ptr->next)
+			if (ptr == m->job)
+				break;
+
+		if (ptr != NULL)
+		{
+			if (prev == NULL)
+				df_queue_head = ptr->next;
+			if (prev != NULL)
+				prev->next = ptr->next;
+			if (df_queue_tail == ptr)
+				df_queue_tail = prev;
+
+			sfree (ptr->dir);
+			sfree (ptr);
+		}
+		else
+		{
+			WARNING ("df plugin: "STATANYFS_STR"(%s) didn't return in "
+					"time. Skipping it until it does.",
+					m->mnt->dir);
+			m->job->abandoned = 1;
+			m->job->next = df_hung;
+			df_hung = m->job;
+			df_hung_num++;
+		}
+		m->job = NULL;
+	}
+
+	/* Replace the hung workers for the next read. */
+	df_workers_start ();
+
+	pthread_mutex_unlock (&df_lock);
+
+	/* The remaining jobs are done and only accessed by this thread. */
+	for (i = 0; i < df_mounts_num; i++)
+	{
+		df_mount_t *m = df_mounts + i;
+		df_job_t *job = m->job;
+
+		if (job == NULL)
+			continue;
+		m->job = NULL;
+
+		if (job->status < 0)
+		{
+			char errbuf[1024];
+			ERROR (STATANYFS_STR"(%s) failed: %s",
+					job->dir,
+					sstrerror (job->error, errbuf,
+						sizeof (errbuf)));
+		}
+		else
+		{
+			df_submit_mount (m, &job->statbuf);
+		}
+
+		sfree (job->dir);
+		sfree (job);
+	}
 
 	return (0);
 } /* int df_read */
 
+static int df_shutdown (void)
+{
+	pthread_mutex_lock (&df_lock);
+	df_shutdown_flag = 1;
+	pthread_cond_broadcast (&df_queue_cond);
+	while (df_queue_head != NULL)
+	{
+		df_job_t *next = df_queue_head->next;
+		sfree (df_queue_head->dir);
+		sfree (df_queue_head);
+		df_queue_head = next;
+	}
+	df_queue_tail = NULL;
+	/* Hung workers are left alone: they free their jobs themselves. */
+	pthread_mutex_unlock (&df_lock);
+
+	df_mounts_free ();
+#if KERNEL_LINUX
+	if (df_mountinfo_fd >= 0)
+	{
+		close (df_mountinfo_fd);
+		df_mountinfo_fd = -1;
+	}
+#endif
+
+	return (0);
+} /* int df_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("df", df_config,
 			config_keys, config_keys_num);
 	plugin_register_init ("df", df_init);
 	plugin_register_read ("df", df_read);
+	plugin_register_shutdown ("df", df_shutdown);
 } /* void module_register */
@@ -25,6 +25,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if HAVE_MACH_MACH_TYPES_H
 #  include <mach/mach_types.h>
@@ -103,6 +104,10 @@ typedef struct diskstats
 } diskstats_t;
 
 static diskstats_t *disklist;
+
+static procfs_file_t *proc_diskstats = NULL;
+/* One if /proc/partitions is read instead. */
+static int proc_fieldshift = 0;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -137,9 +142,12 @@ static ignorelist_t *ignorelist = NULL;
 static int disk_config (const char *key, const char *value)
 {
   if (ignorelist == NULL)
+  {
     ignorelist = ignorelist_create (/* invert = */ 1);
-  if (ignorelist == NULL)
-    return (1);
+    if (ignorelist == NULL)
+      return (1);
+    ignorelist_set_cache (ignorelist, 1024);
+  }
 
   if (strcasecmp ("Disk", key) == 0)
   {
@@ -419,8 +427,8 @@ static int disk_read (void)
 /* #endif HAVE_IOKIT_IOKITLIB_H */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
+	char *line;
 	
 	char *fields[32];
 	int numfields;
@@ -441,24 +449,36 @@ static int disk_read (void)
 
 	diskstats_t *ds, *pre_ds;
 
-	if ((fh = fopen ("/proc/diskstats", "r")) == NULL)
+	if (proc_diskstats == NULL)
 	{
-		fh = fopen ("/proc/partitions", "r");
-		if (fh == NULL)
+		if (access ("/proc/diskstats", R_OK) == 0)
 		{
-			ERROR ("disk plugin: fopen (/proc/{diskstats,partitions}) failed.");
-			return (-1);
+			proc_diskstats = procfs_open ("/proc/diskstats",
+					/* max age = */ 0);
+			proc_fieldshift = 0;
+		}
+		else
+		{
+			/* Kernel is 2.4.* */
+			proc_diskstats = procfs_open ("/proc/partitions",
+					/* max age = */ 0);
+			proc_fieldshift = 1;
 		}
 
-		/* Kernel is 2.4.* */
-		fieldshift = 1;
+		if (proc_diskstats == NULL)
+			return (-1);
 	}
+	fieldshift = proc_fieldshift;
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	buffer = procfs_read (proc_diskstats, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
 	{
 		char *disk_name;
 
-		numfields = strsplit (buffer, fields, 32);
+		numfields = strsplit (line, fields, 32);
 
 		if ((numfields != (14 + fieldshift)) && (numfields != 7))
 			continue;
@@ -627,9 +647,7 @@ static int disk_read (void)
 			disk_submit (disk_name, "disk_merged",
 					read_merged, write_merged);
 		} /* if (is_disk) */
-	} /* while (fgets (buffer, sizeof (buffer), fh) != NULL) */
-
-	fclose (fh);
+	} /* while (procfs_next_line (&buffer) != NULL) */
 /* #endif defined(KERNEL_LINUX) */
 
 #elif HAVE_LIBKSTAT
@@ -753,10 +771,23 @@ static int disk_read (void)
 	return (0);
 } /* int disk_read */
 
+#if KERNEL_LINUX
+static int disk_shutdown (void)
+{
+	procfs_close (proc_diskstats);
+	proc_diskstats = NULL;
+
+	return (0);
+} /* int disk_shutdown */
+#endif
+
 void module_register (void)
 {
   plugin_register_config ("disk", disk_config,
       config_keys, config_keys_num);
   plugin_register_init ("disk", disk_init);
   plugin_register_read ("disk", disk_read);
+#if KERNEL_LINUX
+  plugin_register_shutdown ("disk", disk_shutdown);
+#endif
 } /* void module_register */
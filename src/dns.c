@@ -35,16 +35,47 @@
 #include <pcap.h>
 #include <pcap-bpf.h>
 
+#if KERNEL_LINUX && HAVE_LINUX_IF_PACKET_H
+# include <sys/mman.h>
+# include <arpa/inet.h>
+# include <net/if.h>
+# include <linux/if_packet.h>
+# include <linux/if_ether.h>
+# include <linux/filter.h>
+# if defined(TPACKET3_HDRLEN) && defined(PACKET_FANOUT)
+#  define DNS_HAVE_PACKET_MMAP 1
+# endif
+#endif
+#ifndef DNS_HAVE_PACKET_MMAP
+# define DNS_HAVE_PACKET_MMAP 0
+#endif
+
 /*
  * Private data types
  */
-struct counter_list_s
+#define RC_MAX 16
+
+/* Every capture thread counts into its own counters, so that the threads
+ * don't contend with each other. The lock is only shared with `dns_read'. */
+struct dns_counters_s
+{
+	pthread_mutex_t lock;
+	derive_t queries;
+	derive_t responses;
+	derive_t qtype[T_MAX];
+	derive_t opcode[OP_MAX];
+	derive_t rcode[RC_MAX];
+};
+typedef struct dns_counters_s dns_counters_t;
+
+struct dns_thread_s
 {
-	unsigned int key;
-	unsigned int value;
-	struct counter_list_s *next;
+	pthread_t thread;
+	_Bool running;
+	int index;
+	dns_counters_t counters;
 };
-typedef struct counter_list_s counter_list_t;
+typedef struct dns_thread_s dns_thread_t;
 
 /*
  * Private variables
@@ -53,90 +84,41 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSource",
-	"SelectNumericQueryTypes"
+	"SelectNumericQueryTypes",
+	"PacketMmap",
+	"CaptureThreads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 static int select_numeric_qtype = 1;
+static _Bool use_packet_mmap = 0;
+static int capture_threads = 1;
 
 #define PCAP_SNAPLEN 1460
 static char   *pcap_device = NULL;
 
-static derive_t       tr_queries;
-static derive_t       tr_responses;
-static counter_list_t *qtype_list;
-static counter_list_t *opcode_list;
-static counter_list_t *rcode_list;
-
-static pthread_t       listen_thread;
-static int             listen_thread_init = 0;
-/* The `traffic' mutex if for `tr_queries' and `tr_responses' */
-static pthread_mutex_t traffic_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t qtype_mutex   = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t opcode_mutex  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t rcode_mutex   = PTHREAD_MUTEX_INITIALIZER;
+#if DNS_HAVE_PACKET_MMAP
+/* The ring of every capture thread has DNS_RING_BLOCK_NUM blocks. The kernel
+ * hands a block to the thread once it is full or DNS_RING_BLOCK_TIMEOUT
+ * milliseconds after its first packet. */
+# define DNS_RING_BLOCK_SIZE (1 << 18)
+# define DNS_RING_BLOCK_NUM 64
+# define DNS_RING_FRAME_SIZE 2048
+# define DNS_RING_BLOCK_TIMEOUT 50
+# define DNS_POLL_TIMEOUT 200
+#endif
+
+#if DNS_HAVE_PACKET_MMAP
+static int             lo_ifindex = 0;
+#endif
+
+static dns_thread_t   *threads = NULL;
+static int             threads_num = 0;
+static dns_counters_t *counters_sum = NULL;
+static volatile _Bool  listen_shutdown = 0;
 
 /*
  * Private functions
  */
-static counter_list_t *counter_list_search (counter_list_t **list, unsigned int key)
-{
-	counter_list_t *entry;
-
-	for (entry = *list; entry != NULL; entry = entry->next)
-		if (entry->key == key)
-			break;
-
-	return (entry);
-}
-
-static counter_list_t *counter_list_create (counter_list_t **list,
-		unsigned int key, unsigned int value)
-{
-	counter_list_t *entry;
-
-	entry = (counter_list_t *) malloc (sizeof (counter_list_t));
-	if (entry == NULL)
-		return (NULL);
-
-	memset (entry, 0, sizeof (counter_list_t));
-	entry->key = key;
-	entry->value = value;
-
-	if (*list == NULL)
-	{
-		*list = entry;
-	}
-	else
-	{
-		counter_list_t *last;
-
-		last = *list;
-		while (last->next != NULL)
-			last = last->next;
-
-		last->next = entry;
-	}
-
-	return (entry);
-}
-
-static void counter_list_add (counter_list_t **list,
-		unsigned int key, unsigned int increment)
-{
-	counter_list_t *entry;
-
-	entry = counter_list_search (list, key);
-
-	if (entry != NULL)
-	{
-		entry->value += increment;
-	}
-	else
-	{
-		counter_list_create (list, key, increment);
-	}
-}
-
 static int dns_config (const char *key, const char *value)
 {
 	if (strcasecmp (key, "Interface") == 0)
@@ -158,6 +140,24 @@ static int dns_config (const char *key, const char *value)
 		else
 			select_numeric_qtype = 1;
 	}
+	else if (strcasecmp (key, "PacketMmap") == 0)
+	{
+		if ((value != NULL) && IS_TRUE (value))
+			use_packet_mmap = 1;
+		else
+			use_packet_mmap = 0;
+	}
+	else if (strcasecmp (key, "CaptureThreads") == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			WARNING ("dns plugin: `CaptureThreads' must be at "
+					"least one.");
+			return (1);
+		}
+		capture_threads = tmp;
+	}
 	else
 	{
 		return (-1);
@@ -166,62 +166,49 @@ static int dns_config (const char *key, const char *value)
 	return (0);
 }
 
-static void dns_child_callback (const rfc1035_header_t *dns)
+static void dns_child_callback (const rfc1035_header_t *dns, void *user_data)
 {
+	dns_counters_t *c = user_data;
+
+	pthread_mutex_lock (&c->lock);
+
 	if (dns->qr == 0)
 	{
 		/* This is a query */
-		int skip = 0;
-		if (!select_numeric_qtype)
-		{
-			const char *str = qtype_str(dns->qtype);
-			if ((str == NULL) || (str[0] == '#'))
-				skip = 1;
-		}
-
-		pthread_mutex_lock (&traffic_mutex);
-		tr_queries += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
-
-		if (skip == 0)
-		{
-			pthread_mutex_lock (&qtype_mutex);
-			counter_list_add (&qtype_list, dns->qtype,  1);
-			pthread_mutex_unlock (&qtype_mutex);
-		}
+		c->queries += dns->length;
+		c->qtype[dns->qtype]++;
 	}
 	else
 	{
 		/* This is a reply */
-		pthread_mutex_lock (&traffic_mutex);
-		tr_responses += dns->length;
-		pthread_mutex_unlock (&traffic_mutex);
-
-		pthread_mutex_lock (&rcode_mutex);
-		counter_list_add (&rcode_list,  dns->rcode,  1);
-		pthread_mutex_unlock (&rcode_mutex);
+		c->responses += dns->length;
+		c->rcode[dns->rcode]++;
 	}
 
 	/* FIXME: Are queries, replies or both interesting? */
-	pthread_mutex_lock (&opcode_mutex);
-	counter_list_add (&opcode_list, dns->opcode, 1);
-	pthread_mutex_unlock (&opcode_mutex);
+	c->opcode[dns->opcode]++;
+
+	pthread_mutex_unlock (&c->lock);
+}
+
+static void dns_child_init (void)
+{
+	/* Don't block any signals */
+	sigset_t sigmask;
+	sigemptyset (&sigmask);
+	pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
 }
 
-static void *dns_child_loop (__attribute__((unused)) void *dummy)
+static void *dns_child_loop (void *arg)
 {
+	dns_thread_t *t = arg;
 	pcap_t *pcap_obj;
 	char    pcap_error[PCAP_ERRBUF_SIZE];
 	struct  bpf_program fp;
 
 	int status;
 
-	/* Don't block any signals */
-	{
-		sigset_t sigmask;
-		sigemptyset (&sigmask);
-		pthread_sigmask (SIG_SETMASK, &sigmask, NULL);
-	}
+	dns_child_init ();
 
 	/* Passing `pcap_device == NULL' is okay and the same as passign "any" */
 	DEBUG ("dns plugin: Creating PCAP object..");
@@ -243,60 +230,315 @@ static void *dns_child_loop (__attribute__((unused)) void *dummy)
 	if (pcap_compile (pcap_obj, &fp, "udp port 53", 1, 0) < 0)
 	{
 		ERROR ("dns plugin: pcap_compile failed");
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
 	if (pcap_setfilter (pcap_obj, &fp) < 0)
 	{
 		ERROR ("dns plugin: pcap_setfilter failed");
+		pcap_freecode (&fp);
+		pcap_close (pcap_obj);
 		return (NULL);
 	}
+	pcap_freecode (&fp);
 
 	DEBUG ("dns plugin: PCAP object created.");
 
 	dnstop_set_pcap_obj (pcap_obj);
-	dnstop_set_callback (dns_child_callback);
 
-	status = pcap_loop (pcap_obj,
-			-1 /* loop forever */,
-			handle_pcap /* callback */,
-			NULL /* Whatever this means.. */);
-	if (status < 0)
-		ERROR ("dns plugin: Listener thread is exiting "
-				"abnormally: %s", pcap_geterr (pcap_obj));
+	/* The read timeout makes `pcap_dispatch' return regularly, so that
+	 * the shutdown flag is noticed. */
+	while (!listen_shutdown)
+	{
+		status = pcap_dispatch (pcap_obj,
+				-1 /* all packets of the buffer */,
+				handle_pcap /* callback */,
+				(u_char *) &t->counters);
+		if (status < 0)
+		{
+			ERROR ("dns plugin: Listener thread is exiting "
+					"abnormally: %s", pcap_geterr (pcap_obj));
+			break;
+		}
+	}
 
 	DEBUG ("dns plugin: Child is exiting.");
 
 	pcap_close (pcap_obj);
-	listen_thread_init = 0;
-	pthread_exit (NULL);
-
 	return (NULL);
 } /* static void dns_child_loop (void) */
 
-static int dns_init (void)
+#if DNS_HAVE_PACKET_MMAP
+/* Attaches the filter pcap compiles for "udp port 53" to `fd'. The socket
+ * delivers packets starting with the IP header, which is what pcap calls
+ * `DLT_RAW'. */
+static int dns_ring_set_filter (int fd)
 {
-	/* clean up an old thread */
+	pcap_t *pcap_dead;
+	struct bpf_program fp;
+	struct sock_fprog prog;
 	int status;
 
-	pthread_mutex_lock (&traffic_mutex);
-	tr_queries   = 0;
-	tr_responses = 0;
-	pthread_mutex_unlock (&traffic_mutex);
+	pcap_dead = pcap_open_dead (DLT_RAW, PCAP_SNAPLEN);
+	if (pcap_dead == NULL)
+	{
+		ERROR ("dns plugin: pcap_open_dead failed.");
+		return (-1);
+	}
 
-	if (listen_thread_init != 0)
+	memset (&fp, 0, sizeof (fp));
+	if (pcap_compile (pcap_dead, &fp, "udp port 53", 1, 0) < 0)
+	{
+		ERROR ("dns plugin: pcap_compile failed: %s",
+				pcap_geterr (pcap_dead));
+		pcap_close (pcap_dead);
 		return (-1);
+	}
 
-	status = pthread_create (&listen_thread, NULL, dns_child_loop,
-			(void *) 0);
+	/* `struct bpf_insn' and `struct sock_filter' are the same. */
+	memset (&prog, 0, sizeof (prog));
+	prog.len = (unsigned short) fp.bf_len;
+	prog.filter = (struct sock_filter *) fp.bf_insns;
+
+	status = setsockopt (fd, SOL_SOCKET, SO_ATTACH_FILTER,
+			&prog, sizeof (prog));
 	if (status != 0)
 	{
 		char errbuf[1024];
-		ERROR ("dns plugin: pthread_create failed: %s",
+		ERROR ("dns plugin: Attaching the filter failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+	}
+
+	pcap_freecode (&fp);
+	pcap_close (pcap_dead);
+	return (status);
+} /* int dns_ring_set_filter */
+
+/* Opens a packet socket with a TPACKET_V3 receive ring, which is mapped to
+ * `*ret_ring', and adds it to the fanout group of all capture threads. */
+static int dns_ring_open (uint8_t **ret_ring)
+{
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	int version = TPACKET_V3;
+	int fanout;
+	void *ring;
+	int fd;
+
+	/* Protocol zero: no packets are queued before the socket is bound,
+	 * which happens after the filter has been attached. */
+	fd = socket (AF_PACKET, SOCK_DGRAM, 0);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: Opening a packet socket failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (dns_ring_set_filter (fd) != 0)
+	{
+		close (fd);
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.tp_block_size = DNS_RING_BLOCK_SIZE;
+	req.tp_block_nr = DNS_RING_BLOCK_NUM;
+	req.tp_frame_size = DNS_RING_FRAME_SIZE;
+	req.tp_frame_nr = (DNS_RING_BLOCK_SIZE / DNS_RING_FRAME_SIZE)
+		* DNS_RING_BLOCK_NUM;
+	req.tp_retire_blk_tov = DNS_RING_BLOCK_TIMEOUT;
+
+	if ((setsockopt (fd, SOL_PACKET, PACKET_VERSION,
+					&version, sizeof (version)) != 0)
+			|| (setsockopt (fd, SOL_PACKET, PACKET_RX_RING,
+					&req, sizeof (req)) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: Setting up the TPACKET_V3 ring failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
+
+	ring = mmap (NULL, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCK_NUM,
+			PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ring == MAP_FAILED)
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: mmap failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
+
+	lo_ifindex = (int) if_nametoindex ("lo");
+
+	memset (&sll, 0, sizeof (sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons (ETH_P_ALL);
+	if ((pcap_device != NULL) && (strcasecmp ("any", pcap_device) != 0))
+	{
+		sll.sll_ifindex = (int) if_nametoindex (pcap_device);
+		if (sll.sll_ifindex == 0)
+		{
+			ERROR ("dns plugin: Unknown interface `%s'.",
+					pcap_device);
+			munmap (ring, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCK_NUM);
+			close (fd);
+			return (-1);
+		}
+	}
+
+	/* The kernel distributes the packets among the sockets of the group
+	 * by a hash of the flow, so the packets of one flow are counted by
+	 * the same thread. */
+	fanout = (getpid () & 0xffff) | (PACKET_FANOUT_HASH << 16);
+	if ((bind (fd, (struct sockaddr *) &sll, sizeof (sll)) != 0)
+			|| (setsockopt (fd, SOL_PACKET, PACKET_FANOUT,
+					&fanout, sizeof (fanout)) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("dns plugin: Binding the packet socket to `%s' failed: %s",
+				(pcap_device != NULL) ? pcap_device : "any",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
+		munmap (ring, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCK_NUM);
+		close (fd);
 		return (-1);
 	}
 
-	listen_thread_init = 1;
+	*ret_ring = ring;
+	return (fd);
+} /* int dns_ring_open */
+
+/* Handles the packets of a block in place and returns it to the kernel. */
+static void dns_ring_walk_block (dns_thread_t *t,
+		struct tpacket_block_desc *bd)
+{
+	struct tpacket3_hdr *ppd;
+	uint32_t i;
+
+	ppd = (void *) ((uint8_t *) bd + bd->hdr.bh1.offset_to_first_pkt);
+	for (i = 0; i < bd->hdr.bh1.num_pkts; i++)
+	{
+		struct sockaddr_ll *sll = (void *) ((uint8_t *) ppd
+				+ TPACKET_ALIGN (sizeof (*ppd)));
+
+		/* Like pcap, don't count packets sent on the loopback
+		 * interface twice. */
+		if ((sll->sll_pkttype != PACKET_OUTGOING)
+				|| (sll->sll_ifindex != lo_ifindex))
+			handle_ip_packet ((u_char *) ppd + ppd->tp_net,
+					(int) ppd->tp_snaplen, &t->counters);
+
+		ppd = (void *) ((uint8_t *) ppd + ppd->tp_next_offset);
+	}
+
+	__sync_synchronize ();
+	bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+} /* void dns_ring_walk_block */
+
+static void *dns_ring_loop (void *arg)
+{
+	dns_thread_t *t = arg;
+	uint8_t *ring = NULL;
+	unsigned int block = 0;
+	struct pollfd pfd;
+	int fd;
+
+	dns_child_init ();
+
+	fd = dns_ring_open (&ring);
+	if (fd < 0)
+		return (NULL);
+
+	DEBUG ("dns plugin: Capture thread %i is running.", t->index);
+
+	memset (&pfd, 0, sizeof (pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLERR;
+
+	while (!listen_shutdown)
+	{
+		struct tpacket_block_desc *bd;
+
+		bd = (void *) (ring + block * DNS_RING_BLOCK_SIZE);
+		if ((bd->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+		{
+			poll (&pfd, 1, DNS_POLL_TIMEOUT);
+			continue;
+		}
+		__sync_synchronize ();
+
+		dns_ring_walk_block (t, bd);
+		block = (block + 1) % DNS_RING_BLOCK_NUM;
+	}
+
+	DEBUG ("dns plugin: Capture thread %i is exiting.", t->index);
+
+	munmap (ring, DNS_RING_BLOCK_SIZE * DNS_RING_BLOCK_NUM);
+	close (fd);
+	return (NULL);
+} /* void *dns_ring_loop */
+#endif /* DNS_HAVE_PACKET_MMAP */
+
+static int dns_init (void)
+{
+	void *(*loop) (void *) = dns_child_loop;
+	int i;
+
+	if (threads != NULL)
+		return (-1);
+
+	threads_num = 1;
+	if (use_packet_mmap)
+	{
+#if DNS_HAVE_PACKET_MMAP
+		loop = dns_ring_loop;
+		threads_num = capture_threads;
+#else
+		WARNING ("dns plugin: `PacketMmap' is not supported on this "
+				"system. Falling back to libpcap.");
+#endif
+	}
+	else if (capture_threads != 1)
+	{
+		WARNING ("dns plugin: `CaptureThreads' requires `PacketMmap'. "
+				"Using one thread.");
+	}
+
+	threads = calloc ((size_t) threads_num, sizeof (*threads));
+	counters_sum = calloc (1, sizeof (*counters_sum));
+	if ((threads == NULL) || (counters_sum == NULL))
+	{
+		ERROR ("dns plugin: calloc failed.");
+		sfree (threads);
+		sfree (counters_sum);
+		return (-1);
+	}
+
+	dnstop_set_callback (dns_child_callback);
+	listen_shutdown = 0;
+
+	for (i = 0; i < threads_num; i++)
+	{
+		dns_thread_t *t = threads + i;
+		int status;
+
+		t->index = i;
+		pthread_mutex_init (&t->counters.lock, /* attr = */ NULL);
+
+		status = pthread_create (&t->thread, NULL, loop, t);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("dns plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			continue;
+		}
+		t->running = 1;
+	}
 
 	return (0);
 } /* int dns_init */
@@ -336,77 +578,114 @@ static void submit_octets (derive_t queries, derive_t responses)
 	plugin_dispatch_values (&vl);
 } /* void submit_octets */
 
+/* Adds the counters of all threads up in `counters_sum'. */
+static void dns_counters_sum (void)
+{
+	dns_counters_t *sum = counters_sum;
+	int i;
+	int j;
+
+	sum->queries = 0;
+	sum->responses = 0;
+	memset (sum->qtype, 0, sizeof (sum->qtype));
+	memset (sum->opcode, 0, sizeof (sum->opcode));
+	memset (sum->rcode, 0, sizeof (sum->rcode));
+
+	for (i = 0; i < threads_num; i++)
+	{
+		dns_counters_t *c = &threads[i].counters;
+
+		pthread_mutex_lock (&c->lock);
+		sum->queries += c->queries;
+		sum->responses += c->responses;
+		for (j = 0; j < T_MAX; j++)
+			sum->qtype[j] += c->qtype[j];
+		for (j = 0; j < OP_MAX; j++)
+			sum->opcode[j] += c->opcode[j];
+		for (j = 0; j < RC_MAX; j++)
+			sum->rcode[j] += c->rcode[j];
+		pthread_mutex_unlock (&c->lock);
+	}
+} /* void dns_counters_sum */
+
 static int dns_read (void)
 {
-	unsigned int keys[T_MAX];
-	unsigned int values[T_MAX];
-	int len;
+	dns_counters_t *sum = counters_sum;
 	int i;
 
-	counter_list_t *ptr;
+	if (sum == NULL)
+		return (-1);
 
-	pthread_mutex_lock (&traffic_mutex);
-	values[0] = tr_queries;
-	values[1] = tr_responses;
-	pthread_mutex_unlock (&traffic_mutex);
+	dns_counters_sum ();
 
-	if ((values[0] != 0) || (values[1] != 0))
-		submit_octets (values[0], values[1]);
+	if ((sum->queries != 0) || (sum->responses != 0))
+		submit_octets (sum->queries, sum->responses);
 
-	pthread_mutex_lock (&qtype_mutex);
-	for (ptr = qtype_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < T_MAX; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
-	}
-	pthread_mutex_unlock (&qtype_mutex);
+		const char *str;
 
-	for (i = 0; i < len; i++)
-	{
-		DEBUG ("dns plugin: qtype = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_qtype", qtype_str (keys[i]), values[i]);
-	}
+		if (sum->qtype[i] == 0)
+			continue;
 
-	pthread_mutex_lock (&opcode_mutex);
-	for (ptr = opcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
-	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		str = qtype_str (i);
+		if (!select_numeric_qtype && ((str == NULL) || (str[0] == '#')))
+			continue;
+
+		DEBUG ("dns plugin: qtype = %i; counter = %"PRIi64";",
+				i, sum->qtype[i]);
+		submit_derive ("dns_qtype", str, sum->qtype[i]);
 	}
-	pthread_mutex_unlock (&opcode_mutex);
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < OP_MAX; i++)
 	{
-		DEBUG ("dns plugin: opcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_opcode", opcode_str (keys[i]), values[i]);
+		if (sum->opcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: opcode = %i; counter = %"PRIi64";",
+				i, sum->opcode[i]);
+		submit_derive ("dns_opcode", opcode_str (i), sum->opcode[i]);
 	}
 
-	pthread_mutex_lock (&rcode_mutex);
-	for (ptr = rcode_list, len = 0;
-		       	(ptr != NULL) && (len < T_MAX);
-		       	ptr = ptr->next, len++)
+	for (i = 0; i < RC_MAX; i++)
 	{
-		keys[len]   = ptr->key;
-		values[len] = ptr->value;
+		if (sum->rcode[i] == 0)
+			continue;
+
+		DEBUG ("dns plugin: rcode = %i; counter = %"PRIi64";",
+				i, sum->rcode[i]);
+		submit_derive ("dns_rcode", rcode_str (i), sum->rcode[i]);
 	}
-	pthread_mutex_unlock (&rcode_mutex);
 
-	for (i = 0; i < len; i++)
+	return (0);
+} /* int dns_read */
+
+static int dns_shutdown (void)
+{
+	int i;
+
+	listen_shutdown = 1;
+
+	for (i = 0; i < threads_num; i++)
 	{
-		DEBUG ("dns plugin: rcode = %u; counter = %u;", keys[i], values[i]);
-		submit_derive ("dns_rcode", rcode_str (keys[i]), values[i]);
+		if (threads[i].running)
+			pthread_join (threads[i].thread, /* retval = */ NULL);
+		threads[i].running = 0;
+		pthread_mutex_destroy (&threads[i].counters.lock);
 	}
 
+	sfree (threads);
+	threads_num = 0;
+	sfree (counters_sum);
+	sfree (pcap_device);
+
 	return (0);
-} /* int dns_read */
+} /* int dns_shutdown */
 
 void module_register (void)
 {
 	plugin_register_config ("dns", dns_config, config_keys, config_keys_num);
 	plugin_register_init ("dns", dns_init);
 	plugin_register_read ("dns", dns_read);
+	plugin_register_shutdown ("dns", dns_shutdown);
 } /* void module_register */
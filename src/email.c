@@ -38,6 +38,7 @@
 #include "plugin.h"
 
 #include "configfile.h"
+#include "utils_hashtable.h"
 
 #include <stddef.h>
 
@@ -47,7 +48,7 @@
 
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <sys/select.h>
+#include <poll.h>
 
 /* some systems (e.g. Darwin) seem to not define UNIX_PATH_MAX at all */
 #ifndef UNIX_PATH_MAX
@@ -69,39 +70,29 @@
 /*
  * Private data structures
  */
-/* linked list of email and check types */
+/* counter of one email or check type */
 typedef struct type {
-	char        *name;
-	int         value;
-	struct type *next;
+	char *name;
+	int  value;
 } type_t;
 
+/* counters by type name, updated by the event loop and read by email_read */
 typedef struct {
-	type_t *head;
-	type_t *tail;
-} type_list_t;
+	c_hashtable_t   *table;
+	pthread_mutex_t lock;
+} type_table_t;
 
-/* collector thread control information */
-typedef struct collector {
-	pthread_t thread;
-
-	/* socket descriptor of the current/last connection */
-	FILE *socket;
-} collector_t;
-
-/* linked list of pending connections */
+/* client connection handled by the event loop */
 typedef struct conn {
-	/* socket to read data from */
-	FILE *socket;
+	int fd;
 
-	/* linked list of connections */
-	struct conn *next;
-} conn_t;
+	/* the current, incomplete line */
+	char   line[256 + 1]; /* line + '\0' */
+	size_t line_len;
 
-typedef struct {
-	conn_t *head;
-	conn_t *tail;
-} conn_list_t;
+	/* set while the rest of a too long line is being skipped */
+	int    discard;
+} conn_t;
 
 /*
  * Private variables
@@ -125,42 +116,24 @@ static int  max_conns   = MAX_CONNS;
 /* state of the plugin */
 static int disabled = 0;
 
-/* thread managing "client" connections */
-static pthread_t connector = (pthread_t) 0;
+/* thread multiplexing the listening socket and all client connections */
+static pthread_t loop_thread;
+static int loop_running = 0;
+static volatile int loop_continue = 0;
 static int connector_socket = -1;
 
-/* tell the collector threads that a new connection is available */
-static pthread_cond_t conn_available = PTHREAD_COND_INITIALIZER;
-
-/* connections that are waiting to be processed */
-static pthread_mutex_t conns_mutex = PTHREAD_MUTEX_INITIALIZER;
-static conn_list_t conns;
-
-/* tell the connector thread that a collector is available */
-static pthread_cond_t collector_available = PTHREAD_COND_INITIALIZER;
+/* client connections, only accessed by the event loop thread */
+static conn_t **conns = NULL;
+static int conns_num = 0;
 
-/* collector threads */
-static collector_t **collectors = NULL;
-
-static pthread_mutex_t available_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int available_collectors;
-
-static pthread_mutex_t count_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_count;
-static type_list_t list_count_copy;
-
-static pthread_mutex_t size_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_size;
-static type_list_t list_size_copy;
+static type_table_t table_count;
+static type_table_t table_size;
+static type_table_t table_check;
 
 static pthread_mutex_t score_mutex = PTHREAD_MUTEX_INITIALIZER;
 static double score;
 static int score_count;
 
-static pthread_mutex_t check_mutex = PTHREAD_MUTEX_INITIALIZER;
-static type_list_t list_check;
-static type_list_t list_check_copy;
-
 /*
  * Private functions
  */
@@ -211,174 +184,335 @@ static int email_config (const char *key, const char *value)
 	return 0;
 } /* static int email_config (char *, char *) */
 
-/* Increment the value of the given name in the given list by incr. */
-static void type_list_incr (type_list_t *list, char *name, int incr)
+static int type_table_init (type_table_t *t)
 {
-	if (NULL == list->head) {
-		list->head = (type_t *)smalloc (sizeof (type_t));
+	t->table = c_hashtable_create (c_hashtable_hash_string, (void *) strcmp);
+	if (NULL == t->table)
+		return (-1);
 
-		list->head->name  = sstrdup (name);
-		list->head->value = incr;
-		list->head->next  = NULL;
+	pthread_mutex_init (&t->lock, /* attr = */ NULL);
+	return (0);
+} /* static int type_table_init (type_table_t *) */
 
-		list->tail = list->head;
+static void type_table_destroy (type_table_t *t)
+{
+	void *key;
+	void *value;
+
+	if (NULL == t->table)
+		return;
+
+	while (0 == c_hashtable_pick (t->table, &key, &value)) {
+		type_t *type = value;
+
+		free (type->name);
+		free (type);
 	}
-	else {
-		type_t *ptr;
+	c_hashtable_destroy (t->table);
+	t->table = NULL;
+
+	pthread_mutex_destroy (&t->lock);
+} /* static void type_table_destroy (type_table_t *) */
+
+/* Increment the value of the given name in the given table by incr. */
+static void type_table_incr (type_table_t *t, const char *name, int incr)
+{
+	type_t *type = NULL;
+
+	pthread_mutex_lock (&t->lock);
+
+	if (0 == c_hashtable_get (t->table, name, (void *) &type)) {
+		type->value += incr;
+		pthread_mutex_unlock (&t->lock);
+		return;
+	}
+
+	type = malloc (sizeof (*type));
+	if (NULL != type)
+		type->name = strdup (name);
+
+	if ((NULL == type) || (NULL == type->name)) {
+		log_err ("type_table_incr: malloc failed.");
+		if (NULL != type)
+			free (type);
+		pthread_mutex_unlock (&t->lock);
+		return;
+	}
+	type->value = incr;
 
-		for (ptr = list->head; NULL != ptr; ptr = ptr->next) {
-			if (0 == strcmp (name, ptr->name))
-				break;
+	if (0 != c_hashtable_insert (t->table, type->name, type)) {
+		log_err ("type_table_incr: c_hashtable_insert failed.");
+		free (type->name);
+		free (type);
+	}
+
+	pthread_mutex_unlock (&t->lock);
+} /* static void type_table_incr (type_table_t *, const char *, int) */
+
+static void handle_line (char *line)
+{
+	log_debug ("handle_line: line = '%s'", line);
+
+	if (':' != line[1]) {
+		log_err ("handle_line: syntax error in line '%s'", line);
+		return;
+	}
+
+	if ('e' == line[0]) { /* e:<type>:<bytes> */
+		char *ptr  = NULL;
+		char *type = strtok_r (line + 2, ":", &ptr);
+		char *tmp  = strtok_r (NULL, ":", &ptr);
+		int  bytes = 0;
+
+		if (NULL == tmp) {
+			log_err ("handle_line: syntax error in line '%s'", line);
+			return;
 		}
 
-		if (NULL == ptr) {
-			list->tail->next = (type_t *)smalloc (sizeof (type_t));
-			list->tail = list->tail->next;
+		bytes = atoi (tmp);
+
+		type_table_incr (&table_count, type, 1);
 
-			list->tail->name  = sstrdup (name);
-			list->tail->value = incr;
-			list->tail->next  = NULL;
+		if (bytes > 0)
+			type_table_incr (&table_size, type, bytes);
+	}
+	else if ('s' == line[0]) { /* s:<value> */
+		pthread_mutex_lock (&score_mutex);
+		score = (score * (double)score_count + atof (line + 2))
+				/ (double)(score_count + 1);
+		++score_count;
+		pthread_mutex_unlock (&score_mutex);
+	}
+	else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
+		char *ptr  = NULL;
+		char *type = strtok_r (line + 2, ",", &ptr);
+
+		while (NULL != type) {
+			type_table_incr (&table_check, type, 1);
+			type = strtok_r (NULL, ",", &ptr);
 		}
-		else {
-			ptr->value += incr;
+	}
+	else {
+		log_err ("handle_line: unknown type '%c'", line[0]);
+	}
+} /* static void handle_line (char *) */
+
+/* Splits the data read from a connection into lines. */
+static void conn_handle_data (conn_t *c, const char *data, size_t data_len)
+{
+	size_t i;
+
+	for (i = 0; i < data_len; ++i) {
+		if ('\n' == data[i]) {
+			if (c->discard) {
+				c->discard = 0;
+			}
+			else {
+				if ((c->line_len > 0) && ('\r' == c->line[c->line_len - 1]))
+					--c->line_len;
+				c->line[c->line_len] = '\0';
+				handle_line (c->line);
+			}
+			c->line_len = 0;
+			continue;
+		}
+
+		if (c->discard)
+			continue;
+
+		if (c->line_len >= sizeof (c->line) - 1) {
+			c->line[c->line_len] = '\0';
+			log_warn ("conn_handle_data: line too long (> %zu characters): "
+					"'%s' (truncated)", sizeof (c->line) - 1, c->line);
+			c->discard = 1;
+			c->line_len = 0;
+			continue;
 		}
+
+		c->line[c->line_len] = data[i];
+		++c->line_len;
 	}
-	return;
-} /* static void type_list_incr (type_list_t *, char *) */
+} /* static void conn_handle_data (conn_t *, const char *, size_t) */
 
-static void *collect (void *arg)
+/* Reads everything available from the connection. Returns non-zero if the
+ * connection has been closed by the peer or failed. */
+static int conn_read (conn_t *c)
 {
-	collector_t *this = (collector_t *)arg;
+	char buffer[4096];
 
 	while (1) {
-		int loop = 1;
+		ssize_t status;
 
-		conn_t *connection;
-
-		pthread_mutex_lock (&conns_mutex);
+		status = read (c->fd, buffer, sizeof (buffer));
+		if (status > 0) {
+			conn_handle_data (c, buffer, (size_t) status);
+			continue;
+		}
 
-		while (NULL == conns.head) {
-			pthread_cond_wait (&conn_available, &conns_mutex);
+		if (0 == status) {
+			/* handle a last line lacking the newline */
+			if ((! c->discard) && (c->line_len > 0))
+				conn_handle_data (c, "\n", 1);
+			return (1);
 		}
 
-		connection = conns.head;
-		conns.head = conns.head->next;
+		if (EINTR == errno)
+			continue;
+		if ((EAGAIN == errno) || (EWOULDBLOCK == errno))
+			return (0);
 
-		if (NULL == conns.head) {
-			conns.tail = NULL;
+		{
+			char errbuf[1024];
+			log_err ("conn_read: reading from socket (fd #%i) failed: %s",
+					c->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
 		}
+		return (1);
+	}
+} /* static int conn_read (conn_t *) */
 
-		pthread_mutex_unlock (&conns_mutex);
+static int set_nonblocking (int fd)
+{
+	int flags = fcntl (fd, F_GETFL);
 
-		/* make the socket available to the global
-		 * thread and connection management */
-		this->socket = connection->socket;
+	if (-1 == flags)
+		return (-1);
+	return (fcntl (fd, F_SETFL, flags | O_NONBLOCK));
+} /* static int set_nonblocking (int) */
 
-		log_debug ("collect: handling connection on fd #%i",
-				fileno (this->socket));
+/* Accepts all pending connections, as long as fewer than max_conns are
+ * open. */
+static void accept_connections (void)
+{
+	while (conns_num < max_conns) {
+		conn_t *c;
+		int remote;
 
-		while (loop) {
-			/* 256 bytes ought to be enough for anybody ;-) */
-			char line[256 + 1]; /* line + '\0' */
-			int  len = 0;
+		remote = accept (connector_socket, NULL, NULL);
+		if (-1 == remote) {
+			if (EINTR == errno)
+				continue;
+			if ((EAGAIN != errno) && (EWOULDBLOCK != errno)) {
+				char errbuf[1024];
+				log_err ("accept() failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+			}
+			return;
+		}
 
-			errno = 0;
-			if (NULL == fgets (line, sizeof (line), this->socket)) {
-				loop = 0;
+		if (0 != set_nonblocking (remote)) {
+			char errbuf[1024];
+			log_err ("fcntl() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (remote);
+			continue;
+		}
 
-				if (0 != errno) {
-					char errbuf[1024];
-					log_err ("collect: reading from socket (fd #%i) "
-							"failed: %s", fileno (this->socket),
-							sstrerror (errno, errbuf, sizeof (errbuf)));
-				}
-				break;
-			}
+		c = (conn_t *)malloc (sizeof (*c));
+		if (NULL == c) {
+			log_err ("accept_connections: malloc failed.");
+			close (remote);
+			continue;
+		}
+		memset (c, 0, sizeof (*c));
+		c->fd = remote;
 
-			len = strlen (line);
-			if (('\n' != line[len - 1]) && ('\r' != line[len - 1])) {
-				log_warn ("collect: line too long (> %zu characters): "
-						"'%s' (truncated)", sizeof (line) - 1, line);
+		log_debug ("accept_connections: handling connection on fd #%i",
+				c->fd);
 
-				while (NULL != fgets (line, sizeof (line), this->socket))
-					if (('\n' == line[len - 1]) || ('\r' == line[len - 1]))
-						break;
-				continue;
-			}
+		conns[conns_num] = c;
+		++conns_num;
+	}
+} /* static void accept_connections (void) */
 
-			line[len - 1] = '\0';
+static void close_connection (int index)
+{
+	log_debug ("Shutting down connection on fd #%i", conns[index]->fd);
 
-			log_debug ("collect: line = '%s'", line);
+	close (conns[index]->fd);
+	free (conns[index]);
 
-			if (':' != line[1]) {
-				log_err ("collect: syntax error in line '%s'", line);
-				continue;
-			}
+	/* keep the array dense */
+	--conns_num;
+	conns[index] = conns[conns_num];
+	conns[conns_num] = NULL;
+} /* static void close_connection (int) */
 
-			if ('e' == line[0]) { /* e:<type>:<bytes> */
-				char *ptr  = NULL;
-				char *type = strtok_r (line + 2, ":", &ptr);
-				char *tmp  = strtok_r (NULL, ":", &ptr);
-				int  bytes = 0;
+/* The event loop: the listening socket is polled together with all client
+ * connections, so no connection occupies a thread of its own. */
+static void *email_loop (void __attribute__((unused)) *arg)
+{
+	struct pollfd *fds;
 
-				if (NULL == tmp) {
-					log_err ("collect: syntax error in line '%s'", line);
-					continue;
-				}
+	fds = (struct pollfd *)calloc (max_conns + 1, sizeof (*fds));
+	if (NULL == fds) {
+		log_err ("email_loop: calloc failed.");
+		pthread_exit ((void *)1);
+	}
 
-				bytes = atoi (tmp);
+	while (loop_continue) {
+		int fds_num = 0;
+		int conns_offset = 0;
+		int status;
+		int i;
+
+		/* stop accepting while the maximum number of connections is open;
+		 * further clients wait in the listen queue */
+		if (conns_num < max_conns) {
+			fds[fds_num].fd = connector_socket;
+			fds[fds_num].events = POLLIN;
+			fds[fds_num].revents = 0;
+			++fds_num;
+			conns_offset = 1;
+		}
 
-				pthread_mutex_lock (&count_mutex);
-				type_list_incr (&list_count, type, 1);
-				pthread_mutex_unlock (&count_mutex);
+		for (i = 0; i < conns_num; ++i) {
+			fds[fds_num].fd = conns[i]->fd;
+			fds[fds_num].events = POLLIN;
+			fds[fds_num].revents = 0;
+			++fds_num;
+		}
 
-				if (bytes > 0) {
-					pthread_mutex_lock (&size_mutex);
-					type_list_incr (&list_size, type, bytes);
-					pthread_mutex_unlock (&size_mutex);
-				}
-			}
-			else if ('s' == line[0]) { /* s:<value> */
-				pthread_mutex_lock (&score_mutex);
-				score = (score * (double)score_count + atof (line + 2))
-						/ (double)(score_count + 1);
-				++score_count;
-				pthread_mutex_unlock (&score_mutex);
-			}
-			else if ('c' == line[0]) { /* c:<type1>[,<type2>,...] */
-				char *ptr  = NULL;
-				char *type = strtok_r (line + 2, ",", &ptr);
-
-				do {
-					pthread_mutex_lock (&check_mutex);
-					type_list_incr (&list_check, type, 1);
-					pthread_mutex_unlock (&check_mutex);
-				} while (NULL != (type = strtok_r (NULL, ",", &ptr)));
-			}
-			else {
-				log_err ("collect: unknown type '%c'", line[0]);
-			}
-		} /* while (loop) */
+		status = poll (fds, (nfds_t) fds_num, -1);
+		if (status < 0) {
+			char errbuf[1024];
 
-		log_debug ("Shutting down connection on fd #%i",
-				fileno (this->socket));
+			if (EINTR == errno)
+				continue;
 
-		fclose (connection->socket);
-		free (connection);
+			log_err ("poll() failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
 
-		this->socket = NULL;
+		/* Connections are matched to their descriptors in reverse order,
+		 * so closing one (which moves the last into its slot) doesn't
+		 * affect the ones which are yet to be handled. */
+		for (i = fds_num - 1; i >= 0; --i) {
+			int index;
 
-		pthread_mutex_lock (&available_mutex);
-		++available_collectors;
-		pthread_mutex_unlock (&available_mutex);
+			if (0 == fds[i].revents)
+				continue;
 
-		pthread_cond_signal (&collector_available);
-	} /* while (1) */
+			if (fds[i].fd == connector_socket) {
+				accept_connections ();
+				continue;
+			}
+
+			index = i - conns_offset;
+			if ((index < 0) || (index >= conns_num)
+					|| (conns[index]->fd != fds[i].fd))
+				continue;
+
+			if (0 != conn_read (conns[index]))
+				close_connection (index);
+		}
+	} /* while (loop_continue) */
 
+	free (fds);
 	pthread_exit ((void *)0);
-} /* static void *collect (void *) */
+} /* static void *email_loop (void *) */
 
-static void *open_connection (void __attribute__((unused)) *arg)
+static int create_socket (void)
 {
 	struct sockaddr_un addr;
 
@@ -389,10 +523,9 @@ static void *open_connection (void __attribute__((unused)) *arg)
 	errno = 0;
 	if (-1 == (connector_socket = socket (PF_UNIX, SOCK_STREAM, 0))) {
 		char errbuf[1024];
-		disabled = 1;
 		log_err ("socket() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return (-1);
 	}
 
 	addr.sun_family = AF_UNIX;
@@ -403,23 +536,22 @@ static void *open_connection (void __attribute__((unused)) *arg)
 				offsetof (struct sockaddr_un, sun_path)
 					+ strlen(addr.sun_path))) {
 		char errbuf[1024];
-		disabled = 1;
 		close (connector_socket);
 		connector_socket = -1;
 		log_err ("bind() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return (-1);
 	}
 
 	errno = 0;
-	if (-1 == listen (connector_socket, 5)) {
+	if ((-1 == listen (connector_socket, 5))
+			|| (0 != set_nonblocking (connector_socket))) {
 		char errbuf[1024];
-		disabled = 1;
 		close (connector_socket);
 		connector_socket = -1;
 		log_err ("listen() failed: %s",
 				sstrerror (errno, errbuf, sizeof (errbuf)));
-		pthread_exit ((void *)1);
+		return (-1);
 	}
 
 	{
@@ -460,185 +592,77 @@ static void *open_connection (void __attribute__((unused)) *arg)
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 	}
 
-	{ /* initialize collector threads */
-		int i   = 0;
-		int err = 0;
-
-		pthread_attr_t ptattr;
-
-		conns.head = NULL;
-		conns.tail = NULL;
-
-		pthread_attr_init (&ptattr);
-		pthread_attr_setdetachstate (&ptattr, PTHREAD_CREATE_DETACHED);
-
-		available_collectors = max_conns;
-
-		collectors =
-			(collector_t **)smalloc (max_conns * sizeof (collector_t *));
-
-		for (i = 0; i < max_conns; ++i) {
-			collectors[i] = (collector_t *)smalloc (sizeof (collector_t));
-			collectors[i]->socket = NULL;
+	return (0);
+} /* static int create_socket (void) */
 
-			if (0 != (err = pthread_create (&collectors[i]->thread, &ptattr,
-							collect, collectors[i]))) {
-				char errbuf[1024];
-				log_err ("pthread_create() failed: %s",
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				collectors[i]->thread = (pthread_t) 0;
-			}
-		}
+static int email_init (void)
+{
+	int err = 0;
 
-		pthread_attr_destroy (&ptattr);
+	if ((0 != type_table_init (&table_count))
+			|| (0 != type_table_init (&table_size))
+			|| (0 != type_table_init (&table_check))) {
+		log_err ("email_init: c_hashtable_create failed.");
+		disabled = 1;
+		return (-1);
 	}
 
-	while (1) {
-		int remote = 0;
-
-		conn_t *connection;
-
-		pthread_mutex_lock (&available_mutex);
-
-		while (0 == available_collectors) {
-			pthread_cond_wait (&collector_available, &available_mutex);
-		}
-
-		--available_collectors;
-
-		pthread_mutex_unlock (&available_mutex);
-
-		do {
-			errno = 0;
-			if (-1 == (remote = accept (connector_socket, NULL, NULL))) {
-				if (EINTR != errno) {
-					char errbuf[1024];
-					disabled = 1;
-					close (connector_socket);
-					connector_socket = -1;
-					log_err ("accept() failed: %s",
-							sstrerror (errno, errbuf, sizeof (errbuf)));
-					pthread_exit ((void *)1);
-				}
-			}
-		} while (EINTR == errno);
-
-		connection = (conn_t *)smalloc (sizeof (conn_t));
-
-		connection->socket = fdopen (remote, "r");
-		connection->next   = NULL;
-
-		if (NULL == connection->socket) {
-			close (remote);
-			continue;
-		}
-
-		pthread_mutex_lock (&conns_mutex);
-
-		if (NULL == conns.head) {
-			conns.head = connection;
-			conns.tail = connection;
-		}
-		else {
-			conns.tail->next = connection;
-			conns.tail = conns.tail->next;
-		}
-
-		pthread_mutex_unlock (&conns_mutex);
-
-		pthread_cond_signal (&conn_available);
+	conns = (conn_t **)calloc (max_conns, sizeof (*conns));
+	if (NULL == conns) {
+		log_err ("email_init: calloc failed.");
+		disabled = 1;
+		return (-1);
 	}
-	pthread_exit ((void *)0);
-} /* static void *open_connection (void *) */
 
-static int email_init (void)
-{
-	int err = 0;
+	if (0 != create_socket ()) {
+		disabled = 1;
+		return (-1);
+	}
 
-	if (0 != (err = pthread_create (&connector, NULL,
-				open_connection, NULL))) {
+	loop_continue = 1;
+	if (0 != (err = pthread_create (&loop_thread, NULL,
+				email_loop, NULL))) {
 		char errbuf[1024];
 		disabled = 1;
+		loop_continue = 0;
 		log_err ("pthread_create() failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+				sstrerror (err, errbuf, sizeof (errbuf)));
 		return (-1);
 	}
+	loop_running = 1;
 
 	return (0);
 } /* int email_init */
 
 static int email_shutdown (void)
 {
-	type_t *ptr = NULL;
-
 	int i = 0;
 
-	if (connector != ((pthread_t) 0)) {
-		pthread_kill (connector, SIGTERM);
-		connector = (pthread_t) 0;
-	}
-
-	if (connector_socket >= 0) {
-		close (connector_socket);
-		connector_socket = -1;
+	if (loop_running) {
+		/* interrupt poll(2) */
+		loop_continue = 0;
+		pthread_kill (loop_thread, SIGTERM);
+		pthread_join (loop_thread, NULL);
+		loop_running = 0;
 	}
 
-	/* don't allow any more connections to be processed */
-	pthread_mutex_lock (&conns_mutex);
-
-	available_collectors = 0;
-
-	if (collectors != NULL) {
-		for (i = 0; i < max_conns; ++i) {
-			if (collectors[i] == NULL)
-				continue;
-
-			if (collectors[i]->thread != ((pthread_t) 0)) {
-				pthread_kill (collectors[i]->thread, SIGTERM);
-				collectors[i]->thread = (pthread_t) 0;
-			}
-
-			if (collectors[i]->socket != NULL) {
-				fclose (collectors[i]->socket);
-				collectors[i]->socket = NULL;
-			}
-
-			sfree (collectors[i]);
+	if (NULL != conns) {
+		for (i = 0; i < conns_num; ++i) {
+			close (conns[i]->fd);
+			sfree (conns[i]);
 		}
-		sfree (collectors);
-	} /* if (collectors != NULL) */
-
-	pthread_mutex_unlock (&conns_mutex);
-
-	for (ptr = list_count.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_count_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_size.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
+		conns_num = 0;
+		sfree (conns);
 	}
 
-	for (ptr = list_size_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
-
-	for (ptr = list_check.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
+	if (connector_socket >= 0) {
+		close (connector_socket);
+		connector_socket = -1;
 	}
 
-	for (ptr = list_check_copy.head; NULL != ptr; ptr = ptr->next) {
-		free (ptr->name);
-		free (ptr);
-	}
+	type_table_destroy (&table_count);
+	type_table_destroy (&table_size);
+	type_table_destroy (&table_check);
 
 	unlink ((NULL == sock_file) ? SOCK_PATH : sock_file);
 
@@ -664,48 +688,69 @@ static void email_submit (const char *type, const char *type_instance, gauge_t v
 	plugin_dispatch_values (&vl);
 } /* void email_submit */
 
-/* Copy list l1 to list l2. l2 may partly exist already, but it is assumed
- * that neither the order nor the name of any element of either list is
- * changed and no elements are deleted. The values of l1 are reset to zero
- * after they have been copied to l2. */
-static void copy_type_list (type_list_t *l1, type_list_t *l2)
+/* Copy the counters of table t to a newly allocated array and reset them to
+ * zero. The entries are kept, so each type is reported until shutdown. */
+static type_t *copy_type_table (type_table_t *t, int *num)
 {
-	type_t *ptr1;
-	type_t *ptr2;
+	c_hashtable_iterator_t *iter;
+	type_t *copy = NULL;
+	void *key;
+	void *value;
+	int i = 0;
 
-	type_t *last = NULL;
+	*num = 0;
 
-	for (ptr1 = l1->head, ptr2 = l2->head; NULL != ptr1;
-			ptr1 = ptr1->next, last = ptr2, ptr2 = ptr2->next) {
-		if (NULL == ptr2) {
-			ptr2 = (type_t *)smalloc (sizeof (type_t));
-			ptr2->name = NULL;
-			ptr2->next = NULL;
+	pthread_mutex_lock (&t->lock);
 
-			if (NULL == last) {
-				l2->head = ptr2;
-			}
-			else {
-				last->next = ptr2;
-			}
+	if (0 == c_hashtable_size (t->table)) {
+		pthread_mutex_unlock (&t->lock);
+		return (NULL);
+	}
 
-			l2->tail = ptr2;
-		}
+	copy = (type_t *)calloc (c_hashtable_size (t->table), sizeof (*copy));
+	iter = c_hashtable_get_iterator (t->table);
+	if ((NULL == copy) || (NULL == iter)) {
+		pthread_mutex_unlock (&t->lock);
+		log_err ("copy_type_table: calloc failed.");
+		sfree (copy);
+		if (NULL != iter)
+			c_hashtable_iterator_destroy (iter);
+		return (NULL);
+	}
 
-		if (NULL == ptr2->name) {
-			ptr2->name = sstrdup (ptr1->name);
-		}
+	while (0 == c_hashtable_iterator_next (iter, &key, &value)) {
+		type_t *type = value;
 
-		ptr2->value = ptr1->value;
-		ptr1->value = 0;
+		copy[i].name = sstrdup (type->name);
+		copy[i].value = type->value;
+		type->value = 0;
+		++i;
 	}
-	return;
-}
+	c_hashtable_iterator_destroy (iter);
 
-static int email_read (void)
+	pthread_mutex_unlock (&t->lock);
+
+	*num = i;
+	return (copy);
+} /* static type_t *copy_type_table (type_table_t *, int *) */
+
+static void submit_type_table (type_table_t *t, const char *type)
 {
-	type_t *ptr;
+	type_t *copy;
+	int num = 0;
+	int i;
+
+	copy = copy_type_table (t, &num);
+
+	for (i = 0; i < num; ++i) {
+		email_submit (type, copy[i].name, copy[i].value);
+		free (copy[i].name);
+	}
+	sfree (copy);
+} /* static void submit_type_table (type_table_t *, const char *) */
 
+static int email_read (void)
+{
 	double score_old;
 	int score_count_old;
 
@@ -713,26 +758,10 @@ static int email_read (void)
 		return (-1);
 
 	/* email count */
-	pthread_mutex_lock (&count_mutex);
-
-	copy_type_list (&list_count, &list_count_copy);
-
-	pthread_mutex_unlock (&count_mutex);
-
-	for (ptr = list_count_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_count", ptr->name, ptr->value);
-	}
+	submit_type_table (&table_count, "email_count");
 
 	/* email size */
-	pthread_mutex_lock (&size_mutex);
-
-	copy_type_list (&list_size, &list_size_copy);
-
-	pthread_mutex_unlock (&size_mutex);
-
-	for (ptr = list_size_copy.head; NULL != ptr; ptr = ptr->next) {
-		email_submit ("email_size", ptr->name, ptr->value);
-	}
+	submit_type_table (&table_size, "email_size");
 
 	/* spam score */
 	pthread_mutex_lock (&score_mutex);
@@ -748,14 +777,7 @@ static int email_read (void)
 		email_submit ("spam_score", "", score_old);
 
 	/* spam checks */
-	pthread_mutex_lock (&check_mutex);
-
-	copy_type_list (&list_check, &list_check_copy);
-
-	pthread_mutex_unlock (&check_mutex);
-
-	for (ptr = list_check_copy.head; NULL != ptr; ptr = ptr->next)
-		email_submit ("spam_check", ptr->name, ptr->value);
+	submit_type_table (&table_check, "spam_check");
 
 	return (0);
 } /* int email_read */
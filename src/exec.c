@@ -38,22 +38,34 @@
 #include <signal.h>
 
 #include <pthread.h>
+#include <poll.h>
 
 #define PL_NORMAL        0x01
 #define PL_NOTIF_ACTION  0x02
+#define PL_PERSISTENT    0x04
 
 #define PL_RUNNING       0x10
 
+/* The size of the buffer each `Exec' program's output is read into. */
+#define EXEC_BUFFER_SIZE 16384
+
+/* The number of notifications waiting for a notification thread. When the
+ * queue is full, further notifications are dropped. */
+#define EXEC_NOTIF_QUEUE_MAX 1024
+
 /*
  * Private data types
  */
 /*
  * Access to this structure is serialized using the `pl_lock' lock and the
  * `PL_RUNNING' flag. The execution of notifications is *not* serialized, so
- * all functions used to handle notifications MUST NOT write to this structure.
- * The `pid' and `status' fields are thus unused if the `PL_NOTIF_ACTION' flag
- * is set.
- * The `PL_RUNNING' flag is set in `exec_read' and unset in `exec_read_one'.
+ * all functions used to handle notifications MUST NOT write to this structure,
+ * except for `PersistentNotificationExec' programs, whose `pid' and `fh'
+ * fields are protected by `lock'. The `pid' and `status' fields are unused for
+ * other notification programs.
+ * The `PL_RUNNING' flag is set in `exec_read' and unset by the `exec_loop'
+ * thread, which starts the program, reads its output and waits for it to exit.
+ * Only that thread uses the `fd_*', `buffer*' and `batch' fields.
  */
 struct program_list_s;
 typedef struct program_list_s program_list_t;
@@ -66,6 +78,21 @@ struct program_list_s
   int             pid;
   int             status;
   int             flags;
+
+  /* `Exec' programs */
+  int             fd_out;
+  int             fd_err;
+  _Bool           exiting;
+  char           *buffer;
+  size_t          buffer_fill;
+  char           *buffer_err;
+  size_t          buffer_err_fill;
+  putval_batch_t *batch;
+
+  /* `PersistentNotificationExec' programs */
+  pthread_mutex_t lock;
+  FILE           *fh;
+
   program_list_t *next;
 };
 
@@ -73,6 +100,7 @@ typedef struct program_list_and_notification_s
 {
   program_list_t *pl;
   notification_t n;
+  struct program_list_and_notification_s *next;
 } program_list_and_notification_t;
 
 /*
@@ -81,6 +109,23 @@ typedef struct program_list_and_notification_s
 static program_list_t *pl_head = NULL;
 static pthread_mutex_t pl_lock = PTHREAD_MUTEX_INITIALIZER;
 
+/* The thread handling all `Exec' programs. `exec_read' wakes it up by writing
+ * to `loop_wakeup'. */
+static pthread_t loop_thread;
+static _Bool     loop_thread_running = 0;
+static int       loop_wakeup[2] = { -1, -1 };
+
+/* The threads running the notification programs. */
+static int                notif_threads_max = 5;
+static pthread_t         *notif_threads = NULL;
+static int                notif_threads_num = 0;
+static _Bool              notif_threads_stop = 0;
+static program_list_and_notification_t *notif_queue_head = NULL;
+static program_list_and_notification_t *notif_queue_tail = NULL;
+static int                notif_queue_length = 0;
+static pthread_mutex_t    notif_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t     notif_queue_cond = PTHREAD_COND_INITIALIZER;
+
 /*
  * Functions
  */
@@ -135,9 +180,15 @@ static int exec_config_exec (oconfig_item_t *ci) /* {{{ */
 
   if (strcasecmp ("NotificationExec", ci->key) == 0)
     pl->flags |= PL_NOTIF_ACTION;
+  else if (strcasecmp ("PersistentNotificationExec", ci->key) == 0)
+    pl->flags |= PL_NOTIF_ACTION | PL_PERSISTENT;
   else
     pl->flags |= PL_NORMAL;
 
+  pl->fd_out = -1;
+  pl->fd_err = -1;
+  pthread_mutex_init (&pl->lock, /* attr = */ NULL);
+
   pl->user = strdup (ci->values[0].value.string);
   if (pl->user == NULL)
   {
@@ -254,8 +305,19 @@ static int exec_config (oconfig_item_t *ci) /* {{{ */
   {
     oconfig_item_t *child = ci->children + i;
     if ((strcasecmp ("Exec", child->key) == 0)
-        || (strcasecmp ("NotificationExec", child->key) == 0))
+        || (strcasecmp ("NotificationExec", child->key) == 0)
+        || (strcasecmp ("PersistentNotificationExec", child->key) == 0))
       exec_config_exec (child);
+    else if (strcasecmp ("NotificationThreads", child->key) == 0)
+    {
+      int tmp = notif_threads_max;
+
+      if ((cf_util_get_int (child, &tmp) != 0) || (tmp < 1))
+        WARNING ("exec plugin: `NotificationThreads' needs a positive "
+            "number.");
+      else
+        notif_threads_max = tmp;
+    }
     else
     {
       WARNING ("exec plugin: Unknown config option `%s'.", child->key);
@@ -530,12 +592,29 @@ static int fork_child (program_list_t *pl, int *fd_in, int *fd_out, int *fd_err)
   return (pid);
 } /* int fork_child }}} */
 
-static int parse_line (char *buffer) /* {{{ */
+/* PUTVAL commands are collected in `batch' and dispatched together by the
+ * caller, see exec_read_output. */
+static int parse_line (char *buffer, putval_batch_t *batch) /* {{{ */
 {
-  if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
+  if ((strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
+      && (batch != NULL))
+  {
+    char errbuf[256];
+    int status;
+
+    status = putval_batch_add (batch, buffer, errbuf, sizeof (errbuf));
+    if (status < 0)
+      ERROR ("exec plugin: Ignoring PUTVAL line: %s", errbuf);
+    return ((status < 0) ? -1 : 0);
+  }
+  else if (strncasecmp ("PUTVAL", buffer, strlen ("PUTVAL")) == 0)
     return (handle_putval (stdout, buffer));
   else if (strncasecmp ("PUTNOTIF", buffer, strlen ("PUTNOTIF")) == 0)
+  {
+    /* Keep values and notifications in order. */
+    putval_batch_flush (batch);
     return (handle_putnotif (stdout, buffer));
+  }
   else
   {
     ERROR ("exec plugin: Unable to parse command, ignoring line: \"%s\"",
@@ -544,191 +623,308 @@ static int parse_line (char *buffer) /* {{{ */
   }
 } /* int parse_line }}} */
 
-static void *exec_read_one (void *arg) /* {{{ */
+/* Splits the first `*fill' bytes of `buffer' into lines and calls `callback'
+ * for each complete line. Incomplete lines are moved to the start of the
+ * buffer. A line which doesn't fit into the buffer is discarded. */
+static void exec_split_lines (program_list_t *pl, char *buffer, /* {{{ */
+    size_t size, size_t *fill, void (*callback) (program_list_t *, char *))
+{
+  char *line = buffer;
+  char *pnl;
+
+  buffer[*fill] = 0;
+  while ((pnl = strchr (line, '\n')) != NULL)
+  {
+    *pnl = 0;
+    if ((pnl > line) && (pnl[-1] == '\r'))
+      pnl[-1] = 0;
+
+    (*callback) (pl, line);
+
+    line = pnl + 1;
+  }
+
+  *fill -= (size_t) (line - buffer);
+  if ((*fill > 0) && (line != buffer))
+    memmove (buffer, line, *fill);
+  else if (*fill >= size - 1)
+  {
+    ERROR ("exec plugin: Program `%s' printed a line longer than %zu bytes. "
+        "Discarding it.", pl->exec, size - 1);
+    *fill = 0;
+  }
+} /* }}} void exec_split_lines */
+
+static void exec_handle_line (program_list_t *pl, char *line) /* {{{ */
+{
+  parse_line (line, pl->batch);
+} /* }}} void exec_handle_line */
+
+static void exec_handle_error_line (program_list_t *pl, char *line) /* {{{ */
+{
+  ERROR ("exec plugin: exec_loop: error = %s", line);
+} /* }}} void exec_handle_error_line */
+
+static void exec_set_nonblocking (int fd) /* {{{ */
+{
+  int flags;
+
+  flags = fcntl (fd, F_GETFL);
+  if (flags >= 0)
+    fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+} /* }}} void exec_set_nonblocking */
+
+/* Resets the program's state once it has been started, or failed to start,
+ * so that `exec_read' can start it again. */
+static void exec_read_done (program_list_t *pl) /* {{{ */
+{
+  DEBUG ("exec plugin: Child %i exited with status %i.",
+      (int) pl->pid, pl->status);
+
+  pl->pid = 0;
+  pl->exiting = 0;
+
+  pthread_mutex_lock (&pl_lock);
+  pl->flags &= ~PL_RUNNING;
+  pthread_mutex_unlock (&pl_lock);
+} /* }}} void exec_read_done */
+
+static int exec_read_start (program_list_t *pl) /* {{{ */
 {
-  program_list_t *pl = (program_list_t *) arg;
-  int fd, fd_err, highest_fd;
-  fd_set fdset, copy;
   int status;
-  char buffer[1200];  /* if not completely read */
-  char buffer_err[1024];
-  char *pbuffer = buffer;
-  char *pbuffer_err = buffer_err;
 
-  status = fork_child (pl, NULL, &fd, &fd_err);
-  if (status < 0)
+  if (pl->buffer == NULL)
+    pl->buffer = malloc (EXEC_BUFFER_SIZE);
+  if (pl->buffer_err == NULL)
+    pl->buffer_err = malloc (1024);
+  if ((pl->buffer == NULL) || (pl->buffer_err == NULL))
   {
-    /* Reset the "running" flag */
-    pthread_mutex_lock (&pl_lock);
-    pl->flags &= ~PL_RUNNING;
-    pthread_mutex_unlock (&pl_lock);
-    pthread_exit ((void *) 1);
+    ERROR ("exec plugin: malloc failed.");
+    return (-1);
   }
+  pl->buffer_fill = 0;
+  pl->buffer_err_fill = 0;
+
+  /* If this fails, each PUTVAL is dispatched on its own. */
+  if (pl->batch == NULL)
+    pl->batch = putval_batch_create ();
+
+  status = fork_child (pl, NULL, &pl->fd_out, &pl->fd_err);
+  if (status < 0)
+    return (-1);
   pl->pid = status;
 
   assert (pl->pid != 0);
 
-  FD_ZERO( &fdset );
-  FD_SET(fd, &fdset);
-  FD_SET(fd_err, &fdset);
+  exec_set_nonblocking (pl->fd_out);
+  exec_set_nonblocking (pl->fd_err);
+  return (0);
+} /* }}} int exec_read_start */
 
-  /* Determine the highest file descriptor */
-  highest_fd = (fd > fd_err) ? fd : fd_err;
+/* Returns non-zero once the program has exited. */
+static int exec_read_reap (program_list_t *pl) /* {{{ */
+{
+  int status;
+  pid_t pid;
 
-  /* We use a copy of fdset, as select modifies it */
-  copy = fdset;
+  pid = waitpid (pl->pid, &status, WNOHANG);
+  if (pid == 0)
+    return (0);
+
+  /* If the SIGCHLD handler got to the child first, it has stored the status
+   * already. */
+  if (pid > 0)
+    pl->status = status;
+  return (1);
+} /* }}} int exec_read_reap */
 
-  while (1)
+/* Reads the available output of the program. Returns less than zero once its
+ * STDOUT has been closed. */
+static int exec_read_output (program_list_t *pl, int fd) /* {{{ */
+{
+  char *buffer = (fd == pl->fd_out) ? pl->buffer : pl->buffer_err;
+  size_t *fill = (fd == pl->fd_out) ? &pl->buffer_fill : &pl->buffer_err_fill;
+  size_t size = (fd == pl->fd_out) ? EXEC_BUFFER_SIZE : 1024;
+
+  while (42)
   {
-    int len;
+    ssize_t len;
 
-    status = select (highest_fd + 1, &copy, NULL, NULL, NULL);
-    if (status < 0)
+    len = read (fd, buffer + *fill, size - 1 - *fill);
+    if (len < 0)
     {
       if (errno == EINTR)
         continue;
-      break;
+      if (errno == EAGAIN)
+        break;
     }
 
-    if (FD_ISSET(fd, &copy))
+    if (len <= 0)
     {
-      char *pnl;
-
-      len = read(fd, pbuffer, sizeof(buffer) - 1 - (pbuffer - buffer));
-
-      if (len < 0)
+      /* We've reached EOF */
+      if (fd == pl->fd_err)
       {
-        if (errno == EAGAIN || errno == EINTR)  continue;
-        break;
+        NOTICE ("exec plugin: Program `%s' has closed STDERR.", pl->exec);
+        close (pl->fd_err);
+        pl->fd_err = -1;
+        return (0);
       }
-      else if (len == 0) break;  /* We've reached EOF */
+      return (-1);
+    }
 
-      pbuffer[len] = '\0';
+    *fill += (size_t) len;
+    if (fd == pl->fd_out)
+    {
+      exec_split_lines (pl, buffer, size, fill, exec_handle_line);
+      /* Dispatch everything that has been read in one go. */
+      putval_batch_flush (pl->batch);
+    }
+    else
+      exec_split_lines (pl, buffer, size, fill, exec_handle_error_line);
+  }
 
-      len += pbuffer - buffer;
-      pbuffer = buffer;
+  return (0);
+} /* }}} int exec_read_output */
 
-      while ((pnl = strchr(pbuffer, '\n')))
-      {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+/* Runs all `Exec' programs: Starts those `exec_read' asked for, reads the
+ * output of all of them with one `poll' and waits for them to exit. */
+static void *exec_loop (void __attribute__((unused)) *arg) /* {{{ */
+{
+  program_list_t *pl;
+  struct pollfd *fds;
+  program_list_t **fds_pl;
+  size_t fds_size = 1;
 
-        parse_line (pbuffer);
+  for (pl = pl_head; pl != NULL; pl = pl->next)
+    if ((pl->flags & PL_NORMAL) != 0)
+      fds_size += 2;
 
-        pbuffer = ++pnl;
-      }
-      /* not completely read ? */
-      if (pbuffer - buffer < len)
-      {
-        len -= pbuffer - buffer;
-        memmove(buffer, pbuffer, len);
-        pbuffer = buffer + len;
-      }
-      else
-        pbuffer = buffer;
-    }
-    else if (FD_ISSET(fd_err, &copy))
+  fds = calloc (fds_size, sizeof (*fds));
+  fds_pl = calloc (fds_size, sizeof (*fds_pl));
+  if ((fds == NULL) || (fds_pl == NULL))
+  {
+    ERROR ("exec plugin: calloc failed.");
+    sfree (fds);
+    sfree (fds_pl);
+    return ((void *) 1);
+  }
+
+  while (loop_thread_running)
+  {
+    size_t fds_num = 1;
+    int timeout = -1;
+    size_t i;
+    int status;
+
+    fds[0].fd = loop_wakeup[0];
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+
+    for (pl = pl_head; pl != NULL; pl = pl->next)
     {
-      char *pnl;
+      int running;
 
-      len = read(fd_err, pbuffer_err, sizeof(buffer_err) - 1 - (pbuffer_err - buffer_err));
+      if ((pl->flags & PL_NORMAL) == 0)
+        continue;
+
+      pthread_mutex_lock (&pl_lock);
+      running = (pl->flags & PL_RUNNING) != 0;
+      pthread_mutex_unlock (&pl_lock);
+      if (!running)
+        continue;
 
-      if (len < 0)
+      if (pl->pid == 0)
       {
-        if (errno == EAGAIN || errno == EINTR)  continue;
-        break;
+        if (exec_read_start (pl) != 0)
+        {
+          exec_read_done (pl);
+          continue;
+        }
       }
-      else if (len == 0)
+
+      if (pl->exiting)
       {
-        /* We've reached EOF */
-        NOTICE ("exec plugin: Program `%s' has closed STDERR.",
-            pl->exec);
-        close (fd_err);
-        FD_CLR (fd_err, &fdset);
-        highest_fd = fd;
-        fd_err = -1;
+        if (exec_read_reap (pl))
+          exec_read_done (pl);
+        else
+          /* Check again in a second. */
+          timeout = 1000;
         continue;
       }
 
-      pbuffer_err[len] = '\0';
-
-      len += pbuffer_err - buffer_err;
-      pbuffer_err = buffer_err;
+      fds[fds_num].fd = pl->fd_out;
+      fds[fds_num].events = POLLIN;
+      fds[fds_num].revents = 0;
+      fds_pl[fds_num] = pl;
+      fds_num++;
 
-      while ((pnl = strchr(pbuffer_err, '\n')))
+      if (pl->fd_err >= 0)
       {
-        *pnl = '\0';
-        if (*(pnl-1) == '\r' ) *(pnl-1) = '\0';
+        fds[fds_num].fd = pl->fd_err;
+        fds[fds_num].events = POLLIN;
+        fds[fds_num].revents = 0;
+        fds_pl[fds_num] = pl;
+        fds_num++;
+      }
+    }
 
-        ERROR ("exec plugin: exec_read_one: error = %s", pbuffer_err);
+    status = poll (fds, (nfds_t) fds_num, timeout);
+    if (status < 0)
+    {
+      char errbuf[1024];
 
-        pbuffer_err = ++pnl;
-      }
-      /* not completely read ? */
-      if (pbuffer_err - buffer_err < len)
-      {
-        len -= pbuffer_err - buffer_err;
-        memmove(buffer_err, pbuffer_err, len);
-        pbuffer_err = buffer_err + len;
-      }
-      else
-        pbuffer_err = buffer_err;
+      if (errno == EINTR)
+        continue;
+      ERROR ("exec plugin: poll failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
     }
-    /* reset copy */
-    copy = fdset;
-  }
 
-  DEBUG ("exec plugin: exec_read_one: Waiting for `%s' to exit.", pl->exec);
-  if (waitpid (pl->pid, &status, 0) > 0)
-    pl->status = status;
+    if (fds[0].revents != 0)
+    {
+      char buffer[64];
+      while (read (loop_wakeup[0], buffer, sizeof (buffer)) > 0)
+        /* empty the pipe */;
+    }
 
-  DEBUG ("exec plugin: Child %i exited with status %i.",
-      (int) pl->pid, pl->status);
+    for (i = 1; i < fds_num; i++)
+    {
+      pl = fds_pl[i];
 
-  pl->pid = 0;
+      if ((fds[i].revents == 0) || (pl->exiting))
+        continue;
+      /* STDERR may have been closed while handling STDOUT. */
+      if ((fds[i].fd != pl->fd_out) && (fds[i].fd != pl->fd_err))
+        continue;
 
-  pthread_mutex_lock (&pl_lock);
-  pl->flags &= ~PL_RUNNING;
-  pthread_mutex_unlock (&pl_lock);
+      if (exec_read_output (pl, fds[i].fd) == 0)
+        continue;
 
-  close (fd);
-  if (fd_err >= 0)
-    close (fd_err);
+      DEBUG ("exec plugin: exec_loop: Waiting for `%s' to exit.", pl->exec);
+      close (pl->fd_out);
+      pl->fd_out = -1;
+      if (pl->fd_err >= 0)
+        close (pl->fd_err);
+      pl->fd_err = -1;
+      putval_batch_flush (pl->batch);
+
+      pl->exiting = 1;
+      if (exec_read_reap (pl))
+        exec_read_done (pl);
+    }
+  } /* while (loop_thread_running) */
 
-  pthread_exit ((void *) 0);
-  return (NULL);
-} /* void *exec_read_one }}} */
+  sfree (fds);
+  sfree (fds_pl);
+  return ((void *) 0);
+} /* }}} void *exec_loop */
 
-static void *exec_notification_one (void *arg) /* {{{ */
+static void exec_notification_print (FILE *fh, /* {{{ */
+    const notification_t *n)
 {
-  program_list_t *pl = ((program_list_and_notification_t *) arg)->pl;
-  notification_t *n = &((program_list_and_notification_t *) arg)->n;
   notification_meta_t *meta;
-  int fd;
-  FILE *fh;
-  int pid;
-  int status;
   const char *severity;
 
-  pid = fork_child (pl, &fd, NULL, NULL);
-  if (pid < 0) {
-    sfree (arg);
-    pthread_exit ((void *) 1);
-  }
-
-  fh = fdopen (fd, "w");
-  if (fh == NULL)
-  {
-    char errbuf[1024];
-    ERROR ("exec plugin: fdopen (%i) failed: %s", fd,
-        sstrerror (errno, errbuf, sizeof (errbuf)));
-    kill (pl->pid, SIGTERM);
-    pl->pid = 0;
-    close (fd);
-    sfree (arg);
-    pthread_exit ((void *) 1);
-  }
-
   severity = "FAILURE";
   if (n->severity == NOTIF_WARNING)
     severity = "WARNING";
@@ -768,6 +964,45 @@ static void *exec_notification_one (void *arg) /* {{{ */
   }
 
   fprintf (fh, "\n%s\n", n->message);
+} /* }}} void exec_notification_print */
+
+static FILE *exec_notification_fork (program_list_t *pl, int *ret_pid) /* {{{ */
+{
+  int fd;
+  FILE *fh;
+  int pid;
+
+  pid = fork_child (pl, &fd, NULL, NULL);
+  if (pid < 0)
+    return (NULL);
+
+  fh = fdopen (fd, "w");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("exec plugin: fdopen (%i) failed: %s", fd,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    kill (pid, SIGTERM);
+    close (fd);
+    return (NULL);
+  }
+
+  *ret_pid = pid;
+  return (fh);
+} /* }}} FILE *exec_notification_fork */
+
+static void exec_notification_one (program_list_t *pl, /* {{{ */
+    const notification_t *n)
+{
+  FILE *fh;
+  int pid;
+  int status;
+
+  fh = exec_notification_fork (pl, &pid);
+  if (fh == NULL)
+    return;
+
+  exec_notification_print (fh, n);
 
   fflush (fh);
   fclose (fh);
@@ -776,35 +1011,155 @@ static void *exec_notification_one (void *arg) /* {{{ */
 
   DEBUG ("exec plugin: Child %i exited with status %i.",
       pid, status);
+} /* }}} void exec_notification_one */
+
+/* Writes the notification to the STDIN of the program, which is started if
+ * it isn't running. If the program has exited, it is started again once. */
+static void exec_notification_persistent (program_list_t *pl, /* {{{ */
+    const notification_t *n)
+{
+  int i;
+
+  pthread_mutex_lock (&pl->lock);
+
+  for (i = 0; i < 2; i++)
+  {
+    if (pl->fh == NULL)
+    {
+      int pid = 0;
+
+      pl->fh = exec_notification_fork (pl, &pid);
+      if (pl->fh == NULL)
+        break;
+      pl->pid = pid;
+    }
+
+    exec_notification_print (pl->fh, n);
+    if ((fflush (pl->fh) == 0) && !ferror (pl->fh))
+      break;
+
+    INFO ("exec plugin: Writing to `%s' failed, restarting it.", pl->exec);
+    fclose (pl->fh);
+    pl->fh = NULL;
+    waitpid (pl->pid, &pl->status, WNOHANG);
+    pl->pid = 0;
+  }
+
+  pthread_mutex_unlock (&pl->lock);
+} /* }}} void exec_notification_persistent */
+
+static void *exec_notification_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  pthread_mutex_lock (&notif_queue_lock);
+  while (!notif_threads_stop)
+  {
+    program_list_and_notification_t *pln;
+
+    if (notif_queue_head == NULL)
+    {
+      pthread_cond_wait (&notif_queue_cond, &notif_queue_lock);
+      continue;
+    }
+
+    pln = notif_queue_head;
+    notif_queue_head = pln->next;
+    if (notif_queue_head == NULL)
+      notif_queue_tail = NULL;
+    notif_queue_length--;
+    pthread_mutex_unlock (&notif_queue_lock);
+
+    if ((pln->pl->flags & PL_PERSISTENT) != 0)
+      exec_notification_persistent (pln->pl, &pln->n);
+    else
+      exec_notification_one (pln->pl, &pln->n);
+
+    if (pln->n.meta != NULL)
+      plugin_notification_meta_free (pln->n.meta);
+    sfree (pln);
+
+    pthread_mutex_lock (&notif_queue_lock);
+  }
+  pthread_mutex_unlock (&notif_queue_lock);
 
-  if (n->meta != NULL)
-    plugin_notification_meta_free (n->meta);
-  n->meta = NULL;
-  sfree (arg);
-  pthread_exit ((void *) 0);
-  return (NULL);
-} /* void *exec_notification_one }}} */
+  return ((void *) 0);
+} /* }}} void *exec_notification_thread */
 
 static int exec_init (void) /* {{{ */
 {
   struct sigaction sa;
+  program_list_t *pl;
+  _Bool have_normal = 0;
+  _Bool have_notif = 0;
+  int status;
 
   memset (&sa, '\0', sizeof (sa));
   sa.sa_handler = sigchld_handler;
   sigaction (SIGCHLD, &sa, NULL);
 
+  for (pl = pl_head; pl != NULL; pl = pl->next)
+  {
+    if ((pl->flags & PL_NORMAL) != 0)
+      have_normal = 1;
+    if ((pl->flags & PL_NOTIF_ACTION) != 0)
+      have_notif = 1;
+  }
+
+  if (have_normal && !loop_thread_running)
+  {
+    if (pipe (loop_wakeup) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("exec plugin: pipe failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    exec_set_nonblocking (loop_wakeup[0]);
+    exec_set_nonblocking (loop_wakeup[1]);
+
+    loop_thread_running = 1;
+    status = pthread_create (&loop_thread, /* attr = */ NULL,
+        exec_loop, /* arg = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("exec plugin: pthread_create failed with status %i.", status);
+      loop_thread_running = 0;
+      return (-1);
+    }
+  }
+
+  if (have_notif && (notif_threads == NULL))
+  {
+    notif_threads = calloc ((size_t) notif_threads_max,
+        sizeof (*notif_threads));
+    if (notif_threads == NULL)
+    {
+      ERROR ("exec plugin: calloc failed.");
+      return (-1);
+    }
+
+    for (notif_threads_num = 0; notif_threads_num < notif_threads_max;
+        notif_threads_num++)
+    {
+      status = pthread_create (notif_threads + notif_threads_num,
+          /* attr = */ NULL, exec_notification_thread, /* arg = */ NULL);
+      if (status != 0)
+      {
+        ERROR ("exec plugin: pthread_create failed with status %i.", status);
+        break;
+      }
+    }
+  }
+
   return (0);
 } /* int exec_init }}} */
 
 static int exec_read (void) /* {{{ */
 {
   program_list_t *pl;
+  _Bool wakeup = 0;
 
   for (pl = pl_head; pl != NULL; pl = pl->next)
   {
-    pthread_t t;
-    pthread_attr_t attr;
-
     /* Only execute `normal' style executables here. */
     if ((pl->flags & PL_NORMAL) == 0)
       continue;
@@ -819,11 +1174,18 @@ static int exec_read (void) /* {{{ */
     pl->flags |= PL_RUNNING;
     pthread_mutex_unlock (&pl_lock);
 
-    pthread_attr_init (&attr);
-    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create (&t, &attr, exec_read_one, (void *) pl);
+    wakeup = 1;
   } /* for (pl) */
 
+  /* The `exec_loop' thread starts the programs. */
+  if (wakeup && (write (loop_wakeup[1], "", 1) < 0) && (errno != EAGAIN))
+  {
+    char errbuf[1024];
+    ERROR ("exec plugin: Waking up the exec thread failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
   return (0);
 } /* int exec_read }}} */
 
@@ -835,17 +1197,10 @@ static int exec_notification (const notification_t *n, /* {{{ */
 
   for (pl = pl_head; pl != NULL; pl = pl->next)
   {
-    pthread_t t;
-    pthread_attr_t attr;
-
     /* Only execute `notification' style executables here. */
     if ((pl->flags & PL_NOTIF_ACTION) == 0)
       continue;
 
-    /* Skip if a child is already running. */
-    if (pl->pid != 0)
-      continue;
-
     pln = (program_list_and_notification_t *) malloc (sizeof
         (program_list_and_notification_t));
     if (pln == NULL)
@@ -856,15 +1211,35 @@ static int exec_notification (const notification_t *n, /* {{{ */
 
     pln->pl = pl;
     memcpy (&pln->n, n, sizeof (notification_t));
+    pln->next = NULL;
 
     /* Set the `meta' member to NULL, otherwise `plugin_notification_meta_copy'
      * will run into an endless loop. */
     pln->n.meta = NULL;
     plugin_notification_meta_copy (&pln->n, n);
 
-    pthread_attr_init (&attr);
-    pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
-    pthread_create (&t, &attr, exec_notification_one, (void *) pln);
+    pthread_mutex_lock (&notif_queue_lock);
+    if ((notif_threads_num == 0)
+        || (notif_queue_length >= EXEC_NOTIF_QUEUE_MAX))
+    {
+      pthread_mutex_unlock (&notif_queue_lock);
+      WARNING ("exec plugin: Too many pending notifications, not passing "
+          "this one to `%s'.", pl->exec);
+      if (pln->n.meta != NULL)
+        plugin_notification_meta_free (pln->n.meta);
+      sfree (pln);
+      continue;
+    }
+
+    if (notif_queue_tail == NULL)
+      notif_queue_head = pln;
+    else
+      notif_queue_tail->next = pln;
+    notif_queue_tail = pln;
+    notif_queue_length++;
+
+    pthread_cond_signal (&notif_queue_cond);
+    pthread_mutex_unlock (&notif_queue_lock);
   } /* for (pl) */
 
   return (0);
@@ -874,18 +1249,66 @@ static int exec_shutdown (void) /* {{{ */
 {
   program_list_t *pl;
   program_list_t *next;
+  int i;
+
+  /* Notifications still queued are not passed on: a program which doesn't
+   * exit would block the shutdown. */
+  pthread_mutex_lock (&notif_queue_lock);
+  notif_threads_stop = 1;
+  pthread_cond_broadcast (&notif_queue_cond);
+  pthread_mutex_unlock (&notif_queue_lock);
+  for (i = 0; i < notif_threads_num; i++)
+    pthread_join (notif_threads[i], /* retval = */ NULL);
+  notif_threads_num = 0;
+  sfree (notif_threads);
+
+  while (notif_queue_head != NULL)
+  {
+    program_list_and_notification_t *pln = notif_queue_head;
+
+    notif_queue_head = pln->next;
+    if (pln->n.meta != NULL)
+      plugin_notification_meta_free (pln->n.meta);
+    sfree (pln);
+  }
+  notif_queue_tail = NULL;
+  notif_queue_length = 0;
+
+  if (loop_thread_running)
+  {
+    loop_thread_running = 0;
+    if (write (loop_wakeup[1], "", 1) < 0)
+      WARNING ("exec plugin: Waking up the exec thread failed.");
+    pthread_join (loop_thread, /* retval = */ NULL);
+    close (loop_wakeup[0]);
+    close (loop_wakeup[1]);
+    loop_wakeup[0] = loop_wakeup[1] = -1;
+  }
 
   pl = pl_head;
   while (pl != NULL)
   {
     next = pl->next;
 
+    /* Persistent notification programs exit when their STDIN is closed. */
+    if (pl->fh != NULL)
+      fclose (pl->fh);
+
     if (pl->pid > 0)
     {
       kill (pl->pid, SIGTERM);
       INFO ("exec plugin: Sent SIGTERM to %hu", (unsigned short int) pl->pid);
     }
 
+    if (pl->fd_out >= 0)
+      close (pl->fd_out);
+    if (pl->fd_err >= 0)
+      close (pl->fd_err);
+    putval_batch_destroy (pl->batch);
+    sfree (pl->buffer);
+    sfree (pl->buffer_err);
+    pthread_mutex_destroy (&pl->lock);
+
     sfree (pl->user);
     sfree (pl);
 
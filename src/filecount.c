@@ -24,6 +24,8 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"       
+#include "configfile.h"
+#include "utils_avltree.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +35,32 @@
 
 #define FC_RECURSIVE 1
 #define FC_HIDDEN 2
+#define FC_INCREMENTAL 4
+
+/* With `IncrementalScan' enabled, the directory tree is kept in memory. Each
+ * node holds the counters of the files directly within one directory, which
+ * are only recounted after the directory's modification or change time has
+ * changed. */
+struct fc_node_s;
+typedef struct fc_node_s fc_node_t;
+struct fc_node_s
+{
+  char *name;
+
+  time_t mtime;
+  time_t ctime;
+  dev_t  dev;
+  ino_t  ino;
+  /* The directory may have been changed after it has been read, within the
+   * same second. */
+  _Bool  racy;
+
+  uint64_t files_num;
+  uint64_t files_size;
+
+  /* Subdirectories, name -> fc_node_t. */
+  c_avl_tree_t *children;
+};
 
 struct fc_directory_conf_s
 {
@@ -50,6 +78,11 @@ struct fc_directory_conf_s
   int64_t mtime;
   int64_t size;
 
+  /* Incremental scans */
+  int full_scan_interval;
+  time_t last_full_scan;
+  fc_node_t *root;
+
   /* Helper for the recursive functions */
   time_t now;
 };
@@ -88,6 +121,8 @@ static void fc_submit_dir (const fc_directory_conf_t *dir)
  *     Name "*.conf"
  *     MTime -3600
  *     Size "+10M"
+ *     IncrementalScan true
+ *     FullScanInterval 3600
  *   </Directory>
  * </Plugin>
  *
@@ -367,6 +402,8 @@ static int fc_config_add_dir (oconfig_item_t *ci)
   dir->mtime = 0;
   dir->size = 0;
 
+  dir->full_scan_interval = 3600;
+
   status = 0;
   for (i = 0; i < ci->children_num; i++)
   {
@@ -384,6 +421,10 @@ static int fc_config_add_dir (oconfig_item_t *ci)
       status = fc_config_add_dir_option (dir, option, FC_RECURSIVE);
     else if (strcasecmp ("IncludeHidden", option->key) == 0)
       status = fc_config_add_dir_option (dir, option, FC_HIDDEN);
+    else if (strcasecmp ("IncrementalScan", option->key) == 0)
+      status = fc_config_add_dir_option (dir, option, FC_INCREMENTAL);
+    else if (strcasecmp ("FullScanInterval", option->key) == 0)
+      status = cf_util_get_int (option, &dir->full_scan_interval);
     else
     {
       WARNING ("filecount plugin: fc_config_add_dir: "
@@ -395,6 +436,16 @@ static int fc_config_add_dir (oconfig_item_t *ci)
       break;
   } /* for (ci->children) */
 
+  /* Whether a file matches `MTime' changes as time passes, not only when
+   * the directory is modified. */
+  if ((status == 0) && (dir->options & FC_INCREMENTAL) && (dir->mtime != 0))
+  {
+    WARNING ("filecount plugin: `IncrementalScan' cannot be combined with "
+        "`MTime'. Directory `%s' will be scanned completely each "
+        "interval.", dir->path);
+    dir->options &= ~FC_INCREMENTAL;
+  }
+
   if (status == 0)
   {
     fc_directory_conf_t **temp;
@@ -456,6 +507,55 @@ static int fc_init (void)
   return (0);
 } /* int fc_init */
 
+/* Returns true if the regular file `filename' is selected by the `Name',
+ * `MTime' and `Size' options. */
+static _Bool fc_file_matches (const fc_directory_conf_t *dir,
+    const char *filename, const struct stat *statbuf)
+{
+  int status;
+
+  if (dir->name != NULL)
+  {
+    status = fnmatch (dir->name, filename, /* flags = */ 0);
+    if (status != 0)
+      return (0);
+  }
+
+  if (dir->mtime != 0)
+  {
+    time_t mtime = dir->now;
+
+    if (dir->mtime < 0)
+      mtime += dir->mtime;
+    else
+      mtime -= dir->mtime;
+
+    DEBUG ("filecount plugin: Only collecting files that were touched %s %u.",
+        (dir->mtime < 0) ? "after" : "before",
+        (unsigned int) mtime);
+
+    if (((dir->mtime < 0) && (statbuf->st_mtime < mtime))
+        || ((dir->mtime > 0) && (statbuf->st_mtime > mtime)))
+      return (0);
+  }
+
+  if (dir->size != 0)
+  {
+    off_t size;
+
+    if (dir->size < 0)
+      size = (off_t) ((-1) * dir->size);
+    else
+      size = (off_t) dir->size;
+
+    if (((dir->size < 0) && (statbuf->st_size > size))
+        || ((dir->size > 0) && (statbuf->st_size < size)))
+      return (0);
+  }
+
+  return (1);
+} /* _Bool fc_file_matches */
+
 static int fc_read_dir_callback (const char *dirname, const char *filename,
     void *user_data)
 {
@@ -487,50 +587,248 @@ static int fc_read_dir_callback (const char *dirname, const char *filename,
     return (0);
   }
 
-  if (dir->name != NULL)
+  if (!fc_file_matches (dir, filename, &statbuf))
+    return (0);
+
+  dir->files_num++;
+  dir->files_size += (uint64_t) statbuf.st_size;
+
+  return (0);
+} /* int fc_read_dir_callback */
+
+static void fc_node_free (fc_node_t *node)
+{
+  void *key;
+  void *value;
+
+  if (node == NULL)
+    return;
+
+  if (node->children != NULL)
   {
-    status = fnmatch (dir->name, filename, /* flags = */ 0);
-    if (status != 0)
-      return (0);
+    while (c_avl_pick (node->children, &key, &value) == 0)
+      fc_node_free (value);
+    c_avl_destroy (node->children);
   }
 
-  if (dir->mtime != 0)
+  sfree (node->name);
+  sfree (node);
+} /* void fc_node_free */
+
+static fc_node_t *fc_node_create (const char *name)
+{
+  fc_node_t *node;
+
+  node = (fc_node_t *) malloc (sizeof (*node));
+  if (node == NULL)
+    return (NULL);
+  memset (node, 0, sizeof (*node));
+
+  node->name = strdup (name);
+  node->children = c_avl_create ((void *) strcmp);
+  if ((node->name == NULL) || (node->children == NULL))
   {
-    time_t mtime = dir->now;
+    fc_node_free (node);
+    return (NULL);
+  }
 
-    if (dir->mtime < 0)
-      mtime += dir->mtime;
-    else
-      mtime -= dir->mtime;
+  return (node);
+} /* fc_node_t *fc_node_create */
 
-    DEBUG ("filecount plugin: Only collecting files that were touched %s %u.",
-        (dir->mtime < 0) ? "after" : "before",
-        (unsigned int) mtime);
+struct fc_node_walk_s
+{
+  fc_directory_conf_t *dir;
+  fc_node_t *node;
+  c_avl_tree_t *old_children;
+  _Bool full;
+};
+typedef struct fc_node_walk_s fc_node_walk_t;
 
-    if (((dir->mtime < 0) && (statbuf.st_mtime < mtime))
-        || ((dir->mtime > 0) && (statbuf.st_mtime > mtime)))
-      return (0);
+static int fc_node_update (fc_directory_conf_t *dir, fc_node_t *node,
+    const char *path, const struct stat *statbuf, _Bool full);
+
+static int fc_node_walk_callback (const char *dirname, const char *filename,
+    void *user_data)
+{
+  fc_node_walk_t *walk = user_data;
+  fc_directory_conf_t *dir = walk->dir;
+  char abs_path[PATH_MAX];
+  struct stat statbuf;
+  int status;
+
+  ssnprintf (abs_path, sizeof (abs_path), "%s/%s", dirname, filename);
+
+  status = lstat (abs_path, &statbuf);
+  if (status != 0)
+  {
+    ERROR ("filecount plugin: stat (%s) failed.", abs_path);
+    return (-1);
   }
 
-  if (dir->size != 0)
+  if (S_ISDIR (statbuf.st_mode) && (dir->options & FC_RECURSIVE))
   {
-    off_t size;
+    fc_node_t *child = NULL;
+    char *key = NULL;
 
-    if (dir->size < 0)
-      size = (off_t) ((-1) * dir->size);
-    else
-      size = (off_t) dir->size;
+    /* Subdirectories which still exist keep their counters. */
+    if (c_avl_remove (walk->old_children, filename,
+          (void *) &key, (void *) &child) != 0)
+    {
+      child = fc_node_create (filename);
+      if (child == NULL)
+      {
+        ERROR ("filecount plugin: fc_node_create failed.");
+        return (-1);
+      }
+    }
 
-    if (((dir->size < 0) && (statbuf.st_size > size))
-        || ((dir->size > 0) && (statbuf.st_size < size)))
-      return (0);
+    if (c_avl_insert (walk->node->children, child->name, child) != 0)
+    {
+      ERROR ("filecount plugin: c_avl_insert failed.");
+      fc_node_free (child);
+      return (-1);
+    }
+
+    return (fc_node_update (dir, child, abs_path, &statbuf, walk->full));
+  }
+  else if (!S_ISREG (statbuf.st_mode))
+  {
+    return (0);
   }
 
-  dir->files_num++;
-  dir->files_size += (uint64_t) statbuf.st_size;
+  if (!fc_file_matches (dir, filename, &statbuf))
+    return (0);
+
+  walk->node->files_num++;
+  walk->node->files_size += (uint64_t) statbuf.st_size;
 
   return (0);
-} /* int fc_read_dir_callback */
+} /* int fc_node_walk_callback */
+
+/* Brings the counters of `node' and its subdirectories up to date and adds
+ * them to the directory's counters. Only directories which have changed
+ * since they were read last are read again, the others are only stat'ed. */
+static int fc_node_update (fc_directory_conf_t *dir, fc_node_t *node,
+    const char *path, const struct stat *statbuf, _Bool full)
+{
+  int status = 0;
+
+  if (full || node->racy
+      || (node->mtime != statbuf->st_mtime)
+      || (node->ctime != statbuf->st_ctime)
+      || (node->dev != statbuf->st_dev)
+      || (node->ino != statbuf->st_ino))
+  {
+    fc_node_walk_t walk;
+    void *key;
+    void *value;
+
+    memset (&walk, 0, sizeof (walk));
+    walk.dir = dir;
+    walk.node = node;
+    walk.old_children = node->children;
+    walk.full = full;
+
+    node->children = c_avl_create ((void *) strcmp);
+    if (node->children == NULL)
+    {
+      ERROR ("filecount plugin: c_avl_create failed.");
+      node->children = walk.old_children;
+      return (-1);
+    }
+
+    node->files_num = 0;
+    node->files_size = 0;
+
+    status = walk_directory (path, fc_node_walk_callback, &walk,
+        /* include hidden = */ (dir->options & FC_HIDDEN) ? 1 : 0);
+
+    /* Whatever is left has been removed. */
+    while (c_avl_pick (walk.old_children, &key, &value) == 0)
+      fc_node_free (value);
+    c_avl_destroy (walk.old_children);
+
+    node->mtime = statbuf->st_mtime;
+    node->ctime = statbuf->st_ctime;
+    node->dev = statbuf->st_dev;
+    node->ino = statbuf->st_ino;
+    /* Time stamps have a resolution of one second, so changes made later in
+     * the second the directory has been stat'ed in are read next time. A
+     * failed read is retried, too. */
+    node->racy = (status != 0)
+      || (statbuf->st_mtime >= dir->now) || (statbuf->st_ctime >= dir->now);
+  }
+  else
+  {
+    c_avl_iterator_t iter;
+    char *name;
+    fc_node_t *child;
+
+    c_avl_iterator_init (&iter, node->children);
+    while (c_avl_iterator_next (&iter, (void *) &name, (void *) &child) == 0)
+    {
+      char abs_path[PATH_MAX];
+      struct stat child_statbuf;
+
+      ssnprintf (abs_path, sizeof (abs_path), "%s/%s", path, name);
+
+      /* Removing the subdirectory changes this directory's mtime, so it will
+       * be dropped with the next update. */
+      if ((lstat (abs_path, &child_statbuf) != 0)
+          || !S_ISDIR (child_statbuf.st_mode))
+      {
+        node->racy = 1;
+        continue;
+      }
+
+      /* Failed directories are retried with the next update, like
+       * `walk_directory' the update only fails if nothing could be read. */
+      fc_node_update (dir, child, abs_path, &child_statbuf, full);
+    }
+  }
+
+  dir->files_num += node->files_num;
+  dir->files_size += node->files_size;
+
+  return (status);
+} /* int fc_node_update */
+
+static int fc_read_dir_incremental (fc_directory_conf_t *dir)
+{
+  struct stat statbuf;
+  _Bool full = 0;
+  int status;
+
+  if (dir->root == NULL)
+  {
+    dir->root = fc_node_create (dir->path);
+    if (dir->root == NULL)
+    {
+      ERROR ("filecount plugin: fc_node_create failed.");
+      return (-1);
+    }
+  }
+
+  if ((dir->full_scan_interval > 0)
+      && ((dir->now - dir->last_full_scan) >= dir->full_scan_interval))
+  {
+    full = 1;
+    dir->last_full_scan = dir->now;
+  }
+
+  status = stat (dir->path, &statbuf);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    WARNING ("filecount plugin: stat (%s) failed: %s", dir->path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    fc_node_free (dir->root);
+    dir->root = NULL;
+    return (-1);
+  }
+
+  return (fc_node_update (dir, dir->root, dir->path, &statbuf, full));
+} /* int fc_read_dir_incremental */
 
 static int fc_read_dir (fc_directory_conf_t *dir)
 {
@@ -539,11 +837,14 @@ static int fc_read_dir (fc_directory_conf_t *dir)
   dir->files_num = 0;
   dir->files_size = 0;
 
-  if (dir->mtime != 0)
+  if ((dir->mtime != 0) || (dir->options & FC_INCREMENTAL))
     dir->now = time (NULL);
     
-  status = walk_directory (dir->path, fc_read_dir_callback, dir,
-      /* include hidden */ (dir->options & FC_HIDDEN) ? 1 : 0);
+  if (dir->options & FC_INCREMENTAL)
+    status = fc_read_dir_incremental (dir);
+  else
+    status = walk_directory (dir->path, fc_read_dir_callback, dir,
+        /* include hidden */ (dir->options & FC_HIDDEN) ? 1 : 0);
   if (status != 0)
   {
     WARNING ("filecount plugin: walk_directory (%s) failed.", dir->path);
@@ -25,6 +25,10 @@
 #include "utils_complain.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_avltree.h"
+#include "utils_probes.h"
+
+#include <pthread.h>
 
 /*
  * Data types
@@ -38,6 +42,7 @@ struct fc_match_s
   char name[DATA_MAX_NAME_LEN];
   match_proc_t proc;
   void *user_data;
+  fc_stats_t stats;
   fc_match_t *next;
 }; /* }}} */
 
@@ -50,6 +55,7 @@ struct fc_target_s
   char name[DATA_MAX_NAME_LEN];
   void *user_data;
   target_proc_t proc;
+  fc_stats_t stats;
   fc_target_t *next;
 }; /* }}} */
 
@@ -61,9 +67,19 @@ struct fc_rule_s
   char name[DATA_MAX_NAME_LEN];
   fc_match_t  *matches;
   fc_target_t *targets;
+  size_t index; /* position within the chain */
+  fc_stats_t stats;
   fc_rule_t *next;
 }; /* }}} */
 
+/* Array of rules, ordered by their position within the chain. */
+struct fc_rule_list_s /* {{{ */
+{
+  fc_rule_t **rules;
+  size_t rules_num;
+}; /* }}} */
+typedef struct fc_rule_list_s fc_rule_list_t;
+
 /* List of chains, used for `chain_list_head' */
 struct fc_chain_s /* {{{ */
 {
@@ -71,6 +87,21 @@ struct fc_chain_s /* {{{ */
   fc_rule_t   *rules;
   fc_target_t *targets;
   fc_chain_t  *next;
+
+  /* Rule index, built by `fc_chain_compile'. Rules whose leading matches
+   * require a fixed plugin are stored in `by_plugin', rules requiring only a
+   * fixed type in `by_type', all others in `unindexed'. A value list only
+   * needs to be tested against the rules found for its plugin and type. If
+   * `indexed' is false, all rules are tested one after another. */
+  _Bool indexed;
+  c_avl_tree_t *by_plugin;
+  c_avl_tree_t *by_type;
+  fc_rule_list_t unindexed;
+
+  /* Statistics of the chain and all its rules, matches and targets. Only
+   * updated if `fc_stats_enabled' is true. */
+  fc_stats_t stats;
+  pthread_mutex_t stats_lock;
 }; /* }}} */
 
 /*
@@ -80,6 +111,8 @@ static fc_match_t  *match_list_head;
 static fc_target_t *target_list_head;
 static fc_chain_t  *chain_list_head;
 
+static _Bool fc_stats_enabled = 0;
+
 /*
  * Private functions
  */
@@ -137,13 +170,35 @@ static void fc_free_rules (fc_rule_t *r) /* {{{ */
   free (r);
 } /* }}} void fc_free_rules */
 
+static void fc_free_index (c_avl_tree_t *tree) /* {{{ */
+{
+  char *key;
+  fc_rule_list_t *list;
+
+  if (tree == NULL)
+    return;
+
+  while (c_avl_pick (tree, (void *) &key, (void *) &list) == 0)
+  {
+    free (key);
+    free (list->rules);
+    free (list);
+  }
+  c_avl_destroy (tree);
+} /* }}} void fc_free_index */
+
 static void fc_free_chains (fc_chain_t *c) /* {{{ */
 {
   if (c == NULL)
     return;
 
+  fc_free_index (c->by_plugin);
+  fc_free_index (c->by_type);
+  free (c->unindexed.rules);
+
   fc_free_rules (c->rules);
   fc_free_targets (c->targets);
+  pthread_mutex_destroy (&c->stats_lock);
 
   if (c->next != NULL)
     fc_free_chains (c->next);
@@ -190,6 +245,49 @@ static char *fc_strdup (const char *orig) /* {{{ */
  *    </Target>
  *  </Chain>
  */
+/* Returns the registered match `name'. If it isn't registered yet, the
+ * plugin providing it is loaded if its loading has been deferred. */
+static fc_match_t *fc_find_match (const char *name) /* {{{ */
+{
+  char plugin[DATA_MAX_NAME_LEN];
+  fc_match_t *ptr;
+
+  for (ptr = match_list_head; ptr != NULL; ptr = ptr->next)
+    if (strcasecmp (ptr->name, name) == 0)
+      return (ptr);
+
+  ssnprintf (plugin, sizeof (plugin), "match_%s", name);
+  if (plugin_load_pending (plugin) != 0)
+    return (NULL);
+
+  for (ptr = match_list_head; ptr != NULL; ptr = ptr->next)
+    if (strcasecmp (ptr->name, name) == 0)
+      return (ptr);
+
+  return (NULL);
+} /* }}} fc_match_t *fc_find_match */
+
+/* Like `fc_find_match', for targets. */
+static fc_target_t *fc_find_target (const char *name) /* {{{ */
+{
+  char plugin[DATA_MAX_NAME_LEN];
+  fc_target_t *ptr;
+
+  for (ptr = target_list_head; ptr != NULL; ptr = ptr->next)
+    if (strcasecmp (ptr->name, name) == 0)
+      return (ptr);
+
+  ssnprintf (plugin, sizeof (plugin), "target_%s", name);
+  if (plugin_load_pending (plugin) != 0)
+    return (NULL);
+
+  for (ptr = target_list_head; ptr != NULL; ptr = ptr->next)
+    if (strcasecmp (ptr->name, name) == 0)
+      return (ptr);
+
+  return (NULL);
+} /* }}} fc_target_t *fc_find_target */
+
 static int fc_config_add_match (fc_match_t **matches_head, /* {{{ */
     oconfig_item_t *ci)
 {
@@ -205,14 +303,7 @@ static int fc_config_add_match (fc_match_t **matches_head, /* {{{ */
     return (-1);
   }
 
-  ptr = match_list_head;
-  while (ptr != NULL)
-  {
-    if (strcasecmp (ptr->name, ci->values[0].value.string) == 0)
-      break;
-    ptr = ptr->next;
-  }
-
+  ptr = fc_find_match (ci->values[0].value.string);
   if (ptr == NULL)
   {
     WARNING ("Filter subsystem: Cannot find a \"%s\" match. "
@@ -277,14 +368,7 @@ static int fc_config_add_target (fc_target_t **targets_head, /* {{{ */
     return (-1);
   }
 
-  ptr = target_list_head;
-  while (ptr != NULL)
-  {
-    if (strcasecmp (ptr->name, ci->values[0].value.string) == 0)
-      break;
-    ptr = ptr->next;
-  }
-
+  ptr = fc_find_target (ci->values[0].value.string);
   if (ptr == NULL)
   {
     WARNING ("Filter subsystem: Cannot find a \"%s\" target. "
@@ -433,6 +517,141 @@ static int fc_config_add_rule (fc_chain_t *chain, /* {{{ */
   return (0);
 } /* }}} int fc_config_add_rule */
 
+static int fc_rule_list_append (fc_rule_list_t *list, /* {{{ */
+    fc_rule_t *rule)
+{
+  fc_rule_t **tmp;
+
+  tmp = realloc (list->rules, (list->rules_num + 1) * sizeof (*list->rules));
+  if (tmp == NULL)
+    return (-1);
+
+  list->rules = tmp;
+  list->rules[list->rules_num] = rule;
+  list->rules_num++;
+
+  return (0);
+} /* }}} int fc_rule_list_append */
+
+static int fc_index_add (c_avl_tree_t *tree, const char *key, /* {{{ */
+    fc_rule_t *rule)
+{
+  fc_rule_list_t *list = NULL;
+  char *key_copy;
+
+  if (c_avl_get (tree, key, (void *) &list) == 0)
+    return (fc_rule_list_append (list, rule));
+
+  list = malloc (sizeof (*list));
+  key_copy = fc_strdup (key);
+  if ((list == NULL) || (key_copy == NULL))
+  {
+    free (list);
+    free (key_copy);
+    return (-1);
+  }
+  memset (list, 0, sizeof (*list));
+
+  if ((fc_rule_list_append (list, rule) != 0)
+      || (c_avl_insert (tree, key_copy, list) != 0))
+  {
+    free (list->rules);
+    free (list);
+    free (key_copy);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int fc_index_add */
+
+/* Collects the plugin and type required by the leading matches of `rule'.
+ * Only leading matches are considered: the matches of a rule are tested in
+ * order and testing stops at the first one which doesn't match, so skipping
+ * a rule because of them doesn't change which matches are called. */
+static void fc_rule_literals (const fc_rule_t *rule, /* {{{ */
+    char *plugin, size_t plugin_size, char *type, size_t type_size)
+{
+  fc_match_t *m;
+
+  plugin[0] = 0;
+  type[0] = 0;
+
+  for (m = rule->matches; m != NULL; m = m->next)
+  {
+    char m_plugin[DATA_MAX_NAME_LEN] = "";
+    char m_type[DATA_MAX_NAME_LEN] = "";
+
+    if (m->proc.literals == NULL)
+      break;
+
+    if ((*m->proc.literals) (&m->user_data, m_plugin, sizeof (m_plugin),
+          m_type, sizeof (m_type)) != 0)
+      break;
+
+    if ((plugin[0] == 0) && (m_plugin[0] != 0))
+      sstrncpy (plugin, m_plugin, plugin_size);
+    if ((type[0] == 0) && (m_type[0] != 0))
+      sstrncpy (type, m_type, type_size);
+  }
+} /* }}} void fc_rule_literals */
+
+/* Builds the rule index of `chain'. If that fails, the index is discarded and
+ * all rules are tested for every value list. */
+static void fc_chain_compile (fc_chain_t *chain) /* {{{ */
+{
+  fc_rule_t *rule;
+  size_t indexed_num = 0;
+  size_t index = 0;
+  int status = 0;
+
+  chain->by_plugin = c_avl_create ((void *) strcmp);
+  chain->by_type = c_avl_create ((void *) strcmp);
+  if ((chain->by_plugin == NULL) || (chain->by_type == NULL))
+    status = -1;
+
+  for (rule = chain->rules; (status == 0) && (rule != NULL);
+      rule = rule->next)
+  {
+    char plugin[DATA_MAX_NAME_LEN];
+    char type[DATA_MAX_NAME_LEN];
+
+    rule->index = index;
+    index++;
+
+    fc_rule_literals (rule, plugin, sizeof (plugin), type, sizeof (type));
+
+    if (plugin[0] != 0)
+      status = fc_index_add (chain->by_plugin, plugin, rule);
+    else if (type[0] != 0)
+      status = fc_index_add (chain->by_type, type, rule);
+    else
+      status = fc_rule_list_append (&chain->unindexed, rule);
+
+    if ((plugin[0] != 0) || (type[0] != 0))
+      indexed_num++;
+  }
+
+  if (status != 0)
+    ERROR ("Filter subsystem: Chain %s: Building the rule index failed. "
+        "All rules will be tested for every value.", chain->name);
+
+  if ((status == 0) && (indexed_num > 0))
+  {
+    DEBUG ("Filter subsystem: Chain %s: %zu of %zu rules are indexed.",
+        chain->name, indexed_num, index);
+    chain->indexed = 1;
+    return;
+  }
+
+  fc_free_index (chain->by_plugin);
+  fc_free_index (chain->by_type);
+  free (chain->unindexed.rules);
+  chain->by_plugin = NULL;
+  chain->by_type = NULL;
+  memset (&chain->unindexed, 0, sizeof (chain->unindexed));
+  chain->indexed = 0;
+} /* }}} void fc_chain_compile */
+
 static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
 {
   fc_chain_t *chain;
@@ -458,6 +677,7 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
   chain->rules = NULL;
   chain->targets = NULL;
   chain->next = NULL;
+  pthread_mutex_init (&chain->stats_lock, /* attr = */ NULL);
 
   for (i = 0; i < ci->children_num; i++)
   {
@@ -485,6 +705,8 @@ static int fc_config_add_chain (const oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
 
+  fc_chain_compile (chain);
+
   if (chain_list_head != NULL)
   {
     fc_chain_t *ptr;
@@ -604,12 +826,22 @@ static int fc_bit_return_invoke (const data_set_t __attribute__((unused)) *ds, /
   return (FC_TARGET_RETURN);
 } /* }}} int fc_bit_return_invoke */
 
+/* One `Plugin' of the built-in `write' target. The write callback is looked
+ * up once through `handle' rather than by name for each value list. The list
+ * is terminated by an entry whose `name' is NULL. */
+struct fc_writer_s
+{
+  char *name;
+  plugin_write_handle_t *handle;
+};
+typedef struct fc_writer_s fc_writer_t;
+
 static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
     void **user_data)
 {
   int i;
 
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   size_t plugin_list_len;
 
   plugin_list = NULL;
@@ -618,7 +850,7 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
   for (i = 0; i < ci->children_num; i++)
   {
     oconfig_item_t *child = ci->children + i;
-    char **temp;
+    fc_writer_t *temp;
     int j;
 
     if (strcasecmp ("Plugin", child->key) != 0)
@@ -631,6 +863,8 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
 
     for (j = 0; j < child->values_num; j++)
     {
+      fc_writer_t *writer;
+
       if (child->values[j].type != OCONFIG_TYPE_STRING)
       {
         ERROR ("Filter subsystem: Built-in target `write': "
@@ -638,7 +872,7 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
         continue;
       }
 
-      temp = (char **) realloc (plugin_list, (plugin_list_len + 2)
+      temp = (fc_writer_t *) realloc (plugin_list, (plugin_list_len + 2)
           * (sizeof (*plugin_list)));
       if (temp == NULL)
       {
@@ -646,15 +880,26 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
         continue;
       }
       plugin_list = temp;
+      memset (plugin_list + plugin_list_len, 0, 2 * sizeof (*plugin_list));
 
-      plugin_list[plugin_list_len] = fc_strdup (child->values[j].value.string);
-      if (plugin_list[plugin_list_len] == NULL)
+      writer = plugin_list + plugin_list_len;
+      writer->name = fc_strdup (child->values[j].value.string);
+      if (writer->name == NULL)
       {
         ERROR ("fc_bit_write_create: fc_strdup failed.");
         continue;
       }
+
+      /* The plugin may not have registered its write callback yet, so the
+       * handle looks it up when it is first used. */
+      writer->handle = plugin_write_handle_create (writer->name);
+      if (writer->handle == NULL)
+      {
+        ERROR ("fc_bit_write_create: plugin_write_handle_create failed.");
+        sfree (writer->name);
+        continue;
+      }
       plugin_list_len++;
-      plugin_list[plugin_list_len] = NULL;
     } /* for (j = 0; j < child->values_num; j++) */
   } /* for (i = 0; i < ci->children_num; i++) */
 
@@ -665,7 +910,7 @@ static int fc_bit_write_create (const oconfig_item_t *ci, /* {{{ */
 
 static int fc_bit_write_destroy (void **user_data) /* {{{ */
 {
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   size_t i;
 
   if ((user_data == NULL) || (*user_data == NULL))
@@ -673,8 +918,11 @@ static int fc_bit_write_destroy (void **user_data) /* {{{ */
 
   plugin_list = *user_data;
 
-  for (i = 0; plugin_list[i] != NULL; i++)
-    free (plugin_list[i]);
+  for (i = 0; plugin_list[i].name != NULL; i++)
+  {
+    free (plugin_list[i].name);
+    plugin_write_handle_destroy (plugin_list[i].handle);
+  }
   free (plugin_list);
 
   return (0);
@@ -684,14 +932,14 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
     value_list_t *vl, notification_meta_t __attribute__((unused)) **meta,
     void **user_data)
 {
-  char **plugin_list;
+  fc_writer_t *plugin_list;
   int status;
 
   plugin_list = NULL;
   if (user_data != NULL)
     plugin_list = *user_data;
 
-  if ((plugin_list == NULL) || (plugin_list[0] == NULL))
+  if ((plugin_list == NULL) || (plugin_list[0].name == NULL))
   {
     static c_complain_t enoent_complaint = C_COMPLAIN_INIT_STATIC;
 
@@ -723,15 +971,16 @@ static int fc_bit_write_invoke (const data_set_t *ds, /* {{{ */
   {
     size_t i;
 
-    for (i = 0; plugin_list[i] != NULL; i++)
+    for (i = 0; plugin_list[i].name != NULL; i++)
     {
-      status = plugin_write (plugin_list[i], ds, vl);
+      status = plugin_write_handle (plugin_list[i].handle, ds, vl);
       if (status != 0)
       {
         INFO ("Filter subsystem: Built-in target `write': Dispatching value to "
-            "the `%s' plugin failed with status %i.", plugin_list[i], status);
+            "the `%s' plugin failed with status %i.", plugin_list[i].name,
+            status);
       }
-    } /* for (i = 0; plugin_list[i] != NULL; i++) */
+    } /* for (i = 0; plugin_list[i].name != NULL; i++) */
   }
 
   return (FC_TARGET_CONTINUE);
@@ -858,110 +1107,260 @@ fc_chain_t *fc_chain_get_by_name (const char *chain_name) /* {{{ */
   return (NULL);
 } /* }}} int fc_chain_get_by_name */
 
-int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
-    fc_chain_t *chain)
+static uint64_t fc_time_ns (void) /* {{{ */
 {
-  fc_rule_t *rule;
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+    return (0);
+
+  return (((uint64_t) ts.tv_sec) * 1000000000 + ((uint64_t) ts.tv_nsec));
+} /* }}} uint64_t fc_time_ns */
+
+/* Accounts one invocation which started at `start'. */
+static void fc_stats_add (fc_chain_t *chain, fc_stats_t *stats, /* {{{ */
+    _Bool matched, uint64_t start)
+{
+  uint64_t now = fc_time_ns ();
+
+  pthread_mutex_lock (&chain->stats_lock);
+  stats->invocations++;
+  if (matched)
+    stats->matches++;
+  if (now > start)
+    stats->time_ns += now - start;
+  pthread_mutex_unlock (&chain->stats_lock);
+} /* }}} void fc_stats_add */
+
+/* Tests the matches of `rule' and executes its targets if all of them
+ * match. Returns FC_TARGET_STOP or FC_TARGET_RETURN if a target signaled
+ * that condition, FC_TARGET_CONTINUE otherwise. */
+static int fc_process_rule (const data_set_t *ds, value_list_t *vl, /* {{{ */
+    fc_chain_t *chain, fc_rule_t *rule)
+{
+  fc_match_t *match;
   fc_target_t *target;
+  uint64_t rule_start = 0;
+  uint64_t start = 0;
   int status;
 
-  if (chain == NULL)
-    return (-1);
+  if (rule->name[0] != 0)
+  {
+    DEBUG ("fc_process_chain (%s): Testing the `%s' rule.",
+        chain->name, rule->name);
+  }
 
-  DEBUG ("fc_process_chain (chain = %s);", chain->name);
+  if (fc_stats_enabled)
+    rule_start = fc_time_ns ();
 
-  status = FC_TARGET_CONTINUE;
-  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  /* N. B.: rule->matches may be NULL. */
+  for (match = rule->matches; match != NULL; match = match->next)
   {
-    fc_match_t *match;
-
-    if (rule->name[0] != 0)
+    if (fc_stats_enabled)
+      start = fc_time_ns ();
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    status = (*match->proc.match) (ds, vl, /* meta = */ NULL,
+        &match->user_data);
+    if (fc_stats_enabled)
+      fc_stats_add (chain, &match->stats,
+          (status == FC_MATCH_MATCHES), start);
+    if (status < 0)
     {
-      DEBUG ("fc_process_chain (%s): Testing the `%s' rule.",
-          chain->name, rule->name);
+      WARNING ("fc_process_chain (%s): A match failed.", chain->name);
+      break;
     }
+    else if (status != FC_MATCH_MATCHES)
+      break;
+  }
 
-    /* N. B.: rule->matches may be NULL. */
-    for (match = rule->matches; match != NULL; match = match->next)
-    {
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status = (*match->proc.match) (ds, vl, /* meta = */ NULL,
-          &match->user_data);
-      if (status < 0)
-      {
-        WARNING ("fc_process_chain (%s): A match failed.", chain->name);
-        break;
-      }
-      else if (status != FC_MATCH_MATCHES)
-        break;
-    }
+  /* for-loop has been aborted: Either error or no match. */
+  if (match != NULL)
+  {
+    if (fc_stats_enabled)
+      fc_stats_add (chain, &rule->stats, /* matched = */ 0, rule_start);
+    return (FC_TARGET_CONTINUE);
+  }
 
-    /* for-loop has been aborted: Either error or no match. */
-    if (match != NULL)
+  if (rule->name[0] != 0)
+  {
+    DEBUG ("fc_process_chain (%s): Rule `%s' matches.",
+        chain->name, rule->name);
+  }
+
+  status = FC_TARGET_CONTINUE;
+  for (target = rule->targets; target != NULL; target = target->next)
+  {
+    /* If we get here, all matches have matched the value. Execute the
+     * target. */
+    if (fc_stats_enabled)
+      start = fc_time_ns ();
+    /* FIXME: Pass the meta-data to match targets here (when implemented). */
+    status = (*target->proc.invoke) (ds, vl, /* meta = */ NULL,
+        &target->user_data);
+    /* The target may have changed the identifier. */
+    plugin_value_list_identifier_reset (vl);
+    if (fc_stats_enabled)
+      fc_stats_add (chain, &target->stats, /* matched = */ 0, start);
+    if (status < 0)
     {
-      status = FC_TARGET_CONTINUE;
+      WARNING ("fc_process_chain (%s): A target failed.", chain->name);
       continue;
     }
+    else if (status == FC_TARGET_CONTINUE)
+      continue;
+    else if (status == FC_TARGET_STOP)
+      break;
+    else if (status == FC_TARGET_RETURN)
+      break;
+    else
+    {
+      WARNING ("fc_process_chain (%s): Unknown return value "
+          "from target `%s': %i",
+          chain->name, target->name, status);
+    }
+  }
+
+  if (fc_stats_enabled)
+    fc_stats_add (chain, &rule->stats, /* matched = */ 1, rule_start);
 
+  if ((status == FC_TARGET_STOP)
+      || (status == FC_TARGET_RETURN))
+  {
     if (rule->name[0] != 0)
     {
-      DEBUG ("fc_process_chain (%s): Rule `%s' matches.",
-          chain->name, rule->name);
+      DEBUG ("fc_process_chain (%s): Rule `%s' signaled "
+          "the %s condition.",
+          chain->name, rule->name,
+          (status == FC_TARGET_STOP) ? "stop" : "return");
     }
+    return (status);
+  }
+
+  return (FC_TARGET_CONTINUE);
+} /* }}} int fc_process_rule */
+
+/* Looks up the rule lists for the value list's plugin and type. Each list
+ * starts at its first rule following the rule with index `after', or at its
+ * beginning if `first' is true. Returns the number of lists. */
+static size_t fc_index_lists (fc_chain_t *chain, /* {{{ */
+    const value_list_t *vl, fc_rule_list_t **lists, size_t *pos,
+    _Bool first, size_t after)
+{
+  fc_rule_list_t *list;
+  size_t lists_num = 0;
+  size_t i;
+
+  if (chain->unindexed.rules_num > 0)
+    lists[lists_num++] = &chain->unindexed;
+  if (c_avl_get (chain->by_plugin, vl->plugin, (void *) &list) == 0)
+    lists[lists_num++] = list;
+  if (c_avl_get (chain->by_type, vl->type, (void *) &list) == 0)
+    lists[lists_num++] = list;
+
+  for (i = 0; i < lists_num; i++)
+  {
+    pos[i] = 0;
+    if (first)
+      continue;
+    while ((pos[i] < lists[i]->rules_num)
+        && (lists[i]->rules[pos[i]]->index <= after))
+      pos[i]++;
+  }
 
-    for (target = rule->targets; target != NULL; target = target->next)
+  return (lists_num);
+} /* }}} size_t fc_index_lists */
+
+/* Tests the rules found in the index for the value list's plugin and type,
+ * in the order in which they appear in the chain. Targets may change the
+ * plugin or type, in which case the lists of the new names are used for the
+ * remaining rules. */
+static int fc_process_index (const data_set_t *ds, value_list_t *vl, /* {{{ */
+    fc_chain_t *chain)
+{
+  fc_rule_list_t *lists[3];
+  size_t pos[3] = { 0, 0, 0 };
+  size_t lists_num;
+  char plugin[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  int status = FC_TARGET_CONTINUE;
+
+  lists_num = fc_index_lists (chain, vl, lists, pos, /* first = */ 1, 0);
+  sstrncpy (plugin, vl->plugin, sizeof (plugin));
+  sstrncpy (type, vl->type, sizeof (type));
+
+  while (1)
+  {
+    fc_rule_t *rule = NULL;
+    size_t next = 0;
+    size_t i;
+
+    /* Pick the first rule (in chain order) which hasn't been tested yet. */
+    for (i = 0; i < lists_num; i++)
     {
-      /* If we get here, all matches have matched the value. Execute the
-       * target. */
-      /* FIXME: Pass the meta-data to match targets here (when implemented). */
-      status = (*target->proc.invoke) (ds, vl, /* meta = */ NULL,
-          &target->user_data);
-      if (status < 0)
-      {
-        WARNING ("fc_process_chain (%s): A target failed.", chain->name);
-        continue;
-      }
-      else if (status == FC_TARGET_CONTINUE)
+      fc_rule_t *r;
+
+      if (pos[i] >= lists[i]->rules_num)
         continue;
-      else if (status == FC_TARGET_STOP)
-        break;
-      else if (status == FC_TARGET_RETURN)
-        break;
-      else
+
+      r = lists[i]->rules[pos[i]];
+      if ((rule == NULL) || (r->index < rule->index))
       {
-        WARNING ("fc_process_chain (%s): Unknown return value "
-            "from target `%s': %i",
-            chain->name, target->name, status);
+        rule = r;
+        next = i;
       }
     }
 
-    if ((status == FC_TARGET_STOP)
-        || (status == FC_TARGET_RETURN))
-    {
-      if (rule->name[0] != 0)
-      {
-        DEBUG ("fc_process_chain (%s): Rule `%s' signaled "
-            "the %s condition.",
-            chain->name, rule->name,
-            (status == FC_TARGET_STOP) ? "stop" : "return");
-      }
+    if (rule == NULL)
+      break;
+    pos[next]++;
+
+    status = fc_process_rule (ds, vl, chain, rule);
+    if (status != FC_TARGET_CONTINUE)
       break;
+
+    if ((strcmp (plugin, vl->plugin) != 0)
+        || (strcmp (type, vl->type) != 0))
+    {
+      lists_num = fc_index_lists (chain, vl, lists, pos,
+          /* first = */ 0, rule->index);
+      sstrncpy (plugin, vl->plugin, sizeof (plugin));
+      sstrncpy (type, vl->type, sizeof (type));
     }
-    else
+  }
+
+  return (status);
+} /* }}} int fc_process_index */
+
+static int fc_process_chain_internal (const data_set_t *ds, /* {{{ */
+    value_list_t *vl, fc_chain_t *chain)
+{
+  fc_rule_t *rule;
+  fc_target_t *target;
+  uint64_t start = 0;
+  int status;
+
+  DEBUG ("fc_process_chain (chain = %s);", chain->name);
+
+  status = FC_TARGET_CONTINUE;
+  if (chain->indexed)
+  {
+    status = fc_process_index (ds, vl, chain);
+  }
+  else
+  {
+    for (rule = chain->rules; rule != NULL; rule = rule->next)
     {
-      status = FC_TARGET_CONTINUE;
+      status = fc_process_rule (ds, vl, chain, rule);
+      if (status != FC_TARGET_CONTINUE)
+        break;
     }
-  } /* for (rule) */
+  }
 
   if (status == FC_TARGET_STOP)
     return (FC_TARGET_STOP);
   else if (status == FC_TARGET_RETURN)
     return (FC_TARGET_CONTINUE);
 
-  /* for-loop has been aborted: A target returned `FC_TARGET_STOP' */
-  if (rule != NULL)
-    return (FC_TARGET_CONTINUE);
-
   DEBUG ("fc_process_chain (%s): Executing the default targets.",
       chain->name);
 
@@ -970,9 +1369,15 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
   {
     /* If we get here, all matches have matched the value. Execute the
      * target. */
+    if (fc_stats_enabled)
+      start = fc_time_ns ();
     /* FIXME: Pass the meta-data to match targets here (when implemented). */
     status = (*target->proc.invoke) (ds, vl, /* meta = */ NULL,
         &target->user_data);
+    /* The target may have changed the identifier. */
+    plugin_value_list_identifier_reset (vl);
+    if (fc_stats_enabled)
+      fc_stats_add (chain, &target->stats, /* matched = */ 0, start);
     if (status < 0)
     {
       WARNING ("fc_process_chain (%s): The default target failed.",
@@ -1010,6 +1415,30 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
       chain->name);
 
   return (FC_TARGET_CONTINUE);
+} /* }}} int fc_process_chain_internal */
+
+int fc_process_chain (const data_set_t *ds, value_list_t *vl, /* {{{ */
+    fc_chain_t *chain)
+{
+  uint64_t start;
+  cdtime_t probe_start;
+  int status;
+
+  if (chain == NULL)
+    return (-1);
+
+  if (!fc_stats_enabled && !CD_PROBE_ENABLED)
+    return (fc_process_chain_internal (ds, vl, chain));
+
+  probe_start = CD_PROBE_START ();
+  start = fc_time_ns ();
+  status = fc_process_chain_internal (ds, vl, chain);
+  if (fc_stats_enabled)
+    fc_stats_add (chain, &chain->stats, /* matched = */ 0, start);
+  CD_PROBE4 (filter__chain, chain->name, vl->plugin,
+      CD_PROBE_NS (probe_start), status);
+
+  return (status);
 } /* }}} int fc_process_chain */
 
 /* Iterate over all rules in the chain and execute all targets for which all
@@ -1021,6 +1450,132 @@ int fc_default_action (const data_set_t *ds, value_list_t *vl) /* {{{ */
         /* meta = */ NULL, /* user_data = */ NULL));
 } /* }}} int fc_default_action */
 
+/* Copies the statistics of one chain, so callbacks can be called without
+ * holding its lock. */
+static int fc_statistics_chain (fc_chain_t *chain, /* {{{ */
+    fc_stats_callback_t callback, void *user_data)
+{
+  fc_rule_t *rule;
+  fc_target_t *target;
+  fc_stats_t stats;
+  char object[DATA_MAX_NAME_LEN];
+  int i;
+
+#define FC_STATS_REPORT(kind, s) do { \
+    pthread_mutex_lock (&chain->stats_lock); \
+    stats = (s); \
+    pthread_mutex_unlock (&chain->stats_lock); \
+    if ((*callback) (chain->name, kind, object, &stats, user_data) != 0) \
+      return (-1); \
+  } while (0)
+
+  sstrncpy (object, "chain", sizeof (object));
+  FC_STATS_REPORT ("chain", chain->stats);
+
+  for (rule = chain->rules; rule != NULL; rule = rule->next)
+  {
+    char rule_name[DATA_MAX_NAME_LEN];
+    fc_match_t *match;
+
+    if (rule->name[0] != 0)
+      sstrncpy (rule_name, rule->name, sizeof (rule_name));
+    else
+      ssnprintf (rule_name, sizeof (rule_name), "rule%zu", rule->index + 1);
+
+    sstrncpy (object, rule_name, sizeof (object));
+    FC_STATS_REPORT ("rule", rule->stats);
+
+    for (match = rule->matches, i = 1; match != NULL;
+        match = match->next, i++)
+    {
+      ssnprintf (object, sizeof (object), "%s-match%i-%s",
+          rule_name, i, match->name);
+      FC_STATS_REPORT ("match", match->stats);
+    }
+
+    for (target = rule->targets, i = 1; target != NULL;
+        target = target->next, i++)
+    {
+      ssnprintf (object, sizeof (object), "%s-target%i-%s",
+          rule_name, i, target->name);
+      FC_STATS_REPORT ("target", target->stats);
+    }
+  }
+
+  for (target = chain->targets, i = 1; target != NULL;
+      target = target->next, i++)
+  {
+    ssnprintf (object, sizeof (object), "default-target%i-%s",
+        i, target->name);
+    FC_STATS_REPORT ("target", target->stats);
+  }
+
+#undef FC_STATS_REPORT
+
+  return (0);
+} /* }}} int fc_statistics_chain */
+
+int fc_statistics_iterate (fc_stats_callback_t callback, /* {{{ */
+    void *user_data)
+{
+  fc_chain_t *chain;
+
+  for (chain = chain_list_head; chain != NULL; chain = chain->next)
+    if (fc_statistics_chain (chain, callback, user_data) != 0)
+      return (-1);
+
+  return (0);
+} /* }}} int fc_statistics_iterate */
+
+static void fc_statistics_submit (const char *chain, /* {{{ */
+    const char *type, const char *type_instance, derive_t value)
+{
+  value_t values[1];
+  value_list_t vl = VALUE_LIST_INIT;
+
+  values[0].derive = value;
+
+  vl.values = values;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "filter_chain", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, chain, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void fc_statistics_submit */
+
+static int fc_statistics_dispatch (const char *chain, /* {{{ */
+    const char *kind, const char *object, const fc_stats_t *stats,
+    void __attribute__((unused)) *user_data)
+{
+  fc_statistics_submit (chain, "invocations", object,
+      (derive_t) stats->invocations);
+  if ((strcmp ("rule", kind) == 0) || (strcmp ("match", kind) == 0))
+    fc_statistics_submit (chain, "total_operations", object,
+        (derive_t) stats->matches);
+  fc_statistics_submit (chain, "total_time_in_ns", object,
+      (derive_t) stats->time_ns);
+
+  return (0);
+} /* }}} int fc_statistics_dispatch */
+
+static int fc_statistics_read (void) /* {{{ */
+{
+  return (fc_statistics_iterate (fc_statistics_dispatch,
+        /* user_data = */ NULL));
+} /* }}} int fc_statistics_read */
+
+int fc_statistics_init (void) /* {{{ */
+{
+  if (fc_stats_enabled)
+    return (0);
+
+  fc_stats_enabled = 1;
+  return (plugin_register_read ("filter_chain", fc_statistics_read));
+} /* }}} int fc_statistics_init */
+
 int fc_configure (const oconfig_item_t *ci) /* {{{ */
 {
   fc_init_once ();
@@ -32,6 +32,17 @@
 #define FC_TARGET_STOP     1
 #define FC_TARGET_RETURN   2
 
+/*
+ * Statistics
+ */
+struct fc_stats_s
+{
+  uint64_t invocations;
+  uint64_t matches; /* rules and matches only */
+  uint64_t time_ns;
+};
+typedef struct fc_stats_s fc_stats_t;
+
 /*
  * Match functions
  */
@@ -41,6 +52,12 @@ struct match_proc_s
   int (*destroy) (void **user_data);
   int (*match) (const data_set_t *ds, const value_list_t *vl,
       notification_meta_t **meta, void **user_data);
+  /* Optional. Stores the plugin and type a value list must have to match in
+   * `plugin' and `type', or leaves them empty if the match doesn't require a
+   * fixed value. Used to index the rules of a chain; the match callback is
+   * still called for the rules that aren't skipped. */
+  int (*literals) (void **user_data, char *plugin, size_t plugin_size,
+      char *type, size_t type_size);
 };
 typedef struct match_proc_s match_proc_t;
 
@@ -92,6 +109,19 @@ int fc_process_chain (const data_set_t *ds, value_list_t *vl,
 
 int fc_default_action (const data_set_t *ds, value_list_t *vl);
 
+/* Starts counting invocations and time spent in chains, rules, matches and
+ * targets, and registers a read callback dispatching the counters. */
+int fc_statistics_init (void);
+
+/* Calls `callback' for each chain and each of its rules, matches and
+ * targets. `kind' is "chain", "rule", "match" or "target". `object' is
+ * "chain", the rule's name, "<rule>-match<N>-<name>",
+ * "<rule>-target<N>-<name>" or "default-target<N>-<name>". Unnamed rules are
+ * called "rule<N>". */
+typedef int (*fc_stats_callback_t) (const char *chain, const char *kind,
+    const char *object, const fc_stats_t *stats, void *user_data);
+int fc_statistics_iterate (fc_stats_callback_t callback, void *user_data);
+
 /* 
  * Shortcut for global configuration
  */
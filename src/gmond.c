@@ -19,11 +19,13 @@
  *   Florian octo Forster <octo at collectd.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg and sendmmsg */
+
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
-#include "utils_avltree.h"
+#include "utils_hashtable.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -68,14 +70,61 @@ struct socket_entry_s
 };
 typedef struct socket_entry_s socket_entry_t;
 
+/* Maximum number of datagrams read with one call to `recvmmsg'. The value
+ * lists completed and the meta data requests caused by one such batch are
+ * dispatched and sent together. */
+#define GMOND_RECEIVE_BATCH 32
+/* Values of the value lists queued in one receive context. */
+#define GMOND_BATCH_VALUES (4 * GMOND_RECEIVE_BATCH)
+/* Number of independently locked parts of the staging table. */
+#define GMOND_STAGING_SHARDS 16
+/* Meta data of a metric which has none yet is requested at most this often,
+ * instead of each time a value arrives. */
+#define GMOND_META_REQUEST_INTERVAL TIME_T_TO_CDTIME_T (10)
+
 struct staging_entry_s
 {
   char key[2 * DATA_MAX_NAME_LEN];
   value_list_t vl;
   int flags;
+  cdtime_t meta_requested;
 };
 typedef struct staging_entry_s staging_entry_t;
 
+struct staging_shard_s
+{
+  c_hashtable_t *table;
+  pthread_mutex_t lock;
+};
+typedef struct staging_shard_s staging_shard_t;
+
+struct meta_request_s
+{
+  char buffer[BUFF_SIZE];
+  unsigned int buffer_size;
+};
+typedef struct meta_request_s meta_request_t;
+
+/* State of one receive thread. Completed value lists and meta data requests
+ * are queued here while a batch of datagrams is handled. */
+struct receive_context_s
+{
+  struct pollfd *fds;
+  size_t fds_num;
+  pthread_t thread;
+
+  char buffers[GMOND_RECEIVE_BATCH][BUFF_SIZE];
+
+  value_list_t vls[GMOND_RECEIVE_BATCH];
+  size_t vls_num;
+  value_t values[GMOND_BATCH_VALUES];
+  size_t values_num;
+
+  meta_request_t requests[GMOND_RECEIVE_BATCH];
+  size_t requests_num;
+};
+typedef struct receive_context_s receive_context_t;
+
 struct metric_map_s
 {
   char *ganglia_name;
@@ -92,16 +141,19 @@ static char          *mc_receive_group = NULL;
 #define MC_RECEIVE_PORT_DEFAULT "8649"
 static char          *mc_receive_port = NULL;
 
-static struct pollfd *mc_receive_sockets = NULL;
-static size_t         mc_receive_sockets_num = 0;
+static socket_entry_t *mc_receive_sockets = NULL;
+static size_t          mc_receive_sockets_num = 0;
 
 static socket_entry_t  *mc_send_sockets = NULL;
 static size_t           mc_send_sockets_num = 0;
 static pthread_mutex_t  mc_send_sockets_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static int            mc_receive_thread_loop    = 0;
-static int            mc_receive_thread_running = 0;
-static pthread_t      mc_receive_thread_id;
+/* All receive threads read from all receive sockets, so each datagram is
+ * handled by exactly one of them. */
+static int                mc_receive_threads_num = 1;
+static receive_context_t *mc_receive_threads = NULL;
+static size_t             mc_receive_threads_running = 0;
+static int                mc_receive_thread_loop = 0;
 
 static metric_map_t metric_map_default[] =
 { /*---------------+-------------+-----------+-------------+------+-----*
@@ -130,8 +182,8 @@ static size_t metric_map_len_default = STATIC_ARRAY_SIZE (metric_map_default);
 static metric_map_t *metric_map = NULL;
 static size_t        metric_map_len = 0;
 
-static c_avl_tree_t   *staging_tree;
-static pthread_mutex_t staging_lock = PTHREAD_MUTEX_INITIALIZER;
+static staging_shard_t staging_shards[GMOND_STAGING_SHARDS];
+static _Bool           staging_initialized = 0;
 
 static metric_map_t *metric_lookup (const char *key) /* {{{ */
 {
@@ -363,13 +415,64 @@ static int create_sockets (socket_entry_t **ret_sockets, /* {{{ */
   return (0);
 } /* }}} int create_sockets */
 
-static int request_meta_data (const char *host, const char *name) /* {{{ */
+/* Sends the queued meta data requests to all send sockets. */
+static void meta_requests_send (receive_context_t *ctx) /* {{{ */
+{
+  size_t i;
+  size_t j;
+
+  if (ctx->requests_num == 0)
+    return;
+
+  pthread_mutex_lock (&mc_send_sockets_lock);
+  for (i = 0; i < mc_send_sockets_num; i++)
+  {
+#if HAVE_SENDMMSG
+    struct mmsghdr msgs[GMOND_RECEIVE_BATCH];
+    struct iovec   iovs[GMOND_RECEIVE_BATCH];
+
+    memset (msgs, 0, sizeof (msgs));
+    for (j = 0; j < ctx->requests_num; j++)
+    {
+      iovs[j].iov_base = ctx->requests[j].buffer;
+      iovs[j].iov_len = (size_t) ctx->requests[j].buffer_size;
+      msgs[j].msg_hdr.msg_iov = iovs + j;
+      msgs[j].msg_hdr.msg_iovlen = 1;
+      msgs[j].msg_hdr.msg_name = &mc_send_sockets[i].addr;
+      msgs[j].msg_hdr.msg_namelen = mc_send_sockets[i].addrlen;
+    }
+
+    sendmmsg (mc_send_sockets[i].fd, msgs, (unsigned int) ctx->requests_num,
+        /* flags = */ 0);
+#else
+    for (j = 0; j < ctx->requests_num; j++)
+      sendto (mc_send_sockets[i].fd, ctx->requests[j].buffer,
+          (size_t) ctx->requests[j].buffer_size, /* flags = */ 0,
+          (struct sockaddr *) &mc_send_sockets[i].addr,
+          mc_send_sockets[i].addrlen);
+#endif
+  }
+  pthread_mutex_unlock (&mc_send_sockets_lock);
+
+  ctx->requests_num = 0;
+} /* }}} void meta_requests_send */
+
+/* Dispatches the queued value lists. */
+static void staging_values_dispatch (receive_context_t *ctx) /* {{{ */
+{
+  if (ctx->vls_num > 0)
+    plugin_dispatch_values_batch (ctx->vls, ctx->vls_num);
+
+  ctx->vls_num = 0;
+  ctx->values_num = 0;
+} /* }}} void staging_values_dispatch */
+
+static int request_meta_data (receive_context_t *ctx, /* {{{ */
+    const char *host, const char *name)
 {
   Ganglia_metadata_msg msg;
-  char buffer[BUFF_SIZE];
-  unsigned int buffer_size;
+  meta_request_t *req;
   XDR xdr;
-  size_t i;
 
   memset (&msg, 0, sizeof (msg));
 
@@ -385,8 +488,12 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
     return (-1);
   }
 
-  memset (buffer, 0, sizeof (buffer));
-  xdrmem_create (&xdr, buffer, sizeof (buffer), XDR_ENCODE);
+  if (ctx->requests_num >= STATIC_ARRAY_SIZE (ctx->requests))
+    meta_requests_send (ctx);
+  req = ctx->requests + ctx->requests_num;
+
+  memset (req->buffer, 0, sizeof (req->buffer));
+  xdrmem_create (&xdr, req->buffer, sizeof (req->buffer), XDR_ENCODE);
 
   if (!xdr_Ganglia_metadata_msg (&xdr, &msg))
   {
@@ -395,41 +502,44 @@ static int request_meta_data (const char *host, const char *name) /* {{{ */
     return (-1);
   }
 
-  buffer_size = xdr_getpos (&xdr);
+  req->buffer_size = xdr_getpos (&xdr);
+  ctx->requests_num++;
 
   DEBUG ("gmond plugin: Requesting meta data for %s/%s.",
       host, name);
 
-  pthread_mutex_lock (&mc_send_sockets_lock);
-  for (i = 0; i < mc_send_sockets_num; i++)
-    sendto (mc_send_sockets[i].fd, buffer, (size_t) buffer_size,
-        /* flags = */ 0,
-        (struct sockaddr *) &mc_send_sockets[i].addr,
-        mc_send_sockets[i].addrlen);
-  pthread_mutex_unlock (&mc_send_sockets_lock);
-
   sfree (msg.Ganglia_metadata_msg_u.grequest.metric_id.host);
   sfree (msg.Ganglia_metadata_msg_u.grequest.metric_id.name);
   return (0);
 } /* }}} int request_meta_data */
 
-static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
-    const char *name,
+/* Formats the key of the staging entry into `key' and returns the shard it
+ * belongs to. */
+static staging_shard_t *staging_shard_get (char *key, /* {{{ */
+    size_t key_size, const char *host,
+    const char *type, const char *type_instance)
+{
+  ssnprintf (key, key_size, "%s/%s/%s", host, type,
+      (type_instance != NULL) ? type_instance : "");
+
+  return (staging_shards
+      + (c_hashtable_hash_string (key) % GMOND_STAGING_SHARDS));
+} /* }}} staging_shard_t *staging_shard_get */
+
+/* Must be called with the lock of `shard' held. */
+static staging_entry_t *staging_entry_get (staging_shard_t *shard, /* {{{ */
+    const char *key, const char *host,
     const char *type, const char *type_instance,
     int values_len)
 {
-  char key[2 * DATA_MAX_NAME_LEN];
   staging_entry_t *se;
   int status;
 
-  if (staging_tree == NULL)
+  if (!staging_initialized)
     return (NULL);
 
-  ssnprintf (key, sizeof (key), "%s/%s/%s", host, type,
-      (type_instance != NULL) ? type_instance : "");
-
   se = NULL;
-  status = c_avl_get (staging_tree, key, (void *) &se);
+  status = c_hashtable_get (shard->table, key, (void *) &se);
   if (status == 0)
     return (se);
 
@@ -459,10 +569,10 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
     sstrncpy (se->vl.type_instance, type_instance,
         sizeof (se->vl.type_instance));
 
-  status = c_avl_insert (staging_tree, se->key, se);
+  status = c_hashtable_insert (shard->table, se->key, se);
   if (status != 0)
   {
-    ERROR ("gmond plugin: c_avl_insert failed.");
+    ERROR ("gmond plugin: c_hashtable_insert failed.");
     sfree (se->vl.values);
     sfree (se);
     return (NULL);
@@ -471,42 +581,74 @@ static staging_entry_t *staging_entry_get (const char *host, /* {{{ */
   return (se);
 } /* }}} staging_entry_t *staging_entry_get */
 
-static int staging_entry_submit (const char *host, const char *name, /* {{{ */
+/* Queues the completed value list of `se' in `ctx', or a request for its meta
+ * data if there is none yet. Releases the lock of `shard'. */
+static int staging_entry_submit (receive_context_t *ctx, /* {{{ */
+    staging_shard_t *shard, const char *host, const char *name,
     staging_entry_t *se)
 {
   value_list_t vl;
   value_t values[se->vl.values_len];
 
+  se->flags = 0;
+
   if (se->vl.interval == 0)
   {
     /* No meta data has been received for this metric yet. */
-    se->flags = 0;
-    pthread_mutex_unlock (&staging_lock);
-    request_meta_data (host, name);
+    cdtime_t now = cdtime ();
+    _Bool request = 0;
+
+    if ((se->meta_requested == 0)
+        || ((now - se->meta_requested) >= GMOND_META_REQUEST_INTERVAL))
+    {
+      se->meta_requested = now;
+      request = 1;
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    if (request)
+      request_meta_data (ctx, host, name);
     return (0);
   }
 
-  se->flags = 0;
-
   memcpy (values, se->vl.values, sizeof (values));
   memcpy (&vl, &se->vl, sizeof (vl));
 
   /* Unlock before calling `plugin_dispatch_values'.. */
-  pthread_mutex_unlock (&staging_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   vl.values = values;
 
-  plugin_dispatch_values (&vl);
+  if ((size_t) vl.values_len > STATIC_ARRAY_SIZE (ctx->values))
+  {
+    plugin_dispatch_values (&vl);
+    return (0);
+  }
+
+  if ((ctx->vls_num >= STATIC_ARRAY_SIZE (ctx->vls))
+      || ((ctx->values_num + (size_t) vl.values_len)
+        > STATIC_ARRAY_SIZE (ctx->values)))
+    staging_values_dispatch (ctx);
+
+  memcpy (ctx->vls + ctx->vls_num, &vl, sizeof (vl));
+  ctx->vls[ctx->vls_num].values = ctx->values + ctx->values_num;
+  memcpy (ctx->vls[ctx->vls_num].values, values, sizeof (values));
+
+  ctx->vls_num++;
+  ctx->values_num += (size_t) vl.values_len;
 
   return (0);
 } /* }}} int staging_entry_submit */
 
-static int staging_entry_update (const char *host, const char *name, /* {{{ */
+static int staging_entry_update (receive_context_t *ctx, /* {{{ */
+    const char *host, const char *name,
     const char *type, const char *type_instance,
     int ds_index, int ds_type, value_t value)
 {
   const data_set_t *ds;
+  staging_shard_t *shard;
   staging_entry_t *se;
+  char key[2 * DATA_MAX_NAME_LEN];
 
   ds = plugin_get_ds (type);
   if (ds == NULL)
@@ -522,18 +664,19 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
     return (-1);
   }
 
-  pthread_mutex_lock (&staging_lock);
+  shard = staging_shard_get (key, sizeof (key), host, type, type_instance);
+  pthread_mutex_lock (&shard->lock);
 
-  se = staging_entry_get (host, name, type, type_instance, ds->ds_num);
+  se = staging_entry_get (shard, key, host, type, type_instance, ds->ds_num);
   if (se == NULL)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     ERROR ("gmond plugin: staging_entry_get failed.");
     return (-1);
   }
   if (se->vl.values_len != ds->ds_num)
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
@@ -553,18 +696,19 @@ static int staging_entry_update (const char *host, const char *name, /* {{{ */
   /* Check if all values have been set and submit if so. */
   if (se->flags == ((0x01 << se->vl.values_len) - 1))
   {
-    /* `staging_lock' is unlocked in `staging_entry_submit'. */
-    staging_entry_submit (host, name, se);
+    /* The shard's lock is unlocked in `staging_entry_submit'. */
+    staging_entry_submit (ctx, shard, host, name, se);
   }
   else
   {
-    pthread_mutex_unlock (&staging_lock);
+    pthread_mutex_unlock (&shard->lock);
   }
 
   return (0);
 } /* }}} int staging_entry_update */
 
-static int mc_handle_value_msg (Ganglia_value_msg *msg) /* {{{ */
+static int mc_handle_value_msg (receive_context_t *ctx, /* {{{ */
+    Ganglia_value_msg *msg)
 {
   const char *host;
   const char *name;
@@ -667,7 +811,7 @@ static int mc_handle_value_msg (Ganglia_value_msg *msg) /* {{{ */
     else
       assert (23 == 42);
 
-    return (staging_entry_update (host, name,
+    return (staging_entry_update (ctx, host, name,
           map->type, map->type_instance,
           map->ds_index, map->ds_type,
           val_copy));
@@ -684,9 +828,11 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
     case gmetadata_full:
     {
       Ganglia_metadatadef msg_meta;
+      staging_shard_t *shard;
       staging_entry_t *se;
       const data_set_t *ds;
       metric_map_t *map;
+      char key[2 * DATA_MAX_NAME_LEN];
 
       msg_meta = msg->Ganglia_metadata_msg_u.gfull;
 
@@ -711,14 +857,15 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
       DEBUG ("gmond plugin: Received meta data for %s/%s.",
           msg_meta.metric_id.host, msg_meta.metric_id.name);
 
-      pthread_mutex_lock (&staging_lock);
-      se = staging_entry_get (msg_meta.metric_id.host,
-          msg_meta.metric_id.name,
+      shard = staging_shard_get (key, sizeof (key), msg_meta.metric_id.host,
+          map->type, map->type_instance);
+      pthread_mutex_lock (&shard->lock);
+      se = staging_entry_get (shard, key, msg_meta.metric_id.host,
           map->type, map->type_instance,
           ds->ds_num);
       if (se != NULL)
         se->vl.interval = TIME_T_TO_CDTIME_T (msg_meta.metric.tmax);
-      pthread_mutex_unlock (&staging_lock);
+      pthread_mutex_unlock (&shard->lock);
 
       if (se == NULL)
       {
@@ -738,7 +885,8 @@ static int mc_handle_metadata_msg (Ganglia_metadata_msg *msg) /* {{{ */
   return (0);
 } /* }}} int mc_handle_metadata_msg */
 
-static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
+static int mc_handle_metric (receive_context_t *ctx, /* {{{ */
+    void *buffer, size_t buffer_size)
 {
   XDR xdr;
   Ganglia_msg_formats format;
@@ -762,7 +910,7 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
 
       memset (&msg, 0, sizeof (msg));
       if (xdr_Ganglia_value_msg (&xdr, &msg))
-        mc_handle_value_msg (&msg);
+        mc_handle_value_msg (ctx, &msg);
       break;
     }
 
@@ -785,10 +933,19 @@ static int mc_handle_metric (void *buffer, size_t buffer_size) /* {{{ */
   return (0);
 } /* }}} int mc_handle_metric */
 
-static int mc_handle_socket (struct pollfd *p) /* {{{ */
+/* Reads and handles the datagrams waiting on `p'. */
+static int mc_handle_socket (receive_context_t *ctx, /* {{{ */
+    struct pollfd *p)
 {
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[GMOND_RECEIVE_BATCH];
+  struct iovec   iovs[GMOND_RECEIVE_BATCH];
+  int num;
+  int i;
+#else
   char buffer[BUFF_SIZE];
   ssize_t buffer_size;
+#endif
 
   if ((p->revents & (POLLIN | POLLPRI)) == 0)
   {
@@ -796,60 +953,66 @@ static int mc_handle_socket (struct pollfd *p) /* {{{ */
     return (-1);
   }
 
-  buffer_size = recv (p->fd, buffer, sizeof (buffer), /* flags = */ 0);
+#if HAVE_RECVMMSG
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < GMOND_RECEIVE_BATCH; i++)
+  {
+    iovs[i].iov_base = ctx->buffers[i];
+    iovs[i].iov_len = sizeof (ctx->buffers[i]);
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  /* Other threads may have read the datagrams meanwhile. */
+  num = recvmmsg (p->fd, msgs, GMOND_RECEIVE_BATCH, MSG_DONTWAIT,
+      /* timeout = */ NULL);
+  if (num < 0)
+  {
+    char errbuf[1024];
+
+    p->revents = 0;
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return (0);
+
+    ERROR ("gmond plugin: recvmmsg failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  for (i = 0; i < num; i++)
+    mc_handle_metric (ctx, ctx->buffers[i], (size_t) msgs[i].msg_len);
+#else
+  buffer_size = recv (p->fd, buffer, sizeof (buffer), MSG_DONTWAIT);
   if (buffer_size <= 0)
   {
     char errbuf[1024];
+
+    p->revents = 0;
+    if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return (0);
+
     ERROR ("gmond plugin: recv failed: %s",
         sstrerror (errno, errbuf, sizeof (errbuf)));
-    p->revents = 0;
     return (-1);
   }
 
-  mc_handle_metric (buffer, (size_t) buffer_size);
+  mc_handle_metric (ctx, buffer, (size_t) buffer_size);
+#endif
+
+  staging_values_dispatch (ctx);
+  meta_requests_send (ctx);
   return (0);
 } /* }}} int mc_handle_socket */
 
 static void *mc_receive_thread (void *arg) /* {{{ */
 {
-  socket_entry_t *mc_receive_socket_entries;
+  receive_context_t *ctx = arg;
   int status;
   size_t i;
 
-  mc_receive_socket_entries = NULL;
-  status = create_sockets (&mc_receive_socket_entries, &mc_receive_sockets_num,
-      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
-      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
-      /* listen = */ 1);
-  if (status != 0)
-  {
-    ERROR ("gmond plugin: create_sockets failed.");
-    return ((void *) -1);
-  }
-
-  mc_receive_sockets = (struct pollfd *) calloc (mc_receive_sockets_num,
-      sizeof (*mc_receive_sockets));
-  if (mc_receive_sockets == NULL)
-  {
-    ERROR ("gmond plugin: calloc failed.");
-    for (i = 0; i < mc_receive_sockets_num; i++)
-      close (mc_receive_socket_entries[i].fd);
-    free (mc_receive_socket_entries);
-    mc_receive_socket_entries = NULL;
-    mc_receive_sockets_num = 0;
-    return ((void *) -1);
-  }
-
-  for (i = 0; i < mc_receive_sockets_num; i++)
-  {
-    mc_receive_sockets[i].fd = mc_receive_socket_entries[i].fd;
-    mc_receive_sockets[i].events = POLLIN | POLLPRI;
-    mc_receive_sockets[i].revents = 0;
-  }
-
   while (mc_receive_thread_loop != 0)
   {
-    status = poll (mc_receive_sockets, mc_receive_sockets_num, -1);
+    status = poll (ctx->fds, ctx->fds_num, -1);
     if (status <= 0)
     {
       char errbuf[1024];
@@ -860,51 +1023,133 @@ static void *mc_receive_thread (void *arg) /* {{{ */
       break;
     }
 
-    for (i = 0; i < mc_receive_sockets_num; i++)
+    for (i = 0; i < ctx->fds_num; i++)
     {
-      if (mc_receive_sockets[i].revents != 0)
-        mc_handle_socket (mc_receive_sockets + i);
+      if (ctx->fds[i].revents != 0)
+        mc_handle_socket (ctx, ctx->fds + i);
     }
   } /* while (mc_receive_thread_loop != 0) */
 
   return ((void *) 0);
 } /* }}} void *mc_receive_thread */
 
+static void mc_receive_sockets_close (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < mc_receive_sockets_num; i++)
+    close (mc_receive_sockets[i].fd);
+  sfree (mc_receive_sockets);
+  mc_receive_sockets_num = 0;
+} /* }}} void mc_receive_sockets_close */
+
+static void mc_receive_threads_free (void) /* {{{ */
+{
+  int i;
+
+  if (mc_receive_threads == NULL)
+    return;
+
+  for (i = 0; i < mc_receive_threads_num; i++)
+    sfree (mc_receive_threads[i].fds);
+  sfree (mc_receive_threads);
+} /* }}} void mc_receive_threads_free */
+
 static int mc_receive_thread_start (void) /* {{{ */
 {
   int status;
+  int i;
+  size_t j;
 
-  if (mc_receive_thread_running != 0)
+  if (mc_receive_threads_running != 0)
     return (-1);
 
+  status = create_sockets (&mc_receive_sockets, &mc_receive_sockets_num,
+      (mc_receive_group != NULL) ? mc_receive_group : MC_RECEIVE_GROUP_DEFAULT,
+      (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
+      /* listen = */ 1);
+  if (status != 0)
+  {
+    ERROR ("gmond plugin: create_sockets failed.");
+    return (-1);
+  }
+
+  /* The contexts are too large for the threads' stacks. */
+  mc_receive_threads = calloc ((size_t) mc_receive_threads_num,
+      sizeof (*mc_receive_threads));
+  if (mc_receive_threads == NULL)
+  {
+    ERROR ("gmond plugin: calloc failed.");
+    mc_receive_sockets_close ();
+    return (-1);
+  }
+
+  for (i = 0; i < mc_receive_threads_num; i++)
+  {
+    receive_context_t *ctx = mc_receive_threads + i;
+
+    ctx->fds = calloc (mc_receive_sockets_num, sizeof (*ctx->fds));
+    if (ctx->fds == NULL)
+    {
+      ERROR ("gmond plugin: calloc failed.");
+      mc_receive_threads_free ();
+      mc_receive_sockets_close ();
+      return (-1);
+    }
+    ctx->fds_num = mc_receive_sockets_num;
+
+    for (j = 0; j < mc_receive_sockets_num; j++)
+    {
+      ctx->fds[j].fd = mc_receive_sockets[j].fd;
+      ctx->fds[j].events = POLLIN | POLLPRI;
+      ctx->fds[j].revents = 0;
+    }
+  }
+
   mc_receive_thread_loop = 1;
 
-  status = pthread_create (&mc_receive_thread_id, /* attr = */ NULL,
-      mc_receive_thread, /* args = */ NULL);
-  if (status != 0)
+  for (i = 0; i < mc_receive_threads_num; i++)
+  {
+    status = pthread_create (&mc_receive_threads[i].thread,
+        /* attr = */ NULL, mc_receive_thread, mc_receive_threads + i);
+    if (status != 0)
+    {
+      ERROR ("gmond plugin: Starting receive thread failed.");
+      break;
+    }
+    mc_receive_threads_running++;
+  }
+
+  if (mc_receive_threads_running == 0)
   {
-    ERROR ("gmond plugin: Starting receive thread failed.");
     mc_receive_thread_loop = 0;
+    mc_receive_threads_free ();
+    mc_receive_sockets_close ();
     return (-1);
   }
 
-  mc_receive_thread_running = 1;
   return (0);
 } /* }}} int start_receive_thread */
 
 static int mc_receive_thread_stop (void) /* {{{ */
 {
-  if (mc_receive_thread_running == 0)
+  size_t i;
+
+  if (mc_receive_threads_running == 0)
     return (-1);
 
   mc_receive_thread_loop = 0;
 
-  INFO ("gmond plugin: Stopping receive thread.");
-  pthread_kill (mc_receive_thread_id, SIGTERM);
-  pthread_join (mc_receive_thread_id, /* return value = */ NULL);
-  memset (&mc_receive_thread_id, 0, sizeof (mc_receive_thread_id));
+  INFO ("gmond plugin: Stopping receive thread%s.",
+      (mc_receive_threads_running == 1) ? "" : "s");
+  for (i = 0; i < mc_receive_threads_running; i++)
+    pthread_kill (mc_receive_threads[i].thread, SIGTERM);
+  for (i = 0; i < mc_receive_threads_running; i++)
+    pthread_join (mc_receive_threads[i].thread, /* return value = */ NULL);
 
-  mc_receive_thread_running = 0;
+  mc_receive_threads_running = 0;
+  mc_receive_threads_free ();
+  mc_receive_sockets_close ();
 
   return (0);
 } /* }}} int mc_receive_thread_stop */
@@ -1065,6 +1310,15 @@ static int gmond_config (oconfig_item_t *ci) /* {{{ */
       gmond_config_set_address (child, &mc_receive_group, &mc_receive_port);
     else if (strcasecmp ("Metric", child->key) == 0)
       gmond_config_add_metric (child);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+    {
+      int tmp = mc_receive_threads_num;
+
+      if ((cf_util_get_int (child, &tmp) == 0) && (tmp < 1))
+        WARNING ("gmond plugin: `ReceiveThreads' must be at least one.");
+      else
+        mc_receive_threads_num = tmp;
+    }
     else
     {
       WARNING ("gmond plugin: Unknown configuration option `%s' ignored.",
@@ -1082,11 +1336,22 @@ static int gmond_init (void) /* {{{ */
       (mc_receive_port != NULL) ? mc_receive_port : MC_RECEIVE_PORT_DEFAULT,
       /* listen = */ 0);
 
-  staging_tree = c_avl_create ((void *) strcmp);
-  if (staging_tree == NULL)
+  if (!staging_initialized)
   {
-    ERROR ("gmond plugin: c_avl_create failed.");
-    return (-1);
+    size_t i;
+
+    for (i = 0; i < GMOND_STAGING_SHARDS; i++)
+    {
+      staging_shards[i].table = c_hashtable_create (c_hashtable_hash_string,
+          (void *) strcmp);
+      if (staging_shards[i].table == NULL)
+      {
+        ERROR ("gmond plugin: c_hashtable_create failed.");
+        return (-1);
+      }
+      pthread_mutex_init (&staging_shards[i].lock, /* attr = */ NULL);
+    }
+    staging_initialized = 1;
   }
 
   mc_receive_thread_start ();
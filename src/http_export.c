@@ -0,0 +1,793 @@
+/**
+ * collectd - src/http_export.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_cache.h"
+#include "utils_handoff.h"
+
+#include <pthread.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#if HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+/*
+ * Serves the rates in the value cache over HTTP, one line per data source:
+ *
+ *   <identifier> <data source> <rate> <time>
+ *
+ * The cache is read one shard at a time: `he_collect' copies the entries of
+ * a shard into the request's buffer while the shard is locked, and
+ * `he_send_chunk' formats and sends them once the lock has been released. So
+ * neither is the whole cache copied, nor is the cache locked while writing to
+ * a slow client.
+ */
+#define HE_DEFAULT_PORT "9103"
+#define HE_DEFAULT_THREADS 2
+#define HE_REQUEST_MAX 8192
+#define HE_TIMEOUT_SECONDS 10
+
+/* An entry as copied by `he_collect'. It is followed by `rates_num' rates
+ * and the name, including the terminating null byte, and padded to eight
+ * bytes. */
+struct he_entry_s
+{
+  cdtime_t time;
+  size_t rates_num;
+  size_t name_len;
+};
+typedef struct he_entry_s he_entry_t;
+
+struct he_request_s
+{
+  int fd;
+  const char *plugin;
+
+  char *chunk;
+  size_t chunk_len;
+  size_t chunk_size;
+
+  char out[16384];
+  size_t out_len;
+
+  _Bool gzip;
+#if HAVE_LIBZ
+  z_stream z;
+#endif
+};
+typedef struct he_request_s he_request_t;
+
+/*
+ * Private variables
+ */
+static char *listen_host = NULL;
+static char *listen_port = NULL;
+static int   threads_num = HE_DEFAULT_THREADS;
+
+static int listen_fd = -1;
+static int wakeup_pipe[2] = { -1, -1 };
+static int loop = 0;
+
+static pthread_t *threads = NULL;
+static int threads_started = 0;
+
+/*
+ * Output
+ */
+static int he_send (int fd, const char *data, size_t len) /* {{{ */
+{
+  while (len > 0)
+  {
+    ssize_t status;
+
+    status = send (fd, data, len, MSG_NOSIGNAL);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (-1);
+    }
+
+    data += status;
+    len -= (size_t) status;
+  }
+
+  return (0);
+} /* }}} int he_send */
+
+/* Appends `data' to the response body, compressing it if requested. */
+static int he_write (he_request_t *req, const char *data, /* {{{ */
+    size_t len)
+{
+#if HAVE_LIBZ
+  if (req->gzip)
+  {
+    req->z.next_in = (void *) data;
+    req->z.avail_in = (uInt) len;
+
+    while (req->z.avail_in > 0)
+    {
+      req->z.next_out = (void *) (req->out + req->out_len);
+      req->z.avail_out = (uInt) (sizeof (req->out) - req->out_len);
+
+      if (deflate (&req->z, Z_NO_FLUSH) == Z_STREAM_ERROR)
+        return (-1);
+
+      req->out_len = sizeof (req->out) - req->z.avail_out;
+      if (req->out_len == sizeof (req->out))
+      {
+        if (he_send (req->fd, req->out, req->out_len) != 0)
+          return (-1);
+        req->out_len = 0;
+      }
+    }
+
+    return (0);
+  }
+#endif
+
+  if ((req->out_len + len) > sizeof (req->out))
+  {
+    if (he_send (req->fd, req->out, req->out_len) != 0)
+      return (-1);
+    req->out_len = 0;
+  }
+
+  if (len > sizeof (req->out))
+    return (he_send (req->fd, data, len));
+
+  memcpy (req->out + req->out_len, data, len);
+  req->out_len += len;
+  return (0);
+} /* }}} int he_write */
+
+static int he_finish (he_request_t *req) /* {{{ */
+{
+#if HAVE_LIBZ
+  if (req->gzip)
+  {
+    int status;
+
+    req->z.next_in = NULL;
+    req->z.avail_in = 0;
+
+    do
+    {
+      req->z.next_out = (void *) (req->out + req->out_len);
+      req->z.avail_out = (uInt) (sizeof (req->out) - req->out_len);
+
+      status = deflate (&req->z, Z_FINISH);
+      if (status == Z_STREAM_ERROR)
+        return (-1);
+
+      req->out_len = sizeof (req->out) - req->z.avail_out;
+      if ((req->out_len == sizeof (req->out)) || (status == Z_STREAM_END))
+      {
+        if (he_send (req->fd, req->out, req->out_len) != 0)
+          return (-1);
+        req->out_len = 0;
+      }
+    } while (status != Z_STREAM_END);
+
+    return (0);
+  }
+#endif
+
+  if (req->out_len > 0)
+  {
+    if (he_send (req->fd, req->out, req->out_len) != 0)
+      return (-1);
+    req->out_len = 0;
+  }
+
+  return (0);
+} /* }}} int he_finish */
+
+/*
+ * Reading the cache
+ */
+/* Returns true if the plugin part of `name' is `plugin'. */
+static _Bool he_plugin_matches (const char *name, /* {{{ */
+    const char *plugin)
+{
+  size_t len = strlen (plugin);
+
+  name = strchr (name, '/');
+  if (name == NULL)
+    return (0);
+  name++;
+
+  return ((strncmp (name, plugin, len) == 0)
+      && ((name[len] == '/') || (name[len] == '-')));
+} /* }}} _Bool he_plugin_matches */
+
+/* Called with the shard's lock held, so it only copies the entry. */
+static int he_collect (const char *name, cdtime_t last_time, /* {{{ */
+    cdtime_t __attribute__((unused)) interval,
+    const gauge_t *rates, size_t rates_num, void *user_data)
+{
+  he_request_t *req = user_data;
+  he_entry_t entry;
+  size_t size;
+
+  if ((req->plugin != NULL) && !he_plugin_matches (name, req->plugin))
+    return (0);
+
+  entry.time = last_time;
+  entry.rates_num = rates_num;
+  entry.name_len = strlen (name) + 1;
+
+  size = sizeof (entry) + (rates_num * sizeof (gauge_t)) + entry.name_len;
+  size = (size + 7) & ~((size_t) 7);
+
+  if ((req->chunk_len + size) > req->chunk_size)
+  {
+    size_t chunk_size = (req->chunk_size == 0) ? 65536 : req->chunk_size;
+    char *tmp;
+
+    while ((req->chunk_len + size) > chunk_size)
+      chunk_size *= 2;
+
+    tmp = realloc (req->chunk, chunk_size);
+    if (tmp == NULL)
+      return (-1);
+    req->chunk = tmp;
+    req->chunk_size = chunk_size;
+  }
+
+  memcpy (req->chunk + req->chunk_len, &entry, sizeof (entry));
+  memcpy (req->chunk + req->chunk_len + sizeof (entry), rates,
+      rates_num * sizeof (gauge_t));
+  memcpy (req->chunk + req->chunk_len + sizeof (entry)
+      + (rates_num * sizeof (gauge_t)), name, entry.name_len);
+  req->chunk_len += size;
+
+  return (0);
+} /* }}} int he_collect */
+
+/* Returns the data set of the type in identifier `name'. */
+static const data_set_t *he_get_ds (const char *name) /* {{{ */
+{
+  char type[DATA_MAX_NAME_LEN];
+  const char *ptr;
+  size_t len;
+
+  ptr = strrchr (name, '/');
+  if (ptr == NULL)
+    return (NULL);
+  ptr++;
+
+  len = strcspn (ptr, "-");
+  if (len >= sizeof (type))
+    return (NULL);
+  memcpy (type, ptr, len);
+  type[len] = 0;
+
+  return (plugin_get_ds (type));
+} /* }}} const data_set_t *he_get_ds */
+
+/* Called once a shard's lock has been released. */
+static int he_send_chunk (void *user_data) /* {{{ */
+{
+  he_request_t *req = user_data;
+  size_t offset = 0;
+
+  while (offset < req->chunk_len)
+  {
+    he_entry_t entry;
+    const gauge_t *rates;
+    const char *name;
+    const data_set_t *ds;
+    size_t size;
+    size_t i;
+
+    memcpy (&entry, req->chunk + offset, sizeof (entry));
+    rates = (const gauge_t *) (req->chunk + offset + sizeof (entry));
+    name = (const char *) (rates + entry.rates_num);
+
+    ds = he_get_ds (name);
+    if ((ds != NULL) && ((size_t) ds->ds_num != entry.rates_num))
+      ds = NULL;
+
+    for (i = 0; i < entry.rates_num; i++)
+    {
+      char line[8 * DATA_MAX_NAME_LEN];
+      char ds_name[DATA_MAX_NAME_LEN];
+      int status;
+
+      if (ds != NULL)
+        sstrncpy (ds_name, ds->ds[i].name, sizeof (ds_name));
+      else
+        ssnprintf (ds_name, sizeof (ds_name), "%zu", i);
+
+      if (isnan (rates[i]))
+        status = ssnprintf (line, sizeof (line), "%s %s NaN %.3f\n",
+            name, ds_name, CDTIME_T_TO_DOUBLE (entry.time));
+      else
+        status = ssnprintf (line, sizeof (line), "%s %s %.15g %.3f\n",
+            name, ds_name, rates[i], CDTIME_T_TO_DOUBLE (entry.time));
+      if ((status < 1) || ((size_t) status >= sizeof (line)))
+        continue;
+
+      if (he_write (req, line, (size_t) status) != 0)
+        return (-1);
+    }
+
+    size = sizeof (entry) + (entry.rates_num * sizeof (gauge_t))
+      + entry.name_len;
+    offset += (size + 7) & ~((size_t) 7);
+  }
+
+  req->chunk_len = 0;
+  return (0);
+} /* }}} int he_send_chunk */
+
+/*
+ * HTTP
+ */
+static void he_respond_error (int fd, const char *status) /* {{{ */
+{
+  char buffer[256];
+  int len;
+
+  len = ssnprintf (buffer, sizeof (buffer), "HTTP/1.0 %s\r\n"
+      "Content-Type: text/plain\r\n"
+      "Connection: close\r\n"
+      "\r\n"
+      "%s\n", status, status);
+  if (len > 0)
+    he_send (fd, buffer, (size_t) len);
+} /* }}} void he_respond_error */
+
+/* Decodes "%xx" and "+" in place. */
+static void he_url_decode (char *str) /* {{{ */
+{
+  char *out = str;
+
+  while (*str != 0)
+  {
+    if ((str[0] == '%') && isxdigit ((int) str[1]) && isxdigit ((int) str[2]))
+    {
+      char hex[3] = { str[1], str[2], 0 };
+      *out++ = (char) strtol (hex, NULL, 16);
+      str += 3;
+    }
+    else if (*str == '+')
+    {
+      *out++ = ' ';
+      str++;
+    }
+    else
+      *out++ = *str++;
+  }
+  *out = 0;
+} /* }}} void he_url_decode */
+
+/* Reads the request up to the end of the header. Returns the length or less
+ * than zero on failure. */
+static ssize_t he_read_request (int fd, char *buffer, /* {{{ */
+    size_t buffer_size)
+{
+  size_t len = 0;
+
+  while (len < (buffer_size - 1))
+  {
+    ssize_t status;
+
+    status = recv (fd, buffer + len, buffer_size - 1 - len, /* flags = */ 0);
+    if (status < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return (-1);
+    }
+    else if (status == 0)
+      return (-1);
+
+    len += (size_t) status;
+    buffer[len] = 0;
+
+    if ((strstr (buffer, "\r\n\r\n") != NULL)
+        || (strstr (buffer, "\n\n") != NULL))
+      return ((ssize_t) len);
+  }
+
+  return (-1);
+} /* }}} ssize_t he_read_request */
+
+static void he_handle (int fd) /* {{{ */
+{
+  char buffer[HE_REQUEST_MAX];
+  char response[256];
+  char prefix[DATA_MAX_NAME_LEN + 1];
+  char *fields[4];
+  char *headers;
+  char *path;
+  char *query;
+  char *host = NULL;
+  const char *header;
+  he_request_t *req;
+  int status;
+
+  if (he_read_request (fd, buffer, sizeof (buffer)) < 0)
+    return;
+
+  headers = strchr (buffer, '\n');
+  if (headers == NULL)
+    return;
+  *headers++ = 0;
+
+  if (strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields)) != 3)
+  {
+    he_respond_error (fd, "400 Bad Request");
+    return;
+  }
+
+  if (strcmp ("GET", fields[0]) != 0)
+  {
+    he_respond_error (fd, "405 Method Not Allowed");
+    return;
+  }
+
+  path = fields[1];
+  query = strchr (path, '?');
+  if (query != NULL)
+    *query++ = 0;
+
+  if ((strcmp ("/", path) != 0) && (strcmp ("/metrics", path) != 0))
+  {
+    he_respond_error (fd, "404 Not Found");
+    return;
+  }
+
+  req = malloc (sizeof (*req));
+  if (req == NULL)
+  {
+    he_respond_error (fd, "500 Internal Server Error");
+    return;
+  }
+  memset (req, 0, sizeof (*req));
+  req->fd = fd;
+
+  while ((query != NULL) && (*query != 0))
+  {
+    char *key = query;
+    char *value;
+
+    query = strchr (query, '&');
+    if (query != NULL)
+      *query++ = 0;
+
+    value = strchr (key, '=');
+    if (value == NULL)
+      continue;
+    *value++ = 0;
+    he_url_decode (value);
+
+    if (strcmp ("host", key) == 0)
+      host = value;
+    else if (strcmp ("plugin", key) == 0)
+      req->plugin = value;
+  }
+
+  /* Only look for "gzip" in the value of the Accept-Encoding header. */
+  for (header = headers; header != NULL; header = strchr (header, '\n'))
+  {
+    if (*header == '\n')
+      header++;
+    if (strncasecmp ("Accept-Encoding:", header, 16) == 0)
+    {
+      size_t len = strcspn (header, "\r\n");
+      char value[256];
+
+      sstrncpy (value, header + 16,
+          (len - 16 < sizeof (value)) ? (len - 16 + 1) : sizeof (value));
+      if (strstr (value, "gzip") != NULL)
+        req->gzip = 1;
+    }
+  }
+
+#if HAVE_LIBZ
+  /* Adding 16 to the window bits makes zlib write a gzip header instead of
+   * a zlib header. */
+  if (req->gzip
+      && (deflateInit2 (&req->z, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+          15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK))
+    req->gzip = 0;
+#else
+  req->gzip = 0;
+#endif
+
+  /* `host' and `plugin' point into `buffer'. */
+  ssnprintf (response, sizeof (response), "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; charset=utf-8\r\n"
+      "%s"
+      "Connection: close\r\n"
+      "\r\n",
+      req->gzip ? "Content-Encoding: gzip\r\n" : "");
+  status = he_send (fd, response, strlen (response));
+
+  if (status == 0)
+  {
+    if (host != NULL)
+      ssnprintf (prefix, sizeof (prefix), "%s/", host);
+
+    status = uc_iterate_rates_chunked ((host != NULL) ? prefix : NULL,
+        he_collect, he_send_chunk, req);
+  }
+  if (status == 0)
+    he_finish (req);
+
+#if HAVE_LIBZ
+  if (req->gzip)
+    deflateEnd (&req->z);
+#endif
+  sfree (req->chunk);
+  sfree (req);
+} /* }}} void he_handle */
+
+static void *he_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+  while (loop != 0)
+  {
+    struct pollfd pfd[2];
+    struct timeval tv;
+    int status;
+    int fd;
+
+    memset (pfd, 0, sizeof (pfd));
+    pfd[0].fd = listen_fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = wakeup_pipe[0];
+    pfd[1].events = POLLIN;
+
+    status = poll (pfd, STATIC_ARRAY_SIZE (pfd), /* timeout = */ -1);
+    if ((status < 0) && (errno != EINTR))
+    {
+      char errbuf[1024];
+      ERROR ("http_export plugin: poll failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+      break;
+    }
+
+    if ((loop == 0) || ((pfd[0].revents & POLLIN) == 0))
+      continue;
+
+    /* The listening socket is non-blocking, since another thread may have
+     * accepted the connection already. */
+    fd = accept (listen_fd, NULL, NULL);
+    if (fd < 0)
+      continue;
+
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) & ~O_NONBLOCK);
+
+    memset (&tv, 0, sizeof (tv));
+    tv.tv_sec = HE_TIMEOUT_SECONDS;
+    setsockopt (fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof (tv));
+    setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+
+    he_handle (fd);
+    close (fd);
+  }
+
+  return ((void *) 0);
+} /* }}} void *he_thread */
+
+static int he_open_socket (void) /* {{{ */
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list;
+  struct addrinfo *ai_ptr;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+  ai_hints.ai_flags = AI_PASSIVE;
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_STREAM;
+
+  status = getaddrinfo (listen_host,
+      (listen_port != NULL) ? listen_port : HE_DEFAULT_PORT,
+      &ai_hints, &ai_list);
+  if (status != 0)
+  {
+    ERROR ("http_export plugin: getaddrinfo failed: %s",
+        gai_strerror (status));
+    return (-1);
+  }
+
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    int one = 1;
+
+    /* Passed on by the previous daemon, see utils_handoff.h. */
+    listen_fd = handoff_take (ai_ptr->ai_addr, ai_ptr->ai_addrlen,
+        ai_ptr->ai_socktype);
+    if (listen_fd >= 0)
+      break;
+
+    listen_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (listen_fd < 0)
+      continue;
+
+    setsockopt (listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+    if ((bind (listen_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen) == 0)
+        && (listen (listen_fd, /* backlog = */ 16) == 0))
+      break;
+
+    close (listen_fd);
+    listen_fd = -1;
+  }
+  freeaddrinfo (ai_list);
+
+  if (listen_fd < 0)
+  {
+    char errbuf[1024];
+    ERROR ("http_export plugin: Listening on port %s failed: %s",
+        (listen_port != NULL) ? listen_port : HE_DEFAULT_PORT,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  handoff_export (listen_fd);
+  fcntl (listen_fd, F_SETFL, fcntl (listen_fd, F_GETFL) | O_NONBLOCK);
+  return (0);
+} /* }}} int he_open_socket */
+
+/*
+ * Setup
+ */
+static int he_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("Host", child->key) == 0)
+      status = cf_util_get_string (child, &listen_host);
+    else if (strcasecmp ("Port", child->key) == 0)
+      status = cf_util_get_service (child, &listen_port);
+    else if (strcasecmp ("Threads", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &threads_num);
+      if ((status == 0) && (threads_num < 1))
+      {
+        ERROR ("http_export plugin: `Threads' must be at least one.");
+        status = -1;
+      }
+    }
+    else
+    {
+      WARNING ("http_export plugin: Ignoring unknown config option `%s'.",
+          child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int he_config */
+
+static int he_init (void) /* {{{ */
+{
+  int status;
+
+  if (loop != 0)
+    return (0);
+
+  if (he_open_socket () != 0)
+    return (-1);
+
+  if (pipe (wakeup_pipe) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("http_export plugin: pipe failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  threads = calloc ((size_t) threads_num, sizeof (*threads));
+  if (threads == NULL)
+  {
+    ERROR ("http_export plugin: calloc failed.");
+    return (-1);
+  }
+
+  loop = 1;
+  for (threads_started = 0; threads_started < threads_num; threads_started++)
+  {
+    status = pthread_create (threads + threads_started, /* attr = */ NULL,
+        he_thread, /* arg = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("http_export plugin: pthread_create failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      break;
+    }
+  }
+
+  if (threads_started == 0)
+  {
+    loop = 0;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int he_init */
+
+static int he_shutdown (void) /* {{{ */
+{
+  int i;
+
+  if (loop != 0)
+  {
+    loop = 0;
+    /* The pipe is never read, so every thread sees it as readable. */
+    if (write (wakeup_pipe[1], "", 1) != 1)
+      WARNING ("http_export plugin: Waking up the threads failed.");
+
+    for (i = 0; i < threads_started; i++)
+      pthread_join (threads[i], NULL);
+    threads_started = 0;
+  }
+  sfree (threads);
+
+  if (listen_fd >= 0)
+  {
+    close (listen_fd);
+    listen_fd = -1;
+  }
+
+  if (wakeup_pipe[0] >= 0)
+  {
+    close (wakeup_pipe[0]);
+    close (wakeup_pipe[1]);
+    wakeup_pipe[0] = -1;
+    wakeup_pipe[1] = -1;
+  }
+
+  sfree (listen_host);
+  sfree (listen_port);
+
+  return (0);
+} /* }}} int he_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("http_export", he_config);
+  plugin_register_init ("http_export", he_init);
+  plugin_register_shutdown ("http_export", he_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 tw=78 et fdm=marker : */
@@ -26,7 +26,10 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_hashtable.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
+#include "utils_sampler.h"
 
 #if HAVE_SYS_TYPES_H
 #  include <sys/types.h>
@@ -70,6 +73,18 @@
 # endif /* !COLLECT_GETIFADDRS */
 #endif /* KERNEL_LINUX */
 
+/*
+ * On Linux the statistics are dumped via rtnetlink if possible, which saves
+ * formatting and parsing /proc/net/dev, and yields 64 bit counters.
+ */
+#if !HAVE_GETIFADDRS && KERNEL_LINUX && HAVE_STRUCT_RTNL_LINK_STATS64
+# define IF_USE_NETLINK 1
+# include <linux/netlink.h>
+# include <linux/rtnetlink.h>
+#else
+# define IF_USE_NETLINK 0
+#endif
+
 #if HAVE_PERFSTAT
 static perfstat_netinterface_t *ifstat;
 static int nif;
@@ -87,11 +102,13 @@ static const char *config_keys[] =
 {
 	"Interface",
 	"IgnoreSelected",
+	"SampleInterval",
 	NULL
 };
-static int config_keys_num = 2;
+static int config_keys_num = 3;
 
 static ignorelist_t *ignorelist = NULL;
+static cdtime_t sample_interval = 0;
 
 #ifdef HAVE_LIBKSTAT
 #define MAX_NUMIF 256
@@ -100,14 +117,104 @@ static kstat_t *ksp[MAX_NUMIF];
 static int numif = 0;
 #endif /* HAVE_LIBKSTAT */
 
+#if !HAVE_GETIFADDRS && KERNEL_LINUX
+static procfs_file_t *proc_net_dev = NULL;
+#endif
+
+#if KERNEL_LINUX
+static sampler_t *if_sampler = NULL;
+/* Only used by the sampler's thread. */
+static procfs_file_t *sample_net_dev = NULL;
+#endif
+
+#if IF_USE_NETLINK
+/* Whether an interface is ignored, by index. It is matched against the
+ * ignorelist again only if the interface has been renamed. */
+typedef struct if_cache_s
+{
+	int index;
+	char name[IFNAMSIZ];
+	_Bool ignored;
+	unsigned int generation;
+	struct if_cache_s *next;
+} if_cache_t;
+
+static c_hashtable_t *if_cache = NULL;
+static if_cache_t *if_cache_list = NULL;
+static unsigned int if_cache_generation = 0;
+
+static int if_nl_fd = -1;
+static uint32_t if_nl_seq = 0;
+/* Set if rtnetlink doesn't work, so that /proc/net/dev is read instead. */
+static _Bool if_nl_failed = 0;
+/* Aligned for the netlink headers. */
+static uint64_t if_nl_buffer[8192];
+
+/* The selected interfaces, if they can be looked up by name in the kernel
+ * instead of dumping all interfaces: if all are literal names and
+ * `IgnoreSelected' is false. */
+static char **if_names = NULL;
+static size_t if_names_num = 0;
+static _Bool if_names_literal = 1;
+static _Bool if_ignore_selected = 0;
+
+/* Requests per batch of lookups by name, so that the replies fit into the
+ * socket buffer. */
+#define IF_NL_BATCH 64
+#endif /* IF_USE_NETLINK */
+
+#if IF_USE_NETLINK
+static void if_names_add (const char *name)
+{
+	size_t len = strlen (name);
+	char **tmp;
+
+	/* Regular expressions have to be matched by the ignorelist. */
+	if ((len > 2) && (name[0] == '/') && (name[len - 1] == '/'))
+	{
+		if_names_literal = 0;
+		return;
+	}
+
+	if (len >= IFNAMSIZ)
+	{
+		if_names_literal = 0;
+		return;
+	}
+
+	tmp = realloc (if_names, (if_names_num + 1) * sizeof (*if_names));
+	if (tmp == NULL)
+	{
+		if_names_literal = 0;
+		return;
+	}
+	if_names = tmp;
+
+	if_names[if_names_num] = strdup (name);
+	if (if_names[if_names_num] == NULL)
+	{
+		if_names_literal = 0;
+		return;
+	}
+	if_names_num++;
+} /* void if_names_add */
+#endif /* IF_USE_NETLINK */
+
 static int interface_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
+	{
 		ignorelist = ignorelist_create (/* invert = */ 1);
+		/* Hosts running containers have thousands of interfaces. */
+		ignorelist_set_cache (ignorelist, 8192);
+	}
 
 	if (strcasecmp (key, "Interface") == 0)
 	{
 		ignorelist_add (ignorelist, value);
+#if IF_USE_NETLINK
+		if_names_add (value);
+#endif
 	}
 	else if (strcasecmp (key, "IgnoreSelected") == 0)
 	{
@@ -115,6 +222,14 @@ static int interface_config (const char *key, const char *value)
 		if (IS_TRUE (value))
 			invert = 0;
 		ignorelist_set_invert (ignorelist, invert);
+#if IF_USE_NETLINK
+		if_ignore_selected = IS_TRUE (value) ? 1 : 0;
+#endif
+	}
+	else if (strcasecmp (key, "SampleInterval") == 0)
+	{
+		double tmp = atof (value);
+		sample_interval = (tmp > 0.0) ? DOUBLE_TO_CDTIME_T (tmp) : 0;
 	}
 	else
 	{
@@ -125,7 +240,7 @@ static int interface_config (const char *key, const char *value)
 }
 
 #if HAVE_LIBKSTAT
-static int interface_init (void)
+static int interface_kstat_init (void)
 {
 	kstat_t *ksp_chain;
 	derive_t val;
@@ -151,19 +266,94 @@ static int interface_init (void)
 	}
 
 	return (0);
-} /* int interface_init */
+} /* int interface_kstat_init */
 #endif /* HAVE_LIBKSTAT */
 
-static void if_submit (const char *dev, const char *type,
+#if KERNEL_LINUX
+/* Called by the sampler every `SampleInterval': adds the rates of the
+ * octets and packets counters of the selected interfaces. Reads
+ * /proc/net/dev, which is cheap enough to do that often, even if the
+ * interval's values are read via rtnetlink. */
+static int if_sample (sampler_t *s, cdtime_t now,
+		void __attribute__((unused)) *user_data)
+{
+	char *buffer;
+	char *line;
+
+	if (sample_net_dev == NULL)
+	{
+		sample_net_dev = procfs_open ("/proc/net/dev", /* max age = */ 0);
+		if (sample_net_dev == NULL)
+			return (-1);
+	}
+
+	buffer = procfs_read (sample_net_dev, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		char *fields[16];
+		char *device;
+		char *dummy;
+
+		if (!(dummy = strchr (line, ':')))
+			continue;
+		dummy[0] = '\0';
+		dummy++;
+
+		device = line;
+		while (device[0] == ' ')
+			device++;
+
+		if (device[0] == '\0')
+			continue;
+
+		if (strsplit (dummy, fields, 16) < 11)
+			continue;
+
+		if (ignorelist_match (ignorelist, device) != 0)
+			continue;
+
+		sampler_add_derive (s, device, "octets-rx", atoll (fields[0]), now);
+		sampler_add_derive (s, device, "octets-tx", atoll (fields[8]), now);
+		sampler_add_derive (s, device, "packets-rx", atoll (fields[1]), now);
+		sampler_add_derive (s, device, "packets-tx", atoll (fields[9]), now);
+	}
+
+	return (0);
+} /* int if_sample */
+#endif /* KERNEL_LINUX */
+
+static int interface_init (void)
+{
+	if ((sample_interval > 0) && (if_sampler == NULL))
+	{
+#if KERNEL_LINUX
+		if_sampler = sampler_create ("if/sample", sample_interval,
+				if_sample, /* user data = */ NULL);
+		if (if_sampler == NULL)
+			ERROR ("interface plugin: Starting the sampler failed.");
+#else
+		WARNING ("interface plugin: The `SampleInterval' option is only "
+				"supported on Linux.");
+#endif
+	}
+
+#if HAVE_LIBKSTAT
+	return (interface_kstat_init ());
+#else
+	return (0);
+#endif
+} /* int interface_init */
+
+static void if_dispatch (const char *dev, const char *type,
 		derive_t rx,
 		derive_t tx)
 {
 	value_t values[2];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, dev) != 0)
-		return;
-
 	values[0].derive = rx;
 	values[1].derive = tx;
 
@@ -175,9 +365,349 @@ static void if_submit (const char *dev, const char *type,
 	sstrncpy (vl.type, type, sizeof (vl.type));
 
 	plugin_dispatch_values (&vl);
+} /* void if_dispatch */
+
+static void if_submit (const char *dev, const char *type,
+		derive_t rx,
+		derive_t tx)
+{
+	if (ignorelist_match (ignorelist, dev) != 0)
+		return;
+
+	if_dispatch (dev, type, rx, tx);
 } /* void if_submit */
 
-static int interface_read (void)
+#if IF_USE_NETLINK
+static uint32_t if_cache_hash (const void *key)
+{
+	/* Knuth's multiplicative hash spreads the consecutive indices. */
+	return (((uint32_t) *((const int *) key)) * 2654435761U);
+} /* uint32_t if_cache_hash */
+
+static int if_cache_compare (const void *a, const void *b)
+{
+	return (*((const int *) a) != *((const int *) b));
+} /* int if_cache_compare */
+
+/* Returns whether the interface `index', named `name', is ignored. */
+static _Bool if_cache_ignored (int index, const char *name)
+{
+	if_cache_t *ic = NULL;
+
+	if (c_hashtable_get (if_cache, &index, (void *) &ic) != 0)
+	{
+		ic = calloc (1, sizeof (*ic));
+		if (ic == NULL)
+			return (ignorelist_match (ignorelist, name) != 0);
+		ic->index = index;
+
+		if (c_hashtable_insert (if_cache, &ic->index, ic) != 0)
+		{
+			sfree (ic);
+			return (ignorelist_match (ignorelist, name) != 0);
+		}
+		ic->next = if_cache_list;
+		if_cache_list = ic;
+	}
+
+	ic->generation = if_cache_generation;
+	if (strcmp (ic->name, name) != 0)
+	{
+		sstrncpy (ic->name, name, sizeof (ic->name));
+		ic->ignored = (ignorelist_match (ignorelist, name) != 0);
+	}
+
+	return (ic->ignored);
+} /* _Bool if_cache_ignored */
+
+/* Removes the entries of interfaces which weren't in the last dump. */
+static void if_cache_expire (void)
+{
+	if_cache_t *prev = NULL;
+	if_cache_t *ic = if_cache_list;
+
+	while (ic != NULL)
+	{
+		if_cache_t *next = ic->next;
+
+		if (ic->generation == if_cache_generation)
+		{
+			prev = ic;
+			ic = next;
+			continue;
+		}
+
+		if (prev == NULL)
+			if_cache_list = next;
+		else
+			prev->next = next;
+
+		c_hashtable_remove (if_cache, &ic->index,
+				/* key = */ NULL, /* value = */ NULL);
+		sfree (ic);
+		ic = next;
+	}
+} /* void if_cache_expire */
+
+/* Dispatches the statistics of one RTM_NEWLINK message. If `selected' is
+ * false, the ignorelist decides. */
+static void if_nl_handle_link (const struct nlmsghdr *nlh, _Bool selected)
+{
+	struct ifinfomsg *ifi = NLMSG_DATA (nlh);
+	struct rtattr *rta;
+	int len = IFLA_PAYLOAD (nlh);
+	const char *name = NULL;
+	const void *stats64 = NULL;
+	const void *stats32 = NULL;
+	struct rtnl_link_stats64 s;
+
+	for (rta = IFLA_RTA (ifi); RTA_OK (rta, len); rta = RTA_NEXT (rta, len))
+	{
+		if (rta->rta_type == IFLA_IFNAME)
+			name = RTA_DATA (rta);
+		else if ((rta->rta_type == IFLA_STATS64)
+				&& (RTA_PAYLOAD (rta) >= sizeof (struct rtnl_link_stats64)))
+			stats64 = RTA_DATA (rta);
+		else if ((rta->rta_type == IFLA_STATS)
+				&& (RTA_PAYLOAD (rta) >= sizeof (struct rtnl_link_stats)))
+			stats32 = RTA_DATA (rta);
+	}
+
+	if ((name == NULL) || ((stats64 == NULL) && (stats32 == NULL)))
+		return;
+
+	if (!selected && if_cache_ignored (ifi->ifi_index, name))
+		return;
+
+	/* The attributes are only aligned to four bytes. */
+	if (stats64 != NULL)
+	{
+		memcpy (&s, stats64, sizeof (s));
+	}
+	else
+	{
+		struct rtnl_link_stats s32;
+
+		memcpy (&s32, stats32, sizeof (s32));
+		memset (&s, 0, sizeof (s));
+		s.rx_bytes   = s32.rx_bytes;
+		s.tx_bytes   = s32.tx_bytes;
+		s.rx_packets = s32.rx_packets;
+		s.tx_packets = s32.tx_packets;
+		s.rx_errors  = s32.rx_errors;
+		s.tx_errors  = s32.tx_errors;
+	}
+
+	if_dispatch (name, "if_octets",
+			(derive_t) s.rx_bytes, (derive_t) s.tx_bytes);
+	if_dispatch (name, "if_packets",
+			(derive_t) s.rx_packets, (derive_t) s.tx_packets);
+	if_dispatch (name, "if_errors",
+			(derive_t) s.rx_errors, (derive_t) s.tx_errors);
+} /* void if_nl_handle_link */
+
+/* Handles the replies to the `seq_num' requests starting with `seq_first'.
+ * A dump is finished by NLMSG_DONE, a lookup is answered by one message,
+ * which is an error if there is no such interface. */
+static int if_nl_receive (uint32_t seq_first, uint32_t seq_num, _Bool dump)
+{
+	uint32_t answered = 0;
+
+	while (42)
+	{
+		const struct nlmsghdr *nlh;
+		int len;
+
+		len = (int) recv (if_nl_fd, if_nl_buffer, sizeof (if_nl_buffer),
+				/* flags = */ 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("interface plugin: recv failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+		else if (len == 0)
+			return (-1);
+
+		for (nlh = (const void *) if_nl_buffer; NLMSG_OK (nlh, len);
+				nlh = NLMSG_NEXT (nlh, len))
+		{
+			/* Left over from an earlier, failed read. */
+			if ((nlh->nlmsg_seq < seq_first)
+					|| (nlh->nlmsg_seq >= seq_first + seq_num))
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE)
+			{
+				if (dump)
+					return (0);
+				continue;
+			}
+			else if (nlh->nlmsg_type == NLMSG_ERROR)
+			{
+				const struct nlmsgerr *err = NLMSG_DATA (nlh);
+				char errbuf[1024];
+
+				if (dump)
+				{
+					ERROR ("interface plugin: Dumping the "
+							"interfaces failed: %s",
+							sstrerror (-err->error, errbuf,
+								sizeof (errbuf)));
+					return (-1);
+				}
+
+				/* The interface doesn't exist (yet). */
+				answered++;
+			}
+			else if (nlh->nlmsg_type == RTM_NEWLINK)
+			{
+				if_nl_handle_link (nlh, /* selected = */ !dump);
+				if (!dump)
+					answered++;
+			}
+
+			if (!dump && (answered >= seq_num))
+				return (0);
+		}
+	}
+
+	/* not reached */
+	return (-1);
+} /* int if_nl_receive */
+
+static int if_nl_send (const void *buffer, size_t buffer_size)
+{
+	struct sockaddr_nl nladdr;
+
+	memset (&nladdr, 0, sizeof (nladdr));
+	nladdr.nl_family = AF_NETLINK;
+
+	if (sendto (if_nl_fd, buffer, buffer_size, /* flags = */ 0,
+				(struct sockaddr *) &nladdr, sizeof (nladdr)) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("interface plugin: sendto failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* int if_nl_send */
+
+/* Dumps all interfaces, matching their names against the ignorelist. */
+static int if_nl_read_all (void)
+{
+	struct
+	{
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+	} req;
+	int status;
+
+	if (if_cache == NULL)
+	{
+		if_cache = c_hashtable_create (if_cache_hash, if_cache_compare);
+		if (if_cache == NULL)
+		{
+			ERROR ("interface plugin: c_hashtable_create failed.");
+			return (-1);
+		}
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.nlh.nlmsg_len = sizeof (req);
+	req.nlh.nlmsg_type = RTM_GETLINK;
+	req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+	req.nlh.nlmsg_seq = ++if_nl_seq;
+	req.ifi.ifi_family = AF_UNSPEC;
+
+	if (if_nl_send (&req, sizeof (req)) != 0)
+		return (-1);
+
+	if_cache_generation++;
+	status = if_nl_receive (req.nlh.nlmsg_seq, 1, /* dump = */ 1);
+	if (status == 0)
+		if_cache_expire ();
+
+	return (status);
+} /* int if_nl_read_all */
+
+/* Looks the selected interfaces up by name, so that the kernel doesn't
+ * report the others at all. */
+static int if_nl_read_names (void)
+{
+	struct if_nl_req_s
+	{
+		struct nlmsghdr nlh;
+		struct ifinfomsg ifi;
+		struct rtattr rta;
+		char name[IFNAMSIZ];
+	} req[IF_NL_BATCH];
+	size_t i;
+
+	for (i = 0; i < if_names_num; i += IF_NL_BATCH)
+	{
+		uint32_t seq_first = if_nl_seq + 1;
+		size_t num = if_names_num - i;
+		size_t j;
+
+		if (num > IF_NL_BATCH)
+			num = IF_NL_BATCH;
+
+		memset (req, 0, sizeof (req));
+		for (j = 0; j < num; j++)
+		{
+			req[j].nlh.nlmsg_len = sizeof (req[j]);
+			req[j].nlh.nlmsg_type = RTM_GETLINK;
+			req[j].nlh.nlmsg_flags = NLM_F_REQUEST;
+			req[j].nlh.nlmsg_seq = ++if_nl_seq;
+			req[j].ifi.ifi_family = AF_UNSPEC;
+			req[j].rta.rta_type = IFLA_IFNAME;
+			req[j].rta.rta_len = RTA_LENGTH (sizeof (req[j].name));
+			sstrncpy (req[j].name, if_names[i + j],
+					sizeof (req[j].name));
+		}
+
+		if (if_nl_send (req, num * sizeof (req[0])) != 0)
+			return (-1);
+		if (if_nl_receive (seq_first, (uint32_t) num,
+					/* dump = */ 0) != 0)
+			return (-1);
+	}
+
+	return (0);
+} /* int if_nl_read_names */
+
+static int if_nl_read (void)
+{
+	if (if_nl_fd < 0)
+	{
+		if_nl_fd = socket (AF_NETLINK, SOCK_DGRAM, NETLINK_ROUTE);
+		if (if_nl_fd < 0)
+		{
+			char errbuf[1024];
+			ERROR ("interface plugin: Opening the rtnetlink socket "
+					"failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+		fcntl (if_nl_fd, F_SETFD, FD_CLOEXEC);
+	}
+
+	if (if_names_literal && !if_ignore_selected && (if_names_num > 0))
+		return (if_nl_read_names ());
+	else
+		return (if_nl_read_all ());
+} /* int if_nl_read */
+#endif /* IF_USE_NETLINK */
+
+static int interface_read_counters (void)
 {
 #if HAVE_GETIFADDRS
 	struct ifaddrs *if_list;
@@ -231,8 +761,8 @@ static int interface_read (void)
 /* #endif HAVE_GETIFADDRS */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
+	char *line;
 	derive_t incoming, outgoing;
 	char *device;
 
@@ -240,22 +770,42 @@ static int interface_read (void)
 	char *fields[16];
 	int numfields;
 
-	if ((fh = fopen ("/proc/net/dev", "r")) == NULL)
+#if IF_USE_NETLINK
+	if (!if_nl_failed)
 	{
-		char errbuf[1024];
-		WARNING ("interface plugin: fopen: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		if (if_nl_read () == 0)
+			return (0);
+
+		NOTICE ("interface plugin: Reading the statistics via rtnetlink "
+				"failed. Reading /proc/net/dev from now on.");
+		if_nl_failed = 1;
+		if (if_nl_fd >= 0)
+		{
+			close (if_nl_fd);
+			if_nl_fd = -1;
+		}
 	}
+#endif
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	if (proc_net_dev == NULL)
 	{
-		if (!(dummy = strchr(buffer, ':')))
+		proc_net_dev = procfs_open ("/proc/net/dev", /* max age = */ 0);
+		if (proc_net_dev == NULL)
+			return (-1);
+	}
+
+	buffer = procfs_read (proc_net_dev, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		if (!(dummy = strchr(line, ':')))
 			continue;
 		dummy[0] = '\0';
 		dummy++;
 
-		device = buffer;
+		device = line;
 		while (device[0] == ' ')
 			device++;
 
@@ -279,8 +829,6 @@ static int interface_read (void)
 		outgoing = atoll (fields[10]);
 		if_submit (device, "if_errors", incoming, outgoing);
 	}
-
-	fclose (fh);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -374,14 +922,70 @@ static int interface_read (void)
 #endif /* HAVE_PERFSTAT */
 
 	return (0);
+} /* int interface_read_counters */
+
+static int interface_read (void)
+{
+	int status;
+
+	status = interface_read_counters ();
+
+#if KERNEL_LINUX
+	if (if_sampler != NULL)
+		sampler_dispatch (if_sampler, "interface", "sampled_rate");
+#endif
+
+	return (status);
 } /* int interface_read */
 
+#if KERNEL_LINUX
+static int interface_shutdown (void)
+{
+	sampler_destroy (if_sampler);
+	if_sampler = NULL;
+	procfs_close (sample_net_dev);
+	sample_net_dev = NULL;
+
+#if !HAVE_GETIFADDRS
+	procfs_close (proc_net_dev);
+	proc_net_dev = NULL;
+#endif
+
+#if IF_USE_NETLINK
+	if (if_nl_fd >= 0)
+	{
+		close (if_nl_fd);
+		if_nl_fd = -1;
+	}
+
+	while (if_cache_list != NULL)
+	{
+		if_cache_t *next = if_cache_list->next;
+		sfree (if_cache_list);
+		if_cache_list = next;
+	}
+	c_hashtable_destroy (if_cache);
+	if_cache = NULL;
+
+	while (if_names_num > 0)
+	{
+		if_names_num--;
+		sfree (if_names[if_names_num]);
+	}
+	sfree (if_names);
+#endif
+
+	return (0);
+} /* int interface_shutdown */
+#endif
+
 void module_register (void)
 {
 	plugin_register_config ("interface", interface_config,
 			config_keys, config_keys_num);
-#if HAVE_LIBKSTAT
 	plugin_register_init ("interface", interface_init);
-#endif
 	plugin_register_read ("interface", interface_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("interface", interface_shutdown);
+#endif
 } /* void module_register */
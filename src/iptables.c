@@ -239,135 +239,185 @@ static int iptables_config (const char *key, const char *value)
 	return (0);
 } /* int iptables_config */
 
-static int submit6_match (const struct ip6t_entry_match *match,
-                const struct ip6t_entry *entry,
-                const ip_chain_t *chain,
-                int rule_num)
+static void submit_counters (const ip_chain_t *chain, const char *comment,
+	derive_t bytes, derive_t packets)
 {
     int status;
     value_t values[1];
     value_list_t vl = VALUE_LIST_INIT;
 
-    /* Select the rules to collect */
-    if (chain->rule_type == RTYPE_NUM)
-    {
-        if (chain->rule.num != rule_num)
-            return (0);
-    }
-    else
-    {
-        if (strcmp (match->u.user.name, "comment") != 0)
-            return (0);
-        if ((chain->rule_type == RTYPE_COMMENT)
-                && (strcmp (chain->rule.comment, (char *) match->data) != 0))
-            return (0);
-    }
-
     vl.values = values;
     vl.values_len = 1;
     sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-    sstrncpy (vl.plugin, "ip6tables", sizeof (vl.plugin));
+    sstrncpy (vl.plugin, (chain->ip_version == IPV6) ? "ip6tables" : "iptables",
+	    sizeof (vl.plugin));
 
     status = ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
-            "%s-%s", chain->table, chain->chain);
+	    "%s-%s", chain->table, chain->chain);
     if ((status < 1) || ((unsigned int)status >= sizeof (vl.plugin_instance)))
-        return (0);
+	return;
 
     if (chain->name[0] != '\0')
     {
-        sstrncpy (vl.type_instance, chain->name, sizeof (vl.type_instance));
+	sstrncpy (vl.type_instance, chain->name, sizeof (vl.type_instance));
     }
     else
     {
-        if (chain->rule_type == RTYPE_NUM)
-            ssnprintf (vl.type_instance, sizeof (vl.type_instance),
-                    "%i", chain->rule.num);
-        else
-            sstrncpy (vl.type_instance, (char *) match->data,
-                    sizeof (vl.type_instance));
+	if (chain->rule_type == RTYPE_NUM)
+	    ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+		    "%i", chain->rule.num);
+	else
+	    sstrncpy (vl.type_instance, comment, sizeof (vl.type_instance));
     }
 
     sstrncpy (vl.type, "ipt_bytes", sizeof (vl.type));
-    values[0].derive = (derive_t) entry->counters.bcnt;
+    values[0].derive = bytes;
     plugin_dispatch_values (&vl);
 
     sstrncpy (vl.type, "ipt_packets", sizeof (vl.type));
-    values[0].derive = (derive_t) entry->counters.pcnt;
+    values[0].derive = packets;
     plugin_dispatch_values (&vl);
+} /* void submit_counters */
+
+/* Orders the configured rules by table and chain, so that each table is
+ * fetched once and each chain is walked once, and within a chain by type
+ * and number or comment, so that the rules of a chain can be found without
+ * comparing every rule of the ruleset with every configured one. */
+static int chain_compare (const void *a, const void *b)
+{
+    const ip_chain_t *c0 = *((ip_chain_t * const *) a);
+    const ip_chain_t *c1 = *((ip_chain_t * const *) b);
+    int status;
+
+    if (c0->ip_version != c1->ip_version)
+	return ((c0->ip_version < c1->ip_version) ? -1 : 1);
+
+    status = strcmp (c0->table, c1->table);
+    if (status != 0)
+	return (status);
+
+    status = strcmp (c0->chain, c1->chain);
+    if (status != 0)
+	return (status);
+
+    if (c0->rule_type != c1->rule_type)
+	return ((c0->rule_type < c1->rule_type) ? -1 : 1);
+
+    if (c0->rule_type == RTYPE_NUM)
+	return ((c0->rule.num < c1->rule.num) ? -1
+		: (c0->rule.num > c1->rule.num) ? 1 : 0);
+    else if (c0->rule_type == RTYPE_COMMENT)
+	return (strcmp (c0->rule.comment, c1->rule.comment));
 
     return (0);
-} /* int submit_match */
+} /* int chain_compare */
+
+/* The configured rules of one chain, sorted by `chain_compare'. Rules
+ * selected by number come first, followed by those selected by comment and
+ * those selecting all rules with a comment. */
+typedef struct {
+    ip_chain_t **rules;
+    int rules_num;
+    int num_end;     /* end of the RTYPE_NUM rules */
+    int comment_end; /* end of the RTYPE_COMMENT rules */
+} chain_rules_t;
+
+static void chain_rules_init (chain_rules_t *cr, ip_chain_t **rules,
+	int rules_num)
+{
+    int i;
 
+    cr->rules = rules;
+    cr->rules_num = rules_num;
 
-/* This needs to return `int' for IPT_MATCH_ITERATE to work. */
-static int submit_match (const struct ipt_entry_match *match,
-		const struct ipt_entry *entry,
-		const ip_chain_t *chain,
-		int rule_num) 
+    for (i = 0; i < rules_num; i++)
+	if (rules[i]->rule_type != RTYPE_NUM)
+	    break;
+    cr->num_end = i;
+
+    for (; i < rules_num; i++)
+	if (rules[i]->rule_type != RTYPE_COMMENT)
+	    break;
+    cr->comment_end = i;
+} /* void chain_rules_init */
+
+/* Submits the counters of the rule with number `rule_num'. `*num_next' is
+ * the first RTYPE_NUM rule not handled yet. */
+static void submit_rule_num (const chain_rules_t *cr, int *num_next,
+	int rule_num, derive_t bytes, derive_t packets)
 {
-    int status;
-    value_t values[1];
-    value_list_t vl = VALUE_LIST_INIT;
+    while ((*num_next < cr->num_end)
+	    && (cr->rules[*num_next]->rule.num < rule_num))
+	(*num_next)++;
 
-    /* Select the rules to collect */
-    if (chain->rule_type == RTYPE_NUM)
+    while ((*num_next < cr->num_end)
+	    && (cr->rules[*num_next]->rule.num == rule_num))
     {
-	if (chain->rule.num != rule_num)
-	    return (0);
+	submit_counters (cr->rules[*num_next], NULL, bytes, packets);
+	(*num_next)++;
     }
-    else
-    {
-	if (strcmp (match->u.user.name, "comment") != 0)
-	    return (0);
-	if ((chain->rule_type == RTYPE_COMMENT)
-		&& (strcmp (chain->rule.comment, (char *) match->data) != 0))
-	    return (0);
-    }
-
-    vl.values = values;
-    vl.values_len = 1;
-    sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-    sstrncpy (vl.plugin, "iptables", sizeof (vl.plugin));
+} /* void submit_rule_num */
 
-    status = ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
-	    "%s-%s", chain->table, chain->chain);
-    if ((status < 1) || ((unsigned int)status >= sizeof (vl.plugin_instance)))
-	return (0);
+/* Submits the counters of a rule with the comment `comment'. */
+static void submit_rule_comment (const chain_rules_t *cr, const char *comment,
+	derive_t bytes, derive_t packets)
+{
+    int lo = cr->num_end;
+    int hi = cr->comment_end;
+    int i;
 
-    if (chain->name[0] != '\0')
+    /* Find the first rule with this comment. */
+    while (lo < hi)
     {
-	sstrncpy (vl.type_instance, chain->name, sizeof (vl.type_instance));
+	int mid = lo + (hi - lo) / 2;
+
+	if (strcmp (cr->rules[mid]->rule.comment, comment) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
     }
-    else
+
+    for (i = lo; i < cr->comment_end; i++)
     {
-	if (chain->rule_type == RTYPE_NUM)
-	    ssnprintf (vl.type_instance, sizeof (vl.type_instance),
-		    "%i", chain->rule.num);
-	else
-	    sstrncpy (vl.type_instance, (char *) match->data,
-		    sizeof (vl.type_instance));
+	if (strcmp (cr->rules[i]->rule.comment, comment) != 0)
+	    break;
+	submit_counters (cr->rules[i], comment, bytes, packets);
     }
 
-    sstrncpy (vl.type, "ipt_bytes", sizeof (vl.type));
-    values[0].derive = (derive_t) entry->counters.bcnt;
-    plugin_dispatch_values (&vl);
+    for (i = cr->comment_end; i < cr->rules_num; i++)
+	submit_counters (cr->rules[i], comment, bytes, packets);
+} /* void submit_rule_comment */
 
-    sstrncpy (vl.type, "ipt_packets", sizeof (vl.type));
-    values[0].derive = (derive_t) entry->counters.pcnt;
-    plugin_dispatch_values (&vl);
+/* These need to return `int' for IP6T_MATCH_ITERATE and IPT_MATCH_ITERATE to
+ * work. */
+static int find6_comment (const struct ip6t_entry_match *match,
+	const char **ret_comment)
+{
+    if (strcmp (match->u.user.name, "comment") != 0)
+	return (0);
+    *ret_comment = (const char *) match->data;
+    return (1);
+} /* int find6_comment */
 
-    return (0);
-} /* int submit_match */
+static int find_comment (const struct ipt_entry_match *match,
+	const char **ret_comment)
+{
+    if (strcmp (match->u.user.name, "comment") != 0)
+	return (0);
+    *ret_comment = (const char *) match->data;
+    return (1);
+} /* int find_comment */
 
 
 /* ipv6 submit_chain */
-static void submit6_chain( ip6tc_handle_t *handle, ip_chain_t *chain )
+static void submit6_chain (ip6tc_handle_t *handle, const chain_rules_t *cr)
 {
     const struct ip6t_entry *entry;
     int rule_num;
+    int num_next = 0;
 
-    /* Find first rule for chain and use the iterate macro */
-    entry = ip6tc_first_rule( chain->chain, handle );
+    /* Find first rule for chain and walk it once for all configured rules */
+    entry = ip6tc_first_rule (cr->rules[0]->chain, handle);
     if (entry == NULL)
     {
         DEBUG ("ip6tc_first_rule failed: %s", ip6tc_strerror (errno));
@@ -377,29 +427,38 @@ static void submit6_chain( ip6tc_handle_t *handle, ip_chain_t *chain )
     rule_num = 1;
     while (entry)
     {
-        if (chain->rule_type == RTYPE_NUM)
-        {
-            submit6_match (NULL, entry, chain, rule_num);
-        }
-        else
-        {
-            IP6T_MATCH_ITERATE( entry, submit6_match, entry, chain, rule_num );
-        }
+	derive_t bytes = (derive_t) entry->counters.bcnt;
+	derive_t packets = (derive_t) entry->counters.pcnt;
+
+	submit_rule_num (cr, &num_next, rule_num, bytes, packets);
+
+	if (cr->num_end < cr->rules_num)
+	{
+	    const char *comment = NULL;
 
-        entry = ip6tc_next_rule( entry, handle );
+	    IP6T_MATCH_ITERATE (entry, find6_comment, &comment);
+	    if (comment != NULL)
+		submit_rule_comment (cr, comment, bytes, packets);
+	}
+	else if (num_next >= cr->num_end)
+	    /* All configured rules have been found. */
+	    break;
+
+        entry = ip6tc_next_rule (entry, handle);
         rule_num++;
     } /* while (entry) */
 }
 
 
 /* ipv4 submit_chain */
-static void submit_chain( iptc_handle_t *handle, ip_chain_t *chain )
+static void submit_chain (iptc_handle_t *handle, const chain_rules_t *cr)
 {
     const struct ipt_entry *entry;
     int rule_num;
+    int num_next = 0;
 
-    /* Find first rule for chain and use the iterate macro */    
-    entry = iptc_first_rule( chain->chain, handle );
+    /* Find first rule for chain and walk it once for all configured rules */
+    entry = iptc_first_rule (cr->rules[0]->chain, handle);
     if (entry == NULL)
     {
 	DEBUG ("iptc_first_rule failed: %s", iptc_strerror (errno));
@@ -409,87 +468,138 @@ static void submit_chain( iptc_handle_t *handle, ip_chain_t *chain )
     rule_num = 1;
     while (entry)
     {
-	if (chain->rule_type == RTYPE_NUM)
-	{
-	    submit_match (NULL, entry, chain, rule_num);
-	}
-	else
+	derive_t bytes = (derive_t) entry->counters.bcnt;
+	derive_t packets = (derive_t) entry->counters.pcnt;
+
+	submit_rule_num (cr, &num_next, rule_num, bytes, packets);
+
+	if (cr->num_end < cr->rules_num)
 	{
-	    IPT_MATCH_ITERATE( entry, submit_match, entry, chain, rule_num );
+	    const char *comment = NULL;
+
+	    IPT_MATCH_ITERATE (entry, find_comment, &comment);
+	    if (comment != NULL)
+		submit_rule_comment (cr, comment, bytes, packets);
 	}
+	else if (num_next >= cr->num_end)
+	    /* All configured rules have been found. */
+	    break;
 
-	entry = iptc_next_rule( entry, handle );
+	entry = iptc_next_rule (entry, handle);
 	rule_num++;
     } /* while (entry) */
 }
 
+/* Returns the end of the group of rules starting at `begin' which have the
+ * same table, and the same chain if `same_chain' is true. */
+static int chain_group_end (int begin, int end, _Bool same_chain)
+{
+    int i;
+
+    for (i = begin + 1; i < end; i++)
+    {
+	if ((chain_list[i]->ip_version != chain_list[begin]->ip_version)
+		|| (strcmp (chain_list[i]->table, chain_list[begin]->table) != 0))
+	    break;
+	if (same_chain
+		&& (strcmp (chain_list[i]->chain, chain_list[begin]->chain) != 0))
+	    break;
+    }
+
+    return (i);
+} /* int chain_group_end */
+
+static int iptables_init (void)
+{
+    if (chain_num > 1)
+	qsort (chain_list, (size_t) chain_num, sizeof (*chain_list),
+		chain_compare);
+    return (0);
+} /* int iptables_init */
 
 static int iptables_read (void)
 {
     int i;
     int num_failures = 0;
-    ip_chain_t *chain;
 
-    /* Init the iptc handle structure and query the correct table */    
-    for (i = 0; i < chain_num; i++)
+    /* Take one snapshot of each table and walk each chain once */
+    i = 0;
+    while (i < chain_num)
     {
-	chain = chain_list[i];
-	
-	if (!chain)
-	{
-	    DEBUG ("iptables plugin: chain == NULL");
-	    continue;
-	}
+	int table_end = chain_group_end (i, chain_num, /* same chain = */ 0);
 
-	if ( chain->ip_version == IPV4 )
+	if ( chain_list[i]->ip_version == IPV4 )
         {
 #ifdef HAVE_IPTC_HANDLE_T
 		iptc_handle_t _handle;
 		iptc_handle_t *handle = &_handle;
 
-		*handle = iptc_init (chain->table);
+		*handle = iptc_init (chain_list[i]->table);
 #else
 		iptc_handle_t *handle;
-                handle = iptc_init (chain->table);
+                handle = iptc_init (chain_list[i]->table);
 #endif
 
                 if (!handle)
                 {
                         ERROR ("iptables plugin: iptc_init (%s) failed: %s",
-                                chain->table, iptc_strerror (errno));
-                        num_failures++;
+                                chain_list[i]->table, iptc_strerror (errno));
+                        num_failures += table_end - i;
+                        i = table_end;
                         continue;
                 }
 
-                submit_chain (handle, chain);
+		while (i < table_end)
+		{
+		    chain_rules_t cr;
+		    int chain_end = chain_group_end (i, table_end,
+			    /* same chain = */ 1);
+
+		    chain_rules_init (&cr, chain_list + i, chain_end - i);
+		    submit_chain (handle, &cr);
+		    i = chain_end;
+		}
                 iptc_free (handle);
         }
-        else if ( chain->ip_version == IPV6 )
+        else if ( chain_list[i]->ip_version == IPV6 )
         {
 #ifdef HAVE_IP6TC_HANDLE_T
 		ip6tc_handle_t _handle;
 		ip6tc_handle_t *handle = &_handle;
 
-		*handle = ip6tc_init (chain->table);
+		*handle = ip6tc_init (chain_list[i]->table);
 #else
                 ip6tc_handle_t *handle;
-                handle = ip6tc_init (chain->table);
+                handle = ip6tc_init (chain_list[i]->table);
 #endif
 
                 if (!handle)
                 {
                         ERROR ("iptables plugin: ip6tc_init (%s) failed: %s",
-                                chain->table, ip6tc_strerror (errno));
-                        num_failures++;
+                                chain_list[i]->table, ip6tc_strerror (errno));
+                        num_failures += table_end - i;
+                        i = table_end;
                         continue;
                 }
 
-                submit6_chain (handle, chain);
+		while (i < table_end)
+		{
+		    chain_rules_t cr;
+		    int chain_end = chain_group_end (i, table_end,
+			    /* same chain = */ 1);
+
+		    chain_rules_init (&cr, chain_list + i, chain_end - i);
+		    submit6_chain (handle, &cr);
+		    i = chain_end;
+		}
                 ip6tc_free (handle);
         }
-        else num_failures++;
-
-    } /* for (i = 0 .. chain_num) */
+        else
+	{
+	    num_failures += table_end - i;
+	    i = table_end;
+	}
+    } /* while (i < chain_num) */
 
     return ((num_failures < chain_num) ? 0 : -1);
 } /* int iptables_read */
@@ -515,6 +625,7 @@ void module_register (void)
 {
     plugin_register_config ("iptables", iptables_config,
 	    config_keys, config_keys_num);
+    plugin_register_init ("iptables", iptables_init);
     plugin_register_read ("iptables", iptables_read);
     plugin_register_shutdown ("iptables", iptables_shutdown);
 } /* void module_register */
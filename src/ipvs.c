@@ -33,6 +33,7 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_ignorelist.h"
 
 #if HAVE_ARPA_INET_H
 # include <arpa/inet.h>
@@ -53,14 +54,65 @@
 # include <ip_vs.h>
 #endif /* HAVE_IP_VS_H */
 
+#if HAVE_LINUX_GENETLINK_H && defined(IPVS_GENL_NAME)
+# define CIPVS_HAVE_NETLINK 1
+# include <linux/netlink.h>
+# include <linux/genetlink.h>
+#else
+# define CIPVS_HAVE_NETLINK 0
+#endif
+
 #define log_err(...) ERROR ("ipvs: " __VA_ARGS__)
 #define log_info(...) INFO ("ipvs: " __VA_ARGS__)
 
+/* A virtual service or real server, independent of the interface it has
+ * been read from. Addresses and ports are in network byte order. */
+typedef struct {
+	int      af;
+	uint8_t  addr[16];
+	uint16_t port;
+	uint16_t protocol;
+	uint32_t fwmark;
+
+	derive_t conns;
+	derive_t inpkts;
+	derive_t outpkts;
+	derive_t inbytes;
+	derive_t outbytes;
+} cipvs_entry_t;
+
 /*
  * private variables
  */
+static const char *config_keys[] =
+{
+	"Service",
+	"IgnoreSelected"
+};
+static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+
+static ignorelist_t *ignorelist = NULL;
+
 static int sockfd = -1;
 
+#if CIPVS_HAVE_NETLINK
+static int nl_sock = -1;
+static uint32_t nl_seq = 0;
+/* The generic netlink family of IPVS, zero if it has not been resolved. */
+static uint16_t nl_family = 0;
+
+/* The services selected by the last dump, whose real servers are requested
+ * once the dump is complete. */
+typedef struct {
+	cipvs_entry_t se;
+	char pi[DATA_MAX_NAME_LEN];
+} cipvs_service_t;
+
+static cipvs_service_t *nl_services = NULL;
+static size_t nl_services_num = 0;
+static size_t nl_services_size = 0;
+#endif /* CIPVS_HAVE_NETLINK */
+
 /*
  * libipvs API
  */
@@ -132,10 +184,309 @@ static struct ip_vs_get_dests *ipvs_get_dests (struct ip_vs_service_entry *se)
 	return ret;
 } /* ip_vs_get_dests */
 
+#if CIPVS_HAVE_NETLINK
+/*
+ * generic netlink API
+ *
+ * The services are read with a single dump, including 64 bit counters where
+ * the kernel provides them. The kernel only dumps the real servers of one
+ * service at a time, so those are requested with one dump per selected
+ * service, after the service dump has completed.
+ */
+static void cipvs_nl_close (void)
+{
+	if (nl_sock >= 0) {
+		close (nl_sock);
+		nl_sock = -1;
+	}
+} /* cipvs_nl_close */
+
+static int cipvs_nl_open (void)
+{
+	struct sockaddr_nl sa;
+
+	if (nl_sock >= 0)
+		return 0;
+
+	nl_sock = socket (AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+	if (nl_sock < 0) {
+		char errbuf[1024];
+		log_err ("cipvs_nl_open: socket (NETLINK_GENERIC) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return -1;
+	}
+
+	memset (&sa, 0, sizeof (sa));
+	sa.nl_family = AF_NETLINK;
+	if (0 != bind (nl_sock, (struct sockaddr *) &sa, sizeof (sa))) {
+		char errbuf[1024];
+		log_err ("cipvs_nl_open: bind (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		cipvs_nl_close ();
+		return -1;
+	}
+	return 0;
+} /* cipvs_nl_open */
+
+/* Appends an attribute to the message `nlh', which has room for `size'
+ * bytes. Nested attributes are closed with cipvs_nl_nest_end. */
+static struct nlattr *cipvs_nl_put (struct nlmsghdr *nlh, size_t size,
+		int type, const void *data, size_t len)
+{
+	struct nlattr *nla;
+
+	if (NLMSG_ALIGN (nlh->nlmsg_len) + NLA_HDRLEN + NLA_ALIGN (len) > size)
+		return NULL;
+
+	nla = (struct nlattr *) (((char *) nlh) + NLMSG_ALIGN (nlh->nlmsg_len));
+	nla->nla_type = (uint16_t) type;
+	nla->nla_len = (uint16_t) (NLA_HDRLEN + len);
+	if (len > 0)
+		memcpy (((char *) nla) + NLA_HDRLEN, data, len);
+
+	nlh->nlmsg_len = NLMSG_ALIGN (nlh->nlmsg_len) + NLA_ALIGN (nla->nla_len);
+	return nla;
+} /* cipvs_nl_put */
+
+static void cipvs_nl_nest_end (struct nlmsghdr *nlh, struct nlattr *nest)
+{
+	nest->nla_len = (uint16_t) ((((char *) nlh) + nlh->nlmsg_len)
+			- ((char *) nest));
+} /* cipvs_nl_nest_end */
+
+/* Indexes the attributes of `len' bytes at `data' by their type. Unknown
+ * types are skipped. */
+static void cipvs_nl_parse (const struct nlattr **tb, int max,
+		const void *data, size_t len)
+{
+	size_t offset = 0;
+
+	memset (tb, 0, sizeof (*tb) * (max + 1));
+
+	while (offset + NLA_HDRLEN <= len) {
+		const struct nlattr *nla;
+		int type;
+
+		nla = (const struct nlattr *) (((const char *) data) + offset);
+		if ((nla->nla_len < NLA_HDRLEN) || (offset + nla->nla_len > len))
+			break;
+
+		type = nla->nla_type & NLA_TYPE_MASK;
+		if (type <= max)
+			tb[type] = nla;
+
+		offset += NLA_ALIGN (nla->nla_len);
+	}
+} /* cipvs_nl_parse */
+
+#define CIPVS_NLA_DATA(nla) ((const void *) (((const char *) (nla)) + NLA_HDRLEN))
+#define CIPVS_NLA_LEN(nla) ((size_t) ((nla)->nla_len - NLA_HDRLEN))
+
+static uint64_t cipvs_nl_get_uint (const struct nlattr *nla)
+{
+	if (NULL == nla)
+		return 0;
+
+	if (CIPVS_NLA_LEN (nla) >= sizeof (uint64_t)) {
+		uint64_t v;
+		memcpy (&v, CIPVS_NLA_DATA (nla), sizeof (v));
+		return v;
+	}
+	else if (CIPVS_NLA_LEN (nla) >= sizeof (uint32_t)) {
+		uint32_t v;
+		memcpy (&v, CIPVS_NLA_DATA (nla), sizeof (v));
+		return v;
+	}
+	else if (CIPVS_NLA_LEN (nla) >= sizeof (uint16_t)) {
+		uint16_t v;
+		memcpy (&v, CIPVS_NLA_DATA (nla), sizeof (v));
+		return v;
+	}
+	return 0;
+} /* cipvs_nl_get_uint */
+
+/* Reads the counters from the nested statistics attributes, preferring the
+ * 64 bit ones. */
+static void cipvs_nl_get_stats (cipvs_entry_t *e,
+		const struct nlattr *stats64, const struct nlattr *stats)
+{
+	const struct nlattr *tb[IPVS_STATS_ATTR_MAX + 1];
+	const struct nlattr *nla = (NULL != stats64) ? stats64 : stats;
+
+	if (NULL == nla)
+		return;
+
+	cipvs_nl_parse (tb, IPVS_STATS_ATTR_MAX,
+			CIPVS_NLA_DATA (nla), CIPVS_NLA_LEN (nla));
+
+	e->conns    = (derive_t) cipvs_nl_get_uint (tb[IPVS_STATS_ATTR_CONNS]);
+	e->inpkts   = (derive_t) cipvs_nl_get_uint (tb[IPVS_STATS_ATTR_INPKTS]);
+	e->outpkts  = (derive_t) cipvs_nl_get_uint (tb[IPVS_STATS_ATTR_OUTPKTS]);
+	e->inbytes  = (derive_t) cipvs_nl_get_uint (tb[IPVS_STATS_ATTR_INBYTES]);
+	e->outbytes = (derive_t) cipvs_nl_get_uint (tb[IPVS_STATS_ATTR_OUTBYTES]);
+} /* cipvs_nl_get_stats */
+
+/* Sends the request `req' and calls `callback' with the attributes of each
+ * message of the reply, until the (dump) reply is complete. */
+static int cipvs_nl_query (struct nlmsghdr *req,
+		int (*callback) (const struct nlattr *attrs, size_t attrs_len,
+			void *user_data),
+		void *user_data)
+{
+	char buffer[32768];
+	_Bool done = 0;
+	int status = 0;
+
+	if (0 != cipvs_nl_open ())
+		return -1;
+
+	req->nlmsg_seq = ++nl_seq;
+	if (0 > send (nl_sock, req, req->nlmsg_len, /* flags = */ 0)) {
+		char errbuf[1024];
+		log_err ("cipvs_nl_query: send (AF_NETLINK) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		cipvs_nl_close ();
+		return -1;
+	}
+
+	while (!done) {
+		struct nlmsghdr *nlh;
+		ssize_t len;
+
+		len = recv (nl_sock, buffer, sizeof (buffer), /* flags = */ 0);
+		if (len < 0) {
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+			log_err ("cipvs_nl_query: recv (AF_NETLINK) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			cipvs_nl_close ();
+			return -1;
+		}
+
+		for (nlh = (struct nlmsghdr *) buffer;
+				NLMSG_OK (nlh, (size_t) len);
+				nlh = NLMSG_NEXT (nlh, len)) {
+			size_t offset;
+
+			/* Left over from a previous, failed dump. */
+			if (nlh->nlmsg_seq != nl_seq)
+				continue;
+
+			if (nlh->nlmsg_type == NLMSG_DONE) {
+				done = 1;
+				break;
+			}
+			else if (nlh->nlmsg_type == NLMSG_ERROR) {
+				const struct nlmsgerr *err = NLMSG_DATA (nlh);
+
+				done = 1;
+				if (0 != err->error) {
+					errno = -err->error;
+					status = -1;
+				}
+				break;
+			}
+
+			offset = NLMSG_LENGTH (GENL_HDRLEN);
+			if ((0 == status) && (nlh->nlmsg_len >= offset))
+				status = (*callback) ((const struct nlattr *)
+						(((const char *) nlh) + offset),
+						nlh->nlmsg_len - offset, user_data);
+
+			/* Without NLM_F_MULTI, the message is the only one. */
+			if (0 == (nlh->nlmsg_flags & NLM_F_MULTI)) {
+				done = 1;
+				break;
+			}
+		}
+	}
+	return status;
+} /* cipvs_nl_query */
+
+static void cipvs_nl_init_request (struct nlmsghdr *nlh, uint16_t type,
+		uint16_t flags, uint8_t cmd, uint8_t version)
+{
+	struct genlmsghdr *genl;
+
+	nlh->nlmsg_len = NLMSG_LENGTH (GENL_HDRLEN);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_pid = 0;
+
+	genl = NLMSG_DATA (nlh);
+	memset (genl, 0, GENL_HDRLEN);
+	genl->cmd = cmd;
+	genl->version = version;
+} /* cipvs_nl_init_request */
+
+static int cipvs_nl_family_cb (const struct nlattr *attrs, size_t attrs_len,
+		void *user_data)
+{
+	const struct nlattr *tb[CTRL_ATTR_MAX + 1];
+
+	cipvs_nl_parse (tb, CTRL_ATTR_MAX, attrs, attrs_len);
+	if (NULL == tb[CTRL_ATTR_FAMILY_ID])
+		return -1;
+
+	*((uint16_t *) user_data) =
+		(uint16_t) cipvs_nl_get_uint (tb[CTRL_ATTR_FAMILY_ID]);
+	return 0;
+} /* cipvs_nl_family_cb */
+
+/* Looks up the generic netlink family of IPVS. Fails if the kernel doesn't
+ * provide the netlink interface. */
+static int cipvs_nl_resolve (void)
+{
+	union {
+		struct nlmsghdr nlh;
+		char buffer[NLMSG_SPACE (GENL_HDRLEN) + 64];
+	} req;
+	uint16_t family = 0;
+
+	memset (&req, 0, sizeof (req));
+	cipvs_nl_init_request (&req.nlh, GENL_ID_CTRL, /* flags = */ 0,
+			CTRL_CMD_GETFAMILY, /* version = */ 1);
+	if (NULL == cipvs_nl_put (&req.nlh, sizeof (req), CTRL_ATTR_FAMILY_NAME,
+				IPVS_GENL_NAME, sizeof (IPVS_GENL_NAME)))
+		return -1;
+
+	if ((0 != cipvs_nl_query (&req.nlh, cipvs_nl_family_cb, &family))
+			|| (0 == family))
+		return -1;
+
+	nl_family = family;
+	return 0;
+} /* cipvs_nl_resolve */
+#endif /* CIPVS_HAVE_NETLINK */
+
 /*
  * collectd plugin API and helper functions
  */
-static int cipvs_init (void)
+static int cipvs_config (const char *key, const char *value)
+{
+	if (NULL == ignorelist)
+		ignorelist = ignorelist_create (/* invert = */ 1);
+	if (NULL == ignorelist)
+		return 1;
+
+	if (0 == strcasecmp (key, "Service")) {
+		ignorelist_add (ignorelist, value);
+	}
+	else if (0 == strcasecmp (key, "IgnoreSelected")) {
+		int invert = 1;
+		if (IS_TRUE (value))
+			invert = 0;
+		ignorelist_set_invert (ignorelist, invert);
+	}
+	else {
+		return -1;
+	}
+	return 0;
+} /* cipvs_config */
+
+static int cipvs_init_sockopt (void)
 {
 	struct ip_vs_getinfo ipvs_info;
 
@@ -173,6 +524,19 @@ static int cipvs_init (void)
 				NVERSION (ipvs_info.version));
 	}
 	return 0;
+} /* cipvs_init_sockopt */
+
+static int cipvs_init (void)
+{
+#if CIPVS_HAVE_NETLINK
+	if (0 == cipvs_nl_resolve ()) {
+		log_info ("Using the generic netlink interface of IPVS.");
+		return 0;
+	}
+	cipvs_nl_close ();
+#endif /* CIPVS_HAVE_NETLINK */
+
+	return cipvs_init_sockopt ();
 } /* cipvs_init */
 
 /*
@@ -181,19 +545,18 @@ static int cipvs_init (void)
  */
 
 /* plugin instance */
-static int get_pi (struct ip_vs_service_entry *se, char *pi, size_t size)
+static int get_pi (cipvs_entry_t *se, char *pi, size_t size)
 {
-	struct in_addr addr;
+	char addr[INET6_ADDRSTRLEN];
 	int len = 0;
 
 	if ((NULL == se) || (NULL == pi))
 		return 0;
 
-	addr.s_addr = se->addr;
+	if (NULL == inet_ntop (se->af, se->addr, addr, sizeof (addr)))
+		return -1;
 
-	/* inet_ntoa() returns a pointer to a statically allocated buffer
-	 * I hope non-glibc systems behave the same */
-	len = ssnprintf (pi, size, "%s_%s%u", inet_ntoa (addr),
+	len = ssnprintf (pi, size, "%s_%s%u", addr,
 			(se->protocol == IPPROTO_TCP) ? "TCP" : "UDP",
 			ntohs (se->port));
 
@@ -205,20 +568,18 @@ static int get_pi (struct ip_vs_service_entry *se, char *pi, size_t size)
 } /* get_pi */
 
 /* type instance */
-static int get_ti (struct ip_vs_dest_entry *de, char *ti, size_t size)
+static int get_ti (cipvs_entry_t *de, char *ti, size_t size)
 {
-	struct in_addr addr;
+	char addr[INET6_ADDRSTRLEN];
 	int len = 0;
 
 	if ((NULL == de) || (NULL == ti))
 		return 0;
 
-	addr.s_addr = de->addr;
+	if (NULL == inet_ntop (de->af, de->addr, addr, sizeof (addr)))
+		return -1;
 
-	/* inet_ntoa() returns a pointer to a statically allocated buffer
-	 * I hope non-glibc systems behave the same */
-	len = ssnprintf (ti, size, "%s_%u", inet_ntoa (addr),
-			ntohs (de->port));
+	len = ssnprintf (ti, size, "%s_%u", addr, ntohs (de->port));
 
 	if ((0 > len) || (size <= len)) {
 		log_err ("type instance truncated: %s", ti);
@@ -271,44 +632,80 @@ static void cipvs_submit_if (char *pi, char *t, char *ti,
 	return;
 } /* cipvs_submit_if */
 
-static void cipvs_submit_dest (char *pi, struct ip_vs_dest_entry *de) {
-	struct ip_vs_stats_user stats = de->stats;
+static void cipvs_submit_entry (char *pi, char *ti, cipvs_entry_t *e)
+{
+	cipvs_submit_connections (pi, ti, e->conns);
+	cipvs_submit_if (pi, "if_packets", ti, e->inpkts, e->outpkts);
+	cipvs_submit_if (pi, "if_octets", ti, e->inbytes, e->outbytes);
+	return;
+} /* cipvs_submit_entry */
 
+static void cipvs_submit_dest (char *pi, cipvs_entry_t *de) {
 	char ti[DATA_MAX_NAME_LEN];
 
 	if (0 != get_ti (de, ti, sizeof (ti)))
 		return;
 
-	cipvs_submit_connections (pi, ti, stats.conns);
-	cipvs_submit_if (pi, "if_packets", ti, stats.inpkts, stats.outpkts);
-	cipvs_submit_if (pi, "if_octets", ti, stats.inbytes, stats.outbytes);
+	cipvs_submit_entry (pi, ti, de);
 	return;
 } /* cipvs_submit_dest */
 
+/* Converts the `struct ip_vs_stats_user' of a getsockopt entry. */
+#define CIPVS_COPY_STATS(e, stats) do { \
+	(e)->conns    = (derive_t) (stats).conns;    \
+	(e)->inpkts   = (derive_t) (stats).inpkts;   \
+	(e)->outpkts  = (derive_t) (stats).outpkts;  \
+	(e)->inbytes  = (derive_t) (stats).inbytes;  \
+	(e)->outbytes = (derive_t) (stats).outbytes; \
+} while (0)
+
 static void cipvs_submit_service (struct ip_vs_service_entry *se)
 {
-	struct ip_vs_stats_user  stats = se->stats;
-	struct ip_vs_get_dests  *dests = ipvs_get_dests (se);
+	struct ip_vs_get_dests *dests;
+	cipvs_entry_t e;
 
 	char pi[DATA_MAX_NAME_LEN];
 
 	int i = 0;
 
-	if (0 != get_pi (se, pi, sizeof (pi)))
+	memset (&e, 0, sizeof (e));
+	e.af       = AF_INET;
+	memcpy (e.addr, &se->addr, sizeof (se->addr));
+	e.port     = se->port;
+	e.protocol = se->protocol;
+	e.fwmark   = se->fwmark;
+	CIPVS_COPY_STATS (&e, se->stats);
+
+	if (0 != get_pi (&e, pi, sizeof (pi)))
+		return;
+
+	/* Don't even ask for the real servers of ignored services. */
+	if (0 != ignorelist_match (ignorelist, pi))
 		return;
 
-	cipvs_submit_connections (pi, NULL, stats.conns);
-	cipvs_submit_if (pi, "if_packets", NULL, stats.inpkts, stats.outpkts);
-	cipvs_submit_if (pi, "if_octets", NULL, stats.inbytes, stats.outbytes);
+	cipvs_submit_entry (pi, NULL, &e);
+
+	if (NULL == (dests = ipvs_get_dests (se)))
+		return;
+
+	for (i = 0; i < dests->num_dests; ++i) {
+		struct ip_vs_dest_entry *de = &dests->entrytable[i];
+		cipvs_entry_t d;
+
+		memset (&d, 0, sizeof (d));
+		d.af   = AF_INET;
+		memcpy (d.addr, &de->addr, sizeof (de->addr));
+		d.port = de->port;
+		CIPVS_COPY_STATS (&d, de->stats);
 
-	for (i = 0; i < dests->num_dests; ++i)
-		cipvs_submit_dest (pi, &dests->entrytable[i]);
+		cipvs_submit_dest (pi, &d);
+	}
 
 	free (dests);
 	return;
 } /* cipvs_submit_service */
 
-static int cipvs_read (void)
+static int cipvs_read_sockopt (void)
 {
 	struct ip_vs_get_services *services = NULL;
 	int i = 0;
@@ -324,6 +721,195 @@ static int cipvs_read (void)
 
 	free (services);
 	return 0;
+} /* cipvs_read_sockopt */
+
+#if CIPVS_HAVE_NETLINK
+static void cipvs_nl_get_addr (cipvs_entry_t *e, const struct nlattr *nla)
+{
+	size_t len;
+
+	if (NULL == nla)
+		return;
+
+	len = CIPVS_NLA_LEN (nla);
+	if (len > sizeof (e->addr))
+		len = sizeof (e->addr);
+	memcpy (e->addr, CIPVS_NLA_DATA (nla), len);
+} /* cipvs_nl_get_addr */
+
+/* Dispatches one service of the dump and remembers it if it is selected. */
+static int cipvs_nl_service_cb (const struct nlattr *attrs, size_t attrs_len,
+		void __attribute__((unused)) *user_data)
+{
+	const struct nlattr *cmd[IPVS_CMD_ATTR_MAX + 1];
+	const struct nlattr *tb[IPVS_SVC_ATTR_MAX + 1];
+	cipvs_service_t *s;
+
+	cipvs_nl_parse (cmd, IPVS_CMD_ATTR_MAX, attrs, attrs_len);
+	if (NULL == cmd[IPVS_CMD_ATTR_SERVICE])
+		return 0;
+
+	cipvs_nl_parse (tb, IPVS_SVC_ATTR_MAX,
+			CIPVS_NLA_DATA (cmd[IPVS_CMD_ATTR_SERVICE]),
+			CIPVS_NLA_LEN (cmd[IPVS_CMD_ATTR_SERVICE]));
+
+	if (nl_services_num >= nl_services_size) {
+		size_t size = (nl_services_size > 0) ? (2 * nl_services_size) : 64;
+		cipvs_service_t *tmp;
+
+		tmp = realloc (nl_services, size * sizeof (*tmp));
+		if (NULL == tmp) {
+			log_err ("cipvs_nl_service_cb: realloc failed.");
+			return -1;
+		}
+		nl_services = tmp;
+		nl_services_size = size;
+	}
+
+	s = nl_services + nl_services_num;
+	memset (s, 0, sizeof (*s));
+
+	s->se.af       = (int) cipvs_nl_get_uint (tb[IPVS_SVC_ATTR_AF]);
+	s->se.protocol = (uint16_t) cipvs_nl_get_uint (tb[IPVS_SVC_ATTR_PROTOCOL]);
+	s->se.port     = (uint16_t) cipvs_nl_get_uint (tb[IPVS_SVC_ATTR_PORT]);
+	s->se.fwmark   = (uint32_t) cipvs_nl_get_uint (tb[IPVS_SVC_ATTR_FWMARK]);
+	cipvs_nl_get_addr (&s->se, tb[IPVS_SVC_ATTR_ADDR]);
+#if HAVE_DECL_IPVS_SVC_ATTR_STATS64
+	cipvs_nl_get_stats (&s->se, tb[IPVS_SVC_ATTR_STATS64],
+			tb[IPVS_SVC_ATTR_STATS]);
+#else
+	cipvs_nl_get_stats (&s->se, NULL, tb[IPVS_SVC_ATTR_STATS]);
+#endif
+
+	if (0 != get_pi (&s->se, s->pi, sizeof (s->pi)))
+		return 0;
+
+	if (0 != ignorelist_match (ignorelist, s->pi))
+		return 0;
+
+	cipvs_submit_entry (s->pi, NULL, &s->se);
+	nl_services_num++;
+	return 0;
+} /* cipvs_nl_service_cb */
+
+static int cipvs_nl_dest_cb (const struct nlattr *attrs, size_t attrs_len,
+		void *user_data)
+{
+	cipvs_service_t *s = user_data;
+	const struct nlattr *cmd[IPVS_CMD_ATTR_MAX + 1];
+	const struct nlattr *tb[IPVS_DEST_ATTR_MAX + 1];
+	cipvs_entry_t de;
+
+	cipvs_nl_parse (cmd, IPVS_CMD_ATTR_MAX, attrs, attrs_len);
+	if (NULL == cmd[IPVS_CMD_ATTR_DEST])
+		return 0;
+
+	cipvs_nl_parse (tb, IPVS_DEST_ATTR_MAX,
+			CIPVS_NLA_DATA (cmd[IPVS_CMD_ATTR_DEST]),
+			CIPVS_NLA_LEN (cmd[IPVS_CMD_ATTR_DEST]));
+
+	memset (&de, 0, sizeof (de));
+	/* Real servers may use a different address family than the service
+	 * with recent kernels. */
+	de.af = s->se.af;
+#if HAVE_DECL_IPVS_DEST_ATTR_ADDR_FAMILY
+	if (NULL != tb[IPVS_DEST_ATTR_ADDR_FAMILY])
+		de.af = (int) cipvs_nl_get_uint (tb[IPVS_DEST_ATTR_ADDR_FAMILY]);
+#endif
+	de.port = (uint16_t) cipvs_nl_get_uint (tb[IPVS_DEST_ATTR_PORT]);
+	cipvs_nl_get_addr (&de, tb[IPVS_DEST_ATTR_ADDR]);
+#if HAVE_DECL_IPVS_SVC_ATTR_STATS64
+	cipvs_nl_get_stats (&de, tb[IPVS_DEST_ATTR_STATS64],
+			tb[IPVS_DEST_ATTR_STATS]);
+#else
+	cipvs_nl_get_stats (&de, NULL, tb[IPVS_DEST_ATTR_STATS]);
+#endif
+
+	cipvs_submit_dest (s->pi, &de);
+	return 0;
+} /* cipvs_nl_dest_cb */
+
+static int cipvs_nl_read_dests (cipvs_service_t *s)
+{
+	union {
+		struct nlmsghdr nlh;
+		char buffer[NLMSG_SPACE (GENL_HDRLEN) + 128];
+	} req;
+	struct nlattr *nest;
+	uint16_t af = (uint16_t) s->se.af;
+
+	memset (&req, 0, sizeof (req));
+	cipvs_nl_init_request (&req.nlh, nl_family, NLM_F_DUMP,
+			IPVS_CMD_GET_DEST, IPVS_GENL_VERSION);
+
+	nest = cipvs_nl_put (&req.nlh, sizeof (req),
+			IPVS_CMD_ATTR_SERVICE | NLA_F_NESTED, NULL, 0);
+	if (NULL == nest)
+		return -1;
+
+	cipvs_nl_put (&req.nlh, sizeof (req), IPVS_SVC_ATTR_AF, &af, sizeof (af));
+	if (0 != s->se.fwmark) {
+		cipvs_nl_put (&req.nlh, sizeof (req), IPVS_SVC_ATTR_FWMARK,
+				&s->se.fwmark, sizeof (s->se.fwmark));
+	}
+	else {
+		cipvs_nl_put (&req.nlh, sizeof (req), IPVS_SVC_ATTR_PROTOCOL,
+				&s->se.protocol, sizeof (s->se.protocol));
+		cipvs_nl_put (&req.nlh, sizeof (req), IPVS_SVC_ATTR_ADDR,
+				s->se.addr, sizeof (s->se.addr));
+		cipvs_nl_put (&req.nlh, sizeof (req), IPVS_SVC_ATTR_PORT,
+				&s->se.port, sizeof (s->se.port));
+	}
+	cipvs_nl_nest_end (&req.nlh, nest);
+
+	return cipvs_nl_query (&req.nlh, cipvs_nl_dest_cb, s);
+} /* cipvs_nl_read_dests */
+
+static int cipvs_read_netlink (void)
+{
+	union {
+		struct nlmsghdr nlh;
+		char buffer[NLMSG_SPACE (GENL_HDRLEN)];
+	} req;
+	size_t i;
+
+	/* The family changes if the module has been reloaded. */
+	if ((0 == nl_family) && (0 != cipvs_nl_resolve ()))
+		return -1;
+
+	memset (&req, 0, sizeof (req));
+	cipvs_nl_init_request (&req.nlh, nl_family, NLM_F_DUMP,
+			IPVS_CMD_GET_SERVICE, IPVS_GENL_VERSION);
+
+	nl_services_num = 0;
+	if (0 != cipvs_nl_query (&req.nlh, cipvs_nl_service_cb, NULL)) {
+		char errbuf[1024];
+		log_err ("cipvs_read: Dumping the services failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		nl_family = 0;
+		return -1;
+	}
+
+	for (i = 0; i < nl_services_num; i++) {
+		if (0 != cipvs_nl_read_dests (nl_services + i)) {
+			char errbuf[1024];
+			log_err ("cipvs_read: Dumping the real servers of %s "
+					"failed: %s", nl_services[i].pi,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+	}
+	return 0;
+} /* cipvs_read_netlink */
+#endif /* CIPVS_HAVE_NETLINK */
+
+static int cipvs_read (void)
+{
+#if CIPVS_HAVE_NETLINK
+	if (sockfd < 0)
+		return cipvs_read_netlink ();
+#endif /* CIPVS_HAVE_NETLINK */
+
+	return cipvs_read_sockopt ();
 } /* cipvs_read */
 
 static int cipvs_shutdown (void)
@@ -332,11 +918,20 @@ static int cipvs_shutdown (void)
 		close (sockfd);
 	sockfd = -1;
 
+#if CIPVS_HAVE_NETLINK
+	cipvs_nl_close ();
+	sfree (nl_services);
+	nl_services_num = 0;
+	nl_services_size = 0;
+#endif /* CIPVS_HAVE_NETLINK */
+
 	return 0;
 } /* cipvs_shutdown */
 
 void module_register (void)
 {
+	plugin_register_config ("ipvs", cipvs_config,
+			config_keys, config_keys_num);
 	plugin_register_init ("ipvs", cipvs_init);
 	plugin_register_read ("ipvs", cipvs_read);
 	plugin_register_shutdown ("ipvs", cipvs_shutdown);
@@ -26,6 +26,8 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
+#include "utils_thread.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -37,15 +39,52 @@
 static const char *config_keys[] =
 {
 	"Irq",
-	"IgnoreSelected"
+	"IgnoreSelected",
+	"ReportByCpu",
+	"ReportByNode"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *ignorelist = NULL;
 
+/* Interrupts reported per CPU or per NUMA node in addition to the total,
+ * selected by number or by the name of their device. */
+static ignorelist_t *report_by_cpu = NULL;
+static ignorelist_t *report_by_node = NULL;
+
+static procfs_file_t *proc_interrupts = NULL;
+
+/* The CPU of each column, from the header of /proc/interrupts, which only
+ * lists online CPUs. */
+static int *irq_cpus = NULL;
+static size_t irq_cpus_num = 0;
+static size_t irq_cpus_size = 0;
+
+/* Per-column counts of the current line. */
+static derive_t *irq_counts = NULL;
+static size_t irq_counts_size = 0;
+
+/* The NUMA node of each CPU, or -1. */
+static int *cpu_node = NULL;
+static size_t cpu_node_num = 0;
+static int nodes_num = 0;
+static derive_t *node_counts = NULL;
+
 /*
  * Private functions
  */
+static int irq_config_select (ignorelist_t **list, const char *value)
+{
+	if (*list == NULL)
+	{
+		*list = ignorelist_create (/* invert = */ 1);
+		if (*list == NULL)
+			return (-1);
+	}
+
+	return (ignorelist_add (*list, value));
+} /* int irq_config_select */
+
 static int irq_config (const char *key, const char *value)
 {
 	if (ignorelist == NULL)
@@ -62,6 +101,14 @@ static int irq_config (const char *key, const char *value)
 			invert = 0;
 		ignorelist_set_invert (ignorelist, invert);
 	}
+	else if (strcasecmp (key, "ReportByCpu") == 0)
+	{
+		return (irq_config_select (&report_by_cpu, value));
+	}
+	else if (strcasecmp (key, "ReportByNode") == 0)
+	{
+		return (irq_config_select (&report_by_node, value));
+	}
 	else
 	{
 		return (-1);
@@ -70,32 +117,210 @@ static int irq_config (const char *key, const char *value)
 	return (0);
 }
 
-static void irq_submit (const char *irq_name, derive_t value)
+static int irq_numa_init (void)
+{
+	int status;
+
+	status = thread_cpu_nodes (&cpu_node, &cpu_node_num);
+	if (status < 0)
+	{
+		WARNING ("irq plugin: Cannot determine the NUMA node of each "
+				"CPU. Not reporting NUMA nodes.");
+		return (-1);
+	}
+	nodes_num = status;
+
+	node_counts = calloc ((size_t) nodes_num, sizeof (*node_counts));
+	if (node_counts == NULL)
+	{
+		ERROR ("irq plugin: calloc failed.");
+		nodes_num = 0;
+		return (-1);
+	}
+
+	return (0);
+} /* int irq_numa_init */
+
+static int irq_init (void)
+{
+	if ((report_by_node != NULL) && (node_counts == NULL))
+		irq_numa_init ();
+
+	return (0);
+} /* int irq_init */
+
+static void irq_submit (const char *plugin_instance, const char *irq_name,
+		derive_t value)
 {
 	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	if (ignorelist_match (ignorelist, irq_name) != 0)
-		return;
-
 	values[0].derive = value;
 
 	vl.values = values;
 	vl.values_len = 1;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "irq", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, plugin_instance,
+			sizeof (vl.plugin_instance));
 	sstrncpy (vl.type, "irq", sizeof (vl.type));
 	sstrncpy (vl.type_instance, irq_name, sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
 } /* void irq_submit */
 
+/* Reads the CPU of each column from the header line, "CPU0 CPU1 ...". */
+static int irq_parse_header (char *line)
+{
+	char *ptr = line;
+
+	irq_cpus_num = 0;
+	while (*ptr != 0)
+	{
+		char *end = NULL;
+		long cpu;
+
+		while ((*ptr == ' ') || (*ptr == '\t'))
+			ptr++;
+		if (*ptr == 0)
+			break;
+
+		if (strncmp (ptr, "CPU", 3) != 0)
+			return (-1);
+		cpu = strtol (ptr + 3, &end, 10);
+		if ((end == ptr + 3) || (cpu < 0) || (cpu > INT_MAX))
+			return (-1);
+		ptr = end;
+
+		if (irq_cpus_num >= irq_cpus_size)
+		{
+			size_t size = (irq_cpus_size > 0) ? (2 * irq_cpus_size) : 64;
+			int *tmp_cpus;
+			derive_t *tmp_counts;
+
+			tmp_cpus = realloc (irq_cpus, size * sizeof (*irq_cpus));
+			if (tmp_cpus == NULL)
+				return (-1);
+			irq_cpus = tmp_cpus;
+
+			tmp_counts = realloc (irq_counts, size * sizeof (*irq_counts));
+			if (tmp_counts == NULL)
+				return (-1);
+			irq_counts = tmp_counts;
+
+			irq_cpus_size = size;
+			irq_counts_size = size;
+		}
+
+		irq_cpus[irq_cpus_num] = (int) cpu;
+		irq_cpus_num++;
+	}
+
+	return ((irq_cpus_num > 0) ? 0 : -1);
+} /* int irq_parse_header */
+
+/* Parses up to `irq_cpus_num' counts following the IRQ's name into
+ * `irq_counts', without splitting the line, and advances `*ptr' past them.
+ * Lines such as "ERR:" have fewer columns. Returns the number of counts. */
+static size_t irq_parse_counts (char **ptr)
+{
+	char *p = *ptr;
+	size_t num;
+
+	for (num = 0; num < irq_cpus_num; num++)
+	{
+		derive_t value = 0;
+		char *start;
+
+		while ((*p == ' ') || (*p == '\t'))
+			p++;
+
+		start = p;
+		while ((*p >= '0') && (*p <= '9'))
+		{
+			value = (value * 10) + (*p - '0');
+			p++;
+		}
+
+		/* Not a number, such as the interrupt chip's name. */
+		if ((p == start) || ((*p != ' ') && (*p != '\t') && (*p != 0)))
+		{
+			p = start;
+			break;
+		}
+
+		irq_counts[num] = value;
+	}
+
+	*ptr = p;
+	return (num);
+} /* size_t irq_parse_counts */
+
+/* Returns the last word of `str', which is the name of the device for most
+ * interrupts, e.g. "eth0-TxRx-0". */
+static const char *irq_device (const char *str)
+{
+	const char *end = str + strlen (str);
+	const char *begin;
+
+	while ((end > str) && isspace ((int) end[-1]))
+		end--;
+	begin = end;
+	while ((begin > str) && !isspace ((int) begin[-1]))
+		begin--;
+
+	return (begin);
+}
+
+/* Returns true if `list' selects the IRQ, by name or device. */
+static _Bool irq_selected (ignorelist_t *list, const char *irq_name,
+		const char *device)
+{
+	if (list == NULL)
+		return (0);
+
+	return ((ignorelist_match (list, irq_name) == 0)
+			|| ((device[0] != 0) && (ignorelist_match (list, device) == 0)));
+} /* _Bool irq_selected */
+
+static void irq_submit_details (const char *irq_name, size_t counts_num,
+		_Bool by_cpu, _Bool by_node)
+{
+	char instance[DATA_MAX_NAME_LEN];
+	size_t i;
+	int node;
+
+	if (by_node && (node_counts != NULL))
+		memset (node_counts, 0, nodes_num * sizeof (*node_counts));
+
+	for (i = 0; i < counts_num; i++)
+	{
+		int cpu = irq_cpus[i];
+
+		if (by_cpu)
+		{
+			ssnprintf (instance, sizeof (instance), "%i", cpu);
+			irq_submit (instance, irq_name, irq_counts[i]);
+		}
+
+		if (by_node && (node_counts != NULL)
+				&& ((size_t) cpu < cpu_node_num)
+				&& (cpu_node[cpu] >= 0))
+			node_counts[cpu_node[cpu]] += irq_counts[i];
+	}
+
+	for (node = 0; by_node && (node_counts != NULL) && (node < nodes_num);
+			node++)
+	{
+		ssnprintf (instance, sizeof (instance), "node%i", node);
+		irq_submit (instance, irq_name, node_counts[node]);
+	}
+} /* void irq_submit_details */
+
 static int irq_read (void)
 {
-	FILE *fh;
-	char buffer[1024];
-	int  cpu_count;
-	char *fields[256];
+	char *buffer;
+	char *line;
 
 	/*
 	 * Example content:
@@ -103,90 +328,102 @@ static int irq_read (void)
 	 * 0:       2574          1          3          2   IO-APIC-edge      timer
 	 * 1:     102553     158669     218062      70587   IO-APIC-edge      i8042
 	 * 8:          0          0          0          1   IO-APIC-edge      rtc0
+	 *
+	 * On hosts with hundreds of CPUs, lines are many kilobytes long, so
+	 * the counts are parsed in place rather than split into fields.
 	 */
-	fh = fopen ("/proc/interrupts", "r");
-	if (fh == NULL)
+	if (proc_interrupts == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("irq plugin: fopen (/proc/interrupts): %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		proc_interrupts = procfs_open ("/proc/interrupts",
+				/* max age = */ 0);
+		if (proc_interrupts == NULL)
+			return (-1);
 	}
 
-	/* Get CPU count from the first line */
-	if(fgets (buffer, sizeof (buffer), fh) != NULL) {
-		cpu_count = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
-	} else {
+	buffer = procfs_read (proc_interrupts, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	/* Get the CPUs from the first line */
+	line = procfs_next_line (&buffer);
+	if ((line == NULL) || (irq_parse_header (line) != 0))
+	{
 		ERROR ("irq plugin: unable to get CPU count from first line "
 				"of /proc/interrupts");
 		return (-1);
 	}
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	while ((line = procfs_next_line (&buffer)) != NULL)
 	{
 		char *irq_name;
-		size_t irq_name_len;
+		char *ptr;
 		derive_t irq_value;
-		int i;
-		int fields_num;
-		int irq_values_to_parse;
+		size_t counts_num;
+		size_t i;
+		_Bool by_cpu;
+		_Bool by_node;
 
-		fields_num = strsplit (buffer, fields,
-				STATIC_ARRAY_SIZE (fields));
-		if (fields_num < 2)
+		/* The IRQ's name is followed by a colon. "Lines" without one
+		 * are continued headers. */
+		irq_name = line;
+		while ((*irq_name == ' ') || (*irq_name == '\t'))
+			irq_name++;
+		ptr = strchr (irq_name, ':');
+		if ((ptr == NULL) || (ptr == irq_name))
 			continue;
+		*ptr = 0;
+		ptr++;
 
-		/* Parse this many numeric fields, skip the rest
-		 * (+1 because first there is a name of irq in each line) */
-		if (fields_num >= cpu_count + 1)
-			irq_values_to_parse = cpu_count;
-		else
-			irq_values_to_parse = fields_num - 1;
-
-		/* First field is irq name and colon */
-		irq_name = fields[0];
-		irq_name_len = strlen (irq_name);
-		if (irq_name_len < 2)
+		if (ignorelist_match (ignorelist, irq_name) != 0)
 			continue;
 
-		/* Check if irq name ends with colon.
-		 * Otherwise it's a header. */
-		if (irq_name[irq_name_len - 1] != ':')
+		counts_num = irq_parse_counts (&ptr);
+		/* No valid fields -> do not submit anything. */
+		if (counts_num == 0)
 			continue;
 
-		irq_name[irq_name_len - 1] = 0;
-		irq_name_len--;
-
 		irq_value = 0;
-		for (i = 1; i <= irq_values_to_parse; i++)
-		{
-			/* Per-CPU value */
-			value_t v;
-			int status;
+		for (i = 0; i < counts_num; i++)
+			irq_value += irq_counts[i];
 
-			status = parse_value (fields[i], &v, DS_TYPE_DERIVE);
-			if (status != 0)
-				break;
+		irq_submit ("", irq_name, irq_value);
 
-			irq_value += v.derive;
-		} /* for (i) */
-
-		/* No valid fields -> do not submit anything. */
-		if (i <= 1)
+		if ((report_by_cpu == NULL) && (report_by_node == NULL))
 			continue;
 
-		irq_submit (irq_name, irq_value);
+		/* Lines of per-CPU interrupts such as "NMI" have no device. */
+		by_cpu = irq_selected (report_by_cpu, irq_name, irq_device (ptr));
+		by_node = irq_selected (report_by_node, irq_name, irq_device (ptr));
+		if (by_cpu || by_node)
+			irq_submit_details (irq_name, counts_num, by_cpu, by_node);
 	}
 
-	fclose (fh);
-
 	return (0);
 } /* int irq_read */
 
+static int irq_shutdown (void)
+{
+	procfs_close (proc_interrupts);
+	proc_interrupts = NULL;
+
+	sfree (irq_cpus);
+	irq_cpus_num = 0;
+	irq_cpus_size = 0;
+	sfree (irq_counts);
+	irq_counts_size = 0;
+	sfree (cpu_node);
+	cpu_node_num = 0;
+	sfree (node_counts);
+	nodes_num = 0;
+
+	return (0);
+} /* int irq_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("irq", irq_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("irq", irq_init);
 	plugin_register_read ("irq", irq_read);
+	plugin_register_shutdown ("irq", irq_shutdown);
 } /* void module_register */
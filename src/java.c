@@ -25,6 +25,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_avltree.h"
 
 #include <pthread.h>
 #include <jni.h>
@@ -63,6 +64,7 @@ typedef struct java_plugin_class_s java_plugin_class_t;
 #define CB_TYPE_NOTIFICATION 8
 #define CB_TYPE_MATCH        9
 #define CB_TYPE_TARGET      10
+#define CB_TYPE_WRITE_BATCH 11
 struct cjni_callback_info_s /* {{{ */
 {
   char     *name;
@@ -74,6 +76,31 @@ struct cjni_callback_info_s /* {{{ */
 typedef struct cjni_callback_info_s cjni_callback_info_t;
 /* }}} */
 
+/* Classes and methods needed to convert every value list. They are looked up
+ * once, by `cjni_cache_init', rather than once per value list. The classes
+ * are global references. */
+struct cjni_cache_s /* {{{ */
+{
+  jclass    c_long;
+  jmethodID m_long_constructor;
+  jclass    c_double;
+  jmethodID m_double_constructor;
+
+  jclass    c_valuelist;
+  jmethodID m_valuelist_constructor;
+  jmethodID m_valuelist_setdataset;
+  jmethodID m_valuelist_sethost;
+  jmethodID m_valuelist_setplugin;
+  jmethodID m_valuelist_setplugininstance;
+  jmethodID m_valuelist_settype;
+  jmethodID m_valuelist_settypeinstance;
+  jmethodID m_valuelist_settime;
+  jmethodID m_valuelist_setinterval;
+  jmethodID m_valuelist_addvalue;
+};
+typedef struct cjni_cache_s cjni_cache_t;
+/* }}} */
+
 /*
  * Global variables
  */
@@ -95,6 +122,14 @@ static pthread_mutex_t       java_callbacks_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static oconfig_item_t       *config_block = NULL;
 
+static cjni_cache_t          cjni_cache;
+
+/* `DataSet' objects handed to write callbacks, by type. The objects are global
+ * references and shared by all value lists of a type, so they're created only
+ * once. */
+static c_avl_tree_t         *cjni_data_sets = NULL;
+static pthread_mutex_t       cjni_data_sets_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Prototypes
  *
@@ -109,6 +144,8 @@ static int cjni_callback_register (JNIEnv *jvm_env, jobject o_name,
 static int cjni_read (user_data_t *user_data);
 static int cjni_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t *ud);
+static int cjni_write_batch (const data_set_t **ds, const value_list_t **vl,
+    size_t num, user_data_t *ud);
 static int cjni_flush (cdtime_t timeout, const char *identifier, user_data_t *ud);
 static void cjni_log (int severity, const char *message, user_data_t *ud);
 static int cjni_notification (const notification_t *n, user_data_t *ud);
@@ -225,57 +262,15 @@ static int ctoj_double (JNIEnv *jvm_env, /* {{{ */
 /* Convert a jlong to a java.lang.Number */
 static jobject ctoj_jlong_to_number (JNIEnv *jvm_env, jlong value) /* {{{ */
 {
-  jclass c_long;
-  jmethodID m_long_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_long = (*jvm_env)->FindClass (jvm_env, "java/lang/Long");
-  if (c_long == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "java.lang.Long class failed.");
-    return (NULL);
-  }
-
-  m_long_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_long, "<init>", "(J)V");
-  if (m_long_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jlong_to_number: Looking up the "
-        "`Long (long)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_long, m_long_constructor, value));
+        cjni_cache.c_long, cjni_cache.m_long_constructor, value));
 } /* }}} jobject ctoj_jlong_to_number */
 
 /* Convert a jdouble to a java.lang.Number */
 static jobject ctoj_jdouble_to_number (JNIEnv *jvm_env, jdouble value) /* {{{ */
 {
-  jclass c_double;
-  jmethodID m_double_constructor;
-
-  /* Look up the java.lang.Long class */
-  c_double = (*jvm_env)->FindClass (jvm_env, "java/lang/Double");
-  if (c_double == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "java.lang.Double class failed.");
-    return (NULL);
-  }
-
-  m_double_constructor = (*jvm_env)->GetMethodID (jvm_env,
-      c_double, "<init>", "(D)V");
-  if (m_double_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_jdouble_to_number: Looking up the "
-        "`Double (double)' constructor failed.");
-    return (NULL);
-  }
-
   return ((*jvm_env)->NewObject (jvm_env,
-        c_double, m_double_constructor, value));
+        cjni_cache.c_double, cjni_cache.m_double_constructor, value));
 } /* }}} jobject ctoj_jdouble_to_number */
 
 /* Convert a value_t to a java.lang.Number */
@@ -673,21 +668,10 @@ static jobject ctoj_data_set (JNIEnv *jvm_env, const data_set_t *ds) /* {{{ */
 } /* }}} jobject ctoj_data_set */
 
 static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
-    value_t value, int ds_type,
-    jclass class_ptr, jobject object_ptr)
+    value_t value, int ds_type, jobject object_ptr)
 {
-  jmethodID m_addvalue;
   jobject o_number;
 
-  m_addvalue = (*jvm_env)->GetMethodID (jvm_env, class_ptr,
-      "addValue", "(Ljava/lang/Number;)V");
-  if (m_addvalue == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list_add_value: "
-        "Cannot find method `void addValue (Number)'.");
-    return (-1);
-  }
-
   o_number = ctoj_value_to_number (jvm_env, value, ds_type);
   if (o_number == NULL)
   {
@@ -696,82 +680,111 @@ static int ctoj_value_list_add_value (JNIEnv *jvm_env, /* {{{ */
     return (-1);
   }
 
-  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr, m_addvalue, o_number);
+  (*jvm_env)->CallVoidMethod (jvm_env, object_ptr,
+      cjni_cache.m_valuelist_addvalue, o_number);
 
   (*jvm_env)->DeleteLocalRef (jvm_env, o_number);
 
   return (0);
 } /* }}} int ctoj_value_list_add_value */
 
-static int ctoj_value_list_add_data_set (JNIEnv *jvm_env, /* {{{ */
-    jclass c_valuelist, jobject o_valuelist, const data_set_t *ds)
+/* Returns the shared `DataSet' object of `ds', creating it if necessary. The
+ * returned reference is global and must not be deleted by the caller. */
+static jobject ctoj_data_set_cached (JNIEnv *jvm_env, /* {{{ */
+    const data_set_t *ds)
 {
-  jmethodID m_setdataset;
-  jobject o_dataset;
+  jobject o_dataset = NULL;
+  jobject o_local;
+  char *type;
 
-  /* Look for the `void setDataSource (List<DataSource> ds)' method. */
-  m_setdataset = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
-  if (m_setdataset == NULL)
+  pthread_mutex_lock (&cjni_data_sets_lock);
+
+  if (cjni_data_sets == NULL)
   {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "Cannot find the `void setDataSet (DataSet)' method.");
-    return (-1);
+    cjni_data_sets = c_avl_create ((void *) strcmp);
+    if (cjni_data_sets == NULL)
+    {
+      pthread_mutex_unlock (&cjni_data_sets_lock);
+      ERROR ("java plugin: ctoj_data_set_cached: c_avl_create failed.");
+      return (NULL);
+    }
   }
 
-  /* Create a DataSet object. */
-  o_dataset = ctoj_data_set (jvm_env, ds);
+  if (c_avl_get (cjni_data_sets, ds->type, (void *) &o_dataset) == 0)
+  {
+    pthread_mutex_unlock (&cjni_data_sets_lock);
+    return (o_dataset);
+  }
+
+  o_local = ctoj_data_set (jvm_env, ds);
+  if (o_local == NULL)
+  {
+    pthread_mutex_unlock (&cjni_data_sets_lock);
+    return (NULL);
+  }
+
+  o_dataset = (*jvm_env)->NewGlobalRef (jvm_env, o_local);
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_local);
   if (o_dataset == NULL)
   {
-    ERROR ("java plugin: ctoj_value_list_add_data_set: "
-        "ctoj_data_set (%s) failed.", ds->type);
-    return (-1);
+    pthread_mutex_unlock (&cjni_data_sets_lock);
+    ERROR ("java plugin: ctoj_data_set_cached: NewGlobalRef failed.");
+    return (NULL);
   }
 
-  /* Actually call the method. */
-  (*jvm_env)->CallVoidMethod (jvm_env,
-      o_valuelist, m_setdataset, o_dataset);
+  type = strdup (ds->type);
+  if ((type == NULL) || (c_avl_insert (cjni_data_sets, type, o_dataset) != 0))
+  {
+    pthread_mutex_unlock (&cjni_data_sets_lock);
+    ERROR ("java plugin: ctoj_data_set_cached: Caching the DataSet of "
+        "type %s failed.", ds->type);
+    (*jvm_env)->DeleteGlobalRef (jvm_env, o_dataset);
+    sfree (type);
+    return (NULL);
+  }
+
+  pthread_mutex_unlock (&cjni_data_sets_lock);
+  return (o_dataset);
+} /* }}} jobject ctoj_data_set_cached */
+
+static int ctoj_value_list_set_string (JNIEnv *jvm_env, /* {{{ */
+    jobject o_valuelist, jmethodID m_set, const char *string)
+{
+  jstring o_string;
+
+  o_string = (*jvm_env)->NewStringUTF (jvm_env, string);
+  if (o_string == NULL)
+  {
+    ERROR ("java plugin: ctoj_value_list_set_string: NewStringUTF failed.");
+    return (-1);
+  }
 
-  /* Decrease reference counter on the List<DataSource> object. */
-  (*jvm_env)->DeleteLocalRef (jvm_env, o_dataset);
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist, m_set, o_string);
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_string);
 
   return (0);
-} /* }}} int ctoj_value_list_add_data_set */
+} /* }}} int ctoj_value_list_set_string */
 
 /* Convert a value_list_t (and data_set_t) to a org/collectd/api/ValueList */
 static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     const data_set_t *ds, const value_list_t *vl)
 {
-  jclass c_valuelist;
-  jmethodID m_valuelist_constructor;
   jobject o_valuelist;
+  jobject o_dataset;
   int status;
   int i;
 
-  /* First, create a new ValueList instance..
-   * Look up the class.. */
-  c_valuelist = (*jvm_env)->FindClass (jvm_env,
-      "org/collectd/api/ValueList");
-  if (c_valuelist == NULL)
+  o_dataset = ctoj_data_set_cached (jvm_env, ds);
+  if (o_dataset == NULL)
   {
     ERROR ("java plugin: ctoj_value_list: "
-        "FindClass (org/collectd/api/ValueList) failed.");
-    return (NULL);
-  }
-
-  /* Lookup the `ValueList ()' constructor. */
-  m_valuelist_constructor = (*jvm_env)->GetMethodID (jvm_env, c_valuelist,
-      "<init>", "()V");
-  if (m_valuelist_constructor == NULL)
-  {
-    ERROR ("java plugin: ctoj_value_list: Cannot find the "
-        "`ValueList ()' constructor.");
+        "ctoj_data_set_cached (%s) failed.", ds->type);
     return (NULL);
   }
 
   /* Create a new instance. */
-  o_valuelist = (*jvm_env)->NewObject (jvm_env, c_valuelist,
-      m_valuelist_constructor);
+  o_valuelist = (*jvm_env)->NewObject (jvm_env, cjni_cache.c_valuelist,
+      cjni_cache.m_valuelist_constructor);
   if (o_valuelist == NULL)
   {
     ERROR ("java plugin: ctoj_value_list: Creating a new ValueList instance "
@@ -779,60 +792,40 @@ static jobject ctoj_value_list (JNIEnv *jvm_env, /* {{{ */
     return (NULL);
   }
 
-  status = ctoj_value_list_add_data_set (jvm_env,
-      c_valuelist, o_valuelist, ds);
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: "
-        "ctoj_value_list_add_data_set failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      cjni_cache.m_valuelist_setdataset, o_dataset);
 
   /* Set the strings.. */
-#define SET_STRING(str,method_name) do { \
-  status = ctoj_string (jvm_env, str, \
-      c_valuelist, o_valuelist, method_name); \
+#define SET_STRING(str,method) do { \
+  status = ctoj_value_list_set_string (jvm_env, o_valuelist, \
+      cjni_cache.method, str); \
   if (status != 0) { \
-    ERROR ("java plugin: ctoj_value_list: ctoj_string (%s) failed.", \
-        method_name); \
+    ERROR ("java plugin: ctoj_value_list: " \
+        "ctoj_value_list_set_string (%s) failed.", #method); \
     (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist); \
     return (NULL); \
   } } while (0)
 
-  SET_STRING (vl->host,            "setHost");
-  SET_STRING (vl->plugin,          "setPlugin");
-  SET_STRING (vl->plugin_instance, "setPluginInstance");
-  SET_STRING (vl->type,            "setType");
-  SET_STRING (vl->type_instance,   "setTypeInstance");
+  SET_STRING (vl->host,            m_valuelist_sethost);
+  SET_STRING (vl->plugin,          m_valuelist_setplugin);
+  SET_STRING (vl->plugin_instance, m_valuelist_setplugininstance);
+  SET_STRING (vl->type,            m_valuelist_settype);
+  SET_STRING (vl->type_instance,   m_valuelist_settypeinstance);
 
 #undef SET_STRING
 
-  /* Set the `time' member. Java stores time in milliseconds. */
-  status = ctoj_long (jvm_env, (jlong) CDTIME_T_TO_MS (vl->time),
-      c_valuelist, o_valuelist, "setTime");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setTime) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
-
-  /* Set the `interval' member.. */
-  status = ctoj_long (jvm_env,
-      (jlong) CDTIME_T_TO_MS (vl->interval),
-      c_valuelist, o_valuelist, "setInterval");
-  if (status != 0)
-  {
-    ERROR ("java plugin: ctoj_value_list: ctoj_long (setInterval) failed.");
-    (*jvm_env)->DeleteLocalRef (jvm_env, o_valuelist);
-    return (NULL);
-  }
+  /* Set the `time' and `interval' members. Java stores time in
+   * milliseconds. */
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      cjni_cache.m_valuelist_settime, (jlong) CDTIME_T_TO_MS (vl->time));
+  (*jvm_env)->CallVoidMethod (jvm_env, o_valuelist,
+      cjni_cache.m_valuelist_setinterval,
+      (jlong) CDTIME_T_TO_MS (vl->interval));
 
   for (i = 0; i < vl->values_len; i++)
   {
     status = ctoj_value_list_add_value (jvm_env, vl->values[i], ds->ds[i].type,
-        c_valuelist, o_valuelist);
+        o_valuelist);
     if (status != 0)
     {
       ERROR ("java plugin: ctoj_value_list: "
@@ -1451,6 +1444,39 @@ static jint JNICALL cjni_api_register_write (JNIEnv *jvm_env, /* {{{ */
   return (0);
 } /* }}} jint cjni_api_register_write */
 
+static jint JNICALL cjni_api_register_write_batch (JNIEnv *jvm_env, /* {{{ */
+    jobject this, jobject o_name, jobject o_write,
+    jint batch_size, jlong batch_timeout)
+{
+  user_data_t ud;
+  cjni_callback_info_t *cbi;
+
+  if ((batch_size < 1) || (batch_timeout < 0))
+  {
+    ERROR ("java plugin: cjni_api_register_write_batch: The batch size must "
+        "be positive and the timeout must not be negative.");
+    return (-1);
+  }
+
+  cbi = cjni_callback_info_create (jvm_env, o_name, o_write,
+      CB_TYPE_WRITE_BATCH);
+  if (cbi == NULL)
+    return (-1);
+
+  DEBUG ("java plugin: Registering new batch write callback: %s", cbi->name);
+
+  memset (&ud, 0, sizeof (ud));
+  ud.data = (void *) cbi;
+  ud.free_func = cjni_callback_info_destroy;
+
+  plugin_register_write_batch (cbi->name, cjni_write_batch,
+      (size_t) batch_size, MS_TO_CDTIME_T (batch_timeout), &ud);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_write);
+
+  return (0);
+} /* }}} jint cjni_api_register_write_batch */
+
 static jint JNICALL cjni_api_register_flush (JNIEnv *jvm_env, /* {{{ */
     jobject this, jobject o_name, jobject o_flush)
 {
@@ -1661,6 +1687,10 @@ static JNINativeMethod jni_api_functions[] = /* {{{ */
     "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteInterface;)I",
     cjni_api_register_write },
 
+  { "registerWriteBatch",
+    "(Ljava/lang/String;Lorg/collectd/api/CollectdWriteBatchInterface;IJ)I",
+    cjni_api_register_write_batch },
+
   { "registerFlush",
     "(Ljava/lang/String;Lorg/collectd/api/CollectdFlushInterface;)I",
     cjni_api_register_flush },
@@ -1728,6 +1758,11 @@ static cjni_callback_info_t *cjni_callback_info_create (JNIEnv *jvm_env, /* {{{
       method_signature = "(Lorg/collectd/api/ValueList;)I";
       break;
 
+    case CB_TYPE_WRITE_BATCH:
+      method_name = "write";
+      method_signature = "([Lorg/collectd/api/ValueList;)I";
+      break;
+
     case CB_TYPE_FLUSH:
       method_name = "flush";
       method_signature = "(Ljava/lang/Number;Ljava/lang/String;)I";
@@ -1949,6 +1984,104 @@ static int cjni_init_native (JNIEnv *jvm_env) /* {{{ */
   return (0);
 } /* }}} int cjni_init_native */
 
+/* Looks up a class and returns a global reference to it. */
+static jclass cjni_cache_class (JNIEnv *jvm_env, const char *name) /* {{{ */
+{
+  jclass c_local;
+  jclass c_global;
+
+  c_local = (*jvm_env)->FindClass (jvm_env, name);
+  if (c_local == NULL)
+  {
+    ERROR ("java plugin: cjni_cache_class: FindClass (%s) failed.", name);
+    return (NULL);
+  }
+
+  c_global = (*jvm_env)->NewGlobalRef (jvm_env, c_local);
+  (*jvm_env)->DeleteLocalRef (jvm_env, c_local);
+  if (c_global == NULL)
+    ERROR ("java plugin: cjni_cache_class: NewGlobalRef (%s) failed.", name);
+
+  return (c_global);
+} /* }}} jclass cjni_cache_class */
+
+/* Fill `cjni_cache'. Class references stay valid until they are deleted and
+ * method IDs as long as their class is loaded, so this is done once, right
+ * after the JVM has been created. */
+static int cjni_cache_init (JNIEnv *jvm_env) /* {{{ */
+{
+  cjni_cache_t *c = &cjni_cache;
+
+  c->c_long = cjni_cache_class (jvm_env, "java/lang/Long");
+  c->c_double = cjni_cache_class (jvm_env, "java/lang/Double");
+  c->c_valuelist = cjni_cache_class (jvm_env, "org/collectd/api/ValueList");
+  if ((c->c_long == NULL) || (c->c_double == NULL)
+      || (c->c_valuelist == NULL))
+    return (-1);
+
+#define GET_METHOD(member,class,name,signature) do { \
+  c->member = (*jvm_env)->GetMethodID (jvm_env, c->class, name, signature); \
+  if (c->member == NULL) { \
+    ERROR ("java plugin: cjni_cache_init: Cannot find the method " \
+        "`%s' with signature `%s'.", name, signature); \
+    return (-1); \
+  } } while (0)
+
+  GET_METHOD (m_long_constructor,   c_long,   "<init>", "(J)V");
+  GET_METHOD (m_double_constructor, c_double, "<init>", "(D)V");
+
+  GET_METHOD (m_valuelist_constructor, c_valuelist, "<init>", "()V");
+  GET_METHOD (m_valuelist_setdataset, c_valuelist,
+      "setDataSet", "(Lorg/collectd/api/DataSet;)V");
+  GET_METHOD (m_valuelist_sethost, c_valuelist,
+      "setHost", "(Ljava/lang/String;)V");
+  GET_METHOD (m_valuelist_setplugin, c_valuelist,
+      "setPlugin", "(Ljava/lang/String;)V");
+  GET_METHOD (m_valuelist_setplugininstance, c_valuelist,
+      "setPluginInstance", "(Ljava/lang/String;)V");
+  GET_METHOD (m_valuelist_settype, c_valuelist,
+      "setType", "(Ljava/lang/String;)V");
+  GET_METHOD (m_valuelist_settypeinstance, c_valuelist,
+      "setTypeInstance", "(Ljava/lang/String;)V");
+  GET_METHOD (m_valuelist_settime, c_valuelist, "setTime", "(J)V");
+  GET_METHOD (m_valuelist_setinterval, c_valuelist, "setInterval", "(J)V");
+  GET_METHOD (m_valuelist_addvalue, c_valuelist,
+      "addValue", "(Ljava/lang/Number;)V");
+
+#undef GET_METHOD
+
+  return (0);
+} /* }}} int cjni_cache_init */
+
+/* Release the global references held by `cjni_cache' and `cjni_data_sets'. */
+static void cjni_cache_destroy (JNIEnv *jvm_env) /* {{{ */
+{
+  char *type;
+  jobject o_dataset;
+
+  pthread_mutex_lock (&cjni_data_sets_lock);
+  if (cjni_data_sets != NULL)
+  {
+    while (c_avl_pick (cjni_data_sets, (void *) &type,
+          (void *) &o_dataset) == 0)
+    {
+      (*jvm_env)->DeleteGlobalRef (jvm_env, o_dataset);
+      sfree (type);
+    }
+    c_avl_destroy (cjni_data_sets);
+    cjni_data_sets = NULL;
+  }
+  pthread_mutex_unlock (&cjni_data_sets_lock);
+
+  if (cjni_cache.c_long != NULL)
+    (*jvm_env)->DeleteGlobalRef (jvm_env, cjni_cache.c_long);
+  if (cjni_cache.c_double != NULL)
+    (*jvm_env)->DeleteGlobalRef (jvm_env, cjni_cache.c_double);
+  if (cjni_cache.c_valuelist != NULL)
+    (*jvm_env)->DeleteGlobalRef (jvm_env, cjni_cache.c_valuelist);
+  memset (&cjni_cache, 0, sizeof (cjni_cache));
+} /* }}} void cjni_cache_destroy */
+
 /* Create the JVM. This is called when the first thread tries to access the JVM
  * via cjni_thread_attach. */
 static int cjni_create_jvm (void) /* {{{ */
@@ -2004,6 +2137,13 @@ static int cjni_create_jvm (void) /* {{{ */
     return (-1);
   }
 
+  status = cjni_cache_init (jvm_env);
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_create_jvm: cjni_cache_init failed.");
+    return (-1);
+  }
+
   DEBUG ("java plugin: The JVM has been created.");
   return (0);
 } /* }}} int cjni_create_jvm */
@@ -2534,6 +2674,7 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
   if (vl_java == NULL)
   {
     ERROR ("java plugin: cjni_write: ctoj_value_list failed.");
+    cjni_thread_detach ();
     return (-1);
   }
 
@@ -2552,6 +2693,79 @@ static int cjni_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
   return (ret_status);
 } /* }}} int cjni_write */
 
+/* Call the CB_TYPE_WRITE_BATCH callback pointed to by the `user_data_t'
+ * pointer with an array of all the value lists. */
+static int cjni_write_batch (const data_set_t **ds, /* {{{ */
+    const value_list_t **vl, size_t num, user_data_t *ud)
+{
+  JNIEnv *jvm_env;
+  cjni_callback_info_t *cbi;
+  jobjectArray o_array;
+  int status;
+  int ret_status;
+  size_t i;
+
+  if (jvm == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: jvm == NULL");
+    return (-1);
+  }
+
+  if ((ud == NULL) || (ud->data == NULL))
+  {
+    ERROR ("java plugin: cjni_write_batch: Invalid user data.");
+    return (-1);
+  }
+
+  jvm_env = cjni_thread_attach ();
+  if (jvm_env == NULL)
+    return (-1);
+
+  cbi = (cjni_callback_info_t *) ud->data;
+
+  o_array = (*jvm_env)->NewObjectArray (jvm_env, (jsize) num,
+      cjni_cache.c_valuelist, /* initial element = */ NULL);
+  if (o_array == NULL)
+  {
+    ERROR ("java plugin: cjni_write_batch: NewObjectArray failed.");
+    cjni_thread_detach ();
+    return (-1);
+  }
+
+  for (i = 0; i < num; i++)
+  {
+    jobject vl_java;
+
+    vl_java = ctoj_value_list (jvm_env, ds[i], vl[i]);
+    if (vl_java == NULL)
+    {
+      ERROR ("java plugin: cjni_write_batch: ctoj_value_list failed.");
+      (*jvm_env)->DeleteLocalRef (jvm_env, o_array);
+      cjni_thread_detach ();
+      return (-1);
+    }
+
+    (*jvm_env)->SetObjectArrayElement (jvm_env, o_array, (jsize) i, vl_java);
+    /* The array holds a reference, so the number of local references doesn't
+     * grow with the size of the batch. */
+    (*jvm_env)->DeleteLocalRef (jvm_env, vl_java);
+  }
+
+  ret_status = (*jvm_env)->CallIntMethod (jvm_env,
+      cbi->object, cbi->method, o_array);
+
+  (*jvm_env)->DeleteLocalRef (jvm_env, o_array);
+
+  status = cjni_thread_detach ();
+  if (status != 0)
+  {
+    ERROR ("java plugin: cjni_write_batch: cjni_thread_detach failed.");
+    return (-1);
+  }
+
+  return (ret_status);
+} /* }}} int cjni_write_batch */
+
 /* Call the CB_TYPE_FLUSH callback pointed to by the `user_data_t' pointer. */
 static int cjni_flush (cdtime_t timeout, const char *identifier, /* {{{ */
     user_data_t *ud)
@@ -2926,13 +3140,21 @@ static int cjni_match_target_invoke (const data_set_t *ds, /* {{{ */
     }
     else /* if (status == 0) */
     {
-      /* plugin_dispatch_values assures that this is dynamically allocated
-       * memory. */
-      sfree (vl->values);
+      value_t *values = new_vl.values;
+      int values_len = new_vl.values_len;
 
-      /* This will replace the vl->values pointer to a new, dynamically
-       * allocated piece of memory. */
+      /* The new values are handed to the daemon, which frees them after
+       * dispatching. The other fields are copied over as they are. */
+      new_vl.values = vl->values;
+      new_vl.values_len = vl->values_len;
       memcpy (vl, &new_vl, sizeof (*vl));
+
+      if (plugin_dispatch_values_replace (vl, values, values_len) != 0)
+      {
+        ERROR ("java plugin: cjni_match_target_invoke: "
+            "plugin_dispatch_values_replace failed.");
+        sfree (values);
+      }
     }
   } /* if (cbi->type == CB_TYPE_TARGET) */
 
@@ -3047,6 +3269,8 @@ static int cjni_shutdown (void) /* {{{ */
   java_classes_list_len = 0;
   sfree (java_classes_list);
 
+  cjni_cache_destroy (jvm_env);
+
   /* Destroy the JVM */
   DEBUG ("java plugin: Destroying the JVM.");
   (*jvm)->DestroyJavaVM (jvm);
@@ -3104,7 +3328,7 @@ static int cjni_init (void) /* {{{ */
 void module_register (void)
 {
   plugin_register_complex_config ("java", cjni_config_callback);
-  plugin_register_init ("java", cjni_init);
+  plugin_register_init_parallel ("java", cjni_init);
   plugin_register_shutdown ("java", cjni_shutdown);
 } /* void module_register (void) */
 
@@ -40,8 +40,10 @@
 #include <errno.h>
 #include <math.h>
 #include <netdb.h>
+#include <arpa/inet.h> /* htonl */
 
 #include "client.h"
+#include "network_buffer.h"
 
 /* NI_MAXHOST has been obsoleted by RFC 3493 which is a reason for SunOS 5.11
  * to no longer define it. We'll use the old, RFC 2553 value here. */
@@ -95,10 +97,48 @@
 /*
  * Types
  */
+/* Maximum number of asynchronous commands in flight. Before more commands
+ * are queued, the responses are read, so that neither side blocks writing
+ * while the other one is writing as well. */
+#define LCC_PIPELINE_MAX 512
+/* In binary mode, all value lists of a frame share one response, so many
+ * more of them may be in flight. */
+#define LCC_BINARY_PENDING_MAX 16384
+/* Size of the frames sent in binary mode, the largest network buffer. The
+ * daemon accepts up to 64 KiB. */
+#define LCC_BINARY_FRAME_SIZE 65535
+
+struct lcc_pending_s
+{
+  lcc_callback_t callback;
+  void *user_data;
+  /* The next command gets the same response, see `lcc_binary_flush'. */
+  int shares_response;
+};
+typedef struct lcc_pending_s lcc_pending_t;
+
 struct lcc_connection_s
 {
   FILE *fh;
   char errbuf[1024];
+
+  /* Asynchronous commands which have not been sent yet. */
+  char  *queue;
+  size_t queue_len;
+  size_t queue_size;
+
+  /* Callbacks of all asynchronous commands, in order. The first
+   * `pending_sent' have been sent and are waiting for a response. */
+  lcc_pending_t *pending;
+  size_t pending_num;
+  size_t pending_size;
+  size_t pending_sent;
+
+  /* Binary mode, see `lcc_set_binary'. `binary_active' is set while the
+   * daemon is in binary mode after all queued commands have been sent. */
+  int binary;
+  int binary_active;
+  lcc_network_buffer_t *nb;
 };
 
 struct lcc_response_s
@@ -396,6 +436,267 @@ static int lcc_receive (lcc_connection_t *c, /* {{{ */
   return (0);
 } /* }}} int lcc_receive */
 
+/* Makes room for `len' more bytes in the connection's queue. */
+static int lcc_queue_reserve (lcc_connection_t *c, size_t len) /* {{{ */
+{
+  char *tmp;
+  size_t size;
+
+  if ((c->queue_len + len) <= c->queue_size)
+    return (0);
+
+  size = (c->queue_size == 0) ? 4096 : c->queue_size;
+  while (size < (c->queue_len + len))
+    size *= 2;
+
+  tmp = (char *) realloc (c->queue, size);
+  if (tmp == NULL)
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
+  c->queue = tmp;
+  c->queue_size = size;
+
+  return (0);
+} /* }}} int lcc_queue_reserve */
+
+/* Adds a callback waiting for a response. */
+static int lcc_queue_pending (lcc_connection_t *c, /* {{{ */
+    lcc_callback_t callback, void *user_data, int shares_response)
+{
+  if (c->pending_num >= c->pending_size)
+  {
+    lcc_pending_t *tmp;
+    size_t size = (c->pending_size == 0) ? 64 : (2 * c->pending_size);
+
+    tmp = (lcc_pending_t *) realloc (c->pending, size * sizeof (*tmp));
+    if (tmp == NULL)
+    {
+      lcc_set_errno (c, ENOMEM);
+      return (-1);
+    }
+    c->pending = tmp;
+    c->pending_size = size;
+  }
+
+  c->pending[c->pending_num].callback = callback;
+  c->pending[c->pending_num].user_data = user_data;
+  c->pending[c->pending_num].shares_response = shares_response;
+  c->pending_num++;
+
+  return (0);
+} /* }}} int lcc_queue_pending */
+
+/* Appends the value lists collected in binary mode to the queue as one
+ * frame: the length of the packet in network byte order and the packet
+ * itself. The daemon sends a single response for the frame. */
+static int lcc_binary_flush (lcc_connection_t *c) /* {{{ */
+{
+  uint32_t header;
+  size_t size;
+  int status;
+
+  if ((c->nb == NULL) || (lcc_network_buffer_values_num (c->nb) == 0))
+    return (0);
+
+  if (lcc_queue_reserve (c, sizeof (header) + LCC_BINARY_FRAME_SIZE) != 0)
+    return (-1);
+
+  lcc_network_buffer_finalize (c->nb);
+  size = LCC_BINARY_FRAME_SIZE;
+  status = lcc_network_buffer_get (c->nb,
+      c->queue + c->queue_len + sizeof (header), &size);
+  lcc_network_buffer_initialize (c->nb);
+  if (status != 0)
+  {
+    lcc_set_errno (c, status);
+    return (-1);
+  }
+
+  header = htonl ((uint32_t) size);
+  memcpy (c->queue + c->queue_len, &header, sizeof (header));
+  c->queue_len += sizeof (header) + size;
+
+  /* The value lists of the frame were queued last. */
+  assert (c->pending_num > 0);
+  c->pending[c->pending_num - 1].shares_response = 0;
+
+  return (0);
+} /* }}} int lcc_binary_flush */
+
+/* Queues an empty frame, which switches the daemon back to text mode. */
+static int lcc_binary_leave (lcc_connection_t *c) /* {{{ */
+{
+  uint32_t header = 0;
+
+  if (!c->binary_active)
+    return (0);
+
+  if ((lcc_binary_flush (c) != 0)
+      || (lcc_queue_reserve (c, sizeof (header)) != 0))
+    return (-1);
+
+  if (lcc_queue_pending (c, /* callback = */ NULL, /* user_data = */ NULL,
+        /* shares_response = */ 0) != 0)
+    return (-1);
+
+  memcpy (c->queue + c->queue_len, &header, sizeof (header));
+  c->queue_len += sizeof (header);
+  c->binary_active = 0;
+
+  return (0);
+} /* }}} int lcc_binary_leave */
+
+/* Writes all queued asynchronous commands with a single write. */
+static int lcc_send_queue (lcc_connection_t *c) /* {{{ */
+{
+  if (lcc_binary_flush (c) != 0)
+    return (-1);
+
+  if (c->queue_len == 0)
+    return (0);
+
+  LCC_DEBUG ("send:    --> %zu bytes, %zu commands\n", c->queue_len,
+      c->pending_num - c->pending_sent);
+
+  if ((fwrite (c->queue, 1, c->queue_len, c->fh) != c->queue_len)
+      || (fflush (c->fh) != 0))
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+
+  c->queue_len = 0;
+  c->pending_sent = c->pending_num;
+  return (0);
+} /* }}} int lcc_send_queue */
+
+/* Reads the responses of all sent asynchronous commands and passes them to
+ * the callbacks. If reading fails, the remaining callbacks are called with a
+ * status of -1. Returns the number of failed commands or -1 on I/O errors. */
+static int lcc_receive_pending (lcc_connection_t *c) /* {{{ */
+{
+  size_t sent_num = c->pending_sent;
+  int io_failed = 0;
+  int failed = 0;
+  size_t i;
+
+  lcc_response_t res;
+  int have_res = 0;
+
+  memset (&res, 0, sizeof (res));
+
+  for (i = 0; i < sent_num; i++)
+  {
+    lcc_pending_t *p = c->pending + i;
+
+    if (!io_failed && !have_res)
+    {
+      memset (&res, 0, sizeof (res));
+      if (lcc_receive (c, &res) != 0)
+        io_failed = 1;
+      else
+        have_res = 1;
+    }
+
+    if (io_failed)
+    {
+      failed++;
+      if (p->callback != NULL)
+        (*p->callback) (c, -1, c->errbuf, p->user_data);
+      continue;
+    }
+
+    if (res.status < 0)
+      failed++;
+    if (p->callback != NULL)
+      (*p->callback) (c, res.status, res.message, p->user_data);
+
+    if (!p->shares_response)
+    {
+      lcc_response_free (&res);
+      have_res = 0;
+    }
+  }
+
+  /* Commands queued by the callbacks stay pending. */
+  memmove (c->pending, c->pending + sent_num,
+      (c->pending_num - sent_num) * sizeof (*c->pending));
+  c->pending_num -= sent_num;
+  c->pending_sent -= sent_num;
+
+  return (io_failed ? -1 : failed);
+} /* }}} int lcc_receive_pending */
+
+/* Sends all queued commands and waits for all their responses. */
+static int lcc_sync (lcc_connection_t *c) /* {{{ */
+{
+  int failed = 0;
+
+  while (c->pending_num > 0)
+  {
+    int status;
+
+    if (lcc_send_queue (c) != 0)
+      return (-1);
+
+    status = lcc_receive_pending (c);
+    if (status < 0)
+      return (-1);
+    failed += status;
+  }
+
+  return (failed);
+} /* }}} int lcc_sync */
+
+/* Like `lcc_sync', but leaves binary mode first, so that a text command can
+ * be sent directly afterwards. */
+static int lcc_sync_text (lcc_connection_t *c) /* {{{ */
+{
+  if (lcc_binary_leave (c) != 0)
+    return (-1);
+
+  return (lcc_sync (c));
+} /* }}} int lcc_sync_text */
+
+/* Appends `command' to the connection's queue. The callback is called once
+ * the response has been received. */
+static int lcc_queue (lcc_connection_t *c, const char *command, /* {{{ */
+    lcc_callback_t callback, void *user_data)
+{
+  size_t command_len = strlen (command);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if (c->pending_num >= LCC_PIPELINE_MAX)
+  {
+    if (lcc_sync (c) < 0)
+      return (-1);
+  }
+
+  /* Text commands can't be sent in binary mode. */
+  if (lcc_binary_leave (c) != 0)
+    return (-1);
+
+  if ((lcc_queue_reserve (c, command_len + 3) != 0)
+      || (lcc_queue_pending (c, callback, user_data,
+          /* shares_response = */ 0) != 0))
+    return (-1);
+
+  LCC_DEBUG ("queue:   --> %s\n", command);
+
+  memcpy (c->queue + c->queue_len, command, command_len);
+  memcpy (c->queue + c->queue_len + command_len, "\r\n", 3);
+  c->queue_len += command_len + 2;
+
+  return (0);
+} /* }}} int lcc_queue */
+
 static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     const char *command, lcc_response_t *ret_res)
 {
@@ -408,6 +709,11 @@ static int lcc_sendreceive (lcc_connection_t *c, /* {{{ */
     return (-1);
   }
 
+  /* Responses arrive in order, so asynchronous commands must be finished
+   * first. Their failures are reported through their callbacks. */
+  if (lcc_sync_text (c) < 0)
+    return (-1);
+
   status = lcc_send (c, command);
   if (status != 0)
     return (status);
@@ -647,12 +953,19 @@ int lcc_disconnect (lcc_connection_t *c) /* {{{ */
   if (c == NULL)
     return (-1);
 
+  /* Don't lose values which have been queued but not sent. */
+  if ((c->fh != NULL) && (c->pending_num > 0))
+    lcc_sync (c);
+
   if (c->fh != NULL)
   {
     fclose (c->fh);
     c->fh = NULL;
   }
 
+  lcc_network_buffer_destroy (c->nb);
+  free (c->queue);
+  free (c->pending);
   free (c);
   return (0);
 } /* }}} int lcc_disconnect */
@@ -783,149 +1096,744 @@ int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident, /* {{{ */
   return (0);
 } /* }}} int lcc_getval */
 
-int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+void lcc_getval_result_free (lcc_getval_result_t *res, /* {{{ */
+    size_t res_num)
 {
-  char ident_str[6 * LCC_NAME_LEN];
-  char ident_esc[12 * LCC_NAME_LEN];
-  char command[1024] = "";
-  lcc_response_t res;
-  int status;
   size_t i;
+  size_t j;
 
-  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
-      || (vl->values == NULL) || (vl->values_types == NULL))
+  if (res == NULL)
+    return;
+
+  for (i = 0; i < res_num; i++)
   {
-    lcc_set_errno (c, EINVAL);
-    return (-1);
+    free (res[i].values);
+    if (res[i].values_names != NULL)
+      for (j = 0; j < res[i].values_num; j++)
+        free (res[i].values_names[j]);
+    free (res[i].values_names);
   }
+  free (res);
+} /* }}} void lcc_getval_result_free */
 
-  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
-      &vl->identifier);
+/* Parses one line of an MGETVAL response:
+ *   <identifier> <name>=<value> [<name>=<value> ...] */
+static int lcc_getval_multi_parse (lcc_connection_t *c, /* {{{ */
+    char *line, lcc_getval_result_t *ret)
+{
+  char *ptr;
+  size_t fields_num;
+  size_t i;
+  int status;
+
+  memset (ret, 0, sizeof (*ret));
+
+  ptr = strchr (line, ' ');
+  if (ptr != NULL)
+  {
+    *ptr = 0;
+    ptr++;
+  }
+
+  status = lcc_string_to_identifier (c, &ret->identifier, line);
   if (status != 0)
     return (status);
 
-  SSTRCATF (command, "PUTVAL %s",
-      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+  fields_num = 0;
+  for (i = 0; (ptr != NULL) && (ptr[i] != 0); i++)
+    if (ptr[i] == '=')
+      fields_num++;
 
-  if (vl->interval > 0)
-    SSTRCATF (command, " interval=%i", vl->interval);
+  if (fields_num == 0)
+    return (0);
 
-  if (vl->time > 0)
-    SSTRCATF (command, " %u", (unsigned int) vl->time);
-  else
-    SSTRCAT (command, " N");
+  ret->values = (gauge_t *) calloc (fields_num, sizeof (*ret->values));
+  ret->values_names = (char **) calloc (fields_num,
+      sizeof (*ret->values_names));
+  if ((ret->values == NULL) || (ret->values_names == NULL))
+  {
+    lcc_set_errno (c, ENOMEM);
+    return (-1);
+  }
 
-  for (i = 0; i < vl->values_len; i++)
+  while ((ptr != NULL) && (*ptr != 0) && (ret->values_num < fields_num))
   {
-    if (vl->values_types[i] == LCC_TYPE_COUNTER)
-      SSTRCATF (command, ":%"PRIu64, vl->values[i].counter);
-    else if (vl->values_types[i] == LCC_TYPE_GAUGE)
+    char *key;
+    char *value;
+    char *endptr;
+
+    while (*ptr == ' ')
+      ptr++;
+    key = ptr;
+
+    value = strchr (key, '=');
+    if (value == NULL)
+      break;
+    *value = 0;
+    value++;
+
+    ptr = strchr (value, ' ');
+    if (ptr != NULL)
     {
-      if (isnan (vl->values[i].gauge))
-        SSTRCATF (command, ":U");
-      else
-        SSTRCATF (command, ":%g", vl->values[i].gauge);
+      *ptr = 0;
+      ptr++;
     }
-    else if (vl->values_types[i] == LCC_TYPE_DERIVE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].derive);
-    else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
-	SSTRCATF (command, ":%"PRIu64, vl->values[i].absolute);
-
-  } /* for (i = 0; i < vl->values_len; i++) */
 
-  status = lcc_sendreceive (c, command, &res);
-  if (status != 0)
-    return (status);
+    endptr = NULL;
+    errno = 0;
+    ret->values[ret->values_num] = strtod (value, &endptr);
+    if ((endptr == value) || (errno != 0))
+    {
+      lcc_set_errno (c, EILSEQ);
+      return (-1);
+    }
 
-  if (res.status != 0)
-  {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
-    return (-1);
+    ret->values_names[ret->values_num] = strdup (key);
+    if (ret->values_names[ret->values_num] == NULL)
+    {
+      lcc_set_errno (c, ENOMEM);
+      return (-1);
+    }
+    ret->values_num++;
   }
 
-  lcc_response_free (&res);
   return (0);
-} /* }}} int lcc_putval */
+} /* }}} int lcc_getval_multi_parse */
 
-int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
-    lcc_identifier_t *ident, int timeout)
+/* Receives one MGETVAL response and appends its entries to `*res'. */
+static int lcc_getval_multi_receive (lcc_connection_t *c, /* {{{ */
+    lcc_getval_result_t **res, size_t *res_num)
 {
-  char command[1024] = "";
-  lcc_response_t res;
+  lcc_response_t resp;
+  lcc_getval_result_t *tmp;
+  size_t i;
   int status;
 
-  if (c == NULL)
+  memset (&resp, 0, sizeof (resp));
+  status = lcc_receive (c, &resp);
+  if (status != 0)
+    return (status);
+
+  if (resp.status != 0)
   {
-    lcc_set_errno (c, EINVAL);
+    LCC_SET_ERRSTR (c, "Server error: %s", resp.message);
+    lcc_response_free (&resp);
     return (-1);
   }
 
-  SSTRCPY (command, "FLUSH");
-
-  if (timeout > 0)
-    SSTRCATF (command, " timeout=%i", timeout);
+  if (resp.lines_num == 0)
+    return (0);
 
-  if (plugin != NULL)
+  tmp = (lcc_getval_result_t *) realloc (*res,
+      (*res_num + resp.lines_num) * sizeof (**res));
+  if (tmp == NULL)
   {
-    char buffer[2 * LCC_NAME_LEN];
-    SSTRCATF (command, " plugin=%s",
-        lcc_strescape (buffer, plugin, sizeof (buffer)));
+    lcc_set_errno (c, ENOMEM);
+    lcc_response_free (&resp);
+    return (-1);
   }
+  *res = tmp;
 
-  if (ident != NULL)
+  for (i = 0; i < resp.lines_num; i++)
   {
-    char ident_str[6 * LCC_NAME_LEN];
-    char ident_esc[12 * LCC_NAME_LEN];
-
-    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
+    status = lcc_getval_multi_parse (c, resp.lines[i], *res + *res_num);
+    /* Count the entry even on failure, so it is freed by the caller. */
+    (*res_num)++;
     if (status != 0)
-      return (status);
-
-    SSTRCATF (command, " identifier=%s",
-        lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
-  }
-
-  status = lcc_sendreceive (c, command, &res);
-  if (status != 0)
-    return (status);
-
-  if (res.status != 0)
-  {
-    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
-    lcc_response_free (&res);
-    return (-1);
+      break;
   }
 
-  lcc_response_free (&res);
-  return (0);
-} /* }}} int lcc_flush */
-
-/* TODO: Implement lcc_putnotif */
+  lcc_response_free (&resp);
+  return (status);
+} /* }}} int lcc_getval_multi_receive */
 
-int lcc_listval (lcc_connection_t *c, /* {{{ */
-    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+int lcc_getval_multi (lcc_connection_t *c, /* {{{ */
+    const char * const *identifiers, size_t identifiers_num,
+    lcc_getval_result_t **ret_res, size_t *ret_res_num)
 {
-  lcc_response_t res;
+  /* The daemon reads commands of up to 1023 bytes. */
+  char command[1000] = "";
+  size_t commands_num = 0;
+  lcc_getval_result_t *res = NULL;
+  size_t res_num = 0;
   size_t i;
-  int status;
-
-  lcc_identifier_t *ident;
-  size_t ident_num;
+  int status = 0;
 
   if (c == NULL)
     return (-1);
 
-  if ((ret_ident == NULL) || (ret_ident_num == NULL))
+  if ((identifiers == NULL) || (identifiers_num == 0)
+      || (ret_res == NULL) || (ret_res_num == NULL))
   {
     lcc_set_errno (c, EINVAL);
     return (-1);
   }
 
-  status = lcc_sendreceive (c, "LISTVAL", &res);
-  if (status != 0)
-    return (status);
-
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if (lcc_sync_text (c) < 0)
+    return (-1);
+
+  /* Send all commands before reading the first response, so that long lists
+   * cost a single round trip only. */
+  for (i = 0; i < identifiers_num; i++)
+  {
+    char ident_esc[12 * LCC_NAME_LEN];
+
+    lcc_strescape (ident_esc, identifiers[i], sizeof (ident_esc));
+
+    if ((command[0] != 0)
+        && ((strlen (command) + strlen (ident_esc) + 2) > sizeof (command)))
+    {
+      status = lcc_send (c, command);
+      if (status != 0)
+        return (status);
+      commands_num++;
+      command[0] = 0;
+    }
+
+    if (command[0] == 0)
+      SSTRCPY (command, "MGETVAL");
+    SSTRCATF (command, " %s", ident_esc);
+  }
+
+  status = lcc_send (c, command);
+  if (status != 0)
+    return (status);
+  commands_num++;
+
+  /* Read all the responses, even after an error, to keep the connection in
+   * a usable state. */
+  for (i = 0; i < commands_num; i++)
+  {
+    int tmp;
+
+    tmp = lcc_getval_multi_receive (c, &res, &res_num);
+    if ((tmp != 0) && (status == 0))
+      status = tmp;
+  }
+
+  if (status != 0)
+  {
+    lcc_getval_result_free (res, res_num);
+    return (status);
+  }
+
+  *ret_res = res;
+  *ret_res_num = res_num;
+  return (0);
+} /* }}} int lcc_getval_multi */
+
+static int lcc_putval_command (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, char *command, size_t command_size)
+{
+  char ident_str[6 * LCC_NAME_LEN];
+  char ident_esc[12 * LCC_NAME_LEN];
+  char buffer[1024] = "";
+  int status;
+  size_t i;
+
+  if ((c == NULL) || (vl == NULL) || (vl->values_len < 1)
+      || (vl->values == NULL) || (vl->values_types == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str),
+      &vl->identifier);
+  if (status != 0)
+    return (status);
+
+  SSTRCATF (buffer, "PUTVAL %s",
+      lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+
+  if (vl->interval > 0)
+    SSTRCATF (buffer, " interval=%i", vl->interval);
+
+  if (vl->time > 0)
+    SSTRCATF (buffer, " %u", (unsigned int) vl->time);
+  else
+    SSTRCAT (buffer, " N");
+
+  for (i = 0; i < vl->values_len; i++)
+  {
+    if (vl->values_types[i] == LCC_TYPE_COUNTER)
+      SSTRCATF (buffer, ":%"PRIu64, vl->values[i].counter);
+    else if (vl->values_types[i] == LCC_TYPE_GAUGE)
+    {
+      if (isnan (vl->values[i].gauge))
+        SSTRCATF (buffer, ":U");
+      else
+        SSTRCATF (buffer, ":%g", vl->values[i].gauge);
+    }
+    else if (vl->values_types[i] == LCC_TYPE_DERIVE)
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].derive);
+    else if (vl->values_types[i] == LCC_TYPE_ABSOLUTE)
+	SSTRCATF (buffer, ":%"PRIu64, vl->values[i].absolute);
+
+  } /* for (i = 0; i < vl->values_len; i++) */
+
+  strncpy (command, buffer, command_size);
+  command[command_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_putval_command */
+
+int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl) /* {{{ */
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  if ((c != NULL) && c->binary)
+    return (lcc_putval_many (c, vl, 1));
+
+  status = lcc_putval_command (c, vl, command, sizeof (command));
+  if (status != 0)
+    return (status);
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_putval */
+
+/* Adds the value list to the current frame. Its callback is called with the
+ * response to the entire frame. */
+static int lcc_putval_binary (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, lcc_callback_t callback, void *user_data)
+{
+  int status;
+
+  if ((vl == NULL) || (vl->values_len < 1)
+      || (vl->values == NULL) || (vl->values_types == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if (c->pending_num >= LCC_BINARY_PENDING_MAX)
+  {
+    if (lcc_sync (c) < 0)
+      return (-1);
+  }
+
+  /* Switched back to text mode by another command. */
+  if (!c->binary_active)
+  {
+    if (lcc_queue (c, "BINARY", /* callback = */ NULL,
+          /* user_data = */ NULL) != 0)
+      return (-1);
+    c->binary_active = 1;
+  }
+
+  status = lcc_network_buffer_add_value (c->nb, vl);
+  if (status == ENOMEM)
+  {
+    if (lcc_binary_flush (c) != 0)
+      return (-1);
+    status = lcc_network_buffer_add_value (c->nb, vl);
+  }
+  if (status != 0)
+  {
+    lcc_set_errno (c, status);
+    return (-1);
+  }
+
+  return (lcc_queue_pending (c, callback, user_data,
+        /* shares_response = */ 1));
+} /* }}} int lcc_putval_binary */
+
+int lcc_putval_async (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, lcc_callback_t callback, void *user_data)
+{
+  char command[1024] = "";
+  int status;
+
+  if ((c != NULL) && c->binary)
+    return (lcc_putval_binary (c, vl, callback, user_data));
+
+  status = lcc_putval_command (c, vl, command, sizeof (command));
+  if (status != 0)
+    return (status);
+
+  return (lcc_queue (c, command, callback, user_data));
+} /* }}} int lcc_putval_async */
+
+struct lcc_putval_many_s
+{
+  int failed;
+  char message[1024];
+};
+
+static void lcc_putval_many_cb (__attribute__((unused)) lcc_connection_t *c, /* {{{ */
+    int status, const char *message, void *user_data)
+{
+  struct lcc_putval_many_s *pm = user_data;
+
+  if (status >= 0)
+    return;
+
+  if (pm->failed == 0)
+  {
+    strncpy (pm->message, message, sizeof (pm->message));
+    pm->message[sizeof (pm->message) - 1] = 0;
+  }
+  pm->failed++;
+} /* }}} void lcc_putval_many_cb */
+
+int lcc_putval_many (lcc_connection_t *c, /* {{{ */
+    const lcc_value_list_t *vl, size_t vl_num)
+{
+  struct lcc_putval_many_s pm;
+  size_t i;
+  int status;
+
+  if ((c == NULL) || (vl == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  /* Commands queued earlier must not use `pm' as their user data. */
+  if (lcc_sync (c) < 0)
+    return (-1);
+
+  memset (&pm, 0, sizeof (pm));
+  for (i = 0; i < vl_num; i++)
+  {
+    status = lcc_putval_async (c, vl + i, lcc_putval_many_cb, &pm);
+    if (status != 0)
+      break;
+  }
+
+  /* `pm' lives on the stack, so all responses must be read before
+   * returning, even after an error. */
+  if (lcc_sync (c) < 0)
+    return (-1);
+
+  if (i < vl_num)
+    return (-1);
+
+  if (pm.failed > 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %i of %zu values failed, "
+        "first error: %s", pm.failed, vl_num, pm.message);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int lcc_putval_many */
+
+int lcc_set_binary (lcc_connection_t *c, int enabled) /* {{{ */
+{
+  lcc_response_t res;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((enabled != 0) == (c->binary != 0))
+    return (0);
+
+  if (!enabled)
+  {
+    /* Send the current frame and wait for its response. */
+    status = lcc_sync_text (c);
+    lcc_network_buffer_destroy (c->nb);
+    c->nb = NULL;
+    c->binary = 0;
+    return ((status < 0) ? -1 : 0);
+  }
+
+  c->nb = lcc_network_buffer_create (LCC_BINARY_FRAME_SIZE);
+  if (c->nb == NULL)
+  {
+    lcc_set_errno (c, (errno != 0) ? errno : ENOMEM);
+    return (-1);
+  }
+  lcc_network_buffer_set_dictionary (c->nb, /* enabled = */ 1);
+
+  /* The first switch is synchronous, so that a daemon without binary mode
+   * is detected before any values are lost. */
+  memset (&res, 0, sizeof (res));
+  status = lcc_sendreceive (c, "BINARY", &res);
+  if ((status == 0) && (res.status != 0))
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    status = -1;
+  }
+  lcc_response_free (&res);
+
+  if (status != 0)
+  {
+    lcc_network_buffer_destroy (c->nb);
+    c->nb = NULL;
+    return (-1);
+  }
+
+  c->binary = 1;
+  c->binary_active = 1;
+  return (0);
+} /* }}} int lcc_set_binary */
+
+static int lcc_flush_command (lcc_connection_t *c, const char *plugin, /* {{{ */
+    lcc_identifier_t *ident, int timeout,
+    char *command, size_t command_size)
+{
+  char buffer[1024] = "";
+  int status;
+
+  if (c == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  SSTRCPY (buffer, "FLUSH");
+
+  if (timeout > 0)
+    SSTRCATF (buffer, " timeout=%i", timeout);
+
+  if (plugin != NULL)
+  {
+    char plugin_esc[2 * LCC_NAME_LEN];
+    SSTRCATF (buffer, " plugin=%s",
+        lcc_strescape (plugin_esc, plugin, sizeof (plugin_esc)));
+  }
+
+  if (ident != NULL)
+  {
+    char ident_str[6 * LCC_NAME_LEN];
+    char ident_esc[12 * LCC_NAME_LEN];
+
+    status = lcc_identifier_to_string (c, ident_str, sizeof (ident_str), ident);
+    if (status != 0)
+      return (status);
+
+    SSTRCATF (buffer, " identifier=%s",
+        lcc_strescape (ident_esc, ident_str, sizeof (ident_esc)));
+  }
+
+  strncpy (command, buffer, command_size);
+  command[command_size - 1] = 0;
+  return (0);
+} /* }}} int lcc_flush_command */
+
+int lcc_flush (lcc_connection_t *c, const char *plugin, /* {{{ */
+    lcc_identifier_t *ident, int timeout)
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  int status;
+
+  status = lcc_flush_command (c, plugin, ident, timeout,
+      command, sizeof (command));
+  if (status != 0)
+    return (status);
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_flush */
+
+int lcc_flush_start (lcc_connection_t *c, const char *plugin, /* {{{ */
+    lcc_identifier_t *ident, int timeout, uint64_t *ret_token)
+{
+  char command[1024] = "";
+  lcc_response_t res;
+  const char *ptr;
+  int status;
+
+  if (ret_token == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  status = lcc_flush_command (c, plugin, ident, timeout,
+      command, sizeof (command));
+  if (status != 0)
+    return (status);
+  SSTRCAT (command, " async=true");
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  /* The response is "0 Queued: token=<token>". */
+  ptr = strstr (res.message, "token=");
+  if (ptr == NULL)
+  {
+    LCC_SET_ERRSTR (c, "Invalid response: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+  *ret_token = (uint64_t) strtoull (ptr + strlen ("token="), NULL, 10);
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_flush_start */
+
+int lcc_flush_finished (lcc_connection_t *c, uint64_t token, /* {{{ */
+    int *ret_done)
+{
+  char command[64];
+  lcc_response_t res;
+  int status;
+
+  if (ret_done == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  snprintf (command, sizeof (command), "FLUSH token=%"PRIu64, token);
+  command[sizeof (command) - 1] = 0;
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
+  if (res.status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", res.message);
+    lcc_response_free (&res);
+    return (-1);
+  }
+
+  *ret_done = (strncmp (res.message, "Done", strlen ("Done")) == 0) ? 1 : 0;
+
+  lcc_response_free (&res);
+  return (0);
+} /* }}} int lcc_flush_finished */
+
+int lcc_flush_async (lcc_connection_t *c, const char *plugin, /* {{{ */
+    lcc_identifier_t *ident, int timeout,
+    lcc_callback_t callback, void *user_data)
+{
+  char command[1024] = "";
+  int status;
+
+  status = lcc_flush_command (c, plugin, ident, timeout,
+      command, sizeof (command));
+  if (status != 0)
+    return (status);
+
+  return (lcc_queue (c, command, callback, user_data));
+} /* }}} int lcc_flush_async */
+
+int lcc_send_pending (lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return (-1);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  return (lcc_send_queue (c));
+} /* }}} int lcc_send_pending */
+
+int lcc_receive_responses (lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return (-1);
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  return (lcc_sync (c));
+} /* }}} int lcc_receive_responses */
+
+size_t lcc_pending (lcc_connection_t *c) /* {{{ */
+{
+  if (c == NULL)
+    return (0);
+  return (c->pending_num);
+} /* }}} size_t lcc_pending */
+
+/* TODO: Implement lcc_putnotif */
+
+int lcc_listval (lcc_connection_t *c, /* {{{ */
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  return (lcc_listval_prefix (c, /* prefix = */ NULL,
+        ret_ident, ret_ident_num));
+} /* }}} int lcc_listval */
+
+int lcc_listval_prefix (lcc_connection_t *c, const char *prefix, /* {{{ */
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num)
+{
+  char command[1024] = "LISTVAL";
+  lcc_response_t res;
+  size_t i;
+  int status;
+
+  lcc_identifier_t *ident;
+  size_t ident_num;
+
+  if (c == NULL)
+    return (-1);
+
+  if ((ret_ident == NULL) || (ret_ident_num == NULL))
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if ((prefix != NULL) && (prefix[0] != 0))
+  {
+    char prefix_esc[12 * LCC_NAME_LEN];
+    SSTRCATF (command, " prefix=%s",
+        lcc_strescape (prefix_esc, prefix, sizeof (prefix_esc)));
+  }
+
+  status = lcc_sendreceive (c, command, &res);
+  if (status != 0)
+    return (status);
+
   if (res.status != 0)
   {
     LCC_SET_ERRSTR (c, "Server error: %s", res.message);
@@ -984,7 +1892,131 @@ int lcc_listval (lcc_connection_t *c, /* {{{ */
   *ret_ident_num = ident_num;
 
   return (0);
-} /* }}} int lcc_listval */
+} /* }}} int lcc_listval_prefix */
+
+int lcc_listval_stream (lcc_connection_t *c, /* {{{ */
+    const char *prefix, const char *filter,
+    lcc_listval_cb callback, void *user_data)
+{
+  char command[1024] = "LISTVAL stream=true";
+  char buffer[4096];
+  char *ptr;
+  int cb_status = 0;
+  int status;
+
+  if (c == NULL)
+    return (-1);
+
+  if (callback == NULL)
+  {
+    lcc_set_errno (c, EINVAL);
+    return (-1);
+  }
+
+  if (c->fh == NULL)
+  {
+    lcc_set_errno (c, EBADF);
+    return (-1);
+  }
+
+  if ((prefix != NULL) && (prefix[0] != 0))
+  {
+    char prefix_esc[12 * LCC_NAME_LEN];
+    SSTRCATF (command, " prefix=%s",
+        lcc_strescape (prefix_esc, prefix, sizeof (prefix_esc)));
+  }
+
+  if ((filter != NULL) && (filter[0] != 0))
+  {
+    char filter_esc[12 * LCC_NAME_LEN];
+    SSTRCATF (command, " filter=%s",
+        lcc_strescape (filter_esc, filter, sizeof (filter_esc)));
+  }
+
+  if (lcc_sync_text (c) < 0)
+    return (-1);
+
+  status = lcc_send (c, command);
+  if (status != 0)
+    return (status);
+
+  ptr = fgets (buffer, sizeof (buffer), c->fh);
+  if (ptr == NULL)
+  {
+    lcc_set_errno (c, errno);
+    return (-1);
+  }
+  lcc_chomp (buffer);
+
+  errno = 0;
+  status = (int) strtol (buffer, &ptr, 0);
+  if ((errno != 0) || (ptr == &buffer[0]))
+  {
+    lcc_set_errno (c, EILSEQ);
+    return (-1);
+  }
+
+  /* Daemons without streaming support answer like for a regular LISTVAL.
+   * Anything but the exact status line is therefore an error, too. */
+  if (status != 0)
+  {
+    LCC_SET_ERRSTR (c, "Server error: %s", buffer);
+    return (-1);
+  }
+
+  /* Read up to the terminating empty line, even after the callback asked to
+   * stop, so that the next command gets its own response. */
+  while (42)
+  {
+    lcc_identifier_t ident;
+    char *time_str;
+    char *ident_str;
+    double last_update;
+
+    ptr = fgets (buffer, sizeof (buffer), c->fh);
+    if (ptr == NULL)
+    {
+      lcc_set_errno (c, errno);
+      return (-1);
+    }
+    lcc_chomp (buffer);
+
+    if (buffer[0] == 0)
+      break;
+
+    /* Errors after the status line are sent in place of the end. */
+    if (buffer[0] == '-')
+    {
+      LCC_SET_ERRSTR (c, "Server error: %s", buffer);
+      return (-1);
+    }
+
+    if (cb_status != 0)
+      continue;
+
+    time_str = buffer;
+    ident_str = strchr (buffer, ' ');
+    if (ident_str == NULL)
+    {
+      lcc_set_errno (c, EILSEQ);
+      cb_status = -1;
+      continue;
+    }
+    *ident_str = 0;
+    ident_str++;
+
+    last_update = strtod (time_str, NULL);
+    if (lcc_string_to_identifier (c, &ident, ident_str) != 0)
+    {
+      cb_status = -1;
+      continue;
+    }
+
+    cb_status = (*callback) (&ident, last_update, user_data);
+  }
+
+  return (cb_status);
+} /* }}} int lcc_listval_stream */
 
 const char *lcc_strerror (lcc_connection_t *c) /* {{{ */
 {
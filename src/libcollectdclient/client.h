@@ -99,13 +99,97 @@ int lcc_disconnect (lcc_connection_t *c);
 int lcc_getval (lcc_connection_t *c, lcc_identifier_t *ident,
     size_t *ret_values_num, gauge_t **ret_values, char ***ret_values_names);
 
+/* Result of `lcc_getval_multi': the current values of one identifier. */
+struct lcc_getval_result_s
+{
+  lcc_identifier_t identifier;
+  size_t   values_num;
+  gauge_t *values;
+  char   **values_names;
+};
+typedef struct lcc_getval_result_s lcc_getval_result_t;
+
+/* Like `lcc_getval', but for many identifiers at once. The identifiers are
+ * given as strings and may contain the shell wildcards "*", "?" and "[...]".
+ * Identifiers without values are left out of the result, which must be freed
+ * using `lcc_getval_result_free'. */
+int lcc_getval_multi (lcc_connection_t *c,
+    const char * const *identifiers, size_t identifiers_num,
+    lcc_getval_result_t **ret_res, size_t *ret_res_num);
+void lcc_getval_result_free (lcc_getval_result_t *res, size_t res_num);
+
 int lcc_putval (lcc_connection_t *c, const lcc_value_list_t *vl);
 
 int lcc_flush (lcc_connection_t *c, const char *plugin,
     lcc_identifier_t *ident, int timeout);
+/* Like `lcc_flush', but the daemon flushes in the background and returns
+ * right away. The token stored in `ret_token' can be passed to
+ * `lcc_flush_finished', which sets `ret_done' to 1 once the flush has
+ * finished and to 0 while it's still running. */
+int lcc_flush_start (lcc_connection_t *c, const char *plugin,
+    lcc_identifier_t *ident, int timeout, uint64_t *ret_token);
+int lcc_flush_finished (lcc_connection_t *c, uint64_t token, int *ret_done);
+
+/*
+ * Asynchronous interface: Commands are queued on the connection and sent
+ * with a single write by `lcc_send_pending'. `lcc_receive_responses' sends
+ * whatever is still queued, reads all outstanding responses and calls each
+ * command's callback with the status and message returned by the daemon. The
+ * callback may be NULL. A status of -1 with the library's error message is
+ * passed if the response could not be read. `lcc_receive_responses' returns
+ * the number of failed commands, or -1 on I/O errors.
+ *
+ * At most a few hundred commands are kept in flight: when that limit is
+ * reached, queuing another command reads the outstanding responses first.
+ * The synchronous functions above finish all asynchronous commands before
+ * sending their own.
+ */
+typedef void (*lcc_callback_t) (lcc_connection_t *c, int status,
+    const char *message, void *user_data);
+
+int lcc_putval_async (lcc_connection_t *c, const lcc_value_list_t *vl,
+    lcc_callback_t callback, void *user_data);
+int lcc_flush_async (lcc_connection_t *c, const char *plugin,
+    lcc_identifier_t *ident, int timeout,
+    lcc_callback_t callback, void *user_data);
+int lcc_send_pending (lcc_connection_t *c);
+int lcc_receive_responses (lcc_connection_t *c);
+/* Returns the number of asynchronous commands without a response yet. */
+size_t lcc_pending (lcc_connection_t *c);
+
+/* Submits `vl_num' value lists using the asynchronous interface and waits for
+ * all responses. Returns zero if all of them were accepted. */
+int lcc_putval_many (lcc_connection_t *c, const lcc_value_list_t *vl,
+    size_t vl_num);
+
+/* Switches the connection to the unixsock plugin's binary mode or back. In
+ * binary mode, value lists submitted with `lcc_putval', `lcc_putval_async'
+ * and `lcc_putval_many' are collected in frames of up to 64 KiB in the
+ * network plugin's format, with repeated identifier strings sent only once
+ * per frame. The daemon responds once per frame, so the callbacks of all
+ * value lists of a frame get the same status. Other commands switch the
+ * daemon back to text mode temporarily. Fails if the daemon doesn't support
+ * the binary mode. */
+int lcc_set_binary (lcc_connection_t *c, int enabled);
 
 int lcc_listval (lcc_connection_t *c,
     lcc_identifier_t **ret_ident, size_t *ret_ident_num);
+/* Like `lcc_listval', but only returns identifiers starting with `prefix',
+ * e.g. "myhost/" or "myhost/cpu-0/". */
+/* Calls `callback' for each identifier in the daemon's cache whose string
+ * representation starts with `prefix' and matches the shell wildcard pattern
+ * `filter'; both may be NULL. The identifiers are read from the connection
+ * one at a time, so arbitrarily long lists need no memory. If `callback'
+ * returns non-zero, the remaining identifiers are skipped and that value is
+ * returned. Requires a daemon which supports the LISTVAL "stream" option. */
+typedef int (*lcc_listval_cb) (const lcc_identifier_t *ident,
+    double last_update, void *user_data);
+int lcc_listval_stream (lcc_connection_t *c,
+    const char *prefix, const char *filter,
+    lcc_listval_cb callback, void *user_data);
+
+int lcc_listval_prefix (lcc_connection_t *c, const char *prefix,
+    lcc_identifier_t **ret_ident, size_t *ret_ident_num);
 
 /* TODO: putnotif */
 
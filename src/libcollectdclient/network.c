@@ -0,0 +1,350 @@
+/**
+ * libcollectdclient - src/libcollectdclient/network.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include "network.h"
+
+struct lcc_server_s
+{
+  int fd;
+  struct sockaddr_storage sa;
+  socklen_t sa_len;
+
+  size_t packet_size;
+  lcc_network_buffer_t *buffer;
+
+  lcc_server_t *next;
+};
+
+struct lcc_network_s
+{
+  lcc_server_t *servers;
+};
+
+/*
+ * Private functions
+ */
+static int server_send_buffer (lcc_server_t *srv) /* {{{ */
+{
+  char buffer[srv->packet_size];
+  size_t buffer_size;
+  ssize_t status;
+  int ret = 0;
+
+  if (lcc_network_buffer_values_num (srv->buffer) == 0)
+    return (0);
+
+  buffer_size = sizeof (buffer);
+  if ((lcc_network_buffer_finalize (srv->buffer) != 0)
+      || (lcc_network_buffer_get (srv->buffer, buffer, &buffer_size) != 0))
+    ret = EIO;
+
+  /* The packet is dropped on errors: resending it later would only delay
+   * the newer values. */
+  lcc_network_buffer_initialize (srv->buffer);
+  if (ret != 0)
+    return (ret);
+
+  while (42)
+  {
+    status = sendto (srv->fd, buffer, buffer_size, /* flags = */ 0,
+        (struct sockaddr *) &srv->sa, srv->sa_len);
+    if ((status < 0) && (errno == EINTR))
+      continue;
+    break;
+  }
+
+  if (status < 0)
+    return (errno);
+
+  return (0);
+} /* }}} int server_send_buffer */
+
+static int server_value_add (lcc_server_t *srv, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  int status;
+
+  status = lcc_network_buffer_add_value (srv->buffer, vl);
+  if (status != ENOMEM)
+    return (status);
+
+  /* The packet is full: send it and retry with an empty one. */
+  server_send_buffer (srv);
+  return (lcc_network_buffer_add_value (srv->buffer, vl));
+} /* }}} int server_value_add */
+
+static int server_open_socket (lcc_server_t *srv, /* {{{ */
+    const char *node, const char *service)
+{
+  struct addrinfo ai_hints;
+  struct addrinfo *ai_list = NULL;
+  struct addrinfo *ai_ptr;
+  int status;
+
+  memset (&ai_hints, 0, sizeof (ai_hints));
+#ifdef AI_ADDRCONFIG
+  ai_hints.ai_flags |= AI_ADDRCONFIG;
+#endif
+  ai_hints.ai_family = AF_UNSPEC;
+  ai_hints.ai_socktype = SOCK_DGRAM;
+
+  status = getaddrinfo (node, service, &ai_hints, &ai_list);
+  if (status != 0)
+    return (EHOSTUNREACH);
+
+  srv->fd = -1;
+  for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
+  {
+    if (ai_ptr->ai_addrlen > sizeof (srv->sa))
+      continue;
+
+    srv->fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        ai_ptr->ai_protocol);
+    if (srv->fd < 0)
+      continue;
+
+    memcpy (&srv->sa, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+    srv->sa_len = (socklen_t) ai_ptr->ai_addrlen;
+    break;
+  }
+
+  freeaddrinfo (ai_list);
+
+  if (srv->fd < 0)
+    return (EHOSTUNREACH);
+  return (0);
+} /* }}} int server_open_socket */
+
+static void server_destroy (lcc_server_t *srv) /* {{{ */
+{
+  if (srv == NULL)
+    return;
+
+  server_send_buffer (srv);
+
+  if (srv->fd >= 0)
+    close (srv->fd);
+  lcc_network_buffer_destroy (srv->buffer);
+  free (srv);
+} /* }}} void server_destroy */
+
+/*
+ * Public functions
+ */
+lcc_network_t *lcc_network_create (void) /* {{{ */
+{
+  lcc_network_t *net;
+
+  net = malloc (sizeof (*net));
+  if (net == NULL)
+    return (NULL);
+  memset (net, 0, sizeof (*net));
+
+  net->servers = NULL;
+
+  return (net);
+} /* }}} lcc_network_t *lcc_network_create */
+
+void lcc_network_destroy (lcc_network_t *net) /* {{{ */
+{
+  if (net == NULL)
+    return;
+
+  while (net->servers != NULL)
+  {
+    lcc_server_t *next = net->servers->next;
+    server_destroy (net->servers);
+    net->servers = next;
+  }
+
+  free (net);
+} /* }}} void lcc_network_destroy */
+
+lcc_server_t *lcc_server_create (lcc_network_t *net, /* {{{ */
+    const char *node, const char *service)
+{
+  lcc_server_t *srv;
+  int status;
+
+  if ((net == NULL) || (node == NULL))
+    return (NULL);
+  if (service == NULL)
+    service = LCC_DEFAULT_PORT;
+
+  srv = malloc (sizeof (*srv));
+  if (srv == NULL)
+    return (NULL);
+  memset (srv, 0, sizeof (*srv));
+  srv->fd = -1;
+
+  srv->packet_size = LCC_NETWORK_BUFFER_SIZE_DEFAULT;
+  srv->buffer = lcc_network_buffer_create (srv->packet_size);
+  if (srv->buffer == NULL)
+  {
+    free (srv);
+    return (NULL);
+  }
+
+  status = server_open_socket (srv, node, service);
+  if (status != 0)
+  {
+    lcc_network_buffer_destroy (srv->buffer);
+    free (srv);
+    errno = status;
+    return (NULL);
+  }
+
+  srv->next = net->servers;
+  net->servers = srv;
+
+  return (srv);
+} /* }}} lcc_server_t *lcc_server_create */
+
+int lcc_server_destroy (lcc_network_t *net, lcc_server_t *srv) /* {{{ */
+{
+  lcc_server_t **ptr;
+
+  if ((net == NULL) || (srv == NULL))
+    return (EINVAL);
+
+  for (ptr = &net->servers; *ptr != NULL; ptr = &(*ptr)->next)
+  {
+    if (*ptr != srv)
+      continue;
+
+    *ptr = srv->next;
+    server_destroy (srv);
+    return (0);
+  }
+
+  return (ENOENT);
+} /* }}} int lcc_server_destroy */
+
+int lcc_server_set_ttl (lcc_server_t *srv, uint8_t ttl) /* {{{ */
+{
+  int optval = (int) ttl;
+  int level;
+  int optname;
+
+  if (srv == NULL)
+    return (EINVAL);
+
+  if (srv->sa.ss_family == AF_INET)
+  {
+    struct sockaddr_in *sa = (struct sockaddr_in *) &srv->sa;
+
+    level = IPPROTO_IP;
+    if (IN_MULTICAST (ntohl (sa->sin_addr.s_addr)))
+      optname = IP_MULTICAST_TTL;
+    else
+      optname = IP_TTL;
+  }
+  else if (srv->sa.ss_family == AF_INET6)
+  {
+    struct sockaddr_in6 *sa = (struct sockaddr_in6 *) &srv->sa;
+
+    level = IPPROTO_IPV6;
+    if (IN6_IS_ADDR_MULTICAST (&sa->sin6_addr))
+      optname = IPV6_MULTICAST_HOPS;
+    else
+      optname = IPV6_UNICAST_HOPS;
+  }
+  else
+    return (EAFNOSUPPORT);
+
+  if (setsockopt (srv->fd, level, optname, &optval, sizeof (optval)) != 0)
+    return (errno);
+
+  return (0);
+} /* }}} int lcc_server_set_ttl */
+
+int lcc_server_set_security_level (lcc_server_t *srv, /* {{{ */
+    lcc_security_level_t level,
+    const char *username, const char *password)
+{
+  if (srv == NULL)
+    return (EINVAL);
+
+  /* Changing the level discards the packet, so values added with the old
+   * level are sent first. */
+  server_send_buffer (srv);
+
+  return (lcc_network_buffer_set_security_level (srv->buffer,
+        level, username, password));
+} /* }}} int lcc_server_set_security_level */
+
+int lcc_server_set_dictionary (lcc_server_t *srv, int enabled) /* {{{ */
+{
+  if (srv == NULL)
+    return (EINVAL);
+
+  server_send_buffer (srv);
+  return (lcc_network_buffer_set_dictionary (srv->buffer, enabled));
+} /* }}} int lcc_server_set_dictionary */
+
+int lcc_network_values_send (lcc_network_t *net, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  lcc_server_t *srv;
+  int ret = 0;
+
+  if ((net == NULL) || (vl == NULL))
+    return (EINVAL);
+
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+  {
+    int status = server_value_add (srv, vl);
+    if (status != 0)
+      ret = status;
+  }
+
+  return (ret);
+} /* }}} int lcc_network_values_send */
+
+int lcc_network_flush (lcc_network_t *net) /* {{{ */
+{
+  lcc_server_t *srv;
+  int ret = 0;
+
+  if (net == NULL)
+    return (EINVAL);
+
+  for (srv = net->servers; srv != NULL; srv = srv->next)
+  {
+    int status = server_send_buffer (srv);
+    if (status != 0)
+      ret = status;
+  }
+
+  return (ret);
+} /* }}} int lcc_network_flush */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,66 @@
+/**
+ * libcollectdclient - src/libcollectdclient/network.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_NETWORK_H
+#define LIBCOLLECTDCLIENT_NETWORK_H 1
+
+#include "client.h"
+#include "network_buffer.h"
+
+LCC_BEGIN_DECLS
+
+/*
+ * Sends value lists to one or more servers using the binary protocol of the
+ * network plugin, without going through a local daemon. Value lists are
+ * collected in one packet per server, which is sent when it is full, when
+ * `lcc_network_flush' is called and when the server or network object is
+ * destroyed. An `lcc_network_t' and its servers must not be used by more than
+ * one thread at a time.
+ */
+struct lcc_network_s;
+typedef struct lcc_network_s lcc_network_t;
+
+struct lcc_server_s;
+typedef struct lcc_server_s lcc_server_t;
+
+lcc_network_t *lcc_network_create (void);
+void lcc_network_destroy (lcc_network_t *net);
+
+/* `service' may be NULL to use LCC_DEFAULT_PORT. */
+lcc_server_t *lcc_server_create (lcc_network_t *net,
+    const char *node, const char *service);
+int lcc_server_destroy (lcc_network_t *net, lcc_server_t *srv);
+
+/* Sets the TTL, or the hop limit for multicast groups, of outgoing
+ * packets. */
+int lcc_server_set_ttl (lcc_server_t *srv, uint8_t ttl);
+int lcc_server_set_security_level (lcc_server_t *srv,
+    lcc_security_level_t level,
+    const char *username, const char *password);
+int lcc_server_set_dictionary (lcc_server_t *srv, int enabled);
+
+/* Returns zero if the value list has been added to all servers' packets. */
+int lcc_network_values_send (lcc_network_t *net,
+    const lcc_value_list_t *vl);
+/* Sends all packets which hold at least one value list. */
+int lcc_network_flush (lcc_network_t *net);
+
+LCC_END_DECLS
+
+#endif /* LIBCOLLECTDCLIENT_NETWORK_H */
+/* vim: set sw=2 sts=2 et : */
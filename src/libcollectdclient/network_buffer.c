@@ -0,0 +1,735 @@
+/**
+ * libcollectdclient - src/libcollectdclient/network_buffer.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#if HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h> /* htons */
+
+#include <pthread.h>
+
+#if HAVE_LIBGCRYPT
+# include <gcrypt.h>
+GCRY_THREAD_OPTION_PTHREAD_IMPL;
+#endif
+
+#include "network_buffer.h"
+
+/* The part types must be kept in sync with `src/network.h'. */
+#define TYPE_HOST            0x0000
+#define TYPE_TIME_HR         0x0008
+#define TYPE_PLUGIN          0x0002
+#define TYPE_PLUGIN_INSTANCE 0x0003
+#define TYPE_TYPE            0x0004
+#define TYPE_TYPE_INSTANCE   0x0005
+#define TYPE_VALUES          0x0006
+#define TYPE_INTERVAL_HR     0x0009
+
+#define TYPE_HOST_REF            0x0010
+#define TYPE_PLUGIN_REF          0x0012
+#define TYPE_PLUGIN_INSTANCE_REF 0x0013
+#define TYPE_TYPE_REF            0x0014
+#define TYPE_TYPE_INSTANCE_REF   0x0015
+
+#define TYPE_SIGN_SHA256     0x0200
+#define TYPE_ENCR_AES256     0x0210
+
+#define PART_HEADER_SIZE 4
+#define PART_SIGNATURE_SHA256_SIZE 36
+/* Header, username length, IV and SHA-1 hash; the username comes on top. */
+#define PART_ENCRYPTION_AES256_SIZE 42
+
+/* Number of strings which may be referred to, see `src/network.c'. */
+#define NB_STRING_TABLE_SIZE 128
+
+/* Times are sent in the high resolution format: 2^-30 seconds. */
+#define NB_SECONDS_TO_HR(s) (((uint64_t) (s)) << 30)
+
+struct lcc_network_buffer_s
+{
+  char *buffer;
+  size_t size;
+
+  /* Fields of the previous value list. */
+  lcc_value_list_t state;
+  int dictionary;
+  const char *strings[NB_STRING_TABLE_SIZE];
+  size_t strings_len[NB_STRING_TABLE_SIZE];
+  int strings_num;
+
+  char *ptr;
+  size_t free;
+  size_t values_num;
+  int finalized;
+
+  lcc_security_level_t seclevel;
+  char *username;
+  char *password;
+  size_t header_size;
+
+#if HAVE_LIBGCRYPT
+  gcry_cipher_hd_t cypher;
+  gcry_md_hd_t hmac;
+#endif
+};
+
+/*
+ * Private functions
+ */
+static uint64_t nb_htonll (uint64_t n) /* {{{ */
+{
+#if BYTE_ORDER == BIG_ENDIAN
+  return (n);
+#else
+  return (((uint64_t) htonl ((uint32_t) n)) << 32)
+    | ((uint64_t) htonl ((uint32_t) (n >> 32)));
+#endif
+} /* }}} uint64_t nb_htonll */
+
+/* Doubles are sent in x86 byte order, see `htond' in `src/common.c'. */
+static double nb_htond (double d) /* {{{ */
+{
+#if FP_LAYOUT_NEED_NOTHING
+  return (d);
+#else
+  union
+  {
+    uint8_t  byte[8];
+    uint64_t integer;
+    double   floating;
+  } ret;
+
+  if (isnan (d))
+  {
+    memset (ret.byte, 0, sizeof (ret.byte));
+    ret.byte[6] = 0xf8;
+    ret.byte[7] = 0x7f;
+    return (ret.floating);
+  }
+
+  ret.floating = d;
+# if FP_LAYOUT_NEED_ENDIANFLIP
+  ret.integer = ((ret.integer & 0xff00000000000000LL) >> 56)
+    | ((ret.integer & 0x00ff000000000000LL) >> 40)
+    | ((ret.integer & 0x0000ff0000000000LL) >> 24)
+    | ((ret.integer & 0x000000ff00000000LL) >> 8)
+    | ((ret.integer & 0x00000000ff000000LL) << 8)
+    | ((ret.integer & 0x0000000000ff0000LL) << 24)
+    | ((ret.integer & 0x000000000000ff00LL) << 40)
+    | ((ret.integer & 0x00000000000000ffLL) << 56);
+# else /* FP_LAYOUT_NEED_INTSWAP */
+  ret.integer = ((ret.integer & 0xffffffff00000000LL) >> 32)
+    | ((ret.integer & 0x00000000ffffffffLL) << 32);
+# endif
+  return (ret.floating);
+#endif
+} /* }}} double nb_htond */
+
+#if HAVE_LIBGCRYPT
+static int nb_init_gcrypt (void) /* {{{ */
+{
+  /* The application may have initialized the library already. */
+  if (gcry_control (GCRYCTL_ANY_INITIALIZATION_P))
+    return (0);
+
+  gcry_control (GCRYCTL_SET_THREAD_CBS, &gcry_threads_pthread);
+  if (!gcry_check_version (GCRYPT_VERSION))
+    return (-1);
+  gcry_control (GCRYCTL_INIT_SECMEM, 32768, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  return (0);
+} /* }}} int nb_init_gcrypt */
+
+static void nb_close_crypto (lcc_network_buffer_t *nb) /* {{{ */
+{
+  if (nb->cypher != NULL)
+    gcry_cipher_close (nb->cypher);
+  nb->cypher = NULL;
+
+  if (nb->hmac != NULL)
+    gcry_md_close (nb->hmac);
+  nb->hmac = NULL;
+} /* }}} void nb_close_crypto */
+
+/* Opens the handle needed for `nb->seclevel' and sets its key, once per
+ * configuration, so that each packet only has to reset it. */
+static int nb_open_crypto (lcc_network_buffer_t *nb) /* {{{ */
+{
+  gcry_error_t err;
+
+  if (nb_init_gcrypt () != 0)
+    return (-1);
+
+  if (nb->seclevel == SIGN)
+  {
+    err = gcry_md_open (&nb->hmac, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+    if (err == 0)
+      err = gcry_md_setkey (nb->hmac, nb->password, strlen (nb->password));
+  }
+  else /* if (nb->seclevel == ENCRYPT) */
+  {
+    unsigned char password_hash[32];
+
+    err = gcry_cipher_open (&nb->cypher,
+        GCRY_CIPHER_AES256, GCRY_CIPHER_MODE_OFB, /* flags = */ 0);
+    if (err == 0)
+    {
+      gcry_md_hash_buffer (GCRY_MD_SHA256, password_hash,
+          nb->password, strlen (nb->password));
+      err = gcry_cipher_setkey (nb->cypher,
+          password_hash, sizeof (password_hash));
+    }
+  }
+
+  if (err != 0)
+  {
+    nb_close_crypto (nb);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int nb_open_crypto */
+#endif /* HAVE_LIBGCRYPT */
+
+static int nb_add_part (char **ret_buffer, size_t *ret_buffer_len, /* {{{ */
+    uint16_t type, const void *data, size_t data_len)
+{
+  uint16_t pkg_type;
+  uint16_t pkg_length;
+  size_t part_len;
+
+  part_len = PART_HEADER_SIZE + data_len;
+  if ((part_len > *ret_buffer_len) || (part_len > UINT16_MAX))
+    return (ENOMEM);
+
+  pkg_type = htons (type);
+  pkg_length = htons ((uint16_t) part_len);
+
+  /* The buffer may be unaligned, so everything is written with `memcpy'. */
+  memcpy (*ret_buffer, &pkg_type, sizeof (pkg_type));
+  memcpy (*ret_buffer + sizeof (pkg_type), &pkg_length, sizeof (pkg_length));
+  if (data != NULL)
+    memcpy (*ret_buffer + PART_HEADER_SIZE, data, data_len);
+
+  *ret_buffer += part_len;
+  *ret_buffer_len -= part_len;
+
+  return (0);
+} /* }}} int nb_add_part */
+
+static int nb_add_number (char **ret_buffer, size_t *ret_buffer_len, /* {{{ */
+    uint16_t type, uint64_t value)
+{
+  uint64_t pkg_value = nb_htonll (value);
+
+  return (nb_add_part (ret_buffer, ret_buffer_len,
+        type, &pkg_value, sizeof (pkg_value)));
+} /* }}} int nb_add_number */
+
+/* Writes one of the identifier fields, or a reference to an earlier
+ * occurrence of the same string if the dictionary is enabled. Every string
+ * written takes the next index of the table, as on the receiving end. */
+static int nb_add_identifier (lcc_network_buffer_t *nb, /* {{{ */
+    char **ret_buffer, size_t *ret_buffer_len,
+    uint16_t type, uint16_t ref_type, const char *str)
+{
+  char *part = *ret_buffer;
+  size_t str_len = strlen (str);
+  int status;
+  int i;
+
+  /* Strings shorter than two bytes are always written, because the
+   * reference would not be any smaller. */
+  if (nb->dictionary && (str_len >= 2))
+  {
+    for (i = 0; i < nb->strings_num; i++)
+    {
+      uint16_t index;
+
+      if ((nb->strings_len[i] != str_len)
+          || (memcmp (nb->strings[i], str, str_len) != 0))
+        continue;
+
+      index = htons ((uint16_t) i);
+      return (nb_add_part (ret_buffer, ret_buffer_len,
+            ref_type, &index, sizeof (index)));
+    }
+  }
+
+  /* Includes the terminating null byte. */
+  status = nb_add_part (ret_buffer, ret_buffer_len, type, str, str_len + 1);
+  if ((status == 0) && nb->dictionary
+      && (nb->strings_num < NB_STRING_TABLE_SIZE))
+  {
+    nb->strings[nb->strings_num] = part + PART_HEADER_SIZE;
+    nb->strings_len[nb->strings_num] = str_len;
+    nb->strings_num++;
+  }
+
+  return (status);
+} /* }}} int nb_add_identifier */
+
+static int nb_add_values (char **ret_buffer, size_t *ret_buffer_len, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  char *buffer;
+  uint16_t pkg_num_values;
+  size_t part_len;
+  size_t i;
+
+  part_len = PART_HEADER_SIZE + sizeof (pkg_num_values)
+    + vl->values_len * (sizeof (uint8_t) + sizeof (value_t));
+  if ((part_len > *ret_buffer_len) || (part_len > UINT16_MAX))
+    return (ENOMEM);
+
+  /* Only writes the part header, the data follows below. */
+  buffer = *ret_buffer;
+  if (nb_add_part (&buffer, ret_buffer_len, TYPE_VALUES,
+        /* data = */ NULL, part_len - PART_HEADER_SIZE) != 0)
+    return (ENOMEM);
+
+  buffer = *ret_buffer + PART_HEADER_SIZE;
+  pkg_num_values = htons ((uint16_t) vl->values_len);
+  memcpy (buffer, &pkg_num_values, sizeof (pkg_num_values));
+  buffer += sizeof (pkg_num_values);
+
+  for (i = 0; i < vl->values_len; i++)
+    buffer[i] = (char) vl->values_types[i];
+  buffer += vl->values_len;
+
+  for (i = 0; i < vl->values_len; i++)
+  {
+    value_t value;
+
+    if (vl->values_types[i] == LCC_TYPE_GAUGE)
+      value.gauge = nb_htond (vl->values[i].gauge);
+    else if (vl->values_types[i] == LCC_TYPE_COUNTER)
+      value.counter = nb_htonll (vl->values[i].counter);
+    else if (vl->values_types[i] == LCC_TYPE_DERIVE)
+      value.derive = nb_htonll (vl->values[i].derive);
+    else /* if (vl->values_types[i] == LCC_TYPE_ABSOLUTE) */
+      value.absolute = nb_htonll (vl->values[i].absolute);
+
+    memcpy (buffer, &value, sizeof (value));
+    buffer += sizeof (value);
+  }
+
+  assert (buffer == (*ret_buffer + part_len));
+  *ret_buffer = buffer;
+
+  return (0);
+} /* }}} int nb_add_values */
+
+#define NB_ADD_IDENTIFIER(field, type) do { \
+  if (strcmp (nb->state.identifier.field, vl->identifier.field) != 0) \
+  { \
+    status = nb_add_identifier (nb, &buffer, &buffer_len, \
+        type, type ## _REF, vl->identifier.field); \
+    if (status != 0) \
+      return (status); \
+    memcpy (state.identifier.field, vl->identifier.field, \
+        sizeof (state.identifier.field)); \
+  } \
+} while (0)
+
+/* Writes `vl' to the buffer. `nb->ptr', `nb->free' and `nb->state' are only
+ * changed if the whole value list fits. */
+static int nb_add_value_list (lcc_network_buffer_t *nb, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  lcc_value_list_t state = nb->state;
+  char *buffer = nb->ptr;
+  size_t buffer_len = nb->free;
+  int strings_num = nb->strings_num;
+  time_t t;
+  int status;
+
+  NB_ADD_IDENTIFIER (host, TYPE_HOST);
+
+  t = (vl->time > 0) ? vl->time : time (NULL);
+  if (state.time != t)
+  {
+    status = nb_add_number (&buffer, &buffer_len, TYPE_TIME_HR,
+        NB_SECONDS_TO_HR (t));
+    if (status != 0)
+      return (status);
+    state.time = t;
+  }
+
+  if (state.interval != vl->interval)
+  {
+    status = nb_add_number (&buffer, &buffer_len, TYPE_INTERVAL_HR,
+        NB_SECONDS_TO_HR (vl->interval));
+    if (status != 0)
+      return (status);
+    state.interval = vl->interval;
+  }
+
+  NB_ADD_IDENTIFIER (plugin, TYPE_PLUGIN);
+  NB_ADD_IDENTIFIER (plugin_instance, TYPE_PLUGIN_INSTANCE);
+  NB_ADD_IDENTIFIER (type, TYPE_TYPE);
+  NB_ADD_IDENTIFIER (type_instance, TYPE_TYPE_INSTANCE);
+
+  status = nb_add_values (&buffer, &buffer_len, vl);
+  if (status != 0)
+  {
+    /* Forget the strings of the parts which are being discarded. */
+    nb->strings_num = strings_num;
+    return (status);
+  }
+
+  nb->state = state;
+  nb->ptr = buffer;
+  nb->free = buffer_len;
+
+  return (0);
+} /* }}} int nb_add_value_list */
+#undef NB_ADD_IDENTIFIER
+
+#if HAVE_LIBGCRYPT
+/*
+ * Signed packets start with
+ *   type, length, HMAC-SHA-256 (32 bytes), username
+ * and the hash covers the username and the payload.
+ */
+static int nb_finalize_sign (lcc_network_buffer_t *nb) /* {{{ */
+{
+  unsigned char *hash;
+
+  gcry_md_reset (nb->hmac);
+  gcry_md_write (nb->hmac, nb->buffer + PART_SIGNATURE_SHA256_SIZE,
+      (size_t) (nb->ptr - nb->buffer) - PART_SIGNATURE_SHA256_SIZE);
+  hash = gcry_md_read (nb->hmac, GCRY_MD_SHA256);
+  if (hash == NULL)
+    return (-1);
+
+  memcpy (nb->buffer + PART_HEADER_SIZE, hash, 32);
+  return (0);
+} /* }}} int nb_finalize_sign */
+
+/*
+ * Encrypted packets start with
+ *   type, length, username length, username, IV (16 bytes)
+ * followed by the SHA-1 hash (20 bytes) of the payload and the payload, both
+ * encrypted using AES-256 in OFB mode and the SHA-256 hash of the password as
+ * key.
+ */
+static int nb_finalize_encrypt (lcc_network_buffer_t *nb) /* {{{ */
+{
+  size_t username_len = strlen (nb->username);
+  char *iv = nb->buffer + PART_HEADER_SIZE + sizeof (uint16_t) + username_len;
+  char *hash = iv + 16;
+  size_t encr_size;
+  uint16_t length;
+  gcry_error_t err;
+
+  length = htons ((uint16_t) (nb->ptr - nb->buffer));
+  memcpy (nb->buffer + sizeof (uint16_t), &length, sizeof (length));
+
+  gcry_randomize (iv, 16, GCRY_STRONG_RANDOM);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, hash, nb->buffer + nb->header_size,
+      (size_t) (nb->ptr - nb->buffer) - nb->header_size);
+
+  err = gcry_cipher_reset (nb->cypher);
+  if (err == 0)
+    err = gcry_cipher_setiv (nb->cypher, iv, 16);
+  if (err != 0)
+    return (-1);
+
+  encr_size = (size_t) (nb->ptr - hash);
+  err = gcry_cipher_encrypt (nb->cypher, hash, encr_size,
+      /* in = */ NULL, /* in len = */ 0);
+  if (err != 0)
+    return (-1);
+
+  return (0);
+} /* }}} int nb_finalize_encrypt */
+#endif /* HAVE_LIBGCRYPT */
+
+/*
+ * Public functions
+ */
+lcc_network_buffer_t *lcc_network_buffer_create (size_t size) /* {{{ */
+{
+  lcc_network_buffer_t *nb;
+
+  if (size == 0)
+    size = LCC_NETWORK_BUFFER_SIZE_DEFAULT;
+
+  /* Room for the security header and at least one value. */
+  if ((size < 128) || (size > UINT16_MAX))
+  {
+    errno = EINVAL;
+    return (NULL);
+  }
+
+  nb = malloc (sizeof (*nb));
+  if (nb == NULL)
+    return (NULL);
+  memset (nb, 0, sizeof (*nb));
+
+  nb->size = size;
+  nb->buffer = malloc (nb->size);
+  if (nb->buffer == NULL)
+  {
+    free (nb);
+    return (NULL);
+  }
+
+  nb->seclevel = NONE;
+  lcc_network_buffer_initialize (nb);
+
+  return (nb);
+} /* }}} lcc_network_buffer_t *lcc_network_buffer_create */
+
+void lcc_network_buffer_destroy (lcc_network_buffer_t *nb) /* {{{ */
+{
+  if (nb == NULL)
+    return;
+
+#if HAVE_LIBGCRYPT
+  nb_close_crypto (nb);
+#endif
+  free (nb->username);
+  free (nb->password);
+  free (nb->buffer);
+  free (nb);
+} /* }}} void lcc_network_buffer_destroy */
+
+int lcc_network_buffer_set_security_level (lcc_network_buffer_t *nb, /* {{{ */
+    lcc_security_level_t level,
+    const char *username, const char *password)
+{
+#if HAVE_LIBGCRYPT
+  char *username_copy;
+  char *password_copy;
+#endif
+
+  if (nb == NULL)
+    return (EINVAL);
+
+  if (level == NONE)
+  {
+#if HAVE_LIBGCRYPT
+    nb_close_crypto (nb);
+#endif
+    free (nb->username);
+    free (nb->password);
+    nb->username = NULL;
+    nb->password = NULL;
+    nb->seclevel = NONE;
+    lcc_network_buffer_initialize (nb);
+    return (0);
+  }
+
+#if HAVE_LIBGCRYPT
+  if ((level != SIGN) && (level != ENCRYPT))
+    return (EINVAL);
+
+  if ((username == NULL) || (password == NULL))
+    return (EINVAL);
+
+  /* The header has to leave room for at least one value list. */
+  if (strlen (username) > 64)
+    return (EINVAL);
+
+  username_copy = strdup (username);
+  password_copy = strdup (password);
+  if ((username_copy == NULL) || (password_copy == NULL))
+  {
+    free (username_copy);
+    free (password_copy);
+    return (ENOMEM);
+  }
+
+  nb_close_crypto (nb);
+  free (nb->username);
+  free (nb->password);
+  nb->username = username_copy;
+  nb->password = password_copy;
+  nb->seclevel = level;
+
+  if (nb_open_crypto (nb) != 0)
+  {
+    lcc_network_buffer_set_security_level (nb, NONE, NULL, NULL);
+    return (ENOTSUP);
+  }
+
+  lcc_network_buffer_initialize (nb);
+  return (0);
+#else
+  (void) username;
+  (void) password;
+  return (ENOTSUP);
+#endif
+} /* }}} int lcc_network_buffer_set_security_level */
+
+int lcc_network_buffer_set_dictionary (lcc_network_buffer_t *nb, /* {{{ */
+    int enabled)
+{
+  if (nb == NULL)
+    return (EINVAL);
+
+  /* Strings already in the packet are not in the table, so a change only
+   * takes effect with the next packet. */
+  if (nb->values_num == 0)
+    nb->strings_num = 0;
+  nb->dictionary = enabled ? 1 : 0;
+
+  return (0);
+} /* }}} int lcc_network_buffer_set_dictionary */
+
+int lcc_network_buffer_initialize (lcc_network_buffer_t *nb) /* {{{ */
+{
+  char *buffer;
+  size_t buffer_len;
+
+  if (nb == NULL)
+    return (EINVAL);
+
+  memset (&nb->state, 0, sizeof (nb->state));
+  nb->strings_num = 0;
+  nb->values_num = 0;
+  nb->finalized = 0;
+
+  buffer = nb->buffer;
+  buffer_len = nb->size;
+
+#if HAVE_LIBGCRYPT
+  if (nb->seclevel == SIGN)
+  {
+    size_t username_len = strlen (nb->username);
+
+    /* The part includes the username. The hash is filled in by
+     * `lcc_network_buffer_finalize'. */
+    memset (buffer, 0, PART_SIGNATURE_SHA256_SIZE);
+    memcpy (buffer + PART_SIGNATURE_SHA256_SIZE, nb->username, username_len);
+    nb_add_part (&buffer, &buffer_len, TYPE_SIGN_SHA256, /* data = */ NULL,
+        PART_SIGNATURE_SHA256_SIZE - PART_HEADER_SIZE + username_len);
+  }
+  else if (nb->seclevel == ENCRYPT)
+  {
+    size_t username_len = strlen (nb->username);
+    uint16_t username_length = htons ((uint16_t) username_len);
+
+    /* The length, IV and hash are filled in by
+     * `lcc_network_buffer_finalize'. */
+    memset (buffer, 0, PART_ENCRYPTION_AES256_SIZE + username_len);
+    nb_add_part (&buffer, &buffer_len, TYPE_ENCR_AES256,
+        &username_length, sizeof (username_length));
+    memcpy (buffer, nb->username, username_len);
+    buffer += username_len + 16 + 20;
+    buffer_len -= username_len + 16 + 20;
+  }
+#endif
+
+  nb->header_size = (size_t) (buffer - nb->buffer);
+  nb->ptr = buffer;
+  nb->free = buffer_len;
+
+  return (0);
+} /* }}} int lcc_network_buffer_initialize */
+
+int lcc_network_buffer_finalize (lcc_network_buffer_t *nb) /* {{{ */
+{
+  int status = 0;
+
+  if (nb == NULL)
+    return (EINVAL);
+
+  if (nb->finalized)
+    return (0);
+
+#if HAVE_LIBGCRYPT
+  if (nb->seclevel == SIGN)
+    status = nb_finalize_sign (nb);
+  else if (nb->seclevel == ENCRYPT)
+    status = nb_finalize_encrypt (nb);
+#endif
+
+  if (status != 0)
+    return (EIO);
+
+  nb->finalized = 1;
+  return (0);
+} /* }}} int lcc_network_buffer_finalize */
+
+int lcc_network_buffer_add_value (lcc_network_buffer_t *nb, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  size_t i;
+  int status;
+
+  if ((nb == NULL) || (vl == NULL) || (vl->values_len < 1)
+      || (vl->values == NULL) || (vl->values_types == NULL))
+    return (EINVAL);
+
+  for (i = 0; i < vl->values_len; i++)
+    if ((vl->values_types[i] < LCC_TYPE_COUNTER)
+        || (vl->values_types[i] > LCC_TYPE_ABSOLUTE))
+      return (EINVAL);
+
+  /* A finalized packet must not be changed anymore. */
+  if (nb->finalized)
+    return (ENOMEM);
+
+  status = nb_add_value_list (nb, vl);
+  if (status != 0)
+    return (status);
+
+  nb->values_num++;
+  return (0);
+} /* }}} int lcc_network_buffer_add_value */
+
+size_t lcc_network_buffer_values_num (const lcc_network_buffer_t *nb) /* {{{ */
+{
+  if (nb == NULL)
+    return (0);
+  return (nb->values_num);
+} /* }}} size_t lcc_network_buffer_values_num */
+
+int lcc_network_buffer_get (lcc_network_buffer_t *nb, /* {{{ */
+    void *buffer, size_t *buffer_size)
+{
+  size_t size;
+
+  if ((nb == NULL) || (buffer_size == NULL))
+    return (EINVAL);
+
+  size = (size_t) (nb->ptr - nb->buffer);
+  if ((buffer == NULL) || (*buffer_size < size))
+  {
+    *buffer_size = size;
+    return (ENOBUFS);
+  }
+
+  memcpy (buffer, nb->buffer, size);
+  *buffer_size = size;
+
+  return (0);
+} /* }}} int lcc_network_buffer_get */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,88 @@
+/**
+ * libcollectdclient - src/libcollectdclient/network_buffer.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_NETWORK_BUFFER_H
+#define LIBCOLLECTDCLIENT_NETWORK_BUFFER_H 1
+
+#include "client.h"
+
+/* Ethernet frame - (IPv6 header + UDP header) */
+#define LCC_NETWORK_BUFFER_SIZE_DEFAULT 1452
+
+LCC_BEGIN_DECLS
+
+enum lcc_security_level_e
+{
+  NONE,
+  SIGN,
+  ENCRYPT
+};
+typedef enum lcc_security_level_e lcc_security_level_t;
+
+struct lcc_network_buffer_s;
+typedef struct lcc_network_buffer_s lcc_network_buffer_t;
+
+/*
+ * A network buffer holds one packet of the binary protocol used by the
+ * network plugin. Value lists are appended with `lcc_network_buffer_add_value'
+ * until it returns ENOMEM; then the packet is completed with
+ * `lcc_network_buffer_finalize', copied out with `lcc_network_buffer_get' and
+ * the buffer is prepared for the next packet with
+ * `lcc_network_buffer_initialize'. Fields which are equal to the previous
+ * value list's are not repeated. A buffer must not be used by more than one
+ * thread at a time.
+ */
+/* Passing zero as `size' selects LCC_NETWORK_BUFFER_SIZE_DEFAULT. */
+lcc_network_buffer_t *lcc_network_buffer_create (size_t size);
+void lcc_network_buffer_destroy (lcc_network_buffer_t *nb);
+
+/* Signing and encryption require libcollectdclient to be built with
+ * libgcrypt; otherwise anything but NONE fails with ENOTSUP. The buffer is
+ * initialized, i.e. value lists which have been added are discarded. */
+int lcc_network_buffer_set_security_level (lcc_network_buffer_t *nb,
+    lcc_security_level_t level,
+    const char *username, const char *password);
+
+/* Writes repeated identifier strings as references to their first
+ * occurrence in the packet, like the network plugin's
+ * "IdentifierDictionary" option. Receivers older than that option can't
+ * parse such packets, so this is disabled by default. */
+int lcc_network_buffer_set_dictionary (lcc_network_buffer_t *nb, int enabled);
+
+int lcc_network_buffer_initialize (lcc_network_buffer_t *nb);
+int lcc_network_buffer_finalize (lcc_network_buffer_t *nb);
+
+/* Returns ENOMEM if the value list does not fit into the packet anymore. The
+ * buffer is left unchanged in that case. */
+int lcc_network_buffer_add_value (lcc_network_buffer_t *nb,
+    const lcc_value_list_t *vl);
+
+/* Returns the number of value lists added since the buffer was
+ * initialized. */
+size_t lcc_network_buffer_values_num (const lcc_network_buffer_t *nb);
+
+/* Copies the finalized packet to `buffer'. `*buffer_size' is set to the size
+ * of the packet. If the packet is larger than `*buffer_size', nothing is
+ * copied and ENOBUFS is returned. */
+int lcc_network_buffer_get (lcc_network_buffer_t *nb,
+    void *buffer, size_t *buffer_size);
+
+LCC_END_DECLS
+
+#endif /* LIBCOLLECTDCLIENT_NETWORK_BUFFER_H */
+/* vim: set sw=2 sts=2 et : */
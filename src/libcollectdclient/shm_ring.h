@@ -0,0 +1,287 @@
+/**
+ * libcollectdclient - src/libcollectdclient/shm_ring.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef LIBCOLLECTDCLIENT_SHM_RING_H
+#define LIBCOLLECTDCLIENT_SHM_RING_H 1
+
+/*
+ * Producer side of the ring buffer created by the `shm' plugin. This header
+ * does not need the library: applications only link against librt, if their
+ * system needs it for `shm_open'.
+ *
+ * The shared memory region consists of a header and a power-of-two number of
+ * slots. Each slot starts with a sequence number, which tells producers and
+ * the daemon whose turn it is: a producer claims the slot at position `pos'
+ * by advancing `head' from `pos' to `pos + 1' when the slot's sequence
+ * number equals `pos', fills it and publishes it by setting the sequence
+ * number to `pos + 1'. The daemon returns the slot by setting it to
+ * `pos + slots_num'. Adding a value therefore takes one compare-and-swap and
+ * no system call, and any number of processes and threads may add values at
+ * the same time.
+ *
+ * If the ring is full, `lcc_shm_ring_put' fails with EAGAIN and the value
+ * is counted as dropped. Producers which retry should sleep first, so that
+ * they don't take the CPU from the daemon. A producer which dies between claiming and
+ * publishing a slot blocks the ring until the daemon restarts.
+ *
+ * The daemon defines LCC_SHM_RING_LAYOUT_ONLY to get the layout without the
+ * producer functions and the library's types.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define LCC_SHM_RING_NAME_DEFAULT "/collectd"
+#define LCC_SHM_RING_MAGIC        0x636f6c52 /* "colR" */
+#define LCC_SHM_RING_VERSION      1
+#define LCC_SHM_RING_NAME_LEN     64
+#define LCC_SHM_RING_VALUES_MAX   16
+
+/* Times are in the daemon's high resolution format: 2^-30 seconds. A time of
+ * zero is replaced by the time the daemon reads the record, an interval of
+ * zero by the daemon's interval. `values' hold the bits of the respective
+ * counter_t, gauge_t, derive_t or absolute_t in host byte order. */
+struct lcc_shm_record_s
+{
+  char host[LCC_SHM_RING_NAME_LEN];
+  char plugin[LCC_SHM_RING_NAME_LEN];
+  char plugin_instance[LCC_SHM_RING_NAME_LEN];
+  char type[LCC_SHM_RING_NAME_LEN];
+  char type_instance[LCC_SHM_RING_NAME_LEN];
+  uint64_t time;
+  uint64_t interval;
+  uint32_t values_len;
+  uint8_t  values_types[LCC_SHM_RING_VALUES_MAX];
+  uint64_t values[LCC_SHM_RING_VALUES_MAX];
+};
+typedef struct lcc_shm_record_s lcc_shm_record_t;
+
+struct lcc_shm_slot_s
+{
+  volatile uint64_t sequence;
+  lcc_shm_record_t record;
+};
+typedef struct lcc_shm_slot_s lcc_shm_slot_t;
+
+/* `head' and `tail' are kept on cache lines of their own, so that producers
+ * and the daemon don't invalidate each other's line on every value. */
+struct lcc_shm_ring_header_s
+{
+  volatile uint32_t magic;
+  uint32_t version;
+  uint32_t slot_size;
+  uint32_t slots_num;
+  char pad0[64 - 4 * sizeof (uint32_t)];
+
+  volatile uint64_t head;
+  char pad1[64 - sizeof (uint64_t)];
+
+  volatile uint64_t tail;
+  volatile uint64_t dropped;
+  char pad2[64 - 2 * sizeof (uint64_t)];
+};
+typedef struct lcc_shm_ring_header_s lcc_shm_ring_header_t;
+
+#define LCC_SHM_RING_SIZE(slots_num) (sizeof (lcc_shm_ring_header_t) \
+    + ((size_t) (slots_num)) * sizeof (lcc_shm_slot_t))
+
+#ifndef LCC_SHM_RING_LAYOUT_ONLY
+
+#include "client.h"
+
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+LCC_BEGIN_DECLS
+
+struct lcc_shm_ring_s
+{
+  lcc_shm_ring_header_t *header;
+  lcc_shm_slot_t *slots;
+  size_t map_size;
+};
+typedef struct lcc_shm_ring_s lcc_shm_ring_t;
+
+/* Maps the ring `name', which has to be created by the daemon first. `name'
+ * may be NULL to use LCC_SHM_RING_NAME_DEFAULT. Returns zero or an errno
+ * value. */
+static inline int lcc_shm_ring_open (lcc_shm_ring_t *ring, /* {{{ */
+    const char *name)
+{
+  struct stat statbuf;
+  lcc_shm_ring_header_t *header;
+  void *map;
+  int fd;
+  int status;
+
+  if (ring == NULL)
+    return (EINVAL);
+  memset (ring, 0, sizeof (*ring));
+
+  if (name == NULL)
+    name = LCC_SHM_RING_NAME_DEFAULT;
+
+  fd = shm_open (name, O_RDWR, /* mode = */ 0);
+  if (fd < 0)
+    return (errno);
+
+  if (fstat (fd, &statbuf) != 0)
+  {
+    status = errno;
+    close (fd);
+    return (status);
+  }
+
+  if ((size_t) statbuf.st_size < sizeof (lcc_shm_ring_header_t))
+  {
+    close (fd);
+    return (EAGAIN);
+  }
+
+  map = mmap (NULL, (size_t) statbuf.st_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED, fd, /* offset = */ 0);
+  status = errno;
+  close (fd);
+  if (map == MAP_FAILED)
+    return (status);
+
+  /* The magic number is written last, when the daemon has set up all
+   * slots. */
+  header = map;
+  status = 0;
+  if (header->magic != LCC_SHM_RING_MAGIC)
+    status = EAGAIN;
+  else if ((header->version != LCC_SHM_RING_VERSION)
+      || (header->slot_size != sizeof (lcc_shm_slot_t))
+      || ((size_t) statbuf.st_size < LCC_SHM_RING_SIZE (header->slots_num)))
+    status = EPROTO;
+
+  if (status != 0)
+  {
+    munmap (map, (size_t) statbuf.st_size);
+    return (status);
+  }
+  __sync_synchronize ();
+
+  ring->header = header;
+  ring->slots = (lcc_shm_slot_t *) (header + 1);
+  ring->map_size = (size_t) statbuf.st_size;
+
+  return (0);
+} /* }}} int lcc_shm_ring_open */
+
+static inline void lcc_shm_ring_close (lcc_shm_ring_t *ring) /* {{{ */
+{
+  if ((ring == NULL) || (ring->header == NULL))
+    return;
+
+  munmap ((void *) ring->header, ring->map_size);
+  memset (ring, 0, sizeof (*ring));
+} /* }}} void lcc_shm_ring_close */
+
+/* Adds one value list. Returns EAGAIN if the ring is full and EPIPE if the
+ * daemon has removed the ring; the application should close and reopen it
+ * in that case. */
+static inline int lcc_shm_ring_put (lcc_shm_ring_t *ring, /* {{{ */
+    const lcc_value_list_t *vl)
+{
+  lcc_shm_ring_header_t *header;
+  lcc_shm_slot_t *slot;
+  uint64_t mask;
+  uint64_t pos;
+  size_t i;
+
+  if ((ring == NULL) || (ring->header == NULL) || (vl == NULL)
+      || (vl->values_len < 1) || (vl->values_len > LCC_SHM_RING_VALUES_MAX))
+    return (EINVAL);
+
+  header = ring->header;
+  if (header->magic != LCC_SHM_RING_MAGIC)
+    return (EPIPE);
+
+  mask = (uint64_t) header->slots_num - 1;
+  pos = header->head;
+  while (42)
+  {
+    uint64_t sequence;
+    int64_t diff;
+
+    slot = ring->slots + (pos & mask);
+    sequence = slot->sequence;
+    __sync_synchronize ();
+
+    diff = (int64_t) (sequence - pos);
+    if (diff == 0)
+    {
+      uint64_t prev = __sync_val_compare_and_swap (&header->head,
+          pos, pos + 1);
+      if (prev == pos)
+        break;
+      pos = prev;
+    }
+    else if (diff < 0)
+    {
+      /* The daemon has not read this slot yet: the ring is full. */
+      __sync_fetch_and_add (&header->dropped, 1);
+      return (EAGAIN);
+    }
+    else
+    {
+      pos = header->head;
+    }
+  }
+
+  /* The identifier fields have the same size in both structures. */
+  memcpy (slot->record.host, vl->identifier.host,
+      sizeof (slot->record.host));
+  memcpy (slot->record.plugin, vl->identifier.plugin,
+      sizeof (slot->record.plugin));
+  memcpy (slot->record.plugin_instance, vl->identifier.plugin_instance,
+      sizeof (slot->record.plugin_instance));
+  memcpy (slot->record.type, vl->identifier.type,
+      sizeof (slot->record.type));
+  memcpy (slot->record.type_instance, vl->identifier.type_instance,
+      sizeof (slot->record.type_instance));
+  slot->record.time = ((uint64_t) vl->time) << 30;
+  slot->record.interval = ((uint64_t) vl->interval) << 30;
+  slot->record.values_len = (uint32_t) vl->values_len;
+  for (i = 0; i < vl->values_len; i++)
+  {
+    slot->record.values_types[i] = (uint8_t) vl->values_types[i];
+    memcpy (slot->record.values + i, vl->values + i, sizeof (uint64_t));
+  }
+
+  /* Publish the record: everything above must be visible to the daemon
+   * before the sequence number is. */
+  __sync_synchronize ();
+  slot->sequence = pos + 1;
+
+  return (0);
+} /* }}} int lcc_shm_ring_put */
+
+LCC_END_DECLS
+
+#endif /* ! LCC_SHM_RING_LAYOUT_ONLY */
+
+#endif /* LIBCOLLECTDCLIENT_SHM_RING_H */
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -5,6 +5,7 @@ struct statement_list_s
 {
 	oconfig_item_t *statement;
 	int             statement_num;
+	int             statement_size; /* # entries allocated */
 };
 typedef struct statement_list_s statement_list_t;
 
@@ -12,6 +13,7 @@ struct argument_list_s
 {
 	oconfig_value_t *argument;
 	int              argument_num;
+	int              argument_size; /* # entries allocated */
 };
 typedef struct argument_list_s argument_list_t;
 
@@ -85,8 +85,12 @@ argument_list:
 	argument_list argument
 	{
 	 $$ = $1;
+	 if ($$.argument_num >= $$.argument_size)
+	 {
+		 $$.argument_size *= 2;
+		 $$.argument = realloc ($$.argument, $$.argument_size * sizeof (oconfig_value_t));
+	 }
 	 $$.argument_num++;
-	 $$.argument = realloc ($$.argument, $$.argument_num * sizeof (oconfig_value_t));
 	 $$.argument[$$.argument_num-1] = $2;
 	}
 	| argument
@@ -94,6 +98,7 @@ argument_list:
 	 $$.argument = malloc (sizeof (oconfig_value_t));
 	 $$.argument[0] = $1;
 	 $$.argument_num = 1;
+	 $$.argument_size = 1;
 	}
 	;
 
@@ -162,8 +167,14 @@ statement_list:
 	 $$ = $1;
 	 if (($2.values_num > 0) || ($2.children_num > 0))
 	 {
+		 /* Doubling the array keeps adding statements linear in
+		  * time, even for files with many thousand of them. */
+		 if ($$.statement_num >= $$.statement_size)
+		 {
+			 $$.statement_size = ($$.statement_size > 0) ? ($$.statement_size * 2) : 4;
+			 $$.statement = realloc ($$.statement, $$.statement_size * sizeof (oconfig_item_t));
+		 }
 		 $$.statement_num++;
-		 $$.statement = realloc ($$.statement, $$.statement_num * sizeof (oconfig_item_t));
 		 $$.statement[$$.statement_num-1] = $2;
 	 }
 	}
@@ -171,14 +182,16 @@ statement_list:
 	{
 	 if (($1.values_num > 0) || ($1.children_num > 0))
 	 {
-		 $$.statement = malloc (sizeof (oconfig_item_t));
+		 $$.statement = malloc (4 * sizeof (oconfig_item_t));
 		 $$.statement[0] = $1;
 		 $$.statement_num = 1;
+		 $$.statement_size = 4;
 	 }
 	 else
 	 {
 	 	$$.statement = NULL;
 		$$.statement_num = 0;
+		$$.statement_size = 0;
 	 }
 	}
 	;
@@ -32,6 +32,23 @@
 #include <libxml/tree.h>
 #include <libxml/xpath.h>
 
+#include <pthread.h>
+
+/* virConnectGetAllDomainStats, which returns the statistics of all domains
+ * in one call, appeared in libvirt 1.2.8, domain events handled by the
+ * default event loop in 0.9.0. */
+#if LIBVIR_VERSION_NUMBER >= 1002008
+# define HAVE_ALL_DOMAIN_STATS 1
+#else
+# define HAVE_ALL_DOMAIN_STATS 0
+#endif
+
+#if LIBVIR_VERSION_NUMBER >= 9000
+# define HAVE_DOMAIN_EVENTS 1
+#else
+# define HAVE_DOMAIN_EVENTS 0
+#endif
+
 static const char *config_keys[] = {
     "Connection",
 
@@ -123,6 +140,23 @@ static enum if_field interface_format = if_name;
 /* Time that we last refreshed. */
 static time_t last_refresh = (time_t) 0;
 
+#if HAVE_ALL_DOMAIN_STATS
+/* Cleared if the hypervisor doesn't support virConnectGetAllDomainStats. */
+static _Bool use_all_domain_stats = 1;
+#endif
+
+#if HAVE_DOMAIN_EVENTS
+/* While domain events are received, the lists are only refreshed after a
+ * domain has been started, stopped or changed, instead of every
+ * RefreshInterval seconds. */
+static pthread_t event_thread;
+static _Bool event_thread_running = 0;
+static int event_lifecycle_id = -1;
+static int event_timeout_id = -1;
+static _Bool refresh_needed = 0;
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 static int refresh_lists (void);
 
 /* ERROR(...) macro for virterrors. */
@@ -235,12 +269,94 @@ submit_derive2 (const char *type, derive_t v0, derive_t v1,
     plugin_dispatch_values (&vl);
 } /* void submit_derive2 */
 
+#if HAVE_DOMAIN_EVENTS
+static int
+lv_domain_event (virConnectPtr __attribute__((unused)) c,
+                 virDomainPtr __attribute__((unused)) dom,
+                 int __attribute__((unused)) event,
+                 int __attribute__((unused)) detail,
+                 void __attribute__((unused)) *opaque)
+{
+    pthread_mutex_lock (&refresh_lock);
+    refresh_needed = 1;
+    pthread_mutex_unlock (&refresh_lock);
+    return 0;
+}
+
+/* Only makes virEventRunDefaultImpl return, so that the thread notices when
+ * it is supposed to exit. */
+static void
+lv_event_timeout (int __attribute__((unused)) timer,
+                  void __attribute__((unused)) *opaque)
+{
+}
+
+static void *
+lv_event_loop (void __attribute__((unused)) *arg)
+{
+    while (event_thread_running) {
+        if (virEventRunDefaultImpl () < 0) {
+            VIRT_ERROR (NULL, "virEventRunDefaultImpl");
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void
+lv_events_register (void)
+{
+    if (!event_thread_running || (event_lifecycle_id >= 0) || (interval <= 0))
+        return;
+
+    event_lifecycle_id = virConnectDomainEventRegisterAny (conn,
+            /* domain = */ NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+            VIR_DOMAIN_EVENT_CALLBACK (lv_domain_event),
+            /* opaque = */ NULL, /* free = */ NULL);
+    if (event_lifecycle_id < 0)
+        INFO ("libvirt plugin: Domain events are not available, refreshing "
+                "the lists every %i seconds.", interval);
+}
+
+static void
+lv_events_deregister (void)
+{
+    if ((conn == NULL) || (event_lifecycle_id < 0))
+        return;
+
+    virConnectDomainEventDeregisterAny (conn, event_lifecycle_id);
+    event_lifecycle_id = -1;
+}
+#endif /* HAVE_DOMAIN_EVENTS */
+
 static int
 lv_init (void)
 {
     if (virInitialize () != 0)
         return -1;
 
+#if HAVE_DOMAIN_EVENTS
+    /* The event loop implementation has to be registered before the
+     * connection is opened. */
+    if (!event_thread_running && (virEventRegisterDefaultImpl () == 0)) {
+        int status;
+
+        event_timeout_id = virEventAddTimeout (1000, lv_event_timeout,
+                /* opaque = */ NULL, /* free = */ NULL);
+        if (event_timeout_id < 0)
+            return 0;
+
+        event_thread_running = 1;
+        status = pthread_create (&event_thread, /* attr = */ NULL,
+                lv_event_loop, /* arg = */ NULL);
+        if (status != 0) {
+            ERROR ("libvirt plugin: pthread_create failed with status %i.",
+                    status);
+            event_thread_running = 0;
+        }
+    }
+#endif
+
 	return 0;
 }
 
@@ -359,6 +475,196 @@ lv_config (const char *key, const char *value)
     return -1;
 }
 
+/* Returns true if the domain and device lists have to be rebuilt. */
+static _Bool
+lv_need_refresh (time_t now)
+{
+    if (last_refresh == (time_t) 0)
+        return 1;
+
+#if HAVE_DOMAIN_EVENTS
+    if (event_lifecycle_id >= 0) {
+        _Bool ret;
+
+        pthread_mutex_lock (&refresh_lock);
+        ret = refresh_needed;
+        refresh_needed = 0;
+        pthread_mutex_unlock (&refresh_lock);
+        return ret;
+    }
+#endif
+
+    return ((interval > 0) && ((last_refresh + interval) <= now));
+}
+
+#if HAVE_ALL_DOMAIN_STATS
+/* Returns the index of `dom' in `domains' or -1 if it is not monitored. */
+static int
+lv_find_domain (virDomainPtr dom)
+{
+    const char *name;
+    int i;
+
+    name = virDomainGetName (dom);
+    if (name == NULL)
+        return -1;
+
+    for (i = 0; i < nr_domains; ++i) {
+        const char *tmp = virDomainGetName (domains[i]);
+        if ((tmp != NULL) && (strcmp (name, tmp) == 0))
+            return i;
+    }
+
+    return -1;
+}
+
+static int
+lv_stats_get (virDomainStatsRecordPtr record, const char *group, int index,
+              const char *field, unsigned long long *ret_value)
+{
+    char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+
+    ssnprintf (name, sizeof (name), "%s.%i.%s", group, index, field);
+    return virTypedParamsGetULLong (record->params, record->nparams,
+            name, ret_value);
+}
+
+/* Submits two values if both are returned by the hypervisor. */
+static void
+lv_stats_submit2 (virDomainStatsRecordPtr record, const char *group,
+                  int index, const char *field0, const char *field1,
+                  const char *type, virDomainPtr dom, const char *devname)
+{
+    unsigned long long v0;
+    unsigned long long v1;
+
+    if ((lv_stats_get (record, group, index, field0, &v0) != 1)
+            || (lv_stats_get (record, group, index, field1, &v1) != 1))
+        return;
+
+    submit_derive2 (type, (derive_t) v0, (derive_t) v1, dom, devname);
+}
+
+static void
+lv_submit_domain_stats (virDomainStatsRecordPtr record, virDomainPtr dom)
+{
+    unsigned long long value;
+    unsigned int count;
+    int i;
+    int j;
+
+    if (virTypedParamsGetULLong (record->params, record->nparams,
+                "cpu.time", &value) == 1)
+        cpu_submit (value, dom, "virt_cpu_total");
+
+    count = 0;
+    virTypedParamsGetUInt (record->params, record->nparams,
+            "vcpu.current", &count);
+    for (i = 0; i < (int) count; ++i)
+        if (lv_stats_get (record, "vcpu", i, "time", &value) == 1)
+            vcpu_submit ((derive_t) value, dom, i, "virt_vcpu");
+
+    /* Only the devices found by `refresh_lists' are submitted, so that the
+     * ignore lists apply. */
+    count = 0;
+    virTypedParamsGetUInt (record->params, record->nparams,
+            "block.count", &count);
+    for (i = 0; i < (int) count; ++i) {
+        char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *path = NULL;
+
+        ssnprintf (name, sizeof (name), "block.%i.name", i);
+        if (virTypedParamsGetString (record->params, record->nparams,
+                    name, &path) != 1)
+            continue;
+
+        for (j = 0; j < nr_block_devices; ++j)
+            if ((block_devices[j].dom == dom)
+                    && (strcmp (block_devices[j].path, path) == 0))
+                break;
+        if (j >= nr_block_devices)
+            continue;
+
+        lv_stats_submit2 (record, "block", i, "rd.reqs", "wr.reqs",
+                "disk_ops", dom, block_devices[j].path);
+        lv_stats_submit2 (record, "block", i, "rd.bytes", "wr.bytes",
+                "disk_octets", dom, block_devices[j].path);
+    }
+
+    count = 0;
+    virTypedParamsGetUInt (record->params, record->nparams,
+            "net.count", &count);
+    for (i = 0; i < (int) count; ++i) {
+        char name[VIR_TYPED_PARAM_FIELD_LENGTH];
+        const char *path = NULL;
+        const char *display_name;
+
+        ssnprintf (name, sizeof (name), "net.%i.name", i);
+        if (virTypedParamsGetString (record->params, record->nparams,
+                    name, &path) != 1)
+            continue;
+
+        for (j = 0; j < nr_interface_devices; ++j)
+            if ((interface_devices[j].dom == dom)
+                    && (strcmp (interface_devices[j].path, path) == 0))
+                break;
+        if (j >= nr_interface_devices)
+            continue;
+
+        display_name = interface_devices[j].path;
+        if (interface_format == if_address)
+            display_name = interface_devices[j].address;
+
+        lv_stats_submit2 (record, "net", i, "rx.bytes", "tx.bytes",
+                "if_octets", dom, display_name);
+        lv_stats_submit2 (record, "net", i, "rx.pkts", "tx.pkts",
+                "if_packets", dom, display_name);
+        lv_stats_submit2 (record, "net", i, "rx.errs", "tx.errs",
+                "if_errors", dom, display_name);
+        lv_stats_submit2 (record, "net", i, "rx.drop", "tx.drop",
+                "if_dropped", dom, display_name);
+    }
+}
+
+/* Fetches the statistics of all running domains with a single call instead
+ * of several calls per domain and device. Returns non-zero if they have to
+ * be read one by one. */
+static int
+lv_read_all_domain_stats (void)
+{
+    virDomainStatsRecordPtr *records = NULL;
+    int records_num;
+    int i;
+
+    records_num = virConnectGetAllDomainStats (conn,
+            VIR_DOMAIN_STATS_CPU_TOTAL | VIR_DOMAIN_STATS_VCPU
+            | VIR_DOMAIN_STATS_INTERFACE | VIR_DOMAIN_STATS_BLOCK,
+            &records, VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+    if (records_num < 0) {
+        virErrorPtr err = virConnGetLastError (conn);
+
+        if ((err != NULL) && (err->code == VIR_ERR_NO_SUPPORT)) {
+            INFO ("libvirt plugin: virConnectGetAllDomainStats is not "
+                    "supported, reading the statistics one by one.");
+            use_all_domain_stats = 0;
+        } else {
+            VIRT_ERROR (conn, "virConnectGetAllDomainStats");
+        }
+        return -1;
+    }
+
+    for (i = 0; i < records_num; ++i) {
+        int index = lv_find_domain (records[i]->dom);
+        if (index < 0)
+            continue;
+        lv_submit_domain_stats (records[i], domains[index]);
+    }
+
+    virDomainStatsRecordListFree (records);
+    return 0;
+}
+#endif /* HAVE_ALL_DOMAIN_STATS */
+
 static int
 lv_read (void)
 {
@@ -378,15 +684,22 @@ lv_read (void)
     c_release (LOG_NOTICE, &conn_complain,
             "libvirt plugin: Connection established.");
 
+#if HAVE_DOMAIN_EVENTS
+    lv_events_register ();
+#endif
+
     time (&t);
 
     /* Need to refresh domain or device lists? */
-    if ((last_refresh == (time_t) 0) ||
-            ((interval > 0) && ((last_refresh + interval) <= t))) {
+    if (lv_need_refresh (t)) {
         if (refresh_lists () != 0) {
+#if HAVE_DOMAIN_EVENTS
+            lv_events_deregister ();
+#endif
             if (conn != NULL)
                 virConnectClose (conn);
             conn = NULL;
+            last_refresh = (time_t) 0;
             return -1;
         }
         last_refresh = t;
@@ -405,6 +718,11 @@ lv_read (void)
                  interface_devices[i].path);
 #endif
 
+#if HAVE_ALL_DOMAIN_STATS
+    if (use_all_domain_stats && (lv_read_all_domain_stats () == 0))
+        return 0;
+#endif
+
     /* Get CPU usage, VCPU usage for each domain. */
     for (i = 0; i < nr_domains; ++i) {
         virDomainInfo info;
@@ -807,10 +1125,24 @@ lv_shutdown (void)
     free_interface_devices ();
     free_domains ();
 
+#if HAVE_DOMAIN_EVENTS
+    lv_events_deregister ();
+#endif
+
     if (conn != NULL)
 	virConnectClose (conn);
     conn = NULL;
 
+#if HAVE_DOMAIN_EVENTS
+    if (event_thread_running) {
+        event_thread_running = 0;
+        pthread_join (event_thread, /* retval = */ NULL);
+    }
+    if (event_timeout_id >= 0)
+        virEventRemoveTimeout (event_timeout_id);
+    event_timeout_id = -1;
+#endif
+
     ignorelist_free (il_domains);
     il_domains = NULL;
     ignorelist_free (il_block_devices);
@@ -827,7 +1159,7 @@ module_register (void)
     plugin_register_config ("libvirt",
 	    lv_config,
 	    config_keys, NR_CONFIG_KEYS);
-    plugin_register_init ("libvirt", lv_init);
+    plugin_register_init_parallel ("libvirt", lv_init);
     plugin_register_read ("libvirt", lv_read);
     plugin_register_shutdown ("libvirt", lv_shutdown);
 }
@@ -29,6 +29,12 @@
 
 #define DEFAULT_LOGFILE LOCALSTATEDIR"/log/collectd.log"
 
+/* Size of one formatted line, including timestamp and severity. */
+#define LOG_LINE_SIZE 1100
+
+/* How often to check whether the log file has been rotated. */
+#define LOG_CHECK_INTERVAL TIME_T_TO_CDTIME_T (1)
+
 #if COLLECT_DEBUG
 static int log_level = LOG_DEBUG;
 #else
@@ -36,17 +42,36 @@ static int log_level = LOG_INFO;
 #endif /* COLLECT_DEBUG */
 
 static pthread_mutex_t file_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *log_fh = NULL;
+static cdtime_t log_checked = 0;
 
 static char *log_file = NULL;
 static int print_timestamp = 1;
 static int print_severity = 0;
 
+/* Messages waiting to be written by the log thread. `ring_read' and
+ * `ring_write' only ever increase; the slot is the index modulo
+ * `ring_size'. The slots between the two indices belong to the log thread. */
+typedef char log_line_t[LOG_LINE_SIZE];
+
+static size_t ring_size = 0;
+static log_line_t *ring = NULL;
+static size_t ring_read = 0;
+static size_t ring_write = 0;
+static uint64_t ring_dropped = 0;
+static int ring_loop = 0;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t ring_thread;
+static int ring_thread_running = 0;
+
 static const char *config_keys[] =
 {
 	"LogLevel",
 	"File",
 	"Timestamp",
-	"PrintSeverity"
+	"PrintSeverity",
+	"BufferSize"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -72,8 +97,17 @@ static int logfile_config (const char *key, const char *value)
 			return 1;
 	}
 	else if (0 == strcasecmp (key, "File")) {
+		pthread_mutex_lock (&file_lock);
 		sfree (log_file);
 		log_file = strdup (value);
+		/* Messages may have been logged to the default file already. */
+		if (log_fh != NULL)
+		{
+			fclose (log_fh);
+			log_fh = NULL;
+		}
+		log_checked = 0;
+		pthread_mutex_unlock (&file_lock);
 	}
 	else if (0 == strcasecmp (key, "Timestamp")) {
 		if (IS_FALSE (value))
@@ -86,17 +120,21 @@ static int logfile_config (const char *key, const char *value)
 		else
 			print_severity = 1;
 	}
+	else if (0 == strcasecmp (key, "BufferSize")) {
+		int tmp = atoi (value);
+		if (tmp < 0)
+			return 1;
+		ring_size = (size_t) tmp;
+	}
 	else {
 		return -1;
 	}
 	return 0;
 } /* int logfile_config (const char *, const char *) */
 
-static void logfile_print (const char *msg, int severity,
-	   	cdtime_t timestamp_time)
+static void logfile_format (char *buffer, size_t buffer_size, /* {{{ */
+		const char *msg, int severity, cdtime_t timestamp_time)
 {
-	FILE *fh;
-	int do_close = 0;
 	struct tm timestamp_tm;
 	char timestamp_str[64];
 	char level_str[16] = "";
@@ -133,46 +171,169 @@ static void logfile_print (const char *msg, int severity,
 		strftime (timestamp_str, sizeof (timestamp_str), "%Y-%m-%d %H:%M:%S",
 				&timestamp_tm);
 		timestamp_str[sizeof (timestamp_str) - 1] = '\0';
+
+		ssnprintf (buffer, buffer_size, "[%s] %s%s\n",
+				timestamp_str, level_str, msg);
+	}
+	else
+	{
+		ssnprintf (buffer, buffer_size, "%s%s\n", level_str, msg);
+	}
+} /* }}} void logfile_format */
+
+/* Returns the file to log to, opening it if necessary. Once a second, the
+ * file is reopened if it has been moved or removed, e.g. by logrotate. You
+ * must hold `file_lock' when calling this function. */
+static FILE *logfile_get_fh (void) /* {{{ */
+{
+	const char *path = (log_file == NULL) ? DEFAULT_LOGFILE : log_file;
+	cdtime_t now;
+
+	if (strcasecmp (path, "stderr") == 0)
+		return (stderr);
+	else if (strcasecmp (path, "stdout") == 0)
+		return (stdout);
+
+	now = cdtime ();
+	if ((log_checked != 0) && ((now - log_checked) < LOG_CHECK_INTERVAL))
+		return (log_fh);
+	log_checked = now;
+
+	if (log_fh != NULL)
+	{
+		struct stat path_stat;
+		struct stat fh_stat;
+
+		if ((stat (path, &path_stat) == 0)
+				&& (fstat (fileno (log_fh), &fh_stat) == 0)
+				&& (path_stat.st_dev == fh_stat.st_dev)
+				&& (path_stat.st_ino == fh_stat.st_ino))
+			return (log_fh);
+
+		fclose (log_fh);
+		log_fh = NULL;
+	}
+
+	log_fh = fopen (path, "a");
+	if (log_fh == NULL)
+	{
+		char errbuf[1024];
+		fprintf (stderr, "logfile plugin: fopen (%s) failed: %s\n",
+				path, sstrerror (errno, errbuf, sizeof (errbuf)));
 	}
 
+	return (log_fh);
+} /* }}} FILE *logfile_get_fh */
+
+static void logfile_write (const char *line) /* {{{ */
+{
+	FILE *fh;
+
 	pthread_mutex_lock (&file_lock);
 
-	if (log_file == NULL)
+	fh = logfile_get_fh ();
+	if (fh != NULL)
 	{
-		fh = fopen (DEFAULT_LOGFILE, "a");
-		do_close = 1;
+		fputs (line, fh);
+		fflush (fh);
 	}
-	else if (strcasecmp (log_file, "stderr") == 0)
-		fh = stderr;
-	else if (strcasecmp (log_file, "stdout") == 0)
-		fh = stdout;
-	else
+
+	pthread_mutex_unlock (&file_lock);
+} /* }}} void logfile_write */
+
+/* Hands `line' to the log thread. Returns non-zero if the log thread is not
+ * running, in which case the caller has to write the line itself. */
+static int logfile_enqueue (const char *line) /* {{{ */
+{
+	pthread_mutex_lock (&ring_lock);
+
+	if (!ring_loop)
 	{
-		fh = fopen (log_file, "a");
-		do_close = 1;
+		pthread_mutex_unlock (&ring_lock);
+		return (-1);
 	}
 
-	if (fh == NULL)
+	if ((ring_write - ring_read) >= ring_size)
 	{
-			char errbuf[1024];
-			fprintf (stderr, "logfile plugin: fopen (%s) failed: %s\n",
-					(log_file == NULL) ? DEFAULT_LOGFILE : log_file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
+		ring_dropped++;
+		pthread_mutex_unlock (&ring_lock);
+		return (0);
 	}
-	else
+
+	sstrncpy (ring[ring_write % ring_size], line, sizeof (ring[0]));
+	ring_write++;
+
+	pthread_cond_signal (&ring_cond);
+	pthread_mutex_unlock (&ring_lock);
+
+	return (0);
+} /* }}} int logfile_enqueue */
+
+static void *logfile_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	pthread_mutex_lock (&ring_lock);
+	while (42)
 	{
-		if (print_timestamp)
-			fprintf (fh, "[%s] %s%s\n", timestamp_str, level_str, msg);
-		else
-			fprintf (fh, "%s%s\n", level_str, msg);
+		size_t read_idx;
+		size_t write_idx;
+		uint64_t dropped;
+		FILE *fh;
+
+		while (ring_loop && (ring_read == ring_write))
+			pthread_cond_wait (&ring_cond, &ring_lock);
+
+		if (ring_read == ring_write) /* && !ring_loop */
+			break;
+
+		read_idx = ring_read;
+		write_idx = ring_write;
+		dropped = ring_dropped;
+		ring_dropped = 0;
+		pthread_mutex_unlock (&ring_lock);
+
+		pthread_mutex_lock (&file_lock);
+		fh = logfile_get_fh ();
+		if (fh != NULL)
+		{
+			size_t i;
+
+			for (i = read_idx; i != write_idx; i++)
+				fputs (ring[i % ring_size], fh);
+
+			if (dropped > 0)
+			{
+				char msg[128];
+				log_line_t line;
 
-		if (do_close != 0)
-			fclose (fh);
+				ssnprintf (msg, sizeof (msg), "logfile plugin: Dropped "
+						"%"PRIu64" messages because the buffer was full.",
+						dropped);
+				logfile_format (line, sizeof (line), msg, LOG_WARNING,
+						cdtime ());
+				fputs (line, fh);
+			}
+
+			fflush (fh);
+		}
+		pthread_mutex_unlock (&file_lock);
+
+		pthread_mutex_lock (&ring_lock);
+		ring_read = write_idx;
 	}
+	pthread_mutex_unlock (&ring_lock);
 
-	pthread_mutex_unlock (&file_lock);
+	return ((void *) 0);
+} /* }}} void *logfile_thread */
+
+static void logfile_print (const char *msg, int severity,
+	   	cdtime_t timestamp_time)
+{
+	log_line_t line;
 
-	return;
+	logfile_format (line, sizeof (line), msg, severity, timestamp_time);
+
+	if (logfile_enqueue (line) != 0)
+		logfile_write (line);
 } /* void logfile_print */
 
 static void logfile_log (int severity, const char *msg,
@@ -225,10 +386,67 @@ static int logfile_notification (const notification_t *n,
 	return (0);
 } /* int logfile_notification */
 
+static int logfile_init (void)
+{
+	int status;
+
+	if ((ring_size == 0) || ring_thread_running)
+		return (0);
+
+	ring = calloc (ring_size, sizeof (*ring));
+	if (ring == NULL)
+	{
+		ERROR ("logfile plugin: calloc failed.");
+		return (-1);
+	}
+
+	pthread_mutex_lock (&ring_lock);
+	ring_loop = 1;
+	pthread_mutex_unlock (&ring_lock);
+
+	status = pthread_create (&ring_thread, /* attr = */ NULL,
+			logfile_thread, /* arg = */ NULL);
+	if (status != 0)
+	{
+		pthread_mutex_lock (&ring_lock);
+		ring_loop = 0;
+		pthread_mutex_unlock (&ring_lock);
+		sfree (ring);
+
+		ERROR ("logfile plugin: pthread_create failed with status %i.",
+				status);
+		return (-1);
+	}
+	ring_thread_running = 1;
+
+	return (0);
+} /* int logfile_init */
+
+static int logfile_shutdown (void)
+{
+	if (ring_thread_running)
+	{
+		/* The thread writes all remaining messages before it exits.
+		 * Messages logged after this are written directly. */
+		pthread_mutex_lock (&ring_lock);
+		ring_loop = 0;
+		pthread_cond_signal (&ring_cond);
+		pthread_mutex_unlock (&ring_lock);
+
+		pthread_join (ring_thread, /* retval = */ NULL);
+		ring_thread_running = 0;
+		sfree (ring);
+	}
+
+	return (0);
+} /* int logfile_shutdown */
+
 void module_register (void)
 {
 	plugin_register_config ("logfile", logfile_config,
 			config_keys, config_keys_num);
+	plugin_register_init ("logfile", logfile_init);
+	plugin_register_shutdown ("logfile", logfile_shutdown);
 	plugin_register_log ("logfile", logfile_log, /* user_data = */ NULL);
 	plugin_register_notification ("logfile", logfile_notification,
 			/* user_data = */ NULL);
@@ -27,10 +27,13 @@
  */
 
 #include "collectd.h"
+#include "common.h"
 #include "filter_chain.h"
+#include "utils_avltree.h"
 
 #include <sys/types.h>
 #include <regex.h>
+#include <pthread.h>
 
 #define log_err(...) ERROR ("`regex' match: " __VA_ARGS__)
 #define log_warn(...) WARNING ("`regex' match: " __VA_ARGS__)
@@ -59,8 +62,19 @@ struct mr_match_s
 	mr_regex_t *type;
 	mr_regex_t *type_instance;
 	_Bool invert;
+
+	/* Maps identifiers to the result of the match, so the regular
+	 * expressions are only evaluated once for each identifier. Holds at
+	 * most `cache_size' entries; NULL if caching is disabled. */
+	c_avl_tree_t *cache;
+	int cache_size;
+	pthread_mutex_t cache_lock;
 };
 
+/* The cache's values point to one of these. */
+static int mr_result_matches = FC_MATCH_MATCHES;
+static int mr_result_no_match = FC_MATCH_NO_MATCH;
+
 /*
  * internal helper functions
  */
@@ -77,11 +91,27 @@ static void mr_free_regex (mr_regex_t *r) /* {{{ */
 		mr_free_regex (r->next);
 } /* }}} void mr_free_regex */
 
+static void mr_cache_clear (mr_match_t *m) /* {{{ */
+{
+	void *key;
+	void *value;
+
+	while (c_avl_pick (m->cache, &key, &value) == 0)
+		free (key);
+} /* }}} void mr_cache_clear */
+
 static void mr_free_match (mr_match_t *m) /* {{{ */
 {
 	if (m == NULL)
 		return;
 
+	if (m->cache != NULL)
+	{
+		mr_cache_clear (m);
+		c_avl_destroy (m->cache);
+		pthread_mutex_destroy (&m->cache_lock);
+	}
+
 	mr_free_regex (m->host);
 	mr_free_regex (m->plugin);
 	mr_free_regex (m->plugin_instance);
@@ -123,6 +153,31 @@ static int mr_match_regexen (mr_regex_t *re_head, /* {{{ */
 	return (FC_MATCH_MATCHES);
 } /* }}} int mr_match_regexen */
 
+/* If one of the regular expressions only matches one fixed string, i.e. it
+ * looks like "^string$" without any special characters, copies that string
+ * to "buffer". */
+static void mr_regexen_literal (const mr_regex_t *re_head, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	const mr_regex_t *re;
+
+	for (re = re_head; re != NULL; re = re->next)
+	{
+		size_t len = strlen (re->re_str);
+
+		if ((len < 3) || (len - 2 >= buffer_size)
+				|| (re->re_str[0] != '^') || (re->re_str[len - 1] != '$'))
+			continue;
+
+		if (strcspn (re->re_str + 1, "\\.[]()*+?{}|^$") != len - 2)
+			continue;
+
+		memcpy (buffer, re->re_str + 1, len - 2);
+		buffer[len - 2] = 0;
+		return;
+	}
+} /* }}} void mr_regexen_literal */
+
 static int mr_config_add_regex (mr_regex_t **re_head, /* {{{ */
 		oconfig_item_t *ci)
 {
@@ -217,6 +272,8 @@ static int mr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 			status = mr_config_add_regex (&m->type_instance, child);
 		else if (strcasecmp ("Invert", child->key) == 0)
 			status = cf_util_get_boolean(child, &m->invert);
+		else if (strcasecmp ("CacheSize", child->key) == 0)
+			status = cf_util_get_int (child, &m->cache_size);
 		else
 		{
 			log_err ("The `%s' configuration option is not understood and "
@@ -245,6 +302,18 @@ static int mr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 		break;
 	}
 
+	if ((status == 0) && (m->cache_size > 0))
+	{
+		m->cache = c_avl_create ((void *) strcmp);
+		if (m->cache == NULL)
+		{
+			log_err ("mr_create: c_avl_create failed.");
+			status = -1;
+		}
+		else
+			pthread_mutex_init (&m->cache_lock, /* attr = */ NULL);
+	}
+
 	if (status != 0)
 	{
 		mr_free_match (m);
@@ -262,20 +331,12 @@ static int mr_destroy (void **user_data) /* {{{ */
 	return (0);
 } /* }}} int mr_destroy */
 
-static int mr_match (const data_set_t __attribute__((unused)) *ds, /* {{{ */
-		const value_list_t *vl,
-		notification_meta_t __attribute__((unused)) **meta,
-		void **user_data)
+static int mr_match_uncached (const mr_match_t *m, /* {{{ */
+		const value_list_t *vl)
 {
-	mr_match_t *m;
 	int match_value = FC_MATCH_MATCHES;
 	int nomatch_value = FC_MATCH_NO_MATCH;
 
-	if ((user_data == NULL) || (*user_data == NULL))
-		return (-1);
-
-	m = *user_data;
-
 	if (m->invert)
 	{
 		match_value = FC_MATCH_NO_MATCH;
@@ -296,8 +357,78 @@ static int mr_match (const data_set_t __attribute__((unused)) *ds, /* {{{ */
 		return (nomatch_value);
 
 	return (match_value);
+} /* }}} int mr_match_uncached */
+
+static int mr_match (const data_set_t __attribute__((unused)) *ds, /* {{{ */
+		const value_list_t *vl,
+		notification_meta_t __attribute__((unused)) **meta,
+		void **user_data)
+{
+	mr_match_t *m;
+	char key[6 * DATA_MAX_NAME_LEN];
+	int *cached = NULL;
+	char *key_copy;
+	int status;
+
+	if ((user_data == NULL) || (*user_data == NULL))
+		return (-1);
+
+	m = *user_data;
+
+	if (m->cache == NULL)
+		return (mr_match_uncached (m, vl));
+
+	/* The slash is not allowed in any of the fields. */
+	ssnprintf (key, sizeof (key), "%s/%s/%s/%s/%s",
+			vl->host, vl->plugin, vl->plugin_instance,
+			vl->type, vl->type_instance);
+
+	pthread_mutex_lock (&m->cache_lock);
+	status = c_avl_get (m->cache, key, (void *) &cached);
+	pthread_mutex_unlock (&m->cache_lock);
+	if (status == 0)
+		return (*cached);
+
+	status = mr_match_uncached (m, vl);
+
+	key_copy = strdup (key);
+	if (key_copy == NULL)
+		return (status);
+
+	pthread_mutex_lock (&m->cache_lock);
+	/* Start over instead of growing without bounds. */
+	if (c_avl_size (m->cache) >= m->cache_size)
+		mr_cache_clear (m);
+	if (c_avl_insert (m->cache, key_copy,
+				(status == FC_MATCH_MATCHES)
+				? &mr_result_matches : &mr_result_no_match) != 0)
+		free (key_copy);
+	pthread_mutex_unlock (&m->cache_lock);
+
+	return (status);
 } /* }}} int mr_match */
 
+static int mr_literals (void **user_data, /* {{{ */
+		char *plugin, size_t plugin_size,
+		char *type, size_t type_size)
+{
+	mr_match_t *m;
+
+	if ((user_data == NULL) || (*user_data == NULL))
+		return (-1);
+
+	m = *user_data;
+
+	/* An inverted match may match any plugin and type. */
+	if (m->invert)
+		return (0);
+
+	mr_regexen_literal (m->plugin, plugin, plugin_size);
+	mr_regexen_literal (m->type, type, type_size);
+
+	return (0);
+} /* }}} int mr_literals */
+
 void module_register (void)
 {
 	match_proc_t mproc;
@@ -306,6 +437,7 @@ void module_register (void)
 	mproc.create  = mr_create;
 	mproc.destroy = mr_destroy;
 	mproc.match   = mr_match;
+	mproc.literals = mr_literals;
 	fc_register_match ("regex", mproc);
 } /* module_register */
 
@@ -270,7 +270,7 @@ static int mv_match (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     notification_meta_t __attribute__((unused)) **meta, void **user_data)
 {
   mv_match_t *m;
-  gauge_t *values;
+  gauge_t values[ds->ds_num];
   int status;
   int i;
 
@@ -279,8 +279,7 @@ static int mv_match (const data_set_t *ds, const value_list_t *vl, /* {{{ */
 
   m = *user_data;
 
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
+  if (uc_get_rate_buffer (ds, vl, values) != 0)
   {
     ERROR ("`value' match: Retrieving the current rate from the cache "
         "failed.");
@@ -339,7 +338,6 @@ static int mv_match (const data_set_t *ds, const value_list_t *vl, /* {{{ */
     }
   } /* for (i = 0; i < ds->ds_num; i++) */
 
-  free (values);
   return (status);
 } /* }}} int mv_match */
 
@@ -56,18 +56,36 @@ struct web_page_s /* {{{ */
   char *server;
   char *key;
 
-  memcached_st *memc;
-  char *buffer;
+  /* Set once the page has been received in the current read. */
+  _Bool received;
 
   web_match_t *matches;
 
   web_page_t *next;
 }; /* }}} */
 
+/* All pages of one server are fetched with a single request. */
+struct cmc_server_s;
+typedef struct cmc_server_s cmc_server_t;
+struct cmc_server_s /* {{{ */
+{
+  char *server;
+  memcached_st *memc;
+
+  web_page_t **pages;
+  const char **keys;
+  size_t *keys_length;
+  size_t pages_num;
+
+  cmc_server_t *next;
+}; /* }}} */
+
 /*
  * Global variables;
  */
 static web_page_t *pages_g = NULL;
+static cmc_server_t *servers_g = NULL;
+static _Bool binary_protocol_g = 0;
 
 /*
  * Private functions
@@ -90,37 +108,129 @@ static void cmc_web_page_free (web_page_t *wp) /* {{{ */
   if (wp == NULL)
     return;
 
-  if (wp->memc != NULL)
-    memcached_free(wp->memc);
-  wp->memc = NULL;
-
   sfree (wp->instance);
   sfree (wp->server);
   sfree (wp->key);
-  sfree (wp->buffer);
 
   cmc_web_match_free (wp->matches);
   cmc_web_page_free (wp->next);
   sfree (wp);
 } /* }}} void cmc_web_page_free */
 
-static int cmc_page_init_memc (web_page_t *wp) /* {{{ */
+static void cmc_server_free (cmc_server_t *srv) /* {{{ */
+{
+  if (srv == NULL)
+    return;
+
+  if (srv->memc != NULL)
+    memcached_free (srv->memc);
+  srv->memc = NULL;
+
+  sfree (srv->server);
+  sfree (srv->pages);
+  sfree (srv->keys);
+  sfree (srv->keys_length);
+
+  cmc_server_free (srv->next);
+  sfree (srv);
+} /* }}} void cmc_server_free */
+
+static int cmc_server_init_memc (cmc_server_t *srv) /* {{{ */
 {
   memcached_server_st *server;
+  memcached_return rc;
 
-  wp->memc = memcached_create(NULL);
-  if (wp->memc == NULL)
+  srv->memc = memcached_create(NULL);
+  if (srv->memc == NULL)
   {
     ERROR ("memcachec plugin: memcached_create failed.");
     return (-1);
   }
 
-  server = memcached_servers_parse (wp->server);
-  memcached_server_push (wp->memc, server);
+  if (binary_protocol_g)
+  {
+    rc = memcached_behavior_set (srv->memc,
+        MEMCACHED_BEHAVIOR_BINARY_PROTOCOL, 1);
+    if (rc != MEMCACHED_SUCCESS)
+      WARNING ("memcachec plugin: Enabling the binary protocol for `%s' "
+          "failed: %s", srv->server, memcached_strerror (srv->memc, rc));
+  }
+
+  server = memcached_servers_parse (srv->server);
+  memcached_server_push (srv->memc, server);
   memcached_server_list_free (server);
 
   return (0);
-} /* }}} int cmc_page_init_memc */
+} /* }}} int cmc_server_init_memc */
+
+/* Adds the page to the server it is read from, creating the server if
+ * necessary. */
+static int cmc_server_add_page (web_page_t *wp) /* {{{ */
+{
+  cmc_server_t *srv;
+  web_page_t **pages;
+  const char **keys;
+  size_t *keys_length;
+
+  for (srv = servers_g; srv != NULL; srv = srv->next)
+    if (strcmp (srv->server, wp->server) == 0)
+      break;
+
+  if (srv == NULL)
+  {
+    srv = (cmc_server_t *) malloc (sizeof (*srv));
+    if (srv == NULL)
+    {
+      ERROR ("memcachec plugin: malloc failed.");
+      return (-1);
+    }
+    memset (srv, 0, sizeof (*srv));
+
+    srv->server = strdup (wp->server);
+    if ((srv->server == NULL) || (cmc_server_init_memc (srv) != 0))
+    {
+      ERROR ("memcachec plugin: Initializing the server `%s' failed.",
+          wp->server);
+      cmc_server_free (srv);
+      return (-1);
+    }
+
+    srv->next = servers_g;
+    servers_g = srv;
+  }
+
+  pages = realloc (srv->pages, (srv->pages_num + 1) * sizeof (*pages));
+  if (pages == NULL)
+  {
+    ERROR ("memcachec plugin: realloc failed.");
+    return (-1);
+  }
+  srv->pages = pages;
+
+  keys = realloc (srv->keys, (srv->pages_num + 1) * sizeof (*keys));
+  if (keys == NULL)
+  {
+    ERROR ("memcachec plugin: realloc failed.");
+    return (-1);
+  }
+  srv->keys = keys;
+
+  keys_length = realloc (srv->keys_length,
+      (srv->pages_num + 1) * sizeof (*keys_length));
+  if (keys_length == NULL)
+  {
+    ERROR ("memcachec plugin: realloc failed.");
+    return (-1);
+  }
+  srv->keys_length = keys_length;
+
+  srv->pages[srv->pages_num] = wp;
+  srv->keys[srv->pages_num] = wp->key;
+  srv->keys_length[srv->pages_num] = strlen (wp->key);
+  srv->pages_num++;
+
+  return (0);
+} /* }}} int cmc_server_add_page */
 
 static int cmc_config_add_string (const char *name, char **dest, /* {{{ */
     oconfig_item_t *ci)
@@ -328,7 +438,7 @@ static int cmc_config_add_page (oconfig_item_t *ci) /* {{{ */
 
     if (strcasecmp ("Server", child->key) == 0)
       status = cmc_config_add_string ("Server", &page->server, child);
-    if (strcasecmp ("Key", child->key) == 0)
+    else if (strcasecmp ("Key", child->key) == 0)
       status = cmc_config_add_string ("Key", &page->key, child);
     else if (strcasecmp ("Match", child->key) == 0)
       /* Be liberal with failing matches => don't set `status'. */
@@ -366,9 +476,6 @@ static int cmc_config_add_page (oconfig_item_t *ci) /* {{{ */
       status = -1;
     }
 
-    if (status == 0)
-      status = cmc_page_init_memc (page);
-
     break;
   } /* while (status == 0) */
 
@@ -416,6 +523,12 @@ static int cmc_config (oconfig_item_t *ci) /* {{{ */
       else
         errors++;
     }
+    else if (strcasecmp ("BinaryProtocol", child->key) == 0)
+    {
+      status = cf_util_get_boolean (child, &binary_protocol_g);
+      if (status != 0)
+        errors++;
+    }
     else
     {
       WARNING ("memcachec plugin: Option `%s' not allowed here.", child->key);
@@ -434,11 +547,27 @@ static int cmc_config (oconfig_item_t *ci) /* {{{ */
 
 static int cmc_init (void) /* {{{ */
 {
+  web_page_t *wp;
+
   if (pages_g == NULL)
   {
     INFO ("memcachec plugin: No pages have been defined.");
     return (-1);
   }
+
+  /* The servers are set up here, after the `BinaryProtocol' option has been
+   * read. The connections are kept open between reads. */
+  if (servers_g == NULL)
+  {
+    for (wp = pages_g; wp != NULL; wp = wp->next)
+      if (cmc_server_add_page (wp) != 0)
+        WARNING ("memcachec plugin: Page `%s' will not be read.",
+            wp->instance);
+  }
+
+  if (servers_g == NULL)
+    return (-1);
+
   return (0);
 } /* }}} int cmc_init */
 
@@ -461,31 +590,16 @@ static void cmc_submit (const web_page_t *wp, const web_match_t *wm, /* {{{ */
   plugin_dispatch_values (&vl);
 } /* }}} void cmc_submit */
 
-static int cmc_read_page (web_page_t *wp) /* {{{ */
+static void cmc_read_page (web_page_t *wp, const char *buffer) /* {{{ */
 {
   web_match_t *wm;
-  memcached_return rc;
-  size_t string_length;
-  uint32_t flags;
   int status;
 
-  if (wp->memc == NULL)
-    return (-1);
-
-  wp->buffer = memcached_get (wp->memc, wp->key, strlen (wp->key),
-                              &string_length, &flags, &rc);
-  if (rc != MEMCACHED_SUCCESS)
-  {
-    ERROR ("memcachec plugin: memcached_get failed: %s",
-        memcached_strerror (wp->memc, rc));
-    return (-1);
-  }
-
   for (wm = wp->matches; wm != NULL; wm = wm->next)
   {
     cu_match_value_t *mv;
 
-    status = match_apply (wm->match, wp->buffer);
+    status = match_apply (wm->match, buffer);
     if (status != 0)
     {
       WARNING ("memcachec plugin: match_apply failed.");
@@ -501,24 +615,87 @@ static int cmc_read_page (web_page_t *wp) /* {{{ */
 
     cmc_submit (wp, wm, mv);
   } /* for (wm = wp->matches; wm != NULL; wm = wm->next) */
+} /* }}} void cmc_read_page */
 
-  sfree (wp->buffer);
+/* Requests all keys of the server at once and hands each returned value to
+ * the pages with that key. */
+static int cmc_read_server (cmc_server_t *srv) /* {{{ */
+{
+  memcached_return rc;
+  size_t i;
+
+  for (i = 0; i < srv->pages_num; i++)
+    srv->pages[i]->received = 0;
+
+  rc = memcached_mget (srv->memc, srv->keys, srv->keys_length,
+      srv->pages_num);
+  if (rc != MEMCACHED_SUCCESS)
+  {
+    ERROR ("memcachec plugin: memcached_mget (%s) failed: %s",
+        srv->server, memcached_strerror (srv->memc, rc));
+    return (-1);
+  }
+
+  while (42)
+  {
+    char key[MEMCACHED_MAX_KEY];
+    size_t key_length = 0;
+    size_t value_length = 0;
+    uint32_t flags = 0;
+    char *value;
+
+    value = memcached_fetch (srv->memc, key, &key_length,
+        &value_length, &flags, &rc);
+    if (rc == MEMCACHED_END)
+      break;
+    else if (rc != MEMCACHED_SUCCESS)
+    {
+      ERROR ("memcachec plugin: memcached_fetch (%s) failed: %s",
+          srv->server, memcached_strerror (srv->memc, rc));
+      sfree (value);
+      break;
+    }
+
+    /* Several pages may use the same key. */
+    for (i = 0; i < srv->pages_num; i++)
+    {
+      web_page_t *wp = srv->pages[i];
+
+      if (wp->received || (srv->keys_length[i] != key_length)
+          || (memcmp (srv->keys[i], key, key_length) != 0))
+        continue;
+
+      wp->received = 1;
+      cmc_read_page (wp, (value != NULL) ? value : "");
+    }
+
+    sfree (value);
+  } /* while (42) */
+
+  for (i = 0; i < srv->pages_num; i++)
+    if (!srv->pages[i]->received)
+      ERROR ("memcachec plugin: Key `%s' of page `%s' has not been "
+          "returned by `%s'.", srv->pages[i]->key,
+          srv->pages[i]->instance, srv->server);
 
   return (0);
-} /* }}} int cmc_read_page */
+} /* }}} int cmc_read_server */
 
 static int cmc_read (void) /* {{{ */
 {
-  web_page_t *wp;
+  cmc_server_t *srv;
 
-  for (wp = pages_g; wp != NULL; wp = wp->next)
-    cmc_read_page (wp);
+  for (srv = servers_g; srv != NULL; srv = srv->next)
+    cmc_read_server (srv);
 
   return (0);
 } /* }}} int cmc_read */
 
 static int cmc_shutdown (void) /* {{{ */
 {
+  cmc_server_free (servers_g);
+  servers_g = NULL;
+
   cmc_web_page_free (pages_g);
   pages_g = NULL;
 
@@ -46,318 +46,433 @@
 #define MEMCACHED_DEF_HOST "127.0.0.1"
 #define MEMCACHED_DEF_PORT "11211"
 
-#define MEMCACHED_RETRY_COUNT 100
+/* Large enough for the "stats" output of current versions, which is about
+ * 2 kByte. */
+#define MEMCACHED_BUFFER_SIZE 8192
 
-static const char *config_keys[] =
+struct memcached_s
 {
-	"Socket",
-	"Host",
-	"Port"
+	char *name;
+	char *socket;
+	char *host;
+	char *port;
+
+	/* The connection is kept open between reads, -1 if there is none. */
+	int fd;
+};
+typedef struct memcached_s memcached_t;
+
+/* The statistics which are not dispatched as they are read, but combined
+ * with others after all of them have been read. */
+enum memcached_field_e
+{
+	MEMCACHED_FIELD_BYTES,
+	MEMCACHED_FIELD_BYTES_READ,
+	MEMCACHED_FIELD_BYTES_WRITTEN,
+	MEMCACHED_FIELD_CURR_CONNECTIONS,
+	MEMCACHED_FIELD_CURR_ITEMS,
+	MEMCACHED_FIELD_EVICTIONS,
+	MEMCACHED_FIELD_GET_HITS,
+	MEMCACHED_FIELD_GET_MISSES,
+	MEMCACHED_FIELD_LIMIT_MAXBYTES,
+	MEMCACHED_FIELD_RUSAGE_SYSTEM,
+	MEMCACHED_FIELD_RUSAGE_USER,
+	MEMCACHED_FIELD_THREADS,
+	MEMCACHED_FIELDS_NUM
+};
+
+struct memcached_field_s
+{
+	const char *name;
+	enum memcached_field_e field;
+};
+typedef struct memcached_field_s memcached_field_t;
+
+/* Sorted by name, for `bsearch'. For an explanation on these fields please
+ * refer to
+ * <http://code.sixapart.com/svn/memcached/trunk/server/doc/protocol.txt> */
+static const memcached_field_t memcached_fields[] =
+{
+	{ "bytes",            MEMCACHED_FIELD_BYTES },
+	{ "bytes_read",       MEMCACHED_FIELD_BYTES_READ },
+	{ "bytes_written",    MEMCACHED_FIELD_BYTES_WRITTEN },
+	{ "curr_connections", MEMCACHED_FIELD_CURR_CONNECTIONS },
+	{ "curr_items",       MEMCACHED_FIELD_CURR_ITEMS },
+	{ "evictions",        MEMCACHED_FIELD_EVICTIONS },
+	{ "get_hits",         MEMCACHED_FIELD_GET_HITS },
+	{ "get_misses",       MEMCACHED_FIELD_GET_MISSES },
+	{ "limit_maxbytes",   MEMCACHED_FIELD_LIMIT_MAXBYTES },
+	{ "rusage_system",    MEMCACHED_FIELD_RUSAGE_SYSTEM },
+	{ "rusage_user",      MEMCACHED_FIELD_RUSAGE_USER },
+	{ "threads",          MEMCACHED_FIELD_THREADS }
 };
-static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
-static char *memcached_socket = NULL;
-static char *memcached_host = NULL;
-static char memcached_port[16];
+/* The instance configured by the `Socket', `Host' and `Port' options outside
+ * of an `Instance' block. */
+static memcached_t *memcached_legacy = NULL;
+static _Bool memcached_have_instances = 0;
+
+static int memcached_read (user_data_t *ud);
 
-static int memcached_query_daemon (char *buffer, int buffer_size) /* {{{ */
+static void memcached_free (void *arg) /* {{{ */
 {
+	memcached_t *st = arg;
+
+	if (st == NULL)
+		return;
+
+	if (st->fd >= 0)
+	{
+		shutdown (st->fd, SHUT_RDWR);
+		close (st->fd);
+	}
+
+	sfree (st->name);
+	sfree (st->socket);
+	sfree (st->host);
+	sfree (st->port);
+	sfree (st);
+} /* }}} void memcached_free */
+
+static void memcached_disconnect (memcached_t *st) /* {{{ */
+{
+	if (st->fd < 0)
+		return;
+
+	shutdown (st->fd, SHUT_RDWR);
+	close (st->fd);
+	st->fd = -1;
+} /* }}} void memcached_disconnect */
+
+static int memcached_connect_unix (memcached_t *st) /* {{{ */
+{
+	struct sockaddr_un serv_addr;
 	int fd;
-	ssize_t status;
-	int buffer_fill;
-	int i = 0;
+	int status;
 
-	if (memcached_socket != NULL) {
-		struct sockaddr_un serv_addr;
+	memset (&serv_addr, 0, sizeof (serv_addr));
+	serv_addr.sun_family = AF_UNIX;
+	sstrncpy (serv_addr.sun_path, st->socket,
+			sizeof (serv_addr.sun_path));
 
-		memset (&serv_addr, 0, sizeof (serv_addr));
-		serv_addr.sun_family = AF_UNIX;
-		sstrncpy (serv_addr.sun_path, memcached_socket,
-				sizeof (serv_addr.sun_path));
+	/* create our socket descriptor */
+	fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		char errbuf[1024];
+		ERROR ("memcached: unix socket: %s", sstrerror (errno, errbuf,
+					sizeof (errbuf)));
+		return -1;
+	}
+
+	/* connect to the memcached daemon */
+	status = connect (fd, (struct sockaddr *) &serv_addr,
+			sizeof (serv_addr));
+	if (status != 0) {
+		shutdown (fd, SHUT_RDWR);
+		close (fd);
+		fd = -1;
+	}
+
+	return fd;
+} /* }}} int memcached_connect_unix */
+
+static int memcached_connect_inet (memcached_t *st) /* {{{ */
+{
+	const char *host;
+	const char *port;
+
+	struct addrinfo  ai_hints;
+	struct addrinfo *ai_list, *ai_ptr;
+	int              ai_return = 0;
+	int              fd;
+
+	memset (&ai_hints, '\0', sizeof (ai_hints));
+	ai_hints.ai_flags    = 0;
+#ifdef AI_ADDRCONFIG
+	/*	ai_hints.ai_flags   |= AI_ADDRCONFIG; */
+#endif
+	ai_hints.ai_family   = AF_INET;
+	ai_hints.ai_socktype = SOCK_STREAM;
+	ai_hints.ai_protocol = 0;
+
+	host = (st->host != NULL) ? st->host : MEMCACHED_DEF_HOST;
+	port = (st->port != NULL) ? st->port : MEMCACHED_DEF_PORT;
+
+	if ((ai_return = getaddrinfo (host, port, &ai_hints, &ai_list)) != 0) {
+		char errbuf[1024];
+		ERROR ("memcached: getaddrinfo (%s, %s): %s",
+				host, port,
+				(ai_return == EAI_SYSTEM)
+				? sstrerror (errno, errbuf, sizeof (errbuf))
+				: gai_strerror (ai_return));
+		return -1;
+	}
+
+	fd = -1;
+	for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) {
+		int status;
 
 		/* create our socket descriptor */
-		fd = socket (AF_UNIX, SOCK_STREAM, 0);
+		fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
 		if (fd < 0) {
 			char errbuf[1024];
-			ERROR ("memcached: unix socket: %s", sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			return -1;
+			ERROR ("memcached: socket: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+			continue;
 		}
 
 		/* connect to the memcached daemon */
-		status = (ssize_t) connect (fd, (struct sockaddr *) &serv_addr,
-				sizeof (serv_addr));
+		status = connect (fd, (struct sockaddr *) ai_ptr->ai_addr, ai_ptr->ai_addrlen);
 		if (status != 0) {
 			shutdown (fd, SHUT_RDWR);
 			close (fd);
 			fd = -1;
-		}
-	}
-	else { /* if (memcached_socket == NULL) */
-		const char *host;
-		const char *port;
-
-		struct addrinfo  ai_hints;
-		struct addrinfo *ai_list, *ai_ptr;
-		int              ai_return = 0;
-
-		memset (&ai_hints, '\0', sizeof (ai_hints));
-		ai_hints.ai_flags    = 0;
-#ifdef AI_ADDRCONFIG
-		/*	ai_hints.ai_flags   |= AI_ADDRCONFIG; */
-#endif
-		ai_hints.ai_family   = AF_INET;
-		ai_hints.ai_socktype = SOCK_STREAM;
-		ai_hints.ai_protocol = 0;
-
-		host = memcached_host;
-		if (host == NULL) {
-			host = MEMCACHED_DEF_HOST;
-		}
-
-		port = memcached_port;
-		if (strlen (port) == 0) {
-			port = MEMCACHED_DEF_PORT;
-		}
-
-		if ((ai_return = getaddrinfo (host, port, &ai_hints, &ai_list)) != 0) {
-			char errbuf[1024];
-			ERROR ("memcached: getaddrinfo (%s, %s): %s",
-					host, port,
-					(ai_return == EAI_SYSTEM)
-					? sstrerror (errno, errbuf, sizeof (errbuf))
-					: gai_strerror (ai_return));
-			return -1;
+			continue;
 		}
 
-		fd = -1;
-		for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next) {
-			/* create our socket descriptor */
-			fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype, ai_ptr->ai_protocol);
-			if (fd < 0) {
-				char errbuf[1024];
-				ERROR ("memcached: socket: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
-				continue;
-			}
+		/* A socket could be opened and connecting succeeded. We're
+		 * done. */
+		break;
+	}
 
-			/* connect to the memcached daemon */
-			status = (ssize_t) connect (fd, (struct sockaddr *) ai_ptr->ai_addr, ai_ptr->ai_addrlen);
-			if (status != 0) {
-				shutdown (fd, SHUT_RDWR);
-				close (fd);
-				fd = -1;
-				continue;
-			}
+	freeaddrinfo (ai_list);
+	return fd;
+} /* }}} int memcached_connect_inet */
 
-			/* A socket could be opened and connecting succeeded. We're
-			 * done. */
-			break;
-		}
+static int memcached_connect (memcached_t *st) /* {{{ */
+{
+	if (st->fd >= 0)
+		return 0;
 
-		freeaddrinfo (ai_list);
-	}
+	if (st->socket != NULL)
+		st->fd = memcached_connect_unix (st);
+	else
+		st->fd = memcached_connect_inet (st);
 
-	if (fd < 0) {
-		ERROR ("memcached: Could not connect to daemon.");
+	if (st->fd < 0) {
+		ERROR ("memcached plugin: Instance \"%s\": Could not connect "
+				"to daemon.", st->name);
 		return -1;
 	}
 
-	if (send(fd, "stats\r\n", sizeof("stats\r\n") - 1, MSG_DONTWAIT) != (sizeof("stats\r\n") - 1)) {
-		ERROR ("memcached: Could not send command to the memcached daemon.");
-		return -1;
+	/* The descriptor is kept open: don't leak it to `exec'ed programs. */
+	fcntl (st->fd, F_SETFD, FD_CLOEXEC);
+
+	return 0;
+} /* }}} int memcached_connect */
+
+/* Sends "stats" and reads the response up to and including the terminating
+ * "END" line into `buffer'. Returns zero on success and less than zero on
+ * error. Returns greater than zero, without logging an error, if the
+ * connection was closed before any of the response was received. On error,
+ * the connection is closed, since it is in an undefined state. */
+static int memcached_query_once (memcached_t *st, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	const char *cmd = "stats\r\n";
+	size_t cmd_len = strlen (cmd);
+	size_t buffer_fill = 0;
+	cdtime_t end;
+	int flags = 0;
+	ssize_t status;
+
+#ifdef MSG_NOSIGNAL
+	flags |= MSG_NOSIGNAL;
+#endif
+	status = send (st->fd, cmd, cmd_len, flags);
+	if (status != (ssize_t) cmd_len) {
+		memcached_disconnect (st);
+		return 1;
 	}
 
+	end = cdtime () + interval_g;
+	while (42)
 	{
 		struct pollfd p;
-		int status;
+		cdtime_t now;
+		int timeout_ms;
+
+		now = cdtime ();
+		timeout_ms = (now < end) ? (int) CDTIME_T_TO_MS (end - now) : 0;
 
 		memset (&p, 0, sizeof (p));
-		p.fd = fd;
+		p.fd = st->fd;
 		p.events = POLLIN | POLLERR | POLLHUP;
 		p.revents = 0;
 
-		status = poll (&p, /* nfds = */ 1,
-				/* timeout = */ CDTIME_T_TO_MS (interval_g));
+		status = poll (&p, /* nfds = */ 1, timeout_ms);
 		if (status <= 0)
 		{
+			char errbuf[1024];
+
+			if ((status < 0) && (errno == EINTR))
+				continue;
+
 			if (status == 0)
-			{
-				ERROR ("memcached: poll(2) timed out after %.3f seconds.",
-						CDTIME_T_TO_DOUBLE (interval_g));
-			}
+				ERROR ("memcached plugin: Instance \"%s\": "
+						"poll(2) timed out after %.3f seconds.",
+						st->name, CDTIME_T_TO_DOUBLE (interval_g));
 			else
-			{
-				char errbuf[1024];
-				ERROR ("memcached: poll(2) failed: %s",
+				ERROR ("memcached plugin: Instance \"%s\": "
+						"poll(2) failed: %s", st->name,
 						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
-			shutdown (fd, SHUT_RDWR);
-			close (fd);
-			return (-1);
-		}
-	}
-
-	/* receive data from the memcached daemon */
-	memset (buffer, '\0', buffer_size);
-
-	buffer_fill = 0;
-	while ((status = recv (fd, buffer + buffer_fill, buffer_size - buffer_fill, MSG_DONTWAIT)) != 0) {
-		if (i > MEMCACHED_RETRY_COUNT) {
-			ERROR("recv() timed out");
-			break;
+			memcached_disconnect (st);
+			return -1;
 		}
-		i++;
 
-		if (status == -1) {
+		status = recv (st->fd, buffer + buffer_fill,
+				buffer_size - buffer_fill - 1, MSG_DONTWAIT);
+		if (status < 0)
+		{
 			char errbuf[1024];
 
-			if (errno == EAGAIN) {
+			if ((errno == EAGAIN) || (errno == EINTR))
 				continue;
+
+			if ((errno == ECONNRESET) && (buffer_fill == 0))
+			{
+				memcached_disconnect (st);
+				return 1;
 			}
 
-			ERROR ("memcached: Error reading from socket: %s",
+			ERROR ("memcached plugin: Instance \"%s\": Error reading "
+					"from socket: %s", st->name,
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			shutdown(fd, SHUT_RDWR);
-			close (fd);
+			memcached_disconnect (st);
 			return -1;
 		}
-		buffer_fill += status;
+		else if (status == 0)
+		{
+			memcached_disconnect (st);
+			if (buffer_fill == 0)
+				return 1;
 
-		if (buffer_fill > 3 && buffer[buffer_fill-5] == 'E' && buffer[buffer_fill-4] == 'N' && buffer[buffer_fill-3] == 'D') {
-			/* we got all the data */
-			break;
+			WARNING ("memcached plugin: Instance \"%s\": Peer has "
+					"unexpectedly shut down the socket.", st->name);
+			return -1;
 		}
-	}
 
-	if (buffer_fill >= buffer_size) {
-		buffer[buffer_size - 1] = '\0';
-		WARNING ("memcached: Message from memcached has been truncated.");
-	} else if (buffer_fill == 0) {
-		WARNING ("memcached: Peer has unexpectedly shut down the socket. "
-				"Buffer: `%s'", buffer);
-		shutdown(fd, SHUT_RDWR);
-		close(fd);
-		return -1;
+		buffer_fill += (size_t) status;
+		buffer[buffer_fill] = 0;
+
+		/* The response is complete once it ends with the "END" line,
+		 * or "ERROR" if the command wasn't understood. */
+		if (((buffer_fill >= 5)
+					&& (strcmp (buffer + buffer_fill - 5, "END\r\n") == 0))
+				|| ((buffer_fill >= 7)
+					&& (strcmp (buffer + buffer_fill - 7, "ERROR\r\n") == 0)))
+			break;
+
+		if (buffer_fill >= buffer_size - 1)
+		{
+			/* The rest of the response would be read as the
+			 * response to the next command. */
+			ERROR ("memcached plugin: Instance \"%s\": Message from "
+					"memcached is longer than %zu bytes.",
+					st->name, buffer_size - 1);
+			memcached_disconnect (st);
+			return -1;
+		}
 	}
 
-	shutdown(fd, SHUT_RDWR);
-	close(fd);
 	return 0;
-}
-/* }}} */
+} /* }}} int memcached_query_once */
 
-static int memcached_config (const char *key, const char *value) /* {{{ */
+static int memcached_query_daemon (memcached_t *st, /* {{{ */
+		char *buffer, size_t buffer_size)
 {
-	if (strcasecmp (key, "Socket") == 0) {
-		if (memcached_socket != NULL) {
-			free (memcached_socket);
-		}
-		memcached_socket = strdup (value);
-	} else if (strcasecmp (key, "Host") == 0) {
-		if (memcached_host != NULL) {
-			free (memcached_host);
-		}
-		memcached_host = strdup (value);
-	} else if (strcasecmp (key, "Port") == 0) {
-		int port = (int) (atof (value));
-		if ((port > 0) && (port <= 65535)) {
-			ssnprintf (memcached_port, sizeof (memcached_port), "%i", port);
-		} else {
-			sstrncpy (memcached_port, value, sizeof (memcached_port));
-		}
-	} else {
+	_Bool reused = (st->fd >= 0);
+	int status;
+
+	if (memcached_connect (st) != 0)
 		return -1;
+
+	status = memcached_query_once (st, buffer, buffer_size);
+	if ((status > 0) && reused)
+	{
+		/* The daemon may have closed the connection since the last
+		 * read, e.g. because it was restarted. Try once more with a
+		 * new one. */
+		if (memcached_connect (st) != 0)
+			return -1;
+		status = memcached_query_once (st, buffer, buffer_size);
 	}
 
-	return 0;
-}
-/* }}} */
+	if (status > 0)
+	{
+		WARNING ("memcached plugin: Instance \"%s\": Peer has "
+				"unexpectedly shut down the socket.", st->name);
+		return -1;
+	}
+
+	return status;
+} /* }}} int memcached_query_daemon */
 
-static void submit_derive (const char *type, const char *type_inst,
-		derive_t value) /* {{{ */
+static void submit (memcached_t *st, const char *type, /* {{{ */
+		const char *type_inst, value_t *values, size_t values_len)
 {
-	value_t values[1];
 	value_list_t vl = VALUE_LIST_INIT;
 
-	values[0].derive = value;
-
 	vl.values = values;
-	vl.values_len = 1;
+	vl.values_len = values_len;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "memcached", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, st->name, sizeof (vl.plugin_instance));
 	sstrncpy (vl.type, type, sizeof (vl.type));
 	if (type_inst != NULL)
 		sstrncpy (vl.type_instance, type_inst, sizeof (vl.type_instance));
 
 	plugin_dispatch_values (&vl);
-} /* void memcached_submit_cmd */
-/* }}} */
+} /* }}} void submit */
 
-static void submit_derive2 (const char *type, const char *type_inst,
-		derive_t value0, derive_t value1) /* {{{ */
+static void submit_derive (memcached_t *st, const char *type, /* {{{ */
+		const char *type_inst, derive_t value)
+{
+	value_t values[1];
+
+	values[0].derive = value;
+	submit (st, type, type_inst, values, STATIC_ARRAY_SIZE (values));
+} /* }}} void submit_derive */
+
+static void submit_derive2 (memcached_t *st, const char *type, /* {{{ */
+		const char *type_inst, derive_t value0, derive_t value1)
 {
 	value_t values[2];
-	value_list_t vl = VALUE_LIST_INIT;
 
 	values[0].derive = value0;
 	values[1].derive = value1;
+	submit (st, type, type_inst, values, STATIC_ARRAY_SIZE (values));
+} /* }}} void submit_derive2 */
 
-	vl.values = values;
-	vl.values_len = 2;
-	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-	sstrncpy (vl.plugin, "memcached", sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (type_inst != NULL)
-		sstrncpy (vl.type_instance, type_inst, sizeof (vl.type_instance));
-
-	plugin_dispatch_values (&vl);
-} /* void memcached_submit_cmd */
-/* }}} */
-
-static void submit_gauge (const char *type, const char *type_inst,
-		gauge_t value) /* {{{ */
+static void submit_gauge (memcached_t *st, const char *type, /* {{{ */
+		const char *type_inst, gauge_t value)
 {
 	value_t values[1];
-	value_list_t vl = VALUE_LIST_INIT;
 
 	values[0].gauge = value;
+	submit (st, type, type_inst, values, STATIC_ARRAY_SIZE (values));
+} /* }}} void submit_gauge */
 
-	vl.values = values;
-	vl.values_len = 1;
-	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-	sstrncpy (vl.plugin, "memcached", sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (type_inst != NULL)
-		sstrncpy (vl.type_instance, type_inst, sizeof (vl.type_instance));
-
-	plugin_dispatch_values (&vl);
-}
-/* }}} */
-
-static void submit_gauge2 (const char *type, const char *type_inst,
-		gauge_t value0, gauge_t value1) /* {{{ */
+static void submit_gauge2 (memcached_t *st, const char *type, /* {{{ */
+		const char *type_inst, gauge_t value0, gauge_t value1)
 {
 	value_t values[2];
-	value_list_t vl = VALUE_LIST_INIT;
 
 	values[0].gauge = value0;
 	values[1].gauge = value1;
+	submit (st, type, type_inst, values, STATIC_ARRAY_SIZE (values));
+} /* }}} void submit_gauge2 */
 
-	vl.values = values;
-	vl.values_len = 2;
-	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-	sstrncpy (vl.plugin, "memcached", sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (type_inst != NULL)
-		sstrncpy (vl.type_instance, type_inst, sizeof (vl.type_instance));
-
-	plugin_dispatch_values (&vl);
-}
-/* }}} */
+static int memcached_field_compare (const void *key, const void *entry) /* {{{ */
+{
+	return strcmp ((const char *) key,
+			((const memcached_field_t *) entry)->name);
+} /* }}} int memcached_field_compare */
 
-static int memcached_read (void) /* {{{ */
+static int memcached_read (user_data_t *ud) /* {{{ */
 {
-	char buf[1024];
+	memcached_t *st;
+	char buf[MEMCACHED_BUFFER_SIZE];
+	char *values[MEMCACHED_FIELDS_NUM];
 	char *fields[3];
 	char *ptr;
 	char *line;
@@ -373,19 +488,25 @@ static int memcached_read (void) /* {{{ */
 	derive_t octets_rx = 0;
 	derive_t octets_tx = 0;
 
+	if ((ud == NULL) || (ud->data == NULL))
+	{
+		ERROR ("memcached plugin: memcached_read: Invalid user data.");
+		return -1;
+	}
+	st = ud->data;
+
 	/* get data from daemon */
-	if (memcached_query_daemon (buf, sizeof (buf)) < 0) {
+	if (memcached_query_daemon (st, buf, sizeof (buf)) < 0) {
 		return -1;
 	}
 
-#define FIELD_IS(cnst) \
-	(((sizeof(cnst) - 1) == name_len) && (strcmp (cnst, fields[1]) == 0))
+	memset (values, 0, sizeof (values));
 
 	ptr = buf;
 	saveptr = NULL;
 	while ((line = strtok_r (ptr, "\n\r", &saveptr)) != NULL)
 	{
-		int name_len;
+		const memcached_field_t *f;
 
 		ptr = NULL;
 
@@ -393,112 +514,98 @@ static int memcached_read (void) /* {{{ */
 		if (fields_num != 3)
 			continue;
 
-		name_len = strlen(fields[1]);
-		if (name_len == 0)
-			continue;
-
-		/*
-		 * For an explanation on these fields please refer to
-		 * <http://code.sixapart.com/svn/memcached/trunk/server/doc/protocol.txt>
-		 */
-
-		/*
-		 * CPU time consumed by the memcached process
-		 */
-		if (FIELD_IS ("rusage_user"))
-		{
-			rusage_user = atoll (fields[2]);
-		}
-		else if (FIELD_IS ("rusage_system"))
-		{
-			rusage_syst = atoll(fields[2]);
-		}
-
-		/*
-		 * Number of threads of this instance
-		 */
-		else if (FIELD_IS ("threads"))
-		{
-			submit_gauge2 ("ps_count", NULL, NAN, atof (fields[2]));
-		}
-
-		/*
-		 * Number of items stored
-		 */
-		else if (FIELD_IS ("curr_items"))
-		{
-			submit_gauge ("memcached_items", "current", atof (fields[2]));
-		}
-
-		/*
-		 * Number of bytes used and available (total - used)
-		 */
-		else if (FIELD_IS ("bytes"))
-		{
-			bytes_used = atof (fields[2]);
-		}
-		else if (FIELD_IS ("limit_maxbytes"))
-		{
-			bytes_total = atof(fields[2]);
-		}
-
-		/*
-		 * Connections
-		 */
-		else if (FIELD_IS ("curr_connections"))
-		{
-			submit_gauge ("memcached_connections", "current", atof (fields[2]));
-		}
-
 		/*
 		 * Commands
 		 */
-		else if ((name_len > 4) && (strncmp (fields[1], "cmd_", 4) == 0))
+		if (strncmp (fields[1], "cmd_", 4) == 0)
 		{
 			const char *name = fields[1] + 4;
-			submit_derive ("memcached_command", name, atoll (fields[2]));
+
+			if (name[0] == 0)
+				continue;
+
+			submit_derive (st, "memcached_command", name, atoll (fields[2]));
 			if (strcmp (name, "get") == 0)
 				gets = atof (fields[2]);
+			continue;
 		}
 
-		/*
-		 * Operations on the cache, i. e. cache hits, cache misses and evictions of items
-		 */
-		else if (FIELD_IS ("get_hits"))
-		{
-			submit_derive ("memcached_ops", "hits", atoll (fields[2]));
-			hits = atof (fields[2]);
-		}
-		else if (FIELD_IS ("get_misses"))
-		{
-			submit_derive ("memcached_ops", "misses", atoll (fields[2]));
-		}
-		else if (FIELD_IS ("evictions"))
-		{
-			submit_derive ("memcached_ops", "evictions", atoll (fields[2]));
-		}
-
-		/*
-		 * Network traffic
-		 */
-		else if (FIELD_IS ("bytes_read"))
-		{
-			octets_rx = atoll (fields[2]);
-		}
-		else if (FIELD_IS ("bytes_written"))
-		{
-			octets_tx = atoll (fields[2]);
-		}
+		f = bsearch (fields[1], memcached_fields,
+				STATIC_ARRAY_SIZE (memcached_fields),
+				sizeof (memcached_fields[0]), memcached_field_compare);
+		if (f != NULL)
+			values[f->field] = fields[2];
 	} /* while ((line = strtok_r (ptr, "\n\r", &saveptr)) != NULL) */
 
+	/*
+	 * CPU time consumed by the memcached process
+	 */
+	if (values[MEMCACHED_FIELD_RUSAGE_USER] != NULL)
+		rusage_user = atoll (values[MEMCACHED_FIELD_RUSAGE_USER]);
+	if (values[MEMCACHED_FIELD_RUSAGE_SYSTEM] != NULL)
+		rusage_syst = atoll (values[MEMCACHED_FIELD_RUSAGE_SYSTEM]);
+
+	/*
+	 * Number of threads of this instance
+	 */
+	if (values[MEMCACHED_FIELD_THREADS] != NULL)
+		submit_gauge2 (st, "ps_count", NULL, NAN,
+				atof (values[MEMCACHED_FIELD_THREADS]));
+
+	/*
+	 * Number of items stored
+	 */
+	if (values[MEMCACHED_FIELD_CURR_ITEMS] != NULL)
+		submit_gauge (st, "memcached_items", "current",
+				atof (values[MEMCACHED_FIELD_CURR_ITEMS]));
+
+	/*
+	 * Number of bytes used and available (total - used)
+	 */
+	if (values[MEMCACHED_FIELD_BYTES] != NULL)
+		bytes_used = atof (values[MEMCACHED_FIELD_BYTES]);
+	if (values[MEMCACHED_FIELD_LIMIT_MAXBYTES] != NULL)
+		bytes_total = atof (values[MEMCACHED_FIELD_LIMIT_MAXBYTES]);
+
+	/*
+	 * Connections
+	 */
+	if (values[MEMCACHED_FIELD_CURR_CONNECTIONS] != NULL)
+		submit_gauge (st, "memcached_connections", "current",
+				atof (values[MEMCACHED_FIELD_CURR_CONNECTIONS]));
+
+	/*
+	 * Operations on the cache, i. e. cache hits, cache misses and evictions of items
+	 */
+	if (values[MEMCACHED_FIELD_GET_HITS] != NULL)
+	{
+		submit_derive (st, "memcached_ops", "hits",
+				atoll (values[MEMCACHED_FIELD_GET_HITS]));
+		hits = atof (values[MEMCACHED_FIELD_GET_HITS]);
+	}
+	if (values[MEMCACHED_FIELD_GET_MISSES] != NULL)
+		submit_derive (st, "memcached_ops", "misses",
+				atoll (values[MEMCACHED_FIELD_GET_MISSES]));
+	if (values[MEMCACHED_FIELD_EVICTIONS] != NULL)
+		submit_derive (st, "memcached_ops", "evictions",
+				atoll (values[MEMCACHED_FIELD_EVICTIONS]));
+
+	/*
+	 * Network traffic
+	 */
+	if (values[MEMCACHED_FIELD_BYTES_READ] != NULL)
+		octets_rx = atoll (values[MEMCACHED_FIELD_BYTES_READ]);
+	if (values[MEMCACHED_FIELD_BYTES_WRITTEN] != NULL)
+		octets_tx = atoll (values[MEMCACHED_FIELD_BYTES_WRITTEN]);
+
 	if (!isnan (bytes_used) && !isnan (bytes_total) && (bytes_used <= bytes_total))
-		submit_gauge2 ("df", "cache", bytes_used, bytes_total - bytes_used);
+		submit_gauge2 (st, "df", "cache", bytes_used, bytes_total - bytes_used);
 
 	if ((rusage_user != 0) || (rusage_syst != 0))
-		submit_derive2 ("ps_cputime", NULL, rusage_user, rusage_syst);
+		submit_derive2 (st, "ps_cputime", NULL, rusage_user, rusage_syst);
 
 	if ((octets_rx != 0) || (octets_tx != 0))
-		submit_derive2 ("memcached_octets", NULL, octets_rx, octets_tx);
+		submit_derive2 (st, "memcached_octets", NULL, octets_rx, octets_tx);
 
 	if (!isnan (gets) && !isnan (hits))
 	{
@@ -507,17 +614,168 @@ static int memcached_read (void) /* {{{ */
 		if (gets != 0.0)
 			rate = 100.0 * hits / gets;
 
-		submit_gauge ("percent", "hitratio", rate);
+		submit_gauge (st, "percent", "hitratio", rate);
 	}
 
 	return 0;
-}
-/* }}} */
+} /* }}} int memcached_read */
+
+static int memcached_add_read_callback (memcached_t *st) /* {{{ */
+{
+	user_data_t ud;
+	char callback_name[3*DATA_MAX_NAME_LEN];
+
+	memset (&ud, 0, sizeof (ud));
+	ud.data = st;
+	ud.free_func = memcached_free;
+
+	assert (st->name != NULL);
+	if (st->name[0] != 0)
+		ssnprintf (callback_name, sizeof (callback_name),
+				"memcached/%s", st->name);
+	else
+		sstrncpy (callback_name, "memcached", sizeof (callback_name));
+
+	memcached_have_instances = 1;
+	return (plugin_register_complex_read (/* group = */ NULL,
+				callback_name, memcached_read,
+				/* interval = */ NULL, &ud));
+} /* }}} int memcached_add_read_callback */
+
+static memcached_t *memcached_create (const char *name) /* {{{ */
+{
+	memcached_t *st;
+
+	st = malloc (sizeof (*st));
+	if (st == NULL)
+	{
+		ERROR ("memcached plugin: malloc failed.");
+		return (NULL);
+	}
+	memset (st, 0, sizeof (*st));
+	st->fd = -1;
+
+	st->name = strdup (name);
+	if (st->name == NULL)
+	{
+		ERROR ("memcached plugin: strdup failed.");
+		sfree (st);
+		return (NULL);
+	}
+
+	return (st);
+} /* }}} memcached_t *memcached_create */
+
+/* Handles the options valid both inside and outside of `Instance' blocks. */
+static int memcached_config_option (memcached_t *st, /* {{{ */
+		oconfig_item_t *ci)
+{
+	int status;
+
+	if (strcasecmp ("Socket", ci->key) == 0)
+		status = cf_util_get_string (ci, &st->socket);
+	else if (strcasecmp ("Host", ci->key) == 0)
+		status = cf_util_get_string (ci, &st->host);
+	else if (strcasecmp ("Port", ci->key) == 0)
+		status = cf_util_get_service (ci, &st->port);
+	else
+	{
+		WARNING ("memcached plugin: Option `%s' not allowed here.",
+				ci->key);
+		status = -1;
+	}
+
+	return (status);
+} /* }}} int memcached_config_option */
+
+/* <Instance "name">
+ *   Host "memcache.example.com"
+ *   Port 11211
+ * </Instance> */
+static int memcached_config_instance (oconfig_item_t *ci) /* {{{ */
+{
+	memcached_t *st;
+	char *name = NULL;
+	int status;
+	int i;
+
+	status = cf_util_get_string (ci, &name);
+	if (status != 0)
+		return (status);
+
+	st = memcached_create (name);
+	sfree (name);
+	if (st == NULL)
+		return (-1);
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		status = memcached_config_option (st, ci->children + i);
+		if (status != 0)
+			break;
+	}
+
+	if (status != 0)
+	{
+		memcached_free (st);
+		return (status);
+	}
+
+	return (memcached_add_read_callback (st));
+} /* }}} int memcached_config_instance */
+
+static int memcached_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Instance", child->key) == 0)
+		{
+			memcached_config_instance (child);
+			continue;
+		}
+
+		/* The options of a single, unnamed instance as supported by
+		 * previous versions. */
+		if (memcached_legacy == NULL)
+		{
+			memcached_legacy = memcached_create ("");
+			if (memcached_legacy == NULL)
+				return (-1);
+		}
+		memcached_config_option (memcached_legacy, child);
+	}
+
+	return (0);
+} /* }}} int memcached_config */
+
+static int memcached_init (void) /* {{{ */
+{
+	memcached_t *st;
+
+	/* Without any configuration, the daemon on the default host and port
+	 * is queried. */
+	if (memcached_legacy != NULL)
+		st = memcached_legacy;
+	else if (!memcached_have_instances)
+		st = memcached_create ("");
+	else
+		return (0);
+
+	memcached_legacy = NULL;
+	if (st == NULL)
+		return (-1);
+
+	return (memcached_add_read_callback (st));
+} /* }}} int memcached_init */
 
 void module_register (void) /* {{{ */
 {
-	plugin_register_config ("memcached", memcached_config, config_keys, config_keys_num);
-	plugin_register_read ("memcached", memcached_read);
+	plugin_register_complex_config ("memcached", memcached_config);
+	plugin_register_init ("memcached", memcached_init);
 }
 /* }}} */
 
@@ -529,4 +787,3 @@ void module_register (void) /* {{{ */
  * vim600: sw=4 ts=4 fdm=marker noexpandtab
  * vim<600: sw=4 ts=4 noexpandtab
  */
-
@@ -26,6 +26,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #ifdef HAVE_SYS_SYSCTL_H
 # include <sys/sysctl.h>
@@ -67,7 +68,7 @@ static vm_size_t pagesize;
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-/* no global variables */
+static procfs_file_t *proc_meminfo = NULL;
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKSTAT
@@ -261,8 +262,8 @@ static int memory_read (void)
 /* #endif HAVE_SYSCTLBYNAME */
 
 #elif KERNEL_LINUX
-	FILE *fh;
-	char buffer[1024];
+	char *buffer;
+	char *line;
 
 	char *fields[8];
 	int numfields;
@@ -272,30 +273,33 @@ static int memory_read (void)
 	long long mem_cached = 0;
 	long long mem_free = 0;
 
-	if ((fh = fopen ("/proc/meminfo", "r")) == NULL)
+	if (proc_meminfo == NULL)
 	{
-		char errbuf[1024];
-		WARNING ("memory: fopen: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		proc_meminfo = procfs_open ("/proc/meminfo", /* max age = */ 0);
+		if (proc_meminfo == NULL)
+			return (-1);
 	}
 
-	while (fgets (buffer, 1024, fh) != NULL)
+	buffer = procfs_read (proc_meminfo, /* time = */ NULL);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
 	{
 		long long *val = NULL;
 
-		if (strncasecmp (buffer, "MemTotal:", 9) == 0)
+		if (strncasecmp (line, "MemTotal:", 9) == 0)
 			val = &mem_used;
-		else if (strncasecmp (buffer, "MemFree:", 8) == 0)
+		else if (strncasecmp (line, "MemFree:", 8) == 0)
 			val = &mem_free;
-		else if (strncasecmp (buffer, "Buffers:", 8) == 0)
+		else if (strncasecmp (line, "Buffers:", 8) == 0)
 			val = &mem_buffered;
-		else if (strncasecmp (buffer, "Cached:", 7) == 0)
+		else if (strncasecmp (line, "Cached:", 7) == 0)
 			val = &mem_cached;
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields, 8);
+		numfields = strsplit (line, fields, 8);
 
 		if (numfields < 2)
 			continue;
@@ -303,13 +307,6 @@ static int memory_read (void)
 		*val = atoll (fields[1]) * 1024LL;
 	}
 
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("memory: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
-
 	if (mem_used >= (mem_free + mem_buffered + mem_cached))
 	{
 		mem_used -= mem_free + mem_buffered + mem_cached;
@@ -446,8 +443,19 @@ static int memory_read (void)
 	return (0);
 }
 
+static int memory_shutdown (void)
+{
+#if KERNEL_LINUX
+	procfs_close (proc_meminfo);
+	proc_meminfo = NULL;
+#endif
+
+	return (0);
+}
+
 void module_register (void)
 {
 	plugin_register_init ("memory", memory_init);
 	plugin_register_read ("memory", memory_read);
+	plugin_register_shutdown ("memory", memory_shutdown);
 } /* void module_register */
@@ -22,8 +22,10 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "meta_data.h"
+#include "utils_hashtable.h"
 
 #include <pthread.h>
+#include <sched.h>
 
 /*
  * Data types
@@ -38,25 +40,74 @@ union meta_value_u
 };
 typedef union meta_value_u meta_value_t;
 
-struct meta_entry_s;
-typedef struct meta_entry_s meta_entry_t;
 struct meta_entry_s
 {
-  char         *key;
-  meta_value_t  value;
+  /* Interned, see `md_key_intern'. */
+  const char   *key;
+  /* Case-insensitive hash of `key'. */
+  uint32_t      key_hash;
   int           type;
-  meta_entry_t *next;
+  meta_value_t  value;
 };
+typedef struct meta_entry_s meta_entry_t;
 
+/* Most value lists carry one or two entries, e.g. the network plugin's
+ * "network:username", so a few are stored in the object itself. */
+#define MD_INLINE_ENTRIES 4
+
+/* Entries are kept in insertion order. `entries' points to
+ * `inline_entries', to memory allocated together with the object (see
+ * `meta_data_clone') or to a separate allocation. String values are either
+ * separate allocations or in the same allocation as the object, too, so
+ * `md_embedded' must be checked before freeing anything. */
 struct meta_data_s
 {
-  meta_entry_t   *head;
-  pthread_mutex_t lock;
+  meta_entry_t *entries;
+  int           entries_num;
+  int           entries_size;
+  size_t        alloc_size;
+  /* Held for a few instructions only, so threads spin instead of sleeping
+   * in the kernel. See `md_lock'. */
+  volatile int  lock;
+  meta_entry_t  inline_entries[MD_INLINE_ENTRIES];
 };
 
+/* Interned keys are never freed. The set of keys is defined by the plugins
+ * and small. */
+static c_hashtable_t   *md_keys = NULL;
+static pthread_rwlock_t md_keys_lock = PTHREAD_RWLOCK_INITIALIZER;
+
 /*
  * Private functions
  */
+static void md_lock (meta_data_t *md) /* {{{ */
+{
+  int i = 0;
+
+  while (__sync_lock_test_and_set (&md->lock, 1) != 0)
+  {
+    /* Give the holder a chance to run, in case it has been preempted. */
+    if (++i >= 100)
+    {
+      sched_yield ();
+      i = 0;
+    }
+  }
+} /* }}} void md_lock */
+
+static void md_unlock (meta_data_t *md) /* {{{ */
+{
+  __sync_lock_release (&md->lock);
+} /* }}} void md_unlock */
+
+static _Bool md_embedded (const meta_data_t *md, const void *ptr) /* {{{ */
+{
+  const char *begin = (const char *) md;
+
+  return (((const char *) ptr >= begin)
+      && ((const char *) ptr < begin + md->alloc_size));
+} /* }}} _Bool md_embedded */
+
 static char *md_strdup (const char *orig) /* {{{ */
 {
   size_t sz;
@@ -75,136 +126,222 @@ static char *md_strdup (const char *orig) /* {{{ */
   return (dest);
 } /* }}} char *md_strdup */
 
-static meta_entry_t *md_entry_alloc (const char *key) /* {{{ */
+/* FNV-1a of the lower case key, because keys are compared
+ * case-insensitively. */
+static uint32_t md_key_hash (const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  uint32_t hash = 2166136261U;
 
-  e = (meta_entry_t *) malloc (sizeof (*e));
-  if (e == NULL)
+  while (*key != 0)
   {
-    ERROR ("md_entry_alloc: malloc failed.");
-    return (NULL);
+    hash ^= (uint32_t) tolower ((int) ((unsigned char) *key));
+    hash *= 16777619U;
+    key++;
+  }
+
+  return (hash);
+} /* }}} uint32_t md_key_hash */
+
+static const char *md_key_intern (const char *key) /* {{{ */
+{
+  char *interned = NULL;
+  char *copy;
+
+  pthread_rwlock_rdlock (&md_keys_lock);
+  if (md_keys != NULL)
+    c_hashtable_get (md_keys, key, (void *) &interned);
+  pthread_rwlock_unlock (&md_keys_lock);
+
+  if (interned != NULL)
+    return (interned);
+
+  pthread_rwlock_wrlock (&md_keys_lock);
+
+  if (md_keys == NULL)
+  {
+    md_keys = c_hashtable_create (c_hashtable_hash_string,
+        (int (*) (const void *, const void *)) strcmp);
+    if (md_keys == NULL)
+    {
+      pthread_rwlock_unlock (&md_keys_lock);
+      ERROR ("md_key_intern: c_hashtable_create failed.");
+      return (NULL);
+    }
+  }
+
+  /* Another thread may have been faster. */
+  if (c_hashtable_get (md_keys, key, (void *) &interned) == 0)
+  {
+    pthread_rwlock_unlock (&md_keys_lock);
+    return (interned);
   }
-  memset (e, 0, sizeof (*e));
 
-  e->key = md_strdup (key);
-  if (e->key == NULL)
+  copy = md_strdup (key);
+  if ((copy == NULL) || (c_hashtable_insert (md_keys, copy, copy) != 0))
   {
-    free (e);
-    ERROR ("md_entry_alloc: md_strdup failed.");
+    pthread_rwlock_unlock (&md_keys_lock);
+    free (copy);
+    ERROR ("md_key_intern: Storing key `%s' failed.", key);
     return (NULL);
   }
 
-  e->type = 0;
-  e->next = NULL;
+  pthread_rwlock_unlock (&md_keys_lock);
+  return (copy);
+} /* }}} const char *md_key_intern */
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_alloc */
+static void md_value_free (meta_data_t *md, meta_entry_t *e) /* {{{ */
+{
+  if ((e->type == MD_TYPE_STRING) && !md_embedded (md, e->value.mv_string))
+    free (e->value.mv_string);
+  e->type = 0;
+} /* }}} void md_value_free */
 
-static meta_entry_t *md_entry_clone (const meta_entry_t *orig) /* {{{ */
+/* XXX: The lock on md must be held while calling this function! Returns the
+ * index of the entry or -1. */
+static int md_entry_lookup (meta_data_t *md, /* {{{ */
+    const char *key, uint32_t key_hash)
 {
-  meta_entry_t *copy;
+  int i;
 
-  if (orig == NULL)
-    return (NULL);
+  for (i = 0; i < md->entries_num; i++)
+  {
+    meta_entry_t *e = md->entries + i;
 
-  copy = md_entry_alloc (orig->key);
-  copy->type = orig->type;
-  if (copy->type == MD_TYPE_STRING)
-    copy->value.mv_string = strdup (orig->value.mv_string);
-  else
-    copy->value = orig->value;
+    if ((e->key == key)
+        || ((e->key_hash == key_hash) && (strcasecmp (key, e->key) == 0)))
+      return (i);
+  }
 
-  copy->next = md_entry_clone (orig->next);
-  return (copy);
-} /* }}} meta_entry_t *md_entry_clone */
+  return (-1);
+} /* }}} int md_entry_lookup */
 
-static void md_entry_free (meta_entry_t *e) /* {{{ */
+/* XXX: The lock on md must be held while calling this function! */
+static int md_entries_reserve (meta_data_t *md) /* {{{ */
 {
-  if (e == NULL)
-    return;
+  meta_entry_t *tmp;
+  int size;
 
-  free (e->key);
+  if (md->entries_num < md->entries_size)
+    return (0);
 
-  if (e->type == MD_TYPE_STRING)
-    free (e->value.mv_string);
+  size = 2 * md->entries_size;
+  if (md_embedded (md, md->entries))
+  {
+    tmp = malloc (size * sizeof (*tmp));
+    if (tmp != NULL)
+      memcpy (tmp, md->entries, md->entries_num * sizeof (*tmp));
+  }
+  else
+  {
+    tmp = realloc (md->entries, size * sizeof (*tmp));
+  }
 
-  if (e->next != NULL)
-    md_entry_free (e->next);
+  if (tmp == NULL)
+    return (-ENOMEM);
 
-  free (e);
-} /* }}} void md_entry_free */
+  md->entries = tmp;
+  md->entries_size = size;
+  return (0);
+} /* }}} int md_entries_reserve */
 
-static int md_entry_insert (meta_data_t *md, meta_entry_t *e) /* {{{ */
+/* Adds or replaces the entry `key'. The string of a MD_TYPE_STRING value
+ * must have been allocated with malloc and is owned by `md' afterwards,
+ * even on failure. */
+static int md_entry_set (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t value)
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  const char *interned;
+  uint32_t key_hash;
+  meta_entry_t *e;
+  int idx;
 
-  if ((md == NULL) || (e == NULL))
-    return (-EINVAL);
+  interned = md_key_intern (key);
+  if (interned == NULL)
+  {
+    if (type == MD_TYPE_STRING)
+      free (value.mv_string);
+    return (-ENOMEM);
+  }
+  key_hash = md_key_hash (key);
 
-  pthread_mutex_lock (&md->lock);
+  md_lock (md);
 
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
+  idx = md_entry_lookup (md, interned, key_hash);
+  if (idx >= 0)
   {
-    if (strcasecmp (e->key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
+    e = md->entries + idx;
+    md_value_free (md, e);
   }
-
-  if (this == NULL)
+  else
   {
-    /* This key does not exist yet. */
-    if (md->head == NULL)
-      md->head = e;
-    else
+    if (md_entries_reserve (md) != 0)
     {
-      assert (prev != NULL);
-      prev->next = e;
+      md_unlock (md);
+      ERROR ("md_entry_set: Allocating memory failed.");
+      if (type == MD_TYPE_STRING)
+        free (value.mv_string);
+      return (-ENOMEM);
     }
 
-    e->next = NULL;
+    e = md->entries + md->entries_num;
+    md->entries_num++;
+    e->key = interned;
+    e->key_hash = key_hash;
   }
-  else /* (this != NULL) */
-  {
-    if (prev == NULL)
-      md->head = e;
-    else
-      prev->next = e;
 
-    e->next = this->next;
-  }
-
-  pthread_mutex_unlock (&md->lock);
-
-  if (this != NULL)
-  {
-    this->next = NULL;
-    md_entry_free (this);
-  }
+  e->type = type;
+  e->value = value;
 
+  md_unlock (md);
   return (0);
-} /* }}} int md_entry_insert */
+} /* }}} int md_entry_set */
 
-/* XXX: The lock on md must be held while calling this function! */
-static meta_entry_t *md_entry_lookup (meta_data_t *md, /* {{{ */
-    const char *key)
+/* Copies the value of `key' to `ret_value'. String values are copied with
+ * malloc. */
+static int md_entry_get (meta_data_t *md, const char *key, /* {{{ */
+    int type, meta_value_t *ret_value, const char *func)
 {
   meta_entry_t *e;
+  int idx;
 
-  if ((md == NULL) || (key == NULL))
-    return (NULL);
+  if ((md == NULL) || (key == NULL) || (ret_value == NULL))
+    return (-EINVAL);
 
-  for (e = md->head; e != NULL; e = e->next)
-    if (strcasecmp (key, e->key) == 0)
-      break;
+  md_lock (md);
 
-  return (e);
-} /* }}} meta_entry_t *md_entry_lookup */
+  idx = md_entry_lookup (md, key, md_key_hash (key));
+  if (idx < 0)
+  {
+    md_unlock (md);
+    return (-ENOENT);
+  }
+  e = md->entries + idx;
+
+  if (e->type != type)
+  {
+    md_unlock (md);
+    ERROR ("%s: Type mismatch for key `%s'", func, key);
+    return (-ENOENT);
+  }
+
+  if (type == MD_TYPE_STRING)
+  {
+    ret_value->mv_string = md_strdup (e->value.mv_string);
+    if (ret_value->mv_string == NULL)
+    {
+      md_unlock (md);
+      ERROR ("%s: md_strdup failed.", func);
+      return (-ENOMEM);
+    }
+  }
+  else
+  {
+    *ret_value = e->value;
+  }
+
+  md_unlock (md);
+  return (0);
+} /* }}} int md_entry_get */
 
 /*
  * Public functions
@@ -221,141 +358,168 @@ meta_data_t *meta_data_create (void) /* {{{ */
   }
   memset (md, 0, sizeof (*md));
 
-  md->head = NULL;
-  pthread_mutex_init (&md->lock, /* attr = */ NULL);
+  md->entries = md->inline_entries;
+  md->entries_num = 0;
+  md->entries_size = MD_INLINE_ENTRIES;
+  md->alloc_size = sizeof (*md);
 
   return (md);
 } /* }}} meta_data_t *meta_data_create */
 
+/* The copy is a single allocation: the object, the entries which don't fit
+ * into `inline_entries' and all string values. */
 meta_data_t *meta_data_clone (meta_data_t *orig) /* {{{ */
 {
   meta_data_t *copy;
+  size_t entries_size;
+  size_t size;
+  char *strings;
+  int i;
 
   if (orig == NULL)
     return (NULL);
 
-  copy = meta_data_create ();
+  md_lock (orig);
+
+  entries_size = 0;
+  if (orig->entries_num > MD_INLINE_ENTRIES)
+    entries_size = orig->entries_num * sizeof (meta_entry_t);
+
+  size = sizeof (*copy) + entries_size;
+  for (i = 0; i < orig->entries_num; i++)
+    if (orig->entries[i].type == MD_TYPE_STRING)
+      size += strlen (orig->entries[i].value.mv_string) + 1;
+
+  copy = malloc (size);
   if (copy == NULL)
+  {
+    md_unlock (orig);
+    ERROR ("meta_data_clone: malloc failed.");
     return (NULL);
+  }
+  memset (copy, 0, sizeof (*copy));
+  copy->alloc_size = size;
 
-  pthread_mutex_lock (&orig->lock);
-  copy->head = md_entry_clone (orig->head);
-  pthread_mutex_unlock (&orig->lock);
+  if (entries_size == 0)
+  {
+    copy->entries = copy->inline_entries;
+    copy->entries_size = MD_INLINE_ENTRIES;
+  }
+  else
+  {
+    copy->entries = (meta_entry_t *) (copy + 1);
+    copy->entries_size = orig->entries_num;
+  }
+  copy->entries_num = orig->entries_num;
+  memcpy (copy->entries, orig->entries,
+      orig->entries_num * sizeof (meta_entry_t));
+
+  strings = ((char *) (copy + 1)) + entries_size;
+  for (i = 0; i < copy->entries_num; i++)
+  {
+    meta_entry_t *e = copy->entries + i;
+    size_t len;
+
+    if (e->type != MD_TYPE_STRING)
+      continue;
+
+    len = strlen (e->value.mv_string) + 1;
+    memcpy (strings, e->value.mv_string, len);
+    e->value.mv_string = strings;
+    strings += len;
+  }
+
+  md_unlock (orig);
 
   return (copy);
 } /* }}} meta_data_t *meta_data_clone */
 
 void meta_data_destroy (meta_data_t *md) /* {{{ */
 {
+  int i;
+
   if (md == NULL)
     return;
 
-  md_entry_free (md->head);
-  pthread_mutex_destroy (&md->lock);
+  for (i = 0; i < md->entries_num; i++)
+    md_value_free (md, md->entries + i);
+
+  if (!md_embedded (md, md->entries))
+    free (md->entries);
   free (md);
 } /* }}} void meta_data_destroy */
 
 int meta_data_exists (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int idx;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return (1);
-    }
-  }
+  md_lock (md);
+  idx = md_entry_lookup (md, key, md_key_hash (key));
+  md_unlock (md);
 
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return ((idx >= 0) ? 1 : 0);
 } /* }}} int meta_data_exists */
 
 int meta_data_type (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *e;
+  int type = 0;
+  int idx;
 
   if ((md == NULL) || (key == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-  {
-    if (strcasecmp (key, e->key) == 0)
-    {
-      pthread_mutex_unlock (&md->lock);
-      return e->type;
-    }
-  }
+  md_lock (md);
+  idx = md_entry_lookup (md, key, md_key_hash (key));
+  if (idx >= 0)
+    type = md->entries[idx].type;
+  md_unlock (md);
 
-  pthread_mutex_unlock (&md->lock);
-  return 0;
+  return (type);
 } /* }}} int meta_data_type */
 
 int meta_data_toc (meta_data_t *md, char ***toc) /* {{{ */
 {
-  int i = 0, count = 0;
-  meta_entry_t *e;
+  int i, count;
 
   if ((md == NULL) || (toc == NULL))
     return -EINVAL;
 
-  pthread_mutex_lock (&md->lock);
-
-  for (e = md->head; e != NULL; e = e->next)
-    ++count;    
+  md_lock (md);
 
+  count = md->entries_num;
   *toc = malloc(count * sizeof(**toc));
-  for (e = md->head; e != NULL; e = e->next)
-    (*toc)[i++] = strdup(e->key);
-  
-  pthread_mutex_unlock (&md->lock);
+  for (i = 0; i < count; i++)
+    (*toc)[i] = strdup(md->entries[i].key);
+
+  md_unlock (md);
   return count;
 } /* }}} int meta_data_toc */
 
 int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 {
-  meta_entry_t *this;
-  meta_entry_t *prev;
+  int idx;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  prev = NULL;
-  this = md->head;
-  while (this != NULL)
-  {
-    if (strcasecmp (key, this->key) == 0)
-      break;
-
-    prev = this;
-    this = this->next;
-  }
+  md_lock (md);
 
-  if (this == NULL)
+  idx = md_entry_lookup (md, key, md_key_hash (key));
+  if (idx < 0)
   {
-    pthread_mutex_unlock (&md->lock);
+    md_unlock (md);
     return (-ENOENT);
   }
 
-  if (prev == NULL)
-    md->head = this->next;
-  else
-    prev->next = this->next;
-
-  pthread_mutex_unlock (&md->lock);
+  md_value_free (md, md->entries + idx);
+  memmove (md->entries + idx, md->entries + idx + 1,
+      (md->entries_num - idx - 1) * sizeof (meta_entry_t));
+  md->entries_num--;
 
-  this->next = NULL;
-  md_entry_free (this);
+  md_unlock (md);
 
   return (0);
 } /* }}} int meta_data_delete */
@@ -366,97 +530,67 @@ int meta_data_delete (meta_data_t *md, const char *key) /* {{{ */
 int meta_data_add_string (meta_data_t *md, /* {{{ */
     const char *key, const char *value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
 
   if ((md == NULL) || (key == NULL) || (value == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_string = md_strdup (value);
-  if (e->value.mv_string == NULL)
+  mv.mv_string = md_strdup (value);
+  if (mv.mv_string == NULL)
   {
     ERROR ("meta_data_add_string: md_strdup failed.");
-    md_entry_free (e);
     return (-ENOMEM);
   }
-  e->type = MD_TYPE_STRING;
 
-  return (md_entry_insert (md, e));
+  return (md_entry_set (md, key, MD_TYPE_STRING, mv));
 } /* }}} int meta_data_add_string */
 
 int meta_data_add_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_signed_int = value;
-  e->type = MD_TYPE_SIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  mv.mv_signed_int = value;
+  return (md_entry_set (md, key, MD_TYPE_SIGNED_INT, mv));
 } /* }}} int meta_data_add_signed_int */
 
 int meta_data_add_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_unsigned_int = value;
-  e->type = MD_TYPE_UNSIGNED_INT;
-
-  return (md_entry_insert (md, e));
+  mv.mv_unsigned_int = value;
+  return (md_entry_set (md, key, MD_TYPE_UNSIGNED_INT, mv));
 } /* }}} int meta_data_add_unsigned_int */
 
 int meta_data_add_double (meta_data_t *md, /* {{{ */
     const char *key, double value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_double = value;
-  e->type = MD_TYPE_DOUBLE;
-
-  return (md_entry_insert (md, e));
+  mv.mv_double = value;
+  return (md_entry_set (md, key, MD_TYPE_DOUBLE, mv));
 } /* }}} int meta_data_add_double */
 
 int meta_data_add_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
 
   if ((md == NULL) || (key == NULL))
     return (-EINVAL);
 
-  e = md_entry_alloc (key);
-  if (e == NULL)
-    return (-ENOMEM);
-
-  e->value.mv_boolean = value;
-  e->type = MD_TYPE_BOOLEAN;
-
-  return (md_entry_insert (md, e));
+  mv.mv_boolean = value;
+  return (md_entry_set (md, key, MD_TYPE_BOOLEAN, mv));
 } /* }}} int meta_data_add_boolean */
 
 /*
@@ -465,161 +599,86 @@ int meta_data_add_boolean (meta_data_t *md, /* {{{ */
 int meta_data_get_string (meta_data_t *md, /* {{{ */
     const char *key, char **value)
 {
-  meta_entry_t *e;
-  char *temp;
+  meta_value_t mv;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_STRING)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  temp = md_strdup (e->value.mv_string);
-  if (temp == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    ERROR ("meta_data_get_string: md_strdup failed.");
-    return (-ENOMEM);
-  }
- 
-  pthread_mutex_unlock (&md->lock);
-
-  *value = temp;
+  status = md_entry_get (md, key, MD_TYPE_STRING, &mv,
+      "meta_data_get_string");
+  if (status == 0)
+    *value = mv.mv_string;
 
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_string */
 
 int meta_data_get_signed_int (meta_data_t *md, /* {{{ */
     const char *key, int64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
+  status = md_entry_get (md, key, MD_TYPE_SIGNED_INT, &mv,
+      "meta_data_get_signed_int");
+  if (status == 0)
+    *value = mv.mv_signed_int;
 
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_SIGNED_INT)
-  {
-    ERROR ("meta_data_get_signed_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_signed_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_signed_int */
 
 int meta_data_get_unsigned_int (meta_data_t *md, /* {{{ */
     const char *key, uint64_t *value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_UNSIGNED_INT)
-  {
-    ERROR ("meta_data_get_unsigned_int: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_UNSIGNED_INT, &mv,
+      "meta_data_get_unsigned_int");
+  if (status == 0)
+    *value = mv.mv_unsigned_int;
 
-  *value = e->value.mv_unsigned_int;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_unsigned_int */
 
 int meta_data_get_double (meta_data_t *md, /* {{{ */
     const char *key, double *value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  if (e->type != MD_TYPE_DOUBLE)
-  {
-    ERROR ("meta_data_get_double: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_double;
+  status = md_entry_get (md, key, MD_TYPE_DOUBLE, &mv,
+      "meta_data_get_double");
+  if (status == 0)
+    *value = mv.mv_double;
 
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_double */
 
 int meta_data_get_boolean (meta_data_t *md, /* {{{ */
     const char *key, _Bool *value)
 {
-  meta_entry_t *e;
+  meta_value_t mv;
+  int status;
 
-  if ((md == NULL) || (key == NULL) || (value == NULL))
+  if (value == NULL)
     return (-EINVAL);
 
-  pthread_mutex_lock (&md->lock);
-
-  e = md_entry_lookup (md, key);
-  if (e == NULL)
-  {
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
+  status = md_entry_get (md, key, MD_TYPE_BOOLEAN, &mv,
+      "meta_data_get_boolean");
+  if (status == 0)
+    *value = mv.mv_boolean;
 
-  if (e->type != MD_TYPE_BOOLEAN)
-  {
-    ERROR ("meta_data_get_boolean: Type mismatch for key `%s'", e->key);
-    pthread_mutex_unlock (&md->lock);
-    return (-ENOENT);
-  }
-
-  *value = e->value.mv_boolean;
-
-  pthread_mutex_unlock (&md->lock);
-  return (0);
+  return (status);
 } /* }}} int meta_data_get_boolean */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
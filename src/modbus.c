@@ -36,6 +36,12 @@
 /* Assume version 2.9.2 */
 #endif
 
+/* The number of registers a single "read holding registers" request may
+ * return. */
+#ifndef MODBUS_MAX_READ_REGISTERS
+# define MODBUS_MAX_READ_REGISTERS 125
+#endif
+
 #ifndef MODBUS_TCP_DEFAULT_PORT
 # ifdef MODBUS_TCP_PORT
 #  define MODBUS_TCP_DEFAULT_PORT MODBUS_TCP_PORT
@@ -56,6 +62,7 @@
  *   Address "addr"
  *   Port "1234"
  *   Interval 60
+ *   MaxRegisterGap 0
  *
  *   <Slave 1>
  *     Instance "foobar" # optional
@@ -90,11 +97,27 @@ struct mb_data_s /* {{{ */
   mb_data_t *next;
 }; /* }}} */
 
+/* Data whose registers are read with one request. `registers' is sorted by
+ * register base. */
+struct mb_data_group_s;
+typedef struct mb_data_group_s mb_data_group_t;
+struct mb_data_group_s /* {{{ */
+{
+  mb_data_t **registers;
+  size_t registers_num;
+
+  int register_base;
+  int register_num;
+
+  mb_data_group_t *next;
+}; /* }}} */
+
 struct mb_slave_s /* {{{ */
 {
   int id;
   char instance[DATA_MAX_NAME_LEN];
   mb_data_t *collect;
+  mb_data_group_t *groups;
 }; /* }}} */
 typedef struct mb_slave_s mb_slave_t;
 
@@ -105,6 +128,9 @@ struct mb_host_s /* {{{ */
   /* char service[NI_MAXSERV]; */
   int port;
   cdtime_t interval;
+  /* Registers are read together if at most this many unused registers lie
+   * between them. Negative values disable merging. */
+  int max_register_gap;
 
   mb_slave_t *slaves;
   size_t slaves_num;
@@ -119,16 +145,6 @@ struct mb_host_s /* {{{ */
 }; /* }}} */
 typedef struct mb_host_s mb_host_t;
 
-struct mb_data_group_s;
-typedef struct mb_data_group_s mb_data_group_t;
-struct mb_data_group_s /* {{{ */
-{
-  mb_data_t *registers;
-  size_t registers_num;
-
-  mb_data_group_t *next;
-}; /* }}} */
-
 /*
  * Global variables
  */
@@ -385,17 +401,22 @@ static int mb_init_connection (mb_host_t *host) /* {{{ */
     (vt).absolute = (absolute_t) (raw); \
 } while (0)
 
-static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
-    mb_data_t *data)
+/* Returns the number of registers `data' occupies. */
+static int mb_data_register_num (const mb_data_t *data) /* {{{ */
+{
+  if ((data->register_type == REG_TYPE_INT32)
+      || (data->register_type == REG_TYPE_UINT32)
+      || (data->register_type == REG_TYPE_FLOAT))
+    return (2);
+  return (1);
+} /* }}} int mb_data_register_num */
+
+/* Converts the registers of `data', starting at `values', and submits the
+ * value. */
+static int mb_submit_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
+    mb_data_t *data, const uint16_t *values)
 {
-  uint16_t values[2];
-  int values_num;
   const data_set_t *ds;
-  int status;
-  int i;
-
-  if ((host == NULL) || (slave == NULL) || (data == NULL))
-    return (EINVAL);
 
   ds = plugin_get_ds (data->type);
   if (ds == NULL)
@@ -421,13 +442,96 @@ static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
         "is not UINT32.", data->type, DS_TYPE_TO_STRING (ds->ds[0].type));
   }
 
+  if (data->register_type == REG_TYPE_FLOAT)
+  {
+    float float_value;
+    value_t vt;
+
+    float_value = mb_register_to_float (values[0], values[1]);
+    DEBUG ("Modbus plugin: mb_submit_data: "
+        "Returned float value is %g", (double) float_value);
+
+    CAST_TO_VALUE_T (ds, vt, float_value);
+    mb_submit (host, slave, data, vt);
+  }
+  else if (data->register_type == REG_TYPE_INT32)
+  {
+    union
+    {
+      uint32_t u32;
+      int32_t  i32;
+    } v;
+    value_t vt;
+
+    v.u32 = (((uint32_t) values[0]) << 16)
+      | ((uint32_t) values[1]);
+    DEBUG ("Modbus plugin: mb_submit_data: "
+        "Returned int32 value is %"PRIi32, v.i32);
+
+    CAST_TO_VALUE_T (ds, vt, v.i32);
+    mb_submit (host, slave, data, vt);
+  }
+  else if (data->register_type == REG_TYPE_INT16)
+  {
+    union
+    {
+      uint16_t u16;
+      int16_t  i16;
+    } v;
+    value_t vt;
+
+    v.u16 = values[0];
+
+    DEBUG ("Modbus plugin: mb_submit_data: "
+        "Returned int16 value is %"PRIi16, v.i16);
+
+    CAST_TO_VALUE_T (ds, vt, v.i16);
+    mb_submit (host, slave, data, vt);
+  }
+  else if (data->register_type == REG_TYPE_UINT32)
+  {
+    uint32_t v32;
+    value_t vt;
+
+    v32 = (((uint32_t) values[0]) << 16)
+      | ((uint32_t) values[1]);
+    DEBUG ("Modbus plugin: mb_submit_data: "
+        "Returned uint32 value is %"PRIu32, v32);
+
+    CAST_TO_VALUE_T (ds, vt, v32);
+    mb_submit (host, slave, data, vt);
+  }
+  else /* if (data->register_type == REG_TYPE_UINT16) */
+  {
+    value_t vt;
+
+    DEBUG ("Modbus plugin: mb_submit_data: "
+        "Returned uint16 value is %"PRIu16, values[0]);
+
+    CAST_TO_VALUE_T (ds, vt, values[0]);
+    mb_submit (host, slave, data, vt);
+  }
+
+  return (0);
+} /* }}} int mb_submit_data */
+
+/* Reads all registers of `group' with one request and submits the values of
+ * its data. */
+static int mb_read_group (mb_host_t *host, mb_slave_t *slave, /* {{{ */
+    mb_data_group_t *group)
+{
+  uint16_t values[MODBUS_MAX_READ_REGISTERS];
+  int success;
+  int status;
+  size_t j;
+  int i;
+
+  if ((host == NULL) || (slave == NULL) || (group == NULL))
+    return (EINVAL);
+
+  assert ((group->register_num > 0)
+      && (group->register_num <= MODBUS_MAX_READ_REGISTERS));
   memset (values, 0, sizeof (values));
-  if ((data->register_type == REG_TYPE_INT32)
-      || (data->register_type == REG_TYPE_UINT32)
-      || (data->register_type == REG_TYPE_FLOAT))
-    values_num = 2;
-  else
-    values_num = 1;
 
 #if LEGACY_LIBMODBUS
   /* Version 2.0.3: Pass the connection struct as a pointer and pass the slave
@@ -448,8 +552,8 @@ static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
   for (i = 0; i < 2; i++)
   {
     status = modbus_read_registers (host->connection,
-        /* start_addr = */ data->register_base,
-        /* num_registers = */ values_num, /* buffer = */ values);
+        /* start_addr = */ group->register_base,
+        /* num_registers = */ group->register_num, /* buffer = */ values);
     if (status > 0)
       break;
 
@@ -487,89 +591,40 @@ static int mb_read_data (mb_host_t *host, mb_slave_t *slave, /* {{{ */
 
     DEBUG ("Modbus plugin: Re-established connection to %s", host->host);
 
+#if !LEGACY_LIBMODBUS
+    status = modbus_set_slave (host->connection, slave->id);
+    if (status != 0)
+    {
+      ERROR ("Modbus plugin: modbus_set_slave (%i) failed with status %i.",
+          slave->id, status);
+      return (-1);
+    }
+#endif
+
     /* try again */
     continue;
   } /* for (i = 0, 1) */
 
-  DEBUG ("Modbus plugin: mb_read_data: Success! "
+  DEBUG ("Modbus plugin: mb_read_group: Success! "
       "modbus_read_registers returned with status %i.", status);
 
-  if (data->register_type == REG_TYPE_FLOAT)
-  {
-    float float_value;
-    value_t vt;
-
-    float_value = mb_register_to_float (values[0], values[1]);
-    DEBUG ("Modbus plugin: mb_read_data: "
-        "Returned float value is %g", (double) float_value);
-
-    CAST_TO_VALUE_T (ds, vt, float_value);
-    mb_submit (host, slave, data, vt);
-  }
-  else if (data->register_type == REG_TYPE_INT32)
-  {
-    union
-    {
-      uint32_t u32;
-      int32_t  i32;
-    } v;
-    value_t vt;
-
-    v.u32 = (((uint32_t) values[0]) << 16)
-      | ((uint32_t) values[1]);
-    DEBUG ("Modbus plugin: mb_read_data: "
-        "Returned int32 value is %"PRIi32, v.i32);
-
-    CAST_TO_VALUE_T (ds, vt, v.i32);
-    mb_submit (host, slave, data, vt);
-  }
-  else if (data->register_type == REG_TYPE_INT16)
-  {
-    union
-    {
-      uint16_t u16;
-      int16_t  i16;
-    } v;
-    value_t vt;
-
-    v.u16 = values[0];
-
-    DEBUG ("Modbus plugin: mb_read_data: "
-        "Returned int16 value is %"PRIi16, v.i16);
-
-    CAST_TO_VALUE_T (ds, vt, v.i16);
-    mb_submit (host, slave, data, vt);
-  }
-  else if (data->register_type == REG_TYPE_UINT32)
-  {
-    uint32_t v32;
-    value_t vt;
-
-    v32 = (((uint32_t) values[0]) << 16)
-      | ((uint32_t) values[1]);
-    DEBUG ("Modbus plugin: mb_read_data: "
-        "Returned uint32 value is %"PRIu32, v32);
-
-    CAST_TO_VALUE_T (ds, vt, v32);
-    mb_submit (host, slave, data, vt);
-  }
-  else /* if (data->register_type == REG_TYPE_UINT16) */
+  success = 0;
+  for (j = 0; j < group->registers_num; j++)
   {
-    value_t vt;
+    mb_data_t *data = group->registers[j];
 
-    DEBUG ("Modbus plugin: mb_read_data: "
-        "Returned uint16 value is %"PRIu16, values[0]);
-
-    CAST_TO_VALUE_T (ds, vt, values[0]);
-    mb_submit (host, slave, data, vt);
+    status = mb_submit_data (host, slave, data,
+        values + (data->register_base - group->register_base));
+    if (status == 0)
+      success++;
   }
 
-  return (0);
-} /* }}} int mb_read_data */
+  return ((success > 0) ? 0 : -1);
+} /* }}} int mb_read_group */
 
 static int mb_read_slave (mb_host_t *host, mb_slave_t *slave) /* {{{ */
 {
-  mb_data_t *data;
+  mb_data_group_t *group;
   int success;
   int status;
 
@@ -577,9 +632,9 @@ static int mb_read_slave (mb_host_t *host, mb_slave_t *slave) /* {{{ */
     return (EINVAL);
 
   success = 0;
-  for (data = slave->collect; data != NULL; data = data->next)
+  for (group = slave->groups; group != NULL; group = group->next)
   {
-    status = mb_read_data (host, slave, data);
+    status = mb_read_group (host, slave, group);
     if (status == 0)
       success++;
   }
@@ -643,6 +698,19 @@ static void data_free_all (mb_data_t *data) /* {{{ */
   data_free_all (next);
 } /* }}} void data_free_all */
 
+static void groups_free_all (mb_data_group_t *group) /* {{{ */
+{
+  while (group != NULL)
+  {
+    mb_data_group_t *next = group->next;
+
+    sfree (group->registers);
+    sfree (group);
+
+    group = next;
+  }
+} /* }}} void groups_free_all */
+
 static void slaves_free_all (mb_slave_t *slaves, size_t slaves_num) /* {{{ */
 {
   size_t i;
@@ -651,7 +719,10 @@ static void slaves_free_all (mb_slave_t *slaves, size_t slaves_num) /* {{{ */
     return;
 
   for (i = 0; i < slaves_num; i++)
+  {
+    groups_free_all (slaves[i].groups);
     data_free_all (slaves[i].collect);
+  }
   sfree (slaves);
 } /* }}} void slaves_free_all */
 
@@ -862,6 +933,104 @@ static int mb_config_add_slave (mb_host_t *host, oconfig_item_t *ci) /* {{{ */
   return (status);
 } /* }}} int mb_config_add_slave */
 
+static int mb_data_compare (const void *a, const void *b) /* {{{ */
+{
+  const mb_data_t *d0 = *((mb_data_t * const *) a);
+  const mb_data_t *d1 = *((mb_data_t * const *) b);
+
+  if (d0->register_base < d1->register_base)
+    return (-1);
+  else if (d0->register_base > d1->register_base)
+    return (1);
+  return (0);
+} /* }}} int mb_data_compare */
+
+/* Merges the data of `slave' whose registers are at most `max_gap' registers
+ * apart into groups, which are read with one request of at most
+ * MODBUS_MAX_READ_REGISTERS registers each. */
+static int mb_slave_create_groups (mb_slave_t *slave, int max_gap) /* {{{ */
+{
+  mb_data_t **sorted;
+  mb_data_group_t *last = NULL;
+  mb_data_t *data;
+  size_t data_num;
+  size_t i;
+
+  data_num = 0;
+  for (data = slave->collect; data != NULL; data = data->next)
+    data_num++;
+
+  sorted = calloc (data_num, sizeof (*sorted));
+  if (sorted == NULL)
+    return (ENOMEM);
+
+  i = 0;
+  for (data = slave->collect; data != NULL; data = data->next)
+    sorted[i++] = data;
+  qsort (sorted, data_num, sizeof (*sorted), mb_data_compare);
+
+  for (i = 0; i < data_num; i++)
+  {
+    int begin = sorted[i]->register_base;
+    int end = begin + mb_data_register_num (sorted[i]);
+    mb_data_t **tmp;
+
+    if ((last != NULL) && (max_gap >= 0)
+        && (begin <= last->register_base + last->register_num + max_gap)
+        && (((end > last->register_base + last->register_num)
+            ? end : last->register_base + last->register_num)
+          - last->register_base <= MODBUS_MAX_READ_REGISTERS))
+    {
+      tmp = realloc (last->registers,
+          (last->registers_num + 1) * sizeof (*tmp));
+      if (tmp == NULL)
+      {
+        sfree (sorted);
+        return (ENOMEM);
+      }
+      last->registers = tmp;
+      last->registers[last->registers_num] = sorted[i];
+      last->registers_num++;
+      if (end > last->register_base + last->register_num)
+        last->register_num = end - last->register_base;
+      continue;
+    }
+
+    tmp = malloc (sizeof (*tmp));
+    if (tmp == NULL)
+    {
+      sfree (sorted);
+      return (ENOMEM);
+    }
+    tmp[0] = sorted[i];
+
+    if (last == NULL)
+    {
+      slave->groups = calloc (1, sizeof (*slave->groups));
+      last = slave->groups;
+    }
+    else
+    {
+      last->next = calloc (1, sizeof (*last->next));
+      last = last->next;
+    }
+    if (last == NULL)
+    {
+      sfree (tmp);
+      sfree (sorted);
+      return (ENOMEM);
+    }
+
+    last->registers = tmp;
+    last->registers_num = 1;
+    last->register_base = begin;
+    last->register_num = end - begin;
+  }
+
+  sfree (sorted);
+  return (0);
+} /* }}} int mb_slave_create_groups */
+
 static int mb_config_add_host (oconfig_item_t *ci) /* {{{ */
 {
   mb_host_t *host;
@@ -900,6 +1069,8 @@ static int mb_config_add_host (oconfig_item_t *ci) /* {{{ */
     }
     else if (strcasecmp ("Interval", child->key) == 0)
       status = cf_util_get_cdtime (child, &host->interval);
+    else if (strcasecmp ("MaxRegisterGap", child->key) == 0)
+      status = cf_util_get_int (child, &host->max_register_gap);
     else if (strcasecmp ("Slave", child->key) == 0)
       /* Don't set status: Gracefully continue if a slave fails. */
       mb_config_add_slave (host, child);
@@ -921,6 +1092,17 @@ static int mb_config_add_host (oconfig_item_t *ci) /* {{{ */
     status = -1;
   }
 
+  /* The slaves are grouped once all options, which may follow the Slave
+   * blocks, have been read. */
+  for (i = 0; (status == 0) && (i < (int) host->slaves_num); i++)
+  {
+    status = mb_slave_create_groups (host->slaves + i,
+        host->max_register_gap);
+    if (status != 0)
+      ERROR ("Modbus plugin: Grouping the registers of host \"%s\" "
+          "failed.", host->host);
+  }
+
   if (status == 0)
   {
     user_data_t ud;
@@ -31,11 +31,14 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_hashtable.h"
 
 #ifdef HAVE_MYSQL_H
 #include <mysql.h>
+#include <errmsg.h>
 #elif defined(HAVE_MYSQL_MYSQL_H)
 #include <mysql/mysql.h>
+#include <mysql/errmsg.h>
 #endif
 
 /* TODO: Understand `Select_*' and possibly do that stuff as well.. */
@@ -59,9 +62,51 @@ struct mysql_database_s /* {{{ */
 
 	MYSQL *con;
 	int    state;
+
+	/* Maps the names of the status variables to `mysql_status_var_t's. */
+	c_hashtable_t *status_vars;
 };
 typedef struct mysql_database_s mysql_database_t; /* }}} */
 
+/* What is done with the value of a status variable. */
+enum mysql_status_target_e
+{
+	MYSQL_STATUS_IGNORE,
+	MYSQL_STATUS_COMMANDS,
+	MYSQL_STATUS_HANDLER,
+	MYSQL_STATUS_LOCKS,
+	MYSQL_STATUS_QCACHE_HITS,
+	MYSQL_STATUS_QCACHE_INSERTS,
+	MYSQL_STATUS_QCACHE_NOT_CACHED,
+	MYSQL_STATUS_QCACHE_PRUNES,
+	MYSQL_STATUS_QCACHE_QUERIES,
+	MYSQL_STATUS_BYTES_RECEIVED,
+	MYSQL_STATUS_BYTES_SENT,
+	MYSQL_STATUS_THREADS_RUNNING,
+	MYSQL_STATUS_THREADS_CONNECTED,
+	MYSQL_STATUS_THREADS_CACHED,
+	MYSQL_STATUS_THREADS_CREATED
+};
+
+/* The classification of a status variable, looked up by its name rather than
+ * comparing the name to all known prefixes and names for every row. */
+struct mysql_status_var_s
+{
+	char *name;
+	enum mysql_status_target_e target;
+	/* Points into `name', behind the prefix. */
+	const char *type_instance;
+};
+typedef struct mysql_status_var_s mysql_status_var_t;
+
+/* The statements sent in one round trip by `mysql_read'. */
+enum mysql_statement_e
+{
+	MYSQL_STATEMENT_STATUS,
+	MYSQL_STATEMENT_MASTER,
+	MYSQL_STATEMENT_SLAVE
+};
+
 static int mysql_read (user_data_t *ud);
 
 static void mysql_database_free (void *arg) /* {{{ */
@@ -78,6 +123,20 @@ static void mysql_database_free (void *arg) /* {{{ */
 	if (db->con != NULL)
 		mysql_close (db->con);
 
+	if (db->status_vars != NULL)
+	{
+		void *key;
+		mysql_status_var_t *sv;
+
+		while (c_hashtable_pick (db->status_vars, &key,
+					(void *) &sv) == 0)
+		{
+			sfree (sv->name);
+			sfree (sv);
+		}
+		c_hashtable_destroy (db->status_vars);
+	}
+
 	sfree (db->host);
 	sfree (db->user);
 	sfree (db->pass);
@@ -179,6 +238,17 @@ static int mysql_config_database (oconfig_item_t *ci) /* {{{ */
 			break;
 	}
 
+	if (status == 0)
+	{
+		db->status_vars = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (db->status_vars == NULL)
+		{
+			ERROR ("mysql plugin: c_hashtable_create failed.");
+			status = -1;
+		}
+	}
+
 	/* If all went well, register this database for reading */
 	if (status == 0)
 	{
@@ -235,36 +305,32 @@ static int mysql_config (oconfig_item_t *ci) /* {{{ */
 
 /* }}} End of configuration handling functions */
 
+/* Returns the connection of the database, connecting first if it is not
+ * established. The connection is not checked with `mysql_ping', which would
+ * cost a round trip for every read: `mysql_read' reconnects if a query fails
+ * because the connection has been lost. */
 static MYSQL *getconnection (mysql_database_t *db)
 {
 	if (db->state != 0)
+		return (db->con);
+
+	if (db->con != NULL)
 	{
-		int err;
-		if ((err = mysql_ping (db->con)) != 0)
-		{
-			/* Assured by "mysql_config_database" */
-			assert (db->instance != NULL);
-			WARNING ("mysql_ping failed for instance \"%s\": %s",
-					db->instance,
-					mysql_error (db->con));
-			db->state = 0;
-		}
-		else
-		{
-			db->state = 1;
-			return (db->con);
-		}
+		mysql_close (db->con);
+		db->con = NULL;
 	}
 
-	if ((db->con = mysql_init (db->con)) == NULL)
+	if ((db->con = mysql_init (NULL)) == NULL)
 	{
-		ERROR ("mysql_init failed: %s", mysql_error (db->con));
+		ERROR ("mysql_init failed.");
 		db->state = 0;
 		return (NULL);
 	}
 
+	/* All statements of a read are sent at once. */
 	if (mysql_real_connect (db->con, db->host, db->user, db->pass,
-				db->database, db->port, db->socket, 0) == NULL)
+				db->database, db->port, db->socket,
+				CLIENT_MULTI_STATEMENTS) == NULL)
 	{
 		ERROR ("mysql plugin: Failed to connect to database %s "
 				"at server %s: %s",
@@ -357,47 +423,14 @@ static void traffic_submit (derive_t rx, derive_t tx, mysql_database_t *db)
 	submit ("mysql_octets", NULL, values, STATIC_ARRAY_SIZE (values), db);
 } /* void traffic_submit */
 
-static MYSQL_RES *exec_query (MYSQL *con, const char *query)
+static int mysql_read_master_stats (mysql_database_t *db, MYSQL_RES *res)
 {
-	MYSQL_RES *res;
-
-	int query_len = strlen (query);
-
-	if (mysql_real_query (con, query, query_len))
-	{
-		ERROR ("mysql plugin: Failed to execute query: %s",
-				mysql_error (con));
-		INFO ("mysql plugin: SQL query was: %s", query);
-		return (NULL);
-	}
-
-	res = mysql_store_result (con);
-	if (res == NULL)
-	{
-		ERROR ("mysql plugin: Failed to store query result: %s",
-				mysql_error (con));
-		INFO ("mysql plugin: SQL query was: %s", query);
-		return (NULL);
-	}
-
-	return (res);
-} /* exec_query */
-
-static int mysql_read_master_stats (mysql_database_t *db, MYSQL *con)
-{
-	MYSQL_RES *res;
 	MYSQL_ROW  row;
 
-	char *query;
+	const char *query = "SHOW MASTER STATUS";
 	int   field_num;
 	unsigned long long position;
 
-	query = "SHOW MASTER STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
-
 	row = mysql_fetch_row (res);
 	if (row == NULL)
 	{
@@ -422,17 +455,14 @@ static int mysql_read_master_stats (mysql_database_t *db, MYSQL *con)
 		WARNING ("mysql plugin: `%s' returned more than one row - "
 				"ignoring further results.", query);
 
-	mysql_free_result (res);
-
 	return (0);
 } /* mysql_read_master_stats */
 
-static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
+static int mysql_read_slave_stats (mysql_database_t *db, MYSQL_RES *res)
 {
-	MYSQL_RES *res;
 	MYSQL_ROW  row;
 
-	char *query;
+	const char *query = "SHOW SLAVE STATUS";
 	int   field_num;
 
 	/* WTF? libmysqlclient does not seem to provide any means to
@@ -443,12 +473,6 @@ static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
 	const int EXEC_MASTER_LOG_POS_IDX   = 21;
 	const int SECONDS_BEHIND_MASTER_IDX = 32;
 
-	query = "SHOW SLAVE STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
-
 	row = mysql_fetch_row (res);
 	if (row == NULL)
 	{
@@ -543,18 +567,100 @@ static int mysql_read_slave_stats (mysql_database_t *db, MYSQL *con)
 		WARNING ("mysql plugin: `%s' returned more than one row - "
 				"ignoring further results.", query);
 
-	mysql_free_result (res);
-
 	return (0);
 } /* mysql_read_slave_stats */
 
-static int mysql_read (user_data_t *ud)
+/* Classifies the status variable `name' like the plugin always did, by its
+ * prefix and name. This is done once per name and database, the result is
+ * kept in `db->status_vars'. */
+static mysql_status_var_t *mysql_status_var_get (mysql_database_t *db,
+		const char *name)
+{
+	struct
+	{
+		const char *name;
+		enum mysql_status_target_e target;
+	} prefixes[] =
+	{
+		{ "Com_",         MYSQL_STATUS_COMMANDS },
+		{ "Handler_",     MYSQL_STATUS_HANDLER },
+		{ "Table_locks_", MYSQL_STATUS_LOCKS }
+	}, names[] =
+	{
+		{ "Qcache_hits",             MYSQL_STATUS_QCACHE_HITS },
+		{ "Qcache_inserts",          MYSQL_STATUS_QCACHE_INSERTS },
+		{ "Qcache_not_cached",       MYSQL_STATUS_QCACHE_NOT_CACHED },
+		{ "Qcache_lowmem_prunes",    MYSQL_STATUS_QCACHE_PRUNES },
+		{ "Qcache_queries_in_cache", MYSQL_STATUS_QCACHE_QUERIES },
+		{ "Bytes_received",          MYSQL_STATUS_BYTES_RECEIVED },
+		{ "Bytes_sent",              MYSQL_STATUS_BYTES_SENT },
+		{ "Threads_running",         MYSQL_STATUS_THREADS_RUNNING },
+		{ "Threads_connected",       MYSQL_STATUS_THREADS_CONNECTED },
+		{ "Threads_cached",          MYSQL_STATUS_THREADS_CACHED },
+		{ "Threads_created",         MYSQL_STATUS_THREADS_CREATED }
+	};
+	mysql_status_var_t *sv;
+	size_t i;
+
+	if (c_hashtable_get (db->status_vars, name, (void *) &sv) == 0)
+		return (sv);
+
+	sv = malloc (sizeof (*sv));
+	if (sv == NULL)
+	{
+		ERROR ("mysql plugin: malloc failed.");
+		return (NULL);
+	}
+	sv->name = strdup (name);
+	if (sv->name == NULL)
+	{
+		ERROR ("mysql plugin: strdup failed.");
+		sfree (sv);
+		return (NULL);
+	}
+	sv->target = MYSQL_STATUS_IGNORE;
+	sv->type_instance = sv->name;
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (prefixes); i++)
+	{
+		size_t len = strlen (prefixes[i].name);
+
+		if (strncmp (name, prefixes[i].name, len) != 0)
+			continue;
+
+		sv->target = prefixes[i].target;
+		sv->type_instance = sv->name + len;
+		break;
+	}
+
+	/* Ignore `prepared statements' */
+	if ((sv->target == MYSQL_STATUS_COMMANDS)
+			&& (strncmp (name, "Com_stmt_", strlen ("Com_stmt_")) == 0))
+		sv->target = MYSQL_STATUS_IGNORE;
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (names); i++)
+	{
+		if (strcmp (name, names[i].name) != 0)
+			continue;
+
+		sv->target = names[i].target;
+		break;
+	}
+
+	if (c_hashtable_insert (db->status_vars, sv->name, sv) != 0)
+	{
+		ERROR ("mysql plugin: c_hashtable_insert failed.");
+		sfree (sv->name);
+		sfree (sv);
+		return (NULL);
+	}
+
+	return (sv);
+} /* mysql_status_var_t *mysql_status_var_get */
+
+static int mysql_read_status (mysql_database_t *db, MYSQL_RES *res)
 {
-	mysql_database_t *db;
-	MYSQL     *con;
-	MYSQL_RES *res;
 	MYSQL_ROW  row;
-	char      *query;
 
 	derive_t qcache_hits          = 0;
 	derive_t qcache_inserts       = 0;
@@ -570,99 +676,73 @@ static int mysql_read (user_data_t *ud)
 	unsigned long long traffic_incoming = 0ULL;
 	unsigned long long traffic_outgoing = 0ULL;
 
-	if ((ud == NULL) || (ud->data == NULL))
-	{
-		ERROR ("mysql plugin: mysql_database_read: Invalid user data.");
-		return (-1);
-	}
-
-	db = (mysql_database_t *) ud->data;
-
-	/* An error message will have been printed in this case */
-	if ((con = getconnection (db)) == NULL)
-		return (-1);
-
-	query = "SHOW STATUS";
-	if (mysql_get_server_version (con) >= 50002)
-		query = "SHOW GLOBAL STATUS";
-
-	res = exec_query (con, query);
-	if (res == NULL)
-		return (-1);
-
 	while ((row = mysql_fetch_row (res)))
 	{
-		char *key;
+		mysql_status_var_t *sv;
 		unsigned long long val;
 
-		key = row[0];
-		val = atoll (row[1]);
+		if ((row[0] == NULL) || (row[1] == NULL))
+			continue;
 
-		if (strncmp (key, "Com_", 
-			          strlen ("Com_")) == 0)
-		{
-			if (val == 0ULL)
-				continue;
-
-			/* Ignore `prepared statements' */
-			if (strncmp (key, "Com_stmt_", strlen ("Com_stmt_")) != 0)
-				counter_submit ("mysql_commands", 
-						key + strlen ("Com_"), 
-						val, db);
-		}
-		else if (strncmp (key, "Handler_", 
-				        strlen ("Handler_")) == 0)
-		{
-			if (val == 0ULL)
-				continue;
+		sv = mysql_status_var_get (db, row[0]);
+		if ((sv == NULL) || (sv->target == MYSQL_STATUS_IGNORE))
+			continue;
 
-			counter_submit ("mysql_handler", 
-					key + strlen ("Handler_"), 
-					val, db);
-		}
-		else if (strncmp (key, "Qcache_",
-       				        strlen ("Qcache_")) == 0)
+		val = atoll (row[1]);
+
+		switch (sv->target)
 		{
-			if (strcmp (key, "Qcache_hits") == 0)
+			case MYSQL_STATUS_COMMANDS:
+				if (val != 0ULL)
+					counter_submit ("mysql_commands",
+							sv->type_instance, val, db);
+				break;
+			case MYSQL_STATUS_HANDLER:
+				if (val != 0ULL)
+					counter_submit ("mysql_handler",
+							sv->type_instance, val, db);
+				break;
+			case MYSQL_STATUS_LOCKS:
+				counter_submit ("mysql_locks",
+						sv->type_instance, val, db);
+				break;
+			case MYSQL_STATUS_QCACHE_HITS:
 				qcache_hits = (derive_t) val;
-			else if (strcmp (key, "Qcache_inserts") == 0)
+				break;
+			case MYSQL_STATUS_QCACHE_INSERTS:
 				qcache_inserts = (derive_t) val;
-			else if (strcmp (key, "Qcache_not_cached") == 0)
+				break;
+			case MYSQL_STATUS_QCACHE_NOT_CACHED:
 				qcache_not_cached = (derive_t) val;
-			else if (strcmp (key, "Qcache_lowmem_prunes") == 0)
+				break;
+			case MYSQL_STATUS_QCACHE_PRUNES:
 				qcache_lowmem_prunes = (derive_t) val;
-			else if (strcmp (key, "Qcache_queries_in_cache") == 0)
+				break;
+			case MYSQL_STATUS_QCACHE_QUERIES:
 				qcache_queries_in_cache = (gauge_t) val;
-		}
-		else if (strncmp (key, "Bytes_", 
-				        strlen ("Bytes_")) == 0)
-		{
-			if (strcmp (key, "Bytes_received") == 0)
+				break;
+			case MYSQL_STATUS_BYTES_RECEIVED:
 				traffic_incoming += val;
-			else if (strcmp (key, "Bytes_sent") == 0)
+				break;
+			case MYSQL_STATUS_BYTES_SENT:
 				traffic_outgoing += val;
-		}
-		else if (strncmp (key, "Threads_", 
-       				        strlen ("Threads_")) == 0)
-		{
-			if (strcmp (key, "Threads_running") == 0)
+				break;
+			case MYSQL_STATUS_THREADS_RUNNING:
 				threads_running = (gauge_t) val;
-			else if (strcmp (key, "Threads_connected") == 0)
+				break;
+			case MYSQL_STATUS_THREADS_CONNECTED:
 				threads_connected = (gauge_t) val;
-			else if (strcmp (key, "Threads_cached") == 0)
+				break;
+			case MYSQL_STATUS_THREADS_CACHED:
 				threads_cached = (gauge_t) val;
-			else if (strcmp (key, "Threads_created") == 0)
+				break;
+			case MYSQL_STATUS_THREADS_CREATED:
 				threads_created = (derive_t) val;
-		}
-		else if (strncmp (key, "Table_locks_",
-					strlen ("Table_locks_")) == 0)
-		{
-			counter_submit ("mysql_locks",
-					key + strlen ("Table_locks_"),
-					val, db);
+				break;
+			case MYSQL_STATUS_IGNORE:
+				break;
 		}
 	}
-	mysql_free_result (res); res = NULL;
 
 	if ((qcache_hits != 0)
 			|| (qcache_inserts != 0)
@@ -697,11 +777,116 @@ static int mysql_read (user_data_t *ud)
 
 	traffic_submit  (traffic_incoming, traffic_outgoing, db);
 
+	return (0);
+} /* int mysql_read_status */
+
+static int mysql_read (user_data_t *ud)
+{
+	mysql_database_t *db;
+	MYSQL     *con;
+	char       query[128];
+	enum mysql_statement_e statements[3];
+	size_t     statements_num = 0;
+	size_t     i;
+	int        status;
+
+	if ((ud == NULL) || (ud->data == NULL))
+	{
+		ERROR ("mysql plugin: mysql_database_read: Invalid user data.");
+		return (-1);
+	}
+
+	db = (mysql_database_t *) ud->data;
+
+	/* An error message will have been printed in this case */
+	if ((con = getconnection (db)) == NULL)
+		return (-1);
+
+	/* Send all statements at once, so a read costs one round trip. If
+	 * one of them fails, the server does not execute the following ones,
+	 * so the status, which needs no privileges, comes first. */
+	sstrncpy (query, (mysql_get_server_version (con) >= 50002)
+			? "SHOW GLOBAL STATUS" : "SHOW STATUS", sizeof (query));
+	statements[statements_num++] = MYSQL_STATEMENT_STATUS;
+
 	if (db->master_stats)
-		mysql_read_master_stats (db, con);
+	{
+		strncat (query, "; SHOW MASTER STATUS",
+				sizeof (query) - strlen (query) - 1);
+		statements[statements_num++] = MYSQL_STATEMENT_MASTER;
+	}
 
 	if ((db->slave_stats) || (db->slave_notif))
-		mysql_read_slave_stats (db, con);
+	{
+		strncat (query, "; SHOW SLAVE STATUS",
+				sizeof (query) - strlen (query) - 1);
+		statements[statements_num++] = MYSQL_STATEMENT_SLAVE;
+	}
+
+	status = mysql_real_query (con, query, strlen (query));
+	if ((status != 0) && ((mysql_errno (con) == CR_SERVER_GONE_ERROR)
+				|| (mysql_errno (con) == CR_SERVER_LOST)))
+	{
+		/* The server closed the idle connection or was restarted:
+		 * reconnect and try once more. */
+		WARNING ("mysql plugin: Lost the connection of instance "
+				"\"%s\": %s. Reconnecting.",
+				db->instance, mysql_error (con));
+		db->state = 0;
+		if ((con = getconnection (db)) == NULL)
+			return (-1);
+		status = mysql_real_query (con, query, strlen (query));
+	}
+
+	if (status != 0)
+	{
+		ERROR ("mysql plugin: Failed to execute query: %s",
+				mysql_error (con));
+		INFO ("mysql plugin: SQL query was: %s", query);
+		/* Errors of the client library, as opposed to those of the
+		 * server, mean that the connection is unusable. */
+		if (mysql_errno (con) >= CR_MIN_ERROR)
+			db->state = 0;
+		return (-1);
+	}
+
+	/* All results have to be fetched before the next query. */
+	i = 0;
+	do
+	{
+		MYSQL_RES *res;
+
+		res = mysql_store_result (con);
+		if (res == NULL)
+		{
+			if (mysql_field_count (con) != 0)
+				ERROR ("mysql plugin: Failed to store query "
+						"result: %s", mysql_error (con));
+		}
+		else if (i < statements_num)
+		{
+			if (statements[i] == MYSQL_STATEMENT_STATUS)
+				mysql_read_status (db, res);
+			else if (statements[i] == MYSQL_STATEMENT_MASTER)
+				mysql_read_master_stats (db, res);
+			else
+				mysql_read_slave_stats (db, res);
+		}
+
+		if (res != NULL)
+			mysql_free_result (res);
+		i++;
+	}
+	while ((status = mysql_next_result (con)) == 0);
+
+	if (status > 0)
+	{
+		ERROR ("mysql plugin: Failed to execute query: %s",
+				mysql_error (con));
+		INFO ("mysql plugin: SQL query was: %s", query);
+		if (mysql_errno (con) >= CR_MIN_ERROR)
+			db->state = 0;
+	}
 
 	return (0);
 } /* int mysql_read */
@@ -27,6 +27,9 @@
 #include "collectd.h"
 #include "common.h"
 #include "utils_ignorelist.h"
+#include "utils_hashtable.h"
+
+#include <pthread.h>
 
 #include <netapp_api.h>
 #include <netapp_errno.h>
@@ -118,6 +121,7 @@ typedef struct {
 	cna_interval_t interval;
 	na_elem_t *query;
 	disk_t *disks;
+	c_hashtable_t *disks_by_name;
 } cfg_disk_t;
 /* }}} cfg_disk_t */
 
@@ -174,6 +178,8 @@ typedef struct {
 	ignorelist_t *il_latency;
 
 	data_volume_perf_t *volumes;
+	data_volume_perf_t *volumes_last;
+	c_hashtable_t *volumes_by_name;
 } cfg_volume_perf_t;
 /* }}} data_volume_perf_t */
 
@@ -216,6 +222,8 @@ typedef struct {
 	ignorelist_t *il_snapshot;
 
 	data_volume_usage_t *volumes;
+	data_volume_usage_t *volumes_last;
+	c_hashtable_t *volumes_by_name;
 } cfg_volume_usage_t;
 /* }}} cfg_volume_usage_t */
 
@@ -235,6 +243,15 @@ typedef struct {
 } cfg_system_t;
 /* }}} cfg_system_t */
 
+/* The sections of a host are queried in parallel, each over a connection of
+ * its own. */
+#define CNA_QUERY_WAFL         0
+#define CNA_QUERY_DISK         1
+#define CNA_QUERY_VOLUME_PERF  2
+#define CNA_QUERY_VOLUME_USAGE 3
+#define CNA_QUERY_SYSTEM       4
+#define CNA_QUERY_NUM          5
+
 struct host_config_s {
 	char *name;
 	na_server_transport_t protocol;
@@ -244,7 +261,7 @@ struct host_config_s {
 	char *password;
 	cdtime_t interval;
 
-	na_server_t *srv;
+	na_server_t *srv[CNA_QUERY_NUM];
 	cfg_wafl_t *cfg_wafl;
 	cfg_disk_t *cfg_disk;
 	cfg_volume_perf_t *cfg_volume_perf;
@@ -293,6 +310,8 @@ static void free_cfg_disk (cfg_disk_t *cfg_disk) /* {{{ */
 	if (cfg_disk->query != NULL)
 		na_elem_free (cfg_disk->query);
 
+	if (cfg_disk->disks_by_name != NULL)
+		c_hashtable_destroy (cfg_disk->disks_by_name);
 	free_disk (cfg_disk->disks);
 	sfree (cfg_disk);
 } /* }}} void free_cfg_disk */
@@ -309,6 +328,9 @@ static void free_cfg_volume_perf (cfg_volume_perf_t *cvp) /* {{{ */
 	ignorelist_free (cvp->il_operations);
 	ignorelist_free (cvp->il_latency);
 
+	if (cvp->volumes_by_name != NULL)
+		c_hashtable_destroy (cvp->volumes_by_name);
+
 	/* Free the linked list of volumes */
 	data = cvp->volumes;
 	while (data != NULL)
@@ -336,6 +358,9 @@ static void free_cfg_volume_usage (cfg_volume_usage_t *cvu) /* {{{ */
 	ignorelist_free (cvu->il_capacity);
 	ignorelist_free (cvu->il_snapshot);
 
+	if (cvu->volumes_by_name != NULL)
+		c_hashtable_destroy (cvu->volumes_by_name);
+
 	/* Free the linked list of volumes */
 	data = cvu->volumes;
 	while (data != NULL)
@@ -368,6 +393,7 @@ static void free_cfg_system (cfg_system_t *cs) /* {{{ */
 static void free_host_config (host_config_t *hc) /* {{{ */
 {
 	host_config_t *next;
+	int i;
 
 	if (hc == NULL)
 		return;
@@ -385,8 +411,9 @@ static void free_host_config (host_config_t *hc) /* {{{ */
 	free_cfg_volume_usage (hc->cfg_volume_usage);
 	free_cfg_system (hc->cfg_system);
 
-	if (hc->srv != NULL)
-		na_server_close (hc->srv);
+	for (i = 0; i < CNA_QUERY_NUM; i++)
+		if (hc->srv[i] != NULL)
+			na_server_close (hc->srv[i]);
 
 	sfree (hc);
 
@@ -405,11 +432,16 @@ static disk_t *get_disk(cfg_disk_t *cd, const char *name) /* {{{ */
 	if ((cd == NULL) || (name == NULL))
 		return (NULL);
 
-	for (d = cd->disks; d != NULL; d = d->next) {
-		if (strcmp(d->name, name) == 0)
-			return d;
+	if (cd->disks_by_name == NULL) {
+		cd->disks_by_name = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (cd->disks_by_name == NULL)
+			return (NULL);
 	}
 
+	if (c_hashtable_get (cd->disks_by_name, name, (void *) &d) == 0)
+		return (d);
+
 	d = malloc(sizeof(*d));
 	if (d == NULL)
 		return (NULL);
@@ -422,6 +454,12 @@ static disk_t *get_disk(cfg_disk_t *cd, const char *name) /* {{{ */
 		return (NULL);
 	}
 
+	if (c_hashtable_insert (cd->disks_by_name, d->name, d) != 0) {
+		sfree (d->name);
+		sfree (d);
+		return (NULL);
+	}
+
 	d->next = cd->disks;
 	cd->disks = d;
 
@@ -431,7 +469,6 @@ static disk_t *get_disk(cfg_disk_t *cd, const char *name) /* {{{ */
 static data_volume_usage_t *get_volume_usage (cfg_volume_usage_t *cvu, /* {{{ */
 		const char *name)
 {
-	data_volume_usage_t *last;
 	data_volume_usage_t *new;
 
 	int ignore_capacity = 0;
@@ -440,18 +477,17 @@ static data_volume_usage_t *get_volume_usage (cfg_volume_usage_t *cvu, /* {{{ */
 	if ((cvu == NULL) || (name == NULL))
 		return (NULL);
 
-	last = cvu->volumes;
-	while (last != NULL)
+	if (cvu->volumes_by_name == NULL)
 	{
-		if (strcmp (last->name, name) == 0)
-			return (last);
-
-		if (last->next == NULL)
-			break;
-
-		last = last->next;
+		cvu->volumes_by_name = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (cvu->volumes_by_name == NULL)
+			return (NULL);
 	}
 
+	if (c_hashtable_get (cvu->volumes_by_name, name, (void *) &new) == 0)
+		return (new);
+
 	/* Check the ignorelists. If *both* tell us to ignore a volume, return NULL. */
 	ignore_capacity = ignorelist_match (cvu->il_capacity, name);
 	ignore_snapshot = ignorelist_match (cvu->il_snapshot, name);
@@ -472,6 +508,13 @@ static data_volume_usage_t *get_volume_usage (cfg_volume_usage_t *cvu, /* {{{ */
 		return (NULL);
 	}
 
+	if (c_hashtable_insert (cvu->volumes_by_name, new->name, new) != 0)
+	{
+		sfree (new->name);
+		sfree (new);
+		return (NULL);
+	}
+
 	if (ignore_capacity == 0)
 		new->flags |= CFG_VOLUME_USAGE_DF;
 	if (ignore_snapshot == 0) {
@@ -483,11 +526,12 @@ static data_volume_usage_t *get_volume_usage (cfg_volume_usage_t *cvu, /* {{{ */
 		new->snap_query = NULL;
 	}
 
-	/* Add to end of list. */
-	if (last == NULL)
+	/* Add to the list, which keeps the order the volumes are submitted in. */
+	if (cvu->volumes_last == NULL)
 		cvu->volumes = new;
 	else
-		last->next = new;
+		cvu->volumes_last->next = new;
+	cvu->volumes_last = new;
 
 	return (new);
 } /* }}} data_volume_usage_t *get_volume_usage */
@@ -495,7 +539,6 @@ static data_volume_usage_t *get_volume_usage (cfg_volume_usage_t *cvu, /* {{{ */
 static data_volume_perf_t *get_volume_perf (cfg_volume_perf_t *cvp, /* {{{ */
 		const char *name)
 {
-	data_volume_perf_t *last;
 	data_volume_perf_t *new;
 
 	int ignore_octets = 0;
@@ -505,18 +548,17 @@ static data_volume_perf_t *get_volume_perf (cfg_volume_perf_t *cvp, /* {{{ */
 	if ((cvp == NULL) || (name == NULL))
 		return (NULL);
 
-	last = cvp->volumes;
-	while (last != NULL)
+	if (cvp->volumes_by_name == NULL)
 	{
-		if (strcmp (last->name, name) == 0)
-			return (last);
-
-		if (last->next == NULL)
-			break;
-
-		last = last->next;
+		cvp->volumes_by_name = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (cvp->volumes_by_name == NULL)
+			return (NULL);
 	}
 
+	if (c_hashtable_get (cvp->volumes_by_name, name, (void *) &new) == 0)
+		return (new);
+
 	/* Check the ignorelists. If *all three* tell us to ignore a volume, return
 	 * NULL. */
 	ignore_octets = ignorelist_match (cvp->il_octets, name);
@@ -540,6 +582,13 @@ static data_volume_perf_t *get_volume_perf (cfg_volume_perf_t *cvp, /* {{{ */
 		return (NULL);
 	}
 
+	if (c_hashtable_insert (cvp->volumes_by_name, new->name, new) != 0)
+	{
+		sfree (new->name);
+		sfree (new);
+		return (NULL);
+	}
+
 	if (ignore_octets == 0)
 		new->flags |= CFG_VOLUME_PERF_IO;
 	if (ignore_operations == 0)
@@ -547,11 +596,12 @@ static data_volume_perf_t *get_volume_perf (cfg_volume_perf_t *cvp, /* {{{ */
 	if (ignore_latency == 0)
 		new->flags |= CFG_VOLUME_PERF_LATENCY;
 
-	/* Add to end of list. */
-	if (last == NULL)
+	/* Add to the list, which keeps the order the volumes are submitted in. */
+	if (cvp->volumes_last == NULL)
 		cvp->volumes = new;
 	else
-		last->next = new;
+		cvp->volumes_last->next = new;
+	cvp->volumes_last = new;
 
 	return (new);
 } /* }}} data_volume_perf_t *get_volume_perf */
@@ -958,7 +1008,7 @@ static int cna_setup_wafl (cfg_wafl_t *cw) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_wafl */
 
-static int cna_query_wafl (host_config_t *host) /* {{{ */
+static int cna_query_wafl (host_config_t *host, na_server_t *srv) /* {{{ */
 {
 	na_elem_t *data;
 	int status;
@@ -980,7 +1030,7 @@ static int cna_query_wafl (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_wafl->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_wafl->query);
+	data = na_server_invoke_elem(srv, host->cfg_wafl->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_wafl: na_server_invoke_elem failed for host %s: %s",
@@ -1152,7 +1202,7 @@ static int cna_setup_disk (cfg_disk_t *cd) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_disk */
 
-static int cna_query_disk (host_config_t *host) /* {{{ */
+static int cna_query_disk (host_config_t *host, na_server_t *srv) /* {{{ */
 {
 	na_elem_t *data;
 	int status;
@@ -1175,7 +1225,7 @@ static int cna_query_disk (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_disk->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_disk->query);
+	data = na_server_invoke_elem(srv, host->cfg_disk->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_disk: na_server_invoke_elem failed for host %s: %s",
@@ -1323,7 +1373,7 @@ static int cna_setup_volume_perf (cfg_volume_perf_t *cd) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_volume_perf */
 
-static int cna_query_volume_perf (host_config_t *host) /* {{{ */
+static int cna_query_volume_perf (host_config_t *host, na_server_t *srv) /* {{{ */
 {
 	na_elem_t *data;
 	int status;
@@ -1346,7 +1396,7 @@ static int cna_query_volume_perf (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_volume_perf->query != NULL);
 
-	data = na_server_invoke_elem (host->srv, host->cfg_volume_perf->query);
+	data = na_server_invoke_elem (srv, host->cfg_volume_perf->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_volume_perf: na_server_invoke_elem failed for host %s: %s",
@@ -1455,7 +1505,7 @@ static int cna_change_volume_status (const char *hostname, /* {{{ */
 {
 	notification_t n;
 
-	memset (&n, 0, sizeof (&n));
+	memset (&n, 0, sizeof (n));
 	n.time = cdtime ();
 	sstrncpy (n.host, hostname, sizeof (n.host));
 	sstrncpy (n.plugin, "netapp", sizeof (n.plugin));
@@ -1477,13 +1527,13 @@ static int cna_change_volume_status (const char *hostname, /* {{{ */
 } /* }}} int cna_change_volume_status */
 
 static void cna_handle_volume_snap_usage(const host_config_t *host, /* {{{ */
-		data_volume_usage_t *v)
+		na_server_t *srv, data_volume_usage_t *v)
 {
 	uint64_t snap_used = 0, value;
 	na_elem_t *data, *elem_snap, *elem_snapshots;
 	na_elem_iter_t iter_snap;
 
-	data = na_server_invoke_elem(host->srv, v->snap_query);
+	data = na_server_invoke_elem(srv, v->snap_query);
 	if (na_results_status(data) != NA_OK)
 	{
 		if (na_results_errno(data) == EVOLUMEOFFLINE) {
@@ -1530,7 +1580,7 @@ static void cna_handle_volume_snap_usage(const host_config_t *host, /* {{{ */
 } /* }}} void cna_handle_volume_snap_usage */
 
 static int cna_handle_volume_usage_data (const host_config_t *host, /* {{{ */
-		cfg_volume_usage_t *cfg_volume, na_elem_t *data)
+		na_server_t *srv, cfg_volume_usage_t *cfg_volume, na_elem_t *data)
 {
 	na_elem_t *elem_volume;
 	na_elem_t *elem_volumes;
@@ -1573,7 +1623,7 @@ static int cna_handle_volume_usage_data (const host_config_t *host, /* {{{ */
 			continue;
 
 		if ((v->flags & CFG_VOLUME_USAGE_SNAP) != 0)
-			cna_handle_volume_snap_usage(host, v);
+			cna_handle_volume_snap_usage(host, srv, v);
 		
 		if ((v->flags & CFG_VOLUME_USAGE_DF) == 0)
 			continue;
@@ -1690,7 +1740,7 @@ static int cna_setup_volume_usage (cfg_volume_usage_t *cvu) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_volume_usage */
 
-static int cna_query_volume_usage (host_config_t *host) /* {{{ */
+static int cna_query_volume_usage (host_config_t *host, na_server_t *srv) /* {{{ */
 {
 	na_elem_t *data;
 	int status;
@@ -1713,7 +1763,7 @@ static int cna_query_volume_usage (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_volume_usage->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_volume_usage->query);
+	data = na_server_invoke_elem(srv, host->cfg_volume_usage->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_volume_usage: na_server_invoke_elem failed for host %s: %s",
@@ -1722,7 +1772,8 @@ static int cna_query_volume_usage (host_config_t *host) /* {{{ */
 		return (-1);
 	}
 
-	status = cna_handle_volume_usage_data (host, host->cfg_volume_usage, data);
+	status = cna_handle_volume_usage_data (host, srv,
+			host->cfg_volume_usage, data);
 
 	if (status == 0)
 		host->cfg_volume_usage->interval.last_read = now;
@@ -1850,7 +1901,7 @@ static int cna_setup_system (cfg_system_t *cs) /* {{{ */
 	return (0);
 } /* }}} int cna_setup_system */
 
-static int cna_query_system (host_config_t *host) /* {{{ */
+static int cna_query_system (host_config_t *host, na_server_t *srv) /* {{{ */
 {
 	na_elem_t *data;
 	int status;
@@ -1872,7 +1923,7 @@ static int cna_query_system (host_config_t *host) /* {{{ */
 		return (status);
 	assert (host->cfg_system->query != NULL);
 
-	data = na_server_invoke_elem(host->srv, host->cfg_system->query);
+	data = na_server_invoke_elem(srv, host->cfg_system->query);
 	if (na_results_status (data) != NA_OK)
 	{
 		ERROR ("netapp plugin: cna_query_system: na_server_invoke_elem failed for host %s: %s",
@@ -2386,7 +2437,6 @@ static host_config_t *cna_config_host (const oconfig_item_t *ci) /* {{{ */
 	host->host = NULL;
 	host->username = NULL;
 	host->password = NULL;
-	host->srv = NULL;
 	host->cfg_wafl = NULL;
 	host->cfg_disk = NULL;
 	host->cfg_volume_perf = NULL;
@@ -2474,31 +2524,27 @@ static host_config_t *cna_config_host (const oconfig_item_t *ci) /* {{{ */
  *
  * Pretty standard stuff here.
  */
-static int cna_init_host (host_config_t *host) /* {{{ */
+static na_server_t *cna_server_open (const host_config_t *host) /* {{{ */
 {
-	if (host == NULL)
-		return (EINVAL);
-
-	if (host->srv != NULL)
-		return (0);
+	na_server_t *srv;
 
 	/* Request version 1.1 of the ONTAP API */
-	host->srv = na_server_open(host->host,
+	srv = na_server_open(host->host,
 			/* major version = */ 1, /* minor version = */ 1); 
-	if (host->srv == NULL) {
+	if (srv == NULL) {
 		ERROR ("netapp plugin: na_server_open (%s) failed.", host->host);
-		return (-1);
+		return (NULL);
 	}
 
-	na_server_set_transport_type(host->srv, host->protocol,
+	na_server_set_transport_type(srv, host->protocol,
 			/* transportarg = */ NULL);
-	na_server_set_port(host->srv, host->port);
-	na_server_style(host->srv, NA_STYLE_LOGIN_PASSWORD);
-	na_server_adminuser(host->srv, host->username, host->password);
-	na_server_set_timeout(host->srv, 5 /* seconds */);
+	na_server_set_port(srv, host->port);
+	na_server_style(srv, NA_STYLE_LOGIN_PASSWORD);
+	na_server_adminuser(srv, host->username, host->password);
+	na_server_set_timeout(srv, 5 /* seconds */);
 
-	return 0;
-} /* }}} int cna_init_host */
+	return (srv);
+} /* }}} na_server_t *cna_server_open */
 
 static int cna_init (void) /* {{{ */
 {
@@ -2514,26 +2560,122 @@ static int cna_init (void) /* {{{ */
 	return (0);
 } /* }}} cna_init */
 
+/* Returns the interval of a configured section or NULL if the section hasn't
+ * been configured. */
+static cna_interval_t *cna_query_interval (host_config_t *host, /* {{{ */
+		int query)
+{
+	switch (query)
+	{
+		case CNA_QUERY_WAFL:
+			return ((host->cfg_wafl != NULL)
+					? &host->cfg_wafl->interval : NULL);
+		case CNA_QUERY_DISK:
+			return ((host->cfg_disk != NULL)
+					? &host->cfg_disk->interval : NULL);
+		case CNA_QUERY_VOLUME_PERF:
+			return ((host->cfg_volume_perf != NULL)
+					? &host->cfg_volume_perf->interval : NULL);
+		case CNA_QUERY_VOLUME_USAGE:
+			return ((host->cfg_volume_usage != NULL)
+					? &host->cfg_volume_usage->interval : NULL);
+		case CNA_QUERY_SYSTEM:
+			return ((host->cfg_system != NULL)
+					? &host->cfg_system->interval : NULL);
+	}
+
+	return (NULL);
+} /* }}} cna_interval_t *cna_query_interval */
+
+typedef struct {
+	host_config_t *host;
+	int query;
+	pthread_t thread;
+} cna_query_thread_t;
+
+static void *cna_query_thread (void *arg) /* {{{ */
+{
+	cna_query_thread_t *qt = arg;
+	host_config_t *host = qt->host;
+	na_server_t *srv = host->srv[qt->query];
+
+	switch (qt->query)
+	{
+		case CNA_QUERY_WAFL:         cna_query_wafl (host, srv);         break;
+		case CNA_QUERY_DISK:         cna_query_disk (host, srv);         break;
+		case CNA_QUERY_VOLUME_PERF:  cna_query_volume_perf (host, srv);  break;
+		case CNA_QUERY_VOLUME_USAGE: cna_query_volume_usage (host, srv); break;
+		case CNA_QUERY_SYSTEM:       cna_query_system (host, srv);       break;
+	}
+
+	return (NULL);
+} /* }}} void *cna_query_thread */
+
 static int cna_read (user_data_t *ud) { /* {{{ */
 	host_config_t *host;
-	int status;
+	cna_query_thread_t threads[CNA_QUERY_NUM];
+	int threads_num = 0;
+	cdtime_t now;
+	int i;
 
 	if ((ud == NULL) || (ud->data == NULL))
 		return (-1);
 
 	host = ud->data;
 
-	status = cna_init_host (host);
-	if (status != 0)
-		return (status);
-	
-	cna_query_wafl (host);
-	cna_query_disk (host);
-	cna_query_volume_perf (host);
-	cna_query_volume_usage (host);
-	cna_query_system (host);
+	/* Only the sections which are due are queried. Each one has a connection
+	 * of its own, because a na_server_t can't be used by several threads at
+	 * once. */
+	now = cdtime ();
+	for (i = 0; i < CNA_QUERY_NUM; i++)
+	{
+		cna_interval_t *interval = cna_query_interval (host, i);
 
-	return 0;
+		if ((interval == NULL)
+				|| ((interval->interval + interval->last_read) > now))
+			continue;
+
+		if (host->srv[i] == NULL)
+		{
+			host->srv[i] = cna_server_open (host);
+			if (host->srv[i] == NULL)
+				continue;
+		}
+
+		memset (threads + threads_num, 0, sizeof (threads[threads_num]));
+		threads[threads_num].host = host;
+		threads[threads_num].query = i;
+		threads_num++;
+	}
+
+	if (threads_num == 0)
+		return (0);
+
+	/* The first query is run by this thread, the others in threads of their
+	 * own. If a thread can't be started, its query is run here, too. */
+	for (i = 1; i < threads_num; i++)
+	{
+		int status;
+
+		status = pthread_create (&threads[i].thread, /* attr = */ NULL,
+				cna_query_thread, threads + i);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			WARNING ("netapp plugin: pthread_create failed for host %s: %s",
+					host->name, sstrerror (status, errbuf, sizeof (errbuf)));
+			cna_query_thread (threads + i);
+			threads[i].host = NULL;
+		}
+	}
+
+	cna_query_thread (threads + 0);
+
+	for (i = 1; i < threads_num; i++)
+		if (threads[i].host != NULL)
+			pthread_join (threads[i].thread, /* retval = */ NULL);
+
+	return (0);
 } /* }}} int cna_read */
 
 static int cna_config (oconfig_item_t *ci) { /* {{{ */
@@ -2562,7 +2704,7 @@ static int cna_config (oconfig_item_t *ci) { /* {{{ */
 			ud.data = host;
 			ud.free_func = (void (*) (void *)) free_host_config;
 
-			plugin_register_complex_read (/* group = */ NULL, cb_name,
+			plugin_register_complex_read (/* group = */ "netapp", cb_name,
 					/* callback  = */ cna_read, 
 					/* interval  = */ (host->interval > 0) ? &interval : NULL,
 					/* user data = */ &ud);
@@ -23,6 +23,7 @@
  **/
 
 #define _BSD_SOURCE /* For struct ip_mreq */
+#define _GNU_SOURCE /* For recvmmsg */
 
 #include "collectd.h"
 #include "plugin.h"
@@ -32,6 +33,12 @@
 #include "utils_avltree.h"
 #include "utils_cache.h"
 #include "utils_complain.h"
+#include "utils_handoff.h"
+#include "utils_hashtable.h"
+#include "utils_memory.h"
+#include "utils_probes.h"
+#include "utils_stats.h"
+#include "utils_thread.h"
 
 #include "network.h"
 
@@ -56,6 +63,24 @@
 #if HAVE_NET_IF_H
 # include <net/if.h>
 #endif
+#if HAVE_NETINET_TCP_H
+# include <netinet/tcp.h>
+#endif
+#if HAVE_NETINET_UDP_H
+# include <netinet/udp.h>
+#endif
+
+/* Batches of datagrams are passed to the kernel as one large buffer, which
+ * is split into datagrams by the kernel or the network card. */
+#if HAVE_SENDMMSG && defined(UDP_SEGMENT) && defined(SOL_UDP)
+# define NETWORK_HAVE_GSO 1
+#else
+# define NETWORK_HAVE_GSO 0
+#endif
+
+#if HAVE_LIBLZ4
+# include <lz4.h>
+#endif
 
 #if HAVE_LIBGCRYPT
 # include <gcrypt.h>
@@ -90,14 +115,23 @@ GCRY_THREAD_OPTION_PTHREAD_IMPL;
 #endif
 struct sockent_client
 {
+	/* With `Transport TCP', -1 while not connected. */
 	int fd;
 	struct sockaddr_storage *addr;
 	socklen_t                addrlen;
+	int compress;
+	/* Send runs of datagrams with UDP_SEGMENT. Cleared by the send thread if
+	 * the kernel refuses. */
+	int segment;
+	/* Earliest time of the next connection attempt (TCP only). */
+	cdtime_t next_connect;
+	c_complain_t connect_complaint;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *username;
 	char *password;
 	gcry_cipher_hd_t cypher;
+	gcry_md_hd_t hmac;
 	unsigned char password_hash[32];
 #endif
 };
@@ -106,11 +140,22 @@ struct sockent_server
 {
 	int *fd;
 	size_t fd_num;
+	/* Forward received packets to the `Server's without parsing them. */
+	int passthrough;
+	/* Counters of pass-through sockets. */
+	stats_counter_t forward_octets_rx;
+	stats_counter_t forward_packets_rx;
+	stats_counter_t forward_octets_tx;
+	stats_counter_t forward_packets_tx;
 #if HAVE_LIBGCRYPT
 	int security_level;
 	char *auth_file;
 	fbhash_t *userdb;
-	gcry_cipher_hd_t cypher;
+	/* SHA-256 hashes of the passwords in `userdb', i.e. the AES keys,
+	 * by username. Emptied when `userdb' re-reads the file. */
+	c_avl_tree_t *keys;
+	unsigned int keys_generation;
+	pthread_mutex_t keys_lock;
 #endif
 };
 
@@ -123,6 +168,9 @@ typedef struct sockent
 	char *node;
 	char *service;
 	int interface;
+#define NETWORK_TRANSPORT_UDP 0
+#define NETWORK_TRANSPORT_TCP 1
+	int transport;
 
 	union
 	{
@@ -246,15 +294,223 @@ struct part_encryption_aes256_s
 };
 typedef struct part_encryption_aes256_s part_encryption_aes256_t;
 
+/*                      1 1 1 1 1 1 1 1 1 1 2 2 2 2 2 2 2 2 2 2 3 3
+ *  0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+ * +-------------------------------+-------------------------------+
+ * ! Type                          ! Length                        !
+ * +-------------------------------+-------------------------------+
+ * ! Uncompressed length                                           !
+ * +---------------------------------------------------------------+
+ * ! LZ4 compressed payload                                        !
+ * :                                                               :
+ * +---------------------------------------------------------------+
+ *
+ * The uncompressed payload is a sequence of packets, each preceded by its
+ * length as a 16 bit integer. Every packet is parsed on its own, so fields are
+ * not carried over from one packet to the next.
+ */
+/* Minimum size */
+#define PART_COMPRESSION_LZ4_SIZE 8
+/* Largest uncompressed payload accepted from the network. */
+#define BUFF_COMPRESSED_MAX 1048576
+/* Maximum number of packets combined into one compressed part. */
+#define NETWORK_COMPRESS_PACKETS 8
+/* Space used by one packet in the uncompressed payload. */
+#define NETWORK_COMPRESS_FRAME_SIZE (sizeof (uint16_t) \
+    + network_config_packet_size)
+
+/* Value lists parsed from one packet. They are dispatched together using
+ * `plugin_dispatch_values_batch' once the entire packet has been parsed. */
+struct dispatch_batch_s
+{
+  value_list_t *vl;
+  size_t vl_num;
+  size_t vl_size;
+  /* The values of all value lists, allocated once per packet. */
+  value_t *values;
+  size_t values_num;
+  size_t values_size;
+};
+typedef struct dispatch_batch_s dispatch_batch_t;
+
+/* Identifier of the value lists and notifications of a packet. The fields
+ * point into the packet and are only copied when a value list is added to
+ * the batch or a notification is dispatched. */
+struct packet_fields_s
+{
+  const char *host;
+  const char *plugin;
+  const char *plugin_instance;
+  const char *type;
+  const char *type_instance;
+};
+typedef struct packet_fields_s packet_fields_t;
+
 struct receive_list_entry_s
 {
   char *data;
   int  data_len;
   int  fd;
+  /* Hash of the sender's address, used to pick the dispatch queue. */
+  uint32_t source_hash;
   struct receive_list_entry_s *next;
 };
 typedef struct receive_list_entry_s receive_list_entry_t;
 
+struct receive_list_s
+{
+  receive_list_entry_t *head;
+  receive_list_entry_t *tail;
+  uint64_t length;
+};
+typedef struct receive_list_s receive_list_t;
+
+/* Received packets are distributed between several queues, each of which is
+ * drained by its own dispatch thread. Packets from the same sender always go
+ * to the same queue, so they are dispatched in the order they arrived. */
+struct receive_queue_s
+{
+  receive_list_t  list;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+  /* Signalled when the dispatch thread has emptied the list. Only used with
+   * the `Block' drop policy. */
+  pthread_cond_t  cond_space;
+
+  /* Updated while holding `lock' but read without it. `length_max' is the
+   * highest `list.length' since the statistics were last read.
+   * `dropped_memory' counts the packets dropped because the daemon is over
+   * its `MemoryBudget'. */
+  stats_counter_t dropped;
+  stats_counter_t dropped_memory;
+  uint64_t length_max;
+
+  pthread_t dispatch_thread_id;
+  int       dispatch_thread_running;
+};
+typedef struct receive_queue_s receive_queue_t;
+
+/* Each receive thread polls its own subset of the listening sockets. */
+struct receive_thread_s
+{
+  pthread_t id;
+  int running;
+
+  struct pollfd *pollfd;
+  /* The socket entry each of `pollfd' belongs to. */
+  sockent_t **sockets;
+  size_t pollfd_num;
+
+  /* Only written by the thread itself and read without a lock. Being
+   * per-thread already, they don't need to be `stats_counter_t's. */
+  derive_t octets_rx;
+  derive_t packets_rx;
+  /* Packets read while the buffer pool was exhausted. */
+  derive_t packets_dropped;
+};
+typedef struct receive_thread_s receive_thread_t;
+
+/* Maximum number of datagrams read with one call to `recvmmsg'. */
+#define NETWORK_RECEIVE_BATCH 32
+
+/* With `Transport TCP' each packet is sent as a frame: the packet's length as
+ * a 32-bit integer in network byte order, followed by the packet itself. The
+ * receiver reads up to `NETWORK_STREAM_READ_SIZE' bytes per call. */
+#define NETWORK_STREAM_READ_SIZE 65536
+#define NETWORK_STREAM_FRAME_HEADER_SIZE 4
+/* How long to wait for a connection to be established and for a write to
+ * complete, and how long to wait after a failed attempt. Attempts that timed
+ * out are repeated less often, because they hold up the send thread. */
+#define NETWORK_STREAM_CONNECT_TIMEOUT MS_TO_CDTIME_T (1000)
+#define NETWORK_STREAM_SEND_TIMEOUT    10
+#define NETWORK_STREAM_RETRY_INTERVAL  TIME_T_TO_CDTIME_T (1)
+#define NETWORK_STREAM_TIMEOUT_RETRY_INTERVAL TIME_T_TO_CDTIME_T (10)
+
+/* A TCP connection accepted by a `Listen' socket. */
+struct stream_conn_s
+{
+	int fd;
+	/* The listening socket the connection has been accepted on. Entries
+	 * for the listening sockets themselves have `buffer' set to NULL. */
+	sockent_t *se;
+	int listen_fd;
+	uint32_t source_hash;
+	char  *buffer;
+	size_t buffer_fill;
+	/* Bytes of an oversized frame that still have to be skipped. */
+	size_t skip;
+};
+typedef struct stream_conn_s stream_conn_t;
+
+/* A serialized packet waiting to be sent. `data' points to the memory
+ * directly behind the structure, large enough for one packet. */
+struct send_packet_s
+{
+  char  *data;
+  size_t data_len;
+  /* Time the first value was added to the packet. */
+  cdtime_t first_write;
+  /* Received packets forwarded by a pass-through socket. These are never
+   * compressed again, because they may contain compressed parts already and
+   * receivers refuse nested compression. */
+  _Bool raw;
+  struct send_packet_s *next;
+};
+typedef struct send_packet_s send_packet_t;
+
+/* Strings of the identifier parts (host, plugin, ...) in one packet. Each
+ * string part gets the next index in order of appearance, on both ends, so
+ * that later parts can refer to it using the `TYPE_*_REF' types. `strings'
+ * point into the packet itself. Only the first `NETWORK_STRING_TABLE_SIZE'
+ * strings can be referred to. */
+#define NETWORK_STRING_TABLE_SIZE 128
+struct string_table_s
+{
+  const char *strings[NETWORK_STRING_TABLE_SIZE];
+  size_t      lengths[NETWORK_STRING_TABLE_SIZE];
+  int         strings_num;
+};
+typedef struct string_table_s string_table_t;
+
+/* Buffer in which to-be-sent network packets are constructed. There are
+ * `NETWORK_SEND_BUFFERS' of them and each value list is written to the one
+ * picked by the hash of its host and plugin, so that threads writing values of
+ * different plugins don't contend for one lock. All values of an identifier
+ * go to the same buffer and are therefore sent in order. `vl' holds the
+ * fields of the previous value list, so that repeated fields are only written
+ * to the packet once. */
+struct send_buffer_s
+{
+  pthread_mutex_t lock;
+  send_packet_t  *packet;
+  char           *ptr;
+  int             fill;
+  value_list_t    vl;
+  /* Strings already written to the packet, see `IdentifierDictionary'. */
+  string_table_t  strings;
+  /* Time the first value was added to the packet, zero if it is empty. */
+  cdtime_t        first_write;
+};
+typedef struct send_buffer_s send_buffer_t;
+
+#define NETWORK_SEND_BUFFERS 16
+
+/* Maximum number of datagrams sent with one call to `sendmmsg'. */
+#define NETWORK_SEND_BATCH 32
+
+/* With `SegmentationOffload', datagrams are padded to the size of the
+ * largest one of the batch if that takes at most this fraction of it. */
+#define NETWORK_GSO_PAD_RATIO 8
+/* Limits of one UDP_SEGMENT send: the size of an UDP datagram, less room for
+ * the headers, and the kernel's `UDP_MAX_SEGMENTS'. */
+#define NETWORK_GSO_MAX_SIZE 65000
+#define NETWORK_GSO_MAX_SEGMENTS 64
+
+/* What to do when a receive queue is full. */
+#define RQ_DROP_OLDEST 0
+#define RQ_DROP_NEWEST 1
+#define RQ_BLOCK       2
+
 /*
  * Private variables
  */
@@ -263,14 +519,38 @@ static int network_config_ttl = 0;
 static size_t network_config_packet_size = 1452;
 static int network_config_forward = 0;
 static int network_config_stats = 0;
+static int network_config_receive_threads = 1;
+static int network_config_dispatch_threads = 1;
+/* CPU sets of the receive and dispatch threads, see `thread_check_cpus'. */
+static char *network_config_receive_cpus = NULL;
+static char *network_config_dispatch_cpus = NULL;
+static int network_config_receive_buffers = 4096;
+/* Zero means the receive queues are only bounded by the buffer pool. */
+static int network_config_queue_limit = 0;
+static int network_config_queue_policy = RQ_DROP_OLDEST;
+/* Zero means packets are only sent when they are full or flushed. */
+static cdtime_t network_config_buffer_latency = 0;
+/* Set if any server uses compression. */
+static int network_config_compress = 0;
+static int network_config_dictionary = 0;
+/* Value lists received per second, in total and from each host. Zero means
+ * no limit. */
+static int network_config_receive_rate = 0;
+static int network_config_receive_rate_host = 0;
 
 static sockent_t *sending_sockets = NULL;
 
-static receive_list_entry_t *receive_list_head = NULL;
-static receive_list_entry_t *receive_list_tail = NULL;
-static pthread_mutex_t       receive_list_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t        receive_list_cond = PTHREAD_COND_INITIALIZER;
-static uint64_t              receive_list_length = 0;
+static receive_queue_t *receive_queues = NULL;
+static size_t           receive_queues_num = 0;
+
+/* All receive buffers are allocated once by `receive_pool_init' and are
+ * passed from the receive threads to the dispatch threads and back. */
+static receive_list_entry_t *receive_pool_entries = NULL;
+static char                 *receive_pool_data = NULL;
+static receive_list_t        receive_pool_free = { NULL, NULL, 0 };
+static pthread_mutex_t       receive_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when buffers are returned, see `stream_get_buffer'. */
+static pthread_cond_t        receive_pool_cond = PTHREAD_COND_INITIALIZER;
 
 static sockent_t     *listen_sockets = NULL;
 static struct pollfd *listen_sockets_pollfd = NULL;
@@ -279,174 +559,632 @@ static size_t         listen_sockets_num = 0;
 /* The receive and dispatch threads will run as long as `listen_loop' is set to
  * zero. */
 static int       listen_loop = 0;
-static int       receive_thread_running = 0;
-static pthread_t receive_thread_id;
-static int       dispatch_thread_running = 0;
-static pthread_t dispatch_thread_id;
-
-/* Buffer in which to-be-sent network packets are constructed. */
-static char            *send_buffer;
-static char            *send_buffer_ptr;
-static int              send_buffer_fill;
-static value_list_t     send_buffer_vl = VALUE_LIST_STATIC;
-static pthread_mutex_t  send_buffer_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/* XXX: These counters are incremented from one place only. The spot in which
- * the values are incremented is either only reachable by one thread (the
- * dispatch thread, for example) or locked by some lock (send_buffer_lock for
- * example). Only if neither is true, the stats_lock is acquired. The counters
- * are always read without holding a lock in the hope that writing 8 bytes to
- * memory is an atomic operation. */
-static derive_t stats_octets_rx  = 0;
-static derive_t stats_octets_tx  = 0;
-static derive_t stats_packets_rx = 0;
-static derive_t stats_packets_tx = 0;
-static derive_t stats_values_dispatched = 0;
-static derive_t stats_values_not_dispatched = 0;
-static derive_t stats_values_sent = 0;
-static derive_t stats_values_not_sent = 0;
-static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static receive_thread_t *receive_threads = NULL;
+static size_t            receive_threads_num = 0;
+
+/* Number of listening TCP sockets. These are handled by the stream thread
+ * instead of the receive threads. */
+static size_t            listen_streams_num = 0;
+static receive_thread_t  stream_receiver;
+
+static send_buffer_t    send_buffers[NETWORK_SEND_BUFFERS];
+
+/* Full packets are handed to the send thread through `send_queue'. Sent
+ * packets are kept in `send_packets_free' for reuse. The send thread runs as
+ * long as `send_loop' is zero and there are packets in the queue. */
+static send_packet_t   *send_queue_head = NULL;
+static send_packet_t   *send_queue_tail = NULL;
+static size_t           send_queue_length = 0;
+/* Set by `network_flush_send_buffers' to send held back packets. */
+static int              send_queue_flush = 0;
+static send_packet_t   *send_packets_free = NULL;
+static pthread_mutex_t  send_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   send_queue_cond = PTHREAD_COND_INITIALIZER;
+static int              send_loop = 0;
+static pthread_t        send_thread_id;
+static int              send_thread_running = 0;
+#if HAVE_LIBGCRYPT
+/* Used by the send thread to sign or encrypt up to `NETWORK_SEND_BATCH'
+ * packets at once. */
+static char            *send_scratch = NULL;
+#endif
+#if HAVE_LIBLZ4
+/* Used by the send thread to combine up to `NETWORK_COMPRESS_PACKETS' packets
+ * and to hold up to `NETWORK_SEND_BATCH' compressed datagrams. */
+static char            *send_compress_in = NULL;
+static char            *send_compress_out = NULL;
+#endif
+
+/* Counters shared by the write, receive, dispatch and send threads. They are
+ * updated without a lock and summed up by `network_stats_read'. */
+static stats_counter_t stats_octets_tx = STATS_COUNTER_INIT;
+static stats_counter_t stats_packets_tx = STATS_COUNTER_INIT;
+static stats_counter_t stats_values_dispatched = STATS_COUNTER_INIT;
+static stats_counter_t stats_values_not_dispatched = STATS_COUNTER_INIT;
+static stats_counter_t stats_values_sent = STATS_COUNTER_INIT;
+static stats_counter_t stats_values_not_sent = STATS_COUNTER_INIT;
+/* Datagrams and system calls used to send them. */
+static stats_counter_t stats_send_datagrams = STATS_COUNTER_INIT;
+static stats_counter_t stats_send_calls = STATS_COUNTER_INIT;
+
+/* Token buckets for `MaxReceiveRate' and `MaxReceiveRatePerHost'. Every
+ * bucket holds at most one second worth of value lists. The buckets of hosts
+ * which have not sent anything for `RECEIVE_LIMIT_PURGE' are removed. All of
+ * this is protected by `receive_limit_lock'. */
+#define RECEIVE_LIMIT_PURGE TIME_T_TO_CDTIME_T (60)
+struct receive_limit_s
+{
+  char host[DATA_MAX_NAME_LEN];
+  double tokens;
+  cdtime_t last;
+  derive_t dropped;
+  c_complain_t complaint;
+};
+typedef struct receive_limit_s receive_limit_t;
+
+static receive_limit_t  receive_limit_total =
+  { "", 0.0, 0, 0, C_COMPLAIN_INIT_STATIC };
+static c_hashtable_t   *receive_limit_hosts = NULL;
+static cdtime_t         receive_limit_next_purge = 0;
+static pthread_mutex_t  receive_limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_counter_t stats_values_rate_limited = STATS_COUNTER_INIT;
 
 /*
  * Private functions
  */
-static _Bool check_receive_okay (const value_list_t *vl) /* {{{ */
+/* Values which have been sent and are received again, e.g. because two
+ * daemons forward to each other, aren't newer than the cached value. The
+ * cache drops such values if they have `VL_FLAG_RECEIVED' set, so there is no
+ * need to remember what has been sent. */
+static _Bool check_send_okay (const value_list_t *vl) /* {{{ */
 {
-  uint64_t time_sent = 0;
-  int status;
+  if (network_config_forward != 0)
+    return (1);
+
+  /* By default, only *send* value lists that were not *received* by the
+   * network plugin. */
+  return ((vl->flags & VL_FLAG_RECEIVED) == 0);
+} /* }}} _Bool check_send_okay */
 
-  status = uc_meta_data_get_unsigned_int (vl,
-      "network:time_sent", &time_sent);
+/* Takes a token from `rl', after adding the ones for the time passed since
+ * it was used last. Returns zero if there was none left. */
+static _Bool receive_limit_take (receive_limit_t *rl, int rate, /* {{{ */
+    cdtime_t now)
+{
+  if (now > rl->last)
+  {
+    rl->tokens += ((double) rate) * CDTIME_T_TO_DOUBLE (now - rl->last);
+    if (rl->tokens > (double) rate)
+      rl->tokens = (double) rate;
+  }
+  rl->last = now;
 
-  /* This is a value we already sent. Don't allow it to be received again in
-   * order to avoid looping. */
-  if ((status == 0) && (time_sent >= ((uint64_t) vl->time)))
+  if (rl->tokens < 1.0)
     return (0);
 
+  rl->tokens -= 1.0;
   return (1);
-} /* }}} _Bool check_receive_okay */
+} /* }}} _Bool receive_limit_take */
 
-static _Bool check_send_okay (const value_list_t *vl) /* {{{ */
+/* Removes the buckets of hosts which have been quiet for a while. You must
+ * hold `receive_limit_lock'. */
+static void receive_limit_purge_locked (cdtime_t now) /* {{{ */
 {
-  _Bool received = 0;
-  int status;
+  c_hashtable_iterator_t *iter;
+  receive_limit_t **idle;
+  size_t idle_num = 0;
+  size_t i;
+  void *key;
+  void *value;
 
-  if (network_config_forward != 0)
-    return (1);
+  receive_limit_next_purge = now + RECEIVE_LIMIT_PURGE;
+  if (c_hashtable_size (receive_limit_hosts) == 0)
+    return;
 
-  if (vl->meta == NULL)
-    return (1);
+  idle = calloc ((size_t) c_hashtable_size (receive_limit_hosts),
+      sizeof (*idle));
+  iter = c_hashtable_get_iterator (receive_limit_hosts);
+  if ((idle == NULL) || (iter == NULL))
+  {
+    ERROR ("network plugin: receive_limit_purge_locked: calloc failed.");
+    if (iter != NULL)
+      c_hashtable_iterator_destroy (iter);
+    sfree (idle);
+    return;
+  }
 
-  status = meta_data_get_boolean (vl->meta, "network:received", &received);
-  if (status == -ENOENT)
-    return (1);
-  else if (status != 0)
+  while (c_hashtable_iterator_next (iter, &key, &value) == 0)
   {
-    ERROR ("network plugin: check_send_okay: meta_data_get_boolean failed "
-	"with status %i.", status);
-    return (1);
+    receive_limit_t *rl = value;
+
+    if ((now - rl->last) >= RECEIVE_LIMIT_PURGE)
+      idle[idle_num++] = rl;
   }
+  c_hashtable_iterator_destroy (iter);
 
-  /* By default, only *send* value lists that were not *received* by the
-   * network plugin. */
-  return (!received);
-} /* }}} _Bool check_send_okay */
+  for (i = 0; i < idle_num; i++)
+  {
+    c_hashtable_remove (receive_limit_hosts, idle[i]->host, NULL, NULL);
+    sfree (idle[i]);
+  }
+  sfree (idle);
+} /* }}} void receive_limit_purge_locked */
 
-static int network_dispatch_values (value_list_t *vl, /* {{{ */
-    const char *username)
+/* Returns the bucket of `host', creating a full one if necessary. You must
+ * hold `receive_limit_lock'. */
+static receive_limit_t *receive_limit_host_locked (const char *host, /* {{{ */
+    cdtime_t now)
 {
-  int status;
+  receive_limit_t *rl = NULL;
 
-  if ((vl->time <= 0)
-      || (strlen (vl->host) <= 0)
-      || (strlen (vl->plugin) <= 0)
-      || (strlen (vl->type) <= 0))
-    return (-EINVAL);
+  if (receive_limit_hosts == NULL)
+  {
+    receive_limit_hosts = c_hashtable_create (c_hashtable_hash_string,
+        (void *) strcmp);
+    if (receive_limit_hosts == NULL)
+      return (NULL);
+  }
+
+  if (c_hashtable_get (receive_limit_hosts, host, (void *) &rl) == 0)
+    return (rl);
 
-  if (!check_receive_okay (vl))
+  rl = calloc (1, sizeof (*rl));
+  if (rl == NULL)
+    return (NULL);
+  sstrncpy (rl->host, host, sizeof (rl->host));
+  rl->tokens = (double) network_config_receive_rate_host;
+  rl->last = now;
+  C_COMPLAIN_INIT (&rl->complaint);
+
+  if (c_hashtable_insert (receive_limit_hosts, rl->host, rl) != 0)
   {
-#if COLLECT_DEBUG
-    char name[6*DATA_MAX_NAME_LEN];
-    FORMAT_VL (name, sizeof (name), vl);
-    name[sizeof (name) - 1] = 0;
-    DEBUG ("network plugin: network_dispatch_values: "
-	"NOT dispatching %s.", name);
-#endif
-    stats_values_not_dispatched++;
-    return (0);
+    sfree (rl);
+    return (NULL);
   }
 
-  assert (vl->meta == NULL);
+  return (rl);
+} /* }}} receive_limit_t *receive_limit_host_locked */
+
+/* Returns zero if the value list of `host' exceeds `MaxReceiveRate' or
+ * `MaxReceiveRatePerHost' and has to be dropped. */
+static _Bool check_receive_rate (const char *host) /* {{{ */
+{
+  receive_limit_t *rl = NULL;
+  cdtime_t now;
+
+  if ((network_config_receive_rate <= 0)
+      && (network_config_receive_rate_host <= 0))
+    return (1);
+
+  pthread_mutex_lock (&receive_limit_lock);
+
+  now = cdtime ();
+  if (now >= receive_limit_next_purge)
+    receive_limit_purge_locked (now);
 
-  vl->meta = meta_data_create ();
-  if (vl->meta == NULL)
+  /* A host exceeding its own limit doesn't use up the total. */
+  if (network_config_receive_rate_host > 0)
   {
-    ERROR ("network plugin: meta_data_create failed.");
-    return (-ENOMEM);
+    rl = receive_limit_host_locked (host, now);
+    if ((rl != NULL) && !receive_limit_take (rl,
+          network_config_receive_rate_host, now))
+    {
+      rl->dropped++;
+      stats_counter_inc (&stats_values_rate_limited);
+      c_complain (LOG_WARNING, &rl->complaint, "network plugin: Host \"%s\" "
+          "sends more than %i value lists per second. The excess is dropped "
+          "(%"PRIi64" so far).", host, network_config_receive_rate_host,
+          rl->dropped);
+      pthread_mutex_unlock (&receive_limit_lock);
+      return (0);
+    }
   }
 
-  status = meta_data_add_boolean (vl->meta, "network:received", 1);
-  if (status != 0)
+  if ((network_config_receive_rate > 0) && !receive_limit_take (
+        &receive_limit_total, network_config_receive_rate, now))
+  {
+    receive_limit_total.dropped++;
+    stats_counter_inc (&stats_values_rate_limited);
+    c_complain (LOG_WARNING, &receive_limit_total.complaint, "network plugin: "
+        "More than %i value lists per second are received. The excess is "
+        "dropped (%"PRIi64" so far).", network_config_receive_rate,
+        receive_limit_total.dropped);
+    pthread_mutex_unlock (&receive_limit_lock);
+    return (0);
+  }
+
+  if (rl != NULL)
+    c_release (LOG_INFO, &rl->complaint, "network plugin: Host \"%s\" is "
+        "within its receive rate again.", host);
+  c_release (LOG_INFO, &receive_limit_total.complaint, "network plugin: The "
+      "receive rate is within its limit again.");
+
+  pthread_mutex_unlock (&receive_limit_lock);
+  return (1);
+} /* }}} _Bool check_receive_rate */
+
+/* Adds a value list with the time, interval and values of `vl' and the
+ * identifier `fields' to `batch'. The values must be part of the batch's
+ * `values'. */
+static int network_dispatch_values (const value_list_t *vl, /* {{{ */
+    const packet_fields_t *fields, const char *username,
+    dispatch_batch_t *batch)
+{
+  value_list_t *dst;
+  int status;
+
+  if ((vl->time <= 0)
+      || (fields->host[0] == 0)
+      || (fields->plugin[0] == 0)
+      || (fields->type[0] == 0))
+    return (-EINVAL);
+
+  if (batch->vl_num >= batch->vl_size)
   {
-    ERROR ("network plugin: meta_data_add_boolean failed.");
-    meta_data_destroy (vl->meta);
-    vl->meta = NULL;
-    return (status);
+    value_list_t *tmp;
+    size_t new_size = (batch->vl_size > 0) ? (2 * batch->vl_size) : 16;
+
+    tmp = realloc (batch->vl, new_size * sizeof (*batch->vl));
+    if (tmp == NULL)
+    {
+      ERROR ("network plugin: realloc failed.");
+      return (-ENOMEM);
+    }
+    batch->vl = tmp;
+    batch->vl_size = new_size;
   }
 
+  /* The value list is built in place and only counted if it is going to
+   * be dispatched. */
+  dst = batch->vl + batch->vl_num;
+  dst->values = vl->values;
+  dst->values_len = vl->values_len;
+  dst->time = vl->time;
+  dst->interval = vl->interval;
+  sstrncpy (dst->host, fields->host, sizeof (dst->host));
+  sstrncpy (dst->plugin, fields->plugin, sizeof (dst->plugin));
+  sstrncpy (dst->plugin_instance, fields->plugin_instance,
+      sizeof (dst->plugin_instance));
+  sstrncpy (dst->type, fields->type, sizeof (dst->type));
+  sstrncpy (dst->type_instance, fields->type_instance,
+      sizeof (dst->type_instance));
+  dst->meta = NULL;
+  dst->identifier = NULL;
+  dst->type_id = 0;
+  dst->flags = VL_FLAG_RECEIVED;
+  memset (&dst->trace, 0, sizeof (dst->trace));
+  dst->trace.origin = vl->trace.origin;
+
+  if (!check_receive_rate (dst->host))
+    return (0);
+
   if (username != NULL)
   {
-    status = meta_data_add_string (vl->meta, "network:username", username);
+    dst->meta = meta_data_create ();
+    if (dst->meta == NULL)
+    {
+      ERROR ("network plugin: meta_data_create failed.");
+      return (-ENOMEM);
+    }
+
+    status = meta_data_add_string (dst->meta, "network:username", username);
     if (status != 0)
     {
       ERROR ("network plugin: meta_data_add_string failed.");
-      meta_data_destroy (vl->meta);
-      vl->meta = NULL;
+      meta_data_destroy (dst->meta);
+      dst->meta = NULL;
       return (status);
     }
   }
 
-  plugin_dispatch_values_secure (vl);
-  stats_values_dispatched++;
-
-  meta_data_destroy (vl->meta);
-  vl->meta = NULL;
+  batch->vl_num++;
 
   return (0);
 } /* }}} int network_dispatch_values */
 
+static void network_dispatch_batch (dispatch_batch_t *batch) /* {{{ */
+{
+  size_t i;
+  uint64_t rejected = 0;
+
+  if (batch->vl_num > 0)
+    plugin_dispatch_values_batch (batch->vl, batch->vl_num);
+
+  for (i = 0; i < batch->vl_num; i++)
+  {
+    /* Mostly values which have looped back, see `check_send_okay'. */
+    if (batch->vl[i].flags & VL_FLAG_REJECTED)
+      rejected++;
+
+    meta_data_destroy (batch->vl[i].meta);
+    batch->vl[i].meta = NULL;
+  }
+
+  if (batch->vl_num > 0)
+  {
+    stats_counter_add (&stats_values_dispatched,
+        (uint64_t) batch->vl_num - rejected);
+    stats_counter_add (&stats_values_not_dispatched, rejected);
+  }
+
+  sfree (batch->vl);
+  batch->vl_num = 0;
+  batch->vl_size = 0;
+
+  sfree (batch->values);
+  batch->values_num = 0;
+  batch->values_size = 0;
+} /* }}} void network_dispatch_batch */
+
 #if HAVE_LIBGCRYPT
+/* Cryptographic handles of one thread. Opening a handle and setting its key
+ * take longer than handling a packet, so the handles are kept across packets
+ * and the key is only set again when a packet of a different user arrives.
+ * `cypher_key' and `hmac_key' hold the SHA-256 hash of the password the
+ * respective handle has been set up with; they are valid while the handle is
+ * not NULL. */
+struct network_crypto_s
+{
+  gcry_cipher_hd_t cypher;
+  unsigned char    cypher_key[32];
+  gcry_md_hd_t     hmac;
+  unsigned char    hmac_key[32];
+};
+typedef struct network_crypto_s network_crypto_t;
+
+static pthread_key_t  network_crypto_key;
+static pthread_once_t network_crypto_once = PTHREAD_ONCE_INIT;
+
+static void network_crypto_destroy (void *arg) /* {{{ */
+{
+  network_crypto_t *crypto = arg;
+
+  if (crypto == NULL)
+    return;
+
+  if (crypto->cypher != NULL)
+    gcry_cipher_close (crypto->cypher);
+  if (crypto->hmac != NULL)
+    gcry_md_close (crypto->hmac);
+  sfree (crypto);
+} /* }}} void network_crypto_destroy */
+
+static void network_crypto_key_create (void) /* {{{ */
+{
+  pthread_key_create (&network_crypto_key, network_crypto_destroy);
+} /* }}} void network_crypto_key_create */
+
+/* Returns the calling thread's handles. Several dispatch threads may handle
+ * packets received on the same socket at the same time, so the handles used
+ * for receiving are not shared. */
+static network_crypto_t *network_get_thread_crypto (void) /* {{{ */
+{
+  network_crypto_t *crypto;
+
+  pthread_once (&network_crypto_once, network_crypto_key_create);
+
+  crypto = pthread_getspecific (network_crypto_key);
+  if (crypto != NULL)
+    return (crypto);
+
+  crypto = malloc (sizeof (*crypto));
+  if (crypto == NULL)
+  {
+    ERROR ("network plugin: malloc failed.");
+    return (NULL);
+  }
+  memset (crypto, 0, sizeof (*crypto));
+
+  if (pthread_setspecific (network_crypto_key, crypto) != 0)
+  {
+    ERROR ("network plugin: pthread_setspecific failed.");
+    sfree (crypto);
+    return (NULL);
+  }
+
+  return (crypto);
+} /* }}} network_crypto_t *network_get_thread_crypto */
+
+static void network_free_keys (c_avl_tree_t *keys) /* {{{ */
+{
+  char *username;
+  unsigned char *key;
+
+  while (c_avl_pick (keys, (void *) &username, (void *) &key) == 0)
+  {
+    sfree (username);
+    sfree (key);
+  }
+} /* }}} void network_free_keys */
+
+/* Stores the SHA-256 hash of `username's password in `key'. The hashes are
+ * cached, so that `userdb' only has to be queried for the first packet of each
+ * user and after the password file has changed. */
+static int network_get_user_key (sockent_t *se, /* {{{ */
+    const char *username, unsigned char *key)
+{
+  struct sockent_server *ses = &se->data.server;
+  unsigned int generation;
+  unsigned char *cached;
+  char *username_copy;
+  fbh_snapshot_t *snapshot;
+  const char *secret;
+
+  if (ses->keys == NULL)
+    return (-ENOENT);
+
+  generation = fbh_generation (ses->userdb);
+
+  pthread_mutex_lock (&ses->keys_lock);
+  if (ses->keys_generation != generation)
+  {
+    network_free_keys (ses->keys);
+    ses->keys_generation = generation;
+  }
+
+  cached = NULL;
+  if (c_avl_get (ses->keys, username, (void *) &cached) == 0)
+  {
+    memcpy (key, cached, 32);
+    pthread_mutex_unlock (&ses->keys_lock);
+    return (0);
+  }
+  pthread_mutex_unlock (&ses->keys_lock);
+
+  /* The key is labelled with the generation the password was actually
+   * taken from. */
+  snapshot = fbh_snapshot (ses->userdb);
+  secret = fbh_snapshot_get (snapshot, username);
+  if (secret == NULL)
+  {
+    fbh_snapshot_release (snapshot);
+    return (-ENOENT);
+  }
+
+  gcry_md_hash_buffer (GCRY_MD_SHA256, key, secret, strlen (secret));
+  generation = fbh_snapshot_generation (snapshot);
+  fbh_snapshot_release (snapshot);
+
+  username_copy = strdup (username);
+  cached = malloc (32);
+  if ((username_copy == NULL) || (cached == NULL))
+  {
+    sfree (username_copy);
+    sfree (cached);
+    return (0);
+  }
+  memcpy (cached, key, 32);
+
+  pthread_mutex_lock (&ses->keys_lock);
+  /* Another thread may have added the user in the meantime. */
+  if ((ses->keys_generation != generation)
+      || (c_avl_insert (ses->keys, username_copy, cached) != 0))
+  {
+    sfree (username_copy);
+    sfree (cached);
+  }
+  pthread_mutex_unlock (&ses->keys_lock);
+
+  return (0);
+} /* }}} int network_get_user_key */
+
+/* Returns a HMAC-SHA-256 handle with the password of `username', or the
+ * client's password, set as key. `key' is the SHA-256 hash of that password
+ * and is used to tell whether the handle of the calling thread has already
+ * been set up for this user. */
+static gcry_md_hd_t network_get_hmac_sha256 (sockent_t *se, /* {{{ */
+    const char *username, const unsigned char *key)
+{
+  gcry_error_t err;
+  gcry_md_hd_t *hmac_ptr;
+  unsigned char *hmac_key;
+  network_crypto_t *crypto;
+  fbh_snapshot_t *snapshot = NULL;
+  const char *secret;
+
+  if (se->type == SOCKENT_TYPE_CLIENT)
+  {
+    /* The client's handle is only ever used with the client's password. */
+    hmac_ptr = &se->data.client.hmac;
+    hmac_key = NULL;
+  }
+  else
+  {
+    crypto = network_get_thread_crypto ();
+    if (crypto == NULL)
+      return (NULL);
+    hmac_ptr = &crypto->hmac;
+    hmac_key = crypto->hmac_key;
+  }
+
+  if (*hmac_ptr != NULL)
+  {
+    if ((hmac_key == NULL) || (memcmp (hmac_key, key, 32) == 0))
+    {
+      gcry_md_reset (*hmac_ptr);
+      return (*hmac_ptr);
+    }
+  }
+  else
+  {
+    err = gcry_md_open (hmac_ptr, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
+    if (err != 0)
+    {
+      ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
+          gcry_strerror (err));
+      *hmac_ptr = NULL;
+      return (NULL);
+    }
+  }
+
+  if (se->type == SOCKENT_TYPE_CLIENT)
+    secret = se->data.client.password;
+  else
+  {
+    snapshot = fbh_snapshot (se->data.server.userdb);
+    secret = fbh_snapshot_get (snapshot, username);
+  }
+
+  if (secret == NULL)
+  {
+    fbh_snapshot_release (snapshot);
+    gcry_md_close (*hmac_ptr);
+    *hmac_ptr = NULL;
+    return (NULL);
+  }
+
+  err = gcry_md_setkey (*hmac_ptr, secret, strlen (secret));
+  if (err != 0)
+  {
+    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
+    gcry_md_close (*hmac_ptr);
+    *hmac_ptr = NULL;
+    fbh_snapshot_release (snapshot);
+    return (NULL);
+  }
+
+  /* Label the handle with the password it actually got: the file may have
+   * changed since `key' was looked up. */
+  if (hmac_key != NULL)
+    gcry_md_hash_buffer (GCRY_MD_SHA256, hmac_key, secret, strlen (secret));
+  fbh_snapshot_release (snapshot);
+
+  return (*hmac_ptr);
+} /* }}} gcry_md_hd_t network_get_hmac_sha256 */
+
 static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
     const void *iv, size_t iv_size, const char *username)
 {
   gcry_error_t err;
   gcry_cipher_hd_t *cyper_ptr;
+  unsigned char *cypher_key;
   unsigned char password_hash[32];
+  int set_key = 1;
 
   if (se->type == SOCKENT_TYPE_CLIENT)
   {
 	  cyper_ptr = &se->data.client.cypher;
 	  memcpy (password_hash, se->data.client.password_hash,
 			  sizeof (password_hash));
+	  /* The client's handle is only ever used with the client's key. */
+	  cypher_key = NULL;
   }
   else
   {
-	  char *secret;
+	  network_crypto_t *crypto;
 
-	  cyper_ptr = &se->data.server.cypher;
+	  crypto = network_get_thread_crypto ();
+	  if (crypto == NULL)
+		  return (NULL);
 
 	  if (username == NULL)
 		  return (NULL);
 
-	  secret = fbh_get (se->data.server.userdb, username);
-	  if (secret == NULL)
+	  if (network_get_user_key (se, username, password_hash) != 0)
 		  return (NULL);
 
-	  gcry_md_hash_buffer (GCRY_MD_SHA256,
-			  password_hash,
-			  secret, strlen (secret));
-
-	  sfree (secret);
+	  cyper_ptr = &crypto->cypher;
+	  cypher_key = crypto->cypher_key;
   }
 
   if (*cyper_ptr == NULL)
@@ -461,27 +1199,35 @@ static gcry_cipher_hd_t network_get_aes256_cypher (sockent_t *se, /* {{{ */
       return (NULL);
     }
   }
-  else
+  else if ((cypher_key == NULL)
+      || (memcmp (cypher_key, password_hash, sizeof (password_hash)) == 0))
   {
+    /* Resetting keeps the key, so only the IV has to be set. */
     gcry_cipher_reset (*cyper_ptr);
+    set_key = 0;
   }
   assert (*cyper_ptr != NULL);
 
-  err = gcry_cipher_setkey (*cyper_ptr,
-      password_hash, sizeof (password_hash));
-  if (err != 0)
+  if (set_key)
   {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
-        gcry_strerror (err));
-    gcry_cipher_close (*cyper_ptr);
-    *cyper_ptr = NULL;
-    return (NULL);
+    err = gcry_cipher_setkey (*cyper_ptr,
+        password_hash, sizeof (password_hash));
+    if (err != 0)
+    {
+      ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+          gcry_strerror (err));
+      gcry_cipher_close (*cyper_ptr);
+      *cyper_ptr = NULL;
+      return (NULL);
+    }
+    if (cypher_key != NULL)
+      memcpy (cypher_key, password_hash, sizeof (password_hash));
   }
 
   err = gcry_cipher_setiv (*cyper_ptr, iv, iv_size);
   if (err != 0)
   {
-    ERROR ("network plugin: gcry_cipher_setkey returned: %s",
+    ERROR ("network plugin: gcry_cipher_setiv returned: %s",
         gcry_strerror (err));
     gcry_cipher_close (*cyper_ptr);
     *cyper_ptr = NULL;
@@ -665,8 +1411,87 @@ static int write_part_string (char **ret_buffer, int *ret_buffer_len,
 	return (0);
 } /* int write_part_string */
 
-static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
-		value_t **ret_values, int *ret_num_values)
+static void string_table_add (string_table_t *st, /* {{{ */
+		const char *str, size_t str_len)
+{
+	if (st->strings_num >= NETWORK_STRING_TABLE_SIZE)
+		return;
+
+	st->strings[st->strings_num] = str;
+	st->lengths[st->strings_num] = str_len;
+	st->strings_num++;
+} /* }}} void string_table_add */
+
+static int string_table_lookup (const string_table_t *st, /* {{{ */
+		const char *str, size_t str_len)
+{
+	int i;
+
+	for (i = 0; i < st->strings_num; i++)
+		if ((st->lengths[i] == str_len)
+				&& (memcmp (st->strings[i], str, str_len) == 0))
+			return (i);
+
+	return (-1);
+} /* }}} int string_table_lookup */
+
+/* Writes a reference to entry `index' of the packet's string table. */
+static int write_part_string_ref (char **ret_buffer, /* {{{ */
+		int *ret_buffer_len, int type, uint16_t index)
+{
+	part_header_t pkg_head;
+	uint16_t pkg_index;
+	int packet_len;
+
+	packet_len = sizeof (pkg_head) + sizeof (pkg_index);
+	if (*ret_buffer_len < packet_len)
+		return (-1);
+
+	pkg_head.type = htons (type);
+	pkg_head.length = htons (packet_len);
+	pkg_index = htons (index);
+
+	memcpy (*ret_buffer, &pkg_head, sizeof (pkg_head));
+	memcpy (*ret_buffer + sizeof (pkg_head), &pkg_index, sizeof (pkg_index));
+
+	*ret_buffer += packet_len;
+	*ret_buffer_len -= packet_len;
+
+	return (0);
+} /* }}} int write_part_string_ref */
+
+/* Writes one of the identifier fields. If `st' is not NULL and the string has
+ * already been written to this packet, a reference of type `ref_type' is
+ * written instead. Strings shorter than two bytes are always written, because
+ * the reference would not be any smaller. */
+static int write_part_identifier (char **ret_buffer, /* {{{ */
+		int *ret_buffer_len, string_table_t *st,
+		int type, int ref_type, const char *str)
+{
+	char *part = *ret_buffer;
+	size_t str_len = strlen (str);
+	int status;
+
+	if ((st != NULL) && (str_len >= 2))
+	{
+		int index = string_table_lookup (st, str, str_len);
+		if (index >= 0)
+			return (write_part_string_ref (ret_buffer, ret_buffer_len,
+						ref_type, (uint16_t) index));
+	}
+
+	status = write_part_string (ret_buffer, ret_buffer_len,
+			type, str, (int) str_len);
+	if ((status == 0) && (st != NULL))
+		string_table_add (st, part + sizeof (part_header_t), str_len);
+
+	return (status);
+} /* }}} int write_part_identifier */
+
+/* Decodes the values into the batch's `values', which has to be large enough
+ * for all values of the packet. */
+static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
+		dispatch_batch_t *batch, value_t **ret_values, int *ret_num_values)
 {
 	char *buffer = *ret_buffer;
 	size_t buffer_len = *ret_buffer_len;
@@ -679,7 +1504,7 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 	uint16_t pkg_type;
 	uint16_t pkg_numval;
 
-	uint8_t *pkg_types;
+	const uint8_t *pkg_types;
 	value_t *pkg_values;
 
 	if (buffer_len < 15)
@@ -723,18 +1548,21 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		return (-1);
 	}
 
-	pkg_types = (uint8_t *) malloc (pkg_numval * sizeof (uint8_t));
-	pkg_values = (value_t *) malloc (pkg_numval * sizeof (value_t));
-	if ((pkg_types == NULL) || (pkg_values == NULL))
+	/* Every value takes more space in the packet than in `values', so
+	 * this only fails if the batch has not been set up for the packet. */
+	if ((batch->values_size - batch->values_num) < (size_t) pkg_numval)
 	{
-		sfree (pkg_types);
-		sfree (pkg_values);
-		ERROR ("network plugin: parse_part_values: malloc failed.");
+		ERROR ("network plugin: parse_part_values: "
+				"Not enough space for %"PRIu16" values.",
+				pkg_numval);
 		return (-1);
 	}
 
-	memcpy ((void *) pkg_types, (void *) buffer, pkg_numval * sizeof (uint8_t));
+	/* The types are read from the packet, the values are copied since
+	 * they may not be aligned. */
+	pkg_types = (const uint8_t *) buffer;
 	buffer += pkg_numval * sizeof (uint8_t);
+	pkg_values = batch->values + batch->values_num;
 	memcpy ((void *) pkg_values, (void *) buffer, pkg_numval * sizeof (value_t));
 	buffer += pkg_numval * sizeof (value_t);
 
@@ -762,8 +1590,6 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 		    NOTICE ("network plugin: parse_part_values: "
 			"Don't know how to handle data source type %"PRIu8,
 			pkg_types[i]);
-		    sfree (pkg_types);
-		    sfree (pkg_values);
 		    return (-1);
 		} /* switch (pkg_types[i]) */
 	}
@@ -773,7 +1599,7 @@ static int parse_part_values (void **ret_buffer, size_t *ret_buffer_len,
 	*ret_num_values = pkg_numval;
 	*ret_values     = pkg_values;
 
-	sfree (pkg_types);
+	batch->values_num += pkg_numval;
 
 	return (0);
 } /* int parse_part_values */
@@ -818,8 +1644,10 @@ static int parse_part_number (void **ret_buffer, size_t *ret_buffer_len,
 	return (0);
 } /* int parse_part_number */
 
-static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
-		char *output, int output_len)
+/* Checks a string part and returns a pointer to the string in the packet.
+ * Together with the null byte it's at most `output_len' bytes long. */
+static int parse_part_string_ptr (void **ret_buffer, /* {{{ */
+		size_t *ret_buffer_len, const char **ret_string, int output_len)
 {
 	char *buffer = *ret_buffer;
 	size_t buffer_len = *ret_buffer_len;
@@ -879,14 +1707,14 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
 		return (-1);
 	}
 
-	/* All sanity checks successfull, let's copy the data over */
+	/* All sanity checks successfull */
+	*ret_string = buffer;
 	output_len = pkg_length - header_size;
-	memcpy ((void *) output, (void *) buffer, output_len);
 	buffer += output_len;
 
 	/* For some very weird reason '\0' doesn't do the trick on SPARC in
 	 * this statement. */
-	if (output[output_len - 1] != 0)
+	if (buffer[-1] != 0)
 	{
 		WARNING ("network plugin: parse_part_string: "
 				"Received string does not end "
@@ -897,13 +1725,111 @@ static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
 	*ret_buffer = buffer;
 	*ret_buffer_len = buffer_len - pkg_length;
 
+	return (0);
+} /* }}} int parse_part_string_ptr */
+
+static int parse_part_string (void **ret_buffer, size_t *ret_buffer_len,
+		char *output, int output_len)
+{
+	const char *str = NULL;
+	int status;
+
+	status = parse_part_string_ptr (ret_buffer, ret_buffer_len,
+			&str, output_len);
+	if (status != 0)
+		return (status);
+
+	sstrncpy (output, str, output_len);
 	return (0);
 } /* int parse_part_string */
 
+/* Parses a part of one of the `TYPE_*_REF' types and returns the referenced
+ * string of `st'. */
+static int parse_part_string_ref (void **ret_buffer, /* {{{ */
+		size_t *ret_buffer_len, const string_table_t *st,
+		const char **ret_string)
+{
+	char *buffer = *ret_buffer;
+	size_t buffer_len = *ret_buffer_len;
+
+	uint16_t tmp16;
+	size_t exp_size = 3 * sizeof (uint16_t);
+
+	uint16_t pkg_length;
+	uint16_t index;
+
+	if (buffer_len < exp_size)
+	{
+		WARNING ("network plugin: parse_part_string_ref: "
+				"Packet too short: "
+				"Chunk of size %zu expected, "
+				"but buffer has only %zu bytes left.",
+				exp_size, buffer_len);
+		return (-1);
+	}
+
+	memcpy ((void *) &tmp16, buffer, sizeof (tmp16));
+	buffer += sizeof (tmp16);
+	/* pkg_type = ntohs (tmp16); */
+
+	memcpy ((void *) &tmp16, buffer, sizeof (tmp16));
+	buffer += sizeof (tmp16);
+	pkg_length = ntohs (tmp16);
+
+	if ((pkg_length != exp_size) || (pkg_length > buffer_len))
+	{
+		WARNING ("network plugin: parse_part_string_ref: "
+				"Invalid part length: %"PRIu16, pkg_length);
+		return (-1);
+	}
+
+	memcpy ((void *) &tmp16, buffer, sizeof (tmp16));
+	buffer += sizeof (tmp16);
+	index = ntohs (tmp16);
+
+	if (index >= st->strings_num)
+	{
+		WARNING ("network plugin: parse_part_string_ref: "
+				"Reference to string %"PRIu16" received, "
+				"but the packet has only %i strings so far.",
+				index, st->strings_num);
+		return (-1);
+	}
+
+	*ret_string = st->strings[index];
+
+	*ret_buffer = buffer;
+	*ret_buffer_len = buffer_len - pkg_length;
+
+	return (0);
+} /* }}} int parse_part_string_ref */
+
+/* Parses one of the identifier parts, either a string or a reference to a
+ * previous string of the same packet. Strings are added to `st'. The string
+ * returned points into the packet. */
+static int parse_part_identifier (void **ret_buffer, /* {{{ */
+		size_t *ret_buffer_len, string_table_t *st, int is_ref,
+		const char **ret_string)
+{
+	int status;
+
+	if (is_ref)
+		return (parse_part_string_ref (ret_buffer, ret_buffer_len, st,
+					ret_string));
+
+	status = parse_part_string_ptr (ret_buffer, ret_buffer_len,
+			ret_string, DATA_MAX_NAME_LEN);
+	if (status == 0)
+		string_table_add (st, *ret_string, strlen (*ret_string));
+
+	return (status);
+} /* }}} int parse_part_identifier */
+
 /* Forward declaration: parse_part_sign_sha256 and parse_part_encr_aes256 call
  * parse_packet and vice versa. */
-#define PP_SIGNED    0x01
-#define PP_ENCRYPTED 0x02
+#define PP_SIGNED     0x01
+#define PP_ENCRYPTED  0x02
+#define PP_COMPRESSED 0x04
 static int parse_packet (sockent_t *se,
 		void *buffer, size_t buffer_size, int flags,
 		const char *username);
@@ -924,14 +1850,13 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   size_t buffer_offset;
 
   size_t username_len;
-  char *secret;
+  unsigned char key[32];
 
   part_signature_sha256_t pss;
   uint16_t pss_head_length;
   char hash[sizeof (pss.hash)];
 
   gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash_ptr;
 
   buffer = *ret_buffer;
@@ -979,32 +1904,17 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   assert (buffer_offset == pss_head_length);
 
   /* Query the password */
-  secret = fbh_get (se->data.server.userdb, pss.username);
-  if (secret == NULL)
+  if (network_get_user_key (se, pss.username, key) != 0)
   {
     ERROR ("network plugin: Unknown user: %s", pss.username);
     sfree (pss.username);
     return (-ENOENT);
   }
 
-  /* Create a hash device and check the HMAC */
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC-SHA-256 object failed: %s",
-        gcry_strerror (err));
-    sfree (secret);
-    sfree (pss.username);
-    return (-1);
-  }
-
-  err = gcry_md_setkey (hd, secret, strlen (secret));
-  if (err != 0)
+  /* Get a hash device and check the HMAC */
+  hd = network_get_hmac_sha256 (se, pss.username, key);
+  if (hd == NULL)
   {
-    ERROR ("network plugin: gcry_md_setkey failed: %s", gcry_strerror (err));
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
@@ -1016,17 +1926,11 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
   if (hash_ptr == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    sfree (secret);
     sfree (pss.username);
     return (-1);
   }
   memcpy (hash, hash_ptr, sizeof (hash));
 
-  /* Clean up */
-  gcry_md_close (hd);
-  hd = NULL;
-
   if (memcmp (pss.hash, hash, sizeof (pss.hash)) != 0)
   {
     WARNING ("network plugin: Verifying HMAC-SHA-256 signature failed: "
@@ -1038,7 +1942,6 @@ static int parse_part_sign_sha256 (sockent_t *se, /* {{{ */
         flags | PP_SIGNED, pss.username);
   }
 
-  sfree (secret);
   sfree (pss.username);
 
   *ret_buffer = buffer + buffer_len;
@@ -1265,6 +2168,108 @@ static int parse_part_encr_aes256 (sockent_t *se, /* {{{ */
 } /* }}} int parse_part_encr_aes256 */
 #endif /* !HAVE_LIBGCRYPT */
 
+static int parse_part_compr_lz4 (sockent_t *se, /* {{{ */
+    void **ret_buffer, size_t *ret_buffer_size, int flags,
+    const char *username)
+{
+  char *buffer = *ret_buffer;
+  size_t buffer_size = *ret_buffer_size;
+  size_t part_size;
+  uint16_t tmp16;
+#if HAVE_LIBLZ4
+  size_t payload_size;
+  size_t offset;
+  uint32_t tmp32;
+  char *payload;
+  int status;
+#else
+  static int warning_has_been_printed = 0;
+#endif
+
+  /* parse_packet assures this minimum size. */
+  assert (buffer_size >= (2 * sizeof (uint16_t)));
+
+  memcpy (&tmp16, buffer + sizeof (uint16_t), sizeof (tmp16));
+  part_size = ntohs (tmp16);
+  if ((part_size <= PART_COMPRESSION_LZ4_SIZE)
+      || (part_size > buffer_size))
+  {
+    NOTICE ("network plugin: parse_part_compr_lz4: "
+        "Discarding part with invalid size.");
+    return (-1);
+  }
+
+#if HAVE_LIBLZ4
+  /* The sender only compresses plain parts, so this can only happen with a
+   * forged packet. */
+  if ((flags & PP_COMPRESSED) != 0)
+  {
+    NOTICE ("network plugin: parse_part_compr_lz4: "
+        "Discarding nested compressed part.");
+    return (-1);
+  }
+
+  memcpy (&tmp32, buffer + 2 * sizeof (uint16_t), sizeof (tmp32));
+  payload_size = (size_t) ntohl (tmp32);
+  if ((payload_size == 0) || (payload_size > BUFF_COMPRESSED_MAX))
+  {
+    NOTICE ("network plugin: parse_part_compr_lz4: "
+        "Discarding part with invalid uncompressed size %zu.",
+        payload_size);
+    return (-1);
+  }
+
+  payload = malloc (payload_size);
+  if (payload == NULL)
+    return (-ENOMEM);
+
+  status = LZ4_decompress_safe (buffer + PART_COMPRESSION_LZ4_SIZE, payload,
+      (int) (part_size - PART_COMPRESSION_LZ4_SIZE), (int) payload_size);
+  if (status != (int) payload_size)
+  {
+    sfree (payload);
+    NOTICE ("network plugin: parse_part_compr_lz4: "
+        "LZ4_decompress_safe failed.");
+    return (-1);
+  }
+
+  offset = 0;
+  while ((payload_size - offset) > sizeof (tmp16))
+  {
+    size_t frame_size;
+
+    memcpy (&tmp16, payload + offset, sizeof (tmp16));
+    frame_size = ntohs (tmp16);
+    offset += sizeof (tmp16);
+
+    if (frame_size > (payload_size - offset))
+    {
+      NOTICE ("network plugin: parse_part_compr_lz4: "
+          "Discarding truncated packet.");
+      break;
+    }
+
+    parse_packet (se, payload + offset, frame_size,
+        flags | PP_COMPRESSED, username);
+    offset += frame_size;
+  }
+  sfree (payload);
+#else /* if !HAVE_LIBLZ4 */
+  if (warning_has_been_printed == 0)
+  {
+    WARNING ("network plugin: Received compressed packet, but the network "
+        "plugin was not linked with liblz4, so I cannot "
+        "decompress it. The part will be discarded.");
+    warning_has_been_printed = 1;
+  }
+#endif /* !HAVE_LIBLZ4 */
+
+  *ret_buffer = buffer + part_size;
+  *ret_buffer_size = buffer_size - part_size;
+
+  return (0);
+} /* }}} int parse_part_compr_lz4 */
+
 #undef BUFFER_READ
 
 static int parse_packet (sockent_t *se, /* {{{ */
@@ -1275,6 +2280,12 @@ static int parse_packet (sockent_t *se, /* {{{ */
 
 	value_list_t vl = VALUE_LIST_INIT;
 	notification_t n;
+	packet_fields_t fields;
+	dispatch_batch_t batch;
+	string_table_t strings;
+
+	size_t probe_size = buffer_size;
+	cdtime_t probe_start = CD_PROBE_START ();
 
 #if HAVE_LIBGCRYPT
 	int packet_was_signed = (flags & PP_SIGNED);
@@ -1285,6 +2296,13 @@ static int parse_packet (sockent_t *se, /* {{{ */
 
 	memset (&vl, '\0', sizeof (vl));
 	memset (&n, '\0', sizeof (n));
+	memset (&batch, '\0', sizeof (batch));
+	fields.host = "";
+	fields.plugin = "";
+	fields.plugin_instance = "";
+	fields.type = "";
+	fields.type_instance = "";
+	strings.strings_num = 0;
 	status = 0;
 
 	while ((status == 0) && (0 < buffer_size)
@@ -1362,16 +2380,42 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			continue;
 		}
 #endif /* HAVE_LIBGCRYPT */
+		else if (pkg_type == TYPE_COMPR_LZ4)
+		{
+			status = parse_part_compr_lz4 (se,
+					&buffer, &buffer_size, flags, username);
+			if (status != 0)
+			{
+				ERROR ("network plugin: Decompressing LZ4 "
+						"part failed "
+						"with status %i.", status);
+				break;
+			}
+		}
 		else if (pkg_type == TYPE_VALUES)
 		{
+			/* Each value takes more than sizeof (value_t) bytes in
+			 * the packet, so this is enough for all of them. */
+			if (batch.values == NULL)
+			{
+				batch.values_size = probe_size / sizeof (value_t);
+				batch.values = malloc (batch.values_size
+						* sizeof (*batch.values));
+				if (batch.values == NULL)
+				{
+					ERROR ("network plugin: parse_packet: "
+							"malloc failed.");
+					status = -1;
+					break;
+				}
+			}
+
 			status = parse_part_values (&buffer, &buffer_size,
-					&vl.values, &vl.values_len);
+					&batch, &vl.values, &vl.values_len);
 			if (status != 0)
 				break;
 
-			network_dispatch_values (&vl, username);
-
-			sfree (vl.values);
+			network_dispatch_values (&vl, &fields, username, &batch);
 		}
 		else if (pkg_type == TYPE_TIME)
 		{
@@ -1411,46 +2455,50 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			if (status == 0)
 				vl.interval = (cdtime_t) tmp;
 		}
-		else if (pkg_type == TYPE_HOST)
+		else if (pkg_type == TYPE_ORIGIN_HR)
 		{
-			status = parse_part_string (&buffer, &buffer_size,
-					vl.host, sizeof (vl.host));
+			uint64_t tmp = 0;
+			status = parse_part_number (&buffer, &buffer_size,
+					&tmp);
 			if (status == 0)
-				sstrncpy (n.host, vl.host, sizeof (n.host));
+				vl.trace.origin = (cdtime_t) tmp;
 		}
-		else if (pkg_type == TYPE_PLUGIN)
+		else if ((pkg_type == TYPE_HOST)
+				|| (pkg_type == TYPE_HOST_REF))
 		{
-			status = parse_part_string (&buffer, &buffer_size,
-					vl.plugin, sizeof (vl.plugin));
-			if (status == 0)
-				sstrncpy (n.plugin, vl.plugin,
-						sizeof (n.plugin));
+			status = parse_part_identifier (&buffer, &buffer_size,
+					&strings, pkg_type == TYPE_HOST_REF,
+					&fields.host);
 		}
-		else if (pkg_type == TYPE_PLUGIN_INSTANCE)
+		else if ((pkg_type == TYPE_PLUGIN)
+				|| (pkg_type == TYPE_PLUGIN_REF))
 		{
-			status = parse_part_string (&buffer, &buffer_size,
-					vl.plugin_instance,
-					sizeof (vl.plugin_instance));
-			if (status == 0)
-				sstrncpy (n.plugin_instance,
-						vl.plugin_instance,
-						sizeof (n.plugin_instance));
+			status = parse_part_identifier (&buffer, &buffer_size,
+					&strings, pkg_type == TYPE_PLUGIN_REF,
+					&fields.plugin);
 		}
-		else if (pkg_type == TYPE_TYPE)
+		else if ((pkg_type == TYPE_PLUGIN_INSTANCE)
+				|| (pkg_type == TYPE_PLUGIN_INSTANCE_REF))
 		{
-			status = parse_part_string (&buffer, &buffer_size,
-					vl.type, sizeof (vl.type));
-			if (status == 0)
-				sstrncpy (n.type, vl.type, sizeof (n.type));
+			status = parse_part_identifier (&buffer, &buffer_size,
+					&strings,
+					pkg_type == TYPE_PLUGIN_INSTANCE_REF,
+					&fields.plugin_instance);
 		}
-		else if (pkg_type == TYPE_TYPE_INSTANCE)
+		else if ((pkg_type == TYPE_TYPE)
+				|| (pkg_type == TYPE_TYPE_REF))
 		{
-			status = parse_part_string (&buffer, &buffer_size,
-					vl.type_instance,
-					sizeof (vl.type_instance));
-			if (status == 0)
-				sstrncpy (n.type_instance, vl.type_instance,
-						sizeof (n.type_instance));
+			status = parse_part_identifier (&buffer, &buffer_size,
+					&strings, pkg_type == TYPE_TYPE_REF,
+					&fields.type);
+		}
+		else if ((pkg_type == TYPE_TYPE_INSTANCE)
+				|| (pkg_type == TYPE_TYPE_INSTANCE_REF))
+		{
+			status = parse_part_identifier (&buffer, &buffer_size,
+					&strings,
+					pkg_type == TYPE_TYPE_INSTANCE_REF,
+					&fields.type_instance);
 		}
 		else if (pkg_type == TYPE_MESSAGE)
 		{
@@ -1484,6 +2532,15 @@ static int parse_packet (sockent_t *se, /* {{{ */
 			}
 			else
 			{
+				sstrncpy (n.host, fields.host, sizeof (n.host));
+				sstrncpy (n.plugin, fields.plugin,
+						sizeof (n.plugin));
+				sstrncpy (n.plugin_instance,
+						fields.plugin_instance,
+						sizeof (n.plugin_instance));
+				sstrncpy (n.type, fields.type, sizeof (n.type));
+				sstrncpy (n.type_instance, fields.type_instance,
+						sizeof (n.type_instance));
 				plugin_dispatch_notification (&n);
 			}
 		}
@@ -1497,16 +2554,24 @@ static int parse_packet (sockent_t *se, /* {{{ */
 		}
 		else
 		{
-			DEBUG ("network plugin: parse_packet: Unknown part"
-					" type: 0x%04hx", pkg_type);
+			/* Also skips `TYPE_PAD' parts. */
+			if (pkg_type != TYPE_PAD)
+				DEBUG ("network plugin: parse_packet: Unknown part"
+						" type: 0x%04hx", pkg_type);
 			buffer = ((char *) buffer) + pkg_length;
+			buffer_size -= (size_t) pkg_length;
 		}
 	} /* while (buffer_size > sizeof (part_header_t)) */
 
+	network_dispatch_batch (&batch);
+
 	if (status == 0 && buffer_size > 0)
 		WARNING ("network plugin: parse_packet: Received truncated "
 				"packet, try increasing `MaxPacketSize'");
 
+	CD_PROBE4 (network__packet, probe_size, flags,
+			CD_PROBE_NS (probe_start), status);
+
 	return (status);
 } /* }}} int parse_packet */
 
@@ -1523,6 +2588,8 @@ static void free_sockent_client (struct sockent_client *sec) /* {{{ */
   sfree (sec->password);
   if (sec->cypher != NULL)
     gcry_cipher_close (sec->cypher);
+  if (sec->hmac != NULL)
+    gcry_md_close (sec->hmac);
 #endif
 } /* }}} void free_sockent_client */
 
@@ -1543,8 +2610,12 @@ static void free_sockent_server (struct sockent_server *ses) /* {{{ */
 #if HAVE_LIBGCRYPT
   sfree (ses->auth_file);
   fbh_destroy (ses->userdb);
-  if (ses->cypher != NULL)
-    gcry_cipher_close (ses->cypher);
+  if (ses->keys != NULL)
+  {
+    network_free_keys (ses->keys);
+    c_avl_destroy (ses->keys);
+    pthread_mutex_destroy (&ses->keys_lock);
+  }
 #endif
 } /* }}} void free_sockent_server */
 
@@ -1740,7 +2811,27 @@ static int network_set_interface (const sockent_t *se, const struct addrinfo *ai
 	return (0);
 } /* }}} network_set_interface */
 
-static int network_bind_socket (int fd, const struct addrinfo *ai, const int interface_idx)
+static _Bool network_is_multicast (const struct addrinfo *ai) /* {{{ */
+{
+	if (ai->ai_family == AF_INET)
+	{
+		struct sockaddr_in *addr = (struct sockaddr_in *) ai->ai_addr;
+		return (IN_MULTICAST (ntohl (addr->sin_addr.s_addr)) ? 1 : 0);
+	}
+	else if (ai->ai_family == AF_INET6)
+	{
+		struct sockaddr_in6 *addr = (struct sockaddr_in6 *) ai->ai_addr;
+		return (IN6_IS_ADDR_MULTICAST (&addr->sin6_addr) ? 1 : 0);
+	}
+
+	return (0);
+} /* }}} _Bool network_is_multicast */
+
+/* If `reuse_port' is true, SO_REUSEPORT is set so that several sockets can be
+ * bound to the same address, with the kernel distributing the incoming
+ * datagrams between them. */
+static int network_bind_socket (int fd, const struct addrinfo *ai,
+		const int interface_idx, _Bool reuse_port)
 {
 	int loop = 0;
 	int yes  = 1;
@@ -1754,6 +2845,20 @@ static int network_bind_socket (int fd, const struct addrinfo *ai, const int int
 		return (-1);
 	}
 
+#ifdef SO_REUSEPORT
+	if (reuse_port
+			&& (setsockopt (fd, SOL_SOCKET, SO_REUSEPORT,
+					&yes, sizeof (yes)) == -1))
+	{
+		char errbuf[1024];
+		ERROR ("setsockopt (SO_REUSEPORT): %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+#else
+	assert (!reuse_port);
+#endif
+
 	DEBUG ("fd = %i; calling `bind'", fd);
 
 	if (bind (fd, ai->ai_addr, ai->ai_addrlen) == -1)
@@ -1911,7 +3016,7 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.server.security_level = SECURITY_LEVEL_NONE;
 		se->data.server.auth_file = NULL;
 		se->data.server.userdb = NULL;
-		se->data.server.cypher = NULL;
+		se->data.server.keys = NULL;
 #endif
 	}
 	else
@@ -1923,6 +3028,7 @@ static int sockent_init (sockent_t *se, int type) /* {{{ */
 		se->data.client.username = NULL;
 		se->data.client.password = NULL;
 		se->data.client.cypher = NULL;
+		se->data.client.hmac = NULL;
 #endif
 	}
 
@@ -1986,6 +3092,19 @@ static int sockent_open (sockent_t *se) /* {{{ */
 					return (-1);
 			}
 		}
+		if (se->data.server.userdb != NULL)
+		{
+			se->data.server.keys = c_avl_create ((void *) strcmp);
+			if (se->data.server.keys == NULL)
+			{
+				ERROR ("network plugin: c_avl_create failed.");
+				return (-1);
+			}
+			se->data.server.keys_generation =
+				fbh_generation (se->data.server.userdb);
+			pthread_mutex_init (&se->data.server.keys_lock,
+					/* attr = */ NULL);
+		}
 	}
 #endif /* }}} HAVE_LIBGCRYPT */
 
@@ -2007,8 +3126,16 @@ static int sockent_open (sockent_t *se) /* {{{ */
 	ai_hints.ai_flags |= AI_ADDRCONFIG;
 #endif
 	ai_hints.ai_family   = AF_UNSPEC;
-	ai_hints.ai_socktype = SOCK_DGRAM;
-	ai_hints.ai_protocol = IPPROTO_UDP;
+	if (se->transport == NETWORK_TRANSPORT_TCP)
+	{
+		ai_hints.ai_socktype = SOCK_STREAM;
+		ai_hints.ai_protocol = IPPROTO_TCP;
+	}
+	else
+	{
+		ai_hints.ai_socktype = SOCK_DGRAM;
+		ai_hints.ai_protocol = IPPROTO_UDP;
+	}
 
 	ai_return = getaddrinfo (node, service, &ai_hints, &ai_list);
 	if (ai_return != 0)
@@ -2026,42 +3153,101 @@ static int sockent_open (sockent_t *se) /* {{{ */
 
 		if (se->type == SOCKENT_TYPE_SERVER) /* {{{ */
 		{
-			int *tmp;
-
-			tmp = realloc (se->data.server.fd,
-					sizeof (*tmp) * (se->data.server.fd_num + 1));
-			if (tmp == NULL)
-			{
-				ERROR ("network plugin: realloc failed.");
-				continue;
-			}
-			se->data.server.fd = tmp;
-			tmp = se->data.server.fd + se->data.server.fd_num;
-
-			*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
-					ai_ptr->ai_protocol);
-			if (*tmp < 0)
-			{
-				char errbuf[1024];
-				ERROR ("network plugin: socket(2) failed: %s",
-						sstrerror (errno, errbuf,
-							sizeof (errbuf)));
-				continue;
-			}
+			int copies = 1;
+			int i;
+
+			/* Open one socket per receive thread, so the kernel can
+			 * spread the load. Multicast datagrams would be
+			 * delivered to each of these sockets, so only one is
+			 * opened for multicast groups. */
+#ifdef SO_REUSEPORT
+			if (!network_is_multicast (ai_ptr)
+					&& (se->transport == NETWORK_TRANSPORT_UDP))
+				copies = network_config_receive_threads;
+#endif
 
-			status = network_bind_socket (*tmp, ai_ptr, se->interface);
-			if (status != 0)
+			for (i = 0; i < copies; i++)
 			{
-				close (*tmp);
-				*tmp = -1;
-				continue;
+				int *tmp;
+
+				tmp = realloc (se->data.server.fd,
+						sizeof (*tmp) * (se->data.server.fd_num + 1));
+				if (tmp == NULL)
+				{
+					ERROR ("network plugin: realloc failed.");
+					break;
+				}
+				se->data.server.fd = tmp;
+				tmp = se->data.server.fd + se->data.server.fd_num;
+
+				/* Passed on by the previous daemon, see
+				 * utils_handoff.h. It's bound and, for TCP,
+				 * listening already. */
+				*tmp = handoff_take (ai_ptr->ai_addr,
+						ai_ptr->ai_addrlen, ai_ptr->ai_socktype);
+				if (*tmp >= 0)
+				{
+					handoff_export (*tmp);
+					se->data.server.fd_num++;
+					continue;
+				}
+
+				*tmp = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+						ai_ptr->ai_protocol);
+				if (*tmp < 0)
+				{
+					char errbuf[1024];
+					ERROR ("network plugin: socket(2) failed: %s",
+							sstrerror (errno, errbuf,
+								sizeof (errbuf)));
+					break;
+				}
+
+				status = network_bind_socket (*tmp, ai_ptr,
+						se->interface, (copies > 1));
+				if ((status == 0)
+						&& (se->transport == NETWORK_TRANSPORT_TCP)
+						&& (listen (*tmp, SOMAXCONN) != 0))
+				{
+					char errbuf[1024];
+					ERROR ("network plugin: listen(2) failed: %s",
+							sstrerror (errno, errbuf,
+								sizeof (errbuf)));
+					status = -1;
+				}
+				if (status != 0)
+				{
+					close (*tmp);
+					*tmp = -1;
+					break;
+				}
+
+				handoff_export (*tmp);
+				se->data.server.fd_num++;
 			}
-
-			se->data.server.fd_num++;
 			continue;
 		} /* }}} if (se->type == SOCKENT_TYPE_SERVER) */
 		else /* if (se->type == SOCKENT_TYPE_CLIENT) {{{ */
 		{
+			/* TCP sockets are connected by the send thread, see
+			 * `network_connect_stream'. Only the address is
+			 * needed here. */
+			if (se->transport == NETWORK_TRANSPORT_TCP)
+			{
+				se->data.client.addr = malloc (sizeof (*se->data.client.addr));
+				if (se->data.client.addr == NULL)
+				{
+					ERROR ("network plugin: malloc failed.");
+					continue;
+				}
+
+				memset (se->data.client.addr, 0, sizeof (*se->data.client.addr));
+				assert (sizeof (*se->data.client.addr) >= ai_ptr->ai_addrlen);
+				memcpy (se->data.client.addr, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+				se->data.client.addrlen = ai_ptr->ai_addrlen;
+				break;
+			}
+
 			se->data.client.fd = socket (ai_ptr->ai_family,
 					ai_ptr->ai_socktype,
 					ai_ptr->ai_protocol);
@@ -2105,6 +3291,11 @@ static int sockent_open (sockent_t *se) /* {{{ */
 		if (se->data.server.fd_num <= 0)
 			return (-1);
 	}
+	else if (se->transport == NETWORK_TRANSPORT_TCP)
+	{
+		if (se->data.client.addr == NULL)
+			return (-1);
+	}
 	else /* if (se->type == SOCKENT_TYPE_CLIENT) */
 	{
 		if (se->data.client.fd < 0)
@@ -2122,7 +3313,21 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	if (se == NULL)
 		return (-1);
 
-	if (se->type == SOCKENT_TYPE_SERVER)
+	if ((se->type == SOCKENT_TYPE_SERVER)
+			&& (se->transport == NETWORK_TRANSPORT_TCP))
+	{
+		/* Handled by the stream thread, which looks them up in
+		 * `listen_sockets'. */
+		listen_streams_num += se->data.server.fd_num;
+
+		if (listen_sockets == NULL)
+		{
+			listen_sockets = se;
+			return (0);
+		}
+		last_ptr = listen_sockets;
+	}
+	else if (se->type == SOCKENT_TYPE_SERVER)
 	{
 		struct pollfd *tmp;
 		size_t i;
@@ -2172,239 +3377,1593 @@ static int sockent_add (sockent_t *se) /* {{{ */
 	return (0);
 } /* }}} int sockent_add */
 
-static void *dispatch_thread (void __attribute__((unused)) *arg) /* {{{ */
+static void receive_list_append (receive_list_t *list, /* {{{ */
+    receive_list_entry_t *ent)
 {
-  while (42)
-  {
-    receive_list_entry_t *ent;
-    sockent_t *se;
+  ent->next = NULL;
+  if (list->head == NULL)
+    list->head = ent;
+  else
+    list->tail->next = ent;
+  list->tail = ent;
+  list->length++;
+} /* }}} void receive_list_append */
 
-    /* Lock and wait for more data to come in */
-    pthread_mutex_lock (&receive_list_lock);
-    while ((listen_loop == 0)
-        && (receive_list_head == NULL))
-      pthread_cond_wait (&receive_list_cond, &receive_list_lock);
+/* Removes and returns the first entry of `list'. */
+static receive_list_entry_t *receive_list_shift (receive_list_t *list) /* {{{ */
+{
+  receive_list_entry_t *ent = list->head;
 
-    /* Remove the head entry and unlock */
-    ent = receive_list_head;
-    if (ent != NULL)
-      receive_list_head = ent->next;
-    receive_list_length--;
-    pthread_mutex_unlock (&receive_list_lock);
+  if (ent == NULL)
+    return (NULL);
+
+  list->head = ent->next;
+  if (list->head == NULL)
+    list->tail = NULL;
+  list->length--;
+  ent->next = NULL;
+
+  return (ent);
+} /* }}} receive_list_entry_t *receive_list_shift */
+
+/* Appends all entries of `src' to `dst' and empties `src'. */
+static void receive_list_move (receive_list_t *dst, /* {{{ */
+    receive_list_t *src)
+{
+  if (src->head == NULL)
+    return;
+
+  assert (((dst->head == NULL) && (dst->length == 0))
+      || ((dst->head != NULL) && (dst->length != 0)));
+
+  if (dst->head == NULL)
+    dst->head = src->head;
+  else
+    dst->tail->next = src->head;
+  dst->tail = src->tail;
+  dst->length += src->length;
+
+  src->head = NULL;
+  src->tail = NULL;
+  src->length = 0;
+} /* }}} void receive_list_move */
+
+static int receive_pool_init (void) /* {{{ */
+{
+  size_t num = (size_t) network_config_receive_buffers;
+  size_t i;
+
+  receive_pool_entries = calloc (num, sizeof (*receive_pool_entries));
+  receive_pool_data = malloc (num * network_config_packet_size);
+  if ((receive_pool_entries == NULL) || (receive_pool_data == NULL))
+  {
+    ERROR ("network plugin: Allocating %zu receive buffers failed.", num);
+    sfree (receive_pool_entries);
+    sfree (receive_pool_data);
+    return (-1);
+  }
+  /* The pool never grows, but it's accounted so the budget covers it. */
+  mem_account_add (mem_account_get ("network"),
+      (int64_t) (num * (sizeof (*receive_pool_entries)
+          + network_config_packet_size)));
+
+  for (i = 0; i < num; i++)
+  {
+    receive_list_entry_t *ent = receive_pool_entries + i;
+
+    ent->data = receive_pool_data + (i * network_config_packet_size);
+    ent->next = (i < (num - 1)) ? (ent + 1) : NULL;
+  }
+  receive_pool_free.head = receive_pool_entries;
+  receive_pool_free.tail = receive_pool_entries + (num - 1);
+  receive_pool_free.length = (uint64_t) num;
+
+  return (0);
+} /* }}} int receive_pool_init */
+
+static void receive_pool_destroy (void) /* {{{ */
+{
+  if (receive_pool_entries != NULL)
+    mem_account_add (mem_account_get ("network"),
+        -((int64_t) (((size_t) network_config_receive_buffers)
+            * (sizeof (*receive_pool_entries) + network_config_packet_size))));
+  memset (&receive_pool_free, 0, sizeof (receive_pool_free));
+  sfree (receive_pool_entries);
+  sfree (receive_pool_data);
+} /* }}} void receive_pool_destroy */
+
+/* Takes up to `num' free buffers from the pool and stores them in `ents'.
+ * Returns the number of buffers taken, which is zero if the pool is
+ * exhausted. */
+static size_t receive_pool_get (receive_list_entry_t **ents, /* {{{ */
+    size_t num)
+{
+  size_t i;
+
+  pthread_mutex_lock (&receive_pool_lock);
+  for (i = 0; (i < num) && (receive_pool_free.head != NULL); i++)
+    ents[i] = receive_list_shift (&receive_pool_free);
+  pthread_mutex_unlock (&receive_pool_lock);
+
+  return (i);
+} /* }}} size_t receive_pool_get */
+
+/* Returns all buffers in `list' to the pool. */
+static void receive_pool_put (receive_list_t *list) /* {{{ */
+{
+  if (list->head == NULL)
+    return;
+
+  pthread_mutex_lock (&receive_pool_lock);
+  receive_list_move (&receive_pool_free, list);
+  pthread_cond_broadcast (&receive_pool_cond);
+  pthread_mutex_unlock (&receive_pool_lock);
+} /* }}} void receive_pool_put */
+
+/* Moves the entries of `list' to the queue and wakes up its dispatch thread.
+ * Unless `block' is true, nothing is done if the queue's lock is currently
+ * held by another thread. If the queue is bounded by `MaxQueueLength', the
+ * configured drop policy is applied and dropped entries are returned to the
+ * buffer pool. While the daemon is over its `MemoryBudget', all entries are
+ * dropped. */
+static void receive_queue_push (receive_queue_t *q, /* {{{ */
+    receive_list_t *list, _Bool block)
+{
+  receive_list_t dropped = { NULL, NULL, 0 };
+  uint64_t limit = (uint64_t) network_config_queue_limit;
+
+  if (list->head == NULL)
+    return;
+
+  if (block)
+    pthread_mutex_lock (&q->lock);
+  else if (pthread_mutex_trylock (&q->lock) != 0)
+    return;
+
+  if (mem_pressure () >= MEM_PRESSURE_DROP_RECEIVED)
+  {
+    stats_counter_add (&q->dropped_memory, list->length);
+    receive_list_move (&dropped, list);
+  }
+  else if (limit == 0)
+    receive_list_move (&q->list, list);
+  else if (network_config_queue_policy == RQ_DROP_NEWEST)
+  {
+    while ((list->head != NULL) && (q->list.length < limit))
+      receive_list_append (&q->list, receive_list_shift (list));
+    receive_list_move (&dropped, list);
+  }
+  else if (network_config_queue_policy == RQ_DROP_OLDEST)
+  {
+    receive_list_move (&q->list, list);
+    while (q->list.length > limit)
+      receive_list_append (&dropped, receive_list_shift (&q->list));
+  }
+  else /* if (network_config_queue_policy == RQ_BLOCK) */
+  {
+    /* Waiting here lets the socket buffers fill up, so the kernel starts
+     * dropping packets instead. */
+    while ((listen_loop == 0) && (q->list.length >= limit))
+      pthread_cond_wait (&q->cond_space, &q->lock);
+    receive_list_move (&q->list, list);
+  }
+
+  stats_max_update (&q->length_max, q->list.length);
+  if (dropped.length > 0)
+    stats_counter_add (&q->dropped, dropped.length);
+
+  pthread_cond_signal (&q->cond);
+  pthread_mutex_unlock (&q->lock);
+
+  receive_pool_put (&dropped);
+} /* }}} void receive_queue_push */
+
+
+/* Parses the packet in `ent' with the socket entry it was received on. */
+/* Returns the listening socket entry `fd' belongs to. */
+static sockent_t *network_find_listen_socket (int fd) /* {{{ */
+{
+  sockent_t *se;
+
+  se = listen_sockets;
+  while (se != NULL)
+  {
+    size_t i;
+
+    for (i = 0; i < se->data.server.fd_num; i++)
+      if (se->data.server.fd[i] == fd)
+        return (se);
+
+    se = se->next;
+  }
+
+  return (NULL);
+} /* }}} sockent_t *network_find_listen_socket */
+
+static void network_dispatch_entry (const receive_list_entry_t *ent) /* {{{ */
+{
+  sockent_t *se;
+
+  se = network_find_listen_socket (ent->fd);
+  if (se == NULL)
+  {
+    ERROR ("network plugin: Got packet from FD %i, but can't "
+        "find an appropriate socket entry.",
+        ent->fd);
+    return;
+  }
+
+  parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
+      /* username = */ NULL);
+} /* }}} void network_dispatch_entry */
+
+static void *dispatch_thread (void *arg) /* {{{ */
+{
+  receive_queue_t *q = arg;
+
+  while (42)
+  {
+    receive_list_t work = { NULL, NULL, 0 };
+    receive_list_entry_t *ent;
+
+    /* Lock and wait for more data to come in */
+    pthread_mutex_lock (&q->lock);
+    while ((listen_loop == 0)
+        && (q->list.head == NULL))
+      pthread_cond_wait (&q->cond, &q->lock);
+
+    /* Take all queued entries at once and unlock */
+    receive_list_move (&work, &q->list);
+    if (network_config_queue_policy == RQ_BLOCK)
+      pthread_cond_broadcast (&q->cond_space);
+    pthread_mutex_unlock (&q->lock);
 
     /* Check whether we are supposed to exit. We do NOT check `listen_loop'
      * because we dispatch all missing packets before shutting down. */
-    if (ent == NULL)
+    if (work.head == NULL)
       break;
 
-    /* Look for the correct `sockent_t' */
-    se = listen_sockets;
-    while (se != NULL)
-    {
-      size_t i;
+    for (ent = work.head; ent != NULL; ent = ent->next)
+      network_dispatch_entry (ent);
 
-      for (i = 0; i < se->data.server.fd_num; i++)
-        if (se->data.server.fd[i] == ent->fd)
-          break;
+    receive_pool_put (&work);
+  } /* while (42) */
 
-      if (i < se->data.server.fd_num)
-        break;
+  return (NULL);
+} /* }}} void *dispatch_thread */
 
-      se = se->next;
-    }
+static int start_dispatch_threads (void) /* {{{ */
+{
+  size_t i;
 
-    if (se == NULL)
+  receive_queues = calloc ((size_t) network_config_dispatch_threads,
+      sizeof (*receive_queues));
+  if (receive_queues == NULL)
+  {
+    ERROR ("network plugin: calloc failed.");
+    return (-1);
+  }
+  receive_queues_num = (size_t) network_config_dispatch_threads;
+
+  for (i = 0; i < receive_queues_num; i++)
+  {
+    receive_queue_t *q = receive_queues + i;
+    int status;
+    char name[16];
+
+    pthread_mutex_init (&q->lock, /* attr = */ NULL);
+    pthread_cond_init (&q->cond, /* attr = */ NULL);
+    pthread_cond_init (&q->cond_space, /* attr = */ NULL);
+
+    ssnprintf (name, sizeof (name), "net/dispatch#%i", (int) i);
+    status = thread_create (&q->dispatch_thread_id,
+        NULL /* no attributes */,
+        dispatch_thread, q,
+        name, network_config_dispatch_cpus);
+    if (status != 0)
     {
-      ERROR ("network plugin: Got packet from FD %i, but can't "
-          "find an appropriate socket entry.",
-          ent->fd);
-      sfree (ent->data);
-      sfree (ent);
+      char errbuf[1024];
+      ERROR ("network: pthread_create failed: %s",
+          sstrerror (errno, errbuf,
+            sizeof (errbuf)));
       continue;
     }
 
-    parse_packet (se, ent->data, ent->data_len, /* flags = */ 0,
-	/* username = */ NULL);
-    sfree (ent->data);
-    sfree (ent);
-  } /* while (42) */
+    q->dispatch_thread_running = 1;
+  }
 
-  return (NULL);
-} /* }}} void *dispatch_thread */
+  return (0);
+} /* }}} int start_dispatch_threads */
 
-static int network_receive (void) /* {{{ */
+/* 32 bit FNV-1a of the sender's address. The port is not included, so a sender
+ * using several sockets still has all its packets dispatched in order. */
+static uint32_t network_source_hash (const struct sockaddr_storage *addr, /* {{{ */
+    socklen_t addrlen)
 {
-	char buffer[network_config_packet_size];
-	int  buffer_len;
+  const unsigned char *ptr = NULL;
+  size_t len = 0;
+  uint32_t hash = 2166136261U;
+  size_t i;
 
+  if ((addr->ss_family == AF_INET)
+      && (addrlen >= sizeof (struct sockaddr_in)))
+  {
+    const struct sockaddr_in *sa = (const struct sockaddr_in *) addr;
+    ptr = (const unsigned char *) &sa->sin_addr;
+    len = sizeof (sa->sin_addr);
+  }
+  else if ((addr->ss_family == AF_INET6)
+      && (addrlen >= sizeof (struct sockaddr_in6)))
+  {
+    const struct sockaddr_in6 *sa = (const struct sockaddr_in6 *) addr;
+    ptr = (const unsigned char *) &sa->sin6_addr;
+    len = sizeof (sa->sin6_addr);
+  }
+
+  for (i = 0; i < len; i++)
+  {
+    hash ^= (uint32_t) ptr[i];
+    hash *= 16777619U;
+  }
+
+  return (hash);
+} /* }}} uint32_t network_source_hash */
+
+/* Reads up to `ents_num' datagrams from `fd' into `ents'. `ents_num' must
+ * not be larger than `NETWORK_RECEIVE_BATCH'. Returns the number of datagrams
+ * read, zero if there was nothing to read or less than zero on failure. */
+static int network_receive_batch (int fd, /* {{{ */
+		receive_list_entry_t **ents, size_t ents_num)
+{
+#if HAVE_RECVMMSG
+	struct mmsghdr msgs[NETWORK_RECEIVE_BATCH];
+	struct iovec   iovs[NETWORK_RECEIVE_BATCH];
+	struct sockaddr_storage addrs[NETWORK_RECEIVE_BATCH];
+	int num;
 	int i;
+
+	assert (ents_num <= NETWORK_RECEIVE_BATCH);
+
+	memset (msgs, 0, sizeof (msgs));
+	for (i = 0; i < (int) ents_num; i++)
+	{
+		iovs[i].iov_base = ents[i]->data;
+		iovs[i].iov_len = network_config_packet_size;
+		msgs[i].msg_hdr.msg_iov = iovs + i;
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = addrs + i;
+		msgs[i].msg_hdr.msg_namelen = sizeof (addrs[i]);
+	}
+
+	num = recvmmsg (fd, msgs, (unsigned int) ents_num, MSG_DONTWAIT,
+			/* timeout = */ NULL);
+	if (num < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK)
+				|| (errno == EINTR))
+			return (0);
+
+		ERROR ("recvmmsg failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	for (i = 0; i < num; i++)
+	{
+		ents[i]->data_len = (int) msgs[i].msg_len;
+		ents[i]->source_hash = network_source_hash (addrs + i,
+				msgs[i].msg_hdr.msg_namelen);
+	}
+
+	return (num);
+#else /* if !HAVE_RECVMMSG */
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof (addr);
+	int buffer_len;
+
+	assert (ents_num > 0);
+
+	buffer_len = recvfrom (fd, ents[0]->data, network_config_packet_size,
+			0 /* no flags */, (struct sockaddr *) &addr, &addrlen);
+	if (buffer_len < 0)
+	{
+		char errbuf[1024];
+
+		if (errno == EINTR)
+			return (0);
+
+		ERROR ("recv failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	ents[0]->data_len = buffer_len;
+	ents[0]->source_hash = network_source_hash (&addr, addrlen);
+	return (1);
+#endif /* !HAVE_RECVMMSG */
+} /* }}} int network_receive_batch */
+
+static send_packet_t *send_packet_get (void);
+static void send_queue_push (send_packet_t *p);
+
+/* Queues the packets read from the pass-through socket `se' for sending,
+ * without parsing them. The values are therefore neither dispatched locally
+ * nor passed through the cache or the filter chain. */
+static void network_forward_raw (sockent_t *se, /* {{{ */
+		receive_list_entry_t **ents, int ents_num)
+{
+	send_packet_t *head = NULL;
+	send_packet_t *tail = NULL;
+	uint64_t octets_rx = 0;
+	uint64_t octets_tx = 0;
+	uint64_t packets_tx = 0;
+	cdtime_t now;
+	int i;
+
+	now = cdtime ();
+	for (i = 0; i < ents_num; i++)
+	{
+		send_packet_t *p;
+
+		octets_rx += (uint64_t) ents[i]->data_len;
+
+		/* Without `Server's there is no one to send to. */
+		if (!send_thread_running)
+			continue;
+
+		p = send_packet_get ();
+		if (p == NULL)
+			continue;
+
+		memcpy (p->data, ents[i]->data, (size_t) ents[i]->data_len);
+		p->data_len = (size_t) ents[i]->data_len;
+		p->first_write = now;
+		p->raw = 1;
+
+		if (tail == NULL)
+			head = p;
+		else
+			tail->next = p;
+		tail = p;
+
+		octets_tx += (uint64_t) p->data_len;
+		packets_tx++;
+	}
+
+	if (head != NULL)
+		send_queue_push (head);
+
+	stats_counter_add (&se->data.server.forward_octets_rx, octets_rx);
+	stats_counter_add (&se->data.server.forward_packets_rx,
+			(uint64_t) ents_num);
+	stats_counter_add (&se->data.server.forward_octets_tx, octets_tx);
+	stats_counter_add (&se->data.server.forward_packets_tx, packets_tx);
+} /* }}} void network_forward_raw */
+
+static int network_receive (receive_thread_t *rt) /* {{{ */
+{
+	/* Buffers taken from the pool, the first `ents_num' are in use. */
+	receive_list_entry_t *ents[NETWORK_RECEIVE_BATCH];
+	size_t ents_num = 0;
+	/* While the pool is exhausted, packets are read into `drop_ent' and
+	 * discarded. All elements of `drop_ents' point to it. */
+	receive_list_entry_t  drop_ent;
+	receive_list_entry_t *drop_ents[NETWORK_RECEIVE_BATCH];
+	/* One private list per dispatch queue. */
+	receive_list_t *private_lists;
+	receive_list_t unused = { NULL, NULL, 0 };
+
+	size_t i;
+	int j;
+	int status = 0;
+
+	assert (rt->pollfd_num > 0);
+	assert (receive_queues_num > 0);
+
+	memset (ents, 0, sizeof (ents));
+	memset (&drop_ent, 0, sizeof (drop_ent));
+	for (j = 0; j < NETWORK_RECEIVE_BATCH; j++)
+		drop_ents[j] = &drop_ent;
+
+	drop_ent.data = malloc (network_config_packet_size);
+	private_lists = calloc (receive_queues_num, sizeof (*private_lists));
+	if ((drop_ent.data == NULL) || (private_lists == NULL))
+	{
+		ERROR ("network plugin: malloc failed.");
+		sfree (drop_ent.data);
+		sfree (private_lists);
+		return (-1);
+	}
+
+	while (listen_loop == 0)
+	{
+		status = poll (rt->pollfd, rt->pollfd_num, -1);
+
+		if (status <= 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("poll failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			status = -1;
+			break;
+		}
+
+		for (i = 0; (i < rt->pollfd_num) && (status > 0); i++)
+		{
+			int num;
+
+			if ((rt->pollfd[i].revents
+						& (POLLIN | POLLPRI)) == 0)
+				continue;
+			status--;
+
+			/* Replace the buffers that have been handed to the
+			 * dispatch threads. */
+			if (ents_num < NETWORK_RECEIVE_BATCH)
+				ents_num += receive_pool_get (ents + ents_num,
+						NETWORK_RECEIVE_BATCH - ents_num);
+
+			if (ents_num == 0)
+			{
+				/* Keep reading so the socket buffer doesn't fill up,
+				 * but drop what has been read. */
+				num = network_receive_batch (rt->pollfd[i].fd,
+						drop_ents, NETWORK_RECEIVE_BATCH);
+				if (num < 0)
+				{
+					status = -1;
+					break;
+				}
+				rt->packets_rx += (derive_t) num;
+				rt->packets_dropped += (derive_t) num;
+				continue;
+			}
+
+			num = network_receive_batch (rt->pollfd[i].fd,
+					ents, ents_num);
+			if (num < 0)
+			{
+				status = -1;
+				break;
+			}
+
+			if ((rt->sockets[i] != NULL)
+					&& rt->sockets[i]->data.server.passthrough)
+			{
+				for (j = 0; j < num; j++)
+				{
+					rt->octets_rx += ((uint64_t) ents[j]->data_len);
+					rt->packets_rx++;
+				}
+
+				/* The data has been copied, so the buffers can be
+				 * used again right away. */
+				network_forward_raw (rt->sockets[i], ents, num);
+				continue;
+			}
+
+			for (j = 0; j < num; j++)
+			{
+				receive_list_entry_t *ent = ents[j];
+				receive_list_t *list;
+
+				rt->octets_rx += ((uint64_t) ent->data_len);
+				rt->packets_rx++;
+
+				ent->fd = rt->pollfd[i].fd;
+
+				list = private_lists
+					+ (ent->source_hash % receive_queues_num);
+				receive_list_append (list, ent);
+			}
+
+			/* Move the unused buffers to the front. */
+			ents_num -= (size_t) num;
+			memmove (ents, ents + num, ents_num * sizeof (*ents));
+		} /* for (rt->pollfd) */
+
+		/* Do not block here. Blocking here has led to
+		 * insufficient performance in the past. */
+		for (i = 0; i < receive_queues_num; i++)
+			receive_queue_push (receive_queues + i, private_lists + i,
+					/* block = */ 0);
+
+		if (status < 0)
+			break;
+	} /* while (listen_loop == 0) */
+
+	/* Return the unused buffers to the pool. */
+	for (i = 0; i < ents_num; i++)
+		receive_list_append (&unused, ents[i]);
+	receive_pool_put (&unused);
+	sfree (drop_ent.data);
+
+	/* Make sure everything is dispatched before exiting. */
+	for (i = 0; i < receive_queues_num; i++)
+		receive_queue_push (receive_queues + i, private_lists + i,
+				/* block = */ 1);
+	sfree (private_lists);
+
+	return ((status < 0) ? -1 : 0);
+} /* }}} int network_receive */
+
+static void *receive_thread (void *arg)
+{
+	return (network_receive (arg) ? (void *) 1 : (void *) 0);
+} /* void *receive_thread */
+
+/* Distributes the listening sockets between the receive threads and starts
+ * them. Sockets opened for the same address are next to each other in
+ * `listen_sockets_pollfd', so assigning them round-robin puts each copy into
+ * a different thread. */
+static int start_receive_threads (void) /* {{{ */
+{
+	size_t threads_num;
+	size_t i;
+
+	threads_num = (size_t) network_config_receive_threads;
+	if (threads_num > listen_sockets_num)
+		threads_num = listen_sockets_num;
+	if (threads_num < 1)
+		return (-1);
+
+	receive_threads = calloc (threads_num, sizeof (*receive_threads));
+	if (receive_threads == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < threads_num; i++)
+	{
+		receive_threads[i].pollfd = calloc ((listen_sockets_num / threads_num) + 1,
+				sizeof (*receive_threads[i].pollfd));
+		receive_threads[i].sockets = calloc ((listen_sockets_num / threads_num) + 1,
+				sizeof (*receive_threads[i].sockets));
+		if ((receive_threads[i].pollfd == NULL)
+				|| (receive_threads[i].sockets == NULL))
+		{
+			ERROR ("network plugin: calloc failed.");
+			sfree (receive_threads[i].pollfd);
+			sfree (receive_threads[i].sockets);
+			while (i > 0)
+			{
+				i--;
+				sfree (receive_threads[i].pollfd);
+				sfree (receive_threads[i].sockets);
+			}
+			sfree (receive_threads);
+			return (-1);
+		}
+	}
+	receive_threads_num = threads_num;
+
+	for (i = 0; i < listen_sockets_num; i++)
+	{
+		receive_thread_t *rt = receive_threads + (i % threads_num);
+		rt->pollfd[rt->pollfd_num] = listen_sockets_pollfd[i];
+		rt->sockets[rt->pollfd_num] =
+			network_find_listen_socket (listen_sockets_pollfd[i].fd);
+		rt->pollfd_num++;
+	}
+
+	for (i = 0; i < threads_num; i++)
+	{
+		char name[16];
+		int status;
+
+		ssnprintf (name, sizeof (name), "net/recv#%i", i);
+		status = thread_create (&receive_threads[i].id,
+				NULL /* no attributes */,
+				receive_thread, receive_threads + i,
+				name, network_config_receive_cpus);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("network: pthread_create failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			continue;
+		}
+
+		receive_threads[i].running = 1;
+	}
+
+	return (0);
+} /* }}} int start_receive_threads */
+
+/* Takes one buffer from the pool. If the pool is exhausted, the packets
+ * collected so far are handed to the dispatch threads and the calling thread
+ * waits for buffers to be returned. Not reading from the connections while
+ * waiting makes the kernel slow down the senders. */
+static receive_list_entry_t *stream_get_buffer (receive_list_t *private_lists) /* {{{ */
+{
+	receive_list_entry_t *ent = NULL;
+	size_t i;
+
+	if (receive_pool_get (&ent, 1) == 1)
+		return (ent);
+
+	for (i = 0; i < receive_queues_num; i++)
+		receive_queue_push (receive_queues + i, private_lists + i,
+				/* block = */ 1);
+
+	pthread_mutex_lock (&receive_pool_lock);
+	while ((listen_loop == 0) && (receive_pool_free.head == NULL))
+		pthread_cond_wait (&receive_pool_cond, &receive_pool_lock);
+	if (receive_pool_free.head != NULL)
+		ent = receive_list_shift (&receive_pool_free);
+	pthread_mutex_unlock (&receive_pool_lock);
+
+	return (ent);
+} /* }}} receive_list_entry_t *stream_get_buffer */
+
+static int stream_conn_add (stream_conn_t **conns, /* {{{ */
+		struct pollfd **pollfd, size_t *conns_num,
+		const stream_conn_t *conn)
+{
+	stream_conn_t *tmp_conns;
+	struct pollfd *tmp_pollfd;
+
+	tmp_conns = realloc (*conns, sizeof (**conns) * (*conns_num + 1));
+	if (tmp_conns == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		return (-1);
+	}
+	*conns = tmp_conns;
+
+	tmp_pollfd = realloc (*pollfd, sizeof (**pollfd) * (*conns_num + 1));
+	if (tmp_pollfd == NULL)
+	{
+		ERROR ("network plugin: realloc failed.");
+		return (-1);
+	}
+	*pollfd = tmp_pollfd;
+
+	(*conns)[*conns_num] = *conn;
+	memset (*pollfd + *conns_num, 0, sizeof (**pollfd));
+	(*pollfd)[*conns_num].fd = conn->fd;
+	(*pollfd)[*conns_num].events = POLLIN | POLLPRI;
+	(*conns_num)++;
+
+	return (0);
+} /* }}} int stream_conn_add */
+
+static void stream_conn_close (stream_conn_t *conn) /* {{{ */
+{
+	if (conn->fd >= 0)
+		close (conn->fd);
+	conn->fd = -1;
+	sfree (conn->buffer);
+} /* }}} void stream_conn_close */
+
+/* Accepts a connection on the listening socket `listener'. */
+static void stream_accept (stream_conn_t **conns, /* {{{ */
+		struct pollfd **pollfd, size_t *conns_num, size_t listener)
+{
+	struct sockaddr_storage addr;
+	socklen_t addrlen = sizeof (addr);
+	stream_conn_t conn;
+
+	memset (&conn, 0, sizeof (conn));
+	conn.se = (*conns)[listener].se;
+	conn.listen_fd = (*conns)[listener].fd;
+
+	conn.fd = accept (conn.listen_fd, (struct sockaddr *) &addr, &addrlen);
+	if (conn.fd < 0)
+	{
+		char errbuf[1024];
+		if ((errno != EINTR) && (errno != EAGAIN))
+			ERROR ("network plugin: accept(2) failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		return;
+	}
+
+	/* All packets of one connection go to the same dispatch queue, so they
+	 * are handled in order. */
+	conn.source_hash = network_source_hash (&addr, addrlen);
+	conn.buffer = malloc (NETWORK_STREAM_READ_SIZE
+			+ NETWORK_STREAM_FRAME_HEADER_SIZE + network_config_packet_size);
+	if (conn.buffer == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		close (conn.fd);
+		return;
+	}
+
+	if (stream_conn_add (conns, pollfd, conns_num, &conn) != 0)
+		stream_conn_close (&conn);
+} /* }}} void stream_accept */
+
+/* Reads from `conn' and appends all complete frames to `private_lists'.
+ * Returns non-zero if the connection has been closed or has failed. */
+static int stream_read (stream_conn_t *conn, /* {{{ */
+		receive_list_t *private_lists)
+{
+	size_t buffer_size = NETWORK_STREAM_READ_SIZE
+		+ NETWORK_STREAM_FRAME_HEADER_SIZE + network_config_packet_size;
+	size_t offset = 0;
+	ssize_t status;
+
+	status = read (conn->fd, conn->buffer + conn->buffer_fill,
+			buffer_size - conn->buffer_fill);
+	if (status < 0)
+	{
+		char errbuf[1024];
+		if ((errno == EINTR) || (errno == EAGAIN))
+			return (0);
+		ERROR ("network plugin: read(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	else if (status == 0)
+	{
+		/* Closed by the peer. */
+		return (-1);
+	}
+
+	conn->buffer_fill += (size_t) status;
+	stream_receiver.octets_rx += (derive_t) status;
+
+	while (offset < conn->buffer_fill)
+	{
+		receive_list_entry_t *ent;
+		uint32_t tmp32;
+		size_t frame_size;
+
+		if (conn->skip > 0)
+		{
+			size_t n = conn->buffer_fill - offset;
+			if (n > conn->skip)
+				n = conn->skip;
+			conn->skip -= n;
+			offset += n;
+			continue;
+		}
+
+		if ((conn->buffer_fill - offset) < NETWORK_STREAM_FRAME_HEADER_SIZE)
+			break;
+
+		memcpy (&tmp32, conn->buffer + offset, sizeof (tmp32));
+		frame_size = (size_t) ntohl (tmp32);
+
+		if (frame_size > network_config_packet_size)
+		{
+			WARNING ("network plugin: Ignoring a frame of %zu bytes "
+					"received via TCP, because it's larger than "
+					"`MaxPacketSize' (%zu).",
+					frame_size, network_config_packet_size);
+			conn->skip = frame_size;
+			offset += NETWORK_STREAM_FRAME_HEADER_SIZE;
+			continue;
+		}
+
+		if ((conn->buffer_fill - offset)
+				< (NETWORK_STREAM_FRAME_HEADER_SIZE + frame_size))
+			break;
+
+		if (conn->se->data.server.passthrough)
+		{
+			receive_list_entry_t frame;
+
+			memset (&frame, 0, sizeof (frame));
+			frame.data = conn->buffer + offset
+				+ NETWORK_STREAM_FRAME_HEADER_SIZE;
+			frame.data_len = (int) frame_size;
+
+			ent = &frame;
+			network_forward_raw (conn->se, &ent, 1);
+			stream_receiver.packets_rx++;
+
+			offset += NETWORK_STREAM_FRAME_HEADER_SIZE + frame_size;
+			continue;
+		}
+
+		ent = stream_get_buffer (private_lists);
+		if (ent == NULL)
+			return (-1);
+
+		memcpy (ent->data,
+				conn->buffer + offset + NETWORK_STREAM_FRAME_HEADER_SIZE,
+				frame_size);
+		ent->data_len = (int) frame_size;
+		/* `network_dispatch_entry' identifies the socket by this. */
+		ent->fd = conn->listen_fd;
+		ent->source_hash = conn->source_hash;
+		receive_list_append (private_lists
+				+ (ent->source_hash % receive_queues_num), ent);
+		stream_receiver.packets_rx++;
+
+		offset += NETWORK_STREAM_FRAME_HEADER_SIZE + frame_size;
+	}
+
+	memmove (conn->buffer, conn->buffer + offset,
+			conn->buffer_fill - offset);
+	conn->buffer_fill -= offset;
+
+	return (0);
+} /* }}} int stream_read */
+
+/* Accepts and reads the TCP connections of all `Listen' sockets with
+ * `Transport TCP'. */
+static void *stream_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	stream_conn_t *conns = NULL;
+	struct pollfd *pollfd = NULL;
+	size_t conns_num = 0;
+	receive_list_t *private_lists;
+	sockent_t *se;
+	size_t i;
+	int status;
+
+	private_lists = calloc (receive_queues_num, sizeof (*private_lists));
+	if (private_lists == NULL)
+	{
+		ERROR ("network plugin: calloc failed.");
+		return ((void *) -1);
+	}
+
+	for (se = listen_sockets; se != NULL; se = se->next)
+	{
+		if (se->transport != NETWORK_TRANSPORT_TCP)
+			continue;
+
+		for (i = 0; i < se->data.server.fd_num; i++)
+		{
+			stream_conn_t listener;
+
+			memset (&listener, 0, sizeof (listener));
+			listener.fd = se->data.server.fd[i];
+			listener.listen_fd = listener.fd;
+			listener.se = se;
+			stream_conn_add (&conns, &pollfd, &conns_num, &listener);
+		}
+	}
+
+	while (listen_loop == 0)
+	{
+		size_t num;
+
+		status = poll (pollfd, conns_num, -1);
+		if (status < 0)
+		{
+			char errbuf[1024];
+			if (errno == EINTR)
+				continue;
+			ERROR ("network plugin: poll failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		/* Connections accepted in this loop are appended and are not
+		 * polled yet. */
+		num = conns_num;
+		for (i = 0; i < num; i++)
+		{
+			if (pollfd[i].revents == 0)
+				continue;
+
+			if (conns[i].buffer == NULL)
+				stream_accept (&conns, &pollfd, &conns_num, i);
+			else if (stream_read (conns + i, private_lists) != 0)
+				stream_conn_close (conns + i);
+		}
+
+		for (i = 0; i < receive_queues_num; i++)
+			receive_queue_push (receive_queues + i, private_lists + i,
+					/* block = */ 1);
+
+		/* Remove closed connections. */
+		for (i = 0; i < conns_num; )
+		{
+			if (conns[i].fd >= 0)
+			{
+				pollfd[i].revents = 0;
+				i++;
+				continue;
+			}
+
+			conns_num--;
+			conns[i] = conns[conns_num];
+			pollfd[i] = pollfd[conns_num];
+		}
+	} /* while (listen_loop == 0) */
+
+	/* The listening sockets are closed by `sockent_destroy'. */
+	for (i = 0; i < conns_num; i++)
+		if (conns[i].buffer != NULL)
+			stream_conn_close (conns + i);
+	sfree (conns);
+	sfree (pollfd);
+
+	for (i = 0; i < receive_queues_num; i++)
+		receive_queue_push (receive_queues + i, private_lists + i,
+				/* block = */ 1);
+	sfree (private_lists);
+
+	return ((void *) 0);
+} /* }}} void *stream_thread */
+
+static int start_stream_thread (void) /* {{{ */
+{
 	int status;
 
-	receive_list_entry_t *private_list_head;
-	receive_list_entry_t *private_list_tail;
-	uint64_t              private_list_length;
+	status = thread_create (&stream_receiver.id, /* attr = */ NULL,
+			stream_thread, /* arg = */ NULL,
+			"net/stream", network_config_receive_cpus);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: pthread_create failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	stream_receiver.running = 1;
+
+	return (0);
+} /* }}} int start_stream_thread */
+
+static void send_buffer_reset (send_buffer_t *sb) /* {{{ */
+{
+	sb->ptr = sb->packet->data;
+	sb->fill = 0;
+	sb->first_write = 0;
+	sb->strings.strings_num = 0;
+
+	memset (&sb->vl, 0, sizeof (sb->vl));
+} /* }}} void send_buffer_reset */
+
+/* Returns an unused packet, either from `send_packets_free' or a newly
+ * allocated one. */
+static send_packet_t *send_packet_get (void) /* {{{ */
+{
+	send_packet_t *p;
+
+	pthread_mutex_lock (&send_queue_lock);
+	p = send_packets_free;
+	if (p != NULL)
+		send_packets_free = p->next;
+	pthread_mutex_unlock (&send_queue_lock);
+
+	if (p == NULL)
+	{
+		p = malloc (sizeof (*p) + network_config_packet_size);
+		if (p == NULL)
+		{
+			ERROR ("network plugin: malloc failed.");
+			return (NULL);
+		}
+		p->data = (char *) (p + 1);
+	}
+
+	p->data_len = 0;
+	p->raw = 0;
+	p->next = NULL;
+
+	return (p);
+} /* }}} send_packet_t *send_packet_get */
+
+static void send_packets_free_list (send_packet_t *p) /* {{{ */
+{
+	while (p != NULL)
+	{
+		send_packet_t *next = p->next;
+		sfree (p);
+		p = next;
+	}
+} /* }}} void send_packets_free_list */
+
+/* Appends `p' and the packets linked to it to the send queue and wakes up the
+ * send thread. */
+static void send_queue_push (send_packet_t *p) /* {{{ */
+{
+	send_packet_t *tail;
+	size_t num;
+
+	tail = p;
+	num = 1;
+	while (tail->next != NULL)
+	{
+		tail = tail->next;
+		num++;
+	}
+
+	pthread_mutex_lock (&send_queue_lock);
+	if (send_queue_tail == NULL)
+		send_queue_head = p;
+	else
+		send_queue_tail->next = p;
+	send_queue_tail = tail;
+	send_queue_length += num;
+	pthread_cond_signal (&send_queue_cond);
+	pthread_mutex_unlock (&send_queue_lock);
+} /* }}} void send_queue_push */
+
+/* Hands the packet built in `sb' to the send thread and starts a new one. The
+ * caller must hold `sb->lock'. */
+static void send_buffer_flush (send_buffer_t *sb) /* {{{ */
+{
+	send_packet_t *p;
+
+	DEBUG ("network plugin: send_buffer_flush: fill = %i", sb->fill);
+
+	if (sb->fill <= 0)
+		return;
+
+	p = send_packet_get ();
+	if (p == NULL)
+	{
+		ERROR ("network plugin: Dropping a packet of %i bytes.",
+				sb->fill);
+		send_buffer_reset (sb);
+		return;
+	}
+
+	sb->packet->data_len = (size_t) sb->fill;
+	sb->packet->first_write = sb->first_write;
+	send_queue_push (sb->packet);
+
+	sb->packet = p;
+	send_buffer_reset (sb);
+} /* }}} void send_buffer_flush */
+
+/* Returns the buffer `vl' is written to, locked. The buffer's packet is
+ * allocated on first use. */
+static send_buffer_t *network_lock_send_buffer (const value_list_t *vl) /* {{{ */
+{
+	send_buffer_t *sb;
+	uint32_t hash = 2166136261U;
+	const char *ptr;
+
+	/* 32 bit FNV-1a */
+	for (ptr = vl->host; *ptr != 0; ptr++)
+		hash = (hash ^ (uint32_t) (unsigned char) *ptr) * 16777619U;
+	for (ptr = vl->plugin; *ptr != 0; ptr++)
+		hash = (hash ^ (uint32_t) (unsigned char) *ptr) * 16777619U;
+
+	sb = send_buffers + (hash % NETWORK_SEND_BUFFERS);
+	pthread_mutex_lock (&sb->lock);
 
-        assert (listen_sockets_num > 0);
+	if (sb->packet == NULL)
+	{
+		sb->packet = send_packet_get ();
+		if (sb->packet == NULL)
+		{
+			pthread_mutex_unlock (&sb->lock);
+			return (NULL);
+		}
+		send_buffer_reset (sb);
+	}
+
+	return (sb);
+} /* }}} send_buffer_t *network_lock_send_buffer */
+
+/* Hands all partially filled packets to the send thread. */
+static void network_flush_send_buffers (void) /* {{{ */
+{
+	size_t i;
+
+	/* The buffers are initialized when the send thread is started. */
+	if (!send_thread_running)
+		return;
+
+	for (i = 0; i < NETWORK_SEND_BUFFERS; i++)
+	{
+		send_buffer_t *sb = send_buffers + i;
+
+		pthread_mutex_lock (&sb->lock);
+		if (sb->packet != NULL)
+			send_buffer_flush (sb);
+		pthread_mutex_unlock (&sb->lock);
+	}
+
+	pthread_mutex_lock (&send_queue_lock);
+	if (send_queue_head != NULL)
+		send_queue_flush = 1;
+	pthread_cond_signal (&send_queue_cond);
+	pthread_mutex_unlock (&send_queue_lock);
+} /* }}} void network_flush_send_buffers */
+
+/* Returns when a packet whose first value was added at `first_write' has to
+ * be sent. With `PhaseSpreading', packets are sent at this host's phase of
+ * the `MaxBufferLatency' period, so that hosts don't send at the same time. */
+static cdtime_t network_buffer_due (cdtime_t first_write) /* {{{ */
+{
+	cdtime_t due;
+
+	if (plugin_phase_align ("network", network_config_buffer_latency,
+				first_write + 1, &due) == 0)
+		return (due);
+
+	return (first_write + network_config_buffer_latency);
+} /* }}} cdtime_t network_buffer_due */
+
+/* Hands packets which have been waiting for `MaxBufferLatency' to the send
+ * thread. Returns the time at which the next packet will be due. */
+static cdtime_t network_flush_old_send_buffers (cdtime_t now) /* {{{ */
+{
+	cdtime_t next = now + network_config_buffer_latency;
+	size_t i;
+
+	for (i = 0; i < NETWORK_SEND_BUFFERS; i++)
+	{
+		send_buffer_t *sb = send_buffers + i;
+
+		pthread_mutex_lock (&sb->lock);
+		if ((sb->packet != NULL) && (sb->first_write != 0))
+		{
+			cdtime_t due = network_buffer_due (sb->first_write);
+
+			if (due <= now)
+				send_buffer_flush (sb);
+			else if (due < next)
+				next = due;
+		}
+		pthread_mutex_unlock (&sb->lock);
+	}
+
+	return (next);
+} /* }}} cdtime_t network_flush_old_send_buffers */
+
+#if NETWORK_HAVE_GSO
+/* Returns the number of datagrams starting at `iovs' which can be sent as
+ * one buffer with UDP_SEGMENT: all but the last one must have the same size
+ * and the last one must not be larger. */
+static size_t network_gso_run (const struct iovec *iovs, /* {{{ */
+		size_t iovs_num)
+{
+	size_t size = iovs[0].iov_len;
+	size_t total = size;
+	size_t n = 1;
+
+	while ((n < iovs_num) && (n < NETWORK_GSO_MAX_SEGMENTS)
+			&& (iovs[n - 1].iov_len == size)
+			&& (iovs[n].iov_len <= size)
+			&& ((total + iovs[n].iov_len) <= NETWORK_GSO_MAX_SIZE))
+	{
+		total += iovs[n].iov_len;
+		n++;
+	}
+
+	return (n);
+} /* }}} size_t network_gso_run */
+#endif /* NETWORK_HAVE_GSO */
+
+/* Sends the `iovs_num' datagrams in `iovs' to `se'. A datagram which can't be
+ * sent is logged and skipped. Only called from the send thread. */
+static void network_send_datagrams (sockent_t *se, /* {{{ */
+		struct iovec *iovs, size_t iovs_num)
+{
+#if HAVE_SENDMMSG
+	struct mmsghdr msgs[NETWORK_SEND_BATCH];
+#if NETWORK_HAVE_GSO
+	char control[NETWORK_SEND_BATCH][CMSG_SPACE (sizeof (uint16_t))];
+#endif
+	size_t msgs_num;
+	size_t offset;
+	size_t i;
+
+	assert (iovs_num <= NETWORK_SEND_BATCH);
+
+	memset (msgs, 0, sizeof (msgs));
+	msgs_num = 0;
+	i = 0;
+	while (i < iovs_num)
+	{
+		struct msghdr *mh = &msgs[msgs_num].msg_hdr;
+		size_t n = 1;
+
+		mh->msg_name = se->data.client.addr;
+		mh->msg_namelen = se->data.client.addrlen;
+		mh->msg_iov = iovs + i;
+
+#if NETWORK_HAVE_GSO
+		if (se->data.client.segment)
+			n = network_gso_run (iovs + i, iovs_num - i);
+
+		if (n > 1)
+		{
+			struct cmsghdr *cmsg;
+			uint16_t segment_size = (uint16_t) iovs[i].iov_len;
+
+			memset (control[msgs_num], 0, sizeof (control[msgs_num]));
+			mh->msg_control = control[msgs_num];
+			mh->msg_controllen = sizeof (control[msgs_num]);
+
+			cmsg = CMSG_FIRSTHDR (mh);
+			cmsg->cmsg_level = SOL_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN (sizeof (segment_size));
+			memcpy (CMSG_DATA (cmsg), &segment_size, sizeof (segment_size));
+		}
+#endif /* NETWORK_HAVE_GSO */
 
-	private_list_head = NULL;
-	private_list_tail = NULL;
-	private_list_length = 0;
+		mh->msg_iovlen = n;
+		msgs_num++;
+		i += n;
+	}
 
-	while (listen_loop == 0)
+	offset = 0;
+	while (offset < msgs_num)
 	{
-		status = poll (listen_sockets_pollfd, listen_sockets_num, -1);
+		int status;
+		uint64_t datagrams;
 
-		if (status <= 0)
+		status = sendmmsg (se->data.client.fd, msgs + offset,
+				(unsigned int) (msgs_num - offset), /* flags = */ 0);
+		if (status < 0)
 		{
 			char errbuf[1024];
 			if (errno == EINTR)
 				continue;
-			ERROR ("poll failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			return (-1);
+#if NETWORK_HAVE_GSO
+			/* EIO means that the device can't checksum the
+			 * segments. The datagrams are valid on their own, so
+			 * they are sent again without UDP_SEGMENT. */
+			if ((msgs[offset].msg_hdr.msg_controllen > 0)
+					&& ((errno == EIO) || (errno == EINVAL)
+						|| (errno == EOPNOTSUPP)))
+			{
+				size_t first = (size_t) (msgs[offset].msg_hdr.msg_iov
+						- iovs);
+
+				WARNING ("network plugin: Sending to %s with "
+						"UDP_SEGMENT failed: %s. Disabling "
+						"`SegmentationOffload' for this server.",
+						se->node, sstrerror (errno, errbuf,
+							sizeof (errbuf)));
+				se->data.client.segment = 0;
+				network_send_datagrams (se, iovs + first,
+						iovs_num - first);
+				return;
+			}
+#endif /* NETWORK_HAVE_GSO */
+			ERROR ("network plugin: sendmmsg failed: %s",
+					sstrerror (errno, errbuf,
+						sizeof (errbuf)));
+			offset++;
+			continue;
 		}
 
-		for (i = 0; (i < listen_sockets_num) && (status > 0); i++)
-		{
-			receive_list_entry_t *ent;
+		datagrams = 0;
+		for (i = offset; i < offset + (size_t) status; i++)
+			datagrams += (uint64_t) msgs[i].msg_hdr.msg_iovlen;
+		stats_counter_inc (&stats_send_calls);
+		stats_counter_add (&stats_send_datagrams, datagrams);
+		offset += (size_t) status;
+	}
+#else /* if !HAVE_SENDMMSG */
+	size_t i;
 
-			if ((listen_sockets_pollfd[i].revents
-						& (POLLIN | POLLPRI)) == 0)
-				continue;
-			status--;
+	for (i = 0; i < iovs_num; i++)
+	{
+		int status;
 
-			buffer_len = recv (listen_sockets_pollfd[i].fd,
-					buffer, sizeof (buffer),
-					0 /* no flags */);
-			if (buffer_len < 0)
+		while (42)
+		{
+			status = sendto (se->data.client.fd,
+					iovs[i].iov_base, iovs[i].iov_len,
+					/* flags = */ 0,
+					(struct sockaddr *) se->data.client.addr,
+					se->data.client.addrlen);
+			if (status < 0)
 			{
 				char errbuf[1024];
-				ERROR ("recv failed: %s",
+				if (errno == EINTR)
+					continue;
+				ERROR ("network plugin: sendto failed: %s",
 						sstrerror (errno, errbuf,
 							sizeof (errbuf)));
-				return (-1);
 			}
-
-			stats_octets_rx += ((uint64_t) buffer_len);
-			stats_packets_rx++;
-
-			/* TODO: Possible performance enhancement: Do not free
-			 * these entries in the dispatch thread but put them in
-			 * another list, so we don't have to allocate more and
-			 * more of these structures. */
-			ent = malloc (sizeof (receive_list_entry_t));
-			if (ent == NULL)
-			{
-				ERROR ("network plugin: malloc failed.");
-				return (-1);
-			}
-			memset (ent, 0, sizeof (receive_list_entry_t));
-			ent->data = malloc (network_config_packet_size);
-			if (ent->data == NULL)
+			else
 			{
-				sfree (ent);
-				ERROR ("network plugin: malloc failed.");
-				return (-1);
+				stats_counter_inc (&stats_send_calls);
+				stats_counter_inc (&stats_send_datagrams);
 			}
-			ent->fd = listen_sockets_pollfd[i].fd;
-			ent->next = NULL;
 
-			memcpy (ent->data, buffer, buffer_len);
-			ent->data_len = buffer_len;
+			break;
+		} /* while (42) */
+	}
+#endif /* !HAVE_SENDMMSG */
+} /* }}} void network_send_datagrams */
+
+/* Connects the TCP socket of `se'. Waits at most
+ * `NETWORK_STREAM_CONNECT_TIMEOUT' and doesn't try again for a while after a
+ * failure, so that an unreachable server doesn't hold up sending to the
+ * others. */
+static int network_connect_stream (sockent_t *se) /* {{{ */
+{
+	struct sockent_client *sec = &se->data.client;
+	struct addrinfo ai;
+	struct timeval tv;
+	cdtime_t now;
+	int flags;
+	int yes = 1;
+	int fd;
+	int status;
 
-			if (private_list_head == NULL)
-				private_list_head = ent;
-			else
-				private_list_tail->next = ent;
-			private_list_tail = ent;
-			private_list_length++;
+	now = cdtime ();
+	if (now < sec->next_connect)
+		return (-1);
+	sec->next_connect = now + NETWORK_STREAM_RETRY_INTERVAL;
 
-			/* Do not block here. Blocking here has led to
-			 * insufficient performance in the past. */
-			if (pthread_mutex_trylock (&receive_list_lock) == 0)
-			{
-				assert (((receive_list_head == NULL) && (receive_list_length == 0))
-						|| ((receive_list_head != NULL) && (receive_list_length != 0)));
-
-				if (receive_list_head == NULL)
-					receive_list_head = private_list_head;
-				else
-					receive_list_tail->next = private_list_head;
-				receive_list_tail = private_list_tail;
-				receive_list_length += private_list_length;
-
-				pthread_cond_signal (&receive_list_cond);
-				pthread_mutex_unlock (&receive_list_lock);
-
-				private_list_head = NULL;
-				private_list_tail = NULL;
-				private_list_length = 0;
-			}
-		} /* for (listen_sockets_pollfd) */
-	} /* while (listen_loop == 0) */
+	fd = socket (sec->addr->ss_family, SOCK_STREAM, IPPROTO_TCP);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: socket(2) failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
 
-	/* Make sure everything is dispatched before exiting. */
-	if (private_list_head != NULL)
+	/* `network_set_ttl' and `network_set_interface' work on the client's
+	 * socket and only look at the address family. */
+	sec->fd = fd;
+	memset (&ai, 0, sizeof (ai));
+	ai.ai_family = sec->addr->ss_family;
+	ai.ai_addr = (struct sockaddr *) sec->addr;
+	ai.ai_addrlen = sec->addrlen;
+	network_set_ttl (se, &ai);
+	network_set_interface (se, &ai);
+	sec->fd = -1;
+
+	flags = fcntl (fd, F_GETFL);
+	fcntl (fd, F_SETFL, flags | O_NONBLOCK);
+
+	status = connect (fd, (struct sockaddr *) sec->addr, sec->addrlen);
+	if ((status != 0) && (errno == EINPROGRESS))
 	{
-		pthread_mutex_lock (&receive_list_lock);
+		struct pollfd pfd;
 
-		if (receive_list_head == NULL)
-			receive_list_head = private_list_head;
-		else
-			receive_list_tail->next = private_list_head;
-		receive_list_tail = private_list_tail;
-		receive_list_length += private_list_length;
+		memset (&pfd, 0, sizeof (pfd));
+		pfd.fd = fd;
+		pfd.events = POLLOUT;
 
-		private_list_head = NULL;
-		private_list_tail = NULL;
-		private_list_length = 0;
+		status = poll (&pfd, 1,
+				(int) CDTIME_T_TO_MS (NETWORK_STREAM_CONNECT_TIMEOUT));
+		if (status == 0)
+		{
+			sec->next_connect = cdtime ()
+				+ NETWORK_STREAM_TIMEOUT_RETRY_INTERVAL;
+			errno = ETIMEDOUT;
+			status = -1;
+		}
+		else if (status > 0)
+		{
+			int error = 0;
+			socklen_t error_len = sizeof (error);
 
-		pthread_cond_signal (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
+			getsockopt (fd, SOL_SOCKET, SO_ERROR, &error, &error_len);
+			errno = error;
+			status = (error == 0) ? 0 : -1;
+		}
 	}
 
-	return (0);
-} /* }}} int network_receive */
+	if (status != 0)
+	{
+		char errbuf[1024];
+		c_complain (LOG_ERR, &sec->connect_complaint,
+				"network plugin: Connecting to %s:%s failed: %s",
+				se->node,
+				(se->service != NULL) ? se->service : NET_DEFAULT_PORT,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		return (-1);
+	}
 
-static void *receive_thread (void __attribute__((unused)) *arg)
-{
-	return (network_receive () ? (void *) 1 : (void *) 0);
-} /* void *receive_thread */
+	fcntl (fd, F_SETFL, flags);
 
-static void network_init_buffer (void)
-{
-	memset (send_buffer, 0, network_config_packet_size);
-	send_buffer_ptr = send_buffer;
-	send_buffer_fill = 0;
+	/* A peer which stops reading must not block the send thread forever. */
+	memset (&tv, 0, sizeof (tv));
+	tv.tv_sec = NETWORK_STREAM_SEND_TIMEOUT;
+	setsockopt (fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof (tv));
+#ifdef TCP_NODELAY
+	/* Packets are written in batches, waiting for more data only adds
+	 * latency. */
+	setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof (yes));
+#endif
 
-	memset (&send_buffer_vl, 0, sizeof (send_buffer_vl));
-} /* int network_init_buffer */
+	sec->fd = fd;
+	c_release (LOG_INFO, &sec->connect_complaint,
+			"network plugin: Connected to %s:%s.", se->node,
+			(se->service != NULL) ? se->service : NET_DEFAULT_PORT);
 
-static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
-		const char *buffer, size_t buffer_size)
+	return (0);
+} /* }}} int network_connect_stream */
+
+/* Sends the packets as frames over the TCP connection of `se', connecting
+ * first if necessary. All frames are written with one call, if the kernel
+ * accepts them. If the connection fails, the packets are dropped and the
+ * connection is established again with the next batch. */
+static void network_send_stream (sockent_t *se, /* {{{ */
+		const struct iovec *iovs, size_t iovs_num)
 {
-	int status;
+	uint32_t headers[NETWORK_SEND_BATCH];
+	struct iovec frames[2 * NETWORK_SEND_BATCH];
+	struct iovec *frames_ptr = frames;
+	size_t frames_num = 0;
+	size_t i;
 
-	while (42)
+	assert (iovs_num <= NETWORK_SEND_BATCH);
+
+	if (iovs_num == 0)
+		return;
+
+	/* The server never sends anything, so a readable socket means that the
+	 * connection has been closed. Writing to it would appear to succeed. */
+	if (se->data.client.fd >= 0)
+	{
+		char c;
+
+		if (recv (se->data.client.fd, &c, sizeof (c),
+					MSG_PEEK | MSG_DONTWAIT) >= 0)
+		{
+			close (se->data.client.fd);
+			se->data.client.fd = -1;
+		}
+	}
+
+	if ((se->data.client.fd < 0) && (network_connect_stream (se) != 0))
+		return;
+
+	for (i = 0; i < iovs_num; i++)
+	{
+		headers[i] = htonl ((uint32_t) iovs[i].iov_len);
+		frames[frames_num].iov_base = headers + i;
+		frames[frames_num].iov_len = sizeof (headers[i]);
+		frames_num++;
+		frames[frames_num] = iovs[i];
+		frames_num++;
+	}
+
+	while (frames_num > 0)
 	{
-		status = sendto (se->data.client.fd, buffer, buffer_size,
-                    /* flags = */ 0,
-                    (struct sockaddr *) se->data.client.addr,
-                    se->data.client.addrlen);
-                if (status < 0)
+		struct msghdr msg;
+		ssize_t status;
+		int flags = 0;
+
+		memset (&msg, 0, sizeof (msg));
+		msg.msg_iov = frames_ptr;
+		msg.msg_iovlen = frames_num;
+#ifdef MSG_NOSIGNAL
+		flags |= MSG_NOSIGNAL;
+#endif
+
+		status = sendmsg (se->data.client.fd, &msg, flags);
+		if (status < 0)
 		{
 			char errbuf[1024];
 			if (errno == EINTR)
 				continue;
-			ERROR ("network plugin: sendto failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			break;
+			ERROR ("network plugin: Sending to %s:%s failed: %s",
+					se->node,
+					(se->service != NULL) ? se->service : NET_DEFAULT_PORT,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (se->data.client.fd);
+			se->data.client.fd = -1;
+			return;
 		}
 
-		break;
-	} /* while (42) */
-} /* }}} void networt_send_buffer_plain */
+		/* Skip what has been written, the kernel may have taken only
+		 * part of the data. */
+		while ((frames_num > 0) && ((size_t) status >= frames_ptr->iov_len))
+		{
+			status -= (ssize_t) frames_ptr->iov_len;
+			frames_ptr++;
+			frames_num--;
+		}
+		if (frames_num > 0)
+		{
+			frames_ptr->iov_base = ((char *) frames_ptr->iov_base) + status;
+			frames_ptr->iov_len -= (size_t) status;
+		}
+	}
+} /* }}} void network_send_stream */
 
 #if HAVE_LIBGCRYPT
 #define BUFFER_ADD(p,s) do { \
@@ -2412,45 +4971,32 @@ static void networt_send_buffer_plain (const sockent_t *se, /* {{{ */
   buffer_offset += (s); \
 } while (0)
 
-static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+/* Writes the signed version of `in_buffer' to `buffer', which must have room
+ * for `BUFF_SIG_SIZE + in_buffer_size' bytes. */
+static int network_sign_buffer (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size,
+		char *buffer, size_t *ret_buffer_size)
 {
   part_signature_sha256_t ps;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_offset;
   size_t username_len;
 
   gcry_md_hd_t hd;
-  gcry_error_t err;
   unsigned char *hash;
 
-  hd = NULL;
-  err = gcry_md_open (&hd, GCRY_MD_SHA256, GCRY_MD_FLAG_HMAC);
-  if (err != 0)
-  {
-    ERROR ("network plugin: Creating HMAC object failed: %s",
-        gcry_strerror (err));
-    return;
-  }
-
-  err = gcry_md_setkey (hd, se->data.client.password,
-      strlen (se->data.client.password));
-  if (err != 0)
-  {
-    ERROR ("network plugin: gcry_md_setkey failed: %s",
-        gcry_strerror (err));
-    gcry_md_close (hd);
-    return;
-  }
-
   username_len = strlen (se->data.client.username);
   if (username_len > (BUFF_SIG_SIZE - PART_SIGNATURE_SHA256_SIZE))
   {
     ERROR ("network plugin: Username too long: %s",
         se->data.client.username);
-    return;
+    return (-1);
   }
 
+  hd = network_get_hmac_sha256 (se, se->data.client.username,
+      se->data.client.password_hash);
+  if (hd == NULL)
+    return (-1);
+
   memcpy (buffer + PART_SIGNATURE_SHA256_SIZE,
       se->data.client.username, username_len);
   memcpy (buffer + PART_SIGNATURE_SHA256_SIZE + username_len,
@@ -2468,8 +5014,7 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
   if (hash == NULL)
   {
     ERROR ("network plugin: gcry_md_read failed.");
-    gcry_md_close (hd);
-    return;
+    return (-1);
   }
   memcpy (ps.hash, hash, sizeof (ps.hash));
 
@@ -2482,18 +5027,18 @@ static void networt_send_buffer_signed (const sockent_t *se, /* {{{ */
 
   assert (buffer_offset == PART_SIGNATURE_SHA256_SIZE);
 
-  gcry_md_close (hd);
-  hd = NULL;
-
-  buffer_offset = PART_SIGNATURE_SHA256_SIZE + username_len + in_buffer_size;
-  networt_send_buffer_plain (se, buffer, buffer_offset);
-} /* }}} void networt_send_buffer_signed */
+  *ret_buffer_size = PART_SIGNATURE_SHA256_SIZE + username_len
+    + in_buffer_size;
+  return (0);
+} /* }}} int network_sign_buffer */
 
-static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
-		const char *in_buffer, size_t in_buffer_size)
+/* Writes the encrypted version of `in_buffer' to `buffer', which must have
+ * room for `BUFF_SIG_SIZE + in_buffer_size' bytes. */
+static int network_encrypt_buffer (sockent_t *se, /* {{{ */
+		const char *in_buffer, size_t in_buffer_size,
+		char *buffer, size_t *ret_buffer_size)
 {
   part_encryption_aes256_t pea;
-  char buffer[BUFF_SIG_SIZE + in_buffer_size];
   size_t buffer_size;
   size_t buffer_offset;
   size_t header_size;
@@ -2511,15 +5056,15 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   if ((PART_ENCRYPTION_AES256_SIZE + username_len) > BUFF_SIG_SIZE)
   {
     ERROR ("network plugin: Username too long: %s", pea.username);
-    return;
+    return (-1);
   }
 
   buffer_size = PART_ENCRYPTION_AES256_SIZE + username_len + in_buffer_size;
   header_size = PART_ENCRYPTION_AES256_SIZE + username_len
     - sizeof (pea.hash);
 
-  assert (buffer_size <= sizeof (buffer));
-  DEBUG ("network plugin: networt_send_buffer_encrypted: "
+  assert (buffer_size <= (BUFF_SIG_SIZE + in_buffer_size));
+  DEBUG ("network plugin: network_encrypt_buffer: "
       "buffer_size = %zu;", buffer_size);
 
   pea.head.length = htons ((uint16_t) (PART_ENCRYPTION_AES256_SIZE
@@ -2534,7 +5079,7 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
 
   /* Initialize the buffer */
   buffer_offset = 0;
-  memset (buffer, 0, sizeof (buffer));
+  memset (buffer, 0, buffer_size);
 
 
   BUFFER_ADD (&pea.head.type, sizeof (pea.head.type));
@@ -2551,7 +5096,7 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   cypher = network_get_aes256_cypher (se, pea.iv, sizeof (pea.iv),
       se->data.client.password);
   if (cypher == NULL)
-    return;
+    return (-1);
 
   /* Encrypt the buffer in-place */
   err = gcry_cipher_encrypt (cypher,
@@ -2562,44 +5107,453 @@ static void networt_send_buffer_encrypted (sockent_t *se, /* {{{ */
   {
     ERROR ("network plugin: gcry_cipher_encrypt returned: %s",
         gcry_strerror (err));
-    return;
+    return (-1);
   }
 
-  /* Send it out without further modifications */
-  networt_send_buffer_plain (se, buffer, buffer_size);
-} /* }}} void networt_send_buffer_encrypted */
+  *ret_buffer_size = buffer_size;
+  return (0);
+} /* }}} int network_encrypt_buffer */
 #undef BUFFER_ADD
 #endif /* HAVE_LIBGCRYPT */
 
-static void network_send_buffer (char *buffer, size_t buffer_len) /* {{{ */
+#if HAVE_LIBLZ4
+/* Combines consecutive packets into one LZ4 compressed part, as many as fit
+ * into one datagram, and stores the resulting datagrams in `iovs'. Packets
+ * which don't get smaller are sent unchanged. Returns the number of
+ * datagrams. */
+static size_t network_compress_batch (send_packet_t **packets, /* {{{ */
+		size_t packets_num, struct iovec *iovs)
 {
-  sockent_t *se;
+	/* Leave room for a signature or encryption header, like
+	 * `network_write' does. */
+	int capacity = (int) (network_config_packet_size
+			- (BUFF_SIG_SIZE + PART_COMPRESSION_LZ4_SIZE));
+	size_t iovs_num = 0;
+	size_t i = 0;
+
+	while (i < packets_num)
+	{
+		char *out = send_compress_out
+			+ (iovs_num * network_config_packet_size);
+		size_t in_size = 0;
+		size_t used = 0;
+		int out_size = 0;
+		int status = 0;
+		uint16_t tmp16;
+		uint32_t tmp32;
+
+		while (((i + used) < packets_num)
+				&& (used < NETWORK_COMPRESS_PACKETS)
+				&& !packets[i + used]->raw)
+		{
+			send_packet_t *p = packets[i + used];
+			size_t frame_size = sizeof (tmp16) + p->data_len;
+
+			tmp16 = htons ((uint16_t) p->data_len);
+			memcpy (send_compress_in + in_size, &tmp16, sizeof (tmp16));
+			memcpy (send_compress_in + in_size + sizeof (tmp16),
+					p->data, p->data_len);
+			status = LZ4_compress_default (send_compress_in,
+					out + PART_COMPRESSION_LZ4_SIZE,
+					(int) (in_size + frame_size), capacity);
+			if (status <= 0)
+				break;
+
+			in_size += frame_size;
+			out_size = status;
+			used++;
+		}
+
+		/* The attempt which didn't fit has overwritten the output. */
+		if ((status <= 0) && (used > 0))
+			out_size = LZ4_compress_default (send_compress_in,
+					out + PART_COMPRESSION_LZ4_SIZE,
+					(int) in_size, capacity);
+
+		if ((used == 0) || (out_size <= 0)
+				|| (((size_t) out_size + PART_COMPRESSION_LZ4_SIZE)
+					>= (in_size - (used * sizeof (tmp16)))))
+		{
+			size_t n = (used > 0) ? used : 1;
+
+			while (n > 0)
+			{
+				iovs[iovs_num].iov_base = packets[i]->data;
+				iovs[iovs_num].iov_len = packets[i]->data_len;
+				iovs_num++;
+				i++;
+				n--;
+			}
+			continue;
+		}
+
+		tmp16 = htons (TYPE_COMPR_LZ4);
+		memcpy (out, &tmp16, sizeof (tmp16));
+		tmp16 = htons ((uint16_t) (out_size + PART_COMPRESSION_LZ4_SIZE));
+		memcpy (out + sizeof (tmp16), &tmp16, sizeof (tmp16));
+		tmp32 = htonl ((uint32_t) in_size);
+		memcpy (out + 2 * sizeof (tmp16), &tmp32, sizeof (tmp32));
+
+		iovs[iovs_num].iov_base = out;
+		iovs[iovs_num].iov_len = (size_t) out_size + PART_COMPRESSION_LZ4_SIZE;
+		iovs_num++;
+		i += used;
+	}
+
+	return (iovs_num);
+} /* }}} size_t network_compress_batch */
+#endif /* HAVE_LIBLZ4 */
+
+#if NETWORK_HAVE_GSO
+/* Pads the datagrams in `iovs' with a `TYPE_PAD' part to the size of the
+ * largest one, so that `network_send_datagrams' can send them with
+ * UDP_SEGMENT. Datagrams which would need too much padding are left alone;
+ * each of those ends a run. All buffers have room for
+ * `network_config_packet_size' bytes. */
+static void network_pad_batch (struct iovec *iovs, size_t iovs_num) /* {{{ */
+{
+	size_t size = 0;
+	size_t i;
+
+	for (i = 0; i < iovs_num; i++)
+		if (size < iovs[i].iov_len)
+			size = iovs[i].iov_len;
+
+	assert (size <= network_config_packet_size);
+
+	for (i = 0; i < iovs_num; i++)
+	{
+		size_t pad = size - iovs[i].iov_len;
+		char *ptr = ((char *) iovs[i].iov_base) + iovs[i].iov_len;
+		uint16_t tmp16;
+
+		if ((pad < sizeof (part_header_t))
+				|| (pad > (size / NETWORK_GSO_PAD_RATIO)))
+			continue;
+
+		tmp16 = htons (TYPE_PAD);
+		memcpy (ptr, &tmp16, sizeof (tmp16));
+		tmp16 = htons ((uint16_t) pad);
+		memcpy (ptr + sizeof (tmp16), &tmp16, sizeof (tmp16));
+		memset (ptr + sizeof (part_header_t), 0,
+				pad - sizeof (part_header_t));
+
+		iovs[i].iov_len = size;
+	}
+} /* }}} void network_pad_batch */
+#endif /* NETWORK_HAVE_GSO */
+
+/* Stores the datagrams for sending the `packets_num' packets in `packets' to
+ * `se' in `iovs', compressing, signing or encrypting them first if required.
+ * The datagrams may point to scratch buffers which are valid until the next
+ * call. Returns the number of datagrams. Only called from the send thread. */
+static size_t network_prepare_batch (sockent_t *se, /* {{{ */
+		send_packet_t **packets, size_t packets_num, struct iovec *iovs)
+{
+	size_t iovs_num = 0;
+	size_t i;
+
+	assert (packets_num <= NETWORK_SEND_BATCH);
+
+#if HAVE_LIBLZ4
+	if (se->data.client.compress)
+		iovs_num = network_compress_batch (packets, packets_num, iovs);
+	else
+#endif
+	for (i = 0; i < packets_num; i++)
+	{
+		iovs[iovs_num].iov_base = packets[i]->data;
+		iovs[iovs_num].iov_len = packets[i]->data_len;
+		iovs_num++;
+	}
+
+#if NETWORK_HAVE_GSO
+	/* Signing and encrypting add the same number of bytes to every
+	 * datagram, so the padded ones keep having the same size. */
+	if (se->data.client.segment)
+		network_pad_batch (iovs, iovs_num);
+#endif
+
+#if HAVE_LIBGCRYPT
+	if (se->data.client.security_level != SECURITY_LEVEL_NONE)
+	{
+		size_t in_num = iovs_num;
+
+		iovs_num = 0;
+		for (i = 0; i < in_num; i++)
+		{
+			char  *out = send_scratch
+				+ (i * (BUFF_SIG_SIZE + network_config_packet_size));
+			size_t out_size = 0;
+			int status;
+
+			if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
+				status = network_encrypt_buffer (se,
+						iovs[i].iov_base, iovs[i].iov_len,
+						out, &out_size);
+			else /* if (se->data.client.security_level == SECURITY_LEVEL_SIGN) */
+				status = network_sign_buffer (se,
+						iovs[i].iov_base, iovs[i].iov_len,
+						out, &out_size);
+			if (status != 0)
+				continue;
+
+			iovs[iovs_num].iov_base = out;
+			iovs[iovs_num].iov_len = out_size;
+			iovs_num++;
+		}
+	}
+#endif /* HAVE_LIBGCRYPT */
+
+	return (iovs_num);
+} /* }}} size_t network_prepare_batch */
+
+/* Returns true if `network_prepare_batch' produces the same datagrams for
+ * both servers. Encrypted datagrams get a random IV, so those prepared for
+ * one server are just as good for the other. */
+static _Bool network_same_payload (const sockent_t *se0, /* {{{ */
+		const sockent_t *se1)
+{
+	const struct sockent_client *c0 = &se0->data.client;
+	const struct sockent_client *c1 = &se1->data.client;
+
+	if ((c0->compress != c1->compress) || (c0->segment != c1->segment))
+		return (0);
+
+#if HAVE_LIBGCRYPT
+	if (c0->security_level != c1->security_level)
+		return (0);
+
+	if ((c0->security_level != SECURITY_LEVEL_NONE)
+			&& ((strcmp (c0->username, c1->username) != 0)
+				|| (memcmp (c0->password_hash, c1->password_hash,
+						sizeof (c0->password_hash)) != 0)))
+		return (0);
+#endif
+
+	return (1);
+} /* }}} _Bool network_same_payload */
+
+/* Sends one batch of packets to all servers. Servers with the same settings
+ * share the datagrams, so that compression, signing and encryption are done
+ * once per group instead of once per server. */
+static void network_send_batch (send_packet_t **packets, /* {{{ */
+		size_t packets_num)
+{
+	struct iovec iovs[NETWORK_SEND_BATCH];
+	sockent_t *first;
+
+	assert (packets_num <= NETWORK_SEND_BATCH);
+
+	for (first = sending_sockets; first != NULL; first = first->next)
+	{
+		size_t iovs_num;
+		sockent_t *se;
+
+		/* Skip servers which have been handled with an earlier one. */
+		for (se = sending_sockets; se != first; se = se->next)
+			if (network_same_payload (se, first))
+				break;
+		if (se != first)
+			continue;
+
+		iovs_num = network_prepare_batch (first, packets, packets_num, iovs);
+
+		for (se = first; se != NULL; se = se->next)
+		{
+			if ((se != first) && !network_same_payload (first, se))
+				continue;
+
+			if (se->transport == NETWORK_TRANSPORT_TCP)
+				network_send_stream (se, iovs, iovs_num);
+			else
+				network_send_datagrams (se, iovs, iovs_num);
+		}
+	}
+} /* }}} void network_send_batch */
+
+/* Sends all packets in the list starting at `p' to all servers. */
+static void network_send_packets (send_packet_t *p) /* {{{ */
+{
+	while (p != NULL)
+	{
+		send_packet_t *batch[NETWORK_SEND_BATCH];
+		size_t batch_num = 0;
+		uint64_t octets = 0;
+
+		while ((p != NULL) && (batch_num < NETWORK_SEND_BATCH))
+		{
+			octets += (uint64_t) p->data_len;
+
+			batch[batch_num] = p;
+			batch_num++;
+			p = p->next;
+		}
+
+		stats_counter_add (&stats_octets_tx, octets);
+		stats_counter_add (&stats_packets_tx, (uint64_t) batch_num);
+		network_send_batch (batch, batch_num);
+	}
+} /* }}} void network_send_packets */
+
+/* Returns true if the queued packets should be sent now. With compression,
+ * packets are held back until enough of them can be combined, the oldest
+ * one has reached `MaxBufferLatency' or the plugin is flushed. The caller
+ * must hold `send_queue_lock'. */
+static _Bool send_queue_ready (void) /* {{{ */
+{
+	if (send_queue_head == NULL)
+		return (0);
+
+	if (!network_config_compress
+			|| send_queue_flush
+			|| (send_queue_length >= NETWORK_COMPRESS_PACKETS))
+		return (1);
+
+	if ((network_config_buffer_latency > 0)
+			&& (network_buffer_due (send_queue_head->first_write)
+				<= cdtime ()))
+		return (1);
+
+	return (0);
+} /* }}} _Bool send_queue_ready */
+
+static void *send_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	while (42)
+	{
+		send_packet_t *head = NULL;
+		send_packet_t *tail = NULL;
+		cdtime_t next = 0;
+
+		/* The buffers must not be locked while holding `send_queue_lock',
+		 * so this is done before waiting. A value written while this
+		 * thread is waiting is due after `next'. */
+		if (network_config_buffer_latency > 0)
+			next = network_flush_old_send_buffers (cdtime ());
+
+		pthread_mutex_lock (&send_queue_lock);
+		while ((send_loop == 0) && !send_queue_ready ())
+		{
+			struct timespec ts;
+			cdtime_t deadline = next;
+
+			/* Held back packets are due, too. */
+			if ((send_queue_head != NULL)
+					&& (network_config_buffer_latency > 0))
+			{
+				cdtime_t due = network_buffer_due (
+						send_queue_head->first_write);
+				if ((deadline == 0) || (due < deadline))
+					deadline = due;
+			}
+
+			if (deadline == 0)
+			{
+				pthread_cond_wait (&send_queue_cond, &send_queue_lock);
+				continue;
+			}
+
+			CDTIME_T_TO_TIMESPEC (deadline, &ts);
+			if (pthread_cond_timedwait (&send_queue_cond, &send_queue_lock,
+						&ts) == ETIMEDOUT)
+				break;
+		}
+
+		/* Take all queued packets at once. */
+		if ((send_loop != 0) || send_queue_ready ())
+		{
+			head = send_queue_head;
+			tail = send_queue_tail;
+			send_queue_head = NULL;
+			send_queue_tail = NULL;
+			send_queue_length = 0;
+			send_queue_flush = 0;
+		}
+		pthread_mutex_unlock (&send_queue_lock);
+
+		/* All packets are sent before exiting. */
+		if ((head == NULL) && (send_loop != 0))
+			break;
+		else if (head == NULL)
+			continue;
+
+		network_send_packets (head);
+
+		pthread_mutex_lock (&send_queue_lock);
+		tail->next = send_packets_free;
+		send_packets_free = head;
+		pthread_mutex_unlock (&send_queue_lock);
+	} /* while (42) */
+
+	return (NULL);
+} /* }}} void *send_thread */
+
+static int start_send_thread (void) /* {{{ */
+{
+	size_t i;
+	int status;
+
+	memset (send_buffers, 0, sizeof (send_buffers));
+	for (i = 0; i < NETWORK_SEND_BUFFERS; i++)
+		pthread_mutex_init (&send_buffers[i].lock, /* attr = */ NULL);
+
+#if HAVE_LIBGCRYPT
+	send_scratch = malloc (NETWORK_SEND_BATCH
+			* (BUFF_SIG_SIZE + network_config_packet_size));
+	if (send_scratch == NULL)
+	{
+		ERROR ("network plugin: malloc failed.");
+		return (-1);
+	}
+#endif
+#if HAVE_LIBLZ4
+	send_compress_in = malloc (NETWORK_COMPRESS_PACKETS
+			* NETWORK_COMPRESS_FRAME_SIZE);
+	send_compress_out = malloc (NETWORK_SEND_BATCH
+			* network_config_packet_size);
+	if ((send_compress_in == NULL) || (send_compress_out == NULL))
+	{
+		ERROR ("network plugin: malloc failed.");
+		sfree (send_compress_in);
+		sfree (send_compress_out);
+		return (-1);
+	}
+#endif
+
+	status = thread_create (&send_thread_id, /* attr = */ NULL,
+			send_thread, /* arg = */ NULL,
+			"net/send", /* cpus = */ NULL);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("network plugin: pthread_create failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+#if HAVE_LIBGCRYPT
+		sfree (send_scratch);
+#endif
+#if HAVE_LIBLZ4
+		sfree (send_compress_in);
+		sfree (send_compress_out);
+#endif
+		return (-1);
+	}
+	send_thread_running = 1;
 
-  DEBUG ("network plugin: network_send_buffer: buffer_len = %zu", buffer_len);
+	return (0);
+} /* }}} int start_send_thread */
 
-  for (se = sending_sockets; se != NULL; se = se->next)
-  {
-#if HAVE_LIBGCRYPT
-    if (se->data.client.security_level == SECURITY_LEVEL_ENCRYPT)
-      networt_send_buffer_encrypted (se, buffer, buffer_len);
-    else if (se->data.client.security_level == SECURITY_LEVEL_SIGN)
-      networt_send_buffer_signed (se, buffer, buffer_len);
-    else /* if (se->data.client.security_level == SECURITY_LEVEL_NONE) */
-#endif /* HAVE_LIBGCRYPT */
-      networt_send_buffer_plain (se, buffer, buffer_len);
-  } /* for (sending_sockets) */
-} /* }}} void network_send_buffer */
 
 static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
-		value_list_t *vl_def,
+		value_list_t *vl_def, string_table_t *st,
 		const data_set_t *ds, const value_list_t *vl)
 {
 	char *buffer_orig = buffer;
 
 	if (strcmp (vl_def->host, vl->host) != 0)
 	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_HOST,
-					vl->host, strlen (vl->host)) != 0)
+		if (write_part_identifier (&buffer, &buffer_size, st,
+					TYPE_HOST, TYPE_HOST_REF, vl->host) != 0)
 			return (-1);
 		sstrncpy (vl_def->host, vl->host, sizeof (vl_def->host));
 	}
@@ -2620,36 +5574,46 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 		vl_def->interval = vl->interval;
 	}
 
+	/* Only sent if `PipelineTracing' is enabled here or on the daemon the
+	 * values are forwarded from. */
+	if (vl_def->trace.origin != vl->trace.origin)
+	{
+		if (write_part_number (&buffer, &buffer_size, TYPE_ORIGIN_HR,
+					(uint64_t) vl->trace.origin))
+			return (-1);
+		vl_def->trace.origin = vl->trace.origin;
+	}
+
 	if (strcmp (vl_def->plugin, vl->plugin) != 0)
 	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN,
-					vl->plugin, strlen (vl->plugin)) != 0)
+		if (write_part_identifier (&buffer, &buffer_size, st,
+					TYPE_PLUGIN, TYPE_PLUGIN_REF, vl->plugin) != 0)
 			return (-1);
 		sstrncpy (vl_def->plugin, vl->plugin, sizeof (vl_def->plugin));
 	}
 
 	if (strcmp (vl_def->plugin_instance, vl->plugin_instance) != 0)
 	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_PLUGIN_INSTANCE,
-					vl->plugin_instance,
-					strlen (vl->plugin_instance)) != 0)
+		if (write_part_identifier (&buffer, &buffer_size, st,
+					TYPE_PLUGIN_INSTANCE, TYPE_PLUGIN_INSTANCE_REF,
+					vl->plugin_instance) != 0)
 			return (-1);
 		sstrncpy (vl_def->plugin_instance, vl->plugin_instance, sizeof (vl_def->plugin_instance));
 	}
 
 	if (strcmp (vl_def->type, vl->type) != 0)
 	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE,
-					vl->type, strlen (vl->type)) != 0)
+		if (write_part_identifier (&buffer, &buffer_size, st,
+					TYPE_TYPE, TYPE_TYPE_REF, vl->type) != 0)
 			return (-1);
 		sstrncpy (vl_def->type, ds->type, sizeof (vl_def->type));
 	}
 
 	if (strcmp (vl_def->type_instance, vl->type_instance) != 0)
 	{
-		if (write_part_string (&buffer, &buffer_size, TYPE_TYPE_INSTANCE,
-					vl->type_instance,
-					strlen (vl->type_instance)) != 0)
+		if (write_part_identifier (&buffer, &buffer_size, st,
+					TYPE_TYPE_INSTANCE, TYPE_TYPE_INSTANCE_REF,
+					vl->type_instance) != 0)
 			return (-1);
 		sstrncpy (vl_def->type_instance, vl->type_instance, sizeof (vl_def->type_instance));
 	}
@@ -2660,22 +5624,10 @@ static int add_to_buffer (char *buffer, int buffer_size, /* {{{ */
 	return (buffer - buffer_orig);
 } /* }}} int add_to_buffer */
 
-static void flush_buffer (void)
-{
-	DEBUG ("network plugin: flush_buffer: send_buffer_fill = %i",
-			send_buffer_fill);
-
-	network_send_buffer (send_buffer, (size_t) send_buffer_fill);
-
-	stats_octets_tx += ((uint64_t) send_buffer_fill);
-	stats_packets_tx++;
-
-	network_init_buffer ();
-}
-
 static int network_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
+	send_buffer_t *sb;
 	int status;
 
 	if (!check_send_okay (vl))
@@ -2687,46 +5639,43 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	  DEBUG ("network plugin: network_write: "
 	      "NOT sending %s.", name);
 #endif
-	  /* Counter is not protected by another lock and may be reached by
-	   * multiple threads */
-	  pthread_mutex_lock (&stats_lock);
-	  stats_values_not_sent++;
-	  pthread_mutex_unlock (&stats_lock);
+	  stats_counter_inc (&stats_values_not_sent);
 	  return (0);
 	}
 
-	uc_meta_data_add_unsigned_int (vl,
-	    "network:time_sent", (uint64_t) vl->time);
-
-	pthread_mutex_lock (&send_buffer_lock);
+	sb = network_lock_send_buffer (vl);
+	if (sb == NULL)
+		return (-1);
 
-	status = add_to_buffer (send_buffer_ptr,
-			network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-			&send_buffer_vl,
+	status = add_to_buffer (sb->ptr,
+			network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+			&sb->vl,
+			network_config_dictionary ? &sb->strings : NULL,
 			ds, vl);
 	if (status >= 0)
 	{
 		/* status == bytes added to the buffer */
-		send_buffer_fill += status;
-		send_buffer_ptr  += status;
+		sb->fill += status;
+		sb->ptr  += status;
 
-		stats_values_sent++;
+		stats_counter_inc (&stats_values_sent);
 	}
 	else
 	{
-		flush_buffer ();
+		send_buffer_flush (sb);
 
-		status = add_to_buffer (send_buffer_ptr,
-				network_config_packet_size - (send_buffer_fill + BUFF_SIG_SIZE),
-				&send_buffer_vl,
+		status = add_to_buffer (sb->ptr,
+				network_config_packet_size - (sb->fill + BUFF_SIG_SIZE),
+				&sb->vl,
+				network_config_dictionary ? &sb->strings : NULL,
 				ds, vl);
 
 		if (status >= 0)
 		{
-			send_buffer_fill += status;
-			send_buffer_ptr  += status;
+			sb->fill += status;
+			sb->ptr  += status;
 
-			stats_values_sent++;
+			stats_counter_inc (&stats_values_sent);
 		}
 	}
 
@@ -2734,13 +5683,19 @@ static int network_write (const data_set_t *ds, const value_list_t *vl,
 	{
 		ERROR ("network plugin: Unable to append to the "
 				"buffer for some weird reason");
+		/* Forget the fields and strings of the partial write. */
+		send_buffer_reset (sb);
 	}
-	else if ((network_config_packet_size - send_buffer_fill) < 15)
+	else
 	{
-		flush_buffer ();
+		if (sb->first_write == 0)
+			sb->first_write = cdtime ();
+
+		if ((network_config_packet_size - sb->fill) < 15)
+			send_buffer_flush (sb);
 	}
 
-	pthread_mutex_unlock (&send_buffer_lock);
+	pthread_mutex_unlock (&sb->lock);
 
 	return ((status < 0) ? -1 : 0);
 } /* int network_write */
@@ -2821,6 +5776,60 @@ static int network_config_set_interface (const oconfig_item_t *ci, /* {{{ */
   return (0);
 } /* }}} int network_config_set_interface */
 
+static int network_config_set_positive (const oconfig_item_t *ci, /* {{{ */
+    int *ret_value)
+{
+  int tmp;
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+  {
+    WARNING ("network plugin: The `%s' config option needs exactly "
+        "one numeric argument.", ci->key);
+    return (-1);
+  }
+
+  tmp = (int) ci->values[0].value.number;
+  if (tmp < 1)
+  {
+    WARNING ("network plugin: The `%s' config option must be at least one.",
+        ci->key);
+    return (-1);
+  }
+
+  *ret_value = tmp;
+  return (0);
+} /* }}} int network_config_set_positive */
+
+static int network_config_set_cpus (const oconfig_item_t *ci, /* {{{ */
+    char **ret_cpus)
+{
+  char *tmp;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("network plugin: The `%s' config option needs exactly "
+        "one string argument.", ci->key);
+    return (-1);
+  }
+
+  if (thread_check_cpus (ci->values[0].value.string) != 0)
+  {
+    WARNING ("network plugin: The `%s' option is invalid and will be "
+        "ignored.", ci->key);
+    return (-1);
+  }
+
+  tmp = strdup (ci->values[0].value.string);
+  if (tmp == NULL)
+    return (-1);
+
+  sfree (*ret_cpus);
+  *ret_cpus = tmp;
+
+  return (0);
+} /* }}} int network_config_set_cpus */
+
 static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
 {
   int tmp;
@@ -2839,6 +5848,85 @@ static int network_config_set_buffer_size (const oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int network_config_set_buffer_size */
 
+static int network_config_set_transport (const oconfig_item_t *ci, /* {{{ */
+    int *retval)
+{
+  const char *str;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("network plugin: The `%s' config option needs exactly "
+        "one string argument.", ci->key);
+    return (-1);
+  }
+
+  str = ci->values[0].value.string;
+  if (strcasecmp ("UDP", str) == 0)
+    *retval = NETWORK_TRANSPORT_UDP;
+  else if (strcasecmp ("TCP", str) == 0)
+    *retval = NETWORK_TRANSPORT_TCP;
+  else
+  {
+    WARNING ("network plugin: Unknown %s `%s'.", ci->key, str);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_transport */
+
+static int network_config_set_latency (const oconfig_item_t *ci) /* {{{ */
+{
+  double tmp;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_NUMBER))
+  {
+    WARNING ("network plugin: The `%s' config option needs exactly "
+        "one numeric argument.", ci->key);
+    return (-1);
+  }
+
+  tmp = ci->values[0].value.number;
+  if (tmp < 0.0)
+  {
+    WARNING ("network plugin: The `%s' config option must not be negative.",
+        ci->key);
+    return (-1);
+  }
+
+  network_config_buffer_latency = MS_TO_CDTIME_T (tmp);
+  return (0);
+} /* }}} int network_config_set_latency */
+
+static int network_config_set_drop_policy (const oconfig_item_t *ci) /* {{{ */
+{
+  const char *str;
+
+  if ((ci->values_num != 1)
+      || (ci->values[0].type != OCONFIG_TYPE_STRING))
+  {
+    WARNING ("network plugin: The `%s' config option needs exactly "
+        "one string argument.", ci->key);
+    return (-1);
+  }
+
+  str = ci->values[0].value.string;
+  if (strcasecmp ("DropOldest", str) == 0)
+    network_config_queue_policy = RQ_DROP_OLDEST;
+  else if (strcasecmp ("DropNewest", str) == 0)
+    network_config_queue_policy = RQ_DROP_NEWEST;
+  else if (strcasecmp ("Block", str) == 0)
+    network_config_queue_policy = RQ_BLOCK;
+  else
+  {
+    WARNING ("network plugin: Unknown %s `%s'.", ci->key, str);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int network_config_set_drop_policy */
+
 #if HAVE_LIBGCRYPT
 static int network_config_set_string (const oconfig_item_t *ci, /* {{{ */
     char **ret_string)
@@ -2935,6 +6023,10 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child,
           &se->interface);
+    else if (strcasecmp ("Passthrough", child->key) == 0)
+      network_config_set_boolean (child, &se->data.server.passthrough);
+    else if (strcasecmp ("Transport", child->key) == 0)
+      network_config_set_transport (child, &se->transport);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -2943,6 +6035,19 @@ static int network_config_add_listen (const oconfig_item_t *ci) /* {{{ */
   }
 
 #if HAVE_LIBGCRYPT
+  /* Packets of pass-through sockets are forwarded as they are and checked by
+   * the final receiver only. */
+  if (se->data.server.passthrough
+      && (se->data.server.security_level > SECURITY_LEVEL_NONE))
+  {
+    ERROR ("network plugin: The `Passthrough' option can't be combined with "
+        "a security level higher than `none'. Packets are forwarded without "
+        "being verified or decrypted. Cowardly refusing to open this "
+        "socket!");
+    sockent_destroy (se);
+    return (-1);
+  }
+
   if ((se->data.server.security_level > SECURITY_LEVEL_NONE)
       && (se->data.server.auth_file == NULL))
   {
@@ -3017,6 +6122,12 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     if (strcasecmp ("Interface", child->key) == 0)
       network_config_set_interface (child,
           &se->interface);
+    else if (strcasecmp ("Compress", child->key) == 0)
+      network_config_set_boolean (child, &se->data.client.compress);
+    else if (strcasecmp ("Transport", child->key) == 0)
+      network_config_set_transport (child, &se->transport);
+    else if (strcasecmp ("SegmentationOffload", child->key) == 0)
+      network_config_set_boolean (child, &se->data.client.segment);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3024,6 +6135,34 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     }
   }
 
+  if (se->data.client.segment && (se->transport == NETWORK_TRANSPORT_TCP))
+  {
+    WARNING ("network plugin: The `SegmentationOffload' option only applies "
+        "to UDP and is ignored for `%s'.", se->node);
+    se->data.client.segment = 0;
+  }
+#if !NETWORK_HAVE_GSO
+  if (se->data.client.segment)
+  {
+    WARNING ("network plugin: The `SegmentationOffload' option requires "
+        "UDP_SEGMENT, which is not available on this system. Packets to "
+        "`%s' are sent one by one.", se->node);
+    se->data.client.segment = 0;
+  }
+#endif
+
+#if !HAVE_LIBLZ4
+  if (se->data.client.compress)
+  {
+    WARNING ("network plugin: The `Compress' option requires liblz4, "
+        "but the network plugin was built without it. Packets to "
+        "`%s' will not be compressed.", se->node);
+    se->data.client.compress = 0;
+  }
+#endif
+  if (se->data.client.compress)
+    network_config_compress = 1;
+
 #if HAVE_LIBGCRYPT
   if ((se->data.client.security_level > SECURITY_LEVEL_NONE)
       && ((se->data.client.username == NULL)
@@ -3045,6 +6184,25 @@ static int network_config_add_server (const oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
 
+#if NETWORK_HAVE_GSO
+  /* Kernels before 4.18 don't know the option. */
+  if (se->data.client.segment)
+  {
+    int segment_size = 0;
+    socklen_t segment_size_len = sizeof (segment_size);
+
+    if (getsockopt (se->data.client.fd, SOL_UDP, UDP_SEGMENT,
+          &segment_size, &segment_size_len) != 0)
+    {
+      char errbuf[1024];
+      WARNING ("network plugin: UDP_SEGMENT is not supported: %s. Packets "
+          "to `%s' are sent one by one.",
+          sstrerror (errno, errbuf, sizeof (errbuf)), se->node);
+      se->data.client.segment = 0;
+    }
+  }
+#endif
+
   status = sockent_add (se);
   if (status != 0)
   {
@@ -3060,6 +6218,16 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
 {
   int i;
 
+  /* `ReceiveThreads' determines how many sockets each `Listen' option opens,
+   * so it has to be known before any of those are handled. */
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      network_config_set_positive (child, &network_config_receive_threads);
+  }
+
   for (i = 0; i < ci->children_num; i++)
   {
     oconfig_item_t *child = ci->children + i;
@@ -3076,6 +6244,28 @@ static int network_config (oconfig_item_t *ci) /* {{{ */
       network_config_set_boolean (child, &network_config_forward);
     else if (strcasecmp ("ReportStats", child->key) == 0)
       network_config_set_boolean (child, &network_config_stats);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+      /* handled above */;
+    else if (strcasecmp ("DispatchThreads", child->key) == 0)
+      network_config_set_positive (child, &network_config_dispatch_threads);
+    else if (strcasecmp ("ReceiveThreadsCPUs", child->key) == 0)
+      network_config_set_cpus (child, &network_config_receive_cpus);
+    else if (strcasecmp ("DispatchThreadsCPUs", child->key) == 0)
+      network_config_set_cpus (child, &network_config_dispatch_cpus);
+    else if (strcasecmp ("ReceiveBuffers", child->key) == 0)
+      network_config_set_positive (child, &network_config_receive_buffers);
+    else if (strcasecmp ("MaxQueueLength", child->key) == 0)
+      network_config_set_positive (child, &network_config_queue_limit);
+    else if (strcasecmp ("QueueDropPolicy", child->key) == 0)
+      network_config_set_drop_policy (child);
+    else if (strcasecmp ("MaxBufferLatency", child->key) == 0)
+      network_config_set_latency (child);
+    else if (strcasecmp ("IdentifierDictionary", child->key) == 0)
+      network_config_set_boolean (child, &network_config_dictionary);
+    else if (strcasecmp ("MaxReceiveRate", child->key) == 0)
+      network_config_set_positive (child, &network_config_receive_rate);
+    else if (strcasecmp ("MaxReceiveRatePerHost", child->key) == 0)
+      network_config_set_positive (child, &network_config_receive_rate_host);
     else
     {
       WARNING ("network plugin: Option `%s' is not allowed here.",
@@ -3093,6 +6283,7 @@ static int network_notification (const notification_t *n,
   char *buffer_ptr = buffer;
   int   buffer_free = sizeof (buffer);
   int   status;
+  send_packet_t *p;
 
   memset (buffer, '\0', sizeof (buffer));
 
@@ -3152,7 +6343,13 @@ static int network_notification (const notification_t *n,
   if (status != 0)
     return (-1);
 
-  network_send_buffer (buffer, sizeof (buffer) - buffer_free);
+  p = send_packet_get ();
+  if (p == NULL)
+    return (-1);
+  p->data_len = sizeof (buffer) - buffer_free;
+  p->first_write = cdtime ();
+  memcpy (p->data, buffer, p->data_len);
+  send_queue_push (p);
 
   return (0);
 } /* int network_notification */
@@ -3161,33 +6358,125 @@ static int network_shutdown (void)
 {
 	listen_loop++;
 
-	/* Kill the listening thread */
-	if (receive_thread_running != 0)
+	/* Kill the listening threads */
+	if (receive_threads_num > 0)
+	{
+		size_t i;
+
+		INFO ("network plugin: Stopping receive threads.");
+		for (i = 0; i < receive_threads_num; i++)
+			if (receive_threads[i].running)
+				pthread_kill (receive_threads[i].id, SIGTERM);
+
+		for (i = 0; i < receive_threads_num; i++)
+		{
+			if (!receive_threads[i].running)
+				continue;
+			pthread_join (receive_threads[i].id,
+					NULL /* no return value */);
+			receive_threads[i].running = 0;
+		}
+	}
+
+	if (stream_receiver.running)
 	{
-		INFO ("network plugin: Stopping receive thread.");
-		pthread_kill (receive_thread_id, SIGTERM);
-		pthread_join (receive_thread_id, NULL /* no return value */);
-		memset (&receive_thread_id, 0, sizeof (receive_thread_id));
-		receive_thread_running = 0;
+		INFO ("network plugin: Stopping the TCP receive thread.");
+		pthread_kill (stream_receiver.id, SIGTERM);
+
+		/* Wake it up if it's waiting for receive buffers. */
+		pthread_mutex_lock (&receive_pool_lock);
+		pthread_cond_broadcast (&receive_pool_cond);
+		pthread_mutex_unlock (&receive_pool_lock);
+
+		pthread_join (stream_receiver.id, /* retval = */ NULL);
+		stream_receiver.running = 0;
 	}
 
-	/* Shutdown the dispatching thread */
-	if (dispatch_thread_running != 0)
+	/* Shutdown the dispatching threads */
+	if (receive_queues_num > 0)
 	{
-		INFO ("network plugin: Stopping dispatch thread.");
-		pthread_mutex_lock (&receive_list_lock);
-		pthread_cond_broadcast (&receive_list_cond);
-		pthread_mutex_unlock (&receive_list_lock);
-		pthread_join (dispatch_thread_id, /* ret = */ NULL);
-		dispatch_thread_running = 0;
+		size_t i;
+
+		INFO ("network plugin: Stopping dispatch threads.");
+		for (i = 0; i < receive_queues_num; i++)
+		{
+			receive_queue_t *q = receive_queues + i;
+
+			pthread_mutex_lock (&q->lock);
+			pthread_cond_broadcast (&q->cond);
+			pthread_mutex_unlock (&q->lock);
+		}
+
+		for (i = 0; i < receive_queues_num; i++)
+		{
+			receive_queue_t *q = receive_queues + i;
+
+			if (q->dispatch_thread_running)
+				pthread_join (q->dispatch_thread_id, /* ret = */ NULL);
+			q->dispatch_thread_running = 0;
+
+			pthread_mutex_destroy (&q->lock);
+			pthread_cond_destroy (&q->cond);
+			pthread_cond_destroy (&q->cond_space);
+		}
+
+		sfree (receive_queues);
+		receive_queues_num = 0;
 	}
 
+	/* All buffers are back in the pool once every thread has exited. */
+	receive_pool_destroy ();
+
 	sockent_destroy (listen_sockets);
 
-	if (send_buffer_fill > 0)
-		flush_buffer ();
+	if (receive_threads != NULL)
+	{
+		size_t i;
+		for (i = 0; i < receive_threads_num; i++)
+		{
+			sfree (receive_threads[i].pollfd);
+			sfree (receive_threads[i].sockets);
+		}
+		sfree (receive_threads);
+		receive_threads_num = 0;
+	}
+	sfree (network_config_receive_cpus);
+	sfree (network_config_dispatch_cpus);
+
+	/* Hand the remaining values to the send thread and wait for it to
+	 * send them. */
+	network_flush_send_buffers ();
+	if (send_thread_running)
+	{
+		size_t i;
+
+		pthread_mutex_lock (&send_queue_lock);
+		send_loop++;
+		pthread_cond_broadcast (&send_queue_cond);
+		pthread_mutex_unlock (&send_queue_lock);
+
+		pthread_join (send_thread_id, /* retval = */ NULL);
+		send_thread_running = 0;
+
+		for (i = 0; i < NETWORK_SEND_BUFFERS; i++)
+		{
+			pthread_mutex_destroy (&send_buffers[i].lock);
+			sfree (send_buffers[i].packet);
+		}
+	}
 
-	sfree (send_buffer);
+	send_packets_free_list (send_queue_head);
+	send_queue_head = NULL;
+	send_queue_tail = NULL;
+	send_packets_free_list (send_packets_free);
+	send_packets_free = NULL;
+#if HAVE_LIBGCRYPT
+	sfree (send_scratch);
+#endif
+#if HAVE_LIBLZ4
+	sfree (send_compress_in);
+	sfree (send_compress_out);
+#endif
 
 	/* TODO: Close `sending_sockets' */
 
@@ -3207,21 +6496,71 @@ static int network_stats_read (void) /* {{{ */
 	derive_t copy_packets_tx;
 	derive_t copy_values_dispatched;
 	derive_t copy_values_not_dispatched;
+	derive_t copy_values_rate_limited;
 	derive_t copy_values_sent;
 	derive_t copy_values_not_sent;
+	derive_t copy_send_datagrams;
+	derive_t copy_send_calls;
+	static derive_t last_send_datagrams = 0;
+	static derive_t last_send_calls = 0;
+	derive_t copy_packets_dropped;
 	derive_t copy_receive_list_length;
+	derive_t copy_receive_list_length_max;
+	derive_t copy_receive_list_dropped;
+	derive_t copy_receive_list_dropped_memory;
 	value_list_t vl = VALUE_LIST_INIT;
 	value_t values[2];
+	sockent_t *se;
+	size_t i;
 
-	copy_octets_rx = stats_octets_rx;
-	copy_octets_tx = stats_octets_tx;
-	copy_packets_rx = stats_packets_rx;
-	copy_packets_tx = stats_packets_tx;
-	copy_values_dispatched = stats_values_dispatched;
-	copy_values_not_dispatched = stats_values_not_dispatched;
-	copy_values_sent = stats_values_sent;
-	copy_values_not_sent = stats_values_not_sent;
-	copy_receive_list_length = receive_list_length;
+	copy_octets_rx = 0;
+	copy_packets_rx = 0;
+	copy_packets_dropped = 0;
+	for (i = 0; i < receive_threads_num; i++)
+	{
+		copy_octets_rx += receive_threads[i].octets_rx;
+		copy_packets_rx += receive_threads[i].packets_rx;
+		copy_packets_dropped += receive_threads[i].packets_dropped;
+	}
+	copy_octets_rx += stream_receiver.octets_rx;
+	copy_packets_rx += stream_receiver.packets_rx;
+
+	copy_octets_tx = (derive_t) stats_counter_get (&stats_octets_tx);
+	copy_packets_tx = (derive_t) stats_counter_get (&stats_packets_tx);
+	copy_values_dispatched = (derive_t) stats_counter_get (
+			&stats_values_dispatched);
+	copy_values_not_dispatched = (derive_t) stats_counter_get (
+			&stats_values_not_dispatched);
+	copy_values_rate_limited = (derive_t) stats_counter_get (
+			&stats_values_rate_limited);
+	copy_values_sent = (derive_t) stats_counter_get (&stats_values_sent);
+	copy_values_not_sent = (derive_t) stats_counter_get (
+			&stats_values_not_sent);
+	copy_send_datagrams = (derive_t) stats_counter_get (
+			&stats_send_datagrams);
+	copy_send_calls = (derive_t) stats_counter_get (&stats_send_calls);
+	copy_receive_list_length = 0;
+	copy_receive_list_length_max = 0;
+	copy_receive_list_dropped = 0;
+	copy_receive_list_dropped_memory = 0;
+	for (i = 0; i < receive_queues_num; i++)
+	{
+		receive_queue_t *q = receive_queues + i;
+		uint64_t length;
+		uint64_t length_max;
+
+		length = __sync_fetch_and_add (&q->list.length, 0);
+		/* Start a new high-water mark for the next interval. */
+		length_max = stats_max_reset (&q->length_max, length);
+
+		copy_receive_list_length += (derive_t) length;
+		if (copy_receive_list_length_max < (derive_t) length_max)
+			copy_receive_list_length_max = (derive_t) length_max;
+		copy_receive_list_dropped += (derive_t) stats_counter_get (
+				&q->dropped);
+		copy_receive_list_dropped_memory += (derive_t) stats_counter_get (
+				&q->dropped_memory);
+	}
 
 	/* Initialize `vl' */
 	vl.values = values;
@@ -3243,9 +6582,17 @@ static int network_stats_read (void) /* {{{ */
 	sstrncpy (vl.type, "if_packets", sizeof (vl.type));
 	plugin_dispatch_values_secure (&vl);
 
+	vl.values_len = 1;
+
+	/* Packets dropped because no receive buffer was available */
+	vl.values[0].derive = (derive_t) copy_packets_dropped;
+	sstrncpy (vl.type, "if_rx_errors", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "buffers-exhausted",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
 	/* Values (not) dispatched and (not) send */
 	sstrncpy (vl.type, "total_values", sizeof (vl.type));
-	vl.values_len = 1;
 
 	vl.values[0].derive = (derive_t) copy_values_dispatched;
 	sstrncpy (vl.type_instance, "dispatch-accepted",
@@ -3257,6 +6604,11 @@ static int network_stats_read (void) /* {{{ */
 			sizeof (vl.type_instance));
 	plugin_dispatch_values_secure (&vl);
 
+	vl.values[0].derive = (derive_t) copy_values_rate_limited;
+	sstrncpy (vl.type_instance, "dispatch-ratelimited",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
 	vl.values[0].derive = (derive_t) copy_values_sent;
 	sstrncpy (vl.type_instance, "send-accepted",
 			sizeof (vl.type_instance));
@@ -3267,12 +6619,79 @@ static int network_stats_read (void) /* {{{ */
 			sizeof (vl.type_instance));
 	plugin_dispatch_values_secure (&vl);
 
+	/* Packets dropped because a receive queue was full */
+	vl.values[0].derive = (derive_t) copy_receive_list_dropped;
+	sstrncpy (vl.type, "if_rx_errors", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "queue-full",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
+	/* Packets dropped because of the `MemoryBudget' */
+	vl.values[0].derive = copy_receive_list_dropped_memory;
+	sstrncpy (vl.type_instance, "memory-budget",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
 	/* Receive queue length */
 	vl.values[0].gauge = (gauge_t) copy_receive_list_length;
 	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
 	vl.type_instance[0] = 0;
 	plugin_dispatch_values_secure (&vl);
 
+	/* Longest receive queue since the last read */
+	vl.values[0].gauge = (gauge_t) copy_receive_list_length_max;
+	sstrncpy (vl.type_instance, "max", sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
+	/* Datagrams per system call since the last read, which is above one
+	 * with `sendmmsg' and much higher with `SegmentationOffload'. */
+	if (copy_send_calls > last_send_calls)
+		vl.values[0].gauge = ((gauge_t) (copy_send_datagrams
+					- last_send_datagrams))
+			/ ((gauge_t) (copy_send_calls - last_send_calls));
+	else
+		vl.values[0].gauge = NAN;
+	last_send_datagrams = copy_send_datagrams;
+	last_send_calls = copy_send_calls;
+	sstrncpy (vl.type, "gauge", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "send-datagrams_per_call",
+			sizeof (vl.type_instance));
+	plugin_dispatch_values_secure (&vl);
+
+	/* Octets and packets received and forwarded by pass-through sockets */
+	vl.values_len = 2;
+	vl.type_instance[0] = 0;
+	for (se = listen_sockets; se != NULL; se = se->next)
+	{
+		derive_t copy_forward[4];
+
+		if (!se->data.server.passthrough)
+			continue;
+
+		copy_forward[0] = (derive_t) stats_counter_get (
+				&se->data.server.forward_octets_rx);
+		copy_forward[1] = (derive_t) stats_counter_get (
+				&se->data.server.forward_octets_tx);
+		copy_forward[2] = (derive_t) stats_counter_get (
+				&se->data.server.forward_packets_rx);
+		copy_forward[3] = (derive_t) stats_counter_get (
+				&se->data.server.forward_packets_tx);
+
+		ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance),
+				"forward-%s-%s", se->node,
+				(se->service != NULL) ? se->service : NET_DEFAULT_PORT);
+
+		vl.values[0].derive = copy_forward[0];
+		vl.values[1].derive = copy_forward[1];
+		sstrncpy (vl.type, "if_octets", sizeof (vl.type));
+		plugin_dispatch_values_secure (&vl);
+
+		vl.values[0].derive = copy_forward[2];
+		vl.values[1].derive = copy_forward[3];
+		sstrncpy (vl.type, "if_packets", sizeof (vl.type));
+		plugin_dispatch_values_secure (&vl);
+	}
+
 	return (0);
 } /* }}} int network_stats_read */
 
@@ -3297,68 +6716,46 @@ static int network_init (void)
 
 	plugin_register_shutdown ("network", network_shutdown);
 
-	send_buffer = malloc (network_config_packet_size);
-	if (send_buffer == NULL)
-	{
-		ERROR ("network plugin: malloc failed.");
-		return (-1);
-	}
-	network_init_buffer ();
-
 	/* setup socket(s) and so on */
 	if (sending_sockets != NULL)
 	{
+		if (start_send_thread () != 0)
+			return (-1);
+
 		plugin_register_write ("network", network_write,
 				/* user_data = */ NULL);
 		plugin_register_notification ("network", network_notification,
 				/* user_data = */ NULL);
 	}
 
+	if (sending_sockets == NULL)
+	{
+		sockent_t *se;
+
+		for (se = listen_sockets; se != NULL; se = se->next)
+			if (se->data.server.passthrough)
+				WARNING ("network plugin: `Passthrough' is enabled for "
+						"`%s', but no `Server' is configured to forward "
+						"the packets to.", se->node);
+	}
+
 	/* If no threads need to be started, return here. */
-	if ((listen_sockets_num == 0)
-			|| ((dispatch_thread_running != 0)
-				&& (receive_thread_running != 0)))
+	if ((listen_sockets_num == 0) && (listen_streams_num == 0))
 		return (0);
 
-	if (dispatch_thread_running == 0)
+	if (receive_queues_num == 0)
 	{
-		int status;
-		status = pthread_create (&dispatch_thread_id,
-				NULL /* no attributes */,
-				dispatch_thread,
-				NULL /* no argument */);
-		if (status != 0)
-		{
-			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-		}
-		else
-		{
-			dispatch_thread_running = 1;
-		}
+		if (receive_pool_init () != 0)
+			return (-1);
+		if (start_dispatch_threads () != 0)
+			return (-1);
 	}
 
-	if (receive_thread_running == 0)
-	{
-		int status;
-		status = pthread_create (&receive_thread_id,
-				NULL /* no attributes */,
-				receive_thread,
-				NULL /* no argument */);
-		if (status != 0)
-		{
-			char errbuf[1024];
-			ERROR ("network: pthread_create failed: %s",
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-		}
-		else
-		{
-			receive_thread_running = 1;
-		}
-	}
+	if ((listen_sockets_num > 0) && (receive_threads_num == 0))
+		start_receive_threads ();
+
+	if ((listen_streams_num > 0) && !stream_receiver.running)
+		start_stream_thread ();
 
 	return (0);
 } /* int network_init */
@@ -3374,12 +6771,7 @@ static int network_flush (__attribute__((unused)) cdtime_t timeout,
 		__attribute__((unused)) const char *identifier,
 		__attribute__((unused)) user_data_t *user_data)
 {
-	pthread_mutex_lock (&send_buffer_lock);
-
-	if (send_buffer_fill > 0)
-	  flush_buffer ();
-
-	pthread_mutex_unlock (&send_buffer_lock);
+	network_flush_send_buffers ();
 
 	return (0);
 } /* int network_flush */
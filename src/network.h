@@ -64,6 +64,17 @@
 #define TYPE_VALUES          0x0006
 #define TYPE_INTERVAL        0x0007
 #define TYPE_INTERVAL_HR     0x0009
+/* The time the following values were first dispatched, see
+ * "PipelineTracing" */
+#define TYPE_ORIGIN_HR       0x000a
+
+/* References to a previous string of the same packet, see
+ * "IdentifierDictionary" */
+#define TYPE_HOST_REF            0x0010
+#define TYPE_PLUGIN_REF          0x0012
+#define TYPE_PLUGIN_INSTANCE_REF 0x0013
+#define TYPE_TYPE_REF            0x0014
+#define TYPE_TYPE_INSTANCE_REF   0x0015
 
 /* Types to transmit notifications */
 #define TYPE_MESSAGE         0x0100
@@ -71,5 +82,10 @@
 
 #define TYPE_SIGN_SHA256     0x0200
 #define TYPE_ENCR_AES256     0x0210
+#define TYPE_COMPR_LZ4       0x0220
+
+/* Ignored by receivers. Pads datagrams to the same size, see
+ * "SegmentationOffload". */
+#define TYPE_PAD             0x0300
 
 #endif /* NETWORK_H */
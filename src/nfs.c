@@ -23,6 +23,8 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_complain.h"
+#include "utils_procfs.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -95,7 +97,6 @@ static const char *nfs2_procedures_names[] =
 	"fsstat",
 	NULL
 };
-static int nfs2_procedures_names_num = 18;
 
 static const char *nfs3_procedures_names[] =
 {
@@ -123,7 +124,6 @@ static const char *nfs3_procedures_names[] =
 	"commit",
 	NULL
 };
-static int nfs3_procedures_names_num = 22;
 
 #if HAVE_LIBKSTAT && 0
 extern kstat_ctl_t *kc;
@@ -177,130 +177,288 @@ static int nfs_init (void)
 } /* int nfs_init */
 #endif
 
-#define BUFSIZE 1024
-static void nfs_procedures_submit (const char *plugin_instance,
-	       	unsigned long long *val, const char **names, int len)
+/* The procedure counters of one NFS version are on a line of their own, e.g.
+ * "proc3 22 0 1234 ...". The number following the keyword is the number of
+ * counters on the line. */
+struct nfs_table_s
 {
-	value_t values[1];
+	const char *keyword;
+	const char *version;
+	const char **names;
+	size_t names_num;
+};
+typedef struct nfs_table_s nfs_table_t;
+
+#define NFS_PROCEDURES_MAX 22
+static const nfs_table_t nfs_tables[] =
+{
+	{ "proc2", "v2", nfs2_procedures_names,
+		STATIC_ARRAY_SIZE (nfs2_procedures_names) - 1 },
+	{ "proc3", "v3", nfs3_procedures_names,
+		STATIC_ARRAY_SIZE (nfs3_procedures_names) - 1 }
+};
+#define NFS_TABLES_NUM STATIC_ARRAY_SIZE (nfs_tables)
+
+/* The counters of one table in one file. The value lists are filled in when
+ * the table is found for the first time and dispatched by copying them, so
+ * the names are not formatted again each interval. */
+struct nfs_counters_s
+{
+	value_list_t *vl;
+	value_t *values;
+	/* Whether `values' holds the counters of the previous read. */
+	_Bool valid;
+	c_complain_t complaint;
+};
+typedef struct nfs_counters_s nfs_counters_t;
+
+/* The line number of each table found by the first read is remembered, so
+ * later reads only compare the keywords of those lines. */
+#define NFS_LINES_MAX 32
+struct nfs_file_s
+{
+	const char *path;
+	const char *instance;
+	procfs_file_t *proc;
+
+	/* The index into `nfs_tables' of each line, -1 for other lines. */
+	int layout[NFS_LINES_MAX];
+	_Bool layout_valid;
+
+	nfs_counters_t counters[NFS_TABLES_NUM];
+};
+typedef struct nfs_file_s nfs_file_t;
+
+static nfs_file_t nfs_files[] =
+{
+	{ "/proc/net/rpc/nfs",  "client" },
+	{ "/proc/net/rpc/nfsd", "server" }
+};
+#define NFS_FILES_NUM STATIC_ARRAY_SIZE (nfs_files)
+
+/* The value lists dispatched by one read of one file. Read callbacks of the
+ * same plugin never run concurrently. */
+static value_list_t nfs_batch[NFS_TABLES_NUM * NFS_PROCEDURES_MAX];
+
+static _Bool collect_unchanged = 1;
+
+static const char *config_keys[] =
+{
+	"CollectUnchanged"
+};
+static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+
+static int nfs_config (const char *key, const char *value)
+{
+	if (strcasecmp ("CollectUnchanged", key) == 0)
+		collect_unchanged = IS_TRUE (value) ? 1 : 0;
+	else
+		return (-1);
+
+	return (0);
+} /* int nfs_config */
+
+/* Parses the unsigned number at `*ptr', skipping leading blanks, and advances
+ * `*ptr' past it. Returns false if there is no number. */
+static _Bool nfs_parse_number (char **ptr, derive_t *ret)
+{
+	char *p = *ptr;
+	derive_t value = 0;
+
+	while ((*p == ' ') || (*p == '\t'))
+		p++;
+
+	if ((*p < '0') || (*p > '9'))
+		return (0);
+
+	while ((*p >= '0') && (*p <= '9'))
+	{
+		value = (value * 10) + (*p - '0');
+		p++;
+	}
+
+	*ptr = p;
+	*ret = value;
+	return (1);
+} /* _Bool nfs_parse_number */
+
+static int nfs_counters_init (const nfs_file_t *f, size_t t,
+		nfs_counters_t *c)
+{
+	const nfs_table_t *table = nfs_tables + t;
 	value_list_t vl = VALUE_LIST_INIT;
-	int i;
+	size_t i;
+
+	c->vl = calloc (table->names_num, sizeof (*c->vl));
+	c->values = calloc (table->names_num, sizeof (*c->values));
+	if ((c->vl == NULL) || (c->values == NULL))
+	{
+		ERROR ("nfs plugin: calloc failed.");
+		sfree (c->vl);
+		sfree (c->values);
+		return (-1);
+	}
 
-	vl.values = values;
 	vl.values_len = 1;
 	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
 	sstrncpy (vl.plugin, "nfs", sizeof (vl.plugin));
-	sstrncpy (vl.plugin_instance, plugin_instance,
-		       	sizeof (vl.plugin_instance));
+	ssnprintf (vl.plugin_instance, sizeof (vl.plugin_instance), "%s%s",
+			table->version, f->instance);
 	sstrncpy (vl.type, "nfs_procedure", sizeof (vl.type));
+	vl.type_id = plugin_type_lookup (vl.type);
 
-	for (i = 0; i < len; i++)
+	for (i = 0; i < table->names_num; i++)
 	{
-		values[0].derive = val[i];
-		sstrncpy (vl.type_instance, names[i],
-				sizeof (vl.type_instance));
-		DEBUG ("%s-%s/nfs_procedure-%s = %llu",
-				vl.plugin, vl.plugin_instance,
-				vl.type_instance, val[i]);
-		plugin_dispatch_values (&vl);
+		c->vl[i] = vl;
+		c->vl[i].values = c->values + i;
+		sstrncpy (c->vl[i].type_instance, table->names[i],
+				sizeof (c->vl[i].type_instance));
 	}
-} /* void nfs_procedures_submit */
 
-static void nfs_read_stats_file (FILE *fh, char *inst)
+	c->valid = 0;
+	return (0);
+} /* int nfs_counters_init */
+
+/* Returns the index of the table on line `line_num', or -1 if there is none.
+ * Until the layout is known, the keywords of all tables are compared. */
+static int nfs_line_table (nfs_file_t *f, size_t line_num, const char *line)
 {
-	char buffer[BUFSIZE];
+	size_t t;
 
-	char plugin_instance[DATA_MAX_NAME_LEN];
+	if (f->layout_valid && (line_num < NFS_LINES_MAX))
+	{
+		int expected = f->layout[line_num];
+		size_t len;
 
-	char *fields[48];
-	int numfields = 0;
+		if (expected < 0)
+			return (-1);
 
-	if (fh == NULL)
-		return;
+		len = strlen (nfs_tables[expected].keyword);
+		if ((strncmp (line, nfs_tables[expected].keyword, len) == 0)
+				&& (line[len] == ' '))
+			return (expected);
 
-	while (fgets (buffer, BUFSIZE, fh) != NULL)
+		/* The file looks different, e.g. because the module has
+		 * been reloaded. Find out again. */
+		f->layout_valid = 0;
+	}
+
+	for (t = 0; t < NFS_TABLES_NUM; t++)
 	{
-		numfields = strsplit (buffer, fields, 48);
+		size_t len = strlen (nfs_tables[t].keyword);
 
-		if (((numfields - 2) != nfs2_procedures_names_num)
-				&& ((numfields - 2)
-				       	!= nfs3_procedures_names_num))
-			continue;
+		if ((strncmp (line, nfs_tables[t].keyword, len) == 0)
+				&& (line[len] == ' '))
+			return ((int) t);
+	}
 
-		if (strcmp (fields[0], "proc2") == 0)
-		{
-			int i;
-			unsigned long long *values;
-
-			if ((numfields - 2) != nfs2_procedures_names_num)
-			{
-				WARNING ("nfs plugin: Wrong "
-						"number of fields (= %i) "
-						"for NFSv2 statistics.",
-					       	numfields - 2);
-				continue;
-			}
-
-			ssnprintf (plugin_instance, sizeof (plugin_instance),
-					"v2%s", inst);
-
-			values = (unsigned long long *) malloc (nfs2_procedures_names_num * sizeof (unsigned long long));
-			if (values == NULL)
-			{
-				char errbuf[1024];
-				ERROR ("nfs plugin: malloc "
-						"failed: %s",
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				continue;
-			}
-
-			for (i = 0; i < nfs2_procedures_names_num; i++)
-				values[i] = atoll (fields[i + 2]);
-
-			nfs_procedures_submit (plugin_instance, values,
-					nfs2_procedures_names,
-					nfs2_procedures_names_num);
-
-			free (values);
-		}
-		else if (strncmp (fields[0], "proc3", 5) == 0)
+	return (-1);
+} /* int nfs_line_table */
+
+/* Parses the counters on a table's line, following the keyword, and appends
+ * the value lists to be dispatched to `nfs_batch'. */
+static void nfs_read_table (nfs_file_t *f, size_t t, char *p,
+		size_t *batch_num)
+{
+	const nfs_table_t *table = nfs_tables + t;
+	nfs_counters_t *c = f->counters + t;
+	derive_t values[NFS_PROCEDURES_MAX];
+	derive_t num;
+	size_t i;
+
+	if (!nfs_parse_number (&p, &num) || (num != (derive_t) table->names_num))
+	{
+		c_complain (LOG_WARNING, &c->complaint, "nfs plugin: Wrong "
+				"number of fields for NFS%s statistics in %s.",
+				table->version, f->path);
+		return;
+	}
+
+	for (i = 0; i < table->names_num; i++)
+	{
+		if (!nfs_parse_number (&p, values + i))
 		{
-			int i;
-			unsigned long long *values;
-
-			if ((numfields - 2) != nfs3_procedures_names_num)
-			{
-				WARNING ("nfs plugin: Wrong "
-						"number of fields (= %i) "
-						"for NFSv3 statistics.",
-					       	numfields - 2);
-				continue;
-			}
-
-			ssnprintf (plugin_instance, sizeof (plugin_instance),
-					"v3%s", inst);
-
-			values = (unsigned long long *) malloc (nfs3_procedures_names_num * sizeof (unsigned long long));
-			if (values == NULL)
-			{
-				char errbuf[1024];
-				ERROR ("nfs plugin: malloc "
-						"failed: %s",
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				continue;
-			}
-
-			for (i = 0; i < nfs3_procedures_names_num; i++)
-				values[i] = atoll (fields[i + 2]);
-
-			nfs_procedures_submit (plugin_instance, values,
-					nfs3_procedures_names,
-					nfs3_procedures_names_num);
-
-			free (values);
+			c_complain (LOG_WARNING, &c->complaint, "nfs plugin: "
+					"Cannot parse the NFS%s statistics "
+					"in %s.", table->version, f->path);
+			return;
 		}
-	} /* while (fgets (buffer, BUFSIZE, fh) != NULL) */
-} /* void nfs_read_stats_file */
-#undef BUFSIZE
+	}
+
+	c_release (LOG_INFO, &c->complaint, "nfs plugin: The NFS%s statistics "
+			"in %s are fine again.", table->version, f->path);
+
+	if ((c->vl == NULL) && (nfs_counters_init (f, t, c) != 0))
+		return;
+
+	/* Only if a table appears more than once. */
+	if ((*batch_num + table->names_num) > STATIC_ARRAY_SIZE (nfs_batch))
+		return;
+
+	for (i = 0; i < table->names_num; i++)
+	{
+		if (c->valid && !collect_unchanged
+				&& (c->values[i].derive == values[i]))
+			continue;
+
+		c->values[i].derive = values[i];
+		nfs_batch[*batch_num] = c->vl[i];
+		(*batch_num)++;
+	}
+	c->valid = 1;
+} /* void nfs_read_table */
+
+static void nfs_read_file (nfs_file_t *f)
+{
+	char *buffer;
+	char *line;
+	size_t line_num = 0;
+	size_t batch_num = 0;
+	_Bool layout_valid;
+
+	if (f->proc == NULL)
+	{
+		/* The file only exists while the kernel module is loaded. */
+		if (access (f->path, R_OK) != 0)
+			return;
+
+		f->proc = procfs_open (f->path, /* max_age = */ 0);
+		if (f->proc == NULL)
+			return;
+	}
+
+	buffer = procfs_read (f->proc, /* time = */ NULL);
+	if (buffer == NULL)
+	{
+		procfs_close (f->proc);
+		f->proc = NULL;
+		f->layout_valid = 0;
+		return;
+	}
+
+	layout_valid = f->layout_valid;
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		int t;
+
+		t = nfs_line_table (f, line_num, line);
+		if (!layout_valid && (line_num < NFS_LINES_MAX))
+			f->layout[line_num] = t;
+		line_num++;
+
+		if (t >= 0)
+			nfs_read_table (f, (size_t) t,
+					line + strlen (nfs_tables[t].keyword),
+					&batch_num);
+	}
+
+	/* A layout which turned out to be wrong is learned again next time. */
+	if (!layout_valid)
+		f->layout_valid = (line_num <= NFS_LINES_MAX);
+
+	if (batch_num > 0)
+		plugin_dispatch_values_batch (nfs_batch, batch_num);
+} /* void nfs_read_file */
 
 #if HAVE_LIBKSTAT && 0
 static void nfs2_read_kstat (kstat_t *ksp, char *inst)
@@ -332,19 +490,10 @@ static void nfs2_read_kstat (kstat_t *ksp, char *inst)
 
 static int nfs_read (void)
 {
-	FILE *fh;
-
-	if ((fh = fopen ("/proc/net/rpc/nfs", "r")) != NULL)
-	{
-		nfs_read_stats_file (fh, "client");
-		fclose (fh);
-	}
+	size_t i;
 
-	if ((fh = fopen ("/proc/net/rpc/nfsd", "r")) != NULL)
-	{
-		nfs_read_stats_file (fh, "server");
-		fclose (fh);
-	}
+	for (i = 0; i < NFS_FILES_NUM; i++)
+		nfs_read_file (nfs_files + i);
 
 #if HAVE_LIBKSTAT && 0
 	if (nfs2_ksp_client != NULL)
@@ -356,7 +505,33 @@ static int nfs_read (void)
 	return (0);
 }
 
+static int nfs_shutdown (void)
+{
+	size_t i;
+	size_t t;
+
+	for (i = 0; i < NFS_FILES_NUM; i++)
+	{
+		nfs_file_t *f = nfs_files + i;
+
+		if (f->proc != NULL)
+			procfs_close (f->proc);
+		f->proc = NULL;
+
+		for (t = 0; t < NFS_TABLES_NUM; t++)
+		{
+			sfree (f->counters[t].vl);
+			sfree (f->counters[t].values);
+		}
+	}
+
+	return (0);
+} /* int nfs_shutdown */
+
 void module_register (void)
 {
+	plugin_register_config ("nfs", nfs_config,
+			config_keys, config_keys_num);
 	plugin_register_read ("nfs", nfs_read);
+	plugin_register_shutdown ("nfs", nfs_shutdown);
 } /* void module_register */
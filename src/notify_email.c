@@ -40,17 +40,35 @@ static const char *config_keys[] =
   "SMTPPassword",
   "From",
   "Recipient",
-  "Subject"
+  "Subject",
+  "DigestInterval",
+  "DigestLimit"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static char **recipients;
 static int recipients_len = 0;
 
-static smtp_session_t session;
+/* libESMTP connects in smtp_start_session() and closes the connection before
+ * returning, and a session keeps all messages ever added to it. So a session
+ * is created for each transfer, and notifications are batched into digests
+ * to save the connection and handshake per notification. */
 static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
-static smtp_message_t message;
 static auth_context_t authctx = NULL;
+static _Bool initialized = 0;
+static char smtp_server[MAXSTRING];
+
+static cdtime_t digest_interval = 0;
+static int digest_limit = 1000;
+
+static pthread_mutex_t digest_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *digest_text = NULL;
+static size_t digest_text_len = 0;
+static size_t digest_text_size = 0;
+static int digest_num = 0;
+static int digest_dropped = 0;
+static int digest_severity = 0;
+static char digest_host[DATA_MAX_NAME_LEN];
 
 static int smtp_port = 25;
 static char *smtp_host = NULL;
@@ -113,28 +131,173 @@ static void monitor_cb (const char *buf, int buflen, int writing,
       log_str);
 } /* void monitor_cb */
 
-static int notify_email_init (void)
+static const char *notify_email_severity (int severity)
+{
+  if (severity == NOTIF_FAILURE)
+    return ("FAILURE");
+  else if (severity == NOTIF_WARNING)
+    return ("WARNING");
+  else if (severity == NOTIF_OKAY)
+    return ("OKAY");
+  return ("UNKNOWN");
+} /* const char *notify_email_severity */
+
+/* Sends one message with `subject' and `body' to all recipients. Holds the
+ * session lock for the whole transfer. */
+static int notify_email_send (const char *subject, const char *body)
 {
-  char server[MAXSTRING];
+  smtp_session_t session;
+  smtp_message_t message;
+  char *buf;
+  size_t buf_size;
+  int status = 0;
+  int i;
 
-  ssnprintf(server, sizeof (server), "%s:%i",
-      (smtp_host == NULL) ? DEFAULT_SMTP_HOST : smtp_host,
-      smtp_port);
+  /* Let's make RFC822 message text with \r\n EOLs */
+  buf_size = strlen (subject) + strlen (body) + 128;
+  buf = malloc (buf_size);
+  if (buf == NULL)
+  {
+    ERROR ("notify_email plugin: malloc failed.");
+    return (-1);
+  }
+  ssnprintf (buf, buf_size,
+      "MIME-Version: 1.0\r\n"
+      "Content-Type: text/plain;\r\n"
+      "Content-Transfer-Encoding: 8bit\r\n"
+      "Subject: %s\r\n"
+      "\r\n"
+      "%s",
+      subject, body);
 
   pthread_mutex_lock (&session_lock);
 
-  auth_client_init();
+  if (!initialized) {
+    /* Initialization failed or we're in the process of shutting down. */
+    pthread_mutex_unlock (&session_lock);
+    sfree (buf);
+    return (-1);
+  }
 
   session = smtp_create_session ();
   if (session == NULL) {
     pthread_mutex_unlock (&session_lock);
+    sfree (buf);
     ERROR ("notify_email plugin: cannot create SMTP session");
     return (-1);
   }
 
   smtp_set_monitorcb (session, monitor_cb, NULL, 1);
   smtp_set_hostname (session, hostname_g);
-  smtp_set_server (session, server);
+  smtp_set_server (session, smtp_server);
+
+  if (!smtp_auth_set_context (session, authctx)) {
+    ERROR ("notify_email plugin: cannot set SMTP auth context");
+    status = -1;
+  }
+  else if (!(message = smtp_add_message (session))) {
+    ERROR ("notify_email plugin: cannot set SMTP message");
+    status = -1;
+  }
+  else {
+    smtp_set_reverse_path (message, email_from);
+    smtp_set_header (message, "To", NULL, NULL);
+    smtp_set_message_str (message, buf);
+
+    for (i = 0; i < recipients_len; i++)
+      smtp_add_recipient (message, recipients[i]);
+
+    /* Initiate a connection to the SMTP server and transfer the message. */
+    if (!smtp_start_session (session)) {
+      char errbuf[MAXSTRING];
+      ERROR ("notify_email plugin: SMTP server problem: %s",
+          smtp_strerror (smtp_errno (), errbuf, sizeof errbuf));
+      status = -1;
+    } else {
+      #if COLLECT_DEBUG
+      const smtp_status_t *smtp_status;
+      /* Report on the success or otherwise of the mail transfer. */
+      smtp_status = smtp_message_transfer_status (message);
+      DEBUG ("notify_email plugin: SMTP server report: %d %s",
+        smtp_status->code,
+        (smtp_status->text != NULL) ? smtp_status->text : "\n");
+      #endif
+      smtp_enumerate_recipients (message, print_recipient_status, NULL);
+    }
+  }
+
+  smtp_destroy_session (session);
+  pthread_mutex_unlock (&session_lock);
+  sfree (buf);
+  return (status);
+} /* int notify_email_send */
+
+/* Sends the notifications collected since the last call as one email. */
+static int notify_email_flush (user_data_t __attribute__((unused)) *user_data)
+{
+  char subject[MAXSTRING];
+  char header[128];
+  char *text;
+  char *body;
+  size_t body_size;
+  int num;
+  int dropped;
+  int status;
+
+  pthread_mutex_lock (&digest_lock);
+  if (digest_num == 0) {
+    pthread_mutex_unlock (&digest_lock);
+    return (0);
+  }
+
+  ssnprintf (subject, sizeof (subject),
+      (email_subject == NULL) ? DEFAULT_SMTP_SUBJECT : email_subject,
+      notify_email_severity (digest_severity), digest_host);
+
+  text = digest_text;
+  num = digest_num;
+  dropped = digest_dropped;
+
+  digest_text = NULL;
+  digest_text_len = 0;
+  digest_text_size = 0;
+  digest_num = 0;
+  digest_dropped = 0;
+  digest_severity = 0;
+  digest_host[0] = 0;
+  pthread_mutex_unlock (&digest_lock);
+
+  if (dropped > 0)
+    ssnprintf (header, sizeof (header), "%i notifications, %i more were "
+        "dropped because of the DigestLimit.\r\n\r\n", num, dropped);
+  else
+    ssnprintf (header, sizeof (header), "%i notifications.\r\n\r\n",
+        num);
+
+  body_size = strlen (header) + strlen (text) + 1;
+  body = malloc (body_size);
+  if (body == NULL) {
+    ERROR ("notify_email plugin: malloc failed.");
+    sfree (text);
+    return (-1);
+  }
+  ssnprintf (body, body_size, "%s%s", header, text);
+  sfree (text);
+
+  status = notify_email_send (subject, body);
+  sfree (body);
+  return (status);
+} /* int notify_email_flush */
+
+static int notify_email_init (void)
+{
+  ssnprintf(smtp_server, sizeof (smtp_server), "%s:%i",
+      (smtp_host == NULL) ? DEFAULT_SMTP_HOST : smtp_host,
+      smtp_port);
+
+  pthread_mutex_lock (&session_lock);
+
+  auth_client_init();
 
   if (smtp_user && smtp_password) {
     authctx = auth_create_context ();
@@ -142,23 +305,32 @@ static int notify_email_init (void)
     auth_set_interact_cb (authctx, authinteract, NULL);
   }
 
-  if ( !smtp_auth_set_context (session, authctx)) {
-    pthread_mutex_unlock (&session_lock);
-    ERROR ("notify_email plugin: cannot set SMTP auth context");
-    return (-1);   
+  initialized = 1;
+  pthread_mutex_unlock (&session_lock);
+
+  if (digest_interval > 0)
+  {
+    struct timespec ts;
+
+    CDTIME_T_TO_TIMESPEC (digest_interval, &ts);
+    plugin_register_complex_read (/* group = */ NULL,
+        /* name      = */ "notify_email",
+        /* callback  = */ notify_email_flush,
+        /* interval  = */ &ts,
+        /* user_data = */ NULL);
   }
 
-  pthread_mutex_unlock (&session_lock);
   return (0);
 } /* int notify_email_init */
 
 static int notify_email_shutdown (void)
 {
+  /* Don't lose the notifications collected since the last digest. */
+  notify_email_flush (/* user_data = */ NULL);
+
   pthread_mutex_lock (&session_lock);
 
-  if (session != NULL)
-    smtp_destroy_session (session);
-  session = NULL;
+  initialized = 0;
 
   if (authctx != NULL)
     auth_destroy_context (authctx);
@@ -219,12 +391,78 @@ static int notify_email_config (const char *key, const char *value)
     sfree (email_subject);
     email_subject = strdup (value);
   }
+  else if (0 == strcasecmp (key, "DigestInterval")) {
+    double tmp = atof (value);
+    if (tmp < 0.0)
+    {
+      WARNING ("notify_email plugin: Invalid digest interval: %s", value);
+      return (1);
+    }
+    digest_interval = DOUBLE_TO_CDTIME_T (tmp);
+  }
+  else if (0 == strcasecmp (key, "DigestLimit")) {
+    int tmp = atoi (value);
+    if (tmp < 1)
+    {
+      WARNING ("notify_email plugin: Invalid digest limit: %i", tmp);
+      return (1);
+    }
+    digest_limit = tmp;
+  }
   else {
     return -1;
   }
   return 0;
 } /* int notify_email_config (const char *, const char *) */
 
+/* Appends `entry' to the digest. */
+static int notify_email_digest_add (const notification_t *n,
+    const char *entry)
+{
+  size_t entry_len = strlen (entry);
+
+  pthread_mutex_lock (&digest_lock);
+
+  if (digest_num >= digest_limit) {
+    digest_dropped++;
+    pthread_mutex_unlock (&digest_lock);
+    return (0);
+  }
+
+  if ((digest_text_len + entry_len + 1) > digest_text_size) {
+    size_t new_size = (digest_text_size > 0) ? digest_text_size : 4096;
+    char *tmp;
+
+    while ((digest_text_len + entry_len + 1) > new_size)
+      new_size *= 2;
+
+    tmp = realloc (digest_text, new_size);
+    if (tmp == NULL) {
+      pthread_mutex_unlock (&digest_lock);
+      ERROR ("notify_email plugin: realloc failed.");
+      return (-1);
+    }
+    digest_text = tmp;
+    digest_text_size = new_size;
+  }
+
+  memcpy (digest_text + digest_text_len, entry, entry_len + 1);
+  digest_text_len += entry_len;
+
+  /* The subject names the worst severity and the host, if all
+   * notifications are about the same one. */
+  if ((digest_severity == 0) || (n->severity < digest_severity))
+    digest_severity = n->severity;
+  if (digest_num == 0)
+    sstrncpy (digest_host, n->host, sizeof (digest_host));
+  else if (strcmp (digest_host, n->host) != 0)
+    sstrncpy (digest_host, "several hosts", sizeof (digest_host));
+  digest_num++;
+
+  pthread_mutex_unlock (&digest_lock);
+  return (0);
+} /* int notify_email_digest_add */
+
 static int notify_email_notification (const notification_t *n,
     user_data_t __attribute__((unused)) *user_data)
 {
@@ -233,21 +471,13 @@ static int notify_email_notification (const notification_t *n,
   struct tm timestamp_tm;
   char timestamp_str[64];
 
-  char severity[32];
+  const char *severity;
   char subject[MAXSTRING];
 
   char buf[4096] = "";
   int  buf_len = sizeof (buf);
-  int i;
 
-  ssnprintf (severity, sizeof (severity), "%s",
-      (n->severity == NOTIF_FAILURE) ? "FAILURE"
-      : ((n->severity == NOTIF_WARNING) ? "WARNING"
-        : ((n->severity == NOTIF_OKAY) ? "OKAY" : "UNKNOWN")));
-
-  ssnprintf (subject, sizeof (subject),
-      (email_subject == NULL) ? DEFAULT_SMTP_SUBJECT : email_subject,
-      severity, n->host);
+  severity = notify_email_severity (n->severity);
 
   tt = CDTIME_T_TO_TIME_T (n->time);
   localtime_r (&tt, &timestamp_tm);
@@ -255,62 +485,24 @@ static int notify_email_notification (const notification_t *n,
       &timestamp_tm);
   timestamp_str[sizeof (timestamp_str) - 1] = '\0';
 
-  /* Let's make RFC822 message text with \r\n EOLs */
   ssnprintf (buf, buf_len,
-      "MIME-Version: 1.0\r\n"
-      "Content-Type: text/plain;\r\n"
-      "Content-Transfer-Encoding: 8bit\r\n"
-      "Subject: %s\r\n"
-      "\r\n"
       "%s - %s@%s\r\n"
       "\r\n"
-      "Message: %s",
-      subject,
+      "Message: %s%s",
       timestamp_str,
       severity,
       n->host,
-      n->message);
+      n->message,
+      (digest_interval > 0) ? "\r\n\r\n" : "");
 
-  pthread_mutex_lock (&session_lock);
+  if (digest_interval > 0)
+    return (notify_email_digest_add (n, buf));
 
-  if (session == NULL) {
-    /* Initialization failed or we're in the process of shutting down. */
-    pthread_mutex_unlock (&session_lock);
-    return (-1);
-  }
-
-  if (!(message = smtp_add_message (session))) {
-    pthread_mutex_unlock (&session_lock);
-    ERROR ("notify_email plugin: cannot set SMTP message");
-    return (-1);   
-  }
-  smtp_set_reverse_path (message, email_from);
-  smtp_set_header (message, "To", NULL, NULL);
-  smtp_set_message_str (message, buf);
-
-  for (i = 0; i < recipients_len; i++)
-    smtp_add_recipient (message, recipients[i]);
-
-  /* Initiate a connection to the SMTP server and transfer the message. */
-  if (!smtp_start_session (session)) {
-    char buf[MAXSTRING];
-    ERROR ("notify_email plugin: SMTP server problem: %s",
-        smtp_strerror (smtp_errno (), buf, sizeof buf));
-    pthread_mutex_unlock (&session_lock);
-    return (-1);
-  } else {
-    #if COLLECT_DEBUG
-    const smtp_status_t *status;
-    /* Report on the success or otherwise of the mail transfer. */
-    status = smtp_message_transfer_status (message);
-    DEBUG ("notify_email plugin: SMTP server report: %d %s",
-      status->code, (status->text != NULL) ? status->text : "\n");
-    #endif
-    smtp_enumerate_recipients (message, print_recipient_status, NULL);
-  }
+  ssnprintf (subject, sizeof (subject),
+      (email_subject == NULL) ? DEFAULT_SMTP_SUBJECT : email_subject,
+      severity, n->host);
 
-  pthread_mutex_unlock (&session_lock);
-  return (0);
+  return (notify_email_send (subject, buf));
 } /* int notify_email_notification */
 
 void module_register (void)
@@ -28,6 +28,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_hashtable.h"
 
 #define V1STRING "Common Name,Real Address,Bytes Received,Bytes Sent,Connected Since\n"
 #define V2STRING "HEADER,CLIENT_LIST,Common Name,Real Address,Virtual Address,Bytes Received,Bytes Sent,Connected Since,Connected Since (time_t)\n"
@@ -46,9 +47,58 @@ struct vpn_status_s
 		SINGLE = 10 /* currently no versions for single mode, maybe in the future */
 	} version;
 	char *name;
+
+	/* The counters of each client ("common name") as last dispatched. Only
+	 * used if `CollectUnchangedUsers' is false. */
+	c_hashtable_t *clients;
+	uint64_t generation;
+	int clients_seen;
 };
 typedef struct vpn_status_s vpn_status_t;
 
+struct vpn_client_s
+{
+	char *name;
+	derive_t rx;
+	derive_t tx;
+	/* The `generation' of the status file the client has last been seen in. */
+	uint64_t generation;
+};
+typedef struct vpn_client_s vpn_client_t;
+
+/* Describes the client list of the multi mode status file versions. */
+struct vpn_format_s
+{
+	int version;
+	/* The header line of the client list. */
+	const char *header;
+	/* Client lines start with this keyword, if not NULL. Otherwise, all lines
+	 * following the header are client lines. */
+	const char *client_keyword;
+	/* The client list ends with a line starting with this keyword. */
+	const char *end_keyword;
+	/* Delimiters of the fields. */
+	const char *delimiters;
+	int fields_min;
+	int fields_max;
+	int name_index;
+	int rx_index;
+	int tx_index;
+};
+typedef struct vpn_format_s vpn_format_t;
+
+/* status file is generated by openvpn/multi.c:multi_print_status()
+ * http://svn.openvpn.net/projects/openvpn/trunk/openvpn/multi.c
+ *
+ * Lines with more or less fields than expected are ignored. */
+static const vpn_format_t vpn_formats[] =
+{
+	{ MULTI1, V1STRING, NULL,          "ROUTING TABLE", ",",   4, 15, 0, 2, 3 },
+	{ MULTI2, V2STRING, "CLIENT_LIST", "ROUTING_TABLE", ",",   8,  8, 1, 4, 5 },
+	{ MULTI3, V3STRING, "CLIENT_LIST", "ROUTING_TABLE", " \t\r\n", 12, 12, 1, 4, 5 }
+};
+static int vpn_formats_num = STATIC_ARRAY_SIZE (vpn_formats);
+
 static vpn_status_t **vpn_list = NULL;
 static int vpn_num = 0;
 
@@ -56,6 +106,7 @@ static _Bool new_naming_schema = 0;
 static _Bool collect_compression = 1;
 static _Bool collect_user_count  = 0;
 static _Bool collect_individual_users  = 1;
+static _Bool collect_unchanged_users  = 1;
 
 static const char *config_keys[] =
 {
@@ -64,14 +115,16 @@ static const char *config_keys[] =
 	"ImprovedNamingSchema",
 	"CollectCompression",
 	"CollectUserCount",
-	"CollectIndividualUsers"
+	"CollectIndividualUsers",
+	"CollectUnchangedUsers"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 
 /* Helper function
- * copy-n-pasted from common.c - changed delim to ","  */
-static int openvpn_strsplit (char *string, char **fields, size_t size)
+ * copy-n-pasted from common.c - the delimiters are passed in */
+static int openvpn_strsplit (char *string, char **fields, size_t size,
+		const char *delimiters)
 {
 	size_t i;
 	char *ptr;
@@ -80,7 +133,7 @@ static int openvpn_strsplit (char *string, char **fields, size_t size)
 	i = 0;
 	ptr = string;
 	saveptr = NULL;
-	while ((fields[i] = strtok_r (ptr, ",", &saveptr)) != NULL)
+	while ((fields[i] = strtok_r (ptr, delimiters, &saveptr)) != NULL)
 	{
 		ptr = NULL;
 		i++;
@@ -172,6 +225,7 @@ static int single_read (char *name, FILE *fh)
 	char *fields[4];
 	const int max_fields = STATIC_ARRAY_SIZE (fields);
 	int  fields_num, read = 0;
+	size_t i;
 
 	derive_t link_rx, link_tx;
 	derive_t tun_rx, tun_tx;
@@ -179,20 +233,30 @@ static int single_read (char *name, FILE *fh)
 	derive_t pre_decompress, post_decompress;
 	derive_t overhead_rx, overhead_tx;
 
-	link_rx = 0;
-	link_tx = 0;
-	tun_rx = 0;
-	tun_tx = 0;
-	pre_compress = 0;
-	post_compress = 0;
-	pre_decompress = 0;
-	post_decompress = 0;
-	overhead_rx = 0;
-	overhead_tx = 0;
+	struct
+	{
+		const char *key;
+		derive_t   *value;
+	} counters[] =
+	{
+		/* read from the system and sent over the tunnel */
+		{ "TUN/TAP read bytes",    &tun_tx },
+		/* read from the tunnel and written in the system */
+		{ "TUN/TAP write bytes",   &tun_rx },
+		{ "TCP/UDP read bytes",    &link_rx },
+		{ "TCP/UDP write bytes",   &link_tx },
+		{ "pre-compress bytes",    &pre_compress },
+		{ "post-compress bytes",   &post_compress },
+		{ "pre-decompress bytes",  &pre_decompress },
+		{ "post-decompress bytes", &post_decompress }
+	};
+
+	for (i = 0; i < STATIC_ARRAY_SIZE (counters); i++)
+		*counters[i].value = 0;
 
 	while (fgets (buffer, sizeof (buffer), fh) != NULL)
 	{
-		fields_num = openvpn_strsplit (buffer, fields, max_fields);
+		fields_num = openvpn_strsplit (buffer, fields, max_fields, ",");
 
 		/* status file is generated by openvpn/sig.c:print_status()
 		 * http://svn.openvpn.net/projects/openvpn/trunk/openvpn/sig.c
@@ -205,39 +269,13 @@ static int single_read (char *name, FILE *fh)
 			continue;
 		}
 
-		if (strcmp (fields[0], "TUN/TAP read bytes") == 0)
-		{
-			/* read from the system and sent over the tunnel */
-			tun_tx = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "TUN/TAP write bytes") == 0)
-		{
-			/* read from the tunnel and written in the system */
-			tun_rx = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "TCP/UDP read bytes") == 0)
-		{
-			link_rx = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "TCP/UDP write bytes") == 0)
-		{
-			link_tx = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "pre-compress bytes") == 0)
+		for (i = 0; i < STATIC_ARRAY_SIZE (counters); i++)
 		{
-			pre_compress = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "post-compress bytes") == 0)
-		{
-			post_compress = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "pre-decompress bytes") == 0)
-		{
-			pre_decompress = atoll (fields[1]);
-		}
-		else if (strcmp (fields[0], "post-decompress bytes") == 0)
-		{
-			post_decompress = atoll (fields[1]);
+			if (strcmp (fields[0], counters[i].key) == 0)
+			{
+				*counters[i].value = atoll (fields[1]);
+				break;
+			}
 		}
 	}
 
@@ -260,94 +298,177 @@ static int single_read (char *name, FILE *fh)
 	return (read);
 } /* int single_read */
 
-/* for reading status version 1 */
-static int multi1_read (char *name, FILE *fh)
+static void vpn_client_free (vpn_client_t *c)
 {
-	char buffer[1024];
-	char *fields[10];
-	int  fields_num, read = 0, found_header = 0;
-	long long sum_users = 0;
+	if (c == NULL)
+		return;
 
-	/* read the file until the "ROUTING TABLE" line is found (no more info after) */
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	sfree (c->name);
+	sfree (c);
+} /* void vpn_client_free */
+
+static void vpn_clients_destroy (vpn_status_t *st)
+{
+	void *key;
+	void *value;
+
+	if (st->clients == NULL)
+		return;
+
+	while (c_hashtable_pick (st->clients, &key, &value) == 0)
+		vpn_client_free (value);
+	c_hashtable_destroy (st->clients);
+	st->clients = NULL;
+} /* void vpn_clients_destroy */
+
+/* Returns true if the client's counters have changed since they have been
+ * dispatched last, i.e. if they have to be dispatched again. */
+static _Bool vpn_client_changed (vpn_status_t *st, const char *name,
+		derive_t rx, derive_t tx)
+{
+	vpn_client_t *c = NULL;
+
+	if (st->clients == NULL)
+		return (1);
+
+	if (c_hashtable_get (st->clients, name, (void *) &c) != 0)
 	{
-		if (strcmp (buffer, "ROUTING TABLE\n") == 0)
-			break;
+		c = (vpn_client_t *) malloc (sizeof (*c));
+		if (c == NULL)
+			return (1);
+		memset (c, 0, sizeof (*c));
 
-		if (strcmp (buffer, V1STRING) == 0)
+		c->name = strdup (name);
+		if ((c->name == NULL)
+				|| (c_hashtable_insert (st->clients, c->name, c) != 0))
 		{
-			found_header = 1;
-			continue;
+			vpn_client_free (c);
+			return (1);
 		}
+	}
+	/* Several clients may share a common name. They end up in the same
+	 * value list anyway. */
+	else if (c->generation == st->generation)
+	{
+		return (1);
+	}
+	else if ((c->rx == rx) && (c->tx == tx))
+	{
+		c->generation = st->generation;
+		st->clients_seen++;
+		return (0);
+	}
 
-		/* skip the first lines until the client list section is found */
-		if (found_header == 0)
-			/* we can't start reading data until this string is found */
-			continue;
+	c->rx = rx;
+	c->tx = tx;
+	c->generation = st->generation;
+	st->clients_seen++;
+	return (1);
+} /* _Bool vpn_client_changed */
 
-		fields_num = openvpn_strsplit (buffer,
-				fields, STATIC_ARRAY_SIZE (fields));
-		if (fields_num < 4)
-			continue;
+/* Forgets the clients which have not been seen in the current status file,
+ * so they are dispatched right away if they reconnect. */
+static void vpn_clients_expire (vpn_status_t *st)
+{
+	c_hashtable_iterator_t *iter;
+	char **stale;
+	int stale_num = 0;
+	int stale_max;
+	char *key;
+	vpn_client_t *c;
+	int i;
 
-		if (collect_user_count)
-			/* If so, sum all users, ignore the individuals*/
-		{
-			sum_users += 1;
-		}
-		if (collect_individual_users)
+	if (st->clients == NULL)
+		return;
+
+	stale_max = c_hashtable_size (st->clients) - st->clients_seen;
+	if (stale_max <= 0)
+		return;
+
+	stale = (char **) calloc (stale_max, sizeof (*stale));
+	if (stale == NULL)
+		return;
+
+	iter = c_hashtable_get_iterator (st->clients);
+	while ((iter != NULL) && (stale_num < stale_max)
+			&& (c_hashtable_iterator_next (iter, (void *) &key, (void *) &c) == 0))
+	{
+		if (c->generation != st->generation)
 		{
-			if (new_naming_schema)
-			{
-				iostats_submit (name,               /* vpn instance */
-						fields[0],          /* "Common Name" */
-						atoll (fields[2]),  /* "Bytes Received" */
-						atoll (fields[3])); /* "Bytes Sent" */
-			}
-			else
-			{
-				iostats_submit (fields[0],          /* "Common Name" */
-						NULL,               /* unused when in multimode */
-						atoll (fields[2]),  /* "Bytes Received" */
-						atoll (fields[3])); /* "Bytes Sent" */
-			}
+			stale[stale_num] = key;
+			stale_num++;
 		}
-
-		read = 1;
 	}
+	c_hashtable_iterator_destroy (iter);
 
-	if (collect_user_count)
+	for (i = 0; i < stale_num; i++)
 	{
-		numusers_submit(name, name, sum_users);
-		read = 1;
+		c = NULL;
+		c_hashtable_remove (st->clients, stale[i], NULL, (void *) &c);
+		vpn_client_free (c);
 	}
 
-	return (read);
-} /* int multi1_read */
+	sfree (stale);
+} /* void vpn_clients_expire */
 
-/* for reading status version 2 */
-static int multi2_read (char *name, FILE *fh)
+/* Returns true if the line starts with the field `keyword'. */
+static _Bool line_has_keyword (const char *line, const char *keyword,
+		const char *delimiters)
+{
+	size_t len = strlen (keyword);
+
+	if (strncmp (line, keyword, len) != 0)
+		return (0);
+
+	return ((line[len] == 0) || (line[len] == '\n')
+			|| (strchr (delimiters, line[len]) != NULL));
+} /* _Bool line_has_keyword */
+
+/* for reading the status versions 1, 2 and 3 */
+static int multi_read (vpn_status_t *st, const vpn_format_t *fmt, FILE *fh)
 {
 	char buffer[1024];
-	char *fields[10];
+	char *fields[15];
 	const int max_fields = STATIC_ARRAY_SIZE (fields);
-	int  fields_num, read = 0;
-	long long sum_users    = 0;
+	int  fields_num, read = 0, found_header = 0;
+	long long sum_users = 0;
 
+	st->generation++;
+	st->clients_seen = 0;
+
+	/* Only the client list is of interest, so the file is read until the
+	 * routing table starts. Lines are told apart by their first keyword, so
+	 * lines other than the client list aren't split at all. */
 	while (fgets (buffer, sizeof (buffer), fh) != NULL)
 	{
-		fields_num = openvpn_strsplit (buffer, fields, max_fields);
+		derive_t rx;
+		derive_t tx;
 
-		/* status file is generated by openvpn/multi.c:multi_print_status()
-		 * http://svn.openvpn.net/projects/openvpn/trunk/openvpn/multi.c
-		 *
-		 * The line we're expecting has 8 fields. We ignore all lines
-		 *  with more or less fields.
-		 */
-		if (fields_num != 8)
+		if (line_has_keyword (buffer, fmt->end_keyword, fmt->delimiters))
+			break;
+
+		if (fmt->client_keyword == NULL)
+		{
+			if (strcmp (buffer, fmt->header) == 0)
+			{
+				found_header = 1;
+				continue;
+			}
+
+			/* skip the first lines until the client list section is found */
+			if (found_header == 0)
+				/* we can't start reading data until this string is found */
+				continue;
+		}
+		else if (!line_has_keyword (buffer, fmt->client_keyword,
+					fmt->delimiters))
+		{
 			continue;
+		}
 
-		if (strcmp (fields[0], "CLIENT_LIST") != 0)
+		fields_num = openvpn_strsplit (buffer, fields, max_fields,
+				fmt->delimiters);
+		if ((fields_num < fmt->fields_min) || (fields_num > fmt->fields_max))
 			continue;
 
 		if (collect_user_count)
@@ -357,139 +478,124 @@ static int multi2_read (char *name, FILE *fh)
 		}
 		if (collect_individual_users)
 		{
-			if (new_naming_schema)
+			rx = atoll (fields[fmt->rx_index]); /* "Bytes Received" */
+			tx = atoll (fields[fmt->tx_index]); /* "Bytes Sent" */
+
+			if (!vpn_client_changed (st, fields[fmt->name_index], rx, tx))
+			{
+				/* nothing to do */
+			}
+			else if (new_naming_schema)
 			{
-				/* plugin inst = file name, type inst = fields[1] */
-				iostats_submit (name,               /* vpn instance */
-						fields[1],          /* "Common Name" */
-						atoll (fields[4]),  /* "Bytes Received" */
-						atoll (fields[5])); /* "Bytes Sent" */
+				iostats_submit (st->name,                /* vpn instance */
+						fields[fmt->name_index], /* "Common Name" */
+						rx, tx);
 			}
 			else
 			{
-				/* plugin inst = fields[1], type inst = "" */
-				iostats_submit (fields[1],          /* "Common Name" */
-						NULL,               /* unused when in multimode */
-						atoll (fields[4]),  /* "Bytes Received" */
-						atoll (fields[5])); /* "Bytes Sent" */
+				iostats_submit (fields[fmt->name_index], /* "Common Name" */
+						NULL,                    /* unused when in multimode */
+						rx, tx);
 			}
 		}
 
 		read = 1;
 	}
 
+	vpn_clients_expire (st);
+
 	if (collect_user_count)
 	{
-		numusers_submit(name, name, sum_users);
+		numusers_submit(st->name, st->name, sum_users);
 		read = 1;
 	}
 
 	return (read);
-} /* int multi2_read */
+} /* int multi_read */
 
-/* for reading status version 3 */
-static int multi3_read (char *name, FILE *fh)
+/* Detects the format of the status file by looking for its first header.
+ * Returns zero if the format is unknown. */
+static int version_detect_fh (FILE *fh)
 {
 	char buffer[1024];
-	char *fields[15];
-	const int max_fields = STATIC_ARRAY_SIZE (fields);
-	int  fields_num, read = 0;
-	long long sum_users    = 0;
+	int i;
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	/* now search for the specific multimode data format */
+	while ((fgets (buffer, sizeof (buffer), fh)) != NULL)
 	{
-		fields_num = strsplit (buffer, fields, max_fields);
-
-		/* status file is generated by openvpn/multi.c:multi_print_status()
-		 * http://svn.openvpn.net/projects/openvpn/trunk/openvpn/multi.c
-		 *
-		 * The line we're expecting has 12 fields. We ignore all lines
-		 *  with more or less fields.
-		 */
-		if (fields_num != 12)
+		/* we look at the first line searching for SINGLE mode configuration */
+		if (strcmp (buffer, VSSTRING) == 0)
 		{
-			continue;
+			DEBUG ("openvpn plugin: found status file version SINGLE");
+			return (SINGLE);
 		}
-		else
-		{
-			if (strcmp (fields[0], "CLIENT_LIST") != 0)
-				continue;
 
-			if (collect_user_count)
-				/* If so, sum all users, ignore the individuals*/
-			{
-				sum_users += 1;
-			}
-
-			if (collect_individual_users)
+		/* searching for multi version 1, 2 and 3 */
+		for (i = 0; i < vpn_formats_num; i++)
+		{
+			if (strcmp (buffer, vpn_formats[i].header) == 0)
 			{
-				if (new_naming_schema)
-				{
-					iostats_submit (name,               /* vpn instance */
-							fields[1],          /* "Common Name" */
-							atoll (fields[4]),  /* "Bytes Received" */
-							atoll (fields[5])); /* "Bytes Sent" */
-				}
-				else
-				{
-					iostats_submit (fields[1],          /* "Common Name" */
-							NULL,               /* unused when in multimode */
-							atoll (fields[4]),  /* "Bytes Received" */
-							atoll (fields[5])); /* "Bytes Sent" */
-				}
+				DEBUG ("openvpn plugin: found status file version MULTI%i",
+						vpn_formats[i].version);
+				return (vpn_formats[i].version);
 			}
-
-			read = 1;
 		}
 	}
 
-	if (collect_user_count)
-	{
-		numusers_submit(name, name, sum_users);
-		read = 1;
-	}
-
-	return (read);
-} /* int multi3_read */
+	return (0);
+} /* int version_detect_fh */
 
 /* read callback */
 static int openvpn_read (void)
 {
 	FILE *fh;
-	int  i, read;
+	int  i, j, read;
 
 	read = 0;
 
 	/* call the right read function for every status entry in the list */
 	for (i = 0; i < vpn_num; i++)
 	{
-		fh = fopen (vpn_list[i]->file, "r");
+		vpn_status_t *st = vpn_list[i];
+
+		fh = fopen (st->file, "r");
 		if (fh == NULL)
 		{
 			char errbuf[1024];
-			WARNING ("openvpn plugin: fopen(%s) failed: %s", vpn_list[i]->file,
+			WARNING ("openvpn plugin: fopen(%s) failed: %s", st->file,
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 
 			continue;
 		}
 
-		switch (vpn_list[i]->version)
+		/* The file didn't exist when the configuration was read. The version
+		 * is detected once and kept afterwards. */
+		if (st->version == 0)
 		{
-			case SINGLE:
-				read = single_read(vpn_list[i]->name, fh);
-				break;
+			st->version = version_detect_fh (fh);
+			if (st->version == 0)
+			{
+				fclose (fh);
+				continue;
+			}
 
-			case MULTI1:
-				read = multi1_read(vpn_list[i]->name, fh);
-				break;
+			INFO ("openvpn plugin: %s: Detected status file version %i.",
+					st->file, (int) st->version);
+			rewind (fh);
+		}
 
-			case MULTI2:
-				read = multi2_read(vpn_list[i]->name, fh);
-				break;
+		if (st->version == SINGLE)
+		{
+			read = single_read (st->name, fh);
+		}
+		else
+		{
+			for (j = 0; j < vpn_formats_num; j++)
+				if (vpn_formats[j].version == (int) st->version)
+					break;
 
-			case MULTI3:
-				read = multi3_read(vpn_list[i]->name, fh);
-				break;
+			if (j < vpn_formats_num)
+				read = multi_read (st, vpn_formats + j, fh);
 		}
 
 		fclose (fh);
@@ -498,10 +604,11 @@ static int openvpn_read (void)
 	return (read ? 0 : -1);
 } /* int openvpn_read */
 
+/* Returns the version of the status file, zero if its format is unknown and
+ * -1 if the file cannot be read (yet). */
 static int version_detect (const char *filename)
 {
 	FILE *fh;
-	char buffer[1024];
 	int version = 0;
 
 	/* Sanity checking. We're called from the config handling routine, so
@@ -513,44 +620,13 @@ static int version_detect (const char *filename)
 	if (fh == NULL)
 	{
 		char errbuf[1024];
-		WARNING ("openvpn plugin: Unable to read \"%s\": %s", filename,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (0);
-	}
-
-	/* now search for the specific multimode data format */
-	while ((fgets (buffer, sizeof (buffer), fh)) != NULL)
-	{
-		/* we look at the first line searching for SINGLE mode configuration */
-		if (strcmp (buffer, VSSTRING) == 0)
-		{
-			DEBUG ("openvpn plugin: found status file version SINGLE");
-			version = SINGLE;
-			break;
-		}
-		/* searching for multi version 1 */
-		else if (strcmp (buffer, V1STRING) == 0)
-		{
-			DEBUG ("openvpn plugin: found status file version MULTI1");
-			version = MULTI1;
-			break;
-		}
-		/* searching for multi version 2 */
-		else if (strcmp (buffer, V2STRING) == 0)
-		{
-			DEBUG ("openvpn plugin: found status file version MULTI2");
-			version = MULTI2;
-			break;
-		}
-		/* searching for multi version 3 */
-		else if (strcmp (buffer, V3STRING) == 0)
-		{
-			DEBUG ("openvpn plugin: found status file version MULTI3");
-			version = MULTI3;
-			break;
-		}
+		WARNING ("openvpn plugin: Unable to read \"%s\": %s. The status "
+				"version will be detected once the file is readable.",
+				filename, sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
 	}
 
+	version = version_detect_fh (fh);
 	if (version == 0)
 	{
 		/* This is only reached during configuration, so complaining to
@@ -577,7 +653,10 @@ static int openvpn_config (const char *key, const char *value)
 		/* try to detect the status file format */
 		status_version = version_detect (value);
 
-		if (status_version == 0)
+		/* detected by the read callback */
+		if (status_version < 0)
+			status_version = 0;
+		else if (status_version == 0)
 		{
 			WARNING ("openvpn plugin: unable to detect status version, \
 					discarding status file \"%s\".", value);
@@ -621,6 +700,13 @@ static int openvpn_config (const char *key, const char *value)
 
 		/* create a new vpn element since file, version and name are ok */
 		temp = (vpn_status_t *) malloc (sizeof (vpn_status_t));
+		if (temp == NULL)
+		{
+			ERROR ("openvpn plugin: malloc failed.");
+			sfree (status_file);
+			return (1);
+		}
+		memset (temp, 0, sizeof (*temp));
 		temp->file = status_file;
 		temp->version = status_version;
 		temp->name = status_name;
@@ -677,6 +763,13 @@ static int openvpn_config (const char *key, const char *value)
 		else
 			collect_individual_users = 1;
 	} /* if (strcasecmp("CollectIndividualUsers", key) == 0) */
+	else if (strcasecmp("CollectUnchangedUsers", key) == 0)
+	{
+		if (IS_FALSE (value))
+			collect_unchanged_users = 0;
+		else
+			collect_unchanged_users = 1;
+	} /* if (strcasecmp("CollectUnchangedUsers", key) == 0) */
 	else
 	{
 		return (-1);
@@ -692,6 +785,7 @@ static int openvpn_shutdown (void)
 
 	for (i = 0; i < vpn_num; i++)
 	{
+		vpn_clients_destroy (vpn_list[i]);
 		sfree (vpn_list[i]->file);
 		sfree (vpn_list[i]);
 	}
@@ -713,6 +807,22 @@ static int openvpn_init (void)
 		return (-1);
 	}
 
+	if (!collect_unchanged_users && collect_individual_users)
+	{
+		int i;
+
+		for (i = 0; i < vpn_num; i++)
+		{
+			vpn_list[i]->clients = c_hashtable_create (c_hashtable_hash_string,
+					(void *) strcmp);
+			if (vpn_list[i]->clients == NULL)
+			{
+				ERROR ("openvpn plugin: c_hashtable_create failed.");
+				return (-1);
+			}
+		}
+	}
+
 	plugin_register_read ("openvpn", openvpn_read);
 	plugin_register_shutdown ("openvpn", openvpn_shutdown);
 
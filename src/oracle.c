@@ -53,9 +53,40 @@
 
 #include <oci.h>
 
+/* Number of rows fetched with one call of `OCIStmtFetch2'. */
+#define O_FETCH_ROWS 64
+
+/* Column values are fetched as strings of at most this size. */
+#define O_VALUE_SIZE DATA_MAX_NAME_LEN
+
 /*
  * Data types
  */
+/* Options of a <Query> block, stored as the query's user data. */
+struct o_query_options_s
+{
+  int prefetch_rows;
+  int prefetch_memory;
+};
+typedef struct o_query_options_s o_query_options_t;
+
+/* A query prepared on one database connection. The statement handle, the
+ * column names and the ``defines'' are kept across reads and only set up
+ * again after an error or a reconnect. */
+struct o_statement_s
+{
+  OCIStmt *oci_statement;
+
+  size_t column_num;
+  char **column_names;
+  /* Column-major: The values of column `c' in the fetched rows are
+   * O_VALUE_SIZE bytes apart, starting at c * O_FETCH_ROWS * O_VALUE_SIZE. */
+  char *column_values;
+  sb2 *indicators;
+  OCIDefine **oci_defines;
+};
+typedef struct o_statement_s o_statement_t;
+
 struct o_database_s
 {
   char *name;
@@ -66,6 +97,7 @@ struct o_database_s
   udb_query_preparation_area_t **q_prep_areas;
   udb_query_t **queries;
   size_t        queries_num;
+  o_statement_t *statements;
 
   OCISvcCtx *oci_service_context;
 };
@@ -133,6 +165,23 @@ static void o_report_error (const char *where, /* {{{ */
   }
 } /* }}} void o_report_error */
 
+/* Releases the statement handle and the buffers bound to it. */
+static void o_statement_reset (o_statement_t *st) /* {{{ */
+{
+  if (st->oci_statement != NULL)
+    OCIStmtRelease (st->oci_statement, oci_error,
+        /* key = */ NULL, /* key length = */ 0, /* mode = */ OCI_DEFAULT);
+
+  if (st->column_names != NULL)
+    sfree (st->column_names[0]);
+  sfree (st->column_names);
+  sfree (st->column_values);
+  sfree (st->indicators);
+  sfree (st->oci_defines);
+
+  memset (st, 0, sizeof (*st));
+} /* }}} void o_statement_reset */
+
 static void o_database_free (o_database_t *db) /* {{{ */
 {
   size_t i;
@@ -146,6 +195,11 @@ static void o_database_free (o_database_t *db) /* {{{ */
   sfree (db->password);
   sfree (db->queries);
 
+  if (db->statements != NULL)
+    for (i = 0; i < db->queries_num; ++i)
+      o_statement_reset (db->statements + i);
+  sfree (db->statements);
+
   if (db->q_prep_areas != NULL)
     for (i = 0; i < db->queries_num; ++i)
       udb_query_delete_preparation_area (db->q_prep_areas[i]);
@@ -159,6 +213,8 @@ static void o_database_free (o_database_t *db) /* {{{ */
  * <Plugin oracle>
  *   <Query "plugin_instance0">
  *     Statement "SELECT name, value FROM table"
+ *     PrefetchRows 100
+ *     PrefetchMemory 0
  *     <Result>
  *       Type "gauge"
  *       InstancesFrom "name"
@@ -202,6 +258,50 @@ static int o_config_set_string (char **ret_string, /* {{{ */
   return (0);
 } /* }}} int o_config_set_string */
 
+static int o_config_query_callback (udb_query_t *q, /* {{{ */
+    oconfig_item_t *ci)
+{
+  o_query_options_t *opts;
+  int status;
+
+  opts = udb_query_get_user_data (q);
+  if (opts == NULL)
+  {
+    opts = malloc (sizeof (*opts));
+    if (opts == NULL)
+    {
+      ERROR ("oracle plugin: malloc failed.");
+      return (-1);
+    }
+    opts->prefetch_rows = -1;
+    opts->prefetch_memory = -1;
+    udb_query_set_user_data (q, opts);
+  }
+
+  if (strcasecmp ("PrefetchRows", ci->key) == 0)
+    status = cf_util_get_int (ci, &opts->prefetch_rows);
+  else if (strcasecmp ("PrefetchMemory", ci->key) == 0)
+    status = cf_util_get_int (ci, &opts->prefetch_memory);
+  else
+  {
+    WARNING ("oracle plugin: Option `%s' not allowed in a Query block.",
+        ci->key);
+    return (-1);
+  }
+
+  if (status != 0)
+    return (status);
+
+  if ((opts->prefetch_rows < -1) || (opts->prefetch_memory < -1))
+  {
+    WARNING ("oracle plugin: The `%s' option must not be negative.",
+        ci->key);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int o_config_query_callback */
+
 static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
 {
   o_database_t *db;
@@ -289,6 +389,14 @@ static int o_config_add_database (oconfig_item_t *ci) /* {{{ */
       break;
     }
 
+    db->statements = calloc (db->queries_num, sizeof (*db->statements));
+    if (db->statements == NULL)
+    {
+      WARNING ("oracle plugin: malloc failed");
+      status = -1;
+      break;
+    }
+
     for (i = 0; i < db->queries_num; ++i)
     {
       db->q_prep_areas[i]
@@ -344,7 +452,7 @@ static int o_config (oconfig_item_t *ci) /* {{{ */
     oconfig_item_t *child = ci->children + i;
     if (strcasecmp ("Query", child->key) == 0)
       udb_query_create (&queries, &queries_num, child,
-          /* callback = */ NULL);
+          /* callback = */ o_config_query_callback);
     else if (strcasecmp ("Database", child->key) == 0)
       o_config_add_database (child);
     else
@@ -397,149 +505,115 @@ static int o_init (void) /* {{{ */
   return (0);
 } /* }}} int o_init */
 
-static int o_read_database_query (o_database_t *db, /* {{{ */
-    udb_query_t *q, udb_query_preparation_area_t *prep_area)
+/* Prepares the query on the database's connection. The handle is taken from
+ * the connection's statement cache if possible. */
+static int o_statement_prepare (o_database_t *db, /* {{{ */
+    udb_query_t *q, o_statement_t *st)
 {
-  char **column_names;
-  char **column_values;
-  size_t column_num;
-
-  OCIStmt *oci_statement;
-
-  /* List of `OCIDefine' pointers. These defines map columns to the buffer
-   * space declared above. */
-  OCIDefine **oci_defines;
-
+  o_query_options_t *opts;
+  const char *statement;
+  ub4 prefetch_rows = 100;
+  ub4 prefetch_memory = 0;
   int status;
-  size_t i;
 
-  oci_statement = udb_query_get_user_data (q);
+  statement = udb_query_get_statement (q);
+  assert (statement != NULL);
 
-  /* Prepare the statement */
-  if (oci_statement == NULL) /* {{{ */
+  status = OCIStmtPrepare2 (db->oci_service_context, &st->oci_statement,
+      oci_error, (text *) statement, (ub4) strlen (statement),
+      /* key = */ NULL, /* key length = */ 0,
+      /* language = */ OCI_NTV_SYNTAX,
+      /* mode     = */ OCI_DEFAULT);
+  if (status != OCI_SUCCESS)
   {
-    const char *statement;
+    o_report_error ("o_statement_prepare", "OCIStmtPrepare2", oci_error);
+    st->oci_statement = NULL;
+    return (-1);
+  }
 
-    statement = udb_query_get_statement (q);
-    assert (statement != NULL);
+  opts = udb_query_get_user_data (q);
+  if ((opts != NULL) && (opts->prefetch_rows >= 0))
+    prefetch_rows = (ub4) opts->prefetch_rows;
+  if ((opts != NULL) && (opts->prefetch_memory >= 0))
+    prefetch_memory = (ub4) opts->prefetch_memory;
 
-    status = OCIHandleAlloc (oci_env, (void *) &oci_statement,
-        OCI_HTYPE_STMT, /* user_data_size = */ 0, /* user_data = */ NULL);
-    if (status != OCI_SUCCESS)
-    {
-      o_report_error ("o_read_database_query", "OCIHandleAlloc", oci_error);
-      oci_statement = NULL;
-      return (-1);
-    }
+  /* The rows are transferred from the server in batches of this size, not
+   * only on each call of `OCIStmtFetch2'. Failing to set these isn't fatal. */
+  status = OCIAttrSet (st->oci_statement, OCI_HTYPE_STMT, &prefetch_rows,
+      /* size = */ 0, OCI_ATTR_PREFETCH_ROWS, oci_error);
+  if (status != OCI_SUCCESS)
+    o_report_error ("o_statement_prepare", "OCIAttrSet (OCI_ATTR_PREFETCH_ROWS)",
+        oci_error);
 
-    status = OCIStmtPrepare (oci_statement, oci_error,
-        (text *) statement, (ub4) strlen (statement),
-        /* language = */ OCI_NTV_SYNTAX,
-        /* mode     = */ OCI_DEFAULT);
-    if (status != OCI_SUCCESS)
-    {
-      o_report_error ("o_read_database_query", "OCIStmtPrepare", oci_error);
-      OCIHandleFree (oci_statement, OCI_HTYPE_STMT);
-      oci_statement = NULL;
-      return (-1);
-    }
-    udb_query_set_user_data (q, oci_statement);
+  status = OCIAttrSet (st->oci_statement, OCI_HTYPE_STMT, &prefetch_memory,
+      /* size = */ 0, OCI_ATTR_PREFETCH_MEMORY, oci_error);
+  if (status != OCI_SUCCESS)
+    o_report_error ("o_statement_prepare", "OCIAttrSet (OCI_ATTR_PREFETCH_MEMORY)",
+        oci_error);
 
-    DEBUG ("oracle plugin: o_read_database_query (%s, %s): "
-        "Successfully allocated statement handle.",
-        db->name, udb_query_get_name (q));
-  } /* }}} */
+  DEBUG ("oracle plugin: o_statement_prepare (%s, %s): "
+      "Successfully prepared the statement.",
+      db->name, udb_query_get_name (q));
 
-  assert (oci_statement != NULL);
+  return (0);
+} /* }}} int o_statement_prepare */
 
-  /* Execute the statement */
-  status = OCIStmtExecute (db->oci_service_context, /* {{{ */
-      oci_statement,
-      oci_error,
-      /* iters = */ 0,
-      /* rowoff = */ 0,
-      /* snap_in = */ NULL, /* snap_out = */ NULL,
-      /* mode = */ OCI_DEFAULT);
+/* Looks up the column names of an executed statement and binds the columns
+ * to buffers for O_FETCH_ROWS rows. */
+static int o_statement_define (o_statement_t *st) /* {{{ */
+{
+  ub4 param_counter = 0;
+  size_t column_num;
+  int status;
+  size_t i;
+
+  /* Acquire the number of columns returned. */
+  status = OCIAttrGet (st->oci_statement, OCI_HTYPE_STMT,
+      &param_counter, /* size pointer = */ NULL,
+      OCI_ATTR_PARAM_COUNT, oci_error);
   if (status != OCI_SUCCESS)
   {
-    DEBUG ("oracle plugin: o_read_database_query: status = %i (%#x)", status, status);
-    o_report_error ("o_read_database_query", "OCIStmtExecute", oci_error);
-    ERROR ("oracle plugin: o_read_database_query: "
-        "Failing statement was: %s", udb_query_get_statement (q));
+    o_report_error ("o_statement_define", "OCIAttrGet", oci_error);
     return (-1);
-  } /* }}} */
+  }
 
-  /* Acquire the number of columns returned. */
-  do /* {{{ */
+  column_num = (size_t) param_counter;
+  if (column_num == 0)
   {
-    ub4 param_counter = 0;
-    status = OCIAttrGet (oci_statement, OCI_HTYPE_STMT, /* {{{ */
-        &param_counter, /* size pointer = */ NULL, 
-        OCI_ATTR_PARAM_COUNT, oci_error);
-    if (status != OCI_SUCCESS)
-    {
-      o_report_error ("o_read_database_query", "OCIAttrGet", oci_error);
-      return (-1);
-    } /* }}} */
-
-    column_num = (size_t) param_counter;
-  } while (0); /* }}} */
+    ERROR ("oracle plugin: o_statement_define: The statement returns "
+        "no columns.");
+    return (-1);
+  }
 
   /* Allocate the following buffers:
-   * 
-   *  +---------------+-----------------------------------+
-   *  ! Name          ! Size                              !
-   *  +---------------+-----------------------------------+
-   *  ! column_names  ! column_num x DATA_MAX_NAME_LEN    !
-   *  ! column_values ! column_num x DATA_MAX_NAME_LEN    !
-   *  ! oci_defines   ! column_num x sizeof (OCIDefine *) !
-   *  +---------------+-----------------------------------+
    *
-   * {{{ */
-#define NUMBER_BUFFER_SIZE 64
-
-#define FREE_ALL \
-  if (column_names != NULL) { \
-    sfree (column_names[0]); \
-    sfree (column_names); \
-  } \
-  if (column_values != NULL) { \
-    sfree (column_values[0]); \
-    sfree (column_values); \
-  } \
-  sfree (oci_defines)
-
-#define ALLOC_OR_FAIL(ptr, ptr_size) \
-  do { \
-    size_t alloc_size = (size_t) ((ptr_size)); \
-    (ptr) = malloc (alloc_size); \
-    if ((ptr) == NULL) { \
-      FREE_ALL; \
-      ERROR ("oracle plugin: o_read_database_query: malloc failed."); \
-      return (-1); \
-    } \
-    memset ((ptr), 0, alloc_size); \
-  } while (0)
-
-  /* Initialize everything to NULL so the above works. */
-  column_names  = NULL;
-  column_values = NULL;
-  oci_defines   = NULL;
-
-  ALLOC_OR_FAIL (column_names, column_num * sizeof (char *));
-  ALLOC_OR_FAIL (column_names[0], column_num * DATA_MAX_NAME_LEN
-      * sizeof (char));
-  for (i = 1; i < column_num; i++)
-    column_names[i] = column_names[i - 1] + DATA_MAX_NAME_LEN;
-
-  ALLOC_OR_FAIL (column_values, column_num * sizeof (char *));
-  ALLOC_OR_FAIL (column_values[0], column_num * DATA_MAX_NAME_LEN
-      * sizeof (char));
-  for (i = 1; i < column_num; i++)
-    column_values[i] = column_values[i - 1] + DATA_MAX_NAME_LEN;
-
-  ALLOC_OR_FAIL (oci_defines, column_num * sizeof (OCIDefine *));
-  /* }}} End of buffer allocations. */
+   *  +---------------+---------------------------------------------+
+   *  ! Name          ! Size                                        !
+   *  +---------------+---------------------------------------------+
+   *  ! column_names  ! column_num x DATA_MAX_NAME_LEN              !
+   *  ! column_values ! column_num x O_FETCH_ROWS x O_VALUE_SIZE    !
+   *  ! indicators    ! column_num x O_FETCH_ROWS x sizeof (sb2)    !
+   *  ! oci_defines   ! column_num x sizeof (OCIDefine *)           !
+   *  +---------------+---------------------------------------------+
+   */
+  st->column_names = calloc (column_num, sizeof (*st->column_names));
+  if (st->column_names != NULL)
+  {
+    st->column_names[0] = calloc (column_num, DATA_MAX_NAME_LEN);
+    for (i = 1; (st->column_names[0] != NULL) && (i < column_num); i++)
+      st->column_names[i] = st->column_names[i - 1] + DATA_MAX_NAME_LEN;
+  }
+  st->column_values = calloc (column_num * O_FETCH_ROWS, O_VALUE_SIZE);
+  st->indicators = calloc (column_num * O_FETCH_ROWS,
+      sizeof (*st->indicators));
+  st->oci_defines = calloc (column_num, sizeof (*st->oci_defines));
+  if ((st->column_names == NULL) || (st->column_names[0] == NULL)
+      || (st->column_values == NULL) || (st->indicators == NULL)
+      || (st->oci_defines == NULL))
+  {
+    ERROR ("oracle plugin: o_statement_define: calloc failed.");
+    return (-1);
+  }
 
   /* ``Define'' the returned data, i. e. bind the columns to the buffers
    * allocated above. */
@@ -551,15 +625,12 @@ static int o_read_database_query (o_database_t *db, /* {{{ */
 
     oci_param = NULL;
 
-    status = OCIParamGet (oci_statement, OCI_HTYPE_STMT, oci_error,
+    status = OCIParamGet (st->oci_statement, OCI_HTYPE_STMT, oci_error,
         (void *) &oci_param, (ub4) (i + 1));
     if (status != OCI_SUCCESS)
     {
-      /* This is probably alright */
-      DEBUG ("oracle plugin: o_read_database_query: status = %#x (= %i);", status, status);
-      o_report_error ("o_read_database_query", "OCIParamGet", oci_error);
-      status = OCI_SUCCESS;
-      break;
+      o_report_error ("o_statement_define", "OCIParamGet", oci_error);
+      return (-1);
     }
 
     column_name = NULL;
@@ -569,82 +640,173 @@ static int o_read_database_query (o_database_t *db, /* {{{ */
     if (status != OCI_SUCCESS)
     {
       OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
-      o_report_error ("o_read_database_query", "OCIAttrGet (OCI_ATTR_NAME)",
+      o_report_error ("o_statement_define", "OCIAttrGet (OCI_ATTR_NAME)",
           oci_error);
       continue;
     }
 
-    OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
-    oci_param = NULL;
-
     /* Copy the name to column_names. Warning: The ``string'' returned by OCI
      * may not be null terminated! */
-    memset (column_names[i], 0, DATA_MAX_NAME_LEN);
     if (column_name_length >= DATA_MAX_NAME_LEN)
       column_name_length = DATA_MAX_NAME_LEN - 1;
-    memcpy (column_names[i], column_name, column_name_length);
-    column_names[i][column_name_length] = 0;
+    memcpy (st->column_names[i], column_name, column_name_length);
+    st->column_names[i][column_name_length] = 0;
+
+    OCIDescriptorFree (oci_param, OCI_DTYPE_PARAM);
+    oci_param = NULL;
 
-    DEBUG ("oracle plugin: o_read_database_query: column_names[%zu] = %s; "
+    DEBUG ("oracle plugin: o_statement_define: column_names[%zu] = %s; "
         "column_name_length = %"PRIu32";",
-        i, column_names[i], (uint32_t) column_name_length);
+        i, st->column_names[i], (uint32_t) column_name_length);
 
-    status = OCIDefineByPos (oci_statement,
-        &oci_defines[i], oci_error, (ub4) (i + 1),
-        column_values[i], DATA_MAX_NAME_LEN, SQLT_STR,
-        NULL, NULL, NULL, OCI_DEFAULT);
+    status = OCIDefineByPos (st->oci_statement,
+        &st->oci_defines[i], oci_error, (ub4) (i + 1),
+        st->column_values + (i * O_FETCH_ROWS * O_VALUE_SIZE),
+        O_VALUE_SIZE, SQLT_STR,
+        st->indicators + (i * O_FETCH_ROWS), NULL, NULL, OCI_DEFAULT);
     if (status != OCI_SUCCESS)
     {
-      o_report_error ("o_read_database_query", "OCIDefineByPos", oci_error);
-      continue;
+      o_report_error ("o_statement_define", "OCIDefineByPos", oci_error);
+      return (-1);
     }
-  } /* for (j = 1; j <= param_counter; j++) */
-  /* }}} End of the ``define'' stuff. */
+  } /* }}} for (i = 0; i < column_num; i++) */
+
+  st->column_num = column_num;
+  return (0);
+} /* }}} int o_statement_define */
+
+static int o_read_database_query (o_database_t *db, /* {{{ */
+    udb_query_t *q, udb_query_preparation_area_t *prep_area,
+    o_statement_t *st)
+{
+  char **column_values;
+  int status;
+  size_t i;
+
+  /* Prepare the statement */
+  if (st->oci_statement == NULL)
+  {
+    status = o_statement_prepare (db, q, st);
+    if (status != 0)
+      return (status);
+  }
+
+  assert (st->oci_statement != NULL);
+
+  /* Execute the statement */
+  status = OCIStmtExecute (db->oci_service_context, /* {{{ */
+      st->oci_statement,
+      oci_error,
+      /* iters = */ 0,
+      /* rowoff = */ 0,
+      /* snap_in = */ NULL, /* snap_out = */ NULL,
+      /* mode = */ OCI_DEFAULT);
+  if (status != OCI_SUCCESS)
+  {
+    DEBUG ("oracle plugin: o_read_database_query: status = %i (%#x)", status, status);
+    o_report_error ("o_read_database_query", "OCIStmtExecute", oci_error);
+    ERROR ("oracle plugin: o_read_database_query: "
+        "Failing statement was: %s", udb_query_get_statement (q));
+    o_statement_reset (st);
+    return (-1);
+  } /* }}} */
+
+  /* The defines stay valid when the statement is executed again. */
+  if (st->column_num == 0)
+  {
+    status = o_statement_define (st);
+    if (status != 0)
+    {
+      o_statement_reset (st);
+      return (-1);
+    }
+  }
 
   status = udb_query_prepare_result (q, prep_area, hostname_g,
-      /* plugin = */ "oracle", db->name, column_names, column_num,
+      /* plugin = */ "oracle", db->name, st->column_names, st->column_num,
       /* interval = */ 0);
   if (status != 0)
   {
     ERROR ("oracle plugin: o_read_database_query (%s, %s): "
         "udb_query_prepare_result failed.",
         db->name, udb_query_get_name (q));
-    FREE_ALL;
     return (-1);
   }
 
-  /* Fetch and handle all the rows that matched the query. */
+  column_values = calloc (st->column_num, sizeof (*column_values));
+  if (column_values == NULL)
+  {
+    ERROR ("oracle plugin: o_read_database_query: calloc failed.");
+    udb_query_finish_result (q, prep_area);
+    return (-1);
+  }
+
+  /* Fetch and handle all the rows that matched the query, O_FETCH_ROWS at a
+   * time. */
   while (42) /* {{{ */
   {
-    status = OCIStmtFetch2 (oci_statement, oci_error,
-        /* nrows = */ 1, /* orientation = */ OCI_FETCH_NEXT,
+    ub4 rows_fetched = 0;
+    sword fetch_status;
+    ub4 row;
+
+    fetch_status = OCIStmtFetch2 (st->oci_statement, oci_error,
+        /* nrows = */ O_FETCH_ROWS, /* orientation = */ OCI_FETCH_NEXT,
         /* fetch offset = */ 0, /* mode = */ OCI_DEFAULT);
-    if (status == OCI_NO_DATA)
+    if ((fetch_status != OCI_SUCCESS)
+        && (fetch_status != OCI_SUCCESS_WITH_INFO)
+        && (fetch_status != OCI_NO_DATA))
     {
-      status = OCI_SUCCESS;
+      o_report_error ("o_read_database_query", "OCIStmtFetch2", oci_error);
       break;
     }
-    else if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
+
+    /* The last batch is returned with OCI_NO_DATA. */
+    status = OCIAttrGet (st->oci_statement, OCI_HTYPE_STMT,
+        &rows_fetched, /* size pointer = */ NULL,
+        OCI_ATTR_ROWS_FETCHED, oci_error);
+    if (status != OCI_SUCCESS)
     {
-      o_report_error ("o_read_database_query", "OCIStmtFetch2", oci_error);
+      o_report_error ("o_read_database_query", "OCIAttrGet", oci_error);
       break;
     }
 
-    status = udb_query_handle_result (q, prep_area, column_values);
-    if (status != 0)
+    for (row = 0; row < rows_fetched; row++)
     {
-      WARNING ("oracle plugin: o_read_database_query (%s, %s): "
-          "udb_query_handle_result failed.",
-          db->name, udb_query_get_name (q));
+      _Bool have_null = 0;
+
+      for (i = 0; i < st->column_num; i++)
+      {
+        column_values[i] = st->column_values
+          + ((i * O_FETCH_ROWS) + row) * O_VALUE_SIZE;
+        if (st->indicators[(i * O_FETCH_ROWS) + row] == -1)
+          have_null = 1;
+      }
+
+      if (have_null)
+      {
+        DEBUG ("oracle plugin: o_read_database_query (%s, %s): "
+            "Skipping a row with NULL values.",
+            db->name, udb_query_get_name (q));
+        continue;
+      }
+
+      status = udb_query_handle_result (q, prep_area, column_values);
+      if (status != 0)
+      {
+        WARNING ("oracle plugin: o_read_database_query (%s, %s): "
+            "udb_query_handle_result failed.",
+            db->name, udb_query_get_name (q));
+      }
     }
+
+    if (fetch_status == OCI_NO_DATA)
+      break;
   } /* }}} while (42) */
 
-  /* DEBUG ("oracle plugin: o_read_database_query: This statement succeeded: %s", q->statement); */
-  FREE_ALL;
+  sfree (column_values);
+  udb_query_finish_result (q, prep_area);
 
   return (0);
-#undef FREE_ALL
-#undef ALLOC_OR_FAIL
 } /* }}} int o_read_database_query */
 
 static int o_read_database (o_database_t *db) /* {{{ */
@@ -688,6 +850,8 @@ static int o_read_database (o_database_t *db) /* {{{ */
     {
       INFO ("oracle plugin: Connection to %s lost. Trying to reconnect.",
           db->name);
+      for (i = 0; i < db->queries_num; i++)
+        o_statement_reset (db->statements + i);
       OCIHandleFree (db->oci_service_context, OCI_HTYPE_SVCCTX);
       db->oci_service_context = NULL;
     }
@@ -695,15 +859,18 @@ static int o_read_database (o_database_t *db) /* {{{ */
 
   if (db->oci_service_context == NULL)
   {
-    status = OCILogon (oci_env, oci_error,
+    /* The statement cache lets a statement be re-prepared cheaply after an
+     * error. */
+    status = OCILogon2 (oci_env, oci_error,
         &db->oci_service_context,
         (OraText *) db->username, (ub4) strlen (db->username),
         (OraText *) db->password, (ub4) strlen (db->password),
-        (OraText *) db->connect_id, (ub4) strlen (db->connect_id));
+        (OraText *) db->connect_id, (ub4) strlen (db->connect_id),
+        /* mode = */ OCI_LOGON2_STMTCACHE);
     if ((status != OCI_SUCCESS) && (status != OCI_SUCCESS_WITH_INFO))
     {
-      o_report_error ("o_read_database", "OCILogon", oci_error);
-      DEBUG ("oracle plugin: OCILogon (%s): db->oci_service_context = %p;",
+      o_report_error ("o_read_database", "OCILogon2", oci_error);
+      DEBUG ("oracle plugin: OCILogon2 (%s): db->oci_service_context = %p;",
           db->connect_id, db->oci_service_context);
       db->oci_service_context = NULL;
       return (-1);
@@ -719,7 +886,8 @@ static int o_read_database (o_database_t *db) /* {{{ */
       db->connect_id, db->oci_service_context);
 
   for (i = 0; i < db->queries_num; i++)
-    o_read_database_query (db, db->queries[i], db->q_prep_areas[i]);
+    o_read_database_query (db, db->queries[i], db->q_prep_areas[i],
+        db->statements + i);
 
   return (0);
 } /* }}} int o_read_database */
@@ -739,22 +907,26 @@ static int o_shutdown (void) /* {{{ */
   size_t i;
 
   for (i = 0; i < databases_num; i++)
+  {
+    size_t j;
+
+    for (j = 0; j < databases[i]->queries_num; j++)
+      o_statement_reset (databases[i]->statements + j);
+
     if (databases[i]->oci_service_context != NULL)
     {
       OCIHandleFree (databases[i]->oci_service_context, OCI_HTYPE_SVCCTX);
       databases[i]->oci_service_context = NULL;
     }
+  }
   
   for (i = 0; i < queries_num; i++)
   {
-    OCIStmt *oci_statement;
+    o_query_options_t *opts;
 
-    oci_statement = udb_query_get_user_data (queries[i]);
-    if (oci_statement != NULL)
-    {
-      OCIHandleFree (oci_statement, OCI_HTYPE_STMT);
-      udb_query_set_user_data (queries[i], NULL);
-    }
+    opts = udb_query_get_user_data (queries[i]);
+    sfree (opts);
+    udb_query_set_user_data (queries[i], NULL);
   }
   
   OCIHandleFree (oci_env, OCI_HTYPE_ENV);
@@ -102,6 +102,7 @@ void boot_DynaLoader (PerlInterpreter *, CV *);
 static XS (Collectd_plugin_register_ds);
 static XS (Collectd_plugin_unregister_ds);
 static XS (Collectd_plugin_dispatch_values);
+static XS (Collectd_plugin_dispatch_values_batch);
 static XS (Collectd__plugin_write);
 static XS (Collectd__plugin_flush);
 static XS (Collectd_plugin_dispatch_notification);
@@ -117,6 +118,10 @@ typedef struct c_ithread_s {
 	/* the thread's Perl interpreter */
 	PerlInterpreter *interp;
 
+	/* true if the interpreter has been cloned in advance
+	 * and not been handed to a thread yet */
+	_Bool pooled;
+
 	/* double linked list of threads */
 	struct c_ithread_s *prev;
 	struct c_ithread_s *next;
@@ -169,6 +174,9 @@ static char **perl_argv = NULL;
 
 static char base_name[DATA_MAX_NAME_LEN] = "";
 
+/* number of interpreters to clone at init time */
+static int pool_size = 0;
+
 static struct {
 	char name[64];
 	XS ((*f));
@@ -177,6 +185,8 @@ static struct {
 	{ "Collectd::plugin_register_data_set",   Collectd_plugin_register_ds },
 	{ "Collectd::plugin_unregister_data_set", Collectd_plugin_unregister_ds },
 	{ "Collectd::plugin_dispatch_values",     Collectd_plugin_dispatch_values },
+	{ "Collectd::plugin_dispatch_values_batch",
+		Collectd_plugin_dispatch_values_batch },
 	{ "Collectd::_plugin_write",              Collectd__plugin_write },
 	{ "Collectd::_plugin_flush",              Collectd__plugin_flush },
 	{ "Collectd::plugin_dispatch_notification",
@@ -947,6 +957,56 @@ static int pplugin_dispatch_values (pTHX_ HV *values)
 	return ret;
 } /* static int pplugin_dispatch_values (char *, HV *) */
 
+/*
+ * Submit several value lists to the write functions at once.
+ */
+static int pplugin_dispatch_values_batch (pTHX_ AV *array)
+{
+	value_list_t *vl;
+
+	int len = 0;
+	int num = 0;
+	int ret = 0;
+	int i   = 0;
+
+	if (NULL == array)
+		return -1;
+
+	len = av_len (array) + 1;
+	if (0 >= len)
+		return 0;
+
+	vl = (value_list_t *)smalloc (len * sizeof (*vl));
+
+	for (i = 0; i < len; ++i) {
+		SV **tmp = av_fetch (array, i, 0);
+
+		if ((NULL == tmp)
+				|| (! (SvROK (*tmp) && (SVt_PVHV == SvTYPE (SvRV (*tmp)))))) {
+			log_err ("plugin_dispatch_values_batch: "
+					"Element %i is not a hash reference.", i);
+			ret = -1;
+			continue;
+		}
+
+		memset (vl + num, 0, sizeof (*vl));
+		if (0 != hv2value_list (aTHX_ (HV *)SvRV (*tmp), vl + num)) {
+			ret = -1;
+			continue;
+		}
+		++num;
+	}
+
+	if (0 < num)
+		if (0 != plugin_dispatch_values_batch (vl, (size_t)num))
+			ret = -1;
+
+	for (i = 0; i < num; ++i)
+		sfree (vl[i].values);
+	sfree (vl);
+	return ret;
+} /* static int pplugin_dispatch_values_batch (pTHX_ AV *) */
+
 /*
  * Submit the values to a single write function.
  */
@@ -1200,8 +1260,10 @@ static void c_ithread_destructor (void *arg)
 			break;
 
 	/* the ithread no longer exists */
-	if (NULL == t)
+	if (NULL == t) {
+		pthread_mutex_unlock (&perl_threads->mutex);
 		return;
+	}
 
 	c_ithread_destroy (ithread);
 
@@ -1209,8 +1271,9 @@ static void c_ithread_destructor (void *arg)
 	return;
 } /* static void c_ithread_destructor (void *) */
 
-/* must be called with perl_threads->mutex locked */
-static c_ithread_t *c_ithread_create (PerlInterpreter *base)
+/* must be called with perl_threads->mutex locked
+ * note: this switches the current thread's context to the new interpreter */
+static c_ithread_t *c_ithread_clone (PerlInterpreter *base)
 {
 	c_ithread_t *t = NULL;
 	dTHXa (NULL);
@@ -1248,6 +1311,30 @@ static c_ithread_t *c_ithread_create (PerlInterpreter *base)
 	}
 
 	perl_threads->tail = t;
+	return t;
+} /* static c_ithread_t *c_ithread_clone (PerlInterpreter *) */
+
+/* must be called with perl_threads->mutex locked */
+static c_ithread_t *c_ithread_create (PerlInterpreter *base)
+{
+	c_ithread_t *t = NULL;
+
+	assert (NULL != perl_threads);
+
+	/* use an interpreter cloned at init time if there is one left;
+	 * cloning is expensive and would delay this thread's callback */
+	if (NULL != base)
+		for (t = perl_threads->head; NULL != t; t = t->next)
+			if (t->pooled)
+				break;
+
+	if (NULL != t) {
+		t->pooled = 0;
+		PERL_SET_CONTEXT (t->interp);
+	}
+	else {
+		t = c_ithread_clone (base);
+	}
 
 	pthread_setspecific (perl_thr_key, (const void *)t);
 	return t;
@@ -1659,6 +1746,41 @@ static XS (Collectd_plugin_dispatch_values)
 		XSRETURN_EMPTY;
 } /* static XS (Collectd_plugin_dispatch_values) */
 
+/*
+ * Collectd::plugin_dispatch_values_batch ([ $vl, ... ]).
+ *
+ * values:
+ *   reference to an array of value lists to submit
+ */
+static XS (Collectd_plugin_dispatch_values_batch)
+{
+	SV *values = NULL;
+
+	int ret = 0;
+
+	dXSARGS;
+
+	if (1 != items) {
+		log_err ("Usage: Collectd::plugin_dispatch_values_batch(values)");
+		XSRETURN_EMPTY;
+	}
+
+	values = ST (/* stack index = */ 0);
+
+	/* Make sure the argument is an array reference. */
+	if (! (SvROK (values) && (SVt_PVAV == SvTYPE (SvRV (values))))) {
+		log_err ("Collectd::plugin_dispatch_values_batch: Invalid values.");
+		XSRETURN_EMPTY;
+	}
+
+	ret = pplugin_dispatch_values_batch (aTHX_ (AV *)SvRV (values));
+
+	if (0 == ret)
+		XSRETURN_YES;
+	else
+		XSRETURN_EMPTY;
+} /* static XS (Collectd_plugin_dispatch_values_batch) */
+
 /* Collectd::plugin_write (plugin, ds, vl).
  *
  * plugin:
@@ -1892,6 +2014,8 @@ static XS (Collectd_call_by_name)
 
 static int perl_init (void)
 {
+	int ret = 0;
+
 	dTHX;
 
 	if (NULL == perl_threads)
@@ -1909,7 +2033,24 @@ static int perl_init (void)
 
 	log_debug ("perl_init: c_ithread: interp = %p (active threads: %i)",
 			aTHX, perl_threads->number_of_threads);
-	return pplugin_call_all (aTHX_ PLUGIN_INIT);
+	ret = pplugin_call_all (aTHX_ PLUGIN_INIT);
+
+	/* clone the interpreters after the plugins have been initialized,
+	 * just like the ones cloned when a thread first calls into Perl */
+	if (0 < pool_size) {
+		int i = 0;
+
+		pthread_mutex_lock (&perl_threads->mutex);
+		for (i = 0; i < pool_size; ++i)
+			c_ithread_clone (perl_threads->head->interp)->pooled = 1;
+		pthread_mutex_unlock (&perl_threads->mutex);
+
+		/* cloning switched the context to the last clone */
+		PERL_SET_CONTEXT (aTHX);
+
+		log_debug ("perl_init: Cloned %i interpreters.", pool_size);
+	}
+	return ret;
 } /* static int perl_init (void) */
 
 static int perl_read (void)
@@ -2401,6 +2542,37 @@ static int perl_config_includedir (pTHX_ oconfig_item_t *ci)
 	return 0;
 } /* static int perl_config_includedir (oconfig_item_it *) */
 
+/*
+ * InterpreterPool <Num>|true
+ */
+static int perl_config_interpreterpool (pTHX_ oconfig_item_t *ci)
+{
+	if ((0 != ci->children_num) || (1 != ci->values_num)) {
+		log_err ("InterpreterPool expects a single argument.");
+		return 1;
+	}
+
+	if (OCONFIG_TYPE_BOOLEAN == ci->values[0].type) {
+		/* one interpreter for each read thread */
+		pool_size = ci->values[0].value.boolean
+			? atoi (global_option_get ("ReadThreads"))
+			: 0;
+	}
+	else if ((OCONFIG_TYPE_NUMBER == ci->values[0].type)
+			&& (0 <= ci->values[0].value.number)) {
+		pool_size = (int)ci->values[0].value.number;
+	}
+	else {
+		log_err ("InterpreterPool expects a boolean or "
+				"a non-negative number.");
+		return 1;
+	}
+
+	log_debug ("perl_config: Cloning %i interpreters at init time.",
+			pool_size);
+	return 0;
+} /* static int perl_config_interpreterpool (oconfig_item_it *) */
+
 /*
  * <Plugin> block
  */
@@ -2479,6 +2651,8 @@ static int perl_config (oconfig_item_t *ci)
 			current_status = perl_config_enabledebugger (aTHX_ c);
 		else if (0 == strcasecmp (c->key, "IncludeDir"))
 			current_status = perl_config_includedir (aTHX_ c);
+		else if (0 == strcasecmp (c->key, "InterpreterPool"))
+			current_status = perl_config_interpreterpool (aTHX_ c);
 		else if (0 == strcasecmp (c->key, "Plugin"))
 			current_status = perl_config_plugin (aTHX_ c);
 		else
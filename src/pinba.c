@@ -23,10 +23,13 @@
  *   Florian Forster <octo at verplant.org>
  **/
 
+#define _GNU_SOURCE /* For recvmmsg */
+
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_hashtable.h"
 
 #include <pthread.h>
 #include <sys/socket.h>
@@ -54,6 +57,18 @@
 # define PINBA_MAX_SOCKETS 16
 #endif
 
+/* Maximum number of packets read with one call to `recvmmsg'. */
+#define PINBA_RECEIVE_BATCH 16
+
+/* Bits of a view's mask, one for each of the fields the view matches. */
+#define PINBA_VIEW_HOST   0x01
+#define PINBA_VIEW_SERVER 0x02
+#define PINBA_VIEW_SCRIPT 0x04
+#define PINBA_VIEW_MASKS  8
+
+/* Maximum length of the key a view is looked up with. */
+#define PINBA_VIEW_KEY_SIZE 4096
+
 /*
  * Private data structures
  */
@@ -73,6 +88,19 @@ struct float_counter_s
 };
 typedef struct float_counter_s float_counter_t;
 
+struct pinba_counters_s
+{
+  derive_t req_count;
+
+  float_counter_t req_time;
+  float_counter_t ru_utime;
+  float_counter_t ru_stime;
+
+  derive_t doc_size;
+  gauge_t mem_peak;
+};
+typedef struct pinba_counters_s pinba_counters_t;
+
 struct pinba_statnode_s
 {
   /* collector name, used as plugin instance */
@@ -83,16 +111,36 @@ struct pinba_statnode_s
   char *server;
   char *script;
 
-  derive_t req_count;
+  /* totals of all receive threads, updated by plugin_read */
+  pinba_counters_t counters;
+};
+typedef struct pinba_statnode_s pinba_statnode_t;
 
-  float_counter_t req_time;
-  float_counter_t ru_utime;
-  float_counter_t ru_stime;
+/* The views matching one combination of host, server and script. */
+struct pinba_view_key_s
+{
+  char *key;
+  unsigned int *nodes;
+  size_t nodes_num;
+};
+typedef struct pinba_view_key_s pinba_view_key_t;
 
-  derive_t doc_size;
-  gauge_t mem_peak;
+/* Each receive thread adds the packets it reads to its own counters, one for
+ * each entry of "stat_nodes". Only plugin_read, which moves them to the
+ * totals, takes the lock as well, so the threads hardly ever wait for it. */
+struct pinba_receiver_s
+{
+  pthread_t thread;
+  _Bool running;
+
+  /* The threads share the sockets, but not the list of sockets polled. */
+  pinba_socket_t socket;
+  uint8_t *buffer;
+
+  pthread_mutex_t lock;
+  pinba_counters_t *counters;
 };
-typedef struct pinba_statnode_s pinba_statnode_t;
+typedef struct pinba_receiver_s pinba_receiver_t;
 /* }}} */
 
 /*
@@ -101,14 +149,23 @@ typedef struct pinba_statnode_s pinba_statnode_t;
 /* {{{ */
 static pinba_statnode_t *stat_nodes = NULL;
 static unsigned int stat_nodes_num = 0;
-static pthread_mutex_t stat_nodes_lock;
+static pthread_mutex_t stat_nodes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Views are looked up by the fields they match: "view_index[mask]" maps the
+ * key built by "pinba_view_key" to the views with this mask. Views matching
+ * everything are in "view_all". */
+static c_hashtable_t *view_index[PINBA_VIEW_MASKS];
+static unsigned int *view_all = NULL;
+static size_t view_all_num = 0;
 
 static char *conf_node = NULL;
 static char *conf_service = NULL;
+static int conf_receive_threads = 1;
 
-static _Bool collector_thread_running = 0;
+static pinba_socket_t *pinba_socket = NULL;
+static pinba_receiver_t *receivers = NULL;
+static size_t receivers_num = 0;
 static _Bool collector_thread_do_shutdown = 0;
-static pthread_t collector_thread_id;
 /* }}} */
 
 /*
@@ -135,6 +192,20 @@ static void float_counter_add (float_counter_t *fc, float val) /* {{{ */
   }
 } /* }}} void float_counter_add */
 
+static void float_counter_merge (float_counter_t *dst, /* {{{ */
+    const float_counter_t *src)
+{
+  dst->i += src->i;
+  dst->n += src->n;
+
+  if (dst->n >= 1000000000)
+  {
+    dst->i += 1;
+    dst->n -= 1000000000;
+    assert (dst->n < 1000000000);
+  }
+} /* }}} void float_counter_merge */
+
 static derive_t float_counter_get (const float_counter_t *fc, /* {{{ */
     uint64_t factor)
 {
@@ -186,7 +257,7 @@ static void service_statnode_add(const char *name, /* {{{ */
   node->server = NULL;
   node->script = NULL;
 
-  node->mem_peak = NAN;
+  node->counters.mem_peak = NAN;
   
   /* fill query data */
   strset (&node->name, name);
@@ -198,6 +269,49 @@ static void service_statnode_add(const char *name, /* {{{ */
   stat_nodes_num++;
 } /* }}} void service_statnode_add */
 
+static void pinba_counters_reset (pinba_counters_t *c) /* {{{ */
+{
+  memset (c, 0, sizeof (*c));
+  c->mem_peak = NAN;
+} /* }}} void pinba_counters_reset */
+
+static void pinba_counters_merge (pinba_counters_t *dst, /* {{{ */
+    const pinba_counters_t *src)
+{
+  dst->req_count += src->req_count;
+
+  float_counter_merge (&dst->req_time, &src->req_time);
+  float_counter_merge (&dst->ru_utime, &src->ru_utime);
+  float_counter_merge (&dst->ru_stime, &src->ru_stime);
+
+  dst->doc_size += src->doc_size;
+
+  if (!isnan (src->mem_peak)
+      && (isnan (dst->mem_peak) || (dst->mem_peak < src->mem_peak)))
+    dst->mem_peak = src->mem_peak;
+} /* }}} void pinba_counters_merge */
+
+/* Moves the counters of all receive threads to the totals in "stat_nodes".
+ * The caller must hold "stat_nodes_lock". */
+static void service_statnode_merge (void) /* {{{ */
+{
+  size_t i;
+
+  for (i = 0; i < receivers_num; i++)
+  {
+    pinba_receiver_t *r = receivers + i;
+    unsigned int j;
+
+    pthread_mutex_lock (&r->lock);
+    for (j = 0; j < stat_nodes_num; j++)
+    {
+      pinba_counters_merge (&stat_nodes[j].counters, r->counters + j);
+      pinba_counters_reset (r->counters + j);
+    }
+    pthread_mutex_unlock (&r->lock);
+  }
+} /* }}} void service_statnode_merge */
+
 /* Copy the data from the global "stat_nodes" list into the buffer pointed to
  * by "res", doing the derivation in the process. Returns the next index or
  * zero if the end of the list has been reached. */
@@ -211,7 +325,10 @@ static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
   
   /* begin collecting */
   if (index == 0)
+  {
     pthread_mutex_lock (&stat_nodes_lock);
+    service_statnode_merge ();
+  }
   
   /* end collecting */
   if (index >= stat_nodes_num)
@@ -224,13 +341,13 @@ static unsigned int service_statnode_collect (pinba_statnode_t *res, /* {{{ */
   memcpy (res, node, sizeof (*res));
 
   /* reset node */
-  node->mem_peak = NAN;
+  node->counters.mem_peak = NAN;
   
   return (index + 1);
 } /* }}} unsigned int service_statnode_collect */
 
-static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
-    Pinba__Request* request)
+static void service_statnode_process (pinba_counters_t *node, /* {{{ */
+    const Pinba__Request *request)
 {
   node->req_count++;
 
@@ -246,41 +363,210 @@ static void service_statnode_process (pinba_statnode_t *node, /* {{{ */
 
 } /* }}} void service_statnode_process */
 
-static void service_process_request (Pinba__Request *request) /* {{{ */
+/* Joins the fields selected by "mask" into "buffer". The fields are
+ * terminated by a byte which does not occur in host, server or script names.
+ * Returns non-zero if the key does not fit into the buffer. */
+static int pinba_view_key (char *buffer, size_t buffer_size, /* {{{ */
+    int mask, const char *host, const char *server, const char *script)
+{
+  const char *fields[3] = { host, server, script };
+  size_t fill = 0;
+  int i;
+
+  for (i = 0; i < 3; i++)
+  {
+    size_t len;
+
+    if ((mask & (1 << i)) == 0)
+      continue;
+
+    len = strlen (fields[i]);
+    if ((fill + len + 2) > buffer_size)
+      return (-1);
+
+    memcpy (buffer + fill, fields[i], len);
+    fill += len;
+    buffer[fill] = '\001';
+    fill++;
+  }
+
+  buffer[fill] = 0;
+  return (0);
+} /* }}} int pinba_view_key */
+
+static int pinba_view_mask (const pinba_statnode_t *node) /* {{{ */
+{
+  int mask = 0;
+
+  if (node->host != NULL)
+    mask |= PINBA_VIEW_HOST;
+  if (node->server != NULL)
+    mask |= PINBA_VIEW_SERVER;
+  if (node->script != NULL)
+    mask |= PINBA_VIEW_SCRIPT;
+
+  return (mask);
+} /* }}} int pinba_view_mask */
+
+static int pinba_view_list_add (unsigned int **list, size_t *list_num, /* {{{ */
+    unsigned int index)
+{
+  unsigned int *tmp;
+
+  tmp = realloc (*list, sizeof (**list) * (*list_num + 1));
+  if (tmp == NULL)
+  {
+    ERROR ("pinba plugin: realloc failed.");
+    return (-1);
+  }
+  *list = tmp;
+
+  (*list)[*list_num] = index;
+  (*list_num)++;
+
+  return (0);
+} /* }}} int pinba_view_list_add */
+
+static void pinba_view_index_destroy (void) /* {{{ */
+{
+  int mask;
+
+  for (mask = 0; mask < PINBA_VIEW_MASKS; mask++)
+  {
+    pinba_view_key_t *vk;
+    char *key;
+
+    if (view_index[mask] == NULL)
+      continue;
+
+    while (c_hashtable_pick (view_index[mask],
+          (void *) &key, (void *) &vk) == 0)
+    {
+      sfree (vk->key);
+      sfree (vk->nodes);
+      sfree (vk);
+    }
+
+    c_hashtable_destroy (view_index[mask]);
+    view_index[mask] = NULL;
+  }
+
+  sfree (view_all);
+  view_all_num = 0;
+} /* }}} void pinba_view_index_destroy */
+
+static int pinba_view_index_add (unsigned int index) /* {{{ */
+{
+  pinba_statnode_t *node = stat_nodes + index;
+  pinba_view_key_t *vk;
+  char key[PINBA_VIEW_KEY_SIZE];
+  int mask;
+
+  mask = pinba_view_mask (node);
+  if (mask == 0)
+    return (pinba_view_list_add (&view_all, &view_all_num, index));
+
+  if (pinba_view_key (key, sizeof (key), mask,
+        node->host, node->server, node->script) != 0)
+  {
+    WARNING ("pinba plugin: The host, server and script names of view "
+        "\"%s\" are too long. The view will be ignored.", node->name);
+    return (0);
+  }
+
+  if (view_index[mask] == NULL)
+  {
+    view_index[mask] = c_hashtable_create (c_hashtable_hash_string,
+        (void *) strcmp);
+    if (view_index[mask] == NULL)
+    {
+      ERROR ("pinba plugin: c_hashtable_create failed.");
+      return (-1);
+    }
+  }
+
+  if (c_hashtable_get (view_index[mask], key, (void *) &vk) != 0)
+  {
+    vk = calloc (1, sizeof (*vk));
+    if (vk == NULL)
+    {
+      ERROR ("pinba plugin: calloc failed.");
+      return (-1);
+    }
+
+    vk->key = strdup (key);
+    if ((vk->key == NULL)
+        || (c_hashtable_insert (view_index[mask], vk->key, vk) != 0))
+    {
+      ERROR ("pinba plugin: Adding view \"%s\" to the index failed.",
+          node->name);
+      sfree (vk->key);
+      sfree (vk);
+      return (-1);
+    }
+  }
+
+  return (pinba_view_list_add (&vk->nodes, &vk->nodes_num, index));
+} /* }}} int pinba_view_index_add */
+
+static int pinba_view_index_create (void) /* {{{ */
 {
   unsigned int i;
 
-  pthread_mutex_lock (&stat_nodes_lock);
-  
   for (i = 0; i < stat_nodes_num; i++)
   {
-    if ((stat_nodes[i].host != NULL)
-        && (strcmp (request->hostname, stat_nodes[i].host) != 0))
+    if (pinba_view_index_add (i) != 0)
+    {
+      pinba_view_index_destroy ();
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int pinba_view_index_create */
+
+static void service_process_request (pinba_receiver_t *r, /* {{{ */
+    const Pinba__Request *request)
+{
+  char key[PINBA_VIEW_KEY_SIZE];
+  size_t i;
+  int mask;
+
+  pthread_mutex_lock (&r->lock);
+
+  for (i = 0; i < view_all_num; i++)
+    service_statnode_process (r->counters + view_all[i], request);
+
+  for (mask = 1; mask < PINBA_VIEW_MASKS; mask++)
+  {
+    pinba_view_key_t *vk;
+
+    if (view_index[mask] == NULL)
       continue;
 
-    if ((stat_nodes[i].server != NULL)
-      && (strcmp (request->server_name, stat_nodes[i].server) != 0))
+    /* A key which does not fit cannot match any view either. */
+    if (pinba_view_key (key, sizeof (key), mask, request->hostname,
+          request->server_name, request->script_name) != 0)
       continue;
 
-    if ((stat_nodes[i].script != NULL)
-      && (strcmp (request->script_name, stat_nodes[i].script) != 0))
+    if (c_hashtable_get (view_index[mask], key, (void *) &vk) != 0)
       continue;
 
-    service_statnode_process(&stat_nodes[i], request);
+    for (i = 0; i < vk->nodes_num; i++)
+      service_statnode_process (r->counters + vk->nodes[i], request);
   }
-  
-  pthread_mutex_unlock(&stat_nodes_lock);
+
+  pthread_mutex_unlock (&r->lock);
 } /* }}} void service_process_request */
 
+/* Removes a socket from the list polled by one receive thread. The socket is
+ * shared by all threads and is closed by "pinba_socket_free". */
 static int pb_del_socket (pinba_socket_t *s, /* {{{ */
     nfds_t index)
 {
   if (index >= s->fd_num)
     return (EINVAL);
 
-  close (s->fd[index].fd);
-  s->fd[index].fd = -1;
-
   /* When deleting the last element in the list, no memmove is necessary. */
   if (index < (s->fd_num - 1))
   {
@@ -331,6 +617,7 @@ static int pb_add_socket (pinba_socket_t *s, /* {{{ */
     char errbuf[1024];
     ERROR ("pinba plugin: bind(2) failed: %s",
         sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
     return (0);
   }
 
@@ -422,8 +709,8 @@ static void pinba_socket_free (pinba_socket_t *socket) /* {{{ */
   sfree(socket);
 } /* }}} void pinba_socket_free */
 
-static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
-    size_t buffer_size)
+static int pinba_process_stats_packet (pinba_receiver_t *r, /* {{{ */
+    const uint8_t *buffer, size_t buffer_size)
 {
   Pinba__Request *request;  
   
@@ -432,72 +719,81 @@ static int pinba_process_stats_packet (const uint8_t *buffer, /* {{{ */
   if (!request)
     return (-1);
 
-  service_process_request(request);
+  service_process_request (r, request);
   pinba__request__free_unpacked (request, NULL);
     
   return (0);
 } /* }}} int pinba_process_stats_packet */
 
-static int pinba_udp_read_callback_fn (int sock) /* {{{ */
+/* Reads up to "PINBA_RECEIVE_BATCH" packets from "sock" and accounts them.
+ * Returns the number of packets read, zero if there was nothing to read, e.g.
+ * because another thread was faster, or less than zero on failure. */
+static int pinba_udp_read_callback_fn (pinba_receiver_t *r, int sock) /* {{{ */
 {
-  uint8_t buffer[PINBA_UDP_BUFFER_SIZE];
-  size_t buffer_size;
-  int status;
+#if HAVE_RECVMMSG
+  struct mmsghdr msgs[PINBA_RECEIVE_BATCH];
+  struct iovec   iovs[PINBA_RECEIVE_BATCH];
+  int num;
+  int i;
 
-  while (42)
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < PINBA_RECEIVE_BATCH; i++)
   {
-    buffer_size = sizeof (buffer);
-    status = recvfrom (sock, buffer, buffer_size - 1, MSG_DONTWAIT, /* from = */ NULL, /* from len = */ 0);
-    if (status < 0)
-    {
-      char errbuf[1024];
+    iovs[i].iov_base = r->buffer + (i * PINBA_UDP_BUFFER_SIZE);
+    iovs[i].iov_len = PINBA_UDP_BUFFER_SIZE;
+    msgs[i].msg_hdr.msg_iov = iovs + i;
+    msgs[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  num = recvmmsg (sock, msgs, PINBA_RECEIVE_BATCH, MSG_DONTWAIT,
+      /* timeout = */ NULL);
+#else /* if !HAVE_RECVMMSG */
+  ssize_t status;
+  int num;
 
-      if ((errno == EINTR)
+  status = recvfrom (sock, r->buffer, PINBA_UDP_BUFFER_SIZE, MSG_DONTWAIT,
+      /* from = */ NULL, /* from len = */ 0);
+  num = (status < 0) ? -1 : 1;
+#endif
+  if (num < 0)
+  {
+    char errbuf[1024];
+
+    if ((errno == EINTR)
 #ifdef EWOULDBLOCK
-          || (errno == EWOULDBLOCK)
+        || (errno == EWOULDBLOCK)
 #endif
-          || (errno == EAGAIN))
-      {
-        continue;
-      }
+        || (errno == EAGAIN))
+      return (0);
 
-      WARNING("pinba plugin: recvfrom(2) failed: %s",
-          sstrerror (errno, errbuf, sizeof (errbuf)));
-      return (-1);
-    }
-    else if (status == 0)
-    {
-      DEBUG ("pinba plugin: recvfrom(2) returned unexpected status zero.");
-      return (-1);
-    }
-    else /* if (status > 0) */
-    {
-      assert (((size_t) status) < buffer_size);
-      buffer_size = (size_t) status;
-      buffer[buffer_size] = 0;
+    WARNING ("pinba plugin: Receiving packets failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
 
-      status = pinba_process_stats_packet (buffer, buffer_size);
-      if (status != 0)
-        DEBUG("pinba plugin: Parsing packet failed.");
-      return (status);
-    }
-  } /* while (42) */
+#if HAVE_RECVMMSG
+  for (i = 0; i < num; i++)
+  {
+    if (msgs[i].msg_len == 0)
+      continue;
 
-  /* not reached */
-  assert (23 == 42);
-  return (-1);
-} /* }}} void pinba_udp_read_callback_fn */
+    if (pinba_process_stats_packet (r,
+          r->buffer + (i * PINBA_UDP_BUFFER_SIZE),
+          (size_t) msgs[i].msg_len) != 0)
+      DEBUG ("pinba plugin: Parsing packet failed.");
+  }
+#else
+  if ((status > 0)
+      && (pinba_process_stats_packet (r, r->buffer, (size_t) status) != 0))
+    DEBUG ("pinba plugin: Parsing packet failed.");
+#endif
 
-static int receive_loop (void) /* {{{ */
-{
-  pinba_socket_t *s;
+  return (num);
+} /* }}} int pinba_udp_read_callback_fn */
 
-  s = pinba_socket_open (conf_node, conf_service);
-  if (s == NULL)
-  {
-    ERROR ("pinba plugin: Collector thread is exiting prematurely.");
-    return (-1);
-  }
+static int receive_loop (pinba_receiver_t *r) /* {{{ */
+{
+  pinba_socket_t *s = &r->socket;
 
   while (!collector_thread_do_shutdown)
   {
@@ -521,7 +817,6 @@ static int receive_loop (void) /* {{{ */
 
       ERROR ("pinba plugin: poll(2) failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
-      pinba_socket_free (s);
       return (-1);
     }
 
@@ -534,27 +829,112 @@ static int receive_loop (void) /* {{{ */
       }
       else if (s->fd[i].revents & (POLLIN | POLLPRI))
       {
-        pinba_udp_read_callback_fn (s->fd[i].fd);
+        /* Keep reading while full batches arrive, so a busy socket is
+         * drained without polling it again after every batch. */
+        while ((pinba_udp_read_callback_fn (r, s->fd[i].fd)
+              == PINBA_RECEIVE_BATCH)
+            && !collector_thread_do_shutdown)
+          /* do nothing */;
       }
     } /* for (s->fd) */
   } /* while (!collector_thread_do_shutdown) */
 
-  pinba_socket_free (s);
-  s = NULL;
-
   return (0);
 } /* }}} int receive_loop */
 
 static void *collector_thread (void *arg) /* {{{ */
 {
-  receive_loop ();
+  pinba_receiver_t *r = arg;
+
+  if (receive_loop (r) != 0)
+    ERROR ("pinba plugin: Collector thread is exiting prematurely.");
 
-  memset (&collector_thread_id, 0, sizeof (collector_thread_id));
-  collector_thread_running = 0;
   pthread_exit (NULL);
   return (NULL);
 } /* }}} void *collector_thread */
 
+static void pinba_receivers_destroy (void) /* {{{ */
+{
+  size_t i;
+
+  collector_thread_do_shutdown = 1;
+
+  for (i = 0; i < receivers_num; i++)
+  {
+    pinba_receiver_t *r = receivers + i;
+
+    if (r->running)
+    {
+      int status;
+
+      status = pthread_join (r->thread, /* retval = */ NULL);
+      if (status != 0)
+      {
+        char errbuf[1024];
+        ERROR ("pinba plugin: pthread_join(3) failed: %s",
+            sstrerror (status, errbuf, sizeof (errbuf)));
+      }
+      r->running = 0;
+    }
+
+    pthread_mutex_destroy (&r->lock);
+    sfree (r->buffer);
+    sfree (r->counters);
+  }
+
+  sfree (receivers);
+  receivers_num = 0;
+  collector_thread_do_shutdown = 0;
+} /* }}} void pinba_receivers_destroy */
+
+static int pinba_receivers_create (void) /* {{{ */
+{
+  size_t i;
+
+  receivers = calloc ((size_t) conf_receive_threads, sizeof (*receivers));
+  if (receivers == NULL)
+  {
+    ERROR ("pinba plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < (size_t) conf_receive_threads; i++)
+  {
+    pinba_receiver_t *r = receivers + i;
+    unsigned int j;
+    int status;
+
+    pthread_mutex_init (&r->lock, /* attr = */ NULL);
+    receivers_num++;
+
+    memcpy (&r->socket, pinba_socket, sizeof (r->socket));
+    r->buffer = malloc (PINBA_RECEIVE_BATCH * PINBA_UDP_BUFFER_SIZE);
+    r->counters = calloc (stat_nodes_num, sizeof (*r->counters));
+    if ((r->buffer == NULL) || (r->counters == NULL))
+    {
+      ERROR ("pinba plugin: malloc failed.");
+      pinba_receivers_destroy ();
+      return (-1);
+    }
+    for (j = 0; j < stat_nodes_num; j++)
+      pinba_counters_reset (r->counters + j);
+
+    status = pthread_create (&r->thread, /* attrs = */ NULL,
+        collector_thread, /* args = */ r);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("pinba plugin: pthread_create(3) failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      pinba_receivers_destroy ();
+      return (-1);
+    }
+    r->running = 1;
+  }
+
+  return (0);
+} /* }}} int pinba_receivers_create */
+
 /*
  * Plugin declaration section
  */
@@ -618,6 +998,15 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
       cf_util_get_string (child, &conf_node);
     else if (strcasecmp ("Port", child->key) == 0)
       cf_util_get_service (child, &conf_service);
+    else if (strcasecmp ("ReceiveThreads", child->key) == 0)
+    {
+      int tmp = conf_receive_threads;
+
+      if ((cf_util_get_int (child, &tmp) == 0) && (tmp < 1))
+        WARNING ("pinba plugin: `ReceiveThreads' must be at least one.");
+      else
+        conf_receive_threads = tmp;
+    }
     else if (strcasecmp ("View", child->key) == 0)
       pinba_config_view (child);
     else
@@ -631,8 +1020,6 @@ static int plugin_config (oconfig_item_t *ci) /* {{{ */
 
 static int plugin_init (void) /* {{{ */
 {
-  int status;
-
   if (stat_nodes == NULL)
   {
     /* Collect the "total" data by default. */
@@ -642,45 +1029,39 @@ static int plugin_init (void) /* {{{ */
         /* script = */ NULL);
   }
 
-  if (collector_thread_running)
+  if (receivers != NULL)
     return (0);
 
-  status = pthread_create (&collector_thread_id,
-      /* attrs = */ NULL,
-      collector_thread,
-      /* args = */ NULL);
-  if (status != 0)
+  if (pinba_view_index_create () != 0)
+    return (-1);
+
+  pinba_socket = pinba_socket_open (conf_node, conf_service);
+  if (pinba_socket == NULL)
   {
-    char errbuf[1024];
-    ERROR ("pinba plugin: pthread_create(3) failed: %s",
-        sstrerror (errno, errbuf, sizeof (errbuf)));
+    pinba_view_index_destroy ();
+    return (-1);
+  }
+
+  if (pinba_receivers_create () != 0)
+  {
+    pinba_socket_free (pinba_socket);
+    pinba_socket = NULL;
+    pinba_view_index_destroy ();
     return (-1);
   }
-  collector_thread_running = 1;
 
   return (0);
 } /* }}} */
 
 static int plugin_shutdown (void) /* {{{ */
 {
-  if (collector_thread_running)
-  {
-    int status;
-
-    DEBUG ("pinba plugin: Shutting down collector thread.");
-    collector_thread_do_shutdown = 1;
+  DEBUG ("pinba plugin: Shutting down collector threads.");
+  pinba_receivers_destroy ();
 
-    status = pthread_join (collector_thread_id, /* retval = */ NULL);
-    if (status != 0)
-    {
-      char errbuf[1024];
-      ERROR ("pinba plugin: pthread_join(3) failed: %s",
-          sstrerror (status, errbuf, sizeof (errbuf)));
-    }
+  pinba_socket_free (pinba_socket);
+  pinba_socket = NULL;
 
-    collector_thread_running = 0;
-    collector_thread_do_shutdown = 0;
-  } /* if (collector_thread_running) */
+  pinba_view_index_destroy ();
 
   return (0);
 } /* }}} int plugin_shutdown */
@@ -696,29 +1077,29 @@ static int plugin_submit (const pinba_statnode_t *res) /* {{{ */
   sstrncpy (vl.plugin, "pinba", sizeof (vl.plugin));
   sstrncpy (vl.plugin_instance, res->name, sizeof (vl.plugin_instance));
 
-  value.derive = res->req_count;
+  value.derive = res->counters.req_count;
   sstrncpy (vl.type, "total_requests", sizeof (vl.type)); 
   plugin_dispatch_values (&vl);
 
-  value.derive = float_counter_get (&res->req_time, /* factor = */ 1000);
+  value.derive = float_counter_get (&res->counters.req_time, /* factor = */ 1000);
   sstrncpy (vl.type, "total_time_in_ms", sizeof (vl.type)); 
   plugin_dispatch_values (&vl);
 
-  value.derive = res->doc_size;
+  value.derive = res->counters.doc_size;
   sstrncpy (vl.type, "total_bytes", sizeof (vl.type)); 
   plugin_dispatch_values (&vl);
 
-  value.derive = float_counter_get (&res->ru_utime, /* factor = */ 100);
+  value.derive = float_counter_get (&res->counters.ru_utime, /* factor = */ 100);
   sstrncpy (vl.type, "cpu", sizeof (vl.type));
   sstrncpy (vl.type_instance, "user", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
 
-  value.derive = float_counter_get (&res->ru_stime, /* factor = */ 100);
+  value.derive = float_counter_get (&res->counters.ru_stime, /* factor = */ 100);
   sstrncpy (vl.type, "cpu", sizeof (vl.type));
   sstrncpy (vl.type_instance, "system", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
 
-  value.gauge = res->mem_peak;
+  value.gauge = res->counters.mem_peak;
   sstrncpy (vl.type, "memory", sizeof (vl.type));
   sstrncpy (vl.type_instance, "peak", sizeof (vl.type_instance));
   plugin_dispatch_values (&vl);
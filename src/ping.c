@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_avltree.h"
 
 #include <pthread.h>
 #include <netinet/in.h>
@@ -54,14 +55,35 @@ struct hostlist_s
   double latency_total;
   double latency_squared;
 
-  struct hostlist_s *next;
+  /* Set if the host is to be resolved again after this round. */
+  _Bool resolve;
 };
 typedef struct hostlist_s hostlist_t;
 
+/* The hosts are distributed among the shards round robin: shard `index'
+ * pings `hostlist[index]', `hostlist[index + shards_num]' and so on. Every
+ * shard has its own thread and ping object, and its lock protects the
+ * statistics of its hosts. */
+struct ping_shard_s
+{
+  int index;
+
+  int             thread_loop;
+  int             thread_error;
+  pthread_t       thread_id;
+  pthread_mutex_t lock;
+  pthread_cond_t  cond;
+};
+typedef struct ping_shard_s ping_shard_t;
+
 /*
  * Private variables
  */
-static hostlist_t *hostlist_head = NULL;
+static hostlist_t *hostlist = NULL;
+static size_t      hostlist_num = 0;
+
+static ping_shard_t *shards = NULL;
+static int           shards_num = 0;
 
 static char  *ping_source = NULL;
 #ifdef HAVE_OPING_1_3
@@ -71,12 +93,7 @@ static int    ping_ttl = PING_DEF_TTL;
 static double ping_interval = 1.0;
 static double ping_timeout = 0.9;
 static int    ping_max_missed = -1;
-
-static int             ping_thread_loop = 0;
-static int             ping_thread_error = 0;
-static pthread_t       ping_thread_id;
-static pthread_mutex_t ping_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  ping_cond = PTHREAD_COND_INITIALIZER;
+static int    ping_threads = 1;
 
 static const char *config_keys[] =
 {
@@ -88,7 +105,8 @@ static const char *config_keys[] =
   "TTL",
   "Interval",
   "Timeout",
-  "MaxMissed"
+  "MaxMissed",
+  "Threads"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -142,26 +160,83 @@ static void time_calc (struct timespec *ts_dest, /* {{{ */
   time_normalize (ts_dest);
 } /* }}} void time_calc */
 
+static void timespec_from_double (struct timespec *ts, /* {{{ */
+    double seconds)
+{
+  double temp_sec;
+  double temp_nsec;
+
+  temp_nsec = modf (seconds, &temp_sec);
+  ts->tv_sec  = (time_t) temp_sec;
+  ts->tv_nsec = (long) (temp_nsec * 1000000000L);
+} /* }}} void timespec_from_double */
+
+/* Returns the host an iterator belongs to. The host is stored as the
+ * iterator's context, so it has to be looked up by name only once. */
+static hostlist_t *ping_iterator_host (pingobj_t *pingobj, /* {{{ */
+    pingobj_iter_t *iter, c_avl_tree_t *by_name)
+{
+  char userhost[NI_MAXHOST];
+  hostlist_t *hl;
+  size_t param_size;
+  int status;
+
+  hl = ping_iterator_get_context (iter);
+  if (hl != NULL)
+    return (hl);
+
+  param_size = sizeof (userhost);
+  status = ping_iterator_get_info (iter,
+#ifdef PING_INFO_USERNAME
+      PING_INFO_USERNAME,
+#else
+      PING_INFO_HOSTNAME,
+#endif
+      userhost, &param_size);
+  if (status != 0)
+  {
+    WARNING ("ping plugin: ping_iterator_get_info failed: %s",
+        ping_get_error (pingobj));
+    return (NULL);
+  }
+
+  if (c_avl_get (by_name, userhost, (void *) &hl) != 0)
+  {
+    WARNING ("ping plugin: Cannot find host %s.", userhost);
+    return (NULL);
+  }
+
+  ping_iterator_set_context (iter, hl);
+  return (hl);
+} /* }}} hostlist_t *ping_iterator_host */
+
 static void *ping_thread (void *arg) /* {{{ */
 {
-  static pingobj_t *pingobj = NULL;
+  ping_shard_t *shard = arg;
+  pingobj_t *pingobj = NULL;
+  c_avl_tree_t *by_name = NULL;
 
   struct timeval  tv_begin;
   struct timeval  tv_end;
   struct timespec ts_wait;
   struct timespec ts_int;
 
-  hostlist_t *hl;
+  size_t i;
   int count;
 
-  pthread_mutex_lock (&ping_lock);
+  pthread_mutex_lock (&shard->lock);
 
   pingobj = ping_construct ();
-  if (pingobj == NULL)
+  by_name = c_avl_create ((void *) strcmp);
+  if ((pingobj == NULL) || (by_name == NULL))
   {
     ERROR ("ping plugin: ping_construct failed.");
-    ping_thread_error = 1;
-    pthread_mutex_unlock (&ping_lock);
+    shard->thread_error = 1;
+    pthread_mutex_unlock (&shard->lock);
+    if (pingobj != NULL)
+      ping_destroy (pingobj);
+    if (by_name != NULL)
+      c_avl_destroy (by_name);
     return ((void *) -1);
   }
 
@@ -180,11 +255,15 @@ static void *ping_thread (void *arg) /* {{{ */
   ping_setopt (pingobj, PING_OPT_TIMEOUT, (void *) &ping_timeout);
   ping_setopt (pingobj, PING_OPT_TTL, (void *) &ping_ttl);
 
-  /* Add all the hosts to the ping object. */
+  /* Add the hosts of this shard to the ping object. */
   count = 0;
-  for (hl = hostlist_head; hl != NULL; hl = hl->next)
+  for (i = (size_t) shard->index; i < hostlist_num; i += (size_t) shards_num)
   {
+    hostlist_t *hl = hostlist + i;
     int tmp_status;
+
+    c_avl_insert (by_name, hl->host, hl);
+
     tmp_status = ping_host_add (pingobj, hl->host);
     if (tmp_status != 0)
       WARNING ("ping plugin: ping_host_add (%s) failed: %s",
@@ -196,24 +275,32 @@ static void *ping_thread (void *arg) /* {{{ */
   if (count == 0)
   {
     ERROR ("ping plugin: No host could be added to ping object. Giving up.");
-    ping_thread_error = 1;
-    pthread_mutex_unlock (&ping_lock);
+    shard->thread_error = 1;
+    pthread_mutex_unlock (&shard->lock);
+    ping_destroy (pingobj);
+    c_avl_destroy (by_name);
     return ((void *) -1);
   }
 
-  /* Set up `ts_int' */
+  timespec_from_double (&ts_int, ping_interval);
+
+  /* Stagger the shards over the interval, so that their packets are not sent
+   * (and their replies received) all at the same time. */
+  if (shard->index > 0)
   {
-    double temp_sec;
-    double temp_nsec;
+    struct timespec ts_offset;
 
-    temp_nsec = modf (ping_interval, &temp_sec);
-    ts_int.tv_sec  = (time_t) temp_sec;
-    ts_int.tv_nsec = (long) (temp_nsec * 1000000000L);
+    gettimeofday (&tv_begin, NULL);
+    timespec_from_double (&ts_offset,
+        ping_interval * ((double) shard->index) / ((double) shards_num));
+    time_calc (&ts_wait, &ts_offset, &tv_begin, &tv_begin);
+    pthread_cond_timedwait (&shard->cond, &shard->lock, &ts_wait);
   }
 
-  while (ping_thread_loop > 0)
+  while (shard->thread_loop > 0)
   {
     pingobj_iter_t *iter;
+    int resolve_num = 0;
     int status;
 
     if (gettimeofday (&tv_begin, NULL) < 0)
@@ -221,58 +308,37 @@ static void *ping_thread (void *arg) /* {{{ */
       char errbuf[1024];
       ERROR ("ping plugin: gettimeofday failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
-      ping_thread_error = 1;
+      shard->thread_error = 1;
       break;
     }
 
-    pthread_mutex_unlock (&ping_lock);
+    pthread_mutex_unlock (&shard->lock);
 
     status = ping_send (pingobj);
     if (status < 0)
     {
       ERROR ("ping plugin: ping_send failed: %s", ping_get_error (pingobj));
-      pthread_mutex_lock (&ping_lock);
-      ping_thread_error = 1;
+      pthread_mutex_lock (&shard->lock);
+      shard->thread_error = 1;
       break;
     }
 
-    pthread_mutex_lock (&ping_lock);
+    pthread_mutex_lock (&shard->lock);
 
-    if (ping_thread_loop <= 0)
+    if (shard->thread_loop <= 0)
       break;
 
     for (iter = ping_iterator_get (pingobj);
         iter != NULL;
         iter = ping_iterator_next (iter))
     { /* {{{ */
-      char userhost[NI_MAXHOST];
+      hostlist_t *hl;
       double latency;
       size_t param_size;
 
-      param_size = sizeof (userhost);
-      status = ping_iterator_get_info (iter,
-#ifdef PING_INFO_USERNAME
-          PING_INFO_USERNAME,
-#else
-          PING_INFO_HOSTNAME,
-#endif
-          userhost, &param_size);
-      if (status != 0)
-      {
-        WARNING ("ping plugin: ping_iterator_get_info failed: %s",
-            ping_get_error (pingobj));
-        continue;
-      }
-
-      for (hl = hostlist_head; hl != NULL; hl = hl->next)
-        if (strcmp (userhost, hl->host) == 0)
-          break;
-
+      hl = ping_iterator_host (pingobj, iter, by_name);
       if (hl == NULL)
-      {
-        WARNING ("ping plugin: Cannot find host %s.", userhost);
         continue;
-      }
 
       param_size = sizeof (latency);
       status = ping_iterator_get_info (iter, PING_INFO_LATENCY,
@@ -307,28 +373,46 @@ static void *ping_thread (void *arg) /* {{{ */
         WARNING ("ping plugin: host %s has not answered %d PING requests,"
           " triggering resolve", hl->host, ping_max_missed);
 
-        /* we trigger the resolv simply be removeing and adding the host to our
-         * ping object */
-        status = ping_host_remove (pingobj, hl->host);
-        if (status != 0)
-        {
-          WARNING ("ping plugin: ping_host_remove (%s) failed.", hl->host);
-        }
-        else
-        {
-          status = ping_host_add (pingobj, hl->host);
-          if (status != 0)
-            WARNING ("ping plugin: ping_host_add (%s) failed.", hl->host);
-        }
+        /* Removing the host would free `iter', so this is done after
+         * the loop. */
+        hl->resolve = 1;
+        resolve_num++;
       } /* }}} ping_max_missed */
     } /* }}} for (iter) */
 
+    /* we trigger the resolv simply be removeing and adding the host to our
+     * ping object. The new iterator has no context yet, so the host is
+     * looked up by name after the next round. */
+    for (i = (size_t) shard->index;
+        (resolve_num > 0) && (i < hostlist_num);
+        i += (size_t) shards_num)
+    {
+      hostlist_t *hl = hostlist + i;
+
+      if (!hl->resolve)
+        continue;
+      hl->resolve = 0;
+      resolve_num--;
+
+      status = ping_host_remove (pingobj, hl->host);
+      if (status != 0)
+      {
+        WARNING ("ping plugin: ping_host_remove (%s) failed.", hl->host);
+      }
+      else
+      {
+        status = ping_host_add (pingobj, hl->host);
+        if (status != 0)
+          WARNING ("ping plugin: ping_host_add (%s) failed.", hl->host);
+      }
+    }
+
     if (gettimeofday (&tv_end, NULL) < 0)
     {
       char errbuf[1024];
       ERROR ("ping plugin: gettimeofday failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
-      ping_thread_error = 1;
+      shard->thread_error = 1;
       break;
     }
 
@@ -336,77 +420,80 @@ static void *ping_thread (void *arg) /* {{{ */
      * `ts_wait'. */
     time_calc (&ts_wait, &ts_int, &tv_begin, &tv_end);
 
-    status = pthread_cond_timedwait (&ping_cond, &ping_lock, &ts_wait);
-    if (ping_thread_loop <= 0)
+    status = pthread_cond_timedwait (&shard->cond, &shard->lock, &ts_wait);
+    if (shard->thread_loop <= 0)
       break;
-  } /* while (ping_thread_loop > 0) */
+  } /* while (shard->thread_loop > 0) */
 
-  pthread_mutex_unlock (&ping_lock);
+  pthread_mutex_unlock (&shard->lock);
   ping_destroy (pingobj);
+  c_avl_destroy (by_name);
 
   return ((void *) 0);
 } /* }}} void *ping_thread */
 
-static int start_thread (void) /* {{{ */
+static int start_thread (ping_shard_t *shard) /* {{{ */
 {
   int status;
 
-  pthread_mutex_lock (&ping_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (ping_thread_loop != 0)
+  if (shard->thread_loop != 0)
   {
-    pthread_mutex_unlock (&ping_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
-  ping_thread_loop = 1;
-  ping_thread_error = 0;
-  status = pthread_create (&ping_thread_id, /* attr = */ NULL,
-      ping_thread, /* arg = */ (void *) 0);
+  shard->thread_loop = 1;
+  shard->thread_error = 0;
+  status = pthread_create (&shard->thread_id, /* attr = */ NULL,
+      ping_thread, /* arg = */ (void *) shard);
   if (status != 0)
   {
-    ping_thread_loop = 0;
+    shard->thread_loop = 0;
     ERROR ("ping plugin: Starting thread failed.");
-    pthread_mutex_unlock (&ping_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
-    
-  pthread_mutex_unlock (&ping_lock);
+
+  pthread_mutex_unlock (&shard->lock);
   return (0);
 } /* }}} int start_thread */
 
-static int stop_thread (void) /* {{{ */
+static int stop_thread (ping_shard_t *shard) /* {{{ */
 {
   int status;
 
-  pthread_mutex_lock (&ping_lock);
+  pthread_mutex_lock (&shard->lock);
 
-  if (ping_thread_loop == 0)
+  if (shard->thread_loop == 0)
   {
-    pthread_mutex_unlock (&ping_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-1);
   }
 
-  ping_thread_loop = 0;
-  pthread_cond_broadcast (&ping_cond);
-  pthread_mutex_unlock (&ping_lock);
+  shard->thread_loop = 0;
+  pthread_cond_broadcast (&shard->cond);
+  pthread_mutex_unlock (&shard->lock);
 
-  status = pthread_join (ping_thread_id, /* return = */ NULL);
+  status = pthread_join (shard->thread_id, /* return = */ NULL);
   if (status != 0)
   {
     ERROR ("ping plugin: Stopping thread failed.");
     status = -1;
   }
 
-  memset (&ping_thread_id, 0, sizeof (ping_thread_id));
-  ping_thread_error = 0;
+  memset (&shard->thread_id, 0, sizeof (shard->thread_id));
+  shard->thread_error = 0;
 
   return (status);
 } /* }}} int stop_thread */
 
 static int ping_init (void) /* {{{ */
 {
-  if (hostlist_head == NULL)
+  int i;
+
+  if (hostlist_num == 0)
   {
     NOTICE ("ping plugin: No hosts have been configured.");
     return (-1);
@@ -419,8 +506,28 @@ static int ping_init (void) /* {{{ */
         "Will use a timeout of %gs.", ping_timeout);
   }
 
-  if (start_thread () != 0)
+  shards_num = ping_threads;
+  if ((size_t) shards_num > hostlist_num)
+    shards_num = (int) hostlist_num;
+
+  shards = calloc ((size_t) shards_num, sizeof (*shards));
+  if (shards == NULL)
+  {
+    ERROR ("ping plugin: calloc failed.");
+    shards_num = 0;
     return (-1);
+  }
+
+  for (i = 0; i < shards_num; i++)
+  {
+    shards[i].index = i;
+    pthread_mutex_init (&shards[i].lock, /* attr = */ NULL);
+    pthread_cond_init (&shards[i].cond, /* attr = */ NULL);
+  }
+
+  for (i = 0; i < shards_num; i++)
+    if (start_thread (shards + i) != 0)
+      return (-1);
 
   return (0);
 } /* }}} int ping_init */
@@ -452,33 +559,29 @@ static int ping_config (const char *key, const char *value) /* {{{ */
     hostlist_t *hl;
     char *host;
 
-    hl = (hostlist_t *) malloc (sizeof (hostlist_t));
+    hl = realloc (hostlist, (hostlist_num + 1) * sizeof (*hostlist));
     if (hl == NULL)
     {
       char errbuf[1024];
-      ERROR ("ping plugin: malloc failed: %s",
+      ERROR ("ping plugin: realloc failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
       return (1);
     }
+    hostlist = hl;
 
     host = strdup (value);
     if (host == NULL)
     {
       char errbuf[1024];
-      sfree (hl);
       ERROR ("ping plugin: strdup failed: %s",
           sstrerror (errno, errbuf, sizeof (errbuf)));
       return (1);
     }
 
+    hl = hostlist + hostlist_num;
+    memset (hl, 0, sizeof (*hl));
     hl->host = host;
-    hl->pkg_sent = 0;
-    hl->pkg_recv = 0;
-    hl->pkg_missed = 0;
-    hl->latency_total = 0.0;
-    hl->latency_squared = 0.0;
-    hl->next = hostlist_head;
-    hostlist_head = hl;
+    hostlist_num++;
   }
   else if (strcasecmp (key, "SourceAddress") == 0)
   {
@@ -530,6 +633,14 @@ static int ping_config (const char *key, const char *value) /* {{{ */
     if (ping_max_missed < 0)
       INFO ("ping plugin: MaxMissed < 0, disabled re-resolving of hosts");
   }
+  else if (strcasecmp (key, "Threads") == 0)
+  {
+    int tmp = atoi (value);
+    if (tmp > 0)
+      ping_threads = tmp;
+    else
+      WARNING ("ping plugin: Ignoring invalid number of threads %i.", tmp);
+  }
   else
   {
     return (-1);
@@ -559,29 +670,41 @@ static void submit (const char *host, const char *type, /* {{{ */
 
 static int ping_read (void) /* {{{ */
 {
-  hostlist_t *hl;
+  size_t i;
+  int j;
 
-  if (ping_thread_error != 0)
+  if (shards_num == 0)
+    return (-1);
+
+  for (j = 0; j < shards_num; j++)
   {
-    ERROR ("ping plugin: The ping thread had a problem. Restarting it.");
+    ping_shard_t *shard = shards + j;
+
+    if (shard->thread_error == 0)
+      continue;
+
+    ERROR ("ping plugin: Ping thread %i had a problem. Restarting it.", j);
 
-    stop_thread ();
+    stop_thread (shard);
 
-    for (hl = hostlist_head; hl != NULL; hl = hl->next)
+    pthread_mutex_lock (&shard->lock);
+    for (i = (size_t) j; i < hostlist_num; i += (size_t) shards_num)
     {
-      hl->pkg_sent = 0;
-      hl->pkg_recv = 0;
-      hl->latency_total = 0.0;
-      hl->latency_squared = 0.0;
+      hostlist[i].pkg_sent = 0;
+      hostlist[i].pkg_recv = 0;
+      hostlist[i].latency_total = 0.0;
+      hostlist[i].latency_squared = 0.0;
     }
+    pthread_mutex_unlock (&shard->lock);
 
-    start_thread ();
+    start_thread (shard);
+  } /* for (shards) */
 
-    return (-1);
-  } /* if (ping_thread_error != 0) */
-
-  for (hl = hostlist_head; hl != NULL; hl = hl->next) /* {{{ */
+  for (i = 0; i < hostlist_num; i++) /* {{{ */
   {
+    hostlist_t *hl = hostlist + i;
+    ping_shard_t *shard = shards + (i % (size_t) shards_num);
+
     uint32_t pkg_sent;
     uint32_t pkg_recv;
     double latency_total;
@@ -592,9 +715,9 @@ static int ping_read (void) /* {{{ */
 
     double droprate;
 
-    /* Locking here works, because the structure of the linked list is only
-     * changed during configure and shutdown. */
-    pthread_mutex_lock (&ping_lock);
+    /* Locking here works, because the host array is only changed during
+     * configure and shutdown. */
+    pthread_mutex_lock (&shard->lock);
 
     pkg_sent = hl->pkg_sent;
     pkg_recv = hl->pkg_recv;
@@ -606,7 +729,7 @@ static int ping_read (void) /* {{{ */
     hl->latency_total = 0.0;
     hl->latency_squared = 0.0;
 
-    pthread_mutex_unlock (&ping_lock);
+    pthread_mutex_unlock (&shard->lock);
 
     /* This e. g. happens when starting up. */
     if (pkg_sent == 0)
@@ -638,31 +761,30 @@ static int ping_read (void) /* {{{ */
     submit (hl->host, "ping", latency_average);
     submit (hl->host, "ping_stddev", latency_stddev);
     submit (hl->host, "ping_droprate", droprate);
-  } /* }}} for (hl = hostlist_head; hl != NULL; hl = hl->next) */
+  } /* }}} for (i = 0; i < hostlist_num; i++) */
 
   return (0);
 } /* }}} int ping_read */
 
 static int ping_shutdown (void) /* {{{ */
 {
-  hostlist_t *hl;
-
-  INFO ("ping plugin: Shutting down thread.");
-  if (stop_thread () < 0)
-    return (-1);
+  size_t i;
+  int j;
 
-  hl = hostlist_head;
-  while (hl != NULL)
+  INFO ("ping plugin: Shutting down threads.");
+  for (j = 0; j < shards_num; j++)
   {
-    hostlist_t *hl_next;
-
-    hl_next = hl->next;
-
-    sfree (hl->host);
-    sfree (hl);
-
-    hl = hl_next;
+    stop_thread (shards + j);
+    pthread_mutex_destroy (&shards[j].lock);
+    pthread_cond_destroy (&shards[j].cond);
   }
+  sfree (shards);
+  shards_num = 0;
+
+  for (i = 0; i < hostlist_num; i++)
+    sfree (hostlist[i].host);
+  sfree (hostlist);
+  hostlist_num = 0;
 
   return (0);
 } /* }}} int ping_shutdown */
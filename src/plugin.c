@@ -32,10 +32,20 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
-#include "utils_avltree.h"
+#include "utils_hashtable.h"
 #include "utils_llist.h"
-#include "utils_heap.h"
+#include "utils_log_queue.h"
+#include "utils_thread.h"
+#include "utils_timerwheel.h"
+#include "utils_memory.h"
+#include "utils_notif_queue.h"
+#include "utils_pipeline.h"
+#include "utils_probes.h"
+#include "utils_spool.h"
 #include "utils_cache.h"
+#include "utils_callback_stats.h"
+#include "utils_consolidate.h"
+#include "utils_arena.h"
 #include "filter_chain.h"
 
 /*
@@ -45,6 +55,17 @@ struct callback_func_s
 {
 	void *cf_callback;
 	user_data_t cf_udata;
+	/* Only used by init callbacks, see `plugin_register_init_parallel'. */
+	_Bool cf_parallel;
+	/* Only used by read and write callbacks if `CallbackStatistics' is
+	 * enabled. Set on the first call. */
+	callback_stats_t *cf_stats;
+	/* Only used by write callbacks if `PipelineTracing' is enabled. Set on
+	 * the first call. */
+	pipeline_stats_t *cf_trace;
+	/* Only used by write callbacks: set for `write_batch_add', whose values
+	 * are written when the batch is passed on. */
+	_Bool cf_batch;
 };
 typedef struct callback_func_s callback_func_t;
 
@@ -60,20 +81,309 @@ struct read_func_s
 	callback_func_t rf_super;
 	char rf_group[DATA_MAX_NAME_LEN];
 	char rf_name[DATA_MAX_NAME_LEN];
-	int rf_type;
-	struct timespec rf_interval;
-	struct timespec rf_effective_interval;
-	struct timespec rf_next_read;
+	/* Only changed to RF_REMOVE by `plugin_unregister_read', with
+	 * `read_lock' held. Readers may see the old value and call the
+	 * function one more time. */
+	volatile int rf_type;
+	cdtime_t rf_interval;
+	cdtime_t rf_effective_interval;
+	/* `rf_timer.due' is the next read, in `cdtime_monotonic' time, and
+	 * `rf_timer.next' links the function in the scheduler's lists. */
+	c_timer_t rf_timer;
+	/* From the `ReadTimeout' and `SlowReads' options of the plugin. */
+	cdtime_t rf_timeout;
+	_Bool rf_slow;
+	int rf_overruns;
 };
 typedef struct read_func_s read_func_t;
 
+/* Options of a `LoadPlugin' block for the plugin's read functions, see
+ * `plugin_set_read_options'. */
+struct read_options_s
+{
+	char plugin[DATA_MAX_NAME_LEN];
+	cdtime_t timeout;
+	_Bool slow;
+	struct read_options_s *next;
+};
+typedef struct read_options_s read_options_t;
+
+/* A plugin whose loading has been deferred, see `plugin_load_deferred'. */
+struct deferred_plugin_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	uint32_t flags;
+	struct deferred_plugin_s *next;
+};
+typedef struct deferred_plugin_s deferred_plugin_t;
+
+/* The time it took to load a plugin, for `ReportStartupTimes'. */
+struct load_time_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	cdtime_t duration;
+	struct load_time_s *next;
+};
+typedef struct load_time_s load_time_t;
+
+#define RF_FROM_TIMER(t) ((read_func_t *) (((char *) (t)) \
+			- offsetof (read_func_t, rf_timer)))
+
+/* Every read thread takes the functions to call from its own queue, which
+ * the scheduler thread fills from the timer wheel. If its queue is empty, a
+ * read thread takes functions from the other queues before it sleeps.
+ * Functions which have been called are handed back to the scheduler using
+ * `read_pending', without a lock. */
+#define READ_WHEEL_RESOLUTION MS_TO_CDTIME_T (10)
+struct read_queue_s
+{
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	c_timer_t *head;
+	c_timer_t *tail;
+	int length;
+	/* The thread is waiting or about to wait for `cond'. */
+	_Bool idle;
+	/* The thread has been woken up and should look for work. */
+	_Bool kick;
+	pthread_t thread;
+	/* READ_GROUP_DEFAULT or READ_GROUP_SLOW. Threads only take functions
+	 * from the queues of their own group. */
+	int group;
+
+	/* The function being called and since when, for the watchdog. */
+	read_func_t *running;
+	cdtime_t running_since;
+	_Bool overrun_reported;
+};
+typedef struct read_queue_s read_queue_t;
+
+#define READ_GROUP_DEFAULT 0
+#define READ_GROUP_SLOW    1
+
+#define WQ_DROP_OLDEST 0
+#define WQ_DROP_NEWEST 1
+#define WQ_BLOCK       2
+
+/* A value list which has been handed to one or more write queues. The same
+ * element is shared by all queues, so the values and meta data are copied
+ * only once per dispatch. `wqe_refcount' is only changed atomically. */
+struct write_queue_elem_s
+{
+	const data_set_t *wqe_ds;
+	value_list_t wqe_vl;
+	int wqe_refcount;
+};
+typedef struct write_queue_elem_s write_queue_elem_t;
+
+/* A ring buffer of `wr_limit' element pointers, drained by one worker
+ * thread. */
+struct write_queue_s;
+struct write_ring_s
+{
+	struct write_queue_s *wr_queue;
+
+	pthread_mutex_t wr_lock;
+	pthread_cond_t  wr_cond_data;
+	pthread_cond_t  wr_cond_space;
+
+	write_queue_elem_t **wr_elems;
+	size_t wr_limit;
+	size_t wr_head;
+	size_t wr_length;
+
+	int wr_loop;
+	pthread_t wr_thread;
+	_Bool wr_thread_running;
+
+	uint64_t wr_dropped;
+};
+typedef struct write_ring_s write_ring_t;
+
+/* One queue per registered write callback, with one ring per worker thread.
+ * Each value list goes to the ring picked by the hash of its identifier, so
+ * all values of an identifier are written by the same thread, in order. */
+struct write_queue_s
+{
+	char wq_name[DATA_MAX_NAME_LEN];
+	callback_func_t *wq_cf;
+
+	write_ring_t *wq_rings;
+	size_t wq_rings_num;
+
+	struct write_queue_s *next;
+};
+typedef struct write_queue_s write_queue_t;
+
+/* The spool of a writer whose plugin has a `SpoolDirectory'. Values the
+ * writer fails to write are appended to `ws_spool', and so are all values
+ * while it isn't empty, so that the writer receives them in order. They are
+ * passed to the writer again, at `ws_rate' value lists per second, when it
+ * has recovered. Plain writers are registered as `write_spool_add' with this
+ * structure as user data, batch writers keep it in `wb_spool'. */
+/* A write callback looked up by name once, see `plugin_write_handle_create'.
+ * The lookup is repeated when `wh_generation' is outdated; `wh_lock' only
+ * serializes these lookups. */
+struct plugin_write_handle_s
+{
+	char wh_name[DATA_MAX_NAME_LEN];
+	char wh_key[DATA_MAX_NAME_LEN];
+	callback_func_t *wh_cf;
+	write_queue_t *wh_wq;
+	unsigned int wh_generation;
+	pthread_mutex_t wh_lock;
+};
+
+struct write_batch_s;
+struct write_spool_s
+{
+	char ws_name[DATA_MAX_NAME_LEN];
+	spool_t *ws_spool;
+	pthread_mutex_t ws_lock;
+
+	/* The writer's callback, or its batch for batch writers. */
+	plugin_write_cb ws_callback;
+	user_data_t ws_udata;
+	struct write_batch_s *ws_batch;
+
+	/* Zero if replaying isn't limited. */
+	double   ws_rate;
+	double   ws_credit;
+	cdtime_t ws_last_replay;
+	/* Values aren't passed to the writer before this time after it
+	 * failed. */
+	cdtime_t ws_retry;
+	c_complain_t ws_complaint;
+};
+typedef struct write_spool_s write_spool_t;
+
+/* Replaying reads this many value lists from the spool at a time and at
+ * most `WRITE_SPOOL_REPLAY_MAX' per call, so that a long outage doesn't keep
+ * the writer's thread busy for long. */
+#define WRITE_SPOOL_CHUNK      64
+#define WRITE_SPOOL_REPLAY_MAX 1024
+
+/* A write callback registered with `plugin_register_write_batch'. It is
+ * registered as a regular write callback, `write_batch_add', with this
+ * structure as user data, so the write queues and `plugin_write' treat it
+ * like any other writer. Value lists are copied into `wb_elems' until
+ * `wb_size' have been collected or the oldest one is `wb_timeout' old. */
+struct write_batch_s
+{
+	char wb_name[DATA_MAX_NAME_LEN];
+	plugin_write_batch_cb wb_callback;
+	user_data_t wb_udata;
+
+	size_t   wb_size;
+	cdtime_t wb_timeout;
+
+	pthread_mutex_t wb_lock;
+	write_queue_elem_t **wb_elems;
+	size_t   wb_num;
+	cdtime_t wb_first;
+
+	/* NULL unless the plugin has a `SpoolDirectory'. */
+	write_spool_t *wb_spool;
+
+	/* Only used if `PipelineTracing' is enabled. Set on the first call. */
+	pipeline_stats_t *wb_trace;
+};
+typedef struct write_batch_s write_batch_t;
+
+/* Options of a `LoadPlugin' block for the plugin's write callbacks, see
+ * `plugin_set_write_options'. */
+struct write_options_s
+{
+	char plugin[DATA_MAX_NAME_LEN];
+	cdtime_t interval;
+	int consolidation;
+	/* NULL unless the plugin has a `SpoolDirectory'. */
+	char *spool_dir;
+	uint64_t spool_size;
+	double spool_rate;
+	struct write_options_s *next;
+};
+typedef struct write_options_s write_options_t;
+
+/* A write callback whose plugin has a `WriteInterval'. Like batch writers,
+ * it is registered as `write_consolidate_add' with this structure as user
+ * data, and passes one value list per identifier and interval on to the
+ * plugin's callback. `wc_batch' is set for batch writers, whose batch is
+ * flushed together with the consolidated values. */
+struct write_consolidate_s
+{
+	consolidate_t *wc_cons;
+	write_batch_t *wc_batch;
+};
+typedef struct write_consolidate_s write_consolidate_t;
+
+/* An init callback, copied from `list_init' by `plugin_init_all'. Init
+ * callbacks registered with `plugin_register_init_parallel' are run by the
+ * init threads, all others by the main thread in the order of registration. */
+struct init_job_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	plugin_init_cb callback;
+	_Bool parallel;
+	int status;
+	cdtime_t duration;
+};
+typedef struct init_job_s init_job_t;
+
+struct init_pool_s
+{
+	init_job_t *jobs;
+	size_t jobs_num;
+	/* Next job to check for the init threads. */
+	size_t next;
+	pthread_mutex_t lock;
+};
+typedef struct init_pool_s init_pool_t;
+
+/* A flush callback called by `plugin_flush', possibly by a thread of its
+ * own. */
+struct flush_call_s
+{
+	const char *name;
+	callback_func_t *cf;
+	cdtime_t timeout;
+	const char *identifier;
+	pthread_t thread;
+	_Bool thread_running;
+};
+typedef struct flush_call_s flush_call_t;
+
+/* A flush started by `plugin_flush_async'. A NULL entry in `plugins' or
+ * `identifiers' stands for all of them. */
+struct flush_job_s
+{
+	uint64_t token;
+	char   **plugins;
+	size_t   plugins_num;
+	char   **identifiers;
+	size_t   identifiers_num;
+	cdtime_t timeout;
+
+	_Bool done;
+	int   success;
+	int   error;
+
+	struct flush_job_s *next;
+};
+typedef struct flush_job_s flush_job_t;
+
 /*
  * Private variables
  */
+/* Protects the callback lists while parallel init callbacks may register
+ * further callbacks. */
+static pthread_mutex_t register_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static llist_t *list_init;
 static llist_t *list_write;
 static llist_t *list_flush;
 static llist_t *list_missing;
+static llist_t *list_range;
 static llist_t *list_shutdown;
 static llist_t *list_log;
 static llist_t *list_notification;
@@ -81,17 +391,123 @@ static llist_t *list_notification;
 static fc_chain_t *pre_cache_chain = NULL;
 static fc_chain_t *post_cache_chain = NULL;
 
-static c_avl_tree_t *data_sets;
+/* State of a value list while it is processed by the filter chains. Targets
+ * get the caller's `values' array; it is only copied, to `scratch' or, if it
+ * doesn't fit, to the thread's arena, when a target calls
+ * `plugin_dispatch_values_writable'. The context of the value list whose
+ * chains are running is stored in `dispatch_ctx_key'. */
+#define DISPATCH_SCRATCH_VALUES 8
+struct dispatch_ctx_s
+{
+	value_list_t *vl;
+	value_t *saved_values;
+	int      saved_values_len;
+	/* Array passed to `plugin_dispatch_values_replace', if any. */
+	value_t *owned;
+	value_t  scratch[DISPATCH_SCRATCH_VALUES];
+	struct dispatch_ctx_s *prev;
+
+	vl_identifier_t  identifier;
+	vl_identifier_t *saved_identifier;
+};
+typedef struct dispatch_ctx_s dispatch_ctx_t;
+
+static pthread_key_t dispatch_ctx_key;
+static pthread_once_t dispatch_ctx_once = PTHREAD_ONCE_INIT;
+
+/* Registered data sets by name. The entries are `plugin_data_set_t's, so the
+ * ID of a type is known once it has been looked up. */
+static c_hashtable_t *data_sets;
+
+struct plugin_data_set_s
+{
+	data_set_t ds;
+	int        id;
+};
+typedef struct plugin_data_set_s plugin_data_set_t;
+
+/* Registered data sets by ID. The array of chunks doesn't grow, so lookups
+ * never see a pointer that has been moved. */
+#define TYPE_ID_CHUNK_SIZE 256
+#define TYPE_ID_CHUNKS     256
+static plugin_data_set_t **type_ids[TYPE_ID_CHUNKS];
+static int type_ids_num = 0;
+
+/* Returns the data set of `vl', using its type ID if it is still valid. */
+static const data_set_t *plugin_vl_get_ds (const value_list_t *vl) /* {{{ */
+{
+	const data_set_t *ds;
+
+	ds = plugin_get_ds_by_id (vl->type_id);
+	if ((ds != NULL) && (strcmp (ds->type, vl->type) == 0))
+		return (ds);
+
+	return (plugin_get_ds (vl->type));
+} /* }}} const data_set_t *plugin_vl_get_ds */
+
+static _Bool           callback_stats_enabled = 0;
 
 static char *plugindir = NULL;
 
-static c_heap_t       *read_heap = NULL;
+/* `read_lock' protects `read_list' and the `rf_type' field. */
 static llist_t        *read_list;
-static int             read_loop = 1;
+static volatile int    read_loop = 1;
 static pthread_mutex_t read_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  read_cond = PTHREAD_COND_INITIALIZER;
-static pthread_t      *read_threads = NULL;
+/* The first `read_default_num' queues belong to READ_GROUP_DEFAULT, the
+ * others to READ_GROUP_SLOW. */
+static read_queue_t   *read_queues = NULL;
 static int             read_threads_num = 0;
+static int             read_default_num = 0;
+/* Only changed while reading the configuration. */
+static read_options_t *read_options = NULL;
+
+/* Only used while the configuration is read, so no lock is needed. */
+static deferred_plugin_t *deferred_plugins = NULL;
+static load_time_t       *load_times = NULL;
+static load_time_t       *load_times_tail = NULL;
+static cdtime_t           config_duration = 0;
+static write_options_t *write_options = NULL;
+/* How often the scheduler checks for read functions exceeding their
+ * timeout. Zero if no timeout is configured. */
+static cdtime_t        read_watchdog_interval = 0;
+
+/* Read functions which are to be (re-)inserted into `read_wheel', as a
+ * lock-free stack. Only the scheduler thread, or `plugin_read_all_once' and
+ * `destroy_read_funcs' when no thread is running, take the functions. */
+static c_timer_t * volatile read_pending = NULL;
+static c_timerwheel_t *read_wheel = NULL;
+/* Set from the `PhaseSpreading' option, see `plugin_phase_align'. */
+static _Bool           phase_spreading = 0;
+/* Set from the `CacheReadTime' option. The values dispatched by one read
+ * callback then share the timestamp taken before it was called. */
+static _Bool           read_time_cached = 0;
+static pthread_t       read_scheduler;
+static _Bool           read_scheduler_running = 0;
+/* `read_sched_cond' is signalled when `read_pending' is no longer empty. */
+static pthread_mutex_t read_sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  read_sched_cond;
+
+static write_queue_t   *write_queues = NULL;
+static int              write_queues_threads = 0;
+static size_t           write_queues_limit = 0;
+static int              write_queues_policy = WQ_DROP_OLDEST;
+static const char      *write_queues_cpus = NULL;
+static pthread_rwlock_t write_queues_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Incremented, with `write_queues_lock' held for writing, whenever a write
+ * callback or queue is added or removed, so write handles know when to look
+ * up their callback again. */
+static unsigned int     write_generation = 1;
+
+/* Flush jobs, newest first. The last `FLUSH_JOBS_KEEP' finished jobs are kept
+ * so their outcome can be queried. `flush_jobs_cond' is signalled whenever a
+ * job finishes. */
+#define FLUSH_JOBS_KEEP 64
+static flush_job_t     *flush_jobs = NULL;
+static uint64_t         flush_jobs_token = 0;
+static int              flush_jobs_running = 0;
+static _Bool            flush_jobs_closed = 0;
+static pthread_mutex_t  flush_jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   flush_jobs_cond = PTHREAD_COND_INITIALIZER;
 
 /*
  * Static functions
@@ -143,25 +559,29 @@ static void destroy_all_callbacks (llist_t **list) /* {{{ */
 	*list = NULL;
 } /* }}} void destroy_all_callbacks */
 
-static void destroy_read_heap (void) /* {{{ */
+static void destroy_read_list (c_timer_t *t) /* {{{ */
 {
-	if (read_heap == NULL)
-		return;
-
-	while (42)
+	while (t != NULL)
 	{
-		callback_func_t *cf;
-
-		cf = c_heap_get_root (read_heap);
-		if (cf == NULL)
-			break;
+		c_timer_t *next = t->next;
 
-		destroy_callback (cf);
+		destroy_callback ((callback_func_t *) RF_FROM_TIMER (t));
+		t = next;
 	}
+} /* }}} void destroy_read_list */
+
+/* Frees all read functions. The read threads must have been stopped. */
+static void destroy_read_funcs (void) /* {{{ */
+{
+	destroy_read_list (__sync_lock_test_and_set (&read_pending, NULL));
 
-	c_heap_destroy (read_heap);
-	read_heap = NULL;
-} /* }}} void destroy_read_heap */
+	if (read_wheel != NULL)
+	{
+		destroy_read_list (c_timerwheel_take_all (read_wheel));
+		c_timerwheel_destroy (read_wheel);
+		read_wheel = NULL;
+	}
+} /* }}} void destroy_read_funcs */
 
 static int register_callback (llist_t **list, /* {{{ */
 		const char *name, callback_func_t *cf)
@@ -169,11 +589,14 @@ static int register_callback (llist_t **list, /* {{{ */
 	llentry_t *le;
 	char *key;
 
+	pthread_mutex_lock (&register_lock);
+
 	if (*list == NULL)
 	{
 		*list = llist_create ();
 		if (*list == NULL)
 		{
+			pthread_mutex_unlock (&register_lock);
 			ERROR ("plugin: register_callback: "
 					"llist_create failed.");
 			destroy_callback (cf);
@@ -184,6 +607,7 @@ static int register_callback (llist_t **list, /* {{{ */
 	key = strdup (name);
 	if (key == NULL)
 	{
+		pthread_mutex_unlock (&register_lock);
 		ERROR ("plugin: register_callback: strdup failed.");
 		destroy_callback (cf);
 		return (-1);
@@ -195,6 +619,7 @@ static int register_callback (llist_t **list, /* {{{ */
 		le = llentry_create (key, cf);
 		if (le == NULL)
 		{
+			pthread_mutex_unlock (&register_lock);
 			ERROR ("plugin: register_callback: "
 					"llentry_create failed.");
 			free (key);
@@ -219,6 +644,7 @@ static int register_callback (llist_t **list, /* {{{ */
 		sfree (key);
 	}
 
+	pthread_mutex_unlock (&register_lock);
 	return (0);
 } /* }}} int register_callback */
 
@@ -256,11 +682,16 @@ static int plugin_unregister (llist_t *list, const char *name) /* {{{ */
 	if (list == NULL)
 		return (-1);
 
+	pthread_mutex_lock (&register_lock);
 	e = llist_search (list, name);
 	if (e == NULL)
+	{
+		pthread_mutex_unlock (&register_lock);
 		return (-1);
+	}
 
 	llist_remove (list, e);
+	pthread_mutex_unlock (&register_lock);
 
 	sfree (e->key);
 	destroy_callback (e->value);
@@ -334,80 +765,245 @@ static int plugin_load_file (char *file, uint32_t flags)
 	return (0);
 }
 
-static _Bool timeout_reached(struct timespec timeout)
+/* Hands `rf' to the scheduler. */
+static void read_pending_push (read_func_t *rf) /* {{{ */
 {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	return (now.tv_sec >= timeout.tv_sec && now.tv_usec >= (timeout.tv_nsec / 1000));
-}
+	c_timer_t *head;
+
+	do
+	{
+		head = read_pending;
+		rf->rf_timer.next = head;
+	} while (!__sync_bool_compare_and_swap (&read_pending, head,
+				&rf->rf_timer));
+
+	/* The scheduler checks `read_pending' with `read_sched_lock' held
+	 * before it sleeps, so it only has to be woken up after it has
+	 * taken all functions. */
+	if ((head == NULL) && read_scheduler_running)
+	{
+		pthread_mutex_lock (&read_sched_lock);
+		pthread_cond_signal (&read_sched_cond);
+		pthread_mutex_unlock (&read_sched_lock);
+	}
+} /* }}} void read_pending_push */
 
-static void *plugin_read_thread (void __attribute__((unused)) *args)
+/* Must be called with `q->lock' held. */
+static read_func_t *read_queue_pop_locked (read_queue_t *q) /* {{{ */
 {
-	while (read_loop != 0)
+	c_timer_t *t;
+
+	t = q->head;
+	if (t == NULL)
+		return (NULL);
+
+	q->head = t->next;
+	if (q->head == NULL)
+		q->tail = NULL;
+	q->length--;
+
+	return (RF_FROM_TIMER (t));
+} /* }}} read_func_t *read_queue_pop_locked */
+
+static read_func_t *read_queue_pop (read_queue_t *q) /* {{{ */
+{
+	read_func_t *rf;
+
+	pthread_mutex_lock (&q->lock);
+	rf = read_queue_pop_locked (q);
+	pthread_mutex_unlock (&q->lock);
+
+	return (rf);
+} /* }}} read_func_t *read_queue_pop */
+
+static void read_group_range (int group, int *first, int *num) /* {{{ */
+{
+	if (group == READ_GROUP_SLOW)
+	{
+		*first = read_default_num;
+		*num = read_threads_num - read_default_num;
+	}
+	else
+	{
+		*first = 0;
+		*num = read_default_num;
+	}
+} /* }}} void read_group_range */
+
+/* Takes a function from another thread's queue, whose thread is busy. */
+static read_func_t *read_queue_steal (read_queue_t *self) /* {{{ */
+{
+	int first;
+	int num;
+	int self_index;
+	int i;
+
+	read_group_range (self->group, &first, &num);
+	self_index = (int) (self - read_queues) - first;
+
+	for (i = 1; i < num; i++)
 	{
+		read_queue_t *q = read_queues + first + ((self_index + i) % num);
 		read_func_t *rf;
-		cdtime_t now;
-		int status;
-		int rf_type;
-		int rc;
 
-		/* Get the read function that needs to be read next. */
-		rf = c_heap_get_root (read_heap);
-		if (rf == NULL)
-		{
-			struct timespec abstime;
+		rf = read_queue_pop (q);
+		if (rf != NULL)
+			return (rf);
+	}
 
-			now = cdtime ();
+	return (NULL);
+} /* }}} read_func_t *read_queue_steal */
 
-			CDTIME_T_TO_TIMESPEC (now + interval_g, &abstime);
+/* Wakes up one idle thread, so that it takes a function from a busy queue. */
+static void read_queues_kick (int group) /* {{{ */
+{
+	int first;
+	int num;
+	int i;
 
-			pthread_mutex_lock (&read_lock);
-			pthread_cond_timedwait (&read_cond, &read_lock,
-					&abstime);
-			pthread_mutex_unlock (&read_lock);
-			continue;
-		}
+	read_group_range (group, &first, &num);
+	for (i = first; i < first + num; i++)
+	{
+		read_queue_t *q = read_queues + i;
+		_Bool kicked = 0;
 
-		if ((rf->rf_interval.tv_sec == 0) && (rf->rf_interval.tv_nsec == 0))
+		pthread_mutex_lock (&q->lock);
+		if (q->idle && !q->kick)
 		{
-			now = cdtime ();
+			q->kick = 1;
+			pthread_cond_signal (&q->cond);
+			kicked = 1;
+		}
+		pthread_mutex_unlock (&q->lock);
 
-			CDTIME_T_TO_TIMESPEC (interval_g, &rf->rf_interval);
+		if (kicked)
+			return;
+	}
+} /* }}} void read_queues_kick */
 
-			rf->rf_effective_interval = rf->rf_interval;
+/* Called by the scheduler thread: appends `rf' to the queue of an idle
+ * thread or, if all threads are busy, to the shortest queue. */
+static void read_queues_dispatch (read_func_t *rf) /* {{{ */
+{
+	read_queue_t *best = NULL;
+	int best_length = 0;
+	_Bool idle;
+	int group;
+	int first;
+	int num;
+	int i;
 
-			CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
-		}
+	/* Without slow threads, slow functions are called by the others. */
+	group = READ_GROUP_DEFAULT;
+	if (rf->rf_slow && (read_threads_num > read_default_num))
+		group = READ_GROUP_SLOW;
+	read_group_range (group, &first, &num);
 
-		/* sleep until this entry is due,
-		 * using pthread_cond_timedwait */
-		pthread_mutex_lock (&read_lock);
-		/* In pthread_cond_timedwait, spurious wakeups are possible
-		 * (and really happen, at least on NetBSD with > 1 CPU), thus
-		 * we need to re-evaluate the condition every time
-		 * pthread_cond_timedwait returns. */
-		rc = 0;
-		while ((read_loop != 0)
-				&& !timeout_reached(rf->rf_next_read)
-				&& rc == 0)
+	for (i = first; i < first + num; i++)
+	{
+		read_queue_t *q = read_queues + i;
+		_Bool found = 0;
+
+		pthread_mutex_lock (&q->lock);
+		if (q->idle && (q->head == NULL))
+			found = 1;
+		if (found || (best == NULL) || (q->length < best_length))
 		{
-			rc = pthread_cond_timedwait (&read_cond, &read_lock,
-				&rf->rf_next_read);
+			best = q;
+			best_length = q->length;
 		}
+		pthread_mutex_unlock (&q->lock);
 
-		/* Must hold `read_lock' when accessing `rf->rf_type'. */
-		rf_type = rf->rf_type;
-		pthread_mutex_unlock (&read_lock);
+		if (found)
+			break;
+	}
+
+	rf->rf_timer.next = NULL;
+
+	pthread_mutex_lock (&best->lock);
+	if (best->tail == NULL)
+		best->head = &rf->rf_timer;
+	else
+		best->tail->next = &rf->rf_timer;
+	best->tail = &rf->rf_timer;
+	best->length++;
+
+	idle = best->idle;
+	if (idle)
+	{
+		best->kick = 1;
+		pthread_cond_signal (&best->cond);
+	}
+	pthread_mutex_unlock (&best->lock);
+
+	/* A thread may have become idle since it was looked at above. Threads
+	 * look at all queues after marking themselves idle, so checking for them
+	 * after the function has been added is enough. */
+	if (!idle)
+		read_queues_kick (group);
+} /* }}} void read_queues_dispatch */
+
+/* Returns the next function to call or NULL if the thread should check
+ * `read_loop'. */
+static read_func_t *read_queue_get (read_queue_t *q) /* {{{ */
+{
+	read_func_t *rf;
+
+	rf = read_queue_pop (q);
+	if (rf == NULL)
+		rf = read_queue_steal (q);
+	if (rf != NULL)
+		return (rf);
+
+	pthread_mutex_lock (&q->lock);
+	q->idle = 1;
+	pthread_mutex_unlock (&q->lock);
+
+	/* Look again, see `read_queues_dispatch'. */
+	rf = read_queue_pop (q);
+	if (rf == NULL)
+		rf = read_queue_steal (q);
+
+	pthread_mutex_lock (&q->lock);
+	while ((rf == NULL) && (read_loop != 0) && !q->kick)
+	{
+		pthread_cond_wait (&q->cond, &q->lock);
+		rf = read_queue_pop_locked (q);
+	}
+	q->idle = 0;
+	q->kick = 0;
+	pthread_mutex_unlock (&q->lock);
+
+	return (rf);
+} /* }}} read_func_t *read_queue_get */
+
+static void *plugin_read_thread (void *args) /* {{{ */
+{
+	read_queue_t *q = args;
+
+	while (read_loop != 0)
+	{
+		read_func_t *rf;
+		cdtime_t start;
+		cdtime_t now;
+		int status;
+		int rf_type;
+		arena_mark_t mark;
 
-		/* Check if we're supposed to stop.. This may have interrupted
-		 * the sleep, too. */
+		rf = read_queue_get (q);
+		if (rf == NULL)
+			continue;
+
+		/* Check if we're supposed to stop.. */
 		if (read_loop == 0)
 		{
-			/* Insert `rf' again, so it can be free'd correctly */
-			c_heap_insert (read_heap, rf);
+			/* Hand `rf' back, so it can be free'd correctly */
+			read_pending_push (rf);
 			break;
 		}
 
+		rf_type = rf->rf_type;
+
 		/* The entry has been marked for deletion. The linked list
 		 * entry has already been removed by `plugin_unregister_read'.
 		 * All we have to do here is free the `read_func_t' and
@@ -423,6 +1019,18 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 
 		DEBUG ("plugin_read_thread: Handling `%s'.", rf->rf_name);
 
+		start = cdtime_monotonic ();
+		pthread_mutex_lock (&q->lock);
+		q->running = rf;
+		q->running_since = start;
+		q->overrun_reported = 0;
+		pthread_mutex_unlock (&q->lock);
+
+		if (read_time_cached)
+			cdtime_cache_set (cdtime_coarse ());
+
+		mark = arena_mark ();
+
 		if (rf_type == RF_SIMPLE)
 		{
 			int (*callback) (void);
@@ -440,24 +1048,45 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 			status = (*callback) (&rf->rf_udata);
 		}
 
+		arena_release (mark);
+
+		if (read_time_cached)
+			cdtime_cache_set (0);
+
+		if (callback_stats_enabled)
+			callback_stats_add (&rf->rf_super.cf_stats, "read",
+					rf->rf_name, start, status);
+
+		/* update the ``next read due'' field */
+		now = cdtime_monotonic ();
+
+		pthread_mutex_lock (&q->lock);
+		q->running = NULL;
+		pthread_mutex_unlock (&q->lock);
+
+		if ((rf->rf_timeout > 0) && ((now - start) > rf->rf_timeout))
+		{
+			rf->rf_overruns++;
+			WARNING ("read-function of plugin `%s' took %.3f seconds, "
+					"which exceeds its timeout of %.3f seconds "
+					"(%i time(s) so far).", rf->rf_name,
+					CDTIME_T_TO_DOUBLE (now - start),
+					CDTIME_T_TO_DOUBLE (rf->rf_timeout),
+					rf->rf_overruns);
+		}
+
 		/* If the function signals failure, we will increase the
 		 * intervals in which it will be called. */
 		if (status != 0)
 		{
-			rf->rf_effective_interval.tv_sec *= 2;
-			rf->rf_effective_interval.tv_nsec *= 2;
-			NORMALIZE_TIMESPEC (rf->rf_effective_interval);
-
-			if (rf->rf_effective_interval.tv_sec >= 86400)
-			{
-				rf->rf_effective_interval.tv_sec = 86400;
-				rf->rf_effective_interval.tv_nsec = 0;
-			}
+			rf->rf_effective_interval *= 2;
+			if (rf->rf_effective_interval >= TIME_T_TO_CDTIME_T (86400))
+				rf->rf_effective_interval = TIME_T_TO_CDTIME_T (86400);
 
 			NOTICE ("read-function of plugin `%s' failed. "
 					"Will suspend it for %i seconds.",
 					rf->rf_name,
-					(int) rf->rf_effective_interval.tv_sec);
+					(int) CDTIME_T_TO_TIME_T (rf->rf_effective_interval));
 		}
 		else
 		{
@@ -465,120 +1094,1676 @@ static void *plugin_read_thread (void __attribute__((unused)) *args)
 			rf->rf_effective_interval = rf->rf_interval;
 		}
 
-		/* update the ``next read due'' field */
-		now = cdtime ();
-
 		DEBUG ("plugin_read_thread: Effective interval of the "
-				"%s plugin is %i.%09i.",
+				"%s plugin is %.3f.",
 				rf->rf_name,
-				(int) rf->rf_effective_interval.tv_sec,
-				(int) rf->rf_effective_interval.tv_nsec);
+				CDTIME_T_TO_DOUBLE (rf->rf_effective_interval));
 
 		/* Calculate the next (absolute) time at which this function
 		 * should be called. */
-		rf->rf_next_read.tv_sec = rf->rf_next_read.tv_sec
-			+ rf->rf_effective_interval.tv_sec;
-		rf->rf_next_read.tv_nsec = rf->rf_next_read.tv_nsec
-			+ rf->rf_effective_interval.tv_nsec;
-		NORMALIZE_TIMESPEC (rf->rf_next_read);
+		rf->rf_timer.due += rf->rf_effective_interval;
 
-		/* Check, if `rf_next_read' is in the past. */
-		if (TIMESPEC_TO_CDTIME_T (&rf->rf_next_read) < now)
+		/* Check, if `rf_timer.due' is in the past. */
+		if (rf->rf_timer.due < now)
 		{
-			/* `rf_next_read' is in the past. Insert `now'
-			 * so this value doesn't trail off into the
-			 * past too much. */
-			CDTIME_T_TO_TIMESPEC (now, &rf->rf_next_read);
+			/* The function took longer than its interval. Skip
+			 * the reads which were due while it was running, so
+			 * that it isn't called twice in a row and keeps its
+			 * phase. */
+			uint64_t skipped = 1 + (now - rf->rf_timer.due)
+				/ rf->rf_effective_interval;
+
+			rf->rf_timer.due += skipped * rf->rf_effective_interval;
+
+			if (rf->rf_timeout > 0)
+				NOTICE ("read-function of plugin `%s': Skipping "
+						"%"PRIu64" read(s) which were due while "
+						"it was running.", rf->rf_name, skipped);
+			else
+				DEBUG ("plugin_read_thread: Skipping %"PRIu64" "
+						"read(s) of `%s'.", skipped, rf->rf_name);
 		}
 
-		DEBUG ("plugin_read_thread: Next read of the %s plugin at %i.%09i.",
-				rf->rf_name,
-				(int) rf->rf_next_read.tv_sec,
-				(int) rf->rf_next_read.tv_nsec);
-
-		/* Re-insert this read function into the heap again. */
-		c_heap_insert (read_heap, rf);
+		/* Hand this read function to the scheduler again. */
+		read_pending_push (rf);
 	} /* while (read_loop) */
 
 	pthread_exit (NULL);
 	return ((void *) 0);
-} /* void *plugin_read_thread */
+} /* }}} void *plugin_read_thread */
 
-static void start_read_threads (int num)
+int plugin_phase_align (const char *name, cdtime_t interval, /* {{{ */
+		cdtime_t t, cdtime_t *ret)
 {
-	int i;
+	char buffer[2 * DATA_MAX_NAME_LEN];
+	uint32_t hash;
+	cdtime_t phase;
+	cdtime_t offset;
 
-	if (read_threads != NULL)
-		return;
+	if (!phase_spreading || (name == NULL) || (interval == 0)
+			|| (ret == NULL))
+		return (-1);
 
-	read_threads = (pthread_t *) calloc (num, sizeof (pthread_t));
-	if (read_threads == NULL)
-	{
-		ERROR ("plugin: start_read_threads: calloc failed.");
-		return;
-	}
+	/* The same function has the same phase on every start. Other hosts
+	 * have different phases. */
+	ssnprintf (buffer, sizeof (buffer), "%s/%s", name, hostname_g);
+	hash = c_hashtable_hash_string (buffer);
+	phase = (cdtime_t) ((((double) hash) / 4294967296.0)
+			* ((double) interval));
+	if (phase >= interval)
+		phase = 0;
+
+	offset = t % interval;
+	if (offset <= phase)
+		*ret = t + (phase - offset);
+	else
+		*ret = t + (interval - offset) + phase;
 
-	read_threads_num = 0;
-	for (i = 0; i < num; i++)
+	return (0);
+} /* }}} int plugin_phase_align */
+
+/* Reports read functions which are running longer than their timeout. The
+ * function can't be interrupted, but it is not called again until it
+ * returns. */
+static void read_watchdog_check (void) /* {{{ */
+{
+	cdtime_t now = cdtime_monotonic ();
+	int i;
+
+	for (i = 0; i < read_threads_num; i++)
 	{
-		if (pthread_create (read_threads + read_threads_num, NULL,
-					plugin_read_thread, NULL) == 0)
-		{
-			read_threads_num++;
-		}
-		else
+		read_queue_t *q = read_queues + i;
+		char name[DATA_MAX_NAME_LEN];
+		cdtime_t running = 0;
+		cdtime_t timeout = 0;
+
+		pthread_mutex_lock (&q->lock);
+		if ((q->running != NULL) && !q->overrun_reported
+				&& (q->running->rf_timeout > 0)
+				&& (now > q->running_since)
+				&& ((now - q->running_since) > q->running->rf_timeout))
 		{
-			ERROR ("plugin: start_read_threads: pthread_create failed.");
-			return;
+			q->overrun_reported = 1;
+			sstrncpy (name, q->running->rf_name, sizeof (name));
+			running = now - q->running_since;
+			timeout = q->running->rf_timeout;
 		}
-	} /* for (i) */
-} /* void start_read_threads */
+		pthread_mutex_unlock (&q->lock);
 
-static void stop_read_threads (void)
+		if (timeout == 0)
+			continue;
+
+		WARNING ("read-function of plugin `%s' has been running for "
+				"%.3f seconds, which exceeds its timeout of %.3f "
+				"seconds. %s", name, CDTIME_T_TO_DOUBLE (running),
+				CDTIME_T_TO_DOUBLE (timeout),
+				(q->group == READ_GROUP_SLOW)
+				? "Other slow read-functions may be delayed."
+				: "Consider setting `SlowReads' for this plugin.");
+	}
+} /* }}} void read_watchdog_check */
+
+/* Returns the options of the plugin `rf' belongs to. Read functions belong
+ * to a plugin if their group or name is the plugin's name, or if their name
+ * starts with the plugin's name and a dash or slash, such as "snmp-host". */
+static read_options_t *read_options_get (const read_func_t *rf) /* {{{ */
 {
-	int i;
+	read_options_t *ro;
 
-	if (read_threads == NULL)
-		return;
+	for (ro = read_options; ro != NULL; ro = ro->next)
+	{
+		size_t len = strlen (ro->plugin);
 
-	INFO ("collectd: Stopping %i read threads.", read_threads_num);
+		if ((strcasecmp (ro->plugin, rf->rf_group) == 0)
+				|| (strcasecmp (ro->plugin, rf->rf_name) == 0))
+			return (ro);
 
-	pthread_mutex_lock (&read_lock);
-	read_loop = 0;
-	DEBUG ("plugin: stop_read_threads: Signalling `read_cond'");
-	pthread_cond_broadcast (&read_cond);
-	pthread_mutex_unlock (&read_lock);
+		if ((strncasecmp (ro->plugin, rf->rf_name, len) == 0)
+				&& ((rf->rf_name[len] == '-')
+					|| (rf->rf_name[len] == '/')))
+			return (ro);
+	}
 
-	for (i = 0; i < read_threads_num; i++)
+	return (NULL);
+} /* }}} read_options_t *read_options_get */
+
+int plugin_set_read_options (const char *plugin, /* {{{ */
+		cdtime_t timeout, _Bool slow)
+{
+	read_options_t *ro;
+
+	if (plugin == NULL)
+		return (EINVAL);
+
+	for (ro = read_options; ro != NULL; ro = ro->next)
+		if (strcasecmp (ro->plugin, plugin) == 0)
+			break;
+
+	if (ro == NULL)
 	{
-		if (pthread_join (read_threads[i], NULL) != 0)
+		ro = malloc (sizeof (*ro));
+		if (ro == NULL)
 		{
-			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+			ERROR ("plugin_set_read_options: malloc failed.");
+			return (ENOMEM);
 		}
-		read_threads[i] = (pthread_t) 0;
+		memset (ro, 0, sizeof (*ro));
+		sstrncpy (ro->plugin, plugin, sizeof (ro->plugin));
+		ro->next = read_options;
+		read_options = ro;
 	}
-	sfree (read_threads);
-	read_threads_num = 0;
-} /* void stop_read_threads */
 
-/*
- * Public functions
- */
-void plugin_set_dir (const char *dir)
+	ro->timeout = timeout;
+	ro->slow = slow;
+
+	return (0);
+} /* }}} int plugin_set_read_options */
+
+/* Returns the options of the plugin the write callback `name' belongs to, see
+ * `read_options_get'. */
+static write_options_t *write_options_get (const char *name) /* {{{ */
 {
-	if (plugindir != NULL)
-		free (plugindir);
+	write_options_t *wo;
 
-	if (dir == NULL)
-		plugindir = NULL;
-	else if ((plugindir = strdup (dir)) == NULL)
+	for (wo = write_options; wo != NULL; wo = wo->next)
 	{
-		char errbuf[1024];
-		ERROR ("strdup failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
+		size_t len = strlen (wo->plugin);
+
+		if (strcasecmp (wo->plugin, name) == 0)
+			return (wo);
+
+		if ((strncasecmp (wo->plugin, name, len) == 0)
+				&& ((name[len] == '-') || (name[len] == '/')))
+			return (wo);
+	}
+
+	return (NULL);
+} /* }}} write_options_t *write_options_get */
+
+/* Returns the options of `plugin', creating them if necessary. */
+static write_options_t *write_options_create (const char *plugin) /* {{{ */
+{
+	write_options_t *wo;
+
+	for (wo = write_options; wo != NULL; wo = wo->next)
+		if (strcasecmp (wo->plugin, plugin) == 0)
+			return (wo);
+
+	wo = malloc (sizeof (*wo));
+	if (wo == NULL)
+	{
+		ERROR ("plugin: write_options_create: malloc failed.");
+		return (NULL);
+	}
+	memset (wo, 0, sizeof (*wo));
+	sstrncpy (wo->plugin, plugin, sizeof (wo->plugin));
+	wo->next = write_options;
+	write_options = wo;
+
+	return (wo);
+} /* }}} write_options_t *write_options_create */
+
+int plugin_set_write_options (const char *plugin, /* {{{ */
+		cdtime_t interval, int consolidation)
+{
+	write_options_t *wo;
+
+	if (plugin == NULL)
+		return (EINVAL);
+
+	wo = write_options_create (plugin);
+	if (wo == NULL)
+		return (ENOMEM);
+
+	wo->interval = interval;
+	wo->consolidation = consolidation;
+
+	return (0);
+} /* }}} int plugin_set_write_options */
+
+int plugin_set_spool_options (const char *plugin, /* {{{ */
+		const char *dir, uint64_t size, double rate)
+{
+	write_options_t *wo;
+	char *tmp;
+
+	if ((plugin == NULL) || (dir == NULL))
+		return (EINVAL);
+
+	tmp = strdup (dir);
+	if (tmp == NULL)
+	{
+		ERROR ("plugin_set_spool_options: strdup failed.");
+		return (ENOMEM);
+	}
+
+	wo = write_options_create (plugin);
+	if (wo == NULL)
+	{
+		sfree (tmp);
+		return (ENOMEM);
+	}
+
+	sfree (wo->spool_dir);
+	wo->spool_dir = tmp;
+	wo->spool_size = size;
+	wo->spool_rate = rate;
+
+	return (0);
+} /* }}} int plugin_set_spool_options */
+
+/* Opens the spool of the write callback `name'. Every callback has a
+ * directory of its own below the plugin's `SpoolDirectory'. */
+static write_spool_t *write_spool_create (const write_options_t *wo, /* {{{ */
+		const char *name)
+{
+	write_spool_t *ws;
+	char subdir[DATA_MAX_NAME_LEN];
+	char dir[PATH_MAX];
+
+	ws = malloc (sizeof (*ws));
+	if (ws == NULL)
+	{
+		ERROR ("plugin: write_spool_create: malloc failed.");
+		return (NULL);
+	}
+	memset (ws, 0, sizeof (*ws));
+	sstrncpy (ws->ws_name, name, sizeof (ws->ws_name));
+
+	sstrncpy (subdir, name, sizeof (subdir));
+	replace_special (subdir, sizeof (subdir));
+	ssnprintf (dir, sizeof (dir), "%s/%s", wo->spool_dir, subdir);
+
+	ws->ws_spool = spool_open (dir, wo->spool_size);
+	if (ws->ws_spool == NULL)
+	{
+		ERROR ("plugin: Opening the spool of `%s' in %s failed. Its "
+				"values will be lost while it fails.", name, dir);
+		sfree (ws);
+		return (NULL);
+	}
+
+	ws->ws_rate = wo->spool_rate;
+	C_COMPLAIN_INIT (&ws->ws_complaint);
+	pthread_mutex_init (&ws->ws_lock, /* attr = */ NULL);
+
+	if (!spool_empty (ws->ws_spool))
+		INFO ("plugin: Values spooled for `%s' will be written once it "
+				"accepts values again.", name);
+
+	return (ws);
+} /* }}} write_spool_t *write_spool_create */
+
+/* Moves the read functions from the timer wheel to the read threads' queues
+ * when they are due. */
+static void *plugin_read_scheduler (void __attribute__((unused)) *args) /* {{{ */
+{
+	while (read_loop != 0)
+	{
+		c_timer_t *t;
+		cdtime_t now;
+		uint64_t next;
+		_Bool have_next;
+
+		now = cdtime_monotonic ();
+
+		t = __sync_lock_test_and_set (&read_pending, NULL);
+		while (t != NULL)
+		{
+			read_func_t *rf = RF_FROM_TIMER (t);
+
+			t = t->next;
+
+			if (rf->rf_type == RF_REMOVE)
+			{
+				DEBUG ("plugin_read_scheduler: Destroying the `%s' "
+						"callback.", rf->rf_name);
+				destroy_callback ((callback_func_t *) rf);
+				continue;
+			}
+
+			if (rf->rf_interval == 0)
+			{
+				rf->rf_interval = interval_g;
+				rf->rf_effective_interval = rf->rf_interval;
+			}
+
+			/* Newly registered functions are read right away or,
+			 * with `PhaseSpreading', at their phase. The next reads
+			 * follow in exact intervals, so the phase is kept. */
+			if (rf->rf_timer.due == 0)
+			{
+				cdtime_t wall = cdtime ();
+				cdtime_t aligned;
+
+				rf->rf_timer.due = now;
+				if (plugin_phase_align (rf->rf_name, rf->rf_interval,
+							wall, &aligned) == 0)
+					rf->rf_timer.due += aligned - wall;
+			}
+
+			c_timerwheel_insert (read_wheel, &rf->rf_timer);
+		}
+
+		t = c_timerwheel_advance (read_wheel, now);
+		while (t != NULL)
+		{
+			read_func_t *rf = RF_FROM_TIMER (t);
+
+			t = t->next;
+			read_queues_dispatch (rf);
+		}
+
+		have_next = (c_timerwheel_next (read_wheel, &next) == 0);
+
+		/* Wake up in time to notice functions exceeding their
+		 * timeout. */
+		if (read_watchdog_interval > 0)
+		{
+			read_watchdog_check ();
+			if (!have_next || (next > now + read_watchdog_interval))
+				next = now + read_watchdog_interval;
+			have_next = 1;
+		}
+
+		pthread_mutex_lock (&read_sched_lock);
+		while ((read_loop != 0) && (read_pending == NULL))
+		{
+			struct timespec abstime;
+			int status;
+
+			if (!have_next)
+			{
+				pthread_cond_wait (&read_sched_cond, &read_sched_lock);
+				continue;
+			}
+
+			if (cdtime_monotonic () >= next)
+				break;
+
+			CDTIME_T_TO_TIMESPEC (next, &abstime);
+			status = pthread_cond_timedwait (&read_sched_cond,
+					&read_sched_lock, &abstime);
+			if (status == ETIMEDOUT)
+				break;
+		}
+		pthread_mutex_unlock (&read_sched_lock);
+	} /* while (read_loop) */
+
+	return ((void *) 0);
+} /* }}} void *plugin_read_scheduler */
+
+/* Starts `num' read threads, and `slow_num' threads for the functions of
+ * plugins with the `SlowReads' option. */
+/* Returns the CPU set configured with the global option `key', or NULL if
+ * the option isn't set or invalid. */
+static const char *plugin_option_cpus (const char *key) /* {{{ */
+{
+	const char *cpus = global_option_get (key);
+
+	if ((cpus == NULL) || (cpus[0] == 0))
+		return (NULL);
+
+	if (thread_check_cpus (cpus) != 0)
+	{
+		ERROR ("plugin: The `%s' option is invalid and will be ignored.",
+				key);
+		return (NULL);
+	}
+
+	return (cpus);
+} /* }}} const char *plugin_option_cpus */
+
+static void start_read_threads (int num, int slow_num)
+{
+	pthread_condattr_t attr;
+	read_options_t *ro;
+	const char *cpus;
+	const char *slow_cpus;
+	_Bool have_slow = 0;
+	int i;
+
+	if (read_queues != NULL)
+		return;
+
+	read_watchdog_interval = 0;
+	for (ro = read_options; ro != NULL; ro = ro->next)
+	{
+		if (ro->slow)
+			have_slow = 1;
+		if ((ro->timeout > 0) && ((read_watchdog_interval == 0)
+					|| (ro->timeout / 2 < read_watchdog_interval)))
+			read_watchdog_interval = ro->timeout / 2;
+	}
+	if ((read_watchdog_interval > 0)
+			&& (read_watchdog_interval < MS_TO_CDTIME_T (100)))
+		read_watchdog_interval = MS_TO_CDTIME_T (100);
+
+	if (!have_slow || (slow_num < 0))
+		slow_num = 0;
+
+	read_queues = (read_queue_t *) calloc (num + slow_num,
+			sizeof (read_queue_t));
+	if (read_queues == NULL)
+	{
+		ERROR ("plugin: start_read_threads: calloc failed.");
+		return;
+	}
+
+	read_wheel = c_timerwheel_create (cdtime_monotonic (),
+			READ_WHEEL_RESOLUTION);
+	if (read_wheel == NULL)
+	{
+		ERROR ("plugin: start_read_threads: c_timerwheel_create failed.");
+		sfree (read_queues);
+		return;
+	}
+
+	/* Wait for the next read using the same clock as `cdtime_monotonic'. */
+	pthread_condattr_init (&attr);
+#if HAVE_CDTIME_MONOTONIC
+	pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+#endif
+	pthread_cond_init (&read_sched_cond, &attr);
+	pthread_condattr_destroy (&attr);
+
+	cpus = plugin_option_cpus ("ReadThreadsCPUs");
+	slow_cpus = plugin_option_cpus ("SlowReadThreadsCPUs");
+
+	read_threads_num = 0;
+	for (i = 0; i < num + slow_num; i++)
+	{
+		read_queue_t *q = read_queues + read_threads_num;
+		char name[16];
+
+		pthread_mutex_init (&q->lock, /* attr = */ NULL);
+		pthread_cond_init (&q->cond, /* attr = */ NULL);
+		q->group = (i < num) ? READ_GROUP_DEFAULT : READ_GROUP_SLOW;
+
+		if (q->group == READ_GROUP_DEFAULT)
+			ssnprintf (name, sizeof (name), "reader#%i", i);
+		else
+			ssnprintf (name, sizeof (name), "slowreader#%i", i - num);
+
+		if (thread_create (&q->thread, NULL, plugin_read_thread, q,
+					name, (q->group == READ_GROUP_DEFAULT)
+					? cpus : slow_cpus) == 0)
+		{
+			read_threads_num++;
+		}
+		else
+		{
+			ERROR ("plugin: start_read_threads: pthread_create failed.");
+			pthread_cond_destroy (&q->cond);
+			pthread_mutex_destroy (&q->lock);
+			break;
+		}
+	} /* for (i) */
+
+	read_default_num = (read_threads_num < num) ? read_threads_num : num;
+	if (read_threads_num == 0)
+		return;
+
+	/* `read_scheduler_running' has to be set first, so that functions
+	 * registered from now on wake the scheduler. */
+	read_scheduler_running = 1;
+	if (thread_create (&read_scheduler, NULL, plugin_read_scheduler,
+				NULL, "readscheduler", cpus) != 0)
+	{
+		ERROR ("plugin: start_read_threads: pthread_create failed.");
+		read_scheduler_running = 0;
+	}
+} /* void start_read_threads */
+
+static void stop_read_threads (void)
+{
+	int i;
+
+	if (read_queues == NULL)
+		return;
+
+	INFO ("collectd: Stopping %i read threads.", read_threads_num);
+
+	pthread_mutex_lock (&read_sched_lock);
+	read_loop = 0;
+	DEBUG ("plugin: stop_read_threads: Signalling `read_sched_cond'");
+	pthread_cond_signal (&read_sched_cond);
+	pthread_mutex_unlock (&read_sched_lock);
+
+	for (i = 0; i < read_threads_num; i++)
+	{
+		pthread_mutex_lock (&read_queues[i].lock);
+		pthread_cond_broadcast (&read_queues[i].cond);
+		pthread_mutex_unlock (&read_queues[i].lock);
+	}
+
+	for (i = 0; i < read_threads_num; i++)
+	{
+		if (pthread_join (read_queues[i].thread, NULL) != 0)
+		{
+			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+		}
+		read_queues[i].thread = (pthread_t) 0;
+	}
+
+	if (read_scheduler_running)
+	{
+		if (pthread_join (read_scheduler, NULL) != 0)
+			ERROR ("plugin: stop_read_threads: pthread_join failed.");
+		read_scheduler_running = 0;
+	}
+
+	/* Functions which were waiting in the queues go back to the
+	 * pending list, from where they are freed. */
+	for (i = 0; i < read_threads_num; i++)
+	{
+		read_func_t *rf;
+
+		while ((rf = read_queue_pop (read_queues + i)) != NULL)
+			read_pending_push (rf);
+
+		pthread_cond_destroy (&read_queues[i].cond);
+		pthread_mutex_destroy (&read_queues[i].lock);
+	}
+	pthread_cond_destroy (&read_sched_cond);
+
+	sfree (read_queues);
+	read_threads_num = 0;
+	read_default_num = 0;
+} /* void stop_read_threads */
+
+static void write_queue_elem_release (write_queue_elem_t *wqe) /* {{{ */
+{
+	int refcount;
+
+	if (wqe == NULL)
+		return;
+
+	refcount = __sync_sub_and_fetch (&wqe->wqe_refcount, 1);
+	if (refcount > 0)
+		return;
+
+	sfree (wqe->wqe_vl.values);
+	if (wqe->wqe_vl.meta != NULL)
+	{
+		meta_data_destroy (wqe->wqe_vl.meta);
+		wqe->wqe_vl.meta = NULL;
+	}
+	sfree (wqe);
+} /* }}} void write_queue_elem_release */
+
+static write_queue_elem_t *write_queue_elem_create ( /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	write_queue_elem_t *wqe;
+
+	wqe = malloc (sizeof (*wqe));
+	if (wqe == NULL)
+	{
+		ERROR ("plugin: write_queue_elem_create: malloc failed.");
+		return (NULL);
+	}
+	memset (wqe, 0, sizeof (*wqe));
+
+	wqe->wqe_ds = ds;
+	memcpy (&wqe->wqe_vl, vl, sizeof (wqe->wqe_vl));
+	wqe->wqe_vl.values = NULL;
+	wqe->wqe_vl.meta = NULL;
+	/* The identifier belongs to the dispatching thread. */
+	wqe->wqe_vl.identifier = NULL;
+	/* The creator holds the first reference until all queues have been
+	 * offered the element. */
+	wqe->wqe_refcount = 1;
+
+	wqe->wqe_vl.values = malloc (vl->values_len * sizeof (*vl->values));
+	if (wqe->wqe_vl.values == NULL)
+	{
+		ERROR ("plugin: write_queue_elem_create: malloc failed.");
+		sfree (wqe);
+		return (NULL);
+	}
+	memcpy (wqe->wqe_vl.values, vl->values,
+			vl->values_len * sizeof (*vl->values));
+
+	if (vl->meta != NULL)
+	{
+		wqe->wqe_vl.meta = meta_data_clone (vl->meta);
+		if (wqe->wqe_vl.meta == NULL)
+		{
+			ERROR ("plugin: write_queue_elem_create: "
+					"meta_data_clone failed.");
+			sfree (wqe->wqe_vl.values);
+			sfree (wqe);
+			return (NULL);
+		}
+	}
+
+	return (wqe);
+} /* }}} write_queue_elem_t *write_queue_elem_create */
+
+/* Returns the ring of `wq' the values of `vl's identifier are written to. */
+static write_ring_t *write_queue_ring (write_queue_t *wq, /* {{{ */
+		const value_list_t *vl)
+{
+	const char *fields[] = { vl->host, vl->plugin, vl->plugin_instance,
+		vl->type, vl->type_instance };
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	if (wq->wq_rings_num == 1)
+		return (wq->wq_rings);
+
+	/* 32 bit FNV-1a */
+	for (i = 0; i < STATIC_ARRAY_SIZE (fields); i++)
+	{
+		const char *ptr;
+
+		for (ptr = fields[i]; *ptr != 0; ptr++)
+			hash = (hash ^ (uint32_t) (unsigned char) *ptr) * 16777619U;
+		/* Separate the fields, so "a" "bc" and "ab" "c" differ. */
+		hash = (hash ^ (uint32_t) '/') * 16777619U;
+	}
+
+	return (wq->wq_rings + (hash % wq->wq_rings_num));
+} /* }}} write_ring_t *write_queue_ring */
+
+/* Appends `wqe' to its ring of the queue, applying the configured drop policy
+ * if the ring is full. Takes a reference on success. */
+static int write_queue_enqueue (write_queue_t *wq, /* {{{ */
+		write_queue_elem_t *wqe)
+{
+	write_ring_t *wr = write_queue_ring (wq, &wqe->wqe_vl);
+	write_queue_elem_t *dropped = NULL;
+
+	pthread_mutex_lock (&wr->wr_lock);
+
+	if (write_queues_policy == WQ_BLOCK)
+	{
+		while ((wr->wr_loop != 0) && (wr->wr_length >= wr->wr_limit))
+			pthread_cond_wait (&wr->wr_cond_space, &wr->wr_lock);
+	}
+
+	if ((wr->wr_loop == 0) || ((wr->wr_length >= wr->wr_limit)
+				&& (write_queues_policy != WQ_DROP_OLDEST)))
+	{
+		wr->wr_dropped++;
+		pthread_mutex_unlock (&wr->wr_lock);
+		return (-1);
+	}
+
+	if (wr->wr_length >= wr->wr_limit)
+	{
+		/* WQ_DROP_OLDEST: make room by discarding the head. */
+		dropped = wr->wr_elems[wr->wr_head];
+		wr->wr_elems[wr->wr_head] = NULL;
+		wr->wr_head = (wr->wr_head + 1) % wr->wr_limit;
+		wr->wr_length--;
+		wr->wr_dropped++;
+	}
+
+	__sync_fetch_and_add (&wqe->wqe_refcount, 1);
+
+	wr->wr_elems[(wr->wr_head + wr->wr_length) % wr->wr_limit] = wqe;
+	wr->wr_length++;
+
+	pthread_cond_signal (&wr->wr_cond_data);
+	pthread_mutex_unlock (&wr->wr_lock);
+
+	write_queue_elem_release (dropped);
+	return (0);
+} /* }}} int write_queue_enqueue */
+
+static void *write_queue_thread (void *args) /* {{{ */
+{
+	write_ring_t *wr = args;
+	write_queue_t *wq = wr->wr_queue;
+
+	pthread_mutex_lock (&wr->wr_lock);
+	while (42)
+	{
+		write_queue_elem_t *wqe;
+		plugin_write_cb callback;
+		cdtime_t entry = 0;
+		int status;
+
+		while ((wr->wr_loop != 0) && (wr->wr_length == 0))
+			pthread_cond_wait (&wr->wr_cond_data, &wr->wr_lock);
+
+		/* Drain the ring before exiting so that no values are lost
+		 * during a regular shutdown. */
+		if (wr->wr_length == 0)
+			break;
+
+		wqe = wr->wr_elems[wr->wr_head];
+		wr->wr_elems[wr->wr_head] = NULL;
+		wr->wr_head = (wr->wr_head + 1) % wr->wr_limit;
+		wr->wr_length--;
+
+		pthread_cond_signal (&wr->wr_cond_space);
+		pthread_mutex_unlock (&wr->wr_lock);
+
+		callback = wq->wq_cf->cf_callback;
+		if (pipeline_trace_enabled)
+			entry = cdtime ();
+		if (callback_stats_enabled)
+		{
+			cdtime_t start = cdtime_monotonic ();
+
+			status = (*callback) (wqe->wqe_ds, &wqe->wqe_vl,
+					&wq->wq_cf->cf_udata);
+			callback_stats_add (&wq->wq_cf->cf_stats, "write", wq->wq_name,
+					start, status);
+		}
+		else
+			status = (*callback) (wqe->wqe_ds, &wqe->wqe_vl,
+					&wq->wq_cf->cf_udata);
+		if (status != 0)
+		{
+			DEBUG ("plugin: write_queue_thread: Write callback `%s' "
+					"failed with status %i.", wq->wq_name, status);
+		}
+
+		if (pipeline_trace_enabled)
+			pipeline_trace_write (&wq->wq_cf->cf_trace, wq->wq_name,
+					wq->wq_cf->cf_batch, &wqe->wqe_vl, entry);
+
+		write_queue_elem_release (wqe);
+
+		pthread_mutex_lock (&wr->wr_lock);
+	} /* while (42) */
+	pthread_mutex_unlock (&wr->wr_lock);
+
+	pthread_exit (NULL);
+	return ((void *) 0);
+} /* }}} void *write_queue_thread */
+
+static void write_queue_destroy (write_queue_t *wq) /* {{{ */
+{
+	size_t i;
+
+	if (wq == NULL)
+		return;
+
+	for (i = 0; i < wq->wq_rings_num; i++)
+	{
+		write_ring_t *wr = wq->wq_rings + i;
+
+		pthread_mutex_lock (&wr->wr_lock);
+		wr->wr_loop = 0;
+		pthread_cond_broadcast (&wr->wr_cond_data);
+		pthread_cond_broadcast (&wr->wr_cond_space);
+		pthread_mutex_unlock (&wr->wr_lock);
+	}
+
+	for (i = 0; i < wq->wq_rings_num; i++)
+	{
+		write_ring_t *wr = wq->wq_rings + i;
+
+		if (wr->wr_thread_running
+				&& (pthread_join (wr->wr_thread, NULL) != 0))
+		{
+			ERROR ("plugin: write_queue_destroy: pthread_join failed.");
+		}
+
+		/* Only non-empty if the ring's thread couldn't be started. */
+		while (wr->wr_length > 0)
+		{
+			write_queue_elem_release (wr->wr_elems[wr->wr_head]);
+			wr->wr_head = (wr->wr_head + 1) % wr->wr_limit;
+			wr->wr_length--;
+		}
+		sfree (wr->wr_elems);
+
+		pthread_mutex_destroy (&wr->wr_lock);
+		pthread_cond_destroy (&wr->wr_cond_data);
+		pthread_cond_destroy (&wr->wr_cond_space);
+	}
+	sfree (wq->wq_rings);
+
+	sfree (wq);
+} /* }}} void write_queue_destroy */
+
+static write_queue_t *write_queue_create (const char *name, /* {{{ */
+		callback_func_t *cf)
+{
+	write_queue_t *wq;
+	size_t limit;
+	size_t i;
+
+	wq = malloc (sizeof (*wq));
+	if (wq == NULL)
+	{
+		ERROR ("plugin: write_queue_create: malloc failed.");
+		return (NULL);
+	}
+	memset (wq, 0, sizeof (*wq));
+
+	sstrncpy (wq->wq_name, name, sizeof (wq->wq_name));
+	wq->wq_cf = cf;
+	wq->next = NULL;
+
+	wq->wq_rings = calloc ((size_t) write_queues_threads,
+			sizeof (*wq->wq_rings));
+	if (wq->wq_rings == NULL)
+	{
+		ERROR ("plugin: write_queue_create: calloc failed.");
+		sfree (wq);
+		return (NULL);
+	}
+
+	/* The limit is shared by the rings. */
+	limit = write_queues_limit / (size_t) write_queues_threads;
+	if (limit < 1)
+		limit = 1;
+
+	for (i = 0; i < (size_t) write_queues_threads; i++)
+	{
+		write_ring_t *wr = wq->wq_rings + i;
+
+		wr->wr_queue = wq;
+		wr->wr_limit = limit;
+		wr->wr_loop = 1;
+		pthread_mutex_init (&wr->wr_lock, /* attr = */ NULL);
+		pthread_cond_init (&wr->wr_cond_data, /* attr = */ NULL);
+		pthread_cond_init (&wr->wr_cond_space, /* attr = */ NULL);
+		wq->wq_rings_num++;
+
+		wr->wr_elems = calloc (wr->wr_limit, sizeof (*wr->wr_elems));
+		if (wr->wr_elems == NULL)
+		{
+			ERROR ("plugin: write_queue_create: calloc failed.");
+			write_queue_destroy (wq);
+			return (NULL);
+		}
+	}
+
+	for (i = 0; i < wq->wq_rings_num; i++)
+	{
+		write_ring_t *wr = wq->wq_rings + i;
+		char thread_name[16];
+
+		ssnprintf (thread_name, sizeof (thread_name), "wq/%s", name);
+		if (thread_create (&wr->wr_thread, NULL, write_queue_thread, wr,
+					thread_name, write_queues_cpus) != 0)
+		{
+			ERROR ("plugin: write_queue_create: pthread_create failed.");
+			/* A ring without a thread would never be drained. */
+			write_queue_destroy (wq);
+			return (NULL);
+		}
+		wr->wr_thread_running = 1;
+	}
+
+	return (wq);
+} /* }}} write_queue_t *write_queue_create */
+
+/* Must be called with `write_queues_lock' held for writing. */
+static void write_queue_remove (const char *name) /* {{{ */
+{
+	write_queue_t *prev = NULL;
+	write_queue_t *wq;
+
+	for (wq = write_queues; wq != NULL; prev = wq, wq = wq->next)
+		if (strcasecmp (name, wq->wq_name) == 0)
+			break;
+
+	if (wq == NULL)
+		return;
+
+	if (prev == NULL)
+		write_queues = wq->next;
+	else
+		prev->next = wq->next;
+
+	write_queue_destroy (wq);
+} /* }}} void write_queue_remove */
+
+/* Must be called with `write_queues_lock' held for writing. */
+static int write_queue_add (const char *name, callback_func_t *cf) /* {{{ */
+{
+	write_queue_t *wq;
+	write_queue_t *last;
+
+	wq = write_queue_create (name, cf);
+	if (wq == NULL)
+		return (-1);
+
+	if (write_queues == NULL)
+	{
+		write_queues = wq;
+		return (0);
+	}
+
+	for (last = write_queues; last->next != NULL; last = last->next)
+		/* nop */;
+	last->next = wq;
+
+	return (0);
+} /* }}} int write_queue_add */
+
+static void start_write_queues (void) /* {{{ */
+{
+	const char *str;
+	llentry_t *le;
+	int limit;
+
+	str = global_option_get ("WriteQueueThreads");
+	write_queues_threads = (str != NULL) ? atoi (str) : 0;
+	if (write_queues_threads <= 0)
+	{
+		write_queues_threads = 0;
+		return;
+	}
+
+	str = global_option_get ("WriteQueueLimit");
+	limit = (str != NULL) ? atoi (str) : 0;
+	if (limit <= 0)
+	{
+		WARNING ("plugin: WriteQueueLimit must be greater than zero. "
+				"Using the default of 10000.");
+		limit = 10000;
+	}
+	write_queues_limit = (size_t) limit;
+
+	write_queues_cpus = plugin_option_cpus ("WriteQueueThreadsCPUs");
+
+	str = global_option_get ("WriteQueueDropPolicy");
+	if ((str == NULL) || (strcasecmp ("DropOldest", str) == 0))
+		write_queues_policy = WQ_DROP_OLDEST;
+	else if (strcasecmp ("DropNewest", str) == 0)
+		write_queues_policy = WQ_DROP_NEWEST;
+	else if (strcasecmp ("Block", str) == 0)
+		write_queues_policy = WQ_BLOCK;
+	else
+	{
+		WARNING ("plugin: Unknown WriteQueueDropPolicy `%s'. "
+				"Using `DropOldest'.", str);
+		write_queues_policy = WQ_DROP_OLDEST;
+	}
+
+	pthread_rwlock_wrlock (&write_queues_lock);
+	for (le = llist_head (list_write); le != NULL; le = le->next)
+		write_queue_add (le->key, le->value);
+	write_generation++;
+	pthread_rwlock_unlock (&write_queues_lock);
+
+	INFO ("plugin: Started write queues with %i thread%s per writer "
+			"(limit = %zu).", write_queues_threads,
+			(write_queues_threads == 1) ? "" : "s",
+			write_queues_limit);
+} /* }}} void start_write_queues */
+
+static void stop_write_queues (void) /* {{{ */
+{
+	pthread_rwlock_wrlock (&write_queues_lock);
+	while (write_queues != NULL)
+	{
+		write_queue_t *wq = write_queues;
+
+		write_queues = wq->next;
+		write_queue_destroy (wq);
+	}
+	/* From now on, plugin_write calls the callbacks synchronously. */
+	write_queues_threads = 0;
+	write_generation++;
+	pthread_rwlock_unlock (&write_queues_lock);
+} /* }}} void stop_write_queues */
+
+/* Passes the value lists to the spool's writer until one fails. Returns the
+ * number of value lists written. Batch writers either write all of them or
+ * none. */
+static size_t write_spool_deliver (write_spool_t *ws, /* {{{ */
+		const data_set_t **ds, const value_list_t **vl, size_t num)
+{
+	size_t i;
+
+	if (ws->ws_batch != NULL)
+	{
+		struct write_batch_s *wb = ws->ws_batch;
+
+		if ((*wb->wb_callback) (ds, vl, num, &wb->wb_udata) != 0)
+			return (0);
+		return (num);
+	}
+
+	for (i = 0; i < num; i++)
+		if ((*ws->ws_callback) (ds[i], vl[i], &ws->ws_udata) != 0)
+			break;
+
+	return (i);
+} /* }}} size_t write_spool_deliver */
+
+/* Passes value lists from the spool to the writer, as many as the rate
+ * permits, until the spool is empty or the writer fails. You must hold
+ * `ws->ws_lock'. */
+static void write_spool_replay_nolock (write_spool_t *ws, /* {{{ */
+		cdtime_t now)
+{
+	value_list_t vls[WRITE_SPOOL_CHUNK];
+	const value_list_t *vl[WRITE_SPOOL_CHUNK];
+	const data_set_t *ds[WRITE_SPOOL_CHUNK];
+	size_t index[WRITE_SPOOL_CHUNK];
+	size_t chunk = WRITE_SPOOL_CHUNK;
+	size_t replayed = 0;
+
+	if ((ws->ws_batch != NULL) && (ws->ws_batch->wb_size < chunk))
+		chunk = ws->ws_batch->wb_size;
+
+	if (ws->ws_rate > 0.0)
+	{
+		if (now > ws->ws_last_replay)
+			ws->ws_credit += ws->ws_rate
+				* CDTIME_T_TO_DOUBLE (now - ws->ws_last_replay);
+		/* Allow bursts of one second at most. */
+		if (ws->ws_credit > ws->ws_rate)
+			ws->ws_credit = ws->ws_rate;
+	}
+	ws->ws_last_replay = now;
+
+	while (!spool_empty (ws->ws_spool) && (now >= ws->ws_retry)
+			&& (replayed < WRITE_SPOOL_REPLAY_MAX))
+	{
+		size_t num = chunk;
+		size_t valid = 0;
+		size_t written;
+		size_t i;
+
+		if (ws->ws_rate > 0.0)
+		{
+			if (ws->ws_credit < 1.0)
+				break;
+			if (((double) num) > ws->ws_credit)
+				num = (size_t) ws->ws_credit;
+		}
+
+		num = spool_peek (ws->ws_spool, vls, num);
+		if (num == 0)
+			break;
+
+		/* Value lists whose type is unknown by now are dropped. */
+		for (i = 0; i < num; i++)
+		{
+			const data_set_t *tmp = plugin_vl_get_ds (vls + i);
+
+			if ((vls[i].values == NULL) || (tmp == NULL)
+					|| (tmp->ds_num != vls[i].values_len))
+				continue;
+
+			ds[valid] = tmp;
+			vl[valid] = vls + i;
+			index[valid] = i;
+			valid++;
+		}
+
+		written = (valid > 0) ? write_spool_deliver (ws, ds, vl, valid) : 0;
+		if (written == valid)
+			spool_remove (ws->ws_spool, num);
+		else if (written > 0)
+			spool_remove (ws->ws_spool, index[written]);
+
+		for (i = 0; i < num; i++)
+			sfree (vls[i].values);
+
+		replayed += num;
+		if (ws->ws_rate > 0.0)
+			ws->ws_credit -= (double) num;
+
+		if (written < valid)
+		{
+			ws->ws_retry = now + interval_g;
+			break;
+		}
+	}
+
+	if (spool_empty (ws->ws_spool))
+		c_release (LOG_INFO, &ws->ws_complaint, "plugin: The values "
+				"spooled for `%s' have been written.", ws->ws_name);
+} /* }}} void write_spool_replay_nolock */
+
+/* Passes new value lists to the writer, or appends them to the spool if the
+ * writer fails or the spool isn't empty. */
+static int write_spool_write (write_spool_t *ws, /* {{{ */
+		const data_set_t **ds, const value_list_t **vl, size_t num)
+{
+	cdtime_t now = cdtime ();
+	size_t written = 0;
+	size_t i;
+	int status = 0;
+
+	pthread_mutex_lock (&ws->ws_lock);
+
+	if (!spool_empty (ws->ws_spool))
+		write_spool_replay_nolock (ws, now);
+
+	if (spool_empty (ws->ws_spool) && (now >= ws->ws_retry))
+	{
+		written = write_spool_deliver (ws, ds, vl, num);
+		if (written < num)
+		{
+			ws->ws_retry = now + interval_g;
+			c_complain (LOG_WARNING, &ws->ws_complaint, "plugin: "
+					"Writing to `%s' failed. Spooling values "
+					"until it has recovered.", ws->ws_name);
+		}
+	}
+
+	for (i = written; i < num; i++)
+	{
+		status = spool_append (ws->ws_spool, vl[i]);
+		if (status != 0)
+			break;
+	}
+
+	pthread_mutex_unlock (&ws->ws_lock);
+
+	if (status != 0)
+		ERROR ("plugin: Spooling values for `%s' failed. %zu value "
+				"lists have been lost.", ws->ws_name, num - i);
+
+	return (status);
+} /* }}} int write_spool_write */
+
+/* The write callback of plain writers with a spool. */
+static int write_spool_add (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, user_data_t *ud)
+{
+	return (write_spool_write (ud->data, &ds, &vl, 1));
+} /* }}} int write_spool_add */
+
+static void write_spool_free (write_spool_t *ws) /* {{{ */
+{
+	if (ws == NULL)
+		return;
+
+	spool_close (ws->ws_spool);
+	pthread_mutex_destroy (&ws->ws_lock);
+	sfree (ws);
+} /* }}} void write_spool_free */
+
+/* The free function of plain writers' user data. What's left in the spool is
+ * written after the next start. */
+static void write_spool_destroy (void *arg) /* {{{ */
+{
+	write_spool_t *ws = arg;
+
+	if (ws == NULL)
+		return;
+
+	if ((ws->ws_udata.data != NULL) && (ws->ws_udata.free_func != NULL))
+		ws->ws_udata.free_func (ws->ws_udata.data);
+
+	write_spool_free (ws);
+} /* }}} void write_spool_destroy */
+
+/* Passes `num' elements to the batch callback and releases them. */
+static int write_batch_submit (write_batch_t *wb, /* {{{ */
+		write_queue_elem_t **elems, size_t num)
+{
+	const data_set_t **ds;
+	const value_list_t **vl;
+	size_t i;
+	int status;
+
+	if (num == 0)
+		return (0);
+
+	ds = malloc (num * sizeof (*ds));
+	vl = malloc (num * sizeof (*vl));
+	if ((ds == NULL) || (vl == NULL))
+	{
+		ERROR ("plugin: write_batch_submit: malloc failed.");
+		status = ENOMEM;
+	}
+	else
+	{
+		for (i = 0; i < num; i++)
+		{
+			ds[i] = elems[i]->wqe_ds;
+			vl[i] = &elems[i]->wqe_vl;
+		}
+
+		if (wb->wb_spool != NULL)
+			status = write_spool_write (wb->wb_spool, ds, vl, num);
+		else
+			status = (*wb->wb_callback) (ds, vl, num, &wb->wb_udata);
+		if (status != 0)
+		{
+			DEBUG ("plugin: write_batch_submit: Batch write callback "
+					"`%s' failed with status %i.", wb->wb_name, status);
+		}
+
+		if (pipeline_trace_enabled)
+			pipeline_trace_batch (&wb->wb_trace, wb->wb_name,
+					vl, num);
+	}
+
+	for (i = 0; i < num; i++)
+		write_queue_elem_release (elems[i]);
+	sfree (ds);
+	sfree (vl);
+
+	return (status);
+} /* }}} int write_batch_submit */
+
+/* Takes the collected elements out of `wb', leaving an empty array. Returns
+ * the number of elements taken. You must hold `wb->wb_lock'. */
+static size_t write_batch_take_nolock (write_batch_t *wb, /* {{{ */
+		write_queue_elem_t ***ret_elems)
+{
+	write_queue_elem_t **elems;
+	size_t num;
+
+	elems = calloc (wb->wb_size, sizeof (*elems));
+	if (elems == NULL)
+	{
+		/* Keep collecting; the next call will try again. */
+		ERROR ("plugin: write_batch_take_nolock: calloc failed.");
+		return (0);
+	}
+
+	*ret_elems = wb->wb_elems;
+	num = wb->wb_num;
+
+	wb->wb_elems = elems;
+	wb->wb_num = 0;
+
+	return (num);
+} /* }}} size_t write_batch_take_nolock */
+
+static int write_batch_flush (write_batch_t *wb) /* {{{ */
+{
+	write_queue_elem_t **elems = NULL;
+	size_t num = 0;
+	int status;
+
+	pthread_mutex_lock (&wb->wb_lock);
+	if (wb->wb_num > 0)
+		num = write_batch_take_nolock (wb, &elems);
+	pthread_mutex_unlock (&wb->wb_lock);
+
+	if (num == 0)
+		return (0);
+
+	status = write_batch_submit (wb, elems, num);
+	sfree (elems);
+
+	return (status);
+} /* }}} int write_batch_flush */
+
+/* The write callback of batch writers. */
+static int write_batch_add (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, user_data_t *ud)
+{
+	write_batch_t *wb = ud->data;
+	write_queue_elem_t *wqe;
+	write_queue_elem_t **elems = NULL;
+	size_t num = 0;
+	cdtime_t now;
+	cdtime_t timeout;
+	int status;
+
+	wqe = write_queue_elem_create (ds, vl);
+	if (wqe == NULL)
+		return (ENOMEM);
+
+	now = cdtime ();
+	/* The interval may not be known yet when the callback is registered. */
+	timeout = (wb->wb_timeout > 0) ? wb->wb_timeout : interval_g;
+
+	pthread_mutex_lock (&wb->wb_lock);
+	if (wb->wb_num >= wb->wb_size)
+	{
+		/* Only happens if taking the elements failed before. */
+		pthread_mutex_unlock (&wb->wb_lock);
+		write_queue_elem_release (wqe);
+		return (ENOMEM);
+	}
+
+	if (wb->wb_num == 0)
+		wb->wb_first = now;
+	wb->wb_elems[wb->wb_num] = wqe;
+	wb->wb_num++;
+
+	/* Batches which don't receive any more values are passed on by
+	 * `write_batch_flush_expired' or `plugin_flush'. */
+	if ((wb->wb_num >= wb->wb_size)
+			|| ((now - wb->wb_first) >= timeout))
+		num = write_batch_take_nolock (wb, &elems);
+	pthread_mutex_unlock (&wb->wb_lock);
+
+	if (num == 0)
+		return (0);
+
+	status = write_batch_submit (wb, elems, num);
+	sfree (elems);
+
+	return (status);
+} /* }}} int write_batch_add */
+
+/* The free function of batch writers' user data. Passes on what's left and
+ * frees the plugin's user data. */
+static void write_batch_destroy (void *arg) /* {{{ */
+{
+	write_batch_t *wb = arg;
+
+	if (wb == NULL)
+		return;
+
+	write_batch_flush (wb);
+	write_spool_free (wb->wb_spool);
+
+	if ((wb->wb_udata.data != NULL) && (wb->wb_udata.free_func != NULL))
+		wb->wb_udata.free_func (wb->wb_udata.data);
+
+	sfree (wb->wb_elems);
+	pthread_mutex_destroy (&wb->wb_lock);
+	sfree (wb);
+} /* }}} void write_batch_destroy */
+
+/* Passes pending batches of the given writer, or all writers if `plugin' is
+ * NULL, to their callbacks. */
+static void write_batch_flush_all (const char *plugin) /* {{{ */
+{
+	llentry_t *le;
+
+	if (list_write == NULL)
+		return;
+
+	for (le = llist_head (list_write); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
+
+		if (cf->cf_callback != (void *) write_batch_add)
+			continue;
+		if ((plugin != NULL) && (strcmp (plugin, le->key) != 0))
+			continue;
+
+		write_batch_flush (cf->cf_udata.data);
+	}
+} /* }}} void write_batch_flush_all */
+
+/* Passes on the pending batches whose first value list has been waiting for
+ * longer than the writer's timeout. Called once per interval, so writers
+ * which receive few values don't hold on to a partial batch indefinitely. */
+static void write_batch_flush_expired (void) /* {{{ */
+{
+	llentry_t *le;
+	cdtime_t now;
+
+	if (list_write == NULL)
+		return;
+
+	now = cdtime ();
+	for (le = llist_head (list_write); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
+		write_batch_t *wb;
+		cdtime_t timeout;
+		_Bool expired;
+
+		if (cf->cf_callback != (void *) write_batch_add)
+			continue;
+
+		wb = cf->cf_udata.data;
+		timeout = (wb->wb_timeout > 0) ? wb->wb_timeout : interval_g;
+
+		pthread_mutex_lock (&wb->wb_lock);
+		expired = (wb->wb_num > 0) && ((now - wb->wb_first) >= timeout);
+		pthread_mutex_unlock (&wb->wb_lock);
+
+		if (expired)
+			write_batch_flush (wb);
+	}
+} /* }}} void write_batch_flush_expired */
+
+/* The write callback of writers with a `WriteInterval'. */
+static int write_consolidate_add (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, user_data_t *ud)
+{
+	write_consolidate_t *wc = ud->data;
+
+	return (consolidate_add (wc->wc_cons, ds, vl));
+} /* }}} int write_consolidate_add */
+
+/* The free function of consolidating writers' user data. Passes on what's
+ * left and frees the plugin's user data. */
+static void write_consolidate_destroy (void *arg) /* {{{ */
+{
+	write_consolidate_t *wc = arg;
+
+	if (wc == NULL)
+		return;
+
+	consolidate_destroy (wc->wc_cons);
+	sfree (wc);
+} /* }}} void write_consolidate_destroy */
+
+/* Passes on the values of series which received nothing for a whole interval
+ * of the given writer, or all writers if `plugin' is NULL. */
+static void write_consolidate_flush_all (const char *plugin) /* {{{ */
+{
+	llentry_t *le;
+	cdtime_t now;
+
+	if (list_write == NULL)
+		return;
+
+	now = cdtime ();
+	for (le = llist_head (list_write); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
+		write_consolidate_t *wc;
+
+		if (cf->cf_callback != (void *) write_consolidate_add)
+			continue;
+		if ((plugin != NULL) && (strcmp (plugin, le->key) != 0))
+			continue;
+
+		wc = cf->cf_udata.data;
+		consolidate_flush (wc->wc_cons, now);
+		if (wc->wc_batch != NULL)
+			write_batch_flush (wc->wc_batch);
+	}
+} /* }}} void write_consolidate_flush_all */
+
+/* Passes `msg' to all log callbacks. */
+static void log_dispatch (int level, const char *msg) /* {{{ */
+{
+	llentry_t *le;
+
+	le = llist_head (list_log);
+	while (le != NULL)
+	{
+		callback_func_t *cf;
+		plugin_log_cb callback;
+
+		cf = le->value;
+		callback = cf->cf_callback;
+
+		(*callback) (level, msg, &cf->cf_udata);
+
+		le = le->next;
+	}
+} /* }}} void log_dispatch */
+
+/* Starts the log thread, if configured. */
+static void start_log_queue (void) /* {{{ */
+{
+	const char *str;
+
+	str = global_option_get ("LogQueueLimit");
+	log_queue_start ((str != NULL) ? atoi (str) : 0, log_dispatch);
+} /* }}} void start_log_queue */
+
+/* Passes `n' to all notification callbacks. */
+static void notification_dispatch (const notification_t *n) /* {{{ */
+{
+	llentry_t *le;
+
+	le = llist_head (list_notification);
+	while (le != NULL)
+	{
+		callback_func_t *cf;
+		plugin_notification_cb callback;
+		int status;
+
+		cf = le->value;
+		callback = cf->cf_callback;
+		status = (*callback) (n, &cf->cf_udata);
+		if (status != 0)
+		{
+			WARNING ("plugin_dispatch_notification: Notification "
+					"callback %s returned %i.",
+					le->key, status);
+		}
+
+		le = le->next;
+	}
+} /* }}} void notification_dispatch */
+
+/* Starts the notification queues and coalescing, if configured. */
+static void start_notification_queues (void) /* {{{ */
+{
+	const char *str;
+	double interval;
+	int limit;
+	int threads;
+
+	str = global_option_get ("NotificationCoalesceInterval");
+	interval = (str != NULL) ? atof (str) : 0.0;
+	str = global_option_get ("NotificationQueueLimit");
+	limit = (str != NULL) ? atoi (str) : 0;
+	str = global_option_get ("NotificationQueueThreads");
+	threads = (str != NULL) ? atoi (str) : 1;
+
+	notif_queue_start ((interval > 0.0) ? DOUBLE_TO_CDTIME_T (interval) : 0,
+			limit, threads, notification_dispatch);
+} /* }}} void start_notification_queues */
+
+/* Dispatches the queue length and number of dropped values of each write
+ * queue. Called from the main loop once per interval. */
+static void write_queues_submit_stats (void) /* {{{ */
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	write_queue_t *wq;
+
+	/* Collect the numbers first: dispatching from within the loop would
+	 * need `write_queues_lock' recursively. */
+	char (*names)[DATA_MAX_NAME_LEN] = NULL;
+	gauge_t *lengths = NULL;
+	derive_t *dropped = NULL;
+	size_t num = 0;
+	size_t i;
+
+	pthread_rwlock_rdlock (&write_queues_lock);
+	for (wq = write_queues; wq != NULL; wq = wq->next)
+		num++;
+
+	if (num > 0)
+	{
+		names = calloc (num, sizeof (*names));
+		lengths = calloc (num, sizeof (*lengths));
+		dropped = calloc (num, sizeof (*dropped));
+	}
+
+	if ((names == NULL) || (lengths == NULL) || (dropped == NULL))
+	{
+		pthread_rwlock_unlock (&write_queues_lock);
+		sfree (names);
+		sfree (lengths);
+		sfree (dropped);
+		return;
+	}
+
+	for (i = 0, wq = write_queues; (wq != NULL) && (i < num);
+			i++, wq = wq->next)
+	{
+		size_t j;
+
+		sstrncpy (names[i], wq->wq_name, sizeof (names[i]));
+		lengths[i] = 0.0;
+		dropped[i] = 0;
+		for (j = 0; j < wq->wq_rings_num; j++)
+		{
+			write_ring_t *wr = wq->wq_rings + j;
+
+			pthread_mutex_lock (&wr->wr_lock);
+			lengths[i] += (gauge_t) wr->wr_length;
+			dropped[i] += (derive_t) wr->wr_dropped;
+			pthread_mutex_unlock (&wr->wr_lock);
+		}
+	}
+	pthread_rwlock_unlock (&write_queues_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "write_queue", sizeof (vl.plugin));
+
+	for (i = 0; i < num; i++)
+	{
+		sstrncpy (vl.plugin_instance, names[i], sizeof (vl.plugin_instance));
+
+		sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		values[0].gauge = lengths[i];
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+		values[0].derive = dropped[i];
+		plugin_dispatch_values (&vl);
+	}
+
+	sfree (names);
+	sfree (lengths);
+	sfree (dropped);
+} /* }}} void write_queues_submit_stats */
+
+/*
+ * Public functions
+ */
+void plugin_set_dir (const char *dir)
+{
+	if (plugindir != NULL)
+		free (plugindir);
+
+	if (dir == NULL)
+		plugindir = NULL;
+	else if ((plugindir = strdup (dir)) == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("strdup failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
 	}
 }
 
+static void plugin_record_load_time (const char *name, /* {{{ */
+		cdtime_t duration)
+{
+	load_time_t *lt;
+
+	DEBUG ("plugin_load: Loading plugin `%s' took %.3f seconds.",
+			name, CDTIME_T_TO_DOUBLE (duration));
+
+	if (!IS_TRUE (global_option_get ("ReportStartupTimes")))
+		return;
+
+	lt = malloc (sizeof (*lt));
+	if (lt == NULL)
+		return;
+	memset (lt, 0, sizeof (*lt));
+	sstrncpy (lt->name, name, sizeof (lt->name));
+	lt->duration = duration;
+
+	if (load_times_tail == NULL)
+		load_times = lt;
+	else
+		load_times_tail->next = lt;
+	load_times_tail = lt;
+} /* }}} void plugin_record_load_time */
+
 #define BUFSIZE 512
 int plugin_load (const char *type, uint32_t flags)
 {
@@ -590,6 +2775,7 @@ int plugin_load (const char *type, uint32_t flags)
 	int   ret;
 	struct stat    statbuf;
 	struct dirent *de;
+	cdtime_t start;
 	int status;
 
 	DEBUG ("type = %s", type);
@@ -642,10 +2828,13 @@ int plugin_load (const char *type, uint32_t flags)
 			continue;
 		}
 
+		start = cdtime_monotonic ();
 		if (plugin_load_file (filename, flags) == 0)
 		{
 			/* success */
 			ret = 0;
+			plugin_record_load_time (type,
+					cdtime_monotonic () - start);
 			break;
 		}
 		else
@@ -662,6 +2851,83 @@ int plugin_load (const char *type, uint32_t flags)
 	return (ret);
 }
 
+int plugin_load_deferred (const char *name, uint32_t flags) /* {{{ */
+{
+	deferred_plugin_t *dp;
+
+	for (dp = deferred_plugins; dp != NULL; dp = dp->next)
+	{
+		if (strcasecmp (name, dp->name) == 0)
+		{
+			dp->flags |= flags;
+			return (0);
+		}
+	}
+
+	dp = malloc (sizeof (*dp));
+	if (dp == NULL)
+	{
+		ERROR ("plugin_load_deferred: malloc failed.");
+		return (-1);
+	}
+	memset (dp, 0, sizeof (*dp));
+	sstrncpy (dp->name, name, sizeof (dp->name));
+	dp->flags = flags;
+
+	dp->next = deferred_plugins;
+	deferred_plugins = dp;
+
+	DEBUG ("plugin_load_deferred: Loading `%s' when it's needed.", name);
+	return (0);
+} /* }}} int plugin_load_deferred */
+
+int plugin_load_pending (const char *name) /* {{{ */
+{
+	deferred_plugin_t *dp;
+	deferred_plugin_t *prev = NULL;
+	uint32_t flags;
+
+	if (name == NULL)
+		return (-EINVAL);
+
+	for (dp = deferred_plugins; dp != NULL; prev = dp, dp = dp->next)
+		if (strcasecmp (name, dp->name) == 0)
+			break;
+
+	if (dp == NULL)
+		return (ENOENT);
+
+	if (prev == NULL)
+		deferred_plugins = dp->next;
+	else
+		prev->next = dp->next;
+
+	flags = dp->flags;
+	sfree (dp);
+
+	return (plugin_load (name, flags));
+} /* }}} int plugin_load_pending */
+
+void plugin_load_pending_finish (void) /* {{{ */
+{
+	while (deferred_plugins != NULL)
+	{
+		deferred_plugin_t *dp = deferred_plugins;
+
+		deferred_plugins = dp->next;
+
+		INFO ("plugin: Not loading the `%s' plugin, because neither a "
+				"configuration block nor a reference to it has "
+				"been found.", dp->name);
+		sfree (dp);
+	}
+} /* }}} void plugin_load_pending_finish */
+
+void plugin_set_config_duration (cdtime_t duration) /* {{{ */
+{
+	config_duration = duration;
+} /* }}} void plugin_set_config_duration */
+
 /*
  * The `register_*' functions follow
  */
@@ -686,32 +2952,32 @@ int plugin_register_init (const char *name,
 				/* user_data = */ NULL));
 } /* plugin_register_init */
 
-static int plugin_compare_read_func (const void *arg0, const void *arg1)
+int plugin_register_init_parallel (const char *name,
+		int (*callback) (void))
 {
-	const read_func_t *rf0;
-	const read_func_t *rf1;
+	llentry_t *le;
+	int status;
 
-	rf0 = arg0;
-	rf1 = arg1;
+	status = create_register_callback (&list_init, name, (void *) callback,
+			/* user_data = */ NULL);
+	if (status != 0)
+		return (status);
 
-	if (rf0->rf_next_read.tv_sec < rf1->rf_next_read.tv_sec)
-		return (-1);
-	else if (rf0->rf_next_read.tv_sec > rf1->rf_next_read.tv_sec)
-		return (1);
-	else if (rf0->rf_next_read.tv_nsec < rf1->rf_next_read.tv_nsec)
-		return (-1);
-	else if (rf0->rf_next_read.tv_nsec > rf1->rf_next_read.tv_nsec)
-		return (1);
-	else
-		return (0);
-} /* int plugin_compare_read_func */
+	pthread_mutex_lock (&register_lock);
+	le = llist_search (list_init, name);
+	if (le != NULL)
+		((callback_func_t *) le->value)->cf_parallel = 1;
+	pthread_mutex_unlock (&register_lock);
+
+	return (0);
+} /* plugin_register_init_parallel */
 
-/* Add a read function to both, the heap and a linked list. The linked list if
- * used to look-up read functions, especially for the remove function. The heap
- * is used to determine which plugin to read next. */
+/* Add a read function to both, the scheduler and a linked list. The linked
+ * list is used to look-up read functions, especially for the remove function.
+ * The scheduler determines which plugin to read next. */
 static int plugin_insert_read (read_func_t *rf)
 {
-	int status;
+	read_options_t *ro;
 	llentry_t *le;
 
 	pthread_mutex_lock (&read_lock);
@@ -727,17 +2993,6 @@ static int plugin_insert_read (read_func_t *rf)
 		}
 	}
 
-	if (read_heap == NULL)
-	{
-		read_heap = c_heap_create (plugin_compare_read_func);
-		if (read_heap == NULL)
-		{
-			pthread_mutex_unlock (&read_lock);
-			ERROR ("plugin_insert_read: c_heap_create failed.");
-			return (-1);
-		}
-	}
-
 	le = llist_search (read_list, rf->rf_name);
 	if (le != NULL)
 	{
@@ -757,19 +3012,21 @@ static int plugin_insert_read (read_func_t *rf)
 		return (-1);
 	}
 
-	status = c_heap_insert (read_heap, rf);
-	if (status != 0)
+	ro = read_options_get (rf);
+	if (ro != NULL)
 	{
-		pthread_mutex_unlock (&read_lock);
-		ERROR ("plugin_insert_read: c_heap_insert failed.");
-		llentry_destroy (le);
-		return (-1);
+		rf->rf_timeout = ro->timeout;
+		rf->rf_slow = ro->slow;
 	}
 
 	/* This does not fail. */
 	llist_append (read_list, le);
 
 	pthread_mutex_unlock (&read_lock);
+
+	/* The scheduler may call the function right away, so this has to be
+	 * the last step. */
+	read_pending_push (rf);
 	return (0);
 } /* int plugin_insert_read */
 
@@ -793,8 +3050,7 @@ int plugin_register_read (const char *name,
 	rf->rf_group[0] = '\0';
 	sstrncpy (rf->rf_name, name, sizeof (rf->rf_name));
 	rf->rf_type = RF_SIMPLE;
-	rf->rf_interval.tv_sec = 0;
-	rf->rf_interval.tv_nsec = 0;
+	rf->rf_interval = 0;
 	rf->rf_effective_interval = rf->rf_interval;
 
 	status = plugin_insert_read (rf);
@@ -829,7 +3085,7 @@ int plugin_register_complex_read (const char *group, const char *name,
 	rf->rf_type = RF_COMPLEX;
 	if (interval != NULL)
 	{
-		rf->rf_interval = *interval;
+		rf->rf_interval = TIMESPEC_TO_CDTIME_T (interval);
 	}
 	rf->rf_effective_interval = rf->rf_interval;
 
@@ -851,13 +3107,160 @@ int plugin_register_complex_read (const char *group, const char *name,
 	return (status);
 } /* int plugin_register_complex_read */
 
+/* Wraps the write callback of a plugin with a `WriteInterval' in
+ * `write_consolidate_add'. */
+static int write_consolidate_create (const write_options_t *wo, /* {{{ */
+		plugin_write_cb callback, user_data_t *ud, user_data_t *ret_ud)
+{
+	write_consolidate_t *wc;
+
+	wc = malloc (sizeof (*wc));
+	if (wc == NULL)
+	{
+		ERROR ("plugin_register_write: malloc failed.");
+		return (-1);
+	}
+	memset (wc, 0, sizeof (*wc));
+
+	if ((callback == write_batch_add) && (ud != NULL))
+		wc->wc_batch = ud->data;
+
+	wc->wc_cons = consolidate_create (wo->interval, wo->consolidation,
+			callback, ud);
+	if (wc->wc_cons == NULL)
+	{
+		ERROR ("plugin_register_write: consolidate_create failed.");
+		sfree (wc);
+		return (-1);
+	}
+
+	memset (ret_ud, 0, sizeof (*ret_ud));
+	ret_ud->data = wc;
+	ret_ud->free_func = write_consolidate_destroy;
+
+	return (0);
+} /* }}} int write_consolidate_create */
+
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *ud)
 {
-	return (create_register_callback (&list_write, name,
-				(void *) callback, ud));
+	write_options_t *wo;
+	user_data_t ws_ud;
+	user_data_t wc_ud;
+	llentry_t *le;
+	int status;
+
+	/* Batch writers keep their spool in the batch. */
+	wo = write_options_get (name);
+	if ((wo != NULL) && (wo->spool_dir != NULL)
+			&& (callback != write_batch_add))
+	{
+		write_spool_t *ws = write_spool_create (wo, name);
+
+		if (ws != NULL)
+		{
+			ws->ws_callback = callback;
+			if (ud != NULL)
+				ws->ws_udata = *ud;
+
+			memset (&ws_ud, 0, sizeof (ws_ud));
+			ws_ud.data = ws;
+			ws_ud.free_func = write_spool_destroy;
+
+			callback = write_spool_add;
+			ud = &ws_ud;
+		}
+	}
+
+	if ((wo != NULL) && (wo->interval > 0))
+	{
+		if (write_consolidate_create (wo, callback, ud, &wc_ud) != 0)
+			return (-1);
+
+		callback = write_consolidate_add;
+		ud = &wc_ud;
+	}
+
+	/* An existing callback of the same name is about to be replaced, so
+	 * its queue has to go first. */
+	pthread_rwlock_wrlock (&write_queues_lock);
+	if (write_queues_threads > 0)
+		write_queue_remove (name);
+
+	status = create_register_callback (&list_write, name,
+			(void *) callback, ud);
+
+	if (status == 0)
+	{
+		le = llist_search (list_write, name);
+		if (le != NULL)
+		{
+			callback_func_t *cf = le->value;
+			cf->cf_batch = (callback == write_batch_add);
+
+			/* Writers registered after `plugin_init_all' get a
+			 * queue, too. */
+			if (write_queues_threads > 0)
+				write_queue_add (le->key, cf);
+		}
+	}
+	write_generation++;
+	pthread_rwlock_unlock (&write_queues_lock);
+
+	return (status);
 } /* int plugin_register_write */
 
+int plugin_register_write_batch (const char *name, /* {{{ */
+		plugin_write_batch_cb callback, size_t batch_size,
+		cdtime_t batch_timeout, user_data_t *ud)
+{
+	write_options_t *wo;
+	write_batch_t *wb;
+	user_data_t wb_ud;
+
+	if (batch_size < 1)
+		batch_size = 1;
+
+	wb = malloc (sizeof (*wb));
+	if (wb == NULL)
+	{
+		ERROR ("plugin_register_write_batch: malloc failed.");
+		return (-1);
+	}
+	memset (wb, 0, sizeof (*wb));
+
+	sstrncpy (wb->wb_name, name, sizeof (wb->wb_name));
+	wb->wb_callback = callback;
+	if (ud != NULL)
+		wb->wb_udata = *ud;
+	wb->wb_size = batch_size;
+	wb->wb_timeout = batch_timeout;
+	pthread_mutex_init (&wb->wb_lock, /* attr = */ NULL);
+
+	wb->wb_elems = calloc (wb->wb_size, sizeof (*wb->wb_elems));
+	if (wb->wb_elems == NULL)
+	{
+		ERROR ("plugin_register_write_batch: calloc failed.");
+		pthread_mutex_destroy (&wb->wb_lock);
+		sfree (wb);
+		return (-1);
+	}
+
+	wo = write_options_get (name);
+	if ((wo != NULL) && (wo->spool_dir != NULL))
+	{
+		wb->wb_spool = write_spool_create (wo, name);
+		if (wb->wb_spool != NULL)
+			wb->wb_spool->ws_batch = wb;
+	}
+
+	memset (&wb_ud, 0, sizeof (wb_ud));
+	wb_ud.data = wb;
+	wb_ud.free_func = write_batch_destroy;
+
+	return (plugin_register_write (name, write_batch_add, &wb_ud));
+} /* }}} int plugin_register_write_batch */
+
 int plugin_register_flush (const char *name,
 		plugin_flush_cb callback, user_data_t *ud)
 {
@@ -872,6 +3275,13 @@ int plugin_register_missing (const char *name,
 				(void *) callback, ud));
 } /* int plugin_register_missing */
 
+int plugin_register_range (const char *name,
+		plugin_range_cb callback, user_data_t *ud)
+{
+	return (create_register_callback (&list_range, name,
+				(void *) callback, ud));
+} /* int plugin_register_range */
+
 int plugin_register_shutdown (const char *name,
 		int (*callback) (void))
 {
@@ -879,41 +3289,112 @@ int plugin_register_shutdown (const char *name,
 				(void *) callback, /* user_data = */ NULL));
 } /* int plugin_register_shutdown */
 
+static plugin_data_set_t **type_id_slot (int id) /* {{{ */
+{
+	plugin_data_set_t **chunk;
+
+	if ((id < 1) || (id > type_ids_num))
+		return (NULL);
+
+	chunk = type_ids[(id - 1) / TYPE_ID_CHUNK_SIZE];
+	if (chunk == NULL)
+		return (NULL);
+
+	return (chunk + ((id - 1) % TYPE_ID_CHUNK_SIZE));
+} /* }}} plugin_data_set_t **type_id_slot */
+
+/* Assigns a new ID and stores `pds' in its slot. */
+static int type_id_assign (plugin_data_set_t *pds) /* {{{ */
+{
+	int chunk = type_ids_num / TYPE_ID_CHUNK_SIZE;
+
+	if (chunk >= TYPE_ID_CHUNKS)
+	{
+		ERROR ("plugin_register_data_set: Too many types have been "
+				"registered.");
+		return (-1);
+	}
+
+	if (type_ids[chunk] == NULL)
+	{
+		type_ids[chunk] = calloc (TYPE_ID_CHUNK_SIZE,
+				sizeof (*type_ids[chunk]));
+		if (type_ids[chunk] == NULL)
+		{
+			ERROR ("plugin_register_data_set: calloc failed.");
+			return (-1);
+		}
+	}
+
+	type_ids[chunk][type_ids_num % TYPE_ID_CHUNK_SIZE] = pds;
+	type_ids_num++;
+	pds->id = type_ids_num;
+
+	return (0);
+} /* }}} int type_id_assign */
+
 int plugin_register_data_set (const data_set_t *ds)
 {
+	plugin_data_set_t *pds;
 	data_set_t *ds_copy;
+	int id = 0;
 	int i;
 
 	if ((data_sets != NULL)
-			&& (c_avl_get (data_sets, ds->type, NULL) == 0))
+			&& (c_hashtable_get (data_sets, ds->type, (void *) &pds) == 0))
 	{
 		NOTICE ("Replacing DS `%s' with another version.", ds->type);
+		/* The new version keeps the ID of the old one. */
+		id = pds->id;
 		plugin_unregister_data_set (ds->type);
 	}
 	else if (data_sets == NULL)
 	{
-		data_sets = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+		data_sets = c_hashtable_create (c_hashtable_hash_string,
+				(int (*) (const void *, const void *)) strcmp);
 		if (data_sets == NULL)
 			return (-1);
 	}
 
-	ds_copy = (data_set_t *) malloc (sizeof (data_set_t));
-	if (ds_copy == NULL)
+	pds = (plugin_data_set_t *) malloc (sizeof (*pds));
+	if (pds == NULL)
 		return (-1);
+	ds_copy = &pds->ds;
 	memcpy(ds_copy, ds, sizeof (data_set_t));
 
 	ds_copy->ds = (data_source_t *) malloc (sizeof (data_source_t)
 			* ds->ds_num);
 	if (ds_copy->ds == NULL)
 	{
-		free (ds_copy);
+		free (pds);
 		return (-1);
 	}
 
 	for (i = 0; i < ds->ds_num; i++)
 		memcpy (ds_copy->ds + i, ds->ds + i, sizeof (data_source_t));
 
-	return (c_avl_insert (data_sets, (void *) ds_copy->type, (void *) ds_copy));
+	if (id > 0)
+	{
+		pds->id = id;
+		*type_id_slot (id) = pds;
+	}
+	else if (type_id_assign (pds) != 0)
+	{
+		free (ds_copy->ds);
+		free (pds);
+		return (-1);
+	}
+
+	if (c_hashtable_insert (data_sets, (void *) ds_copy->type,
+				(void *) pds) != 0)
+	{
+		*type_id_slot (pds->id) = NULL;
+		free (ds_copy->ds);
+		free (pds);
+		return (-1);
+	}
+
+	return (0);
 } /* int plugin_register_data_set */
 
 int plugin_register_log (const char *name,
@@ -1050,7 +3531,16 @@ int plugin_unregister_read_group (const char *group) /* {{{ */
 
 int plugin_unregister_write (const char *name)
 {
-	return (plugin_unregister (list_write, name));
+	int status;
+
+	pthread_rwlock_wrlock (&write_queues_lock);
+	if (write_queues_threads > 0)
+		write_queue_remove (name);
+	status = plugin_unregister (list_write, name);
+	write_generation++;
+	pthread_rwlock_unlock (&write_queues_lock);
+
+	return (status);
 }
 
 int plugin_unregister_flush (const char *name)
@@ -1063,6 +3553,11 @@ int plugin_unregister_missing (const char *name)
 	return (plugin_unregister (list_missing, name));
 }
 
+int plugin_unregister_range (const char *name)
+{
+	return (plugin_unregister (list_range, name));
+}
+
 int plugin_unregister_shutdown (const char *name)
 {
 	return (plugin_unregister (list_shutdown, name));
@@ -1070,16 +3565,17 @@ int plugin_unregister_shutdown (const char *name)
 
 int plugin_unregister_data_set (const char *name)
 {
-	data_set_t *ds;
+	plugin_data_set_t *pds;
 
 	if (data_sets == NULL)
 		return (-1);
 
-	if (c_avl_remove (data_sets, name, NULL, (void *) &ds) != 0)
+	if (c_hashtable_remove (data_sets, name, NULL, (void *) &pds) != 0)
 		return (-1);
 
-	sfree (ds->ds);
-	sfree (ds);
+	*type_id_slot (pds->id) = NULL;
+	sfree (pds->ds.ds);
+	sfree (pds);
 
 	return (0);
 } /* int plugin_unregister_data_set */
@@ -1094,11 +3590,202 @@ int plugin_unregister_notification (const char *name)
 	return (plugin_unregister (list_notification, name));
 }
 
+static void init_job_run (init_job_t *job) /* {{{ */
+{
+	cdtime_t start;
+
+	start = cdtime ();
+	job->status = (*job->callback) ();
+	job->duration = cdtime () - start;
+
+	/* Log slow plugins even without debugging, so that it's easy to see
+	 * what delays the start. */
+	if ((job->duration >= TIME_T_TO_CDTIME_T (1))
+			|| IS_TRUE (global_option_get ("ReportStartupTimes")))
+		INFO ("plugin_init_all: Initializing plugin `%s' took %.3f "
+				"seconds.", job->name,
+				CDTIME_T_TO_DOUBLE (job->duration));
+	else
+		DEBUG ("plugin_init_all: Initializing plugin `%s' took %.3f "
+				"seconds.", job->name,
+				CDTIME_T_TO_DOUBLE (job->duration));
+} /* }}} void init_job_run */
+
+static void *init_thread (void *arg) /* {{{ */
+{
+	init_pool_t *pool = arg;
+
+	while (42)
+	{
+		init_job_t *job = NULL;
+
+		pthread_mutex_lock (&pool->lock);
+		while (pool->next < pool->jobs_num)
+		{
+			job = pool->jobs + pool->next;
+			pool->next++;
+			if (job->parallel)
+				break;
+			job = NULL;
+		}
+		pthread_mutex_unlock (&pool->lock);
+
+		if (job == NULL)
+			break;
+
+		init_job_run (job);
+	}
+
+	return ((void *) 0);
+} /* }}} void *init_thread */
+
+/* Copies `list_init', so that init callbacks may register further callbacks
+ * while the others are running. */
+static int init_jobs_create (init_job_t **ret_jobs, /* {{{ */
+		size_t *ret_jobs_num, size_t *ret_parallel_num)
+{
+	init_job_t *jobs;
+	size_t jobs_num = 0;
+	size_t parallel_num = 0;
+	llentry_t *le;
+
+	for (le = llist_head (list_init); le != NULL; le = le->next)
+		jobs_num++;
+
+	jobs = calloc (jobs_num + 1, sizeof (*jobs));
+	if (jobs == NULL)
+		return (-1);
+
+	jobs_num = 0;
+	for (le = llist_head (list_init); le != NULL; le = le->next)
+	{
+		callback_func_t *cf = le->value;
+
+		sstrncpy (jobs[jobs_num].name, le->key,
+				sizeof (jobs[jobs_num].name));
+		jobs[jobs_num].callback = cf->cf_callback;
+		jobs[jobs_num].parallel = cf->cf_parallel;
+		if (cf->cf_parallel)
+			parallel_num++;
+		jobs_num++;
+	}
+
+	*ret_jobs = jobs;
+	*ret_jobs_num = jobs_num;
+	*ret_parallel_num = parallel_num;
+	return (0);
+} /* }}} int init_jobs_create */
+
+/* Runs all init callbacks. Those registered with
+ * `plugin_register_init_parallel' are started on up to `InitThreads'
+ * threads, while the main thread runs the remaining callbacks in order. */
+static void init_all_callbacks (void) /* {{{ */
+{
+	init_pool_t pool;
+	pthread_t *threads = NULL;
+	size_t threads_num = 0;
+	size_t parallel_num;
+	size_t i;
+	int num;
+
+	memset (&pool, 0, sizeof (pool));
+	if (init_jobs_create (&pool.jobs, &pool.jobs_num, &parallel_num) != 0)
+	{
+		ERROR ("plugin_init_all: calloc failed.");
+		return;
+	}
+	pthread_mutex_init (&pool.lock, /* attr = */ NULL);
+
+	num = atoi (global_option_get ("InitThreads"));
+	if ((num > 0) && (parallel_num > 0))
+	{
+		if ((size_t) num > parallel_num)
+			num = (int) parallel_num;
+
+		threads = calloc ((size_t) num, sizeof (*threads));
+		if (threads == NULL)
+			ERROR ("plugin_init_all: calloc failed.");
+
+		for (i = 0; (threads != NULL) && (i < (size_t) num); i++)
+		{
+			if (thread_create (threads + threads_num, NULL,
+						init_thread, &pool, "init",
+						/* cpus = */ NULL) != 0)
+			{
+				ERROR ("plugin_init_all: pthread_create failed.");
+				break;
+			}
+			threads_num++;
+		}
+	}
+
+	for (i = 0; i < pool.jobs_num; i++)
+	{
+		/* Without init threads, run the parallel callbacks here. */
+		if (pool.jobs[i].parallel && (threads_num > 0))
+			continue;
+		init_job_run (pool.jobs + i);
+	}
+
+	for (i = 0; i < threads_num; i++)
+		pthread_join (threads[i], NULL);
+	sfree (threads);
+	pthread_mutex_destroy (&pool.lock);
+
+	for (i = 0; i < pool.jobs_num; i++)
+	{
+		if (pool.jobs[i].status == 0)
+			continue;
+
+		ERROR ("Initialization of plugin `%s' "
+				"failed with status %i. "
+				"Plugin will be unloaded.",
+				pool.jobs[i].name, pool.jobs[i].status);
+		/* Plugins that register read callbacks from the init
+		 * callback should take care of appropriate error
+		 * handling themselves. */
+		/* FIXME: Unload _all_ functions */
+		plugin_unregister_read (pool.jobs[i].name);
+	}
+
+	sfree (pool.jobs);
+} /* }}} void init_all_callbacks */
+
+/* Logs the times it took to load the plugins, collected for
+ * `ReportStartupTimes', and frees them. Returns the total. */
+static cdtime_t report_load_times (int *ret_num) /* {{{ */
+{
+	cdtime_t total = 0;
+	int num = 0;
+
+	while (load_times != NULL)
+	{
+		load_time_t *lt = load_times;
+
+		load_times = lt->next;
+
+		INFO ("plugin_init_all: Loading plugin `%s' took %.3f seconds.",
+				lt->name, CDTIME_T_TO_DOUBLE (lt->duration));
+		total += lt->duration;
+		num++;
+		sfree (lt);
+	}
+	load_times_tail = NULL;
+
+	*ret_num = num;
+	return (total);
+} /* }}} cdtime_t report_load_times */
+
 void plugin_init_all (void)
 {
 	const char *chain_name;
-	llentry_t *le;
-	int status;
+	cdtime_t load_duration;
+	cdtime_t init_start;
+	int load_num;
+
+	/* Pass log messages on from a separate thread from now on. */
+	start_log_queue ();
+	start_notification_queues ();
 
 	/* Init the value cache */
 	uc_init ();
@@ -1109,55 +3796,72 @@ void plugin_init_all (void)
 	chain_name = global_option_get ("PostCacheChain");
 	post_cache_chain = fc_chain_get_by_name (chain_name);
 
+	if (IS_TRUE (global_option_get ("FilterChainStatistics")))
+		fc_statistics_init ();
 
-	if ((list_init == NULL) && (read_heap == NULL))
-		return;
-
-	/* Calling all init callbacks before checking if read callbacks
-	 * are available allows the init callbacks to register the read
-	 * callback. */
-	le = llist_head (list_init);
-	while (le != NULL)
-	{
-		callback_func_t *cf;
-		plugin_init_cb callback;
+	phase_spreading = IS_TRUE (global_option_get ("PhaseSpreading"));
+	read_time_cached = IS_TRUE (global_option_get ("CacheReadTime"));
+	callback_stats_enabled = IS_TRUE (global_option_get ("CallbackStatistics"));
+	if (IS_TRUE (global_option_get ("PipelineTracing")))
+		pipeline_trace_init ();
+	mem_init ();
 
-		cf = le->value;
-		callback = cf->cf_callback;
-		status = (*callback) ();
 
-		if (status != 0)
-		{
-			ERROR ("Initialization of plugin `%s' "
-					"failed with status %i. "
-					"Plugin will be unloaded.",
-					le->key, status);
-			/* Plugins that register read callbacks from the init
-			 * callback should take care of appropriate error
-			 * handling themselves. */
-			/* FIXME: Unload _all_ functions */
-			plugin_unregister_read (le->key);
-		}
+	load_duration = report_load_times (&load_num);
 
-		le = le->next;
-	}
+	/* Calling all init callbacks before checking if read callbacks
+	 * are available allows the init callbacks to register the read
+	 * callback. */
+	init_start = cdtime_monotonic ();
+	if (list_init != NULL)
+		init_all_callbacks ();
+
+	if (IS_TRUE (global_option_get ("ReportStartupTimes")))
+		INFO ("plugin_init_all: Reading the configuration took %.3f "
+				"seconds, %.3f of which were spent loading %i "
+				"plugin%s. Initialization took %.3f seconds.",
+				CDTIME_T_TO_DOUBLE (config_duration),
+				CDTIME_T_TO_DOUBLE (load_duration), load_num,
+				(load_num == 1) ? "" : "s",
+				CDTIME_T_TO_DOUBLE (cdtime_monotonic ()
+					- init_start));
+
+	if ((list_init == NULL) && (read_list == NULL))
+		return;
 
 	/* Start read-threads */
-	if (read_heap != NULL)
+	if (read_list != NULL)
 	{
 		const char *rt;
 		int num;
 		rt = global_option_get ("ReadThreads");
 		num = atoi (rt);
 		if (num != -1)
-			start_read_threads ((num > 0) ? num : 5);
+			start_read_threads ((num > 0) ? num : 5,
+					atoi (global_option_get ("SlowReadThreads")));
 	}
+
+	start_write_queues ();
 } /* void plugin_init_all */
 
 /* TODO: Rename this function. */
 void plugin_read_all (void)
 {
 	uc_check_timeout ();
+	write_batch_flush_expired ();
+
+	if (write_queues_threads > 0)
+		write_queues_submit_stats ();
+
+	notif_queue_submit_stats ();
+
+	if (callback_stats_enabled)
+		callback_stats_submit ();
+
+	if (pipeline_trace_enabled)
+		pipeline_trace_submit ();
+
+	mem_check ();
 
 	return;
 } /* void plugin_read_all */
@@ -1168,19 +3872,34 @@ int plugin_read_all_once (void)
 	int status;
 	int return_status = 0;
 
-	if (read_heap == NULL)
+	c_timer_t *t;
+
+	/* No read thread has been started, so all functions are still waiting
+	 * to be scheduled. */
+	t = __sync_lock_test_and_set (&read_pending, NULL);
+	if (t == NULL)
 	{
 		NOTICE ("No read-functions are registered.");
 		return (0);
 	}
 
-	while (42)
+	while (t != NULL)
 	{
-		read_func_t *rf;
+		read_func_t *rf = RF_FROM_TIMER (t);
+		arena_mark_t mark;
 
-		rf = c_heap_get_root (read_heap);
-		if (rf == NULL)
-			break;
+		t = t->next;
+
+		if (rf->rf_type == RF_REMOVE)
+		{
+			destroy_callback ((void *) rf);
+			continue;
+		}
+
+		if (read_time_cached)
+			cdtime_cache_set (cdtime_coarse ());
+
+		mark = arena_mark ();
 
 		if (rf->rf_type == RF_SIMPLE)
 		{
@@ -1197,6 +3916,11 @@ int plugin_read_all_once (void)
 			status = (*callback) (&rf->rf_udata);
 		}
 
+		arena_release (mark);
+
+		if (read_time_cached)
+			cdtime_cache_set (0);
+
 		if (status != 0)
 		{
 			NOTICE ("read-function of plugin `%s' failed.",
@@ -1210,6 +3934,68 @@ int plugin_read_all_once (void)
 	return (return_status);
 } /* int plugin_read_all_once */
 
+/* Hands `vl' to the write queue(s) instead of calling the write callbacks
+ * directly. Must be called with `write_queues_lock' held for reading. */
+static int plugin_write_enqueue (const char *plugin, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+  write_queue_elem_t *wqe;
+  write_queue_t *wq;
+  int success = 0;
+  int failure = 0;
+
+  wqe = write_queue_elem_create (ds, vl);
+  if (wqe == NULL)
+    return (ENOMEM);
+
+  for (wq = write_queues; wq != NULL; wq = wq->next)
+  {
+    if ((plugin != NULL) && (strcasecmp (plugin, wq->wq_name) != 0))
+      continue;
+
+    if (write_queue_enqueue (wq, wqe) == 0)
+      success++;
+    else
+      failure++;
+
+    if (plugin != NULL)
+      break;
+  }
+
+  /* Drop the creator's reference. */
+  write_queue_elem_release (wqe);
+
+  if ((plugin != NULL) && (success == 0) && (failure == 0))
+    return (ENOENT);
+  if ((success == 0) && (failure != 0))
+    return (-1);
+  return (0);
+} /* }}} int plugin_write_enqueue */
+
+static int plugin_write_call (const char *name, /* {{{ */
+    callback_func_t *cf, const data_set_t *ds, const value_list_t *vl)
+{
+  plugin_write_cb callback = cf->cf_callback;
+  cdtime_t start;
+  cdtime_t entry = 0;
+  int status;
+
+  if (!callback_stats_enabled && !CD_PROBE_ENABLED && !pipeline_trace_enabled)
+    return ((*callback) (ds, vl, &cf->cf_udata));
+
+  if (pipeline_trace_enabled)
+    entry = cdtime ();
+  start = cdtime_monotonic ();
+  status = (*callback) (ds, vl, &cf->cf_udata);
+  CD_PROBE4 (write__callback, name, vl->plugin, CD_PROBE_NS (start), status);
+  if (callback_stats_enabled)
+    callback_stats_add (&cf->cf_stats, "write", name, start, status);
+  if (pipeline_trace_enabled)
+    pipeline_trace_write (&cf->cf_trace, name, cf->cf_batch, vl, entry);
+
+  return (status);
+} /* }}} int plugin_write_call */
+
 int plugin_write (const char *plugin, /* {{{ */
 		const data_set_t *ds, const value_list_t *vl)
 {
@@ -1224,7 +4010,7 @@ int plugin_write (const char *plugin, /* {{{ */
 
   if (ds == NULL)
   {
-    ds = plugin_get_ds (vl->type);
+    ds = plugin_vl_get_ds (vl);
     if (ds == NULL)
     {
       ERROR ("plugin_write: Unable to lookup type `%s'.", vl->type);
@@ -1232,6 +4018,15 @@ int plugin_write (const char *plugin, /* {{{ */
     }
   }
 
+  pthread_rwlock_rdlock (&write_queues_lock);
+  if (write_queues != NULL)
+  {
+    status = plugin_write_enqueue (plugin, ds, vl);
+    pthread_rwlock_unlock (&write_queues_lock);
+    return (status);
+  }
+  pthread_rwlock_unlock (&write_queues_lock);
+
   if (plugin == NULL)
   {
     int success = 0;
@@ -1241,11 +4036,9 @@ int plugin_write (const char *plugin, /* {{{ */
     while (le != NULL)
     {
       callback_func_t *cf = le->value;
-      plugin_write_cb callback;
 
       DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
-      callback = cf->cf_callback;
-      status = (*callback) (ds, vl, &cf->cf_udata);
+      status = plugin_write_call (le->key, cf, ds, vl);
       if (status != 0)
         failure++;
       else
@@ -1262,7 +4055,6 @@ int plugin_write (const char *plugin, /* {{{ */
   else /* plugin != NULL */
   {
     callback_func_t *cf;
-    plugin_write_cb callback;
 
     le = llist_head (list_write);
     while (le != NULL)
@@ -1279,43 +4071,455 @@ int plugin_write (const char *plugin, /* {{{ */
     cf = le->value;
 
     DEBUG ("plugin: plugin_write: Writing values via %s.", le->key);
-    callback = cf->cf_callback;
-    status = (*callback) (ds, vl, &cf->cf_udata);
+    status = plugin_write_call (le->key, cf, ds, vl);
   }
 
   return (status);
 } /* }}} int plugin_write */
 
+plugin_write_handle_t *plugin_write_handle_create (const char *plugin) /* {{{ */
+{
+	plugin_write_handle_t *wh;
+
+	if (plugin == NULL)
+		return (NULL);
+
+	/* Referencing a deferred plugin loads it. */
+	plugin_load_pending (plugin);
+
+	wh = malloc (sizeof (*wh));
+	if (wh == NULL)
+	{
+		ERROR ("plugin_write_handle_create: malloc failed.");
+		return (NULL);
+	}
+	memset (wh, 0, sizeof (*wh));
+
+	sstrncpy (wh->wh_name, plugin, sizeof (wh->wh_name));
+	/* Outdated, so the first write looks the callback up. */
+	wh->wh_generation = 0;
+	pthread_mutex_init (&wh->wh_lock, /* attr = */ NULL);
+
+	return (wh);
+} /* }}} plugin_write_handle_t *plugin_write_handle_create */
+
+void plugin_write_handle_destroy (plugin_write_handle_t *wh) /* {{{ */
+{
+	if (wh == NULL)
+		return;
+
+	pthread_mutex_destroy (&wh->wh_lock);
+	sfree (wh);
+} /* }}} void plugin_write_handle_destroy */
+
+/* Looks up the callback and queue of `wh' again if callbacks have been added
+ * or removed since the last time. Must be called with `write_queues_lock'
+ * held for reading, which keeps the result valid until it is released. */
+static void plugin_write_handle_resolve (plugin_write_handle_t *wh) /* {{{ */
+{
+	llentry_t *le;
+	write_queue_t *wq;
+
+	if (wh->wh_generation == write_generation)
+		return;
+
+	pthread_mutex_lock (&wh->wh_lock);
+	if (wh->wh_generation != write_generation)
+	{
+		wh->wh_cf = NULL;
+		wh->wh_wq = NULL;
+
+		for (le = llist_head (list_write); le != NULL; le = le->next)
+		{
+			if (strcasecmp (wh->wh_name, le->key) != 0)
+				continue;
+
+			sstrncpy (wh->wh_key, le->key, sizeof (wh->wh_key));
+			wh->wh_cf = le->value;
+			break;
+		}
+
+		for (wq = write_queues; wq != NULL; wq = wq->next)
+		{
+			if (strcasecmp (wh->wh_name, wq->wq_name) != 0)
+				continue;
+
+			wh->wh_wq = wq;
+			break;
+		}
+
+		/* Other threads only use the result once they see the new
+		 * generation. */
+		__sync_synchronize ();
+		wh->wh_generation = write_generation;
+	}
+	pthread_mutex_unlock (&wh->wh_lock);
+} /* }}} void plugin_write_handle_resolve */
+
+int plugin_write_handle (plugin_write_handle_t *wh, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl)
+{
+	int status;
+
+	if ((wh == NULL) || (vl == NULL))
+		return (EINVAL);
+
+	if (ds == NULL)
+	{
+		ds = plugin_vl_get_ds (vl);
+		if (ds == NULL)
+		{
+			ERROR ("plugin_write_handle: Unable to lookup type `%s'.",
+					vl->type);
+			return (ENOENT);
+		}
+	}
+
+	/* Unlike `plugin_write', the lock is held while the callback runs, so
+	 * the callback can't be freed meanwhile. */
+	pthread_rwlock_rdlock (&write_queues_lock);
+	plugin_write_handle_resolve (wh);
+
+	if (wh->wh_wq != NULL)
+	{
+		write_queue_elem_t *wqe;
+
+		wqe = write_queue_elem_create (ds, vl);
+		if (wqe == NULL)
+			status = ENOMEM;
+		else
+			status = write_queue_enqueue (wh->wh_wq, wqe);
+		write_queue_elem_release (wqe);
+	}
+	else if (wh->wh_cf != NULL)
+	{
+		DEBUG ("plugin: plugin_write_handle: Writing values via %s.",
+				wh->wh_key);
+		status = plugin_write_call (wh->wh_key, wh->wh_cf, ds, vl);
+	}
+	else
+		status = ENOENT;
+	pthread_rwlock_unlock (&write_queues_lock);
+
+	return (status);
+} /* }}} int plugin_write_handle */
+
+static void *plugin_flush_thread (void *arg) /* {{{ */
+{
+	flush_call_t *fc = arg;
+	plugin_flush_cb callback = fc->cf->cf_callback;
+
+	(*callback) (fc->timeout, fc->identifier, &fc->cf->cf_udata);
+
+	return ((void *) 0);
+} /* }}} void *plugin_flush_thread */
+
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier)
 {
+  flush_call_t *calls;
+  size_t calls_num = 0;
   llentry_t *le;
+  size_t i;
+
+  /* Pending batches have to reach the writers before they are asked to
+   * flush. */
+  write_consolidate_flush_all (plugin);
+  write_batch_flush_all (plugin);
 
   if (list_flush == NULL)
     return (0);
 
-  le = llist_head (list_flush);
-  while (le != NULL)
+  for (le = llist_head (list_flush); le != NULL; le = le->next)
+    if ((plugin == NULL) || (strcmp (plugin, le->key) == 0))
+      calls_num++;
+
+  if (calls_num == 0)
+    return (0);
+
+  calls = calloc (calls_num, sizeof (*calls));
+  if (calls == NULL)
   {
-    callback_func_t *cf;
-    plugin_flush_cb callback;
+    ERROR ("plugin_flush: calloc failed.");
+    return (ENOMEM);
+  }
 
-    if ((plugin != NULL)
-        && (strcmp (plugin, le->key) != 0))
-    {
-      le = le->next;
+  i = 0;
+  for (le = llist_head (list_flush); le != NULL; le = le->next)
+  {
+    if ((plugin != NULL) && (strcmp (plugin, le->key) != 0))
       continue;
-    }
 
-    cf = le->value;
-    callback = cf->cf_callback;
+    calls[i].name = le->key;
+    calls[i].cf = le->value;
+    calls[i].timeout = timeout;
+    calls[i].identifier = identifier;
+    i++;
+  }
 
-    (*callback) (timeout, identifier, &cf->cf_udata);
+  /* The callbacks run concurrently, so a slow writer doesn't hold up the
+   * others. The last one is called by this thread. */
+  for (i = 0; i < calls_num - 1; i++)
+  {
+    char name[16];
+    int status;
 
-    le = le->next;
+    ssnprintf (name, sizeof (name), "flush/%s", calls[i].name);
+    status = thread_create (&calls[i].thread, /* attr = */ NULL,
+        plugin_flush_thread, calls + i, name, /* cpus = */ NULL);
+    if (status == 0)
+      calls[i].thread_running = 1;
+    else
+      plugin_flush_thread (calls + i);
   }
+  plugin_flush_thread (calls + (calls_num - 1));
+
+  for (i = 0; i < calls_num - 1; i++)
+    if (calls[i].thread_running)
+      pthread_join (calls[i].thread, /* retval = */ NULL);
+
+  sfree (calls);
   return (0);
 } /* int plugin_flush */
 
+static void flush_job_free (flush_job_t *job) /* {{{ */
+{
+	size_t i;
+
+	if (job == NULL)
+		return;
+
+	for (i = 0; i < job->plugins_num; i++)
+		sfree (job->plugins[i]);
+	sfree (job->plugins);
+	for (i = 0; i < job->identifiers_num; i++)
+		sfree (job->identifiers[i]);
+	sfree (job->identifiers);
+	sfree (job);
+} /* }}} void flush_job_free */
+
+/* Frees finished jobs beyond the newest `FLUSH_JOBS_KEEP' ones. */
+static void flush_jobs_prune_nolock (void) /* {{{ */
+{
+	flush_job_t *prev = NULL;
+	flush_job_t *job = flush_jobs;
+	int done_num = 0;
+
+	while (job != NULL)
+	{
+		flush_job_t *next = job->next;
+
+		if (job->done && (++done_num > FLUSH_JOBS_KEEP))
+		{
+			if (prev == NULL)
+				flush_jobs = next;
+			else
+				prev->next = next;
+			flush_job_free (job);
+		}
+		else
+			prev = job;
+
+		job = next;
+	}
+} /* }}} void flush_jobs_prune_nolock */
+
+static void *plugin_flush_job_thread (void *arg) /* {{{ */
+{
+	flush_job_t *job = arg;
+	int success = 0;
+	int error = 0;
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < job->plugins_num; i++)
+	{
+		for (j = 0; j < job->identifiers_num; j++)
+		{
+			if (plugin_flush (job->plugins[i], job->timeout,
+						job->identifiers[j]) == 0)
+				success++;
+			else
+				error++;
+		}
+	}
+
+	pthread_mutex_lock (&flush_jobs_lock);
+	job->success = success;
+	job->error = error;
+	job->done = 1;
+	flush_jobs_running--;
+	flush_jobs_prune_nolock ();
+	pthread_cond_broadcast (&flush_jobs_cond);
+	pthread_mutex_unlock (&flush_jobs_lock);
+
+	return ((void *) 0);
+} /* }}} void *plugin_flush_job_thread */
+
+/* Copies `src' to a newly allocated array. An empty `src' is copied as a
+ * single NULL entry. */
+static int flush_job_copy (char ***dst, size_t *dst_num, /* {{{ */
+		char const * const *src, size_t src_num)
+{
+	size_t i;
+
+	*dst_num = (src_num > 0) ? src_num : 1;
+	*dst = calloc (*dst_num, sizeof (**dst));
+	if (*dst == NULL)
+		return (ENOMEM);
+
+	for (i = 0; i < src_num; i++)
+	{
+		if (src[i] == NULL)
+			continue;
+		(*dst)[i] = strdup (src[i]);
+		if ((*dst)[i] == NULL)
+			return (ENOMEM);
+	}
+
+	return (0);
+} /* }}} int flush_job_copy */
+
+int plugin_flush_async (char const * const *plugins, /* {{{ */
+		size_t plugins_num,
+		char const * const *identifiers, size_t identifiers_num,
+		cdtime_t timeout, uint64_t *ret_token)
+{
+	flush_job_t *job;
+	pthread_t thread;
+	pthread_attr_t attr;
+	int status;
+
+	if (ret_token == NULL)
+		return (EINVAL);
+
+	job = calloc (1, sizeof (*job));
+	if (job == NULL)
+		return (ENOMEM);
+	job->timeout = timeout;
+
+	status = flush_job_copy (&job->plugins, &job->plugins_num,
+			plugins, plugins_num);
+	if (status == 0)
+		status = flush_job_copy (&job->identifiers, &job->identifiers_num,
+				identifiers, identifiers_num);
+	if (status != 0)
+	{
+		ERROR ("plugin_flush_async: Copying the arguments failed.");
+		flush_job_free (job);
+		return (status);
+	}
+
+	pthread_mutex_lock (&flush_jobs_lock);
+	if (flush_jobs_closed)
+	{
+		pthread_mutex_unlock (&flush_jobs_lock);
+		flush_job_free (job);
+		return (EBUSY);
+	}
+
+	pthread_attr_init (&attr);
+	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	status = thread_create (&thread, &attr, plugin_flush_job_thread, job,
+			"flush/async", /* cpus = */ NULL);
+	pthread_attr_destroy (&attr);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		pthread_mutex_unlock (&flush_jobs_lock);
+		ERROR ("plugin_flush_async: Starting the thread failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		flush_job_free (job);
+		return (status);
+	}
+
+	/* The thread blocks on the lock before it touches the job, so it's
+	 * safe to link the job only now. */
+	job->token = ++flush_jobs_token;
+	job->next = flush_jobs;
+	flush_jobs = job;
+	flush_jobs_running++;
+	*ret_token = job->token;
+	pthread_mutex_unlock (&flush_jobs_lock);
+
+	return (0);
+} /* }}} int plugin_flush_async */
+
+int plugin_flush_status (uint64_t token, /* {{{ */
+		int *ret_success, int *ret_error)
+{
+	flush_job_t *job;
+	int status = ENOENT;
+
+	pthread_mutex_lock (&flush_jobs_lock);
+	for (job = flush_jobs; job != NULL; job = job->next)
+	{
+		if (job->token != token)
+			continue;
+
+		if (!job->done)
+		{
+			status = EINPROGRESS;
+			break;
+		}
+
+		if (ret_success != NULL)
+			*ret_success = job->success;
+		if (ret_error != NULL)
+			*ret_error = job->error;
+		status = 0;
+		break;
+	}
+	pthread_mutex_unlock (&flush_jobs_lock);
+
+	return (status);
+} /* }}} int plugin_flush_status */
+
+/* Refuses new flush jobs, waits for the running ones and frees them all. */
+static void stop_flush_jobs (void) /* {{{ */
+{
+	pthread_mutex_lock (&flush_jobs_lock);
+	flush_jobs_closed = 1;
+	while (flush_jobs_running > 0)
+		pthread_cond_wait (&flush_jobs_cond, &flush_jobs_lock);
+
+	while (flush_jobs != NULL)
+	{
+		flush_job_t *next = flush_jobs->next;
+		flush_job_free (flush_jobs);
+		flush_jobs = next;
+	}
+	pthread_mutex_unlock (&flush_jobs_lock);
+} /* }}} void stop_flush_jobs */
+
+int plugin_read_range (const char *plugin, const char *identifier, /* {{{ */
+		cdtime_t start, cdtime_t end,
+		plugin_range_value_cb value_cb, void *value_data)
+{
+	llentry_t *le;
+	callback_func_t *cf;
+	plugin_range_cb callback;
+
+	if ((identifier == NULL) || (value_cb == NULL))
+		return (EINVAL);
+
+	if (list_range == NULL)
+		return (ENOENT);
+
+	if (plugin == NULL)
+		le = llist_head (list_range);
+	else
+		le = llist_search (list_range, plugin);
+
+	if (le == NULL)
+		return (ENOENT);
+
+	cf = le->value;
+	callback = cf->cf_callback;
+
+	return ((*callback) (identifier, start, end, value_cb, value_data,
+				&cf->cf_udata));
+} /* }}} int plugin_read_range */
+
 void plugin_shutdown_all (void)
 {
 	llentry_t *le;
@@ -1329,8 +4533,17 @@ void plugin_shutdown_all (void)
 	read_list = NULL;
 	pthread_mutex_unlock (&read_lock);
 
-	destroy_read_heap ();
+	destroy_read_funcs ();
+
+	/* Drain the write queues before flushing, so the flushed data includes
+	 * everything that has been dispatched so far. */
+	stop_write_queues ();
 
+	/* Pass on the queued notifications before the plugins shut down.
+	 * Notifications dispatched later are passed on synchronously. */
+	notif_queue_stop ();
+
+	stop_flush_jobs ();
 	plugin_flush (/* plugin = */ NULL,
 			/* timeout = */ 0,
 			/* identifier = */ NULL);
@@ -1356,6 +4569,11 @@ void plugin_shutdown_all (void)
 		(*callback) ();
 	}
 
+	/* Save the value cache once all plugins have stopped dispatching. */
+	uc_shutdown ();
+
+	log_queue_stop ();
+
 	/* Write plugins which use the `user_data' pointer usually need the
 	 * same data available to the flush callback. If this is the case, set
 	 * the free_function to NULL when registering the flush callback and to
@@ -1363,11 +4581,20 @@ void plugin_shutdown_all (void)
 	 * the data isn't freed twice. */
 	destroy_all_callbacks (&list_flush);
 	destroy_all_callbacks (&list_missing);
+	destroy_all_callbacks (&list_range);
+	pthread_rwlock_wrlock (&write_queues_lock);
 	destroy_all_callbacks (&list_write);
+	write_generation++;
+	pthread_rwlock_unlock (&write_queues_lock);
 
 	destroy_all_callbacks (&list_notification);
 	destroy_all_callbacks (&list_shutdown);
+
+	notif_queue_destroy ();
 	destroy_all_callbacks (&list_log);
+
+	callback_stats_destroy ();
+	pipeline_trace_destroy ();
 } /* void plugin_shutdown_all */
 
 int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
@@ -1408,59 +4635,55 @@ int plugin_dispatch_missing (const value_list_t *vl) /* {{{ */
   return (0);
 } /* int }}} plugin_dispatch_missing */
 
-int plugin_dispatch_values (value_list_t *vl)
+/* Checks the value list, looks up the data set and fills in default values.
+ * If `*ret_ds' is not NULL and matches `vl->type', it is used instead of
+ * looking up the type again. */
+static int plugin_dispatch_values_prepare (value_list_t *vl, /* {{{ */
+		data_set_t **ret_ds)
 {
-	int status;
-	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
-
-	value_t *saved_values;
-	int      saved_values_len;
-
-	data_set_t *ds;
-
-	int free_meta_data = 0;
+	data_set_t *ds = *ret_ds;
 
 	if ((vl == NULL) || (vl->type[0] == 0)
 			|| (vl->values == NULL) || (vl->values_len < 1))
 	{
 		ERROR ("plugin_dispatch_values: Invalid value list "
-				"from plugin %s.", vl->plugin);
+				"from plugin %s.",
+				(vl != NULL) ? vl->plugin : "(null)");
 		return (-1);
 	}
 
-	/* Free meta data only if the calling function didn't specify any. In
-	 * this case matches and targets may add some and the calling function
-	 * may not expect (and therefore free) that data. */
-	if (vl->meta == NULL)
-		free_meta_data = 1;
+	/* Left over from a previous dispatch of the same value list. */
+	vl->flags &= ~VL_FLAG_REJECTED;
 
-	if (list_write == NULL)
-		c_complain_once (LOG_WARNING, &no_write_complaint,
-				"plugin_dispatch_values: No write callback has been "
-				"registered. Please load at least one output plugin, "
-				"if you want the collected data to be stored.");
+	/* Try the type ID before looking up the type by name. */
+	if ((ds == NULL) || (strcmp (ds->type, vl->type) != 0))
+		ds = (data_set_t *) plugin_get_ds_by_id (vl->type_id);
 
-	if (data_sets == NULL)
+	if ((ds == NULL) || (strcmp (ds->type, vl->type) != 0))
 	{
-		ERROR ("plugin_dispatch_values: No data sets registered. "
-				"Could the types database be read? Check "
-				"your `TypesDB' setting!");
-		return (-1);
-	}
+		plugin_data_set_t *pds;
 
-	if (c_avl_get (data_sets, vl->type, (void *) &ds) != 0)
-	{
-		char ident[6 * DATA_MAX_NAME_LEN];
+		if (c_hashtable_get (data_sets, vl->type, (void *) &pds) != 0)
+		{
+			char ident[6 * DATA_MAX_NAME_LEN];
+
+			FORMAT_VL (ident, sizeof (ident), vl);
+			INFO ("plugin_dispatch_values: Dataset not found: %s "
+					"(from \"%s\"), check your types.db!",
+					vl->type, ident);
+			return (-1);
+		}
 
-		FORMAT_VL (ident, sizeof (ident), vl);
-		INFO ("plugin_dispatch_values: Dataset not found: %s "
-				"(from \"%s\"), check your types.db!",
-				vl->type, ident);
-		return (-1);
+		ds = &pds->ds;
+		/* Value lists which are dispatched again, e.g. by plugins
+		 * reusing them, can skip the lookup from now on. */
+		vl->type_id = pds->id;
 	}
 
+	/* Within a read callback, this is the time the callback was started
+	 * if `CacheReadTime' is enabled. */
 	if (vl->time == 0)
-		vl->time = cdtime ();
+		vl->time = cdtime_cached ();
 
 	if (vl->interval <= 0)
 		vl->interval = interval_g;
@@ -1475,14 +4698,6 @@ int plugin_dispatch_values (value_list_t *vl)
 			vl->plugin, vl->plugin_instance,
 			vl->type, vl->type_instance);
 
-#if COLLECT_DEBUG
-	assert (0 == strcmp (ds->type, vl->type));
-#else
-	if (0 != strcmp (ds->type, vl->type))
-		WARNING ("plugin_dispatch_values: (ds->type = %s) != (vl->type = %s)",
-				ds->type, vl->type);
-#endif
-
 #if COLLECT_DEBUG
 	assert (ds->ds_num == vl->values_len);
 #else
@@ -1502,61 +4717,121 @@ int plugin_dispatch_values (value_list_t *vl)
 	escape_slashes (vl->type, sizeof (vl->type));
 	escape_slashes (vl->type_instance, sizeof (vl->type_instance));
 
-	/* Copy the values. This way, we can assure `targets' that they get
-	 * dynamically allocated values, which they can free and replace if
-	 * they like. */
-	if ((pre_cache_chain != NULL) || (post_cache_chain != NULL))
-	{
-		saved_values     = vl->values;
-		saved_values_len = vl->values_len;
+	*ret_ds = ds;
+	return (0);
+} /* }}} int plugin_dispatch_values_prepare */
 
-		vl->values = (value_t *) calloc (vl->values_len,
-				sizeof (*vl->values));
-		if (vl->values == NULL)
-		{
-			ERROR ("plugin_dispatch_values: calloc failed.");
-			vl->values = saved_values;
-			return (-1);
-		}
-		memcpy (vl->values, saved_values,
-				vl->values_len * sizeof (*vl->values));
-	}
-	else /* if ((pre == NULL) && (post == NULL)) */
-	{
-		saved_values     = NULL;
-		saved_values_len = 0;
-	}
+static void dispatch_ctx_key_create (void) /* {{{ */
+{
+	pthread_key_create (&dispatch_ctx_key, /* destructor = */ NULL);
+} /* }}} void dispatch_ctx_key_create */
+
+/* Returns the context of `vl' if its filter chains are running in this
+ * thread. */
+static dispatch_ctx_t *dispatch_ctx_get (const value_list_t *vl) /* {{{ */
+{
+	dispatch_ctx_t *ctx;
+
+	if ((pre_cache_chain == NULL) && (post_cache_chain == NULL))
+		return (NULL);
+
+	pthread_once (&dispatch_ctx_once, dispatch_ctx_key_create);
+
+	for (ctx = pthread_getspecific (dispatch_ctx_key); ctx != NULL;
+			ctx = ctx->prev)
+		if (ctx->vl == vl)
+			return (ctx);
+
+	return (NULL);
+} /* }}} dispatch_ctx_t *dispatch_ctx_get */
+
+static int dispatch_ctx_run_chain (const data_set_t *ds, /* {{{ */
+		value_list_t *vl, fc_chain_t *chain, dispatch_ctx_t *ctx)
+{
+	int status;
+
+	ctx->prev = pthread_getspecific (dispatch_ctx_key);
+	pthread_setspecific (dispatch_ctx_key, ctx);
+
+	status = fc_process_chain (ds, vl, chain);
+
+	pthread_setspecific (dispatch_ctx_key, ctx->prev);
+	ctx->prev = NULL;
+
+	return (status);
+} /* }}} int dispatch_ctx_run_chain */
+
+/* Remembers the caller's values, so they can be restored after targets
+ * replaced them. Nothing is copied here; see
+ * `plugin_dispatch_values_writable'. */
+static int plugin_dispatch_values_save (value_list_t *vl, /* {{{ */
+		dispatch_ctx_t *ctx)
+{
+	ctx->vl = NULL;
+	ctx->owned = NULL;
+	ctx->prev = NULL;
 
-	if (pre_cache_chain != NULL)
+	/* Targets may dispatch copies of the value list they are processing,
+	 * so the identifier of the outer dispatch is put back afterwards. */
+	ctx->identifier.valid = 0;
+	ctx->saved_identifier = vl->identifier;
+	vl->identifier = &ctx->identifier;
+
+	if ((pre_cache_chain == NULL) && (post_cache_chain == NULL))
+		return (0);
+
+	pthread_once (&dispatch_ctx_once, dispatch_ctx_key_create);
+
+	ctx->vl = vl;
+	ctx->saved_values = vl->values;
+	ctx->saved_values_len = vl->values_len;
+	return (0);
+} /* }}} int plugin_dispatch_values_save */
+
+/* Restore the state of the value_list so that plugins don't get confused.. */
+static void plugin_dispatch_values_restore (value_list_t *vl, /* {{{ */
+		dispatch_ctx_t *ctx)
+{
+	vl->identifier = ctx->saved_identifier;
+
+	if (ctx->vl == NULL)
+		return;
+
+	sfree (ctx->owned);
+	vl->values     = ctx->saved_values;
+	vl->values_len = ctx->saved_values_len;
+	ctx->vl = NULL;
+} /* }}} void plugin_dispatch_values_restore */
+
+/* Runs the pre-cache chain. Returns FC_TARGET_STOP if the value list must not
+ * be processed any further. */
+static int plugin_dispatch_values_pre_cache (const data_set_t *ds, /* {{{ */
+		value_list_t *vl, dispatch_ctx_t *ctx)
+{
+	int status;
+
+	if (pre_cache_chain == NULL)
+		return (0);
+
+	status = dispatch_ctx_run_chain (ds, vl, pre_cache_chain, ctx);
+	if (status < 0)
 	{
-		status = fc_process_chain (ds, vl, pre_cache_chain);
-		if (status < 0)
-		{
-			WARNING ("plugin_dispatch_values: Running the "
-					"pre-cache chain failed with "
-					"status %i (%#x).",
-					status, status);
-		}
-		else if (status == FC_TARGET_STOP)
-		{
-			/* Restore the state of the value_list so that plugins
-			 * don't get confused.. */
-			if (saved_values != NULL)
-			{
-				free (vl->values);
-				vl->values     = saved_values;
-				vl->values_len = saved_values_len;
-			}
-			return (0);
-		}
+		WARNING ("plugin_dispatch_values: Running the "
+				"pre-cache chain failed with "
+				"status %i (%#x).",
+				status, status);
 	}
+	return (status);
+} /* }}} int plugin_dispatch_values_pre_cache */
 
-	/* Update the value cache */
-	uc_update (ds, vl);
+static void plugin_dispatch_values_post_cache (const data_set_t *ds, /* {{{ */
+		value_list_t *vl, dispatch_ctx_t *ctx)
+{
+	int status;
 
 	if (post_cache_chain != NULL)
 	{
-		status = fc_process_chain (ds, vl, post_cache_chain);
+		status = dispatch_ctx_run_chain (ds, vl, post_cache_chain, ctx);
 		if (status < 0)
 		{
 			WARNING ("plugin_dispatch_values: Running the "
@@ -1567,16 +4842,150 @@ int plugin_dispatch_values (value_list_t *vl)
 	}
 	else
 		fc_default_action (ds, vl);
+} /* }}} void plugin_dispatch_values_post_cache */
+
+static int plugin_dispatch_values_check_init (void) /* {{{ */
+{
+	static c_complain_t no_write_complaint = C_COMPLAIN_INIT_STATIC;
+
+	if (list_write == NULL)
+		c_complain_once (LOG_WARNING, &no_write_complaint,
+				"plugin_dispatch_values: No write callback has been "
+				"registered. Please load at least one output plugin, "
+				"if you want the collected data to be stored.");
+
+	if (data_sets == NULL)
+	{
+		ERROR ("plugin_dispatch_values: No data sets registered. "
+				"Could the types database be read? Check "
+				"your `TypesDB' setting!");
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int plugin_dispatch_values_check_init */
+
+const vl_identifier_t *plugin_value_list_identifier ( /* {{{ */
+		const value_list_t *vl, vl_identifier_t *buffer)
+{
+	vl_identifier_t *ident;
+
+	if (vl == NULL)
+		return (NULL);
+
+	if (vl->identifier != NULL)
+	{
+		ident = vl->identifier;
+		if (ident->valid)
+			return (ident);
+	}
+	else if (buffer != NULL)
+		ident = buffer;
+	else
+		return (NULL);
+
+	if (FORMAT_VL (ident->name, sizeof (ident->name), vl) != 0)
+	{
+		ident->valid = 0;
+		return (NULL);
+	}
+	ident->hash = c_hashtable_hash_string (ident->name);
+	ident->valid = 1;
+
+	return (ident);
+} /* }}} const vl_identifier_t *plugin_value_list_identifier */
+
+void plugin_value_list_identifier_reset (value_list_t *vl) /* {{{ */
+{
+	if ((vl != NULL) && (vl->identifier != NULL))
+		vl->identifier->valid = 0;
+} /* }}} void plugin_value_list_identifier_reset */
+
+/* Returns the identifier passed to the dispatch probes. */
+static const char *plugin_probe_identifier (const value_list_t *vl, /* {{{ */
+		vl_identifier_t *buffer)
+{
+	const vl_identifier_t *ident;
+
+	ident = plugin_value_list_identifier (vl, buffer);
+	if (ident == NULL)
+		return ("");
+	return (ident->name);
+} /* }}} const char *plugin_probe_identifier */
+
+int plugin_dispatch_values (value_list_t *vl)
+{
+	int status;
+
+	dispatch_ctx_t ctx;
+
+	data_set_t *ds = NULL;
+
+	int free_meta_data = 0;
+
+	vl_identifier_t probe_ident;
+	cdtime_t probe_start;
+
+	arena_mark_t mark;
+
+	if (plugin_dispatch_values_check_init () != 0)
+		return (-1);
 
-	/* Restore the state of the value_list so that plugins don't get
-	 * confused.. */
-	if (saved_values != NULL)
+	if (plugin_dispatch_values_prepare (vl, &ds) != 0)
+		return (-1);
+
+	if (pipeline_trace_enabled)
+		pipeline_trace_dispatch (vl);
+
+	/* Matches and targets allocate transient memory from the arena. */
+	mark = arena_mark ();
+
+	probe_start = CD_PROBE_START ();
+	CD_PROBE2 (dispatch__entry,
+			plugin_probe_identifier (vl, &probe_ident), vl->plugin);
+
+	/* Free meta data only if the calling function didn't specify any. In
+	 * this case matches and targets may add some and the calling function
+	 * may not expect (and therefore free) that data. */
+	if (vl->meta == NULL)
+		free_meta_data = 1;
+
+	if (plugin_dispatch_values_save (vl, &ctx) != 0)
+	{
+		arena_release (mark);
+		return (-1);
+	}
+
+	status = plugin_dispatch_values_pre_cache (ds, vl, &ctx);
+	if (pipeline_trace_enabled)
+		pipeline_trace_pre_cache (vl, cdtime ());
+	if (status == FC_TARGET_STOP)
 	{
-		free (vl->values);
-		vl->values     = saved_values;
-		vl->values_len = saved_values_len;
+		plugin_dispatch_values_restore (vl, &ctx);
+		arena_release (mark);
+		CD_PROBE4 (dispatch__return,
+				plugin_probe_identifier (vl, &probe_ident), vl->plugin,
+				CD_PROBE_NS (probe_start), status);
+		return (0);
 	}
 
+	/* Update the value cache. Value lists the cache rejects because of
+	 * its limits for new identifiers are dropped. */
+	status = uc_update (ds, vl);
+	if (pipeline_trace_enabled)
+		pipeline_trace_cached (vl, cdtime ());
+	if (status != UC_REJECTED)
+		plugin_dispatch_values_post_cache (ds, vl, &ctx);
+	else
+		vl->flags |= VL_FLAG_REJECTED;
+
+	plugin_dispatch_values_restore (vl, &ctx);
+	arena_release (mark);
+
+	CD_PROBE4 (dispatch__return,
+			plugin_probe_identifier (vl, &probe_ident), vl->plugin,
+			CD_PROBE_NS (probe_start), 0);
+
 	if ((free_meta_data != 0) && (vl->meta != NULL))
 	{
 		meta_data_destroy (vl->meta);
@@ -1586,6 +4995,182 @@ int plugin_dispatch_values (value_list_t *vl)
 	return (0);
 } /* int plugin_dispatch_values */
 
+struct dispatch_batch_state_s
+{
+	dispatch_ctx_t ctx;
+	_Bool    free_meta_data;
+	/* Passed to the cache, which may still reject it. */
+	_Bool    cached;
+};
+typedef struct dispatch_batch_state_s dispatch_batch_state_t;
+
+int plugin_dispatch_values_batch (value_list_t *vl, size_t vl_num) /* {{{ */
+{
+	const data_set_t **ds_list;
+	_Bool *rejected;
+	dispatch_batch_state_t *state;
+	data_set_t *ds = NULL;
+	cdtime_t now = 0;
+	int failed = 0;
+	int status;
+	size_t i;
+	arena_mark_t mark;
+
+	if ((vl == NULL) || (vl_num == 0))
+		return (EINVAL);
+
+	if (plugin_dispatch_values_check_init () != 0)
+		return (-1);
+
+	/* The state of the batch and whatever the targets allocate for any of
+	 * its value lists is released at once, after the last one has been
+	 * written. */
+	mark = arena_mark ();
+	ds_list = arena_alloc (vl_num * sizeof (*ds_list));
+	rejected = arena_alloc (vl_num * sizeof (*rejected));
+	state = arena_alloc (vl_num * sizeof (*state));
+	if ((ds_list == NULL) || (rejected == NULL) || (state == NULL))
+	{
+		arena_release (mark);
+		return (-1);
+	}
+	memset (ds_list, 0, vl_num * sizeof (*ds_list));
+	memset (state, 0, vl_num * sizeof (*state));
+
+	for (i = 0; i < vl_num; i++)
+	{
+		/* All value lists without a time get the same time stamp. */
+		if (vl[i].time == 0)
+		{
+			if (now == 0)
+				now = cdtime ();
+			vl[i].time = now;
+		}
+
+		/* Consecutive value lists usually share the same type, so the
+		 * previous data set is tried before doing a lookup. */
+		if (plugin_dispatch_values_prepare (vl + i, &ds) != 0)
+		{
+			failed++;
+			continue;
+		}
+
+		if (pipeline_trace_enabled)
+			pipeline_trace_dispatch (vl + i);
+
+		state[i].free_meta_data = (vl[i].meta == NULL);
+
+		if (plugin_dispatch_values_save (vl + i, &state[i].ctx) != 0)
+		{
+			failed++;
+			continue;
+		}
+
+		status = plugin_dispatch_values_pre_cache (ds, vl + i,
+				&state[i].ctx);
+		if (pipeline_trace_enabled)
+			pipeline_trace_pre_cache (vl + i, cdtime ());
+		if (status == FC_TARGET_STOP)
+		{
+			plugin_dispatch_values_restore (vl + i, &state[i].ctx);
+			continue;
+		}
+
+		ds_list[i] = ds;
+		state[i].cached = 1;
+	}
+
+	/* Update the value cache for the entire batch at once. Rejected value
+	 * lists get their data set reset. Value lists the cache couldn't
+	 * handle for other reasons are still passed on to the writers. */
+	uc_update_batch (ds_list, vl, rejected, vl_num);
+
+	if (pipeline_trace_enabled)
+	{
+		now = cdtime ();
+		for (i = 0; i < vl_num; i++)
+			if (state[i].cached)
+				pipeline_trace_cached (vl + i, now);
+	}
+
+	for (i = 0; i < vl_num; i++)
+	{
+		if (!state[i].cached)
+			continue;
+
+		if (rejected[i])
+			vl[i].flags |= VL_FLAG_REJECTED;
+		else if (ds_list[i] != NULL)
+			plugin_dispatch_values_post_cache (ds_list[i], vl + i,
+					&state[i].ctx);
+
+		plugin_dispatch_values_restore (vl + i, &state[i].ctx);
+
+		if (state[i].free_meta_data && (vl[i].meta != NULL))
+		{
+			meta_data_destroy (vl[i].meta);
+			vl[i].meta = NULL;
+		}
+	}
+
+	arena_release (mark);
+
+	return ((failed == 0) ? 0 : -1);
+} /* }}} int plugin_dispatch_values_batch */
+
+int plugin_dispatch_values_writable (value_list_t *vl) /* {{{ */
+{
+	dispatch_ctx_t *ctx;
+	value_t *values;
+
+	if (vl == NULL)
+		return (EINVAL);
+
+	/* Not in a filter chain or already copied: `vl->values' is ours. */
+	ctx = dispatch_ctx_get (vl);
+	if ((ctx == NULL) || (vl->values != ctx->saved_values))
+		return (0);
+
+	if (vl->values_len <= DISPATCH_SCRATCH_VALUES)
+	{
+		values = ctx->scratch;
+	}
+	else
+	{
+		/* Released along with everything else the dispatch
+		 * allocated in `plugin_dispatch_values'. */
+		values = arena_alloc (vl->values_len * sizeof (*values));
+		if (values == NULL)
+			return (ENOMEM);
+	}
+
+	memcpy (values, vl->values, vl->values_len * sizeof (*values));
+	vl->values = values;
+
+	return (0);
+} /* }}} int plugin_dispatch_values_writable */
+
+int plugin_dispatch_values_replace (value_list_t *vl, /* {{{ */
+		value_t *values, int values_len)
+{
+	dispatch_ctx_t *ctx;
+
+	if ((vl == NULL) || (values == NULL))
+		return (EINVAL);
+
+	ctx = dispatch_ctx_get (vl);
+	if (ctx == NULL)
+		return (EINVAL);
+
+	sfree (ctx->owned);
+	ctx->owned = values;
+
+	vl->values = values;
+	vl->values_len = values_len;
+
+	return (0);
+} /* }}} int plugin_dispatch_values_replace */
+
 int plugin_dispatch_values_secure (const value_list_t *vl)
 {
   value_list_t vl_copy;
@@ -1601,25 +5186,16 @@ int plugin_dispatch_values_secure (const value_list_t *vl)
   if ((pre_cache_chain == NULL) && (post_cache_chain == NULL))
     return (plugin_dispatch_values (&vl_copy));
 
-  /* Set pointers to NULL, just to be on the save side. */
-  vl_copy.values = NULL;
+  /* Targets don't modify the values in place (they are copied by
+   * plugin_dispatch_values_writable first), but they may add meta data. */
   vl_copy.meta = NULL;
 
-  vl_copy.values = malloc (sizeof (*vl_copy.values) * vl->values_len);
-  if (vl_copy.values == NULL)
-  {
-    ERROR ("plugin_dispatch_values_secure: malloc failed.");
-    return (ENOMEM);
-  }
-  memcpy (vl_copy.values, vl->values, sizeof (*vl_copy.values) * vl->values_len);
-
   if (vl->meta != NULL)
   {
     vl_copy.meta = meta_data_clone (vl->meta);
     if (vl_copy.meta == NULL)
     {
       ERROR ("plugin_dispatch_values_secure: meta_data_clone failed.");
-      free (vl_copy.values);
       return (ENOMEM);
     }
   } /* if (vl->meta) */
@@ -1627,14 +5203,12 @@ int plugin_dispatch_values_secure (const value_list_t *vl)
   status = plugin_dispatch_values (&vl_copy);
 
   meta_data_destroy (vl_copy.meta);
-  free (vl_copy.values);
 
   return (status);
 } /* int plugin_dispatch_values_secure */
 
 int plugin_dispatch_notification (const notification_t *notif)
 {
-	llentry_t *le;
 	/* Possible TODO: Add flap detection here */
 
 	DEBUG ("plugin_dispatch_notification: severity = %i; message = %s; "
@@ -1646,25 +5220,10 @@ int plugin_dispatch_notification (const notification_t *notif)
 	if (list_notification == NULL)
 		return (-1);
 
-	le = llist_head (list_notification);
-	while (le != NULL)
-	{
-		callback_func_t *cf;
-		plugin_notification_cb callback;
-		int status;
-
-		cf = le->value;
-		callback = cf->cf_callback;
-		status = (*callback) (notif, &cf->cf_udata);
-		if (status != 0)
-		{
-			WARNING ("plugin_dispatch_notification: Notification "
-					"callback %s returned %i.",
-					le->key, status);
-		}
+	if (notif_queue_dispatch (notif) == 0)
+		return (0);
 
-		le = le->next;
-	}
+	notification_dispatch (notif);
 
 	return (0);
 } /* int plugin_dispatch_notification */
@@ -1673,7 +5232,6 @@ void plugin_log (int level, const char *format, ...)
 {
 	char msg[1024];
 	va_list ap;
-	llentry_t *le;
 
 #if !COLLECT_DEBUG
 	if (level >= LOG_DEBUG)
@@ -1691,34 +5249,49 @@ void plugin_log (int level, const char *format, ...)
 		return;
 	}
 
-	le = llist_head (list_log);
-	while (le != NULL)
-	{
-		callback_func_t *cf;
-		plugin_log_cb callback;
-
-		cf = le->value;
-		callback = cf->cf_callback;
-
-		(*callback) (level, msg, &cf->cf_udata);
+	if (log_queue_dispatch (level, msg) == 0)
+		return;
 
-		le = le->next;
-	}
+	log_dispatch (level, msg);
 } /* void plugin_log */
 
 const data_set_t *plugin_get_ds (const char *name)
 {
-	data_set_t *ds;
+	plugin_data_set_t *pds;
 
-	if (c_avl_get (data_sets, name, (void *) &ds) != 0)
+	if (c_hashtable_get (data_sets, name, (void *) &pds) != 0)
 	{
 		DEBUG ("No such dataset registered: %s", name);
 		return (NULL);
 	}
 
-	return (ds);
+	return (&pds->ds);
 } /* data_set_t *plugin_get_ds */
 
+int plugin_type_lookup (const char *name) /* {{{ */
+{
+	plugin_data_set_t *pds;
+
+	if ((name == NULL) || (data_sets == NULL))
+		return (-1);
+
+	if (c_hashtable_get (data_sets, name, (void *) &pds) != 0)
+		return (-1);
+
+	return (pds->id);
+} /* }}} int plugin_type_lookup */
+
+const data_set_t *plugin_get_ds_by_id (int type_id) /* {{{ */
+{
+	plugin_data_set_t **slot;
+
+	slot = type_id_slot (type_id);
+	if ((slot == NULL) || (*slot == NULL))
+		return (NULL);
+
+	return (&(*slot)->ds);
+} /* }}} const data_set_t *plugin_get_ds_by_id */
+
 static int plugin_notification_meta_add (notification_t *n,
     const char *name,
     enum notification_meta_type_e type,
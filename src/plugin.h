@@ -82,6 +82,30 @@ union value_u
 };
 typedef union value_u value_t;
 
+/* The formatted identifier of a value list and its hash, see
+ * `plugin_value_list_identifier'. */
+struct vl_identifier_s
+{
+	char     name[6 * DATA_MAX_NAME_LEN];
+	uint32_t hash;
+	_Bool    valid;
+};
+typedef struct vl_identifier_s vl_identifier_t;
+
+/* Time stamps taken while a value list is dispatched if `PipelineTracing' is
+ * enabled, zero otherwise. `origin' is the time it was first dispatched,
+ * which may have been by another daemon that sent it over the network; the
+ * others are the times it was dispatched, passed the pre-cache chain and
+ * updated the cache on this daemon. */
+struct vl_trace_s
+{
+	cdtime_t origin;
+	cdtime_t dispatched;
+	cdtime_t pre_cache;
+	cdtime_t cached;
+};
+typedef struct vl_trace_s vl_trace_t;
+
 struct value_list_s
 {
 	value_t *values;
@@ -94,11 +118,32 @@ struct value_list_s
 	char     type[DATA_MAX_NAME_LEN];
 	char     type_instance[DATA_MAX_NAME_LEN];
 	meta_data_t *meta;
+	/* Set by the daemon while the value list is dispatched. Copies of a
+	 * value list must not keep it if they outlive the dispatch or change
+	 * the identifier. */
+	vl_identifier_t *identifier;
+	/* Optional handle for `type', see `plugin_type_lookup'. It is only
+	 * used if it still refers to `type', so copies may keep it. */
+	int      type_id;
+	/* VL_FLAG_* bits, see below. */
+	unsigned int flags;
+	/* Copied along with the value list, so the writers of queued copies
+	 * know how old they are. */
+	vl_trace_t trace;
 };
 typedef struct value_list_s value_list_t;
 
-#define VALUE_LIST_INIT { NULL, 0, 0, interval_g, "localhost", "", "", "", "", NULL }
-#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", NULL }
+/* The value list has been received from another daemon. The cache drops it,
+ * without passing it on to the writers, if it isn't newer than the cached
+ * value, so that values can't loop between daemons which forward to each
+ * other. */
+#define VL_FLAG_RECEIVED 0x01
+/* Set by `plugin_dispatch_values' and `plugin_dispatch_values_batch' if the
+ * cache dropped the value list, see `UC_REJECTED'. */
+#define VL_FLAG_REJECTED 0x02
+
+#define VALUE_LIST_INIT { NULL, 0, 0, interval_g, "localhost", "", "", "", "", NULL, NULL }
+#define VALUE_LIST_STATIC { NULL, 0, 0, 0, "localhost", "", "", "", "", NULL, NULL }
 
 struct data_source_s
 {
@@ -168,8 +213,22 @@ typedef int (*plugin_init_cb) (void);
 typedef int (*plugin_read_cb) (user_data_t *);
 typedef int (*plugin_write_cb) (const data_set_t *, const value_list_t *,
 		user_data_t *);
+/* Batch write callback. Receives `num' value lists and their data sets. */
+typedef int (*plugin_write_batch_cb) (const data_set_t **ds,
+		const value_list_t **vl, size_t num, user_data_t *);
 typedef int (*plugin_flush_cb) (cdtime_t timeout, const char *identifier,
 		user_data_t *);
+/* "range" callbacks are provided by writers which can read back what they
+ * have stored. They call `value_cb' for each value of `identifier' with a
+ * time in [start, end], in order of time. If `value_cb' returns non-zero,
+ * the callback stops and returns that value. Returns ENOENT if there are no
+ * values for `identifier'. */
+typedef int (*plugin_range_value_cb) (cdtime_t time, const value_t *values,
+		size_t values_num, void *user_data);
+typedef int (*plugin_range_cb) (const char *identifier,
+		cdtime_t start, cdtime_t end,
+		plugin_range_value_cb value_cb, void *value_data,
+		user_data_t *);
 /* "missing" callback. Returns less than zero on failure, zero if other
  * callbacks should be called, greater than zero if no more callbacks should be
  * called. */
@@ -218,6 +277,42 @@ void plugin_set_dir (const char *dir);
  */
 int plugin_load (const char *name, uint32_t flags);
 
+/*
+ * NAME
+ *  plugin_load_deferred
+ *
+ * DESCRIPTION
+ *  Remembers the plugin `name' instead of loading it. It is loaded by
+ *  `plugin_load_pending' once the configuration needs it, i.e. when its
+ *  `Plugin' block or a reference to it is read. Plugins which aren't needed
+ *  are never loaded, see `plugin_load_pending_finish'.
+ *
+ * RETURN VALUE
+ *  Zero upon success, a value below zero if an error occurs.
+ */
+int plugin_load_deferred (const char *name, uint32_t flags);
+
+/*
+ * NAME
+ *  plugin_load_pending
+ *
+ * DESCRIPTION
+ *  Loads the plugin `name' if its loading has been deferred.
+ *
+ * RETURN VALUE
+ *  ENOENT if the plugin has not been deferred (it may be loaded already),
+ *  otherwise the return value of `plugin_load'.
+ */
+int plugin_load_pending (const char *name);
+
+/* Forgets all deferred plugins which haven't been loaded after the
+ * configuration has been read. */
+void plugin_load_pending_finish (void);
+
+/* Records how long reading the configuration took, for the
+ * `ReportStartupTimes' option. */
+void plugin_set_config_duration (cdtime_t duration);
+
 void plugin_init_all (void);
 void plugin_read_all (void);
 int plugin_read_all_once (void);
@@ -253,8 +348,60 @@ void plugin_shutdown_all (void);
 int plugin_write (const char *plugin,
     const data_set_t *ds, const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_write_handle
+ *
+ * DESCRIPTION
+ *  Like `plugin_write' with a plugin name, but the write callback is looked
+ *  up by the handle, which remembers it until write callbacks are
+ *  registered or unregistered. Handles are created with
+ *  `plugin_write_handle_create' and may be created before the callback has
+ *  been registered, e.g. while the configuration is read.
+ *
+ * RETURN VALUE
+ *  Returns zero upon success, ENOENT if no such write callback is registered
+ *  and the callback's status otherwise.
+ */
+struct plugin_write_handle_s;
+typedef struct plugin_write_handle_s plugin_write_handle_t;
+
+plugin_write_handle_t *plugin_write_handle_create (const char *plugin);
+void plugin_write_handle_destroy (plugin_write_handle_t *wh);
+int plugin_write_handle (plugin_write_handle_t *wh,
+    const data_set_t *ds, const value_list_t *vl);
+
+/* Calls the flush callbacks of `plugin', or of all plugins if `plugin' is
+ * NULL. The callbacks run concurrently; returns once all have finished. */
 int plugin_flush (const char *plugin, cdtime_t timeout, const char *identifier);
 
+/*
+ * NAME
+ *  plugin_flush_async
+ *
+ * DESCRIPTION
+ *  Calls `plugin_flush' for each combination of the `plugins' and
+ *  `identifiers' in a thread of its own and returns right away. An empty
+ *  array stands for all plugins or identifiers, respectively. The token
+ *  stored in `ret_token' can be passed to `plugin_flush_status'.
+ *
+ * RETURN VALUE
+ *  Zero upon success, EBUSY during shutdown, another error otherwise.
+ */
+int plugin_flush_async (char const * const *plugins, size_t plugins_num,
+		char const * const *identifiers, size_t identifiers_num,
+		cdtime_t timeout, uint64_t *ret_token);
+/* Returns zero if the flush `token' refers to has finished, storing the
+ * number of successful and failed calls of `plugin_flush', EINPROGRESS if
+ * it's still running and ENOENT if the token is unknown. Only the latest
+ * finished flushes are remembered. */
+int plugin_flush_status (uint64_t token, int *ret_success, int *ret_error);
+/* Calls the range callback of `plugin', or the first one registered if
+ * `plugin' is NULL. Returns ENOENT if there is no such callback. */
+int plugin_read_range (const char *plugin, const char *identifier,
+		cdtime_t start, cdtime_t end,
+		plugin_range_value_cb value_cb, void *value_data);
+
 /*
  * The `plugin_register_*' functions are used to make `config', `init',
  * `read', `write' and `shutdown' functions known to the plugin
@@ -267,6 +414,31 @@ int plugin_register_complex_config (const char *type,
 		int (*callback) (oconfig_item_t *));
 int plugin_register_init (const char *name,
 		plugin_init_cb callback);
+/* Like `plugin_register_init', but the callback may run at the same time as
+ * other plugins' init callbacks, and need not run before or after any of
+ * them. Use this for slow init callbacks which only set up the plugin's own
+ * state. */
+int plugin_register_init_parallel (const char *name,
+		plugin_init_cb callback);
+/* Sets the options of the `LoadPlugin' block of `plugin' for all its read
+ * functions registered afterwards, see `ReadTimeout' and `SlowReads' in
+ * collectd.conf(5). */
+int plugin_set_read_options (const char *plugin, cdtime_t timeout,
+		_Bool slow);
+/* Sets the `WriteInterval' and `Consolidation' options of the `LoadPlugin'
+ * block of `plugin' for its write callbacks registered afterwards: the
+ * callbacks receive one value list per identifier and `interval', which
+ * consolidates all values dispatched during that interval. */
+#define PLUGIN_CONSOLIDATE_AVERAGE 0
+#define PLUGIN_CONSOLIDATE_MAXIMUM 1
+#define PLUGIN_CONSOLIDATE_LAST    2
+int plugin_set_write_options (const char *plugin, cdtime_t interval,
+		int consolidation);
+/* Sets the `SpoolDirectory', `SpoolSize' (in bytes) and `SpoolReplayRate'
+ * (value lists per second, zero for no limit) options of the `LoadPlugin'
+ * block of `plugin' for its write callbacks registered afterwards. */
+int plugin_set_spool_options (const char *plugin, const char *dir,
+		uint64_t size, double rate);
 int plugin_register_read (const char *name,
 		int (*callback) (void));
 /* "user_data" will be freed automatically, unless
@@ -277,10 +449,20 @@ int plugin_register_complex_read (const char *group, const char *name,
 		user_data_t *user_data);
 int plugin_register_write (const char *name,
 		plugin_write_cb callback, user_data_t *user_data);
+/* Value lists are collected and passed to "callback" once "batch_size" of
+ * them have been dispatched or the first one is older than "batch_timeout"
+ * (the global interval if zero). The timeout is also checked once per
+ * interval, and pending value lists are passed on before the flush callback
+ * of the same name is called. */
+int plugin_register_write_batch (const char *name,
+		plugin_write_batch_cb callback, size_t batch_size,
+		cdtime_t batch_timeout, user_data_t *user_data);
 int plugin_register_flush (const char *name,
 		plugin_flush_cb callback, user_data_t *user_data);
 int plugin_register_missing (const char *name,
 		plugin_missing_cb callback, user_data_t *user_data);
+int plugin_register_range (const char *name,
+		plugin_range_cb callback, user_data_t *user_data);
 int plugin_register_shutdown (const char *name,
 		plugin_shutdown_cb callback);
 int plugin_register_data_set (const data_set_t *ds);
@@ -297,6 +479,7 @@ int plugin_unregister_read_group (const char *group);
 int plugin_unregister_write (const char *name);
 int plugin_unregister_flush (const char *name);
 int plugin_unregister_missing (const char *name);
+int plugin_unregister_range (const char *name);
 int plugin_unregister_shutdown (const char *name);
 int plugin_unregister_data_set (const char *name);
 int plugin_unregister_log (const char *name);
@@ -318,9 +501,88 @@ int plugin_unregister_notification (const char *name);
  *              function.
  */
 int plugin_dispatch_values (value_list_t *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_batch
+ *
+ * DESCRIPTION
+ *  Dispatches `vl_num' value lists at once. This is equivalent to calling
+ *  `plugin_dispatch_values' for each element, but data sets are only looked
+ *  up when the type changes and the value cache is updated while acquiring
+ *  its lock only once. Value lists without a time are all assigned the same
+ *  time stamp.
+ *
+ * ARGUMENTS
+ *  `vl'        Array of value lists. The elements may be modified in the same
+ *              way `plugin_dispatch_values' modifies its argument.
+ *  `vl_num'    Number of elements in `vl'.
+ *
+ * RETURN VALUE
+ *  Returns zero upon success and non-zero if one or more value lists could
+ *  not be dispatched.
+ */
+int plugin_dispatch_values_batch (value_list_t *vl, size_t vl_num);
 int plugin_dispatch_values_secure (const value_list_t *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_writable
+ *
+ * DESCRIPTION
+ *  Targets must call this function before modifying `vl->values' in place.
+ *  While a value list is processed by the filter chains, `vl->values' may
+ *  still point to the memory of the plugin which dispatched it; the values
+ *  are only copied when a target asks for it.
+ *
+ * RETURN VALUE
+ *  Returns zero upon success. `vl->values' may then be modified until the
+ *  target returns.
+ */
+int plugin_dispatch_values_writable (value_list_t *vl);
+
+/*
+ * NAME
+ *  plugin_dispatch_values_replace
+ *
+ * DESCRIPTION
+ *  Replaces `vl->values' with `values', which must have been allocated with
+ *  malloc(3). The daemon takes ownership of `values' and frees it, and any
+ *  array set by a previous call, once the value list has been dispatched.
+ */
+int plugin_dispatch_values_replace (value_list_t *vl,
+		value_t *values, int values_len);
 int plugin_dispatch_missing (const value_list_t *vl);
 
+/*
+ * NAME
+ *  plugin_value_list_identifier
+ *
+ * DESCRIPTION
+ *  Returns the identifier of `vl' as formatted by `FORMAT_VL', together with
+ *  its hash (see `c_hashtable_hash_string'). While a value list is
+ *  dispatched, the identifier is formatted at most once and shared by the
+ *  value cache, the filter chains and synchronous write callbacks. Otherwise
+ *  it is formatted into `buffer'.
+ *
+ * RETURN VALUE
+ *  Returns a pointer to the identifier, which is valid until `vl' is
+ *  modified or its dispatch finishes, or NULL if formatting failed.
+ */
+const vl_identifier_t *plugin_value_list_identifier (const value_list_t *vl,
+		vl_identifier_t *buffer);
+
+/*
+ * NAME
+ *  plugin_value_list_identifier_reset
+ *
+ * DESCRIPTION
+ *  Must be called after changing the host, plugin, plugin instance, type or
+ *  type instance of a value list which is being dispatched. The filter
+ *  chains do this after each target.
+ */
+void plugin_value_list_identifier_reset (value_list_t *vl);
+
 int plugin_dispatch_notification (const notification_t *notif);
 
 void plugin_log (int level, const char *format, ...)
@@ -338,6 +600,43 @@ void plugin_log (int level, const char *format, ...)
 
 const data_set_t *plugin_get_ds (const char *name);
 
+/*
+ * NAME
+ *  plugin_type_lookup
+ *
+ * DESCRIPTION
+ *  Returns the ID of the type `name'. IDs are assigned when a type is
+ *  registered and don't change if it is replaced later on. Plugins may look
+ *  up the types they submit once, e.g. in their init callback, and store the
+ *  ID in `vl->type_id', which saves looking up `vl->type' by name whenever
+ *  the value list is dispatched. `plugin_dispatch_values' also stores the ID
+ *  in value lists which don't have one yet.
+ *
+ * RETURN VALUE
+ *  The ID, which is greater than zero, or -1 if the type is unknown.
+ */
+int plugin_type_lookup (const char *name);
+
+/* Returns the data set with the ID `type_id' or NULL if there is none. */
+const data_set_t *plugin_get_ds_by_id (int type_id);
+
+/*
+ * NAME
+ *  plugin_phase_align
+ *
+ * DESCRIPTION
+ *  If the `PhaseSpreading' option is enabled, stores in `ret' the first time
+ *  at or after `t' which is at the phase of `name' within `interval'. The
+ *  phase depends on `name' and the host name only, so something which happens
+ *  once per interval at the returned times is spread over the interval and
+ *  across hosts, the same way on every start.
+ *
+ * RETURN VALUE
+ *  Zero upon success or non-zero if phase spreading is disabled.
+ */
+int plugin_phase_align (const char *name, cdtime_t interval,
+		cdtime_t t, cdtime_t *ret);
+
 int plugin_notification_meta_add_string (notification_t *n,
     const char *name,
     const char *value);
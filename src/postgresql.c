@@ -52,6 +52,14 @@
 #define log_warn(...) WARNING ("postgresql: " __VA_ARGS__)
 #define log_info(...) INFO ("postgresql: " __VA_ARGS__)
 
+/* libpq 14 and later can send several queries before reading their
+ * results. */
+#ifdef LIBPQ_HAS_PIPELINING
+# define C_PSQL_HAVE_PIPELINING 1
+#else
+# define C_PSQL_HAVE_PIPELINING 0
+#endif
+
 #ifndef C_PSQL_DEFAULT_CONF
 # define C_PSQL_DEFAULT_CONF PKGDATADIR "/postgresql_default.conf"
 #endif
@@ -113,6 +121,8 @@ typedef struct {
 	int max_params_num;
 
 	/* user configuration */
+	_Bool pipelining;
+
 	udb_query_preparation_area_t **q_prep_areas;
 	udb_query_t    **queries;
 	size_t           queries_num;
@@ -165,6 +175,8 @@ static c_psql_database_t *c_psql_database_new (const char *name)
 
 	db->max_params_num = 0;
 
+	db->pipelining = 1;
+
 	db->q_prep_areas   = NULL;
 	db->queries        = NULL;
 	db->queries_num    = 0;
@@ -310,17 +322,13 @@ static PGresult *c_psql_exec_query_noparams (c_psql_database_t *db,
 	return PQexec (db->conn, udb_query_get_statement (q));
 } /* c_psql_exec_query_noparams */
 
-static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
-		udb_query_t *q, c_psql_user_data_t *data)
+/* Fills in the parameters of a query. `interval' is the buffer for the
+ * value of the "interval" parameter. */
+static void c_psql_query_params (c_psql_database_t *db,
+		c_psql_user_data_t *data, char **params,
+		char *interval, size_t interval_size)
 {
-	char *params[db->max_params_num];
-	char  interval[64];
-	int   i;
-
-	if ((data == NULL) || (data->params_num == 0))
-		return (c_psql_exec_query_noparams (db, q));
-
-	assert (db->max_params_num >= data->params_num);
+	int i;
 
 	for (i = 0; i < data->params_num; ++i) {
 		switch (data->params[i]) {
@@ -335,7 +343,7 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 				params[i] = db->user;
 				break;
 			case C_PSQL_PARAM_INTERVAL:
-				ssnprintf (interval, sizeof (interval), "%.3f",
+				ssnprintf (interval, interval_size, "%.3f",
 						(db->interval > 0)
 						? CDTIME_T_TO_DOUBLE (db->interval) : interval_g);
 				params[i] = interval;
@@ -344,6 +352,20 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 				assert (0);
 		}
 	}
+} /* c_psql_query_params */
+
+static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
+		udb_query_t *q, c_psql_user_data_t *data)
+{
+	char *params[db->max_params_num];
+	char  interval[64];
+
+	if ((data == NULL) || (data->params_num == 0))
+		return (c_psql_exec_query_noparams (db, q));
+
+	assert (db->max_params_num >= data->params_num);
+
+	c_psql_query_params (db, data, params, interval, sizeof (interval));
 
 	return PQexecParams (db->conn, udb_query_get_statement (q),
 			data->params_num, NULL,
@@ -351,13 +373,10 @@ static PGresult *c_psql_exec_query_params (c_psql_database_t *db,
 			NULL, NULL, /* return text data */ 0);
 } /* c_psql_exec_query_params */
 
-static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
-		udb_query_preparation_area_t *prep_area)
+/* Dispatches the values of the result `res' of query `q' and frees it. */
+static int c_psql_handle_result (c_psql_database_t *db, udb_query_t *q,
+		udb_query_preparation_area_t *prep_area, PGresult *res)
 {
-	PGresult *res;
-
-	c_psql_user_data_t *data;
-
 	const char *host;
 
 	char **column_names;
@@ -368,22 +387,6 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 	int status;
 	int row, col;
 
-	/* The user data may hold parameter information, but may be NULL. */
-	data = udb_query_get_user_data (q);
-
-	/* Versions up to `3' don't know how to handle parameters. */
-	if (3 <= db->proto_version)
-		res = c_psql_exec_query_params (db, q, data);
-	else if ((NULL == data) || (0 == data->params_num))
-		res = c_psql_exec_query_noparams (db, q);
-	else {
-		log_err ("Connection to database \"%s\" does not support parameters "
-				"(protocol version %d) - cannot execute query \"%s\".",
-				db->database, db->proto_version,
-				udb_query_get_name (q));
-		return -1;
-	}
-
 	column_names = NULL;
 	column_values = NULL;
 
@@ -395,7 +398,8 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 
 	if (PGRES_TUPLES_OK != PQresultStatus (res)) {
 		log_err ("Failed to execute SQL query: %s",
-				PQerrorMessage (db->conn));
+				(NULL != res) ? PQresultErrorMessage (res)
+				: PQerrorMessage (db->conn));
 		log_info ("SQL query was: %s",
 				udb_query_get_statement (q));
 		BAIL_OUT (-1);
@@ -470,8 +474,141 @@ static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
 
 	BAIL_OUT (0);
 #undef BAIL_OUT
+} /* c_psql_handle_result */
+
+static int c_psql_exec_query (c_psql_database_t *db, udb_query_t *q,
+		udb_query_preparation_area_t *prep_area)
+{
+	PGresult *res;
+
+	c_psql_user_data_t *data;
+
+	/* The user data may hold parameter information, but may be NULL. */
+	data = udb_query_get_user_data (q);
+
+	/* Versions up to `3' don't know how to handle parameters. */
+	if (3 <= db->proto_version)
+		res = c_psql_exec_query_params (db, q, data);
+	else if ((NULL == data) || (0 == data->params_num))
+		res = c_psql_exec_query_noparams (db, q);
+	else {
+		log_err ("Connection to database \"%s\" does not support parameters "
+				"(protocol version %d) - cannot execute query \"%s\".",
+				db->database, db->proto_version,
+				udb_query_get_name (q));
+		return -1;
+	}
+
+	return c_psql_handle_result (db, q, prep_area, res);
 } /* c_psql_exec_query */
 
+static _Bool c_psql_query_applies (c_psql_database_t *db, udb_query_t *q)
+{
+	return (0 == db->server_version)
+		|| (udb_query_check_version (q, db->server_version) > 0);
+} /* c_psql_query_applies */
+
+#if C_PSQL_HAVE_PIPELINING
+/* Sends all queries at once and handles the results as they arrive, so that
+ * reading a database takes one round trip rather than one per query. Every
+ * query is followed by a sync point, so a failing query does not abort the
+ * ones after it. Returns the number of successful queries or -1 if the
+ * queries could not be sent. */
+static int c_psql_exec_pipeline (c_psql_database_t *db)
+{
+	size_t sent[db->queries_num];
+	size_t sent_num = 0;
+	size_t done_num = 0;
+	size_t syncs_num = 0;
+	int nulls_num = 0;
+	int success = 0;
+	size_t i;
+
+	if (1 != PQenterPipelineMode (db->conn)) {
+		log_err ("Entering pipeline mode failed: %s",
+				PQerrorMessage (db->conn));
+		return -1;
+	}
+
+	for (i = 0; i < db->queries_num; ++i) {
+		udb_query_t *q = db->queries[i];
+		c_psql_user_data_t *data;
+		char *params[db->max_params_num + 1];
+		char  interval[64];
+		int   params_num = 0;
+
+		if (! c_psql_query_applies (db, q))
+			continue;
+
+		data = udb_query_get_user_data (q);
+		if ((NULL != data) && (0 < data->params_num)) {
+			c_psql_query_params (db, data, params,
+					interval, sizeof (interval));
+			params_num = data->params_num;
+		}
+
+		if ((1 != PQsendQueryParams (db->conn, udb_query_get_statement (q),
+						params_num, NULL, (const char *const *) params,
+						NULL, NULL, /* return text data */ 0))
+				|| (1 != PQpipelineSync (db->conn))) {
+			log_err ("Failed to send SQL query: %s",
+					PQerrorMessage (db->conn));
+			log_info ("SQL query was: %s", udb_query_get_statement (q));
+			break;
+		}
+
+		sent[sent_num] = i;
+		++sent_num;
+	}
+
+	/* Every query returns its result, a null pointer and the result of its
+	 * sync point. */
+	while (syncs_num < sent_num) {
+		PGresult *res;
+
+		res = PQgetResult (db->conn);
+		if (NULL == res) {
+			/* Only one null pointer is expected after each query. */
+			++nulls_num;
+			if ((CONNECTION_BAD == PQstatus (db->conn)) || (2 < nulls_num))
+				break;
+			continue;
+		}
+		nulls_num = 0;
+
+		if (PGRES_PIPELINE_SYNC == PQresultStatus (res)) {
+			PQclear (res);
+			++syncs_num;
+			continue;
+		}
+
+		if (done_num >= syncs_num + 1) {
+			/* Not expected: ignore further results of the same query. */
+			PQclear (res);
+			continue;
+		}
+
+		i = sent[done_num];
+		++done_num;
+		if (0 == c_psql_handle_result (db, db->queries[i],
+					db->q_prep_areas[i], res))
+			++success;
+	}
+
+	if (1 != PQexitPipelineMode (db->conn)) {
+		log_err ("Leaving pipeline mode failed: %s",
+				PQerrorMessage (db->conn));
+		/* Start over with a new connection in the next read. */
+		PQfinish (db->conn);
+		db->conn = NULL;
+	}
+
+	if ((0 == sent_num) && (0 < db->queries_num))
+		return -1;
+	return success;
+} /* c_psql_exec_pipeline */
+#endif /* C_PSQL_HAVE_PIPELINING */
+
 static int c_psql_read (user_data_t *ud)
 {
 	c_psql_database_t *db;
@@ -491,6 +628,15 @@ static int c_psql_read (user_data_t *ud)
 	if (0 != c_psql_check_connection (db))
 		return -1;
 
+#if C_PSQL_HAVE_PIPELINING
+	if (db->pipelining && (3 <= db->proto_version) && (0 < db->queries_num)) {
+		int status = c_psql_exec_pipeline (db);
+		if (0 > status)
+			return -1;
+		return (0 < status) ? 0 : -1;
+	}
+#endif
+
 	for (i = 0; i < db->queries_num; ++i)
 	{
 		udb_query_preparation_area_t *prep_area;
@@ -499,8 +645,7 @@ static int c_psql_read (user_data_t *ud)
 		prep_area = db->q_prep_areas[i];
 		q = db->queries[i];
 
-		if ((0 != db->server_version)
-				&& (udb_query_check_version (q, db->server_version) <= 0))
+		if (! c_psql_query_applies (db, q))
 			continue;
 
 		if (0 == c_psql_exec_query (db, q, prep_area))
@@ -623,6 +768,8 @@ static int c_psql_config_database (oconfig_item_t *ci)
 					&db->queries, &db->queries_num);
 		else if (0 == strcasecmp (c->key, "Interval"))
 			cf_util_get_cdtime (c, &db->interval);
+		else if (0 == strcasecmp (c->key, "Pipelining"))
+			cf_util_get_boolean (c, &db->pipelining);
 		else
 			log_warn ("Ignoring unknown config key \"%s\".", c->key);
 	}
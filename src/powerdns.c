@@ -29,6 +29,7 @@
 #include "plugin.h"
 #include "configfile.h"
 #include "utils_llist.h"
+#include "utils_avltree.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -72,6 +73,14 @@ struct list_item_s
 
   struct sockaddr_un sockaddr;
   int socktype;
+
+  /* Datagram sockets are bound to `local_sockaddr' and kept open between
+   * reads. */
+  struct sockaddr_un local_sockaddr;
+  int sd;
+
+  /* Maps the requested fields to their `statname_lookup_t', for servers. */
+  c_avl_tree_t *fields_tree;
 };
 
 struct statname_lookup_s
@@ -79,6 +88,9 @@ struct statname_lookup_s
   char *name;
   char *type;
   char *type_instance;
+
+  /* Looked up once by `powerdns_init'. */
+  const data_set_t *ds;
 };
 typedef struct statname_lookup_s statname_lookup_t;
 
@@ -123,7 +135,7 @@ user-msec           number of CPU milliseconds spent in 'user' mode
 
 const char* const default_server_fields[] = /* {{{ */
 {
-  "latency"
+  "latency",
   "packetcache-hit",
   "packetcache-miss",
   "packetcache-size",
@@ -229,6 +241,9 @@ statname_lookup_t lookup_table[] = /* {{{ */
 }; /* }}} */
 int lookup_table_length = STATIC_ARRAY_SIZE (lookup_table);
 
+/* Maps the names in `lookup_table' to their entry, ignoring case. */
+static c_avl_tree_t *lookup_tree = NULL;
+
 static llist_t *list = NULL;
 
 #define PDNS_LOCAL_SOCKPATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-powerdns"
@@ -242,54 +257,39 @@ static char *local_sockpath = NULL;
  * -octo
  */
 
-/* <http://doc.powerdns.com/recursor-stats.html> */
-static void submit (const char *plugin_instance, /* {{{ */
-    const char *pdns_type, const char *value)
+static const statname_lookup_t *lookup_get (const char *pdns_type) /* {{{ */
 {
-  value_list_t vl = VALUE_LIST_INIT;
-  value_t values[1];
+  statname_lookup_t *lookup = NULL;
 
-  const char *type = NULL;
-  const char *type_instance = NULL;
-  const data_set_t *ds;
+  if (lookup_tree == NULL)
+    return (NULL);
 
-  int i;
+  if (c_avl_get (lookup_tree, pdns_type, (void *) &lookup) != 0)
+    return (NULL);
 
-  for (i = 0; i < lookup_table_length; i++)
-    if (strcmp (lookup_table[i].name, pdns_type) == 0)
-      break;
+  return (lookup);
+} /* }}} const statname_lookup_t *lookup_get */
 
-  if (lookup_table[i].type == NULL)
-    return;
+/* <http://doc.powerdns.com/recursor-stats.html> */
+static void submit (const char *plugin_instance, /* {{{ */
+    const statname_lookup_t *lookup, const char *pdns_type,
+    const char *value)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  value_t values[1];
 
-  if (i >= lookup_table_length)
+  if (lookup == NULL)
   {
     INFO ("powerdns plugin: submit: Not found in lookup table: %s = %s;",
         pdns_type, value);
     return;
   }
 
-  type = lookup_table[i].type;
-  type_instance = lookup_table[i].type_instance;
-
-  ds = plugin_get_ds (type);
-  if (ds == NULL)
-  {
-    ERROR ("powerdns plugin: The lookup table returned type `%s', "
-        "but I cannot find it via `plugin_get_ds'.",
-        type);
+  /* `powerdns_init' has complained about the type already. */
+  if (lookup->ds == NULL)
     return;
-  }
 
-  if (ds->ds_num != 1)
-  {
-    ERROR ("powerdns plugin: type `%s' has %i data sources, "
-        "but I can only handle one.",
-        type, ds->ds_num);
-    return;
-  }
-
-  if (0 != parse_value (value, &values[0], ds->ds[0].type))
+  if (0 != parse_value (value, &values[0], lookup->ds->ds[0].type))
   {
     ERROR ("powerdns plugin: Cannot convert `%s' "
         "to a number.", value);
@@ -300,26 +300,29 @@ static void submit (const char *plugin_instance, /* {{{ */
   vl.values_len = 1;
   sstrncpy (vl.host, hostname_g, sizeof (vl.host));
   sstrncpy (vl.plugin, "powerdns", sizeof (vl.plugin));
-  sstrncpy (vl.type, type, sizeof (vl.type));
-  if (type_instance != NULL)
-    sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+  sstrncpy (vl.type, lookup->type, sizeof (vl.type));
+  if (lookup->type_instance != NULL)
+    sstrncpy (vl.type_instance, lookup->type_instance,
+        sizeof (vl.type_instance));
   sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
 
   plugin_dispatch_values (&vl);
 } /* }}} static void submit */
 
-static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
-    char **ret_buffer,
-    size_t *ret_buffer_size)
+static void powerdns_disconnect_dgram (list_item_t *item) /* {{{ */
 {
-  int sd;
-  int status;
+  if (item->sd < 0)
+    return;
 
-  char temp[4096];
-  char *buffer = NULL;
-  size_t buffer_size = 0;
+  close (item->sd);
+  item->sd = -1;
+  unlink (item->local_sockaddr.sun_path);
+} /* }}} void powerdns_disconnect_dgram */
 
-  struct sockaddr_un sa_unix;
+static int powerdns_connect_dgram (list_item_t *item) /* {{{ */
+{
+  int sd;
+  int status;
 
   struct timeval stv_timeout;
   cdtime_t cdt_timeout;
@@ -331,13 +334,7 @@ static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
     return (-1);
   }
 
-  memset (&sa_unix, 0, sizeof (sa_unix));
-  sa_unix.sun_family = AF_UNIX;
-  sstrncpy (sa_unix.sun_path,
-      (local_sockpath != NULL) ? local_sockpath : PDNS_LOCAL_SOCKPATH,
-      sizeof (sa_unix.sun_path));
-
-  status = unlink (sa_unix.sun_path);
+  status = unlink (item->local_sockaddr.sun_path);
   if ((status != 0) && (errno != ENOENT))
   {
     FUNC_ERROR ("unlink");
@@ -349,7 +346,8 @@ static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
   {
     /* We need to bind to a specific path, because this is a datagram socket
      * and otherwise the daemon cannot answer. */
-    status = bind (sd, (struct sockaddr *) &sa_unix, sizeof (sa_unix));
+    status = bind (sd, (struct sockaddr *) &item->local_sockaddr,
+        sizeof (item->local_sockaddr));
     if (status != 0)
     {
       FUNC_ERROR ("bind");
@@ -357,7 +355,7 @@ static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
     }
 
     /* Make the socket writeable by the daemon.. */
-    status = chmod (sa_unix.sun_path, 0666);
+    status = chmod (item->local_sockaddr.sun_path, 0666);
     if (status != 0)
     {
       FUNC_ERROR ("chmod");
@@ -384,15 +382,46 @@ static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
       FUNC_ERROR ("connect");
       break;
     }
+  } while (0);
+
+  if (status != 0)
+  {
+    close (sd);
+    unlink (item->local_sockaddr.sun_path);
+    return (-1);
+  }
+
+  item->sd = sd;
+  return (0);
+} /* }}} int powerdns_connect_dgram */
+
+static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
+    char **ret_buffer,
+    size_t *ret_buffer_size)
+{
+  int status;
 
-    status = send (sd, item->command, strlen (item->command), 0);
+  char temp[4096];
+  char *buffer = NULL;
+  size_t buffer_size = 0;
+
+  if ((item->sd < 0) && (powerdns_connect_dgram (item) != 0))
+    return (-1);
+
+  /* Discard late answers to earlier queries which have timed out. */
+  while (recv (item->sd, temp, sizeof (temp), MSG_DONTWAIT) >= 0)
+    /* do nothing */;
+
+  do /* while (0) */
+  {
+    status = send (item->sd, item->command, strlen (item->command), 0);
     if (status < 0)
     {
       FUNC_ERROR ("send");
       break;
     }
 
-    status = recv (sd, temp, sizeof (temp), /* flags = */ 0);
+    status = recv (item->sd, temp, sizeof (temp), /* flags = */ 0);
     if (status < 0)
     {
       FUNC_ERROR ("recv");
@@ -402,11 +431,12 @@ static int powerdns_get_data_dgram (list_item_t *item, /* {{{ */
     status = 0;
   } while (0);
 
-  close (sd);
-  unlink (sa_unix.sun_path);
-
+  /* The daemon may have been restarted, reconnect with the next read. */
   if (status != 0)
+  {
+    powerdns_disconnect_dgram (item);
     return (-1);
+  }
 
   assert (buffer_size > 0);
   buffer = (char *) malloc (buffer_size);
@@ -536,9 +566,6 @@ static int powerdns_read_server (list_item_t *item) /* {{{ */
   char *key;
   char *value;
 
-  const char* const *fields;
-  int fields_num;
-
   if (item->command == NULL)
     item->command = strdup (SERVER_COMMAND);
   if (item->command == NULL)
@@ -551,26 +578,14 @@ static int powerdns_read_server (list_item_t *item) /* {{{ */
   if (status != 0)
     return (-1);
 
-  if (item->fields_num != 0)
-  {
-    fields = (const char* const *) item->fields;
-    fields_num = item->fields_num;
-  }
-  else
-  {
-    fields = default_server_fields;
-    fields_num = default_server_fields_num;
-  }
-
-  assert (fields != NULL);
-  assert (fields_num > 0);
+  assert (item->fields_tree != NULL);
 
   /* corrupt-packets=0,deferred-cache-inserts=0,deferred-cache-lookup=0,latency=0,packetcache-hit=0,packetcache-miss=0,packetcache-size=0,qsize-q=0,query-cache-hit=0,query-cache-miss=0,recursing-answers=0,recursing-questions=0,servfail-packets=0,tcp-answers=0,tcp-queries=0,timedout-packets=0,udp-answers=0,udp-queries=0,udp4-answers=0,udp4-queries=0,udp6-answers=0,udp6-queries=0, */
   dummy = buffer;
   saveptr = NULL;
   while ((key = strtok_r (dummy, ",", &saveptr)) != NULL)
   {
-    int i;
+    statname_lookup_t *lookup = NULL;
 
     dummy = NULL;
 
@@ -585,13 +600,10 @@ static int powerdns_read_server (list_item_t *item) /* {{{ */
       continue;
 
     /* Check if this item was requested. */
-    for (i = 0; i < fields_num; i++)
-      if (strcasecmp (key, fields[i]) == 0)
-	break;
-    if (i >= fields_num)
+    if (c_avl_get (item->fields_tree, key, (void *) &lookup) != 0)
       continue;
 
-    submit (item->instance, key, value);
+    submit (item->instance, lookup, key, value);
   } /* while (strtok_r) */
 
   sfree (buffer);
@@ -704,11 +716,11 @@ static int powerdns_read_recursor (list_item_t *item) /* {{{ */
   {
     dummy = NULL;
 
-    key = strtok_r (NULL, " \t", &key_saveptr);
+    key = strtok_r (NULL, " \t\n\r", &key_saveptr);
     if (key == NULL)
       break;
 
-    submit (item->instance, key, value);
+    submit (item->instance, lookup_get (key), key, value);
   } /* while (strtok_r) */
 
   sfree (buffer);
@@ -805,6 +817,7 @@ static int powerdns_config_add_server (oconfig_item_t *ci) /* {{{ */
     return (-1);
   }
   memset (item, '\0', sizeof (list_item_t));
+  item->sd = -1;
 
   item->instance = strdup (ci->values[0].value.string);
   if (item->instance == NULL)
@@ -943,18 +956,144 @@ static int powerdns_config (oconfig_item_t *ci) /* {{{ */
   return (0);
 } /* }}} int powerdns_config */
 
-static int powerdns_read (void)
+static int powerdns_read (user_data_t *ud) /* {{{ */
+{
+  list_item_t *item = ud->data;
+
+  return (item->func (item));
+} /* }}} int powerdns_read */
+
+static int powerdns_init_lookup (void) /* {{{ */
+{
+  int i;
+
+  if (lookup_tree != NULL)
+    return (0);
+
+  lookup_tree = c_avl_create ((void *) strcasecmp);
+  if (lookup_tree == NULL)
+  {
+    ERROR ("powerdns plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < lookup_table_length; i++)
+  {
+    statname_lookup_t *lookup = lookup_table + i;
+
+    lookup->ds = plugin_get_ds (lookup->type);
+    if (lookup->ds == NULL)
+    {
+      ERROR ("powerdns plugin: The lookup table returned type `%s', "
+          "but I cannot find it via `plugin_get_ds'.",
+          lookup->type);
+    }
+    else if (lookup->ds->ds_num != 1)
+    {
+      ERROR ("powerdns plugin: type `%s' has %i data sources, "
+          "but I can only handle one.",
+          lookup->type, lookup->ds->ds_num);
+      lookup->ds = NULL;
+    }
+
+    c_avl_insert (lookup_tree, lookup->name, lookup);
+  }
+
+  return (0);
+} /* }}} int powerdns_init_lookup */
+
+/* Maps the fields collected from a server to their lookup table entry, NULL
+ * for fields not found in the table. */
+static int powerdns_init_fields (list_item_t *item) /* {{{ */
+{
+  const char * const *fields;
+  int fields_num;
+  int i;
+
+  if (item->fields_num != 0)
+  {
+    fields = (const char * const *) item->fields;
+    fields_num = item->fields_num;
+  }
+  else
+  {
+    fields = default_server_fields;
+    fields_num = default_server_fields_num;
+  }
+
+  item->fields_tree = c_avl_create ((void *) strcasecmp);
+  if (item->fields_tree == NULL)
+  {
+    ERROR ("powerdns plugin: c_avl_create failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < fields_num; i++)
+    c_avl_insert (item->fields_tree, (void *) fields[i],
+        (void *) lookup_get (fields[i]));
+
+  return (0);
+} /* }}} int powerdns_init_fields */
+
+static int powerdns_init (void) /* {{{ */
 {
+  static _Bool did_init = 0;
   llentry_t *e;
+  int recursors_num = 0;
+  int status;
 
+  if (did_init)
+    return (0);
+
+  status = powerdns_init_lookup ();
+  if (status != 0)
+    return (status);
+
+  for (e = llist_head (list); e != NULL; e = e->next)
+  {
+    list_item_t *item = e->value;
+    if (item->socktype == SOCK_DGRAM)
+      recursors_num++;
+  }
+
+  /* Each server is read by a callback of its own, so they are queried in
+   * parallel. */
   for (e = llist_head (list); e != NULL; e = e->next)
   {
     list_item_t *item = e->value;
-    item->func (item);
+    char cb_name[DATA_MAX_NAME_LEN];
+    user_data_t ud;
+    const char *local;
+
+    if ((item->server_type == SRV_AUTHORITATIVE)
+        && (powerdns_init_fields (item) != 0))
+      continue;
+
+    /* Datagram sockets stay bound while collectd is running, so each one
+     * needs a name of its own. */
+    local = (local_sockpath != NULL) ? local_sockpath : PDNS_LOCAL_SOCKPATH;
+    item->local_sockaddr.sun_family = AF_UNIX;
+    if (recursors_num > 1)
+      ssnprintf (item->local_sockaddr.sun_path,
+          sizeof (item->local_sockaddr.sun_path), "%s-%s",
+          local, item->instance);
+    else
+      sstrncpy (item->local_sockaddr.sun_path, local,
+          sizeof (item->local_sockaddr.sun_path));
+
+    ssnprintf (cb_name, sizeof (cb_name), "powerdns-%s", item->instance);
+
+    memset (&ud, 0, sizeof (ud));
+    ud.data = item;
+    ud.free_func = NULL;
+
+    plugin_register_complex_read ("powerdns", cb_name, powerdns_read,
+        /* interval = */ NULL, &ud);
   }
 
+  did_init = 1;
   return (0);
-} /* static int powerdns_read */
+} /* }}} int powerdns_init */
 
 static int powerdns_shutdown (void)
 {
@@ -968,6 +1107,10 @@ static int powerdns_shutdown (void)
     list_item_t *item = (list_item_t *) e->value;
     e->value = NULL;
 
+    powerdns_disconnect_dgram (item);
+    if (item->fields_tree != NULL)
+      c_avl_destroy (item->fields_tree);
+
     sfree (item->instance);
     sfree (item->command);
     sfree (item);
@@ -976,13 +1119,17 @@ static int powerdns_shutdown (void)
   llist_destroy (list);
   list = NULL;
 
+  if (lookup_tree != NULL)
+    c_avl_destroy (lookup_tree);
+  lookup_tree = NULL;
+
   return (0);
 } /* static int powerdns_shutdown */
 
 void module_register (void)
 {
   plugin_register_complex_config ("powerdns", powerdns_config);
-  plugin_register_read ("powerdns", powerdns_read);
+  plugin_register_init ("powerdns", powerdns_init);
   plugin_register_shutdown ("powerdns", powerdns_shutdown );
 } /* void module_register */
 
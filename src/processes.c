@@ -36,6 +36,8 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_hashtable.h"
+#include "utils_procfs.h"
 
 /* Include header files for the mach system, if they exist.. */
 #if HAVE_THREAD_INFO
@@ -90,6 +92,14 @@
 #  ifndef CONFIG_HZ
 #    define CONFIG_HZ 100
 #  endif
+#  include <pthread.h>
+#  if HAVE_LINUX_CN_PROC_H
+#    include <poll.h>
+#    include <sys/socket.h>
+#    include <linux/netlink.h>
+#    include <linux/connector.h>
+#    include <linux/cn_proc.h>
+#  endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -197,6 +207,95 @@ static mach_msg_type_number_t     pset_list_len;
 
 #elif KERNEL_LINUX
 static long pagesize_g;
+static procfs_file_t *proc_stat = NULL;
+
+/* /proc, kept open. The files of the processes are opened relative to it. */
+static DIR *proc_dir = NULL;
+
+#define PS_THREADS_MAX 64
+/* Number of threads reading /proc/<pid>/stat, see the `Threads' option. */
+static int ps_threads_num = 1;
+
+/* What was found out about a process in earlier reads: the selected
+ * processes it belongs to. The start time and the name tell whether the pid
+ * still refers to the same program. */
+typedef struct ps_cache_entry_s
+{
+	int pid;
+	unsigned long long starttime;
+	char name[PROCSTAT_NAME_LEN];
+
+	/* Zero if the process is new or has exec'ed and the fields above
+	 * are still to be read. */
+	_Bool resolved;
+	procstat_t **matches;
+	size_t matches_num;
+
+	unsigned int generation;
+	struct ps_cache_entry_s *prev;
+	struct ps_cache_entry_s *next;
+} ps_cache_entry_t;
+
+static c_hashtable_t *ps_cache = NULL;
+static ps_cache_entry_t *ps_cache_list = NULL;
+/* Incremented by each read, so that entries of processes which have exited
+ * can be removed. */
+static unsigned int ps_cache_generation = 0;
+
+/* The processes found by one read and their stat files. */
+typedef struct ps_scan_s
+{
+	int pid;
+	int status;
+	char state;
+	unsigned long long starttime;
+	procstat_t ps;
+} ps_scan_t;
+
+static ps_scan_t *ps_scan = NULL;
+static size_t ps_scan_num = 0;
+static size_t ps_scan_size = 0;
+
+typedef struct ps_states_s
+{
+	int running;
+	int sleeping;
+	int zombies;
+	int stopped;
+	int paging;
+	int blocked;
+} ps_states_t;
+
+#if HAVE_LINUX_CN_PROC_H
+/* Process events from the kernel's proc connector, see the `ProcEvents'
+ * option. The listener thread queues them, the read callback applies them
+ * to the cache instead of scanning /proc. */
+#define PS_EVENT_FORK 1
+#define PS_EVENT_EXEC 2
+#define PS_EVENT_EXIT 3
+
+/* Beyond this, the events are dropped and /proc is scanned again. */
+#define PS_EVENTS_MAX 1048576
+
+typedef struct ps_event_s
+{
+	int type;
+	int pid;
+} ps_event_t;
+
+static _Bool ps_events_enabled = 0;
+static int ps_events_fd = -1;
+static pthread_t ps_events_thread;
+static _Bool ps_events_thread_loop = 0;
+
+static pthread_mutex_t ps_events_lock = PTHREAD_MUTEX_INITIALIZER;
+static ps_event_t *ps_events = NULL;
+static size_t ps_events_num = 0;
+static size_t ps_events_size = 0;
+/* Set if events may have been lost, such as before the first read, so that
+ * the cache has to be filled by a scan. */
+static _Bool ps_events_lost = 1;
+#endif /* HAVE_LINUX_CN_PROC_H */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -320,143 +419,156 @@ static int ps_list_match (const char *name, const char *cmdline, procstat_t *ps)
 	return (0);
 } /* int ps_list_match */
 
-/* add process entry to 'instances' of process 'name' (or refresh it) */
-static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+/* add process entry to the 'instances' of 'ps' (or refresh it) */
+static void ps_list_add_entry (procstat_t *ps, procstat_entry_t *entry)
 {
-	procstat_t *ps;
 	procstat_entry_t *pse;
 
 	if (entry->id == 0)
 		return;
 
-	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	for (pse = ps->instances; pse != NULL; pse = pse->next)
+		if ((pse->id == entry->id) || (pse->next == NULL))
+			break;
+
+	if ((pse == NULL) || (pse->id != entry->id))
 	{
-		if ((ps_list_match (name, cmdline, ps)) == 0)
-			continue;
+		procstat_entry_t *new;
 
-		for (pse = ps->instances; pse != NULL; pse = pse->next)
-			if ((pse->id == entry->id) || (pse->next == NULL))
-				break;
+		new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
+		if (new == NULL)
+			return;
+		memset (new, 0, sizeof (procstat_entry_t));
+		new->id = entry->id;
 
-		if ((pse == NULL) || (pse->id != entry->id))
-		{
-			procstat_entry_t *new;
+		if (pse == NULL)
+			ps->instances = new;
+		else
+			pse->next = new;
 
-			new = (procstat_entry_t *) malloc (sizeof (procstat_entry_t));
-			if (new == NULL)
-				return;
-			memset (new, 0, sizeof (procstat_entry_t));
-			new->id = entry->id;
+		pse = new;
+	}
 
-			if (pse == NULL)
-				ps->instances = new;
-			else
-				pse->next = new;
+	pse->age = 0;
+	pse->num_proc   = entry->num_proc;
+	pse->num_lwp    = entry->num_lwp;
+	pse->vmem_size  = entry->vmem_size;
+	pse->vmem_rss   = entry->vmem_rss;
+	pse->vmem_data  = entry->vmem_data;
+	pse->vmem_code  = entry->vmem_code;
+	pse->stack_size = entry->stack_size;
+	pse->io_rchar   = entry->io_rchar;
+	pse->io_wchar   = entry->io_wchar;
+	pse->io_syscr   = entry->io_syscr;
+	pse->io_syscw   = entry->io_syscw;
+
+	ps->num_proc   += pse->num_proc;
+	ps->num_lwp    += pse->num_lwp;
+	ps->vmem_size  += pse->vmem_size;
+	ps->vmem_rss   += pse->vmem_rss;
+	ps->vmem_data  += pse->vmem_data;
+	ps->vmem_code  += pse->vmem_code;
+	ps->stack_size += pse->stack_size;
+
+	ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
+	ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
+	ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
+	ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
+
+	if ((entry->vmem_minflt_counter == 0)
+			&& (entry->vmem_majflt_counter == 0))
+	{
+		pse->vmem_minflt_counter += entry->vmem_minflt;
+		pse->vmem_minflt = entry->vmem_minflt;
 
-			pse = new;
+		pse->vmem_majflt_counter += entry->vmem_majflt;
+		pse->vmem_majflt = entry->vmem_majflt;
+	}
+	else
+	{
+		if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
+		{
+			pse->vmem_minflt = entry->vmem_minflt_counter
+				+ (ULONG_MAX - pse->vmem_minflt_counter);
 		}
-
-		pse->age = 0;
-		pse->num_proc   = entry->num_proc;
-		pse->num_lwp    = entry->num_lwp;
-		pse->vmem_size  = entry->vmem_size;
-		pse->vmem_rss   = entry->vmem_rss;
-		pse->vmem_data  = entry->vmem_data;
-		pse->vmem_code  = entry->vmem_code;
-		pse->stack_size = entry->stack_size;
-		pse->io_rchar   = entry->io_rchar;
-		pse->io_wchar   = entry->io_wchar;
-		pse->io_syscr   = entry->io_syscr;
-		pse->io_syscw   = entry->io_syscw;
-
-		ps->num_proc   += pse->num_proc;
-		ps->num_lwp    += pse->num_lwp;
-		ps->vmem_size  += pse->vmem_size;
-		ps->vmem_rss   += pse->vmem_rss;
-		ps->vmem_data  += pse->vmem_data;
-		ps->vmem_code  += pse->vmem_code;
-		ps->stack_size += pse->stack_size;
-
-		ps->io_rchar   += ((pse->io_rchar == -1)?0:pse->io_rchar);
-		ps->io_wchar   += ((pse->io_wchar == -1)?0:pse->io_wchar);
-		ps->io_syscr   += ((pse->io_syscr == -1)?0:pse->io_syscr);
-		ps->io_syscw   += ((pse->io_syscw == -1)?0:pse->io_syscw);
-
-		if ((entry->vmem_minflt_counter == 0)
-				&& (entry->vmem_majflt_counter == 0))
+		else
 		{
-			pse->vmem_minflt_counter += entry->vmem_minflt;
-			pse->vmem_minflt = entry->vmem_minflt;
+			pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
+		}
+		pse->vmem_minflt_counter = entry->vmem_minflt_counter;
 
-			pse->vmem_majflt_counter += entry->vmem_majflt;
-			pse->vmem_majflt = entry->vmem_majflt;
+		if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
+		{
+			pse->vmem_majflt = entry->vmem_majflt_counter
+				+ (ULONG_MAX - pse->vmem_majflt_counter);
 		}
 		else
 		{
-			if (entry->vmem_minflt_counter < pse->vmem_minflt_counter)
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter
-					+ (ULONG_MAX - pse->vmem_minflt_counter);
-			}
-			else
-			{
-				pse->vmem_minflt = entry->vmem_minflt_counter - pse->vmem_minflt_counter;
-			}
-			pse->vmem_minflt_counter = entry->vmem_minflt_counter;
-
-			if (entry->vmem_majflt_counter < pse->vmem_majflt_counter)
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter
-					+ (ULONG_MAX - pse->vmem_majflt_counter);
-			}
-			else
-			{
-				pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
-			}
-			pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+			pse->vmem_majflt = entry->vmem_majflt_counter - pse->vmem_majflt_counter;
 		}
+		pse->vmem_majflt_counter = entry->vmem_majflt_counter;
+	}
 
-		ps->vmem_minflt_counter += pse->vmem_minflt;
-		ps->vmem_majflt_counter += pse->vmem_majflt;
+	ps->vmem_minflt_counter += pse->vmem_minflt;
+	ps->vmem_majflt_counter += pse->vmem_majflt;
 
-		if ((entry->cpu_user_counter == 0)
-				&& (entry->cpu_system_counter == 0))
-		{
-			pse->cpu_user_counter += entry->cpu_user;
-			pse->cpu_user = entry->cpu_user;
+	if ((entry->cpu_user_counter == 0)
+			&& (entry->cpu_system_counter == 0))
+	{
+		pse->cpu_user_counter += entry->cpu_user;
+		pse->cpu_user = entry->cpu_user;
 
-			pse->cpu_system_counter += entry->cpu_system;
-			pse->cpu_system = entry->cpu_system;
+		pse->cpu_system_counter += entry->cpu_system;
+		pse->cpu_system = entry->cpu_system;
+	}
+	else
+	{
+		if (entry->cpu_user_counter < pse->cpu_user_counter)
+		{
+			pse->cpu_user = entry->cpu_user_counter
+				+ (ULONG_MAX - pse->cpu_user_counter);
 		}
 		else
 		{
-			if (entry->cpu_user_counter < pse->cpu_user_counter)
-			{
-				pse->cpu_user = entry->cpu_user_counter
-					+ (ULONG_MAX - pse->cpu_user_counter);
-			}
-			else
-			{
-				pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
-			}
-			pse->cpu_user_counter = entry->cpu_user_counter;
+			pse->cpu_user = entry->cpu_user_counter - pse->cpu_user_counter;
+		}
+		pse->cpu_user_counter = entry->cpu_user_counter;
 
-			if (entry->cpu_system_counter < pse->cpu_system_counter)
-			{
-				pse->cpu_system = entry->cpu_system_counter
-					+ (ULONG_MAX - pse->cpu_system_counter);
-			}
-			else
-			{
-				pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
-			}
-			pse->cpu_system_counter = entry->cpu_system_counter;
+		if (entry->cpu_system_counter < pse->cpu_system_counter)
+		{
+			pse->cpu_system = entry->cpu_system_counter
+				+ (ULONG_MAX - pse->cpu_system_counter);
 		}
+		else
+		{
+			pse->cpu_system = entry->cpu_system_counter - pse->cpu_system_counter;
+		}
+		pse->cpu_system_counter = entry->cpu_system_counter;
+	}
+
+	ps->cpu_user_counter   += pse->cpu_user;
+	ps->cpu_system_counter += pse->cpu_system;
+} /* void ps_list_add_entry */
+
+#if !KERNEL_LINUX
+/* add process entry to 'instances' of process 'name' (or refresh it). On
+ * Linux the matches of each process are cached, see `ps_cache_get'. */
+static void ps_list_add (const char *name, const char *cmdline, procstat_entry_t *entry)
+{
+	procstat_t *ps;
+
+	if (entry->id == 0)
+		return;
+
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		if ((ps_list_match (name, cmdline, ps)) == 0)
+			continue;
 
-		ps->cpu_user_counter   += pse->cpu_user;
-		ps->cpu_system_counter += pse->cpu_system;
+		ps_list_add_entry (ps, entry);
 	}
 }
+#endif /* !KERNEL_LINUX */
 
 /* remove old entries from instances of processes in list_head_g */
 static void ps_list_reset (void)
@@ -562,6 +674,35 @@ static int ps_config (oconfig_item_t *ci)
 			ps_list_register (c->values[0].value.string,
 					c->values[1].value.string);
 		}
+		else if (strcasecmp (c->key, "Threads") == 0)
+		{
+#if KERNEL_LINUX
+			int tmp = 0;
+
+			if (cf_util_get_int (c, &tmp) != 0)
+				continue;
+
+			if ((tmp < 1) || (tmp > PS_THREADS_MAX))
+			{
+				ERROR ("processes plugin: `Threads' must be "
+						"between 1 and %i.", PS_THREADS_MAX);
+				continue;
+			}
+			ps_threads_num = tmp;
+#else
+			WARNING ("processes plugin: The `Threads' option is "
+					"only used on Linux.");
+#endif
+		}
+		else if (strcasecmp (c->key, "ProcEvents") == 0)
+		{
+#if KERNEL_LINUX && HAVE_LINUX_CN_PROC_H
+			cf_util_get_boolean (c, &ps_events_enabled);
+#else
+			WARNING ("processes plugin: The `ProcEvents' option "
+					"needs the proc connector of Linux.");
+#endif
+		}
 		else
 		{
 			ERROR ("processes plugin: The `%s' configuration option is not "
@@ -728,13 +869,85 @@ static void ps_submit_proc_list (procstat_t *ps)
 
 /* ------- additional functions for KERNEL_LINUX/HAVE_THREAD_INFO ------- */
 #if KERNEL_LINUX
+/* Opens `/proc/<pid>/<file>', relative to the open /proc directory where
+ * possible, which saves the kernel the lookup of "/proc". */
+static int ps_open (int pid, const char *file, int flags)
+{
+	char path[64];
+
+#if HAVE_OPENAT
+	if (proc_dir != NULL)
+	{
+		ssnprintf (path, sizeof (path), "%i/%s", pid, file);
+		return (openat (dirfd (proc_dir), path, flags));
+	}
+#endif
+
+	ssnprintf (path, sizeof (path), "/proc/%i/%s", pid, file);
+	return (open (path, flags));
+} /* int ps_open */
+
+/* Reads `/proc/<pid>/<file>' into `buffer' and terminates it with a null
+ * byte. Returns the number of bytes read or -1 on error. */
+static ssize_t ps_read_file (int pid, const char *file,
+		char *buffer, size_t buffer_size)
+{
+	size_t fill = 0;
+	int fd;
+
+	fd = ps_open (pid, file, O_RDONLY);
+	if (fd < 0)
+		return (-1);
+
+	while (fill < buffer_size - 1)
+	{
+		ssize_t status;
+
+		status = read (fd, buffer + fill, buffer_size - fill - 1);
+		if (status < 0)
+		{
+			if ((errno == EAGAIN) || (errno == EINTR))
+				continue;
+			close (fd);
+			return (-1);
+		}
+		else if (status == 0)
+			break;
+
+		fill += (size_t) status;
+	}
+
+	close (fd);
+	buffer[fill] = 0;
+
+	return ((ssize_t) fill);
+} /* ssize_t ps_read_file */
+
 static int ps_read_tasks (int pid)
 {
-	char           dirname[64];
 	DIR           *dh;
 	struct dirent *ent;
 	int count = 0;
 
+#if HAVE_OPENAT && HAVE_FDOPENDIR
+	int fd;
+
+	fd = ps_open (pid, "task", O_RDONLY);
+	if (fd < 0)
+	{
+		DEBUG ("Failed to open directory `/proc/%i/task'", pid);
+		return (-1);
+	}
+
+	if ((dh = fdopendir (fd)) == NULL)
+	{
+		DEBUG ("Failed to open directory `/proc/%i/task'", pid);
+		close (fd);
+		return (-1);
+	}
+#else
+	char           dirname[64];
+
 	ssnprintf (dirname, sizeof (dirname), "/proc/%i/task", pid);
 
 	if ((dh = opendir (dirname)) == NULL)
@@ -742,6 +955,7 @@ static int ps_read_tasks (int pid)
 		DEBUG ("Failed to open directory `%s'", dirname);
 		return (-1);
 	}
+#endif
 
 	while ((ent = readdir (dh)) != NULL)
 	{
@@ -758,28 +972,28 @@ static int ps_read_tasks (int pid)
 /* Read advanced virtual memory data from /proc/pid/status */
 static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 {
-	FILE *fh;
-	char buffer[1024];
-	char filename[64];
+	char buffer[4096];
+	char *buffer_ptr;
+	char *line;
 	unsigned long long lib = 0;
 	unsigned long long exe = 0;
 	unsigned long long data = 0;
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/status", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file (pid, "status", buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof(buffer), fh) != NULL)
+	buffer_ptr = buffer;
+	while ((line = procfs_next_line (&buffer_ptr)) != NULL)
 	{
 		long long tmp;
 		char *endptr;
 
-		if (strncmp (buffer, "Vm", 2) != 0)
+		if (strncmp (line, "Vm", 2) != 0)
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
                                       STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -790,27 +1004,20 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 		tmp = strtoll (fields[1], &endptr, /* base = */ 10);
 		if ((errno == 0) && (endptr != fields[1]))
 		{
-			if (strncmp (buffer, "VmData", 6) == 0) 
+			if (strncmp (line, "VmData", 6) == 0) 
 			{
 				data = tmp;
 			}
-			else if (strncmp (buffer, "VmLib", 5) == 0)
+			else if (strncmp (line, "VmLib", 5) == 0)
 			{
 				lib = tmp;
 			}
-			else if  (strncmp(buffer, "VmExe", 5) == 0)
+			else if  (strncmp(line, "VmExe", 5) == 0)
 			{
 				exe = tmp;
 			}
 		}
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (procfs_next_line) */
 
 	ps->vmem_data = data * 1024;
 	ps->vmem_code = (exe + lib) * 1024;
@@ -820,35 +1027,35 @@ static procstat_t *ps_read_vmem (int pid, procstat_t *ps)
 
 static procstat_t *ps_read_io (int pid, procstat_t *ps)
 {
-	FILE *fh;
 	char buffer[1024];
-	char filename[64];
+	char *buffer_ptr;
+	char *line;
 
 	char *fields[8];
 	int numfields;
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/io", pid);
-	if ((fh = fopen (filename, "r")) == NULL)
+	if (ps_read_file (pid, "io", buffer, sizeof (buffer)) < 0)
 		return (NULL);
 
-	while (fgets (buffer, sizeof (buffer), fh) != NULL)
+	buffer_ptr = buffer;
+	while ((line = procfs_next_line (&buffer_ptr)) != NULL)
 	{
 		derive_t *val = NULL;
 		long long tmp;
 		char *endptr;
 
-		if (strncasecmp (buffer, "rchar:", 6) == 0)
+		if (strncasecmp (line, "rchar:", 6) == 0)
 			val = &(ps->io_rchar);
-		else if (strncasecmp (buffer, "wchar:", 6) == 0)
+		else if (strncasecmp (line, "wchar:", 6) == 0)
 			val = &(ps->io_wchar);
-		else if (strncasecmp (buffer, "syscr:", 6) == 0)
+		else if (strncasecmp (line, "syscr:", 6) == 0)
 			val = &(ps->io_syscr);
-		else if (strncasecmp (buffer, "syscw:", 6) == 0)
+		else if (strncasecmp (line, "syscw:", 6) == 0)
 			val = &(ps->io_syscw);
 		else
 			continue;
 
-		numfields = strsplit (buffer, fields,
+		numfields = strsplit (line, fields,
 				STATIC_ARRAY_SIZE (fields));
 
 		if (numfields < 2)
@@ -861,28 +1068,22 @@ static procstat_t *ps_read_io (int pid, procstat_t *ps)
 			*val = -1;
 		else
 			*val = (derive_t) tmp;
-	} /* while (fgets) */
-
-	if (fclose (fh))
-	{
-		char errbuf[1024];
-		WARNING ("processes: fclose: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-	}
+	} /* while (procfs_next_line) */
 
 	return (ps);
 } /* procstat_t *ps_read_io */
 
-int ps_read_process (int pid, procstat_t *ps, char *state)
+/* Reads /proc/<pid>/stat, which is all that is needed for the process
+ * states. The files only needed for selected processes are read by
+ * `ps_read_process_details'. This is called by several threads at once. */
+static int ps_read_process (int pid, procstat_t *ps, char *state,
+		unsigned long long *ret_starttime)
 {
-	char  filename[64];
 	char  buffer[1024];
 
 	char *fields[64];
 	char  fields_len;
 
-	int   i;
-
 	int   name_len;
 
 	derive_t cpu_user_counter;
@@ -893,19 +1094,15 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 	memset (ps, 0, sizeof (procstat_t));
 
-	ssnprintf (filename, sizeof (filename), "/proc/%i/stat", pid);
-
-	i = read_file_contents (filename, buffer, sizeof(buffer) - 1);
-	if (i <= 0)
+	if (ps_read_file (pid, "stat", buffer, sizeof (buffer)) <= 0)
 		return (-1);
-	buffer[i] = 0;
 
 	fields_len = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
-	if (fields_len < 24)
+	if (fields_len < 29)
 	{
 		DEBUG ("processes plugin: ps_read_process (pid = %i):"
-				" `%s' has only %i fields..",
-				(int) pid, filename, fields_len);
+				" `/proc/%i/stat' has only %i fields..",
+				(int) pid, (int) pid, fields_len);
 		return (-1);
 	}
 
@@ -918,10 +1115,11 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 	fields[1] = fields[1] + 1;
 	fields[1][name_len] = '\0';
-	strncpy (ps->name, fields[1], PROCSTAT_NAME_LEN);
-
+	sstrncpy (ps->name, fields[1], sizeof (ps->name));
 
 	*state = fields[2][0];
+	/* With the pid, the start time identifies the process. */
+	*ret_starttime = strtoull (fields[21], /* endptr = */ NULL, 10);
 
 	if (*state == 'Z')
 	{
@@ -930,11 +1128,9 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	}
 	else
 	{
-		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
-		{
-			/* returns -1 => kernel 2.4 */
-			ps->num_lwp = 1;
-		}
+		/* Number of threads, zero before Linux 2.6. The task
+		 * directory is then read by `ps_read_process_details'. */
+		ps->num_lwp = strtoul (fields[19], /* endptr = */ NULL, 10);
 		ps->num_proc = 1;
 	}
 
@@ -967,6 +1163,31 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 	cpu_system_counter = cpu_system_counter * 1000000 / CONFIG_HZ;
 	vmem_rss = vmem_rss * pagesize_g;
 
+	ps->cpu_user_counter = cpu_user_counter;
+	ps->cpu_system_counter = cpu_system_counter;
+	ps->vmem_size = (unsigned long) vmem_size;
+	ps->vmem_rss = (unsigned long) vmem_rss;
+	ps->stack_size = (unsigned long) stack_size;
+
+	/* success */
+	return (0);
+} /* int ps_read_process (...) */
+
+/* Reads the rest of the statistics of a selected process. */
+static void ps_read_process_details (int pid, procstat_t *ps)
+{
+	if (ps->num_proc == 0)
+		return;
+
+	if (ps->num_lwp == 0)
+	{
+		if ( (ps->num_lwp = ps_read_tasks (pid)) == -1 )
+		{
+			/* returns -1 => kernel 2.4 */
+			ps->num_lwp = 1;
+		}
+	}
+
 	if ( (ps_read_vmem(pid, ps)) == NULL)
 	{
 		/* No VMem data */
@@ -975,12 +1196,6 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 		DEBUG("ps_read_process: did not get vmem data for pid %i",pid);
 	}
 
-	ps->cpu_user_counter = cpu_user_counter;
-	ps->cpu_system_counter = cpu_system_counter;
-	ps->vmem_size = (unsigned long) vmem_size;
-	ps->vmem_rss = (unsigned long) vmem_rss;
-	ps->stack_size = (unsigned long) stack_size;
-
 	if ( (ps_read_io (pid, ps)) == NULL)
 	{
 		/* no io data */
@@ -991,17 +1206,13 @@ int ps_read_process (int pid, procstat_t *ps, char *state)
 
 		DEBUG("ps_read_process: not get io data for pid %i",pid);
 	}
-
-	/* success */
-	return (0);
-} /* int ps_read_process (...) */
+} /* void ps_read_process_details */
 
 static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 {
 	char  *buf_ptr;
 	size_t len;
 
-	char file[PATH_MAX];
 	int  fd;
 
 	size_t n;
@@ -1009,17 +1220,15 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 	if ((pid < 1) || (NULL == buf) || (buf_len < 2))
 		return NULL;
 
-	ssnprintf (file, sizeof (file), "/proc/%u/cmdline",
-		       	(unsigned int) pid);
-
 	errno = 0;
-	fd = open (file, O_RDONLY);
+	fd = ps_open ((int) pid, "cmdline", O_RDONLY);
 	if (fd < 0) {
 		char errbuf[4096];
 		/* ENOENT means the process exited while we were handling it.
 		 * Don't complain about this, it only fills the logs. */
 		if (errno != ENOENT)
-			WARNING ("processes plugin: Failed to open `%s': %s.", file,
+			WARNING ("processes plugin: Failed to open "
+					"`/proc/%u/cmdline': %s.", (unsigned int) pid,
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 		return NULL;
 	}
@@ -1040,7 +1249,8 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 			if ((EAGAIN == errno) || (EINTR == errno))
 				continue;
 
-			WARNING ("processes plugin: Failed to read from `%s': %s.", file,
+			WARNING ("processes plugin: Failed to read from "
+					"`/proc/%u/cmdline': %s.", (unsigned int) pid,
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 			close (fd);
 			return NULL;
@@ -1091,85 +1301,785 @@ static char *ps_get_cmdline (pid_t pid, char *name, char *buf, size_t buf_len)
 	return buf;
 } /* char *ps_get_cmdline (...) */
 
-static unsigned long read_fork_rate ()
+static uint32_t ps_cache_hash (const void *key)
 {
-	FILE *proc_stat;
-	char buf[1024];
-	unsigned long result = 0;
-	int numfields;
-	char *fields[3];
+	/* Knuth's multiplicative hash spreads the consecutive pids. */
+	return (((uint32_t) *((const int *) key)) * 2654435761U);
+} /* uint32_t ps_cache_hash */
 
-	proc_stat = fopen("/proc/stat", "r");
-	if (proc_stat == NULL) {
-		char errbuf[1024];
-		ERROR ("processes plugin: fopen (/proc/stat) failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return ULONG_MAX;
+static int ps_cache_compare (const void *a, const void *b)
+{
+	return (*((const int *) a) != *((const int *) b));
+} /* int ps_cache_compare */
+
+/* Returns the cache entry of `pid', creating an unresolved one if there is
+ * none. */
+static ps_cache_entry_t *ps_cache_add (int pid)
+{
+	ps_cache_entry_t *ce = NULL;
+
+	if (c_hashtable_get (ps_cache, &pid, (void *) &ce) == 0)
+	{
+		ce->generation = ps_cache_generation;
+		return (ce);
 	}
 
-	while (fgets (buf, sizeof(buf), proc_stat) != NULL)
+	ce = calloc (1, sizeof (*ce));
+	if (ce == NULL)
 	{
-		char *endptr;
+		ERROR ("processes plugin: calloc failed.");
+		return (NULL);
+	}
+	ce->pid = pid;
 
-		numfields = strsplit(buf, fields, STATIC_ARRAY_SIZE (fields));
-		if (numfields != 2)
-			continue;
+	if (c_hashtable_insert (ps_cache, &ce->pid, ce) != 0)
+	{
+		ERROR ("processes plugin: c_hashtable_insert failed.");
+		sfree (ce);
+		return (NULL);
+	}
+	ce->generation = ps_cache_generation;
+
+	ce->next = ps_cache_list;
+	if (ps_cache_list != NULL)
+		ps_cache_list->prev = ce;
+	ps_cache_list = ce;
+
+	return (ce);
+} /* ps_cache_entry_t *ps_cache_add */
+
+static void ps_cache_remove (ps_cache_entry_t *ce)
+{
+	if (ce->prev == NULL)
+		ps_cache_list = ce->next;
+	else
+		ce->prev->next = ce->next;
+	if (ce->next != NULL)
+		ce->next->prev = ce->prev;
+
+	c_hashtable_remove (ps_cache, &ce->pid,
+			/* key = */ NULL, /* value = */ NULL);
+	sfree (ce->matches);
+	sfree (ce);
+} /* void ps_cache_remove */
+
+/* Returns the cache entry of the process read into `s', with the selected
+ * processes it belongs to. The command line is only read and matched if the
+ * process is new, or has exec'ed since, and only if a `ProcessMatch' needs
+ * it. */
+static ps_cache_entry_t *ps_cache_get (const ps_scan_t *s, _Bool need_cmdline,
+		char *cmdline, size_t cmdline_size)
+{
+	ps_cache_entry_t *ce;
+	const char *cmdline_ptr = NULL;
+	procstat_t *ps;
+	size_t matches_num;
+
+	ce = ps_cache_add (s->pid);
+	if (ce == NULL)
+		return (NULL);
+
+	if (ce->resolved && (ce->starttime == s->starttime)
+			&& (strcmp (ce->name, s->ps.name) == 0))
+		return (ce);
+
+	ce->starttime = s->starttime;
+	sstrncpy (ce->name, s->ps.name, sizeof (ce->name));
+	ce->matches_num = 0;
+	ce->resolved = 1;
+
+	if (need_cmdline)
+		cmdline_ptr = ps_get_cmdline (s->pid, ce->name,
+				cmdline, cmdline_size);
 
-		if (strcmp ("processes", fields[0]) != 0)
+	matches_num = 0;
+	for (ps = list_head_g; ps != NULL; ps = ps->next)
+	{
+		procstat_t **tmp;
+
+		if (ps_list_match (ce->name, cmdline_ptr, ps) == 0)
 			continue;
 
-		errno = 0;
-		endptr = NULL;
-		result = strtoul(fields[1], &endptr, /* base = */ 10);
-		if ((endptr == fields[1]) || (errno != 0)) {
-			ERROR ("processes plugin: Cannot parse fork rate: %s",
-					fields[1]);
-			result = ULONG_MAX;
+		tmp = realloc (ce->matches, (matches_num + 1) * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ERROR ("processes plugin: realloc failed.");
 			break;
 		}
-
-		break;
+		ce->matches = tmp;
+		ce->matches[matches_num] = ps;
+		matches_num++;
 	}
+	ce->matches_num = matches_num;
 
-	fclose(proc_stat);
+	return (ce);
+} /* ps_cache_entry_t *ps_cache_get */
 
-	return result;
-}
-
-static void ps_submit_fork_rate (unsigned long value)
+/* Removes the entries of processes which weren't seen by the last read. */
+static void ps_cache_expire (void)
 {
-	value_t values[1];
-	value_list_t vl = VALUE_LIST_INIT;
+	ps_cache_entry_t *ce = ps_cache_list;
 
-	values[0].derive = (derive_t) value;
-
-	vl.values = values;
-	vl.values_len = 1;
-	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
-	sstrncpy (vl.plugin, "processes", sizeof (vl.plugin));
-	sstrncpy (vl.plugin_instance, "", sizeof (vl.plugin_instance));
-	sstrncpy (vl.type, "fork_rate", sizeof (vl.type));
-	sstrncpy (vl.type_instance, "", sizeof (vl.type_instance));
+	while (ce != NULL)
+	{
+		ps_cache_entry_t *next = ce->next;
 
-	plugin_dispatch_values (&vl);
-}
+		if (ce->generation != ps_cache_generation)
+			ps_cache_remove (ce);
 
-#endif /* KERNEL_LINUX */
+		ce = next;
+	}
+} /* void ps_cache_expire */
 
-#if HAVE_THREAD_INFO
-static int mach_get_task_name (task_t t, int *pid, char *name, size_t name_max_len)
+/* Adds the statistics of the process read into `s' to the selected
+ * processes it belongs to. */
+static void ps_list_add_scan (ps_scan_t *s, const ps_cache_entry_t *ce)
 {
-	int mib[4];
+	procstat_entry_t pse;
+	size_t i;
+
+	/* Only the selected processes need more than the stat file. */
+	ps_read_process_details (s->pid, &s->ps);
+
+	pse.id       = s->pid;
+	pse.age      = 0;
+
+	pse.num_proc   = s->ps.num_proc;
+	pse.num_lwp    = s->ps.num_lwp;
+	pse.vmem_size  = s->ps.vmem_size;
+	pse.vmem_rss   = s->ps.vmem_rss;
+	pse.vmem_data  = s->ps.vmem_data;
+	pse.vmem_code  = s->ps.vmem_code;
+	pse.stack_size = s->ps.stack_size;
+
+	pse.vmem_minflt = 0;
+	pse.vmem_minflt_counter = s->ps.vmem_minflt_counter;
+	pse.vmem_majflt = 0;
+	pse.vmem_majflt_counter = s->ps.vmem_majflt_counter;
+
+	pse.cpu_user = 0;
+	pse.cpu_user_counter = s->ps.cpu_user_counter;
+	pse.cpu_system = 0;
+	pse.cpu_system_counter = s->ps.cpu_system_counter;
+
+	pse.io_rchar = s->ps.io_rchar;
+	pse.io_wchar = s->ps.io_wchar;
+	pse.io_syscr = s->ps.io_syscr;
+	pse.io_syscw = s->ps.io_syscw;
+
+	for (i = 0; i < ce->matches_num; i++)
+		ps_list_add_entry (ce->matches[i], &pse);
+} /* void ps_list_add_scan */
+
+static void *ps_scan_thread (void *arg)
+{
+	size_t i;
 
-	struct kinfo_proc kp;
-	size_t            kp_size;
+	for (i = (size_t) (uintptr_t) arg; i < ps_scan_num;
+			i += (size_t) ps_threads_num)
+	{
+		ps_scan_t *s = ps_scan + i;
 
-	mib[0] = CTL_KERN;
-	mib[1] = KERN_PROC;
-	mib[2] = KERN_PROC_PID;
+		s->status = ps_read_process (s->pid, &s->ps, &s->state,
+				&s->starttime);
+	}
 
-	if (pid_for_task (t, pid) != KERN_SUCCESS)
-		return (-1);
+	return (NULL);
+} /* void *ps_scan_thread */
+
+/* Reads /proc/<pid>/stat of all processes in `ps_scan'. With `Threads',
+ * the processes are divided among the calling and additional threads. */
+static void ps_scan_run (void)
+{
+	pthread_t threads[PS_THREADS_MAX];
+	_Bool started[PS_THREADS_MAX];
+	int i;
+
+	memset (started, 0, sizeof (started));
+
+	/* Don't bother for a few processes. */
+	if (ps_scan_num >= 256)
+	{
+		for (i = 1; i < ps_threads_num; i++)
+		{
+			int status;
+
+			status = pthread_create (threads + i, /* attr = */ NULL,
+					ps_scan_thread, (void *) (uintptr_t) i);
+			if (status != 0)
+			{
+				ERROR ("processes plugin: pthread_create failed "
+						"with status %i.", status);
+				continue;
+			}
+			started[i] = 1;
+		}
+	}
+
+	ps_scan_thread ((void *) (uintptr_t) 0);
+
+	for (i = 1; i < ps_threads_num; i++)
+	{
+		if (started[i])
+			pthread_join (threads[i], /* retval = */ NULL);
+		else
+			/* Do the share of a thread which wasn't started. */
+			ps_scan_thread ((void *) (uintptr_t) i);
+	}
+} /* void ps_scan_run */
+
+/* Collects the pids in /proc and reads their stat files, counting the
+ * processes by state and adding those of the selected processes. */
+static int ps_scan_all (ps_states_t *st, _Bool need_cmdline,
+		char *cmdline, size_t cmdline_size)
+{
+	struct dirent *ent;
+	int pid;
+	size_t i;
+
+	if (proc_dir == NULL)
+	{
+		if ((proc_dir = opendir ("/proc")) == NULL)
+		{
+			char errbuf[1024];
+			ERROR ("Cannot open `/proc': %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+	else
+	{
+		rewinddir (proc_dir);
+	}
+
+	/* Collect the pids first, so that their stat files can be read by
+	 * several threads. */
+	ps_scan_num = 0;
+	while ((ent = readdir (proc_dir)) != NULL)
+	{
+		if (!isdigit (ent->d_name[0]))
+			continue;
+
+		if ((pid = atoi (ent->d_name)) < 1)
+			continue;
+
+		if (ps_scan_num >= ps_scan_size)
+		{
+			size_t new_size = (ps_scan_size == 0)
+				? 1024 : 2 * ps_scan_size;
+			ps_scan_t *tmp;
+
+			tmp = realloc (ps_scan, new_size * sizeof (*tmp));
+			if (tmp == NULL)
+			{
+				ERROR ("processes plugin: realloc failed.");
+				break;
+			}
+			ps_scan = tmp;
+			ps_scan_size = new_size;
+		}
+
+		ps_scan[ps_scan_num].pid = pid;
+		ps_scan_num++;
+	}
+
+	ps_scan_run ();
+
+	ps_cache_generation++;
+
+	for (i = 0; i < ps_scan_num; i++)
+	{
+		ps_scan_t *s = ps_scan + i;
+		ps_cache_entry_t *ce;
+
+		if (s->status != 0)
+		{
+			DEBUG ("ps_read_process failed: %i", s->status);
+			continue;
+		}
+
+		switch (s->state)
+		{
+			case 'R': st->running++;  break;
+			case 'S': st->sleeping++; break;
+			case 'D': st->blocked++;  break;
+			case 'Z': st->zombies++;  break;
+			case 'T': st->stopped++;  break;
+			case 'W': st->paging++;   break;
+		}
+
+#if HAVE_LINUX_CN_PROC_H
+		/* The events need an entry for every process. */
+		if ((list_head_g == NULL) && (ps_events_fd < 0))
+			continue;
+#else
+		if (list_head_g == NULL)
+			continue;
+#endif
+
+		ce = ps_cache_get (s, need_cmdline, cmdline, cmdline_size);
+		if ((ce == NULL) || (ce->matches_num == 0))
+			continue;
+
+		ps_list_add_scan (s, ce);
+	}
+
+	ps_cache_expire ();
+
+	return (0);
+} /* int ps_scan_all */
+
+#if HAVE_LINUX_CN_PROC_H
+/* Called with `ps_events_lock' held. */
+static void ps_events_queue (int type, int pid)
+{
+	/* The cache is filled by a scan anyway. */
+	if (ps_events_lost)
+		return;
+
+	if (ps_events_num >= ps_events_size)
+	{
+		size_t new_size = (ps_events_size == 0)
+			? 1024 : 2 * ps_events_size;
+		ps_event_t *tmp;
+
+		if (new_size > PS_EVENTS_MAX)
+			tmp = NULL;
+		else
+			tmp = realloc (ps_events, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ps_events_lost = 1;
+			ps_events_num = 0;
+			return;
+		}
+		ps_events = tmp;
+		ps_events_size = new_size;
+	}
+
+	ps_events[ps_events_num].type = type;
+	ps_events[ps_events_num].pid = pid;
+	ps_events_num++;
+} /* void ps_events_queue */
+
+static void ps_events_handle (const char *buffer, int buffer_len)
+{
+	const struct nlmsghdr *nlh;
+
+	pthread_mutex_lock (&ps_events_lock);
+
+	for (nlh = (const void *) buffer; NLMSG_OK (nlh, buffer_len);
+			nlh = NLMSG_NEXT (nlh, buffer_len))
+	{
+		const struct cn_msg *msg;
+		const struct proc_event *ev;
+
+		if ((nlh->nlmsg_type == NLMSG_ERROR)
+				|| (nlh->nlmsg_type == NLMSG_NOOP))
+			continue;
+
+		msg = NLMSG_DATA (nlh);
+		if ((msg->id.idx != CN_IDX_PROC) || (msg->id.val != CN_VAL_PROC))
+			continue;
+
+		ev = (const void *) msg->data;
+		switch (ev->what)
+		{
+			/* Threads are reported as well, but only processes
+			 * have a directory in /proc. */
+			case PROC_EVENT_FORK:
+				if (ev->event_data.fork.child_pid
+						== ev->event_data.fork.child_tgid)
+					ps_events_queue (PS_EVENT_FORK,
+							ev->event_data.fork.child_tgid);
+				break;
+
+			case PROC_EVENT_EXEC:
+				ps_events_queue (PS_EVENT_EXEC,
+						ev->event_data.exec.process_tgid);
+				break;
+
+			case PROC_EVENT_EXIT:
+				if (ev->event_data.exit.process_pid
+						== ev->event_data.exit.process_tgid)
+					ps_events_queue (PS_EVENT_EXIT,
+							ev->event_data.exit.process_tgid);
+				break;
+
+			default:
+				break;
+		}
+	}
+
+	pthread_mutex_unlock (&ps_events_lock);
+} /* void ps_events_handle */
+
+static void *ps_events_thread_main (void __attribute__((unused)) *arg)
+{
+	/* Aligned for the netlink headers. */
+	uint64_t buffer[1024];
+
+	while (ps_events_thread_loop)
+	{
+		struct pollfd pfd;
+		ssize_t len;
+		int status;
+
+		pfd.fd = ps_events_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		/* Wake up now and then to check whether to stop. */
+		status = poll (&pfd, 1, /* timeout = */ 1000);
+		if (status == 0)
+			continue;
+		else if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("processes plugin: poll failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		len = recv (ps_events_fd, buffer, sizeof (buffer), /* flags = */ 0);
+		if (len < 0)
+		{
+			char errbuf[1024];
+
+			if ((errno == EINTR) || (errno == EAGAIN))
+				continue;
+
+			if (errno == ENOBUFS)
+			{
+				/* The socket buffer overflowed. */
+				pthread_mutex_lock (&ps_events_lock);
+				ps_events_lost = 1;
+				ps_events_num = 0;
+				pthread_mutex_unlock (&ps_events_lock);
+				continue;
+			}
+
+			ERROR ("processes plugin: recv on the proc connector "
+					"failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			break;
+		}
+
+		ps_events_handle ((const char *) buffer, (int) len);
+	}
+
+	/* If the thread failed, /proc is scanned from now on. */
+	pthread_mutex_lock (&ps_events_lock);
+	ps_events_thread_loop = 0;
+	ps_events_lost = 1;
+	pthread_mutex_unlock (&ps_events_lock);
+
+	return (NULL);
+} /* void *ps_events_thread_main */
+
+/* Subscribes to the process events and starts the listener thread. */
+static int ps_events_start (void)
+{
+	struct sockaddr_nl addr;
+	struct
+	{
+		struct nlmsghdr hdr;
+		struct cn_msg msg;
+		enum proc_cn_mcast_op op;
+	} __attribute__((packed)) req;
+	int bufsize = 1024 * 1024;
+	int status;
+
+	ps_events_fd = socket (PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+	if (ps_events_fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("processes plugin: Opening the proc connector failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (ps_events_fd, F_SETFD, FD_CLOEXEC);
+
+	/* A fork bomb overflows a small buffer quickly. Failing to enlarge
+	 * it only means scanning /proc more often. */
+	setsockopt (ps_events_fd, SOL_SOCKET, SO_RCVBUF,
+			&bufsize, sizeof (bufsize));
+
+	memset (&addr, 0, sizeof (addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = CN_IDX_PROC;
+	addr.nl_pid = 0;
+
+	status = bind (ps_events_fd, (struct sockaddr *) &addr, sizeof (addr));
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("processes plugin: Binding to the proc connector "
+				"failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (ps_events_fd);
+		ps_events_fd = -1;
+		return (-1);
+	}
+
+	memset (&req, 0, sizeof (req));
+	req.hdr.nlmsg_len = sizeof (req);
+	req.hdr.nlmsg_type = NLMSG_DONE;
+	req.hdr.nlmsg_pid = getpid ();
+	req.msg.id.idx = CN_IDX_PROC;
+	req.msg.id.val = CN_VAL_PROC;
+	req.msg.len = sizeof (req.op);
+	req.op = PROC_CN_MCAST_LISTEN;
+
+	if (send (ps_events_fd, &req, sizeof (req), /* flags = */ 0) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("processes plugin: Subscribing to the process events "
+				"failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (ps_events_fd);
+		ps_events_fd = -1;
+		return (-1);
+	}
+
+	pthread_mutex_lock (&ps_events_lock);
+	ps_events_lost = 1;
+	ps_events_thread_loop = 1;
+	pthread_mutex_unlock (&ps_events_lock);
+
+	status = pthread_create (&ps_events_thread, /* attr = */ NULL,
+			ps_events_thread_main, /* arg = */ NULL);
+	if (status != 0)
+	{
+		ERROR ("processes plugin: pthread_create failed "
+				"with status %i.", status);
+		ps_events_thread_loop = 0;
+		close (ps_events_fd);
+		ps_events_fd = -1;
+		return (-1);
+	}
+
+	return (0);
+} /* int ps_events_start */
+
+static void ps_events_stop (void)
+{
+	if (ps_events_fd < 0)
+		return;
+
+	pthread_mutex_lock (&ps_events_lock);
+	ps_events_thread_loop = 0;
+	pthread_mutex_unlock (&ps_events_lock);
+	pthread_join (ps_events_thread, /* retval = */ NULL);
+
+	close (ps_events_fd);
+	ps_events_fd = -1;
+
+	sfree (ps_events);
+	ps_events_num = 0;
+	ps_events_size = 0;
+} /* void ps_events_stop */
+
+/* Applies the events queued since the last read to the cache and reads the
+ * selected processes. Returns non-zero, without reading, if events were
+ * lost: then /proc has to be scanned. */
+static int ps_events_read (int *ret_live, _Bool need_cmdline,
+		char *cmdline, size_t cmdline_size)
+{
+	ps_event_t *events;
+	size_t events_num;
+	_Bool lost;
+	ps_cache_entry_t *ce;
+	size_t i;
+	int live = 0;
+
+	pthread_mutex_lock (&ps_events_lock);
+	events = ps_events;
+	events_num = ps_events_num;
+	lost = ps_events_lost || !ps_events_thread_loop;
+	ps_events = NULL;
+	ps_events_num = 0;
+	ps_events_size = 0;
+	/* Queue the events from now on: they apply to the scan, if any. */
+	ps_events_lost = 0;
+	pthread_mutex_unlock (&ps_events_lock);
+
+	if (lost)
+	{
+		sfree (events);
+		return (-1);
+	}
+
+	for (i = 0; i < events_num; i++)
+	{
+		ce = NULL;
+
+		switch (events[i].type)
+		{
+			case PS_EVENT_FORK:
+				ps_cache_add (events[i].pid);
+				break;
+
+			case PS_EVENT_EXEC:
+				ce = ps_cache_add (events[i].pid);
+				if (ce != NULL)
+					ce->resolved = 0;
+				break;
+
+			case PS_EVENT_EXIT:
+				if (c_hashtable_get (ps_cache, &events[i].pid,
+							(void *) &ce) == 0)
+					ps_cache_remove (ce);
+				break;
+		}
+	}
+	sfree (events);
+
+	ps_cache_generation++;
+
+	ce = ps_cache_list;
+	while (ce != NULL)
+	{
+		ps_cache_entry_t *next = ce->next;
+		ps_scan_t s;
+
+		live++;
+
+		/* Processes which aren't selected aren't read at all. */
+		if (ce->resolved && (ce->matches_num == 0))
+		{
+			ce = next;
+			continue;
+		}
+
+		memset (&s, 0, sizeof (s));
+		s.pid = ce->pid;
+		if (ps_read_process (s.pid, &s.ps, &s.state, &s.starttime) != 0)
+		{
+			/* Gone, but the exit event is still to come. */
+			ps_cache_remove (ce);
+			live--;
+			ce = next;
+			continue;
+		}
+
+		ce = ps_cache_get (&s, need_cmdline, cmdline, cmdline_size);
+		if ((ce != NULL) && (ce->matches_num != 0))
+			ps_list_add_scan (&s, ce);
+
+		ce = next;
+	}
+
+	*ret_live = live;
+	return (0);
+} /* int ps_events_read */
+#endif /* HAVE_LINUX_CN_PROC_H */
+
+/* Reads the number of forks since boot and the numbers of running and
+ * blocked tasks from /proc/stat. */
+static int ps_read_proc_stat (unsigned long *ret_forks,
+		unsigned long *ret_running, unsigned long *ret_blocked,
+		cdtime_t *ret_time)
+{
+	char *buffer;
+	char *buf;
+	int numfields;
+	char *fields[3];
+	int found = 0;
+
+	if (proc_stat == NULL)
+	{
+		/* Shared with the other readers of /proc/stat. */
+		proc_stat = procfs_open ("/proc/stat", interval_g / 10);
+		if (proc_stat == NULL)
+			return (-1);
+	}
+
+	buffer = procfs_read (proc_stat, ret_time);
+	if (buffer == NULL)
+		return (-1);
+
+	while ((buf = procfs_next_line (&buffer)) != NULL)
+	{
+		unsigned long *ret;
+		char *endptr;
+
+		numfields = strsplit(buf, fields, STATIC_ARRAY_SIZE (fields));
+		if (numfields != 2)
+			continue;
+
+		if (strcmp ("processes", fields[0]) == 0)
+			ret = ret_forks;
+		else if (strcmp ("procs_running", fields[0]) == 0)
+			ret = ret_running;
+		else if (strcmp ("procs_blocked", fields[0]) == 0)
+			ret = ret_blocked;
+		else
+			continue;
+
+		errno = 0;
+		endptr = NULL;
+		*ret = strtoul(fields[1], &endptr, /* base = */ 10);
+		if ((endptr == fields[1]) || (errno != 0)) {
+			ERROR ("processes plugin: Cannot parse `%s' in "
+					"/proc/stat: %s", fields[0], fields[1]);
+			return (-1);
+		}
+
+		found++;
+		if (found == 3)
+			break;
+	}
+
+	if (found != 3)
+	{
+		ERROR ("processes plugin: /proc/stat lacks the fork count or "
+				"the number of running or blocked tasks.");
+		return (-1);
+	}
+
+	return (0);
+} /* int ps_read_proc_stat */
+
+static void ps_submit_fork_rate (unsigned long value, cdtime_t t)
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	values[0].derive = (derive_t) value;
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "processes", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, "", sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "fork_rate", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "", sizeof (vl.type_instance));
+	vl.time = t;
+
+	plugin_dispatch_values (&vl);
+}
+
+#endif /* KERNEL_LINUX */
+
+#if HAVE_THREAD_INFO
+static int mach_get_task_name (task_t t, int *pid, char *name, size_t name_max_len)
+{
+	int mib[4];
+
+	struct kinfo_proc kp;
+	size_t            kp_size;
+
+	mib[0] = CTL_KERN;
+	mib[1] = KERN_PROC;
+	mib[2] = KERN_PROC_PID;
+
+	if (pid_for_task (t, pid) != KERN_SUCCESS)
+		return (-1);
 	mib[3] = *pid;
 
 	kp_size = sizeof (kp);
@@ -1462,110 +2372,97 @@ static int ps_read (void)
 /* #endif HAVE_THREAD_INFO */
 
 #elif KERNEL_LINUX
-	int running  = 0;
-	int sleeping = 0;
-	int zombies  = 0;
-	int stopped  = 0;
-	int paging   = 0;
-	int blocked  = 0;
-
-	struct dirent *ent;
-	DIR           *proc;
-	int            pid;
+	ps_states_t st;
+	_Bool use_events = 0;
 
 	char cmdline[ARG_MAX];
+	_Bool need_cmdline = 0;
 
-	int        status;
-	procstat_t ps;
-	procstat_entry_t pse;
-	char       state;
-
-	unsigned long fork_rate;
+	unsigned long forks = 0;
+	unsigned long procs_running = 0;
+	unsigned long procs_blocked = 0;
+	cdtime_t proc_stat_time = 0;
+	int proc_stat_status;
 
 	procstat_t *ps_ptr;
 
-	running = sleeping = zombies = stopped = paging = blocked = 0;
+	memset (&st, 0, sizeof (st));
 	ps_list_reset ();
 
-	if ((proc = opendir ("/proc")) == NULL)
+	if (ps_cache == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("Cannot open `/proc': %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		return (-1);
+		ps_cache = c_hashtable_create (ps_cache_hash, ps_cache_compare);
+		if (ps_cache == NULL)
+		{
+			ERROR ("processes plugin: c_hashtable_create failed.");
+			return (-1);
+		}
 	}
 
-	while ((ent = readdir (proc)) != NULL)
-	{
-		if (!isdigit (ent->d_name[0]))
-			continue;
+#if HAVE_REGEX_H
+	/* The command lines are only needed for regular expressions. */
+	for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
+		if (ps_ptr->re != NULL)
+			need_cmdline = 1;
+#endif
 
-		if ((pid = atoi (ent->d_name)) < 1)
-			continue;
+	proc_stat_status = ps_read_proc_stat (&forks,
+			&procs_running, &procs_blocked, &proc_stat_time);
 
-		status = ps_read_process (pid, &ps, &state);
-		if (status != 0)
+#if HAVE_LINUX_CN_PROC_H
+	if (ps_events_enabled && (ps_events_fd < 0))
+	{
+		if (ps_events_start () != 0)
 		{
-			DEBUG ("ps_read_process failed: %i", status);
-			continue;
+			ERROR ("processes plugin: Scanning /proc instead of "
+					"using the process events.");
+			ps_events_enabled = 0;
 		}
+	}
 
-		pse.id       = pid;
-		pse.age      = 0;
-
-		pse.num_proc   = ps.num_proc;
-		pse.num_lwp    = ps.num_lwp;
-		pse.vmem_size  = ps.vmem_size;
-		pse.vmem_rss   = ps.vmem_rss;
-		pse.vmem_data  = ps.vmem_data;
-		pse.vmem_code  = ps.vmem_code;
-		pse.stack_size = ps.stack_size;
-
-		pse.vmem_minflt = 0;
-		pse.vmem_minflt_counter = ps.vmem_minflt_counter;
-		pse.vmem_majflt = 0;
-		pse.vmem_majflt_counter = ps.vmem_majflt_counter;
-
-		pse.cpu_user = 0;
-		pse.cpu_user_counter = ps.cpu_user_counter;
-		pse.cpu_system = 0;
-		pse.cpu_system_counter = ps.cpu_system_counter;
-
-		pse.io_rchar = ps.io_rchar;
-		pse.io_wchar = ps.io_wchar;
-		pse.io_syscr = ps.io_syscr;
-		pse.io_syscw = ps.io_syscw;
+	if ((ps_events_fd >= 0) && (proc_stat_status == 0))
+	{
+		int live = 0;
 
-		switch (state)
+		if (ps_events_read (&live, need_cmdline,
+					cmdline, sizeof (cmdline)) == 0)
 		{
-			case 'R': running++;  break;
-			case 'S': sleeping++; break;
-			case 'D': blocked++;  break;
-			case 'Z': zombies++;  break;
-			case 'T': stopped++;  break;
-			case 'W': paging++;   break;
+			use_events = 1;
+
+			/* The states of the processes which aren't read
+			 * are unknown: only /proc/stat counts the running
+			 * and blocked ones. */
+			st.running = (int) procs_running;
+			st.blocked = (int) procs_blocked;
+			st.sleeping = live - st.running - st.blocked;
+			if (st.sleeping < 0)
+				st.sleeping = 0;
 		}
-
-		ps_list_add (ps.name,
-				ps_get_cmdline (pid, ps.name, cmdline, sizeof (cmdline)),
-				&pse);
 	}
+#endif /* HAVE_LINUX_CN_PROC_H */
 
-	closedir (proc);
+	if (!use_events)
+	{
+		if (ps_scan_all (&st, need_cmdline,
+					cmdline, sizeof (cmdline)) != 0)
+			return (-1);
+	}
 
-	ps_submit_state ("running",  running);
-	ps_submit_state ("sleeping", sleeping);
-	ps_submit_state ("zombies",  zombies);
-	ps_submit_state ("stopped",  stopped);
-	ps_submit_state ("paging",   paging);
-	ps_submit_state ("blocked",  blocked);
+	ps_submit_state ("running",  st.running);
+	ps_submit_state ("sleeping", st.sleeping);
+	if (!use_events)
+	{
+		ps_submit_state ("zombies",  st.zombies);
+		ps_submit_state ("stopped",  st.stopped);
+		ps_submit_state ("paging",   st.paging);
+	}
+	ps_submit_state ("blocked",  st.blocked);
 
 	for (ps_ptr = list_head_g; ps_ptr != NULL; ps_ptr = ps_ptr->next)
 		ps_submit_proc_list (ps_ptr);
 
-	fork_rate = read_fork_rate();
-	if (fork_rate != ULONG_MAX)
-		ps_submit_fork_rate(fork_rate);
+	if (proc_stat_status == 0)
+		ps_submit_fork_rate (forks, proc_stat_time);
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_LIBKVM_GETPROCS && HAVE_STRUCT_KINFO_PROC_FREEBSD
@@ -1837,9 +2734,49 @@ static int ps_read (void)
 	return (0);
 } /* int ps_read */
 
+static int ps_shutdown (void)
+{
+#if HAVE_THREAD_INFO
+	/* nothing to do */
+/* #endif HAVE_THREAD_INFO */
+
+#elif KERNEL_LINUX
+#if HAVE_LINUX_CN_PROC_H
+	ps_events_stop ();
+#endif
+
+	procfs_close (proc_stat);
+	proc_stat = NULL;
+
+	if (proc_dir != NULL)
+	{
+		closedir (proc_dir);
+		proc_dir = NULL;
+	}
+
+	while (ps_cache_list != NULL)
+	{
+		ps_cache_entry_t *next = ps_cache_list->next;
+
+		sfree (ps_cache_list->matches);
+		sfree (ps_cache_list);
+		ps_cache_list = next;
+	}
+	c_hashtable_destroy (ps_cache);
+	ps_cache = NULL;
+
+	sfree (ps_scan);
+	ps_scan_num = 0;
+	ps_scan_size = 0;
+#endif /* KERNEL_LINUX */
+
+	return (0);
+} /* int ps_shutdown */
+
 void module_register (void)
 {
 	plugin_register_complex_config ("processes", ps_config);
 	plugin_register_init ("processes", ps_init);
 	plugin_register_read ("processes", ps_read);
+	plugin_register_shutdown ("processes", ps_shutdown);
 } /* void module_register */
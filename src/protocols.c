@@ -23,6 +23,7 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_procfs.h"
 
 #if !KERNEL_LINUX
 # error "No applicable input method."
@@ -43,6 +44,9 @@ static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static ignorelist_t *values_list = NULL;
 
+static procfs_file_t *snmp_file = NULL;
+static procfs_file_t *netstat_file = NULL;
+
 /* 
  * Functions
  */
@@ -72,11 +76,11 @@ static void submit (const char *protocol_name,
   plugin_dispatch_values (&vl);
 } /* void submit */
 
-static int read_file (const char *path)
+static int read_file (procfs_file_t **fh, const char *path)
 {
-  FILE *fh;
-  char key_buffer[4096];
-  char value_buffer[4096];
+  char *buffer;
+  char *key_buffer;
+  char *value_buffer;
   char *key_ptr;
   char *value_ptr;
   char *key_fields[256];
@@ -86,40 +90,29 @@ static int read_file (const char *path)
   int status;
   int i;
 
-  fh = fopen (path, "r");
-  if (fh == NULL)
+  if (*fh == NULL)
   {
-    ERROR ("protocols plugin: fopen (%s) failed: %s.",
-        path, sstrerror (errno, key_buffer, sizeof (key_buffer)));
-    return (-1);
+    *fh = procfs_open (path, /* max age = */ 0);
+    if (*fh == NULL)
+      return (-1);
   }
 
+  buffer = procfs_read (*fh, /* time = */ NULL);
+  if (buffer == NULL)
+    return (-1);
+
   status = -1;
   while (42)
   {
-    clearerr (fh);
-    key_ptr = fgets (key_buffer, sizeof (key_buffer), fh);
-    if (key_ptr == NULL)
+    key_buffer = procfs_next_line (&buffer);
+    if (key_buffer == NULL)
     {
-      if (feof (fh) != 0)
-      {
-        status = 0;
-        break;
-      }
-      else if (ferror (fh) != 0)
-      {
-        ERROR ("protocols plugin: Reading from %s failed.", path);
-        break;
-      }
-      else
-      {
-        ERROR ("protocols plugin: fgets failed for an unknown reason.");
-        break;
-      }
-    } /* if (key_ptr == NULL) */
+      status = 0;
+      break;
+    }
 
-    value_ptr = fgets (value_buffer, sizeof (value_buffer), fh);
-    if (value_ptr == NULL)
+    value_buffer = procfs_next_line (&buffer);
+    if (value_buffer == NULL)
     {
       ERROR ("protocols plugin: read_file (%s): Could not read values line.",
           path);
@@ -184,8 +177,6 @@ static int read_file (const char *path)
     } /* for (i = 0; i < key_fields_num; i++) */
   } /* while (42) */
 
-  fclose (fh);
-
   return (status);
 } /* int read_file */
 
@@ -194,11 +185,11 @@ static int protocols_read (void)
   int status;
   int success = 0;
 
-  status = read_file (SNMP_FILE);
+  status = read_file (&snmp_file, SNMP_FILE);
   if (status == 0)
     success++;
 
-  status = read_file (NETSTAT_FILE);
+  status = read_file (&netstat_file, NETSTAT_FILE);
   if (status == 0)
     success++;
 
@@ -232,11 +223,22 @@ static int protocols_config (const char *key, const char *value)
   return (0);
 } /* int protocols_config */
 
+static int protocols_shutdown (void)
+{
+  procfs_close (snmp_file);
+  snmp_file = NULL;
+  procfs_close (netstat_file);
+  netstat_file = NULL;
+
+  return (0);
+} /* int protocols_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("protocols", protocols_config,
       config_keys, config_keys_num);
   plugin_register_read ("protocols", protocols_read);
+  plugin_register_shutdown ("protocols", protocols_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 et : */
@@ -131,7 +131,8 @@ static char reg_read_doc[] = "register_read(callback[, interval][, data][, name]
 		"The callback function will be called without parameters, except for\n"
 		"data if it was supplied.";
 
-static char reg_write_doc[] = "register_write(callback[, data][, name]) -> identifier\n"
+static char reg_write_doc[] = "register_write(callback[, data][, name][, batch][, batch_size]\n"
+		"        [, batch_timeout]) -> identifier\n"
 		"\n"
 		"Register a callback function to receive values dispatched by other plugins.\n"
 		"'callback' is a callable object that will be called every time a value\n"
@@ -143,13 +144,29 @@ static char reg_write_doc[] = "register_write(callback[, data][, name]) -> ident
 		"    Every callback needs a unique identifier, so if you want to\n"
 		"    register this callback multiple time from the same module you need\n"
 		"    to specify a name here.\n"
+		"'batch' is an optional boolean. If true, the callback is called with a\n"
+		"    list of Values objects instead of a single one, once 'batch_size'\n"
+		"    (default 100) values have been dispatched or the oldest of them has\n"
+		"    waited for 'batch_timeout' seconds (default: the interval). The\n"
+		"    values are also passed on before a flush callback of the same name\n"
+		"    is called.\n"
 		"'identifier' is the full identifier assigned to this callback.\n"
 		"\n"
 		"The callback function will be called with one or two parameters:\n"
-		"values: A Values object which is a copy of the dispatched values.\n"
+		"values: A Values object which is a copy of the dispatched values,\n"
+		"    or a list of them if 'batch' is true.\n"
 		"data: The optional data parameter passed to the register function.\n"
 		"    If the parameter was omitted it will be omitted here, too.";
 
+static char dispatch_many_doc[] = "dispatch_many(values) -> None\n"
+		"\n"
+		"Dispatches a sequence of Values objects at once. This works like calling\n"
+		"'dispatch' for each of them, but other threads are allowed to run only\n"
+		"once, while all of them are dispatched, and so it is much cheaper for\n"
+		"many values. Unlike 'dispatch', it does not accept arguments overriding\n"
+		"the members of the objects. If one of the objects is invalid, none of\n"
+		"them are dispatched.";
+
 static char reg_notification_doc[] = "register_notification(callback[, data][, name]) -> identifier\n"
 		"\n"
 		"Register a callback function for notifications.\n"
@@ -223,8 +240,11 @@ static cpy_callback_t *cpy_config_callbacks;
 static cpy_callback_t *cpy_init_callbacks;
 static cpy_callback_t *cpy_shutdown_callbacks;
 
+static void cpy_queue_remove(const cpy_callback_t *c);
+
 static void cpy_destroy_user_data(void *data) {
 	cpy_callback_t *c = data;
+	cpy_queue_remove(c);
 	free(c->name);
 	Py_DECREF(c->callback);
 	Py_XDECREF(c->data);
@@ -332,17 +352,17 @@ static int cpy_read_callback(user_data_t *data) {
 	return 0;
 }
 
-static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+/* Returns a new Values object holding a copy of `value_list' or NULL if an
+ * exception has been logged. You must hold the GIL to call this function. */
+static PyObject *cpy_build_values(const data_set_t *ds, const value_list_t *value_list) {
 	int i;
-	cpy_callback_t *c = data->data;
-	PyObject *ret, *list, *temp, *dict = NULL, *val;
+	PyObject *list, *temp, *dict = NULL, *val;
 	Values *v;
 
-	CPY_LOCK_THREADS
 		list = PyList_New(value_list->values_len); /* New reference. */
 		if (list == NULL) {
 			cpy_log_exception("write callback");
-			CPY_RETURN_FROM_THREADS 0;
+			return NULL;
 		}
 		for (i = 0; i < value_list->values_len; ++i) {
 			if (ds->ds[i].type == DS_TYPE_COUNTER) {
@@ -367,12 +387,12 @@ static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_li
 				ERROR("cpy_write_callback: Unknown value type %d.", ds->ds[i].type);
 				Py_END_ALLOW_THREADS
 				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
+				return NULL;
 			}
 			if (PyErr_Occurred() != NULL) {
 				cpy_log_exception("value building for write callback");
 				Py_DECREF(list);
-				CPY_RETURN_FROM_THREADS 0;
+				return NULL;
 			}
 		}
 		dict = PyDict_New();
@@ -429,6 +449,12 @@ static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_li
 			free(table);
 		}
 		val = Values_New(); /* New reference. */
+		if (val == NULL) {
+			cpy_log_exception("write callback");
+			Py_DECREF(list);
+			Py_XDECREF(dict);
+			return NULL;
+		}
 		v = (Values *) val; 
 		sstrncpy(v->data.host, value_list->host, sizeof(v->data.host));
 		sstrncpy(v->data.type, value_list->type, sizeof(v->data.type));
@@ -441,40 +467,361 @@ static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_li
 		v->values = list;
 		Py_CLEAR(v->meta);
 		v->meta = dict;
-		ret = PyObject_CallFunctionObjArgs(c->callback, v, c->data, (void *) 0); /* New reference. */
-		Py_XDECREF(val);
-		if (ret == NULL) {
-			cpy_log_exception("write callback");
-		} else {
-			Py_DECREF(ret);
+		return val;
+}
+
+/* You must hold the GIL to call the cpy_call_* functions. */
+static void cpy_call_write(cpy_callback_t *c, const data_set_t *ds, const value_list_t *value_list) {
+	PyObject *ret, *val;
+
+	val = cpy_build_values(ds, value_list); /* New reference. */
+	if (val == NULL)
+		return;
+	ret = PyObject_CallFunctionObjArgs(c->callback, val, c->data, (void *) 0); /* New reference. */
+	Py_DECREF(val);
+	if (ret == NULL) {
+		cpy_log_exception("write callback");
+	} else {
+		Py_DECREF(ret);
+	}
+}
+
+static void cpy_call_write_batch(cpy_callback_t *c, const data_set_t **ds, const value_list_t **value_list,
+		size_t num) {
+	PyObject *ret, *list, *val;
+	size_t i, list_num = 0;
+
+	list = PyList_New(num); /* New reference. */
+	if (list == NULL) {
+		cpy_log_exception("write callback");
+		return;
+	}
+	for (i = 0; i < num; ++i) {
+		val = cpy_build_values(ds[i], value_list[i]); /* New reference. */
+		if (val == NULL)
+			continue;
+		PyList_SET_ITEM(list, list_num, val); /* Steals a reference. */
+		++list_num;
+	}
+	/* Drop the slots of value lists which couldn't be converted. */
+	if ((list_num < num) && (PyList_SetSlice(list, list_num, num, NULL) != 0)) {
+		cpy_log_exception("write callback");
+		Py_DECREF(list);
+		return;
+	}
+	ret = PyObject_CallFunctionObjArgs(c->callback, list, c->data, (void *) 0); /* New reference. */
+	Py_DECREF(list);
+	if (ret == NULL) {
+		cpy_log_exception("write callback");
+	} else {
+		Py_DECREF(ret);
+	}
+}
+
+static void cpy_call_notification(cpy_callback_t *c, const notification_t *notification) {
+	PyObject *ret, *notify;
+	Notification *n;
+
+	notify = Notification_New(); /* New reference. */
+	if (notify == NULL) {
+		cpy_log_exception("notification callback");
+		return;
+	}
+	n = (Notification *) notify;
+	sstrncpy(n->data.host, notification->host, sizeof(n->data.host));
+	sstrncpy(n->data.type, notification->type, sizeof(n->data.type));
+	sstrncpy(n->data.type_instance, notification->type_instance, sizeof(n->data.type_instance));
+	sstrncpy(n->data.plugin, notification->plugin, sizeof(n->data.plugin));
+	sstrncpy(n->data.plugin_instance, notification->plugin_instance, sizeof(n->data.plugin_instance));
+	n->data.time = CDTIME_T_TO_DOUBLE(notification->time);
+	sstrncpy(n->message, notification->message, sizeof(n->message));
+	n->severity = notification->severity;
+	ret = PyObject_CallFunctionObjArgs(c->callback, n, c->data, (void *) 0); /* New reference. */
+	Py_DECREF(notify);
+	if (ret == NULL) {
+		cpy_log_exception("notification callback");
+	} else {
+		Py_DECREF(ret);
+	}
+}
+
+/* The worker thread: Write and notification callbacks only copy their
+ * arguments to a queue, which this thread hands to the python callbacks.
+ * So the read threads and the other write callbacks never wait for the GIL.
+ * The queue is only ever locked briefly and never while waiting for the GIL,
+ * and elements are only taken from it with the GIL held, so that
+ * cpy_destroy_user_data can remove those of an unregistered callback. */
+
+enum cpy_queue_type_e {
+	CPY_QUEUE_WRITE,
+	CPY_QUEUE_WRITE_BATCH,
+	CPY_QUEUE_NOTIFICATION
+};
+
+typedef struct cpy_queue_elem_s {
+	enum cpy_queue_type_e type;
+	cpy_callback_t *callback;
+	const data_set_t **ds;
+	value_list_t *vl;
+	size_t num;
+	notification_t notification;
+	struct cpy_queue_elem_s *next;
+} cpy_queue_elem_t;
+
+static _Bool cpy_worker_enabled = 0;
+static _Bool cpy_worker_running = 0;
+static pthread_t cpy_worker_thread;
+static pthread_mutex_t cpy_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cpy_queue_cond = PTHREAD_COND_INITIALIZER;
+static cpy_queue_elem_t *cpy_queue_head;
+static cpy_queue_elem_t *cpy_queue_tail;
+static size_t cpy_queue_length;
+static size_t cpy_queue_limit = 10000;
+static uint64_t cpy_queue_dropped;
+
+static void cpy_queue_elem_free(cpy_queue_elem_t *e) {
+	size_t i;
+
+	if (e == NULL)
+		return;
+	for (i = 0; i < e->num; ++i) {
+		free(e->vl[i].values);
+		meta_data_destroy(e->vl[i].meta);
+	}
+	free(e->vl);
+	free(e->ds);
+	free(e);
+}
+
+static int cpy_queue_append(cpy_queue_elem_t *e) {
+	cpy_queue_elem_t *dropped = NULL;
+
+	pthread_mutex_lock(&cpy_queue_lock);
+	if (!cpy_worker_running) {
+		pthread_mutex_unlock(&cpy_queue_lock);
+		cpy_queue_elem_free(e);
+		return -1;
+	}
+	/* Drop the oldest element, the newest values are more interesting. */
+	if (cpy_queue_length >= cpy_queue_limit) {
+		dropped = cpy_queue_head;
+		cpy_queue_head = dropped->next;
+		if (cpy_queue_head == NULL)
+			cpy_queue_tail = NULL;
+		--cpy_queue_length;
+		++cpy_queue_dropped;
+	}
+	e->next = NULL;
+	if (cpy_queue_tail == NULL)
+		cpy_queue_head = e;
+	else
+		cpy_queue_tail->next = e;
+	cpy_queue_tail = e;
+	++cpy_queue_length;
+	pthread_cond_signal(&cpy_queue_cond);
+	pthread_mutex_unlock(&cpy_queue_lock);
+
+	cpy_queue_elem_free(dropped);
+	return 0;
+}
+
+static int cpy_queue_values(cpy_callback_t *c, enum cpy_queue_type_e type,
+		const data_set_t **ds, const value_list_t **value_list, size_t num) {
+	cpy_queue_elem_t *e;
+	size_t i;
+
+	e = calloc(1, sizeof(*e));
+	if (e != NULL) {
+		e->ds = calloc(num, sizeof(*e->ds));
+		e->vl = calloc(num, sizeof(*e->vl));
+	}
+	if (e == NULL || e->ds == NULL || e->vl == NULL) {
+		ERROR("python plugin: calloc failed.");
+		cpy_queue_elem_free(e);
+		return -1;
+	}
+	e->type = type;
+	e->callback = c;
+	for (i = 0; i < num; ++i) {
+		value_list_t *vl = e->vl + i;
+
+		*vl = *value_list[i];
+		/* The identifier belongs to the dispatching thread and the
+		 * trace isn't used by Python callbacks. */
+		vl->identifier = NULL;
+		memset(&vl->trace, 0, sizeof(vl->trace));
+		vl->values = malloc(vl->values_len * sizeof(*vl->values));
+		if (vl->values == NULL) {
+			ERROR("python plugin: malloc failed.");
+			vl->meta = NULL;
+			e->num = i + 1;
+			cpy_queue_elem_free(e);
+			return -1;
+		}
+		memcpy(vl->values, value_list[i]->values, vl->values_len * sizeof(*vl->values));
+		vl->meta = (vl->meta != NULL) ? meta_data_clone(vl->meta) : NULL;
+		e->ds[i] = ds[i];
+		e->num = i + 1;
+	}
+	return cpy_queue_append(e);
+}
+
+/* Removes the queued elements of a callback which is going away. You must
+ * hold the GIL to call this function. */
+static void cpy_queue_remove(const cpy_callback_t *c) {
+	cpy_queue_elem_t *e, *prev = NULL, *next, *removed = NULL;
+
+	pthread_mutex_lock(&cpy_queue_lock);
+	for (e = cpy_queue_head; e != NULL; e = next) {
+		next = e->next;
+		if (e->callback != c) {
+			prev = e;
+			continue;
+		}
+		if (prev == NULL)
+			cpy_queue_head = next;
+		else
+			prev->next = next;
+		if (cpy_queue_tail == e)
+			cpy_queue_tail = prev;
+		--cpy_queue_length;
+		e->next = removed;
+		removed = e;
+	}
+	pthread_mutex_unlock(&cpy_queue_lock);
+
+	while (removed != NULL) {
+		next = removed->next;
+		cpy_queue_elem_free(removed);
+		removed = next;
+	}
+}
+
+static void *cpy_worker(void *data) {
+	cpy_queue_elem_t *e;
+	const value_list_t **vl;
+	size_t i;
+
+	pthread_mutex_lock(&cpy_queue_lock);
+	while (cpy_worker_running || cpy_queue_head != NULL) {
+		if (cpy_queue_head == NULL) {
+			pthread_cond_wait(&cpy_queue_cond, &cpy_queue_lock);
+			continue;
 		}
+		pthread_mutex_unlock(&cpy_queue_lock);
+
+		/* Take the GIL once for everything which is queued by now. */
+		CPY_LOCK_THREADS
+			while (42) {
+				pthread_mutex_lock(&cpy_queue_lock);
+				e = cpy_queue_head;
+				if (e != NULL) {
+					cpy_queue_head = e->next;
+					if (cpy_queue_head == NULL)
+						cpy_queue_tail = NULL;
+					--cpy_queue_length;
+				}
+				pthread_mutex_unlock(&cpy_queue_lock);
+				if (e == NULL)
+					break;
+
+				if (e->type == CPY_QUEUE_NOTIFICATION) {
+					cpy_call_notification(e->callback, &e->notification);
+				} else if (e->type == CPY_QUEUE_WRITE) {
+					cpy_call_write(e->callback, e->ds[0], e->vl);
+				} else {
+					vl = malloc(e->num * sizeof(*vl));
+					if (vl != NULL) {
+						for (i = 0; i < e->num; ++i)
+							vl[i] = e->vl + i;
+						cpy_call_write_batch(e->callback, e->ds, vl, e->num);
+						free(vl);
+					}
+				}
+				cpy_queue_elem_free(e);
+			}
+		CPY_RELEASE_THREADS
+
+		pthread_mutex_lock(&cpy_queue_lock);
+	}
+	pthread_mutex_unlock(&cpy_queue_lock);
+	return NULL;
+}
+
+static int cpy_worker_read(void) {
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+	gauge_t length;
+	derive_t dropped;
+
+	pthread_mutex_lock(&cpy_queue_lock);
+	length = (gauge_t) cpy_queue_length;
+	dropped = (derive_t) cpy_queue_dropped;
+	pthread_mutex_unlock(&cpy_queue_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy(vl.host, hostname_g, sizeof(vl.host));
+	sstrncpy(vl.plugin, "python", sizeof(vl.plugin));
+	sstrncpy(vl.plugin_instance, "worker", sizeof(vl.plugin_instance));
+
+	sstrncpy(vl.type, "queue_length", sizeof(vl.type));
+	values[0].gauge = length;
+	plugin_dispatch_values(&vl);
+
+	sstrncpy(vl.type, "derive", sizeof(vl.type));
+	sstrncpy(vl.type_instance, "dropped", sizeof(vl.type_instance));
+	values[0].derive = dropped;
+	plugin_dispatch_values(&vl);
+	return 0;
+}
+
+static int cpy_write_callback(const data_set_t *ds, const value_list_t *value_list, user_data_t *data) {
+	cpy_callback_t *c = data->data;
+
+	if (cpy_worker_enabled)
+		return cpy_queue_values(c, CPY_QUEUE_WRITE, &ds, &value_list, 1);
+
+	CPY_LOCK_THREADS
+		cpy_call_write(c, ds, value_list);
 	CPY_RELEASE_THREADS
 	return 0;
 }
 
-static int cpy_notification_callback(const notification_t *notification, user_data_t *data) {
+/* Takes the GIL once for the whole batch, rather than once per value list. */
+static int cpy_write_batch_callback(const data_set_t **ds, const value_list_t **value_list,
+		size_t num, user_data_t *data) {
 	cpy_callback_t *c = data->data;
-	PyObject *ret, *notify;
-	Notification *n;
+
+	if (cpy_worker_enabled)
+		return cpy_queue_values(c, CPY_QUEUE_WRITE_BATCH, ds, value_list, num);
 
 	CPY_LOCK_THREADS
-		notify = Notification_New(); /* New reference. */
-		n = (Notification *) notify;
-		sstrncpy(n->data.host, notification->host, sizeof(n->data.host));
-		sstrncpy(n->data.type, notification->type, sizeof(n->data.type));
-		sstrncpy(n->data.type_instance, notification->type_instance, sizeof(n->data.type_instance));
-		sstrncpy(n->data.plugin, notification->plugin, sizeof(n->data.plugin));
-		sstrncpy(n->data.plugin_instance, notification->plugin_instance, sizeof(n->data.plugin_instance));
-		n->data.time = CDTIME_T_TO_DOUBLE(notification->time);
-		sstrncpy(n->message, notification->message, sizeof(n->message));
-		n->severity = notification->severity;
-		ret = PyObject_CallFunctionObjArgs(c->callback, n, c->data, (void *) 0); /* New reference. */
-		Py_XDECREF(notify);
-		if (ret == NULL) {
-			cpy_log_exception("notification callback");
-		} else {
-			Py_DECREF(ret);
+		cpy_call_write_batch(c, ds, value_list, num);
+	CPY_RELEASE_THREADS
+	return 0;
+}
+
+static int cpy_notification_callback(const notification_t *notification, user_data_t *data) {
+	cpy_callback_t *c = data->data;
+	cpy_queue_elem_t *e;
+
+	if (cpy_worker_enabled) {
+		e = calloc(1, sizeof(*e));
+		if (e == NULL) {
+			ERROR("python plugin: calloc failed.");
+			return -1;
 		}
+		e->type = CPY_QUEUE_NOTIFICATION;
+		e->callback = c;
+		e->notification = *notification;
+		/* The python callbacks don't see the meta data. */
+		e->notification.meta = NULL;
+		return cpy_queue_append(e);
+	}
+
+	CPY_LOCK_THREADS
+		cpy_call_notification(c, notification);
 	CPY_RELEASE_THREADS
 	return 0;
 }
@@ -640,8 +987,43 @@ static PyObject *cpy_register_log(PyObject *self, PyObject *args, PyObject *kwds
 }
 
 static PyObject *cpy_register_write(PyObject *self, PyObject *args, PyObject *kwds) {
-	return cpy_register_generic_userdata((void *) plugin_register_write,
-			(void *) cpy_write_callback, args, kwds);
+	char buf[512];
+	cpy_callback_t *c = NULL;
+	user_data_t *user_data = NULL;
+	const char *name = NULL;
+	PyObject *callback = NULL, *data = NULL, *batch = NULL;
+	int batch_size = 100;
+	double batch_timeout = 0;
+	static char *kwlist[] = {"callback", "data", "name", "batch", "batch_size", "batch_timeout", NULL};
+	
+	if (PyArg_ParseTupleAndKeywords(args, kwds, "O|OetOid", kwlist, &callback, &data, NULL, &name,
+			&batch, &batch_size, &batch_timeout) == 0) return NULL;
+	if (PyCallable_Check(callback) == 0) {
+		PyErr_SetString(PyExc_TypeError, "callback needs a be a callable object.");
+		return NULL;
+	}
+	if (batch_size < 1 || batch_timeout < 0) {
+		PyErr_SetString(PyExc_ValueError, "batch_size must be positive and batch_timeout must not be negative.");
+		return NULL;
+	}
+	cpy_build_name(buf, sizeof(buf), callback, name);
+	
+	Py_INCREF(callback);
+	Py_XINCREF(data);
+	c = malloc(sizeof(*c));
+	c->name = strdup(buf);
+	c->callback = callback;
+	c->data = data;
+	c->next = NULL;
+	user_data = malloc(sizeof(*user_data));
+	user_data->free_func = cpy_destroy_user_data;
+	user_data->data = c;
+	if (batch != NULL && PyObject_IsTrue(batch))
+		plugin_register_write_batch(buf, cpy_write_batch_callback, (size_t) batch_size,
+				DOUBLE_TO_CDTIME_T(batch_timeout), user_data);
+	else
+		plugin_register_write(buf, cpy_write_callback, user_data);
+	return cpy_string_to_unicode_or_bytes(buf);
 }
 
 static PyObject *cpy_register_notification(PyObject *self, PyObject *args, PyObject *kwds) {
@@ -658,6 +1040,49 @@ static PyObject *cpy_register_shutdown(PyObject *self, PyObject *args, PyObject
 	return cpy_register_generic(&cpy_shutdown_callbacks, args, kwds);
 }
 
+static PyObject *cpy_dispatch_many(PyObject *self, PyObject *arg) {
+	int ret;
+	Py_ssize_t i, size;
+	PyObject *seq;
+	value_list_t *vl;
+
+	seq = PySequence_Fast(arg, "dispatch_many needs a sequence of Values objects."); /* New reference. */
+	if (seq == NULL)
+		return NULL;
+	size = PySequence_Fast_GET_SIZE(seq);
+	if (size == 0) {
+		Py_DECREF(seq);
+		Py_RETURN_NONE;
+	}
+	vl = calloc(size, sizeof(*vl));
+	if (vl == NULL) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+	for (i = 0; i < size; ++i) {
+		if (Values_to_value_list(PySequence_Fast_GET_ITEM(seq, i), vl + i) != 0)
+			break;
+	}
+	Py_DECREF(seq);
+	if (i < size) {
+		while (i > 0)
+			cpy_value_list_free(vl + --i);
+		free(vl);
+		return NULL;
+	}
+	Py_BEGIN_ALLOW_THREADS
+	ret = plugin_dispatch_values_batch(vl, (size_t) size);
+	Py_END_ALLOW_THREADS
+	for (i = 0; i < size; ++i)
+		cpy_value_list_free(vl + i);
+	free(vl);
+	if (ret != 0) {
+		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
+		return NULL;
+	}
+	Py_RETURN_NONE;
+}
+
 static PyObject *cpy_error(PyObject *self, PyObject *args) {
 	const char *text;
 	if (PyArg_ParseTuple(args, "et", NULL, &text) == 0) return NULL;
@@ -807,6 +1232,7 @@ static PyMethodDef cpy_methods[] = {
 	{"warning", cpy_warning, METH_VARARGS, log_doc},
 	{"error", cpy_error, METH_VARARGS, log_doc},
 	{"flush", (PyCFunction) cpy_flush, METH_VARARGS | METH_KEYWORDS, flush_doc},
+	{"dispatch_many", cpy_dispatch_many, METH_O, dispatch_many_doc},
 	{"register_log", (PyCFunction) cpy_register_log, METH_VARARGS | METH_KEYWORDS, reg_log_doc},
 	{"register_init", (PyCFunction) cpy_register_init, METH_VARARGS | METH_KEYWORDS, reg_init_doc},
 	{"register_config", (PyCFunction) cpy_register_config, METH_VARARGS | METH_KEYWORDS, reg_config_doc},
@@ -830,6 +1256,16 @@ static int cpy_shutdown(void) {
 	cpy_callback_t *c;
 	PyObject *ret;
 	
+	/* Let the worker hand over what is still queued. It needs the GIL for
+	 * that, so this has to happen before we take it. */
+	if (cpy_worker_running) {
+		pthread_mutex_lock(&cpy_queue_lock);
+		cpy_worker_running = 0;
+		pthread_cond_broadcast(&cpy_queue_cond);
+		pthread_mutex_unlock(&cpy_queue_lock);
+		pthread_join(cpy_worker_thread, NULL);
+	}
+
 	/* This can happen if the module was loaded but not configured. */
 	if (state != NULL)
 		PyEval_RestoreThread(state);
@@ -921,6 +1357,17 @@ static int cpy_init(void) {
 	sigaddset(&sigset, SIGINT);
 	pthread_sigmask(SIG_BLOCK, &sigset, NULL);
 	state = PyEval_SaveThread();
+	if (cpy_worker_enabled) {
+		cpy_worker_running = 1;
+		if (pthread_create(&cpy_worker_thread, NULL, cpy_worker, NULL)) {
+			ERROR("python: Error creating the worker thread, "
+				"calling the write and notification callbacks directly.");
+			cpy_worker_running = 0;
+			cpy_worker_enabled = 0;
+		} else {
+			plugin_register_read("python", cpy_worker_read);
+		}
+	}
 	if (do_interactive) {
 		if (pthread_create(&thread, NULL, cpy_interactive, NULL)) {
 			ERROR("python: Error creating thread for interactive interpreter.");
@@ -1053,6 +1500,17 @@ static int cpy_config(oconfig_item_t *ci) {
 			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_BOOLEAN)
 				continue;
 			do_interactive = item->values[0].value.boolean;
+		} else if (strcasecmp(item->key, "WorkerThread") == 0) {
+			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_BOOLEAN)
+				continue;
+			cpy_worker_enabled = item->values[0].value.boolean;
+		} else if (strcasecmp(item->key, "WorkerQueueLimit") == 0) {
+			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_NUMBER
+					|| item->values[0].value.number < 1) {
+				WARNING("python plugin: WorkerQueueLimit needs a positive number.");
+				continue;
+			}
+			cpy_queue_limit = (size_t) item->values[0].value.number;
 		} else if (strcasecmp(item->key, "Encoding") == 0) {
 			if (item->values_num != 1 || item->values[0].type != OCONFIG_TYPE_STRING)
 				continue;
@@ -482,66 +482,61 @@ static meta_data_t *cpy_build_meta(PyObject *meta) {
 	return m;
 }
 
-static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
-	int i, ret;
+/* Fills `vl' from the given members of a Values object, using the data set of
+ * `type' to convert `values'. The values and meta data must be freed with
+ * `cpy_value_list_free'. Sets a Python exception and returns non-zero on
+ * failure. */
+static int cpy_build_value_list(value_list_t *vl, const char *type, PyObject *values,
+		const char *plugin_instance, const char *type_instance, const char *plugin,
+		const char *host, double time, double interval, PyObject *meta) {
+	int i;
 	const data_set_t *ds;
 	int size;
 	value_t *value;
-	value_list_t value_list = VALUE_LIST_INIT;
-	PyObject *values = self->values, *meta = self->meta;
-	double time = self->data.time, interval = self->interval;
-	const char *host = self->data.host;
-	const char *plugin = self->data.plugin;
-	const char *plugin_instance = self->data.plugin_instance;
-	const char *type = self->data.type;
-	const char *type_instance = self->data.type_instance;
-	
-	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
-			"plugin", "host", "time", "interval", "meta", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
-			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
-			NULL, &plugin, NULL, &host, &time, &interval, &meta))
-		return NULL;
 
 	if (type[0] == 0) {
 		PyErr_SetString(PyExc_RuntimeError, "type not set");
-		return NULL;
+		return -1;
 	}
 	ds = plugin_get_ds(type);
 	if (ds == NULL) {
 		PyErr_Format(PyExc_TypeError, "Dataset %s not found", type);
-		return NULL;
+		return -1;
 	}
 	if (values == NULL || (PyTuple_Check(values) == 0 && PyList_Check(values) == 0)) {
 		PyErr_Format(PyExc_TypeError, "values must be list or tuple");
-		return NULL;
+		return -1;
 	}
 	if (meta != NULL && meta != Py_None && !PyDict_Check(meta)) {
 		PyErr_Format(PyExc_TypeError, "meta must be a dict");
-		return NULL;
+		return -1;
 	}
 	size = (int) PySequence_Length(values);
 	if (size != ds->ds_num) {
 		PyErr_Format(PyExc_RuntimeError, "type %s needs %d values, got %i", type, ds->ds_num, size);
-		return NULL;
+		return -1;
 	}
 	value = malloc(size * sizeof(*value));
+	if (value == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
 	for (i = 0; i < size; ++i) {
 		PyObject *item, *num;
 		item = PySequence_Fast_GET_ITEM(values, i); /* Borrowed reference. */
-		if (ds->ds->type == DS_TYPE_COUNTER) {
+		if (ds->ds[i].type == DS_TYPE_COUNTER) {
 			num = PyNumber_Long(item); /* New reference. */
 			if (num != NULL) {
 				value[i].counter = PyLong_AsUnsignedLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_GAUGE) {
+		} else if (ds->ds[i].type == DS_TYPE_GAUGE) {
 			num = PyNumber_Float(item); /* New reference. */
 			if (num != NULL) {
 				value[i].gauge = PyFloat_AsDouble(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_DERIVE) {
+		} else if (ds->ds[i].type == DS_TYPE_DERIVE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -549,7 +544,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 				value[i].derive = PyLong_AsLongLong(num);
 				Py_XDECREF(num);
 			}
-		} else if (ds->ds->type == DS_TYPE_ABSOLUTE) {
+		} else if (ds->ds[i].type == DS_TYPE_ABSOLUTE) {
 			/* This might overflow without raising an exception.
 			 * Not much we can do about it */
 			num = PyNumber_Long(item); /* New reference. */
@@ -559,33 +554,77 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 			}
 		} else {
 			free(value);
-			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds->type, type);
-			return NULL;
+			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds[i].type, type);
+			return -1;
 		}
 		if (PyErr_Occurred() != NULL) {
 			free(value);
-			return NULL;
+			return -1;
 		}
 	}
-	value_list.values = value;
-	value_list.meta = cpy_build_meta(meta);
-	value_list.values_len = size;
-	value_list.time = DOUBLE_TO_CDTIME_T(time);
-	value_list.interval = DOUBLE_TO_CDTIME_T(interval);
-	sstrncpy(value_list.host, host, sizeof(value_list.host));
-	sstrncpy(value_list.plugin, plugin, sizeof(value_list.plugin));
-	sstrncpy(value_list.plugin_instance, plugin_instance, sizeof(value_list.plugin_instance));
-	sstrncpy(value_list.type, type, sizeof(value_list.type));
-	sstrncpy(value_list.type_instance, type_instance, sizeof(value_list.type_instance));
-	if (value_list.host[0] == 0)
-		sstrncpy(value_list.host, hostname_g, sizeof(value_list.host));
-	if (value_list.plugin[0] == 0)
-		sstrncpy(value_list.plugin, "python", sizeof(value_list.plugin));
+	vl->values = value;
+	vl->meta = cpy_build_meta(meta);
+	vl->values_len = size;
+	vl->time = DOUBLE_TO_CDTIME_T(time);
+	vl->interval = DOUBLE_TO_CDTIME_T(interval);
+	sstrncpy(vl->host, host, sizeof(vl->host));
+	sstrncpy(vl->plugin, plugin, sizeof(vl->plugin));
+	sstrncpy(vl->plugin_instance, plugin_instance, sizeof(vl->plugin_instance));
+	sstrncpy(vl->type, type, sizeof(vl->type));
+	sstrncpy(vl->type_instance, type_instance, sizeof(vl->type_instance));
+	if (vl->host[0] == 0)
+		sstrncpy(vl->host, hostname_g, sizeof(vl->host));
+	if (vl->plugin[0] == 0)
+		sstrncpy(vl->plugin, "python", sizeof(vl->plugin));
+	return 0;
+}
+
+int Values_to_value_list(PyObject *obj, value_list_t *vl) {
+	Values *self;
+
+	if (!PyObject_TypeCheck(obj, &ValuesType)) {
+		PyErr_SetString(PyExc_TypeError, "only Values objects can be dispatched");
+		return -1;
+	}
+	self = (Values *) obj;
+	return cpy_build_value_list(vl, self->data.type, self->values,
+			self->data.plugin_instance, self->data.type_instance,
+			self->data.plugin, self->data.host, self->data.time,
+			self->interval, self->meta);
+}
+
+void cpy_value_list_free(value_list_t *vl) {
+	meta_data_destroy(vl->meta);
+	vl->meta = NULL;
+	free(vl->values);
+	vl->values = NULL;
+}
+
+static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
+	int ret;
+	value_list_t value_list = VALUE_LIST_INIT;
+	PyObject *values = self->values, *meta = self->meta;
+	double time = self->data.time, interval = self->interval;
+	const char *host = self->data.host;
+	const char *plugin = self->data.plugin;
+	const char *plugin_instance = self->data.plugin_instance;
+	const char *type = self->data.type;
+	const char *type_instance = self->data.type_instance;
+	
+	static char *kwlist[] = {"type", "values", "plugin_instance", "type_instance",
+			"plugin", "host", "time", "interval", "meta", NULL};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
+			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
+			NULL, &plugin, NULL, &host, &time, &interval, &meta))
+		return NULL;
+
+	if (cpy_build_value_list(&value_list, type, values, plugin_instance,
+			type_instance, plugin, host, time, interval, meta) != 0)
+		return NULL;
 	Py_BEGIN_ALLOW_THREADS;
 	ret = plugin_dispatch_values(&value_list);
 	Py_END_ALLOW_THREADS;
-	meta_data_destroy(value_list.meta);
-	free(value);
+	cpy_value_list_free(&value_list);
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
 		return NULL;
@@ -594,10 +633,7 @@ static PyObject *Values_dispatch(Values *self, PyObject *args, PyObject *kwds) {
 }
 
 static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
-	int i, ret;
-	const data_set_t *ds;
-	int size;
-	value_t *value;
+	int ret;
 	value_list_t value_list = VALUE_LIST_INIT;
 	PyObject *values = self->values, *meta = self->meta;
 	double time = self->data.time, interval = self->interval;
@@ -610,90 +646,18 @@ static PyObject *Values_write(Values *self, PyObject *args, PyObject *kwds) {
 	
 	static char *kwlist[] = {"destination", "type", "values", "plugin_instance", "type_instance",
 			"plugin", "host", "time", "interval", "meta", NULL};
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etOetetetetddO", kwlist,
-			NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|etetOetetetetddO", kwlist,
+			NULL, &dest, NULL, &type, &values, NULL, &plugin_instance, NULL, &type_instance,
 			NULL, &plugin, NULL, &host, &time, &interval, &meta))
 		return NULL;
 
-	if (type[0] == 0) {
-		PyErr_SetString(PyExc_RuntimeError, "type not set");
+	if (cpy_build_value_list(&value_list, type, values, plugin_instance,
+			type_instance, plugin, host, time, interval, meta) != 0)
 		return NULL;
-	}
-	ds = plugin_get_ds(type);
-	if (ds == NULL) {
-		PyErr_Format(PyExc_TypeError, "Dataset %s not found", type);
-		return NULL;
-	}
-	if (values == NULL || (PyTuple_Check(values) == 0 && PyList_Check(values) == 0)) {
-		PyErr_Format(PyExc_TypeError, "values must be list or tuple");
-		return NULL;
-	}
-	size = (int) PySequence_Length(values);
-	if (size != ds->ds_num) {
-		PyErr_Format(PyExc_RuntimeError, "type %s needs %d values, got %i", type, ds->ds_num, size);
-		return NULL;
-	}
-	value = malloc(size * sizeof(*value));
-	for (i = 0; i < size; ++i) {
-		PyObject *item, *num;
-		item = PySequence_Fast_GET_ITEM(values, i); /* Borrowed reference. */
-		if (ds->ds->type == DS_TYPE_COUNTER) {
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].counter = PyLong_AsUnsignedLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_GAUGE) {
-			num = PyNumber_Float(item); /* New reference. */
-			if (num != NULL) {
-				value[i].gauge = PyFloat_AsDouble(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_DERIVE) {
-			/* This might overflow without raising an exception.
-			 * Not much we can do about it */
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].derive = PyLong_AsLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else if (ds->ds->type == DS_TYPE_ABSOLUTE) {
-			/* This might overflow without raising an exception.
-			 * Not much we can do about it */
-			num = PyNumber_Long(item); /* New reference. */
-			if (num != NULL) {
-				value[i].absolute = PyLong_AsUnsignedLongLong(num);
-				Py_XDECREF(num);
-			}
-		} else {
-			free(value);
-			PyErr_Format(PyExc_RuntimeError, "unknown data type %d for %s", ds->ds->type, type);
-			return NULL;
-		}
-		if (PyErr_Occurred() != NULL) {
-			free(value);
-			return NULL;
-		}
-	}
-	value_list.values = value;
-	value_list.values_len = size;
-	value_list.time = DOUBLE_TO_CDTIME_T(time);
-	value_list.interval = DOUBLE_TO_CDTIME_T(interval);
-	sstrncpy(value_list.host, host, sizeof(value_list.host));
-	sstrncpy(value_list.plugin, plugin, sizeof(value_list.plugin));
-	sstrncpy(value_list.plugin_instance, plugin_instance, sizeof(value_list.plugin_instance));
-	sstrncpy(value_list.type, type, sizeof(value_list.type));
-	sstrncpy(value_list.type_instance, type_instance, sizeof(value_list.type_instance));
-	value_list.meta = cpy_build_meta(meta);;
-	if (value_list.host[0] == 0)
-		sstrncpy(value_list.host, hostname_g, sizeof(value_list.host));
-	if (value_list.plugin[0] == 0)
-		sstrncpy(value_list.plugin, "python", sizeof(value_list.plugin));
 	Py_BEGIN_ALLOW_THREADS;
 	ret = plugin_write(dest, NULL, &value_list);
 	Py_END_ALLOW_THREADS;
-	meta_data_destroy(value_list.meta);
-	free(value);
+	cpy_value_list_free(&value_list);
 	if (ret != 0) {
 		PyErr_SetString(PyExc_RuntimeError, "error dispatching values, read the logs");
 		return NULL;
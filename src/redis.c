@@ -53,6 +53,9 @@ struct redis_node_s
   int port;
   int timeout;
 
+  /* Kept open across reads; reopened after an error. */
+  REDIS rh;
+
   redis_node_t *next;
 };
 
@@ -220,89 +223,191 @@ static void redis_submit_d (char *plugin_instance,
   plugin_dispatch_values (&vl);
 } /* }}} */
 
-static int redis_init (void) /* {{{ */
+/* The INFO fields submitted for each node. credis parses the INFO output
+ * into a REDIS_INFO struct; this table maps its members to types. */
+#define REDIS_FIELD_INT   0
+#define REDIS_FIELD_UINT  1
+#define REDIS_FIELD_LLONG 2
+
+struct redis_field_s
 {
-  redis_node_t rn = { "default", REDIS_DEF_HOST, REDIS_DEF_PORT,
-    REDIS_DEF_TIMEOUT, /* next = */ NULL };
+  const char *type;
+  const char *type_instance;
+  int ds_type;
+  int field_type;
+  size_t offset;
+};
+typedef struct redis_field_s redis_field_t;
 
-  if (nodes_head == NULL)
-    redis_node_add (&rn);
+static const redis_field_t redis_fields[] =
+{
+  { "current_connections", "clients", DS_TYPE_GAUGE, REDIS_FIELD_INT,
+    offsetof (REDIS_INFO, connected_clients) },
+  { "current_connections", "slaves", DS_TYPE_GAUGE, REDIS_FIELD_INT,
+    offsetof (REDIS_INFO, connected_slaves) },
+  { "memory", "used", DS_TYPE_GAUGE, REDIS_FIELD_UINT,
+    offsetof (REDIS_INFO, used_memory) },
+  { "volatile_changes", NULL, DS_TYPE_GAUGE, REDIS_FIELD_LLONG,
+    offsetof (REDIS_INFO, changes_since_last_save) },
+  { "total_connections", NULL, DS_TYPE_DERIVE, REDIS_FIELD_LLONG,
+    offsetof (REDIS_INFO, total_connections_received) },
+  { "total_operations", NULL, DS_TYPE_DERIVE, REDIS_FIELD_LLONG,
+    offsetof (REDIS_INFO, total_commands_processed) }
+};
+static size_t redis_fields_num = STATIC_ARRAY_SIZE (redis_fields);
 
-  return (0);
-} /* }}} int redis_init */
+static void redis_submit_info (redis_node_t *rn, /* {{{ */
+    const REDIS_INFO *info)
+{
+  size_t i;
+
+  for (i = 0; i < redis_fields_num; i++)
+  {
+    const redis_field_t *f = redis_fields + i;
+    const char *ptr = ((const char *) info) + f->offset;
+    long long value;
+
+    if (f->field_type == REDIS_FIELD_INT)
+      value = (long long) *((const int *) ptr);
+    else if (f->field_type == REDIS_FIELD_UINT)
+      value = (long long) *((const unsigned int *) ptr);
+    else
+      value = *((const long long *) ptr);
+
+    if (f->ds_type == DS_TYPE_DERIVE)
+      redis_submit_d (rn->name, f->type, f->type_instance, (derive_t) value);
+    else
+      redis_submit_g (rn->name, f->type, f->type_instance, (gauge_t) value);
+  }
+} /* }}} void redis_submit_info */
+
+static void redis_node_disconnect (redis_node_t *rn) /* {{{ */
+{
+  if (rn->rh != NULL)
+  {
+    credis_close (rn->rh);
+    rn->rh = NULL;
+  }
+} /* }}} void redis_node_disconnect */
+
+static void redis_node_free (void *arg) /* {{{ */
+{
+  redis_node_t *rn = arg;
 
-static int redis_read (void) /* {{{ */
+  if (rn == NULL)
+    return;
+
+  redis_node_disconnect (rn);
+  sfree (rn);
+} /* }}} void redis_node_free */
+
+static int redis_node_connect (redis_node_t *rn) /* {{{ */
 {
-  redis_node_t *rn;
+  if (rn->rh != NULL)
+    return (0);
 
-  for (rn = nodes_head; rn != NULL; rn = rn->next)
+  rn->rh = credis_connect (rn->host, rn->port, rn->timeout);
+  if (rn->rh == NULL)
   {
-    REDIS rh;
-    REDIS_INFO info;
+    ERROR ("redis plugin: unable to connect to node `%s' (%s:%d).",
+        rn->name, rn->host, rn->port);
+    return (-1);
+  }
 
-    int status;
+  return (0);
+} /* }}} int redis_node_connect */
 
-    DEBUG ("redis plugin: querying info from node `%s' (%s:%d).", rn->name, rn->host, rn->port);
+static int redis_read (user_data_t *ud) /* {{{ */
+{
+  redis_node_t *rn = ud->data;
+  REDIS_INFO info;
+  int status;
 
-    rh = credis_connect (rn->host, rn->port, rn->timeout);
-    if (rh == NULL)
-    {
-      ERROR ("redis plugin: unable to connect to node `%s' (%s:%d).", rn->name, rn->host, rn->port);
-      continue;
-    }
+  DEBUG ("redis plugin: querying info from node `%s' (%s:%d).", rn->name, rn->host, rn->port);
 
+  /* A connection kept from the last read may have been closed by the
+   * server in the meantime, so a failing query is retried once over a new
+   * connection. */
+  status = redis_node_connect (rn);
+  if (status == 0)
+  {
     memset (&info, 0, sizeof (info));
-    status = credis_info (rh, &info);
+    status = credis_info (rn->rh, &info);
     if (status != 0)
     {
-      WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
-      credis_close (rh);
-      continue;
+      redis_node_disconnect (rn);
+      status = redis_node_connect (rn);
+      if (status == 0)
+      {
+        memset (&info, 0, sizeof (info));
+        status = credis_info (rn->rh, &info);
+      }
     }
+  }
 
-    /* typedef struct _cr_info {
-     *   char redis_version[CREDIS_VERSION_STRING_SIZE];
-     *   int bgsave_in_progress;
-     *   int connected_clients;
-     *   int connected_slaves;
-     *   unsigned int used_memory;
-     *   long long changes_since_last_save;
-     *   int last_save_time;
-     *   long long total_connections_received;
-     *   long long total_commands_processed;
-     *   int uptime_in_seconds;
-     *   int uptime_in_days;
-     *   int role;
-     * } REDIS_INFO; */
-
-    DEBUG ("redis plugin: received info from node `%s': connected_clients = %d; "
-        "connected_slaves = %d; used_memory = %lu; changes_since_last_save = %lld; "
-        "bgsave_in_progress = %d; total_connections_received = %lld; "
-        "total_commands_processed = %lld; uptime_in_seconds = %ld", rn->name,
-        info.connected_clients, info.connected_slaves, info.used_memory,
-        info.changes_since_last_save, info.bgsave_in_progress,
-        info.total_connections_received, info.total_commands_processed,
-        info.uptime_in_seconds);
-
-    redis_submit_g (rn->name, "current_connections", "clients", info.connected_clients);
-    redis_submit_g (rn->name, "current_connections", "slaves", info.connected_slaves);
-    redis_submit_g (rn->name, "memory", "used", info.used_memory);
-    redis_submit_g (rn->name, "volatile_changes", NULL, info.changes_since_last_save);
-    redis_submit_d (rn->name, "total_connections", NULL, info.total_connections_received);
-    redis_submit_d (rn->name, "total_operations", NULL, info.total_commands_processed);
-
-    credis_close (rh);
+  if (status != 0)
+  {
+    WARNING ("redis plugin: unable to get info from node `%s'.", rn->name);
+    redis_node_disconnect (rn);
+    return (-1);
   }
 
-  return 0;
-}
-/* }}} */
+  DEBUG ("redis plugin: received info from node `%s': connected_clients = %d; "
+      "connected_slaves = %d; used_memory = %u; changes_since_last_save = %lld; "
+      "bgsave_in_progress = %d; total_connections_received = %lld; "
+      "total_commands_processed = %lld; uptime_in_seconds = %d", rn->name,
+      info.connected_clients, info.connected_slaves, info.used_memory,
+      info.changes_since_last_save, info.bgsave_in_progress,
+      info.total_connections_received, info.total_commands_processed,
+      info.uptime_in_seconds);
+
+  redis_submit_info (rn, &info);
+
+  return (0);
+} /* }}} int redis_read */
+
+static int redis_init (void) /* {{{ */
+{
+  redis_node_t rn = { "default", REDIS_DEF_HOST, REDIS_DEF_PORT,
+    REDIS_DEF_TIMEOUT, /* rh = */ NULL, /* next = */ NULL };
+  static _Bool did_init = 0;
+
+  if (did_init)
+    return (0);
+  did_init = 1;
+
+  if (nodes_head == NULL)
+    redis_node_add (&rn);
+
+  /* Each node is read by a callback of its own, so that the nodes are
+   * queried in parallel and a slow node doesn't delay the others. The
+   * callbacks take ownership of the nodes. */
+  while (nodes_head != NULL)
+  {
+    redis_node_t *node = nodes_head;
+    char cb_name[DATA_MAX_NAME_LEN];
+    user_data_t ud;
+
+    nodes_head = node->next;
+    node->next = NULL;
+
+    ssnprintf (cb_name, sizeof (cb_name), "redis-%s", node->name);
+
+    memset (&ud, 0, sizeof (ud));
+    ud.data = node;
+    ud.free_func = redis_node_free;
+
+    plugin_register_complex_read (/* group = */ "redis", cb_name,
+        redis_read, /* interval = */ NULL, &ud);
+  }
+
+  return (0);
+} /* }}} int redis_init */
 
 void module_register (void) /* {{{ */
 {
   plugin_register_complex_config ("redis", redis_config);
   plugin_register_init ("redis", redis_init);
-  plugin_register_read ("redis", redis_read);
   /* TODO: plugin_register_write: one redis list per value id with
    * X elements */
 }
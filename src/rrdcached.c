@@ -22,12 +22,34 @@
 #include "collectd.h"
 #include "plugin.h"
 #include "common.h"
+#include "utils_avltree.h"
+#include "utils_known_paths.h"
 #include "utils_rrdcreate.h"
 
+#include <pthread.h>
+
 #undef HAVE_CONFIG_H
 #include <rrd.h>
 #include <rrd_client.h>
 
+/* librrd assembles each command in a buffer of this size and fails if the
+ * command doesn't fit. */
+#define RC_UPDATE_BUFFER_SIZE 4096
+
+/*
+ * Private types
+ */
+/* Values of a file which have not been sent to the daemon yet, either because
+ * the file is being created by the creation threads or because the values are
+ * being batched. */
+struct rc_pending_s
+{
+  char **values;
+  int values_num;
+  cdtime_t first; /* When the oldest value was added. */
+};
+typedef struct rc_pending_s rc_pending_t;
+
 /*
  * Private variables
  */
@@ -46,16 +68,39 @@ static rrdcreate_config_t rrdcreate_config =
 	/* timespans_num = */ 0,
 
 	/* consolidation_functions = */ NULL,
-	/* consolidation_functions_num = */ 0
+	/* consolidation_functions_num = */ 0,
+
+	/* async = */ 0
 };
 
+static c_avl_tree_t *pending = NULL;
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static cdtime_t stat_cache_timeout = 0;
+static known_paths_t *known_paths = NULL;
+
+/* Values waiting to be sent by the batch thread. `batch_send_lock' is held
+ * while values are taken from the tree and sent, so that the values of one
+ * file are always sent in order. Lock it before `batch_lock'. */
+static cdtime_t config_max_delay = 0;
+static int config_batch_size = 128;
+static c_avl_tree_t *batch = NULL;
+static pthread_mutex_t batch_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t batch_send_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t batch_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t batch_thread;
+static int batch_thread_running = 0;
+static int batch_thread_loop = 0;
+static int batch_full = 0;
+
 /*
  * Prototypes.
  */
 static int rc_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t __attribute__((unused)) *user_data);
-static int rc_flush (__attribute__((unused)) cdtime_t timeout,
+static int rc_flush (cdtime_t timeout,
     const char *identifier, __attribute__((unused)) user_data_t *ud);
+static void *rc_batch_thread (void *data);
 
 static int value_list_to_string (char *buffer, int buffer_len,
     const data_set_t *ds, const value_list_t *vl)
@@ -187,8 +232,35 @@ static int rc_config (oconfig_item_t *ci)
 
   for (i = 0; i < ci->children_num; ++i) {
     const char *key = ci->children[i].key;
-    const char *value = config_get_string (ci->children + i);
+    const char *value;
 
+    /* Numeric options */
+    if (strcasecmp ("StatCacheTimeout", key) == 0)
+    {
+      cf_util_get_cdtime (ci->children + i, &stat_cache_timeout);
+      continue;
+    }
+    else if (strcasecmp ("MaxDelay", key) == 0)
+    {
+      cf_util_get_cdtime (ci->children + i, &config_max_delay);
+      continue;
+    }
+    else if (strcasecmp ("BatchSize", key) == 0)
+    {
+      int tmp = config_batch_size;
+
+      if (cf_util_get_int (ci->children + i, &tmp) != 0)
+        continue;
+      if (tmp < 1)
+      {
+        ERROR ("rrdcached plugin: `BatchSize' must be at least one.");
+        continue;
+      }
+      config_batch_size = tmp;
+      continue;
+    }
+
+    value = config_get_string (ci->children + i);
     if (value == NULL) /* config_get_strings prints error message */
       continue;
 
@@ -236,6 +308,13 @@ static int rc_config (oconfig_item_t *ci)
       else
         config_collect_stats = 1;
     }
+    else if (strcasecmp ("CreateFilesAsync", key) == 0)
+    {
+      if (IS_TRUE (value))
+        rrdcreate_config.async = 1;
+      else
+        rrdcreate_config.async = 0;
+    }
     else
     {
       WARNING ("rrdcached plugin: Ignoring invalid option %s.", key);
@@ -354,12 +433,420 @@ static int rc_read (void)
 
 static int rc_init (void)
 {
+  if ((stat_cache_timeout > 0) && (known_paths == NULL))
+  {
+    known_paths = kp_create (stat_cache_timeout);
+    if (known_paths == NULL)
+    {
+      ERROR ("rrdcached plugin: kp_create failed.");
+      return (-1);
+    }
+  }
+
+  if ((config_max_delay > 0) && !batch_thread_running)
+  {
+    int status;
+
+    pthread_mutex_lock (&batch_lock);
+    batch = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (batch == NULL)
+    {
+      pthread_mutex_unlock (&batch_lock);
+      ERROR ("rrdcached plugin: c_avl_create failed.");
+      return (-1);
+    }
+    batch_thread_loop = 1;
+    pthread_mutex_unlock (&batch_lock);
+
+    status = pthread_create (&batch_thread, /* attr = */ NULL,
+        rc_batch_thread, /* args = */ NULL);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      ERROR ("rrdcached plugin: Cannot create batch thread: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      pthread_mutex_lock (&batch_lock);
+      batch_thread_loop = 0;
+      pthread_mutex_unlock (&batch_lock);
+    }
+    else
+    {
+      batch_thread_running = 1;
+    }
+  }
+
   if (config_collect_stats != 0)
     plugin_register_read ("rrdcached", rc_read);
 
   return (0);
 } /* int rc_init */
 
+static void rc_pending_free (rc_pending_t *p) /* {{{ */
+{
+  int i;
+
+  if (p == NULL)
+    return;
+
+  for (i = 0; i < p->values_num; i++)
+    sfree (p->values[i]);
+  sfree (p->values);
+  sfree (p);
+} /* }}} void rc_pending_free */
+
+static int rc_pending_append (rc_pending_t *p, const char *value) /* {{{ */
+{
+  char **tmp;
+
+  tmp = realloc (p->values, (p->values_num + 1) * sizeof (*p->values));
+  if (tmp == NULL)
+  {
+    ERROR ("rrdcached plugin: realloc failed.");
+    return (-1);
+  }
+  p->values = tmp;
+
+  p->values[p->values_num] = strdup (value);
+  if (p->values[p->values_num] == NULL)
+  {
+    ERROR ("rrdcached plugin: strdup failed.");
+    return (-1);
+  }
+  p->values_num++;
+
+  return (0);
+} /* }}} int rc_pending_append */
+
+/* Sends `values' to the daemon, packing as many values into each "update"
+ * command as fit into librrd's buffer. */
+static int rc_send_values (const char *filename, /* {{{ */
+    char **values, int values_num)
+{
+  size_t max_size;
+  int offset;
+  int status;
+
+  status = rrdc_connect (daemon_address);
+  if (status != 0)
+  {
+    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
+        daemon_address, status);
+    return (-1);
+  }
+
+  /* Leave room for the command, the (escaped) file name and the newline. */
+  max_size = 0;
+  if ((2 * strlen (filename) + 16) < RC_UPDATE_BUFFER_SIZE)
+    max_size = RC_UPDATE_BUFFER_SIZE - (2 * strlen (filename) + 16);
+
+  offset = 0;
+  while (offset < values_num)
+  {
+    size_t size = 0;
+    int num = 0;
+
+    while ((offset + num) < values_num)
+    {
+      size_t len = strlen (values[offset + num]) + 1;
+
+      if ((num > 0) && ((size + len) > max_size))
+        break;
+
+      size += len;
+      num++;
+    }
+
+    status = rrdc_update (filename, num, (void *) (values + offset));
+    if (status != 0)
+    {
+      ERROR ("rrdcached plugin: rrdc_update (%s, [%s], %i) failed with "
+          "status %i.", filename, values[offset], num, status);
+      return (-1);
+    }
+
+    offset += num;
+  }
+
+  return (0);
+} /* }}} int rc_send_values */
+
+/* Adds `value' to the values waiting to be sent by the batch thread. Returns
+ * one if the batch thread is not running, in which case the caller has to
+ * send the value itself. */
+static int rc_batch_add (const char *filename, const char *value) /* {{{ */
+{
+  rc_pending_t *p = NULL;
+
+  pthread_mutex_lock (&batch_lock);
+
+  if (!batch_thread_loop)
+  {
+    pthread_mutex_unlock (&batch_lock);
+    return (1);
+  }
+
+  if (c_avl_get (batch, filename, (void *) &p) != 0)
+  {
+    char *key;
+
+    p = malloc (sizeof (*p));
+    key = strdup (filename);
+    if ((p == NULL) || (key == NULL))
+    {
+      pthread_mutex_unlock (&batch_lock);
+      ERROR ("rrdcached plugin: malloc failed.");
+      sfree (p);
+      sfree (key);
+      return (-1);
+    }
+    p->values = NULL;
+    p->values_num = 0;
+    p->first = cdtime ();
+
+    if (c_avl_insert (batch, key, p) != 0)
+    {
+      pthread_mutex_unlock (&batch_lock);
+      ERROR ("rrdcached plugin: c_avl_insert failed.");
+      sfree (p);
+      sfree (key);
+      return (-1);
+    }
+  }
+
+  if (rc_pending_append (p, value) != 0)
+  {
+    pthread_mutex_unlock (&batch_lock);
+    return (-1);
+  }
+
+  if (p->values_num >= config_batch_size)
+  {
+    batch_full = 1;
+    pthread_cond_signal (&batch_cond);
+  }
+
+  pthread_mutex_unlock (&batch_lock);
+  return (0);
+} /* }}} int rc_batch_add */
+
+/* Sends batched values to the daemon. If `filename' is not NULL, only the
+ * values of that file are sent. Otherwise the values of all files, whose
+ * oldest value is at least `max_age' old or which have reached `BatchSize',
+ * are sent. Returns the time when the next file is due. */
+static cdtime_t rc_batch_flush (const char *filename, /* {{{ */
+    cdtime_t max_age)
+{
+  char **keys = NULL;
+  rc_pending_t **entries = NULL;
+  int entries_num = 0;
+  cdtime_t now;
+  cdtime_t next;
+  int i;
+
+  pthread_mutex_lock (&batch_send_lock);
+  pthread_mutex_lock (&batch_lock);
+
+  now = cdtime ();
+  next = now + config_max_delay;
+
+  if ((batch == NULL) || (c_avl_size (batch) == 0))
+  {
+    pthread_mutex_unlock (&batch_lock);
+    pthread_mutex_unlock (&batch_send_lock);
+    return (next);
+  }
+
+  keys = calloc (c_avl_size (batch), sizeof (*keys));
+  entries = calloc (c_avl_size (batch), sizeof (*entries));
+  if ((keys == NULL) || (entries == NULL))
+  {
+    pthread_mutex_unlock (&batch_lock);
+    pthread_mutex_unlock (&batch_send_lock);
+    ERROR ("rrdcached plugin: calloc failed.");
+    sfree (keys);
+    sfree (entries);
+    return (next);
+  }
+
+  if (filename != NULL)
+  {
+    if (c_avl_remove (batch, filename, (void *) &keys[0],
+          (void *) &entries[0]) == 0)
+      entries_num = 1;
+  }
+  else
+  {
+    c_avl_iterator_t iter;
+    char *key;
+    rc_pending_t *p;
+
+    c_avl_iterator_init (&iter, batch);
+    while (c_avl_iterator_next (&iter, (void *) &key, (void *) &p) == 0)
+    {
+      cdtime_t due = p->first + max_age;
+
+      if ((due <= now) || (p->values_num >= config_batch_size))
+      {
+        keys[entries_num] = key;
+        entries[entries_num] = p;
+        entries_num++;
+      }
+      else if (due < next)
+      {
+        next = due;
+      }
+    }
+
+    for (i = 0; i < entries_num; i++)
+      c_avl_remove (batch, keys[i], NULL, NULL);
+  }
+
+  pthread_mutex_unlock (&batch_lock);
+
+  for (i = 0; i < entries_num; i++)
+  {
+    if (rc_send_values (keys[i], entries[i]->values,
+          entries[i]->values_num) != 0)
+    {
+      /* Maybe the file has been removed. */
+      kp_invalidate (known_paths, keys[i]);
+    }
+
+    sfree (keys[i]);
+    rc_pending_free (entries[i]);
+  }
+
+  pthread_mutex_unlock (&batch_send_lock);
+
+  sfree (keys);
+  sfree (entries);
+
+  return (next);
+} /* }}} cdtime_t rc_batch_flush */
+
+static void *rc_batch_thread (void __attribute__((unused)) *data) /* {{{ */
+{
+  pthread_mutex_lock (&batch_lock);
+  while (batch_thread_loop)
+  {
+    struct timespec ts;
+    cdtime_t next;
+
+    batch_full = 0;
+    pthread_mutex_unlock (&batch_lock);
+
+    next = rc_batch_flush (/* filename = */ NULL, config_max_delay);
+
+    pthread_mutex_lock (&batch_lock);
+    if (!batch_thread_loop || batch_full)
+      continue;
+
+    CDTIME_T_TO_TIMESPEC (next, &ts);
+    pthread_cond_timedwait (&batch_cond, &batch_lock, &ts);
+  }
+  pthread_mutex_unlock (&batch_lock);
+
+  return ((void *) 0);
+} /* }}} void *rc_batch_thread */
+
+/* Appends `value' to the values of `filename', if that file is being created.
+ * If `create' is true, the file is added to the list of files being created
+ * if necessary and `ret_new' is set to true if this happened. Returns ENOENT
+ * if the file is not being created and `create' is false. */
+static int rc_pending_add (const char *filename, const char *value, /* {{{ */
+    _Bool create, _Bool *ret_new)
+{
+  rc_pending_t *p = NULL;
+
+  pthread_mutex_lock (&pending_lock);
+
+  if (pending == NULL)
+  {
+    pending = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (pending == NULL)
+    {
+      pthread_mutex_unlock (&pending_lock);
+      ERROR ("rrdcached plugin: c_avl_create failed.");
+      return (-1);
+    }
+  }
+
+  if (c_avl_get (pending, filename, (void *) &p) != 0)
+  {
+    char *key;
+
+    if (!create)
+    {
+      pthread_mutex_unlock (&pending_lock);
+      return (ENOENT);
+    }
+
+    p = malloc (sizeof (*p));
+    key = strdup (filename);
+    if ((p == NULL) || (key == NULL))
+    {
+      pthread_mutex_unlock (&pending_lock);
+      ERROR ("rrdcached plugin: malloc failed.");
+      sfree (p);
+      sfree (key);
+      return (-1);
+    }
+    p->values = NULL;
+    p->values_num = 0;
+    p->first = cdtime ();
+
+    c_avl_insert (pending, key, p);
+    *ret_new = 1;
+  }
+
+  if (rc_pending_append (p, value) != 0)
+  {
+    pthread_mutex_unlock (&pending_lock);
+    return (-1);
+  }
+
+  pthread_mutex_unlock (&pending_lock);
+  return (0);
+} /* }}} int rc_pending_add */
+
+/* Called by the creation threads when the file has been created. */
+static void rc_create_callback (const char *filename, int status) /* {{{ */
+{
+  rc_pending_t *p = NULL;
+  char *key = NULL;
+
+  if (status == 0)
+    kp_set_exists (known_paths, filename);
+  else
+    kp_invalidate (known_paths, filename);
+
+  pthread_mutex_lock (&pending_lock);
+
+  if ((pending == NULL)
+      || (c_avl_remove (pending, filename, (void *) &key, (void *) &p) != 0))
+  {
+    pthread_mutex_unlock (&pending_lock);
+    return;
+  }
+
+  /* Keep holding the lock while sending the values, so that values arriving
+   * in the meantime are not sent before these. */
+  if ((status == 0) && (p->values_num > 0))
+  {
+    rc_send_values (filename, p->values, p->values_num);
+  }
+  else if (status != 0)
+  {
+    ERROR ("rrdcached plugin: Creating `%s' failed, dropping %i %s.",
+        filename, p->values_num, (p->values_num == 1) ? "value" : "values");
+  }
+
+  pthread_mutex_unlock (&pending_lock);
+
+  sfree (key);
+  rc_pending_free (p);
+} /* }}} void rc_create_callback */
+
 static int rc_write (const data_set_t *ds, const value_list_t *vl,
     user_data_t __attribute__((unused)) *user_data)
 {
@@ -398,17 +885,39 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
 
   if (config_create_files != 0)
   {
-    struct stat statbuf;
+    /* If the file is still being created, just add the value to the list. */
+    if (rrdcreate_config.async
+        && (rc_pending_add (filename, values, /* create = */ 0, NULL) == 0))
+      return (0);
 
-    status = stat (filename, &statbuf);
-    if (status != 0)
+    status = kp_check (known_paths, filename);
+    if ((status != 0) && (status != ENOENT))
+      return (-1);
+
+    if (status == ENOENT)
     {
-      if (errno != ENOENT)
+      if (rrdcreate_config.async)
       {
-        char errbuf[1024];
-        ERROR ("rrdcached plugin: stat (%s) failed: %s",
-            filename, sstrerror (errno, errbuf, sizeof (errbuf)));
-        return (-1);
+        _Bool is_new = 0;
+
+        status = rc_pending_add (filename, values, /* create = */ 1, &is_new);
+        if (status != 0)
+          return (-1);
+
+        if (!is_new)
+          return (0);
+
+        status = cu_rrd_create_file_async (filename, ds, vl,
+            &rrdcreate_config, rc_create_callback);
+        if (status != 0)
+        {
+          ERROR ("rrdcached plugin: cu_rrd_create_file_async (%s) failed.",
+              filename);
+          rc_create_callback (filename, status);
+          return (-1);
+        }
+
+        return (0);
       }
 
       status = cu_rrd_create_file (filename, ds, vl, &rrdcreate_config);
@@ -416,32 +925,30 @@ static int rc_write (const data_set_t *ds, const value_list_t *vl,
       {
         ERROR ("rrdcached plugin: cu_rrd_create_file (%s) failed.",
             filename);
+        kp_invalidate (known_paths, filename);
         return (-1);
       }
+      kp_set_exists (known_paths, filename);
     }
   }
 
-  status = rrdc_connect (daemon_address);
-  if (status != 0)
-  {
-    ERROR ("rrdcached plugin: rrdc_connect (%s) failed with status %i.",
-        daemon_address, status);
-    return (-1);
-  }
+  status = rc_batch_add (filename, values);
+  if (status <= 0)
+    return (status);
 
-  status = rrdc_update (filename, /* values_num = */ 1, (void *) values_array);
+  /* Batching is disabled: send the value right away. */
+  status = rc_send_values (filename, values_array, /* values_num = */ 1);
   if (status != 0)
   {
-    ERROR ("rrdcached plugin: rrdc_update (%s, [%s], 1) failed with "
-        "status %i.",
-        filename, values_array[0], status);
+    /* Maybe the file has been removed. */
+    kp_invalidate (known_paths, filename);
     return (-1);
   }
 
   return (0);
 } /* int rc_write */
 
-static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
+static int rc_flush (cdtime_t timeout, /* {{{ */
     const char *identifier,
     __attribute__((unused)) user_data_t *ud)
 {
@@ -449,13 +956,20 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
   int status;
 
   if (identifier == NULL)
-    return (EINVAL);
+  {
+    /* Send batched values which are older than `timeout'. */
+    rc_batch_flush (/* filename = */ NULL, timeout);
+    return (0);
+  }
 
   if (datadir != NULL)
     ssnprintf (filename, sizeof (filename), "%s/%s.rrd", datadir, identifier);
   else
     ssnprintf (filename, sizeof (filename), "%s.rrd", identifier);
 
+  /* The daemon can only flush values it has received. */
+  rc_batch_flush (filename, /* max_age = */ 0);
+
   status = rrdc_connect (daemon_address);
   if (status != 0)
   {
@@ -478,6 +992,57 @@ static int rc_flush (__attribute__((unused)) cdtime_t timeout, /* {{{ */
 
 static int rc_shutdown (void)
 {
+  /* Send the values of files which are still being created. */
+  cu_rrd_create_shutdown ();
+
+  pthread_mutex_lock (&pending_lock);
+  if (pending != NULL)
+  {
+    void *key;
+    void *value;
+
+    while (c_avl_pick (pending, &key, &value) == 0)
+    {
+      sfree (key);
+      rc_pending_free (value);
+    }
+    c_avl_destroy (pending);
+    pending = NULL;
+  }
+  pthread_mutex_unlock (&pending_lock);
+
+  /* Stop the batch thread and send all values it didn't get to. */
+  if (batch_thread_running)
+  {
+    pthread_mutex_lock (&batch_lock);
+    batch_thread_loop = 0;
+    pthread_cond_signal (&batch_cond);
+    pthread_mutex_unlock (&batch_lock);
+
+    pthread_join (batch_thread, /* retval = */ NULL);
+    batch_thread_running = 0;
+
+    rc_batch_flush (/* filename = */ NULL, /* max_age = */ 0);
+  }
+
+  pthread_mutex_lock (&batch_lock);
+  if (batch != NULL)
+  {
+    void *key;
+    void *value;
+
+    while (c_avl_pick (batch, &key, &value) == 0)
+    {
+      sfree (key);
+      rc_pending_free (value);
+    }
+    c_avl_destroy (batch);
+    batch = NULL;
+  }
+  pthread_mutex_unlock (&batch_lock);
+
+  /* `known_paths' is not destroyed here, because other threads may still
+   * be dispatching values to `rc_write'. */
   rrdc_disconnect ();
   return (0);
 } /* int rc_shutdown */
@@ -27,7 +27,13 @@
 #include "plugin.h"
 #include "common.h"
 #include "utils_avltree.h"
+#include "utils_complain.h"
+#include "utils_hashtable.h"
+#include "utils_known_paths.h"
+#include "utils_memory.h"
+#include "utils_probes.h"
 #include "utils_rrdcreate.h"
+#include "utils_thread.h"
 
 #include <rrd.h>
 
@@ -38,18 +44,46 @@
 /*
  * Private types
  */
+/* Cached values are stored in binary form in a list of chunks and are only
+ * converted to strings when they are written to the RRD file. Each chunk
+ * holds up to RRD_CHUNK_SIZE records, so the number of allocations per file
+ * is small. */
+#define RRD_CHUNK_SIZE 32
+struct rrd_chunk_s
+{
+	int      records_num;
+	cdtime_t times[RRD_CHUNK_SIZE];
+	struct rrd_chunk_s *next;
+	/* RRD_CHUNK_SIZE times `ds_num' values */
+	value_t  values[];
+};
+typedef struct rrd_chunk_s rrd_chunk_t;
+#define RRD_CHUNK_BYTES(ds_num) (sizeof (rrd_chunk_t) \
+		+ (RRD_CHUNK_SIZE * (ds_num) * sizeof (value_t)))
+
 struct rrd_cache_s
 {
 	int      values_num;
-	char   **values;
+	rrd_chunk_t *chunks_head;
+	rrd_chunk_t *chunks_tail;
+	int      ds_num;
+	int     *ds_types;
 	cdtime_t first_value;
 	cdtime_t last_value;
 	int64_t  random_variation;
+	/* The cache key, i.e. the file name. Owned by the `cache' tree. */
+	char    *filename;
+	/* Position in the age list, see `cache_age_head' below. */
+	cdtime_t age;
+	struct rrd_cache_s *age_prev;
+	struct rrd_cache_s *age_next;
 	enum
 	{
 		FLAG_NONE   = 0x00,
 		FLAG_QUEUED = 0x01,
-		FLAG_FLUSHQ = 0x02
+		FLAG_FLUSHQ = 0x02,
+		/* The file is being created, values are kept in the cache. */
+		FLAG_CREATE = 0x04
 	} flags;
 };
 typedef struct rrd_cache_s rrd_cache_t;
@@ -64,33 +98,117 @@ typedef enum rrd_queue_dir_e rrd_queue_dir_t;
 struct rrd_queue_s
 {
 	char *filename;
+	struct rrd_queue_s *prev;
 	struct rrd_queue_s *next;
 };
 typedef struct rrd_queue_s rrd_queue_t;
 
+/* Each writer thread has its own pair of queues. Files are assigned to a
+ * writer by hashing the file name, so all updates of one file are written by
+ * the same thread and in order. */
+struct rrd_writer_s
+{
+	rrd_queue_t    *queue_head;
+	rrd_queue_t    *queue_tail;
+	rrd_queue_t    *flushq_head;
+	rrd_queue_t    *flushq_tail;
+	int             queue_length;
+	/* Maps file names to the entries of the regular queue, so that one file
+	 * can be moved to the flush queue without searching the queue. */
+	c_hashtable_t  *queue_index;
+	pthread_t       thread;
+	int             thread_running;
+	pthread_mutex_t queue_lock;
+	pthread_cond_t  queue_cond;
+
+	/* Statistics, protected by `queue_lock': the number of updates, the
+	 * moving average of their latency and the current delay between
+	 * updates in seconds, see `rrd_adapt_delay'. */
+	derive_t        writes;
+	cdtime_t        latency;
+	double          delay;
+
+	/* Values taken from the cache which are being written, so that a
+	 * checkpoint of the journal includes them. Protected by `cache_lock'
+	 * and only set if the journal is enabled. */
+	const char     *inflight_filename;
+	rrd_chunk_t    *inflight_chunks;
+	int             inflight_values_num;
+	int             inflight_ds_num;
+	int            *inflight_ds_types;
+
+	/* Set when records have been added to `journal_buffer'. Only used for
+	 * the first writer, which appends them to the journal. Protected by
+	 * `queue_lock'. */
+	_Bool           journal_pending;
+};
+typedef struct rrd_writer_s rrd_writer_t;
+
 /*
- * Private variables
+ * The journal
+ *
+ * If "JournalFile" is set, a record of every value added to the cache is put
+ * into `journal_buffer', and the first writer thread appends the buffer to the
+ * journal with one write(2) per pass of its queue. This way the values survive
+ * a crash of the daemon, and values still in the journal are added to the
+ * cache again on startup. When the journal has grown to twice its size after
+ * the last checkpoint (plus RRD_JOURNAL_MIN_SIZE), it is replaced by a
+ * checkpoint, i.e. a new journal holding only the values which have not been
+ * written yet. The file uses the host's byte order. Each record holds the
+ * values of one file:
+ *
+ *   rrd_journal_record_t
+ *   uint8_t  ds_types[ds_num]
+ *   char     filename[filename_len]  (not terminated)
+ *   values_num times:
+ *     cdtime_t time
+ *     value_t  values[ds_num]
  */
-static const char *config_keys[] =
+#define RRD_JOURNAL_MAGIC "rrdjrnl"
+#define RRD_JOURNAL_VERSION 1
+#define RRD_JOURNAL_RECORD_MAGIC 0x524a524eU
+#define RRD_JOURNAL_MIN_SIZE (1024 * 1024)
+
+struct rrd_journal_header_s
+{
+	char     magic[8];
+	uint32_t version;
+	uint32_t value_size;
+};
+typedef struct rrd_journal_header_s rrd_journal_header_t;
+
+struct rrd_journal_record_s
 {
-	"CacheTimeout",
-	"CacheFlush",
-	"DataDir",
-	"StepSize",
-	"HeartBeat",
-	"RRARows",
-	"RRATimespan",
-	"XFF",
-	"WritesPerSecond",
-	"RandomTimeout"
+	uint32_t magic;
+	uint16_t filename_len;
+	uint16_t ds_num;
+	uint32_t values_num;
 };
-static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
+typedef struct rrd_journal_record_s rrd_journal_record_t;
 
+/* Journal records are formatted into a buffer before they are written. */
+struct rrd_journal_buffer_s
+{
+	char  *data;
+	size_t len;
+	size_t size;
+};
+typedef struct rrd_journal_buffer_s rrd_journal_buffer_t;
+
+/*
+ * Private variables
+ */
 /* If datadir is zero, the daemon's basedir is used. If stepsize or heartbeat
  * is zero a default, depending on the `interval' member of the value list is
  * being used. */
 static char *datadir   = NULL;
 static double write_rate = 0.0;
+/* With `AdaptiveWriteRate', each writer adjusts its rate between the minimum
+ * and maximum rate so that updates take about `target_latency'. */
+static _Bool adaptive_rate = 0;
+static cdtime_t target_latency = 0;
+static double min_write_rate = 1.0;
+static double max_write_rate = 1000.0;
 static rrdcreate_config_t rrdcreate_config =
 {
 	/* stepsize = */ 0,
@@ -102,26 +220,41 @@ static rrdcreate_config_t rrdcreate_config =
 	/* timespans_num = */ 0,
 
 	/* consolidation_functions = */ NULL,
-	/* consolidation_functions_num = */ 0
+	/* consolidation_functions_num = */ 0,
+
+	/* async = */ 0,
+	/* template_dir = */ NULL
 };
 
 /* XXX: If you need to lock both, cache_lock and queue_lock, at the same time,
- * ALWAYS lock `cache_lock' first! */
+ * ALWAYS lock `cache_lock' first! Never hold the queue_lock of more than one
+ * writer at a time. `journal_lock' has to be locked before both of them. */
 static cdtime_t    cache_timeout = 0;
 static cdtime_t    cache_flush_timeout = 0;
 static cdtime_t    random_timeout = TIME_T_TO_CDTIME_T (1);
 static cdtime_t    cache_flush_last;
 static c_avl_tree_t *cache = NULL;
 static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-static rrd_queue_t    *queue_head = NULL;
-static rrd_queue_t    *queue_tail = NULL;
-static rrd_queue_t    *flushq_head = NULL;
-static rrd_queue_t    *flushq_tail = NULL;
-static pthread_t       queue_thread;
-static int             queue_thread_running = 1;
-static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+/* The cache's entries and chunks, including those being written. */
+static mem_account_t *cache_mem = NULL;
+#define RRD_CACHE_BYTES(ds_num) (sizeof (rrd_cache_t) \
+		+ ((ds_num) * sizeof (int)))
+
+/* All cache entries which are not queued are kept in this list, ordered by
+ * the time they were last (re-)added, oldest first. This way
+ * `rrd_cache_flush' only needs to look at the entries that are past their
+ * timeout instead of the entire tree. Protected by `cache_lock'. */
+static rrd_cache_t *cache_age_head = NULL;
+static rrd_cache_t *cache_age_tail = NULL;
+
+static cdtime_t       stat_cache_timeout = 0;
+static known_paths_t  *known_paths = NULL;
+
+static rrd_writer_t   *writers = NULL;
+static int             writers_num = 1;
+/* CPUs the queue threads are bound to, see `thread_check_cpus'. */
+static char           *writers_cpus = NULL;
+static int             collect_stats = 0;
 
 #if !HAVE_THREADSAFE_LIBRRD
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -129,6 +262,26 @@ static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static int do_shutdown = 0;
 
+/* Only set by the configuration. */
+static char    *journal_file = NULL;
+/* Records of values added to the cache which have not been appended to the
+ * journal yet. Protected by `cache_lock'. */
+static rrd_journal_buffer_t journal_buffer = { NULL, 0, 0 };
+/* Protected by `journal_lock'. `journal_spare' holds the records taken from
+ * `journal_buffer' while they are being written. The buffers are swapped, so
+ * their memory is reused. */
+static pthread_mutex_t journal_lock = PTHREAD_MUTEX_INITIALIZER;
+static int      journal_fd = -1;
+static uint64_t journal_size = 0;
+static uint64_t journal_checkpoint_size = 0;
+static rrd_journal_buffer_t journal_spare = { NULL, 0, 0 };
+static c_complain_t journal_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* The moving average of the update latency gives the last eight updates about
+ * two thirds of the weight. */
+#define RRD_LATENCY_WEIGHT 8
+#define RRD_DEFAULT_TARGET_LATENCY MS_TO_CDTIME_T (20)
+
 #if HAVE_THREADSAFE_LIBRRD
 static int srrd_update (char *filename, char *template,
 		int argc, const char **argv)
@@ -148,6 +301,12 @@ static int srrd_update (char *filename, char *template,
 
 	return (status);
 } /* int srrd_update */
+
+static time_t srrd_last (const char *filename)
+{
+	rrd_clear_error ();
+	return (rrd_last_r (filename));
+} /* time_t srrd_last */
 /* #endif HAVE_THREADSAFE_LIBRRD */
 
 #else /* !HAVE_THREADSAFE_LIBRRD */
@@ -192,10 +351,29 @@ static int srrd_update (char *filename, char *template,
 
 	return (status);
 } /* int srrd_update */
+
+static time_t srrd_last (const char *filename)
+{
+	char *argv[3];
+	time_t last;
+
+	argv[0] = "last";
+	argv[1] = (char *) filename;
+	argv[2] = NULL;
+
+	pthread_mutex_lock (&librrd_lock);
+	optind = 0; /* bug in librrd? */
+	rrd_clear_error ();
+	last = rrd_last (2, argv);
+	pthread_mutex_unlock (&librrd_lock);
+
+	return (last);
+} /* time_t srrd_last */
 #endif /* !HAVE_THREADSAFE_LIBRRD */
 
-static int value_list_to_string (char *buffer, int buffer_len,
-		const data_set_t *ds, const value_list_t *vl)
+static int value_to_string (char *buffer, int buffer_len,
+		int ds_num, const int *ds_types,
+		cdtime_t value_time, const value_t *values)
 {
 	int offset;
 	int status;
@@ -204,41 +382,89 @@ static int value_list_to_string (char *buffer, int buffer_len,
 
 	memset (buffer, '\0', buffer_len);
 
-	tt = CDTIME_T_TO_TIME_T (vl->time);
+	tt = CDTIME_T_TO_TIME_T (value_time);
 	status = ssnprintf (buffer, buffer_len, "%u", (unsigned int) tt);
 	if ((status < 1) || (status >= buffer_len))
 		return (-1);
 	offset = status;
 
-	for (i = 0; i < ds->ds_num; i++)
+	for (i = 0; i < ds_num; i++)
 	{
-		if ((ds->ds[i].type != DS_TYPE_COUNTER)
-				&& (ds->ds[i].type != DS_TYPE_GAUGE)
-				&& (ds->ds[i].type != DS_TYPE_DERIVE)
-				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
-			return (-1);
-
-		if (ds->ds[i].type == DS_TYPE_COUNTER)
+		if (ds_types[i] == DS_TYPE_COUNTER)
 			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%llu", vl->values[i].counter);
-		else if (ds->ds[i].type == DS_TYPE_GAUGE)
+					":%llu", values[i].counter);
+		else if (ds_types[i] == DS_TYPE_GAUGE)
 			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%lf", vl->values[i].gauge);
-		else if (ds->ds[i].type == DS_TYPE_DERIVE)
+					":%lf", values[i].gauge);
+		else if (ds_types[i] == DS_TYPE_DERIVE)
 			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIi64, vl->values[i].derive);
-		else /*if (ds->ds[i].type == DS_TYPE_ABSOLUTE) */
+					":%"PRIi64, values[i].derive);
+		else if (ds_types[i] == DS_TYPE_ABSOLUTE)
 			status = ssnprintf (buffer + offset, buffer_len - offset,
-					":%"PRIu64, vl->values[i].absolute);
+					":%"PRIu64, values[i].absolute);
+		else
+			return (-1);
 
 		if ((status < 1) || (status >= (buffer_len - offset)))
 			return (-1);
 
 		offset += status;
-	} /* for ds->ds_num */
+	} /* for ds_num */
 
 	return (0);
-} /* int value_list_to_string */
+} /* int value_to_string */
+
+/* Converts the values in the chunk list to strings suitable for
+ * `rrd_update'. Values that cannot be converted are skipped. Returns the
+ * number of strings stored in `ret_values'. */
+static int chunks_to_strings (char ***ret_values, const rrd_chunk_t *chunks,
+		int values_num, int ds_num, const int *ds_types)
+{
+	char **values;
+	char buffer[512];
+	const rrd_chunk_t *c;
+	int num = 0;
+	int i;
+
+	values = calloc (values_num, sizeof (*values));
+	if (values == NULL)
+	{
+		ERROR ("rrdtool plugin: calloc failed.");
+		return (-1);
+	}
+
+	for (c = chunks; c != NULL; c = c->next)
+	{
+		for (i = 0; (i < c->records_num) && (num < values_num); i++)
+		{
+			int status;
+
+			status = value_to_string (buffer, sizeof (buffer),
+					ds_num, ds_types,
+					c->times[i], c->values + (i * ds_num));
+			if (status != 0)
+				continue;
+
+			values[num] = strdup (buffer);
+			if (values[num] != NULL)
+				num++;
+		}
+	}
+
+	*ret_values = values;
+	return (num);
+} /* int chunks_to_strings */
+
+static void rrd_chunks_free (rrd_chunk_t *c, int ds_num)
+{
+	while (c != NULL)
+	{
+		rrd_chunk_t *next = c->next;
+		mem_account_add (cache_mem, -((int64_t) RRD_CHUNK_BYTES (ds_num)));
+		sfree (c);
+		c = next;
+	}
+} /* void rrd_chunks_free */
 
 static int value_list_to_filename (char *buffer, int buffer_len,
 		const data_set_t __attribute__((unused)) *ds, const value_list_t *vl)
@@ -284,10 +510,370 @@ static int value_list_to_filename (char *buffer, int buffer_len,
 	return (0);
 } /* int value_list_to_filename */
 
-static void *rrd_queue_thread (void __attribute__((unused)) *data)
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void rrd_cache_age_unlink (rrd_cache_t *rc)
 {
+	/* Not in the list */
+	if ((rc->age_prev == NULL) && (cache_age_head != rc))
+		return;
+
+	if (rc->age_prev == NULL)
+		cache_age_head = rc->age_next;
+	else
+		rc->age_prev->age_next = rc->age_next;
+
+	if (rc->age_next == NULL)
+		cache_age_tail = rc->age_prev;
+	else
+		rc->age_next->age_prev = rc->age_prev;
+
+	rc->age_prev = NULL;
+	rc->age_next = NULL;
+} /* void rrd_cache_age_unlink */
+
+/* XXX: You must hold "cache_lock" when calling this function! */
+static void rrd_cache_age_append (rrd_cache_t *rc)
+{
+	rrd_cache_age_unlink (rc);
+
+	rc->age = cdtime ();
+	rc->age_prev = cache_age_tail;
+	rc->age_next = NULL;
+
+	if (cache_age_tail == NULL)
+		cache_age_head = rc;
+	else
+		cache_age_tail->age_next = rc;
+	cache_age_tail = rc;
+} /* void rrd_cache_age_append */
+
+/* Makes room for `size' more bytes in `buf'. */
+static int rrd_journal_reserve (rrd_journal_buffer_t *buf, /* {{{ */
+		size_t size)
+{
+	size_t new_size;
+	char *tmp;
+
+	if ((buf->size - buf->len) >= size)
+		return (0);
+
+	new_size = (buf->size > 0) ? buf->size : 4096;
+	while ((new_size - buf->len) < size)
+		new_size *= 2;
+
+	tmp = realloc (buf->data, new_size);
+	if (tmp == NULL)
+	{
+		ERROR ("rrdtool plugin: rrd_journal_reserve: realloc failed.");
+		return (-1);
+	}
+	buf->data = tmp;
+	buf->size = new_size;
+
+	return (0);
+} /* }}} int rrd_journal_reserve */
+
+/* Adds `values_num' values of `chunks', starting with value `first', as one
+ * journal record to `buf'. */
+static int rrd_journal_format (rrd_journal_buffer_t *buf, /* {{{ */
+		const char *filename, int ds_num, const int *ds_types,
+		const rrd_chunk_t *chunks, int first, int values_num)
+{
+	rrd_journal_record_t record;
+	size_t filename_len = strlen (filename);
+	size_t value_size = sizeof (cdtime_t) + (ds_num * sizeof (value_t));
+	char *ptr;
+	int i;
+
+	if ((filename_len > UINT16_MAX) || (ds_num > UINT16_MAX))
+		return (-1);
+
+	if (rrd_journal_reserve (buf, sizeof (record) + ds_num + filename_len
+				+ (((size_t) values_num) * value_size)) != 0)
+		return (-1);
+
+	memset (&record, 0, sizeof (record));
+	record.magic = RRD_JOURNAL_RECORD_MAGIC;
+	record.filename_len = (uint16_t) filename_len;
+	record.ds_num = (uint16_t) ds_num;
+	record.values_num = (uint32_t) values_num;
+
+	ptr = buf->data + buf->len;
+	memcpy (ptr, &record, sizeof (record));
+	ptr += sizeof (record);
+	for (i = 0; i < ds_num; i++)
+		*ptr++ = (char) ds_types[i];
+	memcpy (ptr, filename, filename_len);
+	ptr += filename_len;
+
+	while ((chunks != NULL) && (values_num > 0))
+	{
+		if (first >= chunks->records_num)
+		{
+			first -= chunks->records_num;
+			chunks = chunks->next;
+			continue;
+		}
+
+		memcpy (ptr, chunks->times + first, sizeof (cdtime_t));
+		ptr += sizeof (cdtime_t);
+		memcpy (ptr, chunks->values + (first * ds_num),
+				ds_num * sizeof (value_t));
+		ptr += ds_num * sizeof (value_t);
+
+		first++;
+		values_num--;
+	}
+	assert (values_num == 0);
+
+	buf->len = (size_t) (ptr - buf->data);
+	return (0);
+} /* }}} int rrd_journal_format */
+
+/* Appends the records in `journal_spare' to the journal and empties it.
+ * `journal_lock' must be held. */
+static void rrd_journal_write_spare (void) /* {{{ */
+{
+	if ((journal_fd >= 0) && (journal_spare.len > 0))
+	{
+		if (swrite (journal_fd, journal_spare.data, journal_spare.len) != 0)
+		{
+			char errbuf[1024];
+			c_complain (LOG_ERR, &journal_complaint, "rrdtool plugin: "
+					"Appending to the journal %s failed: %s", journal_file,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+		}
+		else
+		{
+			c_release (LOG_INFO, &journal_complaint, "rrdtool plugin: "
+					"Appending to the journal %s succeeded again.",
+					journal_file);
+			journal_size += (uint64_t) journal_spare.len;
+		}
+	}
+
+	journal_spare.len = 0;
+} /* }}} void rrd_journal_write_spare */
+
+/* Replaces the journal with one holding only the values in the cache and
+ * the ones being written. `journal_lock' must be held and `cache_lock' must
+ * not be held: the values are copied with the cache locked, but the file is
+ * written, synced and renamed after unlocking it. */
+static int rrd_journal_checkpoint (void) /* {{{ */
+{
+	rrd_journal_buffer_t snapshot = { NULL, 0, 0 };
+	rrd_journal_buffer_t tmp;
+	rrd_journal_header_t header;
+	c_avl_iterator_t *iter;
+	char tmpfile[PATH_MAX];
+	char *key;
+	rrd_cache_t *rc;
+	int status;
+	int fd;
+	int i;
+
+	memset (&header, 0, sizeof (header));
+	memcpy (header.magic, RRD_JOURNAL_MAGIC, sizeof (RRD_JOURNAL_MAGIC));
+	header.version = RRD_JOURNAL_VERSION;
+	header.value_size = sizeof (value_t);
+	status = rrd_journal_reserve (&snapshot, sizeof (header));
+	if (status == 0)
+	{
+		memcpy (snapshot.data, &header, sizeof (header));
+		snapshot.len = sizeof (header);
+	}
+
+	pthread_mutex_lock (&cache_lock);
+
+	iter = c_avl_get_iterator (cache);
+	while ((status == 0)
+			&& (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0))
+	{
+		if (rc->values_num == 0)
+			continue;
+		status = rrd_journal_format (&snapshot, rc->filename, rc->ds_num,
+				rc->ds_types, rc->chunks_head, 0, rc->values_num);
+	}
+	c_avl_iterator_destroy (iter);
+
+	for (i = 0; (status == 0) && (writers != NULL) && (i < writers_num); i++)
+	{
+		rrd_writer_t *w = writers + i;
+
+		if (w->inflight_filename == NULL)
+			continue;
+		status = rrd_journal_format (&snapshot, w->inflight_filename,
+				w->inflight_ds_num, w->inflight_ds_types,
+				w->inflight_chunks, 0, w->inflight_values_num);
+	}
+
+	/* The snapshot includes the values of the records not appended yet.
+	 * They are kept in `journal_spare' in case the checkpoint fails. */
+	tmp = journal_spare;
+	journal_spare = journal_buffer;
+	journal_buffer = tmp;
+
+	pthread_mutex_unlock (&cache_lock);
+
+	if (status != 0)
+	{
+		ERROR ("rrdtool plugin: Creating the journal checkpoint failed.");
+		sfree (snapshot.data);
+		rrd_journal_write_spare ();
+		return (-1);
+	}
+
+	ssnprintf (tmpfile, sizeof (tmpfile), "%s.tmp", journal_file);
+
+	fd = open (tmpfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("rrdtool plugin: open (%s) failed: %s", tmpfile,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (snapshot.data);
+		rrd_journal_write_spare ();
+		return (-1);
+	}
+
+	/* The new journal has to be complete on disk before it replaces the
+	 * old one. */
+	if ((swrite (fd, snapshot.data, snapshot.len) != 0) || (fsync (fd) != 0)
+			|| (rename (tmpfile, journal_file) != 0))
+	{
+		char errbuf[1024];
+		ERROR ("rrdtool plugin: Writing the journal checkpoint %s "
+				"failed: %s", tmpfile,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		unlink (tmpfile);
+		sfree (snapshot.data);
+		rrd_journal_write_spare ();
+		return (-1);
+	}
+
+	if (journal_fd >= 0)
+		close (journal_fd);
+	journal_fd = fd;
+	journal_size = (uint64_t) snapshot.len;
+	journal_checkpoint_size = (uint64_t) snapshot.len;
+	journal_spare.len = 0;
+	sfree (snapshot.data);
+
+	DEBUG ("rrdtool plugin: Wrote a journal checkpoint of %"PRIu64" bytes.",
+			journal_size);
+	return (0);
+} /* }}} int rrd_journal_checkpoint */
+
+/* Adds a record of the last value added to `rc' to `journal_buffer' and
+ * wakes up the first writer if the buffer was empty. The cache lock must be
+ * held. */
+static void rrd_journal_append (const rrd_cache_t *rc) /* {{{ */
+{
+	size_t len = journal_buffer.len;
+
+	if (journal_file == NULL)
+		return;
+
+	if (rrd_journal_format (&journal_buffer, rc->filename, rc->ds_num,
+				rc->ds_types, rc->chunks_tail,
+				rc->chunks_tail->records_num - 1, /* values_num = */ 1) != 0)
+		return;
+
+	if ((len == 0) && (writers != NULL))
+	{
+		pthread_mutex_lock (&writers[0].queue_lock);
+		writers[0].journal_pending = 1;
+		pthread_cond_signal (&writers[0].queue_cond);
+		pthread_mutex_unlock (&writers[0].queue_lock);
+	}
+} /* }}} void rrd_journal_append */
+
+/* Appends the records in `journal_buffer' to the journal, replacing it with a
+ * checkpoint if it has grown too much. Called by the first writer. */
+static void rrd_journal_flush (void) /* {{{ */
+{
+	rrd_journal_buffer_t tmp;
+
+	pthread_mutex_lock (&journal_lock);
+
+	pthread_mutex_lock (&cache_lock);
+	tmp = journal_spare;
+	journal_spare = journal_buffer;
+	journal_buffer = tmp;
+	pthread_mutex_unlock (&cache_lock);
+
+	rrd_journal_write_spare ();
+
+	if (journal_size > ((2 * journal_checkpoint_size) + RRD_JOURNAL_MIN_SIZE))
+		rrd_journal_checkpoint ();
+
+	pthread_mutex_unlock (&journal_lock);
+} /* }}} void rrd_journal_flush */
+
+/* Frees the values a writer has taken from the cache, once they have been
+ * written, and removes them from the journal's view. */
+static void rrd_writer_release (rrd_writer_t *w, /* {{{ */
+		rrd_chunk_t *chunks, int ds_num, int *ds_types)
+{
+	if (journal_file != NULL)
+	{
+		pthread_mutex_lock (&cache_lock);
+		w->inflight_filename = NULL;
+		w->inflight_chunks = NULL;
+		w->inflight_values_num = 0;
+		w->inflight_ds_num = 0;
+		w->inflight_ds_types = NULL;
+		pthread_mutex_unlock (&cache_lock);
+	}
+
+	rrd_chunks_free (chunks, ds_num);
+	sfree (ds_types);
+} /* }}} void rrd_writer_release */
+
+/* Adjusts the delay between two updates of one writer, in seconds. If
+ * updates take longer than `target_latency', the disks are busy and the
+ * writer backs off, so that more values are collected per update. Otherwise
+ * it speeds up as long as files are waiting in its queue. */
+static double rrd_adapt_delay (double delay, cdtime_t latency,
+		int queue_length)
+{
+	/* The limits apply to all writers together, like "WritesPerSecond". */
+	double delay_min = ((double) writers_num) / max_write_rate;
+	double delay_max = ((double) writers_num) / min_write_rate;
+
+	if (latency > target_latency)
+		delay *= 1.5;
+	else if (queue_length > 0)
+		delay /= 1.25;
+
+	if (delay < delay_min)
+		delay = delay_min;
+	else if (delay > delay_max)
+		delay = delay_max;
+
+	return (delay);
+} /* double rrd_adapt_delay */
+
+static void *rrd_queue_thread (void *data)
+{
+        rrd_writer_t *w = data;
+        double thread_rate;
         struct timeval tv_next_update;
         struct timeval tv_now;
+        cdtime_t adapt_next = 0;
+
+        /* "WritesPerSecond" is a global limit, so each writer gets its share
+         * of it. */
+        thread_rate = write_rate * ((double) writers_num);
+        if (adaptive_rate)
+          thread_rate = rrd_adapt_delay ((thread_rate > 0.0)
+              ? thread_rate : ((double) writers_num) / max_write_rate,
+              /* latency = */ 0, /* queue_length = */ 0);
+
+        pthread_mutex_lock (&w->queue_lock);
+        w->delay = thread_rate;
+        pthread_mutex_unlock (&w->queue_lock);
 
         gettimeofday (&tv_next_update, /* timezone = */ NULL);
 
@@ -295,29 +881,50 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	{
 		rrd_queue_t *queue_entry;
 		rrd_cache_t *cache_entry;
+		rrd_chunk_t *chunks;
+		int   *ds_types;
+		int    ds_num;
 		char **values;
 		int    values_num;
+		int    queue_length;
+		cdtime_t probe_start;
+		cdtime_t update_start;
+		cdtime_t latency;
 		int    status;
 		int    i;
 
+		chunks = NULL;
+		ds_types = NULL;
+		ds_num = 0;
 		values = NULL;
 		values_num = 0;
 
-                pthread_mutex_lock (&queue_lock);
+                pthread_mutex_lock (&w->queue_lock);
                 /* Wait for values to arrive */
                 while (42)
                 {
                   struct timespec ts_wait;
 
-                  while ((flushq_head == NULL) && (queue_head == NULL)
-                      && (do_shutdown == 0))
-                    pthread_cond_wait (&queue_cond, &queue_lock);
+                  while ((w->flushq_head == NULL) && (w->queue_head == NULL)
+                      && (do_shutdown == 0) && !w->journal_pending)
+                    pthread_cond_wait (&w->queue_cond, &w->queue_lock);
 
-                  if ((flushq_head == NULL) && (queue_head == NULL))
+                  /* Append the records of the values added to the cache
+                   * meanwhile to the journal. */
+                  if (w->journal_pending)
+                  {
+                    w->journal_pending = 0;
+                    pthread_mutex_unlock (&w->queue_lock);
+                    rrd_journal_flush ();
+                    pthread_mutex_lock (&w->queue_lock);
+                    continue;
+                  }
+
+                  if ((w->flushq_head == NULL) && (w->queue_head == NULL))
                     break;
 
                   /* Don't delay if there's something to flush */
-                  if (flushq_head != NULL)
+                  if (w->flushq_head != NULL)
                     break;
 
                   /* Don't delay if we're shutting down */
@@ -325,7 +932,7 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                     break;
 
                   /* Don't delay if no delay was configured. */
-                  if (write_rate <= 0.0)
+                  if (thread_rate <= 0.0)
                     break;
 
                   gettimeofday (&tv_now, /* timezone = */ NULL);
@@ -340,8 +947,8 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                   ts_wait.tv_sec = tv_next_update.tv_sec;
                   ts_wait.tv_nsec = 1000 * tv_next_update.tv_usec;
 
-                  status = pthread_cond_timedwait (&queue_cond, &queue_lock,
-                      &ts_wait);
+                  status = pthread_cond_timedwait (&w->queue_cond,
+                      &w->queue_lock, &ts_wait);
                   if (status == ETIMEDOUT)
                     break;
                 } /* while (42) */
@@ -350,33 +957,45 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                  * the same time, ALWAYS lock `cache_lock' first! */
 
                 /* We're in the shutdown phase */
-                if ((flushq_head == NULL) && (queue_head == NULL))
+                if ((w->flushq_head == NULL) && (w->queue_head == NULL))
                 {
-                  pthread_mutex_unlock (&queue_lock);
+                  pthread_mutex_unlock (&w->queue_lock);
                   break;
                 }
 
-                if (flushq_head != NULL)
+                if (w->flushq_head != NULL)
                 {
                   /* Dequeue the first flush entry */
-                  queue_entry = flushq_head;
-                  if (flushq_head == flushq_tail)
-                    flushq_head = flushq_tail = NULL;
+                  queue_entry = w->flushq_head;
+                  if (w->flushq_head == w->flushq_tail)
+                    w->flushq_head = w->flushq_tail = NULL;
                   else
-                    flushq_head = flushq_head->next;
+                  {
+                    w->flushq_head = w->flushq_head->next;
+                    w->flushq_head->prev = NULL;
+                  }
                 }
-                else /* if (queue_head != NULL) */
+                else /* if (w->queue_head != NULL) */
                 {
                   /* Dequeue the first regular entry */
-                  queue_entry = queue_head;
-                  if (queue_head == queue_tail)
-                    queue_head = queue_tail = NULL;
+                  queue_entry = w->queue_head;
+                  if (w->queue_head == w->queue_tail)
+                    w->queue_head = w->queue_tail = NULL;
                   else
-                    queue_head = queue_head->next;
+                  {
+                    w->queue_head = w->queue_head->next;
+                    w->queue_head->prev = NULL;
+                  }
+                  c_hashtable_remove (w->queue_index, queue_entry->filename,
+                      /* key = */ NULL, /* value = */ NULL);
                 }
+                w->queue_length--;
+		queue_length = w->queue_length;
 
 		/* Unlock the queue again */
-		pthread_mutex_unlock (&queue_lock);
+		pthread_mutex_unlock (&w->queue_lock);
+
+		CD_PROBE2 (rrdtool__dequeue, queue_entry->filename, queue_length);
 
 		/* We now need the cache lock so the entry isn't updated while
 		 * we make a copy of it's values */
@@ -387,12 +1006,42 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 
 		if (status == 0)
 		{
-			values = cache_entry->values;
+			/* The cache entry may be removed once we release the lock,
+			 * so we need our own copy of the data source types. */
+			ds_num = cache_entry->ds_num;
+			ds_types = malloc (ds_num * sizeof (*ds_types));
+			if (ds_types == NULL)
+			{
+				ERROR ("rrdtool plugin: malloc failed.");
+				/* Leave the values in the cache and try again later. */
+				cache_entry->flags = FLAG_NONE;
+				rrd_cache_age_append (cache_entry);
+				status = -1;
+			}
+		}
+
+		if (status == 0)
+		{
+			memcpy (ds_types, cache_entry->ds_types,
+					ds_num * sizeof (*ds_types));
+
+			chunks = cache_entry->chunks_head;
 			values_num = cache_entry->values_num;
 
-			cache_entry->values = NULL;
+			cache_entry->chunks_head = NULL;
+			cache_entry->chunks_tail = NULL;
 			cache_entry->values_num = 0;
 			cache_entry->flags = FLAG_NONE;
+			rrd_cache_age_append (cache_entry);
+
+			if (journal_file != NULL)
+			{
+				w->inflight_filename = queue_entry->filename;
+				w->inflight_chunks = chunks;
+				w->inflight_values_num = values_num;
+				w->inflight_ds_num = ds_num;
+				w->inflight_ds_types = ds_types;
+			}
 		}
 
 		pthread_mutex_unlock (&cache_lock);
@@ -404,13 +1053,26 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 			continue;
 		}
 
+		/* Convert the values to strings outside of the cache lock. The
+		 * chunks are kept until the values have been written, for the
+		 * journal. */
+		values_num = chunks_to_strings (&values, chunks,
+				values_num, ds_num, ds_types);
+		if (values_num < 0)
+		{
+			rrd_writer_release (w, chunks, ds_num, ds_types);
+			sfree (queue_entry->filename);
+			sfree (queue_entry);
+			continue;
+		}
+
 		/* Update `tv_next_update' */
-		if (write_rate > 0.0) 
+		if (thread_rate > 0.0)
                 {
                   gettimeofday (&tv_now, /* timezone = */ NULL);
                   tv_next_update.tv_sec = tv_now.tv_sec;
                   tv_next_update.tv_usec = tv_now.tv_usec
-                    + ((suseconds_t) (1000000 * write_rate));
+                    + ((suseconds_t) (1000000 * thread_rate));
                   while (tv_next_update.tv_usec > 1000000)
                   {
                     tv_next_update.tv_sec++;
@@ -419,8 +1081,36 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
                 }
 
 		/* Write the values to the RRD-file */
-		srrd_update (queue_entry->filename, NULL,
+		probe_start = CD_PROBE_START ();
+		update_start = cdtime ();
+		status = srrd_update (queue_entry->filename, NULL,
 				values_num, (const char **)values);
+		latency = cdtime () - update_start;
+		CD_PROBE4 (rrdtool__update, queue_entry->filename, values_num,
+				CD_PROBE_NS (probe_start), status);
+		rrd_writer_release (w, chunks, ds_num, ds_types);
+
+		pthread_mutex_lock (&w->queue_lock);
+		w->writes++;
+		if (w->writes == 1)
+			w->latency = latency;
+		else
+			w->latency = w->latency - (w->latency / RRD_LATENCY_WEIGHT)
+				+ (latency / RRD_LATENCY_WEIGHT);
+
+		/* Adjusting the rate once per second gives the average time
+		 * to follow a change. */
+		if (adaptive_rate && (update_start >= adapt_next))
+		{
+			thread_rate = rrd_adapt_delay (thread_rate, w->latency,
+					queue_length);
+			w->delay = thread_rate;
+			adapt_next = update_start + TIME_T_TO_CDTIME_T (1);
+		}
+		pthread_mutex_unlock (&w->queue_lock);
+		/* Maybe the file has been removed. */
+		if (status != 0)
+			kp_invalidate (known_paths, queue_entry->filename);
 		DEBUG ("rrdtool plugin: queue thread: Wrote %i value%s to %s",
 				values_num, (values_num == 1) ? "" : "s",
 				queue_entry->filename);
@@ -438,9 +1128,22 @@ static void *rrd_queue_thread (void __attribute__((unused)) *data)
 	return ((void *) 0);
 } /* void *rrd_queue_thread */
 
-static int rrd_queue_enqueue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
+static rrd_writer_t *rrd_writer_get (const char *filename) /* {{{ */
 {
+  const unsigned char *ptr;
+  uint32_t hash = 0;
+
+  for (ptr = (const unsigned char *) filename; *ptr != 0; ptr++)
+    hash = (hash * 31) + ((uint32_t) *ptr);
+
+  return (writers + (hash % ((uint32_t) writers_num)));
+} /* }}} rrd_writer_t *rrd_writer_get */
+
+static int rrd_queue_enqueue (const char *filename, _Bool flushq)
+{
+  rrd_writer_t *w;
+  rrd_queue_t **head;
+  rrd_queue_t **tail;
   rrd_queue_t *queue_entry;
 
   queue_entry = (rrd_queue_t *) malloc (sizeof (rrd_queue_t));
@@ -456,55 +1159,64 @@ static int rrd_queue_enqueue (const char *filename,
 
   queue_entry->next = NULL;
 
-  pthread_mutex_lock (&queue_lock);
+  w = rrd_writer_get (filename);
+  head = flushq ? &w->flushq_head : &w->queue_head;
+  tail = flushq ? &w->flushq_tail : &w->queue_tail;
 
+  pthread_mutex_lock (&w->queue_lock);
+
+  if (!flushq && (c_hashtable_insert (w->queue_index,
+          queue_entry->filename, queue_entry) != 0))
+  {
+    pthread_mutex_unlock (&w->queue_lock);
+    sfree (queue_entry->filename);
+    sfree (queue_entry);
+    return (-1);
+  }
+
+  queue_entry->prev = *tail;
   if (*tail == NULL)
     *head = queue_entry;
   else
     (*tail)->next = queue_entry;
   *tail = queue_entry;
+  w->queue_length++;
 
-  pthread_cond_signal (&queue_cond);
-  pthread_mutex_unlock (&queue_lock);
+  pthread_cond_signal (&w->queue_cond);
+  pthread_mutex_unlock (&w->queue_lock);
 
   return (0);
 } /* int rrd_queue_enqueue */
 
-static int rrd_queue_dequeue (const char *filename,
-    rrd_queue_t **head, rrd_queue_t **tail)
+/* Removes `filename' from the regular queue. */
+static int rrd_queue_dequeue (const char *filename)
 {
-  rrd_queue_t *this;
-  rrd_queue_t *prev;
-
-  pthread_mutex_lock (&queue_lock);
+  rrd_writer_t *w;
+  rrd_queue_t *this = NULL;
 
-  prev = NULL;
-  this = *head;
+  w = rrd_writer_get (filename);
 
-  while (this != NULL)
-  {
-    if (strcmp (this->filename, filename) == 0)
-      break;
-    
-    prev = this;
-    this = this->next;
-  }
+  pthread_mutex_lock (&w->queue_lock);
 
-  if (this == NULL)
+  if (c_hashtable_remove (w->queue_index, filename,
+        /* key = */ NULL, (void *) &this) != 0)
   {
-    pthread_mutex_unlock (&queue_lock);
+    pthread_mutex_unlock (&w->queue_lock);
     return (-1);
   }
 
-  if (prev == NULL)
-    *head = this->next;
+  if (this->prev == NULL)
+    w->queue_head = this->next;
   else
-    prev->next = this->next;
+    this->prev->next = this->next;
 
   if (this->next == NULL)
-    *tail = prev;
+    w->queue_tail = this->prev;
+  else
+    this->next->prev = this->prev;
+  w->queue_length--;
 
-  pthread_mutex_unlock (&queue_lock);
+  pthread_mutex_unlock (&w->queue_lock);
 
   sfree (this->filename);
   sfree (this);
@@ -518,76 +1230,64 @@ static void rrd_cache_flush (cdtime_t timeout)
 	rrd_cache_t *rc;
 	cdtime_t     now;
 
-	char **keys = NULL;
-	int    keys_num = 0;
-
-	char *key;
-	c_avl_iterator_t *iter;
-	int i;
-
 	DEBUG ("rrdtool plugin: Flushing cache, timeout = %.3f",
 			CDTIME_T_TO_DOUBLE (timeout));
 
 	now = cdtime ();
 	timeout = TIME_T_TO_CDTIME_T (timeout);
 
-	/* Build a list of entries to be flushed */
-	iter = c_avl_get_iterator (cache);
-	while (c_avl_iterator_next (iter, (void *) &key, (void *) &rc) == 0)
+	/* The age list is sorted, so we can stop at the first entry that is
+	 * young enough. */
+	while ((rc = cache_age_head) != NULL)
 	{
-		if (rc->flags != FLAG_NONE)
-			continue;
 		/* timeout == 0  =>  flush everything */
-		else if ((timeout != 0)
-				&& ((now - rc->first_value) < timeout))
-			continue;
-		else if (rc->values_num > 0)
+		if ((timeout != 0)
+				&& ((now - rc->age) < timeout))
+			break;
+
+		assert (rc->flags == FLAG_NONE);
+
+		if (rc->values_num > 0)
 		{
 			int status;
 
-			status = rrd_queue_enqueue (key, &queue_head,  &queue_tail);
-			if (status == 0)
-				rc->flags = FLAG_QUEUED;
-		}
-		else /* ancient and no values -> waste of memory */
-		{
-			char **tmp = (char **) realloc ((void *) keys,
-					(keys_num + 1) * sizeof (char *));
-			if (tmp == NULL)
+			status = rrd_queue_enqueue (rc->filename, /* flushq = */ 0);
+			if (status != 0)
 			{
-				char errbuf[1024];
-				ERROR ("rrdtool plugin: "
-						"realloc failed: %s",
-						sstrerror (errno, errbuf,
-							sizeof (errbuf)));
-				c_avl_iterator_destroy (iter);
-				sfree (keys);
-				return;
+				/* Try again during the next flush. */
+				rrd_cache_age_append (rc);
+				break;
 			}
-			keys = tmp;
-			keys[keys_num] = key;
-			keys_num++;
+
+			rrd_cache_age_unlink (rc);
+			rc->flags = FLAG_QUEUED;
 		}
-	} /* while (c_avl_iterator_next) */
-	c_avl_iterator_destroy (iter);
-	
-	for (i = 0; i < keys_num; i++)
-	{
-		if (c_avl_remove (cache, keys[i], (void *) &key, (void *) &rc) != 0)
+		else /* ancient and no values -> waste of memory */
 		{
-			DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.", keys[i]);
-			continue;
-		}
+			char *key = NULL;
+			rrd_cache_t *value = NULL;
+
+			rrd_cache_age_unlink (rc);
 
-		assert (rc->values == NULL);
-		assert (rc->values_num == 0);
+			if (c_avl_remove (cache, rc->filename,
+						(void *) &key, (void *) &value) != 0)
+			{
+				DEBUG ("rrdtool plugin: c_avl_remove (%s) failed.",
+						rc->filename);
+				continue;
+			}
 
-		sfree (rc);
-		sfree (key);
-		keys[i] = NULL;
-	} /* for (i = 0..keys_num) */
+			assert (value == rc);
+			assert (rc->chunks_head == NULL);
+			assert (rc->values_num == 0);
 
-	sfree (keys);
+			mem_account_add (cache_mem,
+					-((int64_t) RRD_CACHE_BYTES (rc->ds_num)));
+			sfree (rc->ds_types);
+			sfree (rc);
+			sfree (key);
+		}
+	} /* while (cache_age_head != NULL) */
 
 	cache_flush_last = now;
 } /* void rrd_cache_flush */
@@ -625,14 +1325,14 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
     return (status);
   }
 
-  if (rc->flags == FLAG_FLUSHQ)
+  if ((rc->flags == FLAG_FLUSHQ) || (rc->flags == FLAG_CREATE))
   {
     status = 0;
   }
   else if (rc->flags == FLAG_QUEUED)
   {
-    rrd_queue_dequeue (key, &queue_head, &queue_tail);
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    rrd_queue_dequeue (key);
+    status = rrd_queue_enqueue (key, /* flushq = */ 1);
     if (status == 0)
       rc->flags = FLAG_FLUSHQ;
   }
@@ -642,9 +1342,12 @@ static int rrd_cache_flush_identifier (cdtime_t timeout,
   }
   else if (rc->values_num > 0)
   {
-    status = rrd_queue_enqueue (key, &flushq_head, &flushq_tail);
+    status = rrd_queue_enqueue (key, /* flushq = */ 1);
     if (status == 0)
+    {
+      rrd_cache_age_unlink (rc);
       rc->flags = FLAG_FLUSHQ;
+    }
   }
 
   return (status);
@@ -685,12 +1388,17 @@ static int64_t rrd_get_random_variation (void)
   return (ret);
 } /* int64_t rrd_get_random_variation */
 
+/* If `create_file' is true when calling this function, the file doesn't
+ * exist yet. It's still true after the function returns if the caller has to
+ * create the file and call `rrd_create_callback' afterwards. */
 static int rrd_cache_insert (const char *filename,
-		const char *value, cdtime_t value_time)
+		const data_set_t *ds, const value_list_t *vl, _Bool *create_file)
 {
 	rrd_cache_t *rc = NULL;
+	rrd_chunk_t *chunk;
+	cdtime_t value_time = vl->time;
 	int new_rc = 0;
-	char **values_new;
+	int i;
 
 	pthread_mutex_lock (&cache_lock);
 
@@ -709,15 +1417,42 @@ static int rrd_cache_insert (const char *filename,
 	{
 		rc = malloc (sizeof (*rc));
 		if (rc == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
 			return (-1);
+		}
 		rc->values_num = 0;
-		rc->values = NULL;
+		rc->chunks_head = NULL;
+		rc->chunks_tail = NULL;
+		rc->ds_num = ds->ds_num;
+		rc->ds_types = malloc (ds->ds_num * sizeof (*rc->ds_types));
+		if (rc->ds_types == NULL)
+		{
+			pthread_mutex_unlock (&cache_lock);
+			ERROR ("rrdtool plugin: malloc failed.");
+			sfree (rc);
+			return (-1);
+		}
+		for (i = 0; i < ds->ds_num; i++)
+			rc->ds_types[i] = ds->ds[i].type;
 		rc->first_value = 0;
 		rc->last_value = 0;
 		rc->random_variation = rrd_get_random_variation ();
+		rc->filename = NULL;
+		rc->age = 0;
+		rc->age_prev = NULL;
+		rc->age_next = NULL;
 		rc->flags = FLAG_NONE;
 		new_rc = 1;
 	}
+	else if (rc->ds_num != ds->ds_num)
+	{
+		pthread_mutex_unlock (&cache_lock);
+		ERROR ("rrdtool plugin: The number of data sources of `%s' "
+				"has changed from %i to %i.",
+				filename, rc->ds_num, ds->ds_num);
+		return (-1);
+	}
 
 	if (rc->last_value >= value_time)
 	{
@@ -725,33 +1460,52 @@ static int rrd_cache_insert (const char *filename,
 		DEBUG ("rrdtool plugin: (rc->last_value = %"PRIu64") "
 				">= (value_time = %"PRIu64")",
 				rc->last_value, value_time);
+		if (new_rc == 1)
+		{
+			sfree (rc->ds_types);
+			sfree (rc);
+		}
 		return (-1);
 	}
 
-	values_new = (char **) realloc ((void *) rc->values,
-			(rc->values_num + 1) * sizeof (char *));
-	if (values_new == NULL)
+	/* Append the values to the last chunk, allocating a new one if it's
+	 * full. */
+	chunk = rc->chunks_tail;
+	if ((chunk == NULL) || (chunk->records_num >= RRD_CHUNK_SIZE))
 	{
-		char errbuf[1024];
-		void *cache_key = NULL;
+		chunk = malloc (RRD_CHUNK_BYTES (rc->ds_num));
+		if (chunk == NULL)
+		{
+			char errbuf[1024];
 
-		sstrerror (errno, errbuf, sizeof (errbuf));
+			sstrerror (errno, errbuf, sizeof (errbuf));
+			pthread_mutex_unlock (&cache_lock);
 
-		c_avl_remove (cache, filename, &cache_key, NULL);
-		pthread_mutex_unlock (&cache_lock);
+			ERROR ("rrdtool plugin: malloc failed: %s", errbuf);
 
-		ERROR ("rrdtool plugin: realloc failed: %s", errbuf);
+			if (new_rc == 1)
+			{
+				sfree (rc->ds_types);
+				sfree (rc);
+			}
+			return (-1);
+		}
+		chunk->records_num = 0;
+		chunk->next = NULL;
+		mem_account_add (cache_mem, (int64_t) RRD_CHUNK_BYTES (rc->ds_num));
 
-		sfree (cache_key);
-		sfree (rc->values);
-		sfree (rc);
-		return (-1);
+		if (rc->chunks_tail == NULL)
+			rc->chunks_head = chunk;
+		else
+			rc->chunks_tail->next = chunk;
+		rc->chunks_tail = chunk;
 	}
-	rc->values = values_new;
 
-	rc->values[rc->values_num] = strdup (value);
-	if (rc->values[rc->values_num] != NULL)
-		rc->values_num++;
+	chunk->times[chunk->records_num] = value_time;
+	memcpy (chunk->values + (chunk->records_num * rc->ds_num), vl->values,
+			rc->ds_num * sizeof (value_t));
+	chunk->records_num++;
+	rc->values_num++;
 
 	if (rc->values_num == 1)
 		rc->first_value = value_time;
@@ -771,15 +1525,39 @@ static int rrd_cache_insert (const char *filename,
 
 			ERROR ("rrdtool plugin: strdup failed: %s", errbuf);
 
-			sfree (rc->values[0]);
-			sfree (rc->values);
+			rrd_chunks_free (rc->chunks_head, rc->ds_num);
+			sfree (rc->ds_types);
 			sfree (rc);
 			return (-1);
 		}
 
 		c_avl_insert (cache, cache_key, rc);
+		rc->filename = cache_key;
+		mem_account_add (cache_mem, (int64_t) RRD_CACHE_BYTES (rc->ds_num));
+	}
+
+	rrd_journal_append (rc);
+
+	/* Values for a file which is being created are kept in the cache until
+	 * the file exists. */
+	if (*create_file)
+	{
+		if (rc->flags == FLAG_NONE)
+		{
+			rrd_cache_age_unlink (rc);
+			rc->flags = FLAG_CREATE;
+		}
+		else
+		{
+			*create_file = 0;
+		}
 	}
 
+	/* Entries are moved to the end of the age list when they receive their
+	 * first value. */
+	if ((rc->values_num == 1) && (rc->flags == FLAG_NONE))
+		rrd_cache_age_append (rc);
+
 	DEBUG ("rrdtool plugin: rrd_cache_insert: file = %s; "
 			"values_num = %i; age = %.3f;",
 			filename, rc->values_num,
@@ -793,9 +1571,12 @@ static int rrd_cache_insert (const char *filename,
 		{
 			int status;
 
-			status = rrd_queue_enqueue (filename, &queue_head, &queue_tail);
+			status = rrd_queue_enqueue (filename, /* flushq = */ 0);
 			if (status == 0)
+			{
+				rrd_cache_age_unlink (rc);
 				rc->flags = FLAG_QUEUED;
+			}
 
                         rc->random_variation = rrd_get_random_variation ();
 		}
@@ -814,6 +1595,54 @@ static int rrd_cache_insert (const char *filename,
 	return (0);
 } /* int rrd_cache_insert */
 
+static void rrd_create_callback (const char *filename, int status) /* {{{ */
+{
+	rrd_cache_t *rc = NULL;
+
+	if (status == 0)
+		kp_set_exists (known_paths, filename);
+	else
+		kp_invalidate (known_paths, filename);
+
+	pthread_mutex_lock (&cache_lock);
+
+	if ((cache == NULL)
+			|| (c_avl_get (cache, filename, (void *) &rc) != 0)
+			|| (rc->flags != FLAG_CREATE))
+	{
+		pthread_mutex_unlock (&cache_lock);
+		return;
+	}
+
+	rc->flags = FLAG_NONE;
+
+	if (status != 0)
+	{
+		/* Drop the values, so the next value will try to create the file
+		 * again. */
+		rrd_chunks_free (rc->chunks_head, rc->ds_num);
+		rc->chunks_head = NULL;
+		rc->chunks_tail = NULL;
+		rc->values_num = 0;
+		rrd_cache_age_append (rc);
+	}
+	else if ((rc->values_num > 0)
+			&& ((rc->last_value - rc->first_value)
+				>= (cache_timeout + rc->random_variation)))
+	{
+		if (rrd_queue_enqueue (filename, /* flushq = */ 0) == 0)
+			rc->flags = FLAG_QUEUED;
+		else
+			rrd_cache_age_append (rc);
+	}
+	else
+	{
+		rrd_cache_age_append (rc);
+	}
+
+	pthread_mutex_unlock (&cache_lock);
+} /* }}} void rrd_create_callback */
+
 static int rrd_cache_destroy (void) /* {{{ */
 {
   void *key = NULL;
@@ -832,7 +1661,6 @@ static int rrd_cache_destroy (void) /* {{{ */
   while (c_avl_pick (cache, &key, &value) == 0)
   {
     rrd_cache_t *rc;
-    int i;
 
     sfree (key);
     key = NULL;
@@ -843,14 +1671,16 @@ static int rrd_cache_destroy (void) /* {{{ */
     if (rc->values_num > 0)
       non_empty++;
 
-    for (i = 0; i < rc->values_num; i++)
-      sfree (rc->values[i]);
-    sfree (rc->values);
+    rrd_chunks_free (rc->chunks_head, rc->ds_num);
+    mem_account_add (cache_mem, -((int64_t) RRD_CACHE_BYTES (rc->ds_num)));
+    sfree (rc->ds_types);
     sfree (rc);
   }
 
   c_avl_destroy (cache);
   cache = NULL;
+  cache_age_head = NULL;
+  cache_age_tail = NULL;
 
   if (non_empty > 0)
   {
@@ -883,10 +1713,10 @@ static int rrd_compare_numeric (const void *a_ptr, const void *b_ptr)
 static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 		user_data_t __attribute__((unused)) *user_data)
 {
-	struct stat  statbuf;
 	char         filename[512];
-	char         values[512];
+	_Bool        create_file = 0;
 	int          status;
+	int          i;
 
 	if (do_shutdown)
 		return (0);
@@ -899,35 +1729,55 @@ static int rrd_write (const data_set_t *ds, const value_list_t *vl,
 	if (value_list_to_filename (filename, sizeof (filename), ds, vl) != 0)
 		return (-1);
 
-	if (value_list_to_string (values, sizeof (values), ds, vl) != 0)
+	if (vl->values_len != ds->ds_num)
 		return (-1);
 
-	if (stat (filename, &statbuf) == -1)
+	for (i = 0; i < ds->ds_num; i++)
 	{
-		if (errno == ENOENT)
+		if ((ds->ds[i].type != DS_TYPE_COUNTER)
+				&& (ds->ds[i].type != DS_TYPE_GAUGE)
+				&& (ds->ds[i].type != DS_TYPE_DERIVE)
+				&& (ds->ds[i].type != DS_TYPE_ABSOLUTE))
+			return (-1);
+	}
+
+	status = kp_check (known_paths, filename);
+	if (status == ENOENT)
+	{
+		if (rrdcreate_config.async)
+		{
+			create_file = 1;
+		}
+		else
 		{
 			status = cu_rrd_create_file (filename,
 					ds, vl, &rrdcreate_config);
 			if (status != 0)
+			{
+				kp_invalidate (known_paths, filename);
 				return (-1);
-		}
-		else
-		{
-			char errbuf[1024];
-			ERROR ("stat(%s) failed: %s", filename,
-					sstrerror (errno, errbuf,
-						sizeof (errbuf)));
-			return (-1);
+			}
+			kp_set_exists (known_paths, filename);
 		}
 	}
-	else if (!S_ISREG (statbuf.st_mode))
+	else if (status != 0)
 	{
-		ERROR ("stat(%s): Not a regular file!",
-				filename);
 		return (-1);
 	}
 
-	status = rrd_cache_insert (filename, values, vl->time);
+	status = rrd_cache_insert (filename, ds, vl, &create_file);
+	if ((status == 0) && create_file)
+	{
+		status = cu_rrd_create_file_async (filename, ds, vl,
+				&rrdcreate_config, rrd_create_callback);
+		if (status != 0)
+		{
+			/* Reset the cache entry, so we try again with the next
+			 * value. */
+			rrd_create_callback (filename, status);
+			return (-1);
+		}
+	}
 
 	return (status);
 } /* int rrd_write */
@@ -948,7 +1798,7 @@ static int rrd_flush (cdtime_t timeout, const char *identifier,
 	return (0);
 } /* int rrd_flush */
 
-static int rrd_config (const char *key, const char *value)
+static int rrd_config_value (const char *key, const char *value)
 {
 	if (strcasecmp ("CacheTimeout", key) == 0)
 	{
@@ -1092,6 +1942,43 @@ static int rrd_config (const char *key, const char *value)
 			write_rate = 1.0 / wps;
 		}
 	}
+	else if (strcasecmp ("AdaptiveWriteRate", key) == 0)
+	{
+		if (IS_TRUE (value))
+			adaptive_rate = 1;
+		else
+			adaptive_rate = 0;
+	}
+	else if (strcasecmp ("TargetWriteLatency", key) == 0)
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			fprintf (stderr, "rrdtool: `TargetWriteLatency' must "
+					"be greater than zero.\n");
+			ERROR ("rrdtool: `TargetWriteLatency' must "
+					"be greater than zero.");
+			return (1);
+		}
+		target_latency = DOUBLE_TO_CDTIME_T (tmp);
+	}
+	else if ((strcasecmp ("MinWritesPerSecond", key) == 0)
+			|| (strcasecmp ("MaxWritesPerSecond", key) == 0))
+	{
+		double tmp = atof (value);
+		if (tmp <= 0.0)
+		{
+			fprintf (stderr, "rrdtool: `%s' must "
+					"be greater than zero.\n", key);
+			ERROR ("rrdtool: `%s' must "
+					"be greater than zero.", key);
+			return (1);
+		}
+		if (strcasecmp ("MinWritesPerSecond", key) == 0)
+			min_write_rate = tmp;
+		else
+			max_write_rate = tmp;
+	}
 	else if (strcasecmp ("RandomTimeout", key) == 0)
         {
 		double tmp;
@@ -1109,46 +1996,373 @@ static int rrd_config (const char *key, const char *value)
 			random_timeout = DOUBLE_TO_CDTIME_T (tmp);
 		}
 	}
+	else if (strcasecmp ("WriteThreads", key) == 0)
+	{
+		int tmp = atoi (value);
+		if (tmp < 1)
+		{
+			fprintf (stderr, "rrdtool: `WriteThreads' must "
+					"be at least 1.\n");
+			ERROR ("rrdtool: `WriteThreads' must "
+					"be at least 1.");
+			return (1);
+		}
+		writers_num = tmp;
+	}
+	else if (strcasecmp ("WriteThreadsCPUs", key) == 0)
+	{
+		if (thread_check_cpus (value) != 0)
+		{
+			ERROR ("rrdtool: `WriteThreadsCPUs' is invalid.");
+			return (1);
+		}
+		sfree (writers_cpus);
+		writers_cpus = strdup (value);
+	}
+	else if (strcasecmp ("CollectStatistics", key) == 0)
+	{
+		if (IS_TRUE (value))
+			collect_stats = 1;
+		else
+			collect_stats = 0;
+	}
+	else if (strcasecmp ("CreateFilesAsync", key) == 0)
+	{
+		if (IS_TRUE (value))
+			rrdcreate_config.async = 1;
+		else
+			rrdcreate_config.async = 0;
+	}
+	else if (strcasecmp ("JournalFile", key) == 0)
+	{
+		sfree (journal_file);
+		journal_file = strdup (value);
+	}
+	else if (strcasecmp ("TemplateDir", key) == 0)
+	{
+		sfree (rrdcreate_config.template_dir);
+		rrdcreate_config.template_dir = strdup (value);
+	}
 	else
 	{
 		return (-1);
 	}
 	return (0);
-} /* int rrd_config */
+} /* int rrd_config_value */
+
+static int rrd_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+		char value[4096];
+
+		if (strcasecmp ("StatCacheTimeout", child->key) == 0)
+			cf_util_get_cdtime (child, &stat_cache_timeout);
+		else if (cf_util_get_values_string (child, value,
+					sizeof (value)) != 0)
+			continue;
+		else if (rrd_config_value (child->key, value) < 0)
+			WARNING ("rrdtool plugin: Unknown config option: %s",
+					child->key);
+	}
+
+	return (0);
+} /* }}} int rrd_config */
+
+/* Adds the values in the journal to the cache, except for the ones which have
+ * already been written according to rrd_last(). Must be called before the
+ * journal has been opened and the queue threads have been started. */
+static int rrd_journal_replay (void) /* {{{ */
+{
+	rrd_journal_header_t header;
+	rrd_journal_record_t record;
+	c_avl_tree_t *last_updates;
+	value_t *values = NULL;
+	data_source_t *sources = NULL;
+	char filename[UINT16_MAX + 1];
+	int replayed = 0;
+	int skipped = 0;
+	FILE *fh;
+
+	fh = fopen (journal_file, "r");
+	if (fh == NULL)
+	{
+		char errbuf[1024];
+		if (errno == ENOENT)
+			return (0);
+		ERROR ("rrdtool plugin: fopen (%s) failed: %s", journal_file,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if ((fread (&header, sizeof (header), 1, fh) != 1)
+			|| (memcmp (header.magic, RRD_JOURNAL_MAGIC,
+					sizeof (RRD_JOURNAL_MAGIC)) != 0)
+			|| (header.version != RRD_JOURNAL_VERSION)
+			|| (header.value_size != sizeof (value_t)))
+	{
+		WARNING ("rrdtool plugin: %s is not a journal of this version "
+				"of collectd. Ignoring it.", journal_file);
+		fclose (fh);
+		return (0);
+	}
+
+	/* The time of the last update of each file, or -1 if the file doesn't
+	 * exist, so rrd_last() is called only once per file. */
+	last_updates = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+	if (last_updates == NULL)
+	{
+		fclose (fh);
+		return (-1);
+	}
+
+	/* A truncated record at the end, from a crash while it was being
+	 * appended, ends the replay just like the end of the file. */
+	while (fread (&record, sizeof (record), 1, fh) == 1)
+	{
+		data_set_t ds;
+		value_list_t vl = VALUE_LIST_INIT;
+		_Bool create_file = 0;
+		time_t *last = NULL;
+		uint8_t ds_types[UINT16_MAX];
+		uint32_t i;
+		int j;
+
+		if (record.magic != RRD_JOURNAL_RECORD_MAGIC)
+		{
+			WARNING ("rrdtool plugin: The journal %s is corrupt. "
+					"Ignoring the rest of it.", journal_file);
+			break;
+		}
+
+		if ((fread (ds_types, 1, record.ds_num, fh) != record.ds_num)
+				|| (fread (filename, 1, record.filename_len, fh)
+					!= record.filename_len))
+			break;
+		filename[record.filename_len] = 0;
+
+		sfree (values);
+		sfree (sources);
+		values = calloc (record.ds_num + 1, sizeof (*values));
+		sources = calloc (record.ds_num + 1, sizeof (*sources));
+		if ((values == NULL) || (sources == NULL))
+		{
+			ERROR ("rrdtool plugin: calloc failed.");
+			break;
+		}
+
+		memset (&ds, 0, sizeof (ds));
+		ds.ds_num = record.ds_num;
+		ds.ds = sources;
+		for (j = 0; j < ds.ds_num; j++)
+			sources[j].type = ds_types[j];
+		vl.values = values;
+		vl.values_len = ds.ds_num;
+
+		if (c_avl_get (last_updates, filename, (void *) &last) != 0)
+		{
+			char *key = strdup (filename);
+
+			last = malloc (sizeof (*last));
+			if ((key == NULL) || (last == NULL))
+			{
+				ERROR ("rrdtool plugin: malloc failed.");
+				sfree (key);
+				sfree (last);
+				break;
+			}
+			*last = srrd_last (filename);
+			c_avl_insert (last_updates, key, last);
+		}
+
+		for (i = 0; i < record.values_num; i++)
+		{
+			if ((fread (&vl.time, sizeof (vl.time), 1, fh) != 1)
+					|| (fread (values, sizeof (*values), ds.ds_num, fh)
+						!= (size_t) ds.ds_num))
+				break;
+
+			/* The file is gone or the value has been written. */
+			if ((*last < 0) || (CDTIME_T_TO_TIME_T (vl.time) <= *last))
+			{
+				skipped++;
+				continue;
+			}
+
+			if (rrd_cache_insert (filename, &ds, &vl, &create_file) == 0)
+				replayed++;
+			else
+				skipped++;
+		}
+		if (i < record.values_num)
+			break;
+	}
+
+	fclose (fh);
+	sfree (values);
+	sfree (sources);
+
+	{
+		void *key;
+		void *value;
+
+		while (c_avl_pick (last_updates, &key, &value) == 0)
+		{
+			sfree (key);
+			sfree (value);
+		}
+		c_avl_destroy (last_updates);
+	}
+
+	INFO ("rrdtool plugin: Replayed %i value%s from the journal %s, "
+			"skipped %i.", replayed, (replayed == 1) ? "" : "s",
+			journal_file, skipped);
+	return (0);
+} /* }}} int rrd_journal_replay */
+
+static int rrd_stats_read (void) /* {{{ */
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+	int i;
+
+	if (writers == NULL)
+		return (-1);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "rrdtool", sizeof (vl.plugin));
+
+	for (i = 0; i < writers_num; i++)
+	{
+		int queue_length;
+		derive_t writes;
+		cdtime_t latency;
+		double delay;
+
+		pthread_mutex_lock (&writers[i].queue_lock);
+		queue_length = writers[i].queue_length;
+		writes = writers[i].writes;
+		latency = writers[i].latency;
+		delay = writers[i].delay;
+		pthread_mutex_unlock (&writers[i].queue_lock);
+
+		ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+				"writer-%i", i);
+
+		sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+		values[0].gauge = (gauge_t) queue_length;
+		plugin_dispatch_values (&vl);
+
+		/* Number of updates, i.e. the effective write rate. */
+		sstrncpy (vl.type, "operations", sizeof (vl.type));
+		values[0].derive = writes;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "response_time", sizeof (vl.type));
+		values[0].gauge = (writes > 0)
+			? CDTIME_T_TO_DOUBLE (latency) : NAN;
+		plugin_dispatch_values (&vl);
+
+		/* The rate the writer is limited to; not limited if NaN. */
+		ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+				"write_rate-writer-%i", i);
+		sstrncpy (vl.type, "gauge", sizeof (vl.type));
+		values[0].gauge = (delay > 0.0) ? (1.0 / delay) : NAN;
+		plugin_dispatch_values (&vl);
+	}
+
+	return (0);
+} /* }}} int rrd_stats_read */
 
 static int rrd_shutdown (void)
 {
+	int queued = 0;
+	int i;
+
+	/* Wait for pending files to be created, so their values are flushed
+	 * below. */
+	cu_rrd_create_shutdown ();
+
 	pthread_mutex_lock (&cache_lock);
 	rrd_cache_flush (0);
 	pthread_mutex_unlock (&cache_lock);
 
-	pthread_mutex_lock (&queue_lock);
+	if (writers == NULL)
+	{
+		rrd_cache_destroy ();
+		return (0);
+	}
+
 	do_shutdown = 1;
-	pthread_cond_signal (&queue_cond);
-	pthread_mutex_unlock (&queue_lock);
+	for (i = 0; i < writers_num; i++)
+	{
+		pthread_mutex_lock (&writers[i].queue_lock);
+		queued += writers[i].queue_length;
+		pthread_cond_signal (&writers[i].queue_cond);
+		pthread_mutex_unlock (&writers[i].queue_lock);
+	}
 
-	if ((queue_thread_running != 0)
-			&& ((queue_head != NULL) || (flushq_head != NULL)))
+	if (queued > 0)
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread. "
-				"This may take a while.");
+		INFO ("rrdtool plugin: Shutting down the queue %s. "
+				"This may take a while.",
+				(writers_num == 1) ? "thread" : "threads");
 	}
-	else if (queue_thread_running != 0)
+	else
 	{
-		INFO ("rrdtool plugin: Shutting down the queue thread.");
+		INFO ("rrdtool plugin: Shutting down the queue %s.",
+				(writers_num == 1) ? "thread" : "threads");
 	}
 
 	/* Wait for all the values to be written to disk before returning. */
-	if (queue_thread_running != 0)
+	for (i = 0; i < writers_num; i++)
 	{
-		pthread_join (queue_thread, NULL);
-		memset (&queue_thread, 0, sizeof (queue_thread));
-		queue_thread_running = 0;
-		DEBUG ("rrdtool plugin: queue_thread exited.");
+		if (writers[i].thread_running == 0)
+			continue;
+
+		pthread_join (writers[i].thread, NULL);
+		memset (&writers[i].thread, 0, sizeof (writers[i].thread));
+		writers[i].thread_running = 0;
+		DEBUG ("rrdtool plugin: queue thread %i exited.", i);
+	}
+
+	/* Everything has been written, so this leaves an empty journal, except
+	 * for values of files which are still being created. */
+	pthread_mutex_lock (&journal_lock);
+	if (journal_fd >= 0)
+	{
+		rrd_journal_checkpoint ();
+		close (journal_fd);
+		journal_fd = -1;
 	}
+	sfree (journal_spare.data);
+	journal_spare.size = 0;
+	pthread_mutex_unlock (&journal_lock);
+
+	pthread_mutex_lock (&cache_lock);
+	sfree (journal_buffer.data);
+	journal_buffer.len = 0;
+	journal_buffer.size = 0;
+	pthread_mutex_unlock (&cache_lock);
 
 	rrd_cache_destroy ();
 
+	kp_destroy (known_paths);
+	known_paths = NULL;
+
+	for (i = 0; i < writers_num; i++)
+	{
+		c_hashtable_destroy (writers[i].queue_index);
+		pthread_mutex_destroy (&writers[i].queue_lock);
+		pthread_cond_destroy (&writers[i].queue_cond);
+	}
+	sfree (writers);
+
 	return (0);
 } /* int rrd_shutdown */
 
@@ -1156,14 +2370,27 @@ static int rrd_init (void)
 {
 	static int init_once = 0;
 	int status;
+	int i;
 
 	if (init_once != 0)
 		return (0);
 	init_once = 1;
 
+	cache_mem = mem_account_get ("rrdtool");
+
 	if (rrdcreate_config.heartbeat <= 0)
 		rrdcreate_config.heartbeat = 2 * rrdcreate_config.stepsize;
 
+	if (target_latency == 0)
+		target_latency = RRD_DEFAULT_TARGET_LATENCY;
+	if (min_write_rate > max_write_rate)
+	{
+		WARNING ("rrdtool plugin: `MinWritesPerSecond' is greater than "
+				"`MaxWritesPerSecond'. Using %g for both.",
+				max_write_rate);
+		min_write_rate = max_write_rate;
+	}
+
 	if ((rrdcreate_config.heartbeat > 0)
 			&& (rrdcreate_config.heartbeat < CDTIME_T_TO_TIME_T (interval_g)))
 		WARNING ("rrdtool plugin: Your `heartbeat' is "
@@ -1175,6 +2402,35 @@ static int rrd_init (void)
 				"smaller than your `interval'. This will "
 				"create needlessly big RRD-files.");
 
+	if (stat_cache_timeout > 0)
+	{
+		known_paths = kp_create (stat_cache_timeout);
+		if (known_paths == NULL)
+		{
+			ERROR ("rrdtool plugin: kp_create failed.");
+			return (-1);
+		}
+	}
+
+	writers = calloc (writers_num, sizeof (*writers));
+	if (writers == NULL)
+	{
+		ERROR ("rrdtool plugin: calloc failed.");
+		return (-1);
+	}
+	for (i = 0; i < writers_num; i++)
+	{
+		writers[i].queue_index = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (writers[i].queue_index == NULL)
+		{
+			ERROR ("rrdtool plugin: c_hashtable_create failed.");
+			return (-1);
+		}
+		pthread_mutex_init (&writers[i].queue_lock, /* attr = */ NULL);
+		pthread_cond_init (&writers[i].queue_cond, /* attr = */ NULL);
+	}
+
 	/* Set the cache up */
 	pthread_mutex_lock (&cache_lock);
 
@@ -1195,30 +2451,57 @@ static int rrd_init (void)
 
 	pthread_mutex_unlock (&cache_lock);
 
-	status = pthread_create (&queue_thread, /* attr = */ NULL,
-			rrd_queue_thread, /* args = */ NULL);
-	if (status != 0)
+	if (journal_file != NULL)
 	{
-		ERROR ("rrdtool plugin: Cannot create queue-thread.");
-		return (-1);
+		rrd_journal_replay ();
+
+		/* Start with a fresh journal, holding the replayed values. */
+		pthread_mutex_lock (&journal_lock);
+		status = rrd_journal_checkpoint ();
+		pthread_mutex_unlock (&journal_lock);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot open the journal %s.",
+					journal_file);
+			return (-1);
+		}
+	}
+
+	for (i = 0; i < writers_num; i++)
+	{
+		char name[16];
+
+		ssnprintf (name, sizeof (name), "rrdtool#%i", i);
+		status = thread_create (&writers[i].thread, /* attr = */ NULL,
+				rrd_queue_thread, /* args = */ writers + i,
+				name, writers_cpus);
+		if (status != 0)
+		{
+			ERROR ("rrdtool plugin: Cannot create queue-thread.");
+			return (-1);
+		}
+		writers[i].thread_running = 1;
 	}
-	queue_thread_running = 1;
+
+	if (collect_stats != 0)
+		plugin_register_read ("rrdtool", rrd_stats_read);
 
 	DEBUG ("rrdtool plugin: rrd_init: datadir = %s; stepsize = %lu;"
-			" heartbeat = %i; rrarows = %i; xff = %lf;",
+			" heartbeat = %i; rrarows = %i; xff = %lf;"
+			" write threads = %i;",
 			(datadir == NULL) ? "(null)" : datadir,
 			rrdcreate_config.stepsize,
 			rrdcreate_config.heartbeat,
 			rrdcreate_config.rrarows,
-			rrdcreate_config.xff);
+			rrdcreate_config.xff,
+			writers_num);
 
 	return (0);
 } /* int rrd_init */
 
 void module_register (void)
 {
-	plugin_register_config ("rrdtool", rrd_config,
-			config_keys, config_keys_num);
+	plugin_register_complex_config ("rrdtool", rrd_config);
 	plugin_register_init ("rrdtool", rrd_init);
 	plugin_register_write ("rrdtool", rrd_write, /* user_data = */ NULL);
 	plugin_register_flush ("rrdtool", rrd_flush, /* user_data = */ NULL);
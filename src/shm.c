@@ -0,0 +1,408 @@
+/**
+ * collectd - src/shm.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+/*
+ * Receives values from local applications through a ring buffer in shared
+ * memory. The layout and the producer side are in
+ * `libcollectdclient/shm_ring.h'.
+ */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LCC_SHM_RING_LAYOUT_ONLY 1
+#include "libcollectdclient/shm_ring.h"
+
+#define SHM_DEFAULT_SLOTS 16384
+#define SHM_DEFAULT_BATCH 256
+/* The reader sleeps between one and 64 milliseconds when the ring is empty,
+ * doubling the time while it stays empty. */
+#define SHM_IDLE_MIN_MS 1
+#define SHM_IDLE_MAX_MS 64
+
+static char  *shm_name = NULL;
+static int    shm_slots = SHM_DEFAULT_SLOTS;
+static int    shm_perms = S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP;
+static int    shm_batch_size = SHM_DEFAULT_BATCH;
+static _Bool  shm_report_stats = 0;
+
+static lcc_shm_ring_header_t *ring_header = NULL;
+static lcc_shm_slot_t        *ring_slots = NULL;
+static size_t                 ring_size = 0;
+/* Kept outside of the region, because any process which can write to the
+ * region can change the header. */
+static uint64_t               ring_tail = 0;
+
+static pthread_t reader_thread;
+static _Bool     reader_started = 0;
+static volatile _Bool reader_loop = 0;
+
+static derive_t stats_received = 0;
+
+static const char *shm_get_name (void) /* {{{ */
+{
+	return ((shm_name != NULL) ? shm_name : LCC_SHM_RING_NAME_DEFAULT);
+} /* }}} const char *shm_get_name */
+
+/* Copies the record in `slot' to `vl', whose `values' must have room for
+ * LCC_SHM_RING_VALUES_MAX values. Returns non-zero if the record is invalid.
+ * Producers are not trusted, so the strings are terminated here. */
+static int shm_record_to_vl (const lcc_shm_slot_t *slot, /* {{{ */
+		value_list_t *vl)
+{
+	const lcc_shm_record_t *r = &slot->record;
+	uint32_t i;
+
+	if ((r->values_len < 1) || (r->values_len > LCC_SHM_RING_VALUES_MAX))
+		return (-1);
+
+	for (i = 0; i < r->values_len; i++)
+	{
+		if (r->values_types[i] > DS_TYPE_ABSOLUTE)
+			return (-1);
+		memcpy (vl->values + i, r->values + i, sizeof (vl->values[i]));
+	}
+	vl->values_len = (int) r->values_len;
+
+	if (r->host[0] != 0)
+		sstrncpy (vl->host, r->host, sizeof (vl->host));
+	else
+		sstrncpy (vl->host, hostname_g, sizeof (vl->host));
+	sstrncpy (vl->plugin, r->plugin, sizeof (vl->plugin));
+	sstrncpy (vl->plugin_instance, r->plugin_instance,
+			sizeof (vl->plugin_instance));
+	sstrncpy (vl->type, r->type, sizeof (vl->type));
+	sstrncpy (vl->type_instance, r->type_instance,
+			sizeof (vl->type_instance));
+
+	if ((vl->plugin[0] == 0) || (vl->type[0] == 0))
+		return (-1);
+
+	/* Each record gets its own time, so that several values of one
+	 * identifier in a batch are not rejected as too old. */
+	vl->time = (r->time != 0) ? (cdtime_t) r->time : cdtime ();
+	vl->interval = (cdtime_t) r->interval;
+	vl->meta = NULL;
+
+	return (0);
+} /* }}} int shm_record_to_vl */
+
+/* Reads up to `shm_batch_size' records and dispatches them. Returns the
+ * number of slots consumed. */
+static size_t shm_drain (value_list_t *vl, value_t *values) /* {{{ */
+{
+	uint64_t mask = (uint64_t) shm_slots - 1;
+	uint64_t tail = ring_tail;
+	size_t slots_read = 0;
+	size_t vl_num = 0;
+
+	while (slots_read < (size_t) shm_batch_size)
+	{
+		lcc_shm_slot_t *slot = ring_slots + (tail & mask);
+		uint64_t sequence;
+
+		sequence = slot->sequence;
+		if (sequence != (tail + 1))
+			break;
+		/* Read the record only after the producer has published it. */
+		__sync_synchronize ();
+
+		vl[vl_num].values = values + vl_num * LCC_SHM_RING_VALUES_MAX;
+		if (shm_record_to_vl (slot, vl + vl_num) == 0)
+			vl_num++;
+
+		/* Hand the slot back to the producers for the next round. */
+		__sync_synchronize ();
+		slot->sequence = tail + (uint64_t) shm_slots;
+		tail++;
+		slots_read++;
+	}
+
+	if (slots_read == 0)
+		return (0);
+
+	ring_tail = tail;
+	ring_header->tail = tail;
+
+	if (vl_num > 0)
+		plugin_dispatch_values_batch (vl, vl_num);
+
+	if (shm_report_stats)
+		__sync_fetch_and_add (&stats_received, (derive_t) vl_num);
+
+	return (slots_read);
+} /* }}} size_t shm_drain */
+
+static void *shm_reader_thread (void __attribute__((unused)) *arg) /* {{{ */
+{
+	value_list_t *vl;
+	value_t *values;
+	long idle_ms = SHM_IDLE_MIN_MS;
+
+	vl = calloc ((size_t) shm_batch_size, sizeof (*vl));
+	values = calloc ((size_t) shm_batch_size * LCC_SHM_RING_VALUES_MAX,
+			sizeof (*values));
+	if ((vl == NULL) || (values == NULL))
+	{
+		ERROR ("shm plugin: calloc failed.");
+		sfree (vl);
+		sfree (values);
+		return ((void *) -1);
+	}
+
+	while (reader_loop)
+	{
+		struct timespec ts;
+
+		if (shm_drain (vl, values) > 0)
+		{
+			idle_ms = SHM_IDLE_MIN_MS;
+			continue;
+		}
+
+		ts.tv_sec = idle_ms / 1000;
+		ts.tv_nsec = (idle_ms % 1000) * 1000000;
+		nanosleep (&ts, NULL);
+
+		if (idle_ms < SHM_IDLE_MAX_MS)
+			idle_ms *= 2;
+	}
+
+	sfree (vl);
+	sfree (values);
+	return ((void *) 0);
+} /* }}} void *shm_reader_thread */
+
+static int shm_create_ring (void) /* {{{ */
+{
+	const char *name = shm_get_name ();
+	char errbuf[1024];
+	void *map;
+	int fd;
+	int i;
+
+	ring_size = LCC_SHM_RING_SIZE (shm_slots);
+
+	/* A region left behind by a crashed daemon may be mapped by producers
+	 * still; they will notice the missing magic number eventually. */
+	shm_unlink (name);
+
+	fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, (mode_t) shm_perms);
+	if (fd < 0)
+	{
+		ERROR ("shm plugin: shm_open (%s) failed: %s", name,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* The umask may have removed some of the permissions. */
+	if ((fchmod (fd, (mode_t) shm_perms) != 0)
+			|| (ftruncate (fd, (off_t) ring_size) != 0))
+	{
+		ERROR ("shm plugin: Setting up %s failed: %s", name,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (fd);
+		shm_unlink (name);
+		return (-1);
+	}
+
+	map = mmap (NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			fd, /* offset = */ 0);
+	close (fd);
+	if (map == MAP_FAILED)
+	{
+		ERROR ("shm plugin: mmap failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		shm_unlink (name);
+		return (-1);
+	}
+
+	ring_header = map;
+	ring_slots = (lcc_shm_slot_t *) (ring_header + 1);
+
+	memset (ring_header, 0, sizeof (*ring_header));
+	ring_header->version = LCC_SHM_RING_VERSION;
+	ring_header->slot_size = (uint32_t) sizeof (lcc_shm_slot_t);
+	ring_header->slots_num = (uint32_t) shm_slots;
+	ring_tail = 0;
+	for (i = 0; i < shm_slots; i++)
+		ring_slots[i].sequence = (uint64_t) i;
+
+	/* Producers check the magic number before using the ring. */
+	__sync_synchronize ();
+	ring_header->magic = LCC_SHM_RING_MAGIC;
+
+	return (0);
+} /* }}} int shm_create_ring */
+
+static void shm_destroy_ring (void) /* {{{ */
+{
+	if (ring_header == NULL)
+		return;
+
+	/* Producers which still have the region mapped get EPIPE. */
+	ring_header->magic = 0;
+	__sync_synchronize ();
+
+	munmap ((void *) ring_header, ring_size);
+	ring_header = NULL;
+	ring_slots = NULL;
+
+	shm_unlink (shm_get_name ());
+} /* }}} void shm_destroy_ring */
+
+static int shm_config (oconfig_item_t *ci) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Name", child->key) == 0)
+			cf_util_get_string (child, &shm_name);
+		else if (strcasecmp ("Slots", child->key) == 0)
+			cf_util_get_int (child, &shm_slots);
+		else if (strcasecmp ("Perms", child->key) == 0)
+		{
+			char *perms = NULL;
+
+			if (cf_util_get_string (child, &perms) == 0)
+				shm_perms = (int) strtol (perms, NULL, 8);
+			sfree (perms);
+		}
+		else if (strcasecmp ("BatchSize", child->key) == 0)
+			cf_util_get_int (child, &shm_batch_size);
+		else if (strcasecmp ("ReportStats", child->key) == 0)
+			cf_util_get_boolean (child, &shm_report_stats);
+		else
+			WARNING ("shm plugin: Ignoring unknown config option `%s'.",
+					child->key);
+	}
+
+	if ((shm_name != NULL) && (shm_name[0] != '/'))
+	{
+		WARNING ("shm plugin: The name must start with a slash. "
+				"Using \"%s\" instead of \"%s\".",
+				LCC_SHM_RING_NAME_DEFAULT, shm_name);
+		sfree (shm_name);
+	}
+
+	/* The positions are mapped to slots using a mask. */
+	if ((shm_slots < 2) || ((shm_slots & (shm_slots - 1)) != 0))
+	{
+		WARNING ("shm plugin: Slots must be a power of two greater than "
+				"one. Using %i.", SHM_DEFAULT_SLOTS);
+		shm_slots = SHM_DEFAULT_SLOTS;
+	}
+
+	if (shm_batch_size < 1)
+		shm_batch_size = SHM_DEFAULT_BATCH;
+
+	return (0);
+} /* }}} int shm_config */
+
+static int shm_read (void) /* {{{ */
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	if (ring_header == NULL)
+		return (-1);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "shm", sizeof (vl.plugin));
+	sstrncpy (vl.type, "total_values", sizeof (vl.type));
+
+	values[0].derive = __sync_fetch_and_add (&stats_received, 0);
+	sstrncpy (vl.type_instance, "received", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	values[0].derive = (derive_t) ring_header->dropped;
+	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	vl.type_instance[0] = 0;
+	values[0].gauge = (gauge_t) (ring_header->head - ring_tail);
+	plugin_dispatch_values (&vl);
+
+	return (0);
+} /* }}} int shm_read */
+
+static int shm_init (void) /* {{{ */
+{
+	char errbuf[1024];
+	int status;
+
+	if (reader_started)
+		return (0);
+
+	if (shm_create_ring () != 0)
+		return (-1);
+
+	reader_loop = 1;
+	status = pthread_create (&reader_thread, NULL, shm_reader_thread, NULL);
+	if (status != 0)
+	{
+		ERROR ("shm plugin: pthread_create failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		reader_loop = 0;
+		shm_destroy_ring ();
+		return (-1);
+	}
+	reader_started = 1;
+
+	if (shm_report_stats)
+		plugin_register_read ("shm", shm_read);
+
+	return (0);
+} /* }}} int shm_init */
+
+static int shm_shutdown (void) /* {{{ */
+{
+	if (reader_started)
+	{
+		reader_loop = 0;
+		pthread_join (reader_thread, NULL);
+		reader_started = 0;
+	}
+
+	shm_destroy_ring ();
+	sfree (shm_name);
+
+	return (0);
+} /* }}} int shm_shutdown */
+
+void module_register (void)
+{
+	plugin_register_complex_config ("shm", shm_config);
+	plugin_register_init ("shm", shm_init);
+	plugin_register_shutdown ("shm", shm_shutdown);
+} /* void module_register */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
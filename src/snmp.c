@@ -61,20 +61,6 @@ struct data_definition_s
 };
 typedef struct data_definition_s data_definition_t;
 
-struct host_definition_s
-{
-  char *name;
-  char *address;
-  char *community;
-  int version;
-  void *sess_handle;
-  c_complain_t complaint;
-  cdtime_t interval;
-  data_definition_t **data_list;
-  int data_list_len;
-};
-typedef struct host_definition_s host_definition_t;
-
 /* These two types are used to cache values in `csnmp_read_table' to handle
  * gaps in tables. */
 struct csnmp_list_instances_s
@@ -93,15 +79,98 @@ struct csnmp_table_values_s
 };
 typedef struct csnmp_table_values_s csnmp_table_values_t;
 
+/* The instance names of a table, kept for `InstanceCacheInterval', so that
+ * the instance column isn't requested with the values every time. */
+struct csnmp_instance_cache_s
+{
+  csnmp_list_instances_t *list;
+  cdtime_t time;
+  _Bool valid;
+};
+typedef struct csnmp_instance_cache_s csnmp_instance_cache_t;
+
+/* The state of a table walk, which takes one request per row with GETNEXT
+ * or per `MaxRepetitions' rows with GETBULK. */
+struct csnmp_table_s
+{
+  struct host_definition_s *host;
+  data_definition_t *data;
+  const data_set_t *ds;
+
+  /* The OIDs to request next. */
+  oid_t *oid_list;
+  uint32_t oid_list_len;
+
+  /* If false, the instance names are taken from `cache'. */
+  _Bool with_instance;
+  csnmp_instance_cache_t *cache;
+
+  /* `value_table' and `value_table_ptr' implement a linked list for each
+   * value. `instance_list' and `instance_list_ptr' implement a linked list
+   * of instance names. This is used to jump gaps in the table. */
+  csnmp_list_instances_t *instance_list;
+  csnmp_list_instances_t *instance_list_ptr;
+  csnmp_table_values_t **value_table;
+  csnmp_table_values_t **value_table_ptr;
+};
+typedef struct csnmp_table_s csnmp_table_t;
+
+struct host_definition_s
+{
+  char *name;
+  char *address;
+  char *community;
+  int version;
+  /* Rows per GETBULK request, or zero for GETNEXT. */
+  int bulk_repetitions;
+  _Bool async;
+  void *sess_handle;
+  c_complain_t complaint;
+  cdtime_t interval;
+  data_definition_t **data_list;
+  int data_list_len;
+  /* One entry per element of `data_list', allocated by the first table
+   * walk. */
+  csnmp_instance_cache_t *instance_cache;
+  cdtime_t instance_cache_interval;
+
+  /* State of an asynchronous poll. `async_busy' is protected by
+   * `async_lock', everything else belongs to the engine thread. */
+  _Bool async_busy;
+  _Bool async_send;
+  _Bool async_failed;
+  cdtime_t async_start;
+  int async_data_index;
+  int async_success;
+  _Bool async_table_active;
+  csnmp_table_t async_table;
+  struct host_definition_s *async_next;
+};
+typedef struct host_definition_s host_definition_t;
+
 /*
  * Private variables
  */
 static data_definition_t *data_head = NULL;
 
+/* The asynchronous engine: one thread keeping the requests of all hosts with
+ * `Asynchronous' enabled in flight. The read callbacks only queue a poll and
+ * wake the thread up using `async_pipe'. */
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t async_thread;
+static _Bool async_running = 0;
+static _Bool async_shutdown = 0;
+static int async_pipe[2] = { -1, -1 };
+static host_definition_t *async_queue = NULL;
+/* Hosts with a poll in progress. Only used by the engine thread. */
+static host_definition_t *async_active = NULL;
+
 /*
  * Prototypes
  */
 static int csnmp_read_host (user_data_t *ud);
+static void csnmp_table_destroy (csnmp_table_t *t);
+static void csnmp_async_stop (void);
 
 /*
  * Private functions
@@ -115,9 +184,20 @@ static void csnmp_host_close_session (host_definition_t *host) /* {{{ */
   host->sess_handle = NULL;
 } /* }}} void csnmp_host_close_session */
 
+static void csnmp_instance_list_free (csnmp_list_instances_t *list) /* {{{ */
+{
+  while (list != NULL)
+  {
+    csnmp_list_instances_t *next = list->next;
+    sfree (list);
+    list = next;
+  }
+} /* }}} void csnmp_instance_list_free */
+
 static void csnmp_host_definition_destroy (void *arg) /* {{{ */
 {
   host_definition_t *hd;
+  int i;
 
   hd = arg;
 
@@ -130,8 +210,21 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
 	hd->name);
   }
 
+  /* The engine thread may be using any asynchronous host. */
+  if (hd->async)
+    csnmp_async_stop ();
+  if (hd->async_table_active)
+    csnmp_table_destroy (&hd->async_table);
+
   csnmp_host_close_session (hd);
 
+  if (hd->instance_cache != NULL)
+  {
+    for (i = 0; i < hd->data_list_len; i++)
+      csnmp_instance_list_free (hd->instance_cache[i].list);
+    sfree (hd->instance_cache);
+  }
+
   sfree (hd->name);
   sfree (hd->address);
   sfree (hd->community);
@@ -159,6 +252,7 @@ static void csnmp_host_definition_destroy (void *arg) /* {{{ */
  *      +-> csnmp_config_add_host_community
  *      +-> csnmp_config_add_host_version
  *      +-> csnmp_config_add_host_collect
+ *      +-> csnmp_config_add_host_max_repetitions
  */
 static void call_snmp_init_once (void)
 {
@@ -542,6 +636,25 @@ static int csnmp_config_add_host_collect (host_definition_t *host,
   return (0);
 } /* int csnmp_config_add_host_collect */
 
+static int csnmp_config_add_host_max_repetitions (host_definition_t *hd,
+    oconfig_item_t *ci)
+{
+  int repetitions = 0;
+
+  if (cf_util_get_int (ci, &repetitions) != 0)
+    return (-1);
+
+  if (repetitions < 0)
+  {
+    WARNING ("snmp plugin: `MaxRepetitions' must not be negative.");
+    return (-1);
+  }
+
+  hd->bulk_repetitions = repetitions;
+
+  return (0);
+} /* int csnmp_config_add_host_max_repetitions */
+
 static int csnmp_config_add_host (oconfig_item_t *ci)
 {
   host_definition_t *hd;
@@ -591,6 +704,12 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       csnmp_config_add_host_collect (hd, option);
     else if (strcasecmp ("Interval", option->key) == 0)
       cf_util_get_cdtime (option, &hd->interval);
+    else if (strcasecmp ("InstanceCacheInterval", option->key) == 0)
+      status = cf_util_get_cdtime (option, &hd->instance_cache_interval);
+    else if (strcasecmp ("MaxRepetitions", option->key) == 0)
+      status = csnmp_config_add_host_max_repetitions (hd, option);
+    else if (strcasecmp ("Asynchronous", option->key) == 0)
+      status = cf_util_get_boolean (option, &hd->async);
     else
     {
       WARNING ("snmp plugin: csnmp_config_add_host: Option `%s' not allowed here.", option->key);
@@ -615,6 +734,12 @@ static int csnmp_config_add_host (oconfig_item_t *ci)
       status = -1;
       break;
     }
+    if ((hd->bulk_repetitions > 0) && (hd->version == 1))
+    {
+      WARNING ("snmp plugin: Host `%s': SNMPv1 doesn't support GETBULK. "
+	  "Ignoring `MaxRepetitions'.", hd->name);
+      hd->bulk_repetitions = 0;
+    }
 
     break;
   } /* while (status == 0) */
@@ -831,17 +956,18 @@ static value_t csnmp_value_list_to_value (struct variable_list *vl, int type,
   return (ret);
 } /* value_t csnmp_value_list_to_value */
 
-/* Returns true if all OIDs have left their subtree */
+/* Returns true if all OIDs of the row starting at `vars' have left their
+ * subtree */
 static int csnmp_check_res_left_subtree (const host_definition_t *host,
-    const data_definition_t *data,
-    struct snmp_pdu *res)
+    const data_definition_t *data, _Bool with_instance,
+    struct variable_list *vars)
 {
   struct variable_list *vb;
   int num_checked;
   int num_left_subtree;
   int i;
 
-  vb = res->variables;
+  vb = vars;
   if (vb == NULL)
     return (-1);
 
@@ -849,12 +975,14 @@ static int csnmp_check_res_left_subtree (const host_definition_t *host,
   num_left_subtree = 0;
 
   /* check all the variables and count how many have left their subtree */
-  for (vb = res->variables, i = 0;
+  for (vb = vars, i = 0;
       (vb != NULL) && (i < data->values_len);
       vb = vb->next_variable, i++)
   {
     num_checked++;
-    if (snmp_oid_ncompare (data->values[i].oid,
+    if (vb->type == SNMP_ENDOFMIBVIEW)
+      num_left_subtree++;
+    else if (snmp_oid_ncompare (data->values[i].oid,
 	  data->values[i].oid_len,
 	  vb->name, vb->name_length,
 	  data->values[i].oid_len) != 0)
@@ -869,7 +997,7 @@ static int csnmp_check_res_left_subtree (const host_definition_t *host,
     return (-1);
   }
 
-  if (data->instance.oid.oid_len > 0)
+  if (with_instance)
   {
     if (vb == NULL)
     {
@@ -879,7 +1007,9 @@ static int csnmp_check_res_left_subtree (const host_definition_t *host,
     }
 
     num_checked++;
-    if (snmp_oid_ncompare (data->instance.oid.oid,
+    if (vb->type == SNMP_ENDOFMIBVIEW)
+      num_left_subtree++;
+    else if (snmp_oid_ncompare (data->instance.oid.oid,
 	  data->instance.oid.oid_len,
 	  vb->name, vb->name_length,
 	  data->instance.oid.oid_len) != 0)
@@ -960,19 +1090,14 @@ static int csnmp_strvbcopy (char *dst, /* {{{ */
   return ((int) vb->val_len);
 } /* }}} int csnmp_strvbcopy */
 
+/* Adds the instance name in `vb' to the list. */
 static int csnmp_instance_list_add (csnmp_list_instances_t **head,
     csnmp_list_instances_t **tail,
-    const struct snmp_pdu *res,
+    struct variable_list *vb,
     const host_definition_t *hd, const data_definition_t *dd)
 {
   csnmp_list_instances_t *il;
-  struct variable_list *vb;
 
-  /* Set vb on the last variable */
-  for (vb = res->variables;
-      (vb != NULL) && (vb->next_variable != NULL);
-      vb = vb->next_variable)
-    /* do nothing */;
   if (vb == NULL)
     return (-1);
 
@@ -1027,10 +1152,16 @@ static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *dat
   const data_set_t *ds;
   value_list_t vl = VALUE_LIST_INIT;
 
+  /* All rows of the table are dispatched at once. */
+  value_list_t *vl_batch = NULL;
+  size_t vl_batch_num = 0;
+  size_t vl_batch_size = 0;
+
   csnmp_list_instances_t *instance_list_ptr;
   csnmp_table_values_t **value_table_ptr;
 
   int i;
+  size_t j;
   oid subid;
   int have_more;
 
@@ -1052,13 +1183,6 @@ static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *dat
     value_table_ptr[i] = value_table[i];
 
   vl.values_len = ds->ds_num;
-  vl.values = (value_t *) malloc (sizeof (value_t) * vl.values_len);
-  if (vl.values == NULL)
-  {
-    ERROR ("snmp plugin: malloc failed.");
-    sfree (value_table_ptr);
-    return (-1);
-  }
 
   sstrncpy (vl.host, host->name, sizeof (vl.host));
   sstrncpy (vl.plugin, "snmp", sizeof (vl.plugin));
@@ -1140,278 +1264,389 @@ static int csnmp_dispatch_table (host_definition_t *host, data_definition_t *dat
 	    data->instance_prefix, temp);
     }
 
+    if (vl_batch_num >= vl_batch_size)
+    {
+      value_list_t *tmp;
+      size_t new_size = (vl_batch_size > 0) ? (2 * vl_batch_size) : 16;
+
+      tmp = realloc (vl_batch, new_size * sizeof (*vl_batch));
+      if (tmp == NULL)
+      {
+	ERROR ("snmp plugin: realloc failed.");
+	break;
+      }
+      vl_batch = tmp;
+      vl_batch_size = new_size;
+    }
+
+    vl.values = (value_t *) malloc (sizeof (value_t) * vl.values_len);
+    if (vl.values == NULL)
+    {
+      ERROR ("snmp plugin: malloc failed.");
+      break;
+    }
+
     for (i = 0; i < data->values_len; i++)
       vl.values[i] = value_table_ptr[i]->value;
 
     /* If we get here `vl.type_instance' and all `vl.values' have been set */
-    plugin_dispatch_values (&vl);
+    memcpy (vl_batch + vl_batch_num, &vl, sizeof (vl));
+    vl_batch_num++;
+    vl.values = NULL;
 
     subid++;
   } /* while (have_more != 0) */
 
-  sfree (vl.values);
+  if (vl_batch_num > 0)
+    plugin_dispatch_values_batch (vl_batch, vl_batch_num);
+
+  for (j = 0; j < vl_batch_num; j++)
+    sfree (vl_batch[j].values);
+  sfree (vl_batch);
   sfree (value_table_ptr);
 
   return (0);
 } /* int csnmp_dispatch_table */
 
-static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
+/* Returns the data set of `data' if it matches the configured values. */
+static const data_set_t *csnmp_data_get_ds (const data_definition_t *data)
 {
-  struct snmp_pdu *req;
-  struct snmp_pdu *res;
-  struct variable_list *vb;
-
   const data_set_t *ds;
-  oid_t *oid_list;
-  uint32_t oid_list_len;
-
-  int status;
-  int i;
-
-  /* `value_table' and `value_table_ptr' implement a linked list for each
-   * value. `instance_list' and `instance_list_ptr' implement a linked list of
-   * instance names. This is used to jump gaps in the table. */
-  csnmp_list_instances_t *instance_list;
-  csnmp_list_instances_t *instance_list_ptr;
-  csnmp_table_values_t **value_table;
-  csnmp_table_values_t **value_table_ptr;
-
-  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
-      host->name, data->name);
-
-  if (host->sess_handle == NULL)
-  {
-    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
-    return (-1);
-  }
 
   ds = plugin_get_ds (data->type);
   if (!ds)
   {
     ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
-    return (-1);
+    return (NULL);
   }
 
   if (ds->ds_num != data->values_len)
   {
     ERROR ("snmp plugin: DataSet `%s' requires %i values, but config talks about %i",
 	data->type, ds->ds_num, data->values_len);
-    return (-1);
+    return (NULL);
+  }
+
+  return (ds);
+} /* const data_set_t *csnmp_data_get_ds */
+
+/* Returns the instance cache of `data' or NULL if it isn't used. */
+static csnmp_instance_cache_t *csnmp_instance_cache_get (host_definition_t *host,
+    const data_definition_t *data)
+{
+  int i;
+
+  if ((host->instance_cache_interval == 0)
+      || (data->instance.oid.oid_len == 0))
+    return (NULL);
+
+  if (host->instance_cache == NULL)
+  {
+    host->instance_cache = calloc (host->data_list_len,
+	sizeof (*host->instance_cache));
+    if (host->instance_cache == NULL)
+    {
+      ERROR ("snmp plugin: calloc failed.");
+      return (NULL);
+    }
   }
 
+  for (i = 0; i < host->data_list_len; i++)
+    if (host->data_list[i] == data)
+      return (host->instance_cache + i);
+
+  return (NULL);
+} /* csnmp_instance_cache_t *csnmp_instance_cache_get */
+
+static int csnmp_table_init (csnmp_table_t *t, host_definition_t *host,
+    data_definition_t *data)
+{
+  memset (t, 0, sizeof (*t));
+  t->host = host;
+  t->data = data;
+
+  t->ds = csnmp_data_get_ds (data);
+  if (t->ds == NULL)
+    return (-1);
+
+  /* The instance column is only walked when the cache is too old. */
+  t->with_instance = (data->instance.oid.oid_len > 0);
+  t->cache = csnmp_instance_cache_get (host, data);
+  if ((t->cache != NULL) && t->cache->valid
+      && ((cdtime () - t->cache->time) < host->instance_cache_interval))
+    t->with_instance = 0;
+
   /* We need a copy of all the OIDs, because GETNEXT will destroy them. */
-  oid_list_len = data->values_len + 1;
-  oid_list = (oid_t *) malloc (sizeof (oid_t) * (oid_list_len));
-  if (oid_list == NULL)
+  t->oid_list_len = data->values_len + 1;
+  t->oid_list = (oid_t *) malloc (sizeof (oid_t) * (t->oid_list_len));
+  if (t->oid_list == NULL)
   {
-    ERROR ("snmp plugin: csnmp_read_table: malloc failed.");
+    ERROR ("snmp plugin: csnmp_table_init: malloc failed.");
     return (-1);
   }
-  memcpy (oid_list, data->values, data->values_len * sizeof (oid_t));
-  if (data->instance.oid.oid_len > 0)
-    memcpy (oid_list + data->values_len, &data->instance.oid, sizeof (oid_t));
+  memcpy (t->oid_list, data->values, data->values_len * sizeof (oid_t));
+  if (t->with_instance)
+    memcpy (t->oid_list + data->values_len, &data->instance.oid, sizeof (oid_t));
   else
-    oid_list_len--;
+    t->oid_list_len--;
 
   /* Allocate the `value_table' */
-  value_table = (csnmp_table_values_t **) malloc (sizeof (csnmp_table_values_t *)
+  t->value_table = (csnmp_table_values_t **) malloc (sizeof (csnmp_table_values_t *)
       * 2 * data->values_len);
-  if (value_table == NULL)
+  if (t->value_table == NULL)
   {
-    ERROR ("snmp plugin: csnmp_read_table: malloc failed.");
-    sfree (oid_list);
+    ERROR ("snmp plugin: csnmp_table_init: malloc failed.");
+    sfree (t->oid_list);
     return (-1);
   }
-  memset (value_table, '\0', sizeof (csnmp_table_values_t *) * 2 * data->values_len);
-  value_table_ptr = value_table + data->values_len;
-  
-  instance_list = NULL;
-  instance_list_ptr = NULL;
+  memset (t->value_table, '\0', sizeof (csnmp_table_values_t *) * 2 * data->values_len);
+  t->value_table_ptr = t->value_table + data->values_len;
 
-  status = 0;
-  while (status == 0)
+  t->instance_list = NULL;
+  t->instance_list_ptr = NULL;
+
+  return (0);
+} /* int csnmp_table_init */
+
+static void csnmp_table_destroy (csnmp_table_t *t)
+{
+  int i;
+
+  /* Free all allocated variables here */
+  csnmp_instance_list_free (t->instance_list);
+  t->instance_list = NULL;
+  t->instance_list_ptr = NULL;
+
+  for (i = 0; (t->value_table != NULL) && (i < t->data->values_len); i++)
   {
-    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
-    if (req == NULL)
+    csnmp_table_values_t *tmp;
+    while (t->value_table[i] != NULL)
     {
-      ERROR ("snmp plugin: snmp_pdu_create failed.");
-      status = -1;
-      break;
+      tmp = t->value_table[i]->next;
+      sfree (t->value_table[i]);
+      t->value_table[i] = tmp;
     }
+  }
 
-    for (i = 0; (uint32_t) i < oid_list_len; i++)
-      snmp_add_null_var (req, oid_list[i].oid, oid_list[i].oid_len);
+  sfree (t->value_table);
+  sfree (t->oid_list);
+} /* void csnmp_table_destroy */
 
-    res = NULL;
-    status = snmp_sess_synch_response (host->sess_handle, req, &res);
+/* Creates the request for the next rows of the table. */
+static struct snmp_pdu *csnmp_table_pdu_create (csnmp_table_t *t)
+{
+  struct snmp_pdu *req;
+  uint32_t i;
 
-    if ((status != STAT_SUCCESS) || (res == NULL))
+  if (t->host->bulk_repetitions > 0)
+  {
+    req = snmp_pdu_create (SNMP_MSG_GETBULK);
+    if (req != NULL)
     {
-      char *errstr = NULL;
+      req->non_repeaters = 0;
+      req->max_repetitions = t->host->bulk_repetitions;
+    }
+  }
+  else
+  {
+    req = snmp_pdu_create (SNMP_MSG_GETNEXT);
+  }
 
-      snmp_sess_error (host->sess_handle, NULL, NULL, &errstr);
+  if (req == NULL)
+  {
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
+    return (NULL);
+  }
 
-      c_complain (LOG_ERR, &host->complaint,
-	  "snmp plugin: host %s: snmp_sess_synch_response failed: %s",
-	  host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+  for (i = 0; i < t->oid_list_len; i++)
+    snmp_add_null_var (req, t->oid_list[i].oid, t->oid_list[i].oid_len);
 
-      if (res != NULL)
-	snmp_free_pdu (res);
-      res = NULL;
+  return (req);
+} /* struct snmp_pdu *csnmp_table_pdu_create */
 
-      sfree (errstr);
-      csnmp_host_close_session (host);
+/* Adds the row starting at `vars' to the table. Returns 0 if there may be
+ * more rows, 1 if the end of the table has been reached and -1 on error. */
+static int csnmp_table_add_row (csnmp_table_t *t, struct variable_list *vars)
+{
+  host_definition_t *host = t->host;
+  data_definition_t *data = t->data;
+  struct variable_list *vb;
+  int i;
 
-      status = -1;
-      break;
-    }
-    status = 0;
-    assert (res != NULL);
-    c_release (LOG_INFO, &host->complaint,
-	"snmp plugin: host %s: snmp_sess_synch_response successful.",
-	host->name);
+  if (vars == NULL)
+    return (-1);
 
-    vb = res->variables;
-    if (vb == NULL)
+  /* Check if all values (and possibly the instance) have left their
+   * subtree */
+  if (csnmp_check_res_left_subtree (host, data, t->with_instance, vars) != 0)
+    return (1);
+
+  /* if the instance-OID is walked.. */
+  if (t->with_instance)
+  {
+    /* The instance follows the values. */
+    for (vb = vars, i = 0;
+	(vb != NULL) && (i < data->values_len);
+	vb = vb->next_variable, i++)
+      /* do nothing */;
+    assert (vb != NULL);
+
+    /* Allocate a new `csnmp_list_instances_t', insert the instance name and
+     * add it to the list */
+    if (csnmp_instance_list_add (&t->instance_list, &t->instance_list_ptr,
+	  vb, host, data) != 0)
     {
-      status = -1;
-      break;
+      ERROR ("snmp plugin: csnmp_instance_list_add failed.");
+      return (-1);
     }
 
-    /* Check if all values (and possibly the instance) have left their
-     * subtree */
-    if (csnmp_check_res_left_subtree (host, data, res) != 0)
+    /* Copy OID to oid_list[data->values_len] */
+    memcpy (t->oid_list[data->values_len].oid, vb->name,
+	sizeof (oid) * vb->name_length);
+    t->oid_list[data->values_len].oid_len = vb->name_length;
+  }
+
+  for (vb = vars, i = 0;
+      (vb != NULL) && (i < data->values_len);
+      vb = vb->next_variable, i++)
+  {
+    csnmp_table_values_t *vt;
+
+    /* Check if we left the subtree */
+    if (snmp_oid_ncompare (data->values[i].oid,
+	  data->values[i].oid_len,
+	  vb->name, vb->name_length,
+	  data->values[i].oid_len) != 0)
     {
-      status = 0;
-      break;
+      DEBUG ("snmp plugin: host = %s; data = %s; Value %i left its subtree.",
+	  host->name, data->name, i);
+      continue;
     }
 
-    /* if an instance-OID is configured.. */
-    if (data->instance.oid.oid_len > 0)
+    if ((t->value_table_ptr[i] != NULL)
+	&& (vb->name[vb->name_length - 1] <= t->value_table_ptr[i]->subid))
     {
-      /* Allocate a new `csnmp_list_instances_t', insert the instance name and
-       * add it to the list */
-      if (csnmp_instance_list_add (&instance_list, &instance_list_ptr,
-	    res, host, data) != 0)
-      {
-	ERROR ("snmp plugin: csnmp_instance_list_add failed.");
-	status = -1;
-	break;
-      }
-
-      /* Set vb on the last variable */
-      for (vb = res->variables;
-	  (vb != NULL) && (vb->next_variable != NULL);
-	  vb = vb->next_variable)
-	/* do nothing */;
-      assert (vb != NULL);
-
-      /* Copy OID to oid_list[data->values_len] */
-      memcpy (oid_list[data->values_len].oid, vb->name,
-	  sizeof (oid) * vb->name_length);
-      oid_list[data->values_len].oid_len = vb->name_length;
+      DEBUG ("snmp plugin: host = %s; data = %s; i = %i; "
+	  "SUBID is not increasing.",
+	  host->name, data->name, i);
+      continue;
     }
 
-    for (vb = res->variables, i = 0;
-	(vb != NULL) && (i < data->values_len);
-	vb = vb->next_variable, i++)
+    vt = (csnmp_table_values_t *) malloc (sizeof (csnmp_table_values_t));
+    if (vt == NULL)
     {
-      csnmp_table_values_t *vt;
+      ERROR ("snmp plugin: malloc failed.");
+      return (-1);
+    }
 
-      /* Check if we left the subtree */
-      if (snmp_oid_ncompare (data->values[i].oid,
-	    data->values[i].oid_len,
-	    vb->name, vb->name_length,
-	    data->values[i].oid_len) != 0)
-      {
-	DEBUG ("snmp plugin: host = %s; data = %s; Value %i left its subtree.",
-	    host->name, data->name, i);
-	continue;
-      }
+    vt->subid = vb->name[vb->name_length - 1];
+    vt->value = csnmp_value_list_to_value (vb, t->ds->ds[i].type,
+	data->scale, data->shift, host->name, data->name);
+    vt->next = NULL;
 
-      if ((value_table_ptr[i] != NULL)
-	  && (vb->name[vb->name_length - 1] <= value_table_ptr[i]->subid))
-      {
-	DEBUG ("snmp plugin: host = %s; data = %s; i = %i; "
-	    "SUBID is not increasing.",
-	    host->name, data->name, i);
-	continue;
-      }
+    if (t->value_table_ptr[i] == NULL)
+      t->value_table[i] = vt;
+    else
+      t->value_table_ptr[i]->next = vt;
+    t->value_table_ptr[i] = vt;
 
-      vt = (csnmp_table_values_t *) malloc (sizeof (csnmp_table_values_t));
-      if (vt == NULL)
-      {
-	ERROR ("snmp plugin: malloc failed.");
-	status = -1;
-	break;
-      }
+    /* Copy OID to oid_list[i + 1] */
+    memcpy (t->oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
+    t->oid_list[i].oid_len = vb->name_length;
+  } /* for (i = data->values_len) */
 
-      vt->subid = vb->name[vb->name_length - 1];
-      vt->value = csnmp_value_list_to_value (vb, ds->ds[i].type,
-          data->scale, data->shift, host->name, data->name);
-      vt->next = NULL;
+  return (0);
+} /* int csnmp_table_add_row */
 
-      if (value_table_ptr[i] == NULL)
-	value_table[i] = vt;
-      else
-	value_table_ptr[i]->next = vt;
-      value_table_ptr[i] = vt;
+/* Adds the rows of the response `res' to the table. A GETBULK response
+ * holds up to `MaxRepetitions' rows, an incomplete last row is requested
+ * again. Returns like `csnmp_table_add_row'. */
+static int csnmp_table_add_response (csnmp_table_t *t, struct snmp_pdu *res)
+{
+  struct variable_list *vb;
+  uint32_t vars_num = 0;
+  uint32_t rows_num;
+  uint32_t i;
+  int status = 0;
 
-      /* Copy OID to oid_list[i + 1] */
-      memcpy (oid_list[i].oid, vb->name, sizeof (oid) * vb->name_length);
-      oid_list[i].oid_len = vb->name_length;
-    } /* for (i = data->values_len) */
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
+    vars_num++;
 
-    if (res != NULL)
-      snmp_free_pdu (res);
-    res = NULL;
-  } /* while (status == 0) */
+  /* With less than one row `csnmp_check_res_left_subtree' complains. */
+  rows_num = vars_num / t->oid_list_len;
+  if (rows_num < 1)
+    rows_num = 1;
 
-  if (res != NULL)
-    snmp_free_pdu (res);
-  res = NULL;
+  vb = res->variables;
+  for (i = 0; (i < rows_num) && (status == 0); i++)
+  {
+    uint32_t j;
 
-  if (status == 0)
-    csnmp_dispatch_table (host, data, instance_list, value_table);
+    status = csnmp_table_add_row (t, vb);
 
-  /* Free all allocated variables here */
-  while (instance_list != NULL)
-  {
-    instance_list_ptr = instance_list->next;
-    sfree (instance_list);
-    instance_list = instance_list_ptr;
+    for (j = 0; (vb != NULL) && (j < t->oid_list_len); j++)
+      vb = vb->next_variable;
   }
 
-  for (i = 0; i < data->values_len; i++)
+  return (status);
+} /* int csnmp_table_add_response */
+
+/* Dispatches the walked table. The instance names are either stored in the
+ * cache or taken from it. */
+static int csnmp_table_dispatch (csnmp_table_t *t)
+{
+  csnmp_instance_cache_t *cache = t->cache;
+  csnmp_list_instances_t *il;
+  csnmp_table_values_t *vt;
+
+  if (cache == NULL)
+    return (csnmp_dispatch_table (t->host, t->data, t->instance_list,
+	  t->value_table));
+
+  if (t->with_instance)
   {
-    csnmp_table_values_t *tmp;
-    while (value_table[i] != NULL)
+    csnmp_instance_list_free (cache->list);
+    cache->list = t->instance_list;
+    cache->time = cdtime ();
+    cache->valid = 1;
+    t->instance_list = NULL;
+    t->instance_list_ptr = NULL;
+
+    return (csnmp_dispatch_table (t->host, t->data, cache->list,
+	  t->value_table));
+  }
+
+  /* Both lists are sorted by the sub-ID. A row without a cached name, a new
+   * interface for example, is dispatched after the next walk of the
+   * instance column, which takes place in the next interval. */
+  il = cache->list;
+  for (vt = t->value_table[0]; vt != NULL; vt = vt->next)
+  {
+    while ((il != NULL) && (il->subid < vt->subid))
+      il = il->next;
+
+    if ((il == NULL) || (il->subid != vt->subid))
     {
-      tmp = value_table[i]->next;
-      sfree (value_table[i]);
-      value_table[i] = tmp;
+      DEBUG ("snmp plugin: host %s: data %s: Unknown index %lu. Walking "
+	  "the instance column again next time.",
+	  t->host->name, t->data->name, (unsigned long) vt->subid);
+      cache->valid = 0;
+      break;
     }
   }
 
-  sfree (value_table);
-  sfree (oid_list);
-
-  return (0);
-} /* int csnmp_read_table */
+  return (csnmp_dispatch_table (t->host, t->data, cache->list,
+	t->value_table));
+} /* int csnmp_table_dispatch */
 
-static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+static int csnmp_read_table (host_definition_t *host, data_definition_t *data)
 {
   struct snmp_pdu *req;
   struct snmp_pdu *res;
-  struct variable_list *vb;
-
-  const data_set_t *ds;
-  value_list_t vl = VALUE_LIST_INIT;
-
+  csnmp_table_t table;
   int status;
-  int i;
 
-  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
+  DEBUG ("snmp plugin: csnmp_read_table (host = %s, data = %s)",
       host->name, data->name);
 
   if (host->sess_handle == NULL)
@@ -1420,20 +1655,89 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
     return (-1);
   }
 
-  ds = plugin_get_ds (data->type);
-  if (!ds)
-  {
-    ERROR ("snmp plugin: DataSet `%s' not defined.", data->type);
+  if (csnmp_table_init (&table, host, data) != 0)
     return (-1);
-  }
 
-  if (ds->ds_num != data->values_len)
+  res = NULL;
+  status = 0;
+  while (status == 0)
   {
-    ERROR ("snmp plugin: DataSet `%s' requires %i values, but config talks about %i",
-	data->type, ds->ds_num, data->values_len);
-    return (-1);
+    req = csnmp_table_pdu_create (&table);
+    if (req == NULL)
+    {
+      status = -1;
+      break;
+    }
+
+    res = NULL;
+    status = snmp_sess_synch_response (host->sess_handle, req, &res);
+
+    if ((status != STAT_SUCCESS) || (res == NULL))
+    {
+      char *errstr = NULL;
+
+      snmp_sess_error (host->sess_handle, NULL, NULL, &errstr);
+
+      c_complain (LOG_ERR, &host->complaint,
+	  "snmp plugin: host %s: snmp_sess_synch_response failed: %s",
+	  host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+
+      if (res != NULL)
+	snmp_free_pdu (res);
+      res = NULL;
+
+      sfree (errstr);
+      csnmp_host_close_session (host);
+
+      status = -1;
+      break;
+    }
+    status = 0;
+    assert (res != NULL);
+    c_release (LOG_INFO, &host->complaint,
+	"snmp plugin: host %s: snmp_sess_synch_response successful.",
+	host->name);
+
+    status = csnmp_table_add_response (&table, res);
+
+    snmp_free_pdu (res);
+    res = NULL;
+  } /* while (status == 0) */
+
+  if (status > 0)
+    csnmp_table_dispatch (&table);
+
+  csnmp_table_destroy (&table);
+
+  return (0);
+} /* int csnmp_read_table */
+
+static struct snmp_pdu *csnmp_value_pdu_create (const data_definition_t *data)
+{
+  struct snmp_pdu *req;
+  int i;
+
+  req = snmp_pdu_create (SNMP_MSG_GET);
+  if (req == NULL)
+  {
+    ERROR ("snmp plugin: snmp_pdu_create failed.");
+    return (NULL);
   }
 
+  for (i = 0; i < data->values_len; i++)
+    snmp_add_null_var (req, data->values[i].oid, data->values[i].oid_len);
+
+  return (req);
+} /* struct snmp_pdu *csnmp_value_pdu_create */
+
+/* Dispatches the values of the response `res'. */
+static int csnmp_value_dispatch (host_definition_t *host,
+    data_definition_t *data, const data_set_t *ds, struct snmp_pdu *res)
+{
+  struct variable_list *vb;
+  value_list_t vl = VALUE_LIST_INIT;
+  int i;
+
   vl.values_len = ds->ds_num;
   vl.values = (value_t *) malloc (sizeof (value_t) * vl.values_len);
   if (vl.values == NULL)
@@ -1453,16 +1757,52 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
 
   vl.interval = host->interval;
 
-  req = snmp_pdu_create (SNMP_MSG_GET);
-  if (req == NULL)
+  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
   {
-    ERROR ("snmp plugin: snmp_pdu_create failed.");
-    sfree (vl.values);
+#if COLLECT_DEBUG
+    char buffer[1024];
+    snprint_variable (buffer, sizeof (buffer),
+	vb->name, vb->name_length, vb);
+    DEBUG ("snmp plugin: Got this variable: %s", buffer);
+#endif /* COLLECT_DEBUG */
+
+    for (i = 0; i < data->values_len; i++)
+      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
+	    vb->name, vb->name_length) == 0)
+        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
+            data->scale, data->shift, host->name, data->name);
+  } /* for (res->variables) */
+
+  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
+  plugin_dispatch_values (&vl);
+  sfree (vl.values);
+
+  return (0);
+} /* int csnmp_value_dispatch */
+
+static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
+{
+  struct snmp_pdu *req;
+  struct snmp_pdu *res;
+  const data_set_t *ds;
+  int status;
+
+  DEBUG ("snmp plugin: csnmp_read_value (host = %s, data = %s)",
+      host->name, data->name);
+
+  if (host->sess_handle == NULL)
+  {
+    DEBUG ("snmp plugin: csnmp_read_table: host->sess_handle == NULL");
     return (-1);
   }
 
-  for (i = 0; i < data->values_len; i++)
-    snmp_add_null_var (req, data->values[i].oid, data->values[i].oid_len);
+  ds = csnmp_data_get_ds (data);
+  if (ds == NULL)
+    return (-1);
+
+  req = csnmp_value_pdu_create (data);
+  if (req == NULL)
+    return (-1);
 
   res = NULL;
   status = snmp_sess_synch_response (host->sess_handle, req, &res);
@@ -1485,39 +1825,424 @@ static int csnmp_read_value (host_definition_t *host, data_definition_t *data)
     return (-1);
   }
 
+  status = csnmp_value_dispatch (host, data, ds, res);
 
-  for (vb = res->variables; vb != NULL; vb = vb->next_variable)
+  snmp_free_pdu (res);
+  res = NULL;
+
+  return (status);
+} /* int csnmp_read_value */
+
+/*
+ * The asynchronous engine
+ *
+ * A poll of a host requests its data one after the other, but the requests
+ * of all hosts are in flight at the same time. The callback of net-snmp
+ * only processes the response; the next request is sent by the engine loop.
+ */
+
+/* Complains if reading `host' took longer than its interval. */
+static void csnmp_check_duration (const host_definition_t *host,
+    cdtime_t time_start)
+{
+  cdtime_t time_end = cdtime ();
+
+  if ((time_end - time_start) > host->interval)
   {
-#if COLLECT_DEBUG
-    char buffer[1024];
-    snprint_variable (buffer, sizeof (buffer),
-	vb->name, vb->name_length, vb);
-    DEBUG ("snmp plugin: Got this variable: %s", buffer);
-#endif /* COLLECT_DEBUG */
+    WARNING ("snmp plugin: Host `%s' should be queried every %.3f "
+	"seconds, but reading all values takes %.3f seconds.",
+	host->name,
+	CDTIME_T_TO_DOUBLE (host->interval),
+	CDTIME_T_TO_DOUBLE (time_end - time_start));
+  }
+} /* void csnmp_check_duration */
 
-    for (i = 0; i < data->values_len; i++)
-      if (snmp_oid_compare (data->values[i].oid, data->values[i].oid_len,
-	    vb->name, vb->name_length) == 0)
-        vl.values[i] = csnmp_value_list_to_value (vb, ds->ds[i].type,
-            data->scale, data->shift, host->name, data->name);
-  } /* for (res->variables) */
+/* Finishes the current data of the poll of `host'. */
+static void csnmp_async_data_done (host_definition_t *host, int status)
+{
+  if (host->async_table_active)
+  {
+    if (status == 0)
+      csnmp_table_dispatch (&host->async_table);
+    csnmp_table_destroy (&host->async_table);
+    host->async_table_active = 0;
+  }
 
-  if (res != NULL)
-    snmp_free_pdu (res);
-  res = NULL;
+  if (status == 0)
+    host->async_success++;
+  host->async_data_index++;
+} /* void csnmp_async_data_done */
+
+static int csnmp_async_callback (int operation,
+    struct snmp_session __attribute__((unused)) *sess,
+    int __attribute__((unused)) reqid,
+    struct snmp_pdu *pdu, void *magic)
+{
+  host_definition_t *host = magic;
+  data_definition_t *data;
+  int status;
 
-  DEBUG ("snmp plugin: -> plugin_dispatch_values (&vl);");
-  plugin_dispatch_values (&vl);
-  sfree (vl.values);
+  if (host->async_data_index >= host->data_list_len)
+    return (1);
+  data = host->data_list[host->async_data_index];
+
+  /* `pdu' belongs to the library. */
+  if (operation != NETSNMP_CALLBACK_OP_RECEIVED_MESSAGE)
+  {
+    c_complain (LOG_ERR, &host->complaint,
+	"snmp plugin: host %s: Request failed (operation %i).",
+	host->name, operation);
+    host->async_failed = 1;
+    return (1);
+  }
+  c_release (LOG_INFO, &host->complaint,
+      "snmp plugin: host %s: Request successful.", host->name);
+
+  if (data->is_table)
+  {
+    status = csnmp_table_add_response (&host->async_table, pdu);
+    if (status < 0)
+      csnmp_async_data_done (host, -1);
+    else if (status > 0)
+      csnmp_async_data_done (host, 0);
+  }
+  else
+  {
+    const data_set_t *ds = csnmp_data_get_ds (data);
+
+    status = -1;
+    if (ds != NULL)
+      status = csnmp_value_dispatch (host, data, ds, pdu);
+    csnmp_async_data_done (host, status);
+  }
+
+  host->async_send = 1;
+  return (1);
+} /* int csnmp_async_callback */
+
+/* Sends the next request of the poll of `host'. Returns 0 if a request has
+ * been sent, 1 if the poll is complete and -1 on error. */
+static int csnmp_async_send (host_definition_t *host)
+{
+  while (host->async_data_index < host->data_list_len)
+  {
+    data_definition_t *data = host->data_list[host->async_data_index];
+    struct snmp_pdu *req;
+
+    if (data->is_table)
+    {
+      if (!host->async_table_active)
+      {
+	if (csnmp_table_init (&host->async_table, host, data) != 0)
+	{
+	  csnmp_async_data_done (host, -1);
+	  continue;
+	}
+	host->async_table_active = 1;
+      }
+      req = csnmp_table_pdu_create (&host->async_table);
+    }
+    else
+    {
+      if (csnmp_data_get_ds (data) == NULL)
+      {
+	csnmp_async_data_done (host, -1);
+	continue;
+      }
+      req = csnmp_value_pdu_create (data);
+    }
+
+    if (req == NULL)
+    {
+      csnmp_async_data_done (host, -1);
+      continue;
+    }
+
+    if (snmp_sess_async_send (host->sess_handle, req, csnmp_async_callback,
+	  host) == 0)
+    {
+      char *errstr = NULL;
+
+      snmp_sess_error (host->sess_handle, NULL, NULL, &errstr);
+      ERROR ("snmp plugin: host %s: snmp_sess_async_send failed: %s",
+	  host->name, (errstr == NULL) ? "Unknown problem" : errstr);
+      sfree (errstr);
+
+      snmp_free_pdu (req);
+      return (-1);
+    }
+
+    return (0);
+  }
+
+  return (1);
+} /* int csnmp_async_send */
+
+/* Ends the poll of `host' and removes it from `async_active'. */
+static void csnmp_async_finish (host_definition_t *host)
+{
+  host_definition_t *prev = NULL;
+  host_definition_t *ptr;
+
+  for (ptr = async_active; ptr != NULL; prev = ptr, ptr = ptr->async_next)
+    if (ptr == host)
+      break;
+  if (ptr != NULL)
+  {
+    if (prev == NULL)
+      async_active = host->async_next;
+    else
+      prev->async_next = host->async_next;
+  }
+  host->async_next = NULL;
+
+  if (host->async_table_active)
+  {
+    csnmp_table_destroy (&host->async_table);
+    host->async_table_active = 0;
+  }
+
+  /* Like after a failed synchronous request, the session is opened again
+   * by the next poll. */
+  if (host->async_failed)
+    csnmp_host_close_session (host);
+  else
+    csnmp_check_duration (host, host->async_start);
+
+  pthread_mutex_lock (&async_lock);
+  host->async_busy = 0;
+  pthread_mutex_unlock (&async_lock);
+} /* void csnmp_async_finish */
+
+/* Sends the next requests or finishes the polls of all hosts which the
+ * callback is done with. */
+static void csnmp_async_handle_active (void)
+{
+  host_definition_t *host;
+  host_definition_t *next;
+
+  for (host = async_active; host != NULL; host = next)
+  {
+    int status;
+
+    next = host->async_next;
+
+    if (!host->async_failed && !host->async_send)
+      continue;
+
+    status = 1;
+    if (!host->async_failed)
+    {
+      host->async_send = 0;
+      status = csnmp_async_send (host);
+      if (status < 0)
+	host->async_failed = 1;
+    }
+
+    if (status != 0)
+      csnmp_async_finish (host);
+  }
+} /* void csnmp_async_handle_active */
+
+/* Starts the polls of the queued hosts. */
+static void csnmp_async_start_queued (void)
+{
+  host_definition_t *queue;
+
+  pthread_mutex_lock (&async_lock);
+  queue = async_queue;
+  async_queue = NULL;
+  pthread_mutex_unlock (&async_lock);
+
+  while (queue != NULL)
+  {
+    host_definition_t *host = queue;
+
+    queue = host->async_next;
+
+    host->async_next = async_active;
+    async_active = host;
+
+    host->async_start = cdtime ();
+    host->async_data_index = 0;
+    host->async_success = 0;
+    host->async_failed = 0;
+    host->async_send = 1;
+
+    if (host->sess_handle == NULL)
+      csnmp_host_open_session (host);
+    if (host->sess_handle == NULL)
+      host->async_failed = 1;
+  }
+} /* void csnmp_async_start_queued */
+
+static void *csnmp_async_thread (void __attribute__((unused)) *arg)
+{
+  while (42)
+  {
+    host_definition_t *host;
+    fd_set fdset;
+    struct timeval timeout;
+    int numfds;
+    int block;
+    int status;
+
+    pthread_mutex_lock (&async_lock);
+    if (async_shutdown)
+    {
+      pthread_mutex_unlock (&async_lock);
+      break;
+    }
+    pthread_mutex_unlock (&async_lock);
+
+    csnmp_async_start_queued ();
+    csnmp_async_handle_active ();
+
+    FD_ZERO (&fdset);
+    FD_SET (async_pipe[0], &fdset);
+    numfds = async_pipe[0] + 1;
+    block = 1;
+    memset (&timeout, 0, sizeof (timeout));
+
+    /* Collects the sockets of all sessions and the earliest timeout of
+     * their requests. */
+    for (host = async_active; host != NULL; host = host->async_next)
+      snmp_sess_select_info (host->sess_handle, &numfds, &fdset, &timeout,
+	  &block);
+
+    status = select (numfds, &fdset, NULL, NULL, block ? NULL : &timeout);
+    if (status < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+	continue;
+      ERROR ("snmp plugin: select failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      sleep (1);
+      continue;
+    }
+
+    if (FD_ISSET (async_pipe[0], &fdset))
+    {
+      char buffer[64];
+      while (read (async_pipe[0], buffer, sizeof (buffer)) > 0)
+	/* do nothing */;
+    }
+
+    for (host = async_active; host != NULL; host = host->async_next)
+    {
+      if (status > 0)
+	snmp_sess_read (host->sess_handle, &fdset);
+      /* Resends requests and times them out. */
+      snmp_sess_timeout (host->sess_handle);
+    }
+  } /* while (42) */
+
+  return (NULL);
+} /* void *csnmp_async_thread */
+
+/* Starts the engine thread unless it is running. Called with `async_lock'
+ * held. */
+static int csnmp_async_start (void)
+{
+  int status;
+
+  if (async_running)
+    return (0);
+
+  if (pipe (async_pipe) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("snmp plugin: pipe failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  fcntl (async_pipe[0], F_SETFL, fcntl (async_pipe[0], F_GETFL) | O_NONBLOCK);
+  fcntl (async_pipe[1], F_SETFL, fcntl (async_pipe[1], F_GETFL) | O_NONBLOCK);
+
+  async_shutdown = 0;
+  status = pthread_create (&async_thread, /* attr = */ NULL,
+      csnmp_async_thread, /* arg = */ NULL);
+  if (status != 0)
+  {
+    ERROR ("snmp plugin: pthread_create failed with status %i.", status);
+    close (async_pipe[0]);
+    close (async_pipe[1]);
+    async_pipe[0] = async_pipe[1] = -1;
+    return (-1);
+  }
 
+  async_running = 1;
   return (0);
-} /* int csnmp_read_value */
+} /* int csnmp_async_start */
+
+static void csnmp_async_stop (void)
+{
+  pthread_mutex_lock (&async_lock);
+  if (!async_running)
+  {
+    pthread_mutex_unlock (&async_lock);
+    return;
+  }
+  async_shutdown = 1;
+  pthread_mutex_unlock (&async_lock);
+
+  /* If the pipe is full, the thread is being woken up anyway. */
+  if (write (async_pipe[1], "", 1) < 0)
+  {
+    DEBUG ("snmp plugin: Writing to the pipe failed.");
+  }
+  pthread_join (async_thread, /* retval = */ NULL);
+
+  pthread_mutex_lock (&async_lock);
+  async_running = 0;
+  async_queue = NULL;
+  async_active = NULL;
+  close (async_pipe[0]);
+  close (async_pipe[1]);
+  async_pipe[0] = async_pipe[1] = -1;
+  pthread_mutex_unlock (&async_lock);
+} /* void csnmp_async_stop */
+
+/* Queues a poll of `host' for the engine. Returns 0 if it was queued, 1 if
+ * the previous poll is still running and -1 if the engine can't be used. */
+static int csnmp_async_submit (host_definition_t *host)
+{
+  pthread_mutex_lock (&async_lock);
+
+  if (csnmp_async_start () != 0)
+  {
+    pthread_mutex_unlock (&async_lock);
+    return (-1);
+  }
+
+  if (host->async_busy)
+  {
+    pthread_mutex_unlock (&async_lock);
+    WARNING ("snmp plugin: Host `%s': The previous poll is still running. "
+	"Skipping this interval.", host->name);
+    return (1);
+  }
+
+  host->async_busy = 1;
+  host->async_next = async_queue;
+  async_queue = host;
+
+  pthread_mutex_unlock (&async_lock);
+
+  if (write (async_pipe[1], "", 1) < 0)
+  {
+    DEBUG ("snmp plugin: Writing to the pipe failed.");
+  }
+
+  return (0);
+} /* int csnmp_async_submit */
 
 static int csnmp_read_host (user_data_t *ud)
 {
   host_definition_t *host;
   cdtime_t time_start;
-  cdtime_t time_end;
   int status;
   int success;
   int i;
@@ -1527,6 +2252,14 @@ static int csnmp_read_host (user_data_t *ud)
   if (host->interval == 0)
     host->interval = interval_g;
 
+  if (host->async)
+  {
+    status = csnmp_async_submit (host);
+    if (status >= 0)
+      return (status);
+    /* else: read synchronously */
+  }
+
   time_start = cdtime ();
 
   if (host->sess_handle == NULL)
@@ -1549,15 +2282,7 @@ static int csnmp_read_host (user_data_t *ud)
       success++;
   }
 
-  time_end = cdtime ();
-  if ((time_end - time_start) > host->interval)
-  {
-    WARNING ("snmp plugin: Host `%s' should be queried every %.3f "
-	"seconds, but reading all values takes %.3f seconds.",
-	host->name,
-	CDTIME_T_TO_DOUBLE (host->interval),
-	CDTIME_T_TO_DOUBLE (time_end - time_start));
-  }
+  csnmp_check_duration (host, time_start);
 
   if (success == 0)
     return (-1);
@@ -1579,6 +2304,8 @@ static int csnmp_shutdown (void)
 
   /* When we get here, the read threads have been stopped and all the
    * `host_definition_t' will be freed. */
+  csnmp_async_stop ();
+
   DEBUG ("snmp plugin: Destroying all data definitions.");
 
   data_this = data_head;
@@ -1601,7 +2328,7 @@ static int csnmp_shutdown (void)
 void module_register (void)
 {
   plugin_register_complex_config ("snmp", csnmp_config);
-  plugin_register_init ("snmp", csnmp_init);
+  plugin_register_init_parallel ("snmp", csnmp_init);
   plugin_register_shutdown ("snmp", csnmp_shutdown);
 } /* void module_register */
 
@@ -56,6 +56,14 @@ typedef struct {
 	size_t        results_num;
 
 	size_t max_colnum;
+
+	/* is_sep[c] is true if the character c is one of the separators. */
+	_Bool is_sep[256];
+
+	/* The file is read into this buffer, which is kept across reads and
+	 * grown as needed. */
+	char  *buf;
+	size_t buf_size;
 } tbl_t;
 
 static void tbl_result_setup (tbl_result_t *res)
@@ -96,6 +104,11 @@ static void tbl_setup (tbl_t *tbl, char *file)
 	tbl->results_num = 0;
 
 	tbl->max_colnum  = 0;
+
+	memset (tbl->is_sep, 0, sizeof (tbl->is_sep));
+
+	tbl->buf         = NULL;
+	tbl->buf_size    = 0;
 } /* tbl_setup */
 
 static void tbl_clear (tbl_t *tbl)
@@ -112,6 +125,9 @@ static void tbl_clear (tbl_t *tbl)
 	tbl->results_num = 0;
 
 	tbl->max_colnum  = 0;
+
+	sfree (tbl->buf);
+	tbl->buf_size    = 0;
 } /* tbl_clear */
 
 static tbl_t *tables;
@@ -279,7 +295,13 @@ static int tbl_config_table (oconfig_item_t *ci)
 		log_err ("Table \"%s\" does not specify any separator.", tbl->file);
 		status = 1;
 	}
-	strunescape (tbl->sep, strlen (tbl->sep) + 1);
+	else {
+		char *c;
+
+		strunescape (tbl->sep, strlen (tbl->sep) + 1);
+		for (c = tbl->sep; '\0' != *c; ++c)
+			tbl->is_sep[(unsigned char)*c] = 1;
+	}
 
 	if (NULL == tbl->instance) {
 		tbl->instance = sstrdup (tbl->file);
@@ -431,22 +453,32 @@ static int tbl_result_dispatch (tbl_t *tbl, tbl_result_t *res,
 	return 0;
 } /* tbl_result_dispatch */
 
+/* Splits the line in place. Like strtok, runs of separators count as one
+ * and leading and trailing separators are ignored. */
 static int tbl_parse_line (tbl_t *tbl, char *line, size_t len)
 {
 	char *fields[tbl->max_colnum + 1];
-	char *ptr, *saveptr;
+	char *ptr = line;
+	char *end = line + len;
 
 	size_t i;
 
 	i = 0;
-	ptr = line;
-	saveptr = NULL;
-	while (NULL != (fields[i] = strtok_r (ptr, tbl->sep, &saveptr))) {
-		ptr = NULL;
+	while (i <= tbl->max_colnum) {
+		while ((ptr < end) && tbl->is_sep[(unsigned char)*ptr])
+			++ptr;
+		if (ptr >= end)
+			break;
+
+		fields[i] = ptr;
 		++i;
 
-		if (i > tbl->max_colnum)
-			break;
+		while ((ptr < end) && ! tbl->is_sep[(unsigned char)*ptr])
+			++ptr;
+		if (ptr < end) {
+			*ptr = '\0';
+			++ptr;
+		}
 	}
 
 	if (i <= tbl->max_colnum) {
@@ -465,41 +497,89 @@ static int tbl_parse_line (tbl_t *tbl, char *line, size_t len)
 	return 0;
 } /* tbl_parse_line */
 
-static int tbl_read_table (tbl_t *tbl)
+/* Reads the whole file into tbl->buf. Files in /proc report a size of zero,
+ * so the file is read until EOF rather than according to its size. */
+static ssize_t tbl_read_file (tbl_t *tbl)
 {
-	FILE *fh;
-	char  buf[4096];
+	size_t len = 0;
+	int fd;
 
-	fh = fopen (tbl->file, "r");
-	if (NULL == fh) {
+	fd = open (tbl->file, O_RDONLY);
+	if (fd < 0) {
 		char errbuf[1024];
 		log_err ("Failed to open file \"%s\": %s.", tbl->file,
 				sstrerror (errno, errbuf, sizeof (errbuf)));
 		return -1;
 	}
 
-	buf[sizeof (buf) - 1] = '\0';
-	while (NULL != fgets (buf, sizeof (buf), fh)) {
-		if ('\0' != buf[sizeof (buf) - 1]) {
-			buf[sizeof (buf) - 1] = '\0';
-			log_err ("Table %s: Truncated line: %s", tbl->file, buf);
+	while (42) {
+		ssize_t status;
+
+		/* Keep one byte for the terminating null byte. */
+		if (len + 1 >= tbl->buf_size) {
+			size_t new_size = (0 == tbl->buf_size) ? 4096 : 2 * tbl->buf_size;
+			char *tmp;
+
+			tmp = realloc (tbl->buf, new_size);
+			if (NULL == tmp) {
+				log_err ("realloc failed.");
+				close (fd);
+				return -1;
+			}
+			tbl->buf = tmp;
+			tbl->buf_size = new_size;
 		}
 
-		if (0 != tbl_parse_line (tbl, buf, sizeof (buf))) {
-			log_err ("Table %s: Failed to parse line: %s", tbl->file, buf);
-			continue;
+		status = read (fd, tbl->buf + len, tbl->buf_size - len - 1);
+		if (status < 0) {
+			char errbuf[1024];
+
+			if ((EINTR == errno) || (EAGAIN == errno))
+				continue;
+
+			log_err ("Failed to read from file \"%s\": %s.", tbl->file,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (fd);
+			return -1;
 		}
+		else if (0 == status)
+			break;
+
+		len += (size_t)status;
 	}
 
-	if (0 != ferror (fh)) {
-		char errbuf[1024];
-		log_err ("Failed to read from file \"%s\": %s.", tbl->file,
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fh);
+	close (fd);
+
+	tbl->buf[len] = '\0';
+	return (ssize_t)len;
+} /* tbl_read_file */
+
+static int tbl_read_table (tbl_t *tbl)
+{
+	ssize_t len;
+	char *line;
+	char *end;
+
+	len = tbl_read_file (tbl);
+	if (len < 0)
 		return -1;
+
+	line = tbl->buf;
+	end  = tbl->buf + len;
+	while (line < end) {
+		char *eol;
+
+		eol = memchr (line, '\n', (size_t)(end - line));
+		if (NULL == eol)
+			eol = end;
+		*eol = '\0';
+
+		if (0 != tbl_parse_line (tbl, line, (size_t)(eol - line)))
+			log_err ("Table %s: Failed to parse line: %s", tbl->file, line);
+
+		line = eol + 1;
 	}
 
-	fclose (fh);
 	return 0;
 } /* tbl_read_table */
 
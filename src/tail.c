@@ -28,6 +28,8 @@
  *  <Plugin tail>
  *    <File "/var/log/exim4/mainlog">
  *	Instance "exim"
+ *	Interval 60
+ *	Follow true
  *	<Match>
  *	  Regex "S=([1-9][0-9]*)"
  *	  ExcludeRegex "U=root.*S="
@@ -49,8 +51,8 @@ struct ctail_config_match_s
 };
 typedef struct ctail_config_match_s ctail_config_match_t;
 
-cu_tail_match_t **tail_match_list = NULL;
-size_t tail_match_list_num = 0;
+/* Each file is read by a read callback of its own. */
+static size_t tail_files_num = 0;
 
 static int ctail_config_add_string (const char *name, char **dest, oconfig_item_t *ci)
 {
@@ -223,9 +225,29 @@ static int ctail_config_add_match (cu_tail_match_t *tm,
   return (status);
 } /* int ctail_config_add_match */
 
+static void ctail_free (void *arg)
+{
+  tail_match_destroy ((cu_tail_match_t *) arg);
+} /* void ctail_free */
+
+static int ctail_read (user_data_t *ud)
+{
+  int status;
+
+  status = tail_match_read ((cu_tail_match_t *) ud->data);
+  if (status != 0)
+  {
+    ERROR ("tail plugin: tail_match_read failed.");
+    return (-1);
+  }
+
+  return (0);
+} /* int ctail_read */
+
 static int ctail_config_add_file (oconfig_item_t *ci)
 {
   cu_tail_match_t *tm;
+  cdtime_t interval = 0;
   char *plugin_instance = NULL;
   int num_matches = 0;
   int status;
@@ -260,6 +282,16 @@ static int ctail_config_add_file (oconfig_item_t *ci)
     }
     else if (strcasecmp ("Instance", option->key) == 0)
       status = ctail_config_add_string ("Instance", &plugin_instance, option);
+    else if (strcasecmp ("Interval", option->key) == 0)
+      status = cf_util_get_cdtime (option, &interval);
+    else if (strcasecmp ("Follow", option->key) == 0)
+    {
+      _Bool follow = 0;
+
+      status = cf_util_get_boolean (option, &follow);
+      if ((status == 0) && follow)
+	tail_match_follow (tm);
+    }
     else
     {
       WARNING ("tail plugin: Option `%s' not allowed here.", option->key);
@@ -279,20 +311,29 @@ static int ctail_config_add_file (oconfig_item_t *ci)
   }
   else
   {
-    cu_tail_match_t **temp;
+    user_data_t ud;
+    char cb_name[DATA_MAX_NAME_LEN];
+    struct timespec cb_interval = { 0, 0 };
+
+    memset (&ud, 0, sizeof (ud));
+    ud.data = (void *) tm;
+    ud.free_func = ctail_free;
 
-    temp = (cu_tail_match_t **) realloc (tail_match_list,
-	sizeof (cu_tail_match_t *) * (tail_match_list_num + 1));
-    if (temp == NULL)
+    ssnprintf (cb_name, sizeof (cb_name), "tail-%s",
+	ci->values[0].value.string);
+    CDTIME_T_TO_TIMESPEC (interval, &cb_interval);
+
+    /* A busy file doesn't delay the others this way. */
+    status = plugin_register_complex_read (/* group = */ "tail", cb_name,
+	ctail_read, (interval > 0) ? &cb_interval : NULL, &ud);
+    if (status != 0)
     {
-      ERROR ("tail plugin: realloc failed.");
+      ERROR ("tail plugin: Registering the read callback for `%s' failed.",
+	  ci->values[0].value.string);
       tail_match_destroy (tm);
       return (-1);
     }
-
-    tail_match_list = temp;
-    tail_match_list[tail_match_list_num] = tm;
-    tail_match_list_num++;
+    tail_files_num++;
   }
 
   return (0);
@@ -319,7 +360,7 @@ static int ctail_config (oconfig_item_t *ci)
 
 static int ctail_init (void)
 {
-  if (tail_match_list_num == 0)
+  if (tail_files_num == 0)
   {
     WARNING ("tail plugin: File list is empty. Returning an error.");
     return (-1);
@@ -328,52 +369,10 @@ static int ctail_init (void)
   return (0);
 } /* int ctail_init */
 
-static int ctail_read (void)
-{
-  int success = 0;
-  size_t i;
-
-  for (i = 0; i < tail_match_list_num; i++)
-  {
-    int status;
-
-    status = tail_match_read (tail_match_list[i]);
-    if (status != 0)
-    {
-      ERROR ("tail plugin: tail_match_read[%zu] failed.", i);
-    }
-    else
-    {
-      success++;
-    }
-  }
-
-  if (success == 0)
-    return (-1);
-  return (0);
-} /* int ctail_read */
-
-static int ctail_shutdown (void)
-{
-  size_t i;
-
-  for (i = 0; i < tail_match_list_num; i++)
-  {
-    tail_match_destroy (tail_match_list[i]);
-    tail_match_list[i] = NULL;
-  }
-  sfree (tail_match_list);
-  tail_match_list_num = 0;
-
-  return (0);
-} /* int ctail_shutdown */
-
 void module_register (void)
 {
   plugin_register_complex_config ("tail", ctail_config);
   plugin_register_init ("tail", ctail_init);
-  plugin_register_read ("tail", ctail_read);
-  plugin_register_shutdown ("tail", ctail_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 ts=8 : */
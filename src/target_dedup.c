@@ -0,0 +1,413 @@
+/**
+ * collectd - src/target_dedup.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "filter_chain.h"
+
+#include "utils_hashtable.h"
+
+#include <pthread.h>
+
+/*
+ * The values last passed on and their time are kept in a table of each
+ * target, keyed by the value list's identifier, so checking a value list
+ * takes one lookup and one lock. Entries which haven't been seen for two
+ * heartbeats are removed, since their next value list will be passed on
+ * anyway. Since the target is meant for the post-cache chain, the value
+ * cache has already been updated with the suppressed values, so
+ * `uc_check_timeout' doesn't consider the suppressed series missing.
+ */
+struct td_entry_s
+{
+	/* The key: the identifier and its hash, see
+	 * `plugin_value_list_identifier'. */
+	uint32_t hash;
+	char *name;
+
+	cdtime_t time;     /* of the value list last passed on */
+	cdtime_t seen;     /* of the value list last checked */
+	cdtime_t interval;
+	int values_num;
+	int *types;
+	value_t *values;
+};
+typedef struct td_entry_s td_entry_t;
+
+struct td_data_s
+{
+	double epsilon;
+	int heartbeat;
+
+	pthread_mutex_t lock;
+	c_hashtable_t *entries;
+	cdtime_t last_expire;
+};
+typedef struct td_data_s td_data_t;
+
+static uint32_t td_entry_hash (const void *key) /* {{{ */
+{
+	return (((const td_entry_t *) key)->hash);
+} /* }}} uint32_t td_entry_hash */
+
+static int td_entry_compare (const void *a, const void *b) /* {{{ */
+{
+	const td_entry_t *ea = a;
+	const td_entry_t *eb = b;
+
+	if (ea->hash != eb->hash)
+		return (1);
+	return (strcmp (ea->name, eb->name));
+} /* }}} int td_entry_compare */
+
+static void td_entry_free (td_entry_t *e) /* {{{ */
+{
+	if (e == NULL)
+		return;
+
+	sfree (e->name);
+	sfree (e->types);
+	sfree (e->values);
+	sfree (e);
+} /* }}} void td_entry_free */
+
+static td_entry_t *td_entry_create (const data_set_t *ds, /* {{{ */
+		const vl_identifier_t *ident)
+{
+	td_entry_t *e;
+	int i;
+
+	e = calloc (1, sizeof (*e));
+	if (e == NULL)
+		return (NULL);
+
+	e->hash = ident->hash;
+	e->name = strdup (ident->name);
+	e->values_num = ds->ds_num;
+	e->types = calloc ((size_t) ds->ds_num, sizeof (*e->types));
+	e->values = calloc ((size_t) ds->ds_num, sizeof (*e->values));
+	if ((e->name == NULL) || (e->types == NULL) || (e->values == NULL))
+	{
+		td_entry_free (e);
+		return (NULL);
+	}
+
+	for (i = 0; i < ds->ds_num; i++)
+		e->types[i] = ds->ds[i].type;
+
+	return (e);
+} /* }}} td_entry_t *td_entry_create */
+
+/* Returns true if the value of data source `index' equals the one last
+ * passed on. */
+static _Bool td_value_unchanged (const data_set_t *ds, /* {{{ */
+		const value_list_t *vl, const td_data_t *data,
+		const td_entry_t *e, int index)
+{
+	switch (ds->ds[index].type)
+	{
+		case DS_TYPE_GAUGE:
+		{
+			gauge_t prev = e->values[index].gauge;
+			gauge_t curr = vl->values[index].gauge;
+
+			if (isnan (prev) || isnan (curr))
+				return (isnan (prev) && isnan (curr));
+			return (fabs (curr - prev) <= data->epsilon);
+		}
+
+		case DS_TYPE_DERIVE:
+			return (e->values[index].derive == vl->values[index].derive);
+
+		case DS_TYPE_COUNTER:
+			return (e->values[index].counter
+					== vl->values[index].counter);
+
+		case DS_TYPE_ABSOLUTE:
+			return (e->values[index].absolute
+					== vl->values[index].absolute);
+	}
+
+	return (0);
+} /* }}} _Bool td_value_unchanged */
+
+static void td_remember (td_entry_t *e, const value_list_t *vl) /* {{{ */
+{
+	memcpy (e->values, vl->values, e->values_num * sizeof (*e->values));
+	e->time = vl->time;
+} /* }}} void td_remember */
+
+/* Removes the entries which haven't been seen for two heartbeats. Called at
+ * most once per interval. You must hold `data->lock'. */
+static void td_expire (td_data_t *data, cdtime_t now) /* {{{ */
+{
+	c_hashtable_iterator_t *iter;
+	td_entry_t **expired = NULL;
+	size_t expired_num = 0;
+	size_t expired_size = 0;
+	td_entry_t *key;
+	td_entry_t *e;
+	size_t i;
+
+	if ((now - data->last_expire) < interval_g)
+		return;
+	data->last_expire = now;
+
+	iter = c_hashtable_get_iterator (data->entries);
+	if (iter == NULL)
+		return;
+
+	while (c_hashtable_iterator_next (iter, (void *) &key,
+				(void *) &e) == 0)
+	{
+		cdtime_t timeout = 2 * ((cdtime_t) data->heartbeat) * e->interval;
+
+		if ((e->seen > now) || ((now - e->seen) < timeout))
+			continue;
+
+		if (expired_num >= expired_size)
+		{
+			size_t new_size = (expired_size > 0) ? 2 * expired_size : 16;
+			td_entry_t **tmp;
+
+			tmp = realloc (expired, new_size * sizeof (*tmp));
+			if (tmp == NULL)
+				break;
+			expired = tmp;
+			expired_size = new_size;
+		}
+		expired[expired_num++] = e;
+	}
+	c_hashtable_iterator_destroy (iter);
+
+	/* The table must not be modified while iterating. */
+	for (i = 0; i < expired_num; i++)
+	{
+		c_hashtable_remove (data->entries, expired[i], NULL, NULL);
+		td_entry_free (expired[i]);
+	}
+	sfree (expired);
+} /* }}} void td_expire */
+
+static int td_destroy (void **user_data) /* {{{ */
+{
+	td_data_t *data;
+	td_entry_t *key;
+	td_entry_t *e;
+
+	if (user_data == NULL)
+		return (-EINVAL);
+
+	data = *user_data;
+	if (data == NULL)
+		return (0);
+
+	if (data->entries != NULL)
+	{
+		while (c_hashtable_pick (data->entries, (void *) &key,
+					(void *) &e) == 0)
+			td_entry_free (e);
+		c_hashtable_destroy (data->entries);
+	}
+	pthread_mutex_destroy (&data->lock);
+
+	sfree (*user_data);
+
+	return (0);
+} /* }}} int td_destroy */
+
+static int td_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+	td_data_t *data;
+	int status = 0;
+	int i;
+
+	data = (td_data_t *) malloc (sizeof (*data));
+	if (data == NULL)
+	{
+		ERROR ("td_create: malloc failed.");
+		return (-ENOMEM);
+	}
+	memset (data, 0, sizeof (*data));
+	pthread_mutex_init (&data->lock, /* attr = */ NULL);
+
+	data->epsilon = 0.0;
+	data->heartbeat = 10;
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Epsilon", child->key) == 0)
+		{
+			if ((child->values_num != 1)
+					|| (child->values[0].type != OCONFIG_TYPE_NUMBER))
+			{
+				ERROR ("Target `dedup': The `%s' option needs exactly "
+						"one numeric argument.", child->key);
+				status = -1;
+			}
+			else
+				data->epsilon = fabs (child->values[0].value.number);
+		}
+		else if (strcasecmp ("Heartbeat", child->key) == 0)
+			status = cf_util_get_int (child, &data->heartbeat);
+		else
+		{
+			ERROR ("Target `dedup': The `%s' configuration option is not "
+					"understood and will be ignored.", child->key);
+			status = 0;
+		}
+
+		if (status != 0)
+			break;
+	}
+
+	if ((status == 0) && (data->heartbeat < 1))
+	{
+		ERROR ("Target `dedup': `Heartbeat' must be at least one.");
+		status = -1;
+	}
+
+	if (status == 0)
+	{
+		data->entries = c_hashtable_create (td_entry_hash,
+				td_entry_compare);
+		if (data->entries == NULL)
+		{
+			ERROR ("Target `dedup': c_hashtable_create failed.");
+			status = -ENOMEM;
+		}
+	}
+
+	if (status != 0)
+	{
+		td_destroy ((void *) &data);
+		return (status);
+	}
+
+	*user_data = data;
+	return (0);
+} /* }}} int td_create */
+
+static int td_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
+		notification_meta_t __attribute__((unused)) **meta, void **user_data)
+{
+	td_data_t *data;
+	vl_identifier_t ident_buffer;
+	const vl_identifier_t *ident;
+	td_entry_t key;
+	td_entry_t *e = NULL;
+	cdtime_t interval;
+	cdtime_t now;
+	_Bool unchanged;
+	int i;
+
+	if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+		return (-EINVAL);
+
+	data = *user_data;
+	if (data == NULL)
+	{
+		ERROR ("Target `dedup': Invoke: `data' is NULL.");
+		return (-EINVAL);
+	}
+
+	ident = plugin_value_list_identifier (vl, &ident_buffer);
+	if (ident == NULL)
+		return (FC_TARGET_CONTINUE);
+
+	key.hash = ident->hash;
+	key.name = (char *) ident->name;
+	interval = (vl->interval > 0) ? vl->interval : interval_g;
+	now = cdtime ();
+
+	pthread_mutex_lock (&data->lock);
+
+	td_expire (data, now);
+
+	/* Not passed on before, or the data set has changed. */
+	if ((c_hashtable_get (data->entries, &key, (void *) &e) == 0)
+			&& (e->values_num != ds->ds_num))
+	{
+		c_hashtable_remove (data->entries, e, NULL, NULL);
+		td_entry_free (e);
+		e = NULL;
+	}
+	for (i = 0; (e != NULL) && (i < ds->ds_num); i++)
+	{
+		if (e->types[i] == ds->ds[i].type)
+			continue;
+		c_hashtable_remove (data->entries, e, NULL, NULL);
+		td_entry_free (e);
+		e = NULL;
+	}
+
+	if (e == NULL)
+	{
+		e = td_entry_create (ds, ident);
+		if ((e == NULL) || (c_hashtable_insert (data->entries, e, e) != 0))
+		{
+			pthread_mutex_unlock (&data->lock);
+			ERROR ("Target `dedup': Adding `%s' failed.", ident->name);
+			td_entry_free (e);
+			return (FC_TARGET_CONTINUE);
+		}
+
+		e->interval = interval;
+		e->seen = now;
+		td_remember (e, vl);
+		pthread_mutex_unlock (&data->lock);
+		return (FC_TARGET_CONTINUE);
+	}
+
+	e->interval = interval;
+	e->seen = now;
+
+	/* Half an interval of slack, since reads don't happen exactly one
+	 * interval apart. */
+	unchanged = 0;
+	if ((vl->time >= e->time)
+			&& ((vl->time - e->time + (interval / 2))
+				< (((cdtime_t) data->heartbeat) * interval)))
+	{
+		unchanged = 1;
+		for (i = 0; unchanged && (i < ds->ds_num); i++)
+			unchanged = td_value_unchanged (ds, vl, data, e, i);
+	}
+
+	if (!unchanged)
+		td_remember (e, vl);
+
+	pthread_mutex_unlock (&data->lock);
+
+	return (unchanged ? FC_TARGET_STOP : FC_TARGET_CONTINUE);
+} /* }}} int td_invoke */
+
+void module_register (void)
+{
+	target_proc_t tproc;
+
+	memset (&tproc, 0, sizeof (tproc));
+	tproc.create  = td_create;
+	tproc.destroy = td_destroy;
+	tproc.invoke  = td_invoke;
+	fc_register_target ("dedup", tproc);
+} /* module_register */
+
+/* vim: set sw=8 ts=8 noet fdm=marker : */
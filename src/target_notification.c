@@ -242,7 +242,8 @@ static int tn_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
     {
       if ((rates == NULL) && (rates_failed == 0))
       {
-        rates = uc_get_rate (ds, vl);
+        /* Released when the dispatch of `vl' is done. */
+        rates = uc_get_rate_arena (ds, vl);
         if (rates == NULL)
           rates_failed = 1;
       }
@@ -263,7 +264,6 @@ static int tn_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
 
     REPLACE_FIELD (template, value_str);
   }
-  sfree (rates);
 
   plugin_dispatch_notification (&n);
 
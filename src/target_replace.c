@@ -22,8 +22,9 @@
 #include "collectd.h"
 #include "common.h"
 #include "filter_chain.h"
-#include "utils_subst.h"
+#include "utils_avltree.h"
 
+#include <pthread.h>
 #include <regex.h>
 
 struct tr_action_s;
@@ -32,18 +33,41 @@ struct tr_action_s
 {
   regex_t re;
   char *replacement;
+  size_t replacement_len;
   int may_be_empty;
 
+  /* If the regular expression is a plain string, optionally anchored with
+   * "^", it is searched with `strstr' or `strncmp' instead of `regexec'.
+   * Otherwise, if it is anchored, `literal' is the part which any matching
+   * string starts with, so `regexec' is skipped for other strings. */
+  char *literal;
+  size_t literal_len;
+  _Bool literal_only;
+  _Bool anchored;
+
   tr_action_t *next;
 };
 
+/* The actions for one field. Since the same strings are rewritten every
+ * interval, up to `cache_size' results are kept in `cache', which maps the
+ * original string to the rewritten one. NULL if caching is disabled. */
+struct tr_field_s
+{
+  tr_action_t *actions;
+
+  c_avl_tree_t *cache;
+  int cache_size;
+  pthread_mutex_t cache_lock;
+};
+typedef struct tr_field_s tr_field_t;
+
 struct tr_data_s
 {
-  tr_action_t *host;
-  tr_action_t *plugin;
-  tr_action_t *plugin_instance;
-  /* tr_action_t *type; */
-  tr_action_t *type_instance;
+  tr_field_t host;
+  tr_field_t plugin;
+  tr_field_t plugin_instance;
+  /* tr_field_t type; */
+  tr_field_t type_instance;
 };
 typedef struct tr_data_s tr_data_t;
 
@@ -72,6 +96,7 @@ static void tr_action_destroy (tr_action_t *act) /* {{{ */
 
   regfree (&act->re);
   sfree (act->replacement);
+  sfree (act->literal);
 
   if (act->next != NULL)
     tr_action_destroy (act->next);
@@ -79,13 +104,80 @@ static void tr_action_destroy (tr_action_t *act) /* {{{ */
   sfree (act);
 } /* }}} void tr_action_destroy */
 
-static int tr_config_add_action (tr_action_t **dest, /* {{{ */
+static void tr_cache_clear (tr_field_t *field) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  /* Key and value are allocated together, see `tr_cache_add'. */
+  while (c_avl_pick (field->cache, &key, &value) == 0)
+    free (key);
+} /* }}} void tr_cache_clear */
+
+static void tr_field_destroy (tr_field_t *field) /* {{{ */
+{
+  if (field->cache != NULL)
+  {
+    tr_cache_clear (field);
+    c_avl_destroy (field->cache);
+    field->cache = NULL;
+    pthread_mutex_destroy (&field->cache_lock);
+  }
+
+  tr_action_destroy (field->actions);
+  field->actions = NULL;
+} /* }}} void tr_field_destroy */
+
+/* Sets the literal members of `act' from the regular expression `re_str'. */
+static void tr_action_literal (tr_action_t *act, /* {{{ */
+    const char *re_str)
+{
+  const char *ptr = re_str;
+  size_t len;
+
+  /* An alternative may match anywhere, e.g. "^a|b". */
+  if (strchr (re_str, '|') != NULL)
+    return;
+
+  if (ptr[0] == '^')
+  {
+    act->anchored = 1;
+    ptr++;
+  }
+
+  len = strcspn (ptr, "\\.[]()*+?{}|^$");
+  if (len == 0)
+    return;
+
+  if (ptr[len] == 0)
+    act->literal_only = 1;
+  else if (!act->anchored)
+    return;
+  /* The last character may be optional, e.g. "^abc?". */
+  else if (strchr ("*?{", ptr[len]) != NULL)
+    len--;
+
+  if (len == 0)
+    return;
+
+  act->literal = malloc (len + 1);
+  if (act->literal == NULL)
+  {
+    act->literal_only = 0;
+    return;
+  }
+  memcpy (act->literal, ptr, len);
+  act->literal[len] = 0;
+  act->literal_len = len;
+} /* }}} void tr_action_literal */
+
+static int tr_config_add_action (tr_field_t *field, /* {{{ */
     const oconfig_item_t *ci, int may_be_empty)
 {
   tr_action_t *act;
   int status;
 
-  if (dest == NULL)
+  if (field == NULL)
     return (-EINVAL);
 
   if ((ci->values_num != 2)
@@ -130,15 +222,18 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
     sfree (act);
     return (-ENOMEM);
   }
+  act->replacement_len = strlen (act->replacement);
+
+  tr_action_literal (act, ci->values[0].value.string);
 
   /* Insert action at end of list. */
-  if (*dest == NULL)
-    *dest = act;
+  if (field->actions == NULL)
+    field->actions = act;
   else
   {
     tr_action_t *prev;
 
-    prev = *dest;
+    prev = field->actions;
     while (prev->next != NULL)
       prev = prev->next;
 
@@ -148,66 +243,182 @@ static int tr_config_add_action (tr_action_t **dest, /* {{{ */
   return (0);
 } /* }}} int tr_config_add_action */
 
-static int tr_action_invoke (tr_action_t *act_head, /* {{{ */
-    char *buffer_in, size_t buffer_in_size, int may_be_empty)
+/* Finds the first match of `act' in `buffer', which is `len' bytes long.
+ * Returns zero and the region in `so' and `eo' if there is one. */
+static int tr_action_match (tr_action_t *act, /* {{{ */
+    const char *buffer, size_t len, size_t *so, size_t *eo)
 {
-  tr_action_t *act;
+  regmatch_t matches[1];
   int status;
-  char buffer[DATA_MAX_NAME_LEN];
-  regmatch_t matches[8];
 
-  if (act_head == NULL)
-    return (-EINVAL);
+  if (act->literal_only)
+  {
+    const char *ptr;
 
-  sstrncpy (buffer, buffer_in, sizeof (buffer));
-  memset (matches, 0, sizeof (matches));
+    if (act->anchored)
+      ptr = (strncmp (buffer, act->literal, act->literal_len) == 0)
+        ? buffer : NULL;
+    else
+      ptr = strstr (buffer, act->literal);
+
+    if (ptr == NULL)
+      return (REG_NOMATCH);
+
+    *so = (size_t) (ptr - buffer);
+    *eo = *so + act->literal_len;
+    return (0);
+  }
 
-  DEBUG ("target_replace plugin: tr_action_invoke: <- buffer = %s;", buffer);
+  if ((act->literal != NULL)
+      && ((len < act->literal_len)
+        || (memcmp (buffer, act->literal, act->literal_len) != 0)))
+    return (REG_NOMATCH);
 
-  for (act = act_head; act != NULL; act = act->next)
+  memset (matches, 0, sizeof (matches));
+  status = regexec (&act->re, buffer,
+      STATIC_ARRAY_SIZE (matches), matches,
+      /* flags = */ 0);
+  if (status == REG_NOMATCH)
+    return (status);
+  else if (status != 0)
   {
-    char temp[DATA_MAX_NAME_LEN];
-    char *subst_status;
+    char errbuf[1024] = "";
 
-    status = regexec (&act->re, buffer,
-        STATIC_ARRAY_SIZE (matches), matches,
-        /* flags = */ 0);
-    if (status == REG_NOMATCH)
-      continue;
-    else if (status != 0)
-    {
-      char errbuf[1024] = "";
+    regerror (status, &act->re, errbuf, sizeof (errbuf));
+    ERROR ("Target `replace': Executing a regular expression failed: %s.",
+        errbuf);
+    return (status);
+  }
+
+  *so = (size_t) matches[0].rm_so;
+  *eo = (size_t) matches[0].rm_eo;
+  return (0);
+} /* }}} int tr_action_match */
+
+/* Replaces the region from `so' to `eo' of `buffer' with the replacement of
+ * `act', in place, truncating the result like `subst' does. Returns the new
+ * length. */
+static size_t tr_action_replace (const tr_action_t *act, /* {{{ */
+    char *buffer, size_t buffer_size, size_t len, size_t so, size_t eo)
+{
+  size_t max_len = buffer_size - 1;
+  size_t repl_len = act->replacement_len;
+  size_t dest;
 
-      regerror (status, &act->re, errbuf, sizeof (errbuf));
-      ERROR ("Target `replace': Executing a regular expression failed: %s.",
-          errbuf);
+  if (so + repl_len > max_len)
+    repl_len = max_len - so;
+
+  dest = so + repl_len;
+  if (dest + (len - eo) > max_len)
+    len = eo + (max_len - dest);
+
+  memmove (buffer + dest, buffer + eo, len - eo);
+  memcpy (buffer + so, act->replacement, repl_len);
+
+  len = dest + (len - eo);
+  buffer[len] = 0;
+  return (len);
+} /* }}} size_t tr_action_replace */
+
+/* Rewrites `buffer' with all actions of `field'. Returns true if any of them
+ * changed it. */
+static _Bool tr_field_apply (tr_field_t *field, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  tr_action_t *act;
+  size_t len = strlen (buffer);
+  _Bool changed = 0;
+
+  DEBUG ("target_replace plugin: tr_field_apply: <- buffer = %s;", buffer);
+
+  for (act = field->actions; act != NULL; act = act->next)
+  {
+    size_t so = 0;
+    size_t eo = 0;
+
+    if (tr_action_match (act, buffer, len, &so, &eo) != 0)
       continue;
-    }
 
-    subst_status = subst (temp, sizeof (temp), buffer,
-        matches[0].rm_so, matches[0].rm_eo, act->replacement);
-    if (subst_status == NULL)
+    if ((so > eo) || (eo > len))
     {
-      ERROR ("Target `replace': subst (buffer = %s, start = %zu, end = %zu, "
-          "replacement = %s) failed.",
-          buffer, (size_t) matches[0].rm_so, (size_t) matches[0].rm_eo,
-          act->replacement);
+      ERROR ("Target `replace': Invalid match (buffer = %s, start = %zu, "
+          "end = %zu).", buffer, so, eo);
       continue;
     }
-    sstrncpy (buffer, temp, sizeof (buffer));
 
-    DEBUG ("target_replace plugin: tr_action_invoke: -- buffer = %s;", buffer);
-  } /* for (act = act_head; act != NULL; act = act->next) */
+    len = tr_action_replace (act, buffer, buffer_size, len, so, eo);
+    changed = 1;
+
+    DEBUG ("target_replace plugin: tr_field_apply: -- buffer = %s;", buffer);
+  } /* for (act = field->actions; act != NULL; act = act->next) */
 
-  if ((may_be_empty == 0) && (buffer[0] == 0))
+  return (changed);
+} /* }}} _Bool tr_field_apply */
+
+/* Remembers that `orig' is rewritten to `result'. */
+static void tr_cache_add (tr_field_t *field, /* {{{ */
+    const char *orig, const char *result)
+{
+  size_t orig_size = strlen (orig) + 1;
+  size_t result_size = strlen (result) + 1;
+  char *key;
+
+  key = malloc (orig_size + result_size);
+  if (key == NULL)
+    return;
+  memcpy (key, orig, orig_size);
+  memcpy (key + orig_size, result, result_size);
+
+  pthread_mutex_lock (&field->cache_lock);
+  /* Start over instead of growing without bounds. */
+  if (c_avl_size (field->cache) >= field->cache_size)
+    tr_cache_clear (field);
+  if (c_avl_insert (field->cache, key, key + orig_size) != 0)
+    free (key);
+  pthread_mutex_unlock (&field->cache_lock);
+} /* }}} void tr_cache_add */
+
+static int tr_action_invoke (tr_field_t *field, /* {{{ */
+    char *buffer_in, size_t buffer_in_size, int may_be_empty)
+{
+  char buffer[DATA_MAX_NAME_LEN];
+  _Bool changed;
+
+  if (field->actions == NULL)
+    return (-EINVAL);
+
+  if (field->cache != NULL)
+  {
+    char *result = NULL;
+    int status;
+
+    pthread_mutex_lock (&field->cache_lock);
+    status = c_avl_get (field->cache, buffer_in, (void *) &result);
+    if ((status == 0) && (strcmp (buffer_in, result) != 0))
+      sstrncpy (buffer_in, result, buffer_in_size);
+    pthread_mutex_unlock (&field->cache_lock);
+
+    if (status == 0)
+      return (0);
+  }
+
+  sstrncpy (buffer, buffer_in, sizeof (buffer));
+  changed = tr_field_apply (field, buffer, sizeof (buffer));
+
+  if (changed && (may_be_empty == 0) && (buffer[0] == 0))
   {
     WARNING ("Target `replace': Replacement resulted in an empty string, "
         "which is not allowed for this buffer (`host' or `plugin').");
-    return (0);
+    changed = 0;
   }
 
-  DEBUG ("target_replace plugin: tr_action_invoke: -> buffer = %s;", buffer);
-  sstrncpy (buffer_in, buffer, buffer_in_size);
+  if (field->cache != NULL)
+    tr_cache_add (field, buffer_in, changed ? buffer : buffer_in);
+
+  DEBUG ("target_replace plugin: tr_action_invoke: -> buffer = %s;",
+      changed ? buffer : buffer_in);
+  if (changed)
+    sstrncpy (buffer_in, buffer, buffer_in_size);
 
   return (0);
 } /* }}} int tr_action_invoke */
@@ -223,19 +434,37 @@ static int tr_destroy (void **user_data) /* {{{ */
   if (data == NULL)
     return (0);
 
-  tr_action_destroy (data->host);
-  tr_action_destroy (data->plugin);
-  tr_action_destroy (data->plugin_instance);
-  /* tr_action_destroy (data->type); */
-  tr_action_destroy (data->type_instance);
+  tr_field_destroy (&data->host);
+  tr_field_destroy (&data->plugin);
+  tr_field_destroy (&data->plugin_instance);
+  /* tr_field_destroy (&data->type); */
+  tr_field_destroy (&data->type_instance);
   sfree (data);
 
   return (0);
 } /* }}} int tr_destroy */
 
+static int tr_field_init_cache (tr_field_t *field, int cache_size) /* {{{ */
+{
+  if ((field->actions == NULL) || (cache_size <= 0))
+    return (0);
+
+  field->cache = c_avl_create ((void *) strcmp);
+  if (field->cache == NULL)
+  {
+    ERROR ("tr_create: c_avl_create failed.");
+    return (-1);
+  }
+  field->cache_size = cache_size;
+  pthread_mutex_init (&field->cache_lock, /* attr = */ NULL);
+
+  return (0);
+} /* }}} int tr_field_init_cache */
+
 static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 {
   tr_data_t *data;
+  int cache_size = 0;
   int status;
   int i;
 
@@ -247,12 +476,6 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
   }
   memset (data, 0, sizeof (*data));
 
-  data->host = NULL;
-  data->plugin = NULL;
-  data->plugin_instance = NULL;
-  /* data->type = NULL; */
-  data->type_instance = NULL;
-
   status = 0;
   for (i = 0; i < ci->children_num; i++)
   {
@@ -276,6 +499,8 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
     else if (strcasecmp ("TypeInstance", child->key) == 0)
       status = tr_config_add_action (&data->type_instance, child,
           /* may be empty = */ 1);
+    else if (strcasecmp ("CacheSize", child->key) == 0)
+      status = cf_util_get_int (child, &cache_size);
     else
     {
       ERROR ("Target `replace': The `%s' configuration option is not understood "
@@ -290,11 +515,11 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
   /* Additional sanity-checking */
   while (status == 0)
   {
-    if ((data->host == NULL)
-        && (data->plugin == NULL)
-        && (data->plugin_instance == NULL)
-        /* && (data->type == NULL) */
-        && (data->type_instance == NULL))
+    if ((data->host.actions == NULL)
+        && (data->plugin.actions == NULL)
+        && (data->plugin_instance.actions == NULL)
+        /* && (data->type.actions == NULL) */
+        && (data->type_instance.actions == NULL))
     {
       ERROR ("Target `replace': You need to set at lease one of `Host', "
           "`Plugin', `PluginInstance', `Type', or `TypeInstance'.");
@@ -304,6 +529,15 @@ static int tr_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
     break;
   }
 
+  if (status == 0)
+    status = tr_field_init_cache (&data->host, cache_size);
+  if (status == 0)
+    status = tr_field_init_cache (&data->plugin, cache_size);
+  if (status == 0)
+    status = tr_field_init_cache (&data->plugin_instance, cache_size);
+  if (status == 0)
+    status = tr_field_init_cache (&data->type_instance, cache_size);
+
   if (status != 0)
   {
     tr_destroy ((void *) &data);
@@ -330,8 +564,8 @@ static int tr_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
   }
 
 #define HANDLE_FIELD(f,e) \
-  if (data->f != NULL) \
-    tr_action_invoke (data->f, vl->f, sizeof (vl->f), e)
+  if (data->f.actions != NULL) \
+    tr_action_invoke (&data->f, vl->f, sizeof (vl->f), e)
   HANDLE_FIELD (host, 0);
   HANDLE_FIELD (plugin, 0);
   HANDLE_FIELD (plugin_instance, 1);
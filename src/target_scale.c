@@ -465,6 +465,10 @@ static int ts_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
 		return (-EINVAL);
 	}
 
+	/* The values are modified in place. */
+	if (plugin_dispatch_values_writable (vl) != 0)
+		return (-ENOMEM);
+
 	for (i = 0; i < ds->ds_num; i++)
 	{
 		/* If we've got a list of data sources, is it in the list? */
@@ -23,6 +23,9 @@
 #include "common.h"
 #include "filter_chain.h"
 
+/* The strings are truncated to the size of the value list's fields when the
+ * target is created, and `*_size' includes the terminating null byte, so they
+ * can be copied with `memcpy'. */
 struct ts_data_s
 {
   char *host;
@@ -30,6 +33,12 @@ struct ts_data_s
   char *plugin_instance;
   /* char *type; */
   char *type_instance;
+
+  size_t host_size;
+  size_t plugin_size;
+  size_t plugin_instance_size;
+  /* size_t type_size; */
+  size_t type_instance_size;
 };
 typedef struct ts_data_s ts_data_t;
 
@@ -51,7 +60,7 @@ static char *ts_strdup (const char *orig) /* {{{ */
   return (dest);
 } /* }}} char *ts_strdup */
 
-static int ts_config_add_string (char **dest, /* {{{ */
+static int ts_config_add_string (char **dest, size_t *dest_size, /* {{{ */
     const oconfig_item_t *ci, int may_be_empty)
 {
   char *temp;
@@ -81,8 +90,16 @@ static int ts_config_add_string (char **dest, /* {{{ */
     return (-1);
   }
 
+  if (strlen (temp) >= DATA_MAX_NAME_LEN)
+  {
+    WARNING ("Target `set': The argument of the `%s' option is longer than "
+        "%i bytes and will be truncated.", ci->key, DATA_MAX_NAME_LEN - 1);
+    temp[DATA_MAX_NAME_LEN - 1] = 0;
+  }
+
   free (*dest);
   *dest = temp;
+  *dest_size = strlen (temp) + 1;
 
   return (0);
 } /* }}} int ts_config_add_string */
@@ -135,22 +152,22 @@ static int ts_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 
     if ((strcasecmp ("Host", child->key) == 0)
         || (strcasecmp ("Hostname", child->key) == 0))
-      status = ts_config_add_string (&data->host, child,
-          /* may be empty = */ 0);
+      status = ts_config_add_string (&data->host, &data->host_size,
+          child, /* may be empty = */ 0);
     else if (strcasecmp ("Plugin", child->key) == 0)
-      status = ts_config_add_string (&data->plugin, child,
-          /* may be empty = */ 0);
+      status = ts_config_add_string (&data->plugin, &data->plugin_size,
+          child, /* may be empty = */ 0);
     else if (strcasecmp ("PluginInstance", child->key) == 0)
-      status = ts_config_add_string (&data->plugin_instance, child,
-          /* may be empty = */ 1);
+      status = ts_config_add_string (&data->plugin_instance,
+          &data->plugin_instance_size, child, /* may be empty = */ 1);
 #if 0
     else if (strcasecmp ("Type", child->key) == 0)
-      status = ts_config_add_string (&data->type, child,
-          /* may be empty = */ 0);
+      status = ts_config_add_string (&data->type, &data->type_size,
+          child, /* may be empty = */ 0);
 #endif
     else if (strcasecmp ("TypeInstance", child->key) == 0)
-      status = ts_config_add_string (&data->type_instance, child,
-          /* may be empty = */ 1);
+      status = ts_config_add_string (&data->type_instance,
+          &data->type_instance_size, child, /* may be empty = */ 1);
     else
     {
       ERROR ("Target `set': The `%s' configuration option is not understood "
@@ -204,7 +221,8 @@ static int ts_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
     return (-EINVAL);
   }
 
-#define SET_FIELD(f) if (data->f != NULL) { sstrncpy (vl->f, data->f, sizeof (vl->f)); }
+#define SET_FIELD(f) \
+  if (data->f != NULL) { memcpy (vl->f, data->f, data->f##_size); }
   SET_FIELD (host);
   SET_FIELD (plugin);
   SET_FIELD (plugin_instance);
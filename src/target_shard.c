@@ -0,0 +1,344 @@
+/**
+ * collectd - src/target_shard.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "filter_chain.h"
+#include "utils_complain.h"
+
+/*
+ * Each write plugin has `replicas' points on a ring of 32 bit hashes. A value
+ * list is written by the plugin owning the first point at or after the hash
+ * of its identifier, so adding or removing a plugin only moves the
+ * identifiers next to its points.
+ */
+#define TS_DEFAULT_REPLICAS 128
+
+struct ts_plugin_s
+{
+	char *name;
+	plugin_write_handle_t *handle;
+	c_complain_t complaint;
+};
+typedef struct ts_plugin_s ts_plugin_t;
+
+struct ts_point_s
+{
+	uint32_t hash;
+	size_t plugin;
+};
+typedef struct ts_point_s ts_point_t;
+
+struct ts_data_s
+{
+	ts_plugin_t *plugins;
+	size_t plugins_num;
+
+	ts_point_t *ring;
+	size_t ring_num;
+};
+typedef struct ts_data_s ts_data_t;
+
+/* The hash of the value cache is FNV-1a, which doesn't spread similar
+ * identifiers well enough over the ring by itself. This is the finalizer of
+ * MurmurHash3. */
+static uint32_t ts_mix (uint32_t h) /* {{{ */
+{
+	h ^= h >> 16;
+	h *= UINT32_C (0x85ebca6b);
+	h ^= h >> 13;
+	h *= UINT32_C (0xc2b2ae35);
+	h ^= h >> 16;
+	return (h);
+} /* }}} uint32_t ts_mix */
+
+static uint32_t ts_hash_string (const char *str) /* {{{ */
+{
+	uint32_t hash = 2166136261U;
+
+	while (*str != 0)
+	{
+		hash ^= (uint32_t) ((unsigned char) *str);
+		hash *= 16777619U;
+		str++;
+	}
+
+	return (ts_mix (hash));
+} /* }}} uint32_t ts_hash_string */
+
+static int ts_point_compare (const void *a, const void *b) /* {{{ */
+{
+	const ts_point_t *p0 = a;
+	const ts_point_t *p1 = b;
+
+	if (p0->hash < p1->hash)
+		return (-1);
+	else if (p0->hash > p1->hash)
+		return (1);
+	else if (p0->plugin < p1->plugin)
+		return (-1);
+	else if (p0->plugin > p1->plugin)
+		return (1);
+	return (0);
+} /* }}} int ts_point_compare */
+
+static int ts_destroy (void **user_data) /* {{{ */
+{
+	ts_data_t *data;
+	size_t i;
+
+	if ((user_data == NULL) || (*user_data == NULL))
+		return (0);
+
+	data = *user_data;
+	for (i = 0; i < data->plugins_num; i++)
+	{
+		sfree (data->plugins[i].name);
+		plugin_write_handle_destroy (data->plugins[i].handle);
+	}
+	sfree (data->plugins);
+	sfree (data->ring);
+	sfree (data);
+	*user_data = NULL;
+
+	return (0);
+} /* }}} int ts_destroy */
+
+static int ts_config_add_plugin (const oconfig_item_t *ci, /* {{{ */
+		ts_data_t *data)
+{
+	ts_plugin_t *tmp;
+	int i;
+
+	if (ci->values_num < 1)
+	{
+		ERROR ("Target `shard': The `%s' option needs at least one "
+				"string argument.", ci->key);
+		return (-1);
+	}
+
+	for (i = 0; i < ci->values_num; i++)
+	{
+		ts_plugin_t *p;
+
+		if (ci->values[i].type != OCONFIG_TYPE_STRING)
+		{
+			ERROR ("Target `shard': All arguments of the `%s' option "
+					"must be strings.", ci->key);
+			return (-1);
+		}
+
+		tmp = realloc (data->plugins,
+				sizeof (*tmp) * (data->plugins_num + 1));
+		if (tmp == NULL)
+		{
+			ERROR ("Target `shard': realloc failed.");
+			return (-1);
+		}
+		data->plugins = tmp;
+
+		p = data->plugins + data->plugins_num;
+		memset (p, 0, sizeof (*p));
+		C_COMPLAIN_INIT (&p->complaint);
+
+		p->name = strdup (ci->values[i].value.string);
+		/* The write callback is looked up by the first write. */
+		p->handle = plugin_write_handle_create (ci->values[i].value.string);
+		if ((p->name == NULL) || (p->handle == NULL))
+		{
+			ERROR ("Target `shard': Creating the write handle of `%s' "
+					"failed.", ci->values[i].value.string);
+			sfree (p->name);
+			plugin_write_handle_destroy (p->handle);
+			return (-1);
+		}
+
+		data->plugins_num++;
+	}
+
+	return (0);
+} /* }}} int ts_config_add_plugin */
+
+static int ts_build_ring (ts_data_t *data, int replicas) /* {{{ */
+{
+	size_t i;
+	int j;
+
+	data->ring_num = data->plugins_num * ((size_t) replicas);
+	data->ring = calloc (data->ring_num, sizeof (*data->ring));
+	if (data->ring == NULL)
+	{
+		ERROR ("Target `shard': calloc failed.");
+		return (-1);
+	}
+
+	for (i = 0; i < data->plugins_num; i++)
+	{
+		for (j = 0; j < replicas; j++)
+		{
+			ts_point_t *point = data->ring + (i * ((size_t) replicas)) + j;
+			char buffer[DATA_MAX_NAME_LEN + 16];
+
+			/* Points depend only on the name, so re-ordering or adding
+			 * plugins doesn't move the others' points. */
+			ssnprintf (buffer, sizeof (buffer), "%s#%i",
+					data->plugins[i].name, j);
+			point->hash = ts_hash_string (buffer);
+			point->plugin = i;
+		}
+	}
+
+	qsort (data->ring, data->ring_num, sizeof (*data->ring),
+			ts_point_compare);
+
+	return (0);
+} /* }}} int ts_build_ring */
+
+static int ts_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
+{
+	ts_data_t *data;
+	int replicas = TS_DEFAULT_REPLICAS;
+	int status = 0;
+	int i;
+
+	data = (ts_data_t *) malloc (sizeof (*data));
+	if (data == NULL)
+	{
+		ERROR ("ts_create: malloc failed.");
+		return (-ENOMEM);
+	}
+	memset (data, 0, sizeof (*data));
+
+	for (i = 0; i < ci->children_num; i++)
+	{
+		oconfig_item_t *child = ci->children + i;
+
+		if (strcasecmp ("Plugin", child->key) == 0)
+			status = ts_config_add_plugin (child, data);
+		else if (strcasecmp ("Replicas", child->key) == 0)
+			status = cf_util_get_int (child, &replicas);
+		else
+		{
+			ERROR ("Target `shard': The `%s' configuration option is not "
+					"understood and will be ignored.", child->key);
+			status = 0;
+		}
+
+		if (status != 0)
+			break;
+	}
+
+	if ((status == 0) && (data->plugins_num == 0))
+	{
+		ERROR ("Target `shard': No `Plugin' has been configured.");
+		status = -1;
+	}
+
+	if ((status == 0) && (replicas < 1))
+	{
+		ERROR ("Target `shard': `Replicas' must be at least one.");
+		status = -1;
+	}
+
+	if (status == 0)
+		status = ts_build_ring (data, replicas);
+
+	if (status != 0)
+	{
+		ts_destroy ((void *) &data);
+		return (status);
+	}
+
+	*user_data = data;
+	return (0);
+} /* }}} int ts_create */
+
+/* Returns the plugin owning `hash', i.e. the first point at or after it. */
+static ts_plugin_t *ts_lookup (ts_data_t *data, uint32_t hash) /* {{{ */
+{
+	size_t lo = 0;
+	size_t hi = data->ring_num;
+
+	while (lo < hi)
+	{
+		size_t mid = lo + ((hi - lo) / 2);
+
+		if (data->ring[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == data->ring_num)
+		lo = 0;
+
+	return (data->plugins + data->ring[lo].plugin);
+} /* }}} ts_plugin_t *ts_lookup */
+
+static int ts_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
+		notification_meta_t __attribute__((unused)) **meta, void **user_data)
+{
+	ts_data_t *data;
+	ts_plugin_t *p;
+	const vl_identifier_t *id;
+	vl_identifier_t id_buffer;
+	int status;
+
+	if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+		return (-EINVAL);
+
+	data = *user_data;
+	if (data == NULL)
+	{
+		ERROR ("Target `shard': Invoke: `data' is NULL.");
+		return (-EINVAL);
+	}
+
+	id = plugin_value_list_identifier (vl, &id_buffer);
+	if (id == NULL)
+	{
+		ERROR ("Target `shard': Formatting the identifier failed.");
+		return (-1);
+	}
+
+	p = ts_lookup (data, ts_mix (id->hash));
+
+	status = plugin_write_handle (p->handle, ds, vl);
+	if (status != 0)
+		c_complain (LOG_WARNING, &p->complaint, "Target `shard': Writing "
+				"values via `%s' failed with status %i.", p->name, status);
+	else
+		c_release (LOG_INFO, &p->complaint, "Target `shard': Writing "
+				"values via `%s' succeeded again.", p->name);
+
+	return (FC_TARGET_CONTINUE);
+} /* }}} int ts_invoke */
+
+void module_register (void)
+{
+	target_proc_t tproc;
+
+	memset (&tproc, 0, sizeof (tproc));
+	tproc.create  = ts_create;
+	tproc.destroy = ts_destroy;
+	tproc.invoke  = ts_invoke;
+	fc_register_target ("shard", tproc);
+} /* module_register */
+
+/* vim: set sw=8 ts=8 noet fdm=marker : */
@@ -24,6 +24,7 @@
 #include "plugin.h"
 #include "common.h"
 #include "filter_chain.h"
+#include "utils_hashtable.h"
 
 static void v5_swap_instances (value_list_t *vl) /* {{{ */
 {
@@ -417,42 +418,127 @@ static int v5_zfs_arc_size (const data_set_t *ds, value_list_t *vl) /* {{{ */
   return (FC_TARGET_STOP);
 } /* }}} int v5_zfs_arc_size */
 
+/*
+ * Dispatch
+ *
+ * Most upgrades depend on the type only, the interface upgrade on the plugin
+ * only, so the handlers are looked up in one table per field. If both tables
+ * have a handler, the one listed first below wins.
+ */
+typedef int (*v5_handler_t) (const data_set_t *ds, value_list_t *vl);
+
+struct v5_upgrade_s
+{
+  const char *name;
+  _Bool by_plugin;
+  v5_handler_t handler;
+};
+typedef struct v5_upgrade_s v5_upgrade_t;
+
+static v5_upgrade_t v5_upgrades[] =
+{
+  { "df",            0, v5_df },
+  { "interface",     1, v5_interface },
+  { "mysql_qcache",  0, v5_mysql_qcache },
+  { "mysql_threads", 0, v5_mysql_threads },
+  { "arc_counts",    0, v5_zfs_arc_counts },
+  { "arc_l2_bytes",  0, v5_zfs_arc_l2_bytes },
+  { "arc_l2_size",   0, v5_zfs_arc_l2_size },
+  { "arc_ratio",     0, v5_zfs_arc_ratio },
+  { "arc_size",      0, v5_zfs_arc_size }
+};
+
+/* The tables are not modified after `v5_create', so they may be read by
+ * several threads at once. */
+struct v5_data_s
+{
+  c_hashtable_t *by_type;
+  c_hashtable_t *by_plugin;
+};
+typedef struct v5_data_s v5_data_t;
+
 static int v5_destroy (void **user_data) /* {{{ */
 {
+  v5_data_t *data;
+
+  if ((user_data == NULL) || (*user_data == NULL))
+    return (0);
+
+  data = *user_data;
+  if (data->by_type != NULL)
+    c_hashtable_destroy (data->by_type);
+  if (data->by_plugin != NULL)
+    c_hashtable_destroy (data->by_plugin);
+  sfree (data);
+  *user_data = NULL;
+
   return (0);
 } /* }}} int v5_destroy */
 
 static int v5_create (const oconfig_item_t *ci, void **user_data) /* {{{ */
 {
-  *user_data = NULL;
+  v5_data_t *data;
+  size_t i;
+
+  data = malloc (sizeof (*data));
+  if (data == NULL)
+  {
+    ERROR ("v5_create: malloc failed.");
+    return (-ENOMEM);
+  }
+  memset (data, 0, sizeof (*data));
+
+  data->by_type = c_hashtable_create (c_hashtable_hash_string,
+      (void *) strcmp);
+  data->by_plugin = c_hashtable_create (c_hashtable_hash_string,
+      (void *) strcmp);
+  if ((data->by_type == NULL) || (data->by_plugin == NULL))
+  {
+    ERROR ("v5_create: c_hashtable_create failed.");
+    v5_destroy ((void *) &data);
+    return (-ENOMEM);
+  }
+
+  for (i = 0; i < STATIC_ARRAY_SIZE (v5_upgrades); i++)
+  {
+    v5_upgrade_t *u = v5_upgrades + i;
+    int status;
+
+    status = c_hashtable_insert (u->by_plugin
+        ? data->by_plugin : data->by_type, (void *) u->name, u);
+    if (status != 0)
+    {
+      ERROR ("v5_create: c_hashtable_insert failed.");
+      v5_destroy ((void *) &data);
+      return (-ENOMEM);
+    }
+  }
+
+  *user_data = data;
   return (0);
 } /* }}} int v5_create */
 
 static int v5_invoke (const data_set_t *ds, value_list_t *vl, /* {{{ */
     notification_meta_t __attribute__((unused)) **meta,
-    void __attribute__((unused)) **user_data)
+    void **user_data)
 {
-  if ((ds == NULL) || (vl == NULL) || (user_data == NULL))
+  v5_data_t *data;
+  v5_upgrade_t *by_type = NULL;
+  v5_upgrade_t *by_plugin = NULL;
+
+  if ((ds == NULL) || (vl == NULL) || (user_data == NULL)
+      || (*user_data == NULL))
     return (-EINVAL);
 
-  if (strcmp ("df", vl->type) == 0)
-    return (v5_df (ds, vl));
-  else if (strcmp ("interface", vl->plugin) == 0)
-    return (v5_interface (ds, vl));
-  else if (strcmp ("mysql_qcache", vl->type) == 0)
-    return (v5_mysql_qcache (ds, vl));
-  else if (strcmp ("mysql_threads", vl->type) == 0)
-    return (v5_mysql_threads (ds, vl));
-  else if (strcmp ("arc_counts", vl->type) == 0)
-    return (v5_zfs_arc_counts (ds, vl));
-  else if (strcmp ("arc_l2_bytes", vl->type) == 0)
-    return (v5_zfs_arc_l2_bytes (ds, vl));
-  else if (strcmp ("arc_l2_size", vl->type) == 0)
-    return (v5_zfs_arc_l2_size (ds, vl));
-  else if (strcmp ("arc_ratio", vl->type) == 0)
-    return (v5_zfs_arc_ratio (ds, vl));
-  else if (strcmp ("arc_size", vl->type) == 0)
-    return (v5_zfs_arc_size (ds, vl));
+  data = *user_data;
+
+  c_hashtable_get (data->by_type, vl->type, (void *) &by_type);
+  c_hashtable_get (data->by_plugin, vl->plugin, (void *) &by_plugin);
+
+  if ((by_type != NULL) && ((by_plugin == NULL) || (by_type < by_plugin)))
+    return ((*by_type->handler) (ds, vl));
+  else if (by_plugin != NULL)
+    return ((*by_plugin->handler) (ds, vl));
 
   return (FC_TARGET_CONTINUE);
 } /* }}} int v5_invoke */
@@ -70,6 +70,15 @@
 #endif
 
 #if KERNEL_LINUX
+# if HAVE_STRUCT_INET_DIAG_REQ_V2
+#  include <sys/socket.h>
+#  include <netinet/in.h>
+#  include <arpa/inet.h>
+#  include <linux/netlink.h>
+#  include <linux/rtnetlink.h>
+#  include <linux/sock_diag.h>
+#  include <linux/inet_diag.h>
+# endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -145,6 +154,22 @@ static const char *tcp_state[] =
 # define TCP_STATE_LISTEN 10
 # define TCP_STATE_MIN 1
 # define TCP_STATE_MAX 11
+
+# if HAVE_STRUCT_INET_DIAG_REQ_V2
+/* All of the states above, and state 12, TCP_NEW_SYN_RECV, which newer
+ * kernels use for the requests they report as SYN_RECV. */
+#  define DIAG_STATES_ALL 0x1ffe
+#  define DIAG_OPS_MAX 2048
+
+/* The sock_diag netlink socket. The sockets are dumped at once, filtered by
+ * the kernel, which is much faster than generating and parsing the text of
+ * /proc/net/tcp with many sockets. */
+static int diag_fd = -1;
+static uint32_t diag_seq = 0;
+/* Set if sock_diag doesn't work, so that /proc is read instead. */
+static _Bool diag_failed = 0;
+static struct inet_diag_bc_op diag_ops[DIAG_OPS_MAX];
+# endif
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -489,6 +514,256 @@ static int conn_read_file (const char *file)
 
   return (0);
 } /* int conn_read_file */
+
+#if HAVE_STRUCT_INET_DIAG_REQ_V2
+/* Appends "port >= x && port <= x" at `*pos' and, unless it is the last
+ * test, a jump to the end, which accepts the socket. Offsets are in bytes,
+ * relative to the op. Failing jumps 20 bytes: to the next test, or four bytes
+ * past the end of the last one, which rejects the socket. */
+static void conn_diag_test (size_t ops_num, size_t *pos,
+    uint8_t code_ge, uint8_t code_le, uint16_t port)
+{
+  size_t p = *pos;
+
+  diag_ops[p].code = code_ge;
+  diag_ops[p].yes = 8;
+  diag_ops[p].no = 20;
+  /* Port comparisons take the port from the `no' field of the next op. */
+  diag_ops[p + 1].code = INET_DIAG_BC_NOP;
+  diag_ops[p + 1].yes = 0;
+  diag_ops[p + 1].no = port;
+
+  diag_ops[p + 2].code = code_le;
+  diag_ops[p + 2].yes = 8;
+  diag_ops[p + 2].no = 12;
+  diag_ops[p + 3].code = INET_DIAG_BC_NOP;
+  diag_ops[p + 3].yes = 0;
+  diag_ops[p + 3].no = port;
+
+  if (p + 4 >= ops_num)
+  {
+    *pos = p + 4;
+    return;
+  }
+
+  diag_ops[p + 4].code = INET_DIAG_BC_JMP;
+  diag_ops[p + 4].yes = 4;
+  diag_ops[p + 4].no = (uint16_t) (4 * (ops_num - (p + 4)));
+  *pos = p + 5;
+} /* void conn_diag_test */
+
+/* Builds the filter accepting the sockets of the ports in `port_list_head'.
+ * Returns its size in bytes, zero if no port is to be counted or -1 if there
+ * are too many ports to filter. */
+static ssize_t conn_diag_bytecode (void)
+{
+  port_entry_t *pe;
+  size_t tests_num = 0;
+  size_t ops_num;
+  size_t pos = 0;
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING))
+      tests_num++;
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      tests_num++;
+  }
+
+  if (tests_num == 0)
+    return (0);
+
+  /* Four ops per test and a jump between tests. */
+  ops_num = 5 * tests_num - 1;
+  if (ops_num > DIAG_OPS_MAX)
+    return (-1);
+
+  for (pe = port_list_head; pe != NULL; pe = pe->next)
+  {
+    if (pe->flags & (PORT_COLLECT_LOCAL | PORT_IS_LISTENING))
+      conn_diag_test (ops_num, &pos,
+	  INET_DIAG_BC_S_GE, INET_DIAG_BC_S_LE, pe->port);
+    if (pe->flags & PORT_COLLECT_REMOTE)
+      conn_diag_test (ops_num, &pos,
+	  INET_DIAG_BC_D_GE, INET_DIAG_BC_D_LE, pe->port);
+  }
+
+  return ((ssize_t) (ops_num * sizeof (diag_ops[0])));
+} /* ssize_t conn_diag_bytecode */
+
+/* Dumps the TCP sockets of `family' in `states' which pass the filter of
+ * `bc_len' bytes in `diag_ops' and counts them. */
+static int conn_diag_read_family (uint8_t family, uint32_t states,
+    size_t bc_len)
+{
+  struct sockaddr_nl nladdr;
+  struct
+  {
+    struct nlmsghdr nlh;
+    struct inet_diag_req_v2 r;
+  } req;
+  struct rtattr rta;
+  struct iovec iov[3];
+  struct msghdr msg;
+  uint32_t seq;
+  /* Aligned for the netlink headers. */
+  uint64_t buffer[4096];
+
+  memset (&nladdr, 0, sizeof (nladdr));
+  nladdr.nl_family = AF_NETLINK;
+
+  seq = ++diag_seq;
+
+  memset (&req, 0, sizeof (req));
+  req.nlh.nlmsg_len = sizeof (req);
+  req.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  req.nlh.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  req.nlh.nlmsg_seq = seq;
+  req.r.sdiag_family = family;
+  req.r.sdiag_protocol = IPPROTO_TCP;
+  req.r.idiag_states = states;
+
+  memset (iov, 0, sizeof (iov));
+  iov[0].iov_base = &req;
+  iov[0].iov_len = sizeof (req);
+
+  memset (&msg, 0, sizeof (msg));
+  msg.msg_name = &nladdr;
+  msg.msg_namelen = sizeof (nladdr);
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 1;
+
+  if (bc_len > 0)
+  {
+    rta.rta_type = INET_DIAG_REQ_BYTECODE;
+    rta.rta_len = RTA_LENGTH (bc_len);
+    req.nlh.nlmsg_len += rta.rta_len;
+
+    iov[1].iov_base = &rta;
+    iov[1].iov_len = sizeof (rta);
+    iov[2].iov_base = diag_ops;
+    iov[2].iov_len = bc_len;
+    msg.msg_iovlen = 3;
+  }
+
+  if (sendmsg (diag_fd, &msg, /* flags = */ 0) < 0)
+  {
+    char errbuf[1024];
+    ERROR ("tcpconns plugin: sendmsg failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  while (42)
+  {
+    const struct nlmsghdr *h;
+    int len;
+
+    len = (int) recv (diag_fd, buffer, sizeof (buffer), /* flags = */ 0);
+    if (len < 0)
+    {
+      char errbuf[1024];
+
+      if (errno == EINTR)
+	continue;
+
+      ERROR ("tcpconns plugin: recv failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    else if (len == 0)
+      return (-1);
+
+    for (h = (const void *) buffer; NLMSG_OK (h, len); h = NLMSG_NEXT (h, len))
+    {
+      const struct inet_diag_msg *r;
+      uint8_t state;
+
+      /* Left over from an earlier, failed dump. */
+      if (h->nlmsg_seq != seq)
+	continue;
+
+      if (h->nlmsg_type == NLMSG_DONE)
+	return (0);
+
+      if (h->nlmsg_type == NLMSG_ERROR)
+      {
+	const struct nlmsgerr *err = NLMSG_DATA (h);
+
+	/* For example if the kernel doesn't support the family. */
+	errno = -err->error;
+	return (-1);
+      }
+
+      if (h->nlmsg_type != SOCK_DIAG_BY_FAMILY)
+	continue;
+
+      r = NLMSG_DATA (h);
+      state = r->idiag_state;
+      if (state > TCP_STATE_MAX)
+	state = 3; /* SYN_RECV */
+
+      conn_handle_ports (ntohs (r->id.idiag_sport), ntohs (r->id.idiag_dport),
+	  state);
+    }
+  }
+
+  /* not reached */
+  return (-1);
+} /* int conn_diag_read_family */
+
+static int conn_diag_read (void)
+{
+  uint32_t states = DIAG_STATES_ALL;
+  ssize_t bc_len;
+
+  if (diag_fd < 0)
+  {
+    diag_fd = socket (AF_NETLINK, SOCK_DGRAM, NETLINK_SOCK_DIAG);
+    if (diag_fd < 0)
+    {
+      char errbuf[1024];
+      ERROR ("tcpconns plugin: Opening the sock_diag socket failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    fcntl (diag_fd, F_SETFD, FD_CLOEXEC);
+  }
+
+  /* The listening sockets come first, so that the connections to their
+   * ports can be filtered. IPv6 may not be available. */
+  if (port_collect_listening != 0)
+  {
+    if (conn_diag_read_family (AF_INET, 1 << TCP_STATE_LISTEN, 0) != 0)
+    {
+      char errbuf[1024];
+      ERROR ("tcpconns plugin: Dumping the listening sockets failed: %s",
+	  sstrerror (errno, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    conn_diag_read_family (AF_INET6, 1 << TCP_STATE_LISTEN, 0);
+    states &= ~(1 << TCP_STATE_LISTEN);
+  }
+
+  bc_len = conn_diag_bytecode ();
+  if (bc_len == 0)
+    return (0);
+  else if (bc_len < 0)
+    /* Dump all sockets and count in conn_handle_ports only. */
+    bc_len = 0;
+
+  if (conn_diag_read_family (AF_INET, states, (size_t) bc_len) != 0)
+  {
+    char errbuf[1024];
+    ERROR ("tcpconns plugin: Dumping the sockets failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+  conn_diag_read_family (AF_INET6, states, (size_t) bc_len);
+
+  return (0);
+} /* int conn_diag_read */
+#endif /* HAVE_STRUCT_INET_DIAG_REQ_V2 */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -553,6 +828,27 @@ static int conn_read (void)
 
   conn_reset_port_entry ();
 
+#if HAVE_STRUCT_INET_DIAG_REQ_V2
+  if (!diag_failed)
+  {
+    if (conn_diag_read () == 0)
+    {
+      conn_submit_all ();
+      return (0);
+    }
+
+    NOTICE ("tcpconns plugin: Reading the sockets via sock_diag failed. "
+	"Reading /proc/net/tcp and /proc/net/tcp6 from now on.");
+    diag_failed = 1;
+    if (diag_fd >= 0)
+    {
+      close (diag_fd);
+      diag_fd = -1;
+    }
+    conn_reset_port_entry ();
+  }
+#endif
+
   if (conn_read_file ("/proc/net/tcp") != 0)
     errors_num++;
   if (conn_read_file ("/proc/net/tcp6") != 0)
@@ -571,6 +867,19 @@ static int conn_read (void)
 
   return (0);
 } /* int conn_read */
+
+static int conn_shutdown (void)
+{
+#if HAVE_STRUCT_INET_DIAG_REQ_V2
+  if (diag_fd >= 0)
+  {
+    close (diag_fd);
+    diag_fd = -1;
+  }
+#endif
+
+  return (0);
+} /* int conn_shutdown */
 /* #endif KERNEL_LINUX */
 
 #elif HAVE_SYSCTLBYNAME
@@ -829,6 +1138,9 @@ void module_register (void)
 	/* no initialization */
 #endif
 	plugin_register_read ("tcpconns", conn_read);
+#if KERNEL_LINUX
+	plugin_register_shutdown ("tcpconns", conn_shutdown);
+#endif
 } /* void module_register */
 
 /*
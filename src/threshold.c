@@ -26,7 +26,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
-#include "utils_avltree.h"
+#include "utils_hashtable.h"
 #include "utils_cache.h"
 
 #include <assert.h>
@@ -55,15 +55,44 @@ typedef struct threshold_s
   gauge_t hysteresis;
   unsigned int flags;
   int hits;
+  /* If non-zero, see `ut_group_report'. */
+  cdtime_t group_interval;
   struct threshold_s *next;
 } threshold_t;
+
+/* The notifications of one threshold with the same host, plugin and
+ * severity which have been held back since the first one was sent. */
+typedef struct ut_group_s
+{
+  char *key;
+  const threshold_t *th;
+  char host[DATA_MAX_NAME_LEN];
+  char plugin[DATA_MAX_NAME_LEN];
+  char type[DATA_MAX_NAME_LEN];
+  int severity;
+  cdtime_t window_end;
+
+  uint64_t count;
+  /* The value that is furthest outside the acceptable range. */
+  gauge_t worst_deviation;
+  gauge_t worst_value;
+  char worst_identifier[6 * DATA_MAX_NAME_LEN];
+  char worst_data_source[DATA_MAX_NAME_LEN];
+} ut_group_t;
 /* }}} */
 
 /*
  * Private (static) variables
  * {{{ */
-static c_avl_tree_t   *threshold_tree = NULL;
+static c_hashtable_t  *threshold_tree = NULL;
 static pthread_mutex_t threshold_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Bumped whenever a threshold is added, invalidating the search results
+ * remembered in the value cache. Zero is never used. */
+static unsigned int    threshold_generation = 0;
+
+/* Open groups by "<threshold>/<severity>/<host>/<plugin>". */
+static c_hashtable_t  *group_table = NULL;
+static pthread_mutex_t group_lock = PTHREAD_MUTEX_INITIALIZER;
 /* }}} */
 
 /*
@@ -92,7 +121,7 @@ static threshold_t *threshold_get (const char *hostname,
       (type == NULL) ? "" : type, type_instance);
   name[sizeof (name) - 1] = '\0';
 
-  if (c_avl_get (threshold_tree, name, (void *) &th) == 0)
+  if (c_hashtable_get (threshold_tree, name, (void *) &th) == 0)
     return (th);
   else
     return (NULL);
@@ -150,7 +179,7 @@ static int ut_threshold_add (const threshold_t *th)
 
   if (th_ptr == NULL) /* no such threshold yet */
   {
-    status = c_avl_insert (threshold_tree, name_copy, th_copy);
+    status = c_hashtable_insert (threshold_tree, name_copy, th_copy);
   }
   else /* th_ptr points to the last threshold in the list */
   {
@@ -159,11 +188,15 @@ static int ut_threshold_add (const threshold_t *th)
     sfree (name_copy);
   }
 
+  threshold_generation++;
+  if (threshold_generation == 0)
+    threshold_generation++;
+
   pthread_mutex_unlock (&threshold_lock);
 
   if (status != 0)
   {
-    ERROR ("ut_threshold_add: c_avl_insert (%s) failed.", name);
+    ERROR ("ut_threshold_add: c_hashtable_insert (%s) failed.", name);
     sfree (name_copy);
     sfree (th_copy);
   }
@@ -223,6 +256,35 @@ static threshold_t *threshold_search (const value_list_t *vl)
   return (NULL);
 } /* }}} threshold_t *threshold_search */
 
+/*
+ * threshold_t *threshold_search_cached
+ *
+ * Like "threshold_search" above, but remembers the result, including the
+ * absence of a threshold, with the value's cache entry. Since the result only
+ * changes when thresholds are added, this saves up to twelve lookups per
+ * value.
+ */
+static threshold_t *threshold_search_cached (const value_list_t *vl)
+{ /* {{{ */
+  threshold_t *th = NULL;
+  unsigned int generation;
+
+  pthread_mutex_lock (&threshold_lock);
+  generation = threshold_generation;
+  pthread_mutex_unlock (&threshold_lock);
+
+  if (uc_get_threshold (vl, generation, (void *) &th) == 0)
+    return (th);
+
+  pthread_mutex_lock (&threshold_lock);
+  th = threshold_search (vl);
+  generation = threshold_generation;
+  pthread_mutex_unlock (&threshold_lock);
+
+  uc_set_threshold (vl, generation, th);
+  return (th);
+} /* }}} threshold_t *threshold_search_cached */
+
 /*
  * Configuration
  * =============
@@ -327,6 +389,29 @@ static int ut_config_type_hysteresis (threshold_t *th, oconfig_item_t *ci)
   return (0);
 } /* int ut_config_type_hysteresis */
 
+static int ut_config_type_group_interval (threshold_t *th, /* {{{ */
+    oconfig_item_t *ci)
+{
+  if (cf_util_get_cdtime (ci, &th->group_interval) != 0)
+    return (-1);
+
+  if (th->group_interval == 0)
+    return (0);
+
+  if (group_table == NULL)
+  {
+    group_table = c_hashtable_create (c_hashtable_hash_string,
+        (void *) strcmp);
+    if (group_table == NULL)
+    {
+      ERROR ("threshold values: c_hashtable_create failed.");
+      return (-1);
+    }
+  }
+
+  return (0);
+} /* }}} int ut_config_type_group_interval */
+
 static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
 {
   int i;
@@ -356,6 +441,7 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
   th.failure_max = NAN;
   th.hits = 0;
   th.hysteresis = 0;
+  th.group_interval = 0;
   th.flags = UT_FLAG_INTERESTING; /* interesting by default */
 
   for (i = 0; i < ci->children_num; i++)
@@ -387,6 +473,8 @@ static int ut_config_type (const threshold_t *th_orig, oconfig_item_t *ci)
       status = ut_config_type_hits (&th, option);
     else if (strcasecmp ("Hysteresis", option->key) == 0)
       status = ut_config_type_hysteresis (&th, option);
+    else if (strcasecmp ("GroupInterval", option->key) == 0)
+      status = ut_config_type_group_interval (&th, option);
     else
     {
       WARNING ("threshold values: Option `%s' not allowed inside a `Type' "
@@ -521,45 +609,35 @@ static int ut_config_host (const threshold_t *th_orig, oconfig_item_t *ci)
 /* }}} */
 
 /*
- * int ut_report_state
+ * int ut_update_state
  *
- * Checks if the `state' differs from the old state and creates a notification
- * if appropriate.
- * Does not fail.
+ * Updates the state and hit counter of a cache entry, `entry_state' and
+ * `entry_hits', with the new `state'. Returns non-zero if a notification
+ * should be sent.
  */
-static int ut_report_state (const data_set_t *ds,
-    const value_list_t *vl,
-    const threshold_t *th,
-    const gauge_t *values,
-    int ds_index,
-    int state)
+static int ut_update_state (const threshold_t *th, int state,
+    int *entry_state, int *entry_hits)
 { /* {{{ */
   int state_old;
-  notification_t n;
-
-  char *buf;
-  size_t bufsize;
-
-  int status;
 
   /* Check if hits matched */
   if ( (th->hits != 0) )
   {
-    int hits = uc_get_hits(ds,vl);
+    int hits = *entry_hits;
     /* STATE_OKAY resets hits unless PERSIST_OK flag is set. Hits resets if
      * threshold is hit. */
     if ( ( (state == STATE_OKAY) && ((th->flags & UT_FLAG_PERSIST_OK) == 0) ) || (hits > th->hits) )
     {
-        DEBUG("ut_report_state: reset uc_get_hits = 0");
-        uc_set_hits(ds,vl,0); /* reset hit counter and notify */
+        DEBUG("ut_update_state: reset hits = 0");
+        *entry_hits = 0; /* reset hit counter and notify */
     } else {
-      DEBUG("ut_report_state: th->hits = %d, uc_get_hits = %d",th->hits,uc_get_hits(ds,vl));
-      (void) uc_inc_hits(ds,vl,1); /* increase hit counter */
+      DEBUG("ut_update_state: th->hits = %d, hits = %d",th->hits,hits);
+      *entry_hits = hits + 1; /* increase hit counter */
       return (0);
     }
   } /* end check hits */
 
-  state_old = uc_get_state (ds, vl);
+  state_old = *entry_state;
 
   /* If the state didn't change, report if `persistent' is specified. If the
    * state is `okay', then only report if `persist_ok` flag is set. */
@@ -572,7 +650,32 @@ static int ut_report_state (const data_set_t *ds,
   }
 
   if (state != state_old)
-    uc_set_state (ds, vl, state);
+    *entry_state = state;
+
+  return (1);
+} /* }}} int ut_update_state */
+
+/*
+ * int ut_report_state
+ *
+ * Creates a notification about the change from `state_old' to `state', as
+ * decided by ut_update_state above.
+ * Does not fail.
+ */
+static int ut_report_state (const data_set_t *ds,
+    const value_list_t *vl,
+    const threshold_t *th,
+    const gauge_t *values,
+    int ds_index,
+    int state,
+    int state_old)
+{ /* {{{ */
+  notification_t n;
+
+  char *buf;
+  size_t bufsize;
+
+  int status;
 
   NOTIFICATION_INIT_VL (&n, vl);
 
@@ -709,6 +812,264 @@ static int ut_report_state (const data_set_t *ds,
   return (0);
 } /* }}} int ut_report_state */
 
+/*
+ * gauge_t ut_deviation
+ *
+ * Returns how far the data source `ds_index' is outside of the range `th'
+ * accepts in `state', or zero if that is not known, e.g. for inverted
+ * thresholds.
+ */
+static gauge_t ut_deviation (const value_list_t *vl, const threshold_t *th,
+    const gauge_t *values, int ds_index, int state)
+{ /* {{{ */
+  gauge_t value;
+  double min;
+  double max;
+
+  if ((ds_index < 0) || ((th->flags & UT_FLAG_INVERT) != 0))
+    return (0.0);
+
+  min = (state == STATE_ERROR) ? th->failure_min : th->warning_min;
+  max = (state == STATE_ERROR) ? th->failure_max : th->warning_max;
+  value = values[ds_index];
+
+  if ((th->flags & UT_FLAG_PERCENTAGE) != 0)
+  {
+    gauge_t sum = 0.0;
+    int i;
+
+    for (i = 0; i < vl->values_len; i++)
+      if (!isnan (values[i]))
+        sum += values[i];
+
+    value = (sum == 0.0) ? NAN : (100.0 * value / sum);
+  }
+
+  if (isnan (value))
+    return (0.0);
+  if (!isnan (max) && (value > max))
+    return (value - max);
+  if (!isnan (min) && (value < min))
+    return (min - value);
+  return (0.0);
+} /* }}} gauge_t ut_deviation */
+
+static void ut_group_free (ut_group_t *g)
+{ /* {{{ */
+  if (g == NULL)
+    return;
+
+  sfree (g->key);
+  sfree (g);
+} /* }}} void ut_group_free */
+
+/*
+ * void ut_group_dispatch
+ *
+ * Sends one notification summing up the notifications held back by the group
+ * `g', if there were any.
+ */
+static void ut_group_dispatch (const ut_group_t *g)
+{ /* {{{ */
+  notification_t n;
+  char *buf;
+  size_t bufsize;
+  int status;
+
+  if (g->count == 0)
+    return;
+
+  memset (&n, 0, sizeof (n));
+  n.time = cdtime ();
+  sstrncpy (n.host, g->host, sizeof (n.host));
+  sstrncpy (n.plugin, g->plugin, sizeof (n.plugin));
+  sstrncpy (n.type, g->type, sizeof (n.type));
+
+  if (g->severity == STATE_OKAY)
+    n.severity = NOTIF_OKAY;
+  else if (g->severity == STATE_WARNING)
+    n.severity = NOTIF_WARNING;
+  else
+    n.severity = NOTIF_FAILURE;
+
+  buf = n.message;
+  bufsize = sizeof (n.message);
+
+  status = ssnprintf (buf, bufsize, "Host %s, plugin %s: %"PRIu64" more "
+      "value%s of type %s %s within %.3f seconds.",
+      g->host, g->plugin, g->count, (g->count == 1) ? "" : "s", g->type,
+      (g->severity == STATE_OKAY) ? "returned to the acceptable range"
+      : ((g->severity == STATE_WARNING) ? "crossed the warning threshold"
+        : "crossed the failure threshold"),
+      CDTIME_T_TO_DOUBLE (g->th->group_interval));
+  buf += status;
+  bufsize -= status;
+
+  plugin_notification_meta_add_unsigned_int (&n, "Count", g->count);
+
+  if ((g->severity != STATE_OKAY) && (g->worst_identifier[0] != 0))
+  {
+    ssnprintf (buf, bufsize, " The worst is %s, data source \"%s\" "
+        "with %f.", g->worst_identifier, g->worst_data_source,
+        g->worst_value);
+
+    plugin_notification_meta_add_string (&n, "WorstIdentifier",
+        g->worst_identifier);
+    plugin_notification_meta_add_string (&n, "DataSource",
+        g->worst_data_source);
+    plugin_notification_meta_add_double (&n, "CurrentValue",
+        g->worst_value);
+  }
+
+  plugin_dispatch_notification (&n);
+
+  plugin_notification_meta_free (n.meta);
+} /* }}} void ut_group_dispatch */
+
+/*
+ * int ut_group_report
+ *
+ * If the threshold that is reported on has a `GroupInterval', the first
+ * notification about a host and plugin in a given state is sent right away;
+ * the others are counted until the interval has passed, then summed up in a
+ * single notification by `ut_group_flush'. Returns non-zero if the
+ * notification has been held back.
+ */
+static int ut_group_report (const data_set_t *ds, const value_list_t *vl,
+    const uc_check_t *check)
+{ /* {{{ */
+  const threshold_t *th = check->report_data;
+  char key[3 * DATA_MAX_NAME_LEN + 32];
+  ut_group_t *g = NULL;
+  ut_group_t *expired = NULL;
+  gauge_t deviation;
+  cdtime_t now;
+
+  if ((th == NULL) || (th->group_interval == 0) || (group_table == NULL))
+    return (0);
+
+  ssnprintf (key, sizeof (key), "%p/%i/%s/%s", (const void *) th,
+      check->report_state, vl->host, vl->plugin);
+  now = cdtime ();
+
+  pthread_mutex_lock (&group_lock);
+
+  /* The read callback hasn't caught up with this group yet. */
+  if ((c_hashtable_get (group_table, key, (void *) &g) == 0)
+      && (now >= g->window_end))
+  {
+    c_hashtable_remove (group_table, key, NULL, NULL);
+    expired = g;
+    g = NULL;
+  }
+
+  if (g != NULL)
+  {
+    g->count++;
+
+    deviation = ut_deviation (vl, th, check->rates, check->report_ds_index,
+        check->report_state);
+    if ((check->report_ds_index >= 0)
+        && ((g->worst_identifier[0] == 0)
+          || (deviation > g->worst_deviation)))
+    {
+      g->worst_deviation = deviation;
+      g->worst_value = check->rates[check->report_ds_index];
+      FORMAT_VL (g->worst_identifier, sizeof (g->worst_identifier), vl);
+      sstrncpy (g->worst_data_source, ds->ds[check->report_ds_index].name,
+          sizeof (g->worst_data_source));
+    }
+
+    pthread_mutex_unlock (&group_lock);
+    return (1);
+  }
+
+  /* Open a new group; its first notification is sent right away. */
+  g = calloc (1, sizeof (*g));
+  if (g != NULL)
+    g->key = strdup (key);
+
+  if ((g == NULL) || (g->key == NULL))
+    ERROR ("ut_group_report: calloc failed.");
+  else
+  {
+    g->th = th;
+    sstrncpy (g->host, vl->host, sizeof (g->host));
+    sstrncpy (g->plugin, vl->plugin, sizeof (g->plugin));
+    sstrncpy (g->type, vl->type, sizeof (g->type));
+    g->severity = check->report_state;
+    g->window_end = now + th->group_interval;
+
+    if (c_hashtable_insert (group_table, g->key, g) == 0)
+      g = NULL;
+    else
+      ERROR ("ut_group_report: c_hashtable_insert failed.");
+  }
+  ut_group_free (g);
+
+  pthread_mutex_unlock (&group_lock);
+
+  if (expired != NULL)
+  {
+    ut_group_dispatch (expired);
+    ut_group_free (expired);
+  }
+
+  return (0);
+} /* }}} int ut_group_report */
+
+/*
+ * int ut_group_flush
+ *
+ * Read callback closing the groups whose interval has passed.
+ */
+static int ut_group_flush (void)
+{ /* {{{ */
+  c_hashtable_iterator_t *iter;
+  ut_group_t **expired;
+  size_t expired_num = 0;
+  char *key;
+  ut_group_t *g;
+  cdtime_t now;
+  size_t i;
+
+  now = cdtime ();
+
+  pthread_mutex_lock (&group_lock);
+
+  expired = calloc ((size_t) c_hashtable_size (group_table) + 1,
+      sizeof (*expired));
+  iter = c_hashtable_get_iterator (group_table);
+  if ((expired == NULL) || (iter == NULL))
+  {
+    pthread_mutex_unlock (&group_lock);
+    sfree (expired);
+    if (iter != NULL)
+      c_hashtable_iterator_destroy (iter);
+    return (-1);
+  }
+
+  /* The table must not be modified while iterating. */
+  while (c_hashtable_iterator_next (iter, (void *) &key, (void *) &g) == 0)
+    if (now >= g->window_end)
+      expired[expired_num++] = g;
+  c_hashtable_iterator_destroy (iter);
+
+  for (i = 0; i < expired_num; i++)
+    c_hashtable_remove (group_table, expired[i]->key, NULL, NULL);
+
+  pthread_mutex_unlock (&group_lock);
+
+  for (i = 0; i < expired_num; i++)
+  {
+    ut_group_dispatch (expired[i]);
+    ut_group_free (expired[i]);
+  }
+  sfree (expired);
+
+  return (0);
+} /* }}} int ut_group_flush */
+
 /*
  * int ut_check_one_data_source
  *
@@ -723,12 +1084,12 @@ static int ut_check_one_data_source (const data_set_t *ds,
     const value_list_t __attribute__((unused)) *vl,
     const threshold_t *th,
     const gauge_t *values,
-    int ds_index)
+    int ds_index,
+    int prev_state)
 { /* {{{ */
   const char *ds_name;
   int is_warning = 0;
   int is_failure = 0;
-  int prev_state = STATE_OKAY;
 
   /* check if this threshold applies to this data source */
   if (ds != NULL)
@@ -747,7 +1108,7 @@ static int ut_check_one_data_source (const data_set_t *ds,
 
   /* XXX: This is an experimental code, not optimized, not fast, not reliable,
    * and probably, do not work as you expect. Enjoy! :D */
-  if ( (th->hysteresis > 0) && ((prev_state = uc_get_state(ds,vl)) != STATE_OKAY) )
+  if ( (th->hysteresis > 0) && (prev_state != STATE_OKAY) )
   {
     switch(prev_state)
     {
@@ -789,13 +1150,15 @@ static int ut_check_one_data_source (const data_set_t *ds,
  *
  * Checks all data sources of a value list against the given threshold, using
  * the ut_check_one_data_source function above. Returns the worst status,
- * which is `okay' if nothing has failed.
+ * which is `okay' if nothing has failed. `state_old' is the state of the
+ * value's cache entry, which the hysteresis depends on.
  * Returns less than zero if the data set doesn't have any data sources.
  */
 static int ut_check_one_threshold (const data_set_t *ds,
     const value_list_t *vl,
     const threshold_t *th,
     const gauge_t *values,
+    int state_old,
     int *ret_ds_index)
 { /* {{{ */
   int ret = -1;
@@ -843,7 +1206,8 @@ static int ut_check_one_threshold (const data_set_t *ds,
   {
     int status;
 
-    status = ut_check_one_data_source (ds, vl, th, values_copy, i);
+    status = ut_check_one_data_source (ds, vl, th, values_copy, i,
+        state_old);
     if (ret < status)
     {
       ret = status;
@@ -861,49 +1225,49 @@ static int ut_check_one_threshold (const data_set_t *ds,
  * int ut_check_threshold
  *
  * Gets a list of matching thresholds and searches for the worst status by one
- * of the thresholds. Then reports that status using the ut_report_state
- * function above. 
- * Returns zero on success and if no threshold has been configured. Returns
- * less than zero on failure.
+ * of the thresholds. Then updates the entry's state using the ut_update_state
+ * function above. Called by the value cache for every update, while the
+ * entry is locked; see `uc_register_check'.
+ * Returns non-zero if ut_report_threshold has to send a notification.
  */
 static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
-    __attribute__((unused)) user_data_t *ud)
+    uc_check_t *check)
 { /* {{{ */
   threshold_t *th;
-  gauge_t *values;
+  unsigned int generation;
   int status;
 
   int worst_state = -1;
   threshold_t *worst_th = NULL;
   int worst_ds_index = -1;
 
-  if (threshold_tree == NULL)
-    return (0);
-
-  /* Is this lock really necessary? So far, thresholds are only inserted at
-   * startup. -octo */
+  /* Remember the search result with the entry, so it only needs to be
+   * repeated when thresholds have been added. */
   pthread_mutex_lock (&threshold_lock);
-  th = threshold_search (vl);
+  generation = threshold_generation;
+  if (check->threshold_generation != generation)
+  {
+    check->threshold = threshold_search (vl);
+    check->threshold_generation = generation;
+  }
   pthread_mutex_unlock (&threshold_lock);
+
+  th = check->threshold;
   if (th == NULL)
     return (0);
 
   DEBUG ("ut_check_threshold: Found matching threshold(s)");
 
-  values = uc_get_rate (ds, vl);
-  if (values == NULL)
-    return (0);
-
   while (th != NULL)
   {
     int ds_index = -1;
 
-    status = ut_check_one_threshold (ds, vl, th, values, &ds_index);
+    status = ut_check_one_threshold (ds, vl, th, check->rates, check->state,
+        &ds_index);
     if (status < 0)
     {
       ERROR ("ut_check_threshold: ut_check_one_threshold failed.");
-      sfree (values);
-      return (-1);
+      return (0);
     }
 
     if (worst_state < status)
@@ -916,19 +1280,40 @@ static int ut_check_threshold (const data_set_t *ds, const value_list_t *vl,
     th = th->next;
   } /* while (th) */
 
-  status = ut_report_state (ds, vl, worst_th, values,
-      worst_ds_index, worst_state);
+  check->report_state_old = check->state;
+  if (!ut_update_state (worst_th, worst_state, &check->state, &check->hits))
+    return (0);
+
+  check->report_state = worst_state;
+  check->report_ds_index = worst_ds_index;
+  check->report_data = worst_th;
+  return (1);
+} /* }}} int ut_check_threshold */
+
+/*
+ * int ut_report_threshold
+ *
+ * Sends the notification ut_check_threshold has decided on, after the value
+ * cache has released the entry.
+ */
+static int ut_report_threshold (const data_set_t *ds, const value_list_t *vl,
+    const uc_check_t *check)
+{ /* {{{ */
+  int status;
+
+  if (ut_group_report (ds, vl, check))
+    return (0);
+
+  status = ut_report_state (ds, vl, check->report_data, check->rates,
+      check->report_ds_index, check->report_state, check->report_state_old);
   if (status != 0)
   {
-    ERROR ("ut_check_threshold: ut_report_state failed.");
-    sfree (values);
+    ERROR ("ut_report_threshold: ut_report_state failed.");
     return (-1);
   }
 
-  sfree (values);
-
   return (0);
-} /* }}} int ut_check_threshold */
+} /* }}} int ut_report_threshold */
 
 /*
  * int ut_missing
@@ -947,7 +1332,7 @@ static int ut_missing (const value_list_t *vl,
   if (threshold_tree == NULL)
     return (0);
 
-  th = threshold_search (vl);
+  th = threshold_search_cached (vl);
   if (th == NULL)
     return (0);
 
@@ -973,10 +1358,11 @@ int ut_config (oconfig_item_t *ci)
 
   if (threshold_tree == NULL)
   {
-    threshold_tree = c_avl_create ((void *) strcmp);
+    threshold_tree = c_hashtable_create (c_hashtable_hash_string,
+        (void *) strcmp);
     if (threshold_tree == NULL)
     {
-      ERROR ("ut_config: c_avl_create failed.");
+      ERROR ("ut_config: c_hashtable_create failed.");
       return (-1);
     }
   }
@@ -1012,13 +1398,15 @@ int ut_config (oconfig_item_t *ci)
       break;
   }
 
-  if (c_avl_size (threshold_tree) > 0) {
+  if (c_hashtable_size (threshold_tree) > 0) {
     plugin_register_missing ("threshold", ut_missing,
         /* user data = */ NULL);
-    plugin_register_write ("threshold", ut_check_threshold,
-        /* user data = */ NULL);
+    uc_register_check (ut_check_threshold, ut_report_threshold);
   }
 
+  if (group_table != NULL)
+    plugin_register_read ("threshold", ut_group_flush);
+
   return (status);
 } /* }}} int um_config */
 
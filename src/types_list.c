@@ -25,6 +25,53 @@
 #include "plugin.h"
 #include "configfile.h"
 
+#include <sys/mman.h>
+
+/*
+ * The binary cache of a types.db file, see the `TypesDBCacheDir' option. It
+ * consists of a header, the data sets and all their data sources, in the
+ * host's byte order and structure layout. The cache is used if the size,
+ * modification time and inode of the text file are the same as when the
+ * cache was written.
+ */
+#define TYPES_CACHE_MAGIC   "collectd types cache"
+#define TYPES_CACHE_VERSION 1
+
+struct types_cache_header_s
+{
+  char     magic[24];
+  uint32_t version;
+  uint32_t data_set_size;
+  uint32_t data_source_size;
+  uint32_t data_sets_num;
+  uint32_t data_sources_num;
+  uint32_t pad;
+  uint64_t source_size;
+  uint64_t source_mtime;
+  uint64_t source_ino;
+  char     source[1024];
+};
+typedef struct types_cache_header_s types_cache_header_t;
+
+struct types_cache_entry_s
+{
+  char     type[DATA_MAX_NAME_LEN];
+  uint32_t ds_offset;
+  uint32_t ds_num;
+};
+typedef struct types_cache_entry_s types_cache_entry_t;
+
+/* Data sets parsed from a file, kept until the cache has been written. */
+struct types_parsed_s
+{
+  data_set_t **ds;
+  size_t ds_num;
+  size_t ds_size;
+  size_t sources_num;
+  _Bool failed;
+};
+typedef struct types_parsed_s types_parsed_t;
+
 static int parse_ds (data_source_t *dsrc, char *buf, size_t buf_len)
 {
   char *dummy;
@@ -91,7 +138,7 @@ static int parse_ds (data_source_t *dsrc, char *buf, size_t buf_len)
   return (0);
 } /* int parse_ds */
 
-static void parse_line (char *buf)
+static void parse_line (char *buf, types_parsed_t *parsed)
 {
   char  *fields[64];
   size_t fields_num;
@@ -130,11 +177,37 @@ static void parse_line (char *buf)
 
   plugin_register_data_set (ds);
 
+  if ((parsed != NULL) && !parsed->failed)
+  {
+    if (parsed->ds_num >= parsed->ds_size)
+    {
+      size_t size = (parsed->ds_size == 0) ? 64 : 2 * parsed->ds_size;
+      data_set_t **tmp;
+
+      tmp = realloc (parsed->ds, size * sizeof (*tmp));
+      if (tmp == NULL)
+	parsed->failed = 1;
+      else
+      {
+	parsed->ds = tmp;
+	parsed->ds_size = size;
+      }
+    }
+
+    if (!parsed->failed)
+    {
+      parsed->ds[parsed->ds_num] = ds;
+      parsed->ds_num++;
+      parsed->sources_num += ds->ds_num;
+      return;
+    }
+  }
+
   sfree (ds->ds);
   sfree (ds);
 } /* void parse_line */
 
-static void parse_file (FILE *fh)
+static void parse_file (FILE *fh, types_parsed_t *parsed)
 {
   char buf[4096];
   size_t buf_len;
@@ -165,17 +238,203 @@ static void parse_file (FILE *fh)
     if (buf_len == 0)
       continue;
 
-    parse_line (buf);
+    parse_line (buf, parsed);
   } /* while (fgets) */
 } /* void parse_file */
 
+/* FNV-1a of the file name, so that each types.db gets its own cache. */
+static void types_cache_file_name (char *buffer, size_t buffer_size, /* {{{ */
+    const char *dir, const char *file)
+{
+  uint32_t hash = 2166136261U;
+  const char *ptr;
+
+  for (ptr = file; *ptr != 0; ptr++)
+  {
+    hash ^= (uint32_t) ((unsigned char) *ptr);
+    hash *= 16777619U;
+  }
+
+  ssnprintf (buffer, buffer_size, "%s/types-%08"PRIx32".cache", dir, hash);
+} /* }}} void types_cache_file_name */
+
+static void types_cache_header_init (types_cache_header_t *h, /* {{{ */
+    const char *file, const struct stat *statbuf)
+{
+  memset (h, 0, sizeof (*h));
+  sstrncpy (h->magic, TYPES_CACHE_MAGIC, sizeof (h->magic));
+  h->version = TYPES_CACHE_VERSION;
+  h->data_set_size = (uint32_t) sizeof (types_cache_entry_t);
+  h->data_source_size = (uint32_t) sizeof (data_source_t);
+  h->source_size = (uint64_t) statbuf->st_size;
+  h->source_mtime = (uint64_t) statbuf->st_mtime;
+  h->source_ino = (uint64_t) statbuf->st_ino;
+  sstrncpy (h->source, file, sizeof (h->source));
+} /* }}} void types_cache_header_init */
+
+/* Registers the data sets from the cache. Returns zero if the cache was
+ * usable. */
+static int types_cache_read (const char *cache_file, /* {{{ */
+    const char *file, const struct stat *statbuf)
+{
+  types_cache_header_t expected;
+  const types_cache_header_t *h;
+  const types_cache_entry_t *entries;
+  const data_source_t *sources;
+  struct stat cache_stat;
+  size_t size;
+  void *map;
+  uint32_t i;
+  int fd;
+
+  fd = open (cache_file, O_RDONLY);
+  if (fd < 0)
+    return (-1);
+
+  if ((fstat (fd, &cache_stat) != 0)
+      || ((size_t) cache_stat.st_size < sizeof (*h)))
+  {
+    close (fd);
+    return (-1);
+  }
+  size = (size_t) cache_stat.st_size;
+
+  map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, /* offset = */ 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return (-1);
+
+  h = map;
+  types_cache_header_init (&expected, file, statbuf);
+  expected.data_sets_num = h->data_sets_num;
+  expected.data_sources_num = h->data_sources_num;
+  if ((memcmp (h, &expected, sizeof (expected)) != 0)
+      || (size != sizeof (*h)
+	+ h->data_sets_num * sizeof (*entries)
+	+ h->data_sources_num * sizeof (*sources)))
+  {
+    munmap (map, size);
+    return (-1);
+  }
+
+  entries = (const types_cache_entry_t *) (h + 1);
+  sources = (const data_source_t *) (entries + h->data_sets_num);
+
+  /* Validate everything first, so that a broken cache doesn't register
+   * some of the data sets twice. */
+  for (i = 0; i < h->data_sets_num; i++)
+  {
+    if ((entries[i].ds_num < 1)
+	|| (entries[i].ds_offset > h->data_sources_num)
+	|| (entries[i].ds_num > h->data_sources_num - entries[i].ds_offset)
+	|| (memchr (entries[i].type, 0, sizeof (entries[i].type)) == NULL))
+    {
+      munmap (map, size);
+      return (-1);
+    }
+  }
+
+  for (i = 0; i < h->data_sets_num; i++)
+  {
+    data_set_t ds;
+
+    memcpy (ds.type, entries[i].type, sizeof (ds.type));
+    ds.ds_num = (int) entries[i].ds_num;
+    /* plugin_register_data_set copies the data sources. */
+    ds.ds = (data_source_t *) (sources + entries[i].ds_offset);
+
+    plugin_register_data_set (&ds);
+  }
+
+  munmap (map, size);
+  return (0);
+} /* }}} int types_cache_read */
+
+static int types_cache_write (const char *cache_file, /* {{{ */
+    const char *file, const struct stat *statbuf,
+    const types_parsed_t *parsed)
+{
+  char tmp_file[PATH_MAX];
+  types_cache_header_t h;
+  uint32_t offset;
+  FILE *fh;
+  size_t i;
+  int fd;
+  int status = 0;
+
+  types_cache_header_init (&h, file, statbuf);
+  h.data_sets_num = (uint32_t) parsed->ds_num;
+  h.data_sources_num = (uint32_t) parsed->sources_num;
+
+  /* Write to a temporary file first, so that other instances never read a
+   * partial cache. */
+  ssnprintf (tmp_file, sizeof (tmp_file), "%s.XXXXXX", cache_file);
+  fd = mkstemp (tmp_file);
+  if (fd < 0)
+    return (-1);
+
+  fh = fdopen (fd, "w");
+  if (fh == NULL)
+  {
+    close (fd);
+    unlink (tmp_file);
+    return (-1);
+  }
+
+  if (fwrite (&h, sizeof (h), 1, fh) != 1)
+    status = -1;
+
+  offset = 0;
+  for (i = 0; (status == 0) && (i < parsed->ds_num); i++)
+  {
+    types_cache_entry_t e;
+
+    memset (&e, 0, sizeof (e));
+    sstrncpy (e.type, parsed->ds[i]->type, sizeof (e.type));
+    e.ds_offset = offset;
+    e.ds_num = (uint32_t) parsed->ds[i]->ds_num;
+    offset += e.ds_num;
+
+    if (fwrite (&e, sizeof (e), 1, fh) != 1)
+      status = -1;
+  }
+
+  for (i = 0; (status == 0) && (i < parsed->ds_num); i++)
+  {
+    if (fwrite (parsed->ds[i]->ds, sizeof (data_source_t),
+	  (size_t) parsed->ds[i]->ds_num, fh)
+	!= (size_t) parsed->ds[i]->ds_num)
+      status = -1;
+  }
+
+  if (fclose (fh) != 0)
+    status = -1;
+
+  if ((status == 0) && (rename (tmp_file, cache_file) != 0))
+    status = -1;
+
+  if (status != 0)
+    unlink (tmp_file);
+
+  return (status);
+} /* }}} int types_cache_write */
+
 int read_types_list (const char *file)
 {
+  const char *cache_dir;
+  char cache_file[PATH_MAX];
+  struct stat statbuf;
+  types_parsed_t parsed;
   FILE *fh;
+  size_t i;
 
   if (file == NULL)
     return (-1);
 
+  cache_dir = global_option_get ("TypesDBCacheDir");
+  if ((cache_dir != NULL) && (cache_dir[0] == 0))
+    cache_dir = NULL;
+
   fh = fopen (file, "r");
   if (fh == NULL)
   {
@@ -187,13 +446,48 @@ int read_types_list (const char *file)
     return (-1);
   }
 
-  parse_file (fh);
+  if ((cache_dir != NULL) && (fstat (fileno (fh), &statbuf) != 0))
+    cache_dir = NULL;
+
+  if (cache_dir == NULL)
+  {
+    parse_file (fh, /* parsed = */ NULL);
+    fclose (fh);
+
+    DEBUG ("Done parsing `%s'", file);
+    return (0);
+  }
+
+  types_cache_file_name (cache_file, sizeof (cache_file), cache_dir, file);
+  if (types_cache_read (cache_file, file, &statbuf) == 0)
+  {
+    fclose (fh);
+    DEBUG ("Read `%s' from the cache `%s'", file, cache_file);
+    return (0);
+  }
 
+  memset (&parsed, 0, sizeof (parsed));
+  parse_file (fh, &parsed);
   fclose (fh);
   fh = NULL;
 
   DEBUG ("Done parsing `%s'", file);
 
+  if (!parsed.failed
+      && (types_cache_write (cache_file, file, &statbuf, &parsed) != 0))
+  {
+    char errbuf[1024];
+    WARNING ("Writing the types cache `%s' failed: %s",
+	cache_file, sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  for (i = 0; i < parsed.ds_num; i++)
+  {
+    sfree (parsed.ds[i]->ds);
+    sfree (parsed.ds[i]);
+  }
+  sfree (parsed.ds);
+
   return (0);
 } /* int read_types_list */
 
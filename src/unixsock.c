@@ -23,10 +23,14 @@
 #include "common.h"
 #include "plugin.h"
 #include "configfile.h"
+#include "utils_handoff.h"
 
+#include "utils_cmd_filterstats.h"
 #include "utils_cmd_flush.h"
+#include "utils_cmd_getrange.h"
 #include "utils_cmd_getval.h"
 #include "utils_cmd_listval.h"
+#include "utils_cmd_putbin.h"
 #include "utils_cmd_putval.h"
 #include "utils_cmd_putnotif.h"
 
@@ -36,6 +40,11 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/un.h>
+#include <arpa/inet.h>
+
+#if HAVE_POLL_H
+# include <poll.h>
+#endif
 
 #include <grp.h>
 
@@ -44,6 +53,40 @@
 #endif
 
 #define US_DEFAULT_PATH LOCALSTATEDIR"/run/"PACKAGE_NAME"-unixsock"
+#define US_BUFFER_SIZE 1024
+/* Largest packet accepted in binary mode, see us_handle_frame. */
+#define US_FRAME_SIZE_MAX 65536
+#define US_FRAME_HEADER_SIZE 4
+#define US_DEFAULT_WORKERS 4
+#define US_DEFAULT_MAX_CONNECTIONS 64
+
+/*
+ * Private data structures
+ */
+/* A client connection. It is either polled by the server thread, waiting in
+ * `queue_head' for a worker, being served by a worker or handed back to the
+ * server thread via `idle_list'. Only the current owner touches it.
+ *
+ * Workers write the responses to `fhout', a memory stream, and the server
+ * thread sends them without blocking. A client which doesn't read its
+ * responses therefore only keeps its own connection waiting, not a worker. */
+struct us_conn_s
+{
+	int   fd;
+	FILE *fhout; /* only while a worker is executing commands */
+	char  *out;  /* responses which haven't been sent yet */
+	size_t out_len;
+	size_t out_pos;
+	/* US_BUFFER_SIZE bytes, enlarged when switching to binary mode */
+	char  *buffer;
+	size_t buffer_size;
+	size_t buffer_fill;
+	_Bool eof;
+	_Bool binary; /* frames instead of lines, see us_handle_binary */
+	putval_batch_t *batch; /* created on the first PUTVAL-BATCH command */
+	struct us_conn_s *next;
+};
+typedef struct us_conn_s us_conn_t;
 
 /*
  * Private variables
@@ -54,7 +97,9 @@ static const char *config_keys[] =
 	"SocketFile",
 	"SocketGroup",
 	"SocketPerms",
-	"DeleteSocket"
+	"DeleteSocket",
+	"WorkerThreads",
+	"MaxConnections"
 };
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
@@ -69,6 +114,23 @@ static _Bool delete_socket = 0;
 
 static pthread_t listen_thread = (pthread_t) 0;
 
+/* worker pool */
+static int        workers_num = US_DEFAULT_WORKERS;
+static pthread_t *workers = NULL;
+static int        workers_started = 0;
+static int        workers_loop = 0;
+static int        max_conns = US_DEFAULT_MAX_CONNECTIONS;
+static int        conns_num = 0;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+static us_conn_t *queue_head = NULL;
+static us_conn_t *queue_tail = NULL;
+static us_conn_t *idle_list  = NULL;
+
+/* Written to whenever the server thread has to re-evaluate its poll set. */
+static int wakeup_pipe[2] = { -1, -1 };
+
 /*
  * Functions
  */
@@ -77,6 +139,22 @@ static int us_open_socket (void)
 	struct sockaddr_un sa;
 	int status;
 
+	memset (&sa, '\0', sizeof (sa));
+	sa.sun_family = AF_UNIX;
+	sstrncpy (sa.sun_path, (sock_file != NULL) ? sock_file : US_DEFAULT_PATH,
+			sizeof (sa.sun_path));
+
+	DEBUG ("unixsock plugin: socket path = %s", sa.sun_path);
+
+	/* Passed on by the previous daemon, see utils_handoff.h. Its file
+	 * must not be deleted, or nobody could connect anymore. */
+	sock_fd = handoff_take ((struct sockaddr *) &sa, sizeof (sa), SOCK_STREAM);
+	if (sock_fd >= 0)
+	{
+		handoff_export (sock_fd);
+		return (0);
+	}
+
 	sock_fd = socket (PF_UNIX, SOCK_STREAM, 0);
 	if (sock_fd < 0)
 	{
@@ -86,13 +164,6 @@ static int us_open_socket (void)
 		return (-1);
 	}
 
-	memset (&sa, '\0', sizeof (sa));
-	sa.sun_family = AF_UNIX;
-	sstrncpy (sa.sun_path, (sock_file != NULL) ? sock_file : US_DEFAULT_PATH,
-			sizeof (sa.sun_path));
-
-	DEBUG ("unixsock plugin: socket path = %s", sa.sun_path);
-
 	if (delete_socket)
 	{
 		errno = 0;
@@ -171,160 +242,554 @@ static int us_open_socket (void)
 		}
 	} while (0);
 
+	handoff_export (sock_fd);
 	return (0);
 } /* int us_open_socket */
 
-static void *us_handle_client (void *arg)
+static void us_wakeup (void)
+{
+	char c = 0;
+
+	if (wakeup_pipe[1] < 0)
+		return;
+
+	/* If the pipe is full, the server thread will wake up anyway. */
+	if (write (wakeup_pipe[1], &c, sizeof (c)) < 0)
+		DEBUG ("unixsock plugin: Writing to the wakeup pipe failed.");
+} /* void us_wakeup */
+
+/* Returns the length of the first complete line in the connection's input
+ * buffer, including the newline, or zero if there is none yet. A full buffer
+ * and the rest of the input at end-of-file count as a line, too, just like
+ * fgets(3) would return them. */
+static size_t us_line_length (const us_conn_t *conn)
+{
+	char *newline;
+	size_t len;
+
+	if (conn->buffer_fill == 0)
+		return (0);
+
+	/* The buffer is larger after binary mode has been used. */
+	len = conn->buffer_fill;
+	if (len > US_BUFFER_SIZE - 1)
+		len = US_BUFFER_SIZE - 1;
+
+	newline = memchr (conn->buffer, '\n', len);
+	if (newline != NULL)
+		return ((size_t) (newline - conn->buffer) + 1);
+
+	if ((len >= US_BUFFER_SIZE - 1) || conn->eof)
+		return (len);
+
+	return (0);
+} /* size_t us_line_length */
+
+/* Returns the length of the first complete frame in the connection's input
+ * buffer, including its header, or zero if there is none yet. Invalid and, at
+ * end-of-file, truncated frames are returned as a whole, so that
+ * us_handle_frame reports them. */
+static size_t us_frame_length (const us_conn_t *conn)
 {
-	int fdin;
-	int fdout;
-	FILE *fhin, *fhout;
+	uint32_t len;
+
+	if (conn->buffer_fill < US_FRAME_HEADER_SIZE)
+		return (conn->eof ? conn->buffer_fill : 0);
+
+	memcpy (&len, conn->buffer, sizeof (len));
+	len = ntohl (len);
+	if (len > US_FRAME_SIZE_MAX)
+		return (conn->buffer_fill);
 
-	fdin = *((int *) arg);
-	free (arg);
-	arg = NULL;
+	if (conn->buffer_fill >= US_FRAME_HEADER_SIZE + (size_t) len)
+		return (US_FRAME_HEADER_SIZE + (size_t) len);
 
-	DEBUG ("unixsock plugin: us_handle_client: Reading from fd #%i", fdin);
+	return (conn->eof ? conn->buffer_fill : 0);
+} /* size_t us_frame_length */
 
-	fdout = dup (fdin);
-	if (fdout < 0)
+/* Returns the length of the next command, a line or a frame. */
+static size_t us_request_length (const us_conn_t *conn)
+{
+	if (conn->binary)
+		return (us_frame_length (conn));
+	return (us_line_length (conn));
+} /* size_t us_request_length */
+
+static us_conn_t *us_conn_create (int fd)
+{
+	us_conn_t *conn;
+
+	conn = (us_conn_t *) malloc (sizeof (*conn));
+	if (conn == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: dup failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		pthread_exit ((void *) 1);
+		ERROR ("unixsock plugin: malloc failed.");
+		close (fd);
+		return (NULL);
 	}
+	memset (conn, 0, sizeof (*conn));
+	conn->fd = fd;
 
-	fhin  = fdopen (fdin, "r");
-	if (fhin == NULL)
+	conn->buffer_size = US_BUFFER_SIZE;
+	conn->buffer = malloc (conn->buffer_size);
+	if (conn->buffer == NULL)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		close (fdin);
-		close (fdout);
-		pthread_exit ((void *) 1);
+		ERROR ("unixsock plugin: malloc failed.");
+		close (fd);
+		sfree (conn);
+		return (NULL);
 	}
 
-	fhout = fdopen (fdout, "w");
-	if (fhout == NULL)
+	pthread_mutex_lock (&queue_lock);
+	conns_num++;
+	pthread_mutex_unlock (&queue_lock);
+
+	return (conn);
+} /* us_conn_t *us_conn_create */
+
+static void us_conn_destroy (us_conn_t *conn)
+{
+	if (conn == NULL)
+		return;
+
+	DEBUG ("unixsock plugin: Closing connection on fd #%i", conn->fd);
+
+	if (conn->fhout != NULL)
+		fclose (conn->fhout);
+	sfree (conn->out);
+	close (conn->fd);
+	putval_batch_destroy (conn->batch);
+	sfree (conn->buffer);
+	sfree (conn);
+
+	pthread_mutex_lock (&queue_lock);
+	conns_num--;
+	pthread_mutex_unlock (&queue_lock);
+
+	/* The server thread may be waiting for a free connection slot. */
+	us_wakeup ();
+} /* void us_conn_destroy */
+
+/* Implements the "BINARY" command: the client sends frames from now on, each
+ * a 32 bit length in network byte order followed by a packet in the network
+ * plugin's format, see utils_cmd_putbin.h. Each frame gets a response line.
+ * A frame of length zero switches back to text mode. */
+static int us_handle_binary (us_conn_t *conn)
+{
+	size_t size = US_FRAME_HEADER_SIZE + US_FRAME_SIZE_MAX + 1;
+
+	if (conn->buffer_size < size)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: fdopen failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin); /* this closes fdin as well */
-		close (fdout);
-		pthread_exit ((void *) 1);
+		char *tmp;
+
+		tmp = realloc (conn->buffer, size);
+		if (tmp == NULL)
+		{
+			fprintf (conn->fhout, "-1 realloc failed.\n");
+			return (0);
+		}
+		conn->buffer = tmp;
+		conn->buffer_size = size;
 	}
 
-	/* change output buffer to line buffered mode */
-	if (setvbuf (fhout, NULL, _IOLBF, 0) != 0)
+	conn->binary = 1;
+	fprintf (conn->fhout, "0 Binary mode enabled.\n");
+	return (0);
+} /* int us_handle_binary */
+
+/* Dispatches the values of one frame of `len' bytes at the beginning of the
+ * input buffer. Returns non-zero if the connection should be closed. */
+static int us_handle_frame (us_conn_t *conn, size_t len)
+{
+	uint32_t packet_len = 0;
+
+	if (len >= US_FRAME_HEADER_SIZE)
 	{
-		char errbuf[1024];
-		ERROR ("unixsock plugin: setvbuf failed: %s",
-				sstrerror (errno, errbuf, sizeof (errbuf)));
-		fclose (fhin);
-		fclose (fhout);
-		pthread_exit ((void *) 1);
+		memcpy (&packet_len, conn->buffer, sizeof (packet_len));
+		packet_len = ntohl (packet_len);
 	}
 
-	while (42)
+	/* The stream can't be resynchronized after an invalid frame. */
+	if ((len < US_FRAME_HEADER_SIZE) || (packet_len > US_FRAME_SIZE_MAX))
+	{
+		fprintf (conn->fhout, "-1 Invalid frame header.\n");
+		return (-1);
+	}
+	else if (len < US_FRAME_HEADER_SIZE + (size_t) packet_len)
 	{
-		char buffer[1024];
-		char buffer_copy[1024];
-		char *fields[128];
-		int   fields_num;
-		int   len;
+		fprintf (conn->fhout, "-1 Truncated frame.\n");
+		return (-1);
+	}
 
-		errno = 0;
-		if (fgets (buffer, sizeof (buffer), fhin) == NULL)
-		{
-			if (errno != 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to read from socket #%i: %s",
-						fileno (fhin),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-			}
-			break;
-		}
+	if (packet_len == 0)
+	{
+		conn->binary = 0;
+		fprintf (conn->fhout, "0 Text mode enabled.\n");
+		return (0);
+	}
 
-		len = strlen (buffer);
-		while ((len > 0)
-				&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
-			buffer[--len] = '\0';
+	return (handle_putbin (conn->fhout,
+				conn->buffer + US_FRAME_HEADER_SIZE, packet_len));
+} /* int us_handle_frame */
 
-		if (len == 0)
-			continue;
+/* Executes one command. Returns non-zero if the connection should be closed. */
+static int us_handle_line (us_conn_t *conn, char *buffer)
+{
+	char buffer_copy[US_BUFFER_SIZE];
+	char *fields[128];
+	int   fields_num;
+	int   len;
+	FILE *fhout = conn->fhout;
+
+	len = strlen (buffer);
+	while ((len > 0)
+			&& ((buffer[len - 1] == '\n') || (buffer[len - 1] == '\r')))
+		buffer[--len] = '\0';
+
+	if (len == 0)
+		return (0);
 
-		sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
+	sstrncpy (buffer_copy, buffer, sizeof (buffer_copy));
 
-		fields_num = strsplit (buffer_copy, fields,
-				sizeof (fields) / sizeof (fields[0]));
-		if (fields_num < 1)
+	fields_num = strsplit (buffer_copy, fields,
+			sizeof (fields) / sizeof (fields[0]));
+	if (fields_num < 1)
+	{
+		fprintf (fhout, "-1 Internal error\n");
+		return (-1);
+	}
+
+	/* Inside a PUTVAL-BATCH block, all lines belong to the block. */
+	if (putval_batch_pending (conn->batch)
+			|| (strcasecmp (fields[0], "putval-batch") == 0))
+	{
+		if (conn->batch == NULL)
+			conn->batch = putval_batch_create ();
+		if (conn->batch == NULL)
 		{
-			fprintf (fhout, "-1 Internal error\n");
-			fclose (fhin);
-			fclose (fhout);
-			pthread_exit ((void *) 1);
+			fprintf (fhout, "-1 malloc failed.\n");
+			return (-1);
 		}
-
-		if (strcasecmp (fields[0], "getval") == 0)
+		handle_putval_batch (fhout, buffer, conn->batch);
+	}
+	else if (strcasecmp (fields[0], "getval") == 0)
+	{
+		handle_getval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "getrange") == 0)
+	{
+		handle_getrange (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "mgetval") == 0)
+	{
+		handle_mgetval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putval") == 0)
+	{
+		handle_putval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "listval") == 0)
+	{
+		handle_listval (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "putnotif") == 0)
+	{
+		handle_putnotif (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "flush") == 0)
+	{
+		handle_flush (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "filterstats") == 0)
+	{
+		handle_filterstats (fhout, buffer);
+	}
+	else if (strcasecmp (fields[0], "binary") == 0)
+	{
+		us_handle_binary (conn);
+	}
+	else
+	{
+		if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
 		{
-			handle_getval (fhout, buffer);
+			char errbuf[1024];
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					conn->fd,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "putval") == 0)
+	}
+
+	return (0);
+} /* int us_handle_line */
+
+/* Executes all complete commands in the connection's input buffer and
+ * collects the responses in `conn->out'. Returns non-zero if the connection
+ * should be closed once the responses have been sent. */
+static int us_handle_client (us_conn_t *conn)
+{
+	size_t len;
+	int status = 0;
+
+	sfree (conn->out);
+	conn->out_len = 0;
+	conn->out_pos = 0;
+	conn->fhout = open_memstream (&conn->out, &conn->out_len);
+	if (conn->fhout == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: open_memstream failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	while ((len = us_request_length (conn)) > 0)
+	{
+		char buffer[US_BUFFER_SIZE];
+
+		if (conn->binary)
 		{
-			handle_putval (fhout, buffer);
+			status = us_handle_frame (conn, len);
+
+			conn->buffer_fill -= len;
+			memmove (conn->buffer, conn->buffer + len, conn->buffer_fill);
 		}
-		else if (strcasecmp (fields[0], "listval") == 0)
+		else
 		{
-			handle_listval (fhout, buffer);
+			memcpy (buffer, conn->buffer, len);
+			buffer[len] = '\0';
+
+			conn->buffer_fill -= len;
+			memmove (conn->buffer, conn->buffer + len, conn->buffer_fill);
+
+			status = us_handle_line (conn, buffer);
 		}
-		else if (strcasecmp (fields[0], "putnotif") == 0)
+
+		if (status != 0)
+			break;
+	}
+
+	if (fclose (conn->fhout) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: Buffering the responses for socket #%i "
+				"failed: %s", conn->fd,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (conn->out);
+		conn->out_len = 0;
+		status = -1;
+	}
+	conn->fhout = NULL;
+
+	return (status);
+} /* int us_handle_client */
+
+/* Sends as much of the pending responses as possible without blocking.
+ * Returns less than zero on error, zero once everything has been sent and
+ * greater than zero if some responses are left. */
+static int us_write_client (us_conn_t *conn)
+{
+	while (conn->out_pos < conn->out_len)
+	{
+		ssize_t status;
+
+		status = send (conn->fd, conn->out + conn->out_pos,
+				conn->out_len - conn->out_pos, MSG_DONTWAIT);
+		if (status < 0)
 		{
-			handle_putnotif (fhout, buffer);
+			char errbuf[1024];
+
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return (1);
+			if (errno == EINTR)
+				continue;
+
+			WARNING ("unixsock plugin: failed to write to socket #%i: %s",
+					conn->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
 		}
-		else if (strcasecmp (fields[0], "flush") == 0)
+		conn->out_pos += (size_t) status;
+	}
+
+	sfree (conn->out);
+	conn->out_len = 0;
+	conn->out_pos = 0;
+	return (0);
+} /* int us_write_client */
+
+static void *us_worker_thread (void __attribute__((unused)) *arg)
+{
+	int status;
+
+	pthread_mutex_lock (&queue_lock);
+	while (42)
+	{
+		us_conn_t *conn;
+
+		while ((queue_head == NULL) && (workers_loop != 0))
+			pthread_cond_wait (&queue_cond, &queue_lock);
+
+		if (workers_loop == 0)
+			break;
+
+		conn = queue_head;
+		queue_head = conn->next;
+		if (queue_head == NULL)
+			queue_tail = NULL;
+		conn->next = NULL;
+		pthread_mutex_unlock (&queue_lock);
+
+		/* Close the connection once the responses have been sent. */
+		if (us_handle_client (conn) != 0)
+			conn->eof = 1;
+
+		status = us_write_client (conn);
+		if ((status < 0) || ((status == 0) && conn->eof))
 		{
-			handle_flush (fhout, buffer);
+			us_conn_destroy (conn);
 		}
 		else
 		{
-			if (fprintf (fhout, "-1 Unknown command: %s\n", fields[0]) < 0)
-			{
-				char errbuf[1024];
-				WARNING ("unixsock plugin: failed to write to socket #%i: %s",
-						fileno (fhout),
-						sstrerror (errno, errbuf, sizeof (errbuf)));
-				break;
-			}
+			/* Hand the connection back to the server thread. */
+			pthread_mutex_lock (&queue_lock);
+			conn->next = idle_list;
+			idle_list = conn;
+			pthread_mutex_unlock (&queue_lock);
+			us_wakeup ();
 		}
-	} /* while (fgets) */
 
-	DEBUG ("unixsock plugin: us_handle_client: Exiting..");
-	fclose (fhin);
-	fclose (fhout);
+		pthread_mutex_lock (&queue_lock);
+	} /* while (42) */
+	pthread_mutex_unlock (&queue_lock);
 
-	pthread_exit ((void *) 0);
 	return ((void *) 0);
-} /* void *us_handle_client */
+} /* void *us_worker_thread */
+
+static void us_enqueue (us_conn_t *conn)
+{
+	pthread_mutex_lock (&queue_lock);
+	conn->next = NULL;
+	if (queue_tail == NULL)
+		queue_head = conn;
+	else
+		queue_tail->next = conn;
+	queue_tail = conn;
+	pthread_cond_signal (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
+} /* void us_enqueue */
+
+/* Reads whatever is available from the connection without blocking. Returns
+ * non-zero if the connection should be handed to a worker thread. */
+static int us_read_client (us_conn_t *conn)
+{
+	ssize_t status;
+
+	status = recv (conn->fd, conn->buffer + conn->buffer_fill,
+			conn->buffer_size - 1 - conn->buffer_fill, MSG_DONTWAIT);
+	if (status < 0)
+	{
+		char errbuf[1024];
+
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+			return (0);
+
+		WARNING ("unixsock plugin: failed to read from socket #%i: %s",
+				conn->fd, sstrerror (errno, errbuf, sizeof (errbuf)));
+		conn->eof = 1;
+	}
+	else if (status == 0)
+	{
+		conn->eof = 1;
+	}
+	else
+	{
+		conn->buffer_fill += (size_t) status;
+	}
+
+	return (conn->eof || (us_request_length (conn) > 0));
+} /* int us_read_client */
 
 static void *us_server_thread (void __attribute__((unused)) *arg)
 {
+	us_conn_t **conns = NULL;
+	size_t conns_size = 0;
+	size_t polled_num = 0;
+	struct pollfd *pfd = NULL;
 	int  status;
-	int *remote_fd;
-	pthread_t th;
-	pthread_attr_t th_attr;
-
-	if (us_open_socket () != 0)
-		pthread_exit ((void *) 1);
+	size_t i;
 
 	while (loop != 0)
 	{
-		DEBUG ("unixsock plugin: Calling accept..");
-		status = accept (sock_fd, NULL, NULL);
+		us_conn_t *idle;
+		_Bool accept_more;
+
+		/* Take back the connections the workers are done with. */
+		pthread_mutex_lock (&queue_lock);
+		idle = idle_list;
+		idle_list = NULL;
+		accept_more = ((max_conns <= 0) || (conns_num < max_conns));
+		pthread_mutex_unlock (&queue_lock);
+
+		while (idle != NULL)
+		{
+			us_conn_t *next = idle->next;
+
+			if (polled_num >= conns_size)
+			{
+				us_conn_t **tmp_conns;
+				struct pollfd *tmp_pfd;
+				size_t size = (conns_size == 0) ? 16 : (2 * conns_size);
+
+				tmp_conns = realloc (conns, size * sizeof (*conns));
+				if (tmp_conns != NULL)
+					conns = tmp_conns;
+				tmp_pfd = realloc (pfd, (size + 2) * sizeof (*pfd));
+				if (tmp_pfd != NULL)
+					pfd = tmp_pfd;
+				if ((tmp_conns == NULL) || (tmp_pfd == NULL))
+				{
+					ERROR ("unixsock plugin: realloc failed.");
+					us_conn_destroy (idle);
+					idle = next;
+					continue;
+				}
+				conns_size = size;
+			}
+
+			idle->next = NULL;
+			conns[polled_num] = idle;
+			polled_num++;
+			idle = next;
+		}
+
+		if (pfd == NULL)
+		{
+			pfd = malloc (2 * sizeof (*pfd));
+			if (pfd == NULL)
+			{
+				ERROR ("unixsock plugin: malloc failed.");
+				break;
+			}
+		}
+
+		/* Stop accepting new connections while the limit is reached. They
+		 * will wait in the listen backlog until a slot becomes free. */
+		pfd[0].fd = accept_more ? sock_fd : -1;
+		pfd[0].events = POLLIN;
+		pfd[0].revents = 0;
+		pfd[1].fd = wakeup_pipe[0];
+		pfd[1].events = POLLIN;
+		pfd[1].revents = 0;
+		/* Connections with pending responses are not read from until
+		 * the client has received them. */
+		for (i = 0; i < polled_num; i++)
+		{
+			pfd[i + 2].fd = conns[i]->fd;
+			pfd[i + 2].events = (conns[i]->out_pos < conns[i]->out_len)
+				? POLLOUT : POLLIN;
+			pfd[i + 2].revents = 0;
+		}
+
+		status = poll (pfd, (nfds_t) (polled_num + 2), /* timeout = */ -1);
 		if (status < 0)
 		{
 			char errbuf[1024];
@@ -332,45 +797,105 @@ static void *us_server_thread (void __attribute__((unused)) *arg)
 			if (errno == EINTR)
 				continue;
 
-			ERROR ("unixsock plugin: accept failed: %s",
+			ERROR ("unixsock plugin: poll failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (sock_fd);
-			sock_fd = -1;
-			pthread_exit ((void *) 1);
+			break;
 		}
 
-		remote_fd = (int *) malloc (sizeof (int));
-		if (remote_fd == NULL)
+		if (pfd[1].revents != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: malloc failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (status);
-			continue;
+			char buffer[64];
+			/* Errors are ignored, the pipe is only used for waking up. */
+			if (read (wakeup_pipe[0], buffer, sizeof (buffer)) < 0)
+				DEBUG ("unixsock plugin: Reading the wakeup pipe failed.");
 		}
-		*remote_fd = status;
 
-		DEBUG ("Spawning child to handle connection on fd #%i", *remote_fd);
+		/* Hand every connection with a complete command to a worker. The
+		 * order of `conns' does not matter, so the last entry is moved into
+		 * the gap. Iterate backwards, so moved entries have been looked at
+		 * already. */
+		for (i = polled_num; i > 0; i--)
+		{
+			us_conn_t *conn = conns[i - 1];
 
-		pthread_attr_init (&th_attr);
-		pthread_attr_setdetachstate (&th_attr, PTHREAD_CREATE_DETACHED);
+			if (pfd[i + 1].revents == 0)
+				continue;
 
-		status = pthread_create (&th, &th_attr, us_handle_client, (void *) remote_fd);
-		if (status != 0)
+			if (conn->out_pos < conn->out_len)
+			{
+				status = us_write_client (conn);
+				if (status > 0)
+					continue;
+				if ((status == 0) && !conn->eof)
+					continue;
+
+				/* Error, or the responses before closing have been
+				 * sent. */
+				conns[i - 1] = conns[polled_num - 1];
+				polled_num--;
+				us_conn_destroy (conn);
+				continue;
+			}
+
+			if (us_read_client (conn) == 0)
+				continue;
+
+			conns[i - 1] = conns[polled_num - 1];
+			polled_num--;
+
+			if (us_request_length (conn) > 0)
+				us_enqueue (conn);
+			else /* end of file and nothing left to do */
+				us_conn_destroy (conn);
+		}
+
+		if (pfd[0].revents != 0)
 		{
-			char errbuf[1024];
-			WARNING ("unixsock plugin: pthread_create failed: %s",
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-			close (*remote_fd);
-			free (remote_fd);
-			continue;
+			us_conn_t *conn;
+
+			DEBUG ("unixsock plugin: Calling accept..");
+			status = accept (sock_fd, NULL, NULL);
+			if (status < 0)
+			{
+				char errbuf[1024];
+
+				if ((errno == EINTR) || (errno == EAGAIN)
+						|| (errno == EWOULDBLOCK) || (errno == ECONNABORTED))
+					continue;
+
+				ERROR ("unixsock plugin: accept failed: %s",
+						sstrerror (errno, errbuf, sizeof (errbuf)));
+				break;
+			}
+
+			DEBUG ("unixsock plugin: Accepted connection on fd #%i", status);
+
+			conn = us_conn_create (status);
+			if (conn == NULL)
+				continue;
+
+			/* Let the next iteration add it to the poll set. */
+			pthread_mutex_lock (&queue_lock);
+			conn->next = idle_list;
+			idle_list = conn;
+			pthread_mutex_unlock (&queue_lock);
 		}
 	} /* while (loop) */
 
+	for (i = 0; i < polled_num; i++)
+		us_conn_destroy (conns[i]);
+	sfree (conns);
+	sfree (pfd);
+
+	/* collectdmon passes the socket on to the next daemon. */
+	if (handoff_is_shared (sock_fd))
+		status = 0;
+	else
+		status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
+
 	close (sock_fd);
 	sock_fd = -1;
 
-	status = unlink ((sock_file != NULL) ? sock_file : US_DEFAULT_PATH);
 	if (status != 0)
 	{
 		char errbuf[1024];
@@ -413,6 +938,21 @@ static int us_config (const char *key, const char *val)
 		else
 			delete_socket = 0;
 	}
+	else if (strcasecmp (key, "WorkerThreads") == 0)
+	{
+		int tmp = atoi (val);
+		if (tmp < 1)
+		{
+			WARNING ("unixsock plugin: WorkerThreads must be positive.");
+			return (1);
+		}
+		workers_num = tmp;
+	}
+	else if (strcasecmp (key, "MaxConnections") == 0)
+	{
+		/* zero or less means unlimited */
+		max_conns = atoi (val);
+	}
 	else
 	{
 		return (-1);
@@ -432,6 +972,44 @@ static int us_init (void)
 		return (0);
 	have_init = 1;
 
+	/* The socket is opened before `handoff_complete' is called, see
+	 * utils_handoff.h. */
+	if (us_open_socket () != 0)
+		return (-1);
+
+	if (pipe (wakeup_pipe) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("unixsock plugin: pipe failed: %s",
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (wakeup_pipe[0], F_SETFL, fcntl (wakeup_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (wakeup_pipe[1], F_SETFL, fcntl (wakeup_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	workers = calloc ((size_t) workers_num, sizeof (*workers));
+	if (workers == NULL)
+	{
+		ERROR ("unixsock plugin: calloc failed.");
+		return (-1);
+	}
+
+	workers_loop = 1;
+	for (workers_started = 0; workers_started < workers_num; workers_started++)
+	{
+		status = pthread_create (workers + workers_started, NULL,
+				us_worker_thread, NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("unixsock plugin: pthread_create failed: %s",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			break;
+		}
+	}
+	if (workers_started == 0)
+		return (-1);
+
 	loop = 1;
 
 	status = pthread_create (&listen_thread, NULL, us_server_thread, NULL);
@@ -449,16 +1027,51 @@ static int us_init (void)
 static int us_shutdown (void)
 {
 	void *ret;
+	int i;
 
 	loop = 0;
 
 	if (listen_thread != (pthread_t) 0)
 	{
+		us_wakeup ();
 		pthread_kill (listen_thread, SIGTERM);
 		pthread_join (listen_thread, &ret);
 		listen_thread = (pthread_t) 0;
 	}
 
+	pthread_mutex_lock (&queue_lock);
+	workers_loop = 0;
+	pthread_cond_broadcast (&queue_cond);
+	pthread_mutex_unlock (&queue_lock);
+
+	for (i = 0; i < workers_started; i++)
+		pthread_join (workers[i], &ret);
+	sfree (workers);
+	workers_started = 0;
+
+	/* Connections that were waiting for or returned by a worker. */
+	while (queue_head != NULL)
+	{
+		us_conn_t *next = queue_head->next;
+		us_conn_destroy (queue_head);
+		queue_head = next;
+	}
+	queue_tail = NULL;
+	while (idle_list != NULL)
+	{
+		us_conn_t *next = idle_list->next;
+		us_conn_destroy (idle_list);
+		idle_list = next;
+	}
+
+	if (wakeup_pipe[0] >= 0)
+	{
+		close (wakeup_pipe[0]);
+		close (wakeup_pipe[1]);
+		wakeup_pipe[0] = -1;
+		wakeup_pipe[1] = -1;
+	}
+
 	plugin_unregister_init ("unixsock");
 	plugin_unregister_shutdown ("unixsock");
 
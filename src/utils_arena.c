@@ -0,0 +1,258 @@
+/**
+ * collectd - src/utils_arena.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_arena.h"
+#include "utils_memory.h"
+
+#include <pthread.h>
+
+/* Larger allocations get a block of their own, which is freed again by the
+ * next release. */
+#define ARENA_BLOCK_SIZE 16384
+/* Number of unused blocks kept for the next dispatch. */
+#define ARENA_SPARE_BLOCKS 2
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(n) (((n) + (ARENA_ALIGN - 1)) & ~((size_t) ARENA_ALIGN - 1))
+
+#define ARENA_POISON 0xa5
+
+struct arena_block_s
+{
+	struct arena_block_s *next;
+	size_t size;
+};
+typedef struct arena_block_s arena_block_t;
+
+#define ARENA_HEADER_SIZE ARENA_ALIGN_UP (sizeof (arena_block_t))
+#define ARENA_BLOCK_DATA(b) (((char *) (b)) + ARENA_HEADER_SIZE)
+
+/* The blocks of one thread. Blocks up to `current' are in use, up to `used'
+ * bytes of `current'; the ones after it are spare. `current' is NULL if
+ * nothing is in use. */
+struct arena_s
+{
+	arena_block_t *head;
+	arena_block_t *current;
+	size_t used;
+};
+typedef struct arena_s arena_t;
+
+static pthread_key_t arena_key;
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+static mem_account_t *arena_mem = NULL;
+
+static void arena_block_free (arena_block_t *b) /* {{{ */
+{
+	mem_account_add (arena_mem, -((int64_t) (ARENA_HEADER_SIZE + b->size)));
+	free (b);
+} /* }}} void arena_block_free */
+
+static void arena_destroy (void *arg) /* {{{ */
+{
+	arena_t *a = arg;
+
+	while (a->head != NULL)
+	{
+		arena_block_t *next = a->head->next;
+		arena_block_free (a->head);
+		a->head = next;
+	}
+	free (a);
+} /* }}} void arena_destroy */
+
+static void arena_key_create (void) /* {{{ */
+{
+	pthread_key_create (&arena_key, arena_destroy);
+	arena_mem = mem_account_get ("arena");
+} /* }}} void arena_key_create */
+
+/* Returns the calling thread's arena, creating it if `create' is true. */
+static arena_t *arena_get (_Bool create) /* {{{ */
+{
+	arena_t *a;
+
+	pthread_once (&arena_once, arena_key_create);
+
+	a = pthread_getspecific (arena_key);
+	if ((a != NULL) || !create)
+		return (a);
+
+	a = malloc (sizeof (*a));
+	if (a == NULL)
+	{
+		ERROR ("arena_get: malloc failed.");
+		return (NULL);
+	}
+	memset (a, 0, sizeof (*a));
+
+	if (pthread_setspecific (arena_key, a) != 0)
+	{
+		ERROR ("arena_get: pthread_setspecific failed.");
+		free (a);
+		return (NULL);
+	}
+
+	return (a);
+} /* }}} arena_t *arena_get */
+
+arena_mark_t arena_mark (void) /* {{{ */
+{
+	arena_mark_t mark = { NULL, 0 };
+	arena_t *a;
+
+	a = arena_get (/* create = */ 0);
+	if (a != NULL)
+	{
+		mark.block = a->current;
+		mark.used = a->used;
+	}
+
+	return (mark);
+} /* }}} arena_mark_t arena_mark */
+
+#if COLLECT_DEBUG
+/* Overwrites everything allocated after `mark'. */
+static void arena_poison (const arena_t *a, arena_mark_t mark) /* {{{ */
+{
+	arena_block_t *b;
+
+	if (a->current == NULL)
+		return;
+
+	for (b = (mark.block != NULL) ? mark.block : a->head; b != NULL;
+			b = b->next)
+	{
+		size_t start = (b == mark.block) ? mark.used : 0;
+		size_t end = (b == a->current) ? a->used : b->size;
+
+		if (end > start)
+			memset (ARENA_BLOCK_DATA (b) + start, ARENA_POISON,
+					end - start);
+
+		if (b == a->current)
+			break;
+	}
+} /* }}} void arena_poison */
+#endif
+
+void arena_release (arena_mark_t mark) /* {{{ */
+{
+	arena_t *a;
+	arena_block_t **next_ptr;
+	int spares = 0;
+
+	a = arena_get (/* create = */ 0);
+	if (a == NULL)
+		return;
+
+#if COLLECT_DEBUG
+	arena_poison (a, mark);
+#endif
+
+	a->current = mark.block;
+	a->used = mark.used;
+
+	/* Keep a few spare blocks of the regular size, free the others. */
+	next_ptr = (a->current != NULL) ? &a->current->next : &a->head;
+	while (*next_ptr != NULL)
+	{
+		arena_block_t *b = *next_ptr;
+
+		if ((b->size == ARENA_BLOCK_SIZE) && (spares < ARENA_SPARE_BLOCKS))
+		{
+			spares++;
+			next_ptr = &b->next;
+			continue;
+		}
+
+		*next_ptr = b->next;
+		arena_block_free (b);
+	}
+} /* }}} void arena_release */
+
+void *arena_alloc (size_t size) /* {{{ */
+{
+	arena_t *a;
+	arena_block_t *next;
+	arena_block_t *b;
+	size_t block_size;
+
+	a = arena_get (/* create = */ 1);
+	if (a == NULL)
+		return (NULL);
+
+	size = (size == 0) ? ARENA_ALIGN : ARENA_ALIGN_UP (size);
+
+	if ((a->current != NULL) && ((a->current->size - a->used) >= size))
+	{
+		void *ptr = ARENA_BLOCK_DATA (a->current) + a->used;
+		a->used += size;
+		return (ptr);
+	}
+
+	next = (a->current != NULL) ? a->current->next : a->head;
+	if ((next != NULL) && (next->size >= size))
+	{
+		a->current = next;
+		a->used = size;
+		return (ARENA_BLOCK_DATA (next));
+	}
+
+	block_size = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+	b = malloc (ARENA_HEADER_SIZE + block_size);
+	if (b == NULL)
+	{
+		ERROR ("arena_alloc: malloc (%zu) failed.",
+				ARENA_HEADER_SIZE + block_size);
+		return (NULL);
+	}
+	b->size = block_size;
+	mem_account_add (arena_mem, (int64_t) (ARENA_HEADER_SIZE + block_size));
+
+	/* Spare blocks which are too small stay behind the new one. */
+	b->next = next;
+	if (a->current != NULL)
+		a->current->next = b;
+	else
+		a->head = b;
+
+	a->current = b;
+	a->used = size;
+	return (ARENA_BLOCK_DATA (b));
+} /* }}} void *arena_alloc */
+
+char *arena_strdup (const char *s) /* {{{ */
+{
+	size_t len;
+	char *ret;
+
+	if (s == NULL)
+		return (NULL);
+
+	len = strlen (s) + 1;
+	ret = arena_alloc (len);
+	if (ret != NULL)
+		memcpy (ret, s, len);
+
+	return (ret);
+} /* }}} char *arena_strdup */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,73 @@
+/**
+ * collectd - src/utils_arena.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_ARENA_H
+#define UTILS_ARENA_H 1
+
+#include <stddef.h>
+
+/*
+ * Transient memory
+ *
+ * Each thread has an arena of its own from which memory is allocated by
+ * bumping a pointer. Nothing is freed individually: `plugin_dispatch_values'
+ * and the read threads take a mark before doing their work and release
+ * everything allocated after it once they are done. Memory from the arena is
+ * therefore valid until the value list currently being dispatched has been
+ * processed or, outside of a dispatch, until the read callback returns. It
+ * must never be stored anywhere that outlives that, e.g. in a write queue or
+ * in meta data.
+ *
+ * Marks nest, so a target dispatching a copy of a value list only releases
+ * what has been allocated during that inner dispatch. When collectd is built
+ * with --enable-debug, released memory is overwritten with 0xa5 bytes, so that
+ * pointers which escape are noticed quickly.
+ */
+struct arena_block_s;
+
+struct arena_mark_s
+{
+	struct arena_block_s *block;
+	size_t used;
+};
+typedef struct arena_mark_s arena_mark_t;
+
+/* Returns the current position of the calling thread's arena. */
+arena_mark_t arena_mark (void);
+
+/* Releases all memory the calling thread allocated since `mark' was taken. */
+void arena_release (arena_mark_t mark);
+
+/*
+ * NAME
+ *   arena_alloc
+ *
+ * DESCRIPTION
+ *   Allocates `size' bytes, aligned for any type, from the calling thread's
+ *   arena. The memory is not initialized.
+ *
+ * RETURN VALUE
+ *   A pointer to the memory or NULL if allocating a new block failed.
+ */
+void *arena_alloc (size_t size);
+
+/* Copies `s' to the arena. */
+char *arena_strdup (const char *s);
+
+#endif /* UTILS_ARENA_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
@@ -47,17 +47,31 @@ struct c_avl_node_s
 };
 typedef struct c_avl_node_s c_avl_node_t;
 
+/* Nodes are allocated in slabs, which are only freed when the tree is
+ * destroyed or becomes empty. Slabs start small, so that the many small
+ * trees don't waste memory, and grow up to AVL_SLAB_SIZE_MAX nodes. */
+#define AVL_SLAB_SIZE_MIN 16
+#define AVL_SLAB_SIZE_MAX 1024
+
+struct c_avl_slab_s
+{
+	struct c_avl_slab_s *next;
+	int nodes_num;
+	c_avl_node_t nodes[];
+};
+typedef struct c_avl_slab_s c_avl_slab_t;
+
 struct c_avl_tree_s
 {
 	c_avl_node_t *root;
 	int (*compare) (const void *, const void *);
 	int size;
-};
 
-struct c_avl_iterator_s
-{
-	c_avl_tree_t *tree;
-	c_avl_node_t *node;
+	c_avl_slab_t *slabs;
+	/* Unused nodes, linked by their `parent' member. */
+	c_avl_node_t *free_nodes;
+	/* Number of nodes of the newest slab not handed out yet. */
+	int slab_unused;
 };
 
 /*
@@ -79,17 +93,60 @@ static void verify_tree (c_avl_node_t *n)
 # define verify_tree(n) /**/
 #endif
 
-static void free_node (c_avl_node_t *n)
+static void free_slabs (c_avl_tree_t *t)
 {
-	if (n == NULL)
-		return;
+	while (t->slabs != NULL)
+	{
+		c_avl_slab_t *next = t->slabs->next;
+		free (t->slabs);
+		t->slabs = next;
+	}
 
-	if (n->left != NULL)
-		free_node (n->left);
-	if (n->right != NULL)
-		free_node (n->right);
+	t->free_nodes = NULL;
+	t->slab_unused = 0;
+}
+
+static c_avl_node_t *alloc_node (c_avl_tree_t *t)
+{
+	c_avl_node_t *n;
+
+	if (t->free_nodes != NULL)
+	{
+		n = t->free_nodes;
+		t->free_nodes = n->parent;
+		return (n);
+	}
+
+	if (t->slab_unused == 0)
+	{
+		c_avl_slab_t *s;
+		int nodes_num;
 
-	free (n);
+		nodes_num = (t->slabs == NULL)
+			? AVL_SLAB_SIZE_MIN : 2 * t->slabs->nodes_num;
+		if (nodes_num > AVL_SLAB_SIZE_MAX)
+			nodes_num = AVL_SLAB_SIZE_MAX;
+
+		s = malloc (sizeof (*s) + nodes_num * sizeof (s->nodes[0]));
+		if (s == NULL)
+			return (NULL);
+		s->nodes_num = nodes_num;
+		s->next = t->slabs;
+		t->slabs = s;
+		t->slab_unused = nodes_num;
+	}
+
+	/* Hand out nodes in address order, so that nodes inserted after
+	 * each other are next to each other in memory. */
+	n = t->slabs->nodes + (t->slabs->nodes_num - t->slab_unused);
+	t->slab_unused--;
+	return (n);
+}
+
+static void free_node (c_avl_tree_t *t, c_avl_node_t *n)
+{
+	n->parent = t->free_nodes;
+	t->free_nodes = n;
 }
 
 static int calc_height (c_avl_node_t *n)
@@ -405,7 +462,7 @@ static int _remove (c_avl_tree_t *t, c_avl_node_t *n)
 			rebalance (t, n->parent);
 		}
 
-		free_node (n);
+		free_node (t, n);
 	}
 	else if (n->left == NULL)
 	{
@@ -430,7 +487,7 @@ static int _remove (c_avl_tree_t *t, c_avl_node_t *n)
 			rebalance (t, n->parent);
 
 		n->right = NULL;
-		free_node (n);
+		free_node (t, n);
 	}
 	else if (n->right == NULL)
 	{
@@ -455,7 +512,7 @@ static int _remove (c_avl_tree_t *t, c_avl_node_t *n)
 			rebalance (t, n->parent);
 
 		n->left = NULL;
-		free_node (n);
+		free_node (t, n);
 	}
 	else
 	{
@@ -478,6 +535,7 @@ c_avl_tree_t *c_avl_create (int (*compare) (const void *, const void *))
 	if ((t = (c_avl_tree_t *) malloc (sizeof (c_avl_tree_t))) == NULL)
 		return (NULL);
 
+	memset (t, 0, sizeof (*t));
 	t->root = NULL;
 	t->compare = compare;
 	t->size = 0;
@@ -487,7 +545,10 @@ c_avl_tree_t *c_avl_create (int (*compare) (const void *, const void *))
 
 void c_avl_destroy (c_avl_tree_t *t)
 {
-	free_node (t->root);
+	if (t == NULL)
+		return;
+
+	free_slabs (t);
 	free (t);
 }
 
@@ -497,7 +558,7 @@ int c_avl_insert (c_avl_tree_t *t, void *key, void *value)
 	c_avl_node_t *nptr;
 	int cmp;
 
-	if ((new = (c_avl_node_t *) malloc (sizeof (c_avl_node_t))) == NULL)
+	if ((new = alloc_node (t)) == NULL)
 		return (-1);
 
 	new->key = key;
@@ -510,6 +571,7 @@ int c_avl_insert (c_avl_tree_t *t, void *key, void *value)
 	{
 		new->parent = NULL;
 		t->root = new;
+		++t->size;
 		return (0);
 	}
 
@@ -519,7 +581,7 @@ int c_avl_insert (c_avl_tree_t *t, void *key, void *value)
 		cmp = t->compare (nptr->key, new->key);
 		if (cmp == 0)
 		{
-			free_node (new);
+			free_node (t, new);
 			return (1);
 		}
 		else if (cmp < 0)
@@ -578,6 +640,8 @@ int c_avl_remove (c_avl_tree_t *t, const void *key, void **rkey, void **rvalue)
 	status = _remove (t, n);
 	verify_tree (t->root);
 	--t->size;
+	if (t->size == 0)
+		free_slabs (t);
 	return (status);
 } /* void *c_avl_remove */
 
@@ -630,8 +694,11 @@ int c_avl_pick (c_avl_tree_t *t, void **key, void **value)
 	*key   = n->key;
 	*value = n->value;
 
-	free_node (n);
+	free_node (t, n);
+	--t->size;
 	rebalance (t, p);
+	if (t->size == 0)
+		free_slabs (t);
 
 	return (0);
 } /* int c_avl_pick */
@@ -646,17 +713,26 @@ c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t)
 	iter = (c_avl_iterator_t *) malloc (sizeof (c_avl_iterator_t));
 	if (iter == NULL)
 		return (NULL);
-	memset (iter, '\0', sizeof (c_avl_iterator_t));
-	iter->tree = t;
+	c_avl_iterator_init (iter, t);
 
 	return (iter);
 } /* c_avl_iterator_t *c_avl_get_iterator */
 
+void c_avl_iterator_init (c_avl_iterator_t *iter, c_avl_tree_t *t)
+{
+	if (iter == NULL)
+		return;
+
+	memset (iter, '\0', sizeof (*iter));
+	iter->tree = t;
+} /* void c_avl_iterator_init */
+
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value)
 {
 	c_avl_node_t *n;
 
-	if ((iter == NULL) || (key == NULL) || (value == NULL))
+	if ((iter == NULL) || (iter->tree == NULL)
+			|| (key == NULL) || (value == NULL))
 		return (-1);
 
 	if (iter->node == NULL)
@@ -685,7 +761,8 @@ int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value)
 {
 	c_avl_node_t *n;
 
-	if ((iter == NULL) || (key == NULL) || (value == NULL))
+	if ((iter == NULL) || (iter->tree == NULL)
+			|| (key == NULL) || (value == NULL))
 		return (-1);
 
 	if (iter->node == NULL)
@@ -26,7 +26,15 @@
 struct c_avl_tree_s;
 typedef struct c_avl_tree_s c_avl_tree_t;
 
-struct c_avl_iterator_s;
+struct c_avl_node_s;
+
+/* The members are private; the structure is only declared here so that
+ * iterators can be placed on the stack, see `c_avl_iterator_init'. */
+struct c_avl_iterator_s
+{
+	c_avl_tree_t *tree;
+	struct c_avl_node_s *node;
+};
 typedef struct c_avl_iterator_s c_avl_iterator_t;
 
 /*
@@ -144,6 +152,19 @@ int c_avl_get (c_avl_tree_t *t, const void *key, void **value);
 int c_avl_pick (c_avl_tree_t *t, void **key, void **value);
 
 c_avl_iterator_t *c_avl_get_iterator (c_avl_tree_t *t);
+
+/*
+ * NAME
+ *   c_avl_iterator_init
+ *
+ * DESCRIPTION
+ *   Initializes an iterator provided by the caller, usually on the stack, so
+ *   that no memory has to be allocated. Iterators initialized this way must
+ *   not be passed to `c_avl_iterator_destroy'. Like all iterators, they
+ *   become invalid when the tree is modified.
+ */
+void c_avl_iterator_init (c_avl_iterator_t *iter, c_avl_tree_t *t);
+
 int c_avl_iterator_next (c_avl_iterator_t *iter, void **key, void **value);
 int c_avl_iterator_prev (c_avl_iterator_t *iter, void **key, void **value);
 void c_avl_iterator_destroy (c_avl_iterator_t *iter);
@@ -22,12 +22,17 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
-#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_arena.h"
 #include "meta_data.h"
+#include "utils_hashtable.h"
+#include "utils_complain.h"
+#include "utils_probes.h"
+#include "utils_memory.h"
 
 #include <assert.h>
 #include <pthread.h>
+#include <sys/mman.h>
 
 typedef struct cache_entry_s
 {
@@ -46,6 +51,10 @@ typedef struct cache_entry_s
 	cdtime_t interval;
 	int state;
 	int hits;
+	/* Result of the threshold plugin's lookup for this entry, valid as long
+	 * as `threshold_generation' matches the plugin's current generation. */
+	void *threshold;
+	unsigned int threshold_generation;
 
 	/*
 	 * +-----+-----+-----+-----+-----+-----+-----+-----+-----+----
@@ -60,17 +69,441 @@ typedef struct cache_entry_s
 	size_t   history_index; /* points to the next position to write to. */
 	size_t   history_length;
 
+	/* The compact history used by `uc_get_history_stats'. Same layout as
+	 * `history', but single precision and allocated from the ring slabs.
+	 * `compact_length' steps fill the ring's size class completely. */
+	float   *compact;
+	size_t   compact_index;
+	size_t   compact_length;
+
 	meta_data_t *meta;
+
+	/* Hash of `name' and the next entry in the same hash bucket. */
+	uint32_t hash;
+	struct cache_entry_s *next;
+
+	/* Position in the shard's expiry heap and the time the entry was due
+	 * when it was last (re-)inserted there. `expires' may lag behind the real
+	 * deadline, see `cache_heap_expire'. */
+	cdtime_t expires;
+	size_t   heap_index;
 } cache_entry_t;
 
-static c_avl_tree_t   *cache_tree = NULL;
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+#define UC_HEAP_NONE ((size_t) -1)
+
+/* The cache is split into `UC_SHARDS_NUM' independent hash tables, each with
+ * its own lock. The hash of the identifier selects the shard, so concurrent
+ * updates of different identifiers rarely contend for the same lock. */
+#define UC_SHARDS_NUM 64
+#define UC_BUCKETS_MIN 64
 
-static int cache_compare (const cache_entry_t *a, const cache_entry_t *b)
+typedef struct cache_shard_s
+{
+  pthread_mutex_t lock;
+  cache_entry_t **buckets;
+  size_t buckets_num; /* always a power of two */
+  size_t entries_num;
+
+  /* Min-heap of all entries, ordered by `expires'. */
+  cache_entry_t **heap;
+  size_t heap_num;
+  size_t heap_size;
+} cache_shard_t;
+
+/* Stale entries found by `uc_check_timeout'. The array is kept between calls
+ * so that it only needs to be grown when the number of expired entries
+ * reaches a new maximum. `uc_check_timeout' is only called from the main
+ * loop, so no locking is necessary. */
+typedef struct cache_expired_s
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  uint32_t hash;
+  cdtime_t time;
+  cdtime_t interval;
+} cache_expired_t;
+
+static cache_expired_t *cache_expired = NULL;
+static size_t cache_expired_size = 0;
+
+static cache_shard_t cache_shards[UC_SHARDS_NUM];
+
+/* The memory of all entries, including their history, and of the shards'
+ * tables. */
+static mem_account_t *cache_mem = NULL;
+static c_complain_t cache_mem_complaint = C_COMPLAIN_INIT_STATIC;
+
+/* The `CacheNewEntriesLimit' and `CacheNewEntriesPerHostLimit' options limit
+ * how many entries may be created within `UC_LIMIT_WINDOW', in total and by
+ * the value lists of one host. The counters of all hosts are reset at the end
+ * of each window. Hosts which created no entries during the last window are
+ * forgotten then, so that the table doesn't grow with hosts which are gone.
+ * `uc_limit_lock' is only acquired when an entry is about to be created. */
+#define UC_LIMIT_WINDOW TIME_T_TO_CDTIME_T (60)
+
+typedef struct uc_limit_host_s
+{
+  char host[DATA_MAX_NAME_LEN];
+  int created;
+  uint64_t rejected;
+  c_complain_t complaint;
+} uc_limit_host_t;
+
+static int uc_limit_total = 0;
+static int uc_limit_per_host = 0;
+static pthread_mutex_t uc_limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_hashtable_t *uc_limit_hosts = NULL;
+static int uc_limit_created = 0;
+static uint64_t uc_limit_rejected = 0;
+static c_complain_t uc_limit_complaint = C_COMPLAIN_INIT_STATIC;
+static cdtime_t uc_limit_window_end = 0;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static uc_check_cb uc_check_callback = NULL;
+static uc_report_cb uc_report_callback = NULL;
+
+/* Compact history rings hold a power of two floats, from 2^UC_RING_CLASS_MIN
+ * up to 2^(UC_RING_CLASS_MIN + UC_RING_CLASSES - 1), and are carved from
+ * slabs of UC_RING_SLAB_SIZE bytes. Freed rings are kept in a list per size
+ * class for the next entry; the slabs themselves are never freed. Larger
+ * rings are allocated individually. */
+#define UC_RING_SLAB_SIZE 65536
+#define UC_RING_CLASS_MIN 4
+#define UC_RING_CLASSES   11
+#define UC_RING_MAX_FLOATS (((size_t) 1) << 24)
+
+typedef struct uc_ring_free_s
 {
-  assert ((a != NULL) && (b != NULL));
-  return (strcmp (a->name, b->name));
-} /* int cache_compare */
+  struct uc_ring_free_s *next;
+} uc_ring_free_t;
+
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static uc_ring_free_t *ring_free[UC_RING_CLASSES];
+static char *ring_slab = NULL;
+static size_t ring_slab_left = 0;
+
+/* The same hash as the one `plugin_value_list_identifier' provides. */
+static uint32_t cache_hash (const char *name) /* {{{ */
+{
+  return (c_hashtable_hash_string (name));
+} /* }}} uint32_t cache_hash */
+
+static void cache_shards_init (void) /* {{{ */
+{
+  size_t i;
+
+  memset (cache_shards, 0, sizeof (cache_shards));
+  for (i = 0; i < UC_SHARDS_NUM; i++)
+    pthread_mutex_init (&cache_shards[i].lock, /* attr = */ NULL);
+
+  cache_mem = mem_account_get ("cache");
+} /* }}} void cache_shards_init */
+
+static cache_shard_t *cache_get_shard (uint32_t hash) /* {{{ */
+{
+  pthread_once (&cache_once, cache_shards_init);
+  return (cache_shards + (hash % UC_SHARDS_NUM));
+} /* }}} cache_shard_t *cache_get_shard */
+
+/* The lower bits select the shard, so use the upper bits for the bucket. */
+#define CACHE_BUCKET(shard,hash) \
+  (((hash) / UC_SHARDS_NUM) & ((shard)->buckets_num - 1))
+
+/* The shard's lock must be held by the caller. */
+static cache_entry_t *cache_lookup (cache_shard_t *shard, /* {{{ */
+    const char *name, uint32_t hash)
+{
+  cache_entry_t *ce;
+
+  if (shard->buckets == NULL)
+    return (NULL);
+
+  for (ce = shard->buckets[CACHE_BUCKET (shard, hash)];
+      ce != NULL;
+      ce = ce->next)
+    if ((ce->hash == hash) && (strcmp (ce->name, name) == 0))
+      return (ce);
+
+  return (NULL);
+} /* }}} cache_entry_t *cache_lookup */
+
+/* Doubles the number of buckets. Returns non-zero if memory could not be
+ * allocated; the shard is still usable in that case, merely slower. The
+ * shard's lock must be held by the caller. */
+static int cache_shard_grow (cache_shard_t *shard) /* {{{ */
+{
+  cache_entry_t **buckets;
+  size_t buckets_num;
+  size_t i;
+
+  buckets_num = (shard->buckets_num == 0)
+    ? UC_BUCKETS_MIN : (2 * shard->buckets_num);
+
+  buckets = calloc (buckets_num, sizeof (*buckets));
+  if (buckets == NULL)
+  {
+    ERROR ("utils_cache: cache_shard_grow: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < shard->buckets_num; i++)
+  {
+    cache_entry_t *ce = shard->buckets[i];
+
+    while (ce != NULL)
+    {
+      cache_entry_t *next = ce->next;
+      size_t idx = (ce->hash / UC_SHARDS_NUM) & (buckets_num - 1);
+
+      ce->next = buckets[idx];
+      buckets[idx] = ce;
+
+      ce = next;
+    }
+  }
+
+  mem_account_add (cache_mem, (int64_t) ((buckets_num - shard->buckets_num)
+	* sizeof (*buckets)));
+  sfree (shard->buckets);
+  shard->buckets = buckets;
+  shard->buckets_num = buckets_num;
+
+  return (0);
+} /* }}} int cache_shard_grow */
+
+static cdtime_t cache_deadline (const cache_entry_t *ce) /* {{{ */
+{
+  return (ce->last_update + (ce->interval * timeout_g));
+} /* }}} cdtime_t cache_deadline */
+
+static void cache_heap_swap (cache_shard_t *shard, size_t a, size_t b) /* {{{ */
+{
+  cache_entry_t *tmp = shard->heap[a];
+
+  shard->heap[a] = shard->heap[b];
+  shard->heap[b] = tmp;
+
+  shard->heap[a]->heap_index = a;
+  shard->heap[b]->heap_index = b;
+} /* }}} void cache_heap_swap */
+
+static void cache_heap_up (cache_shard_t *shard, size_t idx) /* {{{ */
+{
+  while (idx > 0)
+  {
+    size_t parent = (idx - 1) / 2;
+
+    if (shard->heap[parent]->expires <= shard->heap[idx]->expires)
+      break;
+
+    cache_heap_swap (shard, parent, idx);
+    idx = parent;
+  }
+} /* }}} void cache_heap_up */
+
+static void cache_heap_down (cache_shard_t *shard, size_t idx) /* {{{ */
+{
+  while (42)
+  {
+    size_t left = (2 * idx) + 1;
+    size_t right = left + 1;
+    size_t min = idx;
+
+    if ((left < shard->heap_num)
+	&& (shard->heap[left]->expires < shard->heap[min]->expires))
+      min = left;
+    if ((right < shard->heap_num)
+	&& (shard->heap[right]->expires < shard->heap[min]->expires))
+      min = right;
+
+    if (min == idx)
+      break;
+
+    cache_heap_swap (shard, min, idx);
+    idx = min;
+  }
+} /* }}} void cache_heap_down */
+
+/* Makes sure one more entry fits into the heap. */
+static int cache_heap_reserve (cache_shard_t *shard) /* {{{ */
+{
+  cache_entry_t **tmp;
+  size_t size;
+
+  if (shard->heap_num < shard->heap_size)
+    return (0);
+
+  size = (shard->heap_size == 0) ? UC_BUCKETS_MIN : (2 * shard->heap_size);
+  tmp = realloc (shard->heap, size * sizeof (*shard->heap));
+  if (tmp == NULL)
+  {
+    ERROR ("utils_cache: cache_heap_reserve: realloc failed.");
+    return (-1);
+  }
+
+  mem_account_add (cache_mem, (int64_t) ((size - shard->heap_size)
+	* sizeof (*shard->heap)));
+  shard->heap = tmp;
+  shard->heap_size = size;
+  return (0);
+} /* }}} int cache_heap_reserve */
+
+/* `cache_heap_reserve' must have succeeded before calling this function. */
+static void cache_heap_insert (cache_shard_t *shard, cache_entry_t *ce) /* {{{ */
+{
+  assert (shard->heap_num < shard->heap_size);
+
+  ce->expires = cache_deadline (ce);
+  ce->heap_index = shard->heap_num;
+  shard->heap[shard->heap_num] = ce;
+  shard->heap_num++;
+
+  cache_heap_up (shard, ce->heap_index);
+} /* }}} void cache_heap_insert */
+
+static void cache_heap_remove (cache_shard_t *shard, cache_entry_t *ce) /* {{{ */
+{
+  size_t idx = ce->heap_index;
+
+  if (idx == UC_HEAP_NONE)
+    return;
+
+  assert (idx < shard->heap_num);
+  assert (shard->heap[idx] == ce);
+
+  shard->heap_num--;
+  if (idx != shard->heap_num)
+  {
+    shard->heap[idx] = shard->heap[shard->heap_num];
+    shard->heap[idx]->heap_index = idx;
+    cache_heap_up (shard, idx);
+    cache_heap_down (shard, idx);
+  }
+
+  ce->heap_index = UC_HEAP_NONE;
+} /* }}} void cache_heap_remove */
+
+/* Returns the next entry that is due at `now' and removes it from the heap,
+ * or returns NULL if there is none. Updating an entry doesn't touch the heap,
+ * so `expires' is only a lower bound of the real deadline: entries that have
+ * been updated in the meantime are moved back into place here instead. The
+ * shard's lock must be held by the caller. */
+static cache_entry_t *cache_heap_expire (cache_shard_t *shard, /* {{{ */
+    cdtime_t now)
+{
+  while (shard->heap_num > 0)
+  {
+    cache_entry_t *ce = shard->heap[0];
+    cdtime_t deadline;
+
+    if (ce->expires > now)
+      return (NULL);
+
+    deadline = cache_deadline (ce);
+    if (deadline > now)
+    {
+      ce->expires = deadline;
+      cache_heap_down (shard, 0);
+      continue;
+    }
+
+    cache_heap_remove (shard, ce);
+    return (ce);
+  }
+
+  return (NULL);
+} /* }}} cache_entry_t *cache_heap_expire */
+
+/* The shard's lock must be held by the caller. */
+static int cache_link (cache_shard_t *shard, cache_entry_t *ce) /* {{{ */
+{
+  size_t idx;
+
+  if ((shard->buckets == NULL)
+      || (shard->entries_num >= shard->buckets_num))
+  {
+    cache_shard_grow (shard);
+    if (shard->buckets == NULL)
+      return (-1);
+  }
+
+  if (cache_heap_reserve (shard) != 0)
+    return (-1);
+  cache_heap_insert (shard, ce);
+
+  idx = CACHE_BUCKET (shard, ce->hash);
+  ce->next = shard->buckets[idx];
+  shard->buckets[idx] = ce;
+  shard->entries_num++;
+
+  return (0);
+} /* }}} int cache_link */
+
+/* Removes the entry from the shard, but doesn't free it. The shard's lock must
+ * be held by the caller. */
+static cache_entry_t *cache_unlink (cache_shard_t *shard, /* {{{ */
+    const char *name, uint32_t hash)
+{
+  cache_entry_t *prev = NULL;
+  cache_entry_t *ce;
+  size_t idx;
+
+  if (shard->buckets == NULL)
+    return (NULL);
+
+  idx = CACHE_BUCKET (shard, hash);
+  for (ce = shard->buckets[idx]; ce != NULL; prev = ce, ce = ce->next)
+    if ((ce->hash == hash) && (strcmp (ce->name, name) == 0))
+      break;
+
+  if (ce == NULL)
+    return (NULL);
+
+  if (prev == NULL)
+    shard->buckets[idx] = ce->next;
+  else
+    prev->next = ce->next;
+  ce->next = NULL;
+  shard->entries_num--;
+
+  cache_heap_remove (shard, ce);
+
+  return (ce);
+} /* }}} cache_entry_t *cache_unlink */
+
+/* Looks up `name' and returns the entry with the shard's lock held. Returns
+ * NULL, without holding any lock, if there is no such entry. */
+static cache_entry_t *cache_get_locked_hash (const char *name, /* {{{ */
+    uint32_t hash, cache_shard_t **ret_shard)
+{
+  cache_shard_t *shard = cache_get_shard (hash);
+  cache_entry_t *ce;
+
+  pthread_mutex_lock (&shard->lock);
+  ce = cache_lookup (shard, name, hash);
+  if (ce == NULL)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    return (NULL);
+  }
+
+  *ret_shard = shard;
+  return (ce);
+} /* }}} cache_entry_t *cache_get_locked_hash */
+
+static cache_entry_t *cache_get_locked (const char *name, /* {{{ */
+    cache_shard_t **ret_shard)
+{
+  return (cache_get_locked_hash (name, cache_hash (name), ret_shard));
+} /* }}} cache_entry_t *cache_get_locked */
+
+/* The memory used by `ce' for `mem_account_add', without meta data. */
+static int64_t cache_entry_size (const cache_entry_t *ce)
+{
+  return ((int64_t) (sizeof (*ce)
+	+ ce->values_num * (sizeof (*ce->values_gauge)
+	  + sizeof (*ce->values_raw))
+	+ ce->history_length * ce->values_num * sizeof (*ce->history)));
+} /* int64_t cache_entry_size */
 
 static cache_entry_t *cache_alloc (int values_num)
 {
@@ -99,18 +532,115 @@ static cache_entry_t *cache_alloc (int values_num)
   ce->history = NULL;
   ce->history_length = 0;
   ce->meta = NULL;
+  ce->heap_index = UC_HEAP_NONE;
 
+  mem_account_add (cache_mem, cache_entry_size (ce));
   return (ce);
 } /* cache_entry_t *cache_alloc */
 
+/* Returns the size class of a ring of `floats' floats, which is rounded up
+ * to the class size, or -1 if it is allocated individually. */
+static int ring_class (size_t *floats) /* {{{ */
+{
+  size_t size = ((size_t) 1) << UC_RING_CLASS_MIN;
+  int class;
+
+  for (class = 0; class < UC_RING_CLASSES; class++)
+  {
+    if (*floats <= size)
+    {
+      *floats = size;
+      return (class);
+    }
+    size *= 2;
+  }
+
+  return (-1);
+} /* }}} int ring_class */
+
+/* Allocates a ring with room for at least `*floats' floats and stores its
+ * actual size in `*floats'. The memory isn't initialized. */
+static float *ring_alloc (size_t *floats) /* {{{ */
+{
+  float *ring;
+  int class;
+  size_t size;
+
+  class = ring_class (floats);
+  size = *floats * sizeof (float);
+  if (class < 0)
+  {
+    ring = malloc (size);
+    if (ring != NULL)
+      mem_account_add (cache_mem, (int64_t) size);
+    return (ring);
+  }
+
+  pthread_mutex_lock (&ring_lock);
+  if (ring_free[class] != NULL)
+  {
+    ring = (float *) ring_free[class];
+    ring_free[class] = ring_free[class]->next;
+  }
+  else
+  {
+    /* What's left of the current slab is wasted. */
+    if (ring_slab_left < size)
+    {
+      ring_slab = malloc (UC_RING_SLAB_SIZE);
+      ring_slab_left = (ring_slab != NULL) ? UC_RING_SLAB_SIZE : 0;
+      if (ring_slab != NULL)
+	mem_account_add (cache_mem, UC_RING_SLAB_SIZE);
+    }
+
+    if (ring_slab_left < size)
+      ring = NULL;
+    else
+    {
+      ring = (float *) ring_slab;
+      ring_slab += size;
+      ring_slab_left -= size;
+    }
+  }
+  pthread_mutex_unlock (&ring_lock);
+
+  return (ring);
+} /* }}} float *ring_alloc */
+
+static void ring_free_ring (float *ring, size_t floats) /* {{{ */
+{
+  uc_ring_free_t *rf;
+  int class;
+
+  if (ring == NULL)
+    return;
+
+  class = ring_class (&floats);
+  if (class < 0)
+  {
+    mem_account_add (cache_mem, -((int64_t) (floats * sizeof (float))));
+    free (ring);
+    return;
+  }
+
+  rf = (uc_ring_free_t *) ring;
+  pthread_mutex_lock (&ring_lock);
+  rf->next = ring_free[class];
+  ring_free[class] = rf;
+  pthread_mutex_unlock (&ring_lock);
+} /* }}} void ring_free_ring */
+
 static void cache_free (cache_entry_t *ce)
 {
   if (ce == NULL)
     return;
 
+  mem_account_add (cache_mem, -cache_entry_size (ce));
   sfree (ce->values_gauge);
   sfree (ce->values_raw);
   sfree (ce->history);
+  ring_free_ring (ce->compact, ce->compact_length * ce->values_num);
+  ce->compact = NULL;
   if (ce->meta != NULL)
   {
     meta_data_destroy (ce->meta);
@@ -134,31 +664,171 @@ static void uc_check_range (const data_set_t *ds, cache_entry_t *ce)
   }
 } /* void uc_check_range */
 
-static int uc_insert (const data_set_t *ds, const value_list_t *vl,
-    const char *key)
+/* Starts a new window. You must hold `uc_limit_lock'. */
+static void uc_limit_reset_locked (cdtime_t now) /* {{{ */
+{
+  c_hashtable_iterator_t *iter;
+  uc_limit_host_t **idle = NULL;
+  size_t idle_num = 0;
+  size_t i;
+  void *key;
+  void *value;
+
+  uc_limit_created = 0;
+  uc_limit_window_end = now + UC_LIMIT_WINDOW;
+
+  if (c_hashtable_size (uc_limit_hosts) == 0)
+    return;
+
+  idle = calloc ((size_t) c_hashtable_size (uc_limit_hosts), sizeof (*idle));
+  iter = c_hashtable_get_iterator (uc_limit_hosts);
+  if ((idle == NULL) || (iter == NULL))
+  {
+    ERROR ("uc_limit_reset_locked: calloc failed.");
+    if (iter != NULL)
+      c_hashtable_iterator_destroy (iter);
+    sfree (idle);
+    return;
+  }
+
+  while (c_hashtable_iterator_next (iter, &key, &value) == 0)
+  {
+    uc_limit_host_t *h = value;
+
+    if ((h->created == 0) && (h->complaint.interval == 0))
+      idle[idle_num++] = h;
+    h->created = 0;
+  }
+  c_hashtable_iterator_destroy (iter);
+
+  for (i = 0; i < idle_num; i++)
+  {
+    c_hashtable_remove (uc_limit_hosts, idle[i]->host, NULL, NULL);
+    sfree (idle[i]);
+  }
+  sfree (idle);
+} /* }}} void uc_limit_reset_locked */
+
+/* Returns the counters of `host', creating them if necessary. You must hold
+ * `uc_limit_lock'. */
+static uc_limit_host_t *uc_limit_host_get_locked (const char *host) /* {{{ */
+{
+  uc_limit_host_t *h = NULL;
+
+  if (uc_limit_hosts == NULL)
+  {
+    uc_limit_hosts = c_hashtable_create (c_hashtable_hash_string,
+	(void *) strcmp);
+    if (uc_limit_hosts == NULL)
+      return (NULL);
+  }
+
+  if (c_hashtable_get (uc_limit_hosts, host, (void *) &h) == 0)
+    return (h);
+
+  h = calloc (1, sizeof (*h));
+  if (h == NULL)
+    return (NULL);
+  sstrncpy (h->host, host, sizeof (h->host));
+  C_COMPLAIN_INIT (&h->complaint);
+
+  if (c_hashtable_insert (uc_limit_hosts, h->host, h) != 0)
+  {
+    sfree (h);
+    return (NULL);
+  }
+
+  return (h);
+} /* }}} uc_limit_host_t *uc_limit_host_get_locked */
+
+/* Returns zero if an entry for a value list of `host' may be created and
+ * counts it, or UC_REJECTED if one of the limits has been reached. */
+static int uc_limit_check (const char *host) /* {{{ */
+{
+  uc_limit_host_t *h = NULL;
+  cdtime_t now;
+
+  if ((uc_limit_total <= 0) && (uc_limit_per_host <= 0))
+    return (0);
+
+  pthread_mutex_lock (&uc_limit_lock);
+
+  now = cdtime ();
+  if (now >= uc_limit_window_end)
+    uc_limit_reset_locked (now);
+
+  if ((uc_limit_total > 0) && (uc_limit_created >= uc_limit_total))
+  {
+    uc_limit_rejected++;
+    c_complain (LOG_WARNING, &uc_limit_complaint, "utils_cache: More than "
+	"%i new identifiers have been dispatched within a minute. Values "
+	"with new identifiers are dropped (%"PRIu64" so far).",
+	uc_limit_total, uc_limit_rejected);
+    pthread_mutex_unlock (&uc_limit_lock);
+    return (UC_REJECTED);
+  }
+
+  if (uc_limit_per_host > 0)
+  {
+    /* Without memory for the counters the host isn't limited. */
+    h = uc_limit_host_get_locked (host);
+    if ((h != NULL) && (h->created >= uc_limit_per_host))
+    {
+      h->rejected++;
+      c_complain (LOG_WARNING, &h->complaint, "utils_cache: Host \"%s\" "
+	  "dispatched more than %i new identifiers within a minute. Its "
+	  "values with new identifiers are dropped (%"PRIu64" so far).",
+	  host, uc_limit_per_host, h->rejected);
+      pthread_mutex_unlock (&uc_limit_lock);
+      return (UC_REJECTED);
+    }
+  }
+
+  uc_limit_created++;
+  c_release (LOG_INFO, &uc_limit_complaint, "utils_cache: New identifiers "
+      "are accepted again.");
+  if (h != NULL)
+  {
+    h->created++;
+    c_release (LOG_INFO, &h->complaint, "utils_cache: New identifiers of "
+	"host \"%s\" are accepted again.", host);
+  }
+
+  pthread_mutex_unlock (&uc_limit_lock);
+  return (0);
+} /* }}} int uc_limit_check */
+
+static int uc_insert (cache_shard_t *shard, const data_set_t *ds,
+    const value_list_t *vl, const char *key, uint32_t hash,
+    cache_entry_t **ret_ce)
 {
   int i;
-  char *key_copy;
   cache_entry_t *ce;
 
-  /* `cache_lock' has been locked by `uc_update' */
+  /* The shard's lock has been locked by `uc_update' */
 
-  key_copy = strdup (key);
-  if (key_copy == NULL)
+  if (mem_pressure () >= MEM_PRESSURE_REJECT_NEW)
   {
-    ERROR ("uc_insert: strdup failed.");
-    return (-1);
+    c_complain (LOG_WARNING, &cache_mem_complaint, "utils_cache: The "
+	"memory budget is exceeded. Values with new identifiers are "
+	"dropped.");
+    return (UC_REJECTED);
   }
+  c_release (LOG_INFO, &cache_mem_complaint, "utils_cache: New identifiers "
+      "are accepted again, the memory budget is no longer exceeded.");
+
+  if (uc_limit_check (vl->host) != 0)
+    return (UC_REJECTED);
 
   ce = cache_alloc (ds->ds_num);
   if (ce == NULL)
   {
-    sfree (key_copy);
     ERROR ("uc_insert: cache_alloc (%i) failed.", ds->ds_num);
     return (-1);
   }
 
   sstrncpy (ce->name, key, sizeof (ce->name));
+  ce->hash = hash;
 
   for (i = 0; i < ds->ds_num; i++)
   {
@@ -169,133 +839,722 @@ static int uc_insert (const data_set_t *ds, const value_list_t *vl,
 	ce->values_raw[i].counter = vl->values[i].counter;
 	break;
 
-      case DS_TYPE_GAUGE:
-	ce->values_gauge[i] = vl->values[i].gauge;
-	ce->values_raw[i].gauge = vl->values[i].gauge;
-	break;
+      case DS_TYPE_GAUGE:
+	ce->values_gauge[i] = vl->values[i].gauge;
+	ce->values_raw[i].gauge = vl->values[i].gauge;
+	break;
+
+      case DS_TYPE_DERIVE:
+	ce->values_gauge[i] = NAN;
+	ce->values_raw[i].derive = vl->values[i].derive;
+	break;
+
+      case DS_TYPE_ABSOLUTE:
+	ce->values_gauge[i] = NAN;
+	if (vl->interval > 0)
+	  ce->values_gauge[i] = ((double) vl->values[i].absolute)
+	    / CDTIME_T_TO_DOUBLE (vl->interval);
+	ce->values_raw[i].absolute = vl->values[i].absolute;
+	break;
+	
+      default:
+	/* This shouldn't happen. */
+	ERROR ("uc_insert: Don't know how to handle data source type %i.",
+	    ds->ds[i].type);
+	cache_free (ce);
+	return (-1);
+    } /* switch (ds->ds[i].type) */
+  } /* for (i) */
+
+  /* Prune invalid gauge data */
+  uc_check_range (ds, ce);
+
+  ce->last_time = vl->time;
+  ce->last_update = cdtime_cached ();
+  ce->interval = vl->interval;
+  ce->state = STATE_OKAY;
+
+  if (cache_link (shard, ce) != 0)
+  {
+    cache_free (ce);
+    ERROR ("uc_insert: cache_link failed.");
+    return (-1);
+  }
+
+  DEBUG ("uc_insert: Added %s to the cache.", key);
+  *ret_ce = ce;
+  return (0);
+} /* int uc_insert */
+
+/*
+ * Cache snapshot
+ *
+ * If the `CacheFile' option is set, the contents of the cache are written to
+ * that file on shutdown and read back by `uc_init'. This way rates of
+ * COUNTER and DERIVE values, threshold states and plugin meta data survive
+ * a restart. The file uses the host's byte order and type sizes; files
+ * written by a different architecture or version are ignored.
+ */
+#define UC_SNAPSHOT_MAGIC   "collectd-uc\0"
+#define UC_SNAPSHOT_VERSION 1
+
+typedef struct uc_snapshot_header_s
+{
+  char     magic[12];
+  uint32_t version;
+  uint32_t entry_size;
+  uint32_t value_size;
+  uint64_t entries_num;
+} uc_snapshot_header_t;
+
+/* Each entry is followed by `name_len' bytes of name, `values_num' raw
+ * values, `values_num' gauges, `history_length * values_num' history gauges
+ * and `meta_num' meta data items. */
+typedef struct uc_snapshot_entry_s
+{
+  uint32_t name_len;
+  uint32_t values_num;
+  uint64_t last_time;
+  uint64_t last_update;
+  uint64_t interval;
+  int32_t  state;
+  int32_t  hits;
+  uint64_t history_length;
+  uint64_t history_index;
+  uint32_t meta_num;
+  uint32_t reserved;
+} uc_snapshot_entry_t;
+
+typedef struct uc_snapshot_reader_s
+{
+  const char *ptr;
+  size_t left;
+} uc_snapshot_reader_t;
+
+static int uc_snapshot_loaded = 0;
+
+static int uc_snapshot_read (uc_snapshot_reader_t *r, /* {{{ */
+    void *buffer, size_t buffer_size)
+{
+  if (buffer_size > r->left)
+    return (-1);
+
+  memcpy (buffer, r->ptr, buffer_size);
+  r->ptr += buffer_size;
+  r->left -= buffer_size;
+  return (0);
+} /* }}} int uc_snapshot_read */
+
+static int uc_snapshot_write (FILE *fh, /* {{{ */
+    const void *buffer, size_t buffer_size)
+{
+  if (buffer_size == 0)
+    return (0);
+
+  if (fwrite (buffer, buffer_size, 1, fh) != 1)
+    return (-1);
+  return (0);
+} /* }}} int uc_snapshot_write */
+
+static int uc_snapshot_write_meta (FILE *fh, meta_data_t *md, /* {{{ */
+    char **toc, int toc_num)
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; (i < toc_num) && (status == 0); i++)
+  {
+    uint32_t key_len = (uint32_t) strlen (toc[i]);
+    int32_t type = (int32_t) meta_data_type (md, toc[i]);
+
+    status = uc_snapshot_write (fh, &key_len, sizeof (key_len));
+    if (status == 0)
+      status = uc_snapshot_write (fh, &type, sizeof (type));
+    if (status == 0)
+      status = uc_snapshot_write (fh, toc[i], key_len);
+    if (status != 0)
+      continue;
+
+    switch (type)
+    {
+      case MD_TYPE_STRING:
+      {
+	char *value = NULL;
+	uint32_t value_len;
+
+	status = meta_data_get_string (md, toc[i], &value);
+	if (status != 0)
+	  break;
+	value_len = (uint32_t) strlen (value);
+	status = uc_snapshot_write (fh, &value_len, sizeof (value_len));
+	if (status == 0)
+	  status = uc_snapshot_write (fh, value, value_len);
+	sfree (value);
+	break;
+      }
+      case MD_TYPE_SIGNED_INT:
+      {
+	int64_t value = 0;
+	status = meta_data_get_signed_int (md, toc[i], &value);
+	if (status == 0)
+	  status = uc_snapshot_write (fh, &value, sizeof (value));
+	break;
+      }
+      case MD_TYPE_UNSIGNED_INT:
+      {
+	uint64_t value = 0;
+	status = meta_data_get_unsigned_int (md, toc[i], &value);
+	if (status == 0)
+	  status = uc_snapshot_write (fh, &value, sizeof (value));
+	break;
+      }
+      case MD_TYPE_DOUBLE:
+      {
+	double value = 0.0;
+	status = meta_data_get_double (md, toc[i], &value);
+	if (status == 0)
+	  status = uc_snapshot_write (fh, &value, sizeof (value));
+	break;
+      }
+      case MD_TYPE_BOOLEAN:
+      {
+	_Bool value = 0;
+	uint8_t tmp;
+	status = meta_data_get_boolean (md, toc[i], &value);
+	tmp = value ? 1 : 0;
+	if (status == 0)
+	  status = uc_snapshot_write (fh, &tmp, sizeof (tmp));
+	break;
+      }
+      default:
+	status = -1;
+    } /* switch (type) */
+  } /* for (i) */
+
+  return (status);
+} /* }}} int uc_snapshot_write_meta */
+
+static int uc_snapshot_read_meta (uc_snapshot_reader_t *r, /* {{{ */
+    meta_data_t *md)
+{
+  char *key;
+  uint32_t key_len;
+  int32_t type;
+  int status;
+
+  if ((uc_snapshot_read (r, &key_len, sizeof (key_len)) != 0)
+      || (uc_snapshot_read (r, &type, sizeof (type)) != 0)
+      || (key_len > r->left))
+    return (-1);
+
+  key = malloc (key_len + 1);
+  if (key == NULL)
+    return (-1);
+  uc_snapshot_read (r, key, key_len);
+  key[key_len] = 0;
+
+  switch (type)
+  {
+    case MD_TYPE_STRING:
+    {
+      char *value;
+      uint32_t value_len;
+
+      if ((uc_snapshot_read (r, &value_len, sizeof (value_len)) != 0)
+	  || (value_len > r->left))
+      {
+	status = -1;
+	break;
+      }
+
+      value = malloc (value_len + 1);
+      if (value == NULL)
+      {
+	status = -1;
+	break;
+      }
+      uc_snapshot_read (r, value, value_len);
+      value[value_len] = 0;
+
+      status = meta_data_add_string (md, key, value);
+      sfree (value);
+      break;
+    }
+    case MD_TYPE_SIGNED_INT:
+    {
+      int64_t value;
+      status = uc_snapshot_read (r, &value, sizeof (value));
+      if (status == 0)
+	status = meta_data_add_signed_int (md, key, value);
+      break;
+    }
+    case MD_TYPE_UNSIGNED_INT:
+    {
+      uint64_t value;
+      status = uc_snapshot_read (r, &value, sizeof (value));
+      if (status == 0)
+	status = meta_data_add_unsigned_int (md, key, value);
+      break;
+    }
+    case MD_TYPE_DOUBLE:
+    {
+      double value;
+      status = uc_snapshot_read (r, &value, sizeof (value));
+      if (status == 0)
+	status = meta_data_add_double (md, key, value);
+      break;
+    }
+    case MD_TYPE_BOOLEAN:
+    {
+      uint8_t value;
+      status = uc_snapshot_read (r, &value, sizeof (value));
+      if (status == 0)
+	status = meta_data_add_boolean (md, key, value ? 1 : 0);
+      break;
+    }
+    default:
+      status = -1;
+  } /* switch (type) */
+
+  sfree (key);
+  return (status);
+} /* }}} int uc_snapshot_read_meta */
+
+/* Reads one entry from the snapshot. Returns the new cache entry, or NULL if
+ * the entry should be skipped. `*ret_error' is set if the remainder of the
+ * file cannot be parsed. */
+static cache_entry_t *uc_snapshot_read_entry (uc_snapshot_reader_t *r, /* {{{ */
+    cdtime_t now, int max_age, int *ret_error)
+{
+  uc_snapshot_entry_t se;
+  char name[6 * DATA_MAX_NAME_LEN];
+  char *type;
+  size_t history_num;
+  cache_entry_t *ce;
+  const data_set_t *ds;
+  int skip = 0;
+  uint32_t i;
+
+  *ret_error = 1;
+
+  if ((uc_snapshot_read (r, &se, sizeof (se)) != 0)
+      || (se.name_len >= sizeof (name))
+      || (se.values_num == 0)
+      || (uc_snapshot_read (r, name, se.name_len) != 0))
+    return (NULL);
+  name[se.name_len] = 0;
+
+  /* Make sure the sizes fit into the file before multiplying them. */
+  if ((se.values_num > (r->left / (sizeof (value_t) + sizeof (gauge_t))))
+      || (se.history_length > (r->left / (se.values_num * sizeof (gauge_t))))
+      || ((se.history_length > 0) && (se.history_index >= se.history_length)))
+    return (NULL);
+  history_num = (size_t) se.history_length * se.values_num;
+
+  ce = cache_alloc ((int) se.values_num);
+  if (ce == NULL)
+    return (NULL);
+
+  sstrncpy (ce->name, name, sizeof (ce->name));
+  ce->hash = cache_hash (ce->name);
+  ce->last_time = (cdtime_t) se.last_time;
+  ce->last_update = (cdtime_t) se.last_update;
+  ce->interval = (cdtime_t) se.interval;
+  ce->state = (int) se.state;
+  ce->hits = (int) se.hits;
+
+  if ((uc_snapshot_read (r, ce->values_raw,
+	  se.values_num * sizeof (*ce->values_raw)) != 0)
+      || (uc_snapshot_read (r, ce->values_gauge,
+	  se.values_num * sizeof (*ce->values_gauge)) != 0))
+  {
+    cache_free (ce);
+    return (NULL);
+  }
+
+  if (history_num > 0)
+  {
+    ce->history = malloc (history_num * sizeof (*ce->history));
+    if ((ce->history == NULL)
+	|| (uc_snapshot_read (r, ce->history,
+	    history_num * sizeof (*ce->history)) != 0))
+    {
+      cache_free (ce);
+      return (NULL);
+    }
+    ce->history_length = (size_t) se.history_length;
+    ce->history_index = (size_t) se.history_index;
+    mem_account_add (cache_mem,
+	(int64_t) (history_num * sizeof (*ce->history)));
+  }
+
+  if (se.meta_num > 0)
+  {
+    ce->meta = meta_data_create ();
+    if (ce->meta == NULL)
+    {
+      cache_free (ce);
+      return (NULL);
+    }
+  }
+
+  for (i = 0; i < se.meta_num; i++)
+  {
+    if (uc_snapshot_read_meta (r, ce->meta) != 0)
+    {
+      cache_free (ce);
+      return (NULL);
+    }
+  }
+
+  /* The entry has been parsed completely, from here on it's only skipped. */
+  *ret_error = 0;
+
+  /* Discard entries which would have timed out by now. */
+  if ((ce->last_update > now)
+      || ((now - ce->last_update) >= (ce->interval * max_age)))
+    skip = 1;
+
+  /* Discard entries whose type has changed. The identifier's type is the
+   * part after the last slash, up to an optional dash. */
+  type = strrchr (name, '/');
+  if ((skip == 0) && (type != NULL))
+  {
+    char *type_instance = strchr (++type, '-');
+    if (type_instance != NULL)
+      *type_instance = 0;
+
+    ds = plugin_get_ds (type);
+    if ((ds == NULL) || (ds->ds_num != ce->values_num))
+      skip = 1;
+  }
+  else
+    skip = 1;
+
+  if (skip)
+  {
+    cache_free (ce);
+    return (NULL);
+  }
+
+  /* Give the value a full timeout period to be updated again, otherwise the
+   * downtime would make `uc_check_timeout' remove it right away. */
+  ce->last_update = now;
+
+  return (ce);
+} /* }}} cache_entry_t *uc_snapshot_read_entry */
+
+static int uc_snapshot_load (const char *file, int max_age) /* {{{ */
+{
+  uc_snapshot_header_t header;
+  uc_snapshot_reader_t r;
+  struct stat statbuf;
+  void *map;
+  cdtime_t now;
+  uint64_t i;
+  size_t loaded = 0;
+  int fd;
+
+  fd = open (file, O_RDONLY);
+  if (fd < 0)
+  {
+    char errbuf[1024];
+    if (errno != ENOENT)
+      ERROR ("utils_cache: Opening the cache file \"%s\" failed: %s",
+	  file, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if ((fstat (fd, &statbuf) != 0) || (statbuf.st_size == 0))
+  {
+    close (fd);
+    return (-1);
+  }
+
+  map = mmap (/* addr = */ NULL, (size_t) statbuf.st_size, PROT_READ,
+      MAP_PRIVATE, fd, /* offset = */ 0);
+  close (fd);
+  if (map == MAP_FAILED)
+  {
+    char errbuf[1024];
+    ERROR ("utils_cache: mmap (\"%s\") failed: %s",
+	file, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  r.ptr = map;
+  r.left = (size_t) statbuf.st_size;
+
+  if ((uc_snapshot_read (&r, &header, sizeof (header)) != 0)
+      || (memcmp (header.magic, UC_SNAPSHOT_MAGIC, sizeof (header.magic)) != 0)
+      || (header.version != UC_SNAPSHOT_VERSION)
+      || (header.entry_size != sizeof (uc_snapshot_entry_t))
+      || (header.value_size != sizeof (value_t)))
+  {
+    WARNING ("utils_cache: \"%s\" is not a compatible cache file. "
+	"Ignoring it.", file);
+    munmap (map, (size_t) statbuf.st_size);
+    return (-1);
+  }
+
+  now = cdtime ();
+  for (i = 0; i < header.entries_num; i++)
+  {
+    cache_entry_t *ce;
+    cache_shard_t *shard;
+    int error = 0;
+
+    ce = uc_snapshot_read_entry (&r, now, max_age, &error);
+    if (error)
+    {
+      ERROR ("utils_cache: The cache file \"%s\" is truncated or corrupt.",
+	  file);
+      break;
+    }
+    if (ce == NULL)
+      continue;
+
+    shard = cache_get_shard (ce->hash);
+    pthread_mutex_lock (&shard->lock);
+    if ((cache_lookup (shard, ce->name, ce->hash) != NULL)
+	|| (cache_link (shard, ce) != 0))
+      cache_free (ce);
+    else
+      loaded++;
+    pthread_mutex_unlock (&shard->lock);
+  }
+
+  munmap (map, (size_t) statbuf.st_size);
+
+  INFO ("utils_cache: Restored %zu of %"PRIu64" cache entries from \"%s\".",
+      loaded, header.entries_num, file);
+  return (0);
+} /* }}} int uc_snapshot_load */
+
+static int uc_snapshot_save (const char *file) /* {{{ */
+{
+  uc_snapshot_header_t header;
+  char tmpfile[PATH_MAX];
+  size_t shard_idx;
+  size_t bucket_idx;
+  FILE *fh;
+  int status = 0;
+
+  ssnprintf (tmpfile, sizeof (tmpfile), "%s.tmp", file);
+
+  fh = fopen (tmpfile, "w");
+  if (fh == NULL)
+  {
+    char errbuf[1024];
+    ERROR ("utils_cache: fopen (\"%s\") failed: %s",
+	tmpfile, sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  /* The number of entries is filled in once all entries have been written. */
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, UC_SNAPSHOT_MAGIC, sizeof (header.magic));
+  header.version = UC_SNAPSHOT_VERSION;
+  header.entry_size = sizeof (uc_snapshot_entry_t);
+  header.value_size = sizeof (value_t);
+  status = uc_snapshot_write (fh, &header, sizeof (header));
 
-      case DS_TYPE_DERIVE:
-	ce->values_gauge[i] = NAN;
-	ce->values_raw[i].derive = vl->values[i].derive;
-	break;
+  for (shard_idx = 0; (shard_idx < UC_SHARDS_NUM) && (status == 0); shard_idx++)
+  {
+    cache_shard_t *shard = cache_shards + shard_idx;
 
-      case DS_TYPE_ABSOLUTE:
-	ce->values_gauge[i] = NAN;
-	if (vl->interval > 0)
-	  ce->values_gauge[i] = ((double) vl->values[i].absolute)
-	    / CDTIME_T_TO_DOUBLE (vl->interval);
-	ce->values_raw[i].absolute = vl->values[i].absolute;
-	break;
-	
-      default:
-	/* This shouldn't happen. */
-	ERROR ("uc_insert: Don't know how to handle data source type %i.",
-	    ds->ds[i].type);
-	return (-1);
-    } /* switch (ds->ds[i].type) */
-  } /* for (i) */
+    pthread_mutex_lock (&shard->lock);
+    for (bucket_idx = 0;
+	(bucket_idx < shard->buckets_num) && (status == 0);
+	bucket_idx++)
+    {
+      cache_entry_t *ce;
 
-  /* Prune invalid gauge data */
-  uc_check_range (ds, ce);
+      for (ce = shard->buckets[bucket_idx];
+	  (ce != NULL) && (status == 0);
+	  ce = ce->next)
+      {
+	uc_snapshot_entry_t se;
+	char **toc = NULL;
+	int toc_num = 0;
+	int i;
+
+	if (ce->meta != NULL)
+	  toc_num = meta_data_toc (ce->meta, &toc);
+
+	memset (&se, 0, sizeof (se));
+	se.name_len = (uint32_t) strlen (ce->name);
+	se.values_num = (uint32_t) ce->values_num;
+	se.last_time = (uint64_t) ce->last_time;
+	se.last_update = (uint64_t) ce->last_update;
+	se.interval = (uint64_t) ce->interval;
+	se.state = (int32_t) ce->state;
+	se.hits = (int32_t) ce->hits;
+	se.history_length = (uint64_t) ce->history_length;
+	se.history_index = (uint64_t) ce->history_index;
+	se.meta_num = (toc_num > 0) ? (uint32_t) toc_num : 0;
+
+	status = uc_snapshot_write (fh, &se, sizeof (se));
+	if (status == 0)
+	  status = uc_snapshot_write (fh, ce->name, se.name_len);
+	if (status == 0)
+	  status = uc_snapshot_write (fh, ce->values_raw,
+	      ce->values_num * sizeof (*ce->values_raw));
+	if (status == 0)
+	  status = uc_snapshot_write (fh, ce->values_gauge,
+	      ce->values_num * sizeof (*ce->values_gauge));
+	if (status == 0)
+	  status = uc_snapshot_write (fh, ce->history,
+	      ce->history_length * ce->values_num * sizeof (*ce->history));
+	if (status == 0)
+	  status = uc_snapshot_write_meta (fh, ce->meta, toc, toc_num);
+
+	for (i = 0; i < toc_num; i++)
+	  sfree (toc[i]);
+	sfree (toc);
+
+	header.entries_num++;
+      } /* for (ce) */
+    } /* for (bucket_idx) */
+    pthread_mutex_unlock (&shard->lock);
+  } /* for (shard_idx) */
+
+  if ((status == 0) && (fseek (fh, 0, SEEK_SET) == 0))
+    status = uc_snapshot_write (fh, &header, sizeof (header));
+  else
+    status = -1;
 
-  ce->last_time = vl->time;
-  ce->last_update = cdtime ();
-  ce->interval = vl->interval;
-  ce->state = STATE_OKAY;
+  if ((fclose (fh) != 0) || (status != 0))
+  {
+    ERROR ("utils_cache: Writing the cache file \"%s\" failed.", tmpfile);
+    unlink (tmpfile);
+    return (-1);
+  }
 
-  if (c_avl_insert (cache_tree, key_copy, ce) != 0)
+  if (rename (tmpfile, file) != 0)
   {
-    sfree (key_copy);
-    ERROR ("uc_insert: c_avl_insert failed.");
+    char errbuf[1024];
+    ERROR ("utils_cache: rename (\"%s\", \"%s\") failed: %s",
+	tmpfile, file, sstrerror (errno, errbuf, sizeof (errbuf)));
+    unlink (tmpfile);
     return (-1);
   }
 
-  DEBUG ("uc_insert: Added %s to the cache.", key);
+  INFO ("utils_cache: Wrote %"PRIu64" cache entries to \"%s\".",
+      header.entries_num, file);
   return (0);
-} /* int uc_insert */
+} /* }}} int uc_snapshot_save */
+
+static int uc_snapshot_max_age (void) /* {{{ */
+{
+  const char *str;
+  int max_age;
+
+  str = global_option_get ("CacheFileMaxAge");
+  if (str == NULL)
+    return (timeout_g);
+
+  max_age = atoi (str);
+  if (max_age <= 0)
+  {
+    WARNING ("utils_cache: CacheFileMaxAge must be positive. "
+	"Using Timeout (%i) instead.", timeout_g);
+    return (timeout_g);
+  }
+
+  return (max_age);
+} /* }}} int uc_snapshot_max_age */
 
 int uc_init (void)
 {
-  if (cache_tree == NULL)
-    cache_tree = c_avl_create ((int (*) (const void *, const void *))
-	cache_compare);
+  const char *file;
+  const char *str;
+
+  pthread_once (&cache_once, cache_shards_init);
+
+  str = global_option_get ("CacheNewEntriesLimit");
+  if (str != NULL)
+    uc_limit_total = atoi (str);
+  str = global_option_get ("CacheNewEntriesPerHostLimit");
+  if (str != NULL)
+    uc_limit_per_host = atoi (str);
+
+  /* `uc_init' may be called more than once, but the snapshot must only be
+   * loaded once. */
+  if (uc_snapshot_loaded)
+    return (0);
+  uc_snapshot_loaded = 1;
+
+  file = global_option_get ("CacheFile");
+  if (file != NULL)
+    uc_snapshot_load (file, uc_snapshot_max_age ());
 
   return (0);
 } /* int uc_init */
 
-int uc_check_timeout (void)
+int uc_shutdown (void)
 {
-  cdtime_t now;
-  cache_entry_t *ce;
+  const char *file;
 
-  char **keys = NULL;
-  cdtime_t *keys_time = NULL;
-  cdtime_t *keys_interval = NULL;
-  int keys_len = 0;
+  file = global_option_get ("CacheFile");
+  if (file == NULL)
+    return (0);
 
-  char *key;
-  c_avl_iterator_t *iter;
+  pthread_once (&cache_once, cache_shards_init);
+  return (uc_snapshot_save (file));
+} /* int uc_shutdown */
 
+int uc_check_timeout (void)
+{
+  cdtime_t now;
+  size_t expired_num = 0;
+  size_t shard_idx;
+  size_t i;
   int status;
-  int i;
-  
-  pthread_mutex_lock (&cache_lock);
+
+  pthread_once (&cache_once, cache_shards_init);
 
   now = cdtime ();
 
-  /* Build a list of entries to be flushed */
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &ce) == 0)
+  /* Build a list of entries to be flushed. Only entries that are actually
+   * due are looked at and only one shard is locked at a time. */
+  for (shard_idx = 0; shard_idx < UC_SHARDS_NUM; shard_idx++)
   {
-    char **tmp;
-    cdtime_t *tmp_time;
-
-    /* If the entry is fresh enough, continue. */
-    if ((now - ce->last_update) < (ce->interval * timeout_g))
-      continue;
-
-    /* If entry has not been updated, add to `keys' array */
-    tmp = (char **) realloc ((void *) keys,
-	(keys_len + 1) * sizeof (char *));
-    if (tmp == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys = tmp;
-
-    tmp_time = realloc (keys_time, (keys_len + 1) * sizeof (*keys_time));
-    if (tmp_time == NULL)
-    {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_time = tmp_time;
+    cache_shard_t *shard = cache_shards + shard_idx;
+    cache_entry_t *ce;
 
-    tmp_time = realloc (keys_interval, (keys_len + 1) * sizeof (*keys_interval));
-    if (tmp_time == NULL)
+    pthread_mutex_lock (&shard->lock);
+    while ((ce = cache_heap_expire (shard, now)) != NULL)
     {
-      ERROR ("uc_check_timeout: realloc failed.");
-      continue;
-    }
-    keys_interval = tmp_time;
-
-    keys[keys_len] = strdup (key);
-    if (keys[keys_len] == NULL)
-    {
-      ERROR ("uc_check_timeout: strdup failed.");
-      continue;
-    }
-    keys_time[keys_len] = ce->last_time;
-    keys_interval[keys_len] = ce->interval;
-
-    keys_len++;
-  } /* while (c_avl_iterator_next) */
+      if (expired_num >= cache_expired_size)
+      {
+	cache_expired_t *tmp;
+	size_t size;
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+	size = (cache_expired_size == 0) ? 64 : (2 * cache_expired_size);
+	tmp = realloc (cache_expired, size * sizeof (*cache_expired));
+	if (tmp == NULL)
+	{
+	  ERROR ("uc_check_timeout: realloc failed.");
+	  /* Put the entry back, it will be handled by the next call. */
+	  cache_heap_insert (shard, ce);
+	  break;
+	}
+	cache_expired = tmp;
+	cache_expired_size = size;
+      }
 
-  if (keys_len == 0)
+      sstrncpy (cache_expired[expired_num].name, ce->name,
+	  sizeof (cache_expired[expired_num].name));
+      cache_expired[expired_num].hash = ce->hash;
+      cache_expired[expired_num].time = ce->last_time;
+      cache_expired[expired_num].interval = ce->interval;
+      expired_num++;
+    } /* while (cache_heap_expire) */
+    pthread_mutex_unlock (&shard->lock);
+  } /* for (shard_idx) */
+
+  if (expired_num == 0)
     return (0);
 
   /* Call the "missing" callback for each value. Do this before removing the
@@ -303,7 +1562,7 @@ int uc_check_timeout (void)
    * including plugin specific meta data, rates, history, …. This must be done
    * without holding the lock, otherwise we will run into a deadlock if a
    * plugin calls the cache interface. */
-  for (i = 0; i < keys_len; i++)
+  for (i = 0; i < expired_num; i++)
   {
     value_list_t vl = VALUE_LIST_INIT;
 
@@ -311,80 +1570,115 @@ int uc_check_timeout (void)
     vl.values_len = 0;
     vl.meta = NULL;
 
-    status = parse_identifier_vl (keys[i], &vl);
+    status = parse_identifier_vl (cache_expired[i].name, &vl);
     if (status != 0)
     {
-      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.", keys[i]);
-      cache_free (ce);
+      ERROR ("uc_check_timeout: parse_identifier_vl (\"%s\") failed.",
+	  cache_expired[i].name);
       continue;
     }
 
-    vl.time = keys_time[i];
-    vl.interval = keys_interval[i];
+    vl.time = cache_expired[i].time;
+    vl.interval = cache_expired[i].interval;
 
     plugin_dispatch_missing (&vl);
-  } /* for (i = 0; i < keys_len; i++) */
+  } /* for (i = 0; i < expired_num; i++) */
 
   /* Now actually remove all the values from the cache. We don't re-evaluate
    * the timestamp again, so in theory it is possible we remove a value after
    * it is updated here. */
-  pthread_mutex_lock (&cache_lock);
-  for (i = 0; i < keys_len; i++)
+  for (i = 0; i < expired_num; i++)
   {
-    key = NULL;
-    ce = NULL;
-
-    status = c_avl_remove (cache_tree, keys[i],
-	(void *) &key, (void *) &ce);
-    if (status != 0)
-    {
-      ERROR ("uc_check_timeout: c_avl_remove (\"%s\") failed.", keys[i]);
-      sfree (keys[i]);
-      continue;
-    }
+    cache_shard_t *shard = cache_get_shard (cache_expired[i].hash);
+    cache_entry_t *ce;
 
-    sfree (keys[i]);
-    sfree (key);
-    cache_free (ce);
-  } /* for (i = 0; i < keys_len; i++) */
-  pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_lock (&shard->lock);
+    ce = cache_unlink (shard, cache_expired[i].name, cache_expired[i].hash);
+    pthread_mutex_unlock (&shard->lock);
 
-  sfree (keys);
-  sfree (keys_time);
-  sfree (keys_interval);
+    if (ce == NULL)
+      ERROR ("uc_check_timeout: cache_unlink (\"%s\") failed.",
+	  cache_expired[i].name);
+    else
+      cache_free (ce);
+  } /* for (i = 0; i < expired_num; i++) */
 
   return (0);
 } /* int uc_check_timeout */
 
-int uc_update (const data_set_t *ds, const value_list_t *vl)
+/* Runs the registered check on the updated entry `ce'. Returns non-zero if
+ * `uc_report' has to be called with `check' after the shard's lock, which
+ * must be held by the caller, has been released. */
+static int uc_check_locked (const data_set_t *ds, const value_list_t *vl,
+    cache_entry_t *ce, uc_check_t *check)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  gauge_t *rates;
   int status;
-  int i;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
-  {
-    ERROR ("uc_update: FORMAT_VL failed.");
-    return (-1);
-  }
+  if ((uc_check_callback == NULL) || (ce->state == STATE_MISSING))
+    return (0);
+
+  memset (check, 0, sizeof (*check));
+  check->rates = ce->values_gauge;
+  check->state = ce->state;
+  check->hits = ce->hits;
+  check->threshold = ce->threshold;
+  check->threshold_generation = ce->threshold_generation;
+
+  status = (*uc_check_callback) (ds, vl, check);
+
+  ce->state = check->state;
+  ce->hits = check->hits;
+  ce->threshold = check->threshold;
+  ce->threshold_generation = check->threshold_generation;
 
-  pthread_mutex_lock (&cache_lock);
+  if ((status == 0) || (uc_report_callback == NULL))
+    return (0);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0) /* entry does not yet exist */
+  /* The entry may change as soon as the lock has been released. */
+  rates = malloc (ce->values_num * sizeof (*rates));
+  if (rates == NULL)
   {
-    status = uc_insert (ds, vl, name);
-    pthread_mutex_unlock (&cache_lock);
-    return (status);
+    ERROR ("uc_check_locked: malloc failed.");
+    return (0);
   }
+  memcpy (rates, ce->values_gauge, ce->values_num * sizeof (*rates));
+  check->rates = rates;
+
+  return (1);
+} /* int uc_check_locked */
+
+static void uc_report (const data_set_t *ds, const value_list_t *vl,
+    uc_check_t *check)
+{
+  (*uc_report_callback) (ds, vl, check);
+
+  free ((void *) check->rates);
+  check->rates = NULL;
+} /* void uc_report */
+
+/* The shard's lock must be held by the caller. */
+static int uc_update_locked (cache_shard_t *shard, const data_set_t *ds,
+    const value_list_t *vl, const char *name, uint32_t hash,
+    cache_entry_t **ret_ce)
+{
+  cache_entry_t *ce;
+  int i;
+
+  ce = cache_lookup (shard, name, hash);
+  if (ce == NULL) /* entry does not yet exist */
+    return (uc_insert (shard, ds, vl, name, hash, ret_ce));
 
   assert (ce != NULL);
   assert (ce->values_num == ds->ds_num);
 
   if (ce->last_time >= vl->time)
   {
-    pthread_mutex_unlock (&cache_lock);
+    /* Received values usually are this old because they have looped back
+     * to where they came from. That's expected with `Forward'. */
+    if (vl->flags & VL_FLAG_RECEIVED)
+      return (UC_REJECTED);
+
     NOTICE ("uc_update: Value too old: name = %s; value time = %.3f; "
 	"last cache update = %.3f;",
 	name,
@@ -447,7 +1741,6 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
 
       default:
 	/* This shouldn't happen. */
-	pthread_mutex_unlock (&cache_lock);
 	ERROR ("uc_update: Don't know how to handle data source type %i.",
 	    ds->ds[i].type);
 	return (-1);
@@ -470,31 +1763,206 @@ int uc_update (const data_set_t *ds, const value_list_t *vl)
     ce->history_index = (ce->history_index + 1) % ce->history_length;
   }
 
+  if (ce->compact != NULL)
+  {
+    float *step = ce->compact + (ce->values_num * ce->compact_index);
+
+    for (i = 0; i < ce->values_num; i++)
+      step[i] = (float) ce->values_gauge[i];
+
+    ce->compact_index = (ce->compact_index + 1) % ce->compact_length;
+  }
+
   /* Prune invalid gauge data */
   uc_check_range (ds, ce);
 
   ce->last_time = vl->time;
-  ce->last_update = cdtime ();
+  ce->last_update = cdtime_cached ();
   ce->interval = vl->interval;
 
-  pthread_mutex_unlock (&cache_lock);
-
+  *ret_ce = ce;
   return (0);
+} /* int uc_update_locked */
+
+int uc_update (const data_set_t *ds, const value_list_t *vl)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard;
+  cache_entry_t *ce = NULL;
+  uc_check_t check;
+  int report = 0;
+  int status;
+
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
+  {
+    ERROR ("uc_update: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  shard = cache_get_shard (ident->hash);
+
+  pthread_mutex_lock (&shard->lock);
+  status = uc_update_locked (shard, ds, vl, ident->name, ident->hash, &ce);
+  if (status == 0)
+    report = uc_check_locked (ds, vl, ce, &check);
+  pthread_mutex_unlock (&shard->lock);
+
+  CD_PROBE2 (cache__update, ident->name, status);
+
+  if (report)
+    uc_report (ds, vl, &check);
+
+  return (status);
 } /* int uc_update */
 
+int uc_update_batch (const data_set_t **ds, const value_list_t *vl,
+    _Bool *rejected, size_t vl_num)
+{
+  const vl_identifier_t **idents;
+  /* Only needed for value lists which are not being dispatched. */
+  vl_identifier_t *ident_bufs = NULL;
+  size_t *order;
+  /* Checks to report once the shard's lock has been released. */
+  uc_check_t *checks = NULL;
+  size_t *reports = NULL;
+  size_t reports_num;
+  size_t shard_start[UC_SHARDS_NUM + 1];
+  size_t shard_pos[UC_SHARDS_NUM];
+  int failed = 0;
+  size_t i;
+
+  if (vl_num == 0)
+    return (0);
+
+  if (rejected != NULL)
+    memset (rejected, 0, vl_num * sizeof (*rejected));
+
+  idents = calloc (vl_num, sizeof (*idents));
+  order = calloc (vl_num, sizeof (*order));
+  if (uc_check_callback != NULL)
+  {
+    checks = calloc (vl_num, sizeof (*checks));
+    reports = calloc (vl_num, sizeof (*reports));
+  }
+  if ((idents == NULL) || (order == NULL)
+      || ((uc_check_callback != NULL)
+	&& ((checks == NULL) || (reports == NULL))))
+  {
+    ERROR ("uc_update_batch: calloc failed.");
+    sfree (idents);
+    sfree (order);
+    sfree (checks);
+    sfree (reports);
+    return (-1);
+  }
+
+  /* Format and hash the identifiers before acquiring any lock. */
+  memset (shard_start, 0, sizeof (shard_start));
+  for (i = 0; i < vl_num; i++)
+  {
+    if (ds[i] == NULL)
+      continue;
+
+    if ((vl[i].identifier == NULL) && (ident_bufs == NULL))
+    {
+      ident_bufs = calloc (vl_num, sizeof (*ident_bufs));
+      if (ident_bufs == NULL)
+      {
+        ERROR ("uc_update_batch: calloc failed.");
+        sfree (idents);
+        sfree (order);
+        sfree (checks);
+        sfree (reports);
+        return (-1);
+      }
+    }
+
+    idents[i] = plugin_value_list_identifier (vl + i,
+        (ident_bufs != NULL) ? ident_bufs + i : NULL);
+    if (idents[i] == NULL)
+    {
+      ERROR ("uc_update_batch: FORMAT_VL failed.");
+      failed++;
+      continue;
+    }
+
+    shard_start[(idents[i]->hash % UC_SHARDS_NUM) + 1]++;
+  }
+
+  /* Group the entries by shard, so that each shard's lock is acquired at
+   * most once. This is a counting sort, so the order of updates within a
+   * shard (and therefore for any one identifier) is preserved. */
+  for (i = 1; i <= UC_SHARDS_NUM; i++)
+    shard_start[i] += shard_start[i - 1];
+
+  memcpy (shard_pos, shard_start, sizeof (shard_pos));
+  for (i = 0; i < vl_num; i++)
+  {
+    if ((ds[i] == NULL) || (idents[i] == NULL))
+      continue;
+    order[shard_pos[idents[i]->hash % UC_SHARDS_NUM]++] = i;
+  }
+
+  for (i = 0; i < UC_SHARDS_NUM; i++)
+  {
+    cache_shard_t *shard;
+    size_t j;
+
+    if (shard_start[i] == shard_start[i + 1])
+      continue;
+
+    shard = cache_get_shard ((uint32_t) i);
+    reports_num = 0;
+    pthread_mutex_lock (&shard->lock);
+    for (j = shard_start[i]; j < shard_start[i + 1]; j++)
+    {
+      size_t idx = order[j];
+      cache_entry_t *ce = NULL;
+      int status;
+
+      status = uc_update_locked (shard, ds[idx], vl + idx, idents[idx]->name,
+	  idents[idx]->hash, &ce);
+      CD_PROBE2 (cache__update, idents[idx]->name, status);
+      if (status == UC_REJECTED)
+      {
+	ds[idx] = NULL;
+	if (rejected != NULL)
+	  rejected[idx] = 1;
+      }
+      else if (status != 0)
+	failed++;
+      else if ((checks != NULL)
+	  && uc_check_locked (ds[idx], vl + idx, ce, checks + reports_num))
+	reports[reports_num++] = idx;
+    }
+    pthread_mutex_unlock (&shard->lock);
+
+    for (j = 0; j < reports_num; j++)
+      uc_report (ds[reports[j]], vl + reports[j], checks + j);
+  }
+
+  sfree (idents);
+  sfree (ident_bufs);
+  sfree (order);
+  sfree (checks);
+  sfree (reports);
+
+  return ((failed == 0) ? 0 : -1);
+} /* int uc_update_batch */
+
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num)
 {
   gauge_t *ret = NULL;
   size_t ret_num = 0;
-  cache_entry_t *ce = NULL;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int status = 0;
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked (name, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
-
     /* remove missing values from getval */
     if (ce->state == STATE_MISSING)
     {
@@ -511,130 +1979,348 @@ int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_val
       }
       else
       {
-        memcpy (ret, ce->values_gauge, ret_num * sizeof (gauge_t));
+        memcpy (ret, ce->values_gauge, ret_num * sizeof (gauge_t));
+      }
+    }
+
+    pthread_mutex_unlock (&shard->lock);
+  }
+  else
+  {
+    DEBUG ("utils_cache: uc_get_rate_by_name: No such value: %s", name);
+    status = -1;
+  }
+
+  if (status == 0)
+  {
+    *ret_values = ret;
+    *ret_values_num = ret_num;
+  }
+
+  return (status);
+} /* gauge_t *uc_get_rate_by_name */
+
+gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
+{
+  gauge_t *ret;
+
+  ret = malloc (ds->ds_num * sizeof (*ret));
+  if (ret == NULL)
+  {
+    ERROR ("utils_cache: uc_get_rate: malloc failed.");
+    return (NULL);
+  }
+
+  if (uc_get_rate_buffer (ds, vl, ret) != 0)
+  {
+    sfree (ret);
+    return (NULL);
+  }
+
+  return (ret);
+} /* gauge_t *uc_get_rate */
+
+gauge_t *uc_get_rate_arena (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl)
+{
+  gauge_t *ret;
+
+  ret = arena_alloc (ds->ds_num * sizeof (*ret));
+  if (ret == NULL)
+    return (NULL);
+
+  if (uc_get_rate_buffer (ds, vl, ret) != 0)
+    return (NULL);
+
+  return (ret);
+} /* }}} gauge_t *uc_get_rate_arena */
+
+int uc_get_rate_by_name_multi (char * const *names, size_t names_num, /* {{{ */
+    gauge_t **ret_values, size_t *ret_values_num)
+{
+  uint32_t *hashes;
+  size_t *order;
+  size_t shard_start[UC_SHARDS_NUM + 1];
+  size_t shard_pos[UC_SHARDS_NUM];
+  int found = 0;
+  size_t i;
+
+  if (names_num == 0)
+    return (0);
+
+  hashes = calloc (names_num, sizeof (*hashes));
+  order = calloc (names_num, sizeof (*order));
+  if ((hashes == NULL) || (order == NULL))
+  {
+    ERROR ("uc_get_rate_by_name_multi: calloc failed.");
+    sfree (hashes);
+    sfree (order);
+    return (-1);
+  }
+
+  pthread_once (&cache_once, cache_shards_init);
+
+  /* Group the names by shard, like uc_update_batch does. */
+  memset (shard_start, 0, sizeof (shard_start));
+  for (i = 0; i < names_num; i++)
+  {
+    ret_values[i] = NULL;
+    ret_values_num[i] = 0;
+
+    hashes[i] = cache_hash (names[i]);
+    shard_start[(hashes[i] % UC_SHARDS_NUM) + 1]++;
+  }
+
+  for (i = 1; i <= UC_SHARDS_NUM; i++)
+    shard_start[i] += shard_start[i - 1];
+
+  memcpy (shard_pos, shard_start, sizeof (shard_pos));
+  for (i = 0; i < names_num; i++)
+    order[shard_pos[hashes[i] % UC_SHARDS_NUM]++] = i;
+
+  for (i = 0; i < UC_SHARDS_NUM; i++)
+  {
+    cache_shard_t *shard;
+    size_t j;
+
+    if (shard_start[i] == shard_start[i + 1])
+      continue;
+
+    shard = cache_get_shard ((uint32_t) i);
+    pthread_mutex_lock (&shard->lock);
+    for (j = shard_start[i]; j < shard_start[i + 1]; j++)
+    {
+      size_t idx = order[j];
+      cache_entry_t *ce;
+      gauge_t *values;
+
+      ce = cache_lookup (shard, names[idx], hashes[idx]);
+      if ((ce == NULL) || (ce->state == STATE_MISSING))
+        continue;
+
+      values = malloc (ce->values_num * sizeof (*values));
+      if (values == NULL)
+      {
+        ERROR ("uc_get_rate_by_name_multi: malloc failed.");
+        continue;
       }
+      memcpy (values, ce->values_gauge, ce->values_num * sizeof (*values));
+
+      ret_values[idx] = values;
+      ret_values_num[idx] = (size_t) ce->values_num;
+      found++;
     }
+    pthread_mutex_unlock (&shard->lock);
   }
-  else
+
+  sfree (hashes);
+  sfree (order);
+
+  return (found);
+} /* }}} int uc_get_rate_by_name_multi */
+
+/* Copies the rates and/or the raw values of `name' into the caller's buffers
+ * while holding the shard's lock once. Either buffer may be NULL. Both must
+ * hold `values_num' elements; if the entry has a different number of values,
+ * nothing is copied and EINVAL is returned. */
+static int uc_copy_by_name (const char *name, /* {{{ */
+    gauge_t *ret_rates, value_t *ret_values, size_t values_num)
+{
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
+  int status = 0;
+
+  ce = cache_get_locked (name, &shard);
+  if (ce == NULL)
   {
-    DEBUG ("utils_cache: uc_get_rate_by_name: No such value: %s", name);
-    status = -1;
+    DEBUG ("utils_cache: uc_copy_by_name: No such value: %s", name);
+    return (-1);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
-  if (status == 0)
+  /* remove missing values from getval */
+  if (ce->state == STATE_MISSING)
+    status = -1;
+  else if ((size_t) ce->values_num != values_num)
   {
-    *ret_values = ret;
-    *ret_values_num = ret_num;
+    ERROR ("utils_cache: uc_copy_by_name: %s has %i values, but the caller "
+        "expected %zu.", name, ce->values_num, values_num);
+    status = EINVAL;
+  }
+  else
+  {
+    if (ret_rates != NULL)
+      memcpy (ret_rates, ce->values_gauge, values_num * sizeof (gauge_t));
+    if (ret_values != NULL)
+      memcpy (ret_values, ce->values_raw, values_num * sizeof (value_t));
   }
 
+  pthread_mutex_unlock (&shard->lock);
   return (status);
-} /* gauge_t *uc_get_rate_by_name */
+} /* }}} int uc_copy_by_name */
 
-gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl)
+int uc_get_rate_by_name_buffer (const char *name, /* {{{ */
+    gauge_t *ret_values, size_t values_num)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  gauge_t *ret = NULL;
-  size_t ret_num = 0;
-  int status;
+  return (uc_copy_by_name (name, ret_values, /* raw = */ NULL, values_num));
+} /* }}} int uc_get_rate_by_name_buffer */
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+int uc_get_rate_buffer (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl, gauge_t *ret_values)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
-    ERROR ("utils_cache: uc_get_rate: FORMAT_VL failed.");
-    return (NULL);
+    ERROR ("utils_cache: uc_get_rate_buffer: FORMAT_VL failed.");
+    return (-1);
   }
 
-  status = uc_get_rate_by_name (name, &ret, &ret_num);
-  if (status != 0)
-    return (NULL);
+  return (uc_copy_by_name (ident->name, ret_values, /* raw = */ NULL,
+        (size_t) ds->ds_num));
+} /* }}} int uc_get_rate_buffer */
+
+int uc_get_rate_and_values (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl, gauge_t *ret_rates, value_t *ret_values)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
 
-  /* This is important - the caller has no other way of knowing how many
-   * values are returned. */
-  if (ret_num != (size_t) ds->ds_num)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
-    ERROR ("utils_cache: uc_get_rate: ds[%s] has %i values, "
-	"but uc_get_rate_by_name returned %zu.",
-	ds->type, ds->ds_num, ret_num);
-    sfree (ret);
-    return (NULL);
+    ERROR ("utils_cache: uc_get_rate_and_values: FORMAT_VL failed.");
+    return (-1);
   }
 
-  return (ret);
-} /* gauge_t *uc_get_rate */
+  return (uc_copy_by_name (ident->name, ret_rates, ret_values,
+        (size_t) ds->ds_num));
+} /* }}} int uc_get_rate_and_values */
+
+struct uc_name_time_s
+{
+  char *name;
+  cdtime_t time;
+};
+
+static int uc_name_time_compare (const void *a, const void *b) /* {{{ */
+{
+  const struct uc_name_time_s *nt_a = a;
+  const struct uc_name_time_s *nt_b = b;
+
+  return (strcmp (nt_a->name, nt_b->name));
+} /* }}} int uc_name_time_compare */
 
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
 {
-  c_avl_iterator_t *iter;
-  char *key;
-  cache_entry_t *value;
+  struct uc_name_time_s *list = NULL;
+  size_t list_size = 0;
+  size_t number = 0;
 
   char **names = NULL;
   cdtime_t *times = NULL;
-  size_t number = 0;
+
+  size_t shard_idx;
+  size_t bucket_idx;
+  size_t i;
 
   int status = 0;
 
   if ((ret_names == NULL) || (ret_number == NULL))
     return (-1);
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_once (&cache_once, cache_shards_init);
 
-  iter = c_avl_get_iterator (cache_tree);
-  while (c_avl_iterator_next (iter, (void *) &key, (void *) &value) == 0)
+  for (shard_idx = 0; (shard_idx < UC_SHARDS_NUM) && (status == 0); shard_idx++)
   {
-    char **temp;
+    cache_shard_t *shard = cache_shards + shard_idx;
 
-    /* remove missing values when list values */
-    if (value->state == STATE_MISSING)
-      continue;
+    pthread_mutex_lock (&shard->lock);
 
-    if (ret_times != NULL)
+    /* Make room for all entries of this shard at once. */
+    if ((number + shard->entries_num) > list_size)
     {
-      cdtime_t *tmp_times;
+      struct uc_name_time_s *tmp;
+      size_t new_size = number + shard->entries_num;
 
-      tmp_times = (cdtime_t *) realloc (times, sizeof (cdtime_t) * (number + 1));
-      if (tmp_times == NULL)
+      tmp = realloc (list, new_size * sizeof (*list));
+      if (tmp == NULL)
       {
+	pthread_mutex_unlock (&shard->lock);
 	status = -1;
 	break;
       }
-      times = tmp_times;
-      times[number] = value->last_time;
+      list = tmp;
+      list_size = new_size;
     }
 
-    temp = (char **) realloc (names, sizeof (char *) * (number + 1));
-    if (temp == NULL)
+    for (bucket_idx = 0; bucket_idx < shard->buckets_num; bucket_idx++)
     {
-      status = -1;
-      break;
-    }
-    names = temp;
-    names[number] = strdup (key);
-    if (names[number] == NULL)
+      cache_entry_t *value;
+
+      for (value = shard->buckets[bucket_idx]; value != NULL; value = value->next)
+      {
+	/* remove missing values when list values */
+	if (value->state == STATE_MISSING)
+	  continue;
+
+	assert (number < list_size);
+	list[number].name = strdup (value->name);
+	if (list[number].name == NULL)
+	{
+	  status = -1;
+	  break;
+	}
+	list[number].time = value->last_time;
+	number++;
+      }
+
+      if (status != 0)
+	break;
+    } /* for (bucket_idx) */
+
+    pthread_mutex_unlock (&shard->lock);
+  } /* for (shard_idx) */
+
+  if (status == 0)
+  {
+    /* Callers expect the names in lexicographical order. */
+    if (number > 1)
+      qsort (list, number, sizeof (*list), uc_name_time_compare);
+
+    if (number > 0)
     {
-      status = -1;
-      break;
-    }
-    number++;
-  } /* while (c_avl_iterator_next) */
+      names = calloc (number, sizeof (*names));
+      if (ret_times != NULL)
+	times = calloc (number, sizeof (*times));
 
-  c_avl_iterator_destroy (iter);
-  pthread_mutex_unlock (&cache_lock);
+      if ((names == NULL) || ((ret_times != NULL) && (times == NULL)))
+	status = -1;
+    }
+  }
 
   if (status != 0)
   {
-    size_t i;
-    
     for (i = 0; i < number; i++)
     {
-      sfree (names[i]);
+      sfree (list[i].name);
     }
+    sfree (list);
     sfree (names);
+    sfree (times);
 
     return (-1);
   }
 
+  for (i = 0; i < number; i++)
+  {
+    names[i] = list[i].name;
+    if (times != NULL)
+      times[i] = list[i].time;
+  }
+  sfree (list);
+
   *ret_names = names;
   if (ret_times != NULL)
     *ret_times = times;
@@ -643,76 +2329,154 @@ int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number)
   return (0);
 } /* int uc_get_names */
 
+int uc_iterate (const char *prefix, uc_iterate_cb callback, /* {{{ */
+    void *user_data)
+{
+  return (uc_iterate_chunked (prefix, callback,
+        /* chunk_done = */ NULL, user_data));
+} /* }}} int uc_iterate */
+
+/* Exactly one of `callback' and `rates_callback' is set. */
+static int uc_iterate_internal (const char *prefix, /* {{{ */
+    uc_iterate_cb callback, uc_iterate_rates_cb rates_callback,
+    uc_iterate_done_cb chunk_done, void *user_data)
+{
+  size_t prefix_len = 0;
+  size_t shard_idx;
+  size_t bucket_idx;
+  int status = 0;
+
+  if ((prefix != NULL) && (prefix[0] != 0))
+    prefix_len = strlen (prefix);
+
+  pthread_once (&cache_once, cache_shards_init);
+
+  /* Only one shard is locked at a time, so updates of the other shards are
+   * not blocked while the callback is running. */
+  for (shard_idx = 0; (shard_idx < UC_SHARDS_NUM) && (status == 0); shard_idx++)
+  {
+    cache_shard_t *shard = cache_shards + shard_idx;
+
+    pthread_mutex_lock (&shard->lock);
+    for (bucket_idx = 0;
+	(bucket_idx < shard->buckets_num) && (status == 0);
+	bucket_idx++)
+    {
+      cache_entry_t *ce;
+
+      for (ce = shard->buckets[bucket_idx];
+	  (ce != NULL) && (status == 0);
+	  ce = ce->next)
+      {
+	if (ce->state == STATE_MISSING)
+	  continue;
+
+	if ((prefix_len > 0) && (strncmp (ce->name, prefix, prefix_len) != 0))
+	  continue;
+
+	if (callback != NULL)
+	  status = (*callback) (ce->name, ce->last_time, ce->interval,
+	      user_data);
+	else
+	  status = (*rates_callback) (ce->name, ce->last_time, ce->interval,
+	      ce->values_gauge, (size_t) ce->values_num, user_data);
+      }
+    } /* for (bucket_idx) */
+    pthread_mutex_unlock (&shard->lock);
+
+    if ((status == 0) && (chunk_done != NULL))
+      status = (*chunk_done) (user_data);
+  } /* for (shard_idx) */
+
+  return (status);
+} /* }}} int uc_iterate_internal */
+
+int uc_iterate_chunked (const char *prefix, uc_iterate_cb callback, /* {{{ */
+    uc_iterate_done_cb chunk_done, void *user_data)
+{
+  if (callback == NULL)
+    return (-EINVAL);
+
+  return (uc_iterate_internal (prefix, callback, /* rates_callback = */ NULL,
+        chunk_done, user_data));
+} /* }}} int uc_iterate_chunked */
+
+int uc_iterate_rates_chunked (const char *prefix, /* {{{ */
+    uc_iterate_rates_cb callback, uc_iterate_done_cb chunk_done,
+    void *user_data)
+{
+  if (callback == NULL)
+    return (-EINVAL);
+
+  return (uc_iterate_internal (prefix, /* callback = */ NULL, callback,
+        chunk_done, user_data));
+} /* }}} int uc_iterate_rates_chunked */
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->state;
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
   return (ret);
 } /* int uc_get_state */
 
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->state;
     ce->state = state;
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
   return (ret);
 } /* int uc_set_state */
 
 int uc_get_history_by_name (const char *name,
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  cache_entry_t *ce = NULL;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   size_t i;
-  int status = 0;
-
-  pthread_mutex_lock (&cache_lock);
 
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
-  {
-    pthread_mutex_unlock (&cache_lock);
+  ce = cache_get_locked (name, &shard);
+  if (ce == NULL)
     return (-ENOENT);
-  }
 
   if (((size_t) ce->values_num) != num_ds)
   {
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->lock);
     return (-EINVAL);
   }
 
@@ -727,7 +2491,7 @@ int uc_get_history_by_name (const char *name,
 	* num_steps * ce->values_num);
     if (tmp == NULL)
     {
-      pthread_mutex_unlock (&cache_lock);
+      pthread_mutex_unlock (&shard->lock);
       return (-ENOMEM);
     }
 
@@ -736,6 +2500,8 @@ int uc_get_history_by_name (const char *name,
 	i++)
       tmp[i] = NAN;
 
+    mem_account_add (cache_mem, (int64_t) ((num_steps - ce->history_length)
+	  * ce->values_num * sizeof (*ce->history)));
     ce->history = tmp;
     ce->history_length = num_steps;
   } /* if (ce->history_length < num_steps) */
@@ -758,7 +2524,7 @@ int uc_get_history_by_name (const char *name,
 	sizeof (*ret_history) * num_ds);
   }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 
   return (0);
 } /* int uc_get_history_by_name */
@@ -766,127 +2532,392 @@ int uc_get_history_by_name (const char *name,
 int uc_get_history (const data_set_t *ds, const value_list_t *vl,
     gauge_t *ret_history, size_t num_steps, size_t num_ds)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("utils_cache: uc_get_history: FORMAT_VL failed.");
     return (-1);
   }
 
-  return (uc_get_history_by_name (name, ret_history, num_steps, num_ds));
+  return (uc_get_history_by_name (ident->name, ret_history, num_steps, num_ds));
 } /* int uc_get_history */
 
+/* Makes sure the compact history of `ce' has room for `num_steps' steps.
+ * Must be called with the entry's shard locked. */
+static int compact_history_grow (cache_entry_t *ce, size_t num_steps) /* {{{ */
+{
+  float *ring;
+  size_t floats;
+  size_t steps;
+  size_t i;
+
+  if (ce->compact_length >= num_steps)
+    return (0);
+
+  if (num_steps > (UC_RING_MAX_FLOATS / ce->values_num))
+    return (-EINVAL);
+
+  floats = num_steps * ce->values_num;
+  ring = ring_alloc (&floats);
+  if (ring == NULL)
+    return (-ENOMEM);
+  steps = floats / ce->values_num;
+
+  /* Copy the old steps, oldest first, so that the new ring starts out
+   * ordered. The other steps are unknown. */
+  for (i = 0; i < ce->compact_length; i++)
+  {
+    size_t src = (ce->compact_index + i) % ce->compact_length;
+    memcpy (ring + (i * ce->values_num), ce->compact + (src * ce->values_num),
+	ce->values_num * sizeof (*ring));
+  }
+  for (i = ce->compact_length * ce->values_num; i < floats; i++)
+    ring[i] = NAN;
+
+  ring_free_ring (ce->compact, ce->compact_length * ce->values_num);
+  ce->compact = ring;
+  ce->compact_index = ce->compact_length % steps;
+  ce->compact_length = steps;
+
+  return (0);
+} /* }}} int compact_history_grow */
+
+/* Moves the `k'th smallest of the `num' values to `values[k]'. */
+static void history_select (float *values, size_t num, size_t k) /* {{{ */
+{
+  size_t left = 0;
+  size_t right = num - 1;
+
+  while (left < right)
+  {
+    float pivot = values[left + (right - left) / 2];
+    size_t i = left;
+    size_t j = right;
+
+    while (i <= j)
+    {
+      while (values[i] < pivot)
+	i++;
+      while (values[j] > pivot)
+	j--;
+      if (i <= j)
+      {
+	float tmp = values[i];
+	values[i] = values[j];
+	values[j] = tmp;
+	i++;
+	if (j == 0)
+	  break;
+	j--;
+      }
+    }
+
+    if (k <= j)
+      right = j;
+    else if (k >= i)
+      left = i;
+    else
+      break;
+  }
+} /* }}} void history_select */
+
+#define UC_STATS_SCRATCH 256
+
+int uc_get_history_stats_by_name (const char *name, /* {{{ */
+    size_t num_steps, size_t ds_index, double percent,
+    uc_history_stats_t *ret_stats)
+{
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
+  float scratch_buffer[UC_STATS_SCRATCH];
+  float *scratch = NULL;
+  double sum = 0.0;
+  size_t num = 0;
+  size_t i;
+  int status;
+
+  if ((name == NULL) || (ret_stats == NULL) || (num_steps == 0))
+    return (-EINVAL);
+
+  ret_stats->num = 0;
+  ret_stats->min = NAN;
+  ret_stats->max = NAN;
+  ret_stats->mean = NAN;
+  ret_stats->percentile = NAN;
+
+  if ((percent > 0.0) && (percent <= 100.0))
+  {
+    if (num_steps <= UC_STATS_SCRATCH)
+      scratch = scratch_buffer;
+    else
+    {
+      scratch = malloc (num_steps * sizeof (*scratch));
+      if (scratch == NULL)
+	return (-ENOMEM);
+    }
+  }
+
+  ce = cache_get_locked (name, &shard);
+  if (ce == NULL)
+    status = -ENOENT;
+  else if (ds_index >= (size_t) ce->values_num)
+    status = -EINVAL;
+  else
+    status = compact_history_grow (ce, num_steps);
+
+  if (status != 0)
+  {
+    if (ce != NULL)
+      pthread_mutex_unlock (&shard->lock);
+    if (scratch != scratch_buffer)
+      sfree (scratch);
+    return (status);
+  }
+
+  /* The newest `num_steps' steps, in no particular order. */
+  for (i = 0; i < num_steps; i++)
+  {
+    size_t step = (ce->compact_index + ce->compact_length - 1 - i)
+      % ce->compact_length;
+    float value = ce->compact[(step * ce->values_num) + ds_index];
+
+    if (isnan (value))
+      continue;
+
+    if ((num == 0) || (value < ret_stats->min))
+      ret_stats->min = value;
+    if ((num == 0) || (value > ret_stats->max))
+      ret_stats->max = value;
+    sum += value;
+
+    if (scratch != NULL)
+      scratch[num] = value;
+    num++;
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+
+  ret_stats->num = num;
+  if (num > 0)
+  {
+    ret_stats->mean = sum / ((double) num);
+
+    /* Nearest rank, as in utils_sampler.c. */
+    if (scratch != NULL)
+    {
+      size_t rank = (size_t) ceil ((percent / 100.0) * ((double) num));
+      if (rank < 1)
+	rank = 1;
+
+      history_select (scratch, num, rank - 1);
+      ret_stats->percentile = scratch[rank - 1];
+    }
+  }
+
+  if (scratch != scratch_buffer)
+    sfree (scratch);
+
+  return (0);
+} /* }}} int uc_get_history_stats_by_name */
+
+int uc_get_history_stats (const data_set_t __attribute__((unused)) *ds, /* {{{ */
+    const value_list_t *vl, size_t num_steps, size_t ds_index,
+    double percent, uc_history_stats_t *ret_stats)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
+  {
+    ERROR ("utils_cache: uc_get_history_stats: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  return (uc_get_history_stats_by_name (ident->name, num_steps, ds_index,
+	percent, ret_stats));
+} /* }}} int uc_get_history_stats */
+
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int ret = STATE_ERROR;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->hits;
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
   return (ret);
 } /* int uc_get_hits */
 
 int uc_set_hits (const data_set_t *ds, const value_list_t *vl, int hits)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->hits;
     ce->hits = hits;
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
   return (ret);
 } /* int uc_set_hits */
 
 int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
   int ret = -1;
 
-  if (FORMAT_VL (name, sizeof (name), vl) != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("uc_get_state: FORMAT_VL failed.");
     return (STATE_ERROR);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  if (c_avl_get (cache_tree, name, (void *) &ce) == 0)
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
   {
-    assert (ce != NULL);
     ret = ce->hits;
     ce->hits = ret + step;
+    pthread_mutex_unlock (&shard->lock);
   }
 
-  pthread_mutex_unlock (&cache_lock);
-
   return (ret);
 } /* int uc_inc_hits */
 
+int uc_register_check (uc_check_cb check, uc_report_cb report) /* {{{ */
+{
+  if ((uc_check_callback != NULL) && (check != NULL)
+      && (check != uc_check_callback))
+  {
+    ERROR ("uc_register_check: A check has already been registered.");
+    return (-1);
+  }
+
+  uc_check_callback = check;
+  uc_report_callback = report;
+  return (0);
+} /* }}} int uc_register_check */
+
+int uc_get_threshold (const value_list_t *vl, /* {{{ */
+    unsigned int generation, void **ret_threshold)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
+  int ret = ENOENT;
+
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
+  {
+    ERROR ("uc_get_threshold: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce != NULL)
+  {
+    if ((generation != 0) && (ce->threshold_generation == generation))
+    {
+      *ret_threshold = ce->threshold;
+      ret = 0;
+    }
+    pthread_mutex_unlock (&shard->lock);
+  }
+
+  return (ret);
+} /* }}} int uc_get_threshold */
+
+int uc_set_threshold (const value_list_t *vl, /* {{{ */
+    unsigned int generation, void *threshold)
+{
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
+
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
+  {
+    ERROR ("uc_set_threshold: FORMAT_VL failed.");
+    return (-1);
+  }
+
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce == NULL)
+    return (ENOENT);
+
+  ce->threshold = threshold;
+  ce->threshold_generation = generation;
+  pthread_mutex_unlock (&shard->lock);
+
+  return (0);
+} /* }}} int uc_set_threshold */
+
 /*
  * Meta data interface
  */
-/* XXX: This function will acquire `cache_lock' but will not free it! */
-static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
+/* XXX: This function will acquire the shard's lock but will not free it! */
+static meta_data_t *uc_get_meta (const value_list_t *vl, /* {{{ */
+    cache_shard_t **ret_shard)
 {
-  char name[6 * DATA_MAX_NAME_LEN];
-  cache_entry_t *ce = NULL;
-  int status;
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
+  cache_shard_t *shard = NULL;
+  cache_entry_t *ce;
 
-  status = FORMAT_VL (name, sizeof (name), vl);
-  if (status != 0)
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
   {
     ERROR ("utils_cache: uc_get_meta: FORMAT_VL failed.");
     return (NULL);
   }
 
-  pthread_mutex_lock (&cache_lock);
-
-  status = c_avl_get (cache_tree, name, (void *) &ce);
-  if (status != 0)
-  {
-    pthread_mutex_unlock (&cache_lock);
+  ce = cache_get_locked_hash (ident->name, ident->hash, &shard);
+  if (ce == NULL)
     return (NULL);
-  }
-  assert (ce != NULL);
 
   if (ce->meta == NULL)
     ce->meta = meta_data_create ();
 
   if (ce->meta == NULL)
-    pthread_mutex_unlock (&cache_lock);
+    pthread_mutex_unlock (&shard->lock);
 
+  *ret_shard = shard;
   return (ce->meta);
 } /* }}} meta_data_t *uc_get_meta */
 
@@ -894,11 +2925,12 @@ static meta_data_t *uc_get_meta (const value_list_t *vl) /* {{{ */
  * shorter.. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  cache_shard_t *shard; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &shard); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (&shard->lock); \
   return (status); \
 }
 int uc_meta_data_exists (const value_list_t *vl, const char *key)
@@ -912,11 +2944,12 @@ int uc_meta_data_delete (const value_list_t *vl, const char *key)
  * two argumetns. */
 #define UC_WRAP(wrap_function) { \
   meta_data_t *meta; \
+  cache_shard_t *shard; \
   int status; \
-  meta = uc_get_meta (vl); \
+  meta = uc_get_meta (vl, &shard); \
   if (meta == NULL) return (-1); \
   status = wrap_function (meta, key, value); \
-  pthread_mutex_unlock (&cache_lock); \
+  pthread_mutex_unlock (&shard->lock); \
   return (status); \
 }
 int uc_meta_data_add_string (const value_list_t *vl,
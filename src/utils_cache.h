@@ -30,24 +30,172 @@
 #define STATE_MISSING 15
 
 int uc_init (void);
+int uc_shutdown (void);
 int uc_check_timeout (void);
+/* Returned by `uc_update' if `vl' would have created a new entry, but the
+ * `CacheNewEntriesLimit' or `CacheNewEntriesPerHostLimit' has been reached,
+ * or if `vl' has `VL_FLAG_RECEIVED' set and isn't newer than the cached
+ * value. Such value lists must not be passed on to the writers. */
+#define UC_REJECTED 1
+
 int uc_update (const data_set_t *ds, const value_list_t *vl);
+/* Updates `vl_num' entries while acquiring the cache lock only once. Entries
+ * with `ds[i] == NULL' are skipped, and `ds[i]' is set to NULL for rejected
+ * entries, see `UC_REJECTED'. If `rejected' is not NULL, `rejected[i]' is set
+ * for exactly those entries and cleared for all others. */
+int uc_update_batch (const data_set_t **ds, const value_list_t *vl,
+    _Bool *rejected, size_t vl_num);
 int uc_get_rate_by_name (const char *name, gauge_t **ret_values, size_t *ret_values_num);
 gauge_t *uc_get_rate (const data_set_t *ds, const value_list_t *vl);
+/* Like `uc_get_rate', but the rates are allocated from the calling thread's
+ * arena and must not be freed, see utils_arena.h. */
+gauge_t *uc_get_rate_arena (const data_set_t *ds, const value_list_t *vl);
+
+/* Like the two functions above, but write the rates into a buffer provided by
+ * the caller, which must have room for `values_num' or `ds->ds_num' elements,
+ * respectively. `uc_get_rate_and_values' additionally copies the raw values
+ * stored in the cache, under the same lock. All return zero on success. */
+int uc_get_rate_by_name_buffer (const char *name,
+    gauge_t *ret_values, size_t values_num);
+int uc_get_rate_buffer (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_values);
+int uc_get_rate_and_values (const data_set_t *ds, const value_list_t *vl,
+    gauge_t *ret_rates, value_t *ret_values);
+
+/* Looks up the rates of `names_num' identifiers, acquiring each shard's lock
+ * at most once. For each name found, `ret_values[i]' is set to a newly
+ * allocated array of `ret_values_num[i]' rates, which the caller must free.
+ * Other entries are set to NULL. Returns the number of names found or less
+ * than zero on failure. */
+int uc_get_rate_by_name_multi (char * const *names, size_t names_num,
+    gauge_t **ret_values, size_t *ret_values_num);
 
 int uc_get_names (char ***ret_names, cdtime_t **ret_times, size_t *ret_number);
 
+/* Calls `callback' for each cache entry whose identifier starts with
+ * `prefix' (all entries if `prefix' is NULL or empty), except for missing
+ * values. The name passed to the callback points into the cache and the
+ * corresponding lock is held while the callback runs, so the callback must
+ * be fast and must not call any other `uc_*' function. Entries are visited in
+ * no particular order. If the callback returns non-zero, the iteration stops
+ * and that value is returned. */
+typedef int (*uc_iterate_cb) (const char *name, cdtime_t last_time,
+    cdtime_t interval, void *user_data);
+int uc_iterate (const char *prefix, uc_iterate_cb callback, void *user_data);
+
+/* Like `uc_iterate', but calls `chunk_done' after each part of the cache has
+ * been visited and its lock has been released. `chunk_done' may block, for
+ * example to write out what `callback' has collected, without holding up
+ * updates. A non-zero return value stops the iteration, too. */
+typedef int (*uc_iterate_done_cb) (void *user_data);
+int uc_iterate_chunked (const char *prefix, uc_iterate_cb callback,
+    uc_iterate_done_cb chunk_done, void *user_data);
+
+/* Like `uc_iterate_chunked', but also passes the rates of the entry, as
+ * returned by `uc_get_rate'. The rates point into the cache, too. */
+typedef int (*uc_iterate_rates_cb) (const char *name, cdtime_t last_time,
+    cdtime_t interval, const gauge_t *rates, size_t rates_num,
+    void *user_data);
+int uc_iterate_rates_chunked (const char *prefix,
+    uc_iterate_rates_cb callback, uc_iterate_done_cb chunk_done,
+    void *user_data);
+
 int uc_get_state (const data_set_t *ds, const value_list_t *vl);
 int uc_set_state (const data_set_t *ds, const value_list_t *vl, int state);
 int uc_get_hits (const data_set_t *ds, const value_list_t *vl);
 int uc_set_hits (const data_set_t *ds, const value_list_t *vl, int hits);
 int uc_inc_hits (const data_set_t *ds, const value_list_t *vl, int step);
 
+/* Stores an opaque pointer with the entry of `vl', on behalf of the threshold
+ * plugin. `uc_get_threshold' only returns a pointer that was stored with the
+ * same, non-zero `generation'; bumping the generation invalidates all stored
+ * pointers at once. Both return ENOENT if there is no (valid) entry. A NULL
+ * pointer is a valid value and can be used to remember negative results. */
+int uc_get_threshold (const value_list_t *vl, unsigned int generation,
+    void **ret_threshold);
+int uc_set_threshold (const value_list_t *vl, unsigned int generation,
+    void *threshold);
+
+/*
+ * Checks on updated entries
+ *
+ * A check registered with `uc_register_check' is called by `uc_update' and
+ * `uc_update_batch' for every entry they have updated or created, except for
+ * missing values, while the entry's lock is held. It can read the new rates
+ * and change the entry's state, hit counter and threshold pointer (see
+ * `uc_set_threshold') through `uc_check_t', without looking the entry up
+ * again. It must be fast and must neither call any `uc_*' function nor
+ * dispatch anything. If it returns non-zero, `report' is called with the same
+ * `uc_check_t' after the lock has been released, for example to dispatch a
+ * notification. Only one check can be registered and it has to be registered
+ * before the first value is dispatched, e.g. from a config callback.
+ */
+struct uc_check_s
+{
+  /* The entry's rates; a copy while `report' runs. */
+  const gauge_t *rates;
+  int state;
+  int hits;
+  void *threshold;
+  unsigned int threshold_generation;
+
+  /* Passed from `check' to `report', not stored with the entry. */
+  int report_state;
+  int report_state_old;
+  int report_ds_index;
+  void *report_data;
+};
+typedef struct uc_check_s uc_check_t;
+
+typedef int (*uc_check_cb) (const data_set_t *ds, const value_list_t *vl,
+    uc_check_t *check);
+typedef int (*uc_report_cb) (const data_set_t *ds, const value_list_t *vl,
+    const uc_check_t *check);
+int uc_register_check (uc_check_cb check, uc_report_cb report);
+
 int uc_get_history (const data_set_t *ds, const value_list_t *vl,
     gauge_t *ret_history, size_t num_steps, size_t num_ds);
 int uc_get_history_by_name (const char *name,
     gauge_t *ret_history, size_t num_steps, size_t num_ds);
 
+/* Statistics of the last `num_steps' values of one data source, see
+ * `uc_get_history_stats'. Steps without a known value are skipped and
+ * counted in neither `num' nor the other fields, which are NAN if `num' is
+ * zero. */
+struct uc_history_stats_s
+{
+  size_t  num;
+  gauge_t min;
+  gauge_t max;
+  gauge_t mean;
+  gauge_t percentile;
+};
+typedef struct uc_history_stats_s uc_history_stats_t;
+
+/*
+ * NAME
+ *   uc_get_history_stats
+ *
+ * DESCRIPTION
+ *   Computes the minimum, maximum and mean of data source `ds_index' over the
+ *   last `num_steps' updates and, if `percent' is within (0, 100], its
+ *   nearest-rank percentile. The values are kept in a compact history of
+ *   floats, separate from the one of `uc_get_history', which is allocated
+ *   by the first call and grows to the longest window asked for. Nothing is
+ *   copied out of the cache; only the percentile needs a private copy of the
+ *   window, which is selected from in linear time. The compact history isn't
+ *   part of the cache snapshot.
+ *
+ * RETURN VALUE
+ *   Zero on success, a negative errno value otherwise.
+ */
+int uc_get_history_stats (const data_set_t *ds, const value_list_t *vl,
+    size_t num_steps, size_t ds_index, double percent,
+    uc_history_stats_t *ret_stats);
+int uc_get_history_stats_by_name (const char *name,
+    size_t num_steps, size_t ds_index, double percent,
+    uc_history_stats_t *ret_stats);
+
 /*
  * Meta data interface
  */
@@ -0,0 +1,254 @@
+/**
+ * collectd - src/utils_callback_stats.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_callback_stats.h"
+#include "utils_hashtable.h"
+#include "utils_stats.h"
+
+#include <pthread.h>
+
+/* Statistics of a read or write callback. Threads add to different shards,
+ * so that write callbacks which are called by many threads at once don't
+ * share cache lines. */
+#define CB_STATS_SHARDS  8
+#define CB_STATS_BUCKETS 8
+struct callback_stats_shard_s
+{
+	uint64_t count;
+	uint64_t failures;
+	uint64_t time_ns;
+	/* Since the statistics were last dispatched. */
+	uint64_t max_ns;
+	/* Calls taking up to 10us, 100us, ..., 10s and longer. */
+	uint64_t buckets[CB_STATS_BUCKETS];
+	char pad[128 - (4 + CB_STATS_BUCKETS) * sizeof (uint64_t)];
+};
+typedef struct callback_stats_shard_s callback_stats_shard_t;
+
+struct callback_stats_s
+{
+	/* "read-<name>" or "write-<name>" */
+	char name[DATA_MAX_NAME_LEN];
+	callback_stats_shard_t shards[CB_STATS_SHARDS];
+};
+
+/* Protects `callback_stats'; the statistics themselves are only updated
+ * atomically. */
+static pthread_mutex_t callback_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_hashtable_t  *callback_stats = NULL;
+
+/* Each thread uses the same shard for all callbacks. */
+static callback_stats_shard_t *callback_stats_shard ( /* {{{ */
+		callback_stats_t *cs)
+{
+	return (cs->shards + (stats_thread_index () % CB_STATS_SHARDS));
+} /* }}} callback_stats_shard_t *callback_stats_shard */
+
+/* Returns the statistics of the callback, caching them in `*cache'. */
+static callback_stats_t *callback_stats_get ( /* {{{ */
+		callback_stats_t **cache, const char *kind, const char *name)
+{
+	char key[DATA_MAX_NAME_LEN];
+	callback_stats_t *cs = NULL;
+
+	if (*cache != NULL)
+		return (*cache);
+
+	ssnprintf (key, sizeof (key), "%s-%s", kind, name);
+
+	pthread_mutex_lock (&callback_stats_lock);
+	if (callback_stats == NULL)
+		callback_stats = c_hashtable_create (c_hashtable_hash_string,
+				(int (*) (const void *, const void *)) strcmp);
+
+	if ((callback_stats != NULL)
+			&& (c_hashtable_get (callback_stats, key, (void *) &cs) != 0))
+	{
+		cs = malloc (sizeof (*cs));
+		if (cs != NULL)
+		{
+			memset (cs, 0, sizeof (*cs));
+			sstrncpy (cs->name, key, sizeof (cs->name));
+			if (c_hashtable_insert (callback_stats, cs->name, cs) != 0)
+				sfree (cs);
+		}
+	}
+	pthread_mutex_unlock (&callback_stats_lock);
+
+	/* All threads store the same pointer. */
+	*cache = cs;
+	return (cs);
+} /* }}} callback_stats_t *callback_stats_get */
+
+void callback_stats_add (callback_stats_t **cache, /* {{{ */
+		const char *kind, const char *name, cdtime_t start, int status)
+{
+	callback_stats_t *cs;
+	callback_stats_shard_t *shard;
+	cdtime_t end;
+	uint64_t ns;
+	uint64_t max;
+	uint64_t bound;
+	int i;
+
+	end = cdtime_monotonic ();
+
+	cs = callback_stats_get (cache, kind, name);
+	if (cs == NULL)
+		return;
+	shard = callback_stats_shard (cs);
+
+	ns = (end > start) ? (uint64_t) CDTIME_T_TO_NS (end - start) : 0;
+
+	__sync_fetch_and_add (&shard->count, 1);
+	if (status != 0)
+		__sync_fetch_and_add (&shard->failures, 1);
+	__sync_fetch_and_add (&shard->time_ns, ns);
+
+	max = shard->max_ns;
+	while ((ns > max)
+			&& !__sync_bool_compare_and_swap (&shard->max_ns, max, ns))
+		max = shard->max_ns;
+
+	for (i = 0, bound = 10000; i < CB_STATS_BUCKETS - 1; i++, bound *= 10)
+		if (ns <= bound)
+			break;
+	__sync_fetch_and_add (&shard->buckets[i], 1);
+} /* }}} void callback_stats_add */
+
+void callback_stats_submit (void) /* {{{ */
+{
+	static const char *bucket_names[CB_STATS_BUCKETS] = { "le_10us",
+		"le_100us", "le_1ms", "le_10ms", "le_100ms", "le_1s", "le_10s",
+		"le_inf" };
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	callback_stats_shard_t *sums = NULL;
+	char (*names)[DATA_MAX_NAME_LEN] = NULL;
+	c_hashtable_iterator_t *iter;
+	callback_stats_t *cs;
+	char *key;
+	size_t num = 0;
+	size_t i;
+	int j;
+
+	/* Sum up the shards first, so that the lock isn't held while
+	 * dispatching. New statistics may appear in between. */
+	pthread_mutex_lock (&callback_stats_lock);
+	num = (size_t) c_hashtable_size (callback_stats);
+	if (num > 0)
+	{
+		sums = calloc (num, sizeof (*sums));
+		names = calloc (num, sizeof (*names));
+	}
+	iter = c_hashtable_get_iterator (callback_stats);
+	if ((sums == NULL) || (names == NULL) || (iter == NULL))
+	{
+		pthread_mutex_unlock (&callback_stats_lock);
+		c_hashtable_iterator_destroy (iter);
+		sfree (sums);
+		sfree (names);
+		return;
+	}
+
+	i = 0;
+	while ((i < num)
+			&& (c_hashtable_iterator_next (iter, (void *) &key,
+					(void *) &cs) == 0))
+	{
+		sstrncpy (names[i], cs->name, sizeof (names[i]));
+		for (j = 0; j < CB_STATS_SHARDS; j++)
+		{
+			callback_stats_shard_t *shard = cs->shards + j;
+			uint64_t max;
+			int k;
+
+			sums[i].count += shard->count;
+			sums[i].failures += shard->failures;
+			sums[i].time_ns += shard->time_ns;
+			max = __sync_lock_test_and_set (&shard->max_ns, 0);
+			if (max > sums[i].max_ns)
+				sums[i].max_ns = max;
+			for (k = 0; k < CB_STATS_BUCKETS; k++)
+				sums[i].buckets[k] += shard->buckets[k];
+		}
+		i++;
+	}
+	num = i;
+	c_hashtable_iterator_destroy (iter);
+	pthread_mutex_unlock (&callback_stats_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+
+	for (i = 0; i < num; i++)
+	{
+		sstrncpy (vl.plugin_instance, names[i], sizeof (vl.plugin_instance));
+
+		sstrncpy (vl.type, "invocations", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		values[0].derive = (derive_t) sums[i].count;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "failures", sizeof (vl.type_instance));
+		values[0].derive = (derive_t) sums[i].failures;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "total_time_in_ns", sizeof (vl.type));
+		vl.type_instance[0] = 0;
+		values[0].derive = (derive_t) sums[i].time_ns;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "response_time", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "max", sizeof (vl.type_instance));
+		values[0].gauge = ((gauge_t) sums[i].max_ns) / 1000000000.0;
+		plugin_dispatch_values (&vl);
+
+		sstrncpy (vl.type, "invocations", sizeof (vl.type));
+		for (j = 0; j < CB_STATS_BUCKETS; j++)
+		{
+			sstrncpy (vl.type_instance, bucket_names[j],
+					sizeof (vl.type_instance));
+			values[0].derive = (derive_t) sums[i].buckets[j];
+			plugin_dispatch_values (&vl);
+		}
+	}
+
+	sfree (sums);
+	sfree (names);
+} /* }}} void callback_stats_submit */
+
+void callback_stats_destroy (void) /* {{{ */
+{
+	char *key;
+	callback_stats_t *cs;
+
+	pthread_mutex_lock (&callback_stats_lock);
+	while (c_hashtable_pick (callback_stats, (void *) &key,
+				(void *) &cs) == 0)
+		sfree (cs);
+	c_hashtable_destroy (callback_stats);
+	callback_stats = NULL;
+	pthread_mutex_unlock (&callback_stats_lock);
+} /* }}} void callback_stats_destroy */
@@ -0,0 +1,49 @@
+/**
+ * collectd - src/utils_callback_stats.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CALLBACK_STATS_H
+#define UTILS_CALLBACK_STATS_H 1
+
+#include "plugin.h"
+
+/*
+ * Callback statistics
+ *
+ * Counts the calls, failures and run time of read and write callbacks, see
+ * `CallbackStatistics'. The statistics are kept under the callback's kind
+ * and name until `callback_stats_destroy' is called, so that unregistering a
+ * callback while it is running is safe.
+ */
+
+struct callback_stats_s;
+typedef struct callback_stats_s callback_stats_t;
+
+/* Records one call of the callback `name' of the kind `kind', "read" or
+ * "write", which started at `start' (`cdtime_monotonic' time) and returned
+ * `status'. The callback's statistics are looked up once and cached in
+ * `*cache'. */
+void callback_stats_add (callback_stats_t **cache, const char *kind,
+		const char *name, cdtime_t start, int status);
+
+/* Dispatches the statistics of all callbacks. Called once per interval. */
+void callback_stats_submit (void);
+
+/* Frees the statistics. */
+void callback_stats_destroy (void);
+
+#endif /* UTILS_CALLBACK_STATS_H */
@@ -0,0 +1,141 @@
+/**
+ * collectd - src/utils_cmd_filterstats.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "filter_chain.h"
+
+#include "utils_cmd_filterstats.h"
+#include "utils_parse_option.h"
+
+/* As with LISTVAL, the output is collected in memory first, because the
+ * number of lines has to be sent before the lines themselves. */
+typedef struct filterstats_buffer_s
+{
+  char *data;
+  size_t len;
+  size_t size;
+  size_t number;
+} filterstats_buffer_t;
+
+#define free_everything_and_return(status) do { \
+    sfree (buf.data); \
+    return (status); \
+  } while (0)
+
+#define print_to_socket(fh, ...) \
+  if (fprintf (fh, __VA_ARGS__) < 0) { \
+    char errbuf[1024]; \
+    WARNING ("handle_filterstats: failed to write to socket #%i: %s", \
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+    free_everything_and_return (-1); \
+  }
+
+static int filterstats_append (const char *chain, /* {{{ */
+    const char *kind, const char *object, const fc_stats_t *stats,
+    void *user_data)
+{
+  filterstats_buffer_t *buf = user_data;
+  int status;
+
+  while (42)
+  {
+    size_t avail = buf->size - buf->len;
+
+    if (avail > 0)
+    {
+      status = snprintf (buf->data + buf->len, avail,
+	  "%s %s %s invocations=%"PRIu64" matches=%"PRIu64
+	  " time_ns=%"PRIu64"\n",
+	  chain, kind, object,
+	  stats->invocations, stats->matches, stats->time_ns);
+      if (status < 0)
+	return (-1);
+      if ((size_t) status < avail)
+      {
+	buf->len += (size_t) status;
+	buf->number++;
+	return (0);
+      }
+    }
+
+    /* Not enough space: grow the buffer and try again. */
+    {
+      size_t size = (buf->size == 0) ? 16384 : (2 * buf->size);
+      char *tmp = realloc (buf->data, size);
+      if (tmp == NULL)
+	return (-1);
+      buf->data = tmp;
+      buf->size = size;
+    }
+  }
+} /* }}} int filterstats_append */
+
+int handle_filterstats (FILE *fh, char *buffer)
+{
+  char *command = NULL;
+  filterstats_buffer_t buf;
+  int status;
+
+  memset (&buf, 0, sizeof (buf));
+
+  DEBUG ("utils_cmd_filterstats: handle_filterstats (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    free_everything_and_return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("FILTERSTATS", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    free_everything_and_return (-1);
+  }
+
+  if (*buffer != 0)
+  {
+    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
+    free_everything_and_return (-1);
+  }
+
+  status = fc_statistics_iterate (filterstats_append, &buf);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 fc_statistics_iterate failed.\n");
+    free_everything_and_return (-1);
+  }
+
+  print_to_socket (fh, "%i Counter%s found\n",
+      (int) buf.number, (buf.number == 1) ? "" : "s");
+  if ((buf.len > 0) && (fwrite (buf.data, buf.len, 1, fh) != 1))
+  {
+    char errbuf[1024];
+    WARNING ("handle_filterstats: failed to write to socket #%i: %s",
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    free_everything_and_return (-1);
+  }
+
+  free_everything_and_return (0);
+} /* int handle_filterstats */
+
+/* vim: set sw=2 sts=2 ts=8 : */
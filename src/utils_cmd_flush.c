@@ -55,6 +55,9 @@ int handle_flush (FILE *fh, char *buffer)
 	int error   = 0;
 
 	double timeout = 0.0;
+	_Bool async = 0;
+	_Bool have_token = 0;
+	uint64_t token = 0;
 	char **plugins = NULL;
 	int plugins_num = 0;
 	char **identifiers = NULL;
@@ -121,6 +124,26 @@ int handle_flush (FILE *fh, char *buffer)
 				timeout = 0.0;
 			}
 		}
+		else if (strcasecmp ("async", opt_key) == 0)
+		{
+			async = IS_TRUE (opt_value) ? 1 : 0;
+		}
+		else if (strcasecmp ("token", opt_key) == 0)
+		{
+			char *endptr = NULL;
+
+			errno = 0;
+			token = (uint64_t) strtoull (opt_value, &endptr, 10);
+			if ((endptr == opt_value) || (*endptr != 0) || (errno != 0))
+			{
+				print_to_socket (fh, "-1 Invalid value for option `token': "
+						"%s\n", opt_value);
+				sfree (plugins);
+				sfree (identifiers);
+				return (-1);
+			}
+			have_token = 1;
+		}
 		else
 		{
 			print_to_socket (fh, "-1 Cannot parse option %s\n", opt_key);
@@ -130,6 +153,54 @@ int handle_flush (FILE *fh, char *buffer)
 		}
 	} /* while (*buffer != 0) */
 
+	/* Query the outcome of an asynchronous flush. */
+	if (have_token)
+	{
+		int status;
+
+		sfree (plugins);
+		sfree (identifiers);
+
+		status = plugin_flush_status (token, &success, &error);
+		if (status == EINPROGRESS)
+		{
+			print_to_socket (fh, "0 In progress\n");
+		}
+		else if (status == 0)
+		{
+			print_to_socket (fh, "0 Done: %i successful, %i errors\n",
+					success, error);
+		}
+		else
+		{
+			print_to_socket (fh, "-1 Unknown token: %"PRIu64"\n", token);
+		}
+		return (0);
+	}
+
+	if (async)
+	{
+		int status;
+
+		status = plugin_flush_async ((char const * const *) plugins,
+				(size_t) plugins_num,
+				(char const * const *) identifiers, (size_t) identifiers_num,
+				DOUBLE_TO_CDTIME_T (timeout), &token);
+		sfree (plugins);
+		sfree (identifiers);
+
+		if (status != 0)
+		{
+			char errbuf[1024];
+			print_to_socket (fh, "-1 Starting the flush failed: %s\n",
+					sstrerror (status, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+
+		print_to_socket (fh, "0 Queued: token=%"PRIu64"\n", token);
+		return (0);
+	}
+
 	/* Add NULL entries for `any plugin' and/or `any value' if nothing was
 	 * specified. */
 	if (plugins_num == 0)
@@ -0,0 +1,228 @@
+/**
+ * collectd - src/utils_cmd_getrange.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+
+#include "utils_cmd_getrange.h"
+#include "utils_parse_option.h"
+
+/* As with LISTVAL, the output is collected in memory first, because the
+ * number of lines has to be sent before the lines themselves. */
+typedef struct getrange_buffer_s
+{
+  const data_set_t *ds;
+  value_list_t vl;
+
+  char *data;
+  size_t len;
+  size_t size;
+  size_t number;
+} getrange_buffer_t;
+
+#define free_everything_and_return(status) do { \
+    sfree (identifier); \
+    sfree (plugin); \
+    sfree (buf.data); \
+    return (status); \
+  } while (0)
+
+#define print_to_socket(fh, ...) \
+  if (fprintf (fh, __VA_ARGS__) < 0) { \
+    char errbuf[1024]; \
+    WARNING ("handle_getrange: failed to write to socket #%i: %s", \
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+    free_everything_and_return (-1); \
+  }
+
+static int getrange_append (cdtime_t time, /* {{{ */
+    const value_t *values, size_t values_num, void *user_data)
+{
+  getrange_buffer_t *buf = user_data;
+  char line[1024];
+  size_t line_len;
+  int status;
+
+  if (values_num != (size_t) buf->ds->ds_num)
+    return (-1);
+
+  buf->vl.time = time;
+  buf->vl.values = (value_t *) values;
+  buf->vl.values_len = (int) values_num;
+
+  status = format_values (line, sizeof (line), buf->ds, &buf->vl,
+      /* store_rates = */ 0);
+  if (status != 0)
+    return (-1);
+  line_len = strlen (line);
+
+  if ((buf->size - buf->len) < (line_len + 2))
+  {
+    size_t size = (buf->size == 0) ? 16384 : (2 * buf->size);
+    char *tmp = realloc (buf->data, size);
+    if (tmp == NULL)
+      return (-1);
+    buf->data = tmp;
+    buf->size = size;
+  }
+
+  memcpy (buf->data + buf->len, line, line_len);
+  buf->data[buf->len + line_len] = '\n';
+  buf->len += line_len + 1;
+  buf->number++;
+
+  return (0);
+} /* }}} int getrange_append */
+
+static int getrange_parse_time (const char *value, cdtime_t *ret) /* {{{ */
+{
+  char *endptr = NULL;
+  double tmp;
+
+  errno = 0;
+  tmp = strtod (value, &endptr);
+  if ((endptr == value) || (*endptr != 0) || (errno != 0)
+      || !isfinite (tmp) || (tmp < 0.0))
+    return (-1);
+
+  *ret = DOUBLE_TO_CDTIME_T (tmp);
+  return (0);
+} /* }}} int getrange_parse_time */
+
+int handle_getrange (FILE *fh, char *buffer)
+{
+  char *command = NULL;
+  char *identifier = NULL;
+  char *plugin = NULL;
+  cdtime_t start = 0;
+  cdtime_t end = cdtime ();
+  getrange_buffer_t buf;
+  int status;
+
+  memset (&buf, 0, sizeof (buf));
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  DEBUG ("utils_cmd_getrange: handle_getrange (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    free_everything_and_return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("GETRANGE", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    free_everything_and_return (-1);
+  }
+
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse identifier.\n");
+    free_everything_and_return (-1);
+  }
+  identifier = strdup (command);
+  if (identifier == NULL)
+  {
+    print_to_socket (fh, "-1 strdup failed.\n");
+    free_everything_and_return (-1);
+  }
+
+  while (*buffer != 0)
+  {
+    char *opt_key;
+    char *opt_value;
+
+    status = parse_option (&buffer, &opt_key, &opt_value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Parsing options failed.\n");
+      free_everything_and_return (-1);
+    }
+
+    if (strcasecmp ("start", opt_key) == 0)
+      status = getrange_parse_time (opt_value, &start);
+    else if (strcasecmp ("end", opt_key) == 0)
+      status = getrange_parse_time (opt_value, &end);
+    else if (strcasecmp ("plugin", opt_key) == 0)
+    {
+      sfree (plugin);
+      plugin = strdup (opt_value);
+      status = (plugin == NULL) ? -1 : 0;
+    }
+    else
+    {
+      print_to_socket (fh, "-1 Cannot parse option %s\n", opt_key);
+      free_everything_and_return (-1);
+    }
+
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Invalid value for option `%s': %s\n",
+	  opt_key, opt_value);
+      free_everything_and_return (-1);
+    }
+  }
+
+  if (parse_identifier_vl (identifier, &buf.vl) != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n", identifier);
+    free_everything_and_return (-1);
+  }
+
+  buf.ds = plugin_get_ds (buf.vl.type);
+  if (buf.ds == NULL)
+  {
+    print_to_socket (fh, "-1 Type `%s' is unknown.\n", buf.vl.type);
+    free_everything_and_return (-1);
+  }
+
+  status = plugin_read_range (plugin, identifier, start, end,
+      getrange_append, &buf);
+  if (status == ENOENT)
+  {
+    print_to_socket (fh, "-1 No such value\n");
+    free_everything_and_return (-1);
+  }
+  else if (status != 0)
+  {
+    print_to_socket (fh, "-1 Reading the values failed.\n");
+    free_everything_and_return (-1);
+  }
+
+  print_to_socket (fh, "%i Value%s found\n",
+      (int) buf.number, (buf.number == 1) ? "" : "s");
+  if ((buf.len > 0) && (fwrite (buf.data, buf.len, 1, fh) != 1))
+  {
+    char errbuf[1024];
+    WARNING ("handle_getrange: failed to write to socket #%i: %s",
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    free_everything_and_return (-1);
+  }
+
+  free_everything_and_return (0);
+} /* int handle_getrange */
+
+/* vim: set sw=2 sts=2 ts=8 : */
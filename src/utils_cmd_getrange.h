@@ -0,0 +1,28 @@
+/**
+ * collectd - src/utils_cmd_getrange.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CMD_GETRANGE_H
+#define UTILS_CMD_GETRANGE_H 1
+
+#include <stdio.h>
+
+int handle_getrange (FILE *fh, char *buffer);
+
+#endif /* UTILS_CMD_GETRANGE_H */
+
+/* vim: set sw=2 sts=2 ts=8 : */
@@ -24,8 +24,11 @@
 #include "plugin.h"
 
 #include "utils_cache.h"
+#include "utils_cmd_getval.h"
 #include "utils_parse_option.h"
 
+#include <fnmatch.h>
+
 #define print_to_socket(fh, ...) \
   if (fprintf (fh, __VA_ARGS__) < 0) { \
     char errbuf[1024]; \
@@ -113,26 +116,30 @@ int handle_getval (FILE *fh, char *buffer)
     return (-1);
   }
 
-  values = NULL;
-  values_num = 0;
-  status = uc_get_rate_by_name (identifier, &values, &values_num);
-  if (status != 0)
+  values_num = (size_t) ds->ds_num;
+  values = malloc (values_num * sizeof (*values));
+  if (values == NULL)
   {
-    print_to_socket (fh, "-1 No such value\n");
+    print_to_socket (fh, "-1 malloc failed.\n");
     sfree (identifier_copy);
     return (-1);
   }
 
-  if ((size_t) ds->ds_num != values_num)
+  status = uc_get_rate_by_name_buffer (identifier, values, values_num);
+  if (status == EINVAL)
   {
-    ERROR ("ds[%s]->ds_num = %i, "
-	"but uc_get_rate_by_name returned %u values.",
-	ds->type, ds->ds_num, (unsigned int) values_num);
     print_to_socket (fh, "-1 Error reading value from cache.\n");
     sfree (values);
     sfree (identifier_copy);
     return (-1);
   }
+  else if (status != 0)
+  {
+    print_to_socket (fh, "-1 No such value\n");
+    sfree (values);
+    sfree (identifier_copy);
+    return (-1);
+  }
 
   print_to_socket (fh, "%u Value%s found\n", (unsigned int) values_num,
       (values_num == 1) ? "" : "s");
@@ -155,4 +162,253 @@ int handle_getval (FILE *fh, char *buffer)
   return (0);
 } /* int handle_getval */
 
+struct mgetval_names_s
+{
+  char **names;
+  size_t names_num;
+  size_t names_size;
+  const char *pattern;
+};
+typedef struct mgetval_names_s mgetval_names_t;
+
+static int mgetval_add (mgetval_names_t *n, const char *name) /* {{{ */
+{
+  char *copy;
+
+  if (n->names_num >= n->names_size)
+  {
+    char **tmp;
+    size_t size = (n->names_size == 0) ? 64 : (2 * n->names_size);
+
+    tmp = realloc (n->names, size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-1);
+    n->names = tmp;
+    n->names_size = size;
+  }
+
+  copy = strdup (name);
+  if (copy == NULL)
+    return (-1);
+
+  n->names[n->names_num] = copy;
+  n->names_num++;
+  return (0);
+} /* }}} int mgetval_add */
+
+/* Called by uc_iterate with a shard's lock held; must not use the cache. */
+static int mgetval_glob_cb (const char *name, /* {{{ */
+    __attribute__((unused)) cdtime_t last_time,
+    __attribute__((unused)) cdtime_t interval, void *user_data)
+{
+  mgetval_names_t *n = user_data;
+
+  if (fnmatch (n->pattern, name, /* flags = */ 0) != 0)
+    return (0);
+
+  return (mgetval_add (n, name));
+} /* }}} int mgetval_glob_cb */
+
+static int mgetval_name_cmp (const void *a, const void *b) /* {{{ */
+{
+  return (strcmp (*((char * const *) a), *((char * const *) b)));
+} /* }}} int mgetval_name_cmp */
+
+/* Formats the response line for one identifier into `buffer'. Returns
+ * non-zero if the identifier's data set doesn't match the cached values. */
+static int mgetval_format (char *buffer, size_t buffer_size, /* {{{ */
+    const char *name, const gauge_t *values, size_t values_num)
+{
+  char name_copy[6 * DATA_MAX_NAME_LEN];
+  char *hostname;
+  char *plugin;
+  char *plugin_instance;
+  char *type;
+  char *type_instance;
+  const data_set_t *ds;
+  size_t offset;
+  size_t i;
+  int status;
+
+  sstrncpy (name_copy, name, sizeof (name_copy));
+  status = parse_identifier (name_copy, &hostname,
+      &plugin, &plugin_instance, &type, &type_instance);
+  if (status != 0)
+    return (-1);
+
+  ds = plugin_get_ds (type);
+  if ((ds == NULL) || ((size_t) ds->ds_num != values_num))
+    return (-1);
+
+  status = ssnprintf (buffer, buffer_size, "%s", name);
+  if ((status < 0) || ((size_t) status >= buffer_size))
+    return (-1);
+  offset = (size_t) status;
+
+  for (i = 0; i < values_num; i++)
+  {
+    if (isnan (values[i]))
+      status = ssnprintf (buffer + offset, buffer_size - offset,
+          " %s=NaN", ds->ds[i].name);
+    else
+      status = ssnprintf (buffer + offset, buffer_size - offset,
+          " %s=%12e", ds->ds[i].name, values[i]);
+    if ((status < 0) || ((size_t) status >= (buffer_size - offset)))
+      return (-1);
+    offset += (size_t) status;
+  }
+
+  return (0);
+} /* }}} int mgetval_format */
+
+int handle_mgetval (FILE *fh, char *buffer) /* {{{ */
+{
+  char *command;
+  mgetval_names_t n;
+  gauge_t **values = NULL;
+  size_t *values_num = NULL;
+  size_t lines_num;
+  size_t i;
+  int status;
+
+  if ((fh == NULL) || (buffer == NULL))
+    return (-1);
+
+  DEBUG ("utils_cmd_getval: handle_mgetval (fh = %p, buffer = %s);",
+      (void *) fh, buffer);
+
+  command = NULL;
+  status = parse_string (&buffer, &command);
+  if (status != 0)
+  {
+    print_to_socket (fh, "-1 Cannot parse command.\n");
+    return (-1);
+  }
+  assert (command != NULL);
+
+  if (strcasecmp ("MGETVAL", command) != 0)
+  {
+    print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+    return (-1);
+  }
+
+  memset (&n, 0, sizeof (n));
+  status = 0;
+  while ((*buffer != 0) && (status == 0))
+  {
+    char *pattern = NULL;
+    char prefix[6 * DATA_MAX_NAME_LEN];
+
+    status = parse_string (&buffer, &pattern);
+    if (status != 0)
+      break;
+
+    if (strpbrk (pattern, "*?[\\") == NULL)
+    {
+      status = mgetval_add (&n, pattern);
+      continue;
+    }
+
+    /* Only entries starting with the part before the first wildcard can
+     * match, so let the cache skip all others. */
+    sstrncpy (prefix, pattern, sizeof (prefix));
+    prefix[strcspn (prefix, "*?[\\")] = 0;
+
+    n.pattern = pattern;
+    status = uc_iterate (prefix, mgetval_glob_cb, &n);
+  }
+
+  if (status != 0)
+  {
+    for (i = 0; i < n.names_num; i++)
+      sfree (n.names[i]);
+    sfree (n.names);
+    print_to_socket (fh, "-1 Cannot parse identifier list.\n");
+    return (-1);
+  }
+
+  /* Overlapping patterns must not return identifiers twice. */
+  if (n.names_num > 1)
+  {
+    size_t j = 0;
+
+    qsort (n.names, n.names_num, sizeof (*n.names), mgetval_name_cmp);
+    for (i = 1; i < n.names_num; i++)
+    {
+      if (strcmp (n.names[j], n.names[i]) == 0)
+        sfree (n.names[i]);
+      else
+        n.names[++j] = n.names[i];
+    }
+    n.names_num = j + 1;
+  }
+
+  if (n.names_num > 0)
+  {
+    values = calloc (n.names_num, sizeof (*values));
+    values_num = calloc (n.names_num, sizeof (*values_num));
+    if ((values == NULL) || (values_num == NULL)
+        || (uc_get_rate_by_name_multi (n.names, n.names_num,
+            values, values_num) < 0))
+    {
+      for (i = 0; i < n.names_num; i++)
+        sfree (n.names[i]);
+      sfree (n.names);
+      sfree (values);
+      sfree (values_num);
+      print_to_socket (fh, "-1 Error reading values from cache.\n");
+      return (-1);
+    }
+  }
+
+  /* Identifiers which don't exist are left out. The response has one line
+   * per identifier, so the number of lines must be known in advance. */
+  lines_num = 0;
+  for (i = 0; i < n.names_num; i++)
+    if (values[i] != NULL)
+      lines_num++;
+
+  status = 0;
+  if (fprintf (fh, "%zu Value%s found\n", lines_num,
+        (lines_num == 1) ? "" : "s") < 0)
+    status = -1;
+
+  for (i = 0; (i < n.names_num) && (status == 0); i++)
+  {
+    char line[4096];
+
+    if (values[i] == NULL)
+      continue;
+
+    if (mgetval_format (line, sizeof (line), n.names[i],
+          values[i], values_num[i]) != 0)
+    {
+      ERROR ("handle_mgetval: Cannot format the values of %s.", n.names[i]);
+      /* Keep the number of lines announced above. */
+      ssnprintf (line, sizeof (line), "%s", n.names[i]);
+    }
+
+    if (fprintf (fh, "%s\n", line) < 0)
+      status = -1;
+  }
+
+  if (status != 0)
+  {
+    char errbuf[1024];
+    WARNING ("handle_mgetval: failed to write to socket #%i: %s",
+        fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+
+  for (i = 0; i < n.names_num; i++)
+  {
+    sfree (n.names[i]);
+    sfree (values[i]);
+  }
+  sfree (n.names);
+  sfree (values);
+  sfree (values_num);
+
+  return (status);
+} /* }}} int handle_mgetval */
+
 /* vim: set sw=2 sts=2 ts=8 : */
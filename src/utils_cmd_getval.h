@@ -26,6 +26,10 @@
 
 int handle_getval (FILE *fh, char *buffer);
 
+/* Handles "MGETVAL <identifier> [<identifier> ...]". Identifiers may contain
+ * the shell wildcards "*", "?" and "[...]", which also match slashes. */
+int handle_mgetval (FILE *fh, char *buffer);
+
 #endif /* UTILS_CMD_GETVAL_H */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -27,14 +27,25 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 
+#include <fnmatch.h>
+
+/* The output is collected in memory first, because the number of values has
+ * to be sent before the values themselves. In streaming mode the buffer only
+ * holds the values of one part of the cache before it is written to `fh'. */
+typedef struct listval_buffer_s
+{
+  char *data;
+  size_t len;
+  size_t size;
+  size_t number;
+
+  const char *filter;
+  FILE *fh;
+} listval_buffer_t;
+
 #define free_everything_and_return(status) do { \
-    size_t j; \
-    for (j = 0; j < number; j++) { \
-      sfree(names[j]); \
-      names[j] = NULL; \
-    } \
-    sfree(names); \
-    sfree(times); \
+    sfree (buf.data); \
+    sfree (filter_prefix); \
     return (status); \
   } while (0)
 
@@ -46,19 +57,95 @@
     free_everything_and_return (-1); \
   }
 
+static int listval_append (const char *name, cdtime_t last_time, /* {{{ */
+    cdtime_t __attribute__((unused)) interval, void *user_data)
+{
+  listval_buffer_t *buf = user_data;
+  int status;
+
+  if ((buf->filter != NULL) && (fnmatch (buf->filter, name, 0) != 0))
+    return (0);
+
+  while (42)
+  {
+    size_t avail = buf->size - buf->len;
+
+    if (avail > 0)
+    {
+      status = snprintf (buf->data + buf->len, avail, "%.3f %s\n",
+	  CDTIME_T_TO_DOUBLE (last_time), name);
+      if (status < 0)
+	return (-1);
+      if ((size_t) status < avail)
+      {
+	buf->len += (size_t) status;
+	buf->number++;
+	return (0);
+      }
+    }
+
+    /* Not enough space: grow the buffer and try again. */
+    {
+      size_t size = (buf->size == 0) ? 65536 : (2 * buf->size);
+      char *tmp = realloc (buf->data, size);
+      if (tmp == NULL)
+	return (-1);
+      buf->data = tmp;
+      buf->size = size;
+    }
+  }
+} /* }}} int listval_append */
+
+/* Writes what has been collected so far in streaming mode. */
+static int listval_flush (void *user_data) /* {{{ */
+{
+  listval_buffer_t *buf = user_data;
+
+  if (buf->len == 0)
+    return (0);
+
+  if (fwrite (buf->data, buf->len, 1, buf->fh) != 1)
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+	fileno (buf->fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  buf->len = 0;
+  return (0);
+} /* }}} int listval_flush */
+
+/* Returns the part of `filter' before the first wildcard, so that entries
+ * which can't match are skipped by `uc_iterate' already. */
+static char *listval_filter_prefix (const char *filter) /* {{{ */
+{
+  size_t len = strcspn (filter, "*?[\\");
+  char *prefix;
+
+  prefix = malloc (len + 1);
+  if (prefix == NULL)
+    return (NULL);
+  memcpy (prefix, filter, len);
+  prefix[len] = 0;
+
+  return (prefix);
+} /* }}} char *listval_filter_prefix */
+
 int handle_listval (FILE *fh, char *buffer)
 {
-  char *command;
-  char **names = NULL;
-  cdtime_t *times = NULL;
-  size_t number = 0;
-  size_t i;
+  char *command = NULL;
+  char *prefix = NULL;
+  char *filter_prefix = NULL;
+  _Bool stream = 0;
+  listval_buffer_t buf;
   int status;
 
+  memset (&buf, 0, sizeof (buf));
+
   DEBUG ("utils_cmd_listval: handle_listval (fh = %p, buffer = %s);",
       (void *) fh, buffer);
 
-  command = NULL;
   status = parse_string (&buffer, &command);
   if (status != 0)
   {
@@ -73,25 +160,84 @@ int handle_listval (FILE *fh, char *buffer)
     free_everything_and_return (-1);
   }
 
-  if (*buffer != 0)
+  while (*buffer != 0)
   {
-    print_to_socket (fh, "-1 Garbage after end of command: %s\n", buffer);
-    free_everything_and_return (-1);
+    char *opt_key = NULL;
+    char *opt_value = NULL;
+
+    status = parse_option (&buffer, &opt_key, &opt_value);
+    if (status != 0)
+    {
+      print_to_socket (fh, "-1 Parsing options failed.\n");
+      free_everything_and_return (-1);
+    }
+
+    if (strcasecmp ("prefix", opt_key) == 0)
+      prefix = opt_value;
+    else if (strcasecmp ("filter", opt_key) == 0)
+      buf.filter = opt_value;
+    else if (strcasecmp ("stream", opt_key) == 0)
+      stream = IS_TRUE (opt_value) ? 1 : 0;
+    else
+    {
+      print_to_socket (fh, "-1 Unknown option: %s\n", opt_key);
+      free_everything_and_return (-1);
+    }
   }
 
-  status = uc_get_names (&names, &times, &number);
+  /* The prefix option is checked by `uc_iterate' and the filter by
+   * `listval_append', so the filter's fixed part is only needed if there is
+   * no prefix. */
+  if ((buf.filter != NULL) && ((prefix == NULL) || (prefix[0] == 0)))
+  {
+    filter_prefix = listval_filter_prefix (buf.filter);
+    if (filter_prefix == NULL)
+    {
+      print_to_socket (fh, "-1 malloc failed.\n");
+      free_everything_and_return (-1);
+    }
+    prefix = filter_prefix;
+  }
+
+  /* The number of values is unknown until the end, so streamed responses are
+   * terminated by an empty line instead. */
+  if (stream)
+  {
+    buf.fh = fh;
+    print_to_socket (fh, "0 Listing values\n");
+
+    status = uc_iterate_chunked (prefix, listval_append, listval_flush, &buf);
+    if (status != 0)
+    {
+      /* The status line has been sent already, so the error is reported in
+       * place of the end of the list. */
+      DEBUG ("command listval: uc_iterate_chunked failed with status %i",
+	  status);
+      print_to_socket (fh, "-1 uc_iterate failed.\n");
+      free_everything_and_return (-1);
+    }
+
+    print_to_socket (fh, "\n");
+    free_everything_and_return (0);
+  }
+
+  status = uc_iterate (prefix, listval_append, &buf);
   if (status != 0)
   {
-    DEBUG ("command listval: uc_get_names failed with status %i", status);
-    print_to_socket (fh, "-1 uc_get_names failed.\n");
+    DEBUG ("command listval: uc_iterate failed with status %i", status);
+    print_to_socket (fh, "-1 uc_iterate failed.\n");
     free_everything_and_return (-1);
   }
 
   print_to_socket (fh, "%i Value%s found\n",
-      (int) number, (number == 1) ? "" : "s");
-  for (i = 0; i < number; i++)
-    print_to_socket (fh, "%.3f %s\n", CDTIME_T_TO_DOUBLE (times[i]),
-       	names[i]);
+      (int) buf.number, (buf.number == 1) ? "" : "s");
+  if ((buf.len > 0) && (fwrite (buf.data, buf.len, 1, fh) != 1))
+  {
+    char errbuf[1024];
+    WARNING ("handle_listval: failed to write to socket #%i: %s",
+	fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf)));
+    free_everything_and_return (-1);
+  }
 
   free_everything_and_return (0);
 } /* int handle_listval */
@@ -0,0 +1,417 @@
+/**
+ * collectd - src/utils_cmd_putbin.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "network.h"
+
+#include "utils_cmd_putbin.h"
+
+#include <arpa/inet.h>
+
+#define print_to_socket(fh, ...) \
+	if (fprintf (fh, __VA_ARGS__) < 0) { \
+		char errbuf[1024]; \
+		WARNING ("handle_putbin: failed to write to socket #%i: %s", \
+				fileno (fh), sstrerror (errno, errbuf, sizeof (errbuf))); \
+		return -1; \
+	}
+
+#define PART_HEADER_SIZE 4
+
+/* Value lists are dispatched in batches of this size. */
+#define PUTBIN_BATCH_MAX 128
+/* Each value takes at least nine bytes in the packet, so a packet of 64 KiB,
+ * the largest frame the unixsock plugin accepts, never has more values. */
+#define PUTBIN_VALUES_MAX 8192
+
+/* Strings of the identifier parts, in order of appearance, see
+ * `string_table_t' in src/network.c. They point into the packet. */
+#define PUTBIN_STRINGS_MAX 128
+
+struct putbin_state_s
+{
+	/* Fields of the value list the next values part belongs to. */
+	value_list_t vl;
+
+	const char *strings[PUTBIN_STRINGS_MAX];
+	int strings_num;
+
+	value_list_t batch[PUTBIN_BATCH_MAX];
+	size_t batch_num;
+	value_t *values;
+	size_t values_num;
+
+	int dispatched;
+	int failed;
+};
+typedef struct putbin_state_s putbin_state_t;
+
+static void putbin_flush (putbin_state_t *state) /* {{{ */
+{
+	if (state->batch_num == 0)
+		return;
+
+	if (plugin_dispatch_values_batch (state->batch, state->batch_num) == 0)
+		state->dispatched += (int) state->batch_num;
+	else
+		state->failed++;
+
+	state->batch_num = 0;
+	state->values_num = 0;
+} /* }}} void putbin_flush */
+
+/* Reads an identifier part, a string or a reference to an earlier one, and
+ * copies it to `ret' (DATA_MAX_NAME_LEN bytes). */
+static int putbin_parse_identifier (putbin_state_t *state, /* {{{ */
+		const char *part, uint16_t part_type, uint16_t part_len,
+		char *ret, char *errbuf, size_t errbuf_size)
+{
+	const char *str;
+
+	if (part_type & 0x0010) /* TYPE_*_REF */
+	{
+		uint16_t index;
+
+		if (part_len != PART_HEADER_SIZE + sizeof (index))
+		{
+			ssnprintf (errbuf, errbuf_size, "Invalid length %"PRIu16
+					" of a reference part.", part_len);
+			return (-1);
+		}
+
+		memcpy (&index, part + PART_HEADER_SIZE, sizeof (index));
+		index = ntohs (index);
+		if (index >= state->strings_num)
+		{
+			ssnprintf (errbuf, errbuf_size, "Reference to string %"PRIu16
+					", but only %i strings have been sent.",
+					index, state->strings_num);
+			return (-1);
+		}
+		str = state->strings[index];
+	}
+	else
+	{
+		size_t str_len = part_len - PART_HEADER_SIZE;
+
+		str = part + PART_HEADER_SIZE;
+		if ((str_len < 1) || (str[str_len - 1] != 0))
+		{
+			sstrncpy (errbuf, "String part is not null-terminated.",
+					errbuf_size);
+			return (-1);
+		}
+		if (str_len > DATA_MAX_NAME_LEN)
+		{
+			sstrncpy (errbuf, "String part is too long.", errbuf_size);
+			return (-1);
+		}
+
+		if (state->strings_num < PUTBIN_STRINGS_MAX)
+		{
+			state->strings[state->strings_num] = str;
+			state->strings_num++;
+		}
+	}
+
+	sstrncpy (ret, str, DATA_MAX_NAME_LEN);
+	return (0);
+} /* }}} int putbin_parse_identifier */
+
+static int putbin_parse_number (const char *part, uint16_t part_len, /* {{{ */
+		uint64_t *ret, char *errbuf, size_t errbuf_size)
+{
+	uint64_t tmp;
+
+	if (part_len != PART_HEADER_SIZE + sizeof (tmp))
+	{
+		ssnprintf (errbuf, errbuf_size, "Invalid length %"PRIu16
+				" of a number part.", part_len);
+		return (-1);
+	}
+
+	memcpy (&tmp, part + PART_HEADER_SIZE, sizeof (tmp));
+	*ret = ntohll (tmp);
+	return (0);
+} /* }}} int putbin_parse_number */
+
+/* Converts a values part and adds a value list with the current fields to the
+ * batch. */
+static int putbin_parse_values (putbin_state_t *state, /* {{{ */
+		const char *part, uint16_t part_len,
+		char *errbuf, size_t errbuf_size)
+{
+	uint16_t num;
+	const uint8_t *types;
+	value_t *values;
+	value_list_t *vl;
+	int i;
+
+	if (part_len < PART_HEADER_SIZE + sizeof (num))
+	{
+		sstrncpy (errbuf, "Values part is too short.", errbuf_size);
+		return (-1);
+	}
+
+	memcpy (&num, part + PART_HEADER_SIZE, sizeof (num));
+	num = ntohs (num);
+	if ((num == 0) || (part_len != PART_HEADER_SIZE + sizeof (num)
+				+ num * (sizeof (uint8_t) + sizeof (value_t))))
+	{
+		sstrncpy (errbuf, "Length and number of values of a values part "
+				"don't match.", errbuf_size);
+		return (-1);
+	}
+
+	if ((state->batch_num >= PUTBIN_BATCH_MAX)
+			|| (state->values_num + num > PUTBIN_VALUES_MAX))
+		putbin_flush (state);
+
+	if (num > PUTBIN_VALUES_MAX)
+	{
+		sstrncpy (errbuf, "Too many values.", errbuf_size);
+		return (-1);
+	}
+
+	/* The values are copied since they may not be aligned. */
+	types = (const uint8_t *) (part + PART_HEADER_SIZE + sizeof (num));
+	values = state->values + state->values_num;
+	memcpy (values, types + num, num * sizeof (value_t));
+
+	for (i = 0; i < num; i++)
+	{
+		switch (types[i])
+		{
+			case DS_TYPE_COUNTER:
+				values[i].counter = (counter_t) ntohll (values[i].counter);
+				break;
+			case DS_TYPE_GAUGE:
+				values[i].gauge = (gauge_t) ntohd (values[i].gauge);
+				break;
+			case DS_TYPE_DERIVE:
+				values[i].derive = (derive_t) ntohll (values[i].derive);
+				break;
+			case DS_TYPE_ABSOLUTE:
+				values[i].absolute = (absolute_t) ntohll (values[i].absolute);
+				break;
+			default:
+				ssnprintf (errbuf, errbuf_size, "Unknown data source "
+						"type %"PRIu8".", types[i]);
+				return (-1);
+		}
+	}
+
+	vl = state->batch + state->batch_num;
+	memcpy (vl, &state->vl, sizeof (*vl));
+	vl->values = values;
+	vl->values_len = num;
+
+	state->batch_num++;
+	state->values_num += num;
+
+	return (0);
+} /* }}} int putbin_parse_values */
+
+static int putbin_parse (putbin_state_t *state, /* {{{ */
+		const char *buffer, size_t buffer_len,
+		char *errbuf, size_t errbuf_size)
+{
+	while (buffer_len > 0)
+	{
+		uint16_t part_type;
+		uint16_t part_len;
+		uint64_t number;
+		int status = 0;
+
+		if (buffer_len < PART_HEADER_SIZE)
+		{
+			sstrncpy (errbuf, "Truncated part header.", errbuf_size);
+			return (-1);
+		}
+
+		memcpy (&part_type, buffer, sizeof (part_type));
+		part_type = ntohs (part_type);
+		memcpy (&part_len, buffer + sizeof (part_type), sizeof (part_len));
+		part_len = ntohs (part_len);
+
+		if ((part_len < PART_HEADER_SIZE) || (part_len > buffer_len))
+		{
+			ssnprintf (errbuf, errbuf_size, "Invalid part length %"PRIu16
+					".", part_len);
+			return (-1);
+		}
+
+		switch (part_type)
+		{
+			case TYPE_HOST:
+			case TYPE_HOST_REF:
+				status = putbin_parse_identifier (state, buffer,
+						part_type, part_len, state->vl.host,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_PLUGIN:
+			case TYPE_PLUGIN_REF:
+				status = putbin_parse_identifier (state, buffer,
+						part_type, part_len, state->vl.plugin,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_PLUGIN_INSTANCE:
+			case TYPE_PLUGIN_INSTANCE_REF:
+				status = putbin_parse_identifier (state, buffer,
+						part_type, part_len, state->vl.plugin_instance,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_TYPE:
+			case TYPE_TYPE_REF:
+				status = putbin_parse_identifier (state, buffer,
+						part_type, part_len, state->vl.type,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_TYPE_INSTANCE:
+			case TYPE_TYPE_INSTANCE_REF:
+				status = putbin_parse_identifier (state, buffer,
+						part_type, part_len, state->vl.type_instance,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_TIME:
+				status = putbin_parse_number (buffer, part_len, &number,
+						errbuf, errbuf_size);
+				if (status == 0)
+					state->vl.time = TIME_T_TO_CDTIME_T (number);
+				break;
+
+			case TYPE_TIME_HR:
+				status = putbin_parse_number (buffer, part_len, &number,
+						errbuf, errbuf_size);
+				if (status == 0)
+					state->vl.time = (cdtime_t) number;
+				break;
+
+			case TYPE_INTERVAL:
+				status = putbin_parse_number (buffer, part_len, &number,
+						errbuf, errbuf_size);
+				if (status == 0)
+					state->vl.interval = TIME_T_TO_CDTIME_T (number);
+				break;
+
+			case TYPE_INTERVAL_HR:
+				status = putbin_parse_number (buffer, part_len, &number,
+						errbuf, errbuf_size);
+				if (status == 0)
+					state->vl.interval = (cdtime_t) number;
+				break;
+
+			case TYPE_VALUES:
+				status = putbin_parse_values (state, buffer, part_len,
+						errbuf, errbuf_size);
+				break;
+
+			case TYPE_SIGN_SHA256:
+			case TYPE_ENCR_AES256:
+			case TYPE_COMPR_LZ4:
+				ssnprintf (errbuf, errbuf_size, "Part type %#"PRIx16
+						" is not supported on this socket.", part_type);
+				status = -1;
+				break;
+
+			default:
+				/* Notifications and unknown parts are skipped, just
+				 * like the network plugin does. */
+				break;
+		}
+
+		if (status != 0)
+			return (-1);
+
+		buffer += part_len;
+		buffer_len -= part_len;
+	}
+
+	return (0);
+} /* }}} int putbin_parse */
+
+int handle_putbin (FILE *fh, const char *buffer, size_t buffer_len) /* {{{ */
+{
+	putbin_state_t *state;
+	char errbuf[256] = "";
+	int status;
+	int dispatched;
+	int failed;
+
+	state = malloc (sizeof (*state));
+	if (state == NULL)
+	{
+		print_to_socket (fh, "-1 malloc failed.\n");
+		return (0);
+	}
+	memset (state, 0, sizeof (*state));
+
+	state->values = calloc (PUTBIN_VALUES_MAX, sizeof (*state->values));
+	if (state->values == NULL)
+	{
+		sfree (state);
+		print_to_socket (fh, "-1 calloc failed.\n");
+		return (0);
+	}
+
+	/* Value lists without an interval get the global one, like PUTVAL
+	 * does. */
+	state->vl.interval = interval_g;
+	sstrncpy (state->vl.host, hostname_g, sizeof (state->vl.host));
+
+	status = putbin_parse (state, buffer, buffer_len,
+			errbuf, sizeof (errbuf));
+	/* Values before an invalid part are dispatched nevertheless. */
+	putbin_flush (state);
+
+	dispatched = state->dispatched;
+	failed = state->failed;
+	sfree (state->values);
+	sfree (state);
+
+	if (status != 0)
+	{
+		print_to_socket (fh, "-1 Invalid packet, %i %s been dispatched: "
+				"%s\n", dispatched,
+				(dispatched == 1) ? "value has" : "values have",
+				errbuf);
+	}
+	else if (failed != 0)
+	{
+		print_to_socket (fh, "-1 Dispatching some values failed, %i %s "
+				"been dispatched.\n", dispatched,
+				(dispatched == 1) ? "value has" : "values have");
+	}
+	else
+	{
+		print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+				dispatched,
+				(dispatched == 1) ? "value has" : "values have");
+	}
+
+	return (0);
+} /* }}} int handle_putbin */
+
+/* vim: set sw=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,43 @@
+/**
+ * collectd - src/utils_cmd_putbin.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CMD_PUTBIN_H
+#define UTILS_CMD_PUTBIN_H 1
+
+#include <stdio.h>
+
+#include "plugin.h"
+
+/*
+ * NAME
+ *   handle_putbin
+ *
+ * DESCRIPTION
+ *   Dispatches the value lists of one packet in the binary format of the
+ *   network plugin and prints a single response line to `fh', like
+ *   handle_putval does. Identifier strings may refer to earlier strings of
+ *   the same packet using the `TYPE_*_REF' parts. Signed, encrypted and
+ *   compressed parts are not supported; notifications are ignored.
+ *
+ * RETURN VALUE
+ *   Zero if the response could be written, even if the packet was invalid,
+ *   and less than zero otherwise.
+ */
+int handle_putbin (FILE *fh, const char *buffer, size_t buffer_len);
+
+#endif /* UTILS_CMD_PUTBIN_H */
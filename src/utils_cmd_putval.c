@@ -23,6 +23,8 @@
 #include "common.h"
 #include "plugin.h"
 
+#include "utils_cache.h"
+#include "utils_cmd_putval.h"
 #include "utils_parse_option.h"
 
 #define print_to_socket(fh, ...) \
@@ -33,21 +35,35 @@
 		return -1; \
 	}
 
-static int dispatch_values (const data_set_t *ds, value_list_t *vl,
-	       	FILE *fh, char *buffer)
-{
-	int status;
-
-	status = parse_values (buffer, vl, ds);
-	if (status != 0)
-	{
-		print_to_socket (fh, "-1 Parsing the values string failed.\n");
-		return (-1);
-	}
+/* Upper bound of value lists collected before they are dispatched, so a huge
+ * PUTVAL-BATCH block doesn't keep all its values in memory. */
+#define PUTVAL_BATCH_MAX 1024
 
-	plugin_dispatch_values (vl);
-	return (0);
-} /* int dispatch_values */
+struct putval_batch_s
+{
+	value_list_t *vl;
+	size_t *values_offset; /* `vl[i].values' is only set by the flush */
+	size_t vl_num;
+	size_t vl_size;
+
+	value_t *values;
+	size_t values_num;
+	size_t values_size;
+
+	/* The identifier of the last command and what it was resolved to.
+	 * Programs usually print many values for the same identifier in a
+	 * row, which then don't need to be looked up again. */
+	char last_identifier[6 * DATA_MAX_NAME_LEN];
+	value_list_t last_vl;
+	const data_set_t *last_ds;
+
+	/* State of a PUTVAL-BATCH block, see handle_putval_batch. */
+	int lines_remaining;
+	int lines_total;
+	int lines_failed;
+	int values_dispatched;
+	char first_error[256];
+};
 
 static int set_option (value_list_t *vl, const char *key, const char *value)
 {
@@ -73,38 +89,247 @@ static int set_option (value_list_t *vl, const char *key, const char *value)
 	return (0);
 } /* int parse_option */
 
-int handle_putval (FILE *fh, char *buffer)
+/* Makes room for one more value list with `values_num' values. */
+static int putval_batch_reserve (putval_batch_t *batch, size_t values_num)
+{
+	if (batch->vl_num >= batch->vl_size)
+	{
+		value_list_t *vl;
+		size_t *offset;
+		size_t size = (batch->vl_size == 0) ? 16 : (2 * batch->vl_size);
+
+		vl = realloc (batch->vl, size * sizeof (*vl));
+		if (vl == NULL)
+			return (-1);
+		batch->vl = vl;
+
+		offset = realloc (batch->values_offset, size * sizeof (*offset));
+		if (offset == NULL)
+			return (-1);
+		batch->values_offset = offset;
+
+		batch->vl_size = size;
+	}
+
+	if ((batch->values_num + values_num) > batch->values_size)
+	{
+		value_t *values;
+		size_t size = (batch->values_size == 0) ? 64 : batch->values_size;
+
+		while (size < (batch->values_num + values_num))
+			size *= 2;
+
+		values = realloc (batch->values, size * sizeof (*values));
+		if (values == NULL)
+			return (-1);
+		batch->values = values;
+		batch->values_size = size;
+	}
+
+	return (0);
+} /* int putval_batch_reserve */
+
+/* Parses "<time>:<value>[:<value>...]" in a single pass, converting each
+ * field where it is instead of splitting the string first. Like
+ * `parse_values', it accepts "N" as the time and "U" as a gauge value and
+ * ignores trailing garbage after a value. */
+static int putval_parse_values (const char *buffer, value_list_t *vl,
+		const data_set_t *ds)
+{
+	const char *ptr = buffer;
+	char *endptr;
+	int i;
+
+	if ((ptr[0] == 'N') && ((ptr[1] == ':') || (ptr[1] == 0)))
+	{
+		vl->time = cdtime ();
+		ptr++;
+	}
+	else
+	{
+		double tmp;
+
+		endptr = NULL;
+		errno = 0;
+		tmp = strtod (ptr, &endptr);
+		if ((errno != 0) || (endptr == ptr)
+				|| ((*endptr != ':') && (*endptr != 0)))
+			return (-1);
+		vl->time = DOUBLE_TO_CDTIME_T (tmp);
+		ptr = endptr;
+	}
+
+	for (i = 0; i < vl->values_len; i++)
+	{
+		const char *value;
+
+		if (*ptr != ':')
+			return (-1);
+		ptr++;
+		value = ptr;
+
+		endptr = NULL;
+		switch (ds->ds[i].type)
+		{
+			case DS_TYPE_GAUGE:
+				if ((ptr[0] == 'U')
+						&& ((ptr[1] == ':') || (ptr[1] == 0)))
+				{
+					vl->values[i].gauge = NAN;
+					endptr = (char *) ptr + 1;
+				}
+				else
+					vl->values[i].gauge = (gauge_t) strtod (ptr, &endptr);
+				break;
+
+			case DS_TYPE_COUNTER:
+				vl->values[i].counter = (counter_t) strtoull (ptr, &endptr, 0);
+				break;
+
+			case DS_TYPE_DERIVE:
+				vl->values[i].derive = (derive_t) strtoll (ptr, &endptr, 0);
+				break;
+
+			case DS_TYPE_ABSOLUTE:
+				vl->values[i].absolute = (absolute_t) strtoull (ptr, &endptr, 0);
+				break;
+
+			default:
+				ERROR ("utils_cmd_putval: Invalid data source type: %i.",
+						ds->ds[i].type);
+				return (-1);
+		}
+
+		if ((endptr == NULL) || (endptr == ptr))
+			return (-1);
+		ptr = endptr;
+
+		if ((*ptr != ':') && (*ptr != 0))
+		{
+			INFO ("utils_cmd_putval: Ignoring trailing garbage after %s "
+					"value. Input string was \"%s\".",
+					DS_TYPE_TO_STRING (ds->ds[i].type), value);
+			while ((*ptr != ':') && (*ptr != 0))
+				ptr++;
+		}
+	}
+
+	if (*ptr != 0)
+		return (-1);
+	return (0);
+} /* int putval_parse_values */
+
+/* Splits `identifier' in place and resolves its type. If `batch' is not
+ * NULL, the result is remembered, so that the same identifier on the next
+ * line costs one string comparison. */
+static const data_set_t *putval_parse_identifier (char *identifier,
+		value_list_t *vl, putval_batch_t *batch,
+		char *errbuf, size_t errbuf_size)
 {
-	char *command;
-	char *identifier;
 	char *hostname;
 	char *plugin;
 	char *plugin_instance;
 	char *type;
 	char *type_instance;
+	const data_set_t *ds;
+	char *ptr;
+	size_t identifier_len;
+
+	if ((batch != NULL) && (batch->last_ds != NULL)
+			&& (strcmp (identifier, batch->last_identifier) == 0))
+	{
+		*vl = batch->last_vl;
+		return (batch->last_ds);
+	}
+
+	/* Check the identifier first: parse_identifier truncates it. */
+	ptr = strchr (identifier, '/');
+	if ((ptr == NULL) || (strchr (ptr + 1, '/') == NULL))
+	{
+		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
+				identifier);
+		ssnprintf (errbuf, errbuf_size, "Cannot parse identifier `%s'.",
+				identifier);
+		return (NULL);
+	}
+
+	identifier_len = strlen (identifier);
+	if ((batch != NULL) && (identifier_len < sizeof (batch->last_identifier)))
+	{
+		batch->last_ds = NULL;
+		memcpy (batch->last_identifier, identifier, identifier_len + 1);
+	}
+	else
+		identifier_len = 0;
+
+	parse_identifier (identifier, &hostname,
+			&plugin, &plugin_instance,
+			&type, &type_instance);
+
+	if ((strlen (hostname) >= sizeof (vl->host))
+			|| (strlen (plugin) >= sizeof (vl->plugin))
+			|| ((plugin_instance != NULL)
+				&& (strlen (plugin_instance) >= sizeof (vl->plugin_instance)))
+			|| ((type_instance != NULL)
+				&& (strlen (type_instance) >= sizeof (vl->type_instance))))
+	{
+		sstrncpy (errbuf, "Identifier too long.", errbuf_size);
+		return (NULL);
+	}
+
+	sstrncpy (vl->host, hostname, sizeof (vl->host));
+	sstrncpy (vl->plugin, plugin, sizeof (vl->plugin));
+	sstrncpy (vl->type, type, sizeof (vl->type));
+	if (plugin_instance != NULL)
+		sstrncpy (vl->plugin_instance, plugin_instance, sizeof (vl->plugin_instance));
+	if (type_instance != NULL)
+		sstrncpy (vl->type_instance, type_instance, sizeof (vl->type_instance));
+
+	/* The ID saves looking up the type again when dispatching. */
+	vl->type_id = plugin_type_lookup (type);
+	ds = plugin_get_ds_by_id (vl->type_id);
+	if (ds == NULL) {
+		ssnprintf (errbuf, errbuf_size, "Type `%s' isn't defined.", type);
+		return (NULL);
+	}
+
+	if ((batch != NULL) && (identifier_len > 0))
+	{
+		batch->last_vl = *vl;
+		batch->last_ds = ds;
+	}
+
+	return (ds);
+} /* const data_set_t *putval_parse_identifier */
+
+/* Parses one PUTVAL command. If `batch' is NULL, each value is dispatched
+ * right away, otherwise the values are appended to `batch'. On failure, an
+ * error message is stored in `errbuf' and -1 is returned. Values parsed before
+ * the error are not discarded. Returns the number of values on success. */
+static int putval_parse (char *buffer, putval_batch_t *batch,
+		char *errbuf, size_t errbuf_size)
+{
+	char *command;
+	char *identifier;
 	int   status;
 	int   values_submitted;
 
-	char *identifier_copy;
-
 	const data_set_t *ds;
 	value_list_t vl = VALUE_LIST_INIT;
-
-	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
-			(void *) fh, buffer);
+	value_t *values = NULL;
 
 	command = NULL;
 	status = parse_string (&buffer, &command);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse command.\n");
+		sstrncpy (errbuf, "Cannot parse command.", errbuf_size);
 		return (-1);
 	}
 	assert (command != NULL);
 
 	if (strcasecmp ("PUTVAL", command) != 0)
 	{
-		print_to_socket (fh, "-1 Unexpected command: `%s'.\n", command);
+		ssnprintf (errbuf, errbuf_size, "Unexpected command: `%s'.", command);
 		return (-1);
 	}
 
@@ -112,67 +337,26 @@ int handle_putval (FILE *fh, char *buffer)
 	status = parse_string (&buffer, &identifier);
 	if (status != 0)
 	{
-		print_to_socket (fh, "-1 Cannot parse identifier.\n");
+		sstrncpy (errbuf, "Cannot parse identifier.", errbuf_size);
 		return (-1);
 	}
 	assert (identifier != NULL);
 
-	/* parse_identifier() modifies its first argument,
-	 * returning pointers into it */
-	identifier_copy = sstrdup (identifier);
-
-	status = parse_identifier (identifier_copy, &hostname,
-			&plugin, &plugin_instance,
-			&type, &type_instance);
-	if (status != 0)
-	{
-		DEBUG ("handle_putval: Cannot parse identifier `%s'.",
-				identifier);
-		print_to_socket (fh, "-1 Cannot parse identifier `%s'.\n",
-				identifier);
-		sfree (identifier_copy);
-		return (-1);
-	}
-
-	if ((strlen (hostname) >= sizeof (vl.host))
-			|| (strlen (plugin) >= sizeof (vl.plugin))
-			|| ((plugin_instance != NULL)
-				&& (strlen (plugin_instance) >= sizeof (vl.plugin_instance)))
-			|| ((type_instance != NULL)
-				&& (strlen (type_instance) >= sizeof (vl.type_instance))))
-	{
-		print_to_socket (fh, "-1 Identifier too long.\n");
-		sfree (identifier_copy);
+	/* The identifier points into `buffer', which is split in place. */
+	ds = putval_parse_identifier (identifier, &vl, batch,
+			errbuf, errbuf_size);
+	if (ds == NULL)
 		return (-1);
-	}
-
-	sstrncpy (vl.host, hostname, sizeof (vl.host));
-	sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
-	sstrncpy (vl.type, type, sizeof (vl.type));
-	if (plugin_instance != NULL)
-		sstrncpy (vl.plugin_instance, plugin_instance, sizeof (vl.plugin_instance));
-	if (type_instance != NULL)
-		sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
-
-	ds = plugin_get_ds (type);
-	if (ds == NULL) {
-		print_to_socket (fh, "-1 Type `%s' isn't defined.\n", type);
-		sfree (identifier_copy);
-		return (-1);
-	}
-
-	/* Free identifier_copy */
-	hostname = NULL;
-	plugin = NULL; plugin_instance = NULL;
-	type = NULL;   type_instance = NULL;
-	sfree (identifier_copy);
 
 	vl.values_len = ds->ds_num;
-	vl.values = (value_t *) malloc (vl.values_len * sizeof (value_t));
-	if (vl.values == NULL)
+	if (batch == NULL)
 	{
-		print_to_socket (fh, "-1 malloc failed.\n");
-		return (-1);
+		values = (value_t *) malloc (vl.values_len * sizeof (value_t));
+		if (values == NULL)
+		{
+			sstrncpy (errbuf, "malloc failed.", errbuf_size);
+			return (-1);
+		}
 	}
 
 	/* All the remaining fields are part of the optionlist. */
@@ -187,7 +371,8 @@ int handle_putval (FILE *fh, char *buffer)
 		{
 			/* parse_option failed, buffer has been modified.
 			 * => we need to abort */
-			print_to_socket (fh, "-1 Misformatted option.\n");
+			sstrncpy (errbuf, "Misformatted option.", errbuf_size);
+			sfree (values);
 			return (-1);
 		}
 		else if (status == 0)
@@ -203,55 +388,378 @@ int handle_putval (FILE *fh, char *buffer)
 		status = parse_string (&buffer, &string);
 		if (status != 0)
 		{
-			print_to_socket (fh, "-1 Misformatted value.\n");
+			sstrncpy (errbuf, "Misformatted value.", errbuf_size);
+			sfree (values);
 			return (-1);
 		}
 		assert (string != NULL);
 
-		status = dispatch_values (ds, &vl, fh, string);
+		if (batch != NULL)
+		{
+			if (putval_batch_reserve (batch, vl.values_len) != 0)
+			{
+				sstrncpy (errbuf, "realloc failed.", errbuf_size);
+				return (-1);
+			}
+			vl.values = batch->values + batch->values_num;
+		}
+		else
+			vl.values = values;
+
+		status = putval_parse_values (string, &vl, ds);
 		if (status != 0)
 		{
-			/* An error has already been printed. */
+			sstrncpy (errbuf, "Parsing the values string failed.",
+					errbuf_size);
+			sfree (values);
 			return (-1);
 		}
+
+		if (batch != NULL)
+		{
+			batch->vl[batch->vl_num] = vl;
+			batch->vl[batch->vl_num].values = NULL;
+			batch->values_offset[batch->vl_num] = batch->values_num;
+			batch->vl_num++;
+			batch->values_num += vl.values_len;
+		}
+		else
+			plugin_dispatch_values (&vl);
+
 		values_submitted++;
 	} /* while (*buffer != 0) */
 	/* Done parsing the options. */
 
+	sfree (values);
+
+	return (values_submitted);
+} /* int putval_parse */
+
+int handle_putval (FILE *fh, char *buffer)
+{
+	char errbuf[256];
+	int values_submitted;
+
+	DEBUG ("utils_cmd_putval: handle_putval (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	values_submitted = putval_parse (buffer, /* batch = */ NULL,
+			errbuf, sizeof (errbuf));
+	if (values_submitted < 0)
+	{
+		print_to_socket (fh, "-1 %s\n", errbuf);
+		return (-1);
+	}
+
 	print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
 			values_submitted,
 			(values_submitted == 1) ? "value has" : "values have");
 
-	sfree (vl.values); 
-
 	return (0);
 } /* int handle_putval */
 
-int create_putval (char *ret, size_t ret_len, /* {{{ */
-	const data_set_t *ds, const value_list_t *vl)
+putval_batch_t *putval_batch_create (void) /* {{{ */
 {
-	char buffer_ident[6 * DATA_MAX_NAME_LEN];
-	char buffer_values[1024];
+	putval_batch_t *batch;
+
+	batch = malloc (sizeof (*batch));
+	if (batch == NULL)
+		return (NULL);
+	memset (batch, 0, sizeof (*batch));
+
+	return (batch);
+} /* }}} putval_batch_t *putval_batch_create */
+
+void putval_batch_destroy (putval_batch_t *batch) /* {{{ */
+{
+	if (batch == NULL)
+		return;
+
+	sfree (batch->vl);
+	sfree (batch->values_offset);
+	sfree (batch->values);
+	sfree (batch);
+} /* }}} void putval_batch_destroy */
+
+int putval_batch_pending (const putval_batch_t *batch) /* {{{ */
+{
+	return ((batch != NULL) && (batch->lines_remaining > 0));
+} /* }}} int putval_batch_pending */
+
+int putval_batch_add (putval_batch_t *batch, char *buffer, /* {{{ */
+		char *errbuf, size_t errbuf_size)
+{
+	int status;
+
+	if (batch == NULL)
+		return (-EINVAL);
+
+	status = putval_parse (buffer, batch, errbuf, errbuf_size);
+	if (batch->vl_num >= PUTVAL_BATCH_MAX)
+		putval_batch_flush (batch);
+
+	return (status);
+} /* }}} int putval_batch_add */
+
+int putval_batch_flush (putval_batch_t *batch) /* {{{ */
+{
+	size_t vl_num;
+	size_t i;
 	int status;
 
-	status = FORMAT_VL (buffer_ident, sizeof (buffer_ident), vl);
+	if ((batch == NULL) || (batch->vl_num == 0))
+		return (0);
+
+	for (i = 0; i < batch->vl_num; i++)
+		batch->vl[i].values = batch->values + batch->values_offset[i];
+
+	status = plugin_dispatch_values_batch (batch->vl, batch->vl_num);
+
+	vl_num = batch->vl_num;
+	batch->vl_num = 0;
+	batch->values_num = 0;
+
 	if (status != 0)
-		return (status);
-	escape_string (buffer_ident, sizeof (buffer_ident));
+		return (-1);
+	return ((int) vl_num);
+} /* }}} int putval_batch_flush */
+
+/* Summarizes a finished PUTVAL-BATCH block. */
+static int putval_batch_report (FILE *fh, putval_batch_t *batch) /* {{{ */
+{
+	if (batch->lines_failed == 0)
+	{
+		print_to_socket (fh, "0 Success: %i %s been dispatched.\n",
+				batch->values_dispatched,
+				(batch->values_dispatched == 1)
+				? "value has" : "values have");
+	}
+	else
+	{
+		print_to_socket (fh, "-1 %i of %i lines failed, "
+				"%i %s been dispatched. First error: %s\n",
+				batch->lines_failed, batch->lines_total,
+				batch->values_dispatched,
+				(batch->values_dispatched == 1)
+				? "value has" : "values have",
+				batch->first_error);
+	}
+
+	return (0);
+} /* }}} int putval_batch_report */
+
+int handle_putval_batch (FILE *fh, char *buffer, /* {{{ */
+		putval_batch_t *batch)
+{
+	char errbuf[256];
+	int status;
+
+	if (batch == NULL)
+		return (-1);
+
+	DEBUG ("utils_cmd_putval: handle_putval_batch (fh = %p, buffer = %s);",
+			(void *) fh, buffer);
+
+	/* Not inside a block: This must be the header. */
+	if (batch->lines_remaining <= 0)
+	{
+		char *command = NULL;
+		char *lines_str = NULL;
+		char *endptr = NULL;
+		long lines = 0;
 
-	status = format_values (buffer_values, sizeof (buffer_values),
-			ds, vl, /* store rates = */ 0);
+		status = parse_string (&buffer, &command);
+		if ((status != 0) || (strcasecmp ("PUTVAL-BATCH", command) != 0))
+		{
+			print_to_socket (fh, "-1 Cannot parse command.\n");
+			return (-1);
+		}
+
+		status = parse_string (&buffer, &lines_str);
+		if (status == 0)
+		{
+			errno = 0;
+			lines = strtol (lines_str, &endptr, 10);
+		}
+		if ((status != 0) || (errno != 0) || (endptr == lines_str)
+				|| (*endptr != 0) || (lines < 1) || (lines > INT_MAX))
+		{
+			print_to_socket (fh, "-1 Invalid number of lines.\n");
+			return (-1);
+		}
+
+		if (*buffer != 0)
+		{
+			print_to_socket (fh, "-1 Garbage after end of command: %s\n",
+					buffer);
+			return (-1);
+		}
+
+		batch->lines_remaining = (int) lines;
+		batch->lines_total = (int) lines;
+		batch->lines_failed = 0;
+		batch->values_dispatched = 0;
+		batch->first_error[0] = 0;
+
+		/* No response until the block is complete. */
+		return (0);
+	}
+
+	status = putval_parse (buffer, batch, errbuf, sizeof (errbuf));
+	if (status < 0)
+	{
+		if (batch->lines_failed == 0)
+			sstrncpy (batch->first_error, errbuf, sizeof (batch->first_error));
+		batch->lines_failed++;
+	}
+	batch->lines_remaining--;
+
+	if ((batch->vl_num >= PUTVAL_BATCH_MAX) || (batch->lines_remaining == 0))
+	{
+		status = putval_batch_flush (batch);
+		if (status < 0)
+		{
+			if (batch->lines_failed == 0)
+				sstrncpy (batch->first_error, "Dispatching values failed.",
+						sizeof (batch->first_error));
+			batch->lines_failed++;
+		}
+		else
+			batch->values_dispatched += status;
+	}
+
+	if (batch->lines_remaining == 0)
+		return (putval_batch_report (fh, batch));
+
+	return (0);
+} /* }}} int handle_putval_batch */
+
+/* Writes `value' in decimal to `buffer', which must have room for 20
+ * characters, and returns the number of characters written. */
+static size_t putval_format_uint (char *buffer, uint64_t value) /* {{{ */
+{
+	char tmp[20];
+	size_t len = 0;
+	size_t i;
+
+	do
+	{
+		tmp[len] = (char) ('0' + (value % 10));
+		value /= 10;
+		len++;
+	} while (value != 0);
+
+	for (i = 0; i < len; i++)
+		buffer[i] = tmp[len - i - 1];
+
+	return (len);
+} /* }}} size_t putval_format_uint */
+
+int format_putval (char *ret, size_t ret_len, /* {{{ */
+		const data_set_t *ds, const value_list_t *vl, _Bool store_rates)
+{
+	gauge_t rates[ds->ds_num];
+	_Bool have_rates = 0;
+	size_t offset;
+	int status;
+	int i;
+
+#define BUFFER_ADD(...) do { \
+	status = ssnprintf (ret + offset, ret_len - offset, __VA_ARGS__); \
+	if ((status < 1) || (((size_t) status) >= (ret_len - offset))) \
+		return (-1); \
+	offset += (size_t) status; \
+} while (0)
+
+	if (ret_len < sizeof ("PUTVAL "))
+		return (-1);
+	memcpy (ret, "PUTVAL ", strlen ("PUTVAL "));
+	offset = strlen ("PUTVAL ");
+
+	/* The identifier is formatted in place and only copied if it needs to
+	 * be quoted. */
+	status = FORMAT_VL (ret + offset, ret_len - offset, vl);
 	if (status != 0)
-		return (status);
-	escape_string (buffer_values, sizeof (buffer_values));
+		return (-1);
+	if (strpbrk (ret + offset, " \t\"\\") != NULL)
+		escape_string (ret + offset, ret_len - offset);
+	offset += strlen (ret + offset);
 
-	ssnprintf (ret, ret_len,
-			"PUTVAL %s interval=%.3f %s",
-			buffer_ident,
+	BUFFER_ADD (" interval=%.3f %.3f",
 			(vl->interval > 0)
 			? CDTIME_T_TO_DOUBLE (vl->interval)
 			: CDTIME_T_TO_DOUBLE (interval_g),
-			buffer_values);
+			CDTIME_T_TO_DOUBLE (vl->time));
+
+	for (i = 0; i < ds->ds_num; i++)
+	{
+		if ((ds->ds[i].type == DS_TYPE_GAUGE) || store_rates)
+		{
+			gauge_t value = vl->values[i].gauge;
+
+			if (ds->ds[i].type != DS_TYPE_GAUGE)
+			{
+				if (!have_rates
+						&& (uc_get_rate_buffer (ds, vl, rates) != 0))
+				{
+					WARNING ("format_putval: "
+							"uc_get_rate_buffer failed.");
+					return (-1);
+				}
+				have_rates = 1;
+				value = rates[i];
+			}
+
+			BUFFER_ADD (":%f", value);
+			continue;
+		}
+
+		/* Integers are converted by hand: a colon, a sign and 20 digits
+		 * plus the terminating null byte. */
+		if ((ret_len - offset) < 24)
+			return (-1);
+		ret[offset] = ':';
+		offset++;
 
+		if (ds->ds[i].type == DS_TYPE_COUNTER)
+			offset += putval_format_uint (ret + offset,
+					(uint64_t) vl->values[i].counter);
+		else if (ds->ds[i].type == DS_TYPE_DERIVE)
+		{
+			derive_t value = vl->values[i].derive;
+
+			if (value < 0)
+			{
+				ret[offset] = '-';
+				offset++;
+				offset += putval_format_uint (ret + offset,
+						(uint64_t) 0 - (uint64_t) value);
+			}
+			else
+				offset += putval_format_uint (ret + offset,
+						(uint64_t) value);
+		}
+		else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+			offset += putval_format_uint (ret + offset,
+					(uint64_t) vl->values[i].absolute);
+		else
+		{
+			ERROR ("format_putval: Unknown data source type: %i",
+					ds->ds[i].type);
+			return (-1);
+		}
+		ret[offset] = 0;
+	} /* for ds->ds_num */
+
+#undef BUFFER_ADD
+
+	return ((int) offset);
+} /* }}} int format_putval */
+
+int create_putval (char *ret, size_t ret_len, /* {{{ */
+	const data_set_t *ds, const value_list_t *vl)
+{
+	if (format_putval (ret, ret_len, ds, vl, /* store rates = */ 0) < 0)
+		return (-1);
 	return (0);
 } /* }}} int create_putval */
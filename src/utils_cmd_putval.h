@@ -28,6 +28,40 @@
 
 int handle_putval (FILE *fh, char *buffer);
 
+/*
+ * Bulk interface: PUTVAL commands added to a batch are parsed immediately,
+ * but their values are collected and dispatched together using
+ * plugin_dispatch_values_batch.
+ *
+ * putval_batch_add parses one PUTVAL command. On failure, it stores an error
+ * message in `errbuf' and returns less than zero. putval_batch_flush
+ * dispatches all collected values and returns the number of value lists.
+ *
+ * handle_putval_batch implements the "PUTVAL-BATCH <lines>" command: the
+ * header line and the <lines> PUTVAL commands following it are all passed to
+ * this function, which only prints a single response after the last one.
+ * putval_batch_pending returns true while such a block is incomplete.
+ */
+struct putval_batch_s;
+typedef struct putval_batch_s putval_batch_t;
+
+putval_batch_t *putval_batch_create (void);
+void putval_batch_destroy (putval_batch_t *batch);
+int putval_batch_add (putval_batch_t *batch, char *buffer,
+		char *errbuf, size_t errbuf_size);
+int putval_batch_flush (putval_batch_t *batch);
+int putval_batch_pending (const putval_batch_t *batch);
+int handle_putval_batch (FILE *fh, char *buffer, putval_batch_t *batch);
+
+/*
+ * format_putval writes the PUTVAL command for `vl', without a newline, to
+ * `ret' in one pass and returns its length, or less than zero if `ret' is too
+ * small. With `store_rates', counter, derive and absolute values are
+ * converted to rates. create_putval is the same without rates and returns
+ * zero on success.
+ */
+int format_putval (char *ret, size_t ret_len,
+		const data_set_t *ds, const value_list_t *vl, _Bool store_rates);
 int create_putval (char *ret, size_t ret_len,
 		const data_set_t *ds, const value_list_t *vl);
 
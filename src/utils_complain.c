@@ -39,8 +39,8 @@ static int vcomplain (int level, c_complain_t *c,
 
 	c->last = now;
 
-	if (c->interval < interval_g)
-		c->interval = interval_g;
+	if (c->interval < CDTIME_T_TO_TIME_T (interval_g))
+		c->interval = CDTIME_T_TO_TIME_T (interval_g);
 	else
 		c->interval *= 2;
 
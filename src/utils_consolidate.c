@@ -0,0 +1,416 @@
+/**
+ * collectd - src/utils_consolidate.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_consolidate.h"
+#include "utils_hashtable.h"
+
+#include <pthread.h>
+
+/* The values of one identifier dispatched during the current interval.
+ * GAUGE values are summed up for the average and compared for the maximum;
+ * ABSOLUTE values, which count what happened since the last value, are
+ * summed up whatever the function; for COUNTER and DERIVE values the last one
+ * is passed on, since the rate derived from it covers the whole interval. */
+struct series_value_s
+{
+	gauge_t sum;
+	gauge_t max;
+	int     count;
+	value_t last;
+};
+typedef struct series_value_s series_value_t;
+
+struct series_s
+{
+	char *key;
+	const data_set_t *ds;
+	/* The identifier and time of the last value list. `values' and `meta'
+	 * are not used. */
+	value_list_t vl;
+	series_value_t *values;
+	int num;
+	/* The end of the current interval, a multiple of the interval. */
+	cdtime_t end;
+};
+typedef struct series_s series_t;
+
+struct consolidate_s
+{
+	plugin_write_cb callback;
+	user_data_t udata;
+
+	cdtime_t interval;
+	int      consolidation;
+
+	pthread_mutex_t lock;
+	c_hashtable_t *series;
+	cdtime_t next_sweep;
+};
+
+/* Returns the data set of `vl', using its type ID if it is still valid. */
+static const data_set_t *consolidate_get_ds (const value_list_t *vl) /* {{{ */
+{
+	const data_set_t *ds;
+
+	ds = plugin_get_ds_by_id (vl->type_id);
+	if ((ds != NULL) && (strcmp (ds->type, vl->type) == 0))
+		return (ds);
+
+	return (plugin_get_ds (vl->type));
+} /* }}} const data_set_t *consolidate_get_ds */
+
+static void series_add (series_t *s, const value_list_t *vl) /* {{{ */
+{
+	int i;
+
+	for (i = 0; i < s->ds->ds_num; i++)
+	{
+		series_value_t *v = s->values + i;
+
+		switch (s->ds->ds[i].type)
+		{
+			case DS_TYPE_GAUGE:
+				v->last.gauge = vl->values[i].gauge;
+				if (isnan (vl->values[i].gauge))
+					break;
+				v->sum += vl->values[i].gauge;
+				if ((v->count == 0) || (v->max < vl->values[i].gauge))
+					v->max = vl->values[i].gauge;
+				v->count++;
+				break;
+
+			case DS_TYPE_ABSOLUTE:
+				v->last.absolute += vl->values[i].absolute;
+				break;
+
+			default:
+				v->last = vl->values[i];
+				break;
+		}
+	}
+
+	memcpy (&s->vl, vl, sizeof (s->vl));
+	s->vl.values = NULL;
+	s->vl.meta = NULL;
+	s->vl.identifier = NULL;
+	s->num++;
+} /* }}} void series_add */
+
+/* Stores the consolidated values of `s' in `ret_vl', which has to be freed
+ * with `sfree (ret_vl->values)', and starts a new interval. */
+static int series_take (consolidate_t *c, series_t *s, /* {{{ */
+		value_list_t *ret_vl)
+{
+	int i;
+
+	memcpy (ret_vl, &s->vl, sizeof (*ret_vl));
+	ret_vl->values_len = s->ds->ds_num;
+	ret_vl->interval = c->interval;
+	ret_vl->values = calloc (s->ds->ds_num, sizeof (*ret_vl->values));
+	if (ret_vl->values == NULL)
+	{
+		ERROR ("utils_consolidate: calloc failed.");
+		return (ENOMEM);
+	}
+
+	for (i = 0; i < s->ds->ds_num; i++)
+	{
+		series_value_t *v = s->values + i;
+
+		if (s->ds->ds[i].type != DS_TYPE_GAUGE)
+			ret_vl->values[i] = v->last;
+		else if (c->consolidation == PLUGIN_CONSOLIDATE_LAST)
+			ret_vl->values[i].gauge = v->last.gauge;
+		else if (v->count == 0)
+			ret_vl->values[i].gauge = NAN;
+		else if (c->consolidation == PLUGIN_CONSOLIDATE_MAXIMUM)
+			ret_vl->values[i].gauge = v->max;
+		else
+			ret_vl->values[i].gauge = v->sum / ((gauge_t) v->count);
+
+		v->sum = 0.0;
+		v->max = 0.0;
+		v->count = 0;
+		if (s->ds->ds[i].type == DS_TYPE_ABSOLUTE)
+			v->last.absolute = 0;
+	}
+	s->num = 0;
+
+	return (0);
+} /* }}} int series_take */
+
+static void series_free (series_t *s) /* {{{ */
+{
+	if (s == NULL)
+		return;
+
+	sfree (s->key);
+	sfree (s->values);
+	sfree (s);
+} /* }}} void series_free */
+
+static series_t *series_create (const char *key, /* {{{ */
+		const data_set_t *ds)
+{
+	series_t *s;
+
+	s = malloc (sizeof (*s));
+	if (s == NULL)
+	{
+		ERROR ("utils_consolidate: malloc failed.");
+		return (NULL);
+	}
+	memset (s, 0, sizeof (*s));
+
+	s->key = strdup (key);
+	s->values = calloc (ds->ds_num, sizeof (*s->values));
+	if ((s->key == NULL) || (s->values == NULL))
+	{
+		ERROR ("utils_consolidate: strdup or calloc failed.");
+		series_free (s);
+		return (NULL);
+	}
+	s->ds = ds;
+
+	return (s);
+} /* }}} series_t *series_create */
+
+/* Passes on the values of all series whose interval ended before `limit', or
+ * of all series if `limit' is zero, and removes the series which received no
+ * values during the last interval. */
+static void consolidate_sweep (consolidate_t *c, cdtime_t limit) /* {{{ */
+{
+	c_hashtable_iterator_t *iter;
+	series_t **expired;
+	value_list_t *vls;
+	size_t expired_num = 0;
+	size_t vls_num = 0;
+	size_t i;
+	int size;
+	void *key;
+	void *value;
+
+	pthread_mutex_lock (&c->lock);
+
+	size = c_hashtable_size (c->series);
+	if (size == 0)
+	{
+		pthread_mutex_unlock (&c->lock);
+		return;
+	}
+
+	expired = calloc ((size_t) size, sizeof (*expired));
+	vls = calloc ((size_t) size, sizeof (*vls));
+	iter = c_hashtable_get_iterator (c->series);
+	if ((expired == NULL) || (vls == NULL) || (iter == NULL))
+	{
+		pthread_mutex_unlock (&c->lock);
+		ERROR ("utils_consolidate: calloc failed.");
+		if (iter != NULL)
+			c_hashtable_iterator_destroy (iter);
+		sfree (expired);
+		sfree (vls);
+		return;
+	}
+
+	while (c_hashtable_iterator_next (iter, &key, &value) == 0)
+	{
+		series_t *s = value;
+
+		if ((limit != 0) && (s->end > limit))
+			continue;
+
+		if (s->num == 0)
+			expired[expired_num++] = s;
+		else if (series_take (c, s, vls + vls_num) == 0)
+			vls_num++;
+	}
+	c_hashtable_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+	{
+		c_hashtable_remove (c->series, expired[i]->key,
+				/* key = */ NULL, /* value = */ NULL);
+		series_free (expired[i]);
+	}
+
+	pthread_mutex_unlock (&c->lock);
+
+	for (i = 0; i < vls_num; i++)
+	{
+		const data_set_t *ds = consolidate_get_ds (vls + i);
+
+		if (ds != NULL)
+			(*c->callback) (ds, vls + i, &c->udata);
+		sfree (vls[i].values);
+	}
+
+	sfree (expired);
+	sfree (vls);
+} /* }}} void consolidate_sweep */
+
+consolidate_t *consolidate_create (cdtime_t interval, /* {{{ */
+		int consolidation, plugin_write_cb callback, user_data_t *ud)
+{
+	consolidate_t *c;
+
+	c = malloc (sizeof (*c));
+	if (c == NULL)
+	{
+		ERROR ("utils_consolidate: malloc failed.");
+		return (NULL);
+	}
+	memset (c, 0, sizeof (*c));
+
+	c->callback = callback;
+	if (ud != NULL)
+		c->udata = *ud;
+	c->interval = interval;
+	c->consolidation = consolidation;
+
+	c->series = c_hashtable_create (c_hashtable_hash_string,
+			(void *) strcmp);
+	if (c->series == NULL)
+	{
+		ERROR ("utils_consolidate: c_hashtable_create failed.");
+		sfree (c);
+		return (NULL);
+	}
+	pthread_mutex_init (&c->lock, /* attr = */ NULL);
+
+	return (c);
+} /* }}} consolidate_t *consolidate_create */
+
+void consolidate_destroy (consolidate_t *c) /* {{{ */
+{
+	void *key;
+	void *value;
+
+	if (c == NULL)
+		return;
+
+	consolidate_sweep (c, /* limit = */ 0);
+	/* The sweep only removes the series it has already passed on. */
+	consolidate_sweep (c, /* limit = */ 0);
+	while (c_hashtable_pick (c->series, &key, &value) == 0)
+		series_free (value);
+	c_hashtable_destroy (c->series);
+
+	if ((c->udata.data != NULL) && (c->udata.free_func != NULL))
+		c->udata.free_func (c->udata.data);
+
+	pthread_mutex_destroy (&c->lock);
+	sfree (c);
+} /* }}} void consolidate_destroy */
+
+int consolidate_add (consolidate_t *c, const data_set_t *ds, /* {{{ */
+		const value_list_t *vl)
+{
+	const vl_identifier_t *ident;
+	vl_identifier_t ident_buffer;
+	series_t *s = NULL;
+	value_list_t vls[2];
+	int vls_num = 0;
+	_Bool sweep = 0;
+	int i;
+
+	ident = plugin_value_list_identifier (vl, &ident_buffer);
+	if (ident == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&c->lock);
+
+	if (c_hashtable_get (c->series, ident->name, (void *) &s) == 0)
+	{
+		if (s->ds != ds)
+		{
+			/* The type has been redefined; start over. */
+			c_hashtable_remove (c->series, s->key, NULL, NULL);
+			series_free (s);
+			s = NULL;
+		}
+		else if (vl->time <= s->vl.time)
+		{
+			/* Late values would be sent out of order. */
+			pthread_mutex_unlock (&c->lock);
+			return (0);
+		}
+	}
+	else
+	{
+		s = NULL;
+	}
+
+	if (s == NULL)
+	{
+		s = series_create (ident->name, ds);
+		if ((s == NULL)
+				|| (c_hashtable_insert (c->series, s->key, s) != 0))
+		{
+			pthread_mutex_unlock (&c->lock);
+			series_free (s);
+			return (ENOMEM);
+		}
+	}
+
+	/* Values of a previous interval which were not passed on yet because
+	 * the series stopped or its values are irregular. */
+	if ((s->num > 0) && (vl->time >= s->end)
+			&& (series_take (c, s, vls + vls_num) == 0))
+		vls_num++;
+
+	if (s->num == 0)
+		s->end = c->interval * (1 + (vl->time / c->interval));
+	series_add (s, vl);
+
+	/* The next value belongs to the next interval, so there is no need to
+	 * wait for it. */
+	if ((vl->time + vl->interval >= s->end)
+			&& (series_take (c, s, vls + vls_num) == 0))
+		vls_num++;
+
+	if (vl->time >= c->next_sweep)
+	{
+		c->next_sweep = vl->time + c->interval;
+		sweep = 1;
+	}
+
+	pthread_mutex_unlock (&c->lock);
+
+	for (i = 0; i < vls_num; i++)
+	{
+		(*c->callback) (ds, vls + i, &c->udata);
+		sfree (vls[i].values);
+	}
+
+	if (sweep)
+		consolidate_sweep (c, vl->time - c->interval);
+
+	return (0);
+} /* }}} int consolidate_add */
+
+void consolidate_flush (consolidate_t *c, cdtime_t now) /* {{{ */
+{
+	if (c == NULL)
+		return;
+
+	consolidate_sweep (c, now - c->interval);
+} /* }}} void consolidate_flush */
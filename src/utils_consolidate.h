@@ -0,0 +1,56 @@
+/**
+ * collectd - src/utils_consolidate.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CONSOLIDATE_H
+#define UTILS_CONSOLIDATE_H 1
+
+#include "plugin.h"
+
+/*
+ * Consolidation of value lists to a longer interval
+ *
+ * The value lists added are collected per identifier and passed on to a write
+ * callback once per interval, i.e. at most one value list per identifier and
+ * interval. GAUGE values are consolidated with one of the
+ * PLUGIN_CONSOLIDATE_* functions, see the `WriteInterval' option. The
+ * consolidator is thread-safe; the callback is called without its lock held.
+ */
+
+struct consolidate_s;
+typedef struct consolidate_s consolidate_t;
+
+/* Creates a consolidator passing value lists to `callback' once per
+ * `interval'. The consolidator takes over `ud', if not NULL, and frees it
+ * when it is destroyed. Returns NULL on error. */
+consolidate_t *consolidate_create (cdtime_t interval, int consolidation,
+		plugin_write_cb callback, user_data_t *ud);
+
+/* Passes on the values which are left and frees the consolidator and the
+ * callback's user data. */
+void consolidate_destroy (consolidate_t *c);
+
+/* Adds `vl'. Values which are not newer than the last value of their
+ * identifier are ignored. */
+int consolidate_add (consolidate_t *c, const data_set_t *ds,
+		const value_list_t *vl);
+
+/* Passes on the values of identifiers which received nothing for a whole
+ * interval before `now'. */
+void consolidate_flush (consolidate_t *c, cdtime_t now);
+
+#endif /* UTILS_CONSOLIDATE_H */
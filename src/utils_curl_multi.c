@@ -0,0 +1,284 @@
+/**
+ * collectd - src/utils_curl_multi.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_curl_multi.h"
+
+/* The longest time to wait for activity before checking the timeout. */
+#define UCM_WAIT_MAX_MS 1000
+
+struct ucm_transfer_s
+{
+	CURL *curl;
+	ucm_callback_t callback;
+	void *user_data;
+};
+typedef struct ucm_transfer_s ucm_transfer_t;
+
+struct ucm_s
+{
+	CURLM *multi;
+
+	ucm_transfer_t *transfers;
+	size_t transfers_num;
+	size_t transfers_size;
+};
+
+ucm_t *ucm_create (void) /* {{{ */
+{
+	ucm_t *m;
+
+	m = calloc (1, sizeof (*m));
+	if (m == NULL)
+	{
+		ERROR ("utils_curl_multi: calloc failed.");
+		return (NULL);
+	}
+
+	m->multi = curl_multi_init ();
+	if (m->multi == NULL)
+	{
+		ERROR ("utils_curl_multi: curl_multi_init failed.");
+		sfree (m);
+		return (NULL);
+	}
+
+	return (m);
+} /* }}} ucm_t *ucm_create */
+
+/* Removes the transfer at `index' and calls its callback. */
+static void ucm_transfer_done (ucm_t *m, size_t index, /* {{{ */
+		CURLcode result)
+{
+	ucm_transfer_t t = m->transfers[index];
+
+	curl_multi_remove_handle (m->multi, t.curl);
+
+	m->transfers_num--;
+	if (index < m->transfers_num)
+		m->transfers[index] = m->transfers[m->transfers_num];
+
+	if (t.callback != NULL)
+		(*t.callback) (t.curl, result, t.user_data);
+} /* }}} void ucm_transfer_done */
+
+void ucm_destroy (ucm_t *m) /* {{{ */
+{
+	if (m == NULL)
+		return;
+
+	/* Transfers which were added but never performed are not reported. */
+	while (m->transfers_num > 0)
+	{
+		m->transfers_num--;
+		curl_multi_remove_handle (m->multi,
+				m->transfers[m->transfers_num].curl);
+	}
+
+	curl_multi_cleanup (m->multi);
+	sfree (m->transfers);
+	sfree (m);
+} /* }}} void ucm_destroy */
+
+int ucm_add (ucm_t *m, CURL *curl, ucm_callback_t callback, /* {{{ */
+		void *user_data)
+{
+	CURLMcode status;
+
+	if ((m == NULL) || (curl == NULL))
+		return (EINVAL);
+
+	if (m->transfers_num >= m->transfers_size)
+	{
+		size_t new_size = (m->transfers_size == 0)
+			? 8 : 2 * m->transfers_size;
+		ucm_transfer_t *tmp;
+
+		tmp = realloc (m->transfers, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+		{
+			ERROR ("utils_curl_multi: realloc failed.");
+			return (ENOMEM);
+		}
+		m->transfers = tmp;
+		m->transfers_size = new_size;
+	}
+
+	status = curl_multi_add_handle (m->multi, curl);
+	if (status != CURLM_OK)
+	{
+		ERROR ("utils_curl_multi: curl_multi_add_handle failed: %s",
+				curl_multi_strerror (status));
+		return (-1);
+	}
+
+	m->transfers[m->transfers_num].curl = curl;
+	m->transfers[m->transfers_num].callback = callback;
+	m->transfers[m->transfers_num].user_data = user_data;
+	m->transfers_num++;
+
+	return (0);
+} /* }}} int ucm_add */
+
+/* Calls the callbacks of all completed transfers. Returns the number of
+ * them which failed. */
+static int ucm_handle_done (ucm_t *m) /* {{{ */
+{
+	CURLMsg *msg;
+	int msgs_left;
+	int failed = 0;
+
+	while ((msg = curl_multi_info_read (m->multi, &msgs_left)) != NULL)
+	{
+		size_t i;
+
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+
+		for (i = 0; i < m->transfers_num; i++)
+			if (m->transfers[i].curl == msg->easy_handle)
+				break;
+		if (i >= m->transfers_num)
+			continue;
+
+		if (msg->data.result != CURLE_OK)
+			failed++;
+		/* `msg' is invalid once the handle has been removed. */
+		ucm_transfer_done (m, i, msg->data.result);
+	}
+
+	return (failed);
+} /* }}} int ucm_handle_done */
+
+/* Waits at most `timeout_ms' for activity on the transfers' sockets. */
+static int ucm_wait (ucm_t *m, long timeout_ms) /* {{{ */
+{
+	long curl_timeout = -1;
+
+	curl_multi_timeout (m->multi, &curl_timeout);
+	if ((curl_timeout >= 0) && (curl_timeout < timeout_ms))
+		timeout_ms = curl_timeout;
+	if (timeout_ms <= 0)
+		return (0);
+
+#if LIBCURL_VERSION_NUM >= 0x071c00
+	{
+		CURLMcode status;
+
+		status = curl_multi_wait (m->multi, /* extra fds = */ NULL, 0,
+				(int) timeout_ms, /* numfds = */ NULL);
+		if (status != CURLM_OK)
+		{
+			ERROR ("utils_curl_multi: curl_multi_wait failed: %s",
+					curl_multi_strerror (status));
+			return (-1);
+		}
+	}
+#else
+	{
+		fd_set fds_read;
+		fd_set fds_write;
+		fd_set fds_except;
+		int fd_max = -1;
+		struct timeval tv;
+
+		FD_ZERO (&fds_read);
+		FD_ZERO (&fds_write);
+		FD_ZERO (&fds_except);
+		curl_multi_fdset (m->multi, &fds_read, &fds_write, &fds_except,
+				&fd_max);
+
+		tv.tv_sec = timeout_ms / 1000;
+		tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+		/* Without sockets, e.g. while resolving a name, this just
+		 * sleeps as long as libcurl asked for. */
+		if ((select (fd_max + 1, &fds_read, &fds_write, &fds_except,
+						&tv) < 0) && (errno != EINTR))
+		{
+			char errbuf[1024];
+			ERROR ("utils_curl_multi: select failed: %s",
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+	}
+#endif
+
+	return (0);
+} /* }}} int ucm_wait */
+
+int ucm_perform (ucm_t *m, cdtime_t timeout) /* {{{ */
+{
+	cdtime_t end = 0;
+	int failed = 0;
+
+	if (m == NULL)
+		return (-1);
+
+	if (timeout > 0)
+		end = cdtime () + timeout;
+
+	while (m->transfers_num > 0)
+	{
+		CURLMcode status;
+		int running = 0;
+		long wait_ms = UCM_WAIT_MAX_MS;
+
+		do
+			status = curl_multi_perform (m->multi, &running);
+		while (status == CURLM_CALL_MULTI_PERFORM);
+
+		if (status != CURLM_OK)
+		{
+			ERROR ("utils_curl_multi: curl_multi_perform failed: %s",
+					curl_multi_strerror (status));
+			break;
+		}
+
+		failed += ucm_handle_done (m);
+		if (m->transfers_num == 0)
+			break;
+
+		if (end != 0)
+		{
+			cdtime_t now = cdtime ();
+
+			if (now >= end)
+				break;
+			if (CDTIME_T_TO_MS (end - now) < wait_ms)
+				wait_ms = CDTIME_T_TO_MS (end - now) + 1;
+		}
+
+		if (ucm_wait (m, wait_ms) != 0)
+			break;
+	}
+
+	/* Cancel whatever is left after a timeout or error. */
+	while (m->transfers_num > 0)
+	{
+		failed++;
+		ucm_transfer_done (m, m->transfers_num - 1,
+				CURLE_OPERATION_TIMEDOUT);
+	}
+
+	return (failed);
+} /* }}} int ucm_perform */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
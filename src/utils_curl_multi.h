@@ -0,0 +1,62 @@
+/**
+ * collectd - src/utils_curl_multi.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_CURL_MULTI_H
+#define UTILS_CURL_MULTI_H 1
+
+#include "utils_time.h"
+
+#include <curl/curl.h>
+
+/*
+ * Concurrent HTTP fetches
+ *
+ * A plugin adds the easy handles of all the transfers of one read with
+ * `ucm_add' and runs them with `ucm_perform', which returns once all of them
+ * are done. The transfers run at the same time in the calling thread, so a
+ * read takes as long as its slowest transfer rather than the sum of all of
+ * them. The callback of a transfer is called, from `ucm_perform', as soon as
+ * it completes, so the response can be handled while the others are still
+ * running.
+ *
+ * The handle is kept between reads: it caches the connections to the servers
+ * and the host names it resolved, so that polling the same servers again
+ * needs neither a new connection nor a DNS lookup.
+ */
+
+struct ucm_s;
+typedef struct ucm_s ucm_t;
+
+/* Called with the result of the transfer, `CURLE_OPERATION_TIMEDOUT' if it
+ * was cancelled by the timeout of `ucm_perform'. */
+typedef void (*ucm_callback_t) (CURL *curl, CURLcode result,
+		void *user_data);
+
+ucm_t *ucm_create (void);
+void ucm_destroy (ucm_t *m);
+
+/* Adds a transfer for the next `ucm_perform'. `curl' must not be added
+ * again before its callback has been called. Returns zero on success. */
+int ucm_add (ucm_t *m, CURL *curl, ucm_callback_t callback,
+		void *user_data);
+
+/* Runs all added transfers until they are done, or at most `timeout' if it
+ * is not zero. Returns the number of transfers which did not succeed. */
+int ucm_perform (ucm_t *m, cdtime_t timeout);
+
+#endif /* UTILS_CURL_MULTI_H */
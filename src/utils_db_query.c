@@ -66,15 +66,22 @@ struct udb_result_preparation_area_s /* {{{ */
 }; /* }}} */
 typedef struct udb_result_preparation_area_s udb_result_preparation_area_t;
 
+/* The mapping of the result columns is kept after a result has been finished
+ * and reused as long as the query returns the same columns, which it usually
+ * does in every interval. */
 struct udb_query_preparation_area_s /* {{{ */
 {
   size_t column_num;
+  char **column_names;
   char *host;
   char *plugin;
   char *db_name;
 
   cdtime_t interval;
 
+  /* Set from `udb_query_prepare_result' to `udb_query_finish_result'. */
+  _Bool active;
+
   udb_result_preparation_area_t *result_prep_areas;
 }; /* }}} */
 
@@ -825,15 +832,26 @@ int udb_query_check_version (udb_query_t *q, unsigned int version) /* {{{ */
   return (1);
 } /* }}} int udb_query_check_version */
 
-void udb_query_finish_result (const udb_query_t const *q, /* {{{ */
+/* Forgets the cached column mapping. */
+static void udb_query_clear_result (const udb_query_t const *q, /* {{{ */
     udb_query_preparation_area_t *prep_area)
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
+  size_t i;
 
   if ((q == NULL) || (prep_area == NULL))
     return;
 
+  prep_area->active = 0;
+
+  if (prep_area->column_names != NULL)
+  {
+    for (i = 0; i < prep_area->column_num; i++)
+      sfree (prep_area->column_names[i]);
+    sfree (prep_area->column_names);
+  }
+
   prep_area->column_num = 0;
   sfree (prep_area->host);
   sfree (prep_area->plugin);
@@ -849,6 +867,40 @@ void udb_query_finish_result (const udb_query_t const *q, /* {{{ */
       break;
     udb_result_finish_result (r, r_area);
   }
+} /* }}} void udb_query_clear_result */
+
+/* Returns true if the cached column mapping can be used for a result with
+ * these columns. */
+static _Bool udb_query_result_cached ( /* {{{ */
+    const udb_query_preparation_area_t *prep_area,
+    const char *host, const char *plugin, const char *db_name,
+    char **column_names, size_t column_num)
+{
+  size_t i;
+
+  if ((prep_area->column_names == NULL)
+      || (prep_area->column_num != column_num))
+    return (0);
+
+  if ((strcmp (prep_area->host, host) != 0)
+      || (strcmp (prep_area->plugin, plugin) != 0)
+      || (strcmp (prep_area->db_name, db_name) != 0))
+    return (0);
+
+  for (i = 0; i < column_num; i++)
+    if (strcmp (prep_area->column_names[i], column_names[i]) != 0)
+      return (0);
+
+  return (1);
+} /* }}} _Bool udb_query_result_cached */
+
+void udb_query_finish_result (const udb_query_t const *q, /* {{{ */
+    udb_query_preparation_area_t *prep_area)
+{
+  if ((q == NULL) || (prep_area == NULL))
+    return;
+
+  prep_area->active = 0;
 } /* }}} void udb_query_finish_result */
 
 int udb_query_handle_result (const udb_query_t const *q, /* {{{ */
@@ -862,8 +914,9 @@ int udb_query_handle_result (const udb_query_t const *q, /* {{{ */
   if ((q == NULL) || (prep_area == NULL))
     return (-EINVAL);
 
-  if ((prep_area->column_num < 1) || (prep_area->host == NULL)
-      || (prep_area->plugin == NULL) || (prep_area->db_name == NULL))
+  if (!prep_area->active || (prep_area->column_num < 1)
+      || (prep_area->host == NULL) || (prep_area->plugin == NULL)
+      || (prep_area->db_name == NULL))
   {
     ERROR ("db query utils: Query `%s': Query is not prepared; "
         "can't handle result.", q->name);
@@ -911,28 +964,50 @@ int udb_query_prepare_result (const udb_query_t const *q, /* {{{ */
 {
   udb_result_preparation_area_t *r_area;
   udb_result_t *r;
+  size_t i;
   int status;
 
   if ((q == NULL) || (prep_area == NULL))
     return (-EINVAL);
 
-  udb_query_finish_result (q, prep_area);
+  if (udb_query_result_cached (prep_area, host, plugin, db_name,
+        column_names, column_num))
+  {
+    prep_area->interval = interval;
+    prep_area->active = 1;
+    return (0);
+  }
+
+  udb_query_clear_result (q, prep_area);
 
   prep_area->column_num = column_num;
+  prep_area->column_names = calloc (column_num, sizeof (char *));
   prep_area->host = strdup (host);
   prep_area->plugin = strdup (plugin);
   prep_area->db_name = strdup (db_name);
 
   prep_area->interval = interval;
 
-  if ((prep_area->host == NULL) || (prep_area->plugin == NULL)
-      || (prep_area->db_name == NULL))
+  if ((prep_area->column_names == NULL) || (prep_area->host == NULL)
+      || (prep_area->plugin == NULL) || (prep_area->db_name == NULL))
   {
     ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.", q->name);
-    udb_query_finish_result (q, prep_area);
+    udb_query_clear_result (q, prep_area);
     return (-ENOMEM);
   }
 
+  for (i = 0; i < column_num; i++)
+  {
+    prep_area->column_names[i] = strdup (column_names[i]);
+    if (prep_area->column_names[i] == NULL)
+    {
+      ERROR ("db query utils: Query `%s': Prepare failed: Out of memory.",
+          q->name);
+      udb_query_clear_result (q, prep_area);
+      return (-ENOMEM);
+    }
+  }
+
 #if defined(COLLECT_DEBUG) && COLLECT_DEBUG
   do
   {
@@ -954,18 +1029,19 @@ int udb_query_prepare_result (const udb_query_t const *q, /* {{{ */
     {
       ERROR ("db query utils: Query `%s': Invalid number of result "
           "preparation areas.", q->name);
-      udb_query_finish_result (q, prep_area);
+      udb_query_clear_result (q, prep_area);
       return (-EINVAL);
     }
 
     status = udb_result_prepare_result (r, r_area, column_names, column_num);
     if (status != 0)
     {
-      udb_query_finish_result (q, prep_area);
+      udb_query_clear_result (q, prep_area);
       return (status);
     }
   }
 
+  prep_area->active = 1;
   return (0);
 } /* }}} int udb_query_prepare_result */
 
@@ -1030,6 +1106,15 @@ udb_query_delete_preparation_area (udb_query_preparation_area_t *q_area) /* {{{
     free (area);
   }
 
+  if (q_area->column_names != NULL)
+  {
+    size_t i;
+
+    for (i = 0; i < q_area->column_num; i++)
+      sfree (q_area->column_names[i]);
+    sfree (q_area->column_names);
+  }
+
   sfree (q_area->host);
   sfree (q_area->plugin);
   sfree (q_area->db_name);
@@ -72,18 +72,18 @@ struct rfc1035_header_s {
 };
 typedef struct rfc1035_header_s rfc1035_header_t;
 
-extern int qtype_counts[T_MAX];
-extern int opcode_counts[OP_MAX];
-extern int qclass_counts[C_MAX];
-
 #if HAVE_PCAP_H
 void dnstop_set_pcap_obj (pcap_t *po);
 #endif
-void dnstop_set_callback (void (*cb) (const rfc1035_header_t *));
+/* The callback is called with the `user_data' passed to `handle_pcap' or
+ * `handle_ip_packet'. */
+void dnstop_set_callback (void (*cb) (const rfc1035_header_t *, void *));
 
 void ignore_list_add_name (const char *name);
 #if HAVE_PCAP_H
 void handle_pcap (u_char * udata, const struct pcap_pkthdr *hdr, const u_char * pkt);
+/* Handles a packet starting with its IPv4 or IPv6 header. */
+int handle_ip_packet (const u_char *pkt, int len, void *user_data);
 #endif
 
 const char *qtype_str(int t);
@@ -25,25 +25,44 @@
 #include <pthread.h>
 
 #include "utils_fbhash.h"
-#include "utils_avltree.h"
+#include "utils_hashtable.h"
+
+/* The contents of the file as read at one point in time. Snapshots are
+ * never modified, so they can be queried without locking. */
+struct fbh_snapshot_s
+{
+  c_hashtable_t *table;
+  unsigned int generation;
+  /* One reference is held by the `fbhash_t' while this is its current
+   * snapshot. */
+  unsigned int refcount;
+};
 
 struct fbhash_s
 {
   char *filename;
+  /* The file is read again if any of these change. */
   time_t mtime;
-
+  ino_t inode;
+  off_t size;
+  /* Time of the last `stat', to check the file at most once per second. */
+  time_t checked;
+  unsigned int generation;
+
+  /* Protects `current' and the fields above. `fbh_generation' reads
+   * `checked' and `generation' without it. */
   pthread_mutex_t lock;
-  c_avl_tree_t *tree;
+  fbh_snapshot_t *current;
 };
 
 /* 
  * Private functions
  */
-static void fbh_free_tree (c_avl_tree_t *tree) /* {{{ */
+static void fbh_free_table (c_hashtable_t *table) /* {{{ */
 {
   int status;
 
-  if (tree == NULL)
+  if (table == NULL)
     return;
 
   while (42)
@@ -51,7 +70,7 @@ static void fbh_free_tree (c_avl_tree_t *tree) /* {{{ */
     char *key = NULL;
     char *value = NULL;
 
-    status = c_avl_pick (tree, (void *) &key, (void *) &value);
+    status = c_hashtable_pick (table, (void *) &key, (void *) &value);
     if (status != 0)
       break;
 
@@ -59,15 +78,28 @@ static void fbh_free_tree (c_avl_tree_t *tree) /* {{{ */
     free (value);
   }
 
-  c_avl_destroy (tree);
-} /* }}} void fbh_free_tree */
+  c_hashtable_destroy (table);
+} /* }}} void fbh_free_table */
+
+static fbh_snapshot_t *fbh_snapshot_acquire (fbhash_t *h) /* {{{ */
+{
+  fbh_snapshot_t *s;
+
+  /* Called with `h->lock' held. */
+  s = h->current;
+  if (s != NULL)
+    __sync_add_and_fetch (&s->refcount, 1);
+
+  return (s);
+} /* }}} fbh_snapshot_t *fbh_snapshot_acquire */
 
 static int fbh_read_file (fbhash_t *h) /* {{{ */
 {
   FILE *fh;
   char buffer[4096];
   struct flock fl;
-  c_avl_tree_t *tree;
+  c_hashtable_t *table;
+  fbh_snapshot_t *snapshot;
   int status;
 
   fh = fopen (h->filename, "r");
@@ -88,14 +120,14 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
     return (-1);
   }
 
-  tree = c_avl_create ((void *) strcmp);
-  if (tree == NULL)
+  table = c_hashtable_create (c_hashtable_hash_string, (void *) strcmp);
+  if (table == NULL)
   {
     fclose (fh);
     return (-1);
   }
 
-  /* Read `fh' into `tree' */
+  /* Read `fh' into `table' */
   while (fgets (buffer, sizeof (buffer), fh) != NULL) /* {{{ */
   {
     size_t len;
@@ -152,7 +184,7 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
       continue;
     }
 
-    status = c_avl_insert (tree, key_copy, value_copy);
+    status = c_hashtable_insert (table, key_copy, value_copy);
     if (status != 0)
     {
       free (key_copy);
@@ -166,8 +198,19 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
 
   fclose (fh);
 
-  fbh_free_tree (h->tree);
-  h->tree = tree;
+  snapshot = malloc (sizeof (*snapshot));
+  if (snapshot == NULL)
+  {
+    fbh_free_table (table);
+    return (-1);
+  }
+  snapshot->table = table;
+  snapshot->generation = h->generation + 1;
+  snapshot->refcount = 1;
+
+  /* Threads using the old snapshot keep it until they release it. */
+  fbh_snapshot_release (h->current);
+  h->current = snapshot;
 
   return (0);
 } /* }}} int fbh_read_file */
@@ -175,20 +218,38 @@ static int fbh_read_file (fbhash_t *h) /* {{{ */
 static int fbh_check_file (fbhash_t *h) /* {{{ */
 {
   struct stat statbuf;
+  time_t now;
   int status;
 
+  /* The modification time has a resolution of one second, so checking more
+   * often than that doesn't gain anything. */
+  now = time (NULL);
+  if ((h->current != NULL) && (h->checked == now))
+    return (0);
+  h->checked = now;
+
   memset (&statbuf, 0, sizeof (statbuf));
 
   status = stat (h->filename, &statbuf);
   if (status != 0)
     return (-1);
 
-  if (h->mtime >= statbuf.st_mtime)
+  /* A file replaced by another one, or rewritten within the second it was
+   * last read in, has the same modification time. */
+  if ((h->current != NULL)
+      && (h->mtime == statbuf.st_mtime)
+      && (h->inode == statbuf.st_ino)
+      && (h->size == statbuf.st_size))
     return (0);
 
   status = fbh_read_file (h);
   if (status == 0)
+  {
     h->mtime = statbuf.st_mtime;
+    h->inode = statbuf.st_ino;
+    h->size = statbuf.st_size;
+    h->generation++;
+  }
 
   return (status);
 } /* }}} int fbh_check_file */
@@ -217,6 +278,8 @@ fbhash_t *fbh_create (const char *file) /* {{{ */
   }
 
   h->mtime = 0;
+  h->checked = 0;
+  h->generation = 0;
   pthread_mutex_init (&h->lock, /* attr = */ NULL);
 
   status = fbh_check_file (h);
@@ -235,36 +298,100 @@ void fbh_destroy (fbhash_t *h) /* {{{ */
     return;
 
   free (h->filename);
-  fbh_free_tree (h->tree);
+  fbh_snapshot_release (h->current);
+  pthread_mutex_destroy (&h->lock);
+  free (h);
 } /* }}} void fbh_destroy */
 
-char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
+fbh_snapshot_t *fbh_snapshot (fbhash_t *h) /* {{{ */
 {
-  char *value;
-  char *value_copy;
-  int status;
+  fbh_snapshot_t *s;
 
-  if ((h == NULL) || (key == NULL))
+  if (h == NULL)
     return (NULL);
 
-  value = NULL;
-  value_copy = NULL;
-
   pthread_mutex_lock (&h->lock);
-
-  /* TODO: Checking this everytime may be a bit much..? */
   fbh_check_file (h);
+  s = fbh_snapshot_acquire (h);
+  pthread_mutex_unlock (&h->lock);
 
-  status = c_avl_get (h->tree, key, (void *) &value);
-  if (status == 0)
-  {
-    assert (value != NULL);
+  return (s);
+} /* }}} fbh_snapshot_t *fbh_snapshot */
+
+void fbh_snapshot_release (fbh_snapshot_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return;
+
+  if (__sync_sub_and_fetch (&s->refcount, 1) != 0)
+    return;
+
+  fbh_free_table (s->table);
+  free (s);
+} /* }}} void fbh_snapshot_release */
+
+const char *fbh_snapshot_get (const fbh_snapshot_t *s, /* {{{ */
+    const char *key)
+{
+  char *value = NULL;
+
+  if ((s == NULL) || (key == NULL))
+    return (NULL);
+
+  if (c_hashtable_get (s->table, key, (void *) &value) != 0)
+    return (NULL);
+
+  assert (value != NULL);
+  return (value);
+} /* }}} const char *fbh_snapshot_get */
+
+unsigned int fbh_snapshot_generation (const fbh_snapshot_t *s) /* {{{ */
+{
+  if (s == NULL)
+    return (0);
+
+  return (s->generation);
+} /* }}} unsigned int fbh_snapshot_generation */
+
+char *fbh_get (fbhash_t *h, const char *key) /* {{{ */
+{
+  fbh_snapshot_t *s;
+  const char *value;
+  char *value_copy = NULL;
+
+  if ((h == NULL) || (key == NULL))
+    return (NULL);
+
+  s = fbh_snapshot (h);
+
+  value = fbh_snapshot_get (s, key);
+  if (value != NULL)
     value_copy = strdup (value);
-  }
 
-  pthread_mutex_unlock (&h->lock);
+  fbh_snapshot_release (s);
 
   return (value_copy);
 } /* }}} char *fbh_get */
 
+unsigned int fbh_generation (fbhash_t *h) /* {{{ */
+{
+  unsigned int generation;
+
+  if (h == NULL)
+    return (0);
+
+  /* This is called for every signed or encrypted packet: only the thread
+   * which finds that a second has passed checks the file. Being off by a
+   * second, because `checked' is read without the lock, does no harm. */
+  if (h->checked == time (NULL))
+    return (h->generation);
+
+  pthread_mutex_lock (&h->lock);
+  fbh_check_file (h);
+  generation = h->generation;
+  pthread_mutex_unlock (&h->lock);
+
+  return (generation);
+} /* }}} unsigned int fbh_generation */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
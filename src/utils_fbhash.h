@@ -42,6 +42,32 @@ void fbh_destroy (fbhash_t *h);
  * responsibility to free this memory. */
 char *fbh_get (fbhash_t *h, const char *key);
 
+/*
+ * Snapshots
+ *
+ * A snapshot is the contents of the file at one point in time. It isn't
+ * changed when the file is re-read, so its values can be used without
+ * copying them and without locking until the snapshot is released.
+ */
+struct fbh_snapshot_s;
+typedef struct fbh_snapshot_s fbh_snapshot_t;
+
+/* Returns the current contents of the file, or NULL if it could not be
+ * read. The snapshot has to be released with `fbh_snapshot_release'. */
+fbh_snapshot_t *fbh_snapshot (fbhash_t *h);
+void fbh_snapshot_release (fbh_snapshot_t *s);
+
+/* Returns the value of `key', which belongs to the snapshot, or NULL. */
+const char *fbh_snapshot_get (const fbh_snapshot_t *s, const char *key);
+
+/* Returns the generation, see `fbh_generation', the snapshot belongs to. */
+unsigned int fbh_snapshot_generation (const fbh_snapshot_t *s);
+
+/* Returns a number which changes every time the file is re-read. Users that
+ * derive data from the values, for example cryptographic keys, can keep that
+ * data for as long as the generation stays the same. */
+unsigned int fbh_generation (fbhash_t *h);
+
 #endif /* UTILS_FBHASH_H */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -24,288 +24,510 @@
 #include "common.h"
 
 #include "utils_cache.h"
+#include "utils_avltree.h"
 #include "utils_format_json.h"
 
-static int escape_string (char *buffer, size_t buffer_size, /* {{{ */
-    const char *string)
+#include <pthread.h>
+
+/*
+ * Output buffer
+ *
+ * The functions below append to a `json_buffer_t'. Running out of space is
+ * remembered in `status', so callers only need to check once, after
+ * everything has been added. The buffer is not null-terminated while it is
+ * being filled.
+ */
+struct json_buffer_s
 {
-  size_t src_pos;
-  size_t dst_pos;
+  char  *data;
+  size_t fill;
+  size_t size;
+  int    status;
+};
+typedef struct json_buffer_s json_buffer_t;
+
+static const char json_digit_pairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+/* Powers of ten up to 10^22 are exact in a double. */
+static const double json_pow10[] =
+{
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+#define JSON_MAX_DECIMALS 9
 
-  if ((buffer == NULL) || (string == NULL))
-    return (-EINVAL);
+static int jb_reserve (json_buffer_t *jb, size_t len) /* {{{ */
+{
+  if (jb->status != 0)
+    return (-1);
 
-  if (buffer_size < 3)
-    return (-ENOMEM);
+  if ((jb->size - jb->fill) < len)
+  {
+    jb->status = -ENOMEM;
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int jb_reserve */
+
+static void jb_add_mem (json_buffer_t *jb, /* {{{ */
+    const char *mem, size_t len)
+{
+  if (jb_reserve (jb, len) != 0)
+    return;
+
+  memcpy (jb->data + jb->fill, mem, len);
+  jb->fill += len;
+} /* }}} void jb_add_mem */
+
+#define jb_add_literal(jb, str) jb_add_mem ((jb), (str), sizeof (str) - 1)
+
+static void jb_add_char (json_buffer_t *jb, char c) /* {{{ */
+{
+  if (jb_reserve (jb, 1) != 0)
+    return;
 
-  dst_pos = 0;
+  jb->data[jb->fill] = c;
+  jb->fill++;
+} /* }}} void jb_add_char */
 
-#define BUFFER_ADD(c) do { \
-  if (dst_pos >= (buffer_size - 1)) { \
-    buffer[buffer_size - 1] = 0; \
-    return (-ENOMEM); \
-  } \
-  buffer[dst_pos] = (c); \
-  dst_pos++; \
-} while (0)
+/* Writes the decimal representation of `value' to the end of `buffer' and
+ * returns the number of digits written. `buffer' must hold at least 20
+ * characters. */
+static size_t json_format_uint_rev (char *buffer, uint64_t value) /* {{{ */
+{
+  char *ptr = buffer + 20;
 
-  /* Escape special characters */
-  BUFFER_ADD ('"');
-  for (src_pos = 0; string[src_pos] != 0; src_pos++)
+  while (value >= 100)
   {
-    if ((string[src_pos] == '"')
-        || (string[src_pos] == '\\'))
-    {
-      BUFFER_ADD ('\\');
-      BUFFER_ADD (string[src_pos]);
-    }
-    else if (string[src_pos] <= 0x001F)
-      BUFFER_ADD ('?');
-    else
-      BUFFER_ADD (string[src_pos]);
-  } /* for */
-  BUFFER_ADD ('"');
-  buffer[dst_pos] = 0;
+    unsigned int idx = (unsigned int) (value % 100) * 2;
+    value /= 100;
+    ptr -= 2;
+    ptr[0] = json_digit_pairs[idx];
+    ptr[1] = json_digit_pairs[idx + 1];
+  }
+
+  if (value >= 10)
+  {
+    unsigned int idx = (unsigned int) value * 2;
+    ptr -= 2;
+    ptr[0] = json_digit_pairs[idx];
+    ptr[1] = json_digit_pairs[idx + 1];
+  }
+  else
+  {
+    ptr--;
+    ptr[0] = (char) ('0' + value);
+  }
 
-#undef BUFFER_ADD
+  return ((size_t) ((buffer + 20) - ptr));
+} /* }}} size_t json_format_uint_rev */
 
-  return (0);
-} /* }}} int buffer_add_string */
+static void jb_add_uint (json_buffer_t *jb, uint64_t value) /* {{{ */
+{
+  char temp[20];
+  size_t len;
 
-static int values_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl, int store_rates)
+  len = json_format_uint_rev (temp, value);
+  jb_add_mem (jb, temp + sizeof (temp) - len, len);
+} /* }}} void jb_add_uint */
+
+static void jb_add_int (json_buffer_t *jb, int64_t value) /* {{{ */
+{
+  if (value < 0)
+  {
+    jb_add_char (jb, '-');
+    /* Negate as unsigned, so INT64_MIN doesn't overflow. */
+    jb_add_uint (jb, ((uint64_t) 0) - ((uint64_t) value));
+  }
+  else
+    jb_add_uint (jb, (uint64_t) value);
+} /* }}} void jb_add_int */
+
+/* Adds the shortest representation of `value' that is parsed back to the same
+ * double. Values with up to JSON_MAX_DECIMALS decimal places, which are the
+ * vast majority, are written as an integer with a decimal point inserted.
+ * Non-finite values are written as "null". */
+static void jb_add_double (json_buffer_t *jb, double value) /* {{{ */
 {
-  size_t offset = 0;
+  char temp[32];
   int i;
-  gauge_t *rates = NULL;
-
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-  { \
-    sfree(rates); \
-    return (-1); \
-  } \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-  { \
-    sfree(rates); \
-    return (-ENOMEM); \
-  } \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
-  for (i = 0; i < ds->ds_num; i++)
+
+  if (!isfinite (value))
   {
-    if (i > 0)
-      BUFFER_ADD (",");
+    jb_add_literal (jb, "null");
+    return;
+  }
+
+  /* If `m / 10^k' is exactly `value', the decimal number m*10^-k is parsed
+   * back to `value', because both are the double closest to the same
+   * rational. The smallest such `k' yields the fewest digits. */
+  for (i = 0; i <= JSON_MAX_DECIMALS; i++)
+  {
+    double scaled = value * json_pow10[i];
+    uint64_t m;
+    size_t len;
+    char *digits;
 
-    if (ds->ds[i].type == DS_TYPE_GAUGE)
+    /* 2^53: larger integers may not be represented exactly. */
+    if (fabs (scaled) >= 9007199254740992.0)
+      break;
+
+    m = (uint64_t) (fabs (scaled) + 0.5);
+    if ((((double) m) / json_pow10[i]) != fabs (value))
+      continue;
+
+    if (signbit (value) && (m != 0))
+      jb_add_char (jb, '-');
+
+    len = json_format_uint_rev (temp, m);
+    digits = temp + 20 - len;
+
+    if (i == 0)
     {
-      if(isfinite (vl->values[i].gauge))
-        BUFFER_ADD ("%g", vl->values[i].gauge);
-      else
-        BUFFER_ADD ("null");
+      jb_add_mem (jb, digits, len);
     }
-    else if (store_rates)
+    else if (len > (size_t) i)
     {
-      if (rates == NULL)
-        rates = uc_get_rate (ds, vl);
-      if (rates == NULL)
-      {
-        WARNING ("utils_format_json: uc_get_rate failed.");
-        sfree(rates);
-        return (-1);
-      }
-
-      if(isfinite (rates[i]))
-        BUFFER_ADD ("%g", rates[i]);
-      else
-        BUFFER_ADD ("null");
+      jb_add_mem (jb, digits, len - i);
+      jb_add_char (jb, '.');
+      jb_add_mem (jb, digits + len - i, (size_t) i);
     }
-    else if (ds->ds[i].type == DS_TYPE_COUNTER)
-      BUFFER_ADD ("%llu", vl->values[i].counter);
-    else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      BUFFER_ADD ("%"PRIi64, vl->values[i].derive);
-    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      BUFFER_ADD ("%"PRIu64, vl->values[i].absolute);
     else
     {
-      ERROR ("format_json: Unknown data source type: %i",
-          ds->ds[i].type);
-      sfree (rates);
-      return (-1);
+      size_t j;
+
+      jb_add_literal (jb, "0.");
+      for (j = len; j < (size_t) i; j++)
+        jb_add_char (jb, '0');
+      jb_add_mem (jb, digits, len);
     }
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+    return;
+  }
 
-#undef BUFFER_ADD
+  /* Seventeen significant digits always suffice. */
+  for (i = 15; i <= 17; i++)
+  {
+    ssnprintf (temp, sizeof (temp), "%.*g", i, value);
+    if ((i == 17) || (strtod (temp, NULL) == value))
+      break;
+  }
+  jb_add_mem (jb, temp, strlen (temp));
+} /* }}} void jb_add_double */
+
+/* Adds `t' in seconds with three decimal places, like "%.3f" does. */
+static void jb_add_time (json_buffer_t *jb, cdtime_t t) /* {{{ */
+{
+  uint64_t sec;
+  uint64_t ms;
+  char temp[20];
 
-  DEBUG ("format_json: values_to_json: buffer = %s;", buffer);
-  sfree(rates);
-  return (0);
-} /* }}} int values_to_json */
+  sec = (uint64_t) (t >> 30);
+  ms = (((uint64_t) (t & 0x3fffffff)) * 1000 + 0x20000000) >> 30;
+  if (ms >= 1000)
+  {
+    sec++;
+    ms -= 1000;
+  }
+
+  jb_add_uint (jb, sec);
+
+  temp[0] = '.';
+  temp[1] = (char) ('0' + (ms / 100));
+  temp[2] = json_digit_pairs[(ms % 100) * 2];
+  temp[3] = json_digit_pairs[(ms % 100) * 2 + 1];
+  jb_add_mem (jb, temp, 4);
+} /* }}} void jb_add_time */
+
+/* Adds `string' in double quotes. Quotes and backslashes are escaped, control
+ * characters are replaced with question marks. */
+static void jb_add_string (json_buffer_t *jb, const char *string) /* {{{ */
+{
+  size_t len = strlen (string);
+  size_t i;
+  char *dst;
+
+  /* Every character needs at most two bytes. */
+  if (jb_reserve (jb, 2 * len + 2) != 0)
+    return;
 
-static int dstypes_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl)
+  dst = jb->data + jb->fill;
+  *dst++ = '"';
+  for (i = 0; i < len; i++)
+  {
+    if ((string[i] == '"') || (string[i] == '\\'))
+    {
+      *dst++ = '\\';
+      *dst++ = string[i];
+    }
+    else if (string[i] <= 0x001F)
+      *dst++ = '?';
+    else
+      *dst++ = string[i];
+  }
+  *dst++ = '"';
+
+  jb->fill = (size_t) (dst - jb->data);
+} /* }}} void jb_add_string */
+
+/*
+ * Data set fragments
+ *
+ * The "dstypes" and "dsnames" members only depend on the data set, so they
+ * are formatted once per type and kept for the lifetime of the process.
+ */
+struct json_ds_fragment_s
 {
-  size_t offset = 0;
+  const data_set_t *ds;
+  int    ds_num;
+  char  *data;
+  size_t len;
+};
+typedef struct json_ds_fragment_s json_ds_fragment_t;
+
+static c_avl_tree_t *json_fragments = NULL;
+static pthread_rwlock_t json_fragments_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static json_ds_fragment_t *json_fragment_create (const data_set_t *ds) /* {{{ */
+{
+  json_ds_fragment_t *f;
+  json_buffer_t jb;
+  size_t size;
   int i;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  size = sizeof (",\"dstypes\":[],\"dsnames\":[]");
   for (i = 0; i < ds->ds_num; i++)
+    size += strlen (DS_TYPE_TO_STRING (ds->ds[i].type))
+      + strlen (ds->ds[i].name) + 6;
+
+  f = malloc (sizeof (*f));
+  if (f == NULL)
+    return (NULL);
+  memset (f, 0, sizeof (*f));
+
+  f->data = malloc (size);
+  if (f->data == NULL)
   {
+    sfree (f);
+    return (NULL);
+  }
+
+  memset (&jb, 0, sizeof (jb));
+  jb.data = f->data;
+  jb.size = size;
+
+  jb_add_literal (&jb, ",\"dstypes\":[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    const char *type = DS_TYPE_TO_STRING (ds->ds[i].type);
+
     if (i > 0)
-      BUFFER_ADD (",");
+      jb_add_char (&jb, ',');
+    jb_add_char (&jb, '"');
+    jb_add_mem (&jb, type, strlen (type));
+    jb_add_char (&jb, '"');
+  }
+  jb_add_literal (&jb, "],\"dsnames\":[");
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+      jb_add_char (&jb, ',');
+    jb_add_char (&jb, '"');
+    jb_add_mem (&jb, ds->ds[i].name, strlen (ds->ds[i].name));
+    jb_add_char (&jb, '"');
+  }
+  jb_add_char (&jb, ']');
 
-    BUFFER_ADD ("\"%s\"", DS_TYPE_TO_STRING (ds->ds[i].type));
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+  /* The size has been calculated above, so this is a bug. */
+  assert (jb.status == 0);
 
-#undef BUFFER_ADD
+  f->ds = ds;
+  f->ds_num = ds->ds_num;
+  f->len = jb.fill;
 
-  DEBUG ("format_json: dstypes_to_json: buffer = %s;", buffer);
+  return (f);
+} /* }}} json_ds_fragment_t *json_fragment_create */
 
-  return (0);
-} /* }}} int dstypes_to_json */
+static void json_fragment_free (json_ds_fragment_t *f) /* {{{ */
+{
+  if (f == NULL)
+    return;
+
+  sfree (f->data);
+  sfree (f);
+} /* }}} void json_fragment_free */
+
+/* Adds the "dstypes" and "dsnames" members of `ds', formatting and
+ * remembering them if this data set hasn't been seen before. */
+static void jb_add_ds_fragment (json_buffer_t *jb, /* {{{ */
+    const data_set_t *ds)
+{
+  json_ds_fragment_t *f = NULL;
+  json_ds_fragment_t *old = NULL;
+  char *key = NULL;
+
+  pthread_rwlock_rdlock (&json_fragments_lock);
+  if ((json_fragments != NULL)
+      && (c_avl_get (json_fragments, ds->type, (void *) &f) == 0)
+      && (f->ds == ds) && (f->ds_num == ds->ds_num))
+  {
+    jb_add_mem (jb, f->data, f->len);
+    pthread_rwlock_unlock (&json_fragments_lock);
+    return;
+  }
+  pthread_rwlock_unlock (&json_fragments_lock);
+
+  f = json_fragment_create (ds);
+  if (f == NULL)
+  {
+    ERROR ("format_json: json_fragment_create failed.");
+    jb->status = -1;
+    return;
+  }
+  jb_add_mem (jb, f->data, f->len);
+
+  pthread_rwlock_wrlock (&json_fragments_lock);
+  if (json_fragments == NULL)
+    json_fragments = c_avl_create (
+        (int (*) (const void *, const void *)) strcmp);
+
+  /* The data set may have been replaced; forget the old fragment. */
+  if ((json_fragments != NULL)
+      && (c_avl_remove (json_fragments, ds->type,
+          (void *) &key, (void *) &old) == 0))
+  {
+    json_fragment_free (old);
+  }
+  else
+  {
+    key = strdup (ds->type);
+  }
+
+  if ((json_fragments == NULL) || (key == NULL)
+      || (c_avl_insert (json_fragments, key, f) != 0))
+  {
+    sfree (key);
+    json_fragment_free (f);
+  }
+  pthread_rwlock_unlock (&json_fragments_lock);
+} /* }}} void jb_add_ds_fragment */
 
-static int dsnames_to_json (char *buffer, size_t buffer_size, /* {{{ */
-                const data_set_t *ds, const value_list_t *vl)
+static int values_to_json (json_buffer_t *jb, /* {{{ */
+                const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  size_t offset = 0;
   int i;
+  gauge_t rates[ds->ds_num];
+  _Bool have_rates = 0;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  int status; \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
-  BUFFER_ADD ("[");
+  jb_add_char (jb, '[');
   for (i = 0; i < ds->ds_num; i++)
   {
     if (i > 0)
-      BUFFER_ADD (",");
-
-    BUFFER_ADD ("\"%s\"", ds->ds[i].name);
-  } /* for ds->ds_num */
-  BUFFER_ADD ("]");
+      jb_add_char (jb, ',');
 
-#undef BUFFER_ADD
+    if (ds->ds[i].type == DS_TYPE_GAUGE)
+      jb_add_double (jb, vl->values[i].gauge);
+    else if (store_rates)
+    {
+      if (!have_rates && (uc_get_rate_buffer (ds, vl, rates) != 0))
+      {
+        WARNING ("utils_format_json: uc_get_rate_buffer failed.");
+        return (-1);
+      }
+      have_rates = 1;
 
-  DEBUG ("format_json: dsnames_to_json: buffer = %s;", buffer);
+      jb_add_double (jb, rates[i]);
+    }
+    else if (ds->ds[i].type == DS_TYPE_COUNTER)
+      jb_add_uint (jb, (uint64_t) vl->values[i].counter);
+    else if (ds->ds[i].type == DS_TYPE_DERIVE)
+      jb_add_int (jb, (int64_t) vl->values[i].derive);
+    else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
+      jb_add_uint (jb, (uint64_t) vl->values[i].absolute);
+    else
+    {
+      ERROR ("format_json: Unknown data source type: %i",
+          ds->ds[i].type);
+      return (-1);
+    }
+  } /* for ds->ds_num */
+  jb_add_char (jb, ']');
 
-  return (0);
-} /* }}} int dsnames_to_json */
+  return (jb->status);
+} /* }}} int values_to_json */
 
-static int value_list_to_json (char *buffer, size_t buffer_size, /* {{{ */
+static int value_list_to_json (json_buffer_t *jb, /* {{{ */
                 const data_set_t *ds, const value_list_t *vl, int store_rates)
 {
-  char temp[512];
-  size_t offset = 0;
   int status;
 
-  memset (buffer, 0, buffer_size);
-
-#define BUFFER_ADD(...) do { \
-  status = ssnprintf (buffer + offset, buffer_size - offset, \
-      __VA_ARGS__); \
-  if (status < 1) \
-    return (-1); \
-  else if (((size_t) status) >= (buffer_size - offset)) \
-    return (-ENOMEM); \
-  else \
-    offset += ((size_t) status); \
-} while (0)
-
   /* All value lists have a leading comma. The first one will be replaced with
    * a square bracket in `format_json_finalize'. */
-  BUFFER_ADD (",{");
+  jb_add_literal (jb, ",{\"values\":");
 
-  status = values_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  status = values_to_json (jb, ds, vl, store_rates);
   if (status != 0)
     return (status);
-  BUFFER_ADD ("\"values\":%s", temp);
 
-  status = dstypes_to_json (temp, sizeof (temp), ds, vl);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dstypes\":%s", temp);
-
-  status = dsnames_to_json (temp, sizeof (temp), ds, vl);
-  if (status != 0)
-    return (status);
-  BUFFER_ADD (",\"dsnames\":%s", temp);
+  jb_add_ds_fragment (jb, ds);
 
-  BUFFER_ADD (",\"time\":%.3f", CDTIME_T_TO_DOUBLE (vl->time));
-  BUFFER_ADD (",\"interval\":%.3f", CDTIME_T_TO_DOUBLE (vl->interval));
+  jb_add_literal (jb, ",\"time\":");
+  jb_add_time (jb, vl->time);
+  jb_add_literal (jb, ",\"interval\":");
+  jb_add_time (jb, vl->interval);
 
-#define BUFFER_ADD_KEYVAL(key, value) do { \
-  status = escape_string (temp, sizeof (temp), (value)); \
-  if (status != 0) \
-    return (status); \
-  BUFFER_ADD (",\"%s\":%s", (key), temp); \
-} while (0)
+  jb_add_literal (jb, ",\"host\":");
+  jb_add_string (jb, vl->host);
+  jb_add_literal (jb, ",\"plugin\":");
+  jb_add_string (jb, vl->plugin);
+  jb_add_literal (jb, ",\"plugin_instance\":");
+  jb_add_string (jb, vl->plugin_instance);
+  jb_add_literal (jb, ",\"type\":");
+  jb_add_string (jb, vl->type);
+  jb_add_literal (jb, ",\"type_instance\":");
+  jb_add_string (jb, vl->type_instance);
 
-  BUFFER_ADD_KEYVAL ("host", vl->host);
-  BUFFER_ADD_KEYVAL ("plugin", vl->plugin);
-  BUFFER_ADD_KEYVAL ("plugin_instance", vl->plugin_instance);
-  BUFFER_ADD_KEYVAL ("type", vl->type);
-  BUFFER_ADD_KEYVAL ("type_instance", vl->type_instance);
+  jb_add_char (jb, '}');
 
-  BUFFER_ADD ("}");
-
-#undef BUFFER_ADD_KEYVAL
-#undef BUFFER_ADD
-
-  DEBUG ("format_json: value_list_to_json: buffer = %s;", buffer);
-
-  return (0);
+  return (jb->status);
 } /* }}} int value_list_to_json */
 
+/* Formats the value list directly into the free space of `buffer'. Two bytes
+ * are left over for `format_json_finalize'. */
 static int format_json_value_list_nocheck (char *buffer, /* {{{ */
     size_t *ret_buffer_fill, size_t *ret_buffer_free,
     const data_set_t *ds, const value_list_t *vl,
     int store_rates, size_t temp_size)
 {
-  char temp[temp_size];
+  json_buffer_t jb;
   int status;
 
-  status = value_list_to_json (temp, sizeof (temp), ds, vl, store_rates);
+  memset (&jb, 0, sizeof (jb));
+  jb.data = buffer + (*ret_buffer_fill);
+  jb.size = temp_size;
+
+  status = value_list_to_json (&jb, ds, vl, store_rates);
   if (status != 0)
+  {
+    /* Drop whatever has been written so far. */
+    jb.data[0] = 0;
     return (status);
-  temp_size = strlen (temp);
+  }
+  jb.data[jb.fill] = 0;
 
-  memcpy (buffer + (*ret_buffer_fill), temp, temp_size + 1);
-  (*ret_buffer_fill) += temp_size;
-  (*ret_buffer_free) -= temp_size;
+  DEBUG ("format_json: value_list_to_json: buffer = %s;", jb.data);
+
+  (*ret_buffer_fill) += jb.fill;
+  (*ret_buffer_free) -= jb.fill;
 
   return (0);
 } /* }}} int format_json_value_list_nocheck */
@@ -379,4 +601,361 @@ int format_json_value_list (char *buffer, /* {{{ */
         store_rates, (*ret_buffer_free) - 2));
 } /* }}} int format_json_value_list */
 
+/*
+ * Parsing
+ *
+ * The parser only handles what the functions above produce: An array of
+ * objects with the "values", "time", "interval" and identifier members. Other
+ * members are skipped. Values are parsed according to the type's data set,
+ * so "dstypes" and "dsnames" are ignored.
+ */
+static void json_skip_space (const char **ptr) /* {{{ */
+{
+  while (isspace ((int) **ptr))
+    (*ptr)++;
+} /* }}} void json_skip_space */
+
+static int json_parse_string (const char **ptr, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  const char *p = *ptr;
+  size_t pos = 0;
+
+  if (*p != '"')
+    return (-EINVAL);
+  p++;
+
+  while (*p != '"')
+  {
+    char c = *p;
+
+    if (c == 0)
+      return (-EINVAL);
+
+    if (c == '\\')
+    {
+      p++;
+      switch (*p)
+      {
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'u':
+          /* Characters outside of ASCII are not allowed in identifiers
+           * anyway. */
+          if (strlen (p) < 5)
+            return (-EINVAL);
+          p += 4;
+          c = '?';
+          break;
+        case 0:
+          return (-EINVAL);
+        default:
+          c = *p;
+      }
+    }
+
+    if (pos >= (buffer_size - 1))
+      return (-ENOMEM);
+    buffer[pos] = c;
+    pos++;
+    p++;
+  }
+  buffer[pos] = 0;
+
+  *ptr = p + 1;
+  return (0);
+} /* }}} int json_parse_string */
+
+/* Copies a number, "null", "true" or "false" to `buffer'. */
+static int json_parse_token (const char **ptr, /* {{{ */
+    char *buffer, size_t buffer_size)
+{
+  const char *p = *ptr;
+  size_t len;
+
+  while ((*p != 0) && (isalnum ((int) *p)
+        || (*p == '-') || (*p == '+') || (*p == '.')))
+    p++;
+
+  len = (size_t) (p - *ptr);
+  if (len == 0)
+    return (-EINVAL);
+  if (len >= buffer_size)
+    return (-ENOMEM);
+
+  memcpy (buffer, *ptr, len);
+  buffer[len] = 0;
+
+  *ptr = p;
+  return (0);
+} /* }}} int json_parse_token */
+
+static int json_skip_value (const char **ptr) /* {{{ */
+{
+  char buffer[128];
+  char close;
+  int status;
+
+  json_skip_space (ptr);
+
+  if (**ptr == '"')
+  {
+    /* Strings may be longer than any buffer, so they're skipped by hand. */
+    const char *p = *ptr + 1;
+
+    while ((*p != 0) && (*p != '"'))
+    {
+      if ((*p == '\\') && (p[1] != 0))
+        p++;
+      p++;
+    }
+    if (*p != '"')
+      return (-EINVAL);
+
+    *ptr = p + 1;
+    return (0);
+  }
+  else if (**ptr == '[')
+    close = ']';
+  else if (**ptr == '{')
+    close = '}';
+  else
+    return (json_parse_token (ptr, buffer, sizeof (buffer)));
+
+  (*ptr)++;
+  json_skip_space (ptr);
+  if (**ptr == close)
+  {
+    (*ptr)++;
+    return (0);
+  }
+
+  while (42)
+  {
+    if (close == '}')
+    {
+      status = json_skip_value (ptr);
+      if (status != 0)
+        return (status);
+      json_skip_space (ptr);
+      if (**ptr != ':')
+        return (-EINVAL);
+      (*ptr)++;
+    }
+
+    status = json_skip_value (ptr);
+    if (status != 0)
+      return (status);
+
+    json_skip_space (ptr);
+    if (**ptr == close)
+      break;
+    else if (**ptr != ',')
+      return (-EINVAL);
+    (*ptr)++;
+  }
+
+  (*ptr)++;
+  return (0);
+} /* }}} int json_skip_value */
+
+static int json_parse_values (const char *ptr, /* {{{ */
+    value_list_t *vl, const data_set_t *ds)
+{
+  char buffer[64];
+  int i;
+  int status;
+
+  json_skip_space (&ptr);
+  if (*ptr != '[')
+    return (-EINVAL);
+  ptr++;
+
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    if (i > 0)
+    {
+      json_skip_space (&ptr);
+      if (*ptr != ',')
+        return (-EINVAL);
+      ptr++;
+    }
+
+    json_skip_space (&ptr);
+    status = json_parse_token (&ptr, buffer, sizeof (buffer));
+    if (status != 0)
+      return (status);
+
+    if (strcmp ("null", buffer) == 0)
+    {
+      /* Only gauges can be unknown. */
+      if (ds->ds[i].type != DS_TYPE_GAUGE)
+        return (-EINVAL);
+      vl->values[i].gauge = NAN;
+    }
+    else if (parse_value (buffer, &vl->values[i], ds->ds[i].type) != 0)
+      return (-EINVAL);
+  }
+
+  json_skip_space (&ptr);
+  if (*ptr != ']')
+    return (-EINVAL);
+
+  return (0);
+} /* }}} int json_parse_values */
+
+static int json_parse_value_list (const char **ptr) /* {{{ */
+{
+  value_list_t vl = VALUE_LIST_INIT;
+  const data_set_t *ds;
+  const char *values_ptr = NULL;
+  char key[32];
+  char buffer[64];
+  int status;
+
+  json_skip_space (ptr);
+  if (**ptr != '{')
+    return (-EINVAL);
+  (*ptr)++;
+
+  json_skip_space (ptr);
+  while (**ptr != '}')
+  {
+    status = json_parse_string (ptr, key, sizeof (key));
+    if (status == -ENOMEM)
+    {
+      /* Not one of ours; skip the value below. */
+      key[0] = 0;
+      status = json_skip_value (ptr);
+    }
+    if (status != 0)
+      return (status);
+
+    json_skip_space (ptr);
+    if (**ptr != ':')
+      return (-EINVAL);
+    (*ptr)++;
+    json_skip_space (ptr);
+
+#define PARSE_STRING(field) \
+    status = json_parse_string (ptr, vl.field, sizeof (vl.field))
+
+    if (strcmp ("values", key) == 0)
+    {
+      /* The type may come after the values, so they're parsed later. */
+      values_ptr = *ptr;
+      status = json_skip_value (ptr);
+    }
+    else if ((strcmp ("time", key) == 0) || (strcmp ("interval", key) == 0))
+    {
+      status = json_parse_token (ptr, buffer, sizeof (buffer));
+      if (status == 0)
+      {
+        cdtime_t t = DOUBLE_TO_CDTIME_T (atof (buffer));
+        if (key[0] == 't')
+          vl.time = t;
+        else
+          vl.interval = t;
+      }
+    }
+    else if (strcmp ("host", key) == 0)
+      PARSE_STRING (host);
+    else if (strcmp ("plugin", key) == 0)
+      PARSE_STRING (plugin);
+    else if (strcmp ("plugin_instance", key) == 0)
+      PARSE_STRING (plugin_instance);
+    else if (strcmp ("type", key) == 0)
+      PARSE_STRING (type);
+    else if (strcmp ("type_instance", key) == 0)
+      PARSE_STRING (type_instance);
+    else
+      status = json_skip_value (ptr);
+
+#undef PARSE_STRING
+
+    if (status != 0)
+      return (status);
+
+    json_skip_space (ptr);
+    if (**ptr == ',')
+    {
+      (*ptr)++;
+      json_skip_space (ptr);
+    }
+    else if (**ptr != '}')
+      return (-EINVAL);
+  }
+  (*ptr)++;
+
+  if ((values_ptr == NULL) || (vl.host[0] == 0) || (vl.plugin[0] == 0)
+      || (vl.type[0] == 0))
+  {
+    WARNING ("format_json: Ignoring incomplete value list.");
+    return (0);
+  }
+
+  ds = plugin_get_ds (vl.type);
+  if (ds == NULL)
+  {
+    WARNING ("format_json: Ignoring value list with unknown type \"%s\".",
+        vl.type);
+    return (0);
+  }
+
+  vl.values_len = ds->ds_num;
+  vl.values = calloc (vl.values_len, sizeof (*vl.values));
+  if (vl.values == NULL)
+    return (-ENOMEM);
+
+  status = json_parse_values (values_ptr, &vl, ds);
+  if (status == 0)
+    plugin_dispatch_values (&vl);
+  else
+    WARNING ("format_json: Ignoring value list with invalid values "
+        "(host = %s, plugin = %s, type = %s).",
+        vl.host, vl.plugin, vl.type);
+
+  sfree (vl.values);
+  return (0);
+} /* }}} int json_parse_value_list */
+
+int format_json_parse (const char *buffer) /* {{{ */
+{
+  const char *ptr = buffer;
+  int status;
+
+  if (buffer == NULL)
+    return (-EINVAL);
+
+  json_skip_space (&ptr);
+  if (*ptr == '{')
+    return (json_parse_value_list (&ptr));
+  else if (*ptr != '[')
+    return (-EINVAL);
+  ptr++;
+
+  json_skip_space (&ptr);
+  if (*ptr == ']')
+    return (0);
+
+  while (42)
+  {
+    status = json_parse_value_list (&ptr);
+    if (status != 0)
+      return (status);
+
+    json_skip_space (&ptr);
+    if (*ptr == ']')
+      break;
+    else if (*ptr != ',')
+      return (-EINVAL);
+    ptr++;
+  }
+
+  return (0);
+} /* }}} int format_json_parse */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -33,4 +33,9 @@ int format_json_value_list (char *buffer,
 int format_json_finalize (char *buffer,
     size_t *ret_buffer_fill, size_t *ret_buffer_free);
 
+/* Parses value lists in the format created by the functions above and
+ * dispatches them. Value lists with unknown types are skipped. Returns zero on
+ * success and less than zero if the buffer could not be parsed. */
+int format_json_parse (const char *buffer);
+
 #endif /* UTILS_FORMAT_JSON_H */
@@ -0,0 +1,311 @@
+/**
+ * collectd - src/utils_handoff.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_handoff.h"
+
+#include <pthread.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+/* The first inherited file descriptor, as with systemd's socket activation. */
+#define HANDOFF_FD_START 3
+/* At most this many sockets are passed on. Must match collectdmon. */
+#define HANDOFF_FDS_MAX 64
+/* The message sent to collectdmon along with the sockets. */
+#define HANDOFF_MESSAGE "collectd-handoff"
+
+/* Inherited sockets which haven't been taken yet are >= 0. */
+static int inherited_fds[HANDOFF_FDS_MAX];
+static int inherited_fds_num = 0;
+
+static int exported_fds[HANDOFF_FDS_MAX];
+static int exported_fds_num = 0;
+static _Bool exported_shared = 0;
+
+/* The socket connected to collectdmon, if any. */
+static int control_fd = -1;
+
+/* Plugins may be initialized in parallel. */
+static pthread_mutex_t handoff_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int handoff_getenv_int (const char *name) /* {{{ */
+{
+	const char *str;
+	char *endptr = NULL;
+	long value;
+
+	str = getenv (name);
+	if (str == NULL)
+		return (-1);
+
+	errno = 0;
+	value = strtol (str, &endptr, 10);
+	if ((errno != 0) || (endptr == str) || (*endptr != 0)
+			|| (value < 0) || (value > INT_MAX))
+		return (-1);
+
+	return ((int) value);
+} /* }}} int handoff_getenv_int */
+
+static void handoff_set_cloexec (int fd) /* {{{ */
+{
+	int flags;
+
+	flags = fcntl (fd, F_GETFD);
+	if (flags >= 0)
+		fcntl (fd, F_SETFD, flags | FD_CLOEXEC);
+} /* }}} void handoff_set_cloexec */
+
+void handoff_init (void) /* {{{ */
+{
+	int num;
+	int i;
+
+	/* The variables are meant for this process only, not for the
+	 * programs started by the exec plugin, for example. */
+	num = handoff_getenv_int ("LISTEN_FDS");
+	if ((num > 0) && (handoff_getenv_int ("LISTEN_PID") == (int) getpid ()))
+	{
+		if (num > HANDOFF_FDS_MAX)
+			num = HANDOFF_FDS_MAX;
+
+		for (i = 0; i < num; i++)
+		{
+			handoff_set_cloexec (HANDOFF_FD_START + i);
+			inherited_fds[i] = HANDOFF_FD_START + i;
+		}
+		inherited_fds_num = num;
+	}
+
+	control_fd = handoff_getenv_int ("COLLECTDMON_FD");
+	if (control_fd >= 0)
+		handoff_set_cloexec (control_fd);
+
+	/* The cache snapshot collectdmon passes from one daemon to the next.
+	 * A `CacheFile' in the config file takes precedence. */
+	if (getenv ("COLLECTD_CACHE_FILE") != NULL)
+		global_option_set ("CacheFile", getenv ("COLLECTD_CACHE_FILE"));
+
+	unsetenv ("LISTEN_FDS");
+	unsetenv ("LISTEN_PID");
+	unsetenv ("COLLECTDMON_FD");
+	unsetenv ("COLLECTD_CACHE_FILE");
+} /* }}} void handoff_init */
+
+/* Returns true if the socket `fd' is bound to `addr'. */
+static _Bool handoff_addr_match (int fd, /* {{{ */
+		const struct sockaddr *addr, socklen_t addrlen)
+{
+	struct sockaddr_storage ss;
+	socklen_t ss_len = sizeof (ss);
+
+	memset (&ss, 0, sizeof (ss));
+	if (getsockname (fd, (struct sockaddr *) &ss, &ss_len) != 0)
+		return (0);
+
+	if (ss.ss_family != addr->sa_family)
+		return (0);
+
+	if (addr->sa_family == AF_INET)
+	{
+		const struct sockaddr_in *a = (const struct sockaddr_in *) addr;
+		const struct sockaddr_in *b = (const struct sockaddr_in *) &ss;
+
+		return ((addrlen >= sizeof (*a))
+				&& (a->sin_port == b->sin_port)
+				&& (a->sin_addr.s_addr == b->sin_addr.s_addr));
+	}
+	else if (addr->sa_family == AF_INET6)
+	{
+		const struct sockaddr_in6 *a = (const struct sockaddr_in6 *) addr;
+		const struct sockaddr_in6 *b = (const struct sockaddr_in6 *) &ss;
+
+		return ((addrlen >= sizeof (*a))
+				&& (a->sin6_port == b->sin6_port)
+				&& (a->sin6_scope_id == b->sin6_scope_id)
+				&& (memcmp (&a->sin6_addr, &b->sin6_addr,
+						sizeof (a->sin6_addr)) == 0));
+	}
+	else if (addr->sa_family == AF_UNIX)
+	{
+		const struct sockaddr_un *a = (const struct sockaddr_un *) addr;
+		const struct sockaddr_un *b = (const struct sockaddr_un *) &ss;
+
+		return (strncmp (a->sun_path, b->sun_path,
+					sizeof (a->sun_path)) == 0);
+	}
+
+	return (0);
+} /* }}} _Bool handoff_addr_match */
+
+int handoff_take (const struct sockaddr *addr, socklen_t addrlen, /* {{{ */
+		int socktype)
+{
+	int fd = -1;
+	int i;
+
+	if (addr == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&handoff_lock);
+	for (i = 0; i < inherited_fds_num; i++)
+	{
+		int type = 0;
+		socklen_t type_len = sizeof (type);
+
+		if (inherited_fds[i] < 0)
+			continue;
+
+		if ((getsockopt (inherited_fds[i], SOL_SOCKET, SO_TYPE,
+						&type, &type_len) != 0)
+				|| (type != socktype))
+			continue;
+
+		if (!handoff_addr_match (inherited_fds[i], addr, addrlen))
+			continue;
+
+		fd = inherited_fds[i];
+		inherited_fds[i] = -1;
+		break;
+	}
+	pthread_mutex_unlock (&handoff_lock);
+
+	if (fd >= 0)
+		DEBUG ("handoff_take: Reusing the inherited socket #%i.", fd);
+
+	return (fd);
+} /* }}} int handoff_take */
+
+void handoff_export (int fd) /* {{{ */
+{
+	if (fd < 0)
+		return;
+
+	pthread_mutex_lock (&handoff_lock);
+	if (exported_fds_num < HANDOFF_FDS_MAX)
+	{
+		exported_fds[exported_fds_num] = fd;
+		exported_fds_num++;
+	}
+	else
+	{
+		WARNING ("handoff_export: Only %i sockets can be passed on, "
+				"socket #%i is not.", HANDOFF_FDS_MAX, fd);
+	}
+	pthread_mutex_unlock (&handoff_lock);
+} /* }}} void handoff_export */
+
+_Bool handoff_is_shared (int fd) /* {{{ */
+{
+	_Bool shared = 0;
+	int i;
+
+	pthread_mutex_lock (&handoff_lock);
+	for (i = 0; exported_shared && (i < exported_fds_num); i++)
+	{
+		if (exported_fds[i] == fd)
+		{
+			shared = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&handoff_lock);
+
+	return (shared);
+} /* }}} _Bool handoff_is_shared */
+
+/* Sends the exported sockets to collectdmon. Sending no sockets at all tells
+ * it to close the ones it holds. */
+static int handoff_send_nolock (void) /* {{{ */
+{
+	char message[] = HANDOFF_MESSAGE;
+	char control[CMSG_SPACE (HANDOFF_FDS_MAX * sizeof (int))];
+	struct iovec iov;
+	struct msghdr msg;
+
+	memset (&msg, 0, sizeof (msg));
+	iov.iov_base = message;
+	iov.iov_len = sizeof (message);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (exported_fds_num > 0)
+	{
+		struct cmsghdr *cmsg;
+
+		memset (control, 0, sizeof (control));
+		msg.msg_control = control;
+		msg.msg_controllen = CMSG_SPACE (exported_fds_num * sizeof (int));
+
+		cmsg = CMSG_FIRSTHDR (&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN (exported_fds_num * sizeof (int));
+		memcpy (CMSG_DATA (cmsg), exported_fds,
+				exported_fds_num * sizeof (int));
+	}
+
+	if (sendmsg (control_fd, &msg, /* flags = */ 0) < 0)
+	{
+		char errbuf[1024];
+		ERROR ("handoff_complete: Passing the sockets to collectdmon "
+				"failed: %s", sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int handoff_send_nolock */
+
+void handoff_complete (void) /* {{{ */
+{
+	int i;
+
+	pthread_mutex_lock (&handoff_lock);
+
+	for (i = 0; i < inherited_fds_num; i++)
+	{
+		if (inherited_fds[i] < 0)
+			continue;
+
+		INFO ("handoff_complete: Closing the inherited socket #%i, which no "
+				"plugin uses.", inherited_fds[i]);
+		close (inherited_fds[i]);
+		inherited_fds[i] = -1;
+	}
+	inherited_fds_num = 0;
+
+	if (control_fd >= 0)
+	{
+		if (handoff_send_nolock () == 0)
+		{
+			exported_shared = 1;
+			INFO ("handoff_complete: Passed %i socket%s to collectdmon.",
+					exported_fds_num, (exported_fds_num == 1) ? "" : "s");
+		}
+		close (control_fd);
+		control_fd = -1;
+	}
+
+	pthread_mutex_unlock (&handoff_lock);
+} /* }}} void handoff_complete */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
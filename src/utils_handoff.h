@@ -0,0 +1,74 @@
+/**
+ * collectd - src/utils_handoff.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_HANDOFF_H
+#define UTILS_HANDOFF_H 1
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/*
+ * Socket handoff
+ *
+ * When collectd is restarted by collectdmon, the listening sockets are passed
+ * from one daemon to the next, so they are never closed and packets arriving
+ * in between wait in the socket buffers. The sockets are passed as file
+ * descriptors 3, 4, ... with LISTEN_FDS and LISTEN_PID set in the
+ * environment, like systemd's socket activation does.
+ *
+ * Plugins look for an inherited socket with `handoff_take' before creating
+ * one and register their listening sockets with `handoff_export'. Once all
+ * plugins have been initialized, `handoff_complete' closes the inherited
+ * sockets nobody has taken and, if the daemon has been started by
+ * collectdmon, sends the exported sockets to it, so it can pass them on to
+ * the next daemon.
+ */
+
+/* Takes the inherited sockets from the environment. Must be called before
+ * any file is opened. */
+void handoff_init (void);
+
+/*
+ * NAME
+ *   handoff_take
+ *
+ * DESCRIPTION
+ *   Looks for an inherited socket of type `socktype' which is bound to
+ *   `addr' (an AF_INET, AF_INET6 or AF_UNIX address) and hands it over to the
+ *   caller. Each socket is only returned once.
+ *
+ * RETURN VALUE
+ *   The file descriptor or -1 if there's no such socket.
+ */
+int handoff_take (const struct sockaddr *addr, socklen_t addrlen,
+		int socktype);
+
+/* Registers a listening socket to be passed to the next daemon. The socket
+ * must stay open until the daemon exits. */
+void handoff_export (int fd);
+
+/* Returns true if `fd' has been passed to collectdmon. The socket is then
+ * still in use after this daemon has exited, so e.g. a UNIX socket's file
+ * must not be removed. */
+_Bool handoff_is_shared (int fd);
+
+/* See above. */
+void handoff_complete (void);
+
+#endif /* UTILS_HANDOFF_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
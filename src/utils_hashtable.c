@@ -0,0 +1,342 @@
+/**
+ * collectd - src/utils_hashtable.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils_hashtable.h"
+
+/* Must be a power of two. */
+#define HT_SIZE_MIN 16
+
+/*
+ * private data types
+ */
+struct c_hashtable_entry_s
+{
+	uint32_t hash;
+	void *key; /* NULL if the entry is unused */
+	void *value;
+};
+typedef struct c_hashtable_entry_s c_hashtable_entry_t;
+
+struct c_hashtable_s
+{
+	c_hashtable_entry_t *entries;
+	uint32_t entries_num; /* power of two */
+	uint32_t size;
+	/* Where `c_hashtable_pick' continues searching. */
+	uint32_t pick_pos;
+
+	uint32_t (*hash) (const void *);
+	int (*compare) (const void *, const void *);
+};
+
+struct c_hashtable_iterator_s
+{
+	c_hashtable_t *table;
+	uint32_t pos;
+};
+
+/*
+ * private functions
+ */
+/* Linear probing: returns the position of `key' or of the unused entry at
+ * which the search stopped. The table always has unused entries. */
+static uint32_t ht_search (c_hashtable_t *h, const void *key,
+		uint32_t hash)
+{
+	uint32_t mask = h->entries_num - 1;
+	uint32_t pos;
+
+	for (pos = hash & mask; h->entries[pos].key != NULL;
+			pos = (pos + 1) & mask)
+	{
+		if ((h->entries[pos].hash == hash)
+				&& (h->compare (h->entries[pos].key, key) == 0))
+			break;
+	}
+
+	return (pos);
+} /* uint32_t ht_search */
+
+static int ht_resize (c_hashtable_t *h, uint32_t entries_num)
+{
+	c_hashtable_entry_t *old_entries = h->entries;
+	uint32_t old_entries_num = h->entries_num;
+	c_hashtable_entry_t *entries;
+	uint32_t i;
+
+	entries = calloc (entries_num, sizeof (*entries));
+	if (entries == NULL)
+		return (-1);
+
+	h->entries = entries;
+	h->entries_num = entries_num;
+	h->pick_pos = 0;
+
+	for (i = 0; i < old_entries_num; i++)
+	{
+		uint32_t pos;
+
+		if (old_entries[i].key == NULL)
+			continue;
+
+		pos = ht_search (h, old_entries[i].key, old_entries[i].hash);
+		h->entries[pos] = old_entries[i];
+	}
+
+	free (old_entries);
+	return (0);
+} /* int ht_resize */
+
+/* Removes the entry at `pos' by moving following entries of the same probe
+ * sequence back, so that no "deleted" markers are needed. */
+static void ht_remove_at (c_hashtable_t *h, uint32_t pos)
+{
+	uint32_t mask = h->entries_num - 1;
+	uint32_t hole = pos;
+	uint32_t next = pos;
+
+	while (42)
+	{
+		uint32_t home;
+
+		next = (next + 1) & mask;
+		if (h->entries[next].key == NULL)
+			break;
+
+		/* The entry may stay if its home position is cyclically in
+		 * (hole, next]. */
+		home = h->entries[next].hash & mask;
+		if ((hole <= next)
+				? ((hole < home) && (home <= next))
+				: ((hole < home) || (home <= next)))
+			continue;
+
+		h->entries[hole] = h->entries[next];
+		hole = next;
+	}
+
+	memset (h->entries + hole, 0, sizeof (h->entries[hole]));
+	h->size--;
+} /* void ht_remove_at */
+
+/*
+ * public functions
+ */
+uint32_t c_hashtable_hash_string (const void *key)
+{
+	const unsigned char *str = key;
+	uint32_t hash = 2166136261U;
+
+	while (*str != 0)
+	{
+		hash ^= (uint32_t) *str;
+		hash *= 16777619U;
+		str++;
+	}
+
+	return (hash);
+} /* uint32_t c_hashtable_hash_string */
+
+c_hashtable_t *c_hashtable_create (uint32_t (*hash) (const void *),
+		int (*compare) (const void *, const void *))
+{
+	c_hashtable_t *h;
+
+	if ((hash == NULL) || (compare == NULL))
+		return (NULL);
+
+	h = (c_hashtable_t *) malloc (sizeof (*h));
+	if (h == NULL)
+		return (NULL);
+	memset (h, 0, sizeof (*h));
+
+	h->entries = calloc (HT_SIZE_MIN, sizeof (*h->entries));
+	if (h->entries == NULL)
+	{
+		free (h);
+		return (NULL);
+	}
+	h->entries_num = HT_SIZE_MIN;
+
+	h->hash = hash;
+	h->compare = compare;
+
+	return (h);
+} /* c_hashtable_t *c_hashtable_create */
+
+void c_hashtable_destroy (c_hashtable_t *h)
+{
+	if (h == NULL)
+		return;
+
+	free (h->entries);
+	free (h);
+} /* void c_hashtable_destroy */
+
+int c_hashtable_insert (c_hashtable_t *h, void *key, void *value)
+{
+	uint32_t hash;
+	uint32_t pos;
+
+	if ((h == NULL) || (key == NULL))
+		return (-1);
+
+	hash = h->hash (key);
+	pos = ht_search (h, key, hash);
+	if (h->entries[pos].key != NULL)
+		return (1);
+
+	/* Keep the load factor below 3/4, so that probe sequences stay
+	 * short. */
+	if (4 * (h->size + 1) > 3 * h->entries_num)
+	{
+		if (ht_resize (h, 2 * h->entries_num) != 0)
+			return (-1);
+		pos = ht_search (h, key, hash);
+	}
+
+	h->entries[pos].hash = hash;
+	h->entries[pos].key = key;
+	h->entries[pos].value = value;
+	h->size++;
+
+	return (0);
+} /* int c_hashtable_insert */
+
+int c_hashtable_remove (c_hashtable_t *h, const void *key,
+		void **rkey, void **rvalue)
+{
+	uint32_t pos;
+
+	if ((h == NULL) || (key == NULL))
+		return (-1);
+
+	pos = ht_search (h, key, h->hash (key));
+	if (h->entries[pos].key == NULL)
+		return (-1);
+
+	if (rkey != NULL)
+		*rkey = h->entries[pos].key;
+	if (rvalue != NULL)
+		*rvalue = h->entries[pos].value;
+
+	ht_remove_at (h, pos);
+	return (0);
+} /* int c_hashtable_remove */
+
+int c_hashtable_get (c_hashtable_t *h, const void *key, void **value)
+{
+	uint32_t pos;
+
+	if ((h == NULL) || (key == NULL))
+		return (-1);
+
+	pos = ht_search (h, key, h->hash (key));
+	if (h->entries[pos].key == NULL)
+		return (-1);
+
+	if (value != NULL)
+		*value = h->entries[pos].value;
+
+	return (0);
+} /* int c_hashtable_get */
+
+int c_hashtable_pick (c_hashtable_t *h, void **key, void **value)
+{
+	uint32_t mask;
+	uint32_t pos;
+
+	if ((h == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	if (h->size == 0)
+		return (-1);
+
+	/* Entries before `pick_pos' are usually unused already, because they
+	 * have been picked before. Removing an entry only moves others to
+	 * positions at or after it, so starting there again is fine. */
+	mask = h->entries_num - 1;
+	for (pos = h->pick_pos; h->entries[pos].key == NULL;
+			pos = (pos + 1) & mask)
+		/* do nothing */;
+
+	*key = h->entries[pos].key;
+	*value = h->entries[pos].value;
+
+	ht_remove_at (h, pos);
+	h->pick_pos = pos;
+
+	return (0);
+} /* int c_hashtable_pick */
+
+c_hashtable_iterator_t *c_hashtable_get_iterator (c_hashtable_t *h)
+{
+	c_hashtable_iterator_t *iter;
+
+	if (h == NULL)
+		return (NULL);
+
+	iter = (c_hashtable_iterator_t *) malloc (sizeof (*iter));
+	if (iter == NULL)
+		return (NULL);
+	memset (iter, 0, sizeof (*iter));
+	iter->table = h;
+
+	return (iter);
+} /* c_hashtable_iterator_t *c_hashtable_get_iterator */
+
+int c_hashtable_iterator_next (c_hashtable_iterator_t *iter,
+		void **key, void **value)
+{
+	c_hashtable_t *h;
+
+	if ((iter == NULL) || (key == NULL) || (value == NULL))
+		return (-1);
+
+	h = iter->table;
+	while ((iter->pos < h->entries_num)
+			&& (h->entries[iter->pos].key == NULL))
+		iter->pos++;
+
+	if (iter->pos >= h->entries_num)
+		return (-1);
+
+	*key = h->entries[iter->pos].key;
+	*value = h->entries[iter->pos].value;
+	iter->pos++;
+
+	return (0);
+} /* int c_hashtable_iterator_next */
+
+void c_hashtable_iterator_destroy (c_hashtable_iterator_t *iter)
+{
+	free (iter);
+} /* void c_hashtable_iterator_destroy */
+
+int c_hashtable_size (c_hashtable_t *h)
+{
+	if (h == NULL)
+		return (0);
+	return ((int) h->size);
+} /* int c_hashtable_size */
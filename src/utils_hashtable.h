@@ -0,0 +1,160 @@
+/**
+ * collectd - src/utils_hashtable.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_HASHTABLE_H
+#define UTILS_HASHTABLE_H 1
+
+#include <stdint.h>
+
+/*
+ * An unordered key-value store with the same interface as the AVL-tree in
+ * "utils_avltree.h". Entries are kept in one array using open addressing
+ * and the hash of each key is stored next to it, so a lookup usually touches
+ * one or two cache lines and calls the compare function only for the
+ * matching entry. Use this instead of the AVL-tree if you don't need to
+ * iterate over the entries in order.
+ */
+
+struct c_hashtable_s;
+typedef struct c_hashtable_s c_hashtable_t;
+
+struct c_hashtable_iterator_s;
+typedef struct c_hashtable_iterator_s c_hashtable_iterator_t;
+
+/*
+ * NAME
+ *   c_hashtable_hash_string
+ *
+ * DESCRIPTION
+ *   Hash function for null-terminated strings (FNV-1a), to be passed to
+ *   `c_hashtable_create' together with `strcmp'.
+ */
+uint32_t c_hashtable_hash_string (const void *key);
+
+/*
+ * NAME
+ *   c_hashtable_create
+ *
+ * DESCRIPTION
+ *   Allocates a new hash table.
+ *
+ * PARAMETERS
+ *   `hash'     Function returning the hash value of a key. Keys which are
+ *              equal must have the same hash value.
+ *   `compare'  Function comparing two keys. It has to return zero if the keys
+ *              are equal and non-zero otherwise, so `strcmp' can be used for
+ *              char-pointers.
+ *
+ * RETURN VALUE
+ *   A c_hashtable_t-pointer upon success or NULL upon failure.
+ */
+c_hashtable_t *c_hashtable_create (uint32_t (*hash) (const void *),
+		int (*compare) (const void *, const void *));
+
+/*
+ * NAME
+ *   c_hashtable_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a hash table. Stored value- and key-pointer are lost, but of
+ *   course not freed.
+ */
+void c_hashtable_destroy (c_hashtable_t *h);
+
+/*
+ * NAME
+ *   c_hashtable_insert
+ *
+ * DESCRIPTION
+ *   Stores the key-value-pair in the hash table pointed to by `h'.
+ *
+ * PARAMETERS
+ *   `h'        Hash table to store the data in.
+ *   `key'      Key used to store the value under. The pointer is stored and
+ *              _not_ copied, see `c_avl_insert'. NULL is not a valid key.
+ *   `value'    Value to be stored.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise. It's less than zero if an error
+ *   occurred or greater than zero if the key is already stored in the table.
+ */
+int c_hashtable_insert (c_hashtable_t *h, void *key, void *value);
+
+/*
+ * NAME
+ *   c_hashtable_remove
+ *
+ * DESCRIPTION
+ *   Removes a key-value-pair from the hash table `h'. The stored key and
+ *   value may be returned in `rkey' and `rvalue', which may be NULL.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the table.
+ */
+int c_hashtable_remove (c_hashtable_t *h, const void *key,
+		void **rkey, void **rvalue);
+
+/*
+ * NAME
+ *   c_hashtable_get
+ *
+ * DESCRIPTION
+ *   Retrieve the `value' belonging to `key'. `value' may be NULL to only
+ *   check whether the key exists.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the key isn't found in the table.
+ */
+int c_hashtable_get (c_hashtable_t *h, const void *key, void **value);
+
+/*
+ * NAME
+ *   c_hashtable_pick
+ *
+ * DESCRIPTION
+ *   Remove an arbitrary element from the table and return its `key' and
+ *   `value', like `c_avl_pick'. Picking all elements one at a time takes
+ *   linear time.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the table is empty or key or value is
+ *   NULL.
+ */
+int c_hashtable_pick (c_hashtable_t *h, void **key, void **value);
+
+/*
+ * The iterator returns the entries in no particular order. The table must
+ * not be modified while an iterator exists.
+ */
+c_hashtable_iterator_t *c_hashtable_get_iterator (c_hashtable_t *h);
+int c_hashtable_iterator_next (c_hashtable_iterator_t *iter,
+		void **key, void **value);
+void c_hashtable_iterator_destroy (c_hashtable_iterator_t *iter);
+
+/*
+ * NAME
+ *   c_hashtable_size
+ *
+ * DESCRIPTION
+ *   Return the number of entries in the specified table, 0 if the table is
+ *   empty or NULL.
+ */
+int c_hashtable_size (c_hashtable_t *h);
+
+#endif /* UTILS_HASHTABLE_H */
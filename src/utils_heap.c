@@ -28,80 +28,138 @@
 
 #include "utils_heap.h"
 
+#define HEAP_MIN_SIZE 16
+
 struct c_heap_s
 {
   pthread_mutex_t lock;
   int (*compare) (const void *, const void *);
+  /* Returns where the element keeps its position in `list', or NULL if the
+   * heap is not indexed. */
+  size_t *(*position) (void *);
 
   void **list;
   size_t list_len; /* # entries used */
   size_t list_size; /* # entries allocated */
 };
 
-enum reheap_direction
+static void heap_set (c_heap_t *h, size_t index, void *ptr) /* {{{ */
 {
-  DIR_UP,
-  DIR_DOWN
-};
+  h->list[index] = ptr;
+  if (h->position != NULL)
+    *h->position (ptr) = index;
+} /* }}} void heap_set */
 
-static void reheap (c_heap_t *h, size_t root, enum reheap_direction dir)
+/* Moves the element at `index' towards the root until its parent is not
+ * bigger. Returns the new position. */
+static size_t sift_up (c_heap_t *h, size_t index) /* {{{ */
 {
-  size_t left;
-  size_t right;
-  size_t min;
-  int status;
+  void *ptr = h->list[index];
 
-  /* Calculate the positions of the children */
-  left = (2 * root) + 1;
-  if (left >= h->list_len)
-    left = 0;
+  while (index > 0)
+  {
+    size_t parent = (index - 1) / 2;
 
-  right = (2 * root) + 2;
-  if (right >= h->list_len)
-    right = 0;
+    if (h->compare (h->list[parent], ptr) <= 0)
+      break;
 
-  /* Check which one of the children is smaller. */
-  if ((left == 0) && (right == 0))
-    return;
-  else if (left == 0)
-    min = right;
-  else if (right == 0)
-    min = left;
-  else
-  {
-    status = h->compare (h->list[left], h->list[right]);
-    if (status > 0)
-      min = right;
-    else
-      min = left;
+    heap_set (h, index, h->list[parent]);
+    index = parent;
   }
 
-  status = h->compare (h->list[root], h->list[min]);
-  if (status <= 0)
+  heap_set (h, index, ptr);
+  return (index);
+} /* }}} size_t sift_up */
+
+/* Moves the element at `index' towards the leaves until none of its children
+ * is smaller. */
+static void sift_down (c_heap_t *h, size_t index) /* {{{ */
+{
+  void *ptr = h->list[index];
+
+  while (42)
   {
-    /* We didn't need to change anything, so the rest of the tree should be
-     * okay now. */
-    return;
+    size_t min = (2 * index) + 1;
+
+    if (min >= h->list_len)
+      break;
+
+    if (((min + 1) < h->list_len)
+        && (h->compare (h->list[min], h->list[min + 1]) > 0))
+      min++;
+
+    if (h->compare (ptr, h->list[min]) <= 0)
+      break;
+
+    heap_set (h, index, h->list[min]);
+    index = min;
   }
-  else /* if (status > 0) */
+
+  heap_set (h, index, ptr);
+} /* }}} void sift_down */
+
+/* Restores the heap property after the key of the element at `index' has
+ * changed in either direction. */
+static void reheap (c_heap_t *h, size_t index) /* {{{ */
+{
+  if (sift_up (h, index) == index)
+    sift_down (h, index);
+} /* }}} void reheap */
+
+/* Returns the position of `ptr' or `list_len' if it is not in the heap. */
+static size_t heap_find (c_heap_t *h, void *ptr) /* {{{ */
+{
+  size_t i;
+
+  if (h->position != NULL)
   {
-    void *tmp;
+    i = *h->position (ptr);
+    if ((i < h->list_len) && (h->list[i] == ptr))
+      return (i);
+    return (h->list_len);
+  }
 
-    tmp = h->list[root];
-    h->list[root] = h->list[min];
-    h->list[min] = tmp;
+  for (i = 0; i < h->list_len; i++)
+    if (h->list[i] == ptr)
+      break;
+
+  return (i);
+} /* }}} size_t heap_find */
+
+/* Removes the element at `index' by moving the last element there. */
+static void heap_remove_at (c_heap_t *h, size_t index) /* {{{ */
+{
+  h->list_len--;
+  if (index < h->list_len)
+  {
+    heap_set (h, index, h->list[h->list_len]);
+    reheap (h, index);
   }
+  h->list[h->list_len] = NULL;
 
-  if ((dir == DIR_UP) && (root == 0))
-    return;
+  /* free some memory, but only when a quarter of the list is used, so
+   * alternating inserts and removals don't resize the list every time. */
+  if ((h->list_size > HEAP_MIN_SIZE) && ((h->list_len * 4) < h->list_size))
+  {
+    void **tmp;
+    size_t new_size = h->list_size / 2;
 
-  if (dir == DIR_UP)
-    reheap (h, (root - 1) / 2, dir);
-  else if (dir == DIR_DOWN)
-    reheap (h, min, dir);
-} /* void reheap */
+    tmp = realloc (h->list, new_size * sizeof (*h->list));
+    if (tmp != NULL)
+    {
+      h->list = tmp;
+      h->list_size = new_size;
+    }
+  }
+} /* }}} void heap_remove_at */
 
 c_heap_t *c_heap_create (int (*compare) (const void *, const void *))
+{
+  return (c_heap_create_indexed (compare, /* position = */ NULL));
+} /* c_heap_t *c_heap_create */
+
+c_heap_t *c_heap_create_indexed (int (*compare) (const void *, const void *),
+    size_t *(*position) (void *))
 {
   c_heap_t *h;
 
@@ -115,13 +173,14 @@ c_heap_t *c_heap_create (int (*compare) (const void *, const void *))
   memset (h, 0, sizeof (*h));
   pthread_mutex_init (&h->lock, /* attr = */ NULL);
   h->compare = compare;
-  
+  h->position = position;
+
   h->list = NULL;
   h->list_len = 0;
   h->list_size = 0;
 
   return (h);
-} /* c_heap_t *c_heap_create */
+} /* c_heap_t *c_heap_create_indexed */
 
 void c_heap_destroy (c_heap_t *h)
 {
@@ -151,8 +210,12 @@ int c_heap_insert (c_heap_t *h, void *ptr)
   if (h->list_len == h->list_size)
   {
     void **tmp;
+    size_t new_size;
 
-    tmp = realloc (h->list, (h->list_size + 16) * sizeof (*h->list));
+    new_size = (h->list_size < HEAP_MIN_SIZE)
+      ? HEAP_MIN_SIZE : 2 * h->list_size;
+
+    tmp = realloc (h->list, new_size * sizeof (*h->list));
     if (tmp == NULL)
     {
       pthread_mutex_unlock (&h->lock);
@@ -160,21 +223,80 @@ int c_heap_insert (c_heap_t *h, void *ptr)
     }
 
     h->list = tmp;
-    h->list_size += 16;
+    h->list_size = new_size;
   }
 
   /* Insert the new node as a leaf. */
   index = h->list_len;
-  h->list[index] = ptr;
   h->list_len++;
+  heap_set (h, index, ptr);
 
   /* Reorganize the heap from bottom up. */
-  reheap (h, /* parent of this node = */ (index - 1) / 2, DIR_UP);
-  
+  sift_up (h, index);
+
   pthread_mutex_unlock (&h->lock);
   return (0);
 } /* int c_heap_insert */
 
+int c_heap_remove (c_heap_t *h, void *ptr)
+{
+  size_t index;
+
+  if ((h == NULL) || (ptr == NULL))
+    return (-EINVAL);
+
+  pthread_mutex_lock (&h->lock);
+
+  index = heap_find (h, ptr);
+  if (index >= h->list_len)
+  {
+    pthread_mutex_unlock (&h->lock);
+    return (-ENOENT);
+  }
+
+  heap_remove_at (h, index);
+
+  pthread_mutex_unlock (&h->lock);
+  return (0);
+} /* int c_heap_remove */
+
+int c_heap_update (c_heap_t *h, void *ptr)
+{
+  size_t index;
+
+  if ((h == NULL) || (ptr == NULL))
+    return (-EINVAL);
+
+  pthread_mutex_lock (&h->lock);
+
+  index = heap_find (h, ptr);
+  if (index >= h->list_len)
+  {
+    pthread_mutex_unlock (&h->lock);
+    return (-ENOENT);
+  }
+
+  reheap (h, index);
+
+  pthread_mutex_unlock (&h->lock);
+  return (0);
+} /* int c_heap_update */
+
+void *c_heap_peek_root (c_heap_t *h)
+{
+  void *ret = NULL;
+
+  if (h == NULL)
+    return (NULL);
+
+  pthread_mutex_lock (&h->lock);
+  if (h->list_len > 0)
+    ret = h->list[0];
+  pthread_mutex_unlock (&h->lock);
+
+  return (ret);
+} /* void *c_heap_peek_root */
+
 void *c_heap_get_root (c_heap_t *h)
 {
   void *ret = NULL;
@@ -189,38 +311,27 @@ void *c_heap_get_root (c_heap_t *h)
     pthread_mutex_unlock (&h->lock);
     return (NULL);
   }
-  else if (h->list_len == 1)
-  {
-    ret = h->list[0];
-    h->list[0] = NULL;
-    h->list_len = 0;
-  }
-  else /* if (h->list_len > 1) */
-  {
-    ret = h->list[0];
-    h->list[0] = h->list[h->list_len - 1];
-    h->list[h->list_len - 1] = NULL;
-    h->list_len--;
 
-    reheap (h, /* root = */ 0, DIR_DOWN);
-  }
+  ret = h->list[0];
+  heap_remove_at (h, 0);
 
-  /* free some memory */
-  if ((h->list_len + 32) < h->list_size)
-  {
-    void **tmp;
+  pthread_mutex_unlock (&h->lock);
 
-    tmp = realloc (h->list, (h->list_len + 16) * sizeof (*h->list));
-    if (tmp != NULL)
-    {
-      h->list = tmp;
-      h->list_size = h->list_len + 16;
-    }
-  }
+  return (ret);
+} /* void *c_heap_get_root */
 
+int c_heap_size (c_heap_t *h)
+{
+  int ret;
+
+  if (h == NULL)
+    return (0);
+
+  pthread_mutex_lock (&h->lock);
+  ret = (int) h->list_len;
   pthread_mutex_unlock (&h->lock);
 
   return (ret);
-} /* void *c_heap_get_root */
+} /* int c_heap_size */
 
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -23,6 +23,8 @@
 #ifndef UTILS_HEAP_H
 #define UTILS_HEAP_H 1
 
+#include <stddef.h>
+
 struct c_heap_s;
 typedef struct c_heap_s c_heap_t;
 
@@ -46,6 +48,27 @@ typedef struct c_heap_s c_heap_t;
  */
 c_heap_t *c_heap_create (int (*compare) (const void *, const void *));
 
+/*
+ * NAME
+ *   c_heap_create_indexed
+ *
+ * DESCRIPTION
+ *   Allocates a new heap which keeps the position of each element in the
+ *   element itself, so that `c_heap_remove' and `c_heap_update' take
+ *   O(log n) instead of O(n) time.
+ *
+ * PARAMETERS
+ *   `compare'  See `c_heap_create'.
+ *   `position' Function returning a pointer to a `size_t' member of the
+ *              element passed, which is reserved for the heap. An element
+ *              can therefore be stored in only one such heap at a time.
+ *
+ * RETURN VALUE
+ *   A c_heap_t-pointer upon success or NULL upon failure.
+ */
+c_heap_t *c_heap_create_indexed (int (*compare) (const void *, const void *),
+    size_t *(*position) (void *));
+
 /*
  * NAME
  *   c_heap_destroy
@@ -92,5 +115,51 @@ int c_heap_insert (c_heap_t *h, void *ptr);
  */
 void *c_heap_get_root (c_heap_t *h);
 
+/*
+ * NAME
+ *   c_heap_peek_root
+ *
+ * DESCRIPTION
+ *   Returns the value at the root of the heap without removing it.
+ *
+ * RETURN VALUE
+ *   The smallest pointer stored or NULL if the heap is empty.
+ */
+void *c_heap_peek_root (c_heap_t *h);
+
+/*
+ * NAME
+ *   c_heap_remove
+ *
+ * DESCRIPTION
+ *   Removes `ptr' from anywhere in the heap.
+ *
+ * RETURN VALUE
+ *   Zero upon success, -ENOENT if `ptr' is not stored in the heap.
+ */
+int c_heap_remove (c_heap_t *h, void *ptr);
+
+/*
+ * NAME
+ *   c_heap_update
+ *
+ * DESCRIPTION
+ *   Moves `ptr' to its place after its key has been changed, in either
+ *   direction. This replaces removing and re-inserting the element.
+ *
+ * RETURN VALUE
+ *   Zero upon success, -ENOENT if `ptr' is not stored in the heap.
+ */
+int c_heap_update (c_heap_t *h, void *ptr);
+
+/*
+ * NAME
+ *   c_heap_size
+ *
+ * RETURN VALUE
+ *   The number of elements stored in the heap.
+ */
+int c_heap_size (c_heap_t *h);
+
 #endif /* UTILS_HEAP_H */
 /* vim: set sw=2 sts=2 et : */
@@ -42,6 +42,10 @@
  * When you hit the IgnoreSelected config option,
  * offer it to the list:
  *   ignorelist_ignore (myconfig_ignore, instantly_got_value_of_ignore);
+ * If the same names are looked up on every read, e.g. device
+ * names, the results of matching them against regex entries
+ * can be remembered:
+ *   ignorelist_set_cache (myconfig_ignore, maximum_number_of_names);
  * That is all for the ignorelist initialization.
  * Later during read and write (plugin's registered functions) get
  * the information whether this entry would be collected or not:
@@ -56,64 +60,112 @@
 #include "common.h"
 #include "plugin.h"
 #include "utils_ignorelist.h"
+#include "utils_hashtable.h"
+
+#include <pthread.h>
 
 /*
  * private prototypes
  */
-struct ignorelist_item_s
+struct ignorelist_s
 {
+	int ignore;		/* ignore entries */
+
+	/* string entries, as keys of a hash table without values */
+	c_hashtable_t *strings;
+
 #if HAVE_REGEX_H
-	regex_t *rmatch;	/* regular expression entry identification */
+	/* regex entries, each compiled on its own */
+	char **regex_strings;
+	regex_t *regex;
+	size_t regex_num;
+
+	/* all regex entries as one alternation, compiled by the first
+	 * `ignorelist_match' after an entry has been added */
+	regex_t combined;
+	_Bool combined_valid;
+	_Bool combined_dirty;
 #endif
-	char *smatch;		/* string entry identification */
-	struct ignorelist_item_s *next;
-};
-typedef struct ignorelist_item_s ignorelist_item_t;
 
-struct ignorelist_s
-{
-	int ignore;		/* ignore entries */
-	ignorelist_item_t *head;	/* pointer to the first entry */
+	/* results of matching names against the regex entries */
+	c_hashtable_t *cache;
+	size_t cache_size;
+
+	pthread_mutex_t lock;
 };
 
+/* Values of the cache entries. */
+static char ignorelist_cache_found;
+static char ignorelist_cache_not_found;
+
 /* *** *** *** ********************************************* *** *** *** */
 /* *** *** *** *** *** ***   private functions   *** *** *** *** *** *** */
 /* *** *** *** ********************************************* *** *** *** */
 
-static inline void ignorelist_append (ignorelist_t *il, ignorelist_item_t *item)
+static void ignorelist_cache_clear (ignorelist_t *il)
 {
-	assert ((il != NULL) && (item != NULL));
+	void *key;
+	void *value;
+
+	if (il->cache == NULL)
+		return;
+
+	while (c_hashtable_pick (il->cache, &key, &value) == 0)
+		sfree (key);
+} /* void ignorelist_cache_clear (ignorelist_t *il) */
 
-	item->next = il->head;
-	il->head = item;
-}
+static void ignorelist_cache_add (ignorelist_t *il, const char *entry,
+		int found)
+{
+	char *key;
+
+	if (il->cache_size == 0)
+		return;
+
+	if (il->cache == NULL)
+	{
+		il->cache = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (il->cache == NULL)
+			return;
+	}
+
+	/* Names of devices which come and go, such as the network interfaces
+	 * of containers, would fill the cache without bounds. */
+	if ((size_t) c_hashtable_size (il->cache) >= il->cache_size)
+		ignorelist_cache_clear (il);
+
+	key = strdup (entry);
+	if (key == NULL)
+		return;
+
+	if (c_hashtable_insert (il->cache, key, found
+				? &ignorelist_cache_found
+				: &ignorelist_cache_not_found) != 0)
+		sfree (key);
+} /* void ignorelist_cache_add */
 
 #if HAVE_REGEX_H
 static int ignorelist_append_regex(ignorelist_t *il, const char *entry)
 {
 	int rcompile;
-	regex_t *regtemp;
+	regex_t regtemp;
+	regex_t *tmp;
+	char **tmp_strings;
 	int errsize;
 	char *regerr = NULL;
-	ignorelist_item_t *new;
 
-	/* create buffer */
-	if ((regtemp = malloc(sizeof(regex_t))) == NULL)
-	{
-		ERROR ("cannot allocate new config entry");
-		return (1);
-	}
-	memset (regtemp, '\0', sizeof(regex_t));
+	memset (&regtemp, '\0', sizeof(regex_t));
 
 	/* compile regex */
-	if ((rcompile = regcomp (regtemp, entry, REG_EXTENDED)) != 0)
+	if ((rcompile = regcomp (&regtemp, entry, REG_EXTENDED | REG_NOSUB)) != 0)
 	{
 		/* prepare message buffer */
-		errsize = regerror(rcompile, regtemp, NULL, 0);
+		errsize = regerror(rcompile, &regtemp, NULL, 0);
 		if (errsize)
 			regerr = smalloc(errsize);
 		/* get error message */
-		if (regerror (rcompile, regtemp, regerr, errsize))
+		if (regerror (rcompile, &regtemp, regerr, errsize))
 		{
 			fprintf (stderr, "Cannot compile regex %s: %i/%s",
 					entry, rcompile, regerr);
@@ -130,79 +182,172 @@ static int ignorelist_append_regex(ignorelist_t *il, const char *entry)
 
 		if (errsize)
 			sfree (regerr);
-		regfree (regtemp);
+		regfree (&regtemp);
 		return (1);
 	}
 	DEBUG("regex compiled: %s - %i", entry, rcompile);
 
 	/* create new entry */
-	if ((new = malloc(sizeof(ignorelist_item_t))) == NULL)
+	tmp = realloc (il->regex, (il->regex_num + 1) * sizeof (*il->regex));
+	if (tmp == NULL)
 	{
 		ERROR ("cannot allocate new config entry");
-		regfree (regtemp);
+		regfree (&regtemp);
 		return (1);
 	}
-	memset (new, '\0', sizeof(ignorelist_item_t));
-	new->rmatch = regtemp;
+	il->regex = tmp;
+
+	tmp_strings = realloc (il->regex_strings,
+			(il->regex_num + 1) * sizeof (*il->regex_strings));
+	if (tmp_strings == NULL)
+	{
+		ERROR ("cannot allocate new config entry");
+		regfree (&regtemp);
+		return (1);
+	}
+	il->regex_strings = tmp_strings;
 
 	/* append new entry */
-	ignorelist_append (il, new);
+	il->regex[il->regex_num] = regtemp;
+	il->regex_strings[il->regex_num] = sstrdup (entry);
+	il->regex_num++;
+
+	pthread_mutex_lock (&il->lock);
+	il->combined_dirty = 1;
+	ignorelist_cache_clear (il);
+	pthread_mutex_unlock (&il->lock);
 
 	return (0);
 } /* int ignorelist_append_regex(ignorelist_t *il, const char *entry) */
-#endif
 
-static int ignorelist_append_string(ignorelist_t *il, const char *entry)
+/*
+ * compile all regex entries into "(entry0)|(entry1)|...", so a name is
+ * matched against all of them in one pass. Should that fail, the entries
+ * are matched one after the other.
+ */
+static void ignorelist_combine (ignorelist_t *il)
 {
-	ignorelist_item_t *new;
+	char *pattern;
+	size_t pattern_size = 1;
+	size_t fill = 0;
+	size_t i;
 
-	/* create new entry */
-	if ((new = malloc(sizeof(ignorelist_item_t))) == NULL )
+	if (il->combined_valid)
 	{
-		ERROR ("cannot allocate new entry");
-		return (1);
+		regfree (&il->combined);
+		il->combined_valid = 0;
 	}
-	memset (new, '\0', sizeof(ignorelist_item_t));
-	new->smatch = sstrdup(entry);
+	il->combined_dirty = 0;
 
-	/* append new entry */
-	ignorelist_append (il, new);
+	if (il->regex_num < 2)
+		return;
 
-	return (0);
-} /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
+	for (i = 0; i < il->regex_num; i++)
+		pattern_size += strlen (il->regex_strings[i]) + 3;
+
+	pattern = malloc (pattern_size);
+	if (pattern == NULL)
+		return;
+
+	for (i = 0; i < il->regex_num; i++)
+	{
+		size_t len = strlen (il->regex_strings[i]);
+
+		if (i > 0)
+			pattern[fill++] = '|';
+		pattern[fill++] = '(';
+		memcpy (pattern + fill, il->regex_strings[i], len);
+		fill += len;
+		pattern[fill++] = ')';
+	}
+	pattern[fill] = 0;
+
+	memset (&il->combined, '\0', sizeof (il->combined));
+	if (regcomp (&il->combined, pattern, REG_EXTENDED | REG_NOSUB) == 0)
+		il->combined_valid = 1;
+	else
+		DEBUG ("Cannot combine regex entries, matching them one by one.");
+
+	sfree (pattern);
+} /* void ignorelist_combine (ignorelist_t *il) */
 
-#if HAVE_REGEX_H
 /*
- * check list for entry regex match
+ * check regex entries for a match
  * return 1 if found
  */
-static int ignorelist_match_regex (ignorelist_item_t *item, const char *entry)
+static int ignorelist_match_regex (ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->rmatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	void *cached;
+	int found = 0;
 
-	/* match regex */
-	if (regexec (item->rmatch, entry, 0, NULL, 0) == 0)
-		return (1);
+	pthread_mutex_lock (&il->lock);
 
-	return (0);
-} /* int ignorelist_match_regex (ignorelist_item_t *item, const char *entry) */
+	if ((il->cache != NULL)
+			&& (c_hashtable_get (il->cache, entry, &cached) == 0))
+	{
+		pthread_mutex_unlock (&il->lock);
+		return (cached == &ignorelist_cache_found);
+	}
+
+	if (il->combined_dirty)
+		ignorelist_combine (il);
+
+	if (il->combined_valid)
+	{
+		if (regexec (&il->combined, entry, 0, NULL, 0) == 0)
+			found = 1;
+	}
+	else
+	{
+		size_t i;
+
+		for (i = 0; i < il->regex_num; i++)
+		{
+			if (regexec (il->regex + i, entry, 0, NULL, 0) == 0)
+			{
+				found = 1;
+				break;
+			}
+		}
+	}
+
+	ignorelist_cache_add (il, entry, found);
+
+	pthread_mutex_unlock (&il->lock);
+	return (found);
+} /* int ignorelist_match_regex (ignorelist_t *il, const char *entry) */
 #endif
 
-/*
- * check list for entry string match
- * return 1 if found
- */
-static int ignorelist_match_string (ignorelist_item_t *item, const char *entry)
+static int ignorelist_append_string(ignorelist_t *il, const char *entry)
 {
-	assert ((item != NULL) && (item->smatch != NULL)
-			&& (entry != NULL) && (strlen (entry) > 0));
+	char *key;
 
-	if (strcmp (entry, item->smatch) == 0)
+	if (il->strings == NULL)
+	{
+		il->strings = c_hashtable_create (c_hashtable_hash_string,
+				(void *) strcmp);
+		if (il->strings == NULL)
+		{
+			ERROR ("cannot allocate new entry");
+			return (1);
+		}
+	}
+
+	/* entries given twice are stored once */
+	if (c_hashtable_get (il->strings, entry, NULL) == 0)
+		return (0);
+
+	/* create new entry */
+	key = sstrdup(entry);
+	if (c_hashtable_insert (il->strings, key, NULL) != 0)
+	{
+		ERROR ("cannot allocate new entry");
+		sfree (key);
 		return (1);
+	}
 
 	return (0);
-} /* int ignorelist_match_string (ignorelist_item_t *item, const char *entry) */
+} /* int ignorelist_append_string(ignorelist_t *il, const char *entry) */
 
 
 /* *** *** *** ******************************************** *** *** *** */
@@ -227,6 +372,8 @@ ignorelist_t *ignorelist_create (int invert)
 	 */
 	il->ignore = invert ? 0 : 1;
 
+	pthread_mutex_init (&il->lock, /* attr = */ NULL);
+
 	return (il);
 } /* ignorelist_t *ignorelist_create (int ignore) */
 
@@ -235,30 +382,40 @@ ignorelist_t *ignorelist_create (int invert)
  */
 void ignorelist_free (ignorelist_t *il)
 {
-	ignorelist_item_t *this;
-	ignorelist_item_t *next;
+	void *key;
+	void *value;
 
 	if (il == NULL)
 		return;
 
-	for (this = il->head; this != NULL; this = next)
+	if (il->strings != NULL)
 	{
-		next = this->next;
+		while (c_hashtable_pick (il->strings, &key, &value) == 0)
+			sfree (key);
+		c_hashtable_destroy (il->strings);
+	}
+
 #if HAVE_REGEX_H
-		if (this->rmatch != NULL)
-		{
-			regfree (this->rmatch);
-			this->rmatch = NULL;
-		}
+	while (il->regex_num > 0)
+	{
+		il->regex_num--;
+		regfree (il->regex + il->regex_num);
+		sfree (il->regex_strings[il->regex_num]);
+	}
+	sfree (il->regex);
+	sfree (il->regex_strings);
+
+	if (il->combined_valid)
+		regfree (&il->combined);
 #endif
-		if (this->smatch != NULL)
-		{
-			sfree (this->smatch);
-			this->smatch = NULL;
-		}
-		sfree (this);
+
+	if (il->cache != NULL)
+	{
+		ignorelist_cache_clear (il);
+		c_hashtable_destroy (il->cache);
 	}
 
+	pthread_mutex_destroy (&il->lock);
 	sfree (il);
 	il = NULL;
 } /* void ignorelist_destroy (ignorelist_t *il) */
@@ -277,6 +434,24 @@ void ignorelist_set_invert (ignorelist_t *il, int invert)
 	il->ignore = invert ? 0 : 1;
 } /* void ignorelist_set_invert (ignorelist_t *il, int ignore) */
 
+/*
+ * remember the results of matching up to `size' names against the regex
+ * entries
+ */
+void ignorelist_set_cache (ignorelist_t *il, size_t size)
+{
+	if (il == NULL)
+	{
+		DEBUG("set_cache call with ignorelist_t == NULL");
+		return;
+	}
+
+	pthread_mutex_lock (&il->lock);
+	il->cache_size = size;
+	ignorelist_cache_clear (il);
+	pthread_mutex_unlock (&il->lock);
+} /* void ignorelist_set_cache (ignorelist_t *il, size_t size) */
+
 /*
  * append entry into ignorelist_t
  * return 1 for success
@@ -333,32 +508,28 @@ int ignorelist_add (ignorelist_t *il, const char *entry)
  */
 int ignorelist_match (ignorelist_t *il, const char *entry)
 {
-	ignorelist_item_t *traverse;
-
 	/* if no entries, collect all */
-	if ((il == NULL) || (il->head == NULL))
+	if (il == NULL)
+		return (0);
+
+#if HAVE_REGEX_H
+	if ((c_hashtable_size (il->strings) == 0) && (il->regex_num == 0))
+		return (0);
+#else
+	if (c_hashtable_size (il->strings) == 0)
 		return (0);
+#endif
 
-	if ((entry == NULL) || (strlen (entry) == 0))
+	if ((entry == NULL) || (entry[0] == 0))
 		return (0);
 
-	/* traverse list and check entries */
-	for (traverse = il->head; traverse != NULL; traverse = traverse->next)
-	{
+	if (c_hashtable_get (il->strings, entry, NULL) == 0)
+		return (il->ignore);
+
 #if HAVE_REGEX_H
-		if (traverse->rmatch != NULL)
-		{
-			if (ignorelist_match_regex (traverse, entry))
-				return (il->ignore);
-		}
-		else
+	if ((il->regex_num > 0) && ignorelist_match_regex (il, entry))
+		return (il->ignore);
 #endif
-		{
-			if (ignorelist_match_string (traverse, entry))
-				return (il->ignore);
-		}
-	} /* for traverse */
 
 	return (1 - il->ignore);
 } /* int ignorelist_match (ignorelist_t *il, const char *entry) */
-
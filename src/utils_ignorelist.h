@@ -55,6 +55,13 @@ void ignorelist_free (ignorelist_t *il);
  */
 void ignorelist_set_invert (ignorelist_t *il, int invert);
 
+/*
+ * remember whether up to `size' names matched one of the regex entries,
+ * for lists matched against the same names again and again. When the
+ * cache is full it is emptied. A size of zero, the default, disables it.
+ */
+void ignorelist_set_cache (ignorelist_t *il, size_t size);
+
 /*
  * append entry to ignorelist_t
  * returns zero on success, non-zero upon failure.
@@ -0,0 +1,201 @@
+/**
+ * collectd - src/utils_known_paths.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "plugin.h"
+#include "common.h"
+
+#include <pthread.h>
+
+#include "utils_known_paths.h"
+#include "utils_avltree.h"
+
+struct kp_entry_s
+{
+  cdtime_t checked;
+  int status;
+};
+typedef struct kp_entry_s kp_entry_t;
+
+struct known_paths_s
+{
+  cdtime_t timeout;
+  c_avl_tree_t *tree;
+  pthread_mutex_t lock;
+};
+
+/*
+ * Private functions
+ */
+static int kp_stat (const char *path) /* {{{ */
+{
+  struct stat statbuf;
+
+  if (stat (path, &statbuf) != 0)
+  {
+    char errbuf[1024];
+
+    if (errno == ENOENT)
+      return (ENOENT);
+
+    ERROR ("stat(%s) failed: %s", path,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  if (!S_ISREG (statbuf.st_mode))
+  {
+    ERROR ("stat(%s): Not a regular file!", path);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int kp_stat */
+
+/* You must hold `kp->lock' when calling this function. */
+static void kp_update (known_paths_t *kp, const char *path, /* {{{ */
+    int status)
+{
+  kp_entry_t *e = NULL;
+  char *key;
+
+  if (c_avl_get (kp->tree, path, (void *) &e) == 0)
+  {
+    e->checked = cdtime ();
+    e->status = status;
+    return;
+  }
+
+  e = malloc (sizeof (*e));
+  key = strdup (path);
+  if ((e == NULL) || (key == NULL))
+  {
+    sfree (e);
+    sfree (key);
+    return;
+  }
+  e->checked = cdtime ();
+  e->status = status;
+
+  if (c_avl_insert (kp->tree, key, e) != 0)
+  {
+    sfree (e);
+    sfree (key);
+  }
+} /* }}} void kp_update */
+
+/*
+ * Public functions
+ */
+known_paths_t *kp_create (cdtime_t timeout) /* {{{ */
+{
+  known_paths_t *kp;
+
+  kp = malloc (sizeof (*kp));
+  if (kp == NULL)
+    return (NULL);
+  memset (kp, 0, sizeof (*kp));
+
+  kp->timeout = timeout;
+  kp->tree = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (kp->tree == NULL)
+  {
+    sfree (kp);
+    return (NULL);
+  }
+  pthread_mutex_init (&kp->lock, /* attr = */ NULL);
+
+  return (kp);
+} /* }}} known_paths_t *kp_create */
+
+void kp_destroy (known_paths_t *kp) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (kp == NULL)
+    return;
+
+  while (c_avl_pick (kp->tree, &key, &value) == 0)
+  {
+    sfree (key);
+    sfree (value);
+  }
+  c_avl_destroy (kp->tree);
+
+  pthread_mutex_destroy (&kp->lock);
+  sfree (kp);
+} /* }}} void kp_destroy */
+
+int kp_check (known_paths_t *kp, const char *path) /* {{{ */
+{
+  kp_entry_t *e = NULL;
+  int status;
+
+  if (kp == NULL)
+    return (kp_stat (path));
+
+  pthread_mutex_lock (&kp->lock);
+  if ((c_avl_get (kp->tree, path, (void *) &e) == 0)
+      && ((cdtime () - e->checked) < kp->timeout))
+  {
+    status = e->status;
+    pthread_mutex_unlock (&kp->lock);
+    return (status);
+  }
+  pthread_mutex_unlock (&kp->lock);
+
+  /* Don't hold the lock while talking to the file system. */
+  status = kp_stat (path);
+
+  pthread_mutex_lock (&kp->lock);
+  if ((status == 0) || (status == ENOENT))
+    kp_update (kp, path, status);
+  pthread_mutex_unlock (&kp->lock);
+
+  return (status);
+} /* }}} int kp_check */
+
+void kp_set_exists (known_paths_t *kp, const char *path) /* {{{ */
+{
+  if (kp == NULL)
+    return;
+
+  pthread_mutex_lock (&kp->lock);
+  kp_update (kp, path, /* status = */ 0);
+  pthread_mutex_unlock (&kp->lock);
+} /* }}} void kp_set_exists */
+
+void kp_invalidate (known_paths_t *kp, const char *path) /* {{{ */
+{
+  char *key = NULL;
+  kp_entry_t *e = NULL;
+
+  if (kp == NULL)
+    return;
+
+  pthread_mutex_lock (&kp->lock);
+  if (c_avl_remove (kp->tree, path, (void *) &key, (void *) &e) == 0)
+  {
+    sfree (key);
+    sfree (e);
+  }
+  pthread_mutex_unlock (&kp->lock);
+} /* }}} void kp_invalidate */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,53 @@
+/**
+ * collectd - src/utils_known_paths.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_KNOWN_PATHS_H
+#define UTILS_KNOWN_PATHS_H 1
+
+#include "utils_time.h"
+
+/*
+ * Known paths
+ *
+ * Remembers whether files exist, so write plugins don't have to call stat(2)
+ * each time they write a value. Both, existing and missing files, are cached
+ * for `timeout' time. After that the file is checked again.
+ */
+
+struct known_paths_s;
+typedef struct known_paths_s known_paths_t;
+
+known_paths_t *kp_create (cdtime_t timeout);
+void kp_destroy (known_paths_t *kp);
+
+/* Returns zero if `path' exists and is a regular file, ENOENT if it doesn't
+ * exist and -1 on all other errors. Errors are logged. If `kp' is NULL, the
+ * file is checked with stat(2) every time. */
+int kp_check (known_paths_t *kp, const char *path);
+
+/* Remembers that `path' exists, for example after the file has been
+ * created. */
+void kp_set_exists (known_paths_t *kp, const char *path);
+
+/* Forgets about `path', so it's checked again the next time. Call this after
+ * creating or writing the file failed. */
+void kp_invalidate (known_paths_t *kp, const char *path);
+
+#endif /* UTILS_KNOWN_PATHS_H */
+
+/* vim: set sw=2 sts=2 et fdm=marker : */
@@ -0,0 +1,290 @@
+/**
+ * collectd - src/utils_log_queue.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_complain.h"
+#include "utils_log_queue.h"
+#include "utils_thread.h"
+
+#include <pthread.h>
+
+/* A log message waiting to be passed to the log callbacks. */
+struct log_msg_s
+{
+	int level;
+	char msg[1024];
+};
+typedef struct log_msg_s log_msg_t;
+
+/* A recently logged message. Identical messages logged within
+ * LOG_COALESCE_INTERVAL are counted instead of being passed on. */
+#define LOG_RECENT_NUM 8
+#define LOG_COALESCE_INTERVAL TIME_T_TO_CDTIME_T (10)
+struct log_recent_s
+{
+	log_msg_t m;
+	int repeated;
+	cdtime_t first;
+};
+typedef struct log_recent_s log_recent_t;
+
+/* Ring of messages for the log thread. The indices only ever increase; the
+ * slot is the index modulo `log_queue_size'. */
+static log_msg_t       *log_queue = NULL;
+static size_t           log_queue_size = 0;
+static size_t           log_queue_read = 0;
+static size_t           log_queue_write = 0;
+static uint64_t         log_queue_dropped = 0;
+static int              log_queue_loop = 0;
+static log_recent_t     log_recent[LOG_RECENT_NUM];
+static pthread_mutex_t  log_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   log_queue_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t        log_thread;
+static log_queue_callback_t log_callback = NULL;
+static int              log_thread_running = 0;
+
+/* You must hold `log_queue_lock' when calling the following functions. */
+static void log_queue_push (int level, const char *msg) /* {{{ */
+{
+	log_msg_t *m;
+
+	if ((log_queue_write - log_queue_read) >= log_queue_size)
+	{
+		log_queue_dropped++;
+		return;
+	}
+
+	m = log_queue + (log_queue_write % log_queue_size);
+	m->level = level;
+	sstrncpy (m->msg, msg, sizeof (m->msg));
+	log_queue_write++;
+
+	pthread_cond_signal (&log_queue_cond);
+} /* }}} void log_queue_push */
+
+/* Reports how often the message in `r' was repeated and clears the slot. */
+static void log_recent_clear (log_recent_t *r) /* {{{ */
+{
+	if (r->repeated > 0)
+	{
+		char msg[sizeof (r->m.msg)];
+
+		ssnprintf (msg, sizeof (msg), "Message repeated %i time%s: %s",
+				r->repeated, (r->repeated == 1) ? "" : "s", r->m.msg);
+		log_queue_push (r->m.level, msg);
+	}
+
+	memset (r, 0, sizeof (*r));
+} /* }}} void log_recent_clear */
+
+/* Clears all slots older than LOG_COALESCE_INTERVAL, or all slots if `force'
+ * is true. Returns the time when the next slot expires, or zero if all slots
+ * are empty. */
+static cdtime_t log_recent_expire (_Bool force) /* {{{ */
+{
+	cdtime_t now = cdtime ();
+	cdtime_t next = 0;
+	int i;
+
+	for (i = 0; i < LOG_RECENT_NUM; i++)
+	{
+		log_recent_t *r = log_recent + i;
+
+		if (r->first == 0)
+			continue;
+
+		if (force || ((now - r->first) >= LOG_COALESCE_INTERVAL))
+			log_recent_clear (r);
+		else if ((next == 0) || ((r->first + LOG_COALESCE_INTERVAL) < next))
+			next = r->first + LOG_COALESCE_INTERVAL;
+	}
+
+	return (next);
+} /* }}} cdtime_t log_recent_expire */
+
+int log_queue_dispatch (int level, const char *msg) /* {{{ */
+{
+	log_recent_t *oldest;
+	int i;
+
+	pthread_mutex_lock (&log_queue_lock);
+
+	if (!log_queue_loop)
+	{
+		pthread_mutex_unlock (&log_queue_lock);
+		return (-1);
+	}
+
+	/* Count the message if it has been logged recently. Otherwise remember
+	 * it in the oldest slot. */
+	oldest = log_recent;
+	for (i = 0; i < LOG_RECENT_NUM; i++)
+	{
+		log_recent_t *r = log_recent + i;
+
+		if ((r->first != 0) && (r->m.level == level)
+				&& (strcmp (r->m.msg, msg) == 0))
+		{
+			r->repeated++;
+			pthread_mutex_unlock (&log_queue_lock);
+			return (0);
+		}
+
+		if (r->first < oldest->first)
+			oldest = r;
+	}
+
+	log_recent_clear (oldest);
+	oldest->m.level = level;
+	sstrncpy (oldest->m.msg, msg, sizeof (oldest->m.msg));
+	oldest->first = cdtime ();
+
+	log_queue_push (level, msg);
+
+	pthread_mutex_unlock (&log_queue_lock);
+	return (0);
+} /* }}} int log_queue_dispatch */
+
+static void *log_thread_main (void __attribute__((unused)) *arg) /* {{{ */
+{
+	c_complain_t complaint = C_COMPLAIN_INIT_STATIC;
+	uint64_t dropped_total = 0;
+
+	pthread_mutex_lock (&log_queue_lock);
+	while (42)
+	{
+		log_msg_t m;
+		uint64_t dropped;
+		cdtime_t next;
+
+		/* Report repeated messages. When shutting down, report all of
+		 * them. */
+		next = log_recent_expire (/* force = */ !log_queue_loop);
+
+		if (log_queue_read == log_queue_write)
+		{
+			if (!log_queue_loop)
+				break;
+
+			if (next != 0)
+			{
+				struct timespec ts;
+
+				CDTIME_T_TO_TIMESPEC (next, &ts);
+				pthread_cond_timedwait (&log_queue_cond, &log_queue_lock,
+						&ts);
+			}
+			else
+			{
+				pthread_cond_wait (&log_queue_cond, &log_queue_lock);
+			}
+			continue;
+		}
+
+		memcpy (&m, log_queue + (log_queue_read % log_queue_size),
+				sizeof (m));
+		log_queue_read++;
+
+		dropped = log_queue_dropped;
+		log_queue_dropped = 0;
+		pthread_mutex_unlock (&log_queue_lock);
+
+		(*log_callback) (m.level, m.msg);
+
+		/* These end up in the queue again, which has room now. */
+		if (dropped > 0)
+		{
+			dropped_total += dropped;
+			c_complain (LOG_WARNING, &complaint, "plugin_log: The log "
+					"queue is full. %"PRIu64" messages have been dropped "
+					"so far.", dropped_total);
+		}
+		else if (log_queue_read == log_queue_write)
+		{
+			c_release (LOG_INFO, &complaint, "plugin_log: The log "
+					"queue is no longer full. %"PRIu64" messages have "
+					"been dropped so far.", dropped_total);
+		}
+
+		pthread_mutex_lock (&log_queue_lock);
+	}
+	pthread_mutex_unlock (&log_queue_lock);
+
+	return ((void *) 0);
+} /* }}} void *log_thread_main */
+
+void log_queue_start (int limit, log_queue_callback_t callback) /* {{{ */
+{
+	int status;
+
+	if ((limit <= 0) || log_thread_running)
+		return;
+
+	log_queue = calloc ((size_t) limit, sizeof (*log_queue));
+	if (log_queue == NULL)
+	{
+		ERROR ("utils_log_queue: calloc failed.");
+		return;
+	}
+
+	pthread_mutex_lock (&log_queue_lock);
+	log_callback = callback;
+	log_queue_size = (size_t) limit;
+	log_queue_read = 0;
+	log_queue_write = 0;
+	memset (log_recent, 0, sizeof (log_recent));
+	log_queue_loop = 1;
+	pthread_mutex_unlock (&log_queue_lock);
+
+	status = thread_create (&log_thread, /* attr = */ NULL,
+			log_thread_main, /* arg = */ NULL, "logger",
+			/* cpus = */ NULL);
+	if (status != 0)
+	{
+		char errbuf[1024];
+
+		pthread_mutex_lock (&log_queue_lock);
+		log_queue_loop = 0;
+		pthread_mutex_unlock (&log_queue_lock);
+		sfree (log_queue);
+
+		ERROR ("utils_log_queue: Starting the log thread failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return;
+	}
+	log_thread_running = 1;
+} /* }}} void log_queue_start */
+
+void log_queue_stop (void) /* {{{ */
+{
+	if (!log_thread_running)
+		return;
+
+	/* The log thread passes on all queued messages before exiting. From
+	 * now on, plugin_log calls the callbacks synchronously. */
+	pthread_mutex_lock (&log_queue_lock);
+	log_queue_loop = 0;
+	pthread_cond_signal (&log_queue_cond);
+	pthread_mutex_unlock (&log_queue_lock);
+
+	pthread_join (log_thread, /* retval = */ NULL);
+	log_thread_running = 0;
+	sfree (log_queue);
+} /* }}} void log_queue_stop */
@@ -0,0 +1,47 @@
+/**
+ * collectd - src/utils_log_queue.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_LOG_QUEUE_H
+#define UTILS_LOG_QUEUE_H 1
+
+#include "plugin.h"
+
+/*
+ * Log queue
+ *
+ * Log messages are handed to a thread, which passes them on to the log
+ * callbacks, so threads logging aren't delayed by slow log callbacks, see
+ * `LogQueueLimit'. If the queue is full, new messages are dropped. Identical
+ * messages logged in quick succession are counted and reported once.
+ */
+
+typedef void (*log_queue_callback_t) (int level, const char *msg);
+
+/* Starts the log thread with a queue of `limit' messages, which passes
+ * messages to `callback', if `limit' is greater than zero. Calling it again
+ * doesn't change a queue which is already running. */
+void log_queue_start (int limit, log_queue_callback_t callback);
+
+/* Passes on the queued messages and stops the log thread. */
+void log_queue_stop (void);
+
+/* Hands a message to the log thread. Returns non-zero if the log thread is
+ * not running, in which case the caller has to pass the message on itself. */
+int log_queue_dispatch (int level, const char *msg);
+
+#endif /* UTILS_LOG_QUEUE_H */
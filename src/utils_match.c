@@ -37,6 +37,10 @@ struct cu_match_s
   regex_t excluderegex;
   int flags;
 
+  /* A string every match of `regex' contains, or NULL. Lines without it are
+   * skipped without running the regular expressions. */
+  char *literal;
+
   int (*callback) (const char *str, char * const *matches, size_t matches_num,
       void *user_data);
   void *user_data;
@@ -70,6 +74,162 @@ static char *match_substr (const char *str, int begin, int end)
   return (ret);
 } /* char *match_substr */
 
+/* Skips the bracket expression starting at `regex[0]', which is the opening
+ * bracket, and returns the position after the closing one. */
+static const char *match_skip_bracket (const char *regex)
+{
+  const char *ptr = regex + 1;
+
+  if (*ptr == '^')
+    ptr++;
+  /* A closing bracket right at the start is part of the list. */
+  if (*ptr == ']')
+    ptr++;
+
+  while ((*ptr != 0) && (*ptr != ']'))
+  {
+    /* Character classes, collating symbols and equivalence classes, e.g.
+     * "[:alpha:]", may contain a closing bracket. */
+    if ((ptr[0] == '[')
+	&& ((ptr[1] == ':') || (ptr[1] == '.') || (ptr[1] == '=')))
+    {
+      char end = ptr[1];
+
+      ptr += 2;
+      while ((*ptr != 0) && !((ptr[0] == end) && (ptr[1] == ']')))
+	ptr++;
+      if (*ptr == 0)
+	break;
+      ptr += 2;
+      continue;
+    }
+    ptr++;
+  }
+
+  if (*ptr == ']')
+    ptr++;
+  return (ptr);
+} /* const char *match_skip_bracket */
+
+/* Returns the longest string which every match of the extended regular
+ * expression `regex' must contain, or NULL if none is found. Only literal
+ * characters of the top level are considered and anything the expression
+ * may repeat zero times is left out, so the result is conservative: a
+ * regular expression with alternatives at the top level, for example, has
+ * none. */
+static char *match_required_literal (const char *regex)
+{
+  char *run;
+  size_t run_len = 0;
+  char *best = NULL;
+  size_t best_len = 0;
+  int depth = 0;
+  const char *ptr;
+
+  run = malloc (strlen (regex) + 1);
+  if (run == NULL)
+    return (NULL);
+
+#define END_RUN do { \
+  if (run_len > best_len) \
+  { \
+    sfree (best); \
+    best = malloc (run_len + 1); \
+    if (best != NULL) \
+    { \
+      memcpy (best, run, run_len); \
+      best[run_len] = 0; \
+      best_len = run_len; \
+    } \
+  } \
+  run_len = 0; \
+} while (0)
+
+  ptr = regex;
+  while (*ptr != 0)
+  {
+    char c = *ptr;
+
+    if (c == '[')
+    {
+      END_RUN;
+      ptr = match_skip_bracket (ptr);
+      continue;
+    }
+    else if (c == '\\')
+    {
+      if (ptr[1] == 0)
+	break;
+
+      /* GNU extensions such as "\w" and back references. */
+      if ((depth > 0) || isalnum ((unsigned char) ptr[1]))
+	END_RUN;
+      else
+	run[run_len++] = ptr[1];
+      ptr += 2;
+      continue;
+    }
+
+    ptr++;
+
+    if (depth > 0)
+    {
+      if (c == '(')
+	depth++;
+      else if (c == ')')
+	depth--;
+      continue;
+    }
+
+    switch (c)
+    {
+      case '|':
+      case ')':
+	/* The literals found so far are required by one alternative
+	 * only. */
+	sfree (best);
+	sfree (run);
+	return (NULL);
+
+      case '(':
+	END_RUN;
+	depth++;
+	break;
+
+      case '*':
+      case '?':
+      case '{':
+	/* The preceding character may be missing. */
+	if (run_len > 0)
+	  run_len--;
+	END_RUN;
+	if (c == '{')
+	{
+	  while ((*ptr != 0) && (*ptr != '}'))
+	    ptr++;
+	  if (*ptr == '}')
+	    ptr++;
+	}
+	break;
+
+      case '+':
+      case '.':
+      case '^':
+      case '$':
+	END_RUN;
+	break;
+
+      default:
+	run[run_len++] = c;
+    }
+  }
+  END_RUN;
+#undef END_RUN
+
+  sfree (run);
+  return (best);
+} /* char *match_required_literal */
+
 static int default_callback (const char __attribute__((unused)) *str,
     char * const *matches, size_t matches_num, void *user_data)
 {
@@ -237,7 +397,9 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
   }
 
   if (excluderegex && strcmp(excluderegex, "") != 0) {
-    status = regcomp (&obj->excluderegex, excluderegex, REG_EXTENDED);
+    /* Only whether the exclude regex matches is of interest. */
+    status = regcomp (&obj->excluderegex, excluderegex,
+	REG_EXTENDED | REG_NOSUB);
     if (status != 0)
     {
 	ERROR ("Compiling the excluding regular expression \"%s\" failed.",
@@ -248,6 +410,10 @@ cu_match_t *match_create_callback (const char *regex, const char *excluderegex,
     obj->flags |= UTILS_MATCH_FLAGS_EXCLUDE_REGEX;
   }
 
+  obj->literal = match_required_literal (regex);
+  DEBUG ("utils_match: match_create_callback: required literal = %s",
+      (obj->literal != NULL) ? obj->literal : "(none)");
+
   obj->callback = callback;
   obj->user_data = user_data;
 
@@ -289,6 +455,7 @@ void match_destroy (cu_match_t *obj)
     sfree (obj->user_data);
   }
 
+  sfree (obj->literal);
   sfree (obj);
 } /* void match_destroy */
 
@@ -298,14 +465,19 @@ int match_apply (cu_match_t *obj, const char *str)
   regmatch_t re_match[32];
   char *matches[32];
   size_t matches_num;
+  size_t re_match_num;
   size_t i;
 
   if ((obj == NULL) || (str == NULL))
     return (-1);
 
+  /* Neither regex needs to run if the line can't match. */
+  if ((obj->literal != NULL) && (strstr (str, obj->literal) == NULL))
+    return (0);
+
   if (obj->flags & UTILS_MATCH_FLAGS_EXCLUDE_REGEX) {
     status = regexec (&obj->excluderegex, str,
-		      STATIC_ARRAY_SIZE (re_match), re_match,
+		      /* nmatch = */ 0, /* pmatch = */ NULL,
 		      /* eflags = */ 0);
     /* Regex did match, so exclude this line */
     if (status == 0) {
@@ -314,8 +486,14 @@ int match_apply (cu_match_t *obj, const char *str)
     }
   }
 
+  /* Asking for more subexpressions than the regex has makes matching
+   * slower. */
+  re_match_num = obj->regex.re_nsub + 1;
+  if (re_match_num > STATIC_ARRAY_SIZE (re_match))
+    re_match_num = STATIC_ARRAY_SIZE (re_match);
+
   status = regexec (&obj->regex, str,
-      STATIC_ARRAY_SIZE (re_match), re_match,
+      re_match_num, re_match,
       /* eflags = */ 0);
 
   /* Regex did not match */
@@ -323,7 +501,7 @@ int match_apply (cu_match_t *obj, const char *str)
     return (0);
 
   memset (matches, '\0', sizeof (matches));
-  for (matches_num = 0; matches_num < STATIC_ARRAY_SIZE (matches); matches_num++)
+  for (matches_num = 0; matches_num < re_match_num; matches_num++)
   {
     if ((re_match[matches_num].rm_so < 0)
 	|| (re_match[matches_num].rm_eo < 0))
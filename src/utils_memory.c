@@ -0,0 +1,221 @@
+/**
+ * collectd - src/utils_memory.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_memory.h"
+
+#include <pthread.h>
+
+/* Accounts are kept in a static array, so that pointers to them stay valid
+ * and `mem_check' can walk them without a lock. */
+#define MEM_ACCOUNTS_MAX 32
+
+struct mem_account_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	int64_t bytes;
+};
+
+static mem_account_t mem_accounts[MEM_ACCOUNTS_MAX];
+static int mem_accounts_num = 0;
+static pthread_mutex_t mem_accounts_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t mem_budget = 0;
+static _Bool mem_statistics = 0;
+static int mem_pressure_level = MEM_PRESSURE_NONE;
+
+static const char *mem_pressure_names[] =
+{
+	"none",
+	"dropping received values",
+	"dropping received values and flushing",
+	"dropping received values, flushing and rejecting new identifiers"
+};
+
+mem_account_t *mem_account_get (const char *name) /* {{{ */
+{
+	mem_account_t *a = NULL;
+	int i;
+
+	pthread_mutex_lock (&mem_accounts_lock);
+	for (i = 0; i < mem_accounts_num; i++)
+	{
+		if (strcmp (mem_accounts[i].name, name) == 0)
+		{
+			a = mem_accounts + i;
+			break;
+		}
+	}
+
+	if ((a == NULL) && (mem_accounts_num < MEM_ACCOUNTS_MAX))
+	{
+		a = mem_accounts + mem_accounts_num;
+		sstrncpy (a->name, name, sizeof (a->name));
+		a->bytes = 0;
+		/* Published after the name has been written, see `mem_check'. */
+		__sync_fetch_and_add (&mem_accounts_num, 1);
+	}
+	pthread_mutex_unlock (&mem_accounts_lock);
+
+	if (a == NULL)
+		ERROR ("mem_account_get: Only %i accounts are supported, `%s' "
+				"is not accounted.", MEM_ACCOUNTS_MAX, name);
+
+	return (a);
+} /* }}} mem_account_t *mem_account_get */
+
+void mem_account_add (mem_account_t *a, int64_t bytes) /* {{{ */
+{
+	if (a == NULL)
+		return;
+
+	__sync_fetch_and_add (&a->bytes, bytes);
+} /* }}} void mem_account_add */
+
+int mem_pressure (void) /* {{{ */
+{
+	return (mem_pressure_level);
+} /* }}} int mem_pressure */
+
+/* Parses a number of bytes with an optional "k", "M" or "G" suffix. */
+static int mem_parse_size (const char *str, uint64_t *ret) /* {{{ */
+{
+	char *endptr = NULL;
+	double value;
+
+	errno = 0;
+	value = strtod (str, &endptr);
+	if ((errno != 0) || (endptr == str) || (value < 0.0))
+		return (-1);
+
+	while (isspace ((int) *endptr))
+		endptr++;
+
+	switch (*endptr)
+	{
+		case 'k': case 'K': value *= 1024.0; endptr++; break;
+		case 'm': case 'M': value *= 1048576.0; endptr++; break;
+		case 'g': case 'G': value *= 1073741824.0; endptr++; break;
+	}
+	if (*endptr == 'B')
+		endptr++;
+	if (*endptr != 0)
+		return (-1);
+
+	*ret = (uint64_t) value;
+	return (0);
+} /* }}} int mem_parse_size */
+
+int mem_init (void) /* {{{ */
+{
+	const char *str;
+
+	mem_statistics = IS_TRUE (global_option_get ("MemoryStatistics"));
+
+	str = global_option_get ("MemoryBudget");
+	if ((str != NULL) && (mem_parse_size (str, &mem_budget) != 0))
+	{
+		ERROR ("mem_init: Cannot parse `MemoryBudget %s'. The budget "
+				"is disabled.", str);
+		mem_budget = 0;
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int mem_init */
+
+static void mem_submit (const char *type_instance, gauge_t value) /* {{{ */
+{
+	value_t values[1];
+	value_list_t vl = VALUE_LIST_INIT;
+
+	values[0].gauge = value;
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+	sstrncpy (vl.plugin_instance, "memory", sizeof (vl.plugin_instance));
+	sstrncpy (vl.type, "memory", sizeof (vl.type));
+	sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+	plugin_dispatch_values (&vl);
+} /* }}} void mem_submit */
+
+void mem_check (void) /* {{{ */
+{
+	int64_t total = 0;
+	int num;
+	int level;
+	int i;
+
+	num = mem_accounts_num;
+	for (i = 0; i < num; i++)
+	{
+		int64_t bytes = mem_accounts[i].bytes;
+
+		if (bytes < 0)
+			bytes = 0;
+		total += bytes;
+
+		if (mem_statistics)
+			mem_submit (mem_accounts[i].name, (gauge_t) bytes);
+	}
+
+	if (mem_statistics)
+		mem_submit ("total", (gauge_t) total);
+
+	if (mem_budget == 0)
+		return;
+
+	level = mem_pressure_level;
+	if ((uint64_t) total > mem_budget)
+	{
+		if (level < MEM_PRESSURE_REJECT_NEW)
+			level++;
+	}
+	else if ((uint64_t) total < (mem_budget / 10) * 9)
+	{
+		if (level > MEM_PRESSURE_NONE)
+			level--;
+	}
+
+	if (level != mem_pressure_level)
+	{
+		if (level > mem_pressure_level)
+			WARNING ("mem_check: %"PRIi64" bytes are in use, the budget "
+					"is %"PRIu64" bytes. Load shedding: %s.",
+					total, mem_budget, mem_pressure_names[level]);
+		else
+			INFO ("mem_check: %"PRIi64" bytes are in use, the budget is "
+					"%"PRIu64" bytes. Load shedding: %s.",
+					total, mem_budget, mem_pressure_names[level]);
+		mem_pressure_level = level;
+	}
+
+	/* Flushing hands the values cached by write plugins, e.g. rrdtool, to
+	 * their writers, which frees the memory as they are written. */
+	if (level >= MEM_PRESSURE_FLUSH)
+		plugin_flush (/* plugin = */ NULL, /* timeout = */ 0,
+				/* identifier = */ NULL);
+} /* }}} void mem_check */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
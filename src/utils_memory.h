@@ -0,0 +1,90 @@
+/**
+ * collectd - src/utils_memory.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_MEMORY_H
+#define UTILS_MEMORY_H 1
+
+#include <stdint.h>
+
+/*
+ * Memory accounting
+ *
+ * Subsystems which may grow without bound count the bytes they hold in an
+ * account of their own. Once per interval `mem_check' sums up all accounts,
+ * reports them if `MemoryStatistics' is enabled and compares the total with
+ * the `MemoryBudget'. While the budget is exceeded, the pressure rises by one
+ * level per interval, so that the cheapest measure is tried first:
+ *
+ *   MEM_PRESSURE_DROP_RECEIVED  Values received from the network are dropped.
+ *   MEM_PRESSURE_FLUSH          In addition, all plugins are flushed.
+ *   MEM_PRESSURE_REJECT_NEW     In addition, the cache refuses identifiers it
+ *                               doesn't know yet.
+ *
+ * Once the total is below 90% of the budget again, the pressure drops by one
+ * level per interval.
+ */
+#define MEM_PRESSURE_NONE           0
+#define MEM_PRESSURE_DROP_RECEIVED  1
+#define MEM_PRESSURE_FLUSH          2
+#define MEM_PRESSURE_REJECT_NEW     3
+
+struct mem_account_s;
+typedef struct mem_account_s mem_account_t;
+
+/*
+ * NAME
+ *   mem_account_get
+ *
+ * DESCRIPTION
+ *   Returns the account called `name', creating it if necessary. Accounts
+ *   are never freed, so the pointer may be kept, e.g. in a static variable.
+ *
+ * RETURN VALUE
+ *   The account or NULL if it couldn't be created. All functions accept NULL
+ *   and do nothing in that case.
+ */
+mem_account_t *mem_account_get (const char *name);
+
+/*
+ * NAME
+ *   mem_account_add
+ *
+ * DESCRIPTION
+ *   Adds `bytes' bytes to the account, or subtracts them if `bytes' is
+ *   negative. Uses an atomic operation and never blocks.
+ */
+void mem_account_add (mem_account_t *a, int64_t bytes);
+
+/*
+ * NAME
+ *   mem_pressure
+ *
+ * DESCRIPTION
+ *   Returns the current pressure level, one of the MEM_PRESSURE_* constants.
+ *   It's always MEM_PRESSURE_NONE if no budget has been configured.
+ */
+int mem_pressure (void);
+
+/* Reads the `MemoryBudget' and `MemoryStatistics' options. */
+int mem_init (void);
+
+/* Called once per interval from the main loop, see above. */
+void mem_check (void);
+
+#endif /* UTILS_MEMORY_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
@@ -0,0 +1,465 @@
+/**
+ * collectd - src/utils_notif_queue.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_hashtable.h"
+#include "utils_notif_queue.h"
+#include "utils_thread.h"
+
+#include <pthread.h>
+
+/* A notification waiting for a notification thread. */
+struct notif_msg_s
+{
+	notification_t n;
+	cdtime_t enqueued;
+};
+typedef struct notif_msg_s notif_msg_t;
+
+/* The ring of notifications of one notification thread. The indices only
+ * ever increase. All members are protected by `notif_queue_lock'. */
+struct notif_queue_s
+{
+	notif_msg_t *nq_ring;
+	size_t nq_read;
+	size_t nq_write;
+	pthread_cond_t nq_cond;
+	pthread_t nq_thread;
+	_Bool nq_running;
+
+	uint64_t nq_dropped;
+	/* Time spent in the queue since the statistics were last submitted. */
+	cdtime_t nq_delay_sum;
+	cdtime_t nq_delay_max;
+	uint64_t nq_delay_num;
+};
+typedef struct notif_queue_s notif_queue_t;
+
+static notif_queue_t   *notif_queues = NULL;
+static size_t           notif_queues_num = 0;
+static size_t           notif_queue_size = 0;
+static _Bool            notif_queue_loop = 0;
+static pthread_mutex_t  notif_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static notif_queue_callback_t notif_callback = NULL;
+
+/* Time each notification identifier and severity has last been passed on,
+ * see `notif_queue_coalesce'. Protected by `notif_recent_lock'. */
+static c_hashtable_t   *notif_recent = NULL;
+static cdtime_t         notif_coalesce_interval = 0;
+static cdtime_t         notif_recent_purge = 0;
+static uint64_t         notif_coalesced = 0;
+static pthread_mutex_t  notif_recent_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Removes the entries of `notif_recent' older than the coalescing interval.
+ * You must hold `notif_recent_lock'. */
+static void notif_queue_recent_purge (cdtime_t now) /* {{{ */
+{
+	c_hashtable_iterator_t *iter;
+	char **expired;
+	size_t expired_num = 0;
+	size_t i;
+	char *key;
+	cdtime_t *first;
+
+	expired = calloc ((size_t) c_hashtable_size (notif_recent) + 1,
+			sizeof (*expired));
+	iter = c_hashtable_get_iterator (notif_recent);
+	if ((expired == NULL) || (iter == NULL))
+	{
+		sfree (expired);
+		if (iter != NULL)
+			c_hashtable_iterator_destroy (iter);
+		return;
+	}
+
+	/* The table must not be modified while iterating. */
+	while (c_hashtable_iterator_next (iter, (void *) &key,
+				(void *) &first) == 0)
+		if ((now - *first) >= notif_coalesce_interval)
+			expired[expired_num++] = key;
+	c_hashtable_iterator_destroy (iter);
+
+	for (i = 0; i < expired_num; i++)
+	{
+		if (c_hashtable_remove (notif_recent, expired[i],
+					(void *) &key, (void *) &first) != 0)
+			continue;
+		sfree (key);
+		sfree (first);
+	}
+	sfree (expired);
+} /* }}} void notif_queue_recent_purge */
+
+/* Returns true if a notification with the same identifier and severity as
+ * `n' has been passed on within the coalescing interval, in which case `n'
+ * is dropped. */
+static _Bool notif_queue_coalesce (const notification_t *n) /* {{{ */
+{
+	char key[6 * DATA_MAX_NAME_LEN + 16];
+	cdtime_t *first;
+	cdtime_t now;
+
+	if (notif_recent == NULL)
+		return (0);
+
+	ssnprintf (key, sizeof (key), "%i/%s/%s/%s/%s/%s", n->severity,
+			n->host, n->plugin, n->plugin_instance,
+			n->type, n->type_instance);
+	now = cdtime ();
+
+	pthread_mutex_lock (&notif_recent_lock);
+
+	if (now >= notif_recent_purge)
+	{
+		notif_queue_recent_purge (now);
+		notif_recent_purge = now + notif_coalesce_interval;
+	}
+
+	if (c_hashtable_get (notif_recent, key, (void *) &first) == 0)
+	{
+		if ((now - *first) < notif_coalesce_interval)
+		{
+			notif_coalesced++;
+			pthread_mutex_unlock (&notif_recent_lock);
+			return (1);
+		}
+
+		*first = now;
+		pthread_mutex_unlock (&notif_recent_lock);
+		return (0);
+	}
+
+	first = malloc (sizeof (*first));
+	if (first != NULL)
+	{
+		char *key_copy = strdup (key);
+
+		*first = now;
+		if ((key_copy == NULL)
+				|| (c_hashtable_insert (notif_recent, key_copy, first) != 0))
+		{
+			sfree (key_copy);
+			sfree (first);
+		}
+	}
+
+	pthread_mutex_unlock (&notif_recent_lock);
+	return (0);
+} /* }}} _Bool notif_queue_coalesce */
+
+/* Hands a copy of `n' to a notification thread. Returns non-zero if the
+ * threads are not running, in which case the caller has to dispatch the
+ * notification itself. */
+static int notif_queue_enqueue (const notification_t *n) /* {{{ */
+{
+	notif_queue_t *nq;
+	notif_msg_t *m;
+
+	pthread_mutex_lock (&notif_queue_lock);
+
+	if (!notif_queue_loop)
+	{
+		pthread_mutex_unlock (&notif_queue_lock);
+		return (-1);
+	}
+
+	nq = notif_queues;
+	if (notif_queues_num > 1)
+	{
+		char key[5 * DATA_MAX_NAME_LEN];
+
+		ssnprintf (key, sizeof (key), "%s/%s/%s/%s/%s", n->host,
+				n->plugin, n->plugin_instance,
+				n->type, n->type_instance);
+		nq += c_hashtable_hash_string (key) % notif_queues_num;
+	}
+
+	if ((nq->nq_write - nq->nq_read) >= notif_queue_size)
+	{
+		nq->nq_dropped++;
+		pthread_mutex_unlock (&notif_queue_lock);
+		return (0);
+	}
+
+	m = nq->nq_ring + (nq->nq_write % notif_queue_size);
+	memcpy (&m->n, n, sizeof (m->n));
+	m->n.meta = NULL;
+	plugin_notification_meta_copy (&m->n, n);
+	m->enqueued = cdtime ();
+	nq->nq_write++;
+
+	pthread_cond_signal (&nq->nq_cond);
+	pthread_mutex_unlock (&notif_queue_lock);
+	return (0);
+} /* }}} int notif_queue_enqueue */
+
+static void *notif_queue_thread (void *arg) /* {{{ */
+{
+	notif_queue_t *nq = arg;
+
+	pthread_mutex_lock (&notif_queue_lock);
+	while (42)
+	{
+		notif_msg_t m;
+		cdtime_t delay;
+
+		/* Pass on all queued notifications before exiting. */
+		if (nq->nq_read == nq->nq_write)
+		{
+			if (!notif_queue_loop)
+				break;
+			pthread_cond_wait (&nq->nq_cond, &notif_queue_lock);
+			continue;
+		}
+
+		memcpy (&m, nq->nq_ring + (nq->nq_read % notif_queue_size),
+				sizeof (m));
+		nq->nq_read++;
+		pthread_mutex_unlock (&notif_queue_lock);
+
+		delay = cdtime () - m.enqueued;
+		(*notif_callback) (&m.n);
+		if (m.n.meta != NULL)
+			plugin_notification_meta_free (m.n.meta);
+
+		pthread_mutex_lock (&notif_queue_lock);
+		nq->nq_delay_sum += delay;
+		if (delay > nq->nq_delay_max)
+			nq->nq_delay_max = delay;
+		nq->nq_delay_num++;
+	}
+	pthread_mutex_unlock (&notif_queue_lock);
+
+	return ((void *) 0);
+} /* }}} void *notif_queue_thread */
+
+void notif_queue_stop (void) /* {{{ */
+{
+	size_t i;
+
+	if (notif_queues == NULL)
+		return;
+
+	/* From now on, notifications are passed on synchronously. */
+	pthread_mutex_lock (&notif_queue_lock);
+	notif_queue_loop = 0;
+	for (i = 0; i < notif_queues_num; i++)
+		pthread_cond_signal (&notif_queues[i].nq_cond);
+	pthread_mutex_unlock (&notif_queue_lock);
+
+	for (i = 0; i < notif_queues_num; i++)
+	{
+		notif_queue_t *nq = notif_queues + i;
+
+		if (nq->nq_running)
+			pthread_join (nq->nq_thread, /* retval = */ NULL);
+
+		/* Only non-empty if the thread could not be started. */
+		for (; nq->nq_read != nq->nq_write; nq->nq_read++)
+		{
+			notif_msg_t *m = nq->nq_ring
+				+ (nq->nq_read % notif_queue_size);
+			if (m->n.meta != NULL)
+				plugin_notification_meta_free (m->n.meta);
+		}
+
+		pthread_cond_destroy (&nq->nq_cond);
+		sfree (nq->nq_ring);
+	}
+
+	sfree (notif_queues);
+	notif_queues_num = 0;
+} /* }}} void notif_queue_stop */
+
+void notif_queue_start (cdtime_t coalesce_interval, int limit, /* {{{ */
+		int threads, notif_queue_callback_t callback)
+{
+	int i;
+
+	if ((coalesce_interval > 0) && (notif_recent == NULL))
+	{
+		notif_recent = c_hashtable_create (c_hashtable_hash_string,
+				(int (*) (const void *, const void *)) strcmp);
+		if (notif_recent == NULL)
+			ERROR ("utils_notif_queue: c_hashtable_create failed.");
+		notif_coalesce_interval = coalesce_interval;
+	}
+
+	if ((limit <= 0) || (notif_queues != NULL))
+		return;
+	if (threads < 1)
+		threads = 1;
+
+	notif_queues = calloc ((size_t) threads, sizeof (*notif_queues));
+	if (notif_queues == NULL)
+	{
+		ERROR ("utils_notif_queue: calloc failed.");
+		return;
+	}
+	notif_queue_size = (size_t) limit;
+	notif_queues_num = (size_t) threads;
+	notif_callback = callback;
+
+	for (i = 0; i < threads; i++)
+	{
+		pthread_cond_init (&notif_queues[i].nq_cond, /* attr = */ NULL);
+		notif_queues[i].nq_ring = calloc (notif_queue_size,
+				sizeof (*notif_queues[i].nq_ring));
+		if (notif_queues[i].nq_ring == NULL)
+		{
+			ERROR ("utils_notif_queue: calloc failed.");
+			notif_queues_num = (size_t) (i + 1);
+			notif_queue_stop ();
+			return;
+		}
+	}
+
+	pthread_mutex_lock (&notif_queue_lock);
+	notif_queue_loop = 1;
+	pthread_mutex_unlock (&notif_queue_lock);
+
+	for (i = 0; i < threads; i++)
+	{
+		char name[16];
+		int status;
+
+		ssnprintf (name, sizeof (name), "notify#%i", i);
+		status = thread_create (&notif_queues[i].nq_thread,
+				/* attr = */ NULL, notif_queue_thread,
+				notif_queues + i, name, /* cpus = */ NULL);
+		if (status != 0)
+		{
+			char errbuf[1024];
+			ERROR ("utils_notif_queue: Starting notification thread %i failed: %s",
+					i, sstrerror (status, errbuf, sizeof (errbuf)));
+			/* Notifications assigned to this queue have to be passed
+			 * on synchronously. */
+			notif_queue_stop ();
+			return;
+		}
+		notif_queues[i].nq_running = 1;
+	}
+} /* }}} void notif_queue_start */
+
+void notif_queue_submit_stats (void) /* {{{ */
+{
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	gauge_t length = 0.0;
+	derive_t dropped = 0;
+	derive_t coalesced;
+	cdtime_t delay_sum = 0;
+	cdtime_t delay_max = 0;
+	uint64_t delay_num = 0;
+	_Bool have_queues;
+	size_t i;
+
+	if ((notif_queues == NULL) && (notif_recent == NULL))
+		return;
+
+	pthread_mutex_lock (&notif_queue_lock);
+	have_queues = notif_queue_loop;
+	for (i = 0; have_queues && (i < notif_queues_num); i++)
+	{
+		notif_queue_t *nq = notif_queues + i;
+
+		length += (gauge_t) (nq->nq_write - nq->nq_read);
+		dropped += (derive_t) nq->nq_dropped;
+		delay_sum += nq->nq_delay_sum;
+		delay_num += nq->nq_delay_num;
+		if (nq->nq_delay_max > delay_max)
+			delay_max = nq->nq_delay_max;
+
+		nq->nq_delay_sum = 0;
+		nq->nq_delay_max = 0;
+		nq->nq_delay_num = 0;
+	}
+	pthread_mutex_unlock (&notif_queue_lock);
+
+	pthread_mutex_lock (&notif_recent_lock);
+	coalesced = (derive_t) notif_coalesced;
+	pthread_mutex_unlock (&notif_recent_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "notification_queue", sizeof (vl.plugin));
+
+	if (notif_recent != NULL)
+	{
+		sstrncpy (vl.type, "derive", sizeof (vl.type));
+		sstrncpy (vl.type_instance, "coalesced", sizeof (vl.type_instance));
+		values[0].derive = coalesced;
+		plugin_dispatch_values (&vl);
+	}
+
+	if (!have_queues)
+		return;
+
+	sstrncpy (vl.type, "queue_length", sizeof (vl.type));
+	vl.type_instance[0] = 0;
+	values[0].gauge = length;
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type, "derive", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "dropped", sizeof (vl.type_instance));
+	values[0].derive = dropped;
+	plugin_dispatch_values (&vl);
+
+	/* Delay in seconds between dispatching a notification and passing it
+	 * to the callbacks, during the last interval. */
+	sstrncpy (vl.type, "delay", sizeof (vl.type));
+	sstrncpy (vl.type_instance, "average", sizeof (vl.type_instance));
+	values[0].gauge = (delay_num > 0)
+		? CDTIME_T_TO_DOUBLE (delay_sum) / ((double) delay_num) : NAN;
+	plugin_dispatch_values (&vl);
+
+	sstrncpy (vl.type_instance, "maximum", sizeof (vl.type_instance));
+	values[0].gauge = (delay_num > 0) ? CDTIME_T_TO_DOUBLE (delay_max) : NAN;
+	plugin_dispatch_values (&vl);
+} /* }}} void notif_queue_submit_stats */
+
+void notif_queue_destroy (void) /* {{{ */
+{
+	pthread_mutex_lock (&notif_recent_lock);
+	if (notif_recent != NULL)
+	{
+		char *key;
+		cdtime_t *first;
+
+		while (c_hashtable_pick (notif_recent, (void *) &key,
+					(void *) &first) == 0)
+		{
+			sfree (key);
+			sfree (first);
+		}
+		c_hashtable_destroy (notif_recent);
+		notif_recent = NULL;
+	}
+	pthread_mutex_unlock (&notif_recent_lock);
+} /* }}} void notif_queue_destroy */
+
+int notif_queue_dispatch (const notification_t *n) /* {{{ */
+{
+	if (notif_queue_coalesce (n))
+		return (0);
+
+	return (notif_queue_enqueue (n));
+} /* }}} int notif_queue_dispatch */
@@ -0,0 +1,62 @@
+/**
+ * collectd - src/utils_notif_queue.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_NOTIF_QUEUE_H
+#define UTILS_NOTIF_QUEUE_H 1
+
+#include "plugin.h"
+
+/*
+ * Notification queues and coalescing
+ *
+ * Notifications are handed to one or more threads, which pass them on to the
+ * notification callbacks, so a slow callback doesn't delay the thread
+ * dispatching the notification. Notifications are assigned to a thread by
+ * their identifier, so those of one identifier are passed on in order. If a
+ * queue is full, new notifications are dropped.
+ *
+ * Independently of the queues, notifications with the same identifier and
+ * severity as one passed on within the coalescing interval can be dropped.
+ */
+
+typedef void (*notif_queue_callback_t) (const notification_t *n);
+
+/* Enables coalescing if `coalesce_interval' is greater than zero, and starts
+ * `threads' threads with queues of `limit' notifications each, which pass
+ * notifications to `callback', if `limit' is greater than zero. Calling it
+ * again doesn't change queues which are already running. */
+void notif_queue_start (cdtime_t coalesce_interval, int limit, int threads,
+		notif_queue_callback_t callback);
+
+/* Passes on the queued notifications and stops the threads. Coalescing
+ * continues until `notif_queue_destroy' is called. */
+void notif_queue_stop (void);
+
+/* Frees the coalescing state. */
+void notif_queue_destroy (void);
+
+/* Hands `n' to a queue or drops it if it is coalesced. Returns non-zero if
+ * the queues are not running, in which case the caller has to pass the
+ * notification on itself. */
+int notif_queue_dispatch (const notification_t *n);
+
+/* Dispatches the length, drops and delay of the queues and the number of
+ * coalesced notifications, if queues or coalescing are enabled. */
+void notif_queue_submit_stats (void);
+
+#endif /* UTILS_NOTIF_QUEUE_H */
@@ -0,0 +1,319 @@
+/**
+ * collectd - src/utils_pipeline.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_hashtable.h"
+#include "utils_pipeline.h"
+#include "utils_stats.h"
+
+#include <pthread.h>
+
+/* Latencies of the value lists passing through the daemon, see
+ * `PipelineTracing'. The first stages are those of the dispatch, kept in
+ * `pipeline_global'; the others are kept per writer, under the writer's
+ * name, until the daemon exits. Each stage ends at one of the time stamps of
+ * `vl_trace_t', when the writer is called or when it returns. */
+enum pipeline_stage_e
+{
+	/* From the origin to the dispatch of a received value list. */
+	PS_NETWORK = 0,
+	/* The pre-cache chain. */
+	PS_PRE_CACHE,
+	/* Updating the cache. */
+	PS_CACHE,
+	/* From the cache update to the writer being called: the post-cache
+	 * chain, writers called before it and the write queue. */
+	PS_QUEUE,
+	/* The write callback. */
+	PS_WRITE,
+	/* From the cache update until the batch containing the value list has
+	 * been written, for batch writers. */
+	PS_BATCH,
+	/* From the origin until the value list has been written. */
+	PS_AGE,
+	PS_NUM
+};
+
+struct pipeline_stats_s
+{
+	/* "pipeline" or "pipeline-<writer>" */
+	char name[DATA_MAX_NAME_LEN];
+	stats_histogram_t stages[PS_NUM];
+};
+
+_Bool pipeline_trace_enabled = 0;
+
+/* Protects `pipeline_stats'; the histograms are only updated atomically. */
+static pthread_mutex_t   pipeline_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static c_hashtable_t    *pipeline_stats = NULL;
+static pipeline_stats_t *pipeline_global = NULL;
+
+/* Returns the statistics kept under `name', creating them if necessary. */
+static pipeline_stats_t *pipeline_stats_get (const char *name) /* {{{ */
+{
+	pipeline_stats_t *ps = NULL;
+
+	pthread_mutex_lock (&pipeline_stats_lock);
+	if (pipeline_stats == NULL)
+		pipeline_stats = c_hashtable_create (c_hashtable_hash_string,
+				(int (*) (const void *, const void *)) strcmp);
+
+	if ((pipeline_stats != NULL)
+			&& (c_hashtable_get (pipeline_stats, name, (void *) &ps) != 0))
+	{
+		ps = calloc (1, sizeof (*ps));
+		if (ps != NULL)
+		{
+			sstrncpy (ps->name, name, sizeof (ps->name));
+			if (c_hashtable_insert (pipeline_stats, ps->name, ps) != 0)
+				sfree (ps);
+		}
+	}
+	pthread_mutex_unlock (&pipeline_stats_lock);
+
+	return (ps);
+} /* }}} pipeline_stats_t *pipeline_stats_get */
+
+/* Returns the statistics of the writer `name', caching them in `*cache'. */
+static pipeline_stats_t *pipeline_stats_writer ( /* {{{ */
+		pipeline_stats_t **cache, const char *name)
+{
+	char key[DATA_MAX_NAME_LEN];
+
+	if (*cache != NULL)
+		return (*cache);
+
+	ssnprintf (key, sizeof (key), "pipeline-%s", name);
+
+	/* All threads store the same pointer. */
+	*cache = pipeline_stats_get (key);
+	return (*cache);
+} /* }}} pipeline_stats_t *pipeline_stats_writer */
+
+/* Records the time from `start' to `end'. Nothing is recorded if `start' is
+ * unknown. */
+static void pipeline_stage_add (pipeline_stats_t *ps, /* {{{ */
+		int stage, cdtime_t start, cdtime_t end)
+{
+	uint64_t ns;
+
+	if ((ps == NULL) || (start == 0))
+		return;
+
+	/* The origin may have been taken by another host's clock. */
+	ns = (end > start) ? (uint64_t) CDTIME_T_TO_NS (end - start) : 0;
+	stats_histogram_add (ps->stages + stage, ns);
+} /* }}} void pipeline_stage_add */
+
+/* Called when `vl' is dispatched. Value lists received from another daemon
+ * keep the origin it sent along. */
+void pipeline_trace_dispatch (value_list_t *vl) /* {{{ */
+{
+	cdtime_t now = cdtime ();
+
+	if ((vl->flags & VL_FLAG_RECEIVED) && (vl->trace.origin != 0))
+		pipeline_stage_add (pipeline_global, PS_NETWORK,
+				vl->trace.origin, now);
+	else
+		vl->trace.origin = now;
+
+	vl->trace.dispatched = now;
+	vl->trace.pre_cache = 0;
+	vl->trace.cached = 0;
+} /* }}} void pipeline_trace_dispatch */
+
+void pipeline_trace_pre_cache (value_list_t *vl, cdtime_t now) /* {{{ */
+{
+	vl->trace.pre_cache = now;
+	pipeline_stage_add (pipeline_global, PS_PRE_CACHE,
+			vl->trace.dispatched, now);
+} /* }}} void pipeline_trace_pre_cache */
+
+void pipeline_trace_cached (value_list_t *vl, cdtime_t now) /* {{{ */
+{
+	vl->trace.cached = now;
+	pipeline_stage_add (pipeline_global, PS_CACHE,
+			vl->trace.pre_cache, now);
+} /* }}} void pipeline_trace_cached */
+
+void pipeline_trace_write (pipeline_stats_t **cache, /* {{{ */
+		const char *name, _Bool batch, const value_list_t *vl,
+		cdtime_t entry)
+{
+	pipeline_stats_t *ps;
+	cdtime_t now;
+
+	if (vl->trace.cached == 0)
+		return;
+
+	ps = pipeline_stats_writer (cache, name);
+	if (ps == NULL)
+		return;
+
+	now = cdtime ();
+	pipeline_stage_add (ps, PS_QUEUE, vl->trace.cached, entry);
+	pipeline_stage_add (ps, PS_WRITE, entry, now);
+	if (!batch)
+		pipeline_stage_add (ps, PS_AGE, vl->trace.origin, now);
+} /* }}} void pipeline_trace_write */
+
+void pipeline_trace_batch (pipeline_stats_t **cache, /* {{{ */
+		const char *name, const value_list_t **vl, size_t num)
+{
+	pipeline_stats_t *ps;
+	cdtime_t now;
+	size_t i;
+
+	ps = pipeline_stats_writer (cache, name);
+	if (ps == NULL)
+		return;
+
+	now = cdtime ();
+	for (i = 0; i < num; i++)
+	{
+		if (vl[i]->trace.cached == 0)
+			continue;
+
+		pipeline_stage_add (ps, PS_BATCH, vl[i]->trace.cached, now);
+		pipeline_stage_add (ps, PS_AGE, vl[i]->trace.origin, now);
+	}
+} /* }}} void pipeline_trace_batch */
+
+void pipeline_trace_submit (void) /* {{{ */
+{
+	static const char *stage_names[PS_NUM] = { "network", "pre_cache",
+		"cache", "queue", "write", "batch", "age" };
+	value_list_t vl = VALUE_LIST_INIT;
+	value_t values[1];
+	pipeline_stats_t **list = NULL;
+	c_hashtable_iterator_t *iter;
+	pipeline_stats_t *ps;
+	char *key;
+	size_t num;
+	size_t i;
+	int j;
+
+	/* The statistics are never freed before shutdown, so only the list
+	 * is copied while holding the lock. */
+	pthread_mutex_lock (&pipeline_stats_lock);
+	num = (size_t) c_hashtable_size (pipeline_stats);
+	if (num > 0)
+		list = calloc (num, sizeof (*list));
+	iter = c_hashtable_get_iterator (pipeline_stats);
+	if ((list == NULL) || (iter == NULL))
+	{
+		pthread_mutex_unlock (&pipeline_stats_lock);
+		c_hashtable_iterator_destroy (iter);
+		sfree (list);
+		return;
+	}
+
+	i = 0;
+	while ((i < num)
+			&& (c_hashtable_iterator_next (iter, (void *) &key,
+					(void *) &ps) == 0))
+		list[i++] = ps;
+	num = i;
+	c_hashtable_iterator_destroy (iter);
+	pthread_mutex_unlock (&pipeline_stats_lock);
+
+	vl.values = values;
+	vl.values_len = 1;
+	sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+	sstrncpy (vl.plugin, "collectd", sizeof (vl.plugin));
+
+	for (i = 0; i < num; i++)
+	{
+		sstrncpy (vl.plugin_instance, list[i]->name,
+				sizeof (vl.plugin_instance));
+
+		for (j = 0; j < PS_NUM; j++)
+		{
+			stats_histogram_t *h = list[i]->stages + j;
+			uint64_t counts[STATS_HISTOGRAM_BUCKETS];
+			uint64_t total = 0;
+			uint64_t max;
+			size_t k;
+
+			for (k = 0; k < STATS_HISTOGRAM_BUCKETS; k++)
+			{
+				counts[k] = stats_counter_get (h->buckets + k);
+				total += counts[k];
+			}
+			max = stats_max_reset (&h->max_ns, 0);
+
+			/* Stages which don't apply are left out. */
+			if (total == 0)
+				continue;
+
+			sstrncpy (vl.type, "total_values", sizeof (vl.type));
+			for (k = 0; k < STATS_HISTOGRAM_BUCKETS; k++)
+			{
+				ssnprintf (vl.type_instance,
+						sizeof (vl.type_instance), "%s-%s",
+						stage_names[j],
+						stats_histogram_bucket_name (k));
+				values[0].derive = (derive_t) counts[k];
+				plugin_dispatch_values (&vl);
+			}
+
+			sstrncpy (vl.type, "total_time_in_ns", sizeof (vl.type));
+			sstrncpy (vl.type_instance, stage_names[j],
+					sizeof (vl.type_instance));
+			values[0].derive = (derive_t) stats_counter_get (&h->sum_ns);
+			plugin_dispatch_values (&vl);
+
+			sstrncpy (vl.type, "response_time", sizeof (vl.type));
+			ssnprintf (vl.type_instance, sizeof (vl.type_instance),
+					"%s-max", stage_names[j]);
+			values[0].gauge = ((gauge_t) max) / 1000000000.0;
+			plugin_dispatch_values (&vl);
+		}
+	}
+
+	sfree (list);
+} /* }}} void pipeline_trace_submit */
+
+void pipeline_trace_destroy (void) /* {{{ */
+{
+	char *key;
+	pipeline_stats_t *ps;
+
+	pipeline_trace_enabled = 0;
+
+	pthread_mutex_lock (&pipeline_stats_lock);
+	while (c_hashtable_pick (pipeline_stats, (void *) &key,
+				(void *) &ps) == 0)
+		sfree (ps);
+	c_hashtable_destroy (pipeline_stats);
+	pipeline_stats = NULL;
+	pipeline_global = NULL;
+	pthread_mutex_unlock (&pipeline_stats_lock);
+} /* }}} void pipeline_trace_destroy */
+
+int pipeline_trace_init (void) /* {{{ */
+{
+	pipeline_global = pipeline_stats_get ("pipeline");
+	if (pipeline_global == NULL)
+		return (-1);
+
+	pipeline_trace_enabled = 1;
+	return (0);
+} /* }}} int pipeline_trace_init */
@@ -0,0 +1,68 @@
+/**
+ * collectd - src/utils_pipeline.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_PIPELINE_H
+#define UTILS_PIPELINE_H 1
+
+#include "plugin.h"
+
+/*
+ * Pipeline tracing
+ *
+ * Records histograms of the latencies of the value lists passing through the
+ * daemon, see `PipelineTracing', using the time stamps in `vl->trace'. The
+ * stages of the dispatch are kept once for the daemon, the stages of writing
+ * once per writer. Callers check `pipeline_trace_enabled' before calling any
+ * of the pipeline_trace_* functions.
+ */
+
+struct pipeline_stats_s;
+typedef struct pipeline_stats_s pipeline_stats_t;
+
+/* Set by `pipeline_trace_init', cleared by `pipeline_trace_destroy'. */
+extern _Bool pipeline_trace_enabled;
+
+/* Enables tracing. Returns zero on success. */
+int pipeline_trace_init (void);
+
+/* Submits the histograms of all stages which have seen values. Called once
+ * per interval. */
+void pipeline_trace_submit (void);
+
+/* Disables tracing and frees the statistics. */
+void pipeline_trace_destroy (void);
+
+/* Called when `vl' is dispatched, before and after it updates the cache. */
+void pipeline_trace_dispatch (value_list_t *vl);
+void pipeline_trace_pre_cache (value_list_t *vl, cdtime_t now);
+void pipeline_trace_cached (value_list_t *vl, cdtime_t now);
+
+/* Records `vl' having been written by the writer `name', which was called at
+ * `entry'. The writer's statistics are looked up once and cached in
+ * `*cache'. The age of the values of batch writers, for which `batch' is
+ * true, is recorded by `pipeline_trace_batch' instead. Value lists which
+ * have not been dispatched, e.g. because they are written with
+ * `plugin_write' directly, are ignored. */
+void pipeline_trace_write (pipeline_stats_t **cache, const char *name,
+		_Bool batch, const value_list_t *vl, cdtime_t entry);
+
+/* Records `num' value lists having been written by the batch writer `name'. */
+void pipeline_trace_batch (pipeline_stats_t **cache, const char *name,
+		const value_list_t **vl, size_t num);
+
+#endif /* UTILS_PIPELINE_H */
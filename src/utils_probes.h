@@ -0,0 +1,79 @@
+/**
+ * collectd - src/utils_probes.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_PROBES_H
+#define UTILS_PROBES_H 1
+
+/*
+ * Static tracepoints ("USDT probes") in the provider `collectd', for use with
+ * SystemTap, bpftrace, perf and similar tools. They are only compiled in if
+ * configure was called with `--enable-usdt'; otherwise the macros expand to
+ * nothing and their arguments are not evaluated.
+ *
+ * An inactive probe is a single "nop" instruction, but the arguments are
+ * still computed. Keep them cheap: pointers to strings which exist anyway and
+ * integers. Durations are passed in nanoseconds, measured with
+ * `CD_PROBE_START' and `CD_PROBE_NS', which read the clock only in builds with
+ * probes.
+ *
+ * Probes:
+ *   dispatch__entry   (identifier, plugin)
+ *   dispatch__return  (identifier, plugin, duration_ns, status)
+ *   cache__update     (identifier, status)
+ *   write__callback   (callback, plugin, duration_ns, status)
+ *   filter__chain     (chain, plugin, duration_ns, status)
+ *   network__packet   (size, flags, duration_ns, status)
+ *   rrdtool__dequeue  (filename, queue_length)
+ *   rrdtool__update   (filename, values_num, duration_ns, status)
+ */
+
+#if defined(COLLECT_USDT) && COLLECT_USDT && HAVE_SYS_SDT_H
+# include <sys/sdt.h>
+# include "utils_time.h"
+
+# define CD_PROBE_ENABLED 1
+
+# define CD_PROBE_START() cdtime_monotonic ()
+# define CD_PROBE_NS(start) \
+	((long) CDTIME_T_TO_NS (cdtime_monotonic () - (start)))
+
+# define CD_PROBE2(name, a, b) \
+	DTRACE_PROBE2 (collectd, name, a, b)
+# define CD_PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4 (collectd, name, a, b, c, d)
+
+#else /* ! COLLECT_USDT */
+
+# define CD_PROBE_ENABLED 0
+
+# define CD_PROBE_START() ((cdtime_t) 0)
+# define CD_PROBE_NS(start) ((long) (start))
+
+/* The arguments are referenced, so that variables only used by probes don't
+ * cause warnings, but never evaluated. */
+# define CD_PROBE2(name, a, b) do { \
+	if (0) { (void) (a); (void) (b); } \
+} while (0)
+# define CD_PROBE4(name, a, b, c, d) do { \
+	if (0) { (void) (a); (void) (b); (void) (c); (void) (d); } \
+} while (0)
+
+#endif /* ! COLLECT_USDT */
+
+#endif /* UTILS_PROBES_H */
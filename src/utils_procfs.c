@@ -0,0 +1,366 @@
+/**
+ * collectd - src/utils_procfs.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_procfs.h"
+
+#include <pthread.h>
+
+#define PROCFS_BUFFER_SIZE 4096
+
+/* The copy of a file shared by all handles with a maximum age. */
+struct procfs_shared_s;
+typedef struct procfs_shared_s procfs_shared_t;
+struct procfs_shared_s
+{
+	char *path;
+	int fd;
+	int refcount;
+
+	pthread_mutex_t lock;
+	char *buffer;
+	size_t buffer_size;
+	size_t length;
+	cdtime_t time;
+
+	procfs_shared_t *next;
+};
+
+struct procfs_file_s
+{
+	char *path;
+	/* -1 if the file is shared. */
+	int fd;
+	procfs_shared_t *shared;
+	cdtime_t max_age;
+
+	char *buffer;
+	size_t buffer_size;
+};
+
+static procfs_shared_t *shared_list = NULL;
+static pthread_mutex_t shared_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int procfs_fd_open (const char *path) /* {{{ */
+{
+	int fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+	{
+		char errbuf[1024];
+		ERROR ("utils_procfs: open (%s) failed: %s", path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	/* The descriptors are kept open: don't leak them to `exec'ed
+	 * programs. */
+	fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+	return (fd);
+} /* }}} int procfs_fd_open */
+
+/* Reads the whole file into `*buffer', growing it as necessary, and
+ * terminates it with a null byte. Returns the length or -1 on error. */
+static ssize_t procfs_fd_read (int fd, const char *path, /* {{{ */
+		char **buffer, size_t *buffer_size)
+{
+	size_t fill = 0;
+
+	while (42)
+	{
+		ssize_t status;
+
+		if ((*buffer == NULL) || (fill + 1 >= *buffer_size))
+		{
+			size_t new_size = (*buffer == NULL)
+				? PROCFS_BUFFER_SIZE : 2 * (*buffer_size);
+			char *tmp;
+
+			tmp = realloc (*buffer, new_size);
+			if (tmp == NULL)
+			{
+				ERROR ("utils_procfs: realloc failed.");
+				return (-1);
+			}
+			*buffer = tmp;
+			*buffer_size = new_size;
+		}
+
+		/* Reading from offset zero makes the kernel generate the
+		 * contents afresh, without seeking first. */
+		status = pread (fd, *buffer + fill, *buffer_size - fill - 1,
+				(off_t) fill);
+		if (status < 0)
+		{
+			char errbuf[1024];
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("utils_procfs: pread (%s) failed: %s", path,
+					sstrerror (errno, errbuf, sizeof (errbuf)));
+			return (-1);
+		}
+		else if (status == 0)
+			break;
+
+		fill += (size_t) status;
+	}
+
+	(*buffer)[fill] = 0;
+	return ((ssize_t) fill);
+} /* }}} ssize_t procfs_fd_read */
+
+static int procfs_buffer_reserve (procfs_file_t *f, size_t size) /* {{{ */
+{
+	char *tmp;
+
+	if (f->buffer_size >= size)
+		return (0);
+
+	tmp = realloc (f->buffer, size);
+	if (tmp == NULL)
+	{
+		ERROR ("utils_procfs: realloc failed.");
+		return (-1);
+	}
+	f->buffer = tmp;
+	f->buffer_size = size;
+
+	return (0);
+} /* }}} int procfs_buffer_reserve */
+
+static procfs_shared_t *procfs_shared_get (const char *path) /* {{{ */
+{
+	procfs_shared_t *s;
+
+	pthread_mutex_lock (&shared_list_lock);
+
+	for (s = shared_list; s != NULL; s = s->next)
+		if (strcmp (path, s->path) == 0)
+			break;
+
+	if (s != NULL)
+	{
+		s->refcount++;
+		pthread_mutex_unlock (&shared_list_lock);
+		return (s);
+	}
+
+	s = calloc (1, sizeof (*s));
+	if (s == NULL)
+	{
+		pthread_mutex_unlock (&shared_list_lock);
+		ERROR ("utils_procfs: calloc failed.");
+		return (NULL);
+	}
+
+	s->path = strdup (path);
+	s->fd = procfs_fd_open (path);
+	if ((s->path == NULL) || (s->fd < 0))
+	{
+		pthread_mutex_unlock (&shared_list_lock);
+		if (s->fd >= 0)
+			close (s->fd);
+		sfree (s->path);
+		sfree (s);
+		return (NULL);
+	}
+	s->refcount = 1;
+	pthread_mutex_init (&s->lock, /* attr = */ NULL);
+
+	s->next = shared_list;
+	shared_list = s;
+
+	pthread_mutex_unlock (&shared_list_lock);
+	return (s);
+} /* }}} procfs_shared_t *procfs_shared_get */
+
+static void procfs_shared_release (procfs_shared_t *s) /* {{{ */
+{
+	procfs_shared_t *prev;
+	procfs_shared_t *ptr;
+
+	pthread_mutex_lock (&shared_list_lock);
+
+	s->refcount--;
+	if (s->refcount > 0)
+	{
+		pthread_mutex_unlock (&shared_list_lock);
+		return;
+	}
+
+	prev = NULL;
+	for (ptr = shared_list; ptr != NULL; prev = ptr, ptr = ptr->next)
+		if (ptr == s)
+			break;
+
+	if (ptr != NULL)
+	{
+		if (prev == NULL)
+			shared_list = s->next;
+		else
+			prev->next = s->next;
+	}
+
+	pthread_mutex_unlock (&shared_list_lock);
+
+	close (s->fd);
+	pthread_mutex_destroy (&s->lock);
+	sfree (s->buffer);
+	sfree (s->path);
+	sfree (s);
+} /* }}} void procfs_shared_release */
+
+procfs_file_t *procfs_open (const char *path, cdtime_t max_age) /* {{{ */
+{
+	procfs_file_t *f;
+
+	if (path == NULL)
+		return (NULL);
+
+	f = calloc (1, sizeof (*f));
+	if (f == NULL)
+	{
+		ERROR ("utils_procfs: calloc failed.");
+		return (NULL);
+	}
+	f->fd = -1;
+	f->max_age = max_age;
+
+	f->path = strdup (path);
+	if (f->path == NULL)
+	{
+		ERROR ("utils_procfs: strdup failed.");
+		sfree (f);
+		return (NULL);
+	}
+
+	if (max_age > 0)
+		f->shared = procfs_shared_get (path);
+	else
+		f->fd = procfs_fd_open (path);
+
+	if ((f->shared == NULL) && (f->fd < 0))
+	{
+		sfree (f->path);
+		sfree (f);
+		return (NULL);
+	}
+
+	return (f);
+} /* }}} procfs_file_t *procfs_open */
+
+void procfs_close (procfs_file_t *f) /* {{{ */
+{
+	if (f == NULL)
+		return;
+
+	if (f->shared != NULL)
+		procfs_shared_release (f->shared);
+	if (f->fd >= 0)
+		close (f->fd);
+
+	sfree (f->buffer);
+	sfree (f->path);
+	sfree (f);
+} /* }}} void procfs_close */
+
+char *procfs_read (procfs_file_t *f, cdtime_t *ret_time) /* {{{ */
+{
+	procfs_shared_t *s;
+	cdtime_t now;
+
+	if (f == NULL)
+		return (NULL);
+
+	if (f->shared == NULL)
+	{
+		if (procfs_fd_read (f->fd, f->path,
+					&f->buffer, &f->buffer_size) < 0)
+			return (NULL);
+
+		if (ret_time != NULL)
+			*ret_time = cdtime ();
+		return (f->buffer);
+	}
+
+	s = f->shared;
+	pthread_mutex_lock (&s->lock);
+
+	now = cdtime ();
+	if ((s->time == 0) || (now < s->time) || ((now - s->time) > f->max_age))
+	{
+		ssize_t status;
+
+		status = procfs_fd_read (s->fd, s->path,
+				&s->buffer, &s->buffer_size);
+		if (status < 0)
+		{
+			s->time = 0;
+			pthread_mutex_unlock (&s->lock);
+			return (NULL);
+		}
+		s->length = (size_t) status;
+		s->time = now;
+	}
+
+	/* The shared copy may not be modified, so the caller gets a copy of
+	 * it. That is much cheaper than reading the file again. */
+	if (procfs_buffer_reserve (f, s->length + 1) != 0)
+	{
+		pthread_mutex_unlock (&s->lock);
+		return (NULL);
+	}
+	memcpy (f->buffer, s->buffer, s->length + 1);
+
+	if (ret_time != NULL)
+		*ret_time = s->time;
+
+	pthread_mutex_unlock (&s->lock);
+	return (f->buffer);
+} /* }}} char *procfs_read */
+
+char *procfs_next_line (char **ptr) /* {{{ */
+{
+	char *line;
+	char *end;
+
+	if ((ptr == NULL) || (*ptr == NULL) || (**ptr == 0))
+		return (NULL);
+
+	line = *ptr;
+	end = strchr (line, '\n');
+	if (end == NULL)
+	{
+		*ptr = line + strlen (line);
+	}
+	else
+	{
+		*end = 0;
+		*ptr = end + 1;
+	}
+
+	return (line);
+} /* }}} char *procfs_next_line */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
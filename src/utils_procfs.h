@@ -0,0 +1,59 @@
+/**
+ * collectd - src/utils_procfs.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_PROCFS_H
+#define UTILS_PROCFS_H 1
+
+#include "utils_time.h"
+
+/*
+ * Reader for files in /proc
+ *
+ * Files are opened once by `procfs_open' and re-read from the start into a
+ * buffer, which is kept between reads, by `procfs_read'. The lines of the
+ * buffer are walked in place with `procfs_next_line' and can be split with
+ * `strsplit', so nothing is copied per line.
+ *
+ * Files which several plugins read, such as /proc/stat, are opened with a
+ * non-zero maximum age. All such handles of the same file share one copy of
+ * its contents, which is read again only once it is older than the maximum
+ * age of the reading handle, so the plugins of one read cycle read the file
+ * once. Such plugins should use the time returned by `procfs_read' as the
+ * time of their values.
+ */
+
+struct procfs_file_s;
+typedef struct procfs_file_s procfs_file_t;
+
+/* Opens `path'. If `max_age' is zero, every `procfs_read' reads the file.
+ * Returns NULL on error. */
+procfs_file_t *procfs_open (const char *path, cdtime_t max_age);
+void procfs_close (procfs_file_t *f);
+
+/* Returns the contents of the file, terminated by a null byte, and stores the
+ * time they were read in `ret_time' unless it is NULL. The buffer belongs to
+ * `f'. It may be modified, but only until the next call. Returns NULL on
+ * error. */
+char *procfs_read (procfs_file_t *f, cdtime_t *ret_time);
+
+/* Returns the line starting at `*ptr', terminated by a null byte instead of
+ * the newline, and advances `*ptr' to the next line. Returns NULL at the end
+ * of the buffer. */
+char *procfs_next_line (char **ptr);
+
+#endif /* UTILS_PROCFS_H */
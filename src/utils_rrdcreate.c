@@ -19,13 +19,74 @@
  *   Florian octo Forster <octo at verplant.org>
  **/
 
+#define _GNU_SOURCE /* For copy_file_range */
+
 #include "collectd.h"
 #include "common.h"
+#include "utils_avltree.h"
 #include "utils_rrdcreate.h"
 
 #include <pthread.h>
 #include <rrd.h>
 
+/* Cloning files requires knowing their layout, see `rrd_header_read'. */
+#if HAVE_RRD_FORMAT_H
+# include <rrd_format.h>
+# define CU_RRD_CLONE 1
+#else
+# define CU_RRD_CLONE 0
+#endif
+
+#if HAVE_LINUX_FS_H
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+#endif
+
+/*
+ * Private types
+ */
+/* The DS and RRA definitions of a file only depend on its type and interval,
+ * so they are built once and then reused for every file with the same type
+ * and interval. Templates are never modified once they're in the cache and
+ * are kept until the process exits.
+ *
+ * If `template_dir' is set, the first file created for a template is also
+ * copied to `clone_file' before any value is written to it. Later files are
+ * then cloned from that empty file and only the header, which depends on the
+ * time of the last update, is rewritten. This is much cheaper than having
+ * librrd compute and write every row again. The `clone_*' members are
+ * protected by `template_lock'; `clone_header' is not modified once
+ * `clone_state' is CLONE_READY. */
+#define CLONE_NONE     0
+#define CLONE_CREATING 1
+#define CLONE_READY    2
+#define CLONE_FAILED   3
+
+struct rrd_template_s
+{
+  unsigned long stepsize;
+  int argc;
+  char **argv;
+
+  int clone_state;
+  char *clone_file;
+  char *clone_header;
+  size_t clone_header_size;
+};
+typedef struct rrd_template_s rrd_template_t;
+
+struct srrd_create_args_s
+{
+  char *filename;
+  time_t last_up;
+  rrd_template_t *template;
+  cu_rrd_create_callback_t callback;
+  struct srrd_create_args_s *next;
+};
+typedef struct srrd_create_args_s srrd_create_args_t;
+
+#define RRD_CREATE_THREADS_NUM 4
+
 /*
  * Private variables
  */
@@ -51,6 +112,17 @@ static int rra_types_num = STATIC_ARRAY_SIZE (rra_types);
 static pthread_mutex_t librrd_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+static c_avl_tree_t   *template_cache = NULL;
+static pthread_mutex_t template_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static srrd_create_args_t *async_head = NULL;
+static srrd_create_args_t *async_tail = NULL;
+static pthread_t       async_threads[RRD_CREATE_THREADS_NUM];
+static int             async_threads_num = 0;
+static int             async_shutdown = 0;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  async_cond = PTHREAD_COND_INITIALIZER;
+
 /*
  * Private functions
  */
@@ -359,68 +431,484 @@ static int srrd_create (const char *filename, /* {{{ */
 } /* }}} int srrd_create */
 #endif /* !HAVE_THREADSAFE_LIBRRD */
 
-/*
- * Public functions
- */
-int cu_rrd_create_file (const char *filename, /* {{{ */
-    const data_set_t *ds, const value_list_t *vl,
-    const rrdcreate_config_t *cfg)
+#if CU_RRD_CLONE
+/* Reads and checks the header of an RRD file created by `srrd_create'. Only
+ * files with consolidation functions whose state is set up from the time of
+ * the last update alone can be cloned, which are all that collectd uses. */
+static int rrd_header_read (const char *filename, /* {{{ */
+    char **ret_header, size_t *ret_header_size)
 {
-  char **argv;
-  int argc;
+  stat_head_t stat_head;
+  rra_def_t *rra_def;
+  char *header;
+  size_t header_size;
+  unsigned long i;
+  ssize_t status;
+  int fd;
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    return (-1);
+
+  status = pread (fd, &stat_head, sizeof (stat_head), 0);
+  if ((status != (ssize_t) sizeof (stat_head))
+      || (memcmp (stat_head.cookie, RRD_COOKIE, sizeof (RRD_COOKIE)) != 0)
+      || ((memcmp (stat_head.version, "0003", 5) != 0)
+        && (memcmp (stat_head.version, "0004", 5) != 0))
+      || (stat_head.float_cookie != FLOAT_COOKIE)
+      || (stat_head.ds_cnt < 1) || (stat_head.ds_cnt > 1024)
+      || (stat_head.rra_cnt < 1) || (stat_head.rra_cnt > 1024)
+      || (stat_head.pdp_step < 1))
+  {
+    close (fd);
+    return (-1);
+  }
+
+  header_size = sizeof (stat_head_t)
+    + stat_head.ds_cnt * sizeof (ds_def_t)
+    + stat_head.rra_cnt * sizeof (rra_def_t)
+    + sizeof (live_head_t)
+    + stat_head.ds_cnt * sizeof (pdp_prep_t)
+    + stat_head.rra_cnt * stat_head.ds_cnt * sizeof (cdp_prep_t)
+    + stat_head.rra_cnt * sizeof (rra_ptr_t);
+
+  header = malloc (header_size);
+  if (header == NULL)
+  {
+    close (fd);
+    return (-1);
+  }
+
+  status = pread (fd, header, header_size, 0);
+  close (fd);
+  if (status != (ssize_t) header_size)
+  {
+    sfree (header);
+    return (-1);
+  }
+
+  rra_def = (rra_def_t *) (header + sizeof (stat_head_t)
+      + stat_head.ds_cnt * sizeof (ds_def_t));
+  for (i = 0; i < stat_head.rra_cnt; i++)
+  {
+    if ((rra_def[i].pdp_cnt < 1)
+        || ((strcmp ("AVERAGE", rra_def[i].cf_nam) != 0)
+          && (strcmp ("MIN", rra_def[i].cf_nam) != 0)
+          && (strcmp ("MAX", rra_def[i].cf_nam) != 0)
+          && (strcmp ("LAST", rra_def[i].cf_nam) != 0)))
+    {
+      sfree (header);
+      return (-1);
+    }
+  }
+
+  *ret_header = header;
+  *ret_header_size = header_size;
+  return (0);
+} /* }}} int rrd_header_read */
+
+/* Sets the time of the last update in a copy of a header read by
+ * `rrd_header_read', together with the state derived from it, the same way
+ * `rrd_create' does. */
+static void rrd_header_set_last_up (char *header, time_t last_up) /* {{{ */
+{
+  stat_head_t *stat_head = (stat_head_t *) header;
+  rra_def_t *rra_def;
+  live_head_t *live_head;
+  pdp_prep_t *pdp_prep;
+  cdp_prep_t *cdp_prep;
+  unsigned long unkn_sec_cnt;
+  unsigned long i;
+  unsigned long j;
+
+  rra_def = (rra_def_t *) (header + sizeof (stat_head_t)
+      + stat_head->ds_cnt * sizeof (ds_def_t));
+  live_head = (live_head_t *) (rra_def + stat_head->rra_cnt);
+  pdp_prep = (pdp_prep_t *) (live_head + 1);
+  cdp_prep = (cdp_prep_t *) (pdp_prep + stat_head->ds_cnt);
+
+  live_head->last_up = last_up;
+  live_head->last_up_usec = 0;
+
+  unkn_sec_cnt = ((unsigned long) last_up) % stat_head->pdp_step;
+  for (i = 0; i < stat_head->ds_cnt; i++)
+    pdp_prep[i].scratch[PDP_unkn_sec_cnt].u_cnt = unkn_sec_cnt;
+
+  for (i = 0; i < stat_head->rra_cnt; i++)
+  {
+    unsigned long unkn_pdp_cnt;
+
+    unkn_pdp_cnt = ((((unsigned long) last_up) - unkn_sec_cnt)
+        % (stat_head->pdp_step * rra_def[i].pdp_cnt)) / stat_head->pdp_step;
+    for (j = 0; j < stat_head->ds_cnt; j++)
+      cdp_prep[(i * stat_head->ds_cnt) + j].scratch[CDP_unkn_pdp_cnt].u_cnt
+        = unkn_pdp_cnt;
+  }
+} /* }}} void rrd_header_set_last_up */
+
+/* Copies `src' to `dst', sharing the blocks if the file system supports it. */
+static int rrd_copy_file (const char *src, const char *dst) /* {{{ */
+{
+  struct stat statbuf;
+  char buffer[65536];
+  off_t offset = 0;
+  int fd_in;
+  int fd_out;
+
+  fd_in = open (src, O_RDONLY);
+  if (fd_in < 0)
+    return (-1);
+
+  fd_out = open (dst, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if ((fd_out < 0) || (fstat (fd_in, &statbuf) != 0))
+  {
+    if (fd_out >= 0)
+      close (fd_out);
+    close (fd_in);
+    return (-1);
+  }
+
+#ifdef FICLONE
+  if (ioctl (fd_out, FICLONE, fd_in) == 0)
+    offset = statbuf.st_size;
+#endif
+
+#if HAVE_COPY_FILE_RANGE
+  while (offset < statbuf.st_size)
+  {
+    ssize_t status;
+
+    status = copy_file_range (fd_in, NULL, fd_out, NULL,
+        (size_t) (statbuf.st_size - offset), /* flags = */ 0);
+    if (status <= 0)
+      break;
+    offset += status;
+  }
+#endif
+
+  /* Neither cloning nor copying in the kernel is supported, or only the start
+   * of the file has been copied. */
+  while (offset < statbuf.st_size)
+  {
+    ssize_t status;
+
+    status = pread (fd_in, buffer, sizeof (buffer), offset);
+    if ((status <= 0) || (swrite (fd_out, buffer, (size_t) status) != 0))
+      break;
+    offset += status;
+  }
+
+  close (fd_in);
+  if ((close (fd_out) != 0) || (offset < statbuf.st_size))
+  {
+    unlink (dst);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rrd_copy_file */
+
+static int rrd_clone (const rrd_template_t *t, /* {{{ */
+    const char *filename, time_t last_up)
+{
+  char *header;
+  ssize_t status;
+  int fd;
+
+  header = malloc (t->clone_header_size);
+  if (header == NULL)
+    return (-1);
+  memcpy (header, t->clone_header, t->clone_header_size);
+  rrd_header_set_last_up (header, last_up);
+
+  if (rrd_copy_file (t->clone_file, filename) != 0)
+  {
+    sfree (header);
+    return (-1);
+  }
+
+  fd = open (filename, O_WRONLY);
+  if (fd < 0)
+  {
+    sfree (header);
+    unlink (filename);
+    return (-1);
+  }
+
+  status = pwrite (fd, header, t->clone_header_size, 0);
+  sfree (header);
+  if ((close (fd) != 0) || (status != (ssize_t) t->clone_header_size))
+  {
+    unlink (filename);
+    return (-1);
+  }
+
+  return (0);
+} /* }}} int rrd_clone */
+
+/* Called by the thread that created the first file of a template. */
+static void rrd_template_store (rrd_template_t *t, /* {{{ */
+    const char *filename, int create_status)
+{
+  char *header = NULL;
+  size_t header_size = 0;
+  int state = CLONE_READY;
+
+  /* Creating this particular file may have failed for reasons unrelated to
+   * the template, so the next file tries again. */
+  if (create_status != 0)
+  {
+    pthread_mutex_lock (&template_lock);
+    t->clone_state = CLONE_NONE;
+    pthread_mutex_unlock (&template_lock);
+    return;
+  }
+
+  if ((check_create_dir (t->clone_file) != 0)
+      || (rrd_copy_file (filename, t->clone_file) != 0))
+  {
+    WARNING ("cu_rrd_create_file: Copying \"%s\" to \"%s\" failed. "
+        "Files of this type will not be cloned.", filename, t->clone_file);
+    state = CLONE_FAILED;
+  }
+  else if (rrd_header_read (t->clone_file, &header, &header_size) != 0)
+  {
+    WARNING ("cu_rrd_create_file: The layout of \"%s\" is not known. "
+        "Files of this type will not be cloned.", filename);
+    unlink (t->clone_file);
+    state = CLONE_FAILED;
+  }
+
+  pthread_mutex_lock (&template_lock);
+  t->clone_header = header;
+  t->clone_header_size = header_size;
+  t->clone_state = state;
+  pthread_mutex_unlock (&template_lock);
+} /* }}} void rrd_template_store */
+#endif /* CU_RRD_CLONE */
+
+/* Creates `filename' from the template, by cloning if possible. */
+static int rrd_template_create (rrd_template_t *t, /* {{{ */
+    const char *filename, time_t last_up)
+{
+  int status;
+#if CU_RRD_CLONE
+  int state = CLONE_FAILED;
+
+  pthread_mutex_lock (&template_lock);
+  if (t->clone_file != NULL)
+  {
+    state = t->clone_state;
+    if (state == CLONE_NONE)
+      t->clone_state = CLONE_CREATING;
+  }
+  pthread_mutex_unlock (&template_lock);
+
+  if (state == CLONE_READY)
+  {
+    if (rrd_clone (t, filename, last_up) == 0)
+      return (0);
+    WARNING ("cu_rrd_create_file: Cloning \"%s\" from \"%s\" failed. "
+        "Creating it with librrd instead.", filename, t->clone_file);
+  }
+#endif
+
+  status = srrd_create (filename, t->stepsize, last_up,
+      t->argc, (const char **) t->argv);
+
+#if CU_RRD_CLONE
+  if (state == CLONE_NONE)
+    rrd_template_store (t, filename, status);
+#endif
+
+  return (status);
+} /* }}} int rrd_template_create */
+
+static rrd_template_t *rrd_template_get (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl, const rrdcreate_config_t *cfg)
+{
+  rrd_template_t *t = NULL;
+  char key[DATA_MAX_NAME_LEN + 32];
+  char *key_copy;
   char **rra_def;
   int rra_num;
   char **ds_def;
   int ds_num;
-  int status = 0;
-  time_t last_up;
-  unsigned long stepsize;
 
-  if (check_create_dir (filename))
-    return (-1);
+  ssnprintf (key, sizeof (key), "%s/%.3f",
+      ds->type, CDTIME_T_TO_DOUBLE (vl->interval));
+
+  pthread_mutex_lock (&template_lock);
+
+  if (template_cache == NULL)
+  {
+    template_cache = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+    if (template_cache == NULL)
+    {
+      pthread_mutex_unlock (&template_lock);
+      ERROR ("cu_rrd_create_file failed: c_avl_create failed.");
+      return (NULL);
+    }
+  }
+
+  if (c_avl_get (template_cache, key, (void *) &t) == 0)
+  {
+    pthread_mutex_unlock (&template_lock);
+    return (t);
+  }
 
+  /* Building the template is cheap compared to creating the file, so we keep
+   * holding the lock. This way each template is only built once. */
   if ((rra_num = rra_get (&rra_def, vl, cfg)) < 1)
   {
+    pthread_mutex_unlock (&template_lock);
     ERROR ("cu_rrd_create_file failed: Could not calculate RRAs");
-    return (-1);
+    return (NULL);
   }
 
   if ((ds_num = ds_get (&ds_def, ds, vl, cfg)) < 1)
   {
+    pthread_mutex_unlock (&template_lock);
+    rra_free (rra_num, rra_def);
     ERROR ("cu_rrd_create_file failed: Could not calculate DSes");
-    return (-1);
+    return (NULL);
   }
 
-  argc = ds_num + rra_num;
+  t = malloc (sizeof (*t));
+  key_copy = strdup (key);
+  if (t != NULL)
+  {
+    memset (t, 0, sizeof (*t));
+    t->argv = (char **) malloc (sizeof (char *) * (ds_num + rra_num + 1));
+  }
+  if ((t != NULL) && (cfg->template_dir != NULL))
+  {
+    char clone_file[PATH_MAX];
 
-  if ((argv = (char **) malloc (sizeof (char *) * (argc + 1))) == NULL)
+    ssnprintf (clone_file, sizeof (clone_file), "%s/%s-%.3f.rrd",
+        cfg->template_dir, ds->type, CDTIME_T_TO_DOUBLE (vl->interval));
+    t->clone_file = strdup (clone_file);
+  }
+  if ((t == NULL) || (t->argv == NULL) || (key_copy == NULL)
+      || ((cfg->template_dir != NULL) && (t->clone_file == NULL)))
   {
     char errbuf[1024];
+
+    pthread_mutex_unlock (&template_lock);
     ERROR ("cu_rrd_create_file failed: %s",
         sstrerror (errno, errbuf, sizeof (errbuf)));
-    return (-1);
+
+    if (t != NULL)
+    {
+      sfree (t->argv);
+      sfree (t->clone_file);
+    }
+    sfree (t);
+    sfree (key_copy);
+    ds_free (ds_num, ds_def);
+    rra_free (rra_num, rra_def);
+    return (NULL);
   }
 
-  memcpy (argv, ds_def, ds_num * sizeof (char *));
-  memcpy (argv + ds_num, rra_def, rra_num * sizeof (char *));
-  argv[ds_num + rra_num] = NULL;
+  /* The strings are now owned by the template. */
+  t->argc = ds_num + rra_num;
+  memcpy (t->argv, ds_def, ds_num * sizeof (char *));
+  memcpy (t->argv + ds_num, rra_def, rra_num * sizeof (char *));
+  t->argv[t->argc] = NULL;
+  sfree (ds_def);
+  sfree (rra_def);
+
+  if (cfg->stepsize > 0)
+    t->stepsize = cfg->stepsize;
+  else
+    t->stepsize = (unsigned long) CDTIME_T_TO_TIME_T (vl->interval);
+
+  c_avl_insert (template_cache, key_copy, t);
+
+  pthread_mutex_unlock (&template_lock);
+  return (t);
+} /* }}} rrd_template_t *rrd_template_get */
+
+static time_t rrd_last_up (const value_list_t *vl) /* {{{ */
+{
+  time_t last_up;
 
   last_up = CDTIME_T_TO_TIME_T (vl->time);
   if (last_up <= 10)
     last_up = time (NULL);
   last_up -= 10;
 
-  if (cfg->stepsize > 0)
-    stepsize = cfg->stepsize;
-  else
-    stepsize = (unsigned long) CDTIME_T_TO_TIME_T (vl->interval);
+  return (last_up);
+} /* }}} time_t rrd_last_up */
+
+static void *srrd_create_thread (void __attribute__((unused)) *data) /* {{{ */
+{
+  while (42)
+  {
+    srrd_create_args_t *args;
+    int status;
+
+    pthread_mutex_lock (&async_lock);
+    while ((async_head == NULL) && (async_shutdown == 0))
+      pthread_cond_wait (&async_cond, &async_lock);
+
+    /* Shutting down and nothing left to do. */
+    if (async_head == NULL)
+    {
+      pthread_mutex_unlock (&async_lock);
+      break;
+    }
+
+    args = async_head;
+    async_head = args->next;
+    if (async_head == NULL)
+      async_tail = NULL;
+    pthread_mutex_unlock (&async_lock);
+
+    if (check_create_dir (args->filename) != 0)
+      status = -1;
+    else
+      status = rrd_template_create (args->template, args->filename,
+          args->last_up);
+
+    if (status != 0)
+    {
+      WARNING ("cu_rrd_create_file_async: srrd_create (%s) returned "
+          "status %i.", args->filename, status);
+    }
+    else
+    {
+      DEBUG ("cu_rrd_create_file_async: Successfully created RRD file "
+          "\"%s\".", args->filename);
+    }
+
+    (*args->callback) (args->filename, status);
+
+    sfree (args->filename);
+    sfree (args);
+  } /* while (42) */
+
+  return ((void *) 0);
+} /* }}} void *srrd_create_thread */
+
+/*
+ * Public functions
+ */
+int cu_rrd_create_file (const char *filename, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl,
+    const rrdcreate_config_t *cfg)
+{
+  rrd_template_t *t;
+  int status = 0;
+
+  if (check_create_dir (filename))
+    return (-1);
 
-  status = srrd_create (filename, stepsize, last_up,
-      argc, (const char **) argv);
+  t = rrd_template_get (ds, vl, cfg);
+  if (t == NULL)
+    return (-1);
 
-  free (argv);
-  ds_free (ds_num, ds_def);
-  rra_free (rra_num, rra_def);
+  status = rrd_template_create (t, filename, rrd_last_up (vl));
 
   if (status != 0)
   {
@@ -436,4 +924,101 @@ int cu_rrd_create_file (const char *filename, /* {{{ */
   return (status);
 } /* }}} int cu_rrd_create_file */
 
+int cu_rrd_create_file_async (const char *filename, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl,
+    const rrdcreate_config_t *cfg,
+    cu_rrd_create_callback_t callback)
+{
+  srrd_create_args_t *args;
+  rrd_template_t *t;
+
+  if ((filename == NULL) || (callback == NULL))
+    return (-EINVAL);
+
+  t = rrd_template_get (ds, vl, cfg);
+  if (t == NULL)
+    return (-1);
+
+  args = malloc (sizeof (*args));
+  if (args == NULL)
+  {
+    ERROR ("cu_rrd_create_file_async: malloc failed.");
+    return (-ENOMEM);
+  }
+  memset (args, 0, sizeof (*args));
+
+  args->filename = strdup (filename);
+  if (args->filename == NULL)
+  {
+    ERROR ("cu_rrd_create_file_async: strdup failed.");
+    sfree (args);
+    return (-ENOMEM);
+  }
+  args->last_up = rrd_last_up (vl);
+  args->template = t;
+  args->callback = callback;
+  args->next = NULL;
+
+  pthread_mutex_lock (&async_lock);
+
+  if (async_shutdown != 0)
+  {
+    pthread_mutex_unlock (&async_lock);
+    sfree (args->filename);
+    sfree (args);
+    return (-1);
+  }
+
+  /* Start the creation threads when they're needed for the first time. */
+  while (async_threads_num < RRD_CREATE_THREADS_NUM)
+  {
+    int status;
+
+    status = pthread_create (async_threads + async_threads_num,
+        /* attr = */ NULL, srrd_create_thread, /* args = */ NULL);
+    if (status != 0)
+    {
+      ERROR ("cu_rrd_create_file_async: pthread_create failed "
+          "with status %i.", status);
+      break;
+    }
+    async_threads_num++;
+  }
+
+  if (async_threads_num == 0)
+  {
+    pthread_mutex_unlock (&async_lock);
+    sfree (args->filename);
+    sfree (args);
+    return (-1);
+  }
+
+  if (async_tail == NULL)
+    async_head = args;
+  else
+    async_tail->next = args;
+  async_tail = args;
+
+  pthread_cond_signal (&async_cond);
+  pthread_mutex_unlock (&async_lock);
+
+  return (0);
+} /* }}} int cu_rrd_create_file_async */
+
+int cu_rrd_create_shutdown (void) /* {{{ */
+{
+  int i;
+
+  pthread_mutex_lock (&async_lock);
+  async_shutdown = 1;
+  pthread_cond_broadcast (&async_cond);
+  pthread_mutex_unlock (&async_lock);
+
+  for (i = 0; i < async_threads_num; i++)
+    pthread_join (async_threads[i], NULL);
+  async_threads_num = 0;
+
+  return (0);
+} /* }}} int cu_rrd_create_shutdown */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
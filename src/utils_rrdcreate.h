@@ -38,13 +38,37 @@ struct rrdcreate_config_s
 
   char **consolidation_functions;
   size_t consolidation_functions_num;
+
+  _Bool async;
+
+  /* If not NULL, an empty copy of the first file created for each type and
+   * interval is kept in this directory and later files are cloned from it.
+   * Only used if the layout of RRD files is known, i.e. <rrd_format.h> is
+   * available. */
+  char *template_dir;
 };
 typedef struct rrdcreate_config_s rrdcreate_config_t;
 
+/* Called by `cu_rrd_create_file_async' when the file has been created
+ * (status == 0) or creating it failed (status != 0). The callback is called
+ * from one of the creation threads. */
+typedef void (*cu_rrd_create_callback_t) (const char *filename, int status);
+
 int cu_rrd_create_file (const char *filename,
     const data_set_t *ds, const value_list_t *vl,
     const rrdcreate_config_t *cfg);
 
+/* Queues the file for creation by a pool of creation threads and returns
+ * immediately. The callback is called exactly once if this function returns
+ * zero. */
+int cu_rrd_create_file_async (const char *filename,
+    const data_set_t *ds, const value_list_t *vl,
+    const rrdcreate_config_t *cfg,
+    cu_rrd_create_callback_t callback);
+
+/* Waits for all queued files to be created and stops the creation threads. */
+int cu_rrd_create_shutdown (void);
+
 #endif /* UTILS_RRDCREATE_H */
 
 /* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,406 @@
+/**
+ * collectd - src/utils_sampler.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_hashtable.h"
+#include "utils_sampler.h"
+#include "utils_thread.h"
+
+#include <pthread.h>
+
+struct sampler_series_s;
+typedef struct sampler_series_s sampler_series_t;
+struct sampler_series_s
+{
+	/* "<plugin instance>/<type instance>" */
+	char *key;
+	char plugin_instance[DATA_MAX_NAME_LEN];
+	char type_instance[DATA_MAX_NAME_LEN];
+
+	/* The samples since the last dispatch. All of them are kept, so the
+	 * percentile is exact; there are `interval / sample_interval' of them. */
+	gauge_t *values;
+	size_t values_num;
+	size_t values_size;
+
+	/* Used by `sampler_add_derive'. */
+	derive_t last_value;
+	cdtime_t last_time;
+	_Bool has_last;
+
+	/* Set by adding a sample, cleared by dispatching. */
+	_Bool updated;
+
+	sampler_series_t *next;
+};
+
+/* One series' statistics, as computed by `sampler_dispatch'. */
+struct sampler_stats_s
+{
+	char plugin_instance[DATA_MAX_NAME_LEN];
+	char type_instance[DATA_MAX_NAME_LEN];
+	gauge_t min;
+	gauge_t average;
+	gauge_t max;
+	gauge_t p99;
+};
+typedef struct sampler_stats_s sampler_stats_t;
+
+struct sampler_s
+{
+	cdtime_t interval;
+	sampler_cb callback;
+	void *user_data;
+
+	c_hashtable_t *series;
+	sampler_series_t *series_list;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	_Bool loop;
+};
+
+static int sampler_gauge_compare (const void *a, const void *b) /* {{{ */
+{
+	gauge_t g0 = *((const gauge_t *) a);
+	gauge_t g1 = *((const gauge_t *) b);
+
+	if (g0 < g1)
+		return (-1);
+	else if (g0 > g1)
+		return (1);
+	return (0);
+} /* }}} int sampler_gauge_compare */
+
+static void *sampler_thread (void *arg) /* {{{ */
+{
+	sampler_t *s = arg;
+	cdtime_t next = cdtime ();
+
+	pthread_mutex_lock (&s->lock);
+	while (s->loop)
+	{
+		cdtime_t now = cdtime ();
+
+		if (now < next)
+		{
+			struct timespec ts;
+
+			CDTIME_T_TO_TIMESPEC (next, &ts);
+			pthread_cond_timedwait (&s->cond, &s->lock, &ts);
+			continue;
+		}
+
+		(*s->callback) (s, now, s->user_data);
+
+		/* Stay on the grid of sample times, skipping the ones which
+		 * have been missed. */
+		next += s->interval;
+		now = cdtime ();
+		if (next <= now)
+			next += ((now - next) / s->interval + 1) * s->interval;
+	}
+	pthread_mutex_unlock (&s->lock);
+
+	return ((void *) 0);
+} /* }}} void *sampler_thread */
+
+static void sampler_series_free (sampler_series_t *ss) /* {{{ */
+{
+	if (ss == NULL)
+		return;
+
+	sfree (ss->key);
+	sfree (ss->values);
+	sfree (ss);
+} /* }}} void sampler_series_free */
+
+static sampler_series_t *sampler_series_get (sampler_t *s, /* {{{ */
+		const char *plugin_instance, const char *type_instance)
+{
+	sampler_series_t *ss = NULL;
+	char key[2 * DATA_MAX_NAME_LEN];
+
+	ssnprintf (key, sizeof (key), "%s/%s", plugin_instance, type_instance);
+	if (c_hashtable_get (s->series, key, (void *) &ss) == 0)
+		return (ss);
+
+	ss = calloc (1, sizeof (*ss));
+	if (ss == NULL)
+		return (NULL);
+
+	ss->key = strdup (key);
+	if (ss->key == NULL)
+	{
+		sfree (ss);
+		return (NULL);
+	}
+	sstrncpy (ss->plugin_instance, plugin_instance,
+			sizeof (ss->plugin_instance));
+	sstrncpy (ss->type_instance, type_instance, sizeof (ss->type_instance));
+
+	if (c_hashtable_insert (s->series, ss->key, ss) != 0)
+	{
+		sampler_series_free (ss);
+		return (NULL);
+	}
+
+	ss->next = s->series_list;
+	s->series_list = ss;
+
+	return (ss);
+} /* }}} sampler_series_t *sampler_series_get */
+
+sampler_t *sampler_create (const char *name, /* {{{ */
+		cdtime_t sample_interval, sampler_cb callback, void *user_data)
+{
+	sampler_t *s;
+	int status;
+
+	if ((sample_interval == 0) || (callback == NULL))
+		return (NULL);
+
+	s = calloc (1, sizeof (*s));
+	if (s == NULL)
+	{
+		ERROR ("sampler_create: calloc failed.");
+		return (NULL);
+	}
+
+	s->interval = sample_interval;
+	s->callback = callback;
+	s->user_data = user_data;
+
+	s->series = c_hashtable_create (c_hashtable_hash_string,
+			(void *) strcmp);
+	if (s->series == NULL)
+	{
+		ERROR ("sampler_create: c_hashtable_create failed.");
+		sfree (s);
+		return (NULL);
+	}
+
+	pthread_mutex_init (&s->lock, /* attr = */ NULL);
+	pthread_cond_init (&s->cond, /* attr = */ NULL);
+	s->loop = 1;
+
+	status = thread_create (&s->thread, /* attr = */ NULL, sampler_thread, s,
+			name, /* cpus = */ NULL);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("sampler_create: Starting the thread failed: %s",
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		pthread_cond_destroy (&s->cond);
+		pthread_mutex_destroy (&s->lock);
+		c_hashtable_destroy (s->series);
+		sfree (s);
+		return (NULL);
+	}
+
+	return (s);
+} /* }}} sampler_t *sampler_create */
+
+void sampler_destroy (sampler_t *s) /* {{{ */
+{
+	if (s == NULL)
+		return;
+
+	pthread_mutex_lock (&s->lock);
+	s->loop = 0;
+	pthread_cond_broadcast (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+	pthread_join (s->thread, /* retval = */ NULL);
+
+	while (s->series_list != NULL)
+	{
+		sampler_series_t *next = s->series_list->next;
+		sampler_series_free (s->series_list);
+		s->series_list = next;
+	}
+	c_hashtable_destroy (s->series);
+
+	pthread_cond_destroy (&s->cond);
+	pthread_mutex_destroy (&s->lock);
+	sfree (s);
+} /* }}} void sampler_destroy */
+
+int sampler_add (sampler_t *s, const char *plugin_instance, /* {{{ */
+		const char *type_instance, gauge_t value)
+{
+	sampler_series_t *ss;
+
+	ss = sampler_series_get (s, plugin_instance, type_instance);
+	if (ss == NULL)
+		return (-1);
+	ss->updated = 1;
+
+	if (isnan (value))
+		return (0);
+
+	if (ss->values_num >= ss->values_size)
+	{
+		size_t new_size = (ss->values_size == 0) ? 64 : 2 * ss->values_size;
+		gauge_t *tmp;
+
+		tmp = realloc (ss->values, new_size * sizeof (*tmp));
+		if (tmp == NULL)
+			return (-1);
+		ss->values = tmp;
+		ss->values_size = new_size;
+	}
+
+	ss->values[ss->values_num] = value;
+	ss->values_num++;
+
+	return (0);
+} /* }}} int sampler_add */
+
+int sampler_add_derive (sampler_t *s, const char *plugin_instance, /* {{{ */
+		const char *type_instance, derive_t value, cdtime_t now)
+{
+	sampler_series_t *ss;
+	gauge_t rate = NAN;
+
+	ss = sampler_series_get (s, plugin_instance, type_instance);
+	if (ss == NULL)
+		return (-1);
+
+	if (ss->has_last && (value >= ss->last_value) && (now > ss->last_time))
+		rate = ((gauge_t) (value - ss->last_value))
+			/ CDTIME_T_TO_DOUBLE (now - ss->last_time);
+
+	ss->last_value = value;
+	ss->last_time = now;
+	ss->has_last = 1;
+
+	return (sampler_add (s, plugin_instance, type_instance, rate));
+} /* }}} int sampler_add_derive */
+
+int sampler_dispatch (sampler_t *s, const char *plugin, /* {{{ */
+		const char *type)
+{
+	sampler_stats_t *stats;
+	size_t stats_num = 0;
+	size_t stats_size = 0;
+	sampler_series_t *prev = NULL;
+	sampler_series_t *ss;
+	cdtime_t now;
+	size_t i;
+
+	if (s == NULL)
+		return (-1);
+
+	pthread_mutex_lock (&s->lock);
+
+	for (ss = s->series_list; ss != NULL; ss = ss->next)
+		stats_size++;
+
+	stats = calloc ((stats_size > 0) ? stats_size : 1, sizeof (*stats));
+	if (stats == NULL)
+	{
+		pthread_mutex_unlock (&s->lock);
+		ERROR ("sampler_dispatch: calloc failed.");
+		return (-1);
+	}
+
+	ss = s->series_list;
+	while (ss != NULL)
+	{
+		sampler_series_t *next = ss->next;
+		sampler_stats_t *st;
+		gauge_t sum = 0.0;
+		size_t j;
+
+		/* Series which haven't been sampled for a whole interval are
+		 * gone, e.g. because the interface has been removed. */
+		if (!ss->updated)
+		{
+			if (prev == NULL)
+				s->series_list = next;
+			else
+				prev->next = next;
+			c_hashtable_remove (s->series, ss->key,
+					/* key = */ NULL, /* value = */ NULL);
+			sampler_series_free (ss);
+			ss = next;
+			continue;
+		}
+		ss->updated = 0;
+		prev = ss;
+		ss = next;
+
+		if (prev->values_num == 0)
+			continue;
+
+		qsort (prev->values, prev->values_num, sizeof (*prev->values),
+				sampler_gauge_compare);
+		for (j = 0; j < prev->values_num; j++)
+			sum += prev->values[j];
+
+		st = stats + stats_num;
+		sstrncpy (st->plugin_instance, prev->plugin_instance,
+				sizeof (st->plugin_instance));
+		sstrncpy (st->type_instance, prev->type_instance,
+				sizeof (st->type_instance));
+		st->min = prev->values[0];
+		st->max = prev->values[prev->values_num - 1];
+		st->average = sum / ((gauge_t) prev->values_num);
+		/* The nearest rank, i.e. the smallest sample such that at least
+		 * 99% of the samples are less or equal. */
+		st->p99 = prev->values[(99 * prev->values_num + 99) / 100 - 1];
+		stats_num++;
+
+		prev->values_num = 0;
+	}
+
+	pthread_mutex_unlock (&s->lock);
+
+	now = cdtime ();
+	for (i = 0; i < stats_num; i++)
+	{
+		value_t values[4];
+		value_list_t vl = VALUE_LIST_INIT;
+
+		values[0].gauge = stats[i].min;
+		values[1].gauge = stats[i].average;
+		values[2].gauge = stats[i].max;
+		values[3].gauge = stats[i].p99;
+
+		vl.values = values;
+		vl.values_len = STATIC_ARRAY_SIZE (values);
+		vl.time = now;
+		sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+		sstrncpy (vl.plugin, plugin, sizeof (vl.plugin));
+		sstrncpy (vl.plugin_instance, stats[i].plugin_instance,
+				sizeof (vl.plugin_instance));
+		sstrncpy (vl.type, type, sizeof (vl.type));
+		sstrncpy (vl.type_instance, stats[i].type_instance,
+				sizeof (vl.type_instance));
+
+		plugin_dispatch_values (&vl);
+	}
+
+	sfree (stats);
+	return (0);
+} /* }}} int sampler_dispatch */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
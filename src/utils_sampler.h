@@ -0,0 +1,108 @@
+/**
+ * collectd - src/utils_sampler.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_SAMPLER_H
+#define UTILS_SAMPLER_H 1
+
+#include "plugin.h"
+
+/*
+ * Sampling faster than the interval
+ *
+ * A sampler calls its callback every `sample_interval' from a thread of its
+ * own. The callback adds one sample per series with `sampler_add' or
+ * `sampler_add_derive'. The plugin's read callback calls `sampler_dispatch',
+ * which dispatches the minimum, average, maximum and 99th percentile of each
+ * series' samples since the last call, so bursts shorter than the interval
+ * show up without dispatching each sample.
+ */
+
+struct sampler_s;
+typedef struct sampler_s sampler_t;
+
+/* Called with the sampler's lock held; `now' is the time of the sample. */
+typedef int (*sampler_cb) (sampler_t *s, cdtime_t now, void *user_data);
+
+/*
+ * NAME
+ *   sampler_create
+ *
+ * DESCRIPTION
+ *   Starts a thread named `name' which calls `callback' every
+ *   `sample_interval'. If a call takes longer than that, samples are
+ *   skipped rather than taken in a hurry.
+ *
+ * RETURN VALUE
+ *   A sampler_t-pointer upon success or NULL upon failure.
+ */
+sampler_t *sampler_create (const char *name, cdtime_t sample_interval,
+		sampler_cb callback, void *user_data);
+
+/*
+ * NAME
+ *   sampler_destroy
+ *
+ * DESCRIPTION
+ *   Stops the thread and frees all series. Samples which haven't been
+ *   dispatched are lost.
+ */
+void sampler_destroy (sampler_t *s);
+
+/*
+ * NAME
+ *   sampler_add
+ *
+ * DESCRIPTION
+ *   Adds the sample `value' to the series identified by `plugin_instance'
+ *   and `type_instance'. May only be called by the sampler's callback.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int sampler_add (sampler_t *s, const char *plugin_instance,
+		const char *type_instance, gauge_t value);
+
+/*
+ * NAME
+ *   sampler_add_derive
+ *
+ * DESCRIPTION
+ *   Like `sampler_add', but `value' is a counter: the sample is its rate per
+ *   second since the previous call for the same series. The first call and
+ *   calls after the counter went backwards only remember the value.
+ */
+int sampler_add_derive (sampler_t *s, const char *plugin_instance,
+		const char *type_instance, derive_t value, cdtime_t now);
+
+/*
+ * NAME
+ *   sampler_dispatch
+ *
+ * DESCRIPTION
+ *   Dispatches one value list per series with the samples added since the
+ *   last call, using `plugin' and `type'. The type must have four data
+ *   sources: min, average, max and p99. Series without new samples are
+ *   forgotten. The sampler's lock is not held while dispatching.
+ *
+ * RETURN VALUE
+ *   Zero upon success, non-zero otherwise.
+ */
+int sampler_dispatch (sampler_t *s, const char *plugin, const char *type);
+
+#endif /* UTILS_SAMPLER_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
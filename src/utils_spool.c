@@ -0,0 +1,567 @@
+/**
+ * collectd - src/utils_spool.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_spool.h"
+
+#include <sys/mman.h>
+#include <dirent.h>
+
+#define SPOOL_MAGIC   0x4c505343 /* "CSPL" */
+#define SPOOL_VERSION 1
+
+#define SPOOL_SEGMENT_SIZE_MIN (64 * 1024)
+#define SPOOL_SEGMENT_SIZE_MAX (16 * 1024 * 1024)
+#define SPOOL_SEGMENTS_MIN     2
+
+#define SPOOL_ALIGN(n) (((n) + 7) & ~((size_t) 7))
+
+/* The first bytes of every segment. `head' is the offset of the first record
+ * which has not been removed. */
+struct spool_header_s
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t head;
+};
+typedef struct spool_header_s spool_header_t;
+
+/* Records consist of this header, the host, plugin, plugin instance, type and
+ * type instance, each terminated by a null byte, and the values, starting at
+ * the next multiple of eight. A size of zero, which is what the segment file
+ * is filled with, marks the end of the records. */
+struct spool_record_s
+{
+	uint32_t size;
+	uint16_t values_len;
+	uint16_t strings_len;
+	uint64_t time;
+	uint64_t interval;
+};
+typedef struct spool_record_s spool_record_t;
+
+struct spool_segment_s;
+typedef struct spool_segment_s spool_segment_t;
+struct spool_segment_s
+{
+	uint64_t seq;
+	int fd;
+	char *map;
+	size_t size;
+	/* The offset behind the last record. */
+	size_t tail;
+	spool_segment_t *next;
+};
+
+struct spool_s
+{
+	char *dir;
+	size_t segment_size;
+	size_t segments_max;
+
+	/* Ordered from the oldest to the newest segment. */
+	spool_segment_t *head;
+	spool_segment_t *tail;
+	size_t segments_num;
+	uint64_t next_seq;
+};
+
+static void spool_segment_path (const spool_t *sp, uint64_t seq, /* {{{ */
+		char *buffer, size_t buffer_size)
+{
+	ssnprintf (buffer, buffer_size, "%s/%016"PRIx64".spool", sp->dir, seq);
+} /* }}} void spool_segment_path */
+
+static spool_header_t *spool_segment_header (spool_segment_t *seg) /* {{{ */
+{
+	return ((spool_header_t *) seg->map);
+} /* }}} spool_header_t *spool_segment_header */
+
+/* Returns the record at `offset' or NULL at the end of the records. */
+static spool_record_t *spool_segment_record (spool_segment_t *seg, /* {{{ */
+		size_t offset)
+{
+	spool_record_t *rec;
+
+	if ((offset + sizeof (*rec)) > seg->size)
+		return (NULL);
+
+	rec = (spool_record_t *) (seg->map + offset);
+	if ((rec->size < sizeof (*rec)) || (rec->size > (seg->size - offset)))
+		return (NULL);
+
+	return (rec);
+} /* }}} spool_record_t *spool_segment_record */
+
+static void spool_segment_close (spool_segment_t *seg, /* {{{ */
+		const spool_t *sp, _Bool remove)
+{
+	if (seg == NULL)
+		return;
+
+	munmap (seg->map, seg->size);
+	close (seg->fd);
+
+	if (remove)
+	{
+		char path[PATH_MAX];
+
+		spool_segment_path (sp, seg->seq, path, sizeof (path));
+		unlink (path);
+	}
+
+	sfree (seg);
+} /* }}} void spool_segment_close */
+
+static spool_segment_t *spool_segment_open (const spool_t *sp, /* {{{ */
+		uint64_t seq, _Bool create)
+{
+	spool_segment_t *seg;
+	spool_header_t *header;
+	spool_record_t *rec;
+	char path[PATH_MAX];
+	char errbuf[1024];
+	struct stat statbuf;
+
+	spool_segment_path (sp, seq, path, sizeof (path));
+
+	seg = malloc (sizeof (*seg));
+	if (seg == NULL)
+	{
+		ERROR ("utils_spool: malloc failed.");
+		return (NULL);
+	}
+	memset (seg, 0, sizeof (*seg));
+	seg->seq = seq;
+
+	seg->fd = open (path, create ? (O_RDWR | O_CREAT | O_EXCL) : O_RDWR,
+			S_IRUSR | S_IWUSR);
+	if (seg->fd < 0)
+	{
+		ERROR ("utils_spool: open (%s) failed: %s", path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		sfree (seg);
+		return (NULL);
+	}
+	fcntl (seg->fd, F_SETFD, FD_CLOEXEC);
+
+	if (create && (ftruncate (seg->fd, (off_t) sp->segment_size) != 0))
+	{
+		ERROR ("utils_spool: ftruncate (%s) failed: %s", path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (seg->fd);
+		unlink (path);
+		sfree (seg);
+		return (NULL);
+	}
+
+	if (fstat (seg->fd, &statbuf) != 0)
+	{
+		ERROR ("utils_spool: fstat (%s) failed: %s", path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (seg->fd);
+		sfree (seg);
+		return (NULL);
+	}
+	seg->size = (size_t) statbuf.st_size;
+	if (seg->size < sizeof (*header))
+	{
+		ERROR ("utils_spool: %s is too small to be a spool segment.",
+				path);
+		close (seg->fd);
+		sfree (seg);
+		return (NULL);
+	}
+
+	seg->map = mmap (/* addr = */ NULL, seg->size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, seg->fd, /* offset = */ 0);
+	if (seg->map == MAP_FAILED)
+	{
+		ERROR ("utils_spool: mmap (%s) failed: %s", path,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		close (seg->fd);
+		if (create)
+			unlink (path);
+		sfree (seg);
+		return (NULL);
+	}
+
+	header = spool_segment_header (seg);
+	if (create)
+	{
+		header->magic = SPOOL_MAGIC;
+		header->version = SPOOL_VERSION;
+		header->head = sizeof (*header);
+	}
+	else if ((header->magic != SPOOL_MAGIC)
+			|| (header->version != SPOOL_VERSION)
+			|| (header->head < sizeof (*header))
+			|| (header->head > seg->size))
+	{
+		ERROR ("utils_spool: %s is not a valid spool segment.", path);
+		munmap (seg->map, seg->size);
+		close (seg->fd);
+		sfree (seg);
+		return (NULL);
+	}
+
+	/* Records behind a damaged one are lost. */
+	seg->tail = (size_t) header->head;
+	while ((rec = spool_segment_record (seg, seg->tail)) != NULL)
+		seg->tail += rec->size;
+
+	return (seg);
+} /* }}} spool_segment_t *spool_segment_open */
+
+/* Inserts `seg' into the list of segments, ordered by their sequence
+ * number. */
+static void spool_segment_insert (spool_t *sp, /* {{{ */
+		spool_segment_t *seg)
+{
+	spool_segment_t *prev = NULL;
+	spool_segment_t *ptr;
+
+	for (ptr = sp->head; ptr != NULL; prev = ptr, ptr = ptr->next)
+		if (ptr->seq > seg->seq)
+			break;
+
+	seg->next = ptr;
+	if (prev == NULL)
+		sp->head = seg;
+	else
+		prev->next = seg;
+	if (ptr == NULL)
+		sp->tail = seg;
+
+	sp->segments_num++;
+	if (sp->next_seq <= seg->seq)
+		sp->next_seq = seg->seq + 1;
+} /* }}} void spool_segment_insert */
+
+/* Removes and deletes the oldest segment. */
+static void spool_segment_drop (spool_t *sp) /* {{{ */
+{
+	spool_segment_t *seg = sp->head;
+
+	if (seg == NULL)
+		return;
+
+	sp->head = seg->next;
+	if (sp->head == NULL)
+		sp->tail = NULL;
+	sp->segments_num--;
+
+	spool_segment_close (seg, sp, /* remove = */ 1);
+} /* }}} void spool_segment_drop */
+
+static size_t spool_segment_count (spool_segment_t *seg) /* {{{ */
+{
+	spool_record_t *rec;
+	size_t offset = (size_t) spool_segment_header (seg)->head;
+	size_t count = 0;
+
+	while ((offset < seg->tail)
+			&& ((rec = spool_segment_record (seg, offset)) != NULL))
+	{
+		offset += rec->size;
+		count++;
+	}
+
+	return (count);
+} /* }}} size_t spool_segment_count */
+
+spool_t *spool_open (const char *dir, uint64_t max_size) /* {{{ */
+{
+	spool_t *sp;
+	char path[PATH_MAX];
+	char errbuf[1024];
+	DIR *dh;
+	struct dirent *de;
+
+	if ((dir == NULL) || (max_size == 0))
+		return (NULL);
+
+	ssnprintf (path, sizeof (path), "%s/", dir);
+	if (check_create_dir (path) != 0)
+	{
+		ERROR ("utils_spool: Unable to create the directory %s.", dir);
+		return (NULL);
+	}
+
+	sp = malloc (sizeof (*sp));
+	if (sp == NULL)
+	{
+		ERROR ("utils_spool: malloc failed.");
+		return (NULL);
+	}
+	memset (sp, 0, sizeof (*sp));
+
+	sp->dir = strdup (dir);
+	if (sp->dir == NULL)
+	{
+		ERROR ("utils_spool: strdup failed.");
+		sfree (sp);
+		return (NULL);
+	}
+
+	/* Small enough for a few segments to fit into the limit, so that
+	 * dropping the oldest one loses only a part of what was spooled. */
+	sp->segment_size = (size_t) (max_size / 8);
+	if (sp->segment_size < SPOOL_SEGMENT_SIZE_MIN)
+		sp->segment_size = SPOOL_SEGMENT_SIZE_MIN;
+	else if (sp->segment_size > SPOOL_SEGMENT_SIZE_MAX)
+		sp->segment_size = SPOOL_SEGMENT_SIZE_MAX;
+	sp->segment_size = SPOOL_ALIGN (sp->segment_size);
+
+	sp->segments_max = (size_t) (max_size / sp->segment_size);
+	if (sp->segments_max < SPOOL_SEGMENTS_MIN)
+		sp->segments_max = SPOOL_SEGMENTS_MIN;
+
+	dh = opendir (dir);
+	if (dh == NULL)
+	{
+		ERROR ("utils_spool: opendir (%s) failed: %s", dir,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		spool_close (sp);
+		return (NULL);
+	}
+
+	while ((de = readdir (dh)) != NULL)
+	{
+		spool_segment_t *seg;
+		uint64_t seq;
+		char suffix[8];
+
+		if ((sscanf (de->d_name, "%16"SCNx64"%7s", &seq, suffix) != 2)
+				|| (strcmp (".spool", suffix) != 0))
+			continue;
+
+		seg = spool_segment_open (sp, seq, /* create = */ 0);
+		if (seg == NULL)
+			continue;
+
+		spool_segment_insert (sp, seg);
+	}
+	closedir (dh);
+
+	/* Segments which have been read completely are removed right away,
+	 * but the daemon may have been stopped in between. */
+	while ((sp->head != NULL)
+			&& (spool_segment_header (sp->head)->head >= sp->head->tail))
+		spool_segment_drop (sp);
+
+	while (sp->segments_num > sp->segments_max)
+		spool_segment_drop (sp);
+
+	return (sp);
+} /* }}} spool_t *spool_open */
+
+void spool_close (spool_t *sp) /* {{{ */
+{
+	if (sp == NULL)
+		return;
+
+	while (sp->head != NULL)
+	{
+		spool_segment_t *seg = sp->head;
+
+		sp->head = seg->next;
+		msync (seg->map, seg->size, MS_ASYNC);
+		spool_segment_close (seg, sp, /* remove = */ 0);
+	}
+
+	sfree (sp->dir);
+	sfree (sp);
+} /* }}} void spool_close */
+
+int spool_append (spool_t *sp, const value_list_t *vl) /* {{{ */
+{
+	const char *strings[5];
+	spool_segment_t *seg;
+	spool_record_t *rec;
+	size_t strings_len = 0;
+	size_t values_offset;
+	size_t size;
+	char *ptr;
+	int i;
+
+	if ((sp == NULL) || (vl == NULL) || (vl->values_len < 1))
+		return (EINVAL);
+
+	strings[0] = vl->host;
+	strings[1] = vl->plugin;
+	strings[2] = vl->plugin_instance;
+	strings[3] = vl->type;
+	strings[4] = vl->type_instance;
+	for (i = 0; i < 5; i++)
+		strings_len += strlen (strings[i]) + 1;
+
+	values_offset = SPOOL_ALIGN (sizeof (*rec) + strings_len);
+	size = values_offset + vl->values_len * sizeof (*vl->values);
+	if ((sizeof (spool_header_t) + size) > sp->segment_size)
+		return (EINVAL);
+
+	seg = sp->tail;
+	if ((seg == NULL) || ((seg->tail + size) > seg->size))
+	{
+		if (sp->segments_num >= sp->segments_max)
+		{
+			WARNING ("utils_spool: The spool in %s is full. Dropping the "
+					"oldest %zu value lists.", sp->dir,
+					spool_segment_count (sp->head));
+			spool_segment_drop (sp);
+		}
+
+		seg = spool_segment_open (sp, sp->next_seq, /* create = */ 1);
+		if (seg == NULL)
+			return (-1);
+		spool_segment_insert (sp, seg);
+	}
+
+	rec = (spool_record_t *) (seg->map + seg->tail);
+	ptr = seg->map + seg->tail + sizeof (*rec);
+	for (i = 0; i < 5; i++)
+	{
+		size_t len = strlen (strings[i]) + 1;
+
+		memcpy (ptr, strings[i], len);
+		ptr += len;
+	}
+	memcpy (seg->map + seg->tail + values_offset, vl->values,
+			vl->values_len * sizeof (*vl->values));
+
+	rec->values_len = (uint16_t) vl->values_len;
+	rec->strings_len = (uint16_t) strings_len;
+	rec->time = (uint64_t) vl->time;
+	rec->interval = (uint64_t) vl->interval;
+	/* Written last, so that a half-written record stays invisible. */
+	rec->size = (uint32_t) size;
+
+	seg->tail += size;
+
+	return (0);
+} /* }}} int spool_append */
+
+static int spool_record_parse (const spool_record_t *rec, /* {{{ */
+		value_list_t *vl)
+{
+	char *fields[5] = { vl->host, vl->plugin, vl->plugin_instance,
+		vl->type, vl->type_instance };
+	const char *ptr = ((const char *) rec) + sizeof (*rec);
+	const char *end = ptr + rec->strings_len;
+	size_t values_offset;
+	int i;
+
+	memset (vl, 0, sizeof (*vl));
+
+	values_offset = SPOOL_ALIGN (sizeof (*rec) + rec->strings_len);
+	if ((values_offset + rec->values_len * sizeof (value_t)) > rec->size)
+		return (-1);
+
+	for (i = 0; i < 5; i++)
+	{
+		const char *null = memchr (ptr, 0, (size_t) (end - ptr));
+
+		if (null == NULL)
+			return (-1);
+		sstrncpy (fields[i], ptr, DATA_MAX_NAME_LEN);
+		ptr = null + 1;
+	}
+
+	vl->values = malloc (rec->values_len * sizeof (*vl->values));
+	if (vl->values == NULL)
+	{
+		ERROR ("utils_spool: malloc failed.");
+		return (ENOMEM);
+	}
+	memcpy (vl->values, ((const char *) rec) + values_offset,
+			rec->values_len * sizeof (*vl->values));
+	vl->values_len = (int) rec->values_len;
+	vl->time = (cdtime_t) rec->time;
+	vl->interval = (cdtime_t) rec->interval;
+	vl->meta = NULL;
+	vl->identifier = NULL;
+
+	return (0);
+} /* }}} int spool_record_parse */
+
+size_t spool_peek (spool_t *sp, value_list_t *vls, size_t num) /* {{{ */
+{
+	spool_segment_t *seg;
+	size_t count = 0;
+
+	if (sp == NULL)
+		return (0);
+
+	for (seg = sp->head; (seg != NULL) && (count < num); seg = seg->next)
+	{
+		spool_record_t *rec;
+		size_t offset = (size_t) spool_segment_header (seg)->head;
+
+		while ((count < num) && (offset < seg->tail)
+				&& ((rec = spool_segment_record (seg, offset)) != NULL))
+		{
+			/* Damaged records are returned without values, so
+			 * that the caller removes them. */
+			if (spool_record_parse (rec, vls + count) == ENOMEM)
+				return (count);
+
+			offset += rec->size;
+			count++;
+		}
+	}
+
+	return (count);
+} /* }}} size_t spool_peek */
+
+void spool_remove (spool_t *sp, size_t num) /* {{{ */
+{
+	if (sp == NULL)
+		return;
+
+	while ((num > 0) && (sp->head != NULL))
+	{
+		spool_segment_t *seg = sp->head;
+		spool_header_t *header = spool_segment_header (seg);
+		spool_record_t *rec;
+
+		while ((num > 0) && (header->head < seg->tail)
+				&& ((rec = spool_segment_record (seg,
+							(size_t) header->head)) != NULL))
+		{
+			header->head += rec->size;
+			num--;
+		}
+
+		/* Nothing is appended to a segment once the next one has been
+		 * started, and an empty newest segment isn't worth keeping. */
+		if (header->head >= seg->tail)
+			spool_segment_drop (sp);
+		else
+			break;
+	}
+} /* }}} void spool_remove */
+
+_Bool spool_empty (const spool_t *sp) /* {{{ */
+{
+	return ((sp == NULL) || (sp->head == NULL));
+} /* }}} _Bool spool_empty */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,61 @@
+/**
+ * collectd - src/utils_spool.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_SPOOL_H
+#define UTILS_SPOOL_H 1
+
+#include "plugin.h"
+
+/*
+ * On-disk queue of value lists
+ *
+ * Value lists are appended to segment files of a fixed size in one directory,
+ * which are mapped into memory, and taken from the head in the order they
+ * were appended. Fully read segments are deleted. If the total size of the
+ * segments would exceed the limit, the oldest segment is deleted, and its
+ * value lists with it.
+ *
+ * Each segment records how much of it has been read, so the value lists left
+ * when the spool is closed are read again after it has been opened again,
+ * e.g. after a restart of the daemon. The spool is not thread-safe.
+ */
+
+struct spool_s;
+typedef struct spool_s spool_t;
+
+/* Opens the spool in `dir', creating the directory if necessary, and picks
+ * up the segments left there. `max_size' is the limit for the size of all
+ * segments in bytes. Returns NULL on error. */
+spool_t *spool_open (const char *dir, uint64_t max_size);
+void spool_close (spool_t *sp);
+
+/* Appends `vl'. Meta data is not stored. Returns zero on success. */
+int spool_append (spool_t *sp, const value_list_t *vl);
+
+/* Stores up to `num' value lists from the head in `vls', without removing
+ * them. The values of each have to be freed with `sfree (vls[i].values)'.
+ * Returns the number of value lists stored. */
+size_t spool_peek (spool_t *sp, value_list_t *vls, size_t num);
+
+/* Removes the first `num' value lists. */
+void spool_remove (spool_t *sp, size_t num);
+
+/* Returns true if there is nothing to read. */
+_Bool spool_empty (const spool_t *sp);
+
+#endif /* UTILS_SPOOL_H */
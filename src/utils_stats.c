@@ -0,0 +1,118 @@
+/**
+ * collectd - src/utils_stats.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "utils_stats.h"
+
+#include <pthread.h>
+
+static pthread_key_t stats_thread_key;
+static pthread_once_t stats_thread_once = PTHREAD_ONCE_INIT;
+static uintptr_t stats_threads = 0;
+
+static void stats_thread_key_create (void) /* {{{ */
+{
+	pthread_key_create (&stats_thread_key, /* destructor = */ NULL);
+} /* }}} void stats_thread_key_create */
+
+size_t stats_thread_index (void) /* {{{ */
+{
+	uintptr_t index;
+
+	pthread_once (&stats_thread_once, stats_thread_key_create);
+
+	/* The key holds the index plus one, so that zero means "unset". */
+	index = (uintptr_t) pthread_getspecific (stats_thread_key);
+	if (index == 0)
+	{
+		index = __sync_add_and_fetch (&stats_threads, 1);
+		pthread_setspecific (stats_thread_key, (void *) index);
+	}
+
+	return ((size_t) (index - 1));
+} /* }}} size_t stats_thread_index */
+
+void stats_counter_add (stats_counter_t *c, uint64_t n) /* {{{ */
+{
+	stats_shard_t *shard = c->shards + (stats_thread_index () % STATS_SHARDS);
+
+	__sync_fetch_and_add (&shard->value, n);
+} /* }}} void stats_counter_add */
+
+uint64_t stats_counter_get (stats_counter_t *c) /* {{{ */
+{
+	uint64_t sum = 0;
+	size_t i;
+
+	for (i = 0; i < STATS_SHARDS; i++)
+		sum += __sync_fetch_and_add (&c->shards[i].value, 0);
+
+	return (sum);
+} /* }}} uint64_t stats_counter_get */
+
+void stats_max_update (uint64_t *max, uint64_t value) /* {{{ */
+{
+	uint64_t old = *max;
+
+	while (value > old)
+	{
+		uint64_t prev = __sync_val_compare_and_swap (max, old, value);
+		if (prev == old)
+			break;
+		old = prev;
+	}
+} /* }}} void stats_max_update */
+
+uint64_t stats_max_reset (uint64_t *max, uint64_t value) /* {{{ */
+{
+	uint64_t old = *max;
+	uint64_t prev;
+
+	while ((prev = __sync_val_compare_and_swap (max, old, value)) != old)
+		old = prev;
+
+	return (old);
+} /* }}} uint64_t stats_max_reset */
+
+void stats_histogram_add (stats_histogram_t *h, uint64_t ns) /* {{{ */
+{
+	uint64_t bound;
+	size_t i;
+
+	for (i = 0, bound = 100000; i < STATS_HISTOGRAM_BUCKETS - 1;
+			i++, bound *= 10)
+		if (ns <= bound)
+			break;
+
+	stats_counter_inc (h->buckets + i);
+	stats_counter_add (&h->sum_ns, ns);
+	stats_max_update (&h->max_ns, ns);
+} /* }}} void stats_histogram_add */
+
+const char *stats_histogram_bucket_name (size_t i) /* {{{ */
+{
+	static const char *names[STATS_HISTOGRAM_BUCKETS] = { "le_100us",
+		"le_1ms", "le_10ms", "le_100ms", "le_1s", "le_10s", "le_100s",
+		"le_inf" };
+
+	if (i >= STATS_HISTOGRAM_BUCKETS)
+		return (NULL);
+	return (names[i]);
+} /* }}} const char *stats_histogram_bucket_name */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
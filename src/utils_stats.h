@@ -0,0 +1,100 @@
+/**
+ * collectd - src/utils_stats.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_STATS_H
+#define UTILS_STATS_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Statistics counters
+ *
+ * A counter is split into shards on separate cache lines. Each thread adds to
+ * "its" shard with an atomic operation, so counters which are incremented by
+ * many threads at once neither need a lock nor bounce a cache line between
+ * CPUs. Reading a counter sums up all shards; the result is exact once the
+ * writers are done, and never lower than a previous read otherwise.
+ *
+ * Counters need no initialization besides being zeroed, so they may be
+ * static, part of a structure allocated with `calloc' or initialized with
+ * `STATS_COUNTER_INIT'. They have nothing to free either.
+ */
+#define STATS_SHARDS 8
+#define STATS_CACHE_LINE 64
+
+struct stats_shard_s
+{
+	uint64_t value;
+	char pad[STATS_CACHE_LINE - sizeof (uint64_t)];
+};
+typedef struct stats_shard_s stats_shard_t;
+
+struct stats_counter_s
+{
+	stats_shard_t shards[STATS_SHARDS];
+};
+typedef struct stats_counter_s stats_counter_t;
+
+#define STATS_COUNTER_INIT { { { 0, { 0 } } } }
+
+/* Returns a number identifying the calling thread. Threads are numbered in
+ * the order they first call this, starting at zero. Users keeping sharded
+ * statistics of their own take it modulo their number of shards. */
+size_t stats_thread_index (void);
+
+/* Adds `n' to `c'. */
+void stats_counter_add (stats_counter_t *c, uint64_t n);
+#define stats_counter_inc(c) stats_counter_add ((c), 1)
+
+/* Returns the sum of all shards of `c'. */
+uint64_t stats_counter_get (stats_counter_t *c);
+
+/* Raises the high-water mark `max' to `value' if it is lower. */
+void stats_max_update (uint64_t *max, uint64_t value);
+
+/* Replaces the high-water mark `max' with `value', e.g. the current level, to
+ * start a new interval, and returns the previous mark. */
+uint64_t stats_max_reset (uint64_t *max, uint64_t value);
+
+/*
+ * Latency histograms
+ *
+ * Durations, in nanoseconds, are counted in buckets of up to 100us, 1ms, ...,
+ * 100s and longer, and summed up, so that the average is known as well. Like
+ * counters, histograms only need to be zeroed. `max_ns' is the high-water
+ * mark; users reset it with `stats_max_reset' whenever they report it.
+ */
+#define STATS_HISTOGRAM_BUCKETS 8
+
+struct stats_histogram_s
+{
+	stats_counter_t buckets[STATS_HISTOGRAM_BUCKETS];
+	stats_counter_t sum_ns;
+	uint64_t max_ns;
+};
+typedef struct stats_histogram_s stats_histogram_t;
+
+/* Records one duration of `ns' nanoseconds. */
+void stats_histogram_add (stats_histogram_t *h, uint64_t ns);
+
+/* Returns the name of bucket `i', "le_100us" to "le_100s" and "le_inf". */
+const char *stats_histogram_bucket_name (size_t i);
+
+#endif /* UTILS_STATS_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
@@ -29,17 +29,58 @@
 #include "common.h"
 #include "utils_tail.h"
 
+#if HAVE_SYS_INOTIFY_H
+# include <sys/inotify.h>
+#endif
+#include <poll.h>
+
+/* Lines are split in this buffer in place. Longer lines are cut. */
+#define CU_TAIL_BUFFER_SIZE 65536
+
 struct cu_tail_s
 {
 	char  *file;
-	FILE  *fh;
+	int    fd;
 	struct stat stat;
+
+	char  *buffer;
+	/* The unread data is buffer[start] to buffer[fill - 1]. */
+	size_t start;
+	size_t fill;
+
+	/* If set, the file is checked for rotation when its end is reached.
+	 * Without inotify this is always the case. */
+	_Bool  check;
+	int    inotify_fd;
+	int    watch_file;
+	int    watch_dir;
+	char  *basename;
 };
 
+#if HAVE_SYS_INOTIFY_H
+static void cu_tail_watch_file (cu_tail_t *obj)
+{
+  if (obj->inotify_fd < 0)
+    return;
+
+  if (obj->watch_file >= 0)
+    inotify_rm_watch (obj->inotify_fd, obj->watch_file);
+
+  obj->watch_file = inotify_add_watch (obj->inotify_fd, obj->file,
+      IN_MODIFY);
+  if (obj->watch_file < 0)
+  {
+    char errbuf[1024];
+    WARNING ("utils_tail: inotify_add_watch (%s) failed: %s", obj->file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+  }
+} /* void cu_tail_watch_file */
+#endif
+
 static int cu_tail_reopen (cu_tail_t *obj)
 {
   int seek_end = 0;
-  FILE *fh;
+  int fd;
   struct stat stat_buf;
   int status;
 
@@ -54,24 +95,27 @@ static int cu_tail_reopen (cu_tail_t *obj)
   }
 
   /* The file is already open.. */
-  if ((obj->fh != NULL) && (stat_buf.st_ino == obj->stat.st_ino))
+  if ((obj->fd >= 0) && (stat_buf.st_ino == obj->stat.st_ino))
   {
+    off_t offset = lseek (obj->fd, 0, SEEK_CUR);
+
+    memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
+
     /* Seek to the beginning if file was truncated */
-    if (stat_buf.st_size < obj->stat.st_size)
+    if ((offset >= 0) && (stat_buf.st_size < offset))
     {
       INFO ("utils_tail: File `%s' was truncated.", obj->file);
-      status = fseek (obj->fh, 0, SEEK_SET);
-      if (status != 0)
+      if (lseek (obj->fd, 0, SEEK_SET) != 0)
       {
 	char errbuf[1024];
-	ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+	ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	    sstrerror (errno, errbuf, sizeof (errbuf)));
-	fclose (obj->fh);
-	obj->fh = NULL;
+	close (obj->fd);
+	obj->fd = -1;
 	return (-1);
       }
+      return (0);
     }
-    memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
     return (1);
   }
 
@@ -80,36 +124,187 @@ static int cu_tail_reopen (cu_tail_t *obj)
   if ((obj->stat.st_ino == 0) || (obj->stat.st_ino == stat_buf.st_ino))
     seek_end = 1;
 
-  fh = fopen (obj->file, "r");
-  if (fh == NULL)
+  fd = open (obj->file, O_RDONLY);
+  if (fd < 0)
   {
     char errbuf[1024];
-    ERROR ("utils_tail: fopen (%s) failed: %s", obj->file,
+    ERROR ("utils_tail: open (%s) failed: %s", obj->file,
 	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
 
   if (seek_end != 0)
   {
-    status = fseek (fh, 0, SEEK_END);
-    if (status != 0)
+    if (lseek (fd, 0, SEEK_END) < 0)
     {
       char errbuf[1024];
-      ERROR ("utils_tail: fseek (%s) failed: %s", obj->file,
+      ERROR ("utils_tail: lseek (%s) failed: %s", obj->file,
 	  sstrerror (errno, errbuf, sizeof (errbuf)));
-      fclose (fh);
+      close (fd);
       return (-1);
     }
   }
 
-  if (obj->fh != NULL)
-    fclose (obj->fh);
-  obj->fh = fh;
+  if (obj->fd >= 0)
+    close (obj->fd);
+  obj->fd = fd;
   memcpy (&obj->stat, &stat_buf, sizeof (struct stat));
 
+#if HAVE_SYS_INOTIFY_H
+  cu_tail_watch_file (obj);
+#endif
+
   return (0);
 } /* int cu_tail_reopen */
 
+/* Returns true if reaching the end of the file should be followed by a check
+ * for rotation and truncation. */
+static _Bool cu_tail_need_check (cu_tail_t *obj)
+{
+  struct stat stat_buf;
+  off_t offset;
+
+  if ((obj->inotify_fd < 0) || obj->check)
+  {
+    obj->check = 0;
+    return (1);
+  }
+
+  /* Truncation only shows as a modification: compare the size of the open
+   * file with the offset, which doesn't need a path lookup. */
+  offset = lseek (obj->fd, 0, SEEK_CUR);
+  if ((offset < 0) || (fstat (obj->fd, &stat_buf) != 0))
+    return (1);
+
+  return (stat_buf.st_size < offset);
+} /* _Bool cu_tail_need_check */
+
+/* Reads more data into the buffer. Returns the number of bytes read, zero at
+ * the end of the file and -1 on error. */
+static ssize_t cu_tail_fill (cu_tail_t *obj)
+{
+  ssize_t status;
+
+  if (obj->start > 0)
+  {
+    memmove (obj->buffer, obj->buffer + obj->start, obj->fill - obj->start);
+    obj->fill -= obj->start;
+    obj->start = 0;
+  }
+
+  do
+  {
+    status = read (obj->fd, obj->buffer + obj->fill,
+	CU_TAIL_BUFFER_SIZE - 1 - obj->fill);
+  } while ((status < 0) && (errno == EINTR));
+
+  if (status < 0)
+  {
+    char errbuf[1024];
+    WARNING ("utils_tail: read (%s) returned an error: %s", obj->file,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  obj->fill += (size_t) status;
+  return (status);
+} /* ssize_t cu_tail_fill */
+
+/* Returns the remaining data as one line. */
+static char *cu_tail_take_all (cu_tail_t *obj, size_t *ret_len)
+{
+  char *line = obj->buffer + obj->start;
+
+  obj->buffer[obj->fill] = 0;
+  *ret_len = obj->fill - obj->start;
+  obj->start = obj->fill;
+
+  return (line);
+} /* char *cu_tail_take_all */
+
+/* Stores the next complete line, null-terminated instead of the newline, in
+ * `*ret_line'. The line remains in the buffer until the next call. At the end
+ * of the file `*ret_line' is set to NULL. Returns 0 when successful and
+ * non-zero otherwise. */
+static int cu_tail_getline (cu_tail_t *obj, char **ret_line, size_t *ret_len)
+{
+  int status;
+
+  *ret_line = NULL;
+  *ret_len = 0;
+
+  if (obj->fd < 0)
+  {
+    /* With inotify the file is opened again when it's created. */
+    if ((obj->inotify_fd >= 0) && !obj->check)
+      return (0);
+    obj->check = 0;
+
+    status = cu_tail_reopen (obj);
+    if (status < 0)
+      return (status);
+  }
+
+  while (42)
+  {
+    char *line = obj->buffer + obj->start;
+    char *end;
+    ssize_t read_status;
+
+    end = memchr (line, '\n', obj->fill - obj->start);
+    if (end != NULL)
+    {
+      *end = 0;
+      *ret_line = line;
+      *ret_len = (size_t) (end - line);
+      obj->start += *ret_len + 1;
+      return (0);
+    }
+
+    /* The line doesn't fit into the buffer: return what there is. */
+    if (obj->fill - obj->start >= CU_TAIL_BUFFER_SIZE - 1)
+    {
+      *ret_line = cu_tail_take_all (obj, ret_len);
+      return (0);
+    }
+
+    read_status = cu_tail_fill (obj);
+    if (read_status > 0)
+      continue;
+
+    if (read_status < 0)
+    {
+      /* Force `cu_tail_reopen' to open the file again. */
+      close (obj->fd);
+      obj->fd = -1;
+    }
+    else if (!cu_tail_need_check (obj))
+    {
+      /* End of the file: the partial line is completed later. */
+      return (0);
+    }
+
+    /* Check if the file was moved away and reopen the new file if so. */
+    status = cu_tail_reopen (obj);
+    if (status < 0)
+      return (status);
+    /* file end reached and file not reopened -> nothing more to read */
+    else if (status > 0)
+      return (0);
+
+    /* A new file is read or the file was truncated: the last line of the
+     * old data won't be completed. */
+    if (obj->fill > obj->start)
+    {
+      *ret_line = cu_tail_take_all (obj, ret_len);
+      obj->start = obj->fill = 0;
+      return (0);
+    }
+    obj->start = obj->fill = 0;
+  }
+} /* int cu_tail_getline */
+
 cu_tail_t *cu_tail_create (const char *file)
 {
 	cu_tail_t *obj;
@@ -120,128 +315,226 @@ cu_tail_t *cu_tail_create (const char *file)
 	memset (obj, '\0', sizeof (cu_tail_t));
 
 	obj->file = strdup (file);
-	if (obj->file == NULL)
+	obj->buffer = malloc (CU_TAIL_BUFFER_SIZE);
+	if ((obj->file == NULL) || (obj->buffer == NULL))
 	{
+		free (obj->file);
+		free (obj->buffer);
 		free (obj);
 		return (NULL);
 	}
 
-	obj->fh = NULL;
+	obj->fd = -1;
+	obj->inotify_fd = -1;
+	obj->watch_file = -1;
+	obj->watch_dir = -1;
 
 	return (obj);
 } /* cu_tail_t *cu_tail_create */
 
 int cu_tail_destroy (cu_tail_t *obj)
 {
-	if (obj->fh != NULL)
-		fclose (obj->fh);
+	if (obj->fd >= 0)
+		close (obj->fd);
+	if (obj->inotify_fd >= 0)
+		close (obj->inotify_fd);
+	free (obj->basename);
+	free (obj->buffer);
 	free (obj->file);
 	free (obj);
 
 	return (0);
 } /* int cu_tail_destroy */
 
-int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
+int cu_tail_watch (cu_tail_t *obj)
 {
-  int status;
+#if HAVE_SYS_INOTIFY_H
+  char dir[PATH_MAX];
+  char *ptr;
+  int fd;
 
-  if (buflen < 1)
+  if (obj->inotify_fd >= 0)
+    return (0);
+
+  sstrncpy (dir, obj->file, sizeof (dir));
+  ptr = strrchr (dir, '/');
+  if (ptr == NULL)
+    sstrncpy (dir, ".", sizeof (dir));
+  else if (ptr == dir)
+    dir[1] = 0;
+  else
+    *ptr = 0;
+
+  ptr = strrchr (obj->file, '/');
+  obj->basename = strdup ((ptr == NULL) ? obj->file : ptr + 1);
+  if (obj->basename == NULL)
+    return (-1);
+
+  fd = inotify_init ();
+  if (fd < 0)
   {
-    ERROR ("utils_tail: cu_tail_readline: buflen too small: %i bytes.",
-	buflen);
+    char errbuf[1024];
+    ERROR ("utils_tail: inotify_init failed: %s",
+	sstrerror (errno, errbuf, sizeof (errbuf)));
     return (-1);
   }
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+  fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
 
-  if (obj->fh == NULL)
+  /* A new file with the name of ours, after a rotation for example. Until
+   * then the old file is read, even if it has been moved away. */
+  obj->watch_dir = inotify_add_watch (fd, dir, IN_CREATE | IN_MOVED_TO);
+  if (obj->watch_dir < 0)
   {
-    status = cu_tail_reopen (obj);
-    if (status < 0)
-      return (status);
+    char errbuf[1024];
+    ERROR ("utils_tail: inotify_add_watch (%s) failed: %s", dir,
+	sstrerror (errno, errbuf, sizeof (errbuf)));
+    close (fd);
+    return (-1);
   }
-  assert (obj->fh != NULL);
 
-  /* Try to read from the filehandle. If that succeeds, everything appears to
-   * be fine and we can return. */
-  clearerr (obj->fh);
-  if (fgets (buf, buflen, obj->fh) != NULL)
+  obj->inotify_fd = fd;
+  /* The file hasn't been looked at yet. */
+  obj->check = 1;
+  if (obj->fd >= 0)
+    cu_tail_watch_file (obj);
+
+  return (0);
+#else
+  WARNING ("utils_tail: cu_tail_watch (%s): inotify isn't supported.",
+      obj->file);
+  return (-1);
+#endif
+} /* int cu_tail_watch */
+
+int cu_tail_wait (cu_tail_t *obj, int timeout)
+{
+#if HAVE_SYS_INOTIFY_H
+  struct pollfd pfd;
+  char buffer[4096]
+    __attribute__ ((aligned (__alignof__ (struct inotify_event))));
+  int status;
+
+  if (obj->inotify_fd < 0)
+#endif
   {
-    buf[buflen - 1] = 0;
+    poll (NULL, 0, timeout);
     return (0);
   }
 
-  /* Check if we encountered an error */
-  if (ferror (obj->fh) != 0)
+#if HAVE_SYS_INOTIFY_H
+  memset (&pfd, 0, sizeof (pfd));
+  pfd.fd = obj->inotify_fd;
+  pfd.events = POLLIN;
+
+  status = poll (&pfd, 1, timeout);
+  if (status < 0)
   {
-    /* Jupp, error. Force `cu_tail_reopen' to reopen the file.. */
-    fclose (obj->fh);
-    obj->fh = NULL;
+    if (errno == EINTR)
+      return (0);
+    return (-1);
   }
-  /* else: eof -> check if the file was moved away and reopen the new file if
-   * so.. */
+  else if (status == 0)
+    return (0);
 
-  status = cu_tail_reopen (obj);
-  /* error -> return with error */
-  if (status < 0)
+  while (42)
+  {
+    ssize_t len;
+    char *ptr;
+
+    len = read (obj->inotify_fd, buffer, sizeof (buffer));
+    if (len <= 0)
+      break;
+
+    for (ptr = buffer; ptr < buffer + len;
+	ptr += sizeof (struct inotify_event) + ((struct inotify_event *) ptr)->len)
+    {
+      struct inotify_event *event = (struct inotify_event *) ptr;
+
+      if (event->wd == obj->watch_file)
+      {
+	/* The file was deleted. */
+	if (event->mask & IN_IGNORED)
+	  obj->watch_file = -1;
+      }
+      else if (event->mask & IN_Q_OVERFLOW)
+      {
+	/* Events were lost. */
+	obj->check = 1;
+      }
+      else if ((event->wd == obj->watch_dir) && (event->len > 0)
+	  && (strcmp (event->name, obj->basename) == 0))
+      {
+	obj->check = 1;
+      }
+    }
+  }
+
+  return (1);
+#endif
+} /* int cu_tail_wait */
+
+int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen)
+{
+  char *line;
+  size_t len;
+  int status;
+
+  if (buflen < 1)
+  {
+    ERROR ("utils_tail: cu_tail_readline: buflen too small: %i bytes.",
+	buflen);
+    return (-1);
+  }
+
+  status = cu_tail_getline (obj, &line, &len);
+  if (status != 0)
     return (status);
-  /* file end reached and file not reopened -> nothing more to read */
-  else if (status > 0)
+
+  /* EOF */
+  if (line == NULL)
   {
     buf[0] = 0;
     return (0);
   }
 
-  /* If we get here: file was re-opened and there may be more to read.. Let's
-   * try again. */
-  if (fgets (buf, buflen, obj->fh) != NULL)
+  /* Like `fgets', keep the newline if it fits. */
+  if (len > (size_t) buflen - 2)
   {
-    buf[buflen - 1] = 0;
-    return (0);
+    sstrncpy (buf, line, (size_t) buflen);
   }
-
-  if (ferror (obj->fh) != 0)
+  else
   {
-    char errbuf[1024];
-    WARNING ("utils_tail: fgets (%s) returned an error: %s", obj->file,
-	sstrerror (errno, errbuf, sizeof (errbuf)));
-    fclose (obj->fh);
-    obj->fh = NULL;
-    return (-1);
+    memcpy (buf, line, len);
+    buf[len] = '\n';
+    buf[len + 1] = 0;
   }
 
-  /* EOf, well, apparently the new file is empty.. */
-  buf[0] = 0;
   return (0);
 } /* int cu_tail_readline */
 
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-		void *data)
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data)
 {
 	int status;
 
 	while (42)
 	{
+		char *line;
 		size_t len;
 
-		status = cu_tail_readline (obj, buf, buflen);
+		status = cu_tail_getline (obj, &line, &len);
 		if (status != 0)
 		{
-			ERROR ("utils_tail: cu_tail_read: cu_tail_readline "
+			ERROR ("utils_tail: cu_tail_read: cu_tail_getline "
 					"failed.");
 			break;
 		}
 
 		/* check for EOF */
-		if (buf[0] == 0)
+		if (line == NULL)
 			break;
 
-		len = strlen (buf);
-		while (len > 0) {
-			if (buf[len - 1] != '\n')
-				break;
-			buf[len - 1] = '\0';
-		}
-
-		status = callback (data, buf, buflen);
+		status = callback (data, line, (int) len + 1);
 		if (status != 0)
 		{
 			ERROR ("utils_tail: cu_tail_read: callback returned "
@@ -71,13 +71,37 @@ int cu_tail_destroy (cu_tail_t *obj);
 int cu_tail_readline (cu_tail_t *obj, char *buf, int buflen);
 
 /*
- * cu_tail_readline
+ * cu_tail_read
  *
- * Reads from the file until eof condition or an error is encountered.
+ * Reads from the file until eof condition or an error is encountered and
+ * passes each complete line to `callback', with the newline replaced by a
+ * null byte. The line is part of an internal buffer; `buflen' is its length
+ * including the null byte. A line which isn't complete yet at the end of the
+ * file is passed once it is.
  *
  * Returns 0 when successful and non-zero otherwise.
  */
-int cu_tail_read (cu_tail_t *obj, char *buf, int buflen, tailfunc_t *callback,
-		void *data);
+int cu_tail_read (cu_tail_t *obj, tailfunc_t *callback, void *data);
+
+/*
+ * cu_tail_watch
+ *
+ * Watches the file and its directory with inotify, so that `cu_tail_wait'
+ * can wait for new data and the file is only checked for rotation when it,
+ * or its name, changes rather than every time its end is reached.
+ *
+ * Returns 0 when successful and non-zero if inotify isn't available.
+ */
+int cu_tail_watch (cu_tail_t *obj);
+
+/*
+ * cu_tail_wait
+ *
+ * Waits up to `timeout' milliseconds for the file to change. Without
+ * `cu_tail_watch' this simply sleeps.
+ *
+ * Returns 1 if the file changed, 0 on timeout and -1 on error.
+ */
+int cu_tail_wait (cu_tail_t *obj, int timeout);
 
 #endif /* UTILS_TAIL_H */
@@ -31,6 +31,10 @@
 #include "utils_tail.h"
 #include "utils_tail_match.h"
 
+#include <pthread.h>
+
+#define TAIL_MATCH_FOLLOW 0x01
+
 struct cu_tail_match_simple_s
 {
   char plugin[DATA_MAX_NAME_LEN];
@@ -56,6 +60,13 @@ struct cu_tail_match_s
 
   cu_tail_match_match_t *matches;
   size_t matches_num;
+
+  /* In follow mode lines are matched by `thread' as they are written.
+   * `lock' protects the matches' data. */
+  pthread_mutex_t lock;
+  pthread_t thread;
+  _Bool thread_running;
+  _Bool thread_stop;
 };
 
 /*
@@ -105,12 +116,35 @@ static int tail_callback (void *data, char *buf,
   cu_tail_match_t *obj = (cu_tail_match_t *) data;
   size_t i;
 
+  if (obj->flags & TAIL_MATCH_FOLLOW)
+    pthread_mutex_lock (&obj->lock);
   for (i = 0; i < obj->matches_num; i++)
     match_apply (obj->matches[i].match, buf);
+  if (obj->flags & TAIL_MATCH_FOLLOW)
+    pthread_mutex_unlock (&obj->lock);
 
   return (0);
 } /* int tail_callback */
 
+static void *tail_thread (void *arg)
+{
+  cu_tail_match_t *obj = (cu_tail_match_t *) arg;
+
+  if (cu_tail_watch (obj->tail) != 0)
+    WARNING ("tail_match: Checking the file for new lines every second "
+	"instead of being notified of them.");
+
+  while (!obj->thread_stop)
+  {
+    cu_tail_read (obj->tail, tail_callback, (void *) obj);
+
+    /* Wake up now and then to notice `thread_stop'. */
+    cu_tail_wait (obj->tail, /* timeout = */ 1000);
+  }
+
+  return (NULL);
+} /* void *tail_thread */
+
 /*
  * Public functions
  */
@@ -129,6 +163,7 @@ cu_tail_match_t *tail_match_create (const char *filename)
     sfree (obj);
     return (NULL);
   }
+  pthread_mutex_init (&obj->lock, /* attr = */ NULL);
 
   return (obj);
 } /* cu_tail_match_t *tail_match_create */
@@ -140,6 +175,13 @@ void tail_match_destroy (cu_tail_match_t *obj)
   if (obj == NULL)
     return;
 
+  if (obj->thread_running)
+  {
+    obj->thread_stop = 1;
+    pthread_join (obj->thread, /* retval = */ NULL);
+    obj->thread_running = 0;
+  }
+
   if (obj->tail != NULL)
   {
     cu_tail_destroy (obj->tail);
@@ -162,9 +204,16 @@ void tail_match_destroy (cu_tail_match_t *obj)
   }
 
   sfree (obj->matches);
+  pthread_mutex_destroy (&obj->lock);
   sfree (obj);
 } /* void tail_match_destroy */
 
+void tail_match_follow (cu_tail_match_t *obj)
+{
+  if (obj != NULL)
+    obj->flags |= TAIL_MATCH_FOLLOW;
+} /* void tail_match_follow */
+
 int tail_match_add_match (cu_tail_match_t *obj, cu_match_t *match,
     int (*submit_match) (cu_match_t *match, void *user_data),
     void *user_data,
@@ -235,16 +284,39 @@ int tail_match_add_match_simple (cu_tail_match_t *obj,
 
 int tail_match_read (cu_tail_match_t *obj)
 {
-  char buffer[4096];
   int status;
   size_t i;
 
-  status = cu_tail_read (obj->tail, buffer, sizeof (buffer), tail_callback,
-      (void *) obj);
-  if (status != 0)
+  /* The thread is started by the first read, since reading starts after
+   * the daemon has forked. */
+  if ((obj->flags & TAIL_MATCH_FOLLOW) && !obj->thread_running)
   {
-    ERROR ("tail_match: cu_tail_read failed.");
-    return (status);
+    status = pthread_create (&obj->thread, /* attr = */ NULL, tail_thread,
+	(void *) obj);
+    if (status == 0)
+    {
+      obj->thread_running = 1;
+    }
+    else
+    {
+      ERROR ("tail_match: pthread_create failed with status %i. "
+	  "Reading the file periodically instead.", status);
+      obj->flags &= ~TAIL_MATCH_FOLLOW;
+    }
+  }
+
+  if (obj->thread_running)
+  {
+    pthread_mutex_lock (&obj->lock);
+  }
+  else
+  {
+    status = cu_tail_read (obj->tail, tail_callback, (void *) obj);
+    if (status != 0)
+    {
+      ERROR ("tail_match: cu_tail_read failed.");
+      return (status);
+    }
   }
 
   for (i = 0; i < obj->matches_num; i++)
@@ -257,6 +329,9 @@ int tail_match_read (cu_tail_match_t *obj)
     (*lt_match->submit) (lt_match->match, lt_match->user_data);
   }
 
+  if (obj->thread_running)
+    pthread_mutex_unlock (&obj->lock);
+
   return (0);
 } /* int tail_match_read */
 
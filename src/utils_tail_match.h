@@ -60,6 +60,21 @@ cu_tail_match_t *tail_match_create (const char *filename);
  */
 void tail_match_destroy (cu_tail_match_t *obj);
 
+/*
+ * NAME
+ *   tail_match_follow
+ *
+ * DESCRIPTION
+ *   Makes the object read and match lines in a thread of its own as they are
+ *   written, woken up by inotify where available. `tail_match_read' then only
+ *   submits the values. The thread is started by the first call of
+ *   `tail_match_read'.
+ *
+ * PARAMETERS
+ *   The object to read in its own thread.
+ */
+void tail_match_follow (cu_tail_match_t *obj);
+
 /*
  * NAME
  *   tail_match_add_match
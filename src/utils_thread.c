@@ -0,0 +1,325 @@
+/**
+ * collectd - src/utils_thread.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#define _GNU_SOURCE /* For pthread_setaffinity_np and pthread_setname_np */
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "utils_thread.h"
+
+#include <pthread.h>
+
+#if HAVE_PTHREAD_SETAFFINITY_NP
+# include <sched.h>
+# include <dirent.h>
+
+/* Parses a list like "0-3,8", as used by the kernel's `cpulist' files. */
+static int cpus_parse_list (const char *list, cpu_set_t *set) /* {{{ */
+{
+	const char *ptr = list;
+	int num = 0;
+
+	CPU_ZERO (set);
+
+	while (*ptr != 0)
+	{
+		char *endptr;
+		long first;
+		long last;
+		long i;
+
+		while ((*ptr == ',') || isspace ((int) *ptr))
+			ptr++;
+		if (*ptr == 0)
+			break;
+
+		errno = 0;
+		first = strtol (ptr, &endptr, 10);
+		if ((errno != 0) || (endptr == ptr) || (first < 0))
+			return (-1);
+		ptr = endptr;
+
+		last = first;
+		if (*ptr == '-')
+		{
+			ptr++;
+			errno = 0;
+			last = strtol (ptr, &endptr, 10);
+			if ((errno != 0) || (endptr == ptr) || (last < first))
+				return (-1);
+			ptr = endptr;
+		}
+
+		if ((*ptr != 0) && (*ptr != ',') && !isspace ((int) *ptr))
+			return (-1);
+
+		if (last >= CPU_SETSIZE)
+			return (-1);
+
+		for (i = first; i <= last; i++)
+		{
+			CPU_SET ((int) i, set);
+			num++;
+		}
+	}
+
+	return (num);
+} /* }}} int cpus_parse_list */
+
+static int cpus_read_file (const char *file, cpu_set_t *set) /* {{{ */
+{
+	char buffer[4096];
+	FILE *fh;
+
+	fh = fopen (file, "r");
+	if (fh == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("thread_check_cpus: Opening `%s' failed: %s", file,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (fgets (buffer, sizeof (buffer), fh) == NULL)
+	{
+		ERROR ("thread_check_cpus: Reading `%s' failed.", file);
+		fclose (fh);
+		return (-1);
+	}
+	fclose (fh);
+
+	return (cpus_parse_list (buffer, set));
+} /* }}} int cpus_read_file */
+
+/* Returns the number of CPUs in `set' or less than zero on error. */
+static int cpus_parse (const char *cpus, cpu_set_t *set) /* {{{ */
+{
+	char file[PATH_MAX];
+	int num;
+
+	if (strncasecmp ("node:", cpus, strlen ("node:")) == 0)
+	{
+		const char *node = cpus + strlen ("node:");
+		char *endptr = NULL;
+
+		if ((strtol (node, &endptr, 10) < 0) || (endptr == node)
+				|| (*endptr != 0))
+		{
+			ERROR ("thread_check_cpus: `%s' is not a valid NUMA node.",
+					node);
+			return (-1);
+		}
+		ssnprintf (file, sizeof (file),
+				"/sys/devices/system/node/node%s/cpulist", node);
+		num = cpus_read_file (file, set);
+	}
+	else if (strncasecmp ("interface:", cpus, strlen ("interface:")) == 0)
+	{
+		const char *iface = cpus + strlen ("interface:");
+
+		if ((*iface == 0) || (strchr (iface, '/') != NULL))
+		{
+			ERROR ("thread_check_cpus: `%s' is not a valid interface "
+					"name.", iface);
+			return (-1);
+		}
+		/* Virtual interfaces have no device and therefore no locality. */
+		ssnprintf (file, sizeof (file),
+				"/sys/class/net/%s/device/local_cpulist", iface);
+		num = cpus_read_file (file, set);
+	}
+	else
+	{
+		num = cpus_parse_list (cpus, set);
+		if (num < 0)
+			ERROR ("thread_check_cpus: Parsing the CPU list `%s' "
+					"failed.", cpus);
+	}
+
+	return (num);
+} /* }}} int cpus_parse */
+
+static int thread_set_cpus (pthread_t thread, const char *cpus) /* {{{ */
+{
+	cpu_set_t set;
+	int status;
+
+	if (cpus_parse (cpus, &set) <= 0)
+		return (-1);
+
+	status = pthread_setaffinity_np (thread, sizeof (set), &set);
+	if (status != 0)
+	{
+		char errbuf[1024];
+		ERROR ("thread_create: Binding a thread to the CPUs `%s' "
+				"failed: %s", cpus,
+				sstrerror (status, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	return (0);
+} /* }}} int thread_set_cpus */
+
+int thread_check_cpus (const char *cpus) /* {{{ */
+{
+	cpu_set_t set;
+	int num;
+
+	if (cpus == NULL)
+		return (-1);
+
+	num = cpus_parse (cpus, &set);
+	if (num == 0)
+		ERROR ("thread_check_cpus: `%s' doesn't contain any CPU.", cpus);
+
+	return ((num > 0) ? 0 : -1);
+} /* }}} int thread_check_cpus */
+
+int thread_cpu_nodes (int **ret_cpu_node, size_t *ret_cpu_num) /* {{{ */
+{
+	const char *dir = "/sys/devices/system/node";
+	int *cpu_node = NULL;
+	size_t cpu_num = 0;
+	int nodes_num = 0;
+	DIR *dh;
+	struct dirent *ent;
+
+	if ((ret_cpu_node == NULL) || (ret_cpu_num == NULL))
+		return (-1);
+
+	dh = opendir (dir);
+	if (dh == NULL)
+	{
+		char errbuf[1024];
+		ERROR ("thread_cpu_nodes: Cannot open %s: %s", dir,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	while ((ent = readdir (dh)) != NULL)
+	{
+		char file[PATH_MAX];
+		cpu_set_t set;
+		int node;
+		int cpu;
+
+		if ((strncmp (ent->d_name, "node", 4) != 0)
+				|| !isdigit ((int) ent->d_name[4]))
+			continue;
+		node = atoi (ent->d_name + 4);
+
+		ssnprintf (file, sizeof (file), "%s/%s/cpulist", dir, ent->d_name);
+		if (cpus_read_file (file, &set) < 0)
+			continue;
+
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+		{
+			if (!CPU_ISSET (cpu, &set))
+				continue;
+
+			if ((size_t) cpu >= cpu_num)
+			{
+				int *tmp;
+				size_t i;
+
+				tmp = realloc (cpu_node, (cpu + 1) * sizeof (*tmp));
+				if (tmp == NULL)
+				{
+					ERROR ("thread_cpu_nodes: realloc failed.");
+					closedir (dh);
+					sfree (cpu_node);
+					return (-1);
+				}
+				for (i = cpu_num; i <= (size_t) cpu; i++)
+					tmp[i] = -1;
+				cpu_node = tmp;
+				cpu_num = (size_t) cpu + 1;
+			}
+
+			cpu_node[cpu] = node;
+		}
+
+		if (node >= nodes_num)
+			nodes_num = node + 1;
+	}
+
+	closedir (dh);
+
+	if (nodes_num == 0)
+	{
+		ERROR ("thread_cpu_nodes: No NUMA nodes found in %s.", dir);
+		sfree (cpu_node);
+		return (-1);
+	}
+
+	*ret_cpu_node = cpu_node;
+	*ret_cpu_num = cpu_num;
+	return (nodes_num);
+} /* }}} int thread_cpu_nodes */
+#else /* !HAVE_PTHREAD_SETAFFINITY_NP */
+static int thread_set_cpus (pthread_t __attribute__((unused)) thread, /* {{{ */
+		const char __attribute__((unused)) *cpus)
+{
+	return (-1);
+} /* }}} int thread_set_cpus */
+
+int thread_check_cpus (const char *cpus) /* {{{ */
+{
+	ERROR ("thread_check_cpus: Binding threads to the CPUs `%s' is not "
+			"supported on this system.", cpus);
+	return (-1);
+} /* }}} int thread_check_cpus */
+
+int thread_cpu_nodes (int __attribute__((unused)) **ret_cpu_node, /* {{{ */
+		size_t __attribute__((unused)) *ret_cpu_num)
+{
+	ERROR ("thread_cpu_nodes: Reading the NUMA nodes of the CPUs is not "
+			"supported on this system.");
+	return (-1);
+} /* }}} int thread_cpu_nodes */
+#endif /* HAVE_PTHREAD_SETAFFINITY_NP */
+
+int thread_create (pthread_t *thread, const pthread_attr_t *attr, /* {{{ */
+		void *(*start_routine) (void *), void *arg,
+		const char *name, const char *cpus)
+{
+	int status;
+
+	status = pthread_create (thread, attr, start_routine, arg);
+	if (status != 0)
+		return (status);
+
+#if HAVE_PTHREAD_SETNAME_NP
+	if (name != NULL)
+	{
+		/* Linux limits names to 16 bytes, including the null byte. */
+		char buffer[16];
+
+		sstrncpy (buffer, name, sizeof (buffer));
+		pthread_setname_np (*thread, buffer);
+	}
+#endif
+
+	if (cpus != NULL)
+		thread_set_cpus (*thread, cpus);
+
+	return (0);
+} /* }}} int thread_create */
+
+/* vim: set sw=8 sts=8 ts=8 noet fdm=marker : */
@@ -0,0 +1,83 @@
+/**
+ * collectd - src/utils_thread.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_THREAD_H
+#define UTILS_THREAD_H 1
+
+#include <pthread.h>
+
+/*
+ * NAME
+ *   thread_create
+ *
+ * DESCRIPTION
+ *   Starts a thread like `pthread_create' does, names it and, optionally,
+ *   binds it to a set of CPUs. Failing to name or bind the thread is logged,
+ *   but the thread keeps running.
+ *
+ * PARAMETERS
+ *   `name'     Name of the thread as shown by top(1) or perf(1). Only the
+ *              first 15 characters are used.
+ *   `cpus'     CPUs the thread may run on, see `thread_check_cpus', or NULL
+ *              to leave the thread's affinity alone.
+ *
+ * RETURN VALUE
+ *   Zero upon success or the error returned by `pthread_create'.
+ */
+int thread_create (pthread_t *thread, const pthread_attr_t *attr,
+		void *(*start_routine) (void *), void *arg,
+		const char *name, const char *cpus);
+
+/*
+ * NAME
+ *   thread_check_cpus
+ *
+ * DESCRIPTION
+ *   Checks a CPU set, so configuration errors are reported when the option
+ *   is read. The set is one of:
+ *
+ *     "0-3,8"            A list of CPUs and ranges of CPUs.
+ *     "node:<N>"         The CPUs of NUMA node <N>.
+ *     "interface:<name>" The CPUs local to network interface <name>, i.e.
+ *                        to the node its device is attached to.
+ *
+ * RETURN VALUE
+ *   Zero if the set names at least one CPU, non-zero (and an error has been
+ *   logged) otherwise.
+ */
+int thread_check_cpus (const char *cpus);
+
+/*
+ * NAME
+ *   thread_cpu_nodes
+ *
+ * DESCRIPTION
+ *   Reads which CPUs belong to which NUMA node from the `cpulist' files in
+ *   /sys/devices/system/node, using the same parser as `thread_check_cpus'.
+ *   On success `*ret_cpu_node' points to a newly allocated array of
+ *   `*ret_cpu_num' elements, holding the node of each CPU or -1 for CPUs
+ *   which don't belong to any node. The caller must free it.
+ *
+ * RETURN VALUE
+ *   The number of nodes, i.e. the highest node number plus one, or less than
+ *   zero (and an error has been logged) on failure.
+ */
+int thread_cpu_nodes (int **ret_cpu_node, size_t *ret_cpu_num);
+
+#endif /* UTILS_THREAD_H */
+/* vim: set sw=8 sts=8 ts=8 noet : */
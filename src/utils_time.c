@@ -24,6 +24,11 @@
 #include "plugin.h"
 #include "common.h"
 
+#include <pthread.h>
+
+static pthread_key_t  cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
 #if HAVE_CLOCK_GETTIME
 cdtime_t cdtime (void) /* {{{ */
 {
@@ -61,4 +66,86 @@ cdtime_t cdtime (void) /* {{{ */
 } /* }}} cdtime_t cdtime */
 #endif
 
+#if HAVE_CDTIME_MONOTONIC
+cdtime_t cdtime_monotonic (void) /* {{{ */
+{
+  int status;
+  struct timespec ts = { 0, 0 };
+
+  status = clock_gettime (CLOCK_MONOTONIC, &ts);
+  if (status != 0)
+  {
+    char errbuf[1024];
+    ERROR ("cdtime_monotonic: clock_gettime failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (0);
+  }
+
+  return (TIMESPEC_TO_CDTIME_T (&ts));
+} /* }}} cdtime_t cdtime_monotonic */
+#else
+cdtime_t cdtime_monotonic (void) /* {{{ */
+{
+  return (cdtime ());
+} /* }}} cdtime_t cdtime_monotonic */
+#endif
+
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_REALTIME_COARSE)
+cdtime_t cdtime_coarse (void) /* {{{ */
+{
+  struct timespec ts = { 0, 0 };
+
+  /* Not supported by kernels before 2.6.32. */
+  if (clock_gettime (CLOCK_REALTIME_COARSE, &ts) != 0)
+    return (cdtime ());
+
+  return (TIMESPEC_TO_CDTIME_T (&ts));
+} /* }}} cdtime_t cdtime_coarse */
+#else
+cdtime_t cdtime_coarse (void) /* {{{ */
+{
+  return (cdtime ());
+} /* }}} cdtime_t cdtime_coarse */
+#endif
+
+static void cache_key_create (void) /* {{{ */
+{
+  pthread_key_create (&cache_key, free);
+} /* }}} void cache_key_create */
+
+void cdtime_cache_set (cdtime_t t) /* {{{ */
+{
+  cdtime_t *cached;
+
+  pthread_once (&cache_once, cache_key_create);
+
+  cached = pthread_getspecific (cache_key);
+  if (cached == NULL)
+  {
+    if (t == 0)
+      return;
+
+    /* cdtime_t doesn't fit into a pointer on 32 bit systems. */
+    cached = malloc (sizeof (*cached));
+    if (cached == NULL)
+      return;
+    pthread_setspecific (cache_key, cached);
+  }
+
+  *cached = t;
+} /* }}} void cdtime_cache_set */
+
+cdtime_t cdtime_cached (void) /* {{{ */
+{
+  cdtime_t *cached;
+
+  pthread_once (&cache_once, cache_key_create);
+
+  cached = pthread_getspecific (cache_key);
+  if ((cached == NULL) || (*cached == 0))
+    return (cdtime ());
+
+  return (*cached);
+} /* }}} cdtime_t cdtime_cached */
+
 /* vim: set sw=2 sts=2 et fdm=marker : */
@@ -66,5 +66,26 @@
 
 cdtime_t cdtime (void);
 
+/* Time since an arbitrary point in the past, which isn't affected by changes
+ * of the system time. Use it to measure intervals and for timeouts. If the
+ * system has no monotonic clock, it's the same as `cdtime'. */
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+# define HAVE_CDTIME_MONOTONIC 1
+#endif
+cdtime_t cdtime_monotonic (void);
+
+/* Wall clock time at a resolution of a few milliseconds, which is cheaper to
+ * get than `cdtime' where the system provides CLOCK_REALTIME_COARSE. Good
+ * enough for timestamps of values read every few seconds. */
+cdtime_t cdtime_coarse (void);
+
+/* Per-thread timestamp: After `cdtime_cache_set (t)' with a non-zero `t',
+ * `cdtime_cached' returns `t' in this thread until the cache is cleared
+ * with `cdtime_cache_set (0)'. Without a cached time, `cdtime_cached'
+ * returns `cdtime ()'. The read threads use this to give all values of one
+ * read callback the same timestamp. */
+void cdtime_cache_set (cdtime_t t);
+cdtime_t cdtime_cached (void);
+
 #endif /* UTILS_TIME_H */
 /* vim: set sw=2 sts=2 et : */
@@ -0,0 +1,267 @@
+/**
+ * collectd - src/utils_timerwheel.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils_timerwheel.h"
+
+/* Four levels of 64 lists each: with a resolution of 10ms, the finest level
+ * covers 640ms and the whole wheel about 1.9 days. Timers further out are
+ * kept in the last list and put back when their list comes up. */
+#define TW_BITS   6
+#define TW_SLOTS  (1 << TW_BITS)
+#define TW_MASK   (TW_SLOTS - 1)
+#define TW_LEVELS 4
+
+/*
+ * private data types
+ */
+struct c_timerwheel_s
+{
+	c_timer_t *slots[TW_LEVELS][TW_SLOTS];
+	/* Due timers which haven't been returned yet. */
+	c_timer_t *expired;
+
+	uint64_t resolution;
+	/* The current tick, i.e. the time divided by `resolution'. */
+	uint64_t tick;
+
+	/* Number of timers in `slots', not counting `expired'. */
+	int slots_num;
+	int size;
+};
+
+/*
+ * private functions
+ */
+static void tw_add (c_timerwheel_t *w, c_timer_t *t)
+{
+	uint64_t ticks;
+	uint64_t delta;
+	int level;
+	int slot;
+
+	/* Round up, so that timers are never returned early. */
+	ticks = t->due / w->resolution;
+	if ((t->due % w->resolution) != 0)
+		ticks++;
+
+	if (ticks <= w->tick)
+	{
+		t->next = w->expired;
+		w->expired = t;
+		return;
+	}
+
+	delta = ticks - w->tick;
+	for (level = 0; level < TW_LEVELS - 1; level++)
+		if (delta < (((uint64_t) 1) << (TW_BITS * (level + 1))))
+			break;
+
+	if (delta >= (((uint64_t) 1) << (TW_BITS * TW_LEVELS)))
+		ticks = w->tick + (((uint64_t) 1) << (TW_BITS * TW_LEVELS)) - 1;
+
+	slot = (int) ((ticks >> (TW_BITS * level)) & TW_MASK);
+	t->next = w->slots[level][slot];
+	w->slots[level][slot] = t;
+	w->slots_num++;
+} /* void tw_add */
+
+/* Re-adds all timers of one list, moving them to a finer level or to the
+ * expired list. */
+static void tw_cascade (c_timerwheel_t *w, int level, int slot)
+{
+	c_timer_t *t;
+
+	t = w->slots[level][slot];
+	w->slots[level][slot] = NULL;
+
+	while (t != NULL)
+	{
+		c_timer_t *next = t->next;
+
+		w->slots_num--;
+		tw_add (w, t);
+		t = next;
+	}
+} /* void tw_cascade */
+
+/*
+ * public functions
+ */
+c_timerwheel_t *c_timerwheel_create (uint64_t now, uint64_t resolution)
+{
+	c_timerwheel_t *w;
+
+	if (resolution == 0)
+		return (NULL);
+
+	w = (c_timerwheel_t *) malloc (sizeof (*w));
+	if (w == NULL)
+		return (NULL);
+	memset (w, 0, sizeof (*w));
+
+	w->resolution = resolution;
+	w->tick = now / resolution;
+
+	return (w);
+} /* c_timerwheel_t *c_timerwheel_create */
+
+void c_timerwheel_destroy (c_timerwheel_t *w)
+{
+	free (w);
+} /* void c_timerwheel_destroy */
+
+void c_timerwheel_insert (c_timerwheel_t *w, c_timer_t *t)
+{
+	if ((w == NULL) || (t == NULL))
+		return;
+
+	tw_add (w, t);
+	w->size++;
+} /* void c_timerwheel_insert */
+
+c_timer_t *c_timerwheel_advance (c_timerwheel_t *w, uint64_t now)
+{
+	uint64_t target;
+	c_timer_t *ret;
+	c_timer_t *t;
+	int level;
+
+	if (w == NULL)
+		return (NULL);
+
+	target = now / w->resolution;
+	while ((w->tick < target) && (w->slots_num > 0))
+	{
+		w->tick++;
+
+		/* Coarse levels first, so that their timers reach the finest
+		 * level before its list for this tick is taken. */
+		for (level = TW_LEVELS - 1; level > 0; level--)
+		{
+			uint64_t mask = (((uint64_t) 1) << (TW_BITS * level)) - 1;
+
+			if ((w->tick & mask) == 0)
+				tw_cascade (w, level,
+						(int) ((w->tick >> (TW_BITS * level)) & TW_MASK));
+		}
+
+		tw_cascade (w, /* level = */ 0, (int) (w->tick & TW_MASK));
+	}
+
+	/* Nothing more to do for the ticks in between. */
+	if (w->tick < target)
+		w->tick = target;
+
+	ret = w->expired;
+	w->expired = NULL;
+
+	for (t = ret; t != NULL; t = t->next)
+		w->size--;
+
+	return (ret);
+} /* c_timer_t *c_timerwheel_advance */
+
+int c_timerwheel_next (c_timerwheel_t *w, uint64_t *ret_time)
+{
+	uint64_t next = 0;
+	_Bool found = 0;
+	int level;
+
+	if ((w == NULL) || (ret_time == NULL))
+		return (-1);
+
+	if (w->expired != NULL)
+	{
+		*ret_time = w->tick * w->resolution;
+		return (0);
+	}
+
+	if (w->slots_num == 0)
+		return (-1);
+
+	/* Each list holds the timers of one block of ticks, which starts
+	 * between one and TW_SLOTS blocks after the current one. */
+	for (level = 0; level < TW_LEVELS; level++)
+	{
+		uint64_t block = w->tick >> (TW_BITS * level);
+		uint64_t i;
+
+		for (i = 1; i <= TW_SLOTS; i++)
+		{
+			uint64_t start;
+
+			if (w->slots[level][(block + i) & TW_MASK] == NULL)
+				continue;
+
+			start = (block + i) << (TW_BITS * level);
+			if (!found || (start < next))
+				next = start;
+			found = 1;
+			break;
+		}
+	}
+
+	*ret_time = next * w->resolution;
+	return (0);
+} /* int c_timerwheel_next */
+
+c_timer_t *c_timerwheel_take_all (c_timerwheel_t *w)
+{
+	c_timer_t *ret;
+	int level;
+	int slot;
+
+	if (w == NULL)
+		return (NULL);
+
+	ret = w->expired;
+	w->expired = NULL;
+
+	for (level = 0; level < TW_LEVELS; level++)
+	{
+		for (slot = 0; slot < TW_SLOTS; slot++)
+		{
+			while (w->slots[level][slot] != NULL)
+			{
+				c_timer_t *t = w->slots[level][slot];
+
+				w->slots[level][slot] = t->next;
+				t->next = ret;
+				ret = t;
+			}
+		}
+	}
+
+	w->slots_num = 0;
+	w->size = 0;
+
+	return (ret);
+} /* c_timer_t *c_timerwheel_take_all */
+
+int c_timerwheel_size (c_timerwheel_t *w)
+{
+	if (w == NULL)
+		return (0);
+	return (w->size);
+} /* int c_timerwheel_size */
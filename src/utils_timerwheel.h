@@ -0,0 +1,134 @@
+/**
+ * collectd - src/utils_timerwheel.h
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#ifndef UTILS_TIMERWHEEL_H
+#define UTILS_TIMERWHEEL_H 1
+
+#include <stdint.h>
+
+/*
+ * A hierarchical timer wheel: timers are kept in lists, one for each tick of
+ * the near future and coarser ones further out, which are split up as their
+ * time comes closer. Inserting a timer and taking the due ones takes constant
+ * time regardless of the number of timers. Timers are embedded in the
+ * caller's structures ("intrusive"), so the wheel doesn't allocate memory
+ * after it has been created. The wheel is not thread-safe.
+ */
+
+struct c_timer_s
+{
+	/* Used by the wheel. The owner may use it to link timers which are not
+	 * in a wheel. */
+	struct c_timer_s *next;
+	/* The time at which the timer is due, in the same unit as the
+	 * `resolution' of the wheel. */
+	uint64_t due;
+};
+typedef struct c_timer_s c_timer_t;
+
+struct c_timerwheel_s;
+typedef struct c_timerwheel_s c_timerwheel_t;
+
+/*
+ * NAME
+ *   c_timerwheel_create
+ *
+ * DESCRIPTION
+ *   Allocates a new, empty timer wheel.
+ *
+ * PARAMETERS
+ *   `now'         The current time.
+ *   `resolution'  Length of one tick. Timers are returned by
+ *                 `c_timerwheel_advance' up to one tick after they are due,
+ *                 never before.
+ *
+ * RETURN VALUE
+ *   A c_timerwheel_t-pointer upon success or NULL upon failure.
+ */
+c_timerwheel_t *c_timerwheel_create (uint64_t now, uint64_t resolution);
+
+/*
+ * NAME
+ *   c_timerwheel_destroy
+ *
+ * DESCRIPTION
+ *   Deallocates a timer wheel. Timers still in the wheel are lost, use
+ *   `c_timerwheel_take_all' first if they need to be freed.
+ */
+void c_timerwheel_destroy (c_timerwheel_t *w);
+
+/*
+ * NAME
+ *   c_timerwheel_insert
+ *
+ * DESCRIPTION
+ *   Adds the timer `t', which is due at `t->due', to the wheel. A timer may
+ *   only be in one wheel at a time and must not be changed until it has been
+ *   returned by `c_timerwheel_advance' or `c_timerwheel_take_all'.
+ */
+void c_timerwheel_insert (c_timerwheel_t *w, c_timer_t *t);
+
+/*
+ * NAME
+ *   c_timerwheel_advance
+ *
+ * DESCRIPTION
+ *   Moves the wheel forward to `now' and removes all timers which are due.
+ *
+ * RETURN VALUE
+ *   A list of the due timers, linked by their `next' member and in no
+ *   particular order, or NULL if no timer is due.
+ */
+c_timer_t *c_timerwheel_advance (c_timerwheel_t *w, uint64_t now);
+
+/*
+ * NAME
+ *   c_timerwheel_next
+ *
+ * DESCRIPTION
+ *   Returns in `ret_time' when `c_timerwheel_advance' has to be called next.
+ *   This is the time of the next due timer or earlier, when timers have to
+ *   be moved from a coarse list to finer ones.
+ *
+ * RETURN VALUE
+ *   Zero upon success or non-zero if the wheel is empty.
+ */
+int c_timerwheel_next (c_timerwheel_t *w, uint64_t *ret_time);
+
+/*
+ * NAME
+ *   c_timerwheel_take_all
+ *
+ * DESCRIPTION
+ *   Removes all timers from the wheel and returns them like
+ *   `c_timerwheel_advance'.
+ */
+c_timer_t *c_timerwheel_take_all (c_timerwheel_t *w);
+
+/*
+ * NAME
+ *   c_timerwheel_size
+ *
+ * DESCRIPTION
+ *   Return the number of timers in the wheel, 0 if the wheel is empty or
+ *   NULL.
+ */
+int c_timerwheel_size (c_timerwheel_t *w);
+
+#endif /* UTILS_TIMERWHEEL_H */
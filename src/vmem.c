@@ -22,6 +22,7 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #if KERNEL_LINUX
 static const char *config_keys[] =
@@ -31,6 +32,8 @@ static const char *config_keys[] =
 static int config_keys_num = STATIC_ARRAY_SIZE (config_keys);
 
 static int verbose_output = 0;
+
+static procfs_file_t *proc_vmstat = NULL;
 /* #endif KERNEL_LINUX */
 
 #else
@@ -105,19 +108,21 @@ static int vmem_read (void)
   derive_t pgmajfault = 0;
   int pgfaultvalid = 0;
 
-  FILE *fh;
-  char buffer[1024];
+  char *buffer;
+  char *line;
 
-  fh = fopen ("/proc/vmstat", "r");
-  if (fh == NULL)
+  if (proc_vmstat == NULL)
   {
-    char errbuf[1024];
-    ERROR ("vmem plugin: fopen (/proc/vmstat) failed: %s",
-	sstrerror (errno, errbuf, sizeof (errbuf)));
-    return (-1);
+    proc_vmstat = procfs_open ("/proc/vmstat", /* max age = */ 0);
+    if (proc_vmstat == NULL)
+      return (-1);
   }
 
-  while (fgets (buffer, sizeof (buffer), fh) != NULL)
+  buffer = procfs_read (proc_vmstat, /* time = */ NULL);
+  if (buffer == NULL)
+    return (-1);
+
+  while ((line = procfs_next_line (&buffer)) != NULL)
   {
     char *fields[4];
     int fields_num;
@@ -126,7 +131,7 @@ static int vmem_read (void)
     derive_t counter;
     gauge_t gauge;
 
-    fields_num = strsplit (buffer, fields, STATIC_ARRAY_SIZE (fields));
+    fields_num = strsplit (line, fields, STATIC_ARRAY_SIZE (fields));
     if (fields_num != 2)
       continue;
 
@@ -254,10 +259,7 @@ static int vmem_read (void)
       value_t value  = { .derive = counter };
       submit_one (NULL, "vmpage_action", "deactivate", value);
     }
-  } /* while (fgets) */
-
-  fclose (fh);
-  fh = NULL;
+  } /* while (procfs_next_line) */
 
   if (pgfaultvalid == 0x03)
     submit_two (NULL, "vmpage_faults", NULL, pgfault, pgmajfault);
@@ -272,11 +274,22 @@ static int vmem_read (void)
   return (0);
 } /* int vmem_read */
 
+static int vmem_shutdown (void)
+{
+#if KERNEL_LINUX
+  procfs_close (proc_vmstat);
+  proc_vmstat = NULL;
+#endif /* KERNEL_LINUX */
+
+  return (0);
+} /* int vmem_shutdown */
+
 void module_register (void)
 {
   plugin_register_config ("vmem", vmem_config,
       config_keys, config_keys_num);
   plugin_register_read ("vmem", vmem_read);
+  plugin_register_shutdown ("vmem", vmem_shutdown);
 } /* void module_register */
 
 /* vim: set sw=2 sts=2 ts=8 : */
@@ -24,8 +24,10 @@
 #include "collectd.h"
 #include "common.h"
 #include "plugin.h"
+#include "utils_procfs.h"
 
 #include <dirent.h>
+#include <fcntl.h>
 #include <sys/types.h>
 
 #define BUFSIZE 512
@@ -124,17 +126,99 @@ static derive_t vserver_get_sock_bytes(const char *s)
 	return (v.derive);
 }
 
-static int vserver_read (void)
+/* Each context is a directory in PROCDIR. The list of contexts is kept
+ * between reads and only read again when the directory's modification time
+ * or link count changes, or when a context has disappeared. With `openat',
+ * each context's directory is kept open, so reading its files doesn't look up
+ * the path again. */
+struct vs_context_s
+{
+	char name[DATA_MAX_NAME_LEN];
+	int dir_fd;
+	_Bool seen;
+};
+typedef struct vs_context_s vs_context_t;
+
+static vs_context_t *contexts = NULL;
+static size_t contexts_num = 0;
+static _Bool contexts_valid = 0;
+static time_t contexts_mtime = 0;
+static nlink_t contexts_nlink = 0;
+
+/* The contents of the file read last. */
+static char *vs_buffer = NULL;
+static size_t vs_buffer_size = 0;
+
+static void vs_context_close (vs_context_t *ctx)
 {
-#if NAME_MAX < 1024
-# define DIRENT_BUFFER_SIZE (sizeof (struct dirent) + 1024 + 1)
+	if (ctx->dir_fd >= 0)
+		close (ctx->dir_fd);
+	ctx->dir_fd = -1;
+} /* void vs_context_close */
+
+static int vs_context_add (DIR *proc, const char *name)
+{
+	vs_context_t *tmp;
+	vs_context_t *ctx;
+
+	tmp = realloc (contexts, (contexts_num + 1) * sizeof (*contexts));
+	if (tmp == NULL)
+	{
+		ERROR ("vserver plugin: realloc failed.");
+		return (-1);
+	}
+	contexts = tmp;
+
+	ctx = contexts + contexts_num;
+	memset (ctx, 0, sizeof (*ctx));
+	sstrncpy (ctx->name, name, sizeof (ctx->name));
+	ctx->dir_fd = -1;
+	ctx->seen = 1;
+
+#if HAVE_OPENAT
+	ctx->dir_fd = openat (dirfd (proc), name, O_RDONLY | O_DIRECTORY);
+	if (ctx->dir_fd < 0)
+	{
+		char errbuf[1024];
+		WARNING ("vserver plugin: open (%s/%s) failed: %s", PROCDIR, name,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+	fcntl (ctx->dir_fd, F_SETFD, FD_CLOEXEC);
 #else
-# define DIRENT_BUFFER_SIZE (sizeof (struct dirent) + NAME_MAX + 1)
+	(void) proc;
 #endif
 
+	contexts_num++;
+	return (0);
+} /* int vs_context_add */
+
+/* Reads the list of contexts if PROCDIR has changed since it was read last. */
+static int vs_contexts_update (void)
+{
 	DIR 			*proc;
 	struct dirent 	*dent; /* 42 */
-	char dirent_buffer[DIRENT_BUFFER_SIZE];
+	struct stat statbuf;
+	time_t mtime;
+	nlink_t nlink;
+	size_t i;
+	size_t j;
+
+	if (stat (PROCDIR, &statbuf) != 0)
+	{
+		char errbuf[1024];
+		ERROR ("vserver plugin: stat (%s): %s", PROCDIR,
+				sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
+
+	if (contexts_valid && (statbuf.st_mtime == contexts_mtime)
+			&& (statbuf.st_nlink == contexts_nlink))
+		return (0);
+
+	/* Changes while the directory is read are noticed next time. */
+	mtime = statbuf.st_mtime;
+	nlink = statbuf.st_nlink;
 
 	errno = 0;
 	proc = opendir (PROCDIR);
@@ -146,24 +230,20 @@ static int vserver_read (void)
 		return (-1);
 	}
 
+	for (i = 0; i < contexts_num; i++)
+		contexts[i].seen = 0;
+
+	/* `proc' is private to this function, so `readdir' is safe. */
 	while (42)
 	{
-		int len;
-		char file[BUFSIZE];
-
-		FILE *fh;
-		char buffer[BUFSIZE];
-
-		struct stat statbuf;
-		char *cols[4];
-
 		int status;
 
-		status = readdir_r (proc, (struct dirent *) dirent_buffer, &dent);
-		if (status != 0)
+		errno = 0;
+		dent = readdir (proc);
+		if ((dent == NULL) && (errno != 0))
 		{
 			char errbuf[4096];
-			ERROR ("vserver plugin: readdir_r failed: %s",
+			ERROR ("vserver plugin: readdir failed: %s",
 					sstrerror (errno, errbuf, sizeof (errbuf)));
 			closedir (proc);
 			return (-1);
@@ -177,186 +257,306 @@ static int vserver_read (void)
 		if (dent->d_name[0] == '.')
 			continue;
 
-		len = ssnprintf (file, sizeof (file), PROCDIR "/%s", dent->d_name);
-		if ((len < 0) || (len >= BUFSIZE))
-			continue;
-		
-		status = stat (file, &statbuf);
+#if HAVE_OPENAT
+		status = fstatat (dirfd (proc), dent->d_name, &statbuf, 0);
+#else
+		{
+			char file[BUFSIZE];
+			ssnprintf (file, sizeof (file), PROCDIR "/%s", dent->d_name);
+			status = stat (file, &statbuf);
+		}
+#endif
 		if (status != 0)
 		{
 			char errbuf[4096];
-			WARNING ("vserver plugin: stat (%s) failed: %s",
-					file, sstrerror (errno, errbuf, sizeof (errbuf)));
+			WARNING ("vserver plugin: stat (%s/%s) failed: %s", PROCDIR,
+					dent->d_name, sstrerror (errno, errbuf, sizeof (errbuf)));
 			continue;
 		}
-		
+
 		if (!S_ISDIR (statbuf.st_mode))
 			continue;
 
-		/* socket message accounting */
-		len = ssnprintf (file, sizeof (file),
-				PROCDIR "/%s/cacct", dent->d_name);
-		if ((len < 0) || ((size_t) len >= sizeof (file)))
-			continue;
+		for (i = 0; i < contexts_num; i++)
+			if (strcmp (contexts[i].name, dent->d_name) == 0)
+				break;
 
-		if (NULL == (fh = fopen (file, "r")))
-		{
-			char errbuf[1024];
-			ERROR ("Cannot open '%s': %s", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-		}
+		if (i < contexts_num)
+			contexts[i].seen = 1;
+		else
+			vs_context_add (proc, dent->d_name);
+	} /* while (readdir) */
 
-		while ((fh != NULL) && (NULL != fgets (buffer, BUFSIZE, fh)))
+	closedir (proc);
+
+	/* Forget the contexts which are gone. */
+	for (i = 0, j = 0; i < contexts_num; i++)
+	{
+		if (!contexts[i].seen)
 		{
-			derive_t rx;
-			derive_t tx;
-			char *type_instance;
+			vs_context_close (contexts + i);
+			continue;
+		}
+		if (i != j)
+			contexts[j] = contexts[i];
+		j++;
+	}
+	contexts_num = j;
 
-			if (strsplit (buffer, cols, 4) < 4)
-				continue;
+	contexts_mtime = mtime;
+	contexts_nlink = nlink;
+	contexts_valid = 1;
 
-			if (0 == strcmp (cols[0], "UNIX:"))
-				type_instance = "unix";
-			else if (0 == strcmp (cols[0], "INET:"))
-				type_instance = "inet";
-			else if (0 == strcmp (cols[0], "INET6:"))
-				type_instance = "inet6";
-			else if (0 == strcmp (cols[0], "OTHER:"))
-				type_instance = "other";
-			else if (0 == strcmp (cols[0], "UNSPEC:"))
-				type_instance = "unspec";
-			else
-				continue;
+	return (0);
+} /* int vs_contexts_update */
 
-			rx = vserver_get_sock_bytes (cols[1]);
-			tx = vserver_get_sock_bytes (cols[2]);
-			/* cols[3] == errors */
+/* Reads the file `file' of the context `ctx' into `vs_buffer'. Returns zero
+ * upon success. */
+static int vs_read_file (vs_context_t *ctx, const char *file)
+{
+	size_t fill = 0;
+	int fd;
 
-			traffic_submit (dent->d_name, type_instance, rx, tx);
-		} /* while (fgets) */
+#if HAVE_OPENAT
+	fd = openat (ctx->dir_fd, file, O_RDONLY);
+#else
+	{
+		char path[BUFSIZE];
+		ssnprintf (path, sizeof (path), PROCDIR "/%s/%s", ctx->name, file);
+		fd = open (path, O_RDONLY);
+	}
+#endif
+	if (fd < 0)
+	{
+		char errbuf[1024];
 
-		if (fh != NULL)
+		/* The context has been stopped. */
+		if ((errno == ENOENT) || (errno == ESRCH))
 		{
-			fclose (fh);
-			fh = NULL;
+			contexts_valid = 0;
+			return (-1);
 		}
 
-		/* thread information and load */
-		len = ssnprintf (file, sizeof (file),
-				PROCDIR "/%s/cvirt", dent->d_name);
-		if ((len < 0) || ((size_t) len >= sizeof (file)))
-			continue;
+		ERROR ("vserver plugin: Cannot open '%s/%s/%s': %s", PROCDIR,
+				ctx->name, file, sstrerror (errno, errbuf, sizeof (errbuf)));
+		return (-1);
+	}
 
-		if (NULL == (fh = fopen (file, "r")))
-		{
-			char errbuf[1024];
-			ERROR ("Cannot open '%s': %s", file,
-					sstrerror (errno, errbuf, sizeof (errbuf)));
-		}
+	while (42)
+	{
+		ssize_t status;
 
-		while ((fh != NULL) && (NULL != fgets (buffer, BUFSIZE, fh)))
+		if ((vs_buffer == NULL) || (fill + 1 >= vs_buffer_size))
 		{
-			int n = strsplit (buffer, cols, 4);
+			size_t new_size = (vs_buffer == NULL)
+				? 4096 : 2 * vs_buffer_size;
+			char *tmp;
 
-			if (2 == n)
+			tmp = realloc (vs_buffer, new_size);
+			if (tmp == NULL)
 			{
-				char   *type_instance;
-				gauge_t value;
-
-				if (0 == strcmp (cols[0], "nr_threads:"))
-					type_instance = "total";
-				else if (0 == strcmp (cols[0], "nr_running:"))
-					type_instance = "running";
-				else if (0 == strcmp (cols[0], "nr_unintr:"))
-					type_instance = "uninterruptable";
-				else if (0 == strcmp (cols[0], "nr_onhold:"))
-					type_instance = "onhold";
-				else
-					continue;
-
-				value = atof (cols[1]);
-				submit_gauge (dent->d_name, "vs_threads", type_instance, value);
-			}
-			else if (4 == n) {
-				if (0 == strcmp (cols[0], "loadavg:"))
-				{
-					gauge_t snum = atof (cols[1]);
-					gauge_t mnum = atof (cols[2]);
-					gauge_t lnum = atof (cols[3]);
-					load_submit (dent->d_name, snum, mnum, lnum);
-				}
+				ERROR ("vserver plugin: realloc failed.");
+				close (fd);
+				return (-1);
 			}
-		} /* while (fgets) */
-
-		if (fh != NULL)
-		{
-			fclose (fh);
-			fh = NULL;
+			vs_buffer = tmp;
+			vs_buffer_size = new_size;
 		}
 
-		/* processes and memory usage */
-		len = ssnprintf (file, sizeof (file),
-				PROCDIR "/%s/limit", dent->d_name);
-		if ((len < 0) || ((size_t) len >= sizeof (file)))
-			continue;
-
-		if (NULL == (fh = fopen (file, "r")))
+		status = pread (fd, vs_buffer + fill, vs_buffer_size - fill - 1,
+				(off_t) fill);
+		if (status < 0)
 		{
 			char errbuf[1024];
-			ERROR ("Cannot open '%s': %s", file,
+
+			if (errno == EINTR)
+				continue;
+
+			ERROR ("vserver plugin: Reading '%s/%s/%s' failed: %s",
+					PROCDIR, ctx->name, file,
 					sstrerror (errno, errbuf, sizeof (errbuf)));
+			close (fd);
+			return (-1);
 		}
+		else if (status == 0)
+			break;
+
+		fill += (size_t) status;
+	}
+
+	close (fd);
+	vs_buffer[fill] = 0;
+	return (0);
+} /* int vs_read_file */
+
+/* socket message accounting */
+static void vs_read_cacct (vs_context_t *ctx)
+{
+	char *buffer = vs_buffer;
+	char *line;
+
+	if (vs_read_file (ctx, "cacct") != 0)
+		return;
 
-		while ((fh != NULL) && (NULL != fgets (buffer, BUFSIZE, fh)))
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		char *cols[4];
+		derive_t rx;
+		derive_t tx;
+		char *type_instance;
+
+		if (strsplit (line, cols, 4) < 4)
+			continue;
+
+		if (0 == strcmp (cols[0], "UNIX:"))
+			type_instance = "unix";
+		else if (0 == strcmp (cols[0], "INET:"))
+			type_instance = "inet";
+		else if (0 == strcmp (cols[0], "INET6:"))
+			type_instance = "inet6";
+		else if (0 == strcmp (cols[0], "OTHER:"))
+			type_instance = "other";
+		else if (0 == strcmp (cols[0], "UNSPEC:"))
+			type_instance = "unspec";
+		else
+			continue;
+
+		rx = vserver_get_sock_bytes (cols[1]);
+		tx = vserver_get_sock_bytes (cols[2]);
+		/* cols[3] == errors */
+
+		traffic_submit (ctx->name, type_instance, rx, tx);
+	}
+} /* void vs_read_cacct */
+
+/* thread information and load */
+static void vs_read_cvirt (vs_context_t *ctx)
+{
+	char *buffer = vs_buffer;
+	char *line;
+
+	if (vs_read_file (ctx, "cvirt") != 0)
+		return;
+
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		char *cols[4];
+		int n = strsplit (line, cols, 4);
+
+		if (2 == n)
 		{
-			char *type = "vs_memory";
-			char *type_instance;
+			char   *type_instance;
 			gauge_t value;
 
-			if (strsplit (buffer, cols, 2) < 2)
+			if (0 == strcmp (cols[0], "nr_threads:"))
+				type_instance = "total";
+			else if (0 == strcmp (cols[0], "nr_running:"))
+				type_instance = "running";
+			else if (0 == strcmp (cols[0], "nr_unintr:"))
+				type_instance = "uninterruptable";
+			else if (0 == strcmp (cols[0], "nr_onhold:"))
+				type_instance = "onhold";
+			else
 				continue;
 
-			if (0 == strcmp (cols[0], "PROC:"))
-			{
-				type = "vs_processes";
-				type_instance = "";
-				value = atof (cols[1]);
-			}
-			else
+			value = atof (cols[1]);
+			submit_gauge (ctx->name, "vs_threads", type_instance, value);
+		}
+		else if (4 == n) {
+			if (0 == strcmp (cols[0], "loadavg:"))
 			{
-				if (0 == strcmp (cols[0], "VM:"))
-					type_instance = "vm";
-				else if (0 == strcmp (cols[0], "VML:"))
-					type_instance = "vml";
-				else if (0 == strcmp (cols[0], "RSS:"))
-					type_instance = "rss";
-				else if (0 == strcmp (cols[0], "ANON:"))
-					type_instance = "anon";
-				else
-					continue;
-
-				value = atof (cols[1]) * pagesize;
+				gauge_t snum = atof (cols[1]);
+				gauge_t mnum = atof (cols[2]);
+				gauge_t lnum = atof (cols[3]);
+				load_submit (ctx->name, snum, mnum, lnum);
 			}
+		}
+	}
+} /* void vs_read_cvirt */
+
+/* processes and memory usage */
+static void vs_read_limit (vs_context_t *ctx)
+{
+	char *buffer = vs_buffer;
+	char *line;
 
-			submit_gauge (dent->d_name, type, type_instance, value);
-		} /* while (fgets) */
+	if (vs_read_file (ctx, "limit") != 0)
+		return;
 
-		if (fh != NULL)
+	while ((line = procfs_next_line (&buffer)) != NULL)
+	{
+		char *cols[2];
+		char *type = "vs_memory";
+		char *type_instance;
+		gauge_t value;
+
+		if (strsplit (line, cols, 2) < 2)
+			continue;
+
+		if (0 == strcmp (cols[0], "PROC:"))
 		{
-			fclose (fh);
-			fh = NULL;
+			type = "vs_processes";
+			type_instance = "";
+			value = atof (cols[1]);
 		}
-	} /* while (readdir) */
+		else
+		{
+			if (0 == strcmp (cols[0], "VM:"))
+				type_instance = "vm";
+			else if (0 == strcmp (cols[0], "VML:"))
+				type_instance = "vml";
+			else if (0 == strcmp (cols[0], "RSS:"))
+				type_instance = "rss";
+			else if (0 == strcmp (cols[0], "ANON:"))
+				type_instance = "anon";
+			else
+				continue;
 
-	closedir (proc);
+			value = atof (cols[1]) * pagesize;
+		}
+
+		submit_gauge (ctx->name, type, type_instance, value);
+	}
+} /* void vs_read_limit */
+
+static int vserver_read (void)
+{
+	size_t i;
+
+	if (vs_contexts_update () != 0)
+		return (-1);
+
+	for (i = 0; i < contexts_num; i++)
+	{
+		vs_read_cacct (contexts + i);
+		vs_read_cvirt (contexts + i);
+		vs_read_limit (contexts + i);
+	}
 
 	return (0);
 } /* int vserver_read */
 
+static int vserver_shutdown (void)
+{
+	size_t i;
+
+	for (i = 0; i < contexts_num; i++)
+		vs_context_close (contexts + i);
+	sfree (contexts);
+	contexts_num = 0;
+	contexts_valid = 0;
+
+	sfree (vs_buffer);
+	vs_buffer_size = 0;
+
+	return (0);
+} /* int vserver_shutdown */
+
 void module_register (void)
 {
 	plugin_register_init ("vserver", vserver_init);
 	plugin_register_read ("vserver", vserver_read);
+	plugin_register_shutdown ("vserver", vserver_shutdown);
 } /* void module_register(void) */
 
 /* vim: set ts=4 sw=4 noexpandtab : */
@@ -0,0 +1,1313 @@
+/**
+ * collectd - src/write_chunks.c
+ * Copyright (C) 2011  The collectd authors
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; only version 2 of the License is applicable.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301 USA
+ **/
+
+#include "collectd.h"
+#include "common.h"
+#include "plugin.h"
+#include "configfile.h"
+#include "utils_complain.h"
+#include "utils_hashtable.h"
+
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+ * Series are distributed over a number of shards by the hash of their
+ * identifier. Each shard has two files in the data directory:
+ *
+ *  "index-<n>"   One line per series, "<id> <types> <identifier>", where
+ *                <types> holds one letter per data source.
+ *  "chunks-<n>"  Compressed chunks of up to `ChunkSize' values of one series,
+ *                appended through a shared memory mapping, so that all
+ *                series of a shard are written sequentially.
+ *
+ * The values of a series are collected in an open chunk in memory, column by
+ * column: the times as delta-of-deltas, gauges XOR'ed with the previous
+ * value as in Facebook's Gorilla and the other types as delta-of-deltas, too.
+ * The chunk is appended to the file once it is full, older than
+ * `ChunkTimeout', flushed or the daemon shuts down. Values in open chunks are
+ * lost if the daemon crashes.
+ */
+#define WC_CHUNK_MAGIC UINT32_C (0x57434b31) /* "WCK1" */
+#define WC_SEGMENT_SIZE (64 * 1024 * 1024)
+
+/* On-disk header of a chunk. It is followed by `columns' column sizes in
+ * bytes (uint32_t) and the columns. Chunks are padded to eight bytes. The
+ * magic is written last. */
+struct wc_chunk_header_s
+{
+  uint32_t magic;
+  uint32_t series_id;
+  uint64_t first_time;
+  uint64_t last_time;
+  uint32_t count;
+  uint32_t columns;
+};
+typedef struct wc_chunk_header_s wc_chunk_header_t;
+
+struct wc_bits_s
+{
+  uint8_t *data;
+  size_t size;
+  size_t bits;
+};
+typedef struct wc_bits_s wc_bits_t;
+
+/* Encoder or decoder state of one column. */
+struct wc_column_s
+{
+  wc_bits_t bits;
+  size_t pos;
+  uint64_t prev;
+  int64_t prev_delta;
+  int leading;
+  int trailing;
+};
+typedef struct wc_column_s wc_column_t;
+
+struct wc_series_s
+{
+  char *identifier;
+  uint32_t id;
+  int ds_num;
+  int *ds_types;
+  cdtime_t last_time;
+
+  /* Offsets of the chunks in the shard's file, oldest first. */
+  uint64_t *chunks;
+  size_t chunks_num;
+  size_t chunks_size;
+
+  /* The open chunk; column zero holds the times. */
+  uint32_t count;
+  cdtime_t first_time;
+  cdtime_t chunk_last_time;
+  wc_column_t *columns;
+};
+typedef struct wc_series_s wc_series_t;
+
+struct wc_shard_s
+{
+  pthread_mutex_t lock;
+  c_hashtable_t *series;
+  uint32_t series_num;
+
+  FILE *index;
+  int fd;
+  char *map;
+  size_t map_size;
+  size_t used;
+
+  cdtime_t sweep_last;
+  c_complain_t complaint;
+};
+typedef struct wc_shard_s wc_shard_t;
+
+/*
+ * Private variables
+ */
+static char *datadir = NULL;
+static int shards_num = 4;
+static uint32_t chunk_size = 120;
+static cdtime_t chunk_timeout = 0;
+
+static wc_shard_t *shards = NULL;
+
+/*
+ * Bit streams
+ */
+static int wc_clz (uint64_t x) /* {{{ */
+{
+  int n = 0;
+
+  if (x == 0)
+    return (64);
+  if ((x & UINT64_C (0xFFFFFFFF00000000)) == 0) { n += 32; x <<= 32; }
+  if ((x & UINT64_C (0xFFFF000000000000)) == 0) { n += 16; x <<= 16; }
+  if ((x & UINT64_C (0xFF00000000000000)) == 0) { n +=  8; x <<=  8; }
+  if ((x & UINT64_C (0xF000000000000000)) == 0) { n +=  4; x <<=  4; }
+  if ((x & UINT64_C (0xC000000000000000)) == 0) { n +=  2; x <<=  2; }
+  if ((x & UINT64_C (0x8000000000000000)) == 0) { n +=  1; }
+  return (n);
+} /* }}} int wc_clz */
+
+static int wc_ctz (uint64_t x) /* {{{ */
+{
+  int n = 0;
+
+  if (x == 0)
+    return (64);
+  if ((x & UINT64_C (0x00000000FFFFFFFF)) == 0) { n += 32; x >>= 32; }
+  if ((x & UINT64_C (0x000000000000FFFF)) == 0) { n += 16; x >>= 16; }
+  if ((x & UINT64_C (0x00000000000000FF)) == 0) { n +=  8; x >>=  8; }
+  if ((x & UINT64_C (0x000000000000000F)) == 0) { n +=  4; x >>=  4; }
+  if ((x & UINT64_C (0x0000000000000003)) == 0) { n +=  2; x >>=  2; }
+  if ((x & UINT64_C (0x0000000000000001)) == 0) { n +=  1; }
+  return (n);
+} /* }}} int wc_ctz */
+
+/* Appends the lowest `n' bits of `value', most significant bit first. */
+static int wc_bits_write (wc_bits_t *b, uint64_t value, int n) /* {{{ */
+{
+  size_t need = (b->bits + n + 7) / 8;
+
+  if (need > b->size)
+  {
+    size_t size = (b->size == 0) ? 64 : (2 * b->size);
+    uint8_t *tmp;
+
+    while (size < need)
+      size *= 2;
+
+    tmp = realloc (b->data, size);
+    if (tmp == NULL)
+      return (-1);
+    memset (tmp + b->size, 0, size - b->size);
+    b->data = tmp;
+    b->size = size;
+  }
+
+  while (n > 0)
+  {
+    int room = 8 - (int) (b->bits % 8);
+    int take = (n < room) ? n : room;
+    uint8_t chunk;
+
+    chunk = (uint8_t) ((value >> (n - take)) & ((1U << take) - 1));
+    b->data[b->bits / 8] |= (uint8_t) (chunk << (room - take));
+    b->bits += take;
+    n -= take;
+  }
+
+  return (0);
+} /* }}} int wc_bits_write */
+
+static int wc_bits_read (wc_column_t *c, int n, uint64_t *ret) /* {{{ */
+{
+  uint64_t value = 0;
+
+  if ((c->pos + n) > c->bits.bits)
+    return (-1);
+
+  while (n > 0)
+  {
+    int room = 8 - (int) (c->pos % 8);
+    int take = (n < room) ? n : room;
+    uint8_t chunk;
+
+    chunk = (uint8_t) ((c->bits.data[c->pos / 8] >> (room - take))
+        & ((1U << take) - 1));
+    value = (value << take) | chunk;
+    c->pos += take;
+    n -= take;
+  }
+
+  *ret = value;
+  return (0);
+} /* }}} int wc_bits_read */
+
+/*
+ * Column encoding
+ */
+/* Zero is stored as a single bit, other values as a one bit, the number of
+ * significant bits of the zig-zag encoded value minus one in six bits, and
+ * the significant bits. */
+static int wc_write_int (wc_bits_t *b, int64_t v) /* {{{ */
+{
+  uint64_t u;
+  int n;
+
+  if (v == 0)
+    return (wc_bits_write (b, 0, 1));
+
+  u = (((uint64_t) v) << 1) ^ ((v < 0) ? UINT64_MAX : 0);
+  n = 64 - wc_clz (u);
+
+  if ((wc_bits_write (b, 1, 1) != 0)
+      || (wc_bits_write (b, (uint64_t) (n - 1), 6) != 0))
+    return (-1);
+  return (wc_bits_write (b, u, n));
+} /* }}} int wc_write_int */
+
+static int wc_read_int (wc_column_t *c, int64_t *ret) /* {{{ */
+{
+  uint64_t flag;
+  uint64_t n;
+  uint64_t u;
+
+  if (wc_bits_read (c, 1, &flag) != 0)
+    return (-1);
+  if (flag == 0)
+  {
+    *ret = 0;
+    return (0);
+  }
+
+  if ((wc_bits_read (c, 6, &n) != 0)
+      || (wc_bits_read (c, (int) n + 1, &u) != 0))
+    return (-1);
+
+  *ret = (int64_t) ((u >> 1) ^ ((u & 1) ? UINT64_MAX : 0));
+  return (0);
+} /* }}} int wc_read_int */
+
+/* Times and integers. The first value of an integer column is stored as is;
+ * the first time is stored in the chunk's header. */
+static int wc_encode_int (wc_column_t *c, uint64_t value, /* {{{ */
+    _Bool first)
+{
+  int64_t delta = (int64_t) (value - c->prev);
+  int status;
+
+  status = wc_write_int (&c->bits, delta - c->prev_delta);
+  c->prev = value;
+  c->prev_delta = first ? 0 : delta;
+  return (status);
+} /* }}} int wc_encode_int */
+
+static int wc_decode_int (wc_column_t *c, uint64_t *ret, /* {{{ */
+    _Bool first)
+{
+  int64_t dod;
+
+  if (wc_read_int (c, &dod) != 0)
+    return (-1);
+
+  c->prev_delta += dod;
+  c->prev += (uint64_t) c->prev_delta;
+  if (first)
+    c->prev_delta = 0;
+  *ret = c->prev;
+  return (0);
+} /* }}} int wc_decode_int */
+
+static int wc_encode_gauge (wc_column_t *c, gauge_t value, /* {{{ */
+    _Bool first)
+{
+  uint64_t bits;
+  uint64_t x;
+  int leading;
+  int trailing;
+  int status;
+
+  memcpy (&bits, &value, sizeof (bits));
+  x = bits ^ c->prev;
+  c->prev = bits;
+
+  if (first)
+    return (wc_bits_write (&c->bits, bits, 64));
+
+  if (x == 0)
+    return (wc_bits_write (&c->bits, 0, 1));
+
+  leading = wc_clz (x);
+  if (leading > 31)
+    leading = 31;
+  trailing = wc_ctz (x);
+
+  /* The meaningful bits fit into the previous window. */
+  if ((c->leading >= 0)
+      && (leading >= c->leading) && (trailing >= c->trailing))
+  {
+    status = wc_bits_write (&c->bits, 2, 2);
+    if (status == 0)
+      status = wc_bits_write (&c->bits, x >> c->trailing,
+          64 - c->leading - c->trailing);
+    return (status);
+  }
+
+  c->leading = leading;
+  c->trailing = trailing;
+
+  if ((wc_bits_write (&c->bits, 3, 2) != 0)
+      || (wc_bits_write (&c->bits, (uint64_t) leading, 5) != 0)
+      || (wc_bits_write (&c->bits,
+          (uint64_t) (64 - leading - trailing - 1), 6) != 0))
+    return (-1);
+  return (wc_bits_write (&c->bits, x >> trailing, 64 - leading - trailing));
+} /* }}} int wc_encode_gauge */
+
+static int wc_decode_gauge (wc_column_t *c, gauge_t *ret, /* {{{ */
+    _Bool first)
+{
+  uint64_t flag;
+  uint64_t x;
+
+  if (first)
+  {
+    if (wc_bits_read (c, 64, &c->prev) != 0)
+      return (-1);
+    memcpy (ret, &c->prev, sizeof (*ret));
+    return (0);
+  }
+
+  if (wc_bits_read (c, 1, &flag) != 0)
+    return (-1);
+
+  if (flag != 0)
+  {
+    if (wc_bits_read (c, 1, &flag) != 0)
+      return (-1);
+
+    if (flag != 0)
+    {
+      uint64_t leading;
+      uint64_t significant;
+
+      if ((wc_bits_read (c, 5, &leading) != 0)
+          || (wc_bits_read (c, 6, &significant) != 0))
+        return (-1);
+      c->leading = (int) leading;
+      c->trailing = 64 - ((int) leading) - ((int) significant + 1);
+    }
+
+    if ((c->leading < 0)
+        || (wc_bits_read (c, 64 - c->leading - c->trailing, &x) != 0))
+      return (-1);
+    c->prev ^= x << c->trailing;
+  }
+
+  memcpy (ret, &c->prev, sizeof (*ret));
+  return (0);
+} /* }}} int wc_decode_gauge */
+
+/*
+ * Series
+ */
+static char wc_type_to_char (int type) /* {{{ */
+{
+  switch (type)
+  {
+    case DS_TYPE_COUNTER:  return ('c');
+    case DS_TYPE_GAUGE:    return ('g');
+    case DS_TYPE_DERIVE:   return ('d');
+    case DS_TYPE_ABSOLUTE: return ('a');
+  }
+  return ('?');
+} /* }}} char wc_type_to_char */
+
+static int wc_char_to_type (char c) /* {{{ */
+{
+  switch (c)
+  {
+    case 'c': return (DS_TYPE_COUNTER);
+    case 'g': return (DS_TYPE_GAUGE);
+    case 'd': return (DS_TYPE_DERIVE);
+    case 'a': return (DS_TYPE_ABSOLUTE);
+  }
+  return (-1);
+} /* }}} int wc_char_to_type */
+
+static void wc_series_reset (wc_series_t *s) /* {{{ */
+{
+  int i;
+
+  s->count = 0;
+  for (i = 0; i <= s->ds_num; i++)
+  {
+    wc_column_t *c = s->columns + i;
+
+    if (c->bits.data != NULL)
+      memset (c->bits.data, 0, (c->bits.bits + 7) / 8);
+    c->bits.bits = 0;
+    c->prev = 0;
+    c->prev_delta = 0;
+    c->leading = -1;
+    c->trailing = 0;
+  }
+} /* }}} void wc_series_reset */
+
+static void wc_series_destroy (wc_series_t *s) /* {{{ */
+{
+  int i;
+
+  if (s == NULL)
+    return;
+
+  if (s->columns != NULL)
+    for (i = 0; i <= s->ds_num; i++)
+      sfree (s->columns[i].bits.data);
+
+  sfree (s->columns);
+  sfree (s->chunks);
+  sfree (s->ds_types);
+  sfree (s->identifier);
+  sfree (s);
+} /* }}} void wc_series_destroy */
+
+static wc_series_t *wc_series_create (const char *identifier, /* {{{ */
+    uint32_t id, int ds_num)
+{
+  wc_series_t *s;
+
+  s = malloc (sizeof (*s));
+  if (s == NULL)
+    return (NULL);
+  memset (s, 0, sizeof (*s));
+
+  s->id = id;
+  s->ds_num = ds_num;
+  s->identifier = strdup (identifier);
+  s->ds_types = calloc ((size_t) ds_num, sizeof (*s->ds_types));
+  s->columns = calloc ((size_t) ds_num + 1, sizeof (*s->columns));
+  if ((s->identifier == NULL) || (s->ds_types == NULL)
+      || (s->columns == NULL))
+  {
+    wc_series_destroy (s);
+    return (NULL);
+  }
+
+  wc_series_reset (s);
+  return (s);
+} /* }}} wc_series_t *wc_series_create */
+
+static int wc_series_add_chunk (wc_series_t *s, uint64_t offset) /* {{{ */
+{
+  if (s->chunks_num >= s->chunks_size)
+  {
+    size_t size = (s->chunks_size == 0) ? 16 : (2 * s->chunks_size);
+    uint64_t *tmp;
+
+    tmp = realloc (s->chunks, size * sizeof (*tmp));
+    if (tmp == NULL)
+      return (-1);
+    s->chunks = tmp;
+    s->chunks_size = size;
+  }
+
+  s->chunks[s->chunks_num] = offset;
+  s->chunks_num++;
+  return (0);
+} /* }}} int wc_series_add_chunk */
+
+/*
+ * Shards
+ */
+static wc_shard_t *wc_shard_get (uint32_t hash) /* {{{ */
+{
+  /* Uses the high bits, since the hash table uses the low ones. */
+  return (shards + ((((uint64_t) hash) * ((uint64_t) shards_num)) >> 32));
+} /* }}} wc_shard_t *wc_shard_get */
+
+static int wc_shard_map (wc_shard_t *shard, size_t size) /* {{{ */
+{
+  char errbuf[1024];
+  void *map;
+
+  if (shard->map != NULL)
+  {
+    munmap (shard->map, shard->map_size);
+    shard->map = NULL;
+    shard->map_size = 0;
+  }
+
+  if (ftruncate (shard->fd, (off_t) size) != 0)
+  {
+    ERROR ("write_chunks plugin: ftruncate failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shard->fd, 0);
+  if (map == MAP_FAILED)
+  {
+    ERROR ("write_chunks plugin: mmap failed: %s",
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  shard->map = map;
+  shard->map_size = size;
+  return (0);
+} /* }}} int wc_shard_map */
+
+/* Appends the open chunk of `s' to the shard's file. */
+static int wc_shard_seal (wc_shard_t *shard, wc_series_t *s) /* {{{ */
+{
+  wc_chunk_header_t header;
+  uint32_t column_size;
+  uint32_t magic = WC_CHUNK_MAGIC;
+  size_t offset;
+  size_t size;
+  char *ptr;
+  int i;
+
+  if (s->count == 0)
+    return (0);
+
+  size = sizeof (header) + (((size_t) s->ds_num + 1) * sizeof (uint32_t));
+  for (i = 0; i <= s->ds_num; i++)
+    size += (s->columns[i].bits.bits + 7) / 8;
+  size = (size + 7) & ~((size_t) 7);
+
+  if ((shard->used + size) > shard->map_size)
+  {
+    size_t old_size = shard->map_size;
+    size_t map_size = old_size + WC_SEGMENT_SIZE;
+
+    while ((shard->used + size) > map_size)
+      map_size += WC_SEGMENT_SIZE;
+
+    if (wc_shard_map (shard, map_size) != 0)
+    {
+      /* Try to restore the previous mapping, so reads keep working. */
+      wc_shard_map (shard, old_size);
+      return (-1);
+    }
+  }
+
+  if (wc_series_add_chunk (s, (uint64_t) shard->used) != 0)
+    return (-1);
+
+  memset (&header, 0, sizeof (header));
+  header.series_id = s->id;
+  header.first_time = (uint64_t) s->first_time;
+  header.last_time = (uint64_t) s->chunk_last_time;
+  header.count = s->count;
+  header.columns = (uint32_t) s->ds_num + 1;
+
+  ptr = shard->map + shard->used;
+  memcpy (ptr, &header, sizeof (header));
+  offset = sizeof (header) + (((size_t) s->ds_num + 1) * sizeof (uint32_t));
+  for (i = 0; i <= s->ds_num; i++)
+  {
+    column_size = (uint32_t) ((s->columns[i].bits.bits + 7) / 8);
+    memcpy (ptr + sizeof (header) + (i * sizeof (uint32_t)),
+        &column_size, sizeof (column_size));
+    if (column_size > 0)
+      memcpy (ptr + offset, s->columns[i].bits.data, column_size);
+    offset += column_size;
+  }
+  memcpy (ptr, &magic, sizeof (magic));
+
+  shard->used += size;
+  wc_series_reset (s);
+  return (0);
+} /* }}} int wc_shard_seal */
+
+/* Seals all chunks whose first value is older than `timeout', or all chunks
+ * if `timeout' is zero. */
+static void wc_shard_sweep (wc_shard_t *shard, cdtime_t timeout) /* {{{ */
+{
+  c_hashtable_iterator_t *iter;
+  wc_series_t *s;
+  char *key;
+  cdtime_t now = cdtime ();
+
+  iter = c_hashtable_get_iterator (shard->series);
+  if (iter == NULL)
+    return;
+
+  while (c_hashtable_iterator_next (iter, (void *) &key, (void *) &s) == 0)
+  {
+    if ((s->count == 0)
+        || ((timeout > 0) && ((now - s->first_time) < timeout)))
+      continue;
+
+    if (wc_shard_seal (shard, s) != 0)
+      c_complain (LOG_ERR, &shard->complaint, "write_chunks plugin: "
+          "Appending a chunk of \"%s\" failed.", s->identifier);
+  }
+  c_hashtable_iterator_destroy (iter);
+
+  shard->sweep_last = now;
+} /* }}} void wc_shard_sweep */
+
+static wc_series_t *wc_shard_add_series (wc_shard_t *shard, /* {{{ */
+    const char *identifier, const data_set_t *ds)
+{
+  wc_series_t *s;
+  int i;
+
+  s = wc_series_create (identifier, shard->series_num, ds->ds_num);
+  if (s == NULL)
+    return (NULL);
+
+  fprintf (shard->index, "%"PRIu32" ", s->id);
+  for (i = 0; i < ds->ds_num; i++)
+  {
+    s->ds_types[i] = ds->ds[i].type;
+    fputc (wc_type_to_char (ds->ds[i].type), shard->index);
+  }
+  fprintf (shard->index, " %s\n", identifier);
+
+  if ((fflush (shard->index) != 0)
+      || (c_hashtable_insert (shard->series, s->identifier, s) != 0))
+  {
+    wc_series_destroy (s);
+    return (NULL);
+  }
+
+  shard->series_num++;
+  return (s);
+} /* }}} wc_series_t *wc_shard_add_series */
+
+static int wc_shard_load_index (wc_shard_t *shard, /* {{{ */
+    wc_series_t ***ret_by_id, const char *filename)
+{
+  wc_series_t **by_id = NULL;
+  char line[8 * DATA_MAX_NAME_LEN];
+  FILE *fh;
+
+  fh = fopen (filename, "r");
+  if (fh == NULL)
+    return ((errno == ENOENT) ? 0 : -1);
+
+  while (fgets (line, sizeof (line), fh) != NULL)
+  {
+    char *fields[2];
+    char *identifier;
+    wc_series_t *s;
+    uint32_t id;
+    size_t len;
+    int i;
+
+    len = strlen (line);
+    while ((len > 0) && (line[len - 1] == '\n'))
+      line[--len] = 0;
+
+    /* The identifier may contain spaces, so only the first two fields are
+     * split off. */
+    fields[0] = line;
+    fields[1] = strchr (fields[0], ' ');
+    identifier = (fields[1] != NULL) ? strchr (fields[1] + 1, ' ') : NULL;
+    if (identifier == NULL)
+      continue;
+    *fields[1]++ = 0;
+    *identifier++ = 0;
+
+    id = (uint32_t) strtoul (fields[0], NULL, 10);
+    if (id != shard->series_num)
+    {
+      WARNING ("write_chunks plugin: Unexpected series ID %"PRIu32" in %s.",
+          id, filename);
+      continue;
+    }
+
+    s = wc_series_create (identifier, id, (int) strlen (fields[1]));
+    if (s == NULL)
+      break;
+    for (i = 0; i < s->ds_num; i++)
+      s->ds_types[i] = wc_char_to_type (fields[1][i]);
+
+    if ((id % 1024) == 0)
+    {
+      wc_series_t **tmp;
+
+      tmp = realloc (by_id, (id + 1024) * sizeof (*tmp));
+      if (tmp == NULL)
+      {
+        wc_series_destroy (s);
+        break;
+      }
+      by_id = tmp;
+    }
+
+    if (c_hashtable_insert (shard->series, s->identifier, s) != 0)
+    {
+      wc_series_destroy (s);
+      continue;
+    }
+
+    by_id[id] = s;
+    shard->series_num++;
+  }
+
+  fclose (fh);
+  *ret_by_id = by_id;
+  return (0);
+} /* }}} int wc_shard_load_index */
+
+/* Finds the chunks written by previous runs and the end of the used part. */
+static void wc_shard_scan (wc_shard_t *shard, /* {{{ */
+    wc_series_t **by_id, size_t file_size)
+{
+  size_t offset = 0;
+
+  while ((offset + sizeof (wc_chunk_header_t)) <= file_size)
+  {
+    wc_chunk_header_t header;
+    size_t size;
+    uint32_t i;
+
+    memcpy (&header, shard->map + offset, sizeof (header));
+    if ((header.magic != WC_CHUNK_MAGIC) || (header.columns < 1)
+        || (header.columns > 1024))
+      break;
+
+    size = sizeof (header) + (header.columns * sizeof (uint32_t));
+    if ((offset + size) > file_size)
+      break;
+    for (i = 0; i < header.columns; i++)
+    {
+      uint32_t column_size;
+
+      memcpy (&column_size,
+          shard->map + offset + sizeof (header) + (i * sizeof (uint32_t)),
+          sizeof (column_size));
+      size += column_size;
+    }
+    size = (size + 7) & ~((size_t) 7);
+    if ((offset + size) > file_size)
+      break;
+
+    if ((header.series_id < shard->series_num)
+        && (by_id[header.series_id] != NULL)
+        && (by_id[header.series_id]->ds_num + 1 == (int) header.columns))
+    {
+      wc_series_t *s = by_id[header.series_id];
+
+      wc_series_add_chunk (s, (uint64_t) offset);
+      if (s->last_time < (cdtime_t) header.last_time)
+        s->last_time = (cdtime_t) header.last_time;
+    }
+
+    offset += size;
+  }
+
+  shard->used = offset;
+} /* }}} void wc_shard_scan */
+
+static int wc_shard_open (wc_shard_t *shard, int index) /* {{{ */
+{
+  char filename[PATH_MAX];
+  char errbuf[1024];
+  wc_series_t **by_id = NULL;
+  struct stat statbuf;
+  size_t map_size;
+
+  pthread_mutex_init (&shard->lock, /* attr = */ NULL);
+  C_COMPLAIN_INIT (&shard->complaint);
+  shard->fd = -1;
+  shard->sweep_last = cdtime ();
+
+  shard->series = c_hashtable_create (c_hashtable_hash_string,
+      (void *) strcmp);
+  if (shard->series == NULL)
+    return (-1);
+
+  ssnprintf (filename, sizeof (filename), "%s/index-%i", datadir, index);
+  if (check_create_dir (filename) != 0)
+    return (-1);
+
+  if (wc_shard_load_index (shard, &by_id, filename) != 0)
+  {
+    ERROR ("write_chunks plugin: Reading %s failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    return (-1);
+  }
+
+  shard->index = fopen (filename, "a");
+  if (shard->index == NULL)
+  {
+    ERROR ("write_chunks plugin: Opening %s failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (by_id);
+    return (-1);
+  }
+
+  ssnprintf (filename, sizeof (filename), "%s/chunks-%i", datadir, index);
+  shard->fd = open (filename, O_RDWR | O_CREAT, 0644);
+  if ((shard->fd < 0) || (fstat (shard->fd, &statbuf) != 0))
+  {
+    ERROR ("write_chunks plugin: Opening %s failed: %s", filename,
+        sstrerror (errno, errbuf, sizeof (errbuf)));
+    sfree (by_id);
+    return (-1);
+  }
+
+  map_size = WC_SEGMENT_SIZE;
+  while (map_size < (size_t) statbuf.st_size)
+    map_size += WC_SEGMENT_SIZE;
+
+  if (wc_shard_map (shard, map_size) != 0)
+  {
+    sfree (by_id);
+    return (-1);
+  }
+
+  wc_shard_scan (shard, by_id, (size_t) statbuf.st_size);
+  sfree (by_id);
+
+  return (0);
+} /* }}} int wc_shard_open */
+
+static void wc_shard_close (wc_shard_t *shard) /* {{{ */
+{
+  wc_series_t *s;
+  char *key;
+
+  if (shard->series != NULL)
+  {
+    wc_shard_sweep (shard, /* timeout = */ 0);
+    while (c_hashtable_pick (shard->series, (void *) &key, (void *) &s) == 0)
+      wc_series_destroy (s);
+    c_hashtable_destroy (shard->series);
+    shard->series = NULL;
+  }
+
+  if (shard->map != NULL)
+  {
+    msync (shard->map, shard->used, MS_SYNC);
+    munmap (shard->map, shard->map_size);
+    shard->map = NULL;
+  }
+
+  if (shard->fd >= 0)
+  {
+    /* Drop the unused part of the last segment. */
+    if (ftruncate (shard->fd, (off_t) shard->used) != 0)
+    {
+      char errbuf[1024];
+      WARNING ("write_chunks plugin: ftruncate failed: %s",
+          sstrerror (errno, errbuf, sizeof (errbuf)));
+    }
+    close (shard->fd);
+    shard->fd = -1;
+  }
+
+  if (shard->index != NULL)
+  {
+    fclose (shard->index);
+    shard->index = NULL;
+  }
+
+  pthread_mutex_destroy (&shard->lock);
+} /* }}} void wc_shard_close */
+
+/*
+ * Reading
+ */
+/* Decodes `count' values from `columns' and passes the ones in [start, end]
+ * on. */
+static int wc_decode (const wc_series_t *s, wc_column_t *columns, /* {{{ */
+    cdtime_t first_time, uint32_t count, cdtime_t start, cdtime_t end,
+    plugin_range_value_cb value_cb, void *value_data)
+{
+  value_t values[s->ds_num];
+  uint32_t n;
+  int i;
+
+  columns[0].prev = (uint64_t) first_time;
+  for (i = 0; i <= s->ds_num; i++)
+    columns[i].leading = -1;
+
+  for (n = 0; n < count; n++)
+  {
+    uint64_t time = (uint64_t) first_time;
+    int status;
+
+    if ((n > 0) && (wc_decode_int (columns, &time, /* first = */ 0) != 0))
+      return (-1);
+
+    for (i = 0; i < s->ds_num; i++)
+    {
+      wc_column_t *c = columns + i + 1;
+      uint64_t tmp;
+
+      if (s->ds_types[i] == DS_TYPE_GAUGE)
+        status = wc_decode_gauge (c, &values[i].gauge, (n == 0));
+      else
+      {
+        status = wc_decode_int (c, &tmp, (n == 0));
+        if (s->ds_types[i] == DS_TYPE_COUNTER)
+          values[i].counter = (counter_t) tmp;
+        else if (s->ds_types[i] == DS_TYPE_DERIVE)
+          values[i].derive = (derive_t) tmp;
+        else
+          values[i].absolute = (absolute_t) tmp;
+      }
+      if (status != 0)
+        return (-1);
+    }
+
+    if ((cdtime_t) time > end)
+      break;
+    if ((cdtime_t) time < start)
+      continue;
+
+    status = (*value_cb) ((cdtime_t) time, values, (size_t) s->ds_num,
+        value_data);
+    if (status != 0)
+      return (status);
+  }
+
+  return (0);
+} /* }}} int wc_decode */
+
+static int wc_read_chunk (const wc_shard_t *shard, /* {{{ */
+    const wc_series_t *s, uint64_t offset, cdtime_t start, cdtime_t end,
+    plugin_range_value_cb value_cb, void *value_data)
+{
+  wc_chunk_header_t header;
+  wc_column_t columns[s->ds_num + 1];
+  size_t data_offset;
+  int i;
+
+  memcpy (&header, shard->map + offset, sizeof (header));
+  if (((cdtime_t) header.last_time < start)
+      || ((cdtime_t) header.first_time > end))
+    return (0);
+
+  memset (columns, 0, sizeof (columns));
+  data_offset = (size_t) offset + sizeof (header)
+    + (header.columns * sizeof (uint32_t));
+  for (i = 0; i <= s->ds_num; i++)
+  {
+    uint32_t column_size;
+
+    memcpy (&column_size, shard->map + offset + sizeof (header)
+        + (i * sizeof (uint32_t)), sizeof (column_size));
+    columns[i].bits.data = (uint8_t *) shard->map + data_offset;
+    columns[i].bits.size = column_size;
+    columns[i].bits.bits = 8 * ((size_t) column_size);
+    data_offset += column_size;
+  }
+
+  return (wc_decode (s, columns, (cdtime_t) header.first_time, header.count,
+        start, end, value_cb, value_data));
+} /* }}} int wc_read_chunk */
+
+static int wc_range (const char *identifier, /* {{{ */
+    cdtime_t start, cdtime_t end,
+    plugin_range_value_cb value_cb, void *value_data,
+    user_data_t __attribute__((unused)) *user_data)
+{
+  char name[6 * DATA_MAX_NAME_LEN];
+  value_list_t vl = VALUE_LIST_INIT;
+  wc_shard_t *shard;
+  wc_series_t *s;
+  size_t i;
+  int status = 0;
+
+  if (shards == NULL)
+    return (-1);
+
+  /* Normalize the identifier, e.g. "host/plugin-/type". */
+  if ((parse_identifier_vl (identifier, &vl) != 0)
+      || (FORMAT_VL (name, sizeof (name), &vl) != 0))
+    return (EINVAL);
+
+  shard = wc_shard_get (c_hashtable_hash_string (name));
+  pthread_mutex_lock (&shard->lock);
+
+  if (c_hashtable_get (shard->series, name, (void *) &s) != 0)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    return (ENOENT);
+  }
+
+  for (i = 0; (i < s->chunks_num) && (status == 0); i++)
+    status = wc_read_chunk (shard, s, s->chunks[i], start, end,
+        value_cb, value_data);
+
+  if ((status == 0) && (s->count > 0))
+  {
+    wc_column_t columns[s->ds_num + 1];
+    int j;
+
+    memset (columns, 0, sizeof (columns));
+    for (j = 0; j <= s->ds_num; j++)
+      columns[j].bits = s->columns[j].bits;
+
+    status = wc_decode (s, columns, s->first_time, s->count, start, end,
+        value_cb, value_data);
+  }
+
+  pthread_mutex_unlock (&shard->lock);
+  return (status);
+} /* }}} int wc_range */
+
+/*
+ * Writing
+ */
+static int wc_append (wc_series_t *s, const value_list_t *vl) /* {{{ */
+{
+  int status;
+  int i;
+
+  if (s->count == 0)
+  {
+    s->first_time = vl->time;
+    s->columns[0].prev = (uint64_t) vl->time;
+  }
+  else
+  {
+    status = wc_encode_int (s->columns, (uint64_t) vl->time,
+        /* first = */ 0);
+    if (status != 0)
+      return (status);
+  }
+
+  for (i = 0; i < s->ds_num; i++)
+  {
+    wc_column_t *c = s->columns + i + 1;
+
+    if (s->ds_types[i] == DS_TYPE_GAUGE)
+      status = wc_encode_gauge (c, vl->values[i].gauge, (s->count == 0));
+    else if (s->ds_types[i] == DS_TYPE_COUNTER)
+      status = wc_encode_int (c, (uint64_t) vl->values[i].counter,
+          (s->count == 0));
+    else if (s->ds_types[i] == DS_TYPE_DERIVE)
+      status = wc_encode_int (c, (uint64_t) vl->values[i].derive,
+          (s->count == 0));
+    else
+      status = wc_encode_int (c, (uint64_t) vl->values[i].absolute,
+          (s->count == 0));
+
+    if (status != 0)
+      return (status);
+  }
+
+  s->count++;
+  s->chunk_last_time = vl->time;
+  s->last_time = vl->time;
+  return (0);
+} /* }}} int wc_append */
+
+static int wc_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+    user_data_t __attribute__((unused)) *user_data)
+{
+  const vl_identifier_t *ident;
+  vl_identifier_t ident_buffer;
+  wc_shard_t *shard;
+  wc_series_t *s;
+  int status;
+
+  if (shards == NULL)
+    return (-1);
+
+  ident = plugin_value_list_identifier (vl, &ident_buffer);
+  if (ident == NULL)
+    return (-1);
+
+  shard = wc_shard_get (ident->hash);
+  pthread_mutex_lock (&shard->lock);
+
+  if (c_hashtable_get (shard->series, ident->name, (void *) &s) != 0)
+  {
+    s = wc_shard_add_series (shard, ident->name, ds);
+    if (s == NULL)
+    {
+      pthread_mutex_unlock (&shard->lock);
+      ERROR ("write_chunks plugin: Adding the series \"%s\" failed.",
+          ident->name);
+      return (-1);
+    }
+  }
+
+  if (s->ds_num != ds->ds_num)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    ERROR ("write_chunks plugin: The series \"%s\" has been stored with "
+        "%i data sources, but the type `%s' has %i.",
+        ident->name, s->ds_num, ds->type, ds->ds_num);
+    return (-1);
+  }
+
+  /* Values have to be stored in order of time. */
+  if (vl->time <= s->last_time)
+  {
+    pthread_mutex_unlock (&shard->lock);
+    return (0);
+  }
+
+  status = 0;
+  if (s->count >= chunk_size)
+    status = wc_shard_seal (shard, s);
+  if (status == 0)
+    status = wc_append (s, vl);
+
+  if (status == 0)
+    c_release (LOG_INFO, &shard->complaint, "write_chunks plugin: "
+        "Storing values succeeded again.");
+  else
+    c_complain (LOG_ERR, &shard->complaint, "write_chunks plugin: "
+        "Storing a value of \"%s\" failed.", ident->name);
+
+  if ((cdtime () - shard->sweep_last) >= chunk_timeout)
+    wc_shard_sweep (shard, chunk_timeout);
+
+  pthread_mutex_unlock (&shard->lock);
+  return (status);
+} /* }}} int wc_write */
+
+static int wc_flush (cdtime_t timeout, /* {{{ */
+    const char *identifier,
+    user_data_t __attribute__((unused)) *user_data)
+{
+  int i;
+
+  if (shards == NULL)
+    return (-1);
+
+  if (identifier != NULL)
+  {
+    value_list_t vl = VALUE_LIST_INIT;
+    char name[6 * DATA_MAX_NAME_LEN];
+    wc_shard_t *shard;
+    wc_series_t *s;
+    int status = 0;
+
+    if ((parse_identifier_vl (identifier, &vl) != 0)
+        || (FORMAT_VL (name, sizeof (name), &vl) != 0))
+      return (-1);
+
+    shard = wc_shard_get (c_hashtable_hash_string (name));
+    pthread_mutex_lock (&shard->lock);
+    if ((c_hashtable_get (shard->series, name, (void *) &s) == 0)
+        && ((timeout == 0) || ((cdtime () - s->first_time) >= timeout)))
+      status = wc_shard_seal (shard, s);
+    pthread_mutex_unlock (&shard->lock);
+
+    return (status);
+  }
+
+  for (i = 0; i < shards_num; i++)
+  {
+    pthread_mutex_lock (&shards[i].lock);
+    wc_shard_sweep (shards + i, timeout);
+    pthread_mutex_unlock (&shards[i].lock);
+  }
+
+  return (0);
+} /* }}} int wc_flush */
+
+/*
+ * Setup
+ */
+static int wc_config (oconfig_item_t *ci) /* {{{ */
+{
+  int status = 0;
+  int i;
+
+  for (i = 0; i < ci->children_num; i++)
+  {
+    oconfig_item_t *child = ci->children + i;
+
+    if (strcasecmp ("DataDir", child->key) == 0)
+      status = cf_util_get_string (child, &datadir);
+    else if (strcasecmp ("Shards", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &shards_num);
+      if ((status == 0) && (shards_num < 1))
+      {
+        ERROR ("write_chunks plugin: `Shards' must be at least one.");
+        status = -1;
+      }
+    }
+    else if (strcasecmp ("ChunkSize", child->key) == 0)
+    {
+      int tmp = (int) chunk_size;
+
+      status = cf_util_get_int (child, &tmp);
+      if ((status == 0) && (tmp < 1))
+      {
+        ERROR ("write_chunks plugin: `ChunkSize' must be at least one.");
+        status = -1;
+      }
+      if (status == 0)
+        chunk_size = (uint32_t) tmp;
+    }
+    else if (strcasecmp ("ChunkTimeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &chunk_timeout);
+    else
+    {
+      WARNING ("write_chunks plugin: Ignoring unknown config option `%s'.",
+          child->key);
+      status = 0;
+    }
+
+    if (status != 0)
+      return (-1);
+  }
+
+  return (0);
+} /* }}} int wc_config */
+
+static int wc_init (void) /* {{{ */
+{
+  int i;
+
+  if (shards != NULL)
+    return (0);
+
+  if (datadir == NULL)
+  {
+    datadir = strdup ("chunks");
+    if (datadir == NULL)
+      return (-1);
+  }
+
+  if (chunk_timeout == 0)
+    chunk_timeout = TIME_T_TO_CDTIME_T (3600);
+
+  shards = calloc ((size_t) shards_num, sizeof (*shards));
+  if (shards == NULL)
+  {
+    ERROR ("write_chunks plugin: calloc failed.");
+    return (-1);
+  }
+
+  for (i = 0; i < shards_num; i++)
+  {
+    if (wc_shard_open (shards + i, i) != 0)
+    {
+      int j;
+
+      ERROR ("write_chunks plugin: Opening shard %i in \"%s\" failed.",
+          i, datadir);
+      for (j = 0; j <= i; j++)
+        wc_shard_close (shards + j);
+      sfree (shards);
+      return (-1);
+    }
+  }
+
+  plugin_register_write ("write_chunks", wc_write, /* user_data = */ NULL);
+  plugin_register_flush ("write_chunks", wc_flush, /* user_data = */ NULL);
+  plugin_register_range ("write_chunks", wc_range, /* user_data = */ NULL);
+
+  return (0);
+} /* }}} int wc_init */
+
+static int wc_shutdown (void) /* {{{ */
+{
+  int i;
+
+  if (shards == NULL)
+    return (0);
+
+  plugin_unregister_range ("write_chunks");
+
+  for (i = 0; i < shards_num; i++)
+    wc_shard_close (shards + i);
+  sfree (shards);
+  sfree (datadir);
+
+  return (0);
+} /* }}} int wc_shutdown */
+
+void module_register (void)
+{
+  plugin_register_complex_config ("write_chunks", wc_config);
+  plugin_register_init ("write_chunks", wc_init);
+  plugin_register_shutdown ("write_chunks", wc_shutdown);
+} /* void module_register */
+
+/* vim: set sw=2 sts=2 tw=78 et fdm=marker : */
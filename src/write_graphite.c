@@ -45,7 +45,10 @@
 #include "plugin.h"
 #include "configfile.h"
 
+#include "utils_avltree.h"
 #include "utils_cache.h"
+#include "utils_complain.h"
+#include "utils_memory.h"
 #include "utils_parse_option.h"
 
 /* Folks without pthread will need to disable this plugin. */
@@ -53,6 +56,7 @@
 
 #include <sys/socket.h>
 #include <netdb.h>
+#include <poll.h>
 
 #ifndef WG_DEFAULT_NODE
 # define WG_DEFAULT_NODE "localhost"
@@ -71,15 +75,79 @@
 # define WG_SEND_BUF_SIZE 1428
 #endif
 
+/* Timeout for connecting and sending in the sender thread, in
+ * milliseconds. */
+#ifndef WG_IO_TIMEOUT
+# define WG_IO_TIMEOUT 10000
+#endif
+
+#define WG_MIN_RECONNECT_DELAY TIME_T_TO_CDTIME_T (1)
+#define WG_MAX_RECONNECT_DELAY TIME_T_TO_CDTIME_T (60)
+
+/* Number of points each destination gets on the consistent hashing ring. */
+#define WG_RING_REPLICAS 100
+
 /*
  * Private variables
  */
-struct wg_callback
+/* Escaped metric name without the data source name, cached per identifier. */
+struct wg_name_s
 {
-    int      sock_fd;
+    char    *base;
+    cdtime_t last_used;
+};
+typedef struct wg_name_s wg_name_t;
 
+/* A full send buffer, waiting to be sent by the sender thread. */
+struct wg_block_s
+{
+    struct wg_block_s *next;
+    size_t   len;
+    char     data[WG_SEND_BUF_SIZE];
+};
+typedef struct wg_block_s wg_block_t;
+
+struct wg_destination_s
+{
     char    *node;
     char    *service;
+    int      sock_fd;
+
+    char     send_buf[WG_SEND_BUF_SIZE];
+    size_t   send_buf_free;
+    size_t   send_buf_fill;
+    cdtime_t send_buf_init_time;
+
+    pthread_mutex_t send_lock;
+
+    /* If `queue_limit' is greater than zero, full buffers are queued and sent
+     * by `thread', so writing threads never wait for the network. The queue
+     * and the thread's state are protected by `send_lock', the socket is only
+     * used by the thread. */
+    int      queue_limit;
+    wg_block_t *queue_head;
+    wg_block_t *queue_tail;
+    int      queue_len;
+    c_complain_t queue_complaint;
+
+    pthread_t thread;
+    _Bool    thread_running;
+    _Bool    thread_shutdown;
+    pthread_cond_t cond;
+    cdtime_t reconnect_delay;
+};
+typedef struct wg_destination_s wg_destination_t;
+
+/* A point on the consistent hashing ring. */
+struct wg_ring_point_s
+{
+    uint32_t hash;
+    size_t   index;
+};
+typedef struct wg_ring_point_s wg_ring_point_t;
+
+struct wg_callback
+{
     char    *prefix;
     char    *postfix;
     char     escape_char;
@@ -88,31 +156,60 @@ struct wg_callback
     _Bool    separate_instances;
     _Bool    always_append_ds;
 
-    char     send_buf[WG_SEND_BUF_SIZE];
-    size_t   send_buf_free;
-    size_t   send_buf_fill;
-    cdtime_t send_buf_init_time;
+    wg_destination_t **destinations;
+    size_t   destinations_num;
 
-    pthread_mutex_t send_lock;
+    /* Sorted by hash; only used with more than one destination. */
+    wg_ring_point_t *ring;
+    size_t   ring_num;
+
+    /* Maps identifiers to wg_name_t. Protected by `names_lock'. */
+    c_avl_tree_t *names;
+    cdtime_t names_checked;
+    pthread_mutex_t names_lock;
 };
 
+/* The queued blocks of all destinations. */
+static mem_account_t *wg_mem = NULL;
 
 /*
  * Functions
  */
-static void wg_reset_buffer (struct wg_callback *cb)
+/* 32 bit FNV-1a. The ring keys only differ in their last characters, so the
+ * result is mixed some more to spread the points evenly. */
+static uint32_t wg_hash (const char *str)
+{
+    uint32_t hash = 2166136261U;
+
+    while (*str != 0)
+    {
+        hash ^= (uint32_t) ((unsigned char) *str);
+        hash *= 16777619U;
+        str++;
+    }
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bU;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35U;
+    hash ^= hash >> 16;
+
+    return (hash);
+}
+
+static void wg_reset_buffer (wg_destination_t *dest)
 {
-    memset (cb->send_buf, 0, sizeof (cb->send_buf));
-    cb->send_buf_free = sizeof (cb->send_buf);
-    cb->send_buf_fill = 0;
-    cb->send_buf_init_time = cdtime ();
+    memset (dest->send_buf, 0, sizeof (dest->send_buf));
+    dest->send_buf_free = sizeof (dest->send_buf);
+    dest->send_buf_fill = 0;
+    dest->send_buf_init_time = cdtime ();
 }
 
-static int wg_send_buffer (struct wg_callback *cb)
+static int wg_send_buffer (wg_destination_t *dest)
 {
     ssize_t status = 0;
 
-    status = swrite (cb->sock_fd, cb->send_buf, strlen (cb->send_buf));
+    status = swrite (dest->sock_fd, dest->send_buf, strlen (dest->send_buf));
     if (status < 0)
     {
         char errbuf[1024];
@@ -120,8 +217,8 @@ static int wg_send_buffer (struct wg_callback *cb)
                 status, sstrerror (errno, errbuf, sizeof (errbuf)));
 
 
-        close (cb->sock_fd);
-        cb->sock_fd = -1;
+        close (dest->sock_fd);
+        dest->sock_fd = -1;
 
         return (-1);
     }
@@ -129,49 +226,45 @@ static int wg_send_buffer (struct wg_callback *cb)
     return (0);
 }
 
-/* NOTE: You must hold cb->send_lock when calling this function! */
-static int wg_flush_nolock (cdtime_t timeout, struct wg_callback *cb)
+/* Waits up to WG_IO_TIMEOUT milliseconds until `fd' is writable. */
+static int wg_wait_writable (int fd)
 {
+    struct pollfd pfd;
     int status;
 
-    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
-            "send_buf_fill = %zu;",
-            (double)timeout,
-            cb->send_buf_fill);
-
-    /* timeout == 0  => flush unconditionally */
-    if (timeout > 0)
-    {
-        cdtime_t now;
+    memset (&pfd, 0, sizeof (pfd));
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
 
-        now = cdtime ();
-        if ((cb->send_buf_init_time + timeout) > now)
-            return (0);
-    }
+    do
+        status = poll (&pfd, 1, WG_IO_TIMEOUT);
+    while ((status < 0) && (errno == EINTR));
 
-    if (cb->send_buf_fill <= 0)
+    if (status == 0)
     {
-        cb->send_buf_init_time = cdtime ();
-        return (0);
+        errno = ETIMEDOUT;
+        return (-1);
     }
+    else if (status < 0)
+        return (-1);
 
-    status = wg_send_buffer (cb);
-    wg_reset_buffer (cb);
-
-    return (status);
+    return (0);
 }
 
-static int wg_callback_init (struct wg_callback *cb)
+/* Connects `dest->sock_fd'. If `nonblocking' is true, the socket is put into
+ * non-blocking mode and connecting gives up after WG_IO_TIMEOUT
+ * milliseconds. */
+static int wg_connect (wg_destination_t *dest, _Bool nonblocking)
 {
     struct addrinfo ai_hints;
     struct addrinfo *ai_list;
     struct addrinfo *ai_ptr;
     int status;
 
-    const char *node = cb->node ? cb->node : WG_DEFAULT_NODE;
-    const char *service = cb->service ? cb->service : WG_DEFAULT_SERVICE;
+    const char *node = dest->node ? dest->node : WG_DEFAULT_NODE;
+    const char *service = dest->service ? dest->service : WG_DEFAULT_SERVICE;
 
-    if (cb->sock_fd > 0)
+    if (dest->sock_fd >= 0)
         return (0);
 
     memset (&ai_hints, 0, sizeof (ai_hints));
@@ -194,16 +287,38 @@ static int wg_callback_init (struct wg_callback *cb)
     assert (ai_list != NULL);
     for (ai_ptr = ai_list; ai_ptr != NULL; ai_ptr = ai_ptr->ai_next)
     {
-        cb->sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
+        dest->sock_fd = socket (ai_ptr->ai_family, ai_ptr->ai_socktype,
                 ai_ptr->ai_protocol);
-        if (cb->sock_fd < 0)
+        if (dest->sock_fd < 0)
             continue;
 
-        status = connect (cb->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        if (nonblocking)
+        {
+            int flags = fcntl (dest->sock_fd, F_GETFL);
+            fcntl (dest->sock_fd, F_SETFL, flags | O_NONBLOCK);
+        }
+
+        status = connect (dest->sock_fd, ai_ptr->ai_addr, ai_ptr->ai_addrlen);
+        if ((status != 0) && nonblocking && (errno == EINPROGRESS))
+        {
+            int so_error = 0;
+            socklen_t so_error_len = sizeof (so_error);
+
+            status = wg_wait_writable (dest->sock_fd);
+            if (status == 0)
+                status = getsockopt (dest->sock_fd, SOL_SOCKET, SO_ERROR,
+                        &so_error, &so_error_len);
+            if ((status == 0) && (so_error != 0))
+            {
+                errno = so_error;
+                status = -1;
+            }
+        }
+
         if (status != 0)
         {
-            close (cb->sock_fd);
-            cb->sock_fd = -1;
+            close (dest->sock_fd);
+            dest->sock_fd = -1;
             continue;
         }
 
@@ -212,43 +327,351 @@ static int wg_callback_init (struct wg_callback *cb)
 
     freeaddrinfo (ai_list);
 
-    if (cb->sock_fd < 0)
+    if (dest->sock_fd < 0)
     {
         char errbuf[1024];
         ERROR ("write_graphite plugin: Connecting to %s:%s failed. "
                 "The last error was: %s", node, service,
                 sstrerror (errno, errbuf, sizeof (errbuf)));
-        close (cb->sock_fd);
         return (-1);
     }
 
-    wg_reset_buffer (cb);
+    return (0);
+}
+
+static int wg_callback_init (wg_destination_t *dest)
+{
+    int status;
+
+    status = wg_connect (dest, /* nonblocking = */ 0);
+    if (status != 0)
+        return (status);
+
+    wg_reset_buffer (dest);
 
     return (0);
 }
 
+/* Sends one queued buffer, connecting first if necessary. Called by the
+ * sender thread without holding any lock. */
+static int wg_send_block (wg_destination_t *dest, const wg_block_t *b)
+{
+    size_t sent = 0;
+
+    if (dest->sock_fd < 0)
+    {
+        if (wg_connect (dest, /* nonblocking = */ 1) != 0)
+            return (-1);
+        INFO ("write_graphite plugin: Connected to %s:%s.",
+                dest->node ? dest->node : WG_DEFAULT_NODE,
+                dest->service ? dest->service : WG_DEFAULT_SERVICE);
+    }
+
+    while (sent < b->len)
+    {
+        ssize_t status;
+
+        status = write (dest->sock_fd, b->data + sent, b->len - sent);
+        if ((status < 0)
+                && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+            status = wg_wait_writable (dest->sock_fd);
+        else if ((status < 0) && (errno == EINTR))
+            status = 0;
+        else if (status > 0)
+        {
+            sent += (size_t) status;
+            status = 0;
+        }
+
+        if (status < 0)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: Sending to %s:%s failed: %s",
+                    dest->node ? dest->node : WG_DEFAULT_NODE,
+                    dest->service ? dest->service : WG_DEFAULT_SERVICE,
+                    sstrerror (errno, errbuf, sizeof (errbuf)));
+            close (dest->sock_fd);
+            dest->sock_fd = -1;
+            return (-1);
+        }
+    }
+
+    return (0);
+}
+
+static void wg_block_free (wg_block_t *b)
+{
+    if (b == NULL)
+        return;
+
+    mem_account_add (wg_mem, -((int64_t) sizeof (*b)));
+    sfree (b);
+}
+
+/* NOTE: You must hold dest->send_lock when calling this function! */
+static void wg_queue_free_nolock (wg_destination_t *dest)
+{
+    while (dest->queue_head != NULL)
+    {
+        wg_block_t *b = dest->queue_head;
+
+        dest->queue_head = b->next;
+        wg_block_free (b);
+    }
+    dest->queue_tail = NULL;
+    dest->queue_len = 0;
+}
+
+static void *wg_sender_thread (void *arg)
+{
+    wg_destination_t *dest = arg;
+
+    pthread_mutex_lock (&dest->send_lock);
+    while (42)
+    {
+        wg_block_t *b;
+        int status;
+
+        while ((dest->queue_head == NULL) && !dest->thread_shutdown)
+            pthread_cond_wait (&dest->cond, &dest->send_lock);
+
+        b = dest->queue_head;
+        if (b == NULL)
+            break;
+
+        dest->queue_head = b->next;
+        if (dest->queue_head == NULL)
+            dest->queue_tail = NULL;
+        dest->queue_len--;
+
+        pthread_mutex_unlock (&dest->send_lock);
+        status = wg_send_block (dest, b);
+        pthread_mutex_lock (&dest->send_lock);
+
+        if (status == 0)
+        {
+            dest->reconnect_delay = 0;
+            wg_block_free (b);
+            continue;
+        }
+
+        if (dest->thread_shutdown)
+        {
+            ERROR ("write_graphite plugin: Dropping %i buffers for %s:%s "
+                    "during shutdown.", dest->queue_len + 1,
+                    dest->node ? dest->node : WG_DEFAULT_NODE,
+                    dest->service ? dest->service : WG_DEFAULT_SERVICE);
+            wg_block_free (b);
+            wg_queue_free_nolock (dest);
+            break;
+        }
+
+        /* Put the buffer back and wait before reconnecting. The delay doubles
+         * with each failure, up to WG_MAX_RECONNECT_DELAY. */
+        b->next = dest->queue_head;
+        dest->queue_head = b;
+        if (dest->queue_tail == NULL)
+            dest->queue_tail = b;
+        dest->queue_len++;
+
+        if (dest->reconnect_delay == 0)
+            dest->reconnect_delay = WG_MIN_RECONNECT_DELAY;
+        else if (dest->reconnect_delay < WG_MAX_RECONNECT_DELAY)
+            dest->reconnect_delay *= 2;
+        if (dest->reconnect_delay > WG_MAX_RECONNECT_DELAY)
+            dest->reconnect_delay = WG_MAX_RECONNECT_DELAY;
+
+        {
+            cdtime_t deadline = cdtime () + dest->reconnect_delay;
+            struct timespec ts;
+
+            CDTIME_T_TO_TIMESPEC (deadline, &ts);
+            while (!dest->thread_shutdown && (cdtime () < deadline))
+                pthread_cond_timedwait (&dest->cond, &dest->send_lock, &ts);
+        }
+    }
+    pthread_mutex_unlock (&dest->send_lock);
+
+    return ((void *) 0);
+}
+
+/* Moves the send buffer to the sender thread's queue, starting the thread if
+ * necessary. If the queue is full, the oldest buffer is dropped.
+ * NOTE: You must hold dest->send_lock when calling this function! */
+static int wg_enqueue_nolock (wg_destination_t *dest)
+{
+    wg_block_t *b;
+    int status;
+
+    if (!dest->thread_running)
+    {
+        status = pthread_create (&dest->thread, /* attr = */ NULL,
+                wg_sender_thread, dest);
+        if (status != 0)
+        {
+            char errbuf[1024];
+            ERROR ("write_graphite plugin: pthread_create failed: %s",
+                    sstrerror (status, errbuf, sizeof (errbuf)));
+            return (-1);
+        }
+        dest->thread_running = 1;
+    }
+
+    b = malloc (sizeof (*b));
+    if (b == NULL)
+    {
+        ERROR ("write_graphite plugin: malloc failed.");
+        return (-1);
+    }
+    b->next = NULL;
+    b->len = dest->send_buf_fill;
+    memcpy (b->data, dest->send_buf, b->len);
+    mem_account_add (wg_mem, (int64_t) sizeof (*b));
+
+    if (dest->queue_len >= dest->queue_limit)
+    {
+        c_complain (LOG_WARNING, &dest->queue_complaint,
+                "write_graphite plugin: The send queue for %s:%s is full. "
+                "Dropping the oldest data.",
+                dest->node ? dest->node : WG_DEFAULT_NODE,
+                dest->service ? dest->service : WG_DEFAULT_SERVICE);
+        while (dest->queue_len >= dest->queue_limit)
+        {
+            wg_block_t *old = dest->queue_head;
+
+            dest->queue_head = old->next;
+            if (dest->queue_head == NULL)
+                dest->queue_tail = NULL;
+            dest->queue_len--;
+            wg_block_free (old);
+        }
+    }
+    else
+    {
+        c_release (LOG_INFO, &dest->queue_complaint,
+                "write_graphite plugin: The send queue for %s:%s is no "
+                "longer full.",
+                dest->node ? dest->node : WG_DEFAULT_NODE,
+                dest->service ? dest->service : WG_DEFAULT_SERVICE);
+    }
+
+    if (dest->queue_tail == NULL)
+        dest->queue_head = b;
+    else
+        dest->queue_tail->next = b;
+    dest->queue_tail = b;
+    dest->queue_len++;
+
+    pthread_cond_signal (&dest->cond);
+
+    return (0);
+}
+
+/* NOTE: You must hold dest->send_lock when calling this function! */
+static int wg_flush_nolock (cdtime_t timeout, wg_destination_t *dest)
+{
+    int status;
+
+    DEBUG ("write_graphite plugin: wg_flush_nolock: timeout = %.3f; "
+            "send_buf_fill = %zu;",
+            (double)timeout,
+            dest->send_buf_fill);
+
+    /* timeout == 0  => flush unconditionally */
+    if (timeout > 0)
+    {
+        cdtime_t now;
+
+        now = cdtime ();
+        if ((dest->send_buf_init_time + timeout) > now)
+            return (0);
+    }
+
+    if (dest->send_buf_fill <= 0)
+    {
+        dest->send_buf_init_time = cdtime ();
+        return (0);
+    }
+
+    if (dest->queue_limit > 0)
+        status = wg_enqueue_nolock (dest);
+    else
+        status = wg_send_buffer (dest);
+    wg_reset_buffer (dest);
+
+    return (status);
+}
+
+static void wg_destination_free (wg_destination_t *dest)
+{
+    if (dest == NULL)
+        return;
+
+    pthread_mutex_lock (&dest->send_lock);
+
+    wg_flush_nolock (/* timeout = */ 0, dest);
+
+    /* The sender thread sends what's left in the queue before exiting. */
+    if (dest->thread_running)
+    {
+        dest->thread_shutdown = 1;
+        pthread_cond_signal (&dest->cond);
+        pthread_mutex_unlock (&dest->send_lock);
+        pthread_join (dest->thread, /* retval = */ NULL);
+        pthread_mutex_lock (&dest->send_lock);
+        dest->thread_running = 0;
+    }
+    wg_queue_free_nolock (dest);
+
+    pthread_mutex_unlock (&dest->send_lock);
+
+    if (dest->sock_fd >= 0)
+        close (dest->sock_fd);
+    dest->sock_fd = -1;
+
+    sfree (dest->node);
+    sfree (dest->service);
+
+    pthread_cond_destroy (&dest->cond);
+    pthread_mutex_destroy (&dest->send_lock);
+
+    sfree (dest);
+}
+
 static void wg_callback_free (void *data)
 {
     struct wg_callback *cb;
+    size_t i;
 
     if (data == NULL)
         return;
 
     cb = data;
 
-    pthread_mutex_lock (&cb->send_lock);
-
-    wg_flush_nolock (/* timeout = */ 0, cb);
-
-    close(cb->sock_fd);
-    cb->sock_fd = -1;
+    for (i = 0; i < cb->destinations_num; i++)
+        wg_destination_free (cb->destinations[i]);
+    sfree (cb->destinations);
+    sfree (cb->ring);
 
-    sfree(cb->node);
-    sfree(cb->service);
     sfree(cb->prefix);
     sfree(cb->postfix);
 
-    pthread_mutex_destroy (&cb->send_lock);
+    if (cb->names != NULL)
+    {
+        void *key;
+        void *value;
+
+        while (c_avl_pick (cb->names, &key, &value) == 0)
+        {
+            wg_name_t *n = value;
+
+            sfree (key);
+            sfree (n->base);
+            sfree (n);
+        }
+        c_avl_destroy (cb->names);
+    }
+    pthread_mutex_destroy (&cb->names_lock);
 
     sfree(cb);
 }
@@ -259,38 +682,135 @@ static int wg_flush (cdtime_t timeout,
 {
     struct wg_callback *cb;
     int status;
+    int ret = 0;
+    size_t i;
 
     if (user_data == NULL)
         return (-EINVAL);
 
     cb = user_data->data;
 
-    pthread_mutex_lock (&cb->send_lock);
-
-    if (cb->sock_fd < 0)
+    for (i = 0; i < cb->destinations_num; i++)
     {
-        status = wg_callback_init (cb);
+        wg_destination_t *dest = cb->destinations[i];
+
+        pthread_mutex_lock (&dest->send_lock);
+
+        if ((dest->queue_limit == 0) && (dest->sock_fd < 0))
+        {
+            status = wg_callback_init (dest);
+            if (status != 0)
+            {
+                ERROR ("write_graphite plugin: wg_callback_init failed.");
+                pthread_mutex_unlock (&dest->send_lock);
+                ret = -1;
+                continue;
+            }
+        }
+
+        status = wg_flush_nolock (timeout, dest);
+        pthread_mutex_unlock (&dest->send_lock);
+
         if (status != 0)
+            ret = status;
+    }
+
+    return (ret);
+}
+
+/* Picks the destination for a metric by looking up the first point on the
+ * ring at or after the metric's hash. */
+static wg_destination_t *wg_get_destination (const struct wg_callback *cb,
+        const char *key)
+{
+    uint32_t hash;
+    size_t lo;
+    size_t hi;
+
+    if (cb->destinations_num == 1)
+        return (cb->destinations[0]);
+
+    hash = wg_hash (key);
+    lo = 0;
+    hi = cb->ring_num;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (cb->ring[mid].hash < hash)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (lo >= cb->ring_num)
+        lo = 0;
+
+    return (cb->destinations[cb->ring[lo].index]);
+}
+
+static int wg_ring_point_compare (const void *a, const void *b)
+{
+    const wg_ring_point_t *p0 = a;
+    const wg_ring_point_t *p1 = b;
+
+    if (p0->hash < p1->hash)
+        return (-1);
+    else if (p0->hash > p1->hash)
+        return (1);
+    else if (p0->index < p1->index)
+        return (-1);
+    else if (p0->index > p1->index)
+        return (1);
+    return (0);
+}
+
+static int wg_ring_build (struct wg_callback *cb)
+{
+    size_t i;
+    int j;
+
+    if (cb->destinations_num < 2)
+        return (0);
+
+    cb->ring_num = cb->destinations_num * WG_RING_REPLICAS;
+    cb->ring = calloc (cb->ring_num, sizeof (*cb->ring));
+    if (cb->ring == NULL)
+    {
+        ERROR ("write_graphite plugin: calloc failed.");
+        cb->ring_num = 0;
+        return (-1);
+    }
+
+    for (i = 0; i < cb->destinations_num; i++)
+    {
+        wg_destination_t *dest = cb->destinations[i];
+
+        for (j = 0; j < WG_RING_REPLICAS; j++)
         {
-            ERROR ("write_graphite plugin: wg_callback_init failed.");
-            pthread_mutex_unlock (&cb->send_lock);
-            return (-1);
+            char buffer[256];
+            wg_ring_point_t *p = cb->ring + (i * WG_RING_REPLICAS) + j;
+
+            ssnprintf (buffer, sizeof (buffer), "%s:%s:%i",
+                    dest->node ? dest->node : WG_DEFAULT_NODE,
+                    dest->service ? dest->service : WG_DEFAULT_SERVICE, j);
+            p->hash = wg_hash (buffer);
+            p->index = i;
         }
     }
 
-    status = wg_flush_nolock (timeout, cb);
-    pthread_mutex_unlock (&cb->send_lock);
+    qsort (cb->ring, cb->ring_num, sizeof (*cb->ring), wg_ring_point_compare);
 
-    return (status);
+    return (0);
 }
 
+/* If `rates' is not NULL, it is used for all non-gauge data sources. */
 static int wg_format_values (char *ret, size_t ret_len,
         int ds_num, const data_set_t *ds, const value_list_t *vl,
-        _Bool store_rates)
+        const gauge_t *rates)
 {
     size_t offset = 0;
     int status;
-    gauge_t *rates = NULL;
 
     assert (0 == strcmp (ds->type, vl->type));
 
@@ -300,33 +820,17 @@ static int wg_format_values (char *ret, size_t ret_len,
     status = ssnprintf (ret + offset, ret_len - offset, \
             __VA_ARGS__); \
     if (status < 1) \
-    { \
-        sfree (rates); \
         return (-1); \
-    } \
     else if (((size_t) status) >= (ret_len - offset)) \
-    { \
-        sfree (rates); \
         return (-1); \
-    } \
     else \
     offset += ((size_t) status); \
 } while (0)
 
     if (ds->ds[ds_num].type == DS_TYPE_GAUGE)
         BUFFER_ADD ("%f", vl->values[ds_num].gauge);
-    else if (store_rates)
-    {
-        if (rates == NULL)
-            rates = uc_get_rate (ds, vl);
-        if (rates == NULL)
-        {
-            WARNING ("format_values: "
-                    "uc_get_rate failed.");
-            return (-1);
-        }
+    else if (rates != NULL)
         BUFFER_ADD ("%g", rates[ds_num]);
-    }
     else if (ds->ds[ds_num].type == DS_TYPE_COUNTER)
         BUFFER_ADD ("%llu", vl->values[ds_num].counter);
     else if (ds->ds[ds_num].type == DS_TYPE_DERIVE)
@@ -337,16 +841,21 @@ static int wg_format_values (char *ret, size_t ret_len,
     {
         ERROR ("format_values plugin: Unknown data source type: %i",
                 ds->ds[ds_num].type);
-        sfree (rates);
         return (-1);
     }
 
 #undef BUFFER_ADD
 
-    sfree (rates);
     return (0);
 }
 
+/* Dots, and the characters isspace(3) and iscntrl(3) match in the "C"
+ * locale. */
+static const char wg_escape_chars[] = ". \t\n\v\f\r"
+    "\001\002\003\004\005\006\007\010\016\017"
+    "\020\021\022\023\024\025\026\027\030\031\032\033\034\035\036\037"
+    "\177";
+
 static void wg_copy_escape_part (char *dst, const char *src, size_t dst_len,
     char escape_char)
 {
@@ -357,6 +866,15 @@ static void wg_copy_escape_part (char *dst, const char *src, size_t dst_len,
     if (src == NULL)
         return;
 
+    /* Usually there is nothing to escape. strcspn(3) is vectorized by the
+     * C library, so check that first and copy the string in one go. */
+    i = strcspn (src, wg_escape_chars);
+    if ((src[i] == 0) && (i < dst_len))
+    {
+        memcpy (dst, src, i);
+        return;
+    }
+
     for (i = 0; i < dst_len; i++)
     {
         if (src[i] == 0)
@@ -374,10 +892,9 @@ static void wg_copy_escape_part (char *dst, const char *src, size_t dst_len,
     }
 }
 
-static int wg_format_name (char *ret, int ret_len,
+static int wg_format_base (char *ret, int ret_len,
         const value_list_t *vl,
-        const struct wg_callback *cb,
-        const char *ds_name)
+        const struct wg_callback *cb)
 {
     char n_host[DATA_MAX_NAME_LEN];
     char n_plugin[DATA_MAX_NAME_LEN];
@@ -426,12 +943,123 @@ static int wg_format_name (char *ret, int ret_len,
     else
         sstrncpy (tmp_type, n_type, sizeof (tmp_type));
 
+    ssnprintf (ret, ret_len, "%s%s%s.%s.%s",
+        prefix, n_host, postfix, tmp_plugin, tmp_type);
+
+    return (0);
+}
+
+/* Removes names which haven't been used for as long as the value cache keeps
+ * values around. NOTE: You must hold cb->names_lock when calling this
+ * function! */
+static void wg_names_expire (struct wg_callback *cb, cdtime_t now)
+{
+    cdtime_t timeout = timeout_g * interval_g;
+    c_avl_iterator_t iter;
+    char **keys = NULL;
+    size_t keys_num = 0;
+    char *key;
+    wg_name_t *n;
+    size_t i;
+
+    if ((now - cb->names_checked) < timeout)
+        return;
+    cb->names_checked = now;
+
+    c_avl_iterator_init (&iter, cb->names);
+    while (c_avl_iterator_next (&iter, (void *) &key, (void *) &n) == 0)
+    {
+        char **tmp;
+
+        if ((now - n->last_used) < timeout)
+            continue;
+
+        tmp = realloc (keys, (keys_num + 1) * sizeof (*keys));
+        if (tmp == NULL)
+            break;
+        keys = tmp;
+        keys[keys_num] = key;
+        keys_num++;
+    }
+
+    for (i = 0; i < keys_num; i++)
+    {
+        if (c_avl_remove (cb->names, keys[i], (void *) &key, (void *) &n) != 0)
+            continue;
+
+        sfree (key);
+        sfree (n->base);
+        sfree (n);
+    }
+    sfree (keys);
+}
+
+/* Escaping every part of the identifier is expensive compared to the rest of
+ * the write path and the same identifiers are written each interval, so the
+ * escaped base name is looked up in `cb->names' first. */
+static int wg_format_name (char *ret, int ret_len,
+        const value_list_t *vl,
+        struct wg_callback *cb,
+        const char *ds_name)
+{
+    vl_identifier_t ident_buf;
+    const vl_identifier_t *ident;
+    const char *identifier;
+    char base[10 * DATA_MAX_NAME_LEN];
+    wg_name_t *n = NULL;
+    cdtime_t now;
+    int status;
+
+    ident = plugin_value_list_identifier (vl, &ident_buf);
+    if (ident == NULL)
+        return (-1);
+    identifier = ident->name;
+
+    now = cdtime ();
+
+    pthread_mutex_lock (&cb->names_lock);
+    if (c_avl_get (cb->names, identifier, (void *) &n) == 0)
+    {
+        n->last_used = now;
+        sstrncpy (base, n->base, sizeof (base));
+        pthread_mutex_unlock (&cb->names_lock);
+    }
+    else
+    {
+        char *key;
+
+        pthread_mutex_unlock (&cb->names_lock);
+
+        status = wg_format_base (base, sizeof (base), vl, cb);
+        if (status != 0)
+            return (status);
+
+        key = strdup (identifier);
+        n = malloc (sizeof (*n));
+        if ((key != NULL) && (n != NULL))
+        {
+            n->base = strdup (base);
+            n->last_used = now;
+        }
+
+        pthread_mutex_lock (&cb->names_lock);
+        if ((key == NULL) || (n == NULL) || (n->base == NULL)
+                || (c_avl_insert (cb->names, key, n) != 0))
+        {
+            /* Out of memory or another thread was faster. */
+            sfree (key);
+            if (n != NULL)
+                sfree (n->base);
+            sfree (n);
+        }
+        wg_names_expire (cb, now);
+        pthread_mutex_unlock (&cb->names_lock);
+    }
+
     if (ds_name != NULL)
-        ssnprintf (ret, ret_len, "%s%s%s.%s.%s.%s",
-            prefix, n_host, postfix, tmp_plugin, tmp_type, ds_name);
+        ssnprintf (ret, ret_len, "%s.%s", base, ds_name);
     else
-        ssnprintf (ret, ret_len, "%s%s%s.%s.%s",
-            prefix, n_host, postfix, tmp_plugin, tmp_type);
+        sstrncpy (ret, base, ret_len);
 
     return (0);
 }
@@ -439,6 +1067,7 @@ static int wg_format_name (char *ret, int ret_len,
 static int wg_send_message (const char* key, const char* value,
         cdtime_t time, struct wg_callback *cb)
 {
+    wg_destination_t *dest;
     int status;
     size_t message_len;
     char message[1024];
@@ -454,47 +1083,50 @@ static int wg_send_message (const char* key, const char* value,
         return (-1);
     }
 
-    pthread_mutex_lock (&cb->send_lock);
+    dest = wg_get_destination (cb, key);
+
+    pthread_mutex_lock (&dest->send_lock);
 
-    if (cb->sock_fd < 0)
+    /* In asynchronous mode, the sender thread connects. */
+    if ((dest->queue_limit == 0) && (dest->sock_fd < 0))
     {
-        status = wg_callback_init (cb);
+        status = wg_callback_init (dest);
         if (status != 0)
         {
             ERROR ("write_graphite plugin: wg_callback_init failed.");
-            pthread_mutex_unlock (&cb->send_lock);
+            pthread_mutex_unlock (&dest->send_lock);
             return (-1);
         }
     }
 
-    if (message_len >= cb->send_buf_free)
+    if (message_len >= dest->send_buf_free)
     {
-        status = wg_flush_nolock (/* timeout = */ 0, cb);
+        status = wg_flush_nolock (/* timeout = */ 0, dest);
         if (status != 0)
         {
-            pthread_mutex_unlock (&cb->send_lock);
+            pthread_mutex_unlock (&dest->send_lock);
             return (status);
         }
     }
 
     /* Assert that we have enough space for this message. */
-    assert (message_len < cb->send_buf_free);
+    assert (message_len < dest->send_buf_free);
 
     /* `message_len + 1' because `message_len' does not include the
      * trailing null byte. Neither does `send_buffer_fill'. */
-    memcpy (cb->send_buf + cb->send_buf_fill,
+    memcpy (dest->send_buf + dest->send_buf_fill,
             message, message_len + 1);
-    cb->send_buf_fill += message_len;
-    cb->send_buf_free -= message_len;
+    dest->send_buf_fill += message_len;
+    dest->send_buf_free -= message_len;
 
     DEBUG ("write_graphite plugin: [%s]:%s buf %zu/%zu (%.1f %%) \"%s\"",
-            cb->node,
-            cb->service,
-            cb->send_buf_fill, sizeof (cb->send_buf),
-            100.0 * ((double) cb->send_buf_fill) / ((double) sizeof (cb->send_buf)),
+            dest->node,
+            dest->service,
+            dest->send_buf_fill, sizeof (dest->send_buf),
+            100.0 * ((double) dest->send_buf_fill) / ((double) sizeof (dest->send_buf)),
             message);
 
-    pthread_mutex_unlock (&cb->send_lock);
+    pthread_mutex_unlock (&dest->send_lock);
 
     return (0);
 }
@@ -504,6 +1136,8 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
 {
     char key[10*DATA_MAX_NAME_LEN];
     char values[512];
+    gauge_t rates_buffer[ds->ds_num];
+    gauge_t *rates = NULL;
 
     int status, i;
 
@@ -514,6 +1148,22 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
         return -1;
     }
 
+    /* Fetch the rates once for all data sources, not once per data source. */
+    for (i = 0; cb->store_rates && (i < ds->ds_num); i++)
+    {
+        if (ds->ds[i].type == DS_TYPE_GAUGE)
+            continue;
+
+        if (uc_get_rate_buffer (ds, vl, rates_buffer) != 0)
+        {
+            WARNING ("write_graphite plugin: "
+                    "uc_get_rate_buffer failed.");
+            return (-1);
+        }
+        rates = rates_buffer;
+        break;
+    }
+
     for (i = 0; i < ds->ds_num; i++)
     {
         const char *ds_name = NULL;
@@ -533,7 +1183,7 @@ static int wg_write_messages (const data_set_t *ds, const value_list_t *vl,
         /* Convert the values to an ASCII representation and put that into
          * `values'. */
         status = wg_format_values (values, sizeof (values), i, ds, vl,
-                    cb->store_rates);
+                    rates);
         if (status != 0)
         {
             ERROR ("write_graphite plugin: error with "
@@ -570,6 +1220,44 @@ static int wg_write (const data_set_t *ds, const value_list_t *vl,
     return (status);
 }
 
+/* Batch write callback: the lines of the whole batch are collected in the
+ * send buffers, which are then flushed, so each destination sees one write
+ * per batch (as long as it fits into the buffer). */
+static int wg_write_batch (const data_set_t **ds, const value_list_t **vl,
+        size_t num, user_data_t *user_data)
+{
+    struct wg_callback *cb;
+    size_t i;
+    int status = 0;
+
+    if (user_data == NULL)
+        return (EINVAL);
+
+    cb = user_data->data;
+
+    for (i = 0; i < num; i++)
+    {
+        int tmp = wg_write_messages (ds[i], vl[i], cb);
+        if (tmp != 0)
+            status = tmp;
+    }
+
+    for (i = 0; i < cb->destinations_num; i++)
+    {
+        wg_destination_t *dest = cb->destinations[i];
+        int tmp;
+
+        pthread_mutex_lock (&dest->send_lock);
+        tmp = wg_flush_nolock (/* timeout = */ 0, dest);
+        pthread_mutex_unlock (&dest->send_lock);
+
+        if (tmp != 0)
+            status = tmp;
+    }
+
+    return (status);
+}
+
 static int config_set_char (char *dest,
         oconfig_item_t *ci)
 {
@@ -601,11 +1289,97 @@ static int config_set_char (char *dest,
     return (0);
 }
 
+/* Adds a destination to `cb'. Takes ownership of `node' and `service', even
+ * on failure. */
+static int wg_destination_add (struct wg_callback *cb,
+        char *node, char *service)
+{
+    wg_destination_t **tmp;
+    wg_destination_t *dest;
+
+    tmp = realloc (cb->destinations,
+            (cb->destinations_num + 1) * sizeof (*cb->destinations));
+    dest = malloc (sizeof (*dest));
+    if ((tmp == NULL) || (dest == NULL))
+    {
+        ERROR ("write_graphite plugin: malloc failed.");
+        if (tmp != NULL)
+            cb->destinations = tmp;
+        sfree (dest);
+        sfree (node);
+        sfree (service);
+        return (-1);
+    }
+    cb->destinations = tmp;
+
+    memset (dest, 0, sizeof (*dest));
+    dest->node = node;
+    dest->service = service;
+    dest->sock_fd = -1;
+    C_COMPLAIN_INIT (&dest->queue_complaint);
+    pthread_mutex_init (&dest->send_lock, /* attr = */ NULL);
+    pthread_cond_init (&dest->cond, /* attr = */ NULL);
+    wg_reset_buffer (dest);
+
+    cb->destinations[cb->destinations_num] = dest;
+    cb->destinations_num++;
+
+    return (0);
+}
+
+static int wg_config_destination (struct wg_callback *cb,
+        oconfig_item_t *ci)
+{
+    char *node;
+    char *service = NULL;
+
+    if ((ci->values_num < 1) || (ci->values_num > 2)
+            || (ci->values[0].type != OCONFIG_TYPE_STRING)
+            || ((ci->values_num == 2)
+                && (ci->values[1].type != OCONFIG_TYPE_STRING)
+                && (ci->values[1].type != OCONFIG_TYPE_NUMBER)))
+    {
+        ERROR ("write_graphite plugin: The \"Destination\" option requires "
+                "a host and an optional port.");
+        return (-1);
+    }
+
+    node = strdup (ci->values[0].value.string);
+    if (ci->values_num == 2)
+    {
+        if (ci->values[1].type == OCONFIG_TYPE_STRING)
+            service = strdup (ci->values[1].value.string);
+        else
+        {
+            char buffer[16];
+            ssnprintf (buffer, sizeof (buffer), "%i",
+                    (int) ci->values[1].value.number);
+            service = strdup (buffer);
+        }
+    }
+
+    if ((node == NULL) || ((ci->values_num == 2) && (service == NULL)))
+    {
+        ERROR ("write_graphite plugin: strdup failed.");
+        sfree (node);
+        sfree (service);
+        return (-1);
+    }
+
+    return (wg_destination_add (cb, node, service));
+}
+
 static int wg_config_carbon (oconfig_item_t *ci)
 {
     struct wg_callback *cb;
     user_data_t user_data;
     char callback_name[DATA_MAX_NAME_LEN];
+    char *node = NULL;
+    char *service = NULL;
+    int queue_limit = 0;
+    int batch_size = 0;
+    cdtime_t batch_timeout = 0;
+    size_t j;
     int i;
 
     cb = malloc (sizeof (*cb));
@@ -615,24 +1389,37 @@ static int wg_config_carbon (oconfig_item_t *ci)
         return (-1);
     }
     memset (cb, 0, sizeof (*cb));
-    cb->sock_fd = -1;
-    cb->node = NULL;
-    cb->service = NULL;
     cb->prefix = NULL;
     cb->postfix = NULL;
     cb->escape_char = WG_DEFAULT_ESCAPE;
     cb->store_rates = 1;
 
-    pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+    cb->names = c_avl_create ((void *) strcmp);
+    if (cb->names == NULL)
+    {
+        ERROR ("write_graphite plugin: c_avl_create failed.");
+        sfree (cb);
+        return (-1);
+    }
+    cb->names_checked = cdtime ();
+    pthread_mutex_init (&cb->names_lock, /* attr = */ NULL);
 
     for (i = 0; i < ci->children_num; i++)
     {
         oconfig_item_t *child = ci->children + i;
 
         if (strcasecmp ("Host", child->key) == 0)
-            cf_util_get_string (child, &cb->node);
+            cf_util_get_string (child, &node);
         else if (strcasecmp ("Port", child->key) == 0)
-            cf_util_get_service (child, &cb->service);
+            cf_util_get_service (child, &service);
+        else if (strcasecmp ("Destination", child->key) == 0)
+            wg_config_destination (cb, child);
+        else if (strcasecmp ("SendQueueLimit", child->key) == 0)
+            cf_util_get_int (child, &queue_limit);
+        else if (strcasecmp ("BatchSize", child->key) == 0)
+            cf_util_get_int (child, &batch_size);
+        else if (strcasecmp ("BatchTimeout", child->key) == 0)
+            cf_util_get_cdtime (child, &batch_timeout);
         else if (strcasecmp ("Prefix", child->key) == 0)
             cf_util_get_string (child, &cb->prefix);
         else if (strcasecmp ("Postfix", child->key) == 0)
@@ -652,14 +1439,50 @@ static int wg_config_carbon (oconfig_item_t *ci)
         }
     }
 
+    /* "Host" and "Port" configure the only destination, unless
+     * "Destination" was used. */
+    if (cb->destinations_num == 0)
+    {
+        if (wg_destination_add (cb, node, service) != 0)
+        {
+            wg_callback_free (cb);
+            return (-1);
+        }
+    }
+    else
+    {
+        if ((node != NULL) || (service != NULL))
+            WARNING ("write_graphite plugin: The \"Host\" and \"Port\" "
+                    "options are ignored when \"Destination\" is used.");
+        sfree (node);
+        sfree (service);
+    }
+
+    if (queue_limit < 0)
+        queue_limit = 0;
+    for (j = 0; j < cb->destinations_num; j++)
+        cb->destinations[j]->queue_limit = queue_limit;
+
+    if (wg_ring_build (cb) != 0)
+    {
+        wg_callback_free (cb);
+        return (-1);
+    }
+
     ssnprintf (callback_name, sizeof (callback_name), "write_graphite/%s/%s",
-            cb->node != NULL ? cb->node : WG_DEFAULT_NODE,
-            cb->service != NULL ? cb->service : WG_DEFAULT_SERVICE);
+            cb->destinations[0]->node != NULL
+            ? cb->destinations[0]->node : WG_DEFAULT_NODE,
+            cb->destinations[0]->service != NULL
+            ? cb->destinations[0]->service : WG_DEFAULT_SERVICE);
 
     memset (&user_data, 0, sizeof (user_data));
     user_data.data = cb;
     user_data.free_func = wg_callback_free;
-    plugin_register_write (callback_name, wg_write, &user_data);
+    if (batch_size > 0)
+        plugin_register_write_batch (callback_name, wg_write_batch,
+                (size_t) batch_size, batch_timeout, &user_data);
+    else
+        plugin_register_write (callback_name, wg_write, &user_data);
 
     user_data.free_func = NULL;
     plugin_register_flush (callback_name, wg_flush, &user_data);
@@ -689,6 +1512,7 @@ static int wg_config (oconfig_item_t *ci)
 
 void module_register (void)
 {
+    wg_mem = mem_account_get ("write_graphite");
     plugin_register_complex_config ("write_graphite", wg_config);
 }
 
@@ -29,6 +29,9 @@
 #include "utils_cache.h"
 #include "utils_parse_option.h"
 #include "utils_format_json.h"
+#include "utils_complain.h"
+#include "utils_memory.h"
+#include "configfile.h"
 
 #if HAVE_PTHREAD_H
 # include <pthread.h>
@@ -36,9 +39,42 @@
 
 #include <curl/curl.h>
 
+#if HAVE_LIBZ
+# include <zlib.h>
+#endif
+
+#define WH_SEND_BUFFER_SIZE 4096
+
+/* How often the sender thread checks for new buffers while requests are in
+ * flight, in milliseconds. */
+#define WH_POLL_INTERVAL 100
+
 /*
  * Private variables
  */
+/* A full send buffer or a batch, waiting to be posted by the sender
+ * thread. */
+struct wh_block_s
+{
+        struct wh_block_s *next;
+        size_t size;
+        char  *data;
+};
+typedef struct wh_block_s wh_block_t;
+
+/* One of the sender thread's easy handles. The handle is idle if `block' is
+ * NULL. */
+struct wh_request_s
+{
+        CURL *curl;
+        char curl_errbuf[CURL_ERROR_SIZE];
+
+        wh_block_t *block;
+        char *body;
+        _Bool started;
+};
+typedef struct wh_request_s wh_request_t;
+
 struct wh_callback_s
 {
         char *location;
@@ -55,18 +91,50 @@ struct wh_callback_s
 #define WH_FORMAT_JSON    1
         int format;
 
+#define WH_COMPRESSION_NONE    0
+#define WH_COMPRESSION_GZIP    1
+#define WH_COMPRESSION_DEFLATE 2
+        int compression;
+#if HAVE_LIBZ
+        z_stream zstream;
+        _Bool    zstream_init;
+#endif
+
         CURL *curl;
         char curl_errbuf[CURL_ERROR_SIZE];
+        struct curl_slist *headers;
 
-        char   send_buffer[4096];
+        char   send_buffer[WH_SEND_BUFFER_SIZE];
         size_t send_buffer_free;
         size_t send_buffer_fill;
         cdtime_t send_buffer_init_time;
 
         pthread_mutex_t send_lock;
+
+        /* If `queue_limit' is greater than zero, full buffers are queued and
+         * posted by `thread' using up to `requests_num' concurrent requests.
+         * The queue and the thread's state are protected by `send_lock', the
+         * multi handle and the requests are only used by the thread. */
+        int queue_limit;
+        wh_block_t *queue_head;
+        wh_block_t *queue_tail;
+        int queue_len;
+        c_complain_t queue_complaint;
+
+        CURLM *multi;
+        wh_request_t *requests;
+        int requests_num;
+
+        pthread_t thread;
+        _Bool thread_running;
+        _Bool thread_shutdown;
+        pthread_cond_t queue_cond;
 };
 typedef struct wh_callback_s wh_callback_t;
 
+/* The queued blocks of all callbacks. */
+static mem_account_t *wh_mem = NULL;
+
 static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
 {
         memset (cb->send_buffer, 0, sizeof (cb->send_buffer));
@@ -82,11 +150,387 @@ static void wh_reset_buffer (wh_callback_t *cb)  /* {{{ */
         }
 } /* }}} wh_reset_buffer */
 
-static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+#if HAVE_LIBZ
+/* Compresses `size' bytes at `data' into a newly allocated buffer, which is
+ * returned in `ret_data'. The stream is reused between calls, so you must
+ * hold cb->send_lock or be the sender thread when calling this function. */
+static int wh_compress (wh_callback_t *cb, /* {{{ */
+                const char *data, size_t size,
+                char **ret_data, size_t *ret_size)
+{
+        char *out;
+        size_t out_size;
+        int status;
+
+        if (!cb->zstream_init)
+        {
+                memset (&cb->zstream, 0, sizeof (cb->zstream));
+                /* Adding 16 to the window bits makes zlib write a gzip
+                 * header instead of a zlib header. */
+                status = deflateInit2 (&cb->zstream, Z_DEFAULT_COMPRESSION,
+                                Z_DEFLATED,
+                                (cb->compression == WH_COMPRESSION_GZIP)
+                                ? (MAX_WBITS + 16) : MAX_WBITS,
+                                /* memLevel = */ 8, Z_DEFAULT_STRATEGY);
+                if (status != Z_OK)
+                {
+                        ERROR ("write_http plugin: deflateInit2 failed "
+                                        "with status %i.", status);
+                        return (-1);
+                }
+                cb->zstream_init = 1;
+        }
+        else
+        {
+                deflateReset (&cb->zstream);
+        }
+
+        /* Leave some room for the gzip header and trailer. */
+        out_size = deflateBound (&cb->zstream, (uLong) size) + 32;
+        out = malloc (out_size);
+        if (out == NULL)
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                return (-1);
+        }
+
+        cb->zstream.next_in = (Bytef *) data;
+        cb->zstream.avail_in = (uInt) size;
+        cb->zstream.next_out = (Bytef *) out;
+        cb->zstream.avail_out = (uInt) out_size;
+
+        status = deflate (&cb->zstream, Z_FINISH);
+        if (status != Z_STREAM_END)
+        {
+                ERROR ("write_http plugin: deflate failed with status %i.",
+                                status);
+                sfree (out);
+                return (-1);
+        }
+
+        *ret_data = out;
+        *ret_size = out_size - cb->zstream.avail_out;
+
+        return (0);
+} /* }}} int wh_compress */
+#endif
+
+/* Returns the body to post for `size' bytes at `data', compressing them if
+ * configured. If a new buffer had to be allocated, it is returned in
+ * `ret_alloc' and must be freed by the caller. */
+static int wh_prepare_body (wh_callback_t *cb, /* {{{ */
+                const char *data, size_t size,
+                const char **ret_body, size_t *ret_size, char **ret_alloc)
+{
+        *ret_body = data;
+        *ret_size = size;
+        *ret_alloc = NULL;
+
+#if HAVE_LIBZ
+        if (cb->compression != WH_COMPRESSION_NONE)
+        {
+                int status;
+
+                status = wh_compress (cb, data, size, ret_alloc, ret_size);
+                if (status != 0)
+                        return (status);
+                *ret_body = *ret_alloc;
+        }
+#endif
+
+        return (0);
+} /* }}} int wh_prepare_body */
+
+static void wh_block_free (wh_block_t *b) /* {{{ */
+{
+        if (b == NULL)
+                return;
+
+        mem_account_add (wh_mem, -((int64_t) (sizeof (*b) + b->size)));
+        sfree (b->data);
+        sfree (b);
+} /* }}} void wh_block_free */
+
+static void wh_queue_free_nolock (wh_callback_t *cb) /* {{{ */
+{
+        while (cb->queue_head != NULL)
+        {
+                wh_block_t *b = cb->queue_head;
+
+                cb->queue_head = b->next;
+                wh_block_free (b);
+        }
+        cb->queue_tail = NULL;
+        cb->queue_len = 0;
+} /* }}} void wh_queue_free_nolock */
+
+/* Adds the request's body to the multi handle. */
+static int wh_request_start (wh_callback_t *cb, wh_request_t *req) /* {{{ */
+{
+        const char *body;
+        size_t body_size;
+        int status;
+
+        status = wh_prepare_body (cb, req->block->data, req->block->size,
+                        &body, &body_size, &req->body);
+        if (status != 0)
+                return (status);
+
+        req->curl_errbuf[0] = 0;
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDSIZE, (long) body_size);
+        curl_easy_setopt (req->curl, CURLOPT_POSTFIELDS, body);
+
+        status = curl_multi_add_handle (cb->multi, req->curl);
+        if (status != CURLM_OK)
+        {
+                ERROR ("write_http plugin: curl_multi_add_handle failed "
+                                "with status %i.", status);
+                return (-1);
+        }
+        req->started = 1;
+
+        return (0);
+} /* }}} int wh_request_start */
+
+static void wh_request_reset (wh_request_t *req) /* {{{ */
+{
+        wh_block_free (req->block);
+        req->block = NULL;
+        sfree (req->body);
+        req->started = 0;
+} /* }}} void wh_request_reset */
+
+/* Handles finished requests and returns the number of handles that became
+ * idle. */
+static int wh_multi_read_done (wh_callback_t *cb) /* {{{ */
+{
+        CURLMsg *msg;
+        int msgs_left;
+        int done = 0;
+
+        while ((msg = curl_multi_info_read (cb->multi, &msgs_left)) != NULL)
+        {
+                wh_request_t *req;
+                char *ptr = NULL;
+
+                if (msg->msg != CURLMSG_DONE)
+                        continue;
+
+                curl_easy_getinfo (msg->easy_handle, CURLINFO_PRIVATE, &ptr);
+                req = (wh_request_t *) ptr;
+                assert (req != NULL);
+
+                if (msg->data.result != CURLE_OK)
+                {
+                        ERROR ("write_http plugin: Posting to %s failed "
+                                        "with status %i: %s",
+                                        cb->location, (int) msg->data.result,
+                                        req->curl_errbuf);
+                }
+
+                curl_multi_remove_handle (cb->multi, req->curl);
+                wh_request_reset (req);
+                done++;
+        }
+
+        return (done);
+} /* }}} int wh_multi_read_done */
+
+/* Waits until one of the requests' sockets becomes ready, curl wants to be
+ * called for a timeout or WH_POLL_INTERVAL has passed. */
+static void wh_multi_wait (wh_callback_t *cb) /* {{{ */
 {
+        fd_set fdread;
+        fd_set fdwrite;
+        fd_set fdexcep;
+        int maxfd = -1;
+        long timeout_ms = -1;
+        struct timeval tv;
+
+        FD_ZERO (&fdread);
+        FD_ZERO (&fdwrite);
+        FD_ZERO (&fdexcep);
+
+        curl_multi_timeout (cb->multi, &timeout_ms);
+        if ((timeout_ms < 0) || (timeout_ms > WH_POLL_INTERVAL))
+                timeout_ms = WH_POLL_INTERVAL;
+        if (timeout_ms == 0)
+                return;
+
+        curl_multi_fdset (cb->multi, &fdread, &fdwrite, &fdexcep, &maxfd);
+
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+        /* With maxfd == -1 this simply sleeps, which is what the curl
+         * documentation recommends. */
+        select (maxfd + 1, &fdread, &fdwrite, &fdexcep, &tv);
+} /* }}} void wh_multi_wait */
+
+/* Posts queued buffers, using up to cb->requests_num requests in parallel.
+ * Each request keeps its connection open, so consecutive requests don't need
+ * to connect again. When shutting down, the queue is drained before the
+ * thread exits. */
+static void *wh_sender_thread (void *arg) /* {{{ */
+{
+        wh_callback_t *cb = arg;
+        int busy = 0;
+        int i;
+
+        pthread_mutex_lock (&cb->send_lock);
+        while (42)
+        {
+                int running;
+
+                /* Hand queued buffers to idle handles. */
+                for (i = 0; (i < cb->requests_num) && (cb->queue_head != NULL); i++)
+                {
+                        wh_block_t *b;
+
+                        if (cb->requests[i].block != NULL)
+                                continue;
+
+                        b = cb->queue_head;
+                        cb->queue_head = b->next;
+                        if (cb->queue_head == NULL)
+                                cb->queue_tail = NULL;
+                        cb->queue_len--;
+
+                        b->next = NULL;
+                        cb->requests[i].block = b;
+                        busy++;
+                }
+
+                if (busy == 0)
+                {
+                        if (cb->thread_shutdown)
+                                break;
+                        pthread_cond_wait (&cb->queue_cond, &cb->send_lock);
+                        continue;
+                }
+                pthread_mutex_unlock (&cb->send_lock);
+
+                for (i = 0; i < cb->requests_num; i++)
+                {
+                        wh_request_t *req = cb->requests + i;
+
+                        if ((req->block == NULL) || req->started)
+                                continue;
+
+                        if (wh_request_start (cb, req) != 0)
+                        {
+                                wh_request_reset (req);
+                                busy--;
+                        }
+                }
+
+                running = 0;
+                while (curl_multi_perform (cb->multi, &running)
+                                == CURLM_CALL_MULTI_PERFORM)
+                        /* do nothing */;
+                busy -= wh_multi_read_done (cb);
+
+                if (busy > 0)
+                        wh_multi_wait (cb);
+
+                pthread_mutex_lock (&cb->send_lock);
+        }
+        pthread_mutex_unlock (&cb->send_lock);
+
+        return ((void *) 0);
+} /* }}} void *wh_sender_thread */
+
+/* Adds `size' bytes at `data' to the sender thread's queue, starting the
+ * thread if necessary. `data' must have been allocated with malloc(3) and is
+ * freed by this function or the thread. If the queue is full, the oldest
+ * buffer is dropped.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wh_enqueue_nolock (wh_callback_t *cb, /* {{{ */
+                char *data, size_t size)
+{
+        wh_block_t *b;
+        int status;
+
+        if (!cb->thread_running)
+        {
+                status = pthread_create (&cb->thread, /* attr = */ NULL,
+                                wh_sender_thread, cb);
+                if (status != 0)
+                {
+                        char errbuf[1024];
+                        ERROR ("write_http plugin: pthread_create failed: %s",
+                                        sstrerror (status, errbuf, sizeof (errbuf)));
+                        sfree (data);
+                        return (-1);
+                }
+                cb->thread_running = 1;
+        }
+
+        b = malloc (sizeof (*b));
+        if (b == NULL)
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                sfree (data);
+                return (-1);
+        }
+        b->next = NULL;
+        b->size = size;
+        b->data = data;
+        mem_account_add (wh_mem, (int64_t) (sizeof (*b) + size));
+
+        if (cb->queue_len >= cb->queue_limit)
+        {
+                c_complain (LOG_WARNING, &cb->queue_complaint,
+                                "write_http plugin: The send queue for %s is "
+                                "full. Dropping the oldest data.",
+                                cb->location);
+                while (cb->queue_len >= cb->queue_limit)
+                {
+                        wh_block_t *old = cb->queue_head;
+
+                        cb->queue_head = old->next;
+                        if (cb->queue_head == NULL)
+                                cb->queue_tail = NULL;
+                        cb->queue_len--;
+                        wh_block_free (old);
+                }
+        }
+        else
+        {
+                c_release (LOG_INFO, &cb->queue_complaint,
+                                "write_http plugin: The send queue for %s is "
+                                "no longer full.", cb->location);
+        }
+
+        if (cb->queue_tail == NULL)
+                cb->queue_head = b;
+        else
+                cb->queue_tail->next = b;
+        cb->queue_tail = b;
+        cb->queue_len++;
+
+        pthread_cond_signal (&cb->queue_cond);
+
+        return (0);
+} /* }}} int wh_enqueue_nolock */
+
+/* Posts `size' bytes at `data' using the callback's handle.
+ * NOTE: You must hold cb->send_lock when calling this function! */
+static int wh_post_nolock (wh_callback_t *cb, /* {{{ */
+                const char *data, size_t size)
+{
+        const char *body;
+        size_t body_size;
+        char *body_alloc = NULL;
         int status = 0;
 
-        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, cb->send_buffer);
+        status = wh_prepare_body (cb, data, size,
+                        &body, &body_size, &body_alloc);
+        if (status != 0)
+                return (status);
+
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDSIZE, (long) body_size);
+        curl_easy_setopt (cb->curl, CURLOPT_POSTFIELDS, body);
         status = curl_easy_perform (cb->curl);
         if (status != 0)
         {
@@ -94,9 +538,86 @@ static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
                                 "status %i: %s",
                                 status, cb->curl_errbuf);
         }
+
+        sfree (body_alloc);
         return (status);
+} /* }}} int wh_post_nolock */
+
+/* NOTE: You must hold cb->send_lock when calling this function! */
+static int wh_send_buffer (wh_callback_t *cb) /* {{{ */
+{
+        char *data;
+
+        if (cb->queue_limit == 0)
+                return (wh_post_nolock (cb, cb->send_buffer,
+                                        cb->send_buffer_fill));
+
+        data = malloc (cb->send_buffer_fill);
+        if (data == NULL)
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                return (-1);
+        }
+        memcpy (data, cb->send_buffer, cb->send_buffer_fill);
+
+        return (wh_enqueue_nolock (cb, data, cb->send_buffer_fill));
 } /* }}} wh_send_buffer */
 
+static void wh_sender_free (wh_callback_t *cb) /* {{{ */
+{
+        int i;
+
+        if (cb->requests != NULL)
+        {
+                for (i = 0; i < cb->requests_num; i++)
+                {
+                        wh_request_reset (cb->requests + i);
+                        if (cb->requests[i].curl != NULL)
+                                curl_easy_cleanup (cb->requests[i].curl);
+                }
+                sfree (cb->requests);
+        }
+
+        if (cb->multi != NULL)
+                curl_multi_cleanup (cb->multi);
+        cb->multi = NULL;
+} /* }}} void wh_sender_free */
+
+/* Creates the sender thread's handles. They are copies of `cb->curl' and are
+ * added to one multi handle, which keeps their connections open. */
+static int wh_sender_init (wh_callback_t *cb) /* {{{ */
+{
+        int i;
+
+        cb->multi = curl_multi_init ();
+        cb->requests = calloc (cb->requests_num, sizeof (*cb->requests));
+        if ((cb->multi == NULL) || (cb->requests == NULL))
+        {
+                ERROR ("write_http plugin: Allocating the sender thread's "
+                                "handles failed.");
+                wh_sender_free (cb);
+                return (-1);
+        }
+
+        for (i = 0; i < cb->requests_num; i++)
+        {
+                wh_request_t *req = cb->requests + i;
+
+                req->curl = curl_easy_duphandle (cb->curl);
+                if (req->curl == NULL)
+                {
+                        ERROR ("write_http plugin: curl_easy_duphandle failed.");
+                        wh_sender_free (cb);
+                        return (-1);
+                }
+                curl_easy_setopt (req->curl, CURLOPT_ERRORBUFFER,
+                                req->curl_errbuf);
+                curl_easy_setopt (req->curl, CURLOPT_PRIVATE, (char *) req);
+        }
+
+        return (0);
+} /* }}} int wh_sender_init */
+
 static int wh_callback_init (wh_callback_t *cb) /* {{{ */
 {
         struct curl_slist *headers;
@@ -121,7 +642,12 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
         else
                 headers = curl_slist_append (headers, "Content-Type: text/plain");
         headers = curl_slist_append (headers, "Expect:");
+        if (cb->compression == WH_COMPRESSION_GZIP)
+                headers = curl_slist_append (headers, "Content-Encoding: gzip");
+        else if (cb->compression == WH_COMPRESSION_DEFLATE)
+                headers = curl_slist_append (headers, "Content-Encoding: deflate");
         curl_easy_setopt (cb->curl, CURLOPT_HTTPHEADER, headers);
+        cb->headers = headers;
 
         curl_easy_setopt (cb->curl, CURLOPT_ERRORBUFFER, cb->curl_errbuf);
         curl_easy_setopt (cb->curl, CURLOPT_URL, cb->location);
@@ -153,6 +679,16 @@ static int wh_callback_init (wh_callback_t *cb) /* {{{ */
         if (cb->cacert != NULL)
                 curl_easy_setopt (cb->curl, CURLOPT_CAINFO, cb->cacert);
 
+        if ((cb->queue_limit > 0) && (wh_sender_init (cb) != 0))
+        {
+                curl_easy_cleanup (cb->curl);
+                cb->curl = NULL;
+                curl_slist_free_all (cb->headers);
+                cb->headers = NULL;
+                sfree (cb->credentials);
+                return (-1);
+        }
+
         wh_reset_buffer (cb);
 
         return (0);
@@ -261,9 +797,38 @@ static void wh_callback_free (void *data) /* {{{ */
 
         cb = data;
 
-        wh_flush_nolock (/* timeout = */ 0, cb);
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (cb->curl != NULL)
+                wh_flush_nolock (/* timeout = */ 0, cb);
+
+        /* The sender thread posts what's left in the queue before exiting. */
+        if (cb->thread_running)
+        {
+                cb->thread_shutdown = 1;
+                pthread_cond_signal (&cb->queue_cond);
+                pthread_mutex_unlock (&cb->send_lock);
+                pthread_join (cb->thread, /* retval = */ NULL);
+                pthread_mutex_lock (&cb->send_lock);
+                cb->thread_running = 0;
+        }
+        wh_queue_free_nolock (cb);
+
+        pthread_mutex_unlock (&cb->send_lock);
+
+        wh_sender_free (cb);
+
+#if HAVE_LIBZ
+        if (cb->zstream_init)
+                deflateEnd (&cb->zstream);
+#endif
+
+        if (cb->curl != NULL)
+                curl_easy_cleanup (cb->curl);
+        curl_slist_free_all (cb->headers);
+        pthread_cond_destroy (&cb->queue_cond);
+        pthread_mutex_destroy (&cb->send_lock);
 
-        curl_easy_cleanup (cb->curl);
         sfree (cb->location);
         sfree (cb->user);
         sfree (cb->pass);
@@ -273,12 +838,15 @@ static void wh_callback_free (void *data) /* {{{ */
         sfree (cb);
 } /* }}} void wh_callback_free */
 
-static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{{ */
-                wh_callback_t *cb)
+/* Formats `vl' as a PUTVAL command, including the trailing newline. */
+static int wh_format_command (const data_set_t *ds, /* {{{ */
+                const value_list_t *vl, wh_callback_t *cb,
+                char *command, size_t command_size, size_t *ret_len)
 {
+        vl_identifier_t ident_buf;
+        const vl_identifier_t *ident;
         char key[10*DATA_MAX_NAME_LEN];
         char values[512];
-        char command[1024];
         size_t command_len;
 
         int status;
@@ -290,11 +858,12 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
         }
 
         /* Copy the identifier to `key' and escape it. */
-        status = FORMAT_VL (key, sizeof (key), vl);
-        if (status != 0) {
+        ident = plugin_value_list_identifier (vl, &ident_buf);
+        if (ident == NULL) {
                 ERROR ("write_http plugin: error with format_name");
-                return (status);
+                return (-1);
         }
+        sstrncpy (key, ident->name, sizeof (key));
         escape_string (key, sizeof (key));
 
         /* Convert the values to an ASCII representation and put that into
@@ -306,17 +875,34 @@ static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{
                 return (status);
         }
 
-        command_len = (size_t) ssnprintf (command, sizeof (command),
+        command_len = (size_t) ssnprintf (command, command_size,
                         "PUTVAL %s interval=%.3f %s\r\n",
                         key,
                         CDTIME_T_TO_DOUBLE (vl->interval),
                         values);
-        if (command_len >= sizeof (command)) {
+        if (command_len >= command_size) {
                 ERROR ("write_http plugin: Command buffer too small: "
                                 "Need %zu bytes.", command_len + 1);
                 return (-1);
         }
 
+        *ret_len = command_len;
+        return (0);
+} /* }}} int wh_format_command */
+
+static int wh_write_command (const data_set_t *ds, const value_list_t *vl, /* {{{ */
+                wh_callback_t *cb)
+{
+        char command[1024];
+        size_t command_len;
+
+        int status;
+
+        status = wh_format_command (ds, vl, cb,
+                        command, sizeof (command), &command_len);
+        if (status != 0)
+                return (status);
+
         pthread_mutex_lock (&cb->send_lock);
 
         if (cb->curl == NULL)
@@ -433,6 +1019,138 @@ static int wh_write (const data_set_t *ds, const value_list_t *vl, /* {{{ */
         return (status);
 } /* }}} int wh_write */
 
+/* Doubles the size of a batch's body. */
+static int wh_batch_grow (char **buffer, /* {{{ */
+                size_t *buffer_size, size_t *buffer_free)
+{
+        char *tmp;
+
+        tmp = realloc (*buffer, 2 * (*buffer_size));
+        if (tmp == NULL)
+        {
+                ERROR ("write_http plugin: realloc failed.");
+                return (-1);
+        }
+
+        *buffer = tmp;
+        *buffer_free += *buffer_size;
+        *buffer_size *= 2;
+
+        return (0);
+} /* }}} int wh_batch_grow */
+
+/* Formats all value lists of a batch into one body and posts it with a
+ * single request. */
+static int wh_write_batch (const data_set_t **ds, /* {{{ */
+                const value_list_t **vl, size_t num,
+                user_data_t *user_data)
+{
+        wh_callback_t *cb;
+        char *buffer;
+        size_t buffer_size = WH_SEND_BUFFER_SIZE;
+        size_t buffer_fill = 0;
+        size_t buffer_free = WH_SEND_BUFFER_SIZE;
+        size_t i;
+        int status;
+
+        if (user_data == NULL)
+                return (-EINVAL);
+
+        cb = user_data->data;
+
+        buffer = malloc (buffer_size);
+        if (buffer == NULL)
+        {
+                ERROR ("write_http plugin: malloc failed.");
+                return (-1);
+        }
+        buffer[0] = 0;
+
+        if (cb->format == WH_FORMAT_JSON)
+                format_json_initialize (buffer, &buffer_fill, &buffer_free);
+
+        for (i = 0; i < num; i++)
+        {
+                if (cb->format == WH_FORMAT_JSON)
+                {
+                        status = format_json_value_list (buffer,
+                                        &buffer_fill, &buffer_free,
+                                        ds[i], vl[i], cb->store_rates);
+                        while ((status == (-ENOMEM))
+                                        && (buffer_size < (1024 * WH_SEND_BUFFER_SIZE))
+                                        && (wh_batch_grow (&buffer, &buffer_size,
+                                                        &buffer_free) == 0))
+                        {
+                                status = format_json_value_list (buffer,
+                                                &buffer_fill, &buffer_free,
+                                                ds[i], vl[i], cb->store_rates);
+                        }
+                }
+                else
+                {
+                        char command[1024];
+                        size_t command_len;
+
+                        status = wh_format_command (ds[i], vl[i], cb,
+                                        command, sizeof (command), &command_len);
+                        while ((status == 0) && (command_len >= buffer_free))
+                        {
+                                status = wh_batch_grow (&buffer, &buffer_size,
+                                                &buffer_free);
+                        }
+                        if (status == 0)
+                        {
+                                memcpy (buffer + buffer_fill, command,
+                                                command_len + 1);
+                                buffer_fill += command_len;
+                                buffer_free -= command_len;
+                        }
+                }
+
+                if (status != 0)
+                        WARNING ("write_http plugin: Formatting a value list "
+                                        "failed with status %i. Skipping it.",
+                                        status);
+        }
+
+        if ((cb->format == WH_FORMAT_JSON) && (buffer_fill > 0))
+                format_json_finalize (buffer, &buffer_fill, &buffer_free);
+
+        if (buffer_fill == 0)
+        {
+                sfree (buffer);
+                return (0);
+        }
+
+        pthread_mutex_lock (&cb->send_lock);
+
+        if (cb->curl == NULL)
+        {
+                status = wh_callback_init (cb);
+                if (status != 0)
+                {
+                        ERROR ("write_http plugin: wh_callback_init failed.");
+                        pthread_mutex_unlock (&cb->send_lock);
+                        sfree (buffer);
+                        return (-1);
+                }
+        }
+
+        if (cb->queue_limit > 0)
+        {
+                status = wh_enqueue_nolock (cb, buffer, buffer_fill);
+        }
+        else
+        {
+                status = wh_post_nolock (cb, buffer, buffer_fill);
+                sfree (buffer);
+        }
+
+        pthread_mutex_unlock (&cb->send_lock);
+
+        return (status);
+} /* }}} int wh_write_batch */
+
 static int config_set_string (char **ret_string, /* {{{ */
                 oconfig_item_t *ci)
 {
@@ -502,10 +1220,52 @@ static int config_set_format (wh_callback_t *cb, /* {{{ */
         return (0);
 } /* }}} int config_set_string */
 
+static int config_set_compression (wh_callback_t *cb, /* {{{ */
+                oconfig_item_t *ci)
+{
+        char *string;
+
+        if ((ci->values_num != 1)
+                        || (ci->values[0].type != OCONFIG_TYPE_STRING))
+        {
+                WARNING ("write_http plugin: The `%s' config option "
+                                "needs exactly one string argument.", ci->key);
+                return (-1);
+        }
+
+        string = ci->values[0].value.string;
+        if (strcasecmp ("None", string) == 0)
+        {
+                cb->compression = WH_COMPRESSION_NONE;
+                return (0);
+        }
+
+#if HAVE_LIBZ
+        if (strcasecmp ("GZip", string) == 0)
+                cb->compression = WH_COMPRESSION_GZIP;
+        else if (strcasecmp ("Deflate", string) == 0)
+                cb->compression = WH_COMPRESSION_DEFLATE;
+        else
+        {
+                ERROR ("write_http plugin: Invalid compression: %s",
+                                string);
+                return (-1);
+        }
+#else
+        ERROR ("write_http plugin: Compression is not available, because "
+                        "the plugin has been compiled without zlib support.");
+        return (-1);
+#endif
+
+        return (0);
+} /* }}} int config_set_compression */
+
 static int wh_config_url (oconfig_item_t *ci) /* {{{ */
 {
         wh_callback_t *cb;
         user_data_t user_data;
+        int batch_size = 0;
+        cdtime_t batch_timeout = 0;
         int i;
 
         cb = malloc (sizeof (*cb));
@@ -523,9 +1283,13 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
         cb->verify_host = 1;
         cb->cacert = NULL;
         cb->format = WH_FORMAT_COMMAND;
+        cb->compression = WH_COMPRESSION_NONE;
         cb->curl = NULL;
+        cb->requests_num = 1;
+        C_COMPLAIN_INIT (&cb->queue_complaint);
 
         pthread_mutex_init (&cb->send_lock, /* attr = */ NULL);
+        pthread_cond_init (&cb->queue_cond, /* attr = */ NULL);
 
         config_set_string (&cb->location, ci);
         if (cb->location == NULL)
@@ -549,6 +1313,16 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                         config_set_format (cb, child);
                 else if (strcasecmp ("StoreRates", child->key) == 0)
                         config_set_boolean (&cb->store_rates, child);
+                else if (strcasecmp ("Compression", child->key) == 0)
+                        config_set_compression (cb, child);
+                else if (strcasecmp ("SendQueueLimit", child->key) == 0)
+                        cf_util_get_int (child, &cb->queue_limit);
+                else if (strcasecmp ("MaxConcurrentRequests", child->key) == 0)
+                        cf_util_get_int (child, &cb->requests_num);
+                else if (strcasecmp ("BatchSize", child->key) == 0)
+                        cf_util_get_int (child, &batch_size);
+                else if (strcasecmp ("BatchTimeout", child->key) == 0)
+                        cf_util_get_cdtime (child, &batch_timeout);
                 else
                 {
                         ERROR ("write_http plugin: Invalid configuration "
@@ -556,6 +1330,15 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
                 }
         }
 
+        if (cb->queue_limit < 0)
+                cb->queue_limit = 0;
+        if (cb->requests_num < 1)
+        {
+                WARNING ("write_http plugin: MaxConcurrentRequests must be "
+                                "at least 1.");
+                cb->requests_num = 1;
+        }
+
         DEBUG ("write_http: Registering write callback with URL %s",
                         cb->location);
 
@@ -565,7 +1348,12 @@ static int wh_config_url (oconfig_item_t *ci) /* {{{ */
         plugin_register_flush ("write_http", wh_flush, &user_data);
 
         user_data.free_func = wh_callback_free;
-        plugin_register_write ("write_http", wh_write, &user_data);
+        if (batch_size > 0)
+                plugin_register_write_batch ("write_http", wh_write_batch,
+                                (size_t) batch_size, batch_timeout,
+                                &user_data);
+        else
+                plugin_register_write ("write_http", wh_write, &user_data);
 
         return (0);
 } /* }}} int wh_config_url */
@@ -592,6 +1380,7 @@ static int wh_config (oconfig_item_t *ci) /* {{{ */
 
 void module_register (void) /* {{{ */
 {
+        wh_mem = mem_account_get ("write_http");
         plugin_register_complex_config ("write_http", wh_config);
 } /* }}} void module_register */
 
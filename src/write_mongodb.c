@@ -42,6 +42,13 @@
 #endif
 #include <mongo.h>
 
+struct wm_doc_s
+{
+  char collection[DATA_MAX_NAME_LEN + 16];
+  bson record;
+};
+typedef struct wm_doc_s wm_doc_t;
+
 struct wm_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -52,6 +59,21 @@ struct wm_node_s
 
   int connected;
 
+  /* Batching: The daemon collects `store_batch_size' value lists, see
+   * plugin_register_write_batch(). Their records are put into the
+   * preallocated `batch' array and inserted with one batch insert per
+   * collection. */
+  int store_batch_size;
+  cdtime_t store_batch_timeout;
+  wm_doc_t *batch;
+  const bson **batch_ptrs;
+  int batch_num;
+
+  /* Statistics, reported by wm_read. */
+  derive_t batches_sent;
+  cdtime_t batch_latency;
+  int batch_latency_num;
+
   mongo conn[1];
   pthread_mutex_t lock;
 };
@@ -60,56 +82,176 @@ typedef struct wm_node_s wm_node_t;
 /*
  * Functions
  */
-static int wm_write (const data_set_t *ds, /* {{{ */
-    const value_list_t *vl,
-    user_data_t *ud)
+static void wm_create_bson (bson *record, /* {{{ */
+    const data_set_t *ds, const value_list_t *vl)
 {
-  wm_node_t *node = ud->data;
-  char collection_name[512];
-  int status;
   int i;
-  bson record;
-
-  ssnprintf(collection_name, sizeof (collection_name), "collectd.%s", vl->plugin);
 
-  bson_init(&record);
-  bson_append_time_t(&record,"ts",CDTIME_T_TO_TIME_T(vl->time));
-  bson_append_string(&record,"h",vl->host);
-  bson_append_string(&record,"i",vl->plugin_instance);
-  bson_append_string(&record,"t",vl->type);
-  bson_append_string(&record,"ti",vl->type_instance);
+  bson_init(record);
+  bson_append_time_t(record,"ts",CDTIME_T_TO_TIME_T(vl->time));
+  bson_append_string(record,"h",vl->host);
+  bson_append_string(record,"i",vl->plugin_instance);
+  bson_append_string(record,"t",vl->type);
+  bson_append_string(record,"ti",vl->type_instance);
 
   for (i = 0; i < ds->ds_num; i++)
   {
     if (ds->ds[i].type == DS_TYPE_COUNTER)
-      bson_append_long(&record, ds->ds[i].name, vl->values[i].counter);
+      bson_append_long(record, ds->ds[i].name, vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_GAUGE)
-      bson_append_double(&record, ds->ds[i].name, vl->values[i].gauge);
+      bson_append_double(record, ds->ds[i].name, vl->values[i].gauge);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      bson_append_long(&record, ds->ds[i].name, vl->values[i].derive);
+      bson_append_long(record, ds->ds[i].name, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      bson_append_long(&record, ds->ds[i].name, vl->values[i].absolute);
+      bson_append_long(record, ds->ds[i].name, vl->values[i].absolute);
     else
       assert (23 == 42);
   }
   /* We must finish the record, other wise the insert will fail */
-  bson_finish(&record);
+  bson_finish(record);
+} /* }}} void wm_create_bson */
 
-  pthread_mutex_lock (&node->lock);
+/* You must hold `node->lock' when calling this function. */
+static int wm_connect (wm_node_t *node) /* {{{ */
+{
+  int status;
 
-  if (node->connected == 0)
+  if (node->connected != 0)
+    return (0);
+
+  status = mongo_connect(node->conn, node->host, node->port);
+  if (status != MONGO_OK) {
+    ERROR ("write_mongodb plugin: Connecting to host \"%s\" (port %i) failed.",
+        (node->host != NULL) ? node->host : "localhost",
+        (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
+    mongo_destroy(node->conn);
+    return (-1);
+  }
+
+  node->connected = 1;
+  return (0);
+} /* }}} int wm_connect */
+
+/* Inserts all records in the batch, using one batch insert per collection.
+ * The records are freed afterwards, even if inserting them failed. You must
+ * hold `node->lock' when calling this function. */
+static int wm_batch_flush (wm_node_t *node) /* {{{ */
+{
+  char collection_name[sizeof (node->batch[0].collection)];
+  cdtime_t start;
+  int status;
+  int ret = 0;
+  int i;
+  int j;
+
+  if (node->batch_num == 0)
+    return (0);
+
+  if (wm_connect (node) != 0)
   {
-    status = mongo_connect(node->conn, node->host, node->port);
-    if (status != MONGO_OK) {
-      ERROR ("write_mongodb plugin: Connecting to host \"%s\" (port %i) failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : MONGO_DEFAULT_PORT);
-      mongo_destroy(node->conn);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    } else {
-      node->connected = 1;
+    ERROR ("write_mongodb plugin: Dropping %i records.", node->batch_num);
+    ret = -1;
+  }
+
+  start = cdtime ();
+  for (i = 0; (ret == 0) && (i < node->batch_num); i++)
+  {
+    int ptrs_num = 0;
+
+    /* Records of collections which have already been inserted have their
+     * collection name cleared. */
+    if (node->batch[i].collection[0] == 0)
+      continue;
+
+    sstrncpy (collection_name, node->batch[i].collection,
+        sizeof (collection_name));
+    for (j = i; j < node->batch_num; j++)
+    {
+      if (strcmp (collection_name, node->batch[j].collection) != 0)
+        continue;
+      node->batch_ptrs[ptrs_num] = &node->batch[j].record;
+      ptrs_num++;
+      node->batch[j].collection[0] = 0;
+    }
+
+    DEBUG ("write_mongodb plugin: inserting %i records into %s",
+        ptrs_num, collection_name);
+
+    status = mongo_insert_batch (node->conn, collection_name,
+        node->batch_ptrs, ptrs_num);
+    if (status != MONGO_OK)
+    {
+      ERROR ("write_mongodb plugin: error inserting %i records: %d",
+          ptrs_num, node->conn->err);
+      if (node->conn->err == MONGO_BSON_INVALID)
+        ERROR ("write_mongodb plugin: %s", node->conn->errstr);
+      ret = -1;
     }
+    else
+      node->batches_sent++;
+  }
+
+  if (ret == 0)
+  {
+    node->batch_latency += cdtime () - start;
+    node->batch_latency_num++;
+  }
+
+  for (i = 0; i < node->batch_num; i++)
+    bson_destroy (&node->batch[i].record);
+  node->batch_num = 0;
+
+  return (ret);
+} /* }}} int wm_batch_flush */
+
+/* Batch write callback: the daemon collects up to `store_batch_size' value
+ * lists, which are inserted with one batch insert per collection. */
+static int wm_write_batch (const data_set_t **ds, /* {{{ */
+    const value_list_t **vl, size_t num, user_data_t *ud)
+{
+  wm_node_t *node = ud->data;
+  size_t i;
+  int status;
+
+  pthread_mutex_lock (&node->lock);
+
+  for (i = 0; (i < num) && (node->batch_num < node->store_batch_size); i++)
+  {
+    wm_doc_t *doc = node->batch + node->batch_num;
+
+    ssnprintf (doc->collection, sizeof (doc->collection),
+        "collectd.%s", vl[i]->plugin);
+    wm_create_bson (&doc->record, ds[i], vl[i]);
+    node->batch_num++;
+  }
+
+  status = wm_batch_flush (node);
+
+  pthread_mutex_unlock (&node->lock);
+
+  return (status);
+} /* }}} int wm_write_batch */
+
+static int wm_write (const data_set_t *ds, /* {{{ */
+    const value_list_t *vl,
+    user_data_t *ud)
+{
+  wm_node_t *node = ud->data;
+  char collection_name[512];
+  int status;
+  bson record;
+
+  ssnprintf(collection_name, sizeof (collection_name), "collectd.%s", vl->plugin);
+
+  wm_create_bson (&record, ds, vl);
+
+  pthread_mutex_lock (&node->lock);
+
+  if (wm_connect (node) != 0)
+  {
+    pthread_mutex_unlock (&node->lock);
+    bson_destroy(&record);
+    return (-1);
   }
 
   /* Assert if the connection has been established */
@@ -136,6 +278,49 @@ static int wm_write (const data_set_t *ds, /* {{{ */
   return (0);
 } /* }}} int wm_write */
 
+static void wm_submit (const wm_node_t *node, const char *type, /* {{{ */
+    const char *type_instance, value_t value)
+{
+  value_list_t vl = VALUE_LIST_INIT;
+
+  vl.values = &value;
+  vl.values_len = 1;
+  sstrncpy (vl.host, hostname_g, sizeof (vl.host));
+  sstrncpy (vl.plugin, "write_mongodb", sizeof (vl.plugin));
+  sstrncpy (vl.plugin_instance, node->name, sizeof (vl.plugin_instance));
+  sstrncpy (vl.type, type, sizeof (vl.type));
+  sstrncpy (vl.type_instance, type_instance, sizeof (vl.type_instance));
+
+  plugin_dispatch_values (&vl);
+} /* }}} void wm_submit */
+
+/* Reports the batch statistics. */
+static int wm_read (user_data_t *ud) /* {{{ */
+{
+  wm_node_t *node = ud->data;
+  value_t batches;
+  value_t latency;
+
+  pthread_mutex_lock (&node->lock);
+
+  batches.derive = node->batches_sent;
+  if (node->batch_latency_num > 0)
+    latency.gauge = CDTIME_T_TO_DOUBLE (node->batch_latency)
+      / ((gauge_t) node->batch_latency_num);
+  else
+    latency.gauge = NAN;
+  node->batch_latency = 0;
+  node->batch_latency_num = 0;
+
+  pthread_mutex_unlock (&node->lock);
+
+  /* Dispatch without holding the lock: The values may end up in wm_write. */
+  wm_submit (node, "total_operations", "batches", batches);
+  wm_submit (node, "latency", "batch", latency);
+
+  return (0);
+} /* }}} int wm_read */
+
 static void wm_config_free (void *ptr) /* {{{ */
 {
   wm_node_t *node = ptr;
@@ -143,6 +328,9 @@ static void wm_config_free (void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
+  sfree (node->batch);
+  sfree (node->batch_ptrs);
+
   if (node->connected != 0)
   {
     mongo_destroy(node->conn);
@@ -194,6 +382,10 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
     }
     else if (strcasecmp ("Timeout", child->key) == 0)
       status = cf_util_get_int (child, &node->timeout);
+    else if (strcasecmp ("StoreBatchSize", child->key) == 0)
+      status = cf_util_get_int (child, &node->store_batch_size);
+    else if (strcasecmp ("StoreBatchTimeout", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->store_batch_timeout);
     else
       WARNING ("write_mongodb plugin: Ignoring unknown config option \"%s\".",
           child->key);
@@ -202,6 +394,20 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
       break;
   } /* for (i = 0; i < ci->children_num; i++) */
 
+  /* A batch size of one is the same as not batching at all. */
+  if ((status == 0) && (node->store_batch_size > 1))
+  {
+    node->batch = calloc ((size_t) node->store_batch_size,
+        sizeof (*node->batch));
+    node->batch_ptrs = calloc ((size_t) node->store_batch_size,
+        sizeof (*node->batch_ptrs));
+    if ((node->batch == NULL) || (node->batch_ptrs == NULL))
+    {
+      ERROR ("write_mongodb plugin: calloc failed.");
+      status = ENOMEM;
+    }
+  }
+
   if (status == 0)
   {
     char cb_name[DATA_MAX_NAME_LEN];
@@ -212,8 +418,20 @@ static int wm_config_node (oconfig_item_t *ci) /* {{{ */
     ud.data = node;
     ud.free_func = wm_config_free;
 
-    status = plugin_register_write (cb_name, wm_write, &ud);
+    if (node->batch != NULL)
+      status = plugin_register_write_batch (cb_name, wm_write_batch,
+          (size_t) node->store_batch_size, node->store_batch_timeout, &ud);
+    else
+      status = plugin_register_write (cb_name, wm_write, &ud);
     INFO ("write_mongodb plugin: registered write plugin %s %d",cb_name,status);
+
+    /* The write callback owns `node'; see wm_config_free. */
+    if ((status == 0) && (node->batch != NULL))
+    {
+      ud.free_func = NULL;
+      plugin_register_complex_read (/* group = */ NULL, cb_name, wm_read,
+          /* interval = */ NULL, &ud);
+    }
   }
 
   if (status != 0)
@@ -28,10 +28,25 @@
 #include "plugin.h"
 #include "common.h"
 #include "configfile.h"
+#include "utils_avltree.h"
+#include "utils_complain.h"
 
 #include <pthread.h>
 #include <credis.h>
 
+#define WR_IDENT_PREFIX "collectd/"
+
+/* A value waiting to be sent by the node's thread. */
+struct wr_cmd_s;
+typedef struct wr_cmd_s wr_cmd_t;
+struct wr_cmd_s
+{
+  char *key;
+  double score;
+  char *value;
+  wr_cmd_t *next;
+};
+
 struct wr_node_s
 {
   char name[DATA_MAX_NAME_LEN];
@@ -42,18 +57,280 @@ struct wr_node_s
 
   REDIS conn;
   pthread_mutex_t lock;
+
+  /* Identifiers which have been added to the "collectd/values" set since
+   * the connection was established. */
+  c_avl_tree_t *seen;
+
+  /* Queue of values sent by `thread', if `max_delay' is greater than
+   * zero. */
+  cdtime_t max_delay;
+  int batch_size;
+  wr_cmd_t *queue_head;
+  wr_cmd_t *queue_tail;
+  int queue_len;
+  cdtime_t queue_first;
+  c_complain_t queue_complaint;
+  pthread_cond_t cond;
+  pthread_t thread;
+  int thread_running;
+  int thread_loop;
 };
 typedef struct wr_node_s wr_node_t;
 
 /*
  * Functions
  */
+static void wr_seen_clear (wr_node_t *node) /* {{{ */
+{
+  void *key;
+  void *value;
+
+  if (node->seen == NULL)
+    return;
+
+  while (c_avl_pick (node->seen, &key, &value) == 0)
+    sfree (key);
+} /* }}} void wr_seen_clear */
+
+static void wr_disconnect (wr_node_t *node) /* {{{ */
+{
+  if (node->conn != NULL)
+  {
+    credis_close (node->conn);
+    node->conn = NULL;
+  }
+
+  /* The identifiers may have to be added again. */
+  wr_seen_clear (node);
+} /* }}} void wr_disconnect */
+
+/* Sends one value to the Redis server, connecting first if necessary. The
+ * identifier (`key' without the "collectd/" prefix) is added to the
+ * "collectd/values" set only if it hasn't been added before. Whoever calls
+ * this function must have exclusive access to `node->conn'. */
+static int wr_send (wr_node_t *node, const char *key, /* {{{ */
+    double score, const char *value)
+{
+  const char *ident = key + strlen (WR_IDENT_PREFIX);
+  int status;
+
+  if (node->conn == NULL)
+  {
+    node->conn = credis_connect (node->host, node->port, node->timeout);
+    if (node->conn == NULL)
+    {
+      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed.",
+          (node->host != NULL) ? node->host : "localhost",
+          (node->port != 0) ? node->port : 6379);
+      return (-1);
+    }
+  }
+
+  /* "credis_zadd" doesn't handle a NULL pointer gracefully, so I'd rather
+   * have a meaningful assertion message than a normal segmentation fault. */
+  assert (node->conn != NULL);
+
+  /* Zero means the element was added, -1 that its score was updated. */
+  status = credis_zadd (node->conn, key, score, value);
+  if (status < -1)
+  {
+    ERROR ("write_redis plugin: credis_zadd (%s) failed with status %i.",
+        key, status);
+    wr_disconnect (node);
+    return (-1);
+  }
+
+  if ((node->seen != NULL) && (c_avl_get (node->seen, ident, NULL) == 0))
+    return (0);
+
+  status = credis_sadd (node->conn, WR_IDENT_PREFIX "values", ident);
+  if (status < -1)
+  {
+    ERROR ("write_redis plugin: credis_sadd (%s) failed with status %i.",
+        ident, status);
+    wr_disconnect (node);
+    return (-1);
+  }
+
+  if (node->seen != NULL)
+  {
+    char *ident_copy = strdup (ident);
+    if ((ident_copy != NULL)
+        && (c_avl_insert (node->seen, ident_copy, NULL) != 0))
+      sfree (ident_copy);
+  }
+
+  return (0);
+} /* }}} int wr_send */
+
+static void wr_cmd_free (wr_cmd_t *cmd) /* {{{ */
+{
+  while (cmd != NULL)
+  {
+    wr_cmd_t *next = cmd->next;
+
+    sfree (cmd->key);
+    sfree (cmd->value);
+    sfree (cmd);
+
+    cmd = next;
+  }
+} /* }}} void wr_cmd_free */
+
+/* Sends all values in `cmds' and frees the list. If the server cannot be
+ * reached, the remaining values are dropped. */
+static void wr_send_all (wr_node_t *node, wr_cmd_t *cmds) /* {{{ */
+{
+  wr_cmd_t *cmd;
+
+  for (cmd = cmds; cmd != NULL; cmd = cmd->next)
+  {
+    if (wr_send (node, cmd->key, cmd->score, cmd->value) == 0)
+      continue;
+
+    if (node->conn == NULL)
+    {
+      int num = 0;
+
+      for (; cmd != NULL; cmd = cmd->next)
+        num++;
+
+      ERROR ("write_redis plugin: Node \"%s\": Dropping %i value%s.",
+          node->name, num, (num == 1) ? "" : "s");
+      break;
+    }
+  }
+
+  wr_cmd_free (cmds);
+} /* }}} void wr_send_all */
+
+static void *wr_thread (void *arg) /* {{{ */
+{
+  wr_node_t *node = arg;
+
+  pthread_mutex_lock (&node->lock);
+  while (42)
+  {
+    wr_cmd_t *cmds;
+
+    if (node->queue_head == NULL)
+    {
+      if (!node->thread_loop)
+        break;
+
+      pthread_cond_wait (&node->cond, &node->lock);
+      continue;
+    }
+
+    /* Wait until the batch is full or the oldest value is due. */
+    if (node->thread_loop && (node->queue_len < node->batch_size)
+        && ((cdtime () - node->queue_first) < node->max_delay))
+    {
+      struct timespec ts;
+
+      CDTIME_T_TO_TIMESPEC (node->queue_first + node->max_delay, &ts);
+      pthread_cond_timedwait (&node->cond, &node->lock, &ts);
+      continue;
+    }
+
+    cmds = node->queue_head;
+    node->queue_head = NULL;
+    node->queue_tail = NULL;
+    node->queue_len = 0;
+    pthread_mutex_unlock (&node->lock);
+
+    /* Only this thread uses the connection, so the lock is not needed
+     * while talking to the server. */
+    wr_send_all (node, cmds);
+
+    pthread_mutex_lock (&node->lock);
+  }
+  pthread_mutex_unlock (&node->lock);
+
+  return ((void *) 0);
+} /* }}} void *wr_thread */
+
+/* Adds a value to the queue of `node', starting the node's thread if
+ * necessary. You must hold `node->lock' when calling this function. */
+static int wr_enqueue (wr_node_t *node, const char *key, /* {{{ */
+    double score, const char *value)
+{
+  wr_cmd_t *cmd;
+
+  if (!node->thread_running)
+  {
+    int status;
+
+    node->thread_loop = 1;
+    status = pthread_create (&node->thread, /* attr = */ NULL,
+        wr_thread, node);
+    if (status != 0)
+    {
+      char errbuf[1024];
+      node->thread_loop = 0;
+      ERROR ("write_redis plugin: pthread_create failed: %s",
+          sstrerror (status, errbuf, sizeof (errbuf)));
+      return (-1);
+    }
+    node->thread_running = 1;
+  }
+
+  /* Don't eat up all memory if the server can't keep up. */
+  if (node->queue_len >= (10 * node->batch_size))
+  {
+    c_complain (LOG_WARNING, &node->queue_complaint,
+        "write_redis plugin: Node \"%s\": The queue is full, "
+        "dropping values.", node->name);
+    return (-1);
+  }
+  c_release (LOG_INFO, &node->queue_complaint,
+      "write_redis plugin: Node \"%s\": The queue is no longer full.",
+      node->name);
+
+  cmd = malloc (sizeof (*cmd));
+  if (cmd == NULL)
+  {
+    ERROR ("write_redis plugin: malloc failed.");
+    return (-1);
+  }
+  memset (cmd, 0, sizeof (*cmd));
+
+  cmd->key = strdup (key);
+  cmd->score = score;
+  cmd->value = strdup (value);
+  if ((cmd->key == NULL) || (cmd->value == NULL))
+  {
+    ERROR ("write_redis plugin: strdup failed.");
+    wr_cmd_free (cmd);
+    return (-1);
+  }
+
+  if (node->queue_tail == NULL)
+  {
+    node->queue_head = cmd;
+    node->queue_first = cdtime ();
+  }
+  else
+  {
+    node->queue_tail->next = cmd;
+  }
+  node->queue_tail = cmd;
+  node->queue_len++;
+
+  if ((node->queue_len == 1) || (node->queue_len >= node->batch_size))
+    pthread_cond_signal (&node->cond);
+
+  return (0);
+} /* }}} int wr_enqueue */
+
 static int wr_write (const data_set_t *ds, /* {{{ */
     const value_list_t *vl,
     user_data_t *ud)
 {
   wr_node_t *node = ud->data;
-  char ident[512];
+  vl_identifier_t ident_buf;
+  const vl_identifier_t *ident;
   char key[512];
   char value[512];
   size_t value_size;
@@ -61,10 +338,10 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   int status;
   int i;
 
-  status = FORMAT_VL (ident, sizeof (ident), vl);
-  if (status != 0)
-    return (status);
-  ssnprintf (key, sizeof (key), "collectd/%s", ident);
+  ident = plugin_value_list_identifier (vl, &ident_buf);
+  if (ident == NULL)
+    return (-1);
+  ssnprintf (key, sizeof (key), WR_IDENT_PREFIX "%s", ident->name);
 
   memset (value, 0, sizeof (value));
   value_size = sizeof (value);
@@ -84,17 +361,17 @@ static int wr_write (const data_set_t *ds, /* {{{ */
   }                                                                  \
 } while (0)
 
-  APPEND ("%lu", (unsigned long) vl->time);
+  APPEND ("%lu", (unsigned long) CDTIME_T_TO_TIME_T (vl->time));
   for (i = 0; i < ds->ds_num; i++)
   {
     if (ds->ds[i].type == DS_TYPE_COUNTER)
-      APPEND ("%llu", vl->values[i].counter);
+      APPEND (":%llu", vl->values[i].counter);
     else if (ds->ds[i].type == DS_TYPE_GAUGE)
-      APPEND ("%g", vl->values[i].gauge);
+      APPEND (":%g", vl->values[i].gauge);
     else if (ds->ds[i].type == DS_TYPE_DERIVE)
-      APPEND ("%"PRIi64, vl->values[i].derive);
+      APPEND (":%"PRIi64, vl->values[i].derive);
     else if (ds->ds[i].type == DS_TYPE_ABSOLUTE)
-      APPEND ("%"PRIu64, vl->values[i].absolute);
+      APPEND (":%"PRIu64, vl->values[i].absolute);
     else
       assert (23 == 42);
   }
@@ -102,30 +379,13 @@ static int wr_write (const data_set_t *ds, /* {{{ */
 #undef APPEND
 
   pthread_mutex_lock (&node->lock);
-
-  if (node->conn == NULL)
-  {
-    node->conn = credis_connect (node->host, node->port, node->timeout);
-    if (node->conn == NULL)
-    {
-      ERROR ("write_redis plugin: Connecting to host \"%s\" (port %i) failed.",
-          (node->host != NULL) ? node->host : "localhost",
-          (node->port != 0) ? node->port : 6379);
-      pthread_mutex_unlock (&node->lock);
-      return (-1);
-    }
-  }
-
-  /* "credis_zadd" doesn't handle a NULL pointer gracefully, so I'd rather
-   * have a meaningful assertion message than a normal segmentation fault. */
-  assert (node->conn != NULL);
-  status = credis_zadd (node->conn, key, (double) vl->time, value);
-
-  credis_sadd (node->conn, "collectd/values", ident);
-
+  if (node->max_delay > 0)
+    status = wr_enqueue (node, key, CDTIME_T_TO_DOUBLE (vl->time), value);
+  else
+    status = wr_send (node, key, CDTIME_T_TO_DOUBLE (vl->time), value);
   pthread_mutex_unlock (&node->lock);
 
-  return (0);
+  return (status);
 } /* }}} int wr_write */
 
 static void wr_config_free (void *ptr) /* {{{ */
@@ -135,12 +395,25 @@ static void wr_config_free (void *ptr) /* {{{ */
   if (node == NULL)
     return;
 
-  if (node->conn != NULL)
+  /* The thread sends the remaining values before exiting. */
+  if (node->thread_running)
   {
-    credis_close (node->conn);
-    node->conn = NULL;
+    pthread_mutex_lock (&node->lock);
+    node->thread_loop = 0;
+    pthread_cond_signal (&node->cond);
+    pthread_mutex_unlock (&node->lock);
+
+    pthread_join (node->thread, /* retval = */ NULL);
+    node->thread_running = 0;
   }
+  wr_cmd_free (node->queue_head);
+
+  wr_disconnect (node);
+  if (node->seen != NULL)
+    c_avl_destroy (node->seen);
 
+  pthread_cond_destroy (&node->cond);
+  pthread_mutex_destroy (&node->lock);
   sfree (node->host);
   sfree (node);
 } /* }}} void wr_config_free */
@@ -159,12 +432,21 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
   node->port = 0;
   node->timeout = 1000;
   node->conn = NULL;
+  node->max_delay = 0;
+  node->batch_size = 1000;
+  C_COMPLAIN_INIT (&node->queue_complaint);
   pthread_mutex_init (&node->lock, /* attr = */ NULL);
+  pthread_cond_init (&node->cond, /* attr = */ NULL);
+
+  node->seen = c_avl_create ((int (*) (const void *, const void *)) strcmp);
+  if (node->seen == NULL)
+    WARNING ("write_redis plugin: c_avl_create failed. Identifiers will be "
+        "added to the \"collectd/values\" set with each value.");
 
   status = cf_util_get_string_buffer (ci, node->name, sizeof (node->name));
   if (status != 0)
   {
-    sfree (node);
+    wr_config_free (node);
     return (status);
   }
 
@@ -185,6 +467,17 @@ static int wr_config_node (oconfig_item_t *ci) /* {{{ */
     }
     else if (strcasecmp ("Timeout", child->key) == 0)
       status = cf_util_get_int (child, &node->timeout);
+    else if (strcasecmp ("MaxDelay", child->key) == 0)
+      status = cf_util_get_cdtime (child, &node->max_delay);
+    else if (strcasecmp ("BatchSize", child->key) == 0)
+    {
+      status = cf_util_get_int (child, &node->batch_size);
+      if ((status == 0) && (node->batch_size < 1))
+      {
+        ERROR ("write_redis plugin: BatchSize must be at least one.");
+        status = EINVAL;
+      }
+    }
     else
       WARNING ("write_redis plugin: Ignoring unknown config option \"%s\".",
           child->key);